@@ -0,0 +1,66 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+/*
+ * mjpg_microbench times the kernels of the hot paths one by one on a fixed
+ * corpus. The kernels of plugins are looked up in the plugins of the build
+ * tree, so they run as they were compiled for mjpg_streamer. Each group of
+ * kernels lives in a file of its own, their headers do not go together.
+ */
+
+/* one operation of a kernel, returns the bytes it processed or -1 on errors */
+typedef long (*bench_fn)(void *arg);
+
+typedef struct {
+    const char *name;
+    bench_fn run;
+    void *arg;
+} bench_kernel;
+
+#define MAX_BENCH_KERNELS 16
+
+/* the fixed input all kernels work on, built from a synthetic test picture */
+typedef struct {
+    int width, height;
+    int quality;                    // of the JPEGs
+    int threads;                    // for the sliced encoder, 1 for none
+    unsigned char *yuyv;            // the test picture
+    int yuyv_size;
+    unsigned char *jpeg;            // encoded by libjpeg, with huffman tables
+    int jpeg_size;
+    unsigned char *mjpeg;           // the same without, like UVC cameras send it
+    int mjpeg_size;
+} bench_corpus;
+
+void *bench_plugin(const char *name);
+
+/* microbench_uvc.c */
+int uvc_kernels(bench_corpus *c, bench_kernel *k);
+
+/* microbench_proxy.c */
+int proxy_kernels(bench_corpus *c, bench_kernel *k);
+
+/* microbench_http.c */
+int request_kernels(bench_corpus *c, bench_kernel *k);
+
+#endif
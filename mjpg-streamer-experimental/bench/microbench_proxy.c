@@ -0,0 +1,121 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "../plugins/input_http/mjpg-proxy.h"
+#include "microbench.h"
+
+/*
+ * the parser of input_http, which takes the pictures out of the multipart
+ * stream of another mjpg_streamer. The stream comes in pieces the size of a
+ * read of the plugin, once with the Content-Length of each part and once
+ * without, which makes the parser look for the boundary in the data.
+ */
+
+#define PROXY_READ_SIZE (64 * 1024)
+#define PROXY_BOUNDARY "boundarydonotcross"
+
+typedef struct {
+    struct extractor_state state;
+    char *part;             // one part of the stream, with the boundary in front
+    int part_size;
+    void (*init)(struct extractor_state *state);
+    void (*extract)(struct extractor_state *state, char *buffer, int length);
+} proxy_bench;
+
+static proxy_bench proxy[2];
+static int stopped = 0;     // should_stop of the parsers
+
+/******************************************************************************
+Description.: hand one part of the stream to the parser
+Input Value.: the proxy_bench
+Return Value: bytes of the part
+******************************************************************************/
+static long bench_extract(void *arg)
+{
+    proxy_bench *p = arg;
+    int i, n;
+
+    for(i = 0; i < p->part_size; i += n) {
+        n = (p->part_size - i < PROXY_READ_SIZE) ? p->part_size - i : PROXY_READ_SIZE;
+        p->extract(&p->state, p->part + i, n);
+    }
+    return p->state.broken ? -1 : p->part_size;
+}
+
+/******************************************************************************
+Description.: prepare a parser which had the response header already
+Input Value.: * p.....: the proxy_bench
+              * c.....: the corpus
+              * length: 1 to announce the Content-Length of the parts
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int proxy_setup(proxy_bench *p, bench_corpus *c, int length)
+{
+    static char response[] = "HTTP/1.0 200 OK\r\n"
+                             "Content-Type: multipart/x-mixed-replace;boundary=" PROXY_BOUNDARY "\r\n"
+                             "\r\n";
+    int head;
+
+    if((p->part = malloc(c->jpeg_size + 256)) == NULL)
+        return -1;
+    head = sprintf(p->part, "\r\n--" PROXY_BOUNDARY "\r\nContent-Type: image/jpeg\r\n");
+    if(length)
+        head += sprintf(p->part + head, "Content-Length: %d\r\n", c->jpeg_size);
+    head += sprintf(p->part + head, "X-Timestamp: 1700000000.000000\r\n\r\n");
+    memcpy(p->part + head, c->jpeg, c->jpeg_size);
+    p->part_size = head + c->jpeg_size;
+
+    memset(&p->state, 0, sizeof(p->state));
+    p->state.should_stop = &stopped;
+    p->init(&p->state);
+    p->extract(&p->state, response, strlen(response));
+    return p->state.body ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: add the kernels of input_http
+Input Value.: * c: the corpus
+              * k: gets the kernels
+Return Value: number of kernels, 0 if input_http is not there
+******************************************************************************/
+int proxy_kernels(bench_corpus *c, bench_kernel *k)
+{
+    void *handle;
+    int i, n = 0;
+
+    if((handle = bench_plugin("input_http.so")) == NULL)
+        return 0;
+
+    for(i = 0; i < 2; i++) {
+        proxy[i].init = dlsym(handle, "init_extractor_state");
+        proxy[i].extract = dlsym(handle, "extract_data");
+        if(proxy[i].init == NULL || proxy[i].extract == NULL || proxy_setup(&proxy[i], c, i == 0) < 0)
+            return n;
+
+        k[n].name = (i == 0) ? "extract_data" : "extract_data (no length)";
+        k[n].run = bench_extract;
+        k[n++].arg = &proxy[i];
+    }
+    return n;
+}
@@ -0,0 +1,157 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdlib.h>
+#include <dlfcn.h>
+
+#include "../plugins/input_uvc/v4l2uvc.h"
+#include "microbench.h"
+
+/*
+ * the kernels of input_uvc: compressing YUYV pictures of cameras without
+ * MJPEG with the JPEG backends of the core, and the copy of MJPEG pictures which adds the huffman tables that
+ * UVC cameras leave out
+ */
+
+typedef struct {
+    bench_corpus *c;
+    struct vdIn vd;
+    jpeg_picture picture;   // the YUYV test picture
+    jpeg_backend *libjpeg;
+    jpeg_backend *slices;   // NULL on one thread
+    unsigned char *out;
+    int out_size;
+    int header_size;        // of the MJPEG picture, up to its SOS marker
+    int (*is_huffman)(unsigned char *buf);
+    int (*memcpy_picture)(struct vdIn *vd, unsigned char *out, unsigned char *buf, int size);
+} uvc_bench;
+
+static uvc_bench uvc;
+
+/******************************************************************************
+Description.: compress the test picture like a YUYV camera
+Input Value.: the backend, uvc holds the picture
+Return Value: bytes of the picture, -1 on errors
+******************************************************************************/
+static long bench_encode(void *arg)
+{
+    if(jpeg_backend_encode(arg, &uvc.picture, uvc.c->quality, uvc.out, uvc.out_size) <= 0)
+        return -1;
+    return uvc.c->yuyv_size;
+}
+
+/******************************************************************************
+Description.: look for the huffman tables in a MJPEG picture lacking them,
+              which scans its header up to the SOS marker
+Input Value.: the uvc_bench
+Return Value: bytes of the header, -1 on errors
+******************************************************************************/
+static long bench_is_huffman(void *arg)
+{
+    uvc_bench *u = arg;
+
+    if(u->is_huffman(u->c->mjpeg) != 0)
+        return -1;
+    return u->header_size;
+}
+
+/******************************************************************************
+Description.: copy a MJPEG picture and add the huffman tables
+Input Value.: the uvc_bench
+Return Value: bytes of the picture, -1 on errors
+******************************************************************************/
+static long bench_memcpy_picture(void *arg)
+{
+    uvc_bench *u = arg;
+
+    if(u->memcpy_picture(&u->vd, u->out, u->c->mjpeg, u->c->mjpeg_size) <= u->c->mjpeg_size)
+        return -1;
+    return u->c->mjpeg_size;
+}
+
+/******************************************************************************
+Description.: add the kernels of input_uvc
+Input Value.: * c: the corpus
+              * k: gets the kernels
+Return Value: number of kernels, 0 if input_uvc is not there
+******************************************************************************/
+int uvc_kernels(bench_corpus *c, bench_kernel *k)
+{
+    jpeg_backend_options opts;
+    unsigned char *sos;
+    void *handle;
+    int n = 0;
+
+    if((handle = bench_plugin("input_uvc.so")) == NULL)
+        return 0;
+
+    uvc.c = c;
+    uvc.is_huffman = dlsym(handle, "is_huffman");
+    uvc.memcpy_picture = dlsym(handle, "memcpy_picture");
+    sos = memmem(c->mjpeg, c->mjpeg_size, "\xff\xda", 2);
+    uvc.header_size = (sos != NULL) ? sos - c->mjpeg : c->mjpeg_size;
+    uvc.out_size = c->yuyv_size + DHT_SPACE;
+    if((uvc.out = malloc(uvc.out_size)) == NULL)
+        return 0;
+
+    /* a camera delivering YUYV, or MJPEG without huffman tables */
+    memset(&uvc.vd, 0, sizeof(uvc.vd));
+    uvc.vd.width = c->width;
+    uvc.vd.height = c->height;
+    uvc.vd.formatIn = V4L2_PIX_FMT_YUYV;
+    uvc.vd.framebuffer = c->yuyv;
+    uvc.vd.huffman = 0;
+
+    memset(&uvc.picture, 0, sizeof(uvc.picture));
+    uvc.picture.format.pixelformat = V4L2_PIX_FMT_YUYV;
+    uvc.picture.format.width = c->width;
+    uvc.picture.format.height = c->height;
+    uvc.picture.format.planes = 1;
+    uvc.picture.format.stride[0] = c->width * 2;
+    uvc.picture.format.dmabuf = -1;
+    uvc.picture.plane[0] = c->yuyv;
+    uvc.picture.size = c->yuyv_size;
+    uvc.picture.index = -1;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.backend = JPEG_BACKEND_LIBJPEG;
+    if((uvc.libjpeg = jpeg_backend_new(&opts)) != NULL) {
+        k[n].name = "encode";
+        k[n].run = bench_encode;
+        k[n++].arg = uvc.libjpeg;
+    }
+    opts.backend = JPEG_BACKEND_SLICES;
+    opts.threads = c->threads;
+    if(c->threads > 1 && (uvc.slices = jpeg_backend_new(&opts)) != NULL) {
+        k[n].name = "encode (sliced)";
+        k[n].run = bench_encode;
+        k[n++].arg = uvc.slices;
+    }
+    if(uvc.is_huffman != NULL) {
+        k[n].name = "is_huffman";
+        k[n].run = bench_is_huffman;
+        k[n++].arg = &uvc;
+    }
+    if(uvc.memcpy_picture != NULL) {
+        k[n].name = "memcpy_picture";
+        k[n].run = bench_memcpy_picture;
+        k[n++].arg = &uvc;
+    }
+    return n;
+}
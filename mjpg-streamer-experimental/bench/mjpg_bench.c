@@ -0,0 +1,682 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../mjpg_streamer.h"
+#include "../utils.h"
+
+/*
+ * mjpg_bench loads an input and an output plugin like mjpg_streamer does,
+ * connects stream clients to the output from a thread of its own and
+ * measures what reaches them. A second thread notes when each frame was
+ * published, so a client knows how long its frame took from then on.
+ */
+
+#define PUBLISHED_SLOTS 4096
+#define CLIENT_HEAD_SIZE 1024
+#define READ_SIZE (256 * 1024)
+
+/* when a frame was published, in the slot its timestamp hashes to */
+typedef struct {
+    unsigned long long timestamp;       // usec of the frame timestamp
+    unsigned long long publish_usec;
+} published;
+
+typedef struct {
+    int fd;
+    int body;               // 1 while the data of a part is read
+    long left;              // bytes of it still to come
+    unsigned long long timestamp;
+    char head[CLIENT_HEAD_SIZE];
+    int head_len;
+} client;
+
+/* what the clients of a step got */
+typedef struct {
+    unsigned long long parts;
+    unsigned long long bytes;
+    unsigned long long unmatched;       // parts whose publish time was not noted
+    unsigned int *latency;              // publish to received in usec, one per part
+    size_t latencies, capacity;
+} results;
+
+static globals global;
+static pthread_mutex_t input_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static published publish_times[PUBLISHED_SLOTS];
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the program has no plugins to add and no options parsed in parallel */
+int plugin_add(command_dest dest, const char *spec)
+{
+    return -1;
+}
+
+int plugin_remove(command_dest dest, int id)
+{
+    return -1;
+}
+
+void plugin_options_parsed(void)
+{
+}
+
+/******************************************************************************
+Description.: prepare the frame bus of an input
+Input Value.: the input
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int init_input(input *in)
+{
+    memset(in, 0, sizeof(*in));
+    if(pthread_mutex_init(&in->db, NULL) != 0 || pthread_cond_init(&in->db_update, NULL) != 0)
+        return -1;
+
+    in->stats.encode_usec.shift = 6;
+    in->stats.dequeue_latency_usec.shift = 6;
+    in->stats.encode_latency_usec.shift = 6;
+    in->stats.publish_latency_usec.shift = 6;
+    return 0;
+}
+
+/******************************************************************************
+Description.: take one more input for a plugin which publishes several
+              streams, like input_add() of mjpg_streamer
+Input Value.: the input of the plugin, while it runs input_init()
+Return Value: id of the new input, -1 if all are taken
+******************************************************************************/
+int input_add(input *in)
+{
+    input *add;
+    int id;
+
+    pthread_mutex_lock(&input_mutex);
+    if(global.incnt >= INPUT_TABLE_SIZE || init_input(&global.in[global.incnt]) < 0) {
+        pthread_mutex_unlock(&input_mutex);
+        return -1;
+    }
+
+    id = global.incnt++;
+    add = &global.in[id];
+    add->plugin = in->plugin;
+    add->handle = in->handle;
+    add->init = in->init;
+    add->stop = in->stop;
+    add->run = in->run;
+    add->cmd = in->cmd;
+    add->param = in->param;
+    add->param.id = id;
+    pthread_mutex_unlock(&input_mutex);
+    return id;
+}
+
+/******************************************************************************
+Description.: split the parameters of a plugin at the spaces
+Input Value.: * spec: the plugin and its parameters
+              * argc: gets the number of arguments
+              * argv: gets them, argv[0] is left to the plugin
+Return Value: 0 if ok, -1 if there are too many
+******************************************************************************/
+static int split_parameters(const char *spec, int *argc, char **argv)
+{
+    char *copy = strdup(spec), *saveptr = NULL, *token;
+
+    *argc = 1;
+    argv[0] = NULL;
+    if(copy == NULL || strtok_r(copy, " ", &saveptr) == NULL)
+        return -1;
+
+    while((token = strtok_r(NULL, " ", &saveptr)) != NULL) {
+        if(*argc >= MAX_PLUGIN_ARGUMENTS)
+            return -1;
+        argv[(*argc)++] = token;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: open the library of a plugin, a plain file name is looked for in
+              the build tree next to this program first
+Input Value.: * spec..: the plugin and its parameters
+              * plugin: gets the file name of the library
+Return Value: the handle, NULL on errors
+******************************************************************************/
+static void *open_plugin(const char *spec, char **plugin)
+{
+    char exe[PATH_MAX], path[PATH_MAX * 2], *dir;
+    void *handle;
+    int n;
+
+    *plugin = strndup(spec, strcspn(spec, " "));
+    if(strchr(*plugin, '/') == NULL && (n = readlink("/proc/self/exe", exe, sizeof(exe) - 1)) > 0) {
+        exe[n] = '\0';
+        if((dir = strrchr(exe, '/')) != NULL)
+            *dir = '\0';
+        /* the plugin foo.so is built in plugins/foo/ */
+        snprintf(path, sizeof(path), "%s/../plugins/%.*s/%s", exe, (int)strcspn(*plugin, "."), *plugin, *plugin);
+        if(access(path, R_OK) == 0) {
+            free(*plugin);
+            *plugin = strdup(path);
+        }
+    }
+
+    if((handle = dlopen(*plugin, RTLD_LAZY)) == NULL)
+        fprintf(stderr, "could not load %s: %s\n", *plugin, dlerror());
+    return handle;
+}
+
+/******************************************************************************
+Description.: load, initialize and run the input plugin
+Input Value.: the plugin and its parameters
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int start_input(const char *spec)
+{
+    input *in = &global.in[0];
+    int i;
+
+    if(init_input(in) < 0 || (in->handle = open_plugin(spec, &in->plugin)) == NULL)
+        return -1;
+    in->init = dlsym(in->handle, "input_init");
+    in->stop = dlsym(in->handle, "input_stop");
+    in->run = dlsym(in->handle, "input_run");
+    in->cmd = dlsym(in->handle, "input_cmd");
+    if(in->init == NULL || in->stop == NULL || in->run == NULL ||
+       split_parameters(spec, &in->param.argc, in->param.argv) < 0)
+        return -1;
+    in->param.parameters = strchr(spec, ' ');
+    in->param.global = &global;
+    global.incnt = 1;
+
+    /* the inputs the plugin added run as well */
+    if(in->init(&in->param, 0) != 0)
+        return -1;
+    for(i = 0; i < global.incnt; i++) {
+        if(global.in[i].run(i) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: load, initialize and run the output plugin
+Input Value.: the plugin and its parameters
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int start_output(const char *spec)
+{
+    output *out = &global.out[0];
+
+    if((out->handle = open_plugin(spec, &out->plugin)) == NULL)
+        return -1;
+    out->init = dlsym(out->handle, "output_init");
+    out->stop = dlsym(out->handle, "output_stop");
+    out->run = dlsym(out->handle, "output_run");
+    out->cmd = dlsym(out->handle, "output_cmd");
+    if(out->init == NULL || out->stop == NULL || out->run == NULL ||
+       split_parameters(spec, &out->param.argc, out->param.argv) < 0)
+        return -1;
+    out->param.parameters = strchr(spec, ' ');
+    out->param.global = &global;
+    out->param.id = 0;
+    global.outcnt = 1;
+
+    if(out->init(&out->param, 0) != 0 || out->run(0) != 0)
+        return -1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: note when each frame of the first input is published
+Input Value.: -
+Return Value: NULL
+******************************************************************************/
+static void *record_publish(void *arg)
+{
+    frame_subscription sub;
+    input_frame *frame;
+    published *p;
+
+    unsigned long long timestamp;
+
+    frame_subscribe(&sub, &global.in[0], FRAME_NEXT, NULL);
+    while(!global.stop) {
+        if((frame = frame_next(&sub, 100)) == NULL)
+            continue;
+
+        timestamp = frame->timestamp.tv_sec * 1000000ULL + frame->timestamp.tv_usec;
+        pthread_mutex_lock(&publish_mutex);
+        p = &publish_times[timestamp % PUBLISHED_SLOTS];
+        p->timestamp = timestamp;
+        p->publish_usec = frame->publish_usec;
+        pthread_mutex_unlock(&publish_mutex);
+        frame_unref(frame);
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: look up when a frame was published
+Input Value.: timestamp of the frame in usec
+Return Value: its publish_usec, 0 if it was not noted or another frame took
+              its slot since
+******************************************************************************/
+static unsigned long long publish_time(unsigned long long timestamp)
+{
+    published *p = &publish_times[timestamp % PUBLISHED_SLOTS];
+    unsigned long long usec;
+
+    pthread_mutex_lock(&publish_mutex);
+    usec = (p->timestamp == timestamp) ? p->publish_usec : 0;
+    pthread_mutex_unlock(&publish_mutex);
+    return usec;
+}
+
+/******************************************************************************
+Description.: connect a stream client
+Input Value.: * c...: the client
+              * port: of the output
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int client_connect(client *c, int port)
+{
+    static const char request[] = "GET /?action=stream HTTP/1.0\r\n\r\n";
+    struct sockaddr_in addr;
+    int tries;
+
+    memset(c, 0, sizeof(*c));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* the server of the output may still be starting */
+    for(tries = 0; ; tries++) {
+        if((c->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+            return -1;
+        if(connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            break;
+        close(c->fd);
+        c->fd = -1;
+        if(errno != ECONNREFUSED || tries == 50)
+            return -1;
+        usleep(100 * 1000);
+    }
+    if(write(c->fd, request, sizeof(request) - 1) != sizeof(request) - 1) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+/******************************************************************************
+Description.: count a part a client received completely
+Input Value.: * r.: results of the step
+              * c.: the client
+              * now: monotonic_usec() of its end
+Return Value: -
+******************************************************************************/
+static void part_received(results *r, client *c, unsigned long long now)
+{
+    unsigned long long published;
+    unsigned int *grown;
+
+    r->parts++;
+    if((published = publish_time(c->timestamp)) == 0 || published > now) {
+        r->unmatched++;
+        return;
+    }
+
+    if(r->latencies == r->capacity) {
+        r->capacity = r->capacity ? 2 * r->capacity : 65536;
+        if((grown = realloc(r->latency, r->capacity * sizeof(unsigned int))) == NULL) {
+            r->unmatched++;
+            return;
+        }
+        r->latency = grown;
+    }
+    r->latency[r->latencies++] = now - published;
+}
+
+/******************************************************************************
+Description.: parse what a client received: the HTTP header, then for every
+              part its header with the length and the timestamp and its data
+Input Value.: * r...: results of the step, NULL while warming up
+              * c...: the client
+              * data: bytes received
+              * len.: their number
+Return Value: 0 if ok, -1 if the stream makes no sense
+******************************************************************************/
+static int client_data(results *r, client *c, const char *data, size_t len)
+{
+    unsigned long long now = monotonic_usec();
+    const char *length, *stamp;
+    long sec, usec;
+    size_t n;
+
+    while(len > 0) {
+        if(c->body) {
+            n = (len < (size_t)c->left) ? len : (size_t)c->left;
+            c->left -= n;
+            data += n;
+            len -= n;
+            if(r != NULL)
+                r->bytes += n;
+            if(c->left == 0) {
+                c->body = 0;
+                if(r != NULL)
+                    part_received(r, c, now);
+            }
+            continue;
+        }
+
+        /* a header ends with an empty line */
+        if(c->head_len == CLIENT_HEAD_SIZE - 1)
+            return -1;
+        c->head[c->head_len++] = *data++;
+        len--;
+        if(c->head_len < 4 || memcmp(c->head + c->head_len - 4, "\r\n\r\n", 4) != 0)
+            continue;
+
+        c->head[c->head_len] = '\0';
+        c->head_len = 0;
+        if((length = strstr(c->head, "Content-Length: ")) == NULL)
+            continue;       /* the header of the response */
+        c->left = strtol(length + strlen("Content-Length: "), NULL, 10);
+        c->timestamp = 0;
+        if((stamp = strstr(c->head, "X-Timestamp: ")) != NULL &&
+           sscanf(stamp + strlen("X-Timestamp: "), "%ld.%ld", &sec, &usec) == 2)
+            c->timestamp = sec * 1000000ULL + usec;
+        c->body = (c->left > 0);
+    }
+    return 0;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/******************************************************************************
+Description.: bytes this process passed to write() and send() so far
+Input Value.: -
+Return Value: the number, 0 if it is not known
+******************************************************************************/
+static unsigned long long bytes_written(void)
+{
+    unsigned long long bytes = 0;
+    char line[128];
+    FILE *f;
+
+    if((f = fopen("/proc/self/io", "r")) == NULL)
+        return 0;
+    while(fgets(line, sizeof(line), f) != NULL) {
+        if(sscanf(line, "wchar: %llu", &bytes) == 1)
+            break;
+    }
+    fclose(f);
+    return bytes;
+}
+
+static unsigned long long cpu_usec(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/******************************************************************************
+Description.: receive on the clients until a time
+Input Value.: * epfd...: epoll instance of the clients
+              * r......: results to count in, NULL while warming up
+              * until..: monotonic_usec() to stop at
+              * failed.: gets the number of clients the server closed
+Return Value: -
+******************************************************************************/
+static void receive(int epfd, results *r, unsigned long long until, int *failed)
+{
+    static char buffer[READ_SIZE];
+    struct epoll_event events[64];
+    unsigned long long now;
+    client *c;
+    ssize_t n;
+    int i, count;
+
+    while((now = monotonic_usec()) < until) {
+        count = epoll_wait(epfd, events, 64, (until - now) / 1000 + 1);
+        for(i = 0; i < count; i++) {
+            /* one read each, a fast server must not keep the others waiting */
+            c = events[i].data.ptr;
+            if((n = read(c->fd, buffer, sizeof(buffer))) > 0 && client_data(r, c, buffer, n) < 0)
+                n = 0;
+            if(n == 0 || (n < 0 && errno != EAGAIN)) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                close(c->fd);
+                c->fd = -1;
+                (*failed)++;
+            }
+        }
+    }
+}
+
+/******************************************************************************
+Description.: run a step: connect the clients, warm up, measure and print a
+              line of results
+Input Value.: * clients.: how many
+              * port....: of the output
+              * warmup..: seconds before measuring
+              * duration: seconds to measure
+              * recorder: the thread noting the publish times
+Return Value: 0 if ok, -1 if the clients could not connect
+******************************************************************************/
+static int run_step(int clients, int port, int warmup, int duration, pthread_t recorder)
+{
+    unsigned long long start, elapsed, cpu, own, noted, written, frames;
+    struct epoll_event ev;
+    clockid_t recorder_clock;
+    results r;
+    client *c;
+    int epfd, i, failed = 0;
+
+    if((c = calloc(clients, sizeof(client))) == NULL || (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+    for(i = 0; i < clients; i++) {
+        if(client_connect(&c[i], port) < 0) {
+            fprintf(stderr, "client %d could not connect to port %d: %s\n", i, port, strerror(errno));
+            while(i-- > 0)
+                close(c[i].fd);
+            free(c);
+            close(epfd);
+            return -1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = &c[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c[i].fd, &ev);
+    }
+
+    receive(epfd, NULL, monotonic_usec() + warmup * 1000000ULL, &failed);
+
+    memset(&r, 0, sizeof(r));
+    if(pthread_getcpuclockid(recorder, &recorder_clock) != 0)
+        recorder_clock = CLOCK_THREAD_CPUTIME_ID;
+    start = monotonic_usec();
+    cpu = cpu_usec(CLOCK_PROCESS_CPUTIME_ID);
+    own = cpu_usec(CLOCK_THREAD_CPUTIME_ID);
+    noted = cpu_usec(recorder_clock);
+    written = bytes_written();
+    frames = global.in[0].stats.frames;
+
+    receive(epfd, &r, start + duration * 1000000ULL, &failed);
+
+    /* the clients and the recorder are not part of what is measured */
+    elapsed = monotonic_usec() - start;
+    cpu = cpu_usec(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    cpu -= cpu_usec(CLOCK_THREAD_CPUTIME_ID) - own;
+    cpu -= cpu_usec(recorder_clock) - noted;
+    written = bytes_written() - written;
+    frames = global.in[0].stats.frames - frames;
+
+    qsort(r.latency, r.latencies, sizeof(unsigned int), compare_latency);
+    printf("%7d %10.1f %10.1f %10u %10u %10.1f %12.0f %10.0f",
+           clients, frames * 1000000.0 / elapsed, r.parts * 1000000.0 / elapsed,
+           r.latencies ? r.latency[r.latencies / 2] : 0,
+           r.latencies ? r.latency[r.latencies * 99 / 100] : 0,
+           r.parts ? (double)cpu / r.parts : 0.0,
+           r.parts ? (double)written / r.parts : 0.0,
+           r.parts ? (double)r.bytes / r.parts : 0.0);
+    if(failed > 0)
+        printf("  (%d clients closed)", failed);
+    if(r.unmatched > 0)
+        printf("  (%llu parts not timed)", r.unmatched);
+    printf("\n");
+    fflush(stdout);
+
+    for(i = 0; i < clients; i++) {
+        if(c[i].fd >= 0)
+            close(c[i].fd);
+    }
+    close(epfd);
+    free(c);
+    free(r.latency);
+
+    /* let the server notice the clients are gone */
+    usleep(200 * 1000);
+    return 0;
+}
+
+static void help(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n" \
+            " [-s | --size <bytes>]......: frames of the test picture input, like 100k\n" \
+            "                              or 2M (100k)\n" \
+            " [-f | --fps <rate>]........: frames per second of it, 0 is as fast as\n" \
+            "                              possible (30)\n" \
+            " [-c | --clients <list>]....: stream clients of each step, like 1,10,100\n" \
+            " [-t | --time <seconds>]....: to measure each step (5)\n" \
+            " [-w | --warmup <seconds>]..: before measuring (1)\n" \
+            " [-p | --port <port>].......: of the HTTP output (8099)\n" \
+            " [-i | --input \"<plugin>\"]..: instead of the test pictures\n" \
+            " [-o | --output \"<plugin>\"].: instead of output_http.so -p <port>\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"size", required_argument, NULL, 's'},
+        {"fps", required_argument, NULL, 'f'},
+        {"clients", required_argument, NULL, 'c'},
+        {"time", required_argument, NULL, 't'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"port", required_argument, NULL, 'p'},
+        {"input", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *size = "100k", *fps = "30", *clients = "1,10,100";
+    char *input = NULL, *output = NULL, *list, *step, *saveptr;
+    int duration = 5, warmup = 1, port = 8099, c;
+    pthread_t recorder;
+
+    while((c = getopt_long(argc, argv, "hs:f:c:t:w:p:i:o:", long_options, NULL)) != -1) {
+        switch(c) {
+        case 's': size = optarg; break;
+        case 'f': fps = optarg; break;
+        case 'c': clients = optarg; break;
+        case 't': duration = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'i': input = optarg; break;
+        case 'o': output = optarg; break;
+        default:
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(duration <= 0 || warmup < 0 || port <= 0) {
+        help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if((input == NULL && asprintf(&input, "input_testpicture.so -g %s -fps %s", size, fps) < 0) ||
+       (output == NULL && asprintf(&output, "output_http.so -p %d", port) < 0))
+        return EXIT_FAILURE;
+
+    signal(SIGPIPE, SIG_IGN);
+    openlog("mjpg_bench", LOG_PID, LOG_USER);
+    log_start(LOG_FORMAT_TEXT);
+
+    global.in = calloc(INPUT_TABLE_SIZE, sizeof(*global.in));
+    global.out = calloc(OUTPUT_TABLE_SIZE, sizeof(*global.out));
+    if(global.in == NULL || global.out == NULL)
+        return EXIT_FAILURE;
+
+    if(start_input(input) < 0) {
+        fprintf(stderr, "could not start %s\n", input);
+        return EXIT_FAILURE;
+    }
+    if(start_output(output) < 0) {
+        fprintf(stderr, "could not start %s\n", output);
+        return EXIT_FAILURE;
+    }
+    if(pthread_create(&recorder, NULL, record_publish, NULL) != 0)
+        return EXIT_FAILURE;
+
+    printf("# %s -> %s, %d s per step\n", input, output, duration);
+    printf("%7s %10s %10s %10s %10s %10s %12s %10s\n", "clients", "frames/s", "sent/s",
+           "p50 us", "p99 us", "cpu us", "written B", "size B");
+    fflush(stdout);
+
+    if((list = strdup(clients)) == NULL)
+        return EXIT_FAILURE;
+    for(step = strtok_r(list, ",", &saveptr); step != NULL; step = strtok_r(NULL, ",", &saveptr)) {
+        if(atoi(step) <= 0 || run_step(atoi(step), port, warmup, duration, recorder) < 0)
+            break;
+    }
+
+    /* the plugins are not unloaded, their threads may still run */
+    global.stop = 1;
+    global.out[0].stop(0);
+    global.in[0].stop(0);
+    log_stop();
+    return 0;
+}
@@ -0,0 +1,366 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <jpeglib.h>
+
+#include "../mjpg_streamer.h"
+#include "../utils.h"
+#include "../plugins/output_autofocus/processJPEG_onlyCenter.h"
+#include "microbench.h"
+
+/*
+ * mjpg_microbench runs each kernel in batches of about BATCH_USEC until the
+ * time of a kernel is over, after one batch to warm the caches up. The
+ * corpus is built from a synthetic picture with the same seed every time,
+ * so two builds or two boards get the same input.
+ */
+
+#define BATCH_USEC 10000
+
+/* the program has no plugins to add, like mjpg_bench */
+int plugin_add(command_dest dest, const char *spec)
+{
+    return -1;
+}
+
+int plugin_remove(command_dest dest, int id)
+{
+    return -1;
+}
+
+void plugin_options_parsed(void)
+{
+}
+
+/******************************************************************************
+Description.: load a plugin of the build tree, or one along LD_LIBRARY_PATH
+Input Value.: file name of the plugin, like input_uvc.so
+Return Value: its handle, NULL if it is not there
+******************************************************************************/
+void *bench_plugin(const char *name)
+{
+    char exe[PATH_MAX], path[PATH_MAX * 2], *dir;
+    void *handle;
+    int n;
+
+    path[0] = '\0';
+    if((n = readlink("/proc/self/exe", exe, sizeof(exe) - 1)) > 0) {
+        exe[n] = '\0';
+        if((dir = strrchr(exe, '/')) != NULL)
+            *dir = '\0';
+        /* the plugin foo.so is built in plugins/foo/ */
+        snprintf(path, sizeof(path), "%s/../plugins/%.*s/%s", exe, (int)strcspn(name, "."), name, name);
+    }
+
+    if((handle = dlopen(access(path, R_OK) == 0 ? path : name, RTLD_LAZY)) == NULL)
+        fprintf(stderr, "skipping the kernels of %s: %s\n", name, dlerror());
+    return handle;
+}
+
+/******************************************************************************
+Description.: draw the test picture, gradients with some noise so the JPEG
+              compresses like a camera picture and not like a flat one
+Input Value.: the corpus, with its size set
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int draw_picture(bench_corpus *c)
+{
+    unsigned int seed = 12345;
+    unsigned char *p;
+    int x, y, noise;
+
+    c->yuyv_size = c->width * c->height * 2;
+    if((c->yuyv = malloc(c->yuyv_size)) == NULL)
+        return -1;
+
+    p = c->yuyv;
+    for(y = 0; y < c->height; y++) {
+        for(x = 0; x < c->width; x += 2) {
+            seed = seed * 1103515245 + 12345;
+            noise = (seed >> 16) & 31;
+            p[0] = (x * 160 / c->width + y * 64 / c->height + noise) & 0xff;
+            p[1] = (128 + (x - c->width / 2) * 64 / c->width) & 0xff;
+            p[2] = (p[0] + ((seed >> 24) & 15)) & 0xff;
+            p[3] = (128 + (y - c->height / 2) * 64 / c->height) & 0xff;
+            p += 4;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: encode the test picture with the standard huffman tables of
+              libjpeg, and make a copy without them like UVC cameras send
+Input Value.: the corpus with its picture
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int encode_picture(bench_corpus *c)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *line, *yuyv, *out = NULL;
+    unsigned long size = 0;
+    JSAMPROW row[1];
+    int x, i, n, length;
+
+    if((line = malloc(c->width * 3)) == NULL)
+        return -1;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, &size);
+    cinfo.image_width = c->width;
+    cinfo.image_height = c->height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    jpeg_set_quality(&cinfo, c->quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while(cinfo.next_scanline < cinfo.image_height) {
+        yuyv = c->yuyv + cinfo.next_scanline * c->width * 2;
+        for(x = 0; x < c->width; x++) {
+            line[x * 3] = yuyv[x * 2];
+            line[x * 3 + 1] = yuyv[(x & ~1) * 2 + 1];
+            line[x * 3 + 2] = yuyv[(x & ~1) * 2 + 3];
+        }
+        row[0] = line;
+        jpeg_write_scanlines(&cinfo, row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(line);
+
+    c->jpeg = out;
+    c->jpeg_size = size;
+    if((c->mjpeg = malloc(size)) == NULL)
+        return -1;
+
+    /* the segments up to SOS without DHT, then the entropy coded data */
+    memcpy(c->mjpeg, out, 2);
+    n = 2;
+    for(i = 2; i + 4 <= (int)size && out[i] == 0xff; i += length) {
+        length = 2 + ((out[i + 2] << 8) | out[i + 3]);
+        if(out[i + 1] == 0xda) {
+            memcpy(c->mjpeg + n, out + i, size - i);
+            n += size - i;
+            break;
+        }
+        if(out[i + 1] != 0xc4) {
+            memcpy(c->mjpeg + n, out + i, length);
+            n += length;
+        }
+    }
+    c->mjpeg_size = n;
+
+    return (n < (int)size) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: score the sharpness of a picture like output_autofocus
+Input Value.: the corpus
+Return Value: bytes of the picture, -1 on errors
+******************************************************************************/
+static long bench_sharpness(void *arg)
+{
+    bench_corpus *c = arg;
+
+    if(getFrameSharpnessValue(c->jpeg, c->jpeg_size) < 0)
+        return -1;
+    return c->jpeg_size;
+}
+
+/******************************************************************************
+Description.: decode a frame like the plugins needing its pixels, the cached
+              picture is dropped each time
+Input Value.: the frame
+Return Value: bytes of the picture, -1 on errors
+******************************************************************************/
+static long bench_decode(void *arg)
+{
+    input_frame *frame = arg;
+
+    frame_decode_free(frame);
+    if(frame_decode(frame, DECODE_YUV420, 0, 0) == NULL)
+        return -1;
+    return frame->size;
+}
+
+/******************************************************************************
+Description.: time a kernel
+Input Value.: * k......: the kernel
+              * seconds: how long to run it
+Return Value: 0 if ok, -1 if it failed
+******************************************************************************/
+static int run_kernel(bench_kernel *k, double seconds)
+{
+    unsigned long long start, now, until, ops = 0, batch = 1, bytes = 0, i;
+    long n;
+
+    /* warm up and find the size of a batch */
+    start = monotonic_usec();
+    do {
+        for(i = 0; i < batch; i++) {
+            if(k->run(k->arg) < 0)
+                return -1;
+        }
+        batch *= 2;
+    } while(monotonic_usec() - start < BATCH_USEC);
+
+    start = monotonic_usec();
+    until = start + seconds * 1000000;
+    batch /= 2;
+    do {
+        for(i = 0; i < batch; i++) {
+            if((n = k->run(k->arg)) < 0)
+                return -1;
+            bytes += n;
+        }
+        ops += batch;
+        now = monotonic_usec();
+    } while(now < until);
+
+    printf("%-26s %10llu %12.1f %12llu %10.1f\n", k->name, ops, (now - start) * 1000.0 / ops,
+           bytes / ops, bytes / (double)(now - start));
+    fflush(stdout);
+    return 0;
+}
+
+/******************************************************************************
+Description.: tell whether a kernel was asked for
+Input Value.: * list: comma separated names or prefixes, NULL for all
+              * name: of the kernel
+Return Value: 1 if it was
+******************************************************************************/
+static int wanted(const char *list, const char *name)
+{
+    const char *p = list;
+    size_t len;
+
+    if(list == NULL)
+        return 1;
+    while(*p != '\0') {
+        len = strcspn(p, ",");
+        if(len > 0 && strncmp(p, name, len) == 0)
+            return 1;
+        p += len;
+        if(*p == ',')
+            p++;
+    }
+    return 0;
+}
+
+static void help(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n" \
+            " [-r | --resolution <WxH>]..: of the test picture (1280x720)\n" \
+            " [-q | --quality <n>].......: of its JPEG (80)\n" \
+            " [-j | --threads <n>].......: encode in slices with this many threads (1)\n" \
+            " [-t | --time <seconds>]....: to run each kernel (1)\n" \
+            " [-k | --kernels <list>]....: only these kernels, like encode,decode\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"resolution", required_argument, NULL, 'r'},
+        {"quality", required_argument, NULL, 'q'},
+        {"threads", required_argument, NULL, 'j'},
+        {"time", required_argument, NULL, 't'},
+        {"kernels", required_argument, NULL, 'k'},
+        {NULL, 0, NULL, 0}
+    };
+    bench_kernel kernels[MAX_BENCH_KERNELS];
+    bench_corpus corpus;
+    input_frame *frame;
+    const char *list = NULL;
+    double seconds = 1;
+    int count = 0, failed = 0, i, c;
+
+    memset(&corpus, 0, sizeof(corpus));
+    corpus.width = 1280;
+    corpus.height = 720;
+    corpus.quality = 80;
+    corpus.threads = 1;
+
+    while((c = getopt_long(argc, argv, "hr:q:j:t:k:", long_options, NULL)) != -1) {
+        switch(c) {
+        case 'r':
+            if(sscanf(optarg, "%dx%d", &corpus.width, &corpus.height) != 2)
+                corpus.width = 0;
+            break;
+        case 'q': corpus.quality = atoi(optarg); break;
+        case 'j': corpus.threads = atoi(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'k': list = optarg; break;
+        default:
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    /* the pictures are YUYV, so the width is even, and 4:2:2 MCUs are 16x8 */
+    if(corpus.width < 16 || corpus.height < 8 || corpus.width % 2 != 0 ||
+       corpus.quality < 1 || corpus.quality > 100 || corpus.threads < 1 || seconds <= 0) {
+        help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(draw_picture(&corpus) < 0 || encode_picture(&corpus) < 0) {
+        fprintf(stderr, "could not build the corpus\n");
+        return EXIT_FAILURE;
+    }
+    if((frame = frame_alloc(corpus.jpeg_size)) == NULL)
+        return EXIT_FAILURE;
+    memcpy(frame->buf, corpus.jpeg, corpus.jpeg_size);
+    frame->size = corpus.jpeg_size;
+
+    count += uvc_kernels(&corpus, kernels + count);
+    count += proxy_kernels(&corpus, kernels + count);
+    count += request_kernels(&corpus, kernels + count);
+    kernels[count].name = "getFrameSharpnessValue";
+    kernels[count].run = bench_sharpness;
+    kernels[count++].arg = &corpus;
+    kernels[count].name = "frame_decode";
+    kernels[count].run = bench_decode;
+    kernels[count++].arg = frame;
+
+    printf("# %dx%d test picture, YUYV %d B, JPEG %d B at quality %d, MJPEG %d B, %g s per kernel\n",
+           corpus.width, corpus.height, corpus.yuyv_size, corpus.jpeg_size, corpus.quality,
+           corpus.mjpeg_size, seconds);
+    printf("%-26s %10s %12s %12s %10s\n", "kernel", "ops", "ns/op", "bytes/op", "MB/s");
+    for(i = 0; i < count; i++) {
+        if(wanted(list, kernels[i].name) && run_kernel(&kernels[i], seconds) < 0) {
+            fprintf(stderr, "%s failed\n", kernels[i].name);
+            failed = 1;
+        }
+    }
+
+    frame_unref(frame);
+    return failed ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,316 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * commands of the outputs for the inputs, queued per input
+ *
+ * Setting a control may take a while, a UVC camera does it with USB control
+ * transfers. Without the queue the thread of a client would wait for them
+ * and a slider dragged in control.htm would send one command after the
+ * other. Each input gets a thread carrying out its commands in the order
+ * they were queued, the caller waits for the result or goes on at once. A
+ * command for a control which is queued already only changes the value of
+ * the queued one, so the control jumps to the latest value instead of
+ * passing all of them, unless a command queued after that one touches the
+ * control as well. Buttons, batches and commands with a string are carried
+ * out one by one.
+ *
+ * The queue of an input stays allocated once it is set up, its thread runs
+ * until the program ends.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+/* more commands waiting for an input are refused */
+#define COMMAND_QUEUE_SIZE 64
+
+typedef struct _queued_command queued_command;
+struct _queued_command {
+    queued_command *next;
+    unsigned int control_id, group;
+    int value;
+    char *value_str;                // NULL without one
+    int refs;                       // the queue until it is carried out, and each waiting caller
+    int done;
+    int result;                     // of cmd() once done
+};
+
+struct _command_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t update;          // a command was queued or carried out
+    queued_command *head, *tail;
+    int count;
+    unsigned long long done;        // commands carried out so far
+};
+
+static pthread_mutex_t command_setup = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+Description.: drop a reference to a queued command, the caller must hold the
+              lock of its queue
+Input Value.: the command
+Return Value: -
+******************************************************************************/
+static void command_release(queued_command *c)
+{
+    if(--c->refs > 0)
+        return;
+    free(c->value_str);
+    free(c);
+}
+
+/******************************************************************************
+Description.: carry out a command, a batch the input does not know is split
+              into its controls
+Input Value.: * in: the input
+              * c.: the command
+Return Value: the result of cmd()
+******************************************************************************/
+static int command_run(input *in, queued_command *c)
+{
+    char *p, *end;
+    int ret, r, id, value;
+
+    if(in->handle == NULL || in->cmd == NULL)
+        return -1;
+
+    ret = in->cmd(in->param.id, c->control_id, c->group, c->value, c->value_str);
+    if(ret >= 0 || c->group != IN_CMD_V4L2_BATCH || c->value_str == NULL)
+        return ret;
+
+    /* "id=value&id=value..." one by one */
+    for(p = c->value_str, ret = 0; *p != '\0'; p = (*end == '&') ? end + 1 : end) {
+        id = strtol(p, &end, 0);
+        if(end == p || *end != '=')
+            return -1;
+        p = end + 1;
+        value = strtol(p, &end, 0);
+        if(end == p)
+            return -1;
+        if((r = in->cmd(in->param.id, id, IN_CMD_V4L2, value, NULL)) != 0)
+            ret = r;
+    }
+    return ret;
+}
+
+/******************************************************************************
+Description.: carry out the queued commands of an input, runs until the
+              program ends
+Input Value.: the input
+Return Value: does not return
+******************************************************************************/
+static void *command_thread(void *arg)
+{
+    input *in = arg;
+    command_queue *q = in->commands;
+    queued_command *c;
+    int result;
+
+    pthread_mutex_lock(&q->lock);
+    while(1) {
+        while(q->head == NULL)
+            pthread_cond_wait(&q->update, &q->lock);
+
+        /* a command being carried out takes no more values */
+        c = q->head;
+        if((q->head = c->next) == NULL)
+            q->tail = NULL;
+        q->count--;
+        pthread_mutex_unlock(&q->lock);
+
+        DBG("command %u of group %u for input %d: %d\n", c->control_id, c->group, in->param.id, c->value);
+        result = command_run(in, c);
+
+        pthread_mutex_lock(&q->lock);
+        c->result = result;
+        c->done = 1;
+        q->done++;
+        pthread_cond_broadcast(&q->update);
+        command_release(c);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: set up the command queue of an input and its thread
+Input Value.: the input
+Return Value: the queue, NULL on errors
+******************************************************************************/
+static command_queue *command_queue_of(input *in)
+{
+    command_queue *q;
+    pthread_t thread;
+
+    pthread_mutex_lock(&command_setup);
+    if((q = in->commands) == NULL) {
+        if((q = calloc(1, sizeof(command_queue))) == NULL) {
+            pthread_mutex_unlock(&command_setup);
+            LOG("not enough memory\n");
+            return NULL;
+        }
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->update, NULL);
+        in->commands = q;
+
+        if(pthread_create(&thread, NULL, command_thread, in) != 0) {
+            in->commands = NULL;
+            pthread_cond_destroy(&q->update);
+            pthread_mutex_destroy(&q->lock);
+            free(q);
+            pthread_mutex_unlock(&command_setup);
+            LOG("could not start the command thread of input %d\n", in->param.id);
+            return NULL;
+        }
+        pthread_detach(thread);
+    }
+    pthread_mutex_unlock(&command_setup);
+
+    return q;
+}
+
+/******************************************************************************
+Description.: tell whether a queued command takes the value of a new one
+Input Value.: * c.........: the queued command
+              * control_id: control of the new command
+              * group.....: its group
+              * value_str.: its string, NULL without one
+Return Value: 1 if it does, 0 otherwise
+******************************************************************************/
+static int command_coalesces(const queued_command *c, unsigned int control_id, unsigned int group,
+                             const char *value_str)
+{
+    if(group == IN_CMD_GENERIC || group == IN_CMD_V4L2_BATCH)
+        return 0;
+    return c->control_id == control_id && c->group == group && c->value_str == NULL && value_str == NULL;
+}
+
+/******************************************************************************
+Description.: tell whether a queued command may set a control, batches and
+              generic commands may set any
+Input Value.: * c.........: the queued command
+              * control_id: the control
+Return Value: 1 if it may, 0 otherwise
+******************************************************************************/
+static int command_touches(const queued_command *c, unsigned int control_id)
+{
+    return c->control_id == control_id || c->group == IN_CMD_GENERIC || c->group == IN_CMD_V4L2_BATCH;
+}
+
+/******************************************************************************
+Description.: queue a command for an input, it is carried out by the thread
+              of the input after the ones queued before it
+Input Value.: * in........: the input
+              * control_id: the control
+              * group.....: its group, one of IN_CMD_*
+              * value.....: the value to set
+              * value_str.: string of the command, it is copied, may be NULL
+              * flags.....: COMMAND_WAIT to wait until the command is done
+Return Value: the result of cmd() with COMMAND_WAIT, 0 if the command was
+              queued without it, -1 if it could not be queued
+******************************************************************************/
+int input_command(input *in, unsigned int control_id, unsigned int group, int value, const char *value_str, int flags)
+{
+    command_queue *q;
+    queued_command *c, *last = NULL;
+    int result;
+
+    if(in->cmd == NULL || (q = command_queue_of(in)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&q->lock);
+    /* the value goes to the last command for the control, so no other one is overtaken */
+    for(c = q->head; c != NULL; c = c->next) {
+        if(command_touches(c, control_id))
+            last = c;
+    }
+    c = (last != NULL && command_coalesces(last, control_id, group, value_str)) ? last : NULL;
+
+    if(c != NULL) {
+        DBG("command %u of input %d takes the value %d instead of %d\n", control_id, in->param.id, value, c->value);
+        c->value = value;
+    } else {
+        if(q->count == COMMAND_QUEUE_SIZE) {
+            pthread_mutex_unlock(&q->lock);
+            LOG("too many commands queued for input %d\n", in->param.id);
+            return -1;
+        }
+        if((c = calloc(1, sizeof(queued_command))) == NULL ||
+           (value_str != NULL && (c->value_str = strdup(value_str)) == NULL)) {
+            pthread_mutex_unlock(&q->lock);
+            free(c);
+            LOG("not enough memory\n");
+            return -1;
+        }
+        c->control_id = control_id;
+        c->group = group;
+        c->value = value;
+        c->refs = 1;
+        if(q->tail != NULL)
+            q->tail->next = c;
+        else
+            q->head = c;
+        q->tail = c;
+        q->count++;
+        pthread_cond_broadcast(&q->update);
+    }
+
+    if(!(flags & COMMAND_WAIT)) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+
+    c->refs++;
+    while(!c->done)
+        pthread_cond_wait(&q->update, &q->lock);
+    result = c->result;
+    command_release(c);
+    pthread_mutex_unlock(&q->lock);
+
+    return result;
+}
+
+/******************************************************************************
+Description.: the number of commands carried out for an input, it changes
+              whenever one of them may have set a control
+Input Value.: the input
+Return Value: commands done so far
+******************************************************************************/
+unsigned long long input_commands_done(input *in)
+{
+    command_queue *q = in->commands;
+    unsigned long long done;
+
+    if(q == NULL)
+        return 0;
+
+    pthread_mutex_lock(&q->lock);
+    done = q->done;
+    pthread_mutex_unlock(&q->lock);
+    return done;
+}
@@ -0,0 +1,445 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * the pictures decoded from the JPEG of a frame, shared by the plugins which
+ * need its pixels
+ *
+ * A viewer, a recorder which encodes to H.264 and the change detection of
+ * output_file would each decode the same frame on their own. frame_decode()
+ * keeps the pictures with the frame instead: the first plugin asking for a
+ * format at a size decodes it, the others get the same picture, and it goes
+ * away with the last reference to the frame. A plugin which asks while
+ * another one is still decoding waits for that picture rather than decoding
+ * it a second time.
+ *
+ * The pictures are read-only. Their planes stay valid as long as the caller
+ * holds its reference to the frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#include <jerror.h>
+#endif
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+#define DECODE_PENDING 0
+#define DECODE_READY 1
+#define DECODE_FAILED 2
+
+/* the lists of all frames, a picture being decoded is announced with the cond */
+static pthread_mutex_t decode_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t decode_done = PTHREAD_COND_INITIALIZER;
+
+/* the pictures go with the last reference to their frame, not before */
+static memory_account decode_memory = MEMORY_ACCOUNT("decoded", MEMORY_CACHE, NULL, NULL);
+
+/******************************************************************************
+Description.: read the size of the picture from the frame header of a JPEG,
+              which is all it takes to notice an input changed its size
+Input Value.: * frame.........: the frame
+              * width, height.: get the size
+Return Value: 0 if ok, -1 without a frame header
+******************************************************************************/
+int frame_picture_size(const input_frame *frame, int *width, int *height)
+{
+    const unsigned char *data = frame->buf;
+    int i = 2, size = frame->size;
+
+    while(i + 9 <= size && data[i] == 0xFF) {
+        if(data[i + 1] >= 0xC0 && data[i + 1] <= 0xCF && data[i + 1] != 0xC4 &&
+           data[i + 1] != 0xC8 && data[i + 1] != 0xCC) {
+            *height = (data[i + 5] << 8) | data[i + 6];
+            *width = (data[i + 7] << 8) | data[i + 8];
+            return (*width > 0 && *height > 0) ? 0 : -1;
+        }
+        i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: the smallest scale libjpeg decodes at which still covers a size
+Input Value.: * frame.........: the frame
+              * width, height.: the size wanted, 0 for the full picture
+Return Value: the denominator, 1, 2, 4 or 8, -1 without a frame header
+******************************************************************************/
+static int choose_denom(const input_frame *frame, int width, int height)
+{
+    int w, h, denom;
+
+    if(frame_picture_size(frame, &w, &h) < 0)
+        return -1;
+    if(width <= 0 || height <= 0)
+        return 1;
+
+    for(denom = 8; denom > 1; denom /= 2) {
+        if((w + denom - 1) / denom >= width && (h + denom - 1) / denom >= height)
+            return denom;
+    }
+    return 1;
+}
+
+#ifdef NO_LIBJPEG
+
+static int decode_picture(input_frame *frame, decoded_picture *pic)
+{
+    return -1;
+}
+
+#else
+
+#if JPEG_LIB_VERSION >= 70
+#define COMPONENT_SCALED_SIZE(component) ((component)->DCT_v_scaled_size)
+#define MIN_SCALED_SIZE(cinfo) ((cinfo)->min_DCT_v_scaled_size)
+#else
+#define COMPONENT_SCALED_SIZE(component) ((component)->DCT_scaled_size)
+#define MIN_SCALED_SIZE(cinfo) ((cinfo)->min_DCT_scaled_size)
+#endif
+
+/* longjmp target for errors of libjpeg, the default handler would exit */
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} decode_error_mgr;
+
+static void decode_error_exit(j_common_ptr cinfo)
+{
+    decode_error_mgr *err = (decode_error_mgr *)cinfo->err;
+
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->setjmp_buffer, 1);
+}
+
+/* the warnings of a truncated frame would fill the log with every frame */
+static void decode_output_message(j_common_ptr cinfo)
+{
+    #ifdef DEBUG
+    char buffer[JMSG_LENGTH_MAX];
+
+    (*cinfo->err->format_message)(cinfo, buffer);
+    DBG("%s\n", buffer);
+    #endif
+}
+
+/* how libjpeg writes the planes of a raw decode into a picture */
+typedef struct {
+    int pitch[3];       // bytes between the lines libjpeg writes
+    int compact;        // it writes the chroma at full width, keep every other sample
+    int rows;           // chroma lines it writes for each line of the picture
+} raw_layout;
+
+/******************************************************************************
+Description.: set up the planes of a raw decode, the chroma of a 4:2:0
+              picture is half the width of the luma and half the height.
+              A 4:2:2 JPEG becomes 4:2:0 by skipping every other chroma line
+              with the stride. libjpeg-turbo scales the chroma up in the IDCT
+              when it scales a frame down, those planes and the ones of full
+              chroma JPEGs are subsampled after the decode.
+Input Value.: * dinfo.: decompressor with raw_data_out set and started
+              * pic...: the picture
+              * layout: gets how libjpeg writes the planes
+Return Value: 0 if ok, -1 if the layout does not fit 4:2:0 or without memory
+******************************************************************************/
+static int setup_raw_planes(struct jpeg_decompress_struct *dinfo, decoded_picture *pic, raw_layout *layout)
+{
+    jpeg_component_info *component = dinfo->comp_info;
+    JDIMENSION width = component[0].downsampled_width, height = component[0].downsampled_height;
+    size_t offset[3], size = 0;
+    int c, lines;
+
+    if(component[1].downsampled_width != component[2].downsampled_width ||
+       component[1].downsampled_height != component[2].downsampled_height)
+        return -1;
+
+    if(component[1].downsampled_width == (width + 1) / 2)
+        layout->compact = 0;
+    else if(component[1].downsampled_width == width)
+        layout->compact = 1;
+    else
+        return -1;
+
+    if(component[1].downsampled_height == (height + 1) / 2)
+        layout->rows = 1;
+    else if(component[1].downsampled_height == height)
+        layout->rows = 2;
+    else
+        return -1;
+
+    /* libjpeg writes whole blocks, the planes are padded to them */
+    for(c = 0; c < 3; c++) {
+        lines = component[c].v_samp_factor * COMPONENT_SCALED_SIZE(&component[c]);
+        if(lines > 4 * DCTSIZE)
+            return -1;
+        layout->pitch[c] = (component[c].width_in_blocks * COMPONENT_SCALED_SIZE(&component[c]) + 31) & ~31;
+        pic->stride[c] = layout->pitch[c] * (c > 0 && !layout->compact ? layout->rows : 1);
+        offset[c] = size;
+        size += (size_t)layout->pitch[c] * lines * dinfo->total_iMCU_rows;
+    }
+
+    if((pic->buffer = malloc(size)) == NULL)
+        return -1;
+    pic->size = size;
+    for(c = 0; c < 3; c++)
+        pic->plane[c] = pic->buffer + offset[c];
+    return 0;
+}
+
+/******************************************************************************
+Description.: decode the components as libjpeg stores them, without color
+              conversion or upsampling, one row of MCUs at a time
+Input Value.: * dinfo.: decompressor with raw_data_out set and started
+              * pic...: the picture with its planes set up
+              * layout: how libjpeg writes the planes
+Return Value: -
+******************************************************************************/
+static void read_raw_planes(struct jpeg_decompress_struct *dinfo, decoded_picture *pic, const raw_layout *layout)
+{
+    JSAMPROW rows[3][4 * DCTSIZE];
+    JSAMPARRAY planes[3] = { rows[0], rows[1], rows[2] };
+    jpeg_component_info *component;
+    JDIMENSION lines, row = 0;
+    int c, i, height;
+
+    lines = dinfo->max_v_samp_factor * MIN_SCALED_SIZE(dinfo);
+    while(dinfo->output_scanline < dinfo->output_height) {
+        for(c = 0; c < 3; c++) {
+            component = &dinfo->comp_info[c];
+            height = component->v_samp_factor * COMPONENT_SCALED_SIZE(component);
+            for(i = 0; i < height; i++)
+                rows[c][i] = pic->plane[c] + ((size_t)row * height + i) * layout->pitch[c];
+        }
+
+        if(jpeg_read_raw_data(dinfo, planes, lines) == 0)
+            ERREXIT(dinfo, JERR_INPUT_EOF);
+        row++;
+    }
+}
+
+/******************************************************************************
+Description.: subsample full width chroma planes in place, the lines move
+              towards the start of the plane so nothing is overwritten early
+Input Value.: * pic...: the picture
+              * layout: how libjpeg wrote the planes
+Return Value: -
+******************************************************************************/
+static void compact_chroma(decoded_picture *pic, const raw_layout *layout)
+{
+    unsigned char *from, *to;
+    int c, x, y, width = (pic->width + 1) / 2, height = (pic->height + 1) / 2;
+
+    for(c = 1; c < 3; c++) {
+        for(y = 0; y < height; y++) {
+            from = pic->plane[c] + (size_t)y * layout->rows * layout->pitch[c];
+            to = pic->plane[c] + (size_t)y * pic->stride[c];
+            for(x = 0; x < width; x++)
+                to[x] = from[2 * x];
+        }
+    }
+}
+
+/******************************************************************************
+Description.: decode a frame into a picture of the format and scale it has
+Input Value.: * frame: the frame
+              * pic..: the picture, gets its size, planes and buffer
+Return Value: 0 if ok, -1 if the frame is broken or has no such picture
+******************************************************************************/
+static int decode_picture(input_frame *frame, decoded_picture *pic)
+{
+    struct jpeg_decompress_struct dinfo;
+    decode_error_mgr err;
+    raw_layout layout;
+    JSAMPROW row;
+    size_t luma, chroma = 0;
+
+    dinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = decode_error_exit;
+    err.pub.output_message = decode_output_message;
+    jpeg_create_decompress(&dinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_decompress(&dinfo);
+        free(pic->buffer);
+        pic->buffer = NULL;
+        return -1;
+    }
+
+    jpeg_mem_src(&dinfo, frame->buf, frame->size);
+    jpeg_read_header(&dinfo, TRUE);
+
+    dinfo.scale_num = 1;
+    dinfo.scale_denom = pic->denom;
+    dinfo.do_fancy_upsampling = FALSE;
+
+    if(pic->format == DECODE_YUV420 && dinfo.num_components == 3 && dinfo.jpeg_color_space == JCS_YCbCr) {
+        /* the planes come out of the IDCT as they are, without a color conversion */
+        dinfo.raw_data_out = TRUE;
+        dinfo.out_color_space = JCS_YCbCr;
+        jpeg_start_decompress(&dinfo);
+        pic->width = dinfo.output_width;
+        pic->height = dinfo.output_height;
+        if(setup_raw_planes(&dinfo, pic, &layout) < 0)
+            longjmp(err.setjmp_buffer, 1);
+        read_raw_planes(&dinfo, pic, &layout);
+        if(layout.compact)
+            compact_chroma(pic, &layout);
+    } else {
+        /* a gray JPEG also makes a 4:2:0 picture, with neutral chroma */
+        if(pic->format == DECODE_YUV420 && dinfo.num_components != 1)
+            longjmp(err.setjmp_buffer, 1);
+        dinfo.out_color_space = (pic->format == DECODE_RGB24) ? JCS_RGB : JCS_GRAYSCALE;
+        jpeg_start_decompress(&dinfo);
+        pic->width = dinfo.output_width;
+        pic->height = dinfo.output_height;
+        pic->stride[0] = pic->width * dinfo.output_components;
+        luma = (size_t)pic->stride[0] * pic->height;
+        if(pic->format == DECODE_YUV420) {
+            pic->stride[1] = pic->stride[2] = (pic->width + 1) / 2;
+            chroma = (size_t)pic->stride[1] * ((pic->height + 1) / 2);
+        }
+
+        if((pic->buffer = malloc(luma + 2 * chroma)) == NULL)
+            ERREXIT1(&dinfo, JERR_OUT_OF_MEMORY, 0);
+        pic->size = luma + 2 * chroma;
+        pic->plane[0] = pic->buffer;
+        if(chroma > 0) {
+            pic->plane[1] = pic->buffer + luma;
+            pic->plane[2] = pic->plane[1] + chroma;
+            memset(pic->plane[1], 128, 2 * chroma);
+        }
+
+        while(dinfo.output_scanline < dinfo.output_height) {
+            row = pic->plane[0] + (size_t)dinfo.output_scanline * pic->stride[0];
+            jpeg_read_scanlines(&dinfo, &row, 1);
+        }
+    }
+
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_decompress(&dinfo);
+    return 0;
+}
+
+#endif
+
+/******************************************************************************
+Description.: find a picture of a frame, the decode_lock is held
+Input Value.: * frame.: the frame
+              * format: frame_decode_t
+              * denom.: the scale
+Return Value: the picture, NULL if there is none yet
+******************************************************************************/
+static decoded_picture *find_picture(input_frame *frame, int format, int denom)
+{
+    decoded_picture *pic, *luma = NULL;
+
+    for(pic = frame->decoded; pic != NULL; pic = pic->next) {
+        if(pic->denom != denom)
+            continue;
+        if(pic->format == format)
+            return pic;
+        /* the luma plane of a 4:2:0 picture is the gray picture */
+        if(format == DECODE_GREY && pic->format == DECODE_YUV420 && pic->state == DECODE_READY)
+            luma = pic;
+    }
+
+    return luma;
+}
+
+/******************************************************************************
+Description.: the picture of a frame, decoded by the first plugin which asks
+              for it and shared with the others. It is at the smallest of
+              1/1, 1/2, 1/4 and 1/8 of the frame which covers the size asked
+              for, at that scale libjpeg skips most of the work.
+Input Value.: * frame.........: the frame, the caller holds a reference
+              * format........: DECODE_YUV420, DECODE_GREY or DECODE_RGB24
+              * width, height.: the smallest size wanted, 0 for the whole frame
+Return Value: the picture, valid while the caller holds the frame, NULL if the
+              frame can not be decoded to it. For DECODE_GREY it may be a
+              4:2:0 picture, its plane[0] is the gray picture.
+******************************************************************************/
+const decoded_picture *frame_decode(input_frame *frame, int format, int width, int height)
+{
+    decoded_picture *pic;
+    int denom, state, cancel;
+
+    if(frame == NULL || format < DECODE_YUV420 || format > DECODE_RGB24)
+        return NULL;
+    if((denom = choose_denom(frame, width, height)) < 0)
+        return NULL;
+
+    /* neither the wait with the lock nor a half decoded picture may be cancelled */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
+    pthread_mutex_lock(&decode_lock);
+
+    while((pic = find_picture(frame, format, denom)) != NULL && pic->state == DECODE_PENDING)
+        pthread_cond_wait(&decode_done, &decode_lock);
+
+    /* the first one decodes without the lock, the others wait for it above */
+    if(pic == NULL && (pic = calloc(1, sizeof(*pic))) != NULL) {
+        pic->format = format;
+        pic->denom = denom;
+        pic->state = DECODE_PENDING;
+        pic->next = frame->decoded;
+        frame->decoded = pic;
+        pthread_mutex_unlock(&decode_lock);
+
+        state = (decode_picture(frame, pic) == 0) ? DECODE_READY : DECODE_FAILED;
+        if(state == DECODE_READY)
+            memory_add(&decode_memory, pic->size);
+
+        pthread_mutex_lock(&decode_lock);
+        pic->state = state;
+        pthread_cond_broadcast(&decode_done);
+    }
+
+    pthread_mutex_unlock(&decode_lock);
+    pthread_setcancelstate(cancel, NULL);
+
+    return (pic != NULL && pic->state == DECODE_READY) ? pic : NULL;
+}
+
+/******************************************************************************
+Description.: free the pictures of a frame, called with its last reference
+Input Value.: the frame
+Return Value: -
+******************************************************************************/
+void frame_decode_free(input_frame *frame)
+{
+    decoded_picture *pic;
+
+    while((pic = frame->decoded) != NULL) {
+        frame->decoded = pic->next;
+        if(pic->state == DECODE_READY)
+            memory_add(&decode_memory, -(long long)pic->size);
+        free(pic->buffer);
+        free(pic);
+    }
+}
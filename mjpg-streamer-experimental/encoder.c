@@ -0,0 +1,519 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * slice-parallel JPEG encoding for input plugins
+ *
+ * A picture is cut into horizontal slices which are encoded as JPEGs of their
+ * own on several threads at once. Each one starts with fresh DC predictions,
+ * just like the data after a restart marker does, so their entropy coded
+ * segments are joined with RSTn markers in between. The headers of the first
+ * slice get the full height and a DRI marker announcing the slice size.
+ *
+ * The encoding itself is left to the plugin, this file does not depend on
+ * libjpeg and works with any encoder that writes baseline or extended
+ * sequential JPEGs.
+ *
+ * The rate control at the end of this file picks the quality of software
+ * encoders from the sizes of their last frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+/* slices hold a multiple of this many lines, the MCU height of 4:2:0 */
+#define SLICE_ALIGN 16
+
+#define M_SOF0 0xc0
+#define M_SOF1 0xc1
+#define M_SOF2 0xc2
+#define M_RST0 0xd0
+#define M_SOI  0xd8
+#define M_EOI  0xd9
+#define M_SOS  0xda
+#define M_DRI  0xdd
+
+/* rate control: a JPEG roughly doubles in size every RATE_GAIN quality steps */
+#define RATE_GAIN 12.0
+#define RATE_MAX_DOWN 20.0      /* quality steps a single frame may take away */
+#define RATE_MAX_UP 2.0         /* quality steps a single frame may add */
+#define RATE_HEADROOM 0.8       /* the quality only rises below this part of the budget */
+#define RATE_DAMPING 0.5        /* part of a bitrate error corrected with one frame */
+#define RATE_SMOOTHING 0.25     /* weight of a new frame in the average frame interval */
+#define RATE_MIN_QUALITY 10
+
+typedef struct {
+    unsigned char *data;
+    int size;                   /* bytes allocated */
+    int len;                    /* bytes of the encoded slice, -1 on errors */
+} jpeg_slice;
+
+struct _jpeg_encoder {
+    int threads;                /* workers plus the calling thread */
+    pthread_t *workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;       /* a new picture is ready */
+    pthread_cond_t done;        /* the last slice is finished */
+    unsigned int generation;    /* counts the pictures */
+    int stop;
+
+    /* the picture being encoded */
+    jpeg_slice_fn fn;
+    void *arg;
+    int height;
+    int lines;                  /* lines per slice */
+    int count;                  /* number of slices */
+    int next;                   /* next slice to encode */
+    int pending;                /* slices not finished yet */
+    jpeg_slice *slices;
+};
+
+/******************************************************************************
+Description.: encode the slices of the current picture until none is left,
+              the mutex must be held
+Input Value.: the encoder
+Return Value: -
+******************************************************************************/
+static void encode_slices(jpeg_encoder *enc)
+{
+    jpeg_slice *s;
+    int i, first;
+
+    while(enc->next < enc->count) {
+        i = enc->next++;
+        s = &enc->slices[i];
+        first = i * enc->lines;
+
+        pthread_mutex_unlock(&enc->mutex);
+        s->len = enc->fn(enc->arg, first, MIN(enc->lines, enc->height - first), s->data, s->size);
+        pthread_mutex_lock(&enc->mutex);
+
+        if(--enc->pending == 0)
+            pthread_cond_signal(&enc->done);
+    }
+}
+
+/******************************************************************************
+Description.: a worker thread of the encoder
+Input Value.: the encoder
+Return Value: NULL
+******************************************************************************/
+static void *encoder_thread(void *arg)
+{
+    jpeg_encoder *enc = arg;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&enc->mutex);
+    while(1) {
+        while(!enc->stop && enc->generation == generation)
+            pthread_cond_wait(&enc->start, &enc->mutex);
+        if(enc->stop)
+            break;
+
+        generation = enc->generation;
+        encode_slices(enc);
+    }
+    pthread_mutex_unlock(&enc->mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: create an encoder
+Input Value.: number of threads encoding a picture, including the caller
+Return Value: the encoder or NULL on errors
+******************************************************************************/
+jpeg_encoder *jpeg_encoder_new(int threads)
+{
+    jpeg_encoder *enc;
+    int i;
+
+    if(threads < 1 || (enc = calloc(1, sizeof(jpeg_encoder))) == NULL)
+        return NULL;
+
+    if((enc->slices = calloc(threads, sizeof(jpeg_slice))) == NULL ||
+       (enc->workers = calloc(threads, sizeof(pthread_t))) == NULL) {
+        free(enc->slices);
+        free(enc);
+        return NULL;
+    }
+
+    pthread_mutex_init(&enc->mutex, NULL);
+    pthread_cond_init(&enc->start, NULL);
+    pthread_cond_init(&enc->done, NULL);
+
+    /* the calling thread encodes a slice as well */
+    enc->threads = 1;
+    for(i = 1; i < threads; i++) {
+        if(pthread_create(&enc->workers[i], NULL, encoder_thread, enc) != 0) {
+            LOG("could not start encoder thread %d\n", i);
+            break;
+        }
+        enc->threads++;
+    }
+
+    return enc;
+}
+
+/******************************************************************************
+Description.: stop the threads of an encoder and free it
+Input Value.: the encoder, may be NULL
+Return Value: -
+******************************************************************************/
+void jpeg_encoder_free(jpeg_encoder *enc)
+{
+    int i;
+
+    if(enc == NULL)
+        return;
+
+    pthread_mutex_lock(&enc->mutex);
+    enc->stop = 1;
+    pthread_cond_broadcast(&enc->start);
+    pthread_mutex_unlock(&enc->mutex);
+
+    for(i = 1; i < enc->threads; i++)
+        pthread_join(enc->workers[i], NULL);
+
+    for(i = 0; i < enc->threads; i++)
+        free(enc->slices[i].data);
+
+    pthread_cond_destroy(&enc->done);
+    pthread_cond_destroy(&enc->start);
+    pthread_mutex_destroy(&enc->mutex);
+    free(enc->workers);
+    free(enc->slices);
+    free(enc);
+}
+
+/******************************************************************************
+Description.: find the start of the entropy coded data of a JPEG
+Input Value.: * data: the JPEG
+              * len.: its length
+              * sof.: set to the offset of the SOF marker
+Return Value: offset of the SOS marker, -1 if the JPEG can not be parsed
+******************************************************************************/
+static int find_scan(const unsigned char *data, int len, int *sof)
+{
+    int pos = 2;
+
+    *sof = -1;
+    if(len < 4 || data[0] != 0xff || data[1] != M_SOI)
+        return -1;
+
+    while(pos + 4 <= len && data[pos] == 0xff) {
+        if(data[pos + 1] == M_SOS)
+            return pos;
+        if(data[pos + 1] == M_SOF0 || data[pos + 1] == M_SOF1)
+            *sof = pos;
+        if(data[pos + 1] == M_SOF2)
+            return -1;          /* progressive JPEGs have several scans */
+        pos += 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: join the encoded slices to a single JPEG
+Input Value.: * enc...: the encoder holding the slices
+              * buffer: destination
+              * size..: bytes available
+Return Value: length of the JPEG, -1 on errors
+******************************************************************************/
+static int join_slices(jpeg_encoder *enc, unsigned char *buffer, int size)
+{
+    const unsigned char *data = enc->slices[0].data;
+    int len = enc->slices[0].len;
+    int sof, sos, pos, out, i, c, n;
+    int width, hmax = 1, vmax = 1, interval;
+    jpeg_slice *s;
+
+    if((sos = find_scan(data, len, &sof)) < 0 || sof < 0)
+        return -1;
+
+    /* the restart interval counts MCUs, a slice holds lines / MCU height rows of them */
+    width = (data[sof + 7] << 8) | data[sof + 8];
+    for(c = 0; c < data[sof + 9]; c++) {
+        hmax = MAX(hmax, data[sof + 11 + 3 * c] >> 4);
+        vmax = MAX(vmax, data[sof + 11 + 3 * c] & 0x0f);
+    }
+    interval = (width + 8 * hmax - 1) / (8 * hmax) * (enc->lines / (8 * vmax));
+    if(enc->lines % (8 * vmax) != 0 || interval > 0xffff)
+        return -1;
+
+    /* the headers of the first slice, without a DRI marker it may have */
+    out = 0;
+    for(pos = 0; pos < sos; pos += n) {
+        n = (pos == 0) ? 2 : 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+        if(pos != 0 && data[pos + 1] == M_DRI)
+            continue;
+        if(out + n > size)
+            return -1;
+        memcpy(buffer + out, data + pos, n);
+        if(pos == sof) {
+            buffer[out + 5] = enc->height >> 8;
+            buffer[out + 6] = enc->height & 0xff;
+        }
+        out += n;
+    }
+
+    if(out + 6 > size)
+        return -1;
+    buffer[out++] = 0xff;
+    buffer[out++] = M_DRI;
+    buffer[out++] = 0;
+    buffer[out++] = 4;
+    buffer[out++] = interval >> 8;
+    buffer[out++] = interval & 0xff;
+
+    /* the SOS header and the scan of each slice, up to its EOI */
+    for(i = 0; i < enc->count; i++) {
+        s = &enc->slices[i];
+        if(s->len < 4 || s->data[s->len - 2] != 0xff || s->data[s->len - 1] != M_EOI ||
+           (pos = find_scan(s->data, s->len, &sof)) < 0)
+            return -1;
+
+        if(i > 0) {
+            /* skip the SOS header, the one of the first slice is valid for all */
+            pos += 2 + ((s->data[pos + 2] << 8) | s->data[pos + 3]);
+            if(out + 2 > size)
+                return -1;
+            buffer[out++] = 0xff;
+            buffer[out++] = M_RST0 + ((i - 1) & 7);
+        }
+
+        n = s->len - 2 - pos;
+        if(out + n + 2 > size)
+            return -1;
+        memcpy(buffer + out, s->data + pos, n);
+        out += n;
+    }
+
+    buffer[out++] = 0xff;
+    buffer[out++] = M_EOI;
+    return out;
+}
+
+/******************************************************************************
+Description.: Encode a picture in slices on the threads of the encoder.
+              fn is called for consecutive ranges of lines and has to store
+              them as a complete JPEG of this height. It must be reentrant
+              and use the same tables and sampling for all slices. Each
+              slice gets at most size bytes.
+Input Value.: * enc...: the encoder
+              * fn....: encodes some lines of the picture
+              * arg...: passed to fn
+              * height: number of lines of the picture
+              * buffer: destination of the JPEG
+              * size..: bytes available in buffer
+Return Value: length of the JPEG, -1 on errors
+******************************************************************************/
+int jpeg_encoder_encode(jpeg_encoder *enc, jpeg_slice_fn fn, void *arg, int height, unsigned char *buffer, int size)
+{
+    int i, lines, len;
+
+    /* slices of less than two MCU rows are not worth a thread */
+    lines = (height + enc->threads - 1) / enc->threads;
+    lines = (lines + SLICE_ALIGN - 1) / SLICE_ALIGN * SLICE_ALIGN;
+    if(enc->threads == 1 || lines >= height || lines < 2 * SLICE_ALIGN)
+        return fn(arg, 0, height, buffer, size);
+
+    pthread_mutex_lock(&enc->mutex);
+
+    for(i = 0; i < enc->threads; i++) {
+        if(enc->slices[i].size < size) {
+            free(enc->slices[i].data);
+            if((enc->slices[i].data = malloc(size)) == NULL) {
+                enc->slices[i].size = 0;
+                pthread_mutex_unlock(&enc->mutex);
+                return fn(arg, 0, height, buffer, size);
+            }
+            enc->slices[i].size = size;
+        }
+    }
+
+    enc->fn = fn;
+    enc->arg = arg;
+    enc->height = height;
+    enc->lines = lines;
+    enc->count = (height + lines - 1) / lines;
+    enc->next = 0;
+    enc->pending = enc->count;
+    enc->generation++;
+    pthread_cond_broadcast(&enc->start);
+
+    encode_slices(enc);
+    while(enc->pending > 0)
+        pthread_cond_wait(&enc->done, &enc->mutex);
+
+    for(i = 0; i < enc->count; i++) {
+        if(enc->slices[i].len < 0)
+            break;
+    }
+    len = (i == enc->count) ? join_slices(enc, buffer, size) : -1;
+
+    pthread_mutex_unlock(&enc->mutex);
+
+    /* something about the slices did not fit, encode it as a whole */
+    if(len < 0) {
+        DBG("could not join the slices, encoding the picture at once\n");
+        return fn(arg, 0, height, buffer, size);
+    }
+
+    return len;
+}
+
+/******************************************************************************
+Description.: set up the rate control of an input, its "JPEG quality" control
+              is added if the plugin did not register one
+Input Value.: * rc......: the rate control
+              * in......: the input
+              * quality.: the configured quality, the highest one used
+              * kbps....: bitrate to stay below, 0 for no limit
+              * max_size: bytes a frame should stay below, 0 for no limit
+Return Value: -
+******************************************************************************/
+void rate_control_init(rate_control *rc, input *in, int quality, int kbps, int max_size)
+{
+    control *ctrls;
+    int i;
+
+    memset(rc, 0, sizeof(rate_control));
+    rc->kbps = kbps;
+    rc->max_size = max_size;
+    rc->max_quality = quality;
+    rc->quality = quality;
+
+    for(i = 0; i < in->parametercount; i++) {
+        if(in->in_parameters[i].group == IN_CMD_JPEG_QUALITY)
+            break;
+    }
+
+    if(i == in->parametercount) {
+        if((ctrls = realloc(in->in_parameters, (i + 1) * sizeof(control))) == NULL)
+            return;
+        in->in_parameters = ctrls;
+        memset(&ctrls[i], 0, sizeof(control));
+        ctrls[i].ctrl.id = 1;
+        snprintf((char *)ctrls[i].ctrl.name, sizeof(ctrls[i].ctrl.name), "JPEG quality");
+        ctrls[i].ctrl.minimum = 0;
+        ctrls[i].ctrl.maximum = 100;
+        ctrls[i].ctrl.step = 1;
+        ctrls[i].ctrl.default_value = quality;
+        ctrls[i].ctrl.type = V4L2_CTRL_TYPE_INTEGER;
+        ctrls[i].group = IN_CMD_JPEG_QUALITY;
+        in->parametercount++;
+    }
+
+    rc->ctrl = &in->in_parameters[i];
+    rc->ctrl->value = quality;
+}
+
+/******************************************************************************
+Description.: change the configured quality, e.g. through IN_CMD_JPEG_QUALITY
+Input Value.: * rc.....: the rate control
+              * quality: the new highest quality
+Return Value: -
+******************************************************************************/
+void rate_control_set_quality(rate_control *rc, int quality)
+{
+    rc->max_quality = quality;
+    rc->quality = quality;
+    if(rc->ctrl != NULL)
+        rc->ctrl->value = quality;
+}
+
+/******************************************************************************
+Description.: the base 2 logarithm, good enough for the rate control and
+              without depending on libm
+Input Value.: a positive number
+Return Value: log2(x), linear between powers of two
+******************************************************************************/
+static double octaves(double x)
+{
+    double n = 0;
+
+    while(x >= 2) {
+        x /= 2;
+        n++;
+    }
+    while(x < 1) {
+        x *= 2;
+        n--;
+    }
+
+    return n + (x - 1);
+}
+
+/******************************************************************************
+Description.: count an encoded frame and pick the quality of the next one.
+              Errors of the bitrate are corrected over a few frames, a frame
+              above the size limit lowers the quality at once so the next
+              frames fit again.
+Input Value.: * rc..: the rate control
+              * size: bytes of the frame that was just encoded
+Return Value: the quality for the next frame
+******************************************************************************/
+int rate_control_update(rate_control *rc, int size)
+{
+    unsigned long long now = monotonic_usec();
+    double ratio = 0, step = 0, down = 0;
+
+    if(rc->kbps <= 0 && rc->max_size <= 0)
+        return rc->max_quality;
+
+    if(rc->last_usec != 0) {
+        double interval = (double)(now - rc->last_usec);
+        rc->interval = (rc->interval == 0) ? interval : rc->interval + (interval - rc->interval) * RATE_SMOOTHING;
+    }
+    rc->last_usec = now;
+
+    /* how far the frame is above (> 1) or below (< 1) the budget */
+    if(rc->kbps > 0 && rc->interval > 0) {
+        ratio = size / (rc->kbps * 125.0 * rc->interval / 1000000.0);
+        if(ratio > 1)
+            down = RATE_DAMPING * RATE_GAIN * octaves(ratio);
+    }
+    if(rc->max_size > 0 && (double)size / rc->max_size > ratio) {
+        ratio = (double)size / rc->max_size;
+        if(ratio > 1)
+            down = MAX(down, RATE_GAIN * octaves(ratio));
+    }
+
+    if(down > 0)
+        step = -MIN(down, RATE_MAX_DOWN);
+    else if(ratio > 0 && ratio < RATE_HEADROOM)
+        step = MIN(RATE_DAMPING * RATE_GAIN * octaves(RATE_HEADROOM / ratio), RATE_MAX_UP);
+
+    rc->quality = MIN(MAX(rc->quality + step, RATE_MIN_QUALITY), rc->max_quality);
+    if(rc->ctrl != NULL)
+        rc->ctrl->value = (int)(rc->quality + 0.5);
+
+    return (int)(rc->quality + 0.5);
+}
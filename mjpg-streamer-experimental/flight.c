@@ -0,0 +1,428 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Flight recorder of the frame events
+ *
+ * Each thread records into a ring of its own, found through a thread local
+ * pointer, so recording takes no lock and no atomic read-modify-write: the
+ * event is written into the next slot and the count of the ring is stored
+ * with release semantics. A trace reads the rings while they are written; it
+ * copies the events, reads the count again and drops the copies which the
+ * writer may have overwritten meanwhile, with a margin of FLIGHT_MARGIN
+ * slots for writes which were not visible yet.
+ *
+ * Rings are taken from a list which only grows, up to FLIGHT_RINGS of them.
+ * A thread takes a ring with its first event and gives it back when it ends,
+ * the ring keeps its events until a new thread takes it over. Beyond the
+ * limit new threads take the ring of an ended thread which was idle for the
+ * longest time, or record nothing while all rings are in use.
+ *
+ * SIGUSR1 only writes a byte into a pipe, a thread of flight_start() waits
+ * on it and writes the trace into a file of the folder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/syscall.h>
+
+#include "mjpg_streamer.h"
+
+#define FLIGHT_MARGIN 16
+
+typedef struct _flight_ring flight_ring;
+struct _flight_ring {
+    flight_ring *next;              // the list of all rings, never freed
+    int used;                       // a thread records into it
+    int tid;                        // of the thread which recorded last
+    unsigned long long count;       // events recorded since the thread took it
+    flight_event events[FLIGHT_EVENTS];
+};
+
+static flight_ring *rings;
+static int ring_count;
+static __thread flight_ring *own;
+static __thread int no_ring;        // all rings were in use
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static const char *folder;
+static int dump_seconds;
+static int wake[2] = { -1, -1 };
+
+/******************************************************************************
+Description.: give the ring of a thread back when the thread ends
+Input Value.: the ring
+Return Value: -
+******************************************************************************/
+static void ring_release(void *arg)
+{
+    flight_ring *r = arg;
+
+    __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+Description.: create the key which gives rings back
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+/******************************************************************************
+Description.: find a ring for the calling thread
+Input Value.: -
+Return Value: the ring, NULL if all of them are in use
+******************************************************************************/
+static flight_ring *ring_take(void)
+{
+    flight_ring *r, *oldest;
+    unsigned long long last, oldest_usec;
+    int unused = 0;
+
+    pthread_once(&ring_once, ring_key_create);
+
+    while(1) {
+        /* a new one while there may be more */
+        if(__atomic_load_n(&ring_count, __ATOMIC_RELAXED) < FLIGHT_RINGS &&
+           __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED) < FLIGHT_RINGS) {
+            if((r = calloc(1, sizeof(flight_ring))) == NULL)
+                return NULL;
+            r->used = 1;
+            r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+            while(!__atomic_compare_exchange_n(&rings, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+            break;
+        }
+
+        /* otherwise the one of the thread which ended first */
+        oldest = NULL;
+        oldest_usec = ~0ULL;
+        for(r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+            if(__atomic_load_n(&r->used, __ATOMIC_ACQUIRE))
+                continue;
+            last = (r->count > 0) ? r->events[(r->count - 1) % FLIGHT_EVENTS].usec : 0;
+            if(last < oldest_usec) {
+                oldest = r;
+                oldest_usec = last;
+            }
+        }
+        if(oldest == NULL)
+            return NULL;
+        if(__atomic_compare_exchange_n(&oldest->used, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            r = oldest;
+            __atomic_store_n(&r->count, 0, __ATOMIC_RELEASE);
+            break;
+        }
+        unused = 0;
+    }
+
+    r->tid = (int)syscall(SYS_gettid);
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+/******************************************************************************
+Description.: record an event into the ring of the calling thread
+Input Value.: * type..: of the event
+              * input.: number of the input of the frame
+              * seq...: sequence number of the frame
+              * usec..: monotonic_usec() of the event, 0 for now
+              * a.....: value of the event, see flight_type
+              * output: plugin sending the frame, -1 for others
+              * fd....: socket sending the frame, -1 for others
+Return Value: -
+******************************************************************************/
+void flight_record(flight_type type, int input, unsigned long long seq, unsigned long long usec,
+                   unsigned long long a, int output, int fd)
+{
+    flight_ring *r = own;
+    flight_event *e;
+
+    if(r == NULL) {
+        if(no_ring || (r = own = ring_take()) == NULL) {
+            no_ring = 1;
+            return;
+        }
+    }
+
+    e = &r->events[r->count % FLIGHT_EVENTS];
+    e->usec = (usec != 0) ? usec : monotonic_usec();
+    e->seq = seq;
+    e->a = a;
+    e->fd = fd;
+    e->output = output;
+    e->input = input;
+    e->type = type;
+    __atomic_store_n(&r->count, r->count + 1, __ATOMIC_RELEASE);
+
+    /* a dropped frame is an event of its own in the trace */
+    if(type == FLIGHT_ACQUIRE && a > 0)
+        flight_record(FLIGHT_DROP, input, seq, e->usec, a, output, fd);
+}
+
+/******************************************************************************
+Description.: copy the events of a ring which are still intact
+Input Value.: * r.....: the ring
+              * copy..: FLIGHT_EVENTS events
+Return Value: number of events copied, oldest first
+******************************************************************************/
+static int ring_copy(flight_ring *r, flight_event *copy)
+{
+    unsigned long long before, after, first, i;
+    int n = 0;
+
+    before = __atomic_load_n(&r->count, __ATOMIC_ACQUIRE);
+    first = (before > FLIGHT_EVENTS) ? before - FLIGHT_EVENTS : 0;
+    for(i = first; i < before; i++)
+        copy[i - first] = r->events[i % FLIGHT_EVENTS];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&r->count, __ATOMIC_ACQUIRE);
+
+    /* the thread ended and the ring started over for another one */
+    if(after < before)
+        return 0;
+
+    /* slots the writer went on to since the copy began */
+    if(after + FLIGHT_MARGIN > first + FLIGHT_EVENTS) {
+        n = (int)(after + FLIGHT_MARGIN - first - FLIGHT_EVENTS);
+        if(n >= (int)(before - first))
+            return 0;
+        memmove(copy, copy + n, (before - first - n) * sizeof(flight_event));
+    }
+    return (int)(before - first) - n;
+}
+
+/******************************************************************************
+Description.: write the common fields of a trace event
+Input Value.: * f....: the trace
+              * name.: of the event
+              * ph...: its phase in the trace event format
+              * tid..: thread which recorded it
+              * e....: the event
+              * comma: nonzero after the first event
+Return Value: -
+******************************************************************************/
+static void write_event(FILE *f, const char *name, const char *ph, int tid, const flight_event *e, int comma)
+{
+    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"input\":%d,\"seq\":%llu",
+            comma ? "," : "", name, ph, e->usec, (int)getpid(), tid, e->input, e->seq);
+}
+
+/******************************************************************************
+Description.: write the events of the last seconds of all rings as a trace
+              in the Chrome trace event format
+Input Value.: * f......: where to write it
+              * seconds: how far back, 0 for all events kept
+Return Value: number of events written, -1 without memory
+******************************************************************************/
+int flight_write(FILE *f, int seconds)
+{
+    static const char *names[FLIGHT_TYPES] = {
+        "capture", "encode", "encode", "publish", "acquire", "drop", "send", "send"
+    };
+    unsigned long long since = 0, now = monotonic_usec();
+    flight_event *copy;
+    flight_ring *r;
+    const flight_event *e;
+    char label[48];
+    int i, n, written = 0, named, comma = 0;
+
+    if((copy = malloc(FLIGHT_EVENTS * sizeof(flight_event))) == NULL)
+        return -1;
+    if(seconds > 0 && now > seconds * 1000000ULL)
+        since = now - seconds * 1000000ULL;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for(r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        n = ring_copy(r, copy);
+        named = 0;
+
+        /* the thread is named after what it did: serve a client, run an input or else */
+        snprintf(label, sizeof(label), "thread %d", r->tid);
+        for(i = n - 1; i >= 0; i--) {
+            if(copy[i].output >= 0) {
+                snprintf(label, sizeof(label), "output %d, client fd %d", copy[i].output, copy[i].fd);
+                break;
+            }
+            if(copy[i].type <= FLIGHT_PUBLISH)
+                snprintf(label, sizeof(label), "input %d", copy[i].input);
+        }
+        for(i = 0; i < n; i++) {
+            e = &copy[i];
+            if(e->usec < since || e->type >= FLIGHT_TYPES)
+                continue;
+
+            if(!named) {
+                fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        comma ? "," : "", (int)getpid(), r->tid, label);
+                named = comma = 1;
+            }
+
+            switch(e->type) {
+            case FLIGHT_CAPTURE:
+                /* from the capture by the driver until the input got the frame */
+                write_event(f, names[e->type], "X", r->tid, e, comma);
+                fprintf(f, ",\"dequeue_usec\":%llu},\"dur\":%llu}", e->a, (e->a > e->usec) ? e->a - e->usec : 0);
+                break;
+            case FLIGHT_ENCODE_START:
+            case FLIGHT_SEND_START:
+                write_event(f, names[e->type], "B", r->tid, e, comma);
+                if(e->output >= 0)
+                    fprintf(f, ",\"output\":%d,\"fd\":%d", e->output, e->fd);
+                fprintf(f, "}}");
+                break;
+            case FLIGHT_ENCODE_END:
+            case FLIGHT_SEND_END:
+                write_event(f, names[e->type], "E", r->tid, e, comma);
+                fprintf(f, ",\"size\":%llu}}", e->a);
+                break;
+            case FLIGHT_PUBLISH:
+                write_event(f, names[e->type], "i", r->tid, e, comma);
+                fprintf(f, ",\"size\":%llu},\"s\":\"p\"}", e->a);
+                break;
+            default:
+                write_event(f, names[e->type], "i", r->tid, e, comma);
+                fprintf(f, ",\"skipped\":%llu},\"s\":\"t\"}", e->a);
+                break;
+            }
+            written++;
+            comma = 1;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    free(copy);
+    return written;
+}
+
+/******************************************************************************
+Description.: parse the argument of --trace, a folder and optionally the
+              seconds of events to write, e.g. /var/log/mjpg,30
+Input Value.: * arg....: the argument
+              * folder.: gets the folder, to be freed
+              * seconds: gets the seconds, FLIGHT_SECONDS if not given
+Return Value: 0 on success, -1 if the argument is invalid
+******************************************************************************/
+int flight_parse(const char *arg, char **folder, int *seconds)
+{
+    const char *comma = strrchr(arg, ',');
+    char *end;
+
+    *seconds = FLIGHT_SECONDS;
+    if(comma != NULL) {
+        *seconds = strtol(comma + 1, &end, 10);
+        if(end == comma + 1 || *end != '\0' || *seconds < 0)
+            return -1;
+    } else {
+        comma = arg + strlen(arg);
+    }
+
+    if(comma == arg || (*folder = strndup(arg, comma - arg)) == NULL)
+        return -1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: wake the trace thread, the only work of the signal handler
+Input Value.: the signal
+Return Value: -
+******************************************************************************/
+static void flight_signal(int sig)
+{
+    int saved = errno;
+    char c = 1;
+
+    if(write(wake[1], &c, 1) < 0) {
+        /* a trace is being written already */
+    }
+    errno = saved;
+}
+
+/******************************************************************************
+Description.: write a trace into the folder whenever SIGUSR1 arrives
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *flight_thread(void *arg)
+{
+    char path[PATH_MAX], c;
+    struct timespec ts;
+    FILE *f;
+    int n;
+
+    while(read(wake[0], &c, 1) >= 0 || errno == EINTR) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        snprintf(path, sizeof(path), "%s/mjpg-streamer-trace-%d-%lld.json", folder, (int)getpid(), (long long)ts.tv_sec);
+        if((f = fopen(path, "w")) == NULL) {
+            LOG("could not write the trace %s: %s\n", path, strerror(errno));
+            continue;
+        }
+        n = flight_write(f, dump_seconds);
+        if(fclose(f) != 0 || n < 0) {
+            LOG("could not write the trace %s\n", path);
+        } else {
+            LOG("wrote %d events of the flight recorder to %s\n", n, path);
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: write the events of the last seconds into a file of a folder
+              on SIGUSR1
+Input Value.: * dir....: the folder
+              * seconds: of events to write, 0 for all kept
+Return Value: 0 on success, -1 otherwise
+******************************************************************************/
+int flight_start(const char *dir, int seconds)
+{
+    struct sigaction sa;
+    pthread_t thread;
+
+    folder = dir;
+    dump_seconds = seconds;
+    if(pipe(wake) < 0)
+        return -1;
+    fcntl(wake[1], F_SETFL, O_NONBLOCK);
+    fcntl(wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(wake[1], F_SETFD, FD_CLOEXEC);
+
+    if(pthread_create(&thread, NULL, flight_thread, NULL) != 0)
+        return -1;
+    pthread_detach(thread);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = flight_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGUSR1, &sa, NULL);
+}
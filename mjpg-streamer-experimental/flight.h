@@ -0,0 +1,86 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdio.h>
+
+/*
+ * flight recorder of the frame events, always on. The probes of probes.h
+ * also record their event into a ring of the calling thread, so a trace of
+ * the last seconds can be written after an intermittent stall without a
+ * tracer having been attached: on SIGUSR1 into a file, see flight_start(),
+ * or over HTTP with flight_write(). The trace is JSON in the Chrome trace
+ * event format, which Perfetto and chrome://tracing open.
+ *
+ * A ring keeps the last FLIGHT_EVENTS events of its thread. At most
+ * FLIGHT_RINGS threads record at a time, the rings of threads which ended
+ * are kept for the trace until a new thread needs one.
+ */
+#define FLIGHT_EVENTS 1024
+#define FLIGHT_RINGS 256
+#define FLIGHT_SECONDS 10           // of events written on SIGUSR1 by default
+
+typedef enum {
+    FLIGHT_CAPTURE,                 // a = dequeue_usec, the event is at capture_usec
+    FLIGHT_ENCODE_START,
+    FLIGHT_ENCODE_END,              // a = size
+    FLIGHT_PUBLISH,                 // a = size
+    FLIGHT_ACQUIRE,                 // a = frames skipped
+    FLIGHT_DROP,                    // a = frames skipped, recorded along with FLIGHT_ACQUIRE
+    FLIGHT_SEND_START,
+    FLIGHT_SEND_END,                // a = size
+    FLIGHT_TYPES
+} flight_type;
+
+typedef struct {
+    unsigned long long usec;        // monotonic_usec()
+    unsigned long long seq;         // of the frame
+    unsigned long long a;           // by type, see above
+    int fd;                         // of the client of a send
+    short output;                   // plugin sending the frame
+    unsigned char input;
+    unsigned char type;
+} flight_event;
+
+void flight_record(flight_type type, int input, unsigned long long seq, unsigned long long usec,
+                   unsigned long long a, int output, int fd);
+int flight_write(FILE *f, int seconds);
+int flight_parse(const char *arg, char **folder, int *seconds);
+int flight_start(const char *folder, int seconds);
+
+/* the events of the probes of probes.h */
+#define FLIGHT_capture(input, seq, capture_usec, dequeue_usec) \
+    flight_record(FLIGHT_CAPTURE, input, seq, capture_usec, dequeue_usec, -1, -1)
+#define FLIGHT_encode_start(input, seq) \
+    flight_record(FLIGHT_ENCODE_START, input, seq, 0, 0, -1, -1)
+#define FLIGHT_encode_end(input, seq, size) \
+    flight_record(FLIGHT_ENCODE_END, input, seq, 0, size, -1, -1)
+#define FLIGHT_publish(input, seq, size, publish_usec) \
+    flight_record(FLIGHT_PUBLISH, input, seq, publish_usec, size, -1, -1)
+#define FLIGHT_acquire(input, seq, skipped) \
+    flight_record(FLIGHT_ACQUIRE, input, seq, 0, skipped, -1, -1)
+#define FLIGHT_send_start(input, seq, output, fd) \
+    flight_record(FLIGHT_SEND_START, input, seq, 0, 0, output, fd)
+#define FLIGHT_send_end(input, seq, output, fd, size) \
+    flight_record(FLIGHT_SEND_END, input, seq, 0, size, output, fd)
+
+#endif
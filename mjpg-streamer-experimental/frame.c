@@ -0,0 +1,1363 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "mjpg_streamer.h"
+#include "probes.h"
+
+/*
+ * frames are rented from a pool of power of two sized blocks, from 4 kB
+ * (class 0) up to 64 MB. Released blocks are kept for reuse so a stream
+ * with a steady frame size stops hitting the allocator and page faults
+ * after the first few frames. Bigger frames fall back to malloc().
+ *
+ * Each NUMA node has free lists of its own, a block goes back to the list
+ * of the node it was allocated on, whichever thread releases it.
+ *
+ * With --lock-memory new blocks are faulted in when they are mapped, not
+ * by the first frame written into them, and with ,huge the blocks of
+ * POOL_HUGE_SIZE and more come from the hugetlb pages the system reserved.
+ */
+#define POOL_MIN_SHIFT  12
+#define POOL_CLASSES    15
+#define POOL_MAX_FREE   16
+#define POOL_HUGE_SIZE  (2 * 1024 * 1024)
+
+typedef struct _pool_block pool_block;
+struct _pool_block {
+    pool_block *next;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_block *pool_free[NUMA_MAX_NODES][POOL_CLASSES];
+static int pool_count[NUMA_MAX_NODES][POOL_CLASSES];
+
+/* the released blocks, they are the first to go over the memory budget */
+static long long pool_evict(void *arg, long long bytes);
+static memory_account pool_memory = MEMORY_ACCOUNT("pool", MEMORY_POOL, pool_evict, NULL);
+
+/******************************************************************************
+Description.: find the smallest size class which fits a number of bytes
+Input Value.: bytes to store, including the frame header
+Return Value: the size class or -1 if it is too big for the pool
+******************************************************************************/
+static int pool_class_of(size_t bytes)
+{
+    int class = 0;
+
+    while(((size_t)1 << (POOL_MIN_SHIFT + class)) < bytes) {
+        if(++class == POOL_CLASSES)
+            return -1;
+    }
+
+    return class;
+}
+
+/******************************************************************************
+Description.: the free lists of a node
+Input Value.: the node, -1 for the one the calling thread runs on
+Return Value: the index of the lists
+******************************************************************************/
+static int pool_node(int node)
+{
+    if(node < 0)
+        node = numa_current_node();
+    return (node >= 0 && node < NUMA_MAX_NODES) ? node : 0;
+}
+
+/******************************************************************************
+Description.: fault in the pages of a new block, once its node and page size
+              are settled
+Input Value.: * block: the block
+              * size.: its size
+Return Value: -
+******************************************************************************/
+static void pool_fault_in(void *block, size_t size)
+{
+    volatile unsigned char *page = block;
+    size_t offset;
+
+    #ifdef MADV_POPULATE_WRITE
+    if(madvise(block, size, MADV_POPULATE_WRITE) == 0)
+        return;
+    #endif
+    for(offset = 0; offset < size; offset += 1 << POOL_MIN_SHIFT)
+        page[offset] = 0;
+}
+
+/******************************************************************************
+Description.: get a block of a size class, reuse a released one if possible
+Input Value.: * class: size class
+              * node.: gets the node of the block, is the node to allocate
+                       on or -1 for the one of the calling thread
+Return Value: the block or NULL on error
+******************************************************************************/
+static void *pool_get(int class, int *node)
+{
+    size_t size = (size_t)1 << (POOL_MIN_SHIFT + class);
+    int wanted = *node, n = pool_node(wanted), locking = memory_locking();
+    pool_block *block;
+
+    *node = n;
+    pthread_mutex_lock(&pool_lock);
+    if((block = pool_free[n][class]) != NULL) {
+        pool_free[n][class] = block->next;
+        pool_count[n][class]--;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if(block != NULL) {
+        memory_add(&pool_memory, -(long long)size);
+        return block;
+    }
+
+    block = MAP_FAILED;
+    #ifdef MAP_HUGETLB
+    if((locking & MEMORY_HUGE) && size >= POOL_HUGE_SIZE)
+        block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    #endif
+    if(block == MAP_FAILED)
+        block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(block == MAP_FAILED)
+        return NULL;
+
+    /* the pages of another node are not touched first by its threads */
+    if(wanted >= 0)
+        numa_prefer(block, size, n);
+
+    #ifdef MADV_HUGEPAGE
+    /* big frames are backed by transparent hugepages where available */
+    if(size >= POOL_HUGE_SIZE)
+        madvise(block, size, MADV_HUGEPAGE);
+    #endif
+
+    if(locking & MEMORY_LOCKED)
+        pool_fault_in(block, size);
+
+    return block;
+}
+
+/******************************************************************************
+Description.: give a block back to the pool, unmap it if the pool is full
+              or the memory budget is exceeded
+Input Value.: * ptr..: block returned by pool_get()
+              * class: its size class
+              * node.: its node, -1 if not known
+Return Value: -
+******************************************************************************/
+static void pool_put(void *ptr, int class, int node)
+{
+    size_t size = (size_t)1 << (POOL_MIN_SHIFT + class);
+    pool_block *block = ptr;
+    int n = pool_node(node);
+
+    if(memory_pressure()) {
+        munmap(block, size);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if(pool_count[n][class] < POOL_MAX_FREE) {
+        block->next = pool_free[n][class];
+        pool_free[n][class] = block;
+        pool_count[n][class]++;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if(block != NULL)
+        munmap(block, size);
+    else
+        memory_add(&pool_memory, size);
+}
+
+/******************************************************************************
+Description.: unmap released blocks for the memory budget, the largest first
+Input Value.: * arg..: unused
+              * bytes: to free
+Return Value: bytes freed
+******************************************************************************/
+static long long pool_evict(void *arg, long long bytes)
+{
+    long long freed = 0;
+    pool_block *block;
+    size_t size;
+    int class, n;
+
+    for(class = POOL_CLASSES - 1; class >= 0 && freed < bytes; class--) {
+        size = (size_t)1 << (POOL_MIN_SHIFT + class);
+        for(n = 0; n < NUMA_MAX_NODES && freed < bytes; n++) {
+            while(freed < bytes) {
+                pthread_mutex_lock(&pool_lock);
+                if((block = pool_free[n][class]) != NULL) {
+                    pool_free[n][class] = block->next;
+                    pool_count[n][class]--;
+                }
+                pthread_mutex_unlock(&pool_lock);
+
+                if(block == NULL)
+                    break;
+                munmap(block, size);
+                memory_add(&pool_memory, -(long long)size);
+                freed += size;
+            }
+        }
+    }
+
+    return freed;
+}
+
+/******************************************************************************
+Description.: preallocate pool blocks, input plugins call this once they know
+              the size of their frames so streaming does not start with a
+              burst of page faults. The blocks are for the node the calling
+              thread runs on.
+Input Value.: * capacity: number of bytes a frame has to hold
+              * count...: number of frames to prepare
+Return Value: 0 if everything is ok, -1 on error
+******************************************************************************/
+int frame_pool_reserve(int capacity, int count)
+{
+    int class, i, taken, *nodes, rc = 0;
+    void **blocks;
+
+    if(capacity < 0 || count < 0 || (class = pool_class_of(sizeof(input_frame) + capacity)) < 0)
+        return -1;
+    if(count == 0)
+        return 0;
+
+    blocks = malloc(count * sizeof(void *));
+    nodes = malloc(count * sizeof(int));
+    if(blocks == NULL || nodes == NULL) {
+        free(blocks);
+        free(nodes);
+        return -1;
+    }
+
+    /* all blocks are taken before any goes back, else the same one comes again */
+    for(taken = 0; taken < count; taken++) {
+        nodes[taken] = -1;
+        if((blocks[taken] = pool_get(class, &nodes[taken])) == NULL) {
+            rc = -1;
+            break;
+        }
+
+        /* fault the pages in now */
+        memset(blocks[taken], 0, (size_t)1 << (POOL_MIN_SHIFT + class));
+    }
+
+    for(i = 0; i < taken; i++)
+        pool_put(blocks[i], class, nodes[i]);
+
+    free(blocks);
+    free(nodes);
+    return rc;
+}
+
+/******************************************************************************
+Description.: allocate a new, empty frame with room for at least capacity
+              bytes, frame->capacity tells how much was actually reserved
+Input Value.: capacity is the number of bytes the frame can hold
+Return Value: the frame with a reference count of one or NULL on error
+******************************************************************************/
+input_frame *frame_alloc(int capacity)
+{
+    return frame_alloc_on(capacity, -1);
+}
+
+/******************************************************************************
+Description.: allocate a new, empty frame on a NUMA node, like frame_alloc()
+Input Value.: * capacity: the number of bytes the frame can hold
+              * node....: the node, -1 for the one of the calling thread
+Return Value: the frame with a reference count of one or NULL on error
+******************************************************************************/
+input_frame *frame_alloc_on(int capacity, int node)
+{
+    input_frame *frame;
+    int class;
+
+    if(capacity < 0)
+        return NULL;
+
+    /* header and data share one allocation */
+    if((class = pool_class_of(sizeof(input_frame) + capacity)) >= 0) {
+        if((frame = pool_get(class, &node)) == NULL)
+            return NULL;
+        capacity = ((size_t)1 << (POOL_MIN_SHIFT + class)) - sizeof(input_frame);
+    } else if((frame = malloc(sizeof(input_frame) + capacity)) == NULL) {
+        return NULL;
+    } else {
+        node = numa_current_node();
+    }
+
+    frame->buf = (unsigned char *)(frame + 1);
+    frame->size = 0;
+    frame->capacity = capacity;
+    frame->pool_class = class;
+    frame->numa_node = node;
+    frame->timestamp.tv_sec = 0;
+    frame->timestamp.tv_usec = 0;
+    frame->seq = 0;
+    frame->burst = 0;
+    frame->burst_index = 0;
+    frame->refcount = 1;
+    frame->release = NULL;
+    frame->release_arg = NULL;
+    frame->capture_usec = 0;
+    frame->dequeue_usec = 0;
+    frame->encoded_usec = 0;
+    frame->publish_usec = 0;
+    frame->app_size = 0;
+    frame->raw = NULL;
+    memset(&frame->format, 0, sizeof(frame->format));
+    frame->format.dmabuf = -1;
+    frame->decoded = NULL;
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: make a frame of data owned by somebody else, like a buffer of
+              a driver, so it can be published without copying it
+Input Value.: * data...: the JPEG data
+              * size...: its length
+              * release: called with arg once the last reference is gone
+              * arg....: passed to release
+Return Value: the frame with a reference count of one or NULL on error
+******************************************************************************/
+input_frame *frame_wrap(unsigned char *data, int size, void (*release)(void *arg), void *arg)
+{
+    input_frame *frame;
+
+    if((frame = frame_alloc(0)) == NULL)
+        return NULL;
+
+    frame->buf = data;
+    frame->size = size;
+    frame->capacity = size;
+    frame->release = release;
+    frame->release_arg = arg;
+    /* the header goes back to the pool of the thread releasing it */
+    frame->numa_node = -1;
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: length of the JPEG of a frame, its metadata segment included
+Input Value.: the frame
+Return Value: number of bytes
+******************************************************************************/
+int frame_length(const input_frame *frame)
+{
+    return frame->size + frame->app_size;
+}
+
+/******************************************************************************
+Description.: the pieces of the JPEG of a frame from an offset on, the SOI
+              marker, the metadata segment and the rest of buf. Nothing is
+              copied, the pieces point into the frame.
+Input Value.: * frame.: the frame
+              * offset: bytes of the JPEG to leave out, like those already sent
+              * iov...: gets up to FRAME_IOVECS pieces
+Return Value: number of pieces, 0 if the offset is at or behind the end
+******************************************************************************/
+int frame_iovec(const input_frame *frame, size_t offset, struct iovec *iov)
+{
+    size_t pieces[FRAME_IOVECS][2] = {
+        { 0, 2 },                               /* SOI of buf */
+        { 0, frame->app_size },                 /* the segment */
+        { 2, frame->size - 2 }                  /* the rest of buf */
+    };
+    int i, cnt = 0;
+
+    if(frame->app_size == 0) {
+        if(offset >= (size_t)frame->size)
+            return 0;
+        iov[0].iov_base = frame->buf + offset;
+        iov[0].iov_len = frame->size - offset;
+        return 1;
+    }
+
+    for(i = 0; i < FRAME_IOVECS; i++) {
+        if(offset >= pieces[i][1]) {
+            offset -= pieces[i][1];
+            continue;
+        }
+        iov[cnt].iov_base = ((i == 1) ? (unsigned char *)frame->app : frame->buf) + pieces[i][0] + offset;
+        iov[cnt++].iov_len = pieces[i][1] - offset;
+        offset = 0;
+    }
+
+    return cnt;
+}
+
+/******************************************************************************
+Description.: copy the JPEG of a frame together, for outputs which need it in
+              one piece
+Input Value.: * frame: the frame
+              * dest.: gets frame_length() bytes
+Return Value: number of bytes copied
+******************************************************************************/
+int frame_copy(const input_frame *frame, unsigned char *dest)
+{
+    struct iovec iov[FRAME_IOVECS];
+    int i, cnt, len = 0;
+
+    cnt = frame_iovec(frame, 0, iov);
+    for(i = 0; i < cnt; i++) {
+        memcpy(dest + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    return len;
+}
+
+/******************************************************************************
+Description.: the frame with its metadata segment inside buf, for outputs which
+              keep or pass on the JPEG in one piece
+Input Value.: frame, the reference of the caller is handed over
+Return Value: the frame itself without a segment, else a copy of it, NULL if
+              no memory is left
+******************************************************************************/
+input_frame *frame_flatten(input_frame *frame)
+{
+    input_frame *flat;
+
+    if(frame == NULL || frame->app_size == 0)
+        return frame;
+
+    if((flat = frame_alloc(frame_length(frame))) != NULL) {
+        flat->size = frame_copy(frame, flat->buf);
+        flat->timestamp = frame->timestamp;
+        flat->seq = frame->seq;
+        flat->burst = frame->burst;
+        flat->burst_index = frame->burst_index;
+        flat->capture_usec = frame->capture_usec;
+        flat->dequeue_usec = frame->dequeue_usec;
+        flat->encoded_usec = frame->encoded_usec;
+        flat->publish_usec = frame->publish_usec;
+        flat->raw = frame_ref(frame->raw);
+    }
+    frame_unref(frame);
+
+    return flat;
+}
+
+/******************************************************************************
+Description.: take an additional reference to a frame
+Input Value.: frame to reference, may be NULL
+Return Value: the same frame
+******************************************************************************/
+input_frame *frame_ref(input_frame *frame)
+{
+    if(frame != NULL)
+        __sync_add_and_fetch(&frame->refcount, 1);
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: drop a reference, the last reference returns the frame to
+              the pool
+Input Value.: frame to release, may be NULL
+Return Value: -
+******************************************************************************/
+void frame_unref(input_frame *frame)
+{
+    if(frame == NULL)
+        return;
+
+    if(__sync_sub_and_fetch(&frame->refcount, 1) != 0)
+        return;
+
+    frame_unref(frame->raw);
+    frame_decode_free(frame);
+    if(frame->release != NULL)
+        frame->release(frame->release_arg);
+
+    if(frame->pool_class >= 0)
+        pool_put(frame, frame->pool_class, frame->numa_node);
+    else
+        free(frame);
+}
+
+/******************************************************************************
+Description.: count a consumer of the frames of an input. The first one wakes
+              an input which stopped capturing for lack of consumers.
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+void input_subscribe(input *in)
+{
+    void (*wake)(input *);
+
+    if(__sync_fetch_and_add(&in->subscribers, 1) == 0 &&
+       (wake = __atomic_load_n(&in->wake, __ATOMIC_ACQUIRE)) != NULL)
+        wake(in);
+}
+
+/******************************************************************************
+Description.: drop a consumer counted by input_subscribe()
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+void input_unsubscribe(input *in)
+{
+    __sync_fetch_and_sub(&in->subscribers, 1);
+}
+
+/******************************************************************************
+Description.: tell an input whether anyone consumes its frames
+Input Value.: the input
+Return Value: 1 if a consumer subscribed, 0 otherwise
+******************************************************************************/
+int input_subscribed(input *in)
+{
+    return __atomic_load_n(&in->subscribers, __ATOMIC_RELAXED) > 0;
+}
+
+/******************************************************************************
+Description.: tell the consumers that an input stopped or started capturing
+              again, the current frame of an idle input may be old
+Input Value.: * in..: the input
+              * idle: 1 while it does not capture
+Return Value: -
+******************************************************************************/
+void input_set_idle(input *in, int idle)
+{
+    __atomic_store_n(&in->idle, idle, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+Description.: find out whether an input stopped capturing
+Input Value.: the input
+Return Value: 1 if it is idle, 0 otherwise
+******************************************************************************/
+int input_idle(input *in)
+{
+    return __atomic_load_n(&in->idle, __ATOMIC_ACQUIRE);
+}
+
+/******************************************************************************
+Description.: get a current frame of an idle input for a single consumer like
+              a snapshot. The input is woken and the first frame it captures
+              is waited for, the last frame it had is the fallback.
+Input Value.: * in..: the input
+              * msec: longest time to wait for a frame in milliseconds
+Return Value: referenced frame or NULL if there is none at all,
+              release it with frame_unref()
+******************************************************************************/
+input_frame *input_wake_frame(input *in, int msec)
+{
+    input_frame *frame = input_get_frame(in), *fresh;
+    unsigned long long seq = (frame != NULL) ? frame->seq : 0;
+
+    input_subscribe(in);
+    if((fresh = input_timed_next_frame(in, &seq, NULL, msec)) != NULL) {
+        frame_unref(frame);
+        frame = fresh;
+    }
+    input_unsubscribe(in);
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: ask an input for raw frames next to its JPEG frames, inputs
+              only copy the pixels while someone wants them
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+void input_raw_subscribe(input *in)
+{
+    __sync_fetch_and_add(&in->raw_subscribers, 1);
+}
+
+/******************************************************************************
+Description.: drop a subscription of input_raw_subscribe()
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+void input_raw_unsubscribe(input *in)
+{
+    __sync_fetch_and_sub(&in->raw_subscribers, 1);
+}
+
+/******************************************************************************
+Description.: tell an input whether to attach raw frames
+Input Value.: the input
+Return Value: 1 if a consumer subscribed to them, 0 otherwise
+******************************************************************************/
+int input_raw_wanted(input *in)
+{
+    return __atomic_load_n(&in->raw_subscribers, __ATOMIC_RELAXED) > 0;
+}
+
+/******************************************************************************
+Description.: copy the planes of a picture into a raw frame, one after the
+              other
+Input Value.: * format.: the layout of the picture, its offsets are set here
+              * planes.: the first byte of each plane
+              * lengths: the bytes of each plane
+Return Value: the frame with a reference count of one or NULL on error
+******************************************************************************/
+input_frame *frame_raw_copy(const raw_format *format, const unsigned char *const *planes, const int *lengths)
+{
+    input_frame *raw;
+    int i, size = 0;
+
+    if(format->planes < 1 || format->planes > RAW_PLANES)
+        return NULL;
+    for(i = 0; i < format->planes; i++)
+        size += lengths[i];
+
+    if((raw = frame_alloc(size)) == NULL)
+        return NULL;
+
+    raw->format = *format;
+    for(i = 0; i < format->planes; i++) {
+        raw->format.offset[i] = raw->size;
+        memcpy(raw->buf + raw->size, planes[i], lengths[i]);
+        raw->size += lengths[i];
+    }
+
+    return raw;
+}
+
+/******************************************************************************
+Description.: attach a raw frame to the JPEG frame compressed from it, before
+              the JPEG frame is published, which gives it its sequence number
+              and times
+Input Value.: * frame: the JPEG frame
+              * raw..: the raw frame, the reference of the caller is handed
+                       over, may be NULL
+Return Value: -
+******************************************************************************/
+void frame_attach_raw(input_frame *frame, input_frame *raw)
+{
+    frame_unref(frame->raw);
+    frame->raw = raw;
+}
+
+/******************************************************************************
+Description.: microseconds of a clock which does not jump with the wall time
+Input Value.: -
+Return Value: the current time
+******************************************************************************/
+unsigned long long monotonic_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/******************************************************************************
+Description.: the wall clock time a frame was captured at. The timestamp of
+              a frame may come from the monotonic clock of the driver, so it
+              is taken back from the current time by the age of the frame.
+Input Value.: * frame: the frame
+              * tv...: gets the time
+Return Value: -
+******************************************************************************/
+void frame_wall_time(const input_frame *frame, struct timeval *tv)
+{
+    unsigned long long then = frame->capture_usec ? frame->capture_usec : frame->publish_usec;
+    unsigned long long now = monotonic_usec(), wall;
+
+    gettimeofday(tv, NULL);
+    if(then == 0 || then > now)
+        return;
+
+    wall = (unsigned long long)tv->tv_sec * 1000000ULL + tv->tv_usec - (now - then);
+    tv->tv_sec = wall / 1000000ULL;
+    tv->tv_usec = wall % 1000000ULL;
+}
+
+/******************************************************************************
+Description.: count a value in a histogram, may be called by several threads
+Input Value.: * h....: the histogram
+              * value: the value to count
+Return Value: -
+******************************************************************************/
+void histogram_observe(histogram *h, unsigned long long value)
+{
+    int i = 0;
+
+    while(i < HISTOGRAM_BUCKETS - 1 && value >= (1ULL << (h->shift + i)))
+        i++;
+
+    __sync_fetch_and_add(&h->bucket[i], 1);
+    __sync_fetch_and_add(&h->count, 1);
+    __sync_fetch_and_add(&h->sum, value);
+}
+
+/******************************************************************************
+Description.: lock the db mutex of an input, counting the time spent waiting
+              if someone else holds it
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+static void lock_db(input *in)
+{
+    unsigned long long start;
+
+    if(pthread_mutex_trylock(&in->db) == 0)
+        return;
+
+    start = monotonic_usec();
+    pthread_mutex_lock(&in->db);
+
+    __sync_fetch_and_add(&in->stats.db_contended, 1);
+    __sync_fetch_and_add(&in->stats.db_wait_usec, monotonic_usec() - start);
+}
+
+/******************************************************************************
+Description.: put a waiter on the list of its input or take it off, the
+              caller holds the db mutex
+Input Value.: the waiter
+Return Value: -
+******************************************************************************/
+static void queue_waiter(frame_waiter *w)
+{
+    w->prev = NULL;
+    w->next = w->in->waiters;
+    if(w->next != NULL)
+        w->next->prev = w;
+    w->in->waiters = w;
+    w->queued = 1;
+}
+
+static void unqueue_waiter(frame_waiter *w)
+{
+    if(w->prev != NULL)
+        w->prev->next = w->next;
+    else
+        w->in->waiters = w->next;
+    if(w->next != NULL)
+        w->next->prev = w->prev;
+    w->queued = 0;
+}
+
+/******************************************************************************
+Description.: take the waiters a frame is due for off the list of its
+              input, the caller holds the db mutex. Event loops get their
+              eventfd written, the others get the frame handed over.
+Input Value.: * in...: the input
+              * frame: the frame just published
+Return Value: the waiters to post once the mutex is released, linked by next
+******************************************************************************/
+static frame_waiter *take_waiters(input *in, input_frame *frame)
+{
+    frame_waiter *w, *next, *woken = NULL;
+    uint64_t one = 1;
+
+    for(w = in->waiters; w != NULL; w = next) {
+        next = w->next;
+        if(frame->seq <= w->seq)
+            continue;
+
+        unqueue_waiter(w);
+        if(w->fd >= 0) {
+            if(write(w->fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                DBG("could not write eventfd\n");
+            continue;
+        }
+
+        w->frame = frame_ref(frame);
+        w->next = woken;
+        woken = w;
+    }
+
+    return woken;
+}
+
+/******************************************************************************
+Description.: make a frame the current frame of an input and wake up the
+              consumers waiting for it. The oldest frame of the ring is dropped.
+              The caller hands over its reference, the frame must not be
+              modified afterwards. A frame the governor drops is released.
+Input Value.: * in....: input plugin which produced the frame
+              * frame.: the filled frame
+Return Value: -
+******************************************************************************/
+void input_publish_frame(input *in, input_frame *frame)
+{
+    input_frame *old;
+    frame_waiter *woken, *next;
+    unsigned int epoch;
+    int slot;
+
+    /* an input the governor degraded keeps only some of its frames */
+    if(governor_drop(in)) {
+        frame_unref(frame);
+        return;
+    }
+
+    /* cameras which can not rotate themselves get their frames turned here */
+    if(in->transform != TRANSFORM_NONE)
+        frame = frame_transform(frame, in->transform);
+
+    /* the time each stage took, as far as the input told */
+    frame->publish_usec = monotonic_usec();
+    if(frame->capture_usec != 0 && frame->dequeue_usec >= frame->capture_usec)
+        histogram_observe(&in->stats.dequeue_latency_usec, frame->dequeue_usec - frame->capture_usec);
+    if(frame->dequeue_usec != 0 && frame->encoded_usec >= frame->dequeue_usec)
+        histogram_observe(&in->stats.encode_latency_usec, frame->encoded_usec - frame->dequeue_usec);
+    if(frame->encoded_usec != 0)
+        histogram_observe(&in->stats.publish_latency_usec, frame->publish_usec - frame->encoded_usec);
+
+    lock_db(in);
+
+    /* the frame falling out of the ring gets released after unlocking */
+    frame->seq = ++in->seq;
+
+    if(frame->raw != NULL) {
+        frame->raw->seq = frame->seq;
+        frame->raw->timestamp = frame->timestamp;
+        frame->raw->capture_usec = frame->capture_usec;
+        frame->raw->dequeue_usec = frame->dequeue_usec;
+        frame->raw->encoded_usec = frame->encoded_usec;
+        frame->raw->publish_usec = frame->publish_usec;
+    }
+
+    /* the metadata carries the sequence number, it is known only now */
+    if(in->metadata != METADATA_NONE)
+        frame_metadata(in, frame);
+    slot = frame->seq % INPUT_RING_SIZE;
+    old = in->ring[slot];
+    in->ring[slot] = frame;
+    __atomic_store_n(&in->current, frame, __ATOMIC_SEQ_CST);
+
+    /*
+     * input_peek_frame() may still be about to reference a pointer it read
+     * from current before the swap. Those readers registered in the old
+     * epoch, once they are gone no one can reach a frame that has left
+     * current, so old may be released safely.
+     */
+    epoch = __atomic_load_n(&in->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&in->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&in->peekers[epoch & 1], __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    __sync_fetch_and_add(&in->stats.frames, 1);
+    __sync_fetch_and_add(&in->stats.bytes, frame_length(frame));
+    PROBE(publish, in->param.id, frame->seq, frame->size, frame->publish_usec);
+
+    /* keep the legacy fields pointing to the current data */
+    in->buf = frame->buf;
+    in->size = frame->size;
+    in->timestamp = frame->timestamp;
+
+    /* signal fresh_frame */
+    woken = take_waiters(in, frame);
+    pthread_cond_broadcast(&in->db_update);
+    pthread_mutex_unlock(&in->db);
+
+    /* a waiter may be gone as soon as it is posted */
+    for(; woken != NULL; woken = next) {
+        next = woken->next;
+        sem_post(&woken->wake);
+    }
+
+    /* the last seconds are kept for an instant replay with --replay */
+    if(in->replay != NULL)
+        replay_keep(in, frame);
+
+    frame_unref(old);
+}
+
+/******************************************************************************
+Description.: convenience function for inputs which receive the JPEG data in
+              a buffer they do not own, copies the data into a new frame
+              and publishes it
+Input Value.: * in.......: input plugin which produced the frame
+              * data.....: JPEG data
+              * size.....: number of bytes in data
+              * timestamp: capture time, NULL means "now"
+Return Value: 0 if the frame was published, -1 on error
+******************************************************************************/
+int input_publish(input *in, const unsigned char *data, int size, const struct timeval *timestamp)
+{
+    input_frame *frame;
+
+    if((frame = frame_alloc(size)) == NULL)
+        return -1;
+
+    memcpy(frame->buf, data, size);
+    frame->size = size;
+
+    if(timestamp != NULL)
+        frame->timestamp = *timestamp;
+    else
+        gettimeofday(&frame->timestamp, NULL);
+
+    input_publish_frame(in, frame);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: get the current frame of an input without waiting
+Input Value.: input plugin to read from
+Return Value: referenced frame or NULL if nothing was published yet,
+              release it with frame_unref()
+******************************************************************************/
+input_frame *input_get_frame(input *in)
+{
+    input_frame *frame;
+
+    lock_db(in);
+    frame = frame_ref(in->current);
+    pthread_mutex_unlock(&in->db);
+
+    if(frame != NULL)
+        PROBE(acquire, in->param.id, frame->seq, 0);
+    return frame;
+}
+
+/******************************************************************************
+Description.: get the current frame of an input without taking the db mutex,
+              meant for consumers like snapshots which just need the newest
+              frame and must not contend with the capture thread
+Input Value.: input plugin to read from
+Return Value: referenced frame or NULL if nothing was published yet,
+              release it with frame_unref()
+******************************************************************************/
+input_frame *input_peek_frame(input *in)
+{
+    input_frame *frame;
+    unsigned int epoch;
+
+    epoch = __atomic_load_n(&in->epoch, __ATOMIC_SEQ_CST);
+    __sync_add_and_fetch(&in->peekers[epoch & 1], 1);
+
+    /* current can not be released while we are registered */
+    frame = frame_ref(__atomic_load_n(&in->current, __ATOMIC_SEQ_CST));
+
+    __sync_sub_and_fetch(&in->peekers[epoch & 1], 1);
+
+    if(frame != NULL)
+        PROBE(acquire, in->param.id, frame->seq, 0);
+    return frame;
+}
+
+/******************************************************************************
+Description.: take a waiter off the list unless a frame was handed to it,
+              a post on its way is waited for then
+Input Value.: the waiter
+Return Value: -
+******************************************************************************/
+static void withdraw_waiter(frame_waiter *w)
+{
+    int queued;
+
+    lock_db(w->in);
+    if((queued = w->queued))
+        unqueue_waiter(w);
+    pthread_mutex_unlock(&w->in->db);
+
+    if(!queued) {
+        while(sem_wait(&w->wake) < 0 && errno == EINTR);
+    }
+}
+
+/******************************************************************************
+Description.: cleanup handler of a cancelled wait
+Input Value.: arg is the waiter
+Return Value: -
+******************************************************************************/
+static void cancel_waiter(void *arg)
+{
+    frame_waiter *w = arg;
+
+    withdraw_waiter(w);
+    frame_unref(w->frame);
+    sem_destroy(&w->wake);
+}
+
+/******************************************************************************
+Description.: wait for the first frame after a sequence number, the caller
+              holds the db mutex and found no such frame yet. The frame is
+              handed over by input_publish_frame(), so the woken consumer
+              does not take the mutex again.
+Input Value.: * in......: input plugin to read from
+              * seq.....: the frame to wait for is the first one after it
+              * deadline: on the realtime clock, NULL waits as long as it takes
+Return Value: referenced frame or NULL if none came in time, the db mutex
+              is released in any case
+******************************************************************************/
+static input_frame *wait_published(input *in, unsigned long long seq, const struct timespec *deadline)
+{
+    frame_waiter w;
+    int rc;
+
+    memset(&w, 0, sizeof(w));
+    w.in = in;
+    w.seq = seq;
+    w.fd = -1;
+    sem_init(&w.wake, 0, 0);
+    queue_waiter(&w);
+    pthread_mutex_unlock(&in->db);
+
+    /* sem_wait() is a cancellation point, do not leave the waiter queued */
+    pthread_cleanup_push(cancel_waiter, &w);
+    do {
+        rc = (deadline != NULL) ? sem_timedwait(&w.wake, deadline) : sem_wait(&w.wake);
+    } while(rc < 0 && errno == EINTR);
+
+    if(rc < 0)
+        withdraw_waiter(&w);
+    pthread_cleanup_pop(0);
+
+    sem_destroy(&w.wake);
+    return w.frame;
+}
+
+/******************************************************************************
+Description.: wait for a frame newer than the one seen last, frames that
+              were published in between are skipped
+Input Value.: * in.: input plugin to read from
+              * seq: sequence number of the last frame the caller has seen,
+                     0 if it has not seen any frame yet. Gets updated to the
+                     sequence number of the returned frame.
+Return Value: referenced frame, release it with frame_unref()
+******************************************************************************/
+input_frame *input_wait_frame(input *in, unsigned long long *seq)
+{
+    input_frame *frame = NULL;
+
+    lock_db(in);
+    if(in->current != NULL && in->seq > *seq) {
+        frame = frame_ref(in->current);
+        pthread_mutex_unlock(&in->db);
+    } else {
+        frame = wait_published(in, *seq, NULL);
+    }
+
+    PROBE(acquire, in->param.id, frame->seq, 0);
+    *seq = frame->seq;
+    return frame;
+}
+
+/******************************************************************************
+Description.: look up a frame in the ring, the caller must hold the db mutex
+Input Value.: * in.....: input plugin to read from
+              * seq....: sequence number of the last frame the caller has seen
+              * dropped: gets the number of frames after seq which already
+                         left the ring, may be NULL
+Return Value: the oldest frame newer than seq that is still in the ring
+              (not referenced) or NULL if there is none yet
+******************************************************************************/
+static input_frame *ring_lookup(input *in, unsigned long long seq, unsigned long long *dropped)
+{
+    unsigned long long next = seq + 1;
+
+    if(dropped != NULL)
+        *dropped = 0;
+
+    if(in->current == NULL || next > in->seq)
+        return NULL;
+
+    /* the consumer fell behind, continue with the oldest frame available */
+    if(in->seq - next >= INPUT_RING_SIZE) {
+        if(dropped != NULL)
+            *dropped = in->seq - INPUT_RING_SIZE + 1 - next;
+        next = in->seq - INPUT_RING_SIZE + 1;
+    }
+
+    return in->ring[next % INPUT_RING_SIZE];
+}
+
+/******************************************************************************
+Description.: get the frame following the one seen last without waiting
+Input Value.: * in.....: input plugin to read from
+              * seq....: sequence number of the last frame the caller has seen,
+                         0 if it has not seen any frame yet
+              * dropped: gets the number of frames that were overwritten
+                         before the caller could fetch them, may be NULL
+Return Value: referenced frame or NULL if no newer frame exists,
+              release it with frame_unref()
+******************************************************************************/
+input_frame *input_next_frame(input *in, unsigned long long seq, unsigned long long *dropped)
+{
+    input_frame *frame;
+
+    lock_db(in);
+    frame = frame_ref(ring_lookup(in, seq, dropped));
+    pthread_mutex_unlock(&in->db);
+
+    if(frame != NULL)
+        PROBE(acquire, in->param.id, frame->seq, (dropped != NULL) ? *dropped : 0);
+    return frame;
+}
+
+/******************************************************************************
+Description.: wait for the frame following the one seen last, unlike
+              input_wait_frame() no frame is skipped as long as the caller
+              does not fall behind by more than INPUT_RING_SIZE frames
+Input Value.: * in.....: input plugin to read from
+              * seq....: sequence number of the last frame the caller has seen,
+                         0 if it has not seen any frame yet. Gets updated to
+                         the sequence number of the returned frame.
+              * dropped: gets the number of frames that were overwritten
+                         before the caller could fetch them, may be NULL
+Return Value: referenced frame, release it with frame_unref()
+******************************************************************************/
+input_frame *input_wait_next_frame(input *in, unsigned long long *seq, unsigned long long *dropped)
+{
+    input_frame *frame;
+
+    lock_db(in);
+    if((frame = frame_ref(ring_lookup(in, *seq, dropped))) != NULL)
+        pthread_mutex_unlock(&in->db);
+    else
+        frame = wait_published(in, *seq, NULL);
+
+    PROBE(acquire, in->param.id, frame->seq, (dropped != NULL) ? *dropped : 0);
+    *seq = frame->seq;
+    return frame;
+}
+
+/******************************************************************************
+Description.: compute the deadline of a wait for a frame
+Input Value.: * deadline: gets the time
+              * msec....: milliseconds from now
+Return Value: -
+******************************************************************************/
+static void deadline_after(struct timespec *deadline, int msec)
+{
+    /* sem_timedwait() waits on the realtime clock */
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += msec / 1000;
+    deadline->tv_nsec += (msec % 1000) * 1000000L;
+    if(deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/******************************************************************************
+Description.: like input_wait_next_frame(), but give up after a while
+Input Value.: * in.....: input plugin to read from
+              * seq....: sequence number of the last frame the caller has seen,
+                         gets updated to the one of the returned frame
+              * dropped: gets the number of frames that were overwritten
+                         before the caller could fetch them, may be NULL
+              * msec...: longest time to wait in milliseconds
+Return Value: referenced frame, release it with frame_unref(), NULL if no
+              frame came in time
+******************************************************************************/
+input_frame *input_timed_next_frame(input *in, unsigned long long *seq, unsigned long long *dropped, int msec)
+{
+    input_frame *frame;
+    struct timespec deadline;
+
+    deadline_after(&deadline, msec);
+
+    lock_db(in);
+    if((frame = frame_ref(ring_lookup(in, *seq, dropped))) != NULL)
+        pthread_mutex_unlock(&in->db);
+    else
+        frame = wait_published(in, *seq, &deadline);
+
+    if(frame != NULL) {
+        PROBE(acquire, in->param.id, frame->seq, (dropped != NULL) ? *dropped : 0);
+        *seq = frame->seq;
+    }
+    return frame;
+}
+
+/******************************************************************************
+Description.: start consuming the frames of an input, until
+              frame_unsubscribe() the input counts it as a consumer
+Input Value.: * sub..: the subscription to set up
+              * in...: input plugin to read from
+              * mode.: FRAME_LATEST or FRAME_NEXT
+              * stats: statistics of the output to count skipped frames as
+                       overruns in, NULL if skipping them is intended
+Return Value: -
+******************************************************************************/
+void frame_subscribe(frame_subscription *sub, input *in, frame_mode mode, output_stats *stats)
+{
+    memset(sub, 0, sizeof(*sub));
+    sub->in = in;
+    sub->mode = mode;
+    sub->stats = stats;
+    input_subscribe(in);
+}
+
+/******************************************************************************
+Description.: stop consuming the frames of an input, the subscription can not
+              be used anymore afterwards
+Input Value.: the subscription
+Return Value: -
+******************************************************************************/
+void frame_unsubscribe(frame_subscription *sub)
+{
+    if(sub->in == NULL)
+        return;
+
+    input_unsubscribe(sub->in);
+    sub->in = NULL;
+}
+
+/******************************************************************************
+Description.: the frames up to which a subscription is not interested in
+Input Value.: the subscription
+Return Value: the sequence number of the last frame which is not due
+******************************************************************************/
+static unsigned long long subscription_after(frame_subscription *sub)
+{
+    if(sub->seq == 0 || sub->every <= 1)
+        return sub->seq;
+    return sub->seq + sub->every - 1;
+}
+
+/******************************************************************************
+Description.: look up the frame a subscription gets next, the caller must
+              hold the db mutex
+Input Value.: * sub....: the subscription
+              * skipped: gets the number of frames skipped before it
+Return Value: the frame (not referenced) or NULL if there is none yet
+******************************************************************************/
+static input_frame *subscription_lookup(frame_subscription *sub, unsigned long long *skipped)
+{
+    input *in = sub->in;
+    unsigned long long after = subscription_after(sub);
+
+    if(sub->mode == FRAME_NEXT)
+        return ring_lookup(in, after, skipped);
+
+    if(in->current == NULL || in->seq <= after)
+        return NULL;
+
+    *skipped = (sub->seq != 0) ? in->seq - after - 1 : 0;
+    return in->current;
+}
+
+/******************************************************************************
+Description.: wait for the next frame of a subscription, the newest one or
+              the one following the frame handed out last depending on its
+              mode, and count the frames skipped before it. Frames before
+              the next one due with every are neither waited for nor
+              counted.
+Input Value.: * sub.: the subscription
+              * msec: longest time to wait in milliseconds, -1 waits as long
+                      as it takes
+Return Value: referenced frame, release it with frame_unref(), NULL if no
+              frame came in time
+******************************************************************************/
+input_frame *frame_next(frame_subscription *sub, int msec)
+{
+    input *in = sub->in;
+    input_frame *frame;
+    unsigned long long skipped = 0, after;
+    struct timespec deadline;
+
+    if(msec >= 0)
+        deadline_after(&deadline, msec);
+
+    lock_db(in);
+    if((frame = frame_ref(subscription_lookup(sub, &skipped))) != NULL) {
+        pthread_mutex_unlock(&in->db);
+    } else {
+        /* the frame handed over is the first one due */
+        after = subscription_after(sub);
+        frame = wait_published(in, after, (msec >= 0) ? &deadline : NULL);
+        if(frame != NULL && sub->seq != 0)
+            skipped = frame->seq - after - 1;
+    }
+
+    if(frame == NULL)
+        return NULL;
+
+    sub->seq = frame->seq;
+    sub->received++;
+    sub->skipped = skipped;
+    sub->dropped += skipped;
+    PROBE(acquire, in->param.id, frame->seq, skipped);
+    if(sub->stats != NULL && skipped > 0)
+        __sync_fetch_and_add(&sub->stats->overruns, skipped);
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: arm a waiter of an event loop for the first frame after a
+              sequence number, its eventfd is written once that frame is
+              published. Arming an armed waiter again only makes it wake
+              for an earlier frame.
+Input Value.: * w..: the waiter, zeroed before its first use
+              * in.: input plugin to watch
+              * seq: sequence number of the last frame the caller has seen
+              * fd.: the eventfd to write
+Return Value: 1 if there is such a frame already, nothing is armed then,
+              0 otherwise
+******************************************************************************/
+int frame_watch(frame_waiter *w, input *in, unsigned long long seq, int fd)
+{
+    int published;
+
+    lock_db(in);
+    if(!(published = (in->current != NULL && in->seq > seq))) {
+        if(!w->queued) {
+            w->in = in;
+            w->seq = seq;
+            w->fd = fd;
+            queue_waiter(w);
+        } else if(seq < w->seq) {
+            w->seq = seq;
+        }
+    }
+    pthread_mutex_unlock(&in->db);
+
+    return published;
+}
+
+/******************************************************************************
+Description.: disarm a waiter of frame_watch()
+Input Value.: the waiter
+Return Value: -
+******************************************************************************/
+void frame_unwatch(frame_waiter *w)
+{
+    if(w->in == NULL)
+        return;
+
+    lock_db(w->in);
+    if(w->queued)
+        unqueue_waiter(w);
+    pthread_mutex_unlock(&w->in->db);
+}
@@ -0,0 +1,390 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Degradation governor
+ *
+ * One thread reads the sensors and moves the inputs between the levels, the
+ * hooks only read the level of their input, a plain int, and count frames
+ * in fields only the thread of the plugin touches. A level which changes
+ * between two frames takes effect with the next one.
+ *
+ * The order of the inputs is fixed by their priority and number: the input
+ * with the lowest priority, the highest number among equal ones, is degraded
+ * first, and restored last.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+#define THERMAL_ZONE "/sys/class/thermal/thermal_zone%d/temp"
+
+static const char *degrade_names[DEGRADE_LEVELS] = { "none", "fps", "quality", "variants" };
+
+static globals *pglobal;
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static governor_state state;
+
+/* what the thread saw at its last look, only touched by the thread */
+static unsigned long long cpu_busy, cpu_total;
+static unsigned long long encode_sum[INPUT_TABLE_SIZE], encode_count[INPUT_TABLE_SIZE], frames[INPUT_TABLE_SIZE];
+
+/******************************************************************************
+Description.: Read the limits of --governor like "75" or "75,90"
+Input Value.: * arg........: the temperature in degrees Celsius, 0 for none,
+                             and the load in percent after a comma
+              * temperature: where to store the temperature
+              * load.......: where to store the load, GOVERNOR_LOAD without
+Return Value: 0 on success, -1 if the limits are not valid
+******************************************************************************/
+int governor_parse(const char *arg, double *temperature, double *load)
+{
+    char *end;
+
+    *temperature = strtod(arg, &end);
+    if(end == arg || *temperature < 0 || (*end != '\0' && *end != ','))
+        return -1;
+
+    *load = GOVERNOR_LOAD;
+    if(*end == ',') {
+        arg = end + 1;
+        *load = strtod(arg, &end);
+        if(end == arg || *end != '\0' || *load <= 0 || *load > 100)
+            return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: the name of a level for the messages, the metrics and
+              program.json
+Input Value.: the degrade_level
+Return Value: its name
+******************************************************************************/
+const char *degrade_name(int level)
+{
+    return (level >= 0 && level < DEGRADE_LEVELS) ? degrade_names[level] : "unknown";
+}
+
+/******************************************************************************
+Description.: read the temperature of the hottest thermal zone
+Input Value.: -
+Return Value: degrees Celsius, -1 if there is no thermal zone
+******************************************************************************/
+static double read_temperature(void)
+{
+    char path[64];
+    double hottest = -1;
+    long millidegrees;
+    FILE *f;
+    int i;
+
+    for(i = 0; ; i++) {
+        snprintf(path, sizeof(path), THERMAL_ZONE, i);
+        if((f = fopen(path, "r")) == NULL)
+            break;
+        if(fscanf(f, "%ld", &millidegrees) == 1)
+            hottest = MAX(hottest, millidegrees / 1000.0);
+        fclose(f);
+    }
+
+    return hottest;
+}
+
+/******************************************************************************
+Description.: read the load of all CPUs since the last call from /proc/stat
+Input Value.: -
+Return Value: percent of the time the CPUs were busy, 0 at the first call or
+              if it can not be read
+******************************************************************************/
+static double read_load(void)
+{
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal, busy, total;
+    double load = 0;
+    FILE *f;
+    int n;
+
+    if((f = fopen("/proc/stat", "r")) == NULL)
+        return 0;
+    iowait = irq = softirq = steal = 0;
+    n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+    fclose(f);
+    if(n < 4)
+        return 0;
+
+    /* waiting for I/O leaves the CPU to the others */
+    busy = user + nice + system + irq + softirq + steal;
+    total = busy + idle + iowait;
+    if(cpu_total != 0 && total > cpu_total)
+        load = 100.0 * (busy - cpu_busy) / (total - cpu_total);
+    cpu_busy = busy;
+    cpu_total = total;
+    return load;
+}
+
+/******************************************************************************
+Description.: tell if an input took longer to encode its frames than it may,
+              against the interval of its frames in the last look
+Input Value.: * i......: the number of the input
+              * elapsed: microseconds since the last look
+Return Value: 1 if it missed its deadline, 0 otherwise
+******************************************************************************/
+static int input_late(int i, unsigned long long elapsed)
+{
+    input *in = &pglobal->in[i];
+    unsigned long long sum = in->stats.encode_usec.sum;
+    unsigned long long count = in->stats.encode_usec.count;
+    unsigned long long published = in->stats.frames;
+    int late = 0;
+
+    /* the mean encode time against the mean interval, without dividing */
+    if(count > encode_count[i] && published > frames[i] && elapsed > 0)
+        late = (sum - encode_sum[i]) * (published - frames[i]) * 100 >
+               (count - encode_count[i]) * elapsed * GOVERNOR_DEADLINE;
+
+    encode_sum[i] = sum;
+    encode_count[i] = count;
+    frames[i] = published;
+    return late;
+}
+
+/******************************************************************************
+Description.: tell if an input comes before another one in the order the
+              inputs are degraded in
+Input Value.: the numbers of the inputs
+Return Value: 1 if a comes first, 0 otherwise
+******************************************************************************/
+static int degraded_before(int a, int b)
+{
+    if(pglobal->in[a].priority != pglobal->in[b].priority)
+        return pglobal->in[a].priority < pglobal->in[b].priority;
+    return a > b;
+}
+
+/******************************************************************************
+Description.: degrade the first input which is not at the lowest level yet,
+              or restore the last one which is degraded
+Input Value.: * down...: 1 to degrade, 0 to restore
+              * reason.: what the thread saw, for the message
+Return Value: 1 if an input changed its level, 0 if there was none to change
+******************************************************************************/
+static int governor_step(int down, const char *reason)
+{
+    int i, found = -1, level;
+
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].handle == NULL)
+            continue;
+        if(down ? pglobal->in[i].degrade >= DEGRADE_LEVELS - 1 : pglobal->in[i].degrade == DEGRADE_NONE)
+            continue;
+        if(found < 0 || (down ? degraded_before(i, found) : degraded_before(found, i)))
+            found = i;
+    }
+    if(found < 0)
+        return 0;
+
+    level = pglobal->in[found].degrade + (down ? 1 : -1);
+    __atomic_store_n(&pglobal->in[found].degrade, level, __ATOMIC_RELAXED);
+    LOG("governor: input %d %s to level %s, %s\n", found, down ? "degraded" : "restored", degrade_name(level), reason);
+
+    pthread_mutex_lock(&state_mutex);
+    state.actions++;
+    pthread_mutex_unlock(&state_mutex);
+    return 1;
+}
+
+/******************************************************************************
+Description.: look at the sensors once a second and shed or restore load
+Input Value.: -
+Return Value: always NULL
+******************************************************************************/
+static void *governor_thread(void *arg)
+{
+    unsigned long long now, last = monotonic_usec(), last_step = 0;
+    double temperature, load, max_temperature, max_load;
+    int i, late, calm = 0, over, headroom;
+    char reason[96];
+
+    pthread_mutex_lock(&state_mutex);
+    max_temperature = state.max_temperature;
+    max_load = state.max_load;
+    pthread_mutex_unlock(&state_mutex);
+
+    read_load();
+    while(!pglobal->stop) {
+        sleep(GOVERNOR_INTERVAL);
+        now = monotonic_usec();
+
+        temperature = read_temperature();
+        load = read_load();
+        for(i = 0, late = 0; i < pglobal->incnt; i++) {
+            if(pglobal->in[i].handle != NULL)
+                late += input_late(i, now - last);
+        }
+        last = now;
+
+        pthread_mutex_lock(&state_mutex);
+        state.temperature = temperature;
+        state.load = load;
+        state.late = late;
+        pthread_mutex_unlock(&state_mutex);
+
+        over = (max_temperature > 0 && temperature >= max_temperature) || load >= max_load || late > 0;
+        headroom = (max_temperature == 0 || temperature <= max_temperature - GOVERNOR_TEMP_HYSTERESIS) &&
+                   load <= max_load - GOVERNOR_LOAD_HYSTERESIS && late == 0;
+        if(temperature >= 0)
+            snprintf(reason, sizeof(reason), "%.1f C, %.0f%% load, %d late", temperature, load, late);
+        else
+            snprintf(reason, sizeof(reason), "%.0f%% load, %d late", load, late);
+
+        /* a step is given time to show before the next one */
+        if(over) {
+            calm = 0;
+            if(now - last_step >= GOVERNOR_SETTLE * 1000000ULL && governor_step(1, reason))
+                last_step = now;
+        } else if(headroom) {
+            calm += GOVERNOR_INTERVAL;
+            if(calm >= GOVERNOR_RESTORE && governor_step(0, reason)) {
+                last_step = now;
+                calm = 0;
+            }
+        } else {
+            calm = 0;
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: start the thread which degrades the inputs
+Input Value.: * global.....: the inputs
+              * temperature: limit in degrees Celsius, 0 for none
+              * load.......: limit of the load in percent
+Return Value: 0 on success, -1 otherwise
+******************************************************************************/
+int governor_start(globals *global, double temperature, double load)
+{
+    pthread_t thread;
+
+    pglobal = global;
+    state.max_temperature = temperature;
+    state.max_load = load;
+    state.temperature = read_temperature();
+    if(temperature > 0 && state.temperature < 0)
+        LOG("governor: there is no thermal zone, only the load and the deadlines are watched\n");
+
+    if(pthread_create(&thread, NULL, governor_thread, NULL) != 0)
+        return -1;
+    pthread_detach(thread);
+
+    pthread_mutex_lock(&state_mutex);
+    state.running = 1;
+    pthread_mutex_unlock(&state_mutex);
+    return 0;
+}
+
+/******************************************************************************
+Description.: copy what the governor saw last
+Input Value.: where to store it, running is 0 without --governor
+Return Value: -
+******************************************************************************/
+void governor_get(governor_state *copy)
+{
+    pthread_mutex_lock(&state_mutex);
+    *copy = state;
+    pthread_mutex_unlock(&state_mutex);
+}
+
+/******************************************************************************
+Description.: count a frame of a degraded input, every GOVERNOR_FPS_DIVISOR-th
+              one is kept
+Input Value.: the input
+Return Value: 1 if the frame is to be skipped, 0 otherwise
+******************************************************************************/
+static int fps_skip(input *in)
+{
+    if(in->governor_count++ % GOVERNOR_FPS_DIVISOR == 0)
+        return 0;
+
+    __sync_fetch_and_add(&in->stats.governor_skipped, 1);
+    return 1;
+}
+
+/******************************************************************************
+Description.: called by a plugin before it encodes a picture
+Input Value.: the input the picture is for
+Return Value: 1 if the plugin should skip the picture, 0 to encode it
+******************************************************************************/
+int governor_skip(input *in)
+{
+    in->encodes = 1;
+    if(__atomic_load_n(&in->degrade, __ATOMIC_RELAXED) < DEGRADE_FPS)
+        return 0;
+    return fps_skip(in);
+}
+
+/******************************************************************************
+Description.: called by input_publish_frame() for each frame, the frames of
+              plugins which skip their pictures themselves are kept
+Input Value.: the input
+Return Value: 1 if the frame is to be dropped, 0 to publish it
+******************************************************************************/
+int governor_drop(input *in)
+{
+    if(in->encodes || __atomic_load_n(&in->degrade, __ATOMIC_RELAXED) < DEGRADE_FPS)
+        return 0;
+    return fps_skip(in);
+}
+
+/******************************************************************************
+Description.: the JPEG quality a software encoder is to use
+Input Value.: * in.....: the input
+              * quality: the quality the plugin would use
+Return Value: the quality, GOVERNOR_QUALITY at most from DEGRADE_QUALITY on
+******************************************************************************/
+int governor_quality(input *in, int quality)
+{
+    if(__atomic_load_n(&in->degrade, __ATOMIC_RELAXED) < DEGRADE_QUALITY)
+        return quality;
+    return MIN(quality, GOVERNOR_QUALITY);
+}
+
+/******************************************************************************
+Description.: tell if the scaled, cropped and requantized streams of an input
+              take a frame
+Input Value.: * input_number: the input
+              * seq.........: sequence number of the frame
+Return Value: 1 if the frame is due, 0 if the streams skip it
+******************************************************************************/
+int governor_variant_due(int input_number, unsigned long long seq)
+{
+    if(pglobal == NULL || __atomic_load_n(&pglobal->in[input_number].degrade, __ATOMIC_RELAXED) < DEGRADE_VARIANTS)
+        return 1;
+    return seq % GOVERNOR_VARIANT_EVERY == 0;
+}
@@ -0,0 +1,88 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+/*
+ * the governor sheds load once the system runs hot, the CPUs are busy or the
+ * encoders of the inputs miss their deadlines, before the latency grows
+ * without bounds. A thread looks at the hottest thermal zone, the load of
+ * /proc/stat and the time each input takes to encode a frame against the
+ * interval of its frames once a second, and degrades one input one level
+ * further while any of them is over its limit. The inputs with the lowest
+ * --priority go first, all the way down, before the next ones are touched.
+ * Once everything stayed below the limits for GOVERNOR_RESTORE seconds the
+ * last step is undone, one at a time.
+ *
+ * The plugins and outputs ask the governor on the way of each frame, so a
+ * level costs nothing until it takes effect. Without --governor all inputs
+ * stay at DEGRADE_NONE.
+ */
+#define GOVERNOR_INTERVAL 1             // seconds between two looks
+#define GOVERNOR_SETTLE 3               // seconds a step is given to show before the next one
+#define GOVERNOR_RESTORE 10             // seconds of headroom before a step is undone
+#define GOVERNOR_TEMP_HYSTERESIS 5      // degrees under the limit which count as headroom
+#define GOVERNOR_LOAD_HYSTERESIS 15     // percent of load under the limit which count as headroom
+#define GOVERNOR_DEADLINE 80            // percent of its frame interval an encode may take
+#define GOVERNOR_LOAD 90                // default limit of the load
+#define GOVERNOR_FPS_DIVISOR 2          // a degraded input keeps every second frame
+#define GOVERNOR_QUALITY 50             // highest JPEG quality from DEGRADE_QUALITY on
+#define GOVERNOR_VARIANT_EVERY 4        // variants are renewed with every 4th frame from DEGRADE_VARIANTS on
+
+/* the levels of an input, each one adds to the ones before */
+typedef enum {
+    DEGRADE_NONE = 0,
+    DEGRADE_FPS,            // every second frame is skipped before it is encoded
+    DEGRADE_QUALITY,        // the software encoders stay at GOVERNOR_QUALITY or below
+    DEGRADE_VARIANTS,       // scaled, cropped and requantized streams of output_http
+                            // are renewed less often
+    DEGRADE_LEVELS
+} degrade_level;
+
+typedef struct {
+    int running;
+    double max_temperature;         // limit in degrees Celsius, 0 for none
+    double max_load;                // limit in percent
+    double temperature;             // of the hottest thermal zone, -1 if there is none
+    double load;                    // percent of the time the CPUs were busy in the last interval
+    int late;                       // inputs which missed their encode deadline in it
+    unsigned long long actions;     // steps taken either way
+} governor_state;
+
+struct _globals;
+struct _input;
+
+int governor_parse(const char *arg, double *temperature, double *load);
+int governor_start(struct _globals *global, double temperature, double load);
+void governor_get(governor_state *state);
+const char *degrade_name(int level);
+
+/*
+ * the hooks on the way of the frames. Plugins which encode call
+ * governor_skip() before they do, input_publish_frame() drops the frames of
+ * the other inputs with governor_drop() instead.
+ */
+int governor_skip(struct _input *in);
+int governor_drop(struct _input *in);
+int governor_quality(struct _input *in, int quality);
+int governor_variant_due(int input_number, unsigned long long seq);
+
+#endif
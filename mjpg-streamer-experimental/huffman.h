@@ -0,0 +1,213 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+/*
+ * huffman decoding of the entropy coded data of a baseline JPEG, shared by
+ * the motion detection and output_autofocus. Both only read coefficients,
+ * so this ends at the symbols; what a symbol means is up to them. The
+ * functions are inline, decode_symbol() runs for every coefficient.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+/* codes up to this length are decoded with a single table lookup */
+#define HUFFMAN_FAST_BITS 9
+
+typedef struct {
+    unsigned char definition[16 + 256];     // counts and symbols as in the DHT
+    int length;                             // of the definition, 0 if unused
+    unsigned char fast_length[1 << HUFFMAN_FAST_BITS];
+    unsigned char fast_symbol[1 << HUFFMAN_FAST_BITS];
+    int maxcode[18];                        // largest code of each length
+    int offset[17];                         // from a code to its symbol index
+    unsigned char symbols[256];
+} huffman_table;
+
+typedef struct {
+    const unsigned char *data;
+    const unsigned char *end;
+    uint64_t bits;                          // msb first
+    int count;
+} bit_reader;
+
+/******************************************************************************
+Description.: build the lookup tables of a huffman table, unless they were
+              built for the same definition before
+Input Value.: * table.....: to build
+              * definition: 16 counts of codes per length and the symbols
+              * length....: bytes available at definition
+Return Value: bytes of the definition, -1 if it is broken
+******************************************************************************/
+static inline int huffman_build_table(huffman_table *table, const unsigned char *definition, int length)
+{
+    int count = 0, code = 0, index = 0, bits, i, j, fill;
+
+    if(length < 16)
+        return -1;
+    for(i = 0; i < 16; i++)
+        count += definition[i];
+    if(count > 256 || 16 + count > length)
+        return -1;
+
+    /* cameras send the same tables with every frame */
+    if(table->length == 16 + count && memcmp(table->definition, definition, 16 + count) == 0)
+        return 16 + count;
+
+    memcpy(table->definition, definition, 16 + count);
+    memcpy(table->symbols, definition + 16, count);
+    memset(table->fast_length, 0, sizeof(table->fast_length));
+    table->length = 0;
+
+    for(bits = 1; bits <= 16; bits++) {
+        /* the codes of a length have to fit into it before any is entered */
+        if(code + definition[bits - 1] > (1 << bits))
+            return -1;
+        table->offset[bits] = index - code;
+        for(j = 0; j < definition[bits - 1]; j++, index++, code++) {
+            if(bits > HUFFMAN_FAST_BITS)
+                continue;
+            /* every lookahead starting with this code */
+            fill = 1 << (HUFFMAN_FAST_BITS - bits);
+            for(i = 0; i < fill; i++) {
+                table->fast_length[(code << (HUFFMAN_FAST_BITS - bits)) | i] = bits;
+                table->fast_symbol[(code << (HUFFMAN_FAST_BITS - bits)) | i] = table->symbols[index];
+            }
+        }
+        table->maxcode[bits] = definition[bits - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    table->maxcode[17] = 0x7fffffff;
+
+    table->length = 16 + count;
+    return 16 + count;
+}
+
+/******************************************************************************
+Description.: top the bit buffer up to more than 56 bits, a marker ends the
+              entropy coded data and zeros are shifted in after it
+Input Value.: * reader: the bit reader
+Return Value: -
+******************************************************************************/
+static inline void huffman_fill(bit_reader *reader)
+{
+    unsigned char byte;
+    uint64_t word;
+
+    /*
+     * the usual case, eight bytes without a 0xff among them are taken at
+     * once. The bits behind the last whole byte are those of the next one,
+     * which puts the same bits there again.
+     */
+    if(reader->end - reader->data >= 8) {
+        memcpy(&word, reader->data, 8);
+        if((((~word) - 0x0101010101010101ULL) & word & 0x8080808080808080ULL) == 0) {
+            word = be64toh(word);
+            reader->bits |= word >> reader->count;
+            reader->data += (64 - reader->count) >> 3;
+            reader->count += ((64 - reader->count) >> 3) << 3;
+            return;
+        }
+    }
+
+    while(reader->count <= 56) {
+        byte = 0;
+        if(reader->data < reader->end) {
+            byte = *reader->data;
+            if(byte == 0xff) {
+                if(reader->data + 1 < reader->end && reader->data[1] == 0x00)
+                    reader->data += 2;
+                else
+                    byte = 0, reader->end = reader->data;
+            } else {
+                reader->data++;
+            }
+        }
+        reader->bits |= (uint64_t)byte << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+static inline int huffman_get_bits(bit_reader *reader, int count)
+{
+    int value = (int)(reader->bits >> (64 - count));
+
+    reader->bits <<= count;
+    reader->count -= count;
+    return value;
+}
+
+/******************************************************************************
+Description.: decode one symbol, the buffer must hold at least 16 bits
+Input Value.: * reader: the bit reader
+              * table.: the huffman table
+Return Value: the symbol, -1 if the code is not in the table
+******************************************************************************/
+static inline int huffman_decode(bit_reader *reader, const huffman_table *table)
+{
+    int look = (int)(reader->bits >> (64 - HUFFMAN_FAST_BITS)), bits, code;
+
+    if((bits = table->fast_length[look]) != 0) {
+        reader->bits <<= bits;
+        reader->count -= bits;
+        return table->fast_symbol[look];
+    }
+
+    for(bits = HUFFMAN_FAST_BITS + 1; bits <= 16; bits++) {
+        code = (int)(reader->bits >> (64 - bits));
+        if(code <= table->maxcode[bits]) {
+            reader->bits <<= bits;
+            reader->count -= bits;
+            return table->symbols[code + table->offset[bits]];
+        }
+    }
+    return -1;
+}
+
+/******************************************************************************
+Description.: skip to the restart marker which ends an interval
+Input Value.: * reader: the bit reader
+              * end...: of the JPEG
+Return Value: 0 if ok, -1 if there is no restart marker
+******************************************************************************/
+static inline int huffman_restart(bit_reader *reader, const unsigned char *end)
+{
+    const unsigned char *p = reader->data;
+
+    while((p = memchr(p, 0xff, end - p)) != NULL && p + 1 < end) {
+        if(p[1] >= 0xd0 && p[1] <= 0xd7)
+            break;
+        p++;
+    }
+    if(p == NULL || p + 1 >= end)
+        return -1;
+
+    reader->data = p + 2;
+    reader->end = end;
+    reader->bits = 0;
+    reader->count = 0;
+    return 0;
+}
+
+#endif
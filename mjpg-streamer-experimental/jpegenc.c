@@ -0,0 +1,1126 @@
+/*******************************************************************************
+# Linux-UVC streaming input-plugin for MJPG-streamer                           #
+#                                                                              #
+# This package work with the Logitech UVC based webcams with the mjpeg feature #
+#                                                                              #
+#   Orginally Copyright (C) 2005 2006 Laurent Pinchart &&  Michel Xhaard       #
+#   Modifications Copyright (C) 2006  Gabriel A. Devenyi                       #
+#   Modifications Copyright (C) 2007  Tom Stöveken                             #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * JPEG encoder backends for input plugins
+ *
+ * Raw pictures are compressed by one of several encoders behind the same
+ * function: libjpeg, libjpeg on the threads of a jpeg_encoder in slices,
+ * TurboJPEG or a V4L2 mem2mem device. Plugins let the user pick one per
+ * input. In the auto mode each encoder that is available compresses a few
+ * of the first pictures, the fastest one keeps the job.
+ *
+ * A backend that can not take the pictures, because it is missing from this
+ * build, does not know their format or its device failed, hands the job to
+ * libjpeg for good.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#endif
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+/* compressors kept per backend, enough for the slices of all encoder threads */
+#define JPEG_COMPRESSORS 16
+
+/* pictures each encoder gets in the auto mode, the first one only warms it up */
+#define AUTO_PICTURES 4
+
+/* returned by an encoder which can not take the picture at all */
+#define JPEG_UNSUPPORTED -2
+
+static const char *backend_names[JPEG_BACKENDS] = {"auto", "libjpeg", "slices", "turbojpeg", "m2m"};
+
+#ifndef NO_LIBJPEG
+/* a libjpeg compressor which is set up once and reused for many pictures */
+typedef struct {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr dest;
+    int busy;                   /* taken by a thread, only changed atomically */
+    int created;                /* cinfo holds a compressor */
+    unsigned int pixelformat;   /* the pictures it is set up for */
+    int width, quality, flags;
+    unsigned char *buffer;      /* destination of the current picture */
+    int size;
+    int overflow;               /* the JPEG did not fit into buffer */
+    JSAMPARRAY planes[3];       /* MCU rows of raw 4:2:2 data */
+    unsigned char *line_buffer; /* a line of RGB pixels */
+    JOCTET spill[4096];         /* takes the rest of a JPEG which did not fit */
+} jpeg_compressor;
+#endif
+
+struct _jpeg_backend {
+    int backend;                /* the configured one */
+    int current;                /* the one compressing, JPEG_BACKEND_AUTO while they are compared */
+    int flags;
+    char *device;               /* of the mem2mem encoder, NULL to search for one */
+    jpeg_encoder *encoder;      /* threads of the slices, may be NULL */
+    int own_encoder;            /* the encoder was started for this backend */
+
+    #ifndef NO_LIBJPEG
+    jpeg_compressor compressors[JPEG_COMPRESSORS];
+    #endif
+
+    /* JPEG_BACKEND_M2M, opened with the first picture */
+    m2m_encoder *m2m;
+    int m2m_failed;
+    unsigned int m2m_format;    /* the pictures it was opened for */
+    int m2m_width, m2m_height, m2m_stride;
+
+    #ifdef HAVE_TURBOJPEG
+    tjhandle tj;
+    unsigned char *tj_buffer;   /* takes JPEGs which may not fit the destination */
+    unsigned long tj_capacity;
+    unsigned char *tj_planes;   /* packed 4:2:2 pictures split into planes */
+    size_t tj_planes_size;
+    #endif
+
+    /* the auto mode */
+    int candidates[JPEG_BACKENDS];
+    unsigned long long best_usec[JPEG_BACKENDS];
+    int count;                  /* number of candidates */
+    int trial;                  /* pictures the candidates compressed so far */
+};
+
+/******************************************************************************
+Description.: look up an encoder backend by name
+Input Value.: auto, libjpeg, slices, turbojpeg or m2m
+Return Value: JPEG_BACKEND_*, -1 for unknown names
+******************************************************************************/
+int jpeg_backend_parse(const char *name)
+{
+    int i;
+
+    for(i = 0; i < JPEG_BACKENDS; i++) {
+        if(strcmp(name, backend_names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: name of an encoder backend
+Input Value.: JPEG_BACKEND_*
+Return Value: the name, "unknown" for invalid values
+******************************************************************************/
+const char *jpeg_backend_name(int backend)
+{
+    return (backend >= 0 && backend < JPEG_BACKENDS) ? backend_names[backend] : "unknown";
+}
+
+#if !defined(NO_LIBJPEG) || defined(HAVE_TURBOJPEG)
+/******************************************************************************
+Description.: split a line of YUYV or UYVY pixels into its Y, Cb and Cr
+              planes, the way jpeg_write_raw_data() takes them
+Input Value.: * src...: the packed line
+              * width.: number of pixels, even
+              * uyvy..: nonzero if the chroma comes first
+              * y.....: width luma samples are stored here
+              * u, v..: width / 2 chroma samples each are stored here
+Return Value: -
+******************************************************************************/
+static void split_yuv422_line(const unsigned char *src, int width, int uyvy,
+                              unsigned char *y, unsigned char *u, unsigned char *v)
+{
+    int x = 0;
+
+    #if defined(__SSE2__)
+    const __m128i low = _mm_set1_epi16(0x00ff);
+
+    /* 16 pixels per round */
+    for(; x + 16 <= width; x += 16, src += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i luma, chroma;
+
+        if(uyvy) {
+            luma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            chroma = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+        } else {
+            luma = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+            chroma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        }
+
+        _mm_storeu_si128((__m128i *)(y + x), luma);
+        _mm_storel_epi64((__m128i *)(u + x / 2), _mm_packus_epi16(_mm_and_si128(chroma, low), chroma));
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(chroma, 8), chroma));
+    }
+    #elif defined(__ARM_NEON)
+    /* 16 pixels per round, vld4 sorts the bytes into Y0, U, Y1 and V */
+    for(; x + 16 <= width; x += 16, src += 32) {
+        uint8x8x4_t p = vld4_u8(src);
+        uint8x8x2_t luma;
+
+        if(uyvy) {
+            luma.val[0] = p.val[1];
+            luma.val[1] = p.val[3];
+            vst1_u8(u + x / 2, p.val[0]);
+            vst1_u8(v + x / 2, p.val[2]);
+        } else {
+            luma.val[0] = p.val[0];
+            luma.val[1] = p.val[2];
+            vst1_u8(u + x / 2, p.val[1]);
+            vst1_u8(v + x / 2, p.val[3]);
+        }
+        vst2_u8(y + x, luma);
+    }
+    #endif
+
+    for(; x < width; x += 2, src += 4) {
+        if(uyvy) {
+            y[x] = src[1];
+            y[x + 1] = src[3];
+            u[x / 2] = src[0];
+            v[x / 2] = src[2];
+        } else {
+            y[x] = src[0];
+            y[x + 1] = src[2];
+            u[x / 2] = src[1];
+            v[x / 2] = src[3];
+        }
+    }
+}
+
+/******************************************************************************
+Description.: split a line of the interleaved chroma plane of NV12 or NV16
+              into its Cb and Cr samples
+Input Value.: * src..: the CbCr pairs
+              * count: number of pairs
+              * u, v.: count samples each are stored here
+Return Value: -
+******************************************************************************/
+static void split_uv_line(const unsigned char *src, int count, unsigned char *u, unsigned char *v)
+{
+    int x = 0;
+
+    #if defined(__SSE2__)
+    const __m128i low = _mm_set1_epi16(0x00ff);
+
+    /* 16 pairs per round */
+    for(; x + 16 <= count; x += 16, src += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+        _mm_storeu_si128((__m128i *)(u + x), _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+        _mm_storeu_si128((__m128i *)(v + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    #elif defined(__ARM_NEON)
+    /* 16 pairs per round, vld2 sorts the bytes into Cb and Cr */
+    for(; x + 16 <= count; x += 16, src += 32) {
+        uint8x16x2_t p = vld2q_u8(src);
+
+        vst1q_u8(u + x, p.val[0]);
+        vst1q_u8(v + x, p.val[1]);
+    }
+    #endif
+
+    for(; x < count; x++, src += 2) {
+        u[x] = src[0];
+        v[x] = src[1];
+    }
+}
+#endif
+
+#ifndef NO_LIBJPEG
+/******************************************************************************
+Description.: libjpeg destination manager writing into the buffer given to
+              compress_lines(), a JPEG which does not fit goes on into the
+              spill area and is thrown away
+Input Value.: the compressor
+Return Value: -
+******************************************************************************/
+METHODDEF(void) init_destination(j_compress_ptr cinfo)
+{
+    jpeg_compressor *c = (jpeg_compressor *)cinfo;
+
+    c->dest.next_output_byte = c->buffer;
+    c->dest.free_in_buffer = c->size;
+    c->overflow = 0;
+}
+
+METHODDEF(boolean) empty_output_buffer(j_compress_ptr cinfo)
+{
+    jpeg_compressor *c = (jpeg_compressor *)cinfo;
+
+    c->overflow = 1;
+    c->dest.next_output_byte = c->spill;
+    c->dest.free_in_buffer = sizeof(c->spill);
+    return TRUE;
+}
+
+METHODDEF(void) term_destination(j_compress_ptr cinfo)
+{
+}
+
+/******************************************************************************
+Description.: compress YUYV or UYVY data without converting it to RGB, the
+              planes are handed to libjpeg as 4:2:2 sampled YCbCr
+Input Value.: * c....: compressor set up for raw data, already started
+              * pic..: the picture
+              * first: first line of the picture to compress
+Return Value: -
+******************************************************************************/
+static void write_yuv422(jpeg_compressor *c, const jpeg_picture *pic, int first)
+{
+    j_compress_ptr cinfo = &c->cinfo;
+    JSAMPARRAY *planes = c->planes;
+    int w = pic->format.width;
+    int uyvy = (pic->format.pixelformat == V4L2_PIX_FMT_UYVY);
+    /* the planes are padded to whole MCUs of 16x8 pixels */
+    int width = (w + 15) & ~15;
+    int i, row, line;
+
+    while(cinfo->next_scanline < cinfo->image_height) {
+        for(row = 0; row < DCTSIZE; row++) {
+            /* the last line is repeated to fill the MCU */
+            line = cinfo->next_scanline + row;
+            if(line >= (int)cinfo->image_height)
+                line = cinfo->image_height - 1;
+            line += first;
+            split_yuv422_line(pic->plane[0] + line * pic->format.stride[0], w, uyvy,
+                              planes[0][row], planes[1][row], planes[2][row]);
+
+            for(i = w; i < width; i++)
+                planes[0][row][i] = planes[0][row][w - 1];
+            for(i = w / 2; i < width / 2; i++) {
+                planes[1][row][i] = planes[1][row][w / 2 - 1];
+                planes[2][row][i] = planes[2][row][w / 2 - 1];
+            }
+        }
+
+        jpeg_write_raw_data(cinfo, planes, DCTSIZE);
+    }
+}
+
+/******************************************************************************
+Description.: hand the planes of a YUV420 picture to libjpeg as they are, 16
+              luma and 8 chroma rows at a time
+Input Value.: * c....: compressor set up for raw data, already started
+              * pic..: the picture
+              * first: first line of the picture to compress, even
+Return Value: -
+******************************************************************************/
+static void write_yuv420(jpeg_compressor *c, const jpeg_picture *pic, int first)
+{
+    j_compress_ptr cinfo = &c->cinfo;
+    const raw_format *f = &pic->format;
+    JSAMPROW y[16], u[8], v[8];
+    JSAMPARRAY data[3] = { y, u, v };
+    int i, row;
+
+    /* the last rows repeat at the bottom */
+    while(cinfo->next_scanline < cinfo->image_height) {
+        for(i = 0; i < 16; i++) {
+            row = MIN(cinfo->next_scanline + i, cinfo->image_height - 1);
+            y[i] = (JSAMPROW)(pic->plane[0] + (first + row) * f->stride[0]);
+            if(i < 8) {
+                row = MIN(cinfo->next_scanline / 2 + i, (cinfo->image_height - 1) / 2);
+                u[i] = (JSAMPROW)(pic->plane[1] + (first / 2 + row) * f->stride[1]);
+                v[i] = (JSAMPROW)(pic->plane[2] + (first / 2 + row) * f->stride[2]);
+            }
+        }
+        jpeg_write_raw_data(cinfo, data, 16);
+    }
+}
+
+/******************************************************************************
+Description.: hand a NV12 or NV16 picture to libjpeg without converting it,
+              the luma rows are passed as they are and the interleaved chroma
+              is split into the planes of the compressor
+Input Value.: * c....: compressor set up for raw data, already started
+              * pic..: the picture
+              * first: first line of the picture to compress, even for NV12
+Return Value: -
+******************************************************************************/
+static void write_nv(jpeg_compressor *c, const jpeg_picture *pic, int first)
+{
+    j_compress_ptr cinfo = &c->cinfo;
+    const raw_format *f = &pic->format;
+    int nv12 = (f->pixelformat == V4L2_PIX_FMT_NV12);
+    int rows = nv12 ? 2 * DCTSIZE : DCTSIZE;
+    int count = (f->width + 1) / 2;
+    /* the chroma planes are padded to whole MCUs of 16 pixels */
+    int width = ((f->width + 15) & ~15) / 2;
+    JSAMPROW y[2 * DCTSIZE];
+    JSAMPARRAY data[3] = { y, c->planes[1], c->planes[2] };
+    int i, x, row;
+
+    /* the last rows repeat at the bottom */
+    while(cinfo->next_scanline < cinfo->image_height) {
+        for(i = 0; i < rows; i++) {
+            row = MIN(cinfo->next_scanline + i, cinfo->image_height - 1);
+            y[i] = (JSAMPROW)(pic->plane[0] + (first + row) * f->stride[0]);
+        }
+        for(i = 0; i < DCTSIZE; i++) {
+            if(nv12)
+                row = first / 2 + MIN(cinfo->next_scanline / 2 + i, (cinfo->image_height - 1) / 2);
+            else
+                row = first + MIN(cinfo->next_scanline + i, cinfo->image_height - 1);
+            split_uv_line(pic->plane[1] + row * f->stride[1], count, c->planes[1][i], c->planes[2][i]);
+
+            for(x = count; x < width; x++) {
+                c->planes[1][i][x] = c->planes[1][i][count - 1];
+                c->planes[2][i][x] = c->planes[2][i][count - 1];
+            }
+        }
+        jpeg_write_raw_data(cinfo, data, rows);
+    }
+}
+
+/******************************************************************************
+Description.: hand the lines of a RGB24, BGR24, RGB565 or GREY picture to
+              libjpeg, converting them to RGB if needed
+Input Value.: * c....: compressor, already started
+              * pic..: the picture
+              * first: first line of the picture to compress
+Return Value: -
+******************************************************************************/
+static void write_lines(jpeg_compressor *c, const jpeg_picture *pic, int first)
+{
+    j_compress_ptr cinfo = &c->cinfo;
+    const raw_format *f = &pic->format;
+    JSAMPROW row_pointer[1];
+    int x;
+
+    while(cinfo->next_scanline < cinfo->image_height) {
+        const unsigned char *src = pic->plane[0] + (first + cinfo->next_scanline) * f->stride[0];
+        unsigned char *ptr = c->line_buffer;
+
+        if(f->pixelformat == V4L2_PIX_FMT_RGB565) {
+            for(x = 0; x < f->width; x++) {
+                unsigned int twoByte = (src[1] << 8) + src[0];
+                *(ptr++) = (src[1] & 248);
+                *(ptr++) = (unsigned char)((twoByte & 2016) >> 3);
+                *(ptr++) = ((src[0] & 31) * 8);
+                src += 2;
+            }
+            row_pointer[0] = c->line_buffer;
+        #ifndef JCS_EXTENSIONS
+        } else if(f->pixelformat == V4L2_PIX_FMT_BGR24) {
+            for(x = 0; x < f->width; x++) {
+                *(ptr++) = src[2];
+                *(ptr++) = src[1];
+                *(ptr++) = src[0];
+                src += 3;
+            }
+            row_pointer[0] = c->line_buffer;
+        #endif
+        } else {
+            /* the lines are already laid out the way libjpeg wants them */
+            row_pointer[0] = (JSAMPROW)src;
+        }
+
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
+    }
+}
+
+/******************************************************************************
+Description.: take a compressor of the backend no other thread uses
+Input Value.: the backend
+Return Value: the compressor, NULL if all are busy
+******************************************************************************/
+static jpeg_compressor *take_compressor(jpeg_backend *b)
+{
+    int i;
+
+    for(i = 0; i < JPEG_COMPRESSORS; i++) {
+        if(__sync_lock_test_and_set(&b->compressors[i].busy, 1) == 0)
+            return &b->compressors[i];
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: set up a compressor for a kind of pictures. This is only done
+              when the format, width or flags changed, the destination
+              manager and the row buffers are kept otherwise and a new
+              quality only builds the tables again.
+Input Value.: * c......: the compressor
+              * f......: format of the pictures
+              * quality: JPEG quality
+              * flags..: JPEG_OPTIMIZE, JPEG_PROGRESSIVE
+Return Value: -
+******************************************************************************/
+static void setup_compressor(jpeg_compressor *c, const raw_format *f, int quality, int flags)
+{
+    unsigned int format = f->pixelformat;
+    /* the planes are padded to whole MCUs of 16x8 pixels */
+    int width = (f->width + 15) & ~15;
+
+    if(c->created) {
+        if(c->width == f->width && c->pixelformat == format && c->flags == flags) {
+            if(c->quality != quality) {
+                jpeg_set_quality(&c->cinfo, quality, TRUE);
+                c->quality = quality;
+            }
+            return;
+        }
+        jpeg_destroy_compress(&c->cinfo);
+    }
+
+    c->cinfo.err = jpeg_std_error(&c->jerr);
+    jpeg_create_compress(&c->cinfo);
+    c->created = 1;
+    c->width = f->width;
+    c->pixelformat = format;
+    c->quality = quality;
+    c->flags = flags;
+    c->line_buffer = NULL;
+
+    c->dest.init_destination = init_destination;
+    c->dest.empty_output_buffer = empty_output_buffer;
+    c->dest.term_destination = term_destination;
+    c->cinfo.dest = &c->dest;
+
+    c->cinfo.image_width = f->width;
+    c->cinfo.image_height = f->height;
+    c->cinfo.input_components = 3;
+    if(format == V4L2_PIX_FMT_YUYV || format == V4L2_PIX_FMT_UYVY || format == V4L2_PIX_FMT_YUV420 ||
+       format == V4L2_PIX_FMT_NV12 || format == V4L2_PIX_FMT_NV16) {
+        c->cinfo.in_color_space = JCS_YCbCr;
+    } else if(format == V4L2_PIX_FMT_GREY) {
+        c->cinfo.input_components = 1;
+        c->cinfo.in_color_space = JCS_GRAYSCALE;
+    #ifdef JCS_EXTENSIONS
+    } else if(format == V4L2_PIX_FMT_BGR24) {
+        /* libjpeg-turbo reads the B, G, R order itself */
+        c->cinfo.in_color_space = JCS_EXT_BGR;
+    #endif
+    } else {
+        c->cinfo.in_color_space = JCS_RGB;
+    }
+
+    jpeg_set_defaults(&c->cinfo);
+    jpeg_set_quality(&c->cinfo, quality, TRUE);
+
+    if(format == V4L2_PIX_FMT_YUYV || format == V4L2_PIX_FMT_UYVY) {
+        /* the camera delivers 4:2:2 already, libjpeg takes the planes as they are */
+        c->cinfo.raw_data_in = TRUE;
+        c->cinfo.comp_info[0].h_samp_factor = 2;
+        c->cinfo.comp_info[0].v_samp_factor = 1;
+        c->cinfo.comp_info[1].h_samp_factor = 1;
+        c->cinfo.comp_info[1].v_samp_factor = 1;
+        c->cinfo.comp_info[2].h_samp_factor = 1;
+        c->cinfo.comp_info[2].v_samp_factor = 1;
+
+        c->planes[0] = (*c->cinfo.mem->alloc_sarray)((j_common_ptr)&c->cinfo, JPOOL_PERMANENT, width, DCTSIZE);
+        c->planes[1] = (*c->cinfo.mem->alloc_sarray)((j_common_ptr)&c->cinfo, JPOOL_PERMANENT, width / 2, DCTSIZE);
+        c->planes[2] = (*c->cinfo.mem->alloc_sarray)((j_common_ptr)&c->cinfo, JPOOL_PERMANENT, width / 2, DCTSIZE);
+    } else if(format == V4L2_PIX_FMT_YUV420) {
+        /* the planes are passed as they are, the defaults already sample 2x2 */
+        c->cinfo.raw_data_in = TRUE;
+    } else if(format == V4L2_PIX_FMT_NV12 || format == V4L2_PIX_FMT_NV16) {
+        /* the luma is passed as it is, NV16 has the chroma of every line */
+        c->cinfo.raw_data_in = TRUE;
+        if(format == V4L2_PIX_FMT_NV16)
+            c->cinfo.comp_info[0].v_samp_factor = 1;
+
+        c->planes[1] = (*c->cinfo.mem->alloc_sarray)((j_common_ptr)&c->cinfo, JPOOL_PERMANENT, width / 2, DCTSIZE);
+        c->planes[2] = (*c->cinfo.mem->alloc_sarray)((j_common_ptr)&c->cinfo, JPOOL_PERMANENT, width / 2, DCTSIZE);
+    } else if(format == V4L2_PIX_FMT_RGB565 || format == V4L2_PIX_FMT_BGR24) {
+        c->line_buffer = (*c->cinfo.mem->alloc_small)((j_common_ptr)&c->cinfo, JPOOL_PERMANENT, f->width * 3);
+    }
+
+    c->cinfo.optimize_coding = (flags & JPEG_OPTIMIZE) ? TRUE : FALSE;
+    if(flags & JPEG_PROGRESSIVE)
+        jpeg_simple_progression(&c->cinfo);
+}
+
+/******************************************************************************
+Description.: tell whether libjpeg is given pictures of a format
+Input Value.: V4L2_PIX_FMT_*
+Return Value: nonzero if compress_lines() takes them
+******************************************************************************/
+static int libjpeg_format(unsigned int format)
+{
+    return format == V4L2_PIX_FMT_YUYV || format == V4L2_PIX_FMT_UYVY || format == V4L2_PIX_FMT_YUV420 ||
+           format == V4L2_PIX_FMT_NV12 || format == V4L2_PIX_FMT_NV16 || format == V4L2_PIX_FMT_RGB24 || format == V4L2_PIX_FMT_BGR24 || format == V4L2_PIX_FMT_RGB565 ||
+           format == V4L2_PIX_FMT_GREY;
+}
+
+/******************************************************************************
+Description.: compress some lines of a picture with libjpeg. Based on
+              compress_yuyv_to_jpeg written by Gabriel A. Devenyi, modified
+              to support other formats like RGB5:6:5 by Miklós Márton.
+Input Value.: * b......: the backend holding the compressors
+              * pic....: the picture
+              * first..: first line to compress
+              * lines..: number of lines
+              * quality: JPEG quality
+              * buffer.: destination
+              * size...: size of the destination
+Return Value: length of the JPEG, -1 if it did not fit, JPEG_UNSUPPORTED for
+              formats libjpeg is not given
+******************************************************************************/
+static int compress_lines(jpeg_backend *b, const jpeg_picture *pic, int first, int lines,
+                          int quality, unsigned char *buffer, int size)
+{
+    unsigned int format = pic->format.pixelformat;
+    jpeg_compressor *c, tmp;
+    int len;
+
+    if(!libjpeg_format(format))
+        return JPEG_UNSUPPORTED;
+
+    /* more threads than compressors, this one is thrown away afterwards */
+    if((c = take_compressor(b)) == NULL) {
+        memset(&tmp, 0, sizeof(tmp));
+        c = &tmp;
+    }
+
+    setup_compressor(c, &pic->format, quality, b->flags);
+    c->buffer = buffer;
+    c->size = size;
+    c->cinfo.image_height = lines;
+
+    jpeg_start_compress(&c->cinfo, TRUE);
+    if(format == V4L2_PIX_FMT_YUYV || format == V4L2_PIX_FMT_UYVY) {
+        write_yuv422(c, pic, first);
+    } else if(format == V4L2_PIX_FMT_YUV420) {
+        write_yuv420(c, pic, first);
+    } else if(format == V4L2_PIX_FMT_NV12 || format == V4L2_PIX_FMT_NV16) {
+        write_nv(c, pic, first);
+    } else {
+        write_lines(c, pic, first);
+    }
+    /* finishing keeps the compressor and its tables for the next picture */
+    jpeg_finish_compress(&c->cinfo);
+    len = c->overflow ? -1 : size - (int)c->dest.free_in_buffer;
+
+    if(c == &tmp)
+        jpeg_destroy_compress(&tmp.cinfo);
+    else
+        __sync_lock_release(&c->busy);
+
+    return len;
+}
+
+/* what the slices of a picture need to know */
+typedef struct {
+    jpeg_backend *b;
+    const jpeg_picture *pic;
+    int quality;
+} slice_job;
+
+/******************************************************************************
+Description.: jpeg_slice_fn for the encoder, compresses some lines
+Input Value.: the slice_job, the range of lines and the destination
+Return Value: length of the JPEG, -1 on errors
+******************************************************************************/
+static int compress_slice(void *arg, int first, int lines, unsigned char *buffer, int size)
+{
+    slice_job *job = arg;
+    int len = compress_lines(job->b, job->pic, first, lines, job->quality, buffer, size);
+
+    return (len < 0) ? -1 : len;
+}
+#endif
+
+#ifdef HAVE_TURBOJPEG
+/******************************************************************************
+Description.: compress a picture with TurboJPEG, packed 4:2:2 pictures are
+              split into planes first
+Input Value.: * b......: the backend
+              * pic....: the picture
+              * quality: JPEG quality
+              * buffer.: destination
+              * size...: size of the destination
+Return Value: length of the JPEG, -1 on errors, JPEG_UNSUPPORTED for formats
+              TurboJPEG is not given
+******************************************************************************/
+static int compress_turbojpeg(jpeg_backend *b, const jpeg_picture *pic, int quality, unsigned char *buffer, int size)
+{
+    const raw_format *f = &pic->format;
+    const unsigned char *planes[3];
+    unsigned char *out;
+    unsigned long len, capacity;
+    int strides[3], subsamp, pf = -1, ret, i;
+
+    switch(f->pixelformat) {
+    case V4L2_PIX_FMT_RGB24:
+        pf = TJPF_RGB;
+        subsamp = TJSAMP_420;
+        break;
+    case V4L2_PIX_FMT_BGR24:
+        pf = TJPF_BGR;
+        subsamp = TJSAMP_420;
+        break;
+    case V4L2_PIX_FMT_GREY:
+        pf = TJPF_GRAY;
+        subsamp = TJSAMP_GRAY;
+        break;
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_NV12:
+        subsamp = TJSAMP_420;
+        break;
+    case V4L2_PIX_FMT_NV16:
+        subsamp = TJSAMP_422;
+        break;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        subsamp = TJSAMP_422;
+        break;
+    default:
+        return JPEG_UNSUPPORTED;
+    }
+
+    /* Huffman optimization and progressive JPEGs are left to libjpeg */
+    if(b->flags != 0 || (b->tj == NULL && (b->tj = tjInitCompress()) == NULL))
+        return JPEG_UNSUPPORTED;
+
+    if(f->pixelformat == V4L2_PIX_FMT_YUYV || f->pixelformat == V4L2_PIX_FMT_UYVY) {
+        size_t need = (size_t)f->width * f->height * 2;
+
+        if(b->tj_planes_size < need) {
+            free(b->tj_planes);
+            if((b->tj_planes = malloc(need)) == NULL) {
+                b->tj_planes_size = 0;
+                return -1;
+            }
+            b->tj_planes_size = need;
+        }
+
+        strides[0] = f->width;
+        strides[1] = strides[2] = f->width / 2;
+        planes[0] = b->tj_planes;
+        planes[1] = b->tj_planes + f->width * f->height;
+        planes[2] = planes[1] + (f->width / 2) * f->height;
+        for(i = 0; i < f->height; i++)
+            split_yuv422_line(pic->plane[0] + i * f->stride[0], f->width, f->pixelformat == V4L2_PIX_FMT_UYVY,
+                              (unsigned char *)planes[0] + i * strides[0],
+                              (unsigned char *)planes[1] + i * strides[1],
+                              (unsigned char *)planes[2] + i * strides[2]);
+    } else if(f->pixelformat == V4L2_PIX_FMT_NV12 || f->pixelformat == V4L2_PIX_FMT_NV16) {
+        /* the luma is taken as it is, only the chroma is split */
+        int count = (f->width + 1) / 2;
+        int rows = (f->pixelformat == V4L2_PIX_FMT_NV12) ? (f->height + 1) / 2 : f->height;
+        size_t need = (size_t)count * rows * 2;
+
+        if(b->tj_planes_size < need) {
+            free(b->tj_planes);
+            if((b->tj_planes = malloc(need)) == NULL) {
+                b->tj_planes_size = 0;
+                return -1;
+            }
+            b->tj_planes_size = need;
+        }
+
+        strides[0] = f->stride[0];
+        strides[1] = strides[2] = count;
+        planes[0] = pic->plane[0];
+        planes[1] = b->tj_planes;
+        planes[2] = b->tj_planes + count * rows;
+        for(i = 0; i < rows; i++)
+            split_uv_line(pic->plane[1] + i * f->stride[1], count,
+                          (unsigned char *)planes[1] + i * count, (unsigned char *)planes[2] + i * count);
+    } else {
+        for(i = 0; i < RAW_PLANES; i++) {
+            planes[i] = pic->plane[i];
+            strides[i] = f->stride[i];
+        }
+    }
+
+    /* TurboJPEG writes into the destination itself if it takes the largest JPEG possible */
+    capacity = tjBufSize(f->width, f->height, subsamp);
+    if((unsigned long)size >= capacity) {
+        out = buffer;
+    } else {
+        if(b->tj_capacity < capacity) {
+            tjFree(b->tj_buffer);
+            if((b->tj_buffer = tjAlloc(capacity)) == NULL) {
+                b->tj_capacity = 0;
+                return -1;
+            }
+            b->tj_capacity = capacity;
+        }
+        out = b->tj_buffer;
+    }
+
+    len = capacity;
+    if(pf >= 0) {
+        ret = tjCompress2(b->tj, (unsigned char *)planes[0], f->width, strides[0], f->height, pf,
+                          &out, &len, subsamp, quality, TJFLAG_NOREALLOC);
+    } else {
+        ret = tjCompressFromYUVPlanes(b->tj, planes, f->width, strides, f->height, subsamp,
+                                      &out, &len, quality, TJFLAG_NOREALLOC);
+    }
+    if(ret < 0) {
+        DBG("TurboJPEG failed: %s\n", tjGetErrorStr());
+        return -1;
+    }
+
+    if(out != buffer) {
+        if(len > (unsigned long)size)
+            return -1;
+        memcpy(buffer, out, len);
+    }
+    return (int)len;
+}
+#endif
+
+/******************************************************************************
+Description.: compress a picture on the mem2mem device, which is opened again
+              whenever the kind of pictures changes
+Input Value.: * b......: the backend
+              * pic....: the picture
+              * quality: JPEG quality the device is opened with
+              * buffer.: destination
+              * size...: size of the destination
+Return Value: length of the JPEG, JPEG_UNSUPPORTED if there is no device or
+              it failed
+******************************************************************************/
+static int compress_m2m(jpeg_backend *b, const jpeg_picture *pic, int quality, unsigned char *buffer, int size)
+{
+    const raw_format *f = &pic->format;
+    int len;
+
+    if(b->m2m_failed)
+        return JPEG_UNSUPPORTED;
+
+    /* the device takes a picture in one piece, NV12 and NV16 with the chroma right behind the luma */
+    if(f->planes > 1 && ((f->pixelformat != V4L2_PIX_FMT_NV12 && f->pixelformat != V4L2_PIX_FMT_NV16) ||
+                         f->stride[1] != f->stride[0] || pic->plane[1] != pic->plane[0] + f->stride[0] * f->height))
+        return JPEG_UNSUPPORTED;
+
+    if(b->m2m != NULL &&
+       (b->m2m_format != f->pixelformat || b->m2m_width != f->width ||
+        b->m2m_height != f->height || b->m2m_stride != f->stride[0])) {
+        m2m_encoder_free(b->m2m);
+        b->m2m = NULL;
+    }
+
+    if(b->m2m == NULL) {
+        b->m2m = m2m_encoder_new(b->device, f->width, f->height, f->pixelformat, f->stride[0],
+                                 quality, (f->dmabuf >= 0) ? pic->buffers : 0);
+        if(b->m2m == NULL) {
+            b->m2m_failed = 1;
+            return JPEG_UNSUPPORTED;
+        }
+        b->m2m_format = f->pixelformat;
+        b->m2m_width = f->width;
+        b->m2m_height = f->height;
+        b->m2m_stride = f->stride[0];
+    }
+
+    if((len = m2m_encoder_encode(b->m2m, pic->index, f->dmabuf, pic->plane[0], pic->size, buffer, size)) < 0) {
+        m2m_encoder_free(b->m2m);
+        b->m2m = NULL;
+        b->m2m_failed = 1;
+        return JPEG_UNSUPPORTED;
+    }
+
+    return len;
+}
+
+/******************************************************************************
+Description.: compress a picture with one of the backends
+Input Value.: * b......: the backend
+              * backend: JPEG_BACKEND_* to use, not JPEG_BACKEND_AUTO
+              * pic, quality, buffer, size: see jpeg_backend_encode()
+Return Value: length of the JPEG, -1 on errors, JPEG_UNSUPPORTED if this
+              backend can not take the picture
+******************************************************************************/
+static int compress_with(jpeg_backend *b, int backend, const jpeg_picture *pic, int quality,
+                         unsigned char *buffer, int size)
+{
+    #ifndef NO_LIBJPEG
+    slice_job job;
+    #endif
+
+    switch(backend) {
+    #ifndef NO_LIBJPEG
+    case JPEG_BACKEND_LIBJPEG:
+        return compress_lines(b, pic, 0, pic->format.height, quality, buffer, size);
+    case JPEG_BACKEND_SLICES:
+        /* slices have to share the huffman tables and can not be progressive */
+        if(b->encoder == NULL || b->flags != 0)
+            return compress_lines(b, pic, 0, pic->format.height, quality, buffer, size);
+        if(!libjpeg_format(pic->format.pixelformat))
+            return JPEG_UNSUPPORTED;
+        job.b = b;
+        job.pic = pic;
+        job.quality = quality;
+        return jpeg_encoder_encode(b->encoder, compress_slice, &job, pic->format.height, buffer, size);
+    #endif
+    #ifdef HAVE_TURBOJPEG
+    case JPEG_BACKEND_TURBOJPEG:
+        return compress_turbojpeg(b, pic, quality, buffer, size);
+    #endif
+    case JPEG_BACKEND_M2M:
+        return compress_m2m(b, pic, quality, buffer, size);
+    default:
+        return JPEG_UNSUPPORTED;
+    }
+}
+
+/******************************************************************************
+Description.: free what only the backends other than the current one need
+Input Value.: the backend
+Return Value: -
+******************************************************************************/
+static void release_unused(jpeg_backend *b)
+{
+    if(b->current != JPEG_BACKEND_M2M) {
+        m2m_encoder_free(b->m2m);
+        b->m2m = NULL;
+    }
+
+    #ifdef HAVE_TURBOJPEG
+    if(b->current != JPEG_BACKEND_TURBOJPEG) {
+        if(b->tj != NULL)
+            tjDestroy(b->tj);
+        b->tj = NULL;
+        tjFree(b->tj_buffer);
+        b->tj_buffer = NULL;
+        b->tj_capacity = 0;
+        free(b->tj_planes);
+        b->tj_planes = NULL;
+        b->tj_planes_size = 0;
+    }
+    #endif
+
+    if(b->current != JPEG_BACKEND_SLICES && b->own_encoder) {
+        jpeg_encoder_free(b->encoder);
+        b->encoder = NULL;
+        b->own_encoder = 0;
+    }
+}
+
+/******************************************************************************
+Description.: pick the fastest of the candidates once all of them compressed
+              their pictures, libjpeg if none of them succeeded
+Input Value.: the backend
+Return Value: -
+******************************************************************************/
+static void choose_fastest(jpeg_backend *b)
+{
+    char times[128];
+    int i, len = 0, best = -1;
+
+    for(i = 0; i < b->count; i++) {
+        if(b->best_usec[i] != ULLONG_MAX) {
+            /* a truncated list ends there */
+            if(len < (int)sizeof(times))
+                len += snprintf(times + len, sizeof(times) - len, "%s%s %.1f ms",
+                                (len > 0) ? ", " : "", backend_names[b->candidates[i]], b->best_usec[i] / 1000.0);
+            if(best < 0 || b->best_usec[i] < b->best_usec[best])
+                best = i;
+        }
+    }
+
+    b->current = (best >= 0) ? b->candidates[best] : JPEG_BACKEND_LIBJPEG;
+    IPRINT("JPEG backend......: %s, the fastest of %s\n", backend_names[b->current], (len > 0) ? times : "none");
+    release_unused(b);
+}
+
+/******************************************************************************
+Description.: compress a picture in the auto mode, with the candidate whose
+              turn it is
+Input Value.: see jpeg_backend_encode()
+Return Value: length of the JPEG, -1 on errors
+******************************************************************************/
+static int compress_auto(jpeg_backend *b, const jpeg_picture *pic, int quality, unsigned char *buffer, int size)
+{
+    unsigned long long start, usec;
+    int i, len;
+
+    while(b->trial < b->count * AUTO_PICTURES) {
+        i = b->trial / AUTO_PICTURES;
+        start = monotonic_usec();
+        len = compress_with(b, b->candidates[i], pic, quality, buffer, size);
+        usec = monotonic_usec() - start;
+
+        /* the next candidate takes this picture */
+        if(len == JPEG_UNSUPPORTED) {
+            DBG("the %s JPEG encoder can not take the pictures\n", backend_names[b->candidates[i]]);
+            b->best_usec[i] = ULLONG_MAX;
+            b->trial = (i + 1) * AUTO_PICTURES;
+            continue;
+        }
+
+        if(b->trial % AUTO_PICTURES != 0 && len >= 0 && usec < b->best_usec[i])
+            b->best_usec[i] = usec;
+        if(++b->trial == b->count * AUTO_PICTURES)
+            choose_fastest(b);
+        return len;
+    }
+
+    choose_fastest(b);
+    return jpeg_backend_encode(b, pic, quality, buffer, size);
+}
+
+/******************************************************************************
+Description.: set up an encoder backend, devices and libraries are only
+              opened with the first picture
+Input Value.: the options
+Return Value: the backend, NULL without memory
+******************************************************************************/
+jpeg_backend *jpeg_backend_new(const jpeg_backend_options *opts)
+{
+    jpeg_backend *b;
+    int n, i;
+
+    if((b = calloc(1, sizeof(jpeg_backend))) == NULL)
+        return NULL;
+
+    b->backend = opts->backend;
+    b->flags = opts->flags;
+    b->device = (opts->device != NULL) ? strdup(opts->device) : NULL;
+    b->encoder = opts->encoder;
+
+    /* the slices are compressed on threads of their own unless the plugin shares some */
+    if((b->backend == JPEG_BACKEND_SLICES || b->backend == JPEG_BACKEND_AUTO) && b->encoder == NULL &&
+       b->flags == 0) {
+        n = (opts->threads > 0) ? opts->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if(n > 1 && (b->encoder = jpeg_encoder_new(n)) != NULL)
+            b->own_encoder = 1;
+    }
+
+    if(b->backend != JPEG_BACKEND_AUTO) {
+        b->current = b->backend;
+        return b;
+    }
+
+    #ifndef NO_LIBJPEG
+    b->candidates[b->count++] = JPEG_BACKEND_LIBJPEG;
+    if(b->encoder != NULL && b->flags == 0)
+        b->candidates[b->count++] = JPEG_BACKEND_SLICES;
+    #endif
+    #ifdef HAVE_TURBOJPEG
+    if(b->flags == 0)
+        b->candidates[b->count++] = JPEG_BACKEND_TURBOJPEG;
+    #endif
+    b->candidates[b->count++] = JPEG_BACKEND_M2M;
+
+    for(i = 0; i < b->count; i++)
+        b->best_usec[i] = ULLONG_MAX;
+    b->current = JPEG_BACKEND_AUTO;
+
+    return b;
+}
+
+/******************************************************************************
+Description.: compress a raw picture to JPEG
+Input Value.: * b......: the backend
+              * pic....: the picture
+              * quality: JPEG quality, a mem2mem device keeps the one of
+                         its first picture
+              * buffer.: destination of the JPEG
+              * size...: size of the destination
+Return Value: length of the JPEG, -1 on errors or if it did not fit
+******************************************************************************/
+int jpeg_backend_encode(jpeg_backend *b, const jpeg_picture *pic, int quality, unsigned char *buffer, int size)
+{
+    int len;
+
+    if(b->current == JPEG_BACKEND_AUTO)
+        return compress_auto(b, pic, quality, buffer, size);
+
+    if((len = compress_with(b, b->current, pic, quality, buffer, size)) != JPEG_UNSUPPORTED)
+        return len;
+
+    if(b->current == JPEG_BACKEND_LIBJPEG)
+        return -1;
+
+    IPRINT("the %s JPEG encoder can not take the pictures, compressing with libjpeg from now on\n",
+           backend_names[b->current]);
+    b->current = JPEG_BACKEND_LIBJPEG;
+    release_unused(b);
+
+    len = compress_with(b, b->current, pic, quality, buffer, size);
+    return (len < 0) ? -1 : len;
+}
+
+/******************************************************************************
+Description.: tell which backend compresses the pictures
+Input Value.: the backend
+Return Value: JPEG_BACKEND_*, JPEG_BACKEND_AUTO while they are compared
+******************************************************************************/
+int jpeg_backend_current(jpeg_backend *b)
+{
+    return b->current;
+}
+
+/******************************************************************************
+Description.: close the mem2mem device, for example because the buffers it
+              imported are gone, it is opened again with the next picture
+Input Value.: the backend
+Return Value: -
+******************************************************************************/
+void jpeg_backend_reset(jpeg_backend *b)
+{
+    m2m_encoder_free(b->m2m);
+    b->m2m = NULL;
+}
+
+/******************************************************************************
+Description.: free a backend and everything it opened
+Input Value.: the backend, may be NULL
+Return Value: -
+******************************************************************************/
+void jpeg_backend_free(jpeg_backend *b)
+{
+    #ifndef NO_LIBJPEG
+    int i;
+    #endif
+
+    if(b == NULL)
+        return;
+
+    b->current = JPEG_BACKEND_LIBJPEG;
+    release_unused(b);
+
+    #ifndef NO_LIBJPEG
+    for(i = 0; i < JPEG_COMPRESSORS; i++) {
+        if(b->compressors[i].created)
+            jpeg_destroy_compress(&b->compressors[i].cinfo);
+    }
+    #endif
+
+    free(b->device);
+    free(b);
+}
@@ -0,0 +1,493 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * LL-HLS segments of an input, kept in memory
+ *
+ * output_mp4 --live hands over the CMAF header and parts of its H.264 or
+ * HEVC stream, output_http serves the playlist, the header, the parts and
+ * the complete segments of the ring. A segment starts with each keyframe
+ * and consists of all parts up to the next one, so a CDN in front of the
+ * server fetches each of them once and players which do not know LL-HLS
+ * get regular segments.
+ *
+ * The parts are kept as frames, readers take references and send them
+ * without holding the lock. Requests for a playlist or a part which is not
+ * there yet wait for it, the blocking playlist reload and preload hints of
+ * LL-HLS. The stream of an input stays allocated once it is set up, a
+ * later producer takes it over and continues the numbering.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/uio.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+/* segments in the ring, the one being filled included */
+#define LIVE_SEGMENTS 8
+
+/* the parts of this many segments at the live edge are listed */
+#define LIVE_PART_SEGMENTS 3
+
+typedef struct {
+    input_frame *data;
+    unsigned int duration;          // in the timescale of the stream
+    int independent;                // starts with a keyframe
+} live_chunk;
+
+typedef struct {
+    unsigned long long duration;
+    int count;
+    live_chunk part[LIVE_PARTS];
+} live_segment;
+
+struct _live_stream {
+    pthread_mutex_t lock;
+    pthread_cond_t update;
+    int active;                     // a producer feeds the stream
+    unsigned int timescale;
+    unsigned int part_target;       // ms
+    unsigned int target;            // s, the longest segment so far
+    input_frame *header;
+
+    /* segment msn is in segment[msn % LIVE_SEGMENTS], from first to msn */
+    unsigned long long first, msn;
+    live_segment segment[LIVE_SEGMENTS];
+
+    live_stream *next;              // of all inputs, under live_setup
+};
+
+static pthread_mutex_t live_setup = PTHREAD_MUTEX_INITIALIZER;
+static live_stream *streams;
+
+/*
+ * the ring of each stream, the oldest segments are dropped for the memory
+ * budget down to the ones in the playlist with their parts
+ */
+static long long live_evict(void *arg, long long bytes);
+static memory_account live_memory = MEMORY_ACCOUNT("live", MEMORY_RING, live_evict, NULL);
+
+/******************************************************************************
+Description.: drop a frame of the stream
+Input Value.: the frame, may be NULL
+Return Value: the bytes it held
+******************************************************************************/
+static long long drop(input_frame *frame)
+{
+    long long size;
+
+    if(frame == NULL)
+        return 0;
+
+    size = frame->size;
+    memory_add(&live_memory, -size);
+    frame_unref(frame);
+    return size;
+}
+
+/******************************************************************************
+Description.: drop the parts of a segment
+Input Value.: the segment
+Return Value: the bytes they held
+******************************************************************************/
+static long long clear_segment(live_segment *s)
+{
+    long long size = 0;
+    int i;
+
+    for(i = 0; i < s->count; i++)
+        size += drop(s->part[i].data);
+    s->count = 0;
+    s->duration = 0;
+    return size;
+}
+
+/******************************************************************************
+Description.: drop the oldest segments of the streams for the memory budget,
+              the segments a player needs to join at the live edge stay
+Input Value.: * arg..: unused
+              * bytes: to free
+Return Value: bytes freed
+******************************************************************************/
+static long long live_evict(void *arg, long long bytes)
+{
+    long long freed = 0;
+    live_stream *s;
+
+    pthread_mutex_lock(&live_setup);
+    for(s = streams; s != NULL && freed < bytes; s = s->next) {
+        pthread_mutex_lock(&s->lock);
+        while(freed < bytes && s->msn - s->first > LIVE_PART_SEGMENTS) {
+            freed += clear_segment(&s->segment[s->first % LIVE_SEGMENTS]);
+            s->first++;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    pthread_mutex_unlock(&live_setup);
+
+    return freed;
+}
+
+/******************************************************************************
+Description.: copy pieces into a new frame
+Input Value.: * iov..: the pieces
+              * count: their number
+Return Value: the frame, NULL without memory
+******************************************************************************/
+static input_frame *gather(const struct iovec *iov, int count)
+{
+    input_frame *frame;
+    size_t size = 0;
+    int i;
+
+    for(i = 0; i < count; i++)
+        size += iov[i].iov_len;
+    if((frame = frame_alloc(size)) == NULL)
+        return NULL;
+
+    for(i = 0; i < count; i++) {
+        memcpy(frame->buf + frame->size, iov[i].iov_base, iov[i].iov_len);
+        frame->size += iov[i].iov_len;
+    }
+    memory_add(&live_memory, frame->size);
+    return frame;
+}
+
+/******************************************************************************
+Description.: set up the stream of an input for a producer
+Input Value.: * in.........: the input
+              * timescale..: ticks per second of the durations of the parts
+              * part_msec..: the parts are not longer
+              * segment_sec: the segments are usually not longer
+Return Value: 0 if ok, -1 if the input has a producer already or on errors
+******************************************************************************/
+int live_start(input *in, unsigned int timescale, unsigned int part_msec, unsigned int segment_sec)
+{
+    live_stream *s;
+    pthread_condattr_t attr;
+    int i;
+
+    pthread_mutex_lock(&live_setup);
+    if((s = in->live) == NULL) {
+        if((s = calloc(1, sizeof(live_stream))) == NULL) {
+            pthread_mutex_unlock(&live_setup);
+            LOG("not enough memory\n");
+            return -1;
+        }
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&s->update, &attr);
+        pthread_condattr_destroy(&attr);
+
+        /* caches keep segments by name, the numbers of a restarted
+         * program must not meet those of the last run */
+        s->msn = time(NULL);
+        s->next = streams;
+        streams = s;
+        in->live = s;
+    }
+    pthread_mutex_unlock(&live_setup);
+
+    pthread_mutex_lock(&s->lock);
+    if(s->active) {
+        pthread_mutex_unlock(&s->lock);
+        LOG("input %d has a live stream already\n", in->param.id);
+        return -1;
+    }
+
+    /* the numbers go on where a former producer left off */
+    for(i = 0; i < LIVE_SEGMENTS; i++)
+        clear_segment(&s->segment[i]);
+    if(s->header != NULL) {
+        drop(s->header);
+        s->header = NULL;
+        s->msn++;
+    }
+    s->first = s->msn;
+    s->active = 1;
+    s->timescale = timescale;
+    s->part_target = part_msec;
+    s->target = MAX(segment_sec, 1);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+/******************************************************************************
+Description.: detach the producer, the readers get nothing new
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+void live_stop(input *in)
+{
+    live_stream *s = in->live;
+
+    if(s == NULL)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    s->active = 0;
+    pthread_cond_broadcast(&s->update);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/******************************************************************************
+Description.: set the header of the stream, the init segment of CMAF
+Input Value.: * in...: the input
+              * iov..: pieces of the header
+              * count: their number
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+int live_header(input *in, const struct iovec *iov, int count)
+{
+    live_stream *s = in->live;
+    input_frame *frame, *old;
+
+    if(s == NULL || (frame = gather(iov, count)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&s->lock);
+    old = s->header;
+    s->header = frame;
+    pthread_mutex_unlock(&s->lock);
+
+    drop(old);
+    return 0;
+}
+
+/******************************************************************************
+Description.: add a part to the stream, a part with a keyframe completes the
+              segment before it, as does the part after LIVE_PARTS of them
+Input Value.: * in.........: the input
+              * iov........: pieces of the part, moof and mdat
+              * count......: their number
+              * duration...: of the part, in the timescale
+              * independent: nonzero if it starts with a keyframe
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+int live_part(input *in, const struct iovec *iov, int count, unsigned int duration, int independent)
+{
+    live_stream *s = in->live;
+    live_segment *seg;
+    input_frame *frame;
+    unsigned int sec;
+
+    if(s == NULL || (frame = gather(iov, count)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&s->lock);
+    seg = &s->segment[s->msn % LIVE_SEGMENTS];
+    if(seg->count > 0 && (independent || seg->count == LIVE_PARTS)) {
+        /* the target duration grows, not shrinks, as players expect */
+        sec = (seg->duration + s->timescale - 1) / s->timescale;
+        s->target = MAX(s->target, sec);
+
+        s->msn++;
+        if(s->msn - s->first >= LIVE_SEGMENTS)
+            s->first = s->msn - LIVE_SEGMENTS + 1;
+        seg = &s->segment[s->msn % LIVE_SEGMENTS];
+        clear_segment(seg);
+    }
+    seg->part[seg->count].data = frame;
+    seg->part[seg->count].duration = duration;
+    seg->part[seg->count].independent = independent;
+    seg->count++;
+    seg->duration += duration;
+    pthread_cond_broadcast(&s->update);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+/******************************************************************************
+Description.: wait for the stream to change, with the lock held
+Input Value.: * s.......: the stream
+              * deadline: of the monotonic clock
+Return Value: 0 if it may have changed, -1 once the deadline passed
+******************************************************************************/
+static int wait_update(live_stream *s, const struct timespec *deadline)
+{
+    return (pthread_cond_timedwait(&s->update, &s->lock, deadline) == ETIMEDOUT) ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: deadline a number of ms from now
+Input Value.: * deadline: gets the deadline
+              * msec....: the ms
+Return Value: -
+******************************************************************************/
+static void deadline_in(struct timespec *deadline, int msec)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += msec / 1000;
+    deadline->tv_nsec += (msec % 1000) * 1000000L;
+    if(deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/******************************************************************************
+Description.: append the parts of a segment to a playlist
+Input Value.: * s....: the stream
+              * msn..: the segment
+              * p....: where to write
+              * end..: end of the buffer
+Return Value: where the next line goes
+******************************************************************************/
+static char *list_parts(live_stream *s, unsigned long long msn, char *p, char *end)
+{
+    live_segment *seg = &s->segment[msn % LIVE_SEGMENTS];
+    int i;
+
+    for(i = 0; i < seg->count && p < end; i++) {
+        p += snprintf(p, end - p, "#EXT-X-PART:DURATION=%.5f,URI=\"%llu.%d.m4s\"%s\n",
+                      (double)seg->part[i].duration / s->timescale, msn, i,
+                      seg->part[i].independent ? ",INDEPENDENT=YES" : "");
+    }
+    return p;
+}
+
+/******************************************************************************
+Description.: write the playlist, once it has a segment or part, for the
+              blocking reload of LL-HLS
+Input Value.: * in.....: the input
+              * msn....: the segment to wait for, -1 to not wait
+              * part...: its part to wait for, -1 for the complete segment
+              * msec...: how long to wait at most
+              * buffer.: gets the playlist
+              * size...: size of the buffer
+Return Value: its length, 0 if the segment did not come in time or is too
+              far ahead, -1 if the input has no live stream
+******************************************************************************/
+int live_playlist(input *in, long long msn, int part, int msec, char *buffer, int size)
+{
+    live_stream *s = in->live;
+    struct timespec deadline;
+    char *p = buffer, *end = buffer + size;
+    unsigned long long i;
+
+    if(s == NULL)
+        return -1;
+
+    deadline_in(&deadline, msec);
+    pthread_mutex_lock(&s->lock);
+
+    /* LL-HLS refuses to wait for more than the segment after the next one */
+    if(msn >= 0 && (unsigned long long)msn > s->msn + 2) {
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+    while(s->header == NULL || s->segment[s->msn % LIVE_SEGMENTS].count == 0 ||
+          (msn >= 0 && (s->msn < (unsigned long long)msn ||
+                        (s->msn == (unsigned long long)msn &&
+                         (part < 0 || s->segment[s->msn % LIVE_SEGMENTS].count <= part))))) {
+        if(!s->active || wait_update(s, &deadline) < 0) {
+            pthread_mutex_unlock(&s->lock);
+            return s->active ? 0 : -1;
+        }
+    }
+
+    p += snprintf(p, end - p, "#EXTM3U\n"
+                  "#EXT-X-VERSION:9\n"
+                  "#EXT-X-TARGETDURATION:%u\n"
+                  "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n"
+                  "#EXT-X-PART-INF:PART-TARGET=%.3f\n"
+                  "#EXT-X-MEDIA-SEQUENCE:%llu\n"
+                  "#EXT-X-MAP:URI=\"init.mp4\"\n",
+                  s->target, 3.0 * s->part_target / 1000, (double)s->part_target / 1000, s->first);
+
+    for(i = s->first; i < s->msn && p < end; i++) {
+        if(i + LIVE_PART_SEGMENTS > s->msn)
+            p = list_parts(s, i, p, end);
+        if(p < end)
+            p += snprintf(p, end - p, "#EXTINF:%.5f,\n%llu.m4s\n",
+                          (double)s->segment[i % LIVE_SEGMENTS].duration / s->timescale, i);
+    }
+    if(p < end)
+        p = list_parts(s, s->msn, p, end);
+    if(p < end)
+        p += snprintf(p, end - p, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%llu.%d.m4s\"\n",
+                      s->msn, s->segment[s->msn % LIVE_SEGMENTS].count);
+    pthread_mutex_unlock(&s->lock);
+
+    if(p >= end)
+        return 0;
+    return p - buffer;
+}
+
+/******************************************************************************
+Description.: take the header, a part or the parts of a complete segment, a
+              part which is not there yet is waited for
+Input Value.: * in.....: the input
+              * msn....: the segment, -1 for the header
+              * part...: the part, -1 for the complete segment
+              * msec...: how long to wait at most
+              * parts..: get references to the frames, LIVE_PARTS at most
+Return Value: the number of frames, 0 if they are not in the ring or did not
+              come in time, -1 if the input has no live stream
+******************************************************************************/
+int live_get(input *in, long long msn, int part, int msec, input_frame **parts)
+{
+    live_stream *s = in->live;
+    struct timespec deadline;
+    live_segment *seg;
+    int i, n = 0;
+
+    if(s == NULL)
+        return -1;
+
+    deadline_in(&deadline, msec);
+    pthread_mutex_lock(&s->lock);
+
+    if(msn < 0) {
+        if(s->header != NULL)
+            parts[n++] = frame_ref(s->header);
+        pthread_mutex_unlock(&s->lock);
+        return n;
+    }
+
+    /* the part after the last one and those of the next segment come soon */
+    while(s->active && (s->msn < (unsigned long long)msn ||
+                        (s->msn == (unsigned long long)msn &&
+                         (part < 0 || s->segment[s->msn % LIVE_SEGMENTS].count <= part)))) {
+        if((unsigned long long)msn > s->msn + 1 || part >= LIVE_PARTS || wait_update(s, &deadline) < 0)
+            break;
+    }
+
+    if((unsigned long long)msn >= s->first && (unsigned long long)msn <= s->msn) {
+        seg = &s->segment[msn % LIVE_SEGMENTS];
+        if(part >= 0 && part < seg->count) {
+            parts[n++] = frame_ref(seg->part[part].data);
+        } else if(part < 0 && (unsigned long long)msn < s->msn) {
+            for(i = 0; i < seg->count; i++)
+                parts[n++] = frame_ref(seg->part[i].data);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return n;
+}
@@ -0,0 +1,380 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include "mjpg_streamer.h"
+
+/* a power of two */
+#define LOG_RING_SIZE 256
+
+typedef struct {
+    unsigned long seq;              // the position it may be taken at, see ring_claim()
+    log_site *site;
+    int priority;
+    const char *prefix;
+    struct timeval time;
+    pid_t thread;
+    unsigned int suppressed;        // messages of the site suppressed before this one
+    char text[LOG_MESSAGE_SIZE];
+} log_entry;
+
+/*
+ * a bounded queue of many writers and the one thread which drains it. A
+ * writer claims the entry at head with a compare and swap once the drain
+ * thread released it one round ago, and publishes it by setting its seq to
+ * the position after it.
+ */
+static log_entry ring[LOG_RING_SIZE];
+static unsigned long head, tail;
+static unsigned long lost;
+
+static sem_t wake;
+static pthread_t drainer;
+static int running, stopping;
+static log_format output_format;
+
+/* writes to stderr and syslog, so messages do not interleave */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+Description.: decide whether a call site may log now
+Input Value.: * site......: the call site
+              * suppressed: gets the number of its messages suppressed before
+Return Value: 1 if the message is written, 0 if it is suppressed
+******************************************************************************/
+static int log_allowed(log_site *site, unsigned int *suppressed)
+{
+    struct timespec now;
+    unsigned long long window;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    window = now.tv_sec / LOG_RATE_INTERVAL;
+
+    /* two threads starting a window at once may let a message more through */
+    if(__atomic_load_n(&site->window, __ATOMIC_RELAXED) != window) {
+        __atomic_store_n(&site->window, window, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+    }
+
+    if(__sync_add_and_fetch(&site->count, 1) > LOG_RATE_BURST) {
+        __sync_fetch_and_add(&site->suppressed, 1);
+        return 0;
+    }
+
+    *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/******************************************************************************
+Description.: write a string as a JSON string
+Input Value.: * file: to write to
+              * text: the string, a newline at its end is left out
+Return Value: -
+******************************************************************************/
+static void json_string(FILE *file, const char *text)
+{
+    const unsigned char *c;
+
+    fputc('"', file);
+    for(c = (const unsigned char *)text; *c != '\0'; c++) {
+        if(*c == '\n' && c[1] == '\0')
+            break;
+        if(*c == '"' || *c == '\\')
+            fprintf(file, "\\%c", *c);
+        else if(*c == '\n')
+            fputs("\\n", file);
+        else if(*c < 0x20)
+            fprintf(file, "\\u%04x", *c);
+        else
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+/******************************************************************************
+Description.: write a message to stderr and syslog, the caller holds
+              output_lock
+Input Value.: the message
+Return Value: -
+******************************************************************************/
+static void write_entry(const log_entry *e)
+{
+    const char *source = (strcmp(e->prefix, INPUT_PLUGIN_PREFIX) == 0) ? "input" :
+                         (strcmp(e->prefix, OUTPUT_PLUGIN_PREFIX) == 0) ? "output" : "main";
+
+    if(output_format == LOG_FORMAT_JSON) {
+        fprintf(stderr, "{\"time\": %ld.%06ld, \"priority\": %d, \"source\": \"%s\", \"file\": ",
+                (long)e->time.tv_sec, (long)e->time.tv_usec, e->priority, source);
+        json_string(stderr, e->site->file);
+        fprintf(stderr, ", \"line\": %d, \"function\": ", e->site->line);
+        json_string(stderr, e->site->function);
+        fprintf(stderr, ", \"thread\": %d, \"suppressed\": %u, \"message\": ", (int)e->thread, e->suppressed);
+        json_string(stderr, e->text);
+        fputs("}\n", stderr);
+    } else {
+        if(e->suppressed > 0)
+            fprintf(stderr, "%s(%u messages like the next one were suppressed)\n", e->prefix, e->suppressed);
+        fprintf(stderr, "%s%s", e->prefix, e->text);
+    }
+
+    if(e->suppressed > 0)
+        syslog(e->priority, "(%u messages like the next one were suppressed)", e->suppressed);
+    syslog(e->priority, "%s", e->text);
+}
+
+/******************************************************************************
+Description.: fill in a message
+Input Value.: * e.........: the entry to fill
+              * site......: where it comes from
+              * priority..: syslog priority
+              * prefix....: written before it to stderr
+              * suppressed: messages of the site suppressed before
+              * format, ap: the message
+Return Value: -
+******************************************************************************/
+static void fill_entry(log_entry *e, log_site *site, int priority, const char *prefix,
+                       unsigned int suppressed, const char *format, va_list ap)
+{
+    e->site = site;
+    e->priority = priority;
+    e->prefix = prefix;
+    e->suppressed = suppressed;
+    e->thread = syscall(SYS_gettid);
+    gettimeofday(&e->time, NULL);
+    vsnprintf(e->text, sizeof(e->text), format, ap);
+}
+
+/******************************************************************************
+Description.: claim the entry at the head of the ring
+Input Value.: position: gets the position of the entry
+Return Value: the entry, NULL if the ring is full
+******************************************************************************/
+static log_entry *ring_claim(unsigned long *position)
+{
+    unsigned long pos = __atomic_load_n(&head, __ATOMIC_RELAXED), seq;
+    log_entry *e;
+
+    while(1) {
+        e = &ring[pos % LOG_RING_SIZE];
+        seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        if(seq == pos) {
+            if(__atomic_compare_exchange_n(&head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if((long)(seq - pos) < 0) {
+            /* the drain thread has not released it yet */
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    *position = pos;
+    return e;
+}
+
+/******************************************************************************
+Description.: log a message, which is what LOG(), IPRINT() and OPRINT() do
+Input Value.: * site....: the call site
+              * priority: syslog priority
+              * prefix..: written before the message to stderr
+              * format..: printf() format of the message and its arguments
+Return Value: -
+******************************************************************************/
+void log_print(log_site *site, int priority, const char *prefix, const char *format, ...)
+{
+    unsigned long position;
+    unsigned int suppressed;
+    log_entry *e, now;
+    va_list ap;
+
+    if(!log_allowed(site, &suppressed))
+        return;
+
+    va_start(ap, format);
+    if(!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        fill_entry(&now, site, priority, prefix, suppressed, format, ap);
+        pthread_mutex_lock(&output_lock);
+        write_entry(&now);
+        pthread_mutex_unlock(&output_lock);
+    } else if((e = ring_claim(&position)) != NULL) {
+        fill_entry(e, site, priority, prefix, suppressed, format, ap);
+        __atomic_store_n(&e->seq, position + 1, __ATOMIC_RELEASE);
+        sem_post(&wake);
+    } else {
+        __sync_fetch_and_add(&lost, 1);
+    }
+    va_end(ap);
+}
+
+/******************************************************************************
+Description.: write the messages published in the ring, the caller holds
+              output_lock
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void drain_ring(void)
+{
+    unsigned long missed;
+    log_entry *e, note;
+
+    while(1) {
+        e = &ring[tail % LOG_RING_SIZE];
+        if(__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        write_entry(e);
+        __atomic_store_n(&e->seq, tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        tail++;
+    }
+
+    if((missed = __atomic_exchange_n(&lost, 0, __ATOMIC_RELAXED)) != 0) {
+        static log_site site = LOG_SITE;
+        memset(&note, 0, sizeof(note));
+        note.site = &site;
+        note.priority = LOG_WARNING;
+        note.prefix = "";
+        note.thread = syscall(SYS_gettid);
+        gettimeofday(&note.time, NULL);
+        snprintf(note.text, sizeof(note.text), "%lu log messages were lost, the log could not keep up\n", missed);
+        write_entry(&note);
+    }
+}
+
+/******************************************************************************
+Description.: thread which writes the messages of the ring
+Input Value.: -
+Return Value: NULL
+******************************************************************************/
+static void *drain_thread(void *arg)
+{
+    while(1) {
+        while(sem_wait(&wake) < 0 && errno == EINTR);
+
+        pthread_mutex_lock(&output_lock);
+        drain_ring();
+        pthread_mutex_unlock(&output_lock);
+
+        if(__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+            break;
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: a forked process has no drain thread, it logs right away
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void log_forked(void)
+{
+    pthread_mutex_init(&output_lock, NULL);
+    running = 0;
+}
+
+/******************************************************************************
+Description.: look up the name of a log format
+Input Value.: * name..: "text" or "json"
+              * format: gets the format
+Return Value: 0 if ok, -1 for an unknown name
+******************************************************************************/
+int log_parse_format(const char *name, log_format *format)
+{
+    if(strcmp(name, "text") == 0)
+        *format = LOG_FORMAT_TEXT;
+    else if(strcmp(name, "json") == 0)
+        *format = LOG_FORMAT_JSON;
+    else
+        return -1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: start writing the messages from a thread of their own, the
+              messages are drained at exit
+Input Value.: format: how messages are written to stderr
+Return Value: 0 if ok, -1 if they keep being written right away
+******************************************************************************/
+int log_start(log_format format)
+{
+    static int once;
+    sigset_t all, old;
+    int i, rc;
+
+    output_format = format;
+    if(running)
+        return 0;
+
+    for(i = 0; i < LOG_RING_SIZE; i++)
+        ring[i].seq = i;
+    head = tail = 0;
+    stopping = 0;
+
+    /* a signal handler which logs must not interrupt the thread holding output_lock */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = (sem_init(&wake, 0, 0) < 0 || pthread_create(&drainer, NULL, drain_thread, NULL) != 0);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(rc) {
+        fprintf(stderr, "could not start the log thread, messages are written right away\n");
+        return -1;
+    }
+
+    if(!once) {
+        pthread_atfork(NULL, NULL, log_forked);
+        atexit(log_stop);
+        once = 1;
+    }
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/******************************************************************************
+Description.: write the messages still in the ring, stop the thread and close
+              the connection to syslog, later messages are written right away
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void log_stop(void)
+{
+    if(__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL)) {
+        __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+        sem_post(&wake);
+        pthread_join(drainer, NULL);
+
+        /* messages published while the thread finished */
+        pthread_mutex_lock(&output_lock);
+        drain_ring();
+        pthread_mutex_unlock(&output_lock);
+    }
+
+    closelog();
+}
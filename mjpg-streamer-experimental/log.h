@@ -0,0 +1,68 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <syslog.h>
+
+/*
+ * LOG(), IPRINT() and OPRINT() hand their message to a ring which a thread
+ * of its own writes to stderr and syslog, a slow journald does not stall
+ * the thread which logs. Until log_start() and in forked processes the
+ * messages are written right away. A full ring drops messages instead of
+ * waiting, they are counted.
+ *
+ * Each call site may log LOG_RATE_BURST messages in LOG_RATE_INTERVAL
+ * seconds, the ones above are suppressed and counted with the next message
+ * from the site that gets through.
+ */
+#define LOG_MESSAGE_SIZE 1024
+#define LOG_RATE_BURST 30
+#define LOG_RATE_INTERVAL 10
+
+typedef enum {
+    LOG_FORMAT_TEXT,
+    LOG_FORMAT_JSON                 // one object per line with the fields of the message
+} log_format;
+
+/* a place in the code which logs, one static instance per macro use */
+typedef struct _log_site log_site;
+struct _log_site {
+    const char *file;
+    int line;
+    const char *function;
+
+    /* rate limit */
+    unsigned long long window;      // LOG_RATE_INTERVAL seconds counted in
+    unsigned int count;             // messages in the window
+    unsigned int suppressed;        // not written since the last one that was
+};
+
+#define LOG_SITE { __FILE__, __LINE__, __func__, 0, 0, 0 }
+
+void log_print(log_site *site, int priority, const char *prefix, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+int log_parse_format(const char *name, log_format *format);
+int log_start(log_format format);
+void log_stop(void);
+
+#endif
@@ -0,0 +1,579 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+/*
+ * JPEG encoding on a V4L2 memory-to-memory device
+ *
+ * Many SoCs have a JPEG encoder which the kernel offers as a mem2mem video
+ * device: raw pictures are queued on its OUTPUT queue and JPEGs come back on
+ * its CAPTURE queue. Pictures are handed over as DMABUF file descriptors of
+ * the camera buffers when possible, so the hardware reads them where the
+ * camera wrote them. Otherwise, or if the device can not import them, they
+ * are copied into a buffer of the encoder.
+ *
+ * Single- and multi-planar devices are supported, as long as the raw format
+ * itself fits into one plane.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+/* devices probed if none is given */
+#define M2M_PROBE_DEVICES 64
+
+/* time a picture may take, in ms */
+#define M2M_TIMEOUT 2000
+
+struct _m2m_encoder {
+    int fd;
+    int mplane;                 /* the device uses the multi-planar API */
+    unsigned int out_type;
+    unsigned int cap_type;
+
+    /* OUTPUT queue, the raw pictures */
+    unsigned int out_memory;    /* V4L2_MEMORY_DMABUF or V4L2_MEMORY_MMAP */
+    int out_count;              /* number of DMABUF slots */
+    void *out_mem;              /* the buffer pictures are copied to */
+    size_t out_length;
+    int bytesperline;           /* of the pictures given to us */
+    int out_bytesperline;       /* of the device */
+    int height;
+    int lines;                  /* of all planes, the chroma of NV12 and NV16 follows the luma */
+
+    /* CAPTURE queue, a single buffer for the JPEG */
+    void *cap_mem;
+    size_t cap_length;
+};
+
+/******************************************************************************
+Description.: ioctl which is restarted after signals
+Input Value.: like ioctl()
+Return Value: like ioctl()
+******************************************************************************/
+static int m2m_ioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while(ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: check if a queue of the device supports a pixel format
+Input Value.: * fd.........: the device
+              * type.......: the queue
+              * pixelformat: the format
+Return Value: 1 if it does, 0 if not
+******************************************************************************/
+static int m2m_has_format(int fd, unsigned int type, unsigned int pixelformat)
+{
+    struct v4l2_fmtdesc desc;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.type = type;
+    while(m2m_ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0) {
+        if(desc.pixelformat == pixelformat)
+            return 1;
+        desc.index++;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: check if a device is a JPEG encoder for pictures of a format
+Input Value.: * fd.........: the device
+              * pixelformat: format of the raw pictures
+              * mplane.....: set to 1 for multi-planar devices
+Return Value: 0 if the device can be used, -1 if not
+******************************************************************************/
+static int m2m_probe(int fd, unsigned int pixelformat, int *mplane)
+{
+    struct v4l2_capability cap;
+    unsigned int caps;
+
+    memset(&cap, 0, sizeof(cap));
+    if(m2m_ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0)
+        return -1;
+
+    caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if(!(caps & V4L2_CAP_STREAMING))
+        return -1;
+
+    if(caps & V4L2_CAP_VIDEO_M2M_MPLANE)
+        *mplane = 1;
+    else if(caps & V4L2_CAP_VIDEO_M2M)
+        *mplane = 0;
+    else
+        return -1;
+
+    if(!m2m_has_format(fd, *mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE : V4L2_BUF_TYPE_VIDEO_OUTPUT, pixelformat) ||
+       !m2m_has_format(fd, *mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_JPEG))
+        return -1;
+
+    DBG("%s is a JPEG encoder\n", cap.card);
+    return 0;
+}
+
+/******************************************************************************
+Description.: prepare a v4l2_buffer for a queue of the encoder
+Input Value.: * m......: the encoder
+              * buf....: the buffer to fill in
+              * plane..: storage for the plane of multi-planar devices
+              * type...: the queue
+              * memory.: V4L2_MEMORY_*
+              * index..: number of the buffer
+Return Value: -
+******************************************************************************/
+static void m2m_buffer(m2m_encoder *m, struct v4l2_buffer *buf, struct v4l2_plane *plane,
+                       unsigned int type, unsigned int memory, int index)
+{
+    memset(buf, 0, sizeof(*buf));
+    memset(plane, 0, sizeof(*plane));
+    buf->type = type;
+    buf->memory = memory;
+    buf->index = index;
+    if(m->mplane) {
+        buf->m.planes = plane;
+        buf->length = 1;
+    }
+}
+
+/******************************************************************************
+Description.: set the format of a queue
+Input Value.: * m..........: the encoder
+              * type.......: the queue
+              * width......: width of the pictures
+              * height.....: height of the pictures
+              * pixelformat: format of the queue
+              * bytesperline: length of the lines, 0 for compressed formats
+Return Value: the bytes per line the device chose, -1 on errors
+******************************************************************************/
+static int m2m_set_format(m2m_encoder *m, unsigned int type, int width, int height,
+                          unsigned int pixelformat, int bytesperline)
+{
+    struct v4l2_format fmt;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = type;
+    if(m->mplane) {
+        fmt.fmt.pix_mp.width = width;
+        fmt.fmt.pix_mp.height = height;
+        fmt.fmt.pix_mp.pixelformat = pixelformat;
+        fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+        fmt.fmt.pix_mp.num_planes = 1;
+        fmt.fmt.pix_mp.plane_fmt[0].bytesperline = bytesperline;
+    } else {
+        fmt.fmt.pix.width = width;
+        fmt.fmt.pix.height = height;
+        fmt.fmt.pix.pixelformat = pixelformat;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        fmt.fmt.pix.bytesperline = bytesperline;
+    }
+
+    if(m2m_ioctl(m->fd, VIDIOC_S_FMT, &fmt) < 0) {
+        perror("VIDIOC_S_FMT on the JPEG encoder");
+        return -1;
+    }
+
+    if(m->mplane) {
+        if(fmt.fmt.pix_mp.width != width || fmt.fmt.pix_mp.height != height ||
+           fmt.fmt.pix_mp.pixelformat != pixelformat || fmt.fmt.pix_mp.num_planes != 1)
+            return -1;
+        return fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+    }
+
+    if(fmt.fmt.pix.width != width || fmt.fmt.pix.height != height ||
+       fmt.fmt.pix.pixelformat != pixelformat)
+        return -1;
+    return fmt.fmt.pix.bytesperline;
+}
+
+/******************************************************************************
+Description.: allocate and map a buffer of the device
+Input Value.: * m......: the encoder
+              * type...: the queue
+              * mem....: set to the mapping
+              * length.: set to the size of the mapping
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int m2m_map_buffer(m2m_encoder *m, unsigned int type, void **mem, size_t *length)
+{
+    struct v4l2_requestbuffers rb;
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    unsigned int offset;
+
+    memset(&rb, 0, sizeof(rb));
+    rb.count = 1;
+    rb.type = type;
+    rb.memory = V4L2_MEMORY_MMAP;
+    if(m2m_ioctl(m->fd, VIDIOC_REQBUFS, &rb) < 0 || rb.count < 1) {
+        perror("VIDIOC_REQBUFS on the JPEG encoder");
+        return -1;
+    }
+
+    m2m_buffer(m, &buf, &plane, type, V4L2_MEMORY_MMAP, 0);
+    if(m2m_ioctl(m->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+        perror("VIDIOC_QUERYBUF on the JPEG encoder");
+        return -1;
+    }
+
+    *length = m->mplane ? plane.length : buf.length;
+    offset = m->mplane ? plane.m.mem_offset : buf.m.offset;
+    *mem = mmap(NULL, *length, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, offset);
+    if(*mem == MAP_FAILED) {
+        perror("mmap of the JPEG encoder buffer");
+        *mem = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: switch the OUTPUT queue from DMABUF to a buffer of the device
+              which pictures are copied to
+Input Value.: the encoder
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int m2m_output_mmap(m2m_encoder *m)
+{
+    struct v4l2_requestbuffers rb;
+    int type = m->out_type;
+
+    if(m->out_memory == V4L2_MEMORY_DMABUF) {
+        m2m_ioctl(m->fd, VIDIOC_STREAMOFF, &type);
+        memset(&rb, 0, sizeof(rb));
+        rb.type = type;
+        rb.memory = V4L2_MEMORY_DMABUF;
+        m2m_ioctl(m->fd, VIDIOC_REQBUFS, &rb);
+    }
+
+    m->out_memory = V4L2_MEMORY_MMAP;
+    m->out_count = 0;
+    if(m2m_map_buffer(m, m->out_type, &m->out_mem, &m->out_length) < 0)
+        return -1;
+
+    if(m2m_ioctl(m->fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("VIDIOC_STREAMON on the JPEG encoder");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: wait for a buffer and dequeue it
+Input Value.: * m......: the encoder
+              * buf....: prepared with m2m_buffer(), filled in by the device
+              * events.: POLLIN for CAPTURE, POLLOUT for OUTPUT
+Return Value: 0 on success, -1 on errors and timeouts
+******************************************************************************/
+static int m2m_dequeue(m2m_encoder *m, struct v4l2_buffer *buf, short events)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = m->fd;
+    pfd.events = events;
+
+    while(m2m_ioctl(m->fd, VIDIOC_DQBUF, buf) < 0) {
+        if(errno != EAGAIN)
+            return -1;
+        do {
+            ret = poll(&pfd, 1, M2M_TIMEOUT);
+        } while(ret < 0 && errno == EINTR);
+        if(ret <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Open a hardware JPEG encoder
+Input Value.: * device.....: the mem2mem device, NULL to use the first one
+                             which can encode pictures of this format
+              * width......: width of the pictures
+              * height.....: height of the pictures
+              * pixelformat: V4L2_PIX_FMT_* of the pictures
+              * bytesperline: length of their lines
+              * quality....: JPEG quality
+              * buffers....: number of DMABUF slots, 0 if pictures are
+                             always copied
+Return Value: the encoder, NULL if there is no suitable device
+******************************************************************************/
+m2m_encoder *m2m_encoder_new(const char *device, int width, int height, unsigned int pixelformat,
+                             int bytesperline, int quality, int buffers)
+{
+    struct v4l2_requestbuffers rb;
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    struct v4l2_control ctrl;
+    char name[32];
+    m2m_encoder *m;
+    int i, type;
+
+    if((m = calloc(1, sizeof(m2m_encoder))) == NULL)
+        return NULL;
+    m->fd = -1;
+
+    /* look for the first device which converts this format to JPEG */
+    for(i = 0; m->fd < 0 && i < (device != NULL ? 1 : M2M_PROBE_DEVICES); i++) {
+        if(device == NULL) {
+            snprintf(name, sizeof(name), "/dev/video%d", i);
+        } else {
+            snprintf(name, sizeof(name), "%s", device);
+        }
+
+        if((m->fd = open(name, O_RDWR | O_NONBLOCK)) < 0) {
+            if(device != NULL)
+                perror(name);
+            continue;
+        }
+
+        if(m2m_probe(m->fd, pixelformat, &m->mplane) < 0) {
+            if(device != NULL)
+                fprintf(stderr, "%s is no JPEG encoder for this format\n", name);
+            close(m->fd);
+            m->fd = -1;
+        }
+    }
+
+    if(m->fd < 0) {
+        free(m);
+        return NULL;
+    }
+
+    m->out_type = m->mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    m->cap_type = m->mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    m->bytesperline = bytesperline;
+    m->height = height;
+    if(pixelformat == V4L2_PIX_FMT_NV12)
+        m->lines = height + (height + 1) / 2;
+    else if(pixelformat == V4L2_PIX_FMT_NV16)
+        m->lines = 2 * height;
+    else
+        m->lines = height;
+
+    if((m->out_bytesperline = m2m_set_format(m, m->out_type, width, height, pixelformat, bytesperline)) < 0 ||
+       m2m_set_format(m, m->cap_type, width, height, V4L2_PIX_FMT_JPEG, 0) < 0) {
+        fprintf(stderr, "%s does not encode %dx%d pictures\n", name, width, height);
+        goto fail;
+    }
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+    ctrl.value = quality;
+    if(m2m_ioctl(m->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+        DBG("the JPEG encoder does not support setting the quality\n");
+    }
+
+    /* the camera buffers can only be imported if their lines match */
+    m->out_memory = V4L2_MEMORY_MMAP;
+    if(buffers > 0 && m->out_bytesperline == bytesperline) {
+        memset(&rb, 0, sizeof(rb));
+        rb.count = buffers;
+        rb.type = m->out_type;
+        rb.memory = V4L2_MEMORY_DMABUF;
+        if(m2m_ioctl(m->fd, VIDIOC_REQBUFS, &rb) == 0 && rb.count >= (unsigned int)buffers) {
+            m->out_memory = V4L2_MEMORY_DMABUF;
+            m->out_count = buffers;
+        }
+    }
+
+    if(m->out_memory == V4L2_MEMORY_MMAP &&
+       m2m_map_buffer(m, m->out_type, &m->out_mem, &m->out_length) < 0)
+        goto fail;
+
+    if(m2m_map_buffer(m, m->cap_type, &m->cap_mem, &m->cap_length) < 0)
+        goto fail;
+
+    m2m_buffer(m, &buf, &plane, m->cap_type, V4L2_MEMORY_MMAP, 0);
+    if(m2m_ioctl(m->fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("VIDIOC_QBUF on the JPEG encoder");
+        goto fail;
+    }
+
+    type = m->out_type;
+    if(m2m_ioctl(m->fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("VIDIOC_STREAMON on the JPEG encoder");
+        goto fail;
+    }
+    type = m->cap_type;
+    if(m2m_ioctl(m->fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("VIDIOC_STREAMON on the JPEG encoder");
+        goto fail;
+    }
+
+    IPRINT("JPEG encoder......: %s (%s)\n", name,
+           (m->out_memory == V4L2_MEMORY_DMABUF) ? "DMABUF import" : "copying pictures");
+    return m;
+
+fail:
+    m2m_encoder_free(m);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: Encode a picture
+Input Value.: * m......: the encoder
+              * index..: number of the camera buffer, selects the DMABUF slot
+              * dmabuf.: DMABUF file descriptor of the picture, -1 if there is
+                         none
+              * data...: the picture itself, used if it has to be copied
+              * size...: its length
+              * buffer.: storage for the JPEG
+              * max....: size of the storage
+Return Value: length of the JPEG, -1 on errors
+******************************************************************************/
+int m2m_encoder_encode(m2m_encoder *m, int index, int dmabuf, const unsigned char *data, int size,
+                       unsigned char *buffer, int max)
+{
+    struct v4l2_buffer out, cap;
+    struct v4l2_plane out_plane, cap_plane;
+    unsigned int len, offset;
+    int line, lines, length;
+
+    if(m->out_memory == V4L2_MEMORY_DMABUF) {
+        if(dmabuf >= 0 && index >= 0 && index < m->out_count) {
+            m2m_buffer(m, &out, &out_plane, m->out_type, V4L2_MEMORY_DMABUF, index);
+            if(m->mplane) {
+                out_plane.m.fd = dmabuf;
+                out_plane.bytesused = size;
+            } else {
+                out.m.fd = dmabuf;
+                out.bytesused = size;
+            }
+            if(m2m_ioctl(m->fd, VIDIOC_QBUF, &out) == 0)
+                goto queued;
+        }
+
+        /* e.g. the device needs contiguous memory the camera does not have */
+        IPRINT("the JPEG encoder can not import camera buffers, copying pictures\n");
+        if(m2m_output_mmap(m) < 0)
+            return -1;
+    }
+
+    if(data == NULL)
+        return -1;
+
+    /* copy the picture line by line if the device wants other strides */
+    if(m->out_bytesperline == m->bytesperline) {
+        length = MIN((size_t)size, m->out_length);
+        memcpy(m->out_mem, data, length);
+    } else {
+        lines = MIN(m->lines, size / m->bytesperline);
+        lines = MIN((size_t)lines, m->out_length / m->out_bytesperline);
+        for(line = 0; line < lines; line++) {
+            memcpy((unsigned char *)m->out_mem + line * m->out_bytesperline,
+                   data + line * m->bytesperline, MIN(m->bytesperline, m->out_bytesperline));
+        }
+        length = lines * m->out_bytesperline;
+    }
+
+    m2m_buffer(m, &out, &out_plane, m->out_type, V4L2_MEMORY_MMAP, 0);
+    if(m->mplane)
+        out_plane.bytesused = length;
+    else
+        out.bytesused = length;
+    if(m2m_ioctl(m->fd, VIDIOC_QBUF, &out) < 0) {
+        perror("VIDIOC_QBUF on the JPEG encoder");
+        return -1;
+    }
+
+queued:
+    m2m_buffer(m, &cap, &cap_plane, m->cap_type, V4L2_MEMORY_MMAP, 0);
+    if(m2m_dequeue(m, &cap, POLLIN) < 0) {
+        perror("JPEG encoder");
+        return -1;
+    }
+
+    /* the picture has to be back before the camera may overwrite it */
+    m2m_buffer(m, &out, &out_plane, m->out_type, m->out_memory, 0);
+    if(m2m_dequeue(m, &out, POLLOUT) < 0) {
+        perror("JPEG encoder");
+        return -1;
+    }
+
+    len = m->mplane ? cap_plane.bytesused : cap.bytesused;
+    offset = m->mplane ? cap_plane.data_offset : 0;
+    if((cap.flags & V4L2_BUF_FLAG_ERROR) || len <= offset || (int)(len - offset) > max ||
+       len > m->cap_length) {
+        length = -1;
+    } else {
+        length = len - offset;
+        memcpy(buffer, (unsigned char *)m->cap_mem + offset, length);
+    }
+
+    m2m_buffer(m, &cap, &cap_plane, m->cap_type, V4L2_MEMORY_MMAP, 0);
+    if(m2m_ioctl(m->fd, VIDIOC_QBUF, &cap) < 0) {
+        perror("VIDIOC_QBUF on the JPEG encoder");
+        return -1;
+    }
+
+    return length;
+}
+
+/******************************************************************************
+Description.: Stop and close a hardware JPEG encoder
+Input Value.: the encoder, may be NULL
+Return Value: -
+******************************************************************************/
+void m2m_encoder_free(m2m_encoder *m)
+{
+    int type;
+
+    if(m == NULL)
+        return;
+
+    if(m->fd >= 0) {
+        type = m->out_type;
+        m2m_ioctl(m->fd, VIDIOC_STREAMOFF, &type);
+        type = m->cap_type;
+        m2m_ioctl(m->fd, VIDIOC_STREAMOFF, &type);
+    }
+    if(m->out_mem != NULL)
+        munmap(m->out_mem, m->out_length);
+    if(m->cap_mem != NULL)
+        munmap(m->cap_mem, m->cap_length);
+    if(m->fd >= 0)
+        close(m->fd);
+    free(m);
+}
@@ -0,0 +1,423 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Memory accounting of the subsystems and the global budget
+ *
+ * memory_add() only changes two counters with atomic operations, it may be
+ * called with any lock held. The thread started by memory_start() does the
+ * evicting: it walks the accounts by priority and calls their evict
+ * functions without the lock of the registry, so they may take their own
+ * locks and release frames, which accounts the blocks going back to the
+ * pool. memory_unregister() waits for an evict function of the account
+ * which is running.
+ *
+ * The thread is woken when the sum crosses the budget and checks again
+ * every MEMORY_INTERVAL seconds while it stays above, memory the accounts
+ * can not evict is only reported.
+ *
+ * memory_lock_all() locks the process with mlockall(), the pages are locked
+ * as they are touched, so the stacks of the threads only take what they use.
+ * The thread then also reports the accounts holding more than can be locked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "mjpg_streamer.h"
+
+#define MEMORY_INTERVAL 1
+
+static pthread_mutex_t memory_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t memory_idle = PTHREAD_COND_INITIALIZER;
+static memory_account *accounts;
+static memory_account *evicting;    // its evict function runs
+
+static long long total;
+static long long budget;            // 0 without a limit
+static long long locked;            // limit of the locked memory, 0 if not locked
+static int locking;                 // MEMORY_LOCKED, MEMORY_HUGE
+static sem_t wake;
+static pthread_t evictor;
+static int running;
+
+/******************************************************************************
+Description.: add an account to the registry
+Input Value.: the account
+Return Value: -
+******************************************************************************/
+static void account_register(memory_account *account)
+{
+    pthread_mutex_lock(&memory_lock);
+    if(!account->registered) {
+        account->next = accounts;
+        accounts = account;
+        __atomic_store_n(&account->registered, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&memory_lock);
+}
+
+/******************************************************************************
+Description.: account for memory a subsystem allocated or released
+Input Value.: * account: of the subsystem, registered with the first call
+              * bytes..: allocated, negative if released
+Return Value: -
+******************************************************************************/
+void memory_add(memory_account *account, long long bytes)
+{
+    long long now;
+
+    if(!__atomic_load_n(&account->registered, __ATOMIC_ACQUIRE))
+        account_register(account);
+
+    __atomic_add_fetch(&account->used, bytes, __ATOMIC_RELAXED);
+    now = __atomic_add_fetch(&total, bytes, __ATOMIC_RELAXED);
+
+    /* the thread is only woken when the sum crosses the budget */
+    if(bytes > 0 && ((budget > 0 && now > budget && now - bytes <= budget) ||
+                     (locked > 0 && now > locked && now - bytes <= locked)) &&
+       __atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        sem_post(&wake);
+}
+
+/******************************************************************************
+Description.: remove an account, what it still holds is no longer counted.
+              The lock of the subsystem must not be held, its evict function
+              may wait for it.
+Input Value.: the account
+Return Value: -
+******************************************************************************/
+void memory_unregister(memory_account *account)
+{
+    memory_account **p;
+
+    pthread_mutex_lock(&memory_lock);
+    while(evicting == account)
+        pthread_cond_wait(&memory_idle, &memory_lock);
+
+    if(account->registered) {
+        for(p = &accounts; *p != account; p = &(*p)->next);
+        *p = account->next;
+        account->next = NULL;
+        __atomic_sub_fetch(&total, __atomic_exchange_n(&account->used, 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&account->registered, 0, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&memory_lock);
+}
+
+/******************************************************************************
+Description.: tell whether the accounts hold more than the budget, the pool
+              and caches keep less for reuse then
+Input Value.: -
+Return Value: 1 if they do, 0 otherwise or without a budget
+******************************************************************************/
+int memory_pressure(void)
+{
+    return budget > 0 && __atomic_load_n(&total, __ATOMIC_RELAXED) > budget;
+}
+
+/******************************************************************************
+Description.: the budget set with memory_start()
+Input Value.: -
+Return Value: the budget in bytes, 0 without a limit
+******************************************************************************/
+long long memory_budget(void)
+{
+    return budget;
+}
+
+/******************************************************************************
+Description.: sum up the accounts of each name
+Input Value.: * usage: gets the sums
+              * count: at most this many
+Return Value: number of sums written
+******************************************************************************/
+int memory_report(memory_usage *usage, int count)
+{
+    memory_account *account;
+    int i, n = 0;
+
+    pthread_mutex_lock(&memory_lock);
+    for(account = accounts; account != NULL; account = account->next) {
+        for(i = 0; i < n && strcmp(usage[i].name, account->name) != 0; i++);
+        if(i == n) {
+            if(n == count)
+                continue;
+            memset(&usage[n], 0, sizeof(memory_usage));
+            snprintf(usage[n].name, sizeof(usage[n].name), "%s", account->name);
+            usage[n].priority = account->priority;
+            n++;
+        }
+        usage[i].used += __atomic_load_n(&account->used, __ATOMIC_RELAXED);
+        usage[i].evicted += account->evicted;
+    }
+    pthread_mutex_unlock(&memory_lock);
+
+    return n;
+}
+
+/******************************************************************************
+Description.: read the budget of --memory-budget
+Input Value.: * arg...: megabytes
+              * budget: gets the bytes
+Return Value: 0 if ok, -1 if it is not a positive number
+******************************************************************************/
+int memory_parse_budget(const char *arg, long long *budget)
+{
+    char *end;
+    long long mb = strtoll(arg, &end, 10);
+
+    if(end == arg || *end != '\0' || mb <= 0)
+        return -1;
+
+    *budget = mb * 1024 * 1024;
+    return 0;
+}
+
+/******************************************************************************
+Description.: evict from the accounts by priority until the sum is under the
+              low water mark again
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void evict_accounts(void)
+{
+    long long target = budget / 100 * MEMORY_LOW_WATER, excess, freed;
+    memory_account *account;
+    int priority;
+
+    pthread_mutex_lock(&memory_lock);
+    for(priority = 0; priority < MEMORY_PRIORITIES; priority++) {
+        for(account = accounts; account != NULL; account = account->next) {
+            if((excess = __atomic_load_n(&total, __ATOMIC_RELAXED) - target) <= 0)
+                break;
+            if(account->priority != priority || account->evict == NULL ||
+               __atomic_load_n(&account->used, __ATOMIC_RELAXED) <= 0)
+                continue;
+
+            /* the account stays in the list until its evict function returns */
+            evicting = account;
+            pthread_mutex_unlock(&memory_lock);
+            freed = account->evict(account->arg, excess);
+            pthread_mutex_lock(&memory_lock);
+            evicting = NULL;
+            pthread_cond_broadcast(&memory_idle);
+
+            if(freed > 0) {
+                account->evicted += freed;
+                DBG("evicted %lld bytes of %s\n", freed, account->name);
+            }
+        }
+    }
+    pthread_mutex_unlock(&memory_lock);
+}
+
+/******************************************************************************
+Description.: the thread which keeps the accounts within the budget
+Input Value.: unused
+Return Value: unused
+******************************************************************************/
+static void *memory_thread(void *arg)
+{
+    struct timespec deadline;
+    int warned = 0, over_locked = 0;
+    long long now;
+
+    while(1) {
+        /* sem_timedwait() waits on the realtime clock */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += MEMORY_INTERVAL;
+        while(sem_timedwait(&wake, &deadline) < 0 && errno == EINTR);
+
+        /* the allocations past the limit fail or are not locked */
+        now = __atomic_load_n(&total, __ATOMIC_RELAXED);
+        if(locked > 0 && now > locked && !over_locked) {
+            LOG("%lld MB are held by the pool, caches and rings, more than the %lld MB which can be locked\n",
+                now / (1024 * 1024), locked / (1024 * 1024));
+            over_locked = 1;
+        } else if(now <= locked) {
+            over_locked = 0;
+        }
+
+        if(!memory_pressure()) {
+            warned = 0;
+            continue;
+        }
+
+        evict_accounts();
+
+        /* once until it is under the budget again */
+        if(memory_pressure() && !warned) {
+            LOG("%lld MB are held, more than the memory budget of %lld MB\n",
+                __atomic_load_n(&total, __ATOMIC_RELAXED) / (1024 * 1024), budget / (1024 * 1024));
+            warned = 1;
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: start the thread for the budget and the locked memory, once
+Input Value.: -
+Return Value: 0 if ok, -1 if the thread could not be started
+******************************************************************************/
+static int start_thread(void)
+{
+    if(__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return 0;
+
+    if(sem_init(&wake, 0, 0) < 0 || pthread_create(&evictor, NULL, memory_thread, NULL) != 0)
+        return -1;
+    pthread_detach(evictor);
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/******************************************************************************
+Description.: set the budget and start the thread which enforces it
+Input Value.: the budget in bytes, 0 to only account
+Return Value: 0 if ok, -1 if the thread could not be started
+******************************************************************************/
+int memory_start(long long limit)
+{
+    if(limit <= 0 || budget > 0)
+        return 0;
+
+    budget = limit;
+    if(start_thread() < 0) {
+        LOG("could not start the memory thread, the budget is not enforced\n");
+        budget = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: read the option of --lock-memory
+Input Value.: * arg..: megabytes, followed by ,huge for hugetlb pages
+              * limit: gets the bytes
+              * huge.: gets 1 with ,huge, 0 otherwise
+Return Value: 0 if ok, -1 if it is not understood
+******************************************************************************/
+int memory_parse_lock(const char *arg, long long *limit, int *huge)
+{
+    char *end;
+    long long mb = strtoll(arg, &end, 10);
+
+    if(end == arg || mb <= 0 || (*end != '\0' && strcmp(end, ",huge") != 0))
+        return -1;
+
+    *limit = mb * 1024 * 1024;
+    *huge = (*end != '\0');
+    return 0;
+}
+
+/******************************************************************************
+Description.: tell whether the process holds a capability, from the effective
+              set of /proc/self/status
+Input Value.: number of the capability
+Return Value: 1 if it does, 0 otherwise
+******************************************************************************/
+static int has_capability(int capability)
+{
+    unsigned long long caps = 0;
+    char line[128];
+    FILE *status;
+
+    if((status = fopen("/proc/self/status", "r")) == NULL)
+        return 0;
+    while(fgets(line, sizeof(line), status) != NULL) {
+        if(sscanf(line, "CapEff: %llx", &caps) == 1)
+            break;
+    }
+    fclose(status);
+
+    return (caps >> capability) & 1;
+}
+
+/******************************************************************************
+Description.: lock the memory of the process into RAM, all it touched and all
+              it touches from now on, and have the frame pool fault its blocks
+              in when it maps them, with hugetlb pages if asked for. Without
+              CAP_IPC_LOCK the limit of locked memory is raised to the one
+              given, the process is not locked if that fails, its threads
+              could not even get their stacks then.
+Input Value.: * limit: bytes which may be locked
+              * huge.: 1 to back the blocks of 2 MB and more with hugetlb pages
+Return Value: 0 if ok, -1 if the memory was not locked
+******************************************************************************/
+int memory_lock_all(long long limit, int huge)
+{
+    struct rlimit rl;
+    int flags = MCL_CURRENT | MCL_FUTURE;
+
+    locking = MEMORY_LOCKED | (huge ? MEMORY_HUGE : 0);
+
+    /* CAP_IPC_LOCK is number 14, it lifts the limit */
+    if(!has_capability(14)) {
+        if(getrlimit(RLIMIT_MEMLOCK, &rl) < 0)
+            rl.rlim_cur = rl.rlim_max = 0;
+        if(rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)limit) {
+            rl.rlim_cur = limit;
+            if(rl.rlim_max != RLIM_INFINITY && rl.rlim_max < (rlim_t)limit)
+                rl.rlim_max = limit;
+            if(setrlimit(RLIMIT_MEMLOCK, &rl) < 0) {
+                LOG("only %lld MB may be locked, raise the memlock limit or give CAP_IPC_LOCK\n",
+                    (long long)(getrlimit(RLIMIT_MEMLOCK, &rl) == 0 ? rl.rlim_cur : 0) / (1024 * 1024));
+                return -1;
+            }
+        }
+    }
+
+    #ifdef MCL_ONFAULT
+    flags |= MCL_ONFAULT;
+    #endif
+    if(mlockall(flags) < 0) {
+        LOG("could not lock the memory: %s\n", strerror(errno));
+        return -1;
+    }
+
+    locked = limit;
+    if(start_thread() < 0)
+        LOG("could not start the memory thread, the locked memory is not watched\n");
+    return 0;
+}
+
+/******************************************************************************
+Description.: how the frame pool maps its blocks
+Input Value.: -
+Return Value: MEMORY_LOCKED if they are to be faulted in at once, with
+              MEMORY_HUGE for hugetlb pages, 0 without memory_lock_all().
+              The blocks are faulted in even if the locking failed.
+******************************************************************************/
+int memory_locking(void)
+{
+    return locking;
+}
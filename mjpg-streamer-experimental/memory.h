@@ -0,0 +1,95 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/*
+ * the subsystems which keep memory around, like the frame pool, caches,
+ * pre-event buffers and rings, account for it here. With a budget set a
+ * thread of its own evicts memory once their sum is above it, from the
+ * lowest priority up: the idle blocks of the pool first, the rings last,
+ * until the sum is back under MEMORY_LOW_WATER percent of the budget.
+ *
+ * An account registers with its first memory_add(), a subsystem calls it
+ * with the change of each allocation and release, also for those made by
+ * its evict function.
+ *
+ * For a latency which does not depend on the memory of the system the
+ * process can be locked into RAM, see memory_lock_all(), the frame pool
+ * faults in its blocks when it maps them then.
+ */
+#define MEMORY_LOW_WATER 90
+#define MEMORY_NAME_SIZE 16
+
+/* memory_locking() */
+#define MEMORY_LOCKED 1
+#define MEMORY_HUGE 2
+
+typedef enum {
+    MEMORY_POOL,                    // idle blocks kept for reuse
+    MEMORY_CACHE,                   // data which can be built again
+    MEMORY_BUFFER,                  // pre-event buffers
+    MEMORY_RING,                    // frame rings clients are served from
+    MEMORY_PRIORITIES
+} memory_priority;
+
+/*
+ * frees about bytes of the memory of an account, returns how many it freed.
+ * It is called by the memory thread, not while memory_add() runs.
+ */
+typedef long long (*memory_evict_fn)(void *arg, long long bytes);
+
+typedef struct _memory_account memory_account;
+struct _memory_account {
+    const char *name;
+    memory_priority priority;
+    memory_evict_fn evict;          // NULL if nothing can be evicted
+    void *arg;
+
+    /* only to be touched by memory.c */
+    long long used;
+    long long evicted;              // bytes evict() gave back
+    int registered;
+    memory_account *next;
+};
+
+#define MEMORY_ACCOUNT(name, priority, evict, arg) { name, priority, evict, arg, 0, 0, 0, NULL }
+
+/* the sum of the accounts of the same name */
+typedef struct {
+    char name[MEMORY_NAME_SIZE];
+    memory_priority priority;
+    long long used;
+    long long evicted;
+} memory_usage;
+
+void memory_add(memory_account *account, long long bytes);
+void memory_unregister(memory_account *account);
+int memory_pressure(void);
+long long memory_budget(void);
+int memory_report(memory_usage *usage, int count);
+int memory_parse_budget(const char *arg, long long *budget);
+int memory_start(long long limit);
+int memory_parse_lock(const char *arg, long long *limit, int *huge);
+int memory_lock_all(long long limit, int huge);
+int memory_locking(void);
+
+#endif
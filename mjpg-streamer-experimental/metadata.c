@@ -0,0 +1,280 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * capture metadata in the frames (--metadata exif|com)
+ *
+ * The X-Timestamp header of output_http is lost as soon as a frame is saved,
+ * so the capture time, the sequence number and the input go into the JPEG
+ * itself: as an APP1 segment with EXIF tags, which photo tools show, or as a
+ * COM segment with a line of text. The segment lives in the frame next to
+ * the data and goes right after the SOI marker when the frame is written,
+ * the data of the frame is neither moved nor copied for it.
+ *
+ * The EXIF tags written:
+ *   IFD0 Make             "mjpg-streamer"
+ *   IFD0 Model            name of the input
+ *   IFD0 DateTime         capture time on the wall clock in UTC, seconds
+ *   Exif DateTimeOriginal the same
+ *   Exif OffsetTimeOriginal "+00:00"
+ *   Exif SubSecTimeOriginal microseconds of the capture time
+ *   Exif PixelXDimension  width of the picture, which may change at runtime
+ *   Exif PixelYDimension  its height
+ *   Exif ImageUniqueID    input number and sequence number in hex, 8 + 24 digits
+ *   Exif BodySerialNumber input number
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+#define M_APP1 0xe1
+#define M_COM  0xfe
+
+/* the segment starts with its marker, length and the EXIF identifier */
+#define EXIF_HEADER 10
+
+/* TIFF field types */
+#define TIFF_ASCII 2
+#define TIFF_LONG  4
+
+/* writes a big endian TIFF structure, offsets count from its start */
+typedef struct {
+    unsigned char *tiff;
+    size_t entry;               /* next entry of the current IFD */
+    size_t data;                /* next free byte behind the IFDs */
+    size_t size;                /* room for the whole structure */
+} exif_writer;
+
+/******************************************************************************
+Description.: look up a kind of metadata by its name
+Input Value.: name, "exif" or "com"
+Return Value: METADATA_EXIF, METADATA_COM or -1 if the name is unknown
+******************************************************************************/
+int metadata_parse(const char *name)
+{
+    if(strcmp(name, "exif") == 0)
+        return METADATA_EXIF;
+    if(strcmp(name, "com") == 0)
+        return METADATA_COM;
+    return -1;
+}
+
+static void put16(unsigned char *p, unsigned int value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/******************************************************************************
+Description.: start an IFD at the current entry position
+Input Value.: * w.....: the writer
+              * count.: number of entries it gets
+              * offset: where the IFD starts
+              * next..: offset of the next IFD, 0 for none
+Return Value: -
+******************************************************************************/
+static void exif_ifd(exif_writer *w, int count, size_t offset, size_t next)
+{
+    put16(w->tiff + offset, count);
+    put32(w->tiff + offset + 2 + count * 12, next);
+    w->entry = offset + 2;
+}
+
+/******************************************************************************
+Description.: add an entry with a number to the current IFD
+Input Value.: * w....: the writer
+              * tag..: the tag
+              * value: its value
+Return Value: -
+******************************************************************************/
+static void exif_long(exif_writer *w, int tag, unsigned int value)
+{
+    unsigned char *e = w->tiff + w->entry;
+
+    put16(e, tag);
+    put16(e + 2, TIFF_LONG);
+    put32(e + 4, 1);
+    put32(e + 8, value);
+    w->entry += 12;
+}
+
+/******************************************************************************
+Description.: add an entry with a string to the current IFD, a string longer
+              than the room left gets cut
+Input Value.: * w..: the writer
+              * tag: the tag
+              * s..: the string
+Return Value: -
+******************************************************************************/
+static void exif_ascii(exif_writer *w, int tag, const char *s)
+{
+    unsigned char *e = w->tiff + w->entry;
+    size_t count = strlen(s) + 1, room = (w->data < w->size) ? w->size - w->data : 0;
+
+    put16(e, tag);
+    put16(e + 2, TIFF_ASCII);
+
+    /* a full segment leaves an empty string at least */
+    if(count > 4)
+        count = MAX(MIN(count, room), 1);
+
+    /* up to four bytes are stored in the entry itself */
+    if(count <= 4) {
+        memset(e + 8, 0, 4);
+        memcpy(e + 8, s, count - 1);
+    } else {
+        memcpy(w->tiff + w->data, s, count - 1);
+        w->tiff[w->data + count - 1] = '\0';
+        put32(e + 8, w->data);
+        /* values start at even offsets */
+        w->data = MIN(w->data + count + (count & 1), w->size);
+    }
+
+    put32(e + 4, count);
+    w->entry += 12;
+}
+
+/******************************************************************************
+Description.: write the APP1 segment with the EXIF data of a frame
+Input Value.: * in...: the input of the frame
+              * frame: the frame, gets the segment
+              * tm...: capture time
+              * usec.: its microseconds
+Return Value: length of the segment
+******************************************************************************/
+static int exif_segment(input *in, input_frame *frame, struct tm *tm, long usec)
+{
+    char datetime[20], subsec[8], unique[33], serial[12];
+    unsigned char *seg = frame->app;
+    exif_writer w;
+    size_t ifd0 = 8, exif = ifd0 + 2 + 4 * 12 + 4;
+    int width = 0, height = 0;
+
+    strftime(datetime, sizeof(datetime), "%Y:%m:%d %H:%M:%S", tm);
+    snprintf(subsec, sizeof(subsec), "%06ld", usec);
+    snprintf(unique, sizeof(unique), "%08x%024llx", in->param.id, frame->seq);
+    snprintf(serial, sizeof(serial), "%d", in->param.id);
+    frame_picture_size(frame, &width, &height);
+
+    w.tiff = seg + EXIF_HEADER;
+    w.size = FRAME_APP_SIZE - EXIF_HEADER;
+    w.data = exif + 2 + 7 * 12 + 4;
+
+    /* TIFF header, big endian, IFD0 follows it */
+    memcpy(w.tiff, "MM\0\x2a", 4);
+    put32(w.tiff + 4, ifd0);
+
+    /* the entries of an IFD are sorted by their tags */
+    exif_ifd(&w, 4, ifd0, 0);
+    exif_ascii(&w, 0x010f, "mjpg-streamer");
+    exif_ascii(&w, 0x0110, (in->name != NULL) ? in->name : in->plugin);
+    exif_ascii(&w, 0x0132, datetime);
+    exif_long(&w, 0x8769, exif);
+
+    exif_ifd(&w, 7, exif, 0);
+    exif_ascii(&w, 0x9003, datetime);
+    exif_ascii(&w, 0x9011, "+00:00");
+    exif_ascii(&w, 0x9291, subsec);
+    exif_long(&w, 0xa002, width);
+    exif_long(&w, 0xa003, height);
+    exif_ascii(&w, 0xa420, unique);
+    exif_ascii(&w, 0xa431, serial);
+
+    seg[0] = 0xff;
+    seg[1] = M_APP1;
+    put16(seg + 2, EXIF_HEADER - 2 + w.data);
+    memcpy(seg + 4, "Exif\0\0", 6);
+
+    return EXIF_HEADER + w.data;
+}
+
+/******************************************************************************
+Description.: write the COM segment with a line of text about a frame
+Input Value.: * in...: the input of the frame
+              * frame: the frame, gets the segment
+              * tm...: capture time
+              * usec.: its microseconds
+Return Value: length of the segment
+******************************************************************************/
+static int com_segment(input *in, input_frame *frame, struct tm *tm, long usec)
+{
+    char datetime[24], burst[32] = "";
+    int len, width = 0, height = 0;
+
+    strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%S", tm);
+    frame_picture_size(frame, &width, &height);
+    if(frame->burst != 0)
+        snprintf(burst, sizeof(burst), " burst=%u/%d", frame->burst, frame->burst_index);
+    len = snprintf((char *)frame->app + 4, FRAME_APP_SIZE - 4, "input=%d seq=%llu time=%s.%06ldZ size=%dx%d%s name=%s",
+                   in->param.id, frame->seq, datetime, usec, width, height, burst,
+                   (in->name != NULL) ? in->name : in->plugin);
+    len = MIN(len, FRAME_APP_SIZE - 5);
+
+    frame->app[0] = 0xff;
+    frame->app[1] = M_COM;
+    put16(frame->app + 2, len + 2);
+
+    return len + 4;
+}
+
+/******************************************************************************
+Description.: put the metadata of its input into a frame, called by
+              input_publish_frame() once the frame has its sequence number
+Input Value.: * in...: the input
+              * frame: the frame, a JPEG starting with SOI
+Return Value: -
+******************************************************************************/
+void frame_metadata(input *in, input_frame *frame)
+{
+    struct timeval wall;
+    struct tm tm;
+    time_t t;
+
+    if(frame->size < 2 || frame->buf[0] != 0xff || frame->buf[1] != 0xd8)
+        return;
+
+    if(frame->timestamp.tv_sec == 0)
+        gettimeofday(&frame->timestamp, NULL);
+
+    /* the timestamp of the frame may be on the monotonic clock of the driver */
+    frame_wall_time(frame, &wall);
+    t = wall.tv_sec;
+    gmtime_r(&t, &tm);
+
+    frame->app_size = (in->metadata == METADATA_COM) ? com_segment(in, frame, &tm, (long)wall.tv_usec) :
+                      exif_segment(in, frame, &tm, (long)wall.tv_usec);
+}
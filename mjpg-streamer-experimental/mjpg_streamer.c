@@ -36,15 +36,110 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <syslog.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
 
 #include "utils.h"
 #include "mjpg_streamer.h"
+#include "supervisor.h"
 
 /* globals */
 static globals global;
 
+/*
+ * how the threads of a plugin are scheduled. Threads take the affinity,
+ * policy and nice level of the thread creating them, so init() and run() of
+ * a plugin with settings are called from a thread which has them and every
+ * thread the plugin starts from there inherits them.
+ */
+typedef struct {
+    int cpus_set;       // --cpus was given
+    cpu_set_t cpus;
+    int policy;         // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int priority;       // of SCHED_FIFO and SCHED_RR
+    int nice_set;       // --nice was given
+    int nice;
+    int numa_set;       // --numa was given
+    int numa;           // the node, NUMA_NIC for inputs placed by their plugin
+} plugin_sched;
+
+/* what input_publish_frame() and the governor do with the frames of an input */
+typedef struct {
+    int transform;      // --transform
+    int metadata;       // --metadata
+    motion_config motion;   // --motion
+    int replay;         // --replay
+    int priority;       // --priority
+} frame_options;
+
+/* input_sched is indexed like global.in, output_sched like global.out */
+static plugin_sched *input_sched;
+static plugin_sched *output_sched;
+
+/*
+ * a change of the plugins asked for while the program runs, main() carries
+ * them out one after the other once the plugins given at start run
+ */
+typedef struct {
+    int remove;
+    command_dest dest;
+    const char *spec;   // plugin to add with its parameters
+    int id;             // plugin to remove
+    int result;
+    int done;
+} plugin_request;
+
+static pthread_mutex_t request_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t request_update = PTHREAD_COND_INITIALIZER;
+static plugin_request *request;
+
+/* plugins are only added and removed at runtime with --runtime-plugins */
+static int runtime_plugins;
+
+/*
+ * the inputs are initialized in parallel, but getopt() and the static
+ * options of the plugins are shared, so one init() at a time parses its
+ * options. It holds the turn until it calls plugin_options_parsed() or
+ * returns.
+ */
+static pthread_mutex_t options_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t options_free = PTHREAD_COND_INITIALIZER;
+static int options_busy;
+static __thread int options_held;
+
+/* input_add() is called by plugins initialized at the same time */
+static pthread_mutex_t input_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"input", required_argument, NULL, 'i'},
+    {"output", required_argument, NULL, 'o'},
+    {"version", no_argument, NULL, 'v'},
+    {"background", no_argument, NULL, 'b'},
+    {"cpus", required_argument, NULL, 'c'},
+    {"realtime", required_argument, NULL, 'r'},
+    {"nice", required_argument, NULL, 'n'},
+    {"config", required_argument, NULL, 'f'},
+    {"shards", no_argument, NULL, 's'},
+    {"log-format", required_argument, NULL, 'l'},
+    {"transform", required_argument, NULL, 't'},
+    {"metadata", required_argument, NULL, 'm'},
+    {"motion", required_argument, NULL, 'M'},
+    {"memory-budget", required_argument, NULL, 'B'},
+    {"lock-memory", required_argument, NULL, 'L'},
+    {"trace", required_argument, NULL, 'T'},
+    {"numa", required_argument, NULL, 'N'},
+    {"replay", required_argument, NULL, 'R'},
+    {"governor", required_argument, NULL, 'G'},
+    {"priority", required_argument, NULL, 'P'},
+    {"runtime-plugins", no_argument, NULL, 'D'},
+    {NULL, 0, NULL, 0}
+};
+
 /******************************************************************************
 Description.: Display a help message
 Input Value.: argv[0] is the program name and the parameter progname
@@ -58,7 +153,43 @@ static void help(char *progname)
             "  -o | --output \"<output-plugin.so> [parameters]\"\n" \
             " [-h | --help ]........: display this help\n" \
             " [-v | --version ].....: display version information\n" \
-            " [-b | --background]...: fork to the background, daemon mode\n", progname);
+            " [-b | --background]...: fork to the background, daemon mode\n" \
+            " [-f | --config <file>]: read options from a file, one per line\n" \
+            " [-s | --shards].......: run each input and the outputs in processes\n" \
+            "                         of their own, restarted when they fail\n" \
+            " [-l | --log-format text|json]: write the messages as text or as one\n" \
+            "                         JSON object per line\n" \
+            " [-B | --memory-budget <MB>]: evict from the frame pool, caches, pre-event\n" \
+            "                         buffers and rings once they hold more, with\n" \
+            "                         --shards the budget of each process\n" \
+            " [-L | --lock-memory <MB>[,huge]]: lock up to this much memory into RAM\n" \
+            "                         and fault the frame pool in, huge for hugetlb\n" \
+            "                         pages behind frames of 2 MB and more\n" \
+            " [-T | --trace <folder>[,<seconds>]]: where SIGUSR1 writes the frame events\n" \
+            "                         of the last seconds, /tmp and 10 by default\n" \
+            " [-G | --governor <celsius>[,<load>]]: lower the frame rate and quality of\n" \
+            "                         the inputs while the CPU is hotter, busier than\n" \
+            "                         <load> percent (90) or an encoder falls behind\n" \
+            " The following options apply to the threads of the plugin before them:\n" \
+            " [-c | --cpus <list>]..: cores to run on, e.g. 2,3 or 0-1\n" \
+            " [-r | --realtime fifo|rr:<priority>]: real-time scheduling policy\n" \
+            " [-n | --nice <level>].: nice level from -20 to 19\n" \
+            " [-N | --numa <node>|nic]: run on a NUMA node and allocate there, nic\n" \
+            "                         for an input on the node of its network card\n" \
+            " The following options apply to the input before them:\n" \
+            " [-t | --transform <name>]: rotate or flip the frames losslessly, one of\n" \
+            "                         hflip, vflip, rotate90, rotate180, rotate270,\n" \
+            "                         transpose or transverse\n" \
+            " [-m | --metadata exif|com]: put capture time, sequence number and\n" \
+            "                         input into each frame, as EXIF or comment\n" \
+            " [-M | --motion <percent>[,<columns>x<rows>]]: detect motion, when this\n" \
+            "                         much of a zone changes, 3x3 zones by default\n" \
+            " [-D | --runtime-plugins]: let output_http add and remove plugins by\n" \
+            "                         name, with any parameters, off by default\n" \
+            " [-R | --replay <seconds>]: keep the frames of the last seconds in memory\n" \
+            "                         for an instant replay over HTTP\n" \
+            " [-P | --priority <n>].: inputs of a lower priority are degraded first by\n" \
+            "                         --governor, 0 by default\n", progname);
     fprintf(stderr, "-----------------------------------------------------------------------\n");
     fprintf(stderr, "Example #1:\n" \
             " To open an UVC webcam \"/dev/video1\" and stream it via HTTP:\n" \
@@ -72,6 +203,18 @@ static void help(char *progname)
             " To get help for a certain input plugin:\n" \
             "  %s -i \"input_uvc.so --help\"\n", progname);
     fprintf(stderr, "-----------------------------------------------------------------------\n");
+    fprintf(stderr, "Example #4:\n" \
+            " To capture on core 3 with real-time priority and serve HTTP on the others:\n" \
+            "  %s -i \"input_uvc.so\" -c 3 -r fifo:50 -o \"output_http.so\" -c 0-2 -n 5\n", progname);
+    fprintf(stderr, "-----------------------------------------------------------------------\n");
+    fprintf(stderr, "Example #5:\n" \
+            " To read the plugins from a file with lines like \"input input_uvc.so\":\n" \
+            "  %s -f /etc/mjpg_streamer.conf\n", progname);
+    fprintf(stderr, "-----------------------------------------------------------------------\n");
+    fprintf(stderr, "Example #6:\n" \
+            " To keep the other cameras streaming when one of them crashes:\n" \
+            "  %s -s -i \"input_uvc.so -d /dev/video0\" -i \"input_uvc.so -d /dev/video1\" -o \"output_http.so\"\n", progname);
+    fprintf(stderr, "-----------------------------------------------------------------------\n");
     fprintf(stderr, "In case the modules (=plugins) can not be found:\n" \
             " * Set the default search path for the modules with:\n" \
             "   export LD_LIBRARY_PATH=/path/to/plugins,\n" \
@@ -102,6 +245,9 @@ static void signal_handler(int sig)
     /* clean up threads */
     LOG("force cancellation of threads and cleanup resources\n");
     for(i = 0; i < global.incnt; i++) {
+        if(global.in[i].handle == NULL)
+            continue;
+        motion_stop(&global.in[i]);
         global.in[i].stop(i);
         /*for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
             if (global.in[i].param.argv[j] != NULL) {
@@ -111,6 +257,8 @@ static void signal_handler(int sig)
     }
 
     for(i = 0; i < global.outcnt; i++) {
+        if(global.out[i].handle == NULL)
+            continue;
         global.out[i].stop(global.out[i].param.id);
         pthread_cond_destroy(&global.in[i].db_update);
         pthread_mutex_destroy(&global.in[i].db);
@@ -123,11 +271,14 @@ static void signal_handler(int sig)
 
     /* close handles of input plugins */
     for(i = 0; i < global.incnt; i++) {
-        dlclose(global.in[i].handle);
+        if(global.in[i].handle != NULL)
+            dlclose(global.in[i].handle);
     }
 
     for(i = 0; i < global.outcnt; i++) {
         int j, skip = 0;
+        if(global.out[i].handle == NULL)
+            continue;
         DBG("about to decrement usage counter for handle of %s, id #%02d, handle: %p\n", \
             global.out[i].plugin, global.out[i].param.id, global.out[i].handle);
 
@@ -149,7 +300,7 @@ static void signal_handler(int sig)
 
     LOG("done\n");
 
-    closelog();
+    log_stop();
     exit(0);
     return;
 }
@@ -184,6 +335,711 @@ static int split_parameters(char *parameter_string, int *argc, char **argv)
     return 1;
 }
 
+/******************************************************************************
+Description.: prepare the frame bus of an input
+Input Value.: the input
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int init_input(input *in)
+{
+    /* this mutex and the conditional variable are used to synchronize access to the global picture buffer */
+    if(pthread_mutex_init(&in->db, NULL) != 0) {
+        LOG("could not initialize mutex variable\n");
+        return -1;
+    }
+    if(pthread_cond_init(&in->db_update, NULL) != 0) {
+        LOG("could not initialize condition variable\n");
+        return -1;
+    }
+
+    in->stop      = 0;
+    in->context   = NULL;
+    in->buf       = NULL;
+    in->size      = 0;
+    memset(in->ring, 0, sizeof(in->ring));
+    in->current   = NULL;
+    in->waiters   = NULL;
+    in->seq       = 0;
+    in->peekers[0] = in->peekers[1] = 0;
+    in->epoch     = 0;
+    in->transform = TRANSFORM_NONE;
+    in->metadata  = METADATA_NONE;
+    memset(&in->motion_config, 0, sizeof(in->motion_config));
+    in->motion    = NULL;
+    in->live      = NULL;
+    in->commands  = NULL;
+    in->replay_sec = 0;
+    in->replay    = NULL;
+    in->raw_subscribers = 0;
+    in->numa_node = -1;
+    memset(&in->stats, 0, sizeof(in->stats));
+    in->stats.encode_usec.shift = 6; // 64 us up to about a second
+    in->stats.dequeue_latency_usec.shift = 6;
+    in->stats.encode_latency_usec.shift = 6;
+    in->stats.publish_latency_usec.shift = 6;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: take one more input for a plugin which publishes several
+              streams, e.g. for several cameras. It gets the functions and
+              parameters of the plugin, input_run() and input_stop() are
+              called with its id as well.
+Input Value.: the input of the plugin, while it runs input_init()
+Return Value: id of the new input, -1 if all are taken
+******************************************************************************/
+int input_add(input *in)
+{
+    input *add;
+    int id;
+
+    pthread_mutex_lock(&input_mutex);
+    if(global.incnt >= INPUT_TABLE_SIZE) {
+        pthread_mutex_unlock(&input_mutex);
+        LOG("only %d inputs are supported\n", INPUT_TABLE_SIZE);
+        return -1;
+    }
+
+    id = global.incnt;
+    add = &global.in[id];
+    if(init_input(add) < 0) {
+        pthread_mutex_unlock(&input_mutex);
+        return -1;
+    }
+
+    /* every input holds a reference of the plugin, they are all closed */
+    add->plugin = strdup(in->plugin);
+    add->handle = dlopen(in->plugin, RTLD_LAZY);
+    add->init = in->init;
+    add->stop = in->stop;
+    add->run = in->run;
+    add->cmd = in->cmd;
+    add->param = in->param;
+    add->param.id = id;
+    input_sched[id] = input_sched[in->param.id];
+    add->numa_node = in->numa_node;
+    add->transform = in->transform;
+    add->metadata = in->metadata;
+    add->motion_config = in->motion_config;
+    add->replay_sec = in->replay_sec;
+    add->priority = in->priority;
+
+    global.incnt++;
+    pthread_mutex_unlock(&input_mutex);
+    return id;
+}
+
+/******************************************************************************
+Description.: allocate a zeroed table which never moves, the memory is only
+              used once its pages are touched
+Input Value.: * count: entries of the table
+              * size.: of an entry
+Return Value: the table, the program exits without memory
+******************************************************************************/
+static void *plugin_table(size_t count, size_t size)
+{
+    void *table;
+
+    table = mmap(NULL, count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(table == MAP_FAILED) {
+        LOG("could not allocate the table of %zu plugins: %s\n", count, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+/******************************************************************************
+Description.: parse a real-time policy like fifo:50
+Input Value.: * value: the policy and its priority
+              * sched: gets them
+Return Value: 0 if ok, -1 if it is malformed
+******************************************************************************/
+static int parse_realtime(const char *value, plugin_sched *sched)
+{
+    char *end;
+
+    if(strncmp(value, "fifo:", 5) == 0)
+        sched->policy = SCHED_FIFO;
+    else if(strncmp(value, "rr:", 3) == 0)
+        sched->policy = SCHED_RR;
+    else
+        return -1;
+
+    sched->priority = strtol(strchr(value, ':') + 1, &end, 10);
+    if(*end != '\0' || sched->priority < sched_get_priority_min(sched->policy) ||
+       sched->priority > sched_get_priority_max(sched->policy))
+        return -1;
+
+    return 0;
+}
+
+/* a call of a plugin function from a thread with its scheduling */
+typedef struct {
+    plugin_sched *sched;
+    int (*call)(void *arg);
+    void *arg;
+    int result;
+} plugin_call;
+
+/******************************************************************************
+Description.: thread calling a plugin function, the nice level is set here
+              since threads do not take it from attributes
+Input Value.: the plugin_call
+Return Value: NULL
+******************************************************************************/
+static void *plugin_call_thread(void *arg)
+{
+    plugin_call *c = arg;
+
+    /* on Linux the nice level belongs to the thread */
+    if(c->sched->nice_set && setpriority(PRIO_PROCESS, syscall(SYS_gettid), c->sched->nice) < 0)
+        LOG("could not set the nice level %d: %s\n", c->sched->nice, strerror(errno));
+
+    /* affinity and memory policy, both are passed on to new threads */
+    if(c->sched->numa_set && c->sched->numa >= 0 && numa_bind(c->sched->numa) < 0)
+        LOG("could not bind to NUMA node %d, none of its cores is allowed\n", c->sched->numa);
+
+    c->result = c->call(c->arg);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: call a function of a plugin, the threads it starts get the
+              scheduling given for the plugin. Settings the system refuses
+              are reported and left out.
+Input Value.: * sched: scheduling of the plugin
+              * call.: the function
+              * arg..: its argument
+Return Value: what the function returns
+******************************************************************************/
+static int call_scheduled(plugin_sched *sched, int (*call)(void *arg), void *arg)
+{
+    plugin_call c = { sched, call, arg, -1 };
+    struct sched_param param;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    if(!sched->cpus_set && sched->policy == SCHED_OTHER && !sched->nice_set &&
+       !(sched->numa_set && sched->numa >= 0))
+        return call(arg);
+
+    pthread_attr_init(&attr);
+    if(sched->cpus_set)
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &sched->cpus);
+    if(sched->policy != SCHED_OTHER) {
+        param.sched_priority = sched->priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, sched->policy);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    if((rc = pthread_create(&thread, &attr, plugin_call_thread, &c)) == EPERM && sched->policy != SCHED_OTHER) {
+        LOG("real-time scheduling is not permitted, the plugin runs without it\n");
+        sched->policy = SCHED_OTHER;
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        rc = pthread_create(&thread, &attr, plugin_call_thread, &c);
+    }
+    pthread_attr_destroy(&attr);
+
+    if(rc != 0) {
+        LOG("could not apply the scheduling of the plugin: %s\n", strerror(rc));
+        memset(sched, 0, sizeof(plugin_sched));
+        return call(arg);
+    }
+
+    pthread_join(thread, NULL);
+    return c.result;
+}
+
+/******************************************************************************
+Description.: wait for the turn to parse the options in init()
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void take_options(void)
+{
+    pthread_mutex_lock(&options_mutex);
+    while(options_busy)
+        pthread_cond_wait(&options_free, &options_mutex);
+    options_busy = 1;
+    pthread_mutex_unlock(&options_mutex);
+    options_held = 1;
+}
+
+/******************************************************************************
+Description.: called by init() of a plugin once it is done with getopt() and
+              its static options, the rest of init(), like opening a device,
+              runs alongside init() of the other plugins then
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void plugin_options_parsed(void)
+{
+    if(!options_held)
+        return;
+
+    options_held = 0;
+    pthread_mutex_lock(&options_mutex);
+    options_busy = 0;
+    pthread_cond_signal(&options_free);
+    pthread_mutex_unlock(&options_mutex);
+}
+
+static int init_input_plugin(void *arg)
+{
+    input *in = arg;
+    int rc;
+
+    take_options();
+    rc = in->init(&in->param, in->param.id);
+    plugin_options_parsed();
+    return rc;
+}
+
+static int run_input_plugin(void *arg)
+{
+    input *in = arg;
+
+    return in->run(in->param.id);
+}
+
+static int init_output_plugin(void *arg)
+{
+    output *out = arg;
+    int rc;
+
+    take_options();
+    rc = out->init(&out->param, out->param.id);
+    plugin_options_parsed();
+    return rc;
+}
+
+static int run_output_plugin(void *arg)
+{
+    output *out = arg;
+
+    return out->run(out->param.id);
+}
+
+/******************************************************************************
+Description.: open the library of an input plugin and split its parameters
+Input Value.: * in..: the input, prepared by init_input()
+              * spec: the plugin and its parameters, it must stay valid
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int open_input(input *in, char *spec)
+{
+    int j;
+
+    in->plugin = strndup(spec, strcspn(spec, " "));
+    in->handle = dlopen(in->plugin, RTLD_LAZY);
+    if(!in->handle) {
+        LOG("ERROR: could not find input plugin\n");
+        LOG("       Perhaps you want to adjust the search path with:\n");
+        LOG("       # export LD_LIBRARY_PATH=/path/to/plugin/folder\n");
+        LOG("       dlopen: %s\n", dlerror());
+        return -1;
+    }
+    in->init = dlsym(in->handle, "input_init");
+    in->stop = dlsym(in->handle, "input_stop");
+    in->run = dlsym(in->handle, "input_run");
+    if(in->init == NULL || in->stop == NULL || in->run == NULL) {
+        LOG("%s\n", dlerror());
+        dlclose(in->handle);
+        in->handle = NULL;
+        return -1;
+    }
+    /* try to find optional command */
+    in->cmd = dlsym(in->handle, "input_cmd");
+
+    in->param.parameters = strchr(spec, ' ');
+
+    for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
+        in->param.argv[j] = NULL;
+    }
+
+    split_parameters(in->param.parameters, &in->param.argc, in->param.argv);
+    in->param.global = &global;
+    return 0;
+}
+
+/******************************************************************************
+Description.: open the library of an output plugin and split its parameters
+Input Value.: * out.: the output
+              * spec: the plugin and its parameters, it must stay valid
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int open_output(output *out, char *spec)
+{
+    int j;
+
+    out->plugin = strndup(spec, strcspn(spec, " "));
+    out->handle = dlopen(out->plugin, RTLD_LAZY);
+    if(!out->handle) {
+        LOG("ERROR: could not find output plugin %s\n", out->plugin);
+        LOG("       Perhaps you want to adjust the search path with:\n");
+        LOG("       # export LD_LIBRARY_PATH=/path/to/plugin/folder\n");
+        LOG("       dlopen: %s\n", dlerror());
+        return -1;
+    }
+    out->init = dlsym(out->handle, "output_init");
+    out->stop = dlsym(out->handle, "output_stop");
+    out->run = dlsym(out->handle, "output_run");
+    if(out->init == NULL || out->stop == NULL || out->run == NULL) {
+        LOG("%s\n", dlerror());
+        dlclose(out->handle);
+        out->handle = NULL;
+        return -1;
+    }
+
+    /* try to find optional command */
+    out->cmd = dlsym(out->handle, "output_cmd");
+
+    out->param.parameters = strchr(spec, ' ');
+
+    for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
+        out->param.argv[j] = NULL;
+    }
+    split_parameters(out->param.parameters, &out->param.argc, out->param.argv);
+
+    out->param.global = &global;
+    return 0;
+}
+
+/******************************************************************************
+Description.: give up the reference of a removed plugin to its library.
+              stop() cancels the threads of a plugin without waiting for
+              them and some plugins leave threads serving their clients
+              behind, so the code stays mapped for them while the number of
+              the plugin is marked as removed.
+Input Value.: * plugin: file name of the library
+              * handle: of the plugin, set to NULL
+Return Value: -
+******************************************************************************/
+static void release_plugin(const char *plugin, void **handle)
+{
+    void *closing = *handle, *keep;
+
+    *handle = NULL;
+    if((keep = dlopen(plugin, RTLD_LAZY | RTLD_NOLOAD | RTLD_NODELETE)) == NULL)
+        return;
+    dlclose(keep);
+    dlclose(closing);
+}
+
+/******************************************************************************
+Description.: load, initialize and run an input plugin while the program runs
+Input Value.: the plugin and its parameters
+Return Value: number of its first input, -1 on errors
+******************************************************************************/
+static int add_input(const char *spec)
+{
+    int first = global.incnt, i, rc;
+    input *in = &global.in[first];
+    char *copy;
+
+    if(first >= INPUT_TABLE_SIZE) {
+        LOG("only %d inputs are supported\n", INPUT_TABLE_SIZE);
+        return -1;
+    }
+    if((copy = strdup(spec)) == NULL || init_input(in) < 0 || open_input(in, copy) < 0) {
+        free(copy);
+        return -1;
+    }
+    in->param.id = first;
+    global.incnt++;
+
+    /* a plugin taking several inputs adds them in init() behind this one */
+    rc = call_scheduled(&input_sched[first], init_input_plugin, in);
+    for(i = first; i < global.incnt; i++) {
+        if(rc != 0) {
+            release_plugin(global.in[i].plugin, &global.in[i].handle);
+            continue;
+        }
+        syslog(LOG_INFO, "starting input plugin %s", global.in[i].plugin);
+        if(call_scheduled(&input_sched[i], run_input_plugin, &global.in[i])) {
+            LOG("can not run input plugin %d: %s\n", i, global.in[i].plugin);
+            release_plugin(global.in[i].plugin, &global.in[i].handle);
+        }
+    }
+
+    if(rc != 0) {
+        LOG("input_init() of %s failed, the plugin is not added\n", in->plugin);
+        return -1;
+    }
+    return first;
+}
+
+/******************************************************************************
+Description.: load, initialize and run an output plugin while the program runs
+Input Value.: the plugin and its parameters
+Return Value: number of the output, -1 on errors
+******************************************************************************/
+static int add_output(const char *spec)
+{
+    int id = global.outcnt;
+    output *out = &global.out[id];
+    char *copy;
+
+    if(id >= OUTPUT_TABLE_SIZE) {
+        LOG("only %d output plugins are supported\n", OUTPUT_TABLE_SIZE);
+        return -1;
+    }
+    if((copy = strdup(spec)) == NULL || open_output(out, copy) < 0) {
+        free(copy);
+        return -1;
+    }
+    out->param.id = id;
+    global.outcnt++;
+
+    if(call_scheduled(&output_sched[id], init_output_plugin, out)) {
+        LOG("output_init() of %s failed, the plugin is not added\n", out->plugin);
+        release_plugin(out->plugin, &out->handle);
+        return -1;
+    }
+
+    syslog(LOG_INFO, "starting output plugin: %s (ID: %02d)", out->plugin, id);
+    call_scheduled(&output_sched[id], run_output_plugin, out);
+    return id;
+}
+
+/******************************************************************************
+Description.: stop a plugin while the program runs, its number is not used
+              again. Clients of a removed input get no more frames.
+Input Value.: * dest: Dest_Input or Dest_Output
+              * id..: number of the plugin
+Return Value: 0 on success, -1 if there is no such plugin
+******************************************************************************/
+static int remove_plugin(command_dest dest, int id)
+{
+    if(dest == Dest_Input && id >= 0 && id < global.incnt && global.in[id].handle != NULL) {
+        syslog(LOG_INFO, "stopping input plugin %s (ID: %02d)", global.in[id].plugin, id);
+        global.in[id].stop(id);
+        release_plugin(global.in[id].plugin, &global.in[id].handle);
+        return 0;
+    }
+
+    if(dest == Dest_Output && id >= 0 && id < global.outcnt && global.out[id].handle != NULL) {
+        syslog(LOG_INFO, "stopping output plugin %s (ID: %02d)", global.out[id].plugin, id);
+        global.out[id].stop(global.out[id].param.id);
+        release_plugin(global.out[id].plugin, &global.out[id].handle);
+        return 0;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: hand a change of the plugins to the main thread and wait until
+              it is done. New plugins get the scheduling of the main thread
+              instead of the one of the thread asking for them.
+Input Value.: the request
+Return Value: its result
+******************************************************************************/
+static int post_request(plugin_request *r)
+{
+    pthread_mutex_lock(&request_mutex);
+    while(request != NULL)
+        pthread_cond_wait(&request_update, &request_mutex);
+    request = r;
+    pthread_cond_broadcast(&request_update);
+    while(!r->done)
+        pthread_cond_wait(&request_update, &request_mutex);
+    pthread_mutex_unlock(&request_mutex);
+
+    return r->result;
+}
+
+/******************************************************************************
+Description.: carry out the changes of the plugins, runs in the main thread
+              until a signal ends the program
+Input Value.: -
+Return Value: does not return
+******************************************************************************/
+static void serve_requests(void)
+{
+    plugin_request *r;
+
+    pthread_mutex_lock(&request_mutex);
+    while(1) {
+        while(request == NULL || request->done)
+            pthread_cond_wait(&request_update, &request_mutex);
+        r = request;
+        pthread_mutex_unlock(&request_mutex);
+
+        if(r->remove)
+            r->result = remove_plugin(r->dest, r->id);
+        else if(r->dest == Dest_Input)
+            r->result = add_input(r->spec);
+        else if(r->dest == Dest_Output)
+            r->result = add_output(r->spec);
+        else
+            r->result = -1;
+
+        pthread_mutex_lock(&request_mutex);
+        r->done = 1;
+        request = NULL;
+        pthread_cond_broadcast(&request_update);
+    }
+}
+
+/******************************************************************************
+Description.: add a plugin while the program runs
+Input Value.: * dest: Dest_Input or Dest_Output
+              * spec: the plugin and its parameters, like -i and -o take them
+Return Value: number of the plugin, -1 on errors
+******************************************************************************/
+int plugin_add(command_dest dest, const char *spec)
+{
+    plugin_request r = { 0, dest, spec, -1, -1, 0 };
+    size_t name_len;
+
+    if(!runtime_plugins) {
+        LOG("plugins can only be added with --runtime-plugins\n");
+        return -1;
+    }
+    if(spec == NULL || *spec == '\0' || *spec == ' ')
+        return -1;
+
+    /* the plugin is looked up in the library path, never loaded from a path */
+    name_len = strcspn(spec, " ");
+    if(memchr(spec, '/', name_len) != NULL) {
+        LOG("only plugin names are accepted at runtime, not paths\n");
+        return -1;
+    }
+    return post_request(&r);
+}
+
+/******************************************************************************
+Description.: stop and remove a plugin while the program runs
+Input Value.: * dest: Dest_Input or Dest_Output
+              * id..: number of the plugin
+Return Value: 0 on success, -1 if there is no such plugin
+******************************************************************************/
+int plugin_remove(command_dest dest, int id)
+{
+    plugin_request r = { 1, dest, NULL, id, -1, 0 };
+
+    if(!runtime_plugins) {
+        LOG("plugins can only be removed with --runtime-plugins\n");
+        return -1;
+    }
+    return post_request(&r);
+}
+
+/******************************************************************************
+Description.: initialize and run an input given at start, the inputs do this
+              in parallel so a camera which takes long to set up does not
+              hold up the others
+Input Value.: the input
+Return Value: NULL, the program exits if the input fails
+******************************************************************************/
+static void *start_input(void *arg)
+{
+    input *in = arg;
+    int id = in->param.id;
+
+    if(call_scheduled(&input_sched[id], init_input_plugin, in)) {
+        LOG("input_init() return value signals to exit\n");
+        log_stop();
+        exit(0);
+    }
+
+    syslog(LOG_INFO, "starting input plugin %s", in->plugin);
+    if(call_scheduled(&input_sched[id], run_input_plugin, in)) {
+        LOG("can not run input plugin %d: %s\n", id, in->plugin);
+        log_stop();
+        exit(EXIT_FAILURE);
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: find the configuration file among the options, getopt_long()
+              takes them in the same forms
+Input Value.: argc and argv of main()
+Return Value: the file name or NULL
+******************************************************************************/
+static char *config_file(int argc, char *argv[])
+{
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--") == 0)
+            break;
+        if((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--config") == 0) && i + 1 < argc)
+            return argv[i + 1];
+        if(strncmp(argv[i], "--config=", 9) == 0)
+            return argv[i] + 9;
+        if(strncmp(argv[i], "-f", 2) == 0 && argv[i][2] != '\0')
+            return argv[i] + 2;
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: read the options of a configuration file. A line holds the
+              long name of an option and its argument, like
+                  input input_uvc.so -d /dev/video0
+                  cpus 3
+              empty lines and lines starting with # are skipped.
+Input Value.: * file: name of the file
+              * args: gets the options as they would be on the command line
+Return Value: number of arguments in args, the program exits on errors
+******************************************************************************/
+static int read_config(const char *file, char ***args)
+{
+    char *line = NULL, *key, *value, **grown;
+    size_t size = 0;
+    int count = 0, number = 0, i;
+    FILE *f;
+
+    if((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "could not open the configuration %s: %s\n", file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    *args = NULL;
+    while(getline(&line, &size, f) >= 0) {
+        number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        key = line + strspn(line, " \t");
+        if(*key == '\0' || *key == '#')
+            continue;
+
+        value = key + strcspn(key, " \t");
+        if(*value != '\0')
+            *value++ = '\0';
+        value += strspn(value, " \t");
+        for(i = strlen(value); i > 0 && (value[i - 1] == ' ' || value[i - 1] == '\t'); i--)
+            value[i - 1] = '\0';
+
+        for(i = 0; long_options[i].name != NULL && strcmp(long_options[i].name, key) != 0; i++);
+        if(long_options[i].name == NULL || long_options[i].val == 'f' ||
+           (long_options[i].has_arg == required_argument) != (*value != '\0')) {
+            fprintf(stderr, "%s:%d: can not use \"%s\"\n", file, number, key);
+            exit(EXIT_FAILURE);
+        }
+
+        if((grown = realloc(*args, (count + 2) * sizeof(char *))) == NULL) {
+            fprintf(stderr, "not enough memory\n");
+            exit(EXIT_FAILURE);
+        }
+        *args = grown;
+        if(asprintf(&(*args)[count++], "--%s", key) < 0 ||
+           (*value != '\0' && ((*args)[count++] = strdup(value)) == NULL)) {
+            fprintf(stderr, "not enough memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(line);
+    fclose(f);
+    return count;
+}
+
 /******************************************************************************
 Description.:
 Input Value.:
@@ -192,11 +1048,43 @@ Return Value:
 int main(int argc, char *argv[])
 {
     //char *input  = "input_uvc.so --resolution 640x480 --fps 5 --device /dev/video0";
-    char *input[MAX_INPUT_PLUGINS];
-    char *output[MAX_OUTPUT_PLUGINS];
-    int daemon = 0, i, j;
-    size_t tmp = 0;
+    char **input, **output, **config, **args;
+    plugin_sched *sched, *last = NULL;
+    frame_options *frames, *last_frames = NULL;
+    pthread_t *starters;
+    int daemon = 0, shards = 0, motion = 0, inputs = 0, huge = 0, i, k, n;
+    log_format format = LOG_FORMAT_TEXT;
+    long long budget = 0, lock = 0;
+    char *end, *file, *trace = "/tmp";
+    int trace_sec = FLIGHT_SECONDS, governor = 0;
+    double max_temperature = 0, max_load = GOVERNOR_LOAD;
 
+    /* the options of a configuration file come first, the command line adds to them */
+    if((file = config_file(argc, argv)) != NULL) {
+        n = read_config(file, &config);
+        if((args = calloc(argc + n + 1, sizeof(char *))) == NULL) {
+            fprintf(stderr, "not enough memory\n");
+            exit(EXIT_FAILURE);
+        }
+        args[0] = argv[0];
+        memcpy(args + 1, config, n * sizeof(char *));
+        memcpy(args + 1 + n, argv + 1, (argc - 1) * sizeof(char *));
+        free(config);
+        argc += n;
+        argv = args;
+    }
+
+    /* every plugin takes an argument, there are less plugins than those */
+    input = calloc(argc, sizeof(char *));
+    output = calloc(argc, sizeof(char *));
+    sched = calloc(argc, sizeof(plugin_sched));
+    frames = calloc(argc, sizeof(frame_options));
+    if(input == NULL || output == NULL || sched == NULL || frames == NULL) {
+        fprintf(stderr, "not enough memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    output_sched = plugin_table(OUTPUT_TABLE_SIZE, sizeof(plugin_sched));
     output[0] = "output_http.so --port 8080";
     global.outcnt = 0;
     global.incnt = 0;
@@ -204,27 +1092,106 @@ int main(int argc, char *argv[])
     /* parameter parsing */
     while(1) {
         int c = 0;
-        static struct option long_options[] = {
-            {"help", no_argument, NULL, 'h'},
-            {"input", required_argument, NULL, 'i'},
-            {"output", required_argument, NULL, 'o'},
-            {"version", no_argument, NULL, 'v'},
-            {"background", no_argument, NULL, 'b'},
-            {NULL, 0, NULL, 0}
-        };
 
-        c = getopt_long(argc, argv, "hi:o:vb", long_options, NULL);
+        c = getopt_long(argc, argv, "hi:o:vbc:r:n:N:f:sl:t:m:M:B:L:T:R:G:P:D", long_options, NULL);
 
         /* no more options to parse */
         if(c == -1) break;
 
         switch(c) {
         case 'i':
-            input[global.incnt++] = strdup(optarg);
+            last = &sched[inputs];
+            last_frames = &frames[inputs];
+            input[inputs++] = strdup(optarg);
+            shard_plugin(c, optarg);
             break;
 
         case 'o':
+            if(global.outcnt >= OUTPUT_TABLE_SIZE) {
+                fprintf(stderr, "only %d output plugins are supported\n", OUTPUT_TABLE_SIZE);
+                exit(EXIT_FAILURE);
+            }
+            last = &output_sched[global.outcnt];
+            last_frames = NULL;
             output[global.outcnt++] = strdup(optarg);
+            shard_plugin(c, optarg);
+            break;
+
+        case 'c':
+            if(last == NULL || numa_parse_cpus(optarg, &last->cpus) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            last->cpus_set = 1;
+            shard_option(c, optarg);
+            break;
+
+        case 'r':
+            if(last == NULL || parse_realtime(optarg, last) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_option(c, optarg);
+            break;
+
+        case 'n':
+            if(last == NULL || (last->nice = strtol(optarg, &end, 10)) < -20 || last->nice > 19 || *end != '\0') {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            last->nice_set = 1;
+            shard_option(c, optarg);
+            break;
+
+        case 'N':
+            /* only an input knows the NIC it receives from */
+            if(last == NULL || numa_parse_node(optarg, &last->numa) < 0 ||
+               (last->numa == NUMA_NIC && last_frames == NULL)) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            last->numa_set = 1;
+            shard_option(c, optarg);
+            break;
+
+        case 't':
+            if(last_frames == NULL || (last_frames->transform = transform_parse(optarg)) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_option(c, optarg);
+            break;
+
+        case 'm':
+            if(last_frames == NULL || (last_frames->metadata = metadata_parse(optarg)) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_option(c, optarg);
+            break;
+
+        case 'M':
+            if(last_frames == NULL || motion_parse(optarg, &last_frames->motion) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            motion = 1;
+            break;
+
+        case 'R':
+            if(last_frames == NULL || (last_frames->replay = strtol(optarg, &end, 10)) <= 0 || *end != '\0') {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            motion = 1;
+            break;
+
+        case 'P':
+            if(last_frames == NULL || (last_frames->priority = strtol(optarg, &end, 10), end == optarg) || *end != '\0') {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_option(c, optarg);
             break;
 
         case 'v':
@@ -242,6 +1209,60 @@ int main(int argc, char *argv[])
             daemon = 1;
             break;
 
+        case 'f':
+            /* read before the other options */
+            break;
+
+        case 's':
+            shards = 1;
+            break;
+
+        case 'D':
+            runtime_plugins = 1;
+            shard_global(c, NULL);
+            break;
+
+        case 'l':
+            if(log_parse_format(optarg, &format) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_global(c, optarg);
+            break;
+
+        case 'B':
+            if(memory_parse_budget(optarg, &budget) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_global(c, optarg);
+            break;
+
+        case 'L':
+            if(memory_parse_lock(optarg, &lock, &huge) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_global(c, optarg);
+            break;
+
+        case 'T':
+            if(flight_parse(optarg, &trace, &trace_sec) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            shard_global(c, optarg);
+            break;
+
+        case 'G':
+            if(governor_parse(optarg, &max_temperature, &max_load) < 0) {
+                help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            governor = 1;
+            shard_global(c, optarg);
+            break;
+
         case 'h': /* fall through */
         default:
             help(argv[0]);
@@ -259,13 +1280,33 @@ int main(int argc, char *argv[])
         daemon_mode();
     }
 
+    /* from now on the messages are written by a thread of their own */
+    log_start(format);
+
+    /* the plugins run in the shards, this process only watches them */
+    if(shards) {
+        /* the state would stay in the process of the input */
+        if(motion) {
+            LOG("--motion and --replay do not work with --shards\n");
+            log_stop();
+            exit(EXIT_FAILURE);
+        }
+        if(global.outcnt == 0)
+            shard_plugin('o', output[0]);
+        /* the shards record their frames, a trace is asked of them */
+        signal(SIGUSR1, SIG_IGN);
+        n = supervise(argv[0]);
+        log_stop();
+        return n;
+    }
+
     /* ignore SIGPIPE (send by OS if transmitting to closed TCP sockets) */
     signal(SIGPIPE, SIG_IGN);
 
     /* register signal handler for <CTRL>+C in order to clean up */
     if(signal(SIGINT, signal_handler) == SIG_ERR) {
         LOG("could not register signal handler\n");
-        closelog();
+        log_stop();
         exit(EXIT_FAILURE);
     }
 
@@ -279,143 +1320,121 @@ int main(int argc, char *argv[])
     LOG("MJPG Streamer Version.: %s\n", SOURCE_VERSION);
 #endif
 
+    /* the frame events are always recorded, SIGUSR1 writes them out */
+    if(flight_start(trace, trace_sec) < 0)
+        LOG("could not set up writing traces on SIGUSR1\n");
+
+    /* caches and buffers of the plugins are evicted from once it is exceeded */
+    if(budget > 0 && memory_start(budget) == 0)
+        LOG("memory budget.........: %lld MB\n", budget / (1024 * 1024));
+
+    /* before the plugins, whatever they map is locked as they touch it */
+    if(lock > 0 && memory_lock_all(lock, huge) == 0)
+        LOG("locked memory.........: up to %lld MB%s\n", lock / (1024 * 1024), huge ? ", hugetlb pages" : "");
+
     /* check if at least one output plugin was selected */
     if(global.outcnt == 0) {
         /* no? Then use the default plugin instead */
         global.outcnt = 1;
     }
 
-    /* open input plugin */
-    for(i = 0; i < global.incnt; i++) {
-        /* this mutex and the conditional variable are used to synchronize access to the global picture buffer */
-        if(pthread_mutex_init(&global.in[i].db, NULL) != 0) {
-            LOG("could not initialize mutex variable\n");
-            closelog();
-            exit(EXIT_FAILURE);
-        }
-        if(pthread_cond_init(&global.in[i].db_update, NULL) != 0) {
-            LOG("could not initialize condition variable\n");
-            closelog();
-            exit(EXIT_FAILURE);
-        }
+    global.in = plugin_table(INPUT_TABLE_SIZE, sizeof(*global.in));
+    global.out = plugin_table(OUTPUT_TABLE_SIZE, sizeof(*global.out));
+    input_sched = plugin_table(INPUT_TABLE_SIZE, sizeof(plugin_sched));
 
-        tmp = (size_t)(strchr(input[i], ' ') - input[i]);
-        global.in[i].stop      = 0;
-        global.in[i].context   = NULL;
-        global.in[i].buf       = NULL;
-        global.in[i].size      = 0;
-        global.in[i].plugin = (tmp > 0) ? strndup(input[i], tmp) : strdup(input[i]);
-        global.in[i].handle = dlopen(global.in[i].plugin, RTLD_LAZY);
-        if(!global.in[i].handle) {
-            LOG("ERROR: could not find input plugin\n");
-            LOG("       Perhaps you want to adjust the search path with:\n");
-            LOG("       # export LD_LIBRARY_PATH=/path/to/plugin/folder\n");
-            LOG("       dlopen: %s\n", dlerror());
-            closelog();
+    /* open the input plugins, they are numbered in the order they were given */
+    for(k = 0; k < inputs; k++) {
+        i = global.incnt++;
+        if(init_input(&global.in[i]) < 0 || open_input(&global.in[i], input[k]) < 0) {
+            log_stop();
             exit(EXIT_FAILURE);
         }
-        global.in[i].init = dlsym(global.in[i].handle, "input_init");
-        if(global.in[i].init == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.in[i].stop = dlsym(global.in[i].handle, "input_stop");
-        if(global.in[i].stop == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.in[i].run = dlsym(global.in[i].handle, "input_run");
-        if(global.in[i].run == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        /* try to find optional command */
-        global.in[i].cmd = dlsym(global.in[i].handle, "input_cmd");
-
-        global.in[i].param.parameters = strchr(input[i], ' ');
-
-        for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
-            global.in[i].param.argv[j] = NULL;
-        }
-
-        split_parameters(global.in[i].param.parameters, &global.in[i].param.argc, global.in[i].param.argv);
-        global.in[i].param.global = &global;
         global.in[i].param.id = i;
-
-        if(global.in[i].init(&global.in[i].param, i)) {
-            LOG("input_init() return value signals to exit\n");
-            closelog();
-            exit(0);
-        }
+        input_sched[i] = sched[k];
+        if(sched[k].numa_set)
+            global.in[i].numa_node = sched[k].numa;
+        global.in[i].transform = frames[k].transform;
+        global.in[i].metadata = frames[k].metadata;
+        global.in[i].motion_config = frames[k].motion;
+        global.in[i].replay_sec = frames[k].replay;
+        global.in[i].priority = frames[k].priority;
+        if(frames[k].transform != TRANSFORM_NONE)
+            LOG("frames of input %d are turned: %s\n", i, transform_name(frames[k].transform));
     }
 
-    /* open output plugin */
-    for(i = 0; i < global.outcnt; i++) {
-        tmp = (size_t)(strchr(output[i], ' ') - output[i]);
-        global.out[i].plugin = (tmp > 0) ? strndup(output[i], tmp) : strdup(output[i]);
-        global.out[i].handle = dlopen(global.out[i].plugin, RTLD_LAZY);
-        if(!global.out[i].handle) {
-            LOG("ERROR: could not find output plugin %s\n", global.out[i].plugin);
-            LOG("       Perhaps you want to adjust the search path with:\n");
-            LOG("       # export LD_LIBRARY_PATH=/path/to/plugin/folder\n");
-            LOG("       dlopen: %s\n", dlerror());
-            closelog();
-            exit(EXIT_FAILURE);
-        }
-        global.out[i].init = dlsym(global.out[i].handle, "output_init");
-        if(global.out[i].init == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.out[i].stop = dlsym(global.out[i].handle, "output_stop");
-        if(global.out[i].stop == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.out[i].run = dlsym(global.out[i].handle, "output_run");
-        if(global.out[i].run == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
+    /*
+     * initialize and start them in parallel. The inputs a plugin adds for
+     * more cameras get the numbers after those, in the order the plugins
+     * add them, and run once all plugins are initialized.
+     */
+    if((starters = calloc(inputs, sizeof(pthread_t))) == NULL) {
+        LOG("not enough memory\n");
+        log_stop();
+        exit(EXIT_FAILURE);
+    }
+    for(k = 0; k < inputs; k++) {
+        if(pthread_create(&starters[k], NULL, start_input, &global.in[k]) != 0) {
+            starters[k] = 0;
+            start_input(&global.in[k]);
         }
+    }
+    for(k = 0; k < inputs; k++) {
+        if(starters[k] != 0)
+            pthread_join(starters[k], NULL);
+    }
+    free(starters);
 
-        /* try to find optional command */
-        global.out[i].cmd = dlsym(global.out[i].handle, "output_cmd");
-
-        global.out[i].param.parameters = strchr(output[i], ' ');
-
-        for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
-            global.out[i].param.argv[j] = NULL;
+    for(i = inputs; i < global.incnt; i++) {
+        syslog(LOG_INFO, "starting input plugin %s", global.in[i].plugin);
+        if(call_scheduled(&input_sched[i], run_input_plugin, &global.in[i])) {
+            LOG("can not run input plugin %d: %s\n", i, global.in[i].plugin);
+            log_stop();
+            return 1;
         }
-        split_parameters(global.out[i].param.parameters, &global.out[i].param.argc, global.out[i].param.argv);
+    }
 
-        global.out[i].param.global = &global;
-        global.out[i].param.id = i;
-        if(global.out[i].init(&global.out[i].param, i)) {
-            LOG("output_init() return value signals to exit\n");
-            closelog();
+    /* the outputs find the motion and the replay of the inputs from the start */
+    for(i = 0; i < global.incnt; i++) {
+        if(motion_start(&global.in[i]) < 0 || replay_start(&global.in[i]) < 0) {
+            log_stop();
             exit(EXIT_FAILURE);
         }
     }
 
-    /* start to read the input, push pictures into global buffer */
-    DBG("starting %d input plugin\n", global.incnt);
-    for(i = 0; i < global.incnt; i++) {
-        syslog(LOG_INFO, "starting input plugin %s", global.in[i].plugin);
-        if(global.in[i].run(i)) {
-            LOG("can not run input plugin %d: %s\n", i, global.in[i].plugin);
-            closelog();
-            return 1;
+    /* the inputs run, their encoders are watched from now on */
+    if(governor) {
+        if(governor_start(&global, max_temperature, max_load) < 0) {
+            LOG("could not start the governor\n");
+        } else if(max_temperature > 0) {
+            LOG("governor..............: %.0f C, %.0f%% load\n", max_temperature, max_load);
+        } else {
+            LOG("governor..............: %.0f%% load\n", max_load);
         }
     }
 
+    /* open output plugin, each one starts as soon as it is initialized */
     DBG("starting %d output plugin(s)\n", global.outcnt);
     for(i = 0; i < global.outcnt; i++) {
+        if(open_output(&global.out[i], output[i]) < 0) {
+            log_stop();
+            exit(EXIT_FAILURE);
+        }
+        global.out[i].param.id = i;
+        if(call_scheduled(&output_sched[i], init_output_plugin, &global.out[i])) {
+            LOG("output_init() return value signals to exit\n");
+            log_stop();
+            exit(EXIT_FAILURE);
+        }
+
         syslog(LOG_INFO, "starting output plugin: %s (ID: %02d)", global.out[i].plugin, global.out[i].param.id);
-        global.out[i].run(global.out[i].param.id);
+        call_scheduled(&output_sched[i], run_output_plugin, &global.out[i]);
     }
 
-    /* wait for signals */
-    pause();
+    /* the supervisor of --shards waits for this before it starts the outputs */
+    shard_ready(global.incnt);
+
+    /* add and remove plugins on request until a signal ends the program */
+    serve_requests();
 
     return 0;
 }
@@ -24,11 +24,20 @@
 #define MJPG_STREAMER_H
 #define SOURCE_VERSION "2.0"
 
-/* FIXME take a look to the output_http clients thread marked with fixme if you want to set more then 10 plugins */
-#define MAX_INPUT_PLUGINS 10
-#define MAX_OUTPUT_PLUGINS 10
 #define MAX_PLUGIN_ARGUMENTS 32
 
+/* inputs and outputs start on their own cache lines, their locks and
+ * counters are busy and must not share a line with the neighbours */
+#define CACHE_LINE_SIZE 64
+
+/*
+ * address space for this many inputs and outputs is reserved, the tables do
+ * not move when plugins are added while the program runs. Only the entries
+ * in use are ever touched.
+ */
+#define INPUT_TABLE_SIZE 4096
+#define OUTPUT_TABLE_SIZE 64
+
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
 #include <pthread.h>
@@ -39,7 +48,12 @@
 #define DBG(...)
 #endif
 
-#define LOG(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
+#include "log.h"
+#define LOG(...) { static log_site _site = LOG_SITE; log_print(&_site, LOG_INFO, "", __VA_ARGS__); }
+#include "memory.h"
+#include "flight.h"
+#include "governor.h"
+#include "numa.h"
 
 #include "plugins/input.h"
 #include "plugins/output.h"
@@ -54,6 +68,14 @@ typedef enum {
     Dest_Program = 2,
 } command_dest;
 
+/* commands which can be send to the program itself, Dest_Program */
+enum _program_cmd {
+    PROGRAM_CMD_ADD_INPUT =     1, // value_str: the plugin and its parameters
+    PROGRAM_CMD_ADD_OUTPUT =    2,
+    PROGRAM_CMD_REMOVE_INPUT =  3, // the plugin number of the one to remove
+    PROGRAM_CMD_REMOVE_OUTPUT = 4,
+};
+
 /* commands which can be send to the input plugin */
 //typedef enum _cmd_group cmd_group;
 enum _cmd_group {
@@ -62,8 +84,12 @@ enum _cmd_group {
     IN_CMD_RESOLUTION =     2,
     IN_CMD_JPEG_QUALITY =   3,
     IN_CMD_PWC =            4,
+    IN_CMD_V4L2_BATCH =     5, // value_string holds "id=value" pairs joined by '&', value is unused
 };
 
+/* most controls a IN_CMD_V4L2_BATCH command may carry */
+#define IN_CMD_BATCH_MAX 32
+
 typedef struct _control control;
 struct _control {
     struct v4l2_queryctrl ctrl;
@@ -80,16 +106,36 @@ struct _control {
 struct _globals {
     int stop;
 
-    /* input plugin */
-    input in[MAX_INPUT_PLUGINS];
+    /*
+     * input plugins, incnt of them. The table does not move, plugins may
+     * keep pointers to their inputs. All inputs given at start are set up
+     * before the first output is initialized, more may follow at runtime.
+     * The number of a removed plugin is not used again, its handle is NULL.
+     */
+    input *in;
     int incnt;
 
-    /* output plugin */
-    output out[MAX_OUTPUT_PLUGINS];
+    /* output plugins, outcnt of them, the same applies */
+    output *out;
     int outcnt;
 
     /* pointer to control functions */
     //int (*control)(int command, char *details);
 };
 
+/*
+ * add a plugin while the program runs, from "input_uvc.so -d /dev/video1"
+ * like the -i and -o options take it, or stop and remove one. The main
+ * thread carries the change out, these must not be called from init().
+ */
+int plugin_add(command_dest dest, const char *spec);
+int plugin_remove(command_dest dest, int id);
+
+/*
+ * init() of the plugins parse their options one after the other, a plugin
+ * calls this once it is done with getopt() and its static options so its
+ * slow rest, like opening a device, runs alongside the other ones
+ */
+void plugin_options_parsed(void);
+
 #endif
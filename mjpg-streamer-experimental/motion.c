@@ -0,0 +1,538 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * motion detection on the frames of an input (--motion)
+ *
+ * A thread per input takes the newest frame and reads only what it needs of
+ * the entropy coded data: the DC coefficient of each luma block, the mean
+ * brightness of its 8x8 pixels. The AC coefficients are walked over without
+ * dequantizing them, there is no IDCT, no colour conversion and no picture
+ * in memory, so a frame costs a fraction of a decode at 1/8 scale.
+ *
+ * Each block keeps a background level, a running average which follows
+ * slow changes like the daylight. A block differing from it by more than
+ * MOTION_LEVEL changed. The picture is divided into zones, there is motion
+ * while the changed blocks of a zone reach the threshold. When most of the
+ * picture changes at once, like when the light is switched on, the
+ * background starts over instead.
+ *
+ * output_http serves the state as motion.json, output_file records events
+ * on it with --motion-trigger. A frame the walker can not read, progressive
+ * or arithmetic coded, is left out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+#include "huffman.h"
+
+/* a block changed when its mean luma differs from the background by more */
+#define MOTION_LEVEL 12
+
+/* the background moves by 1 / 2^MOTION_LEARN of the difference each frame */
+#define MOTION_LEARN 5
+
+/* the background has this many fraction bits */
+#define MOTION_FRACTION 4
+
+/* percent of the picture above which a change is taken for the light */
+#define MOTION_GLOBAL 75
+
+#define HUFF_EXTEND(x, s) ((x) < (1 << ((s) - 1)) ? (x) + (((-1) << (s)) + 1) : (x))
+
+/* the layout of the first scan, a baseline or extended huffman coded one */
+typedef struct {
+    int width, height;
+    int components;                         // in the scan
+    int blocksH[4], blocksV[4];             // of each component in an MCU
+    int mcux, mcuy;                         // MCUs per row and column
+    int restart_interval;                   // MCUs, 0 without restart markers
+    int quant;                              // of the DC of the luma
+    int columns, rows;                      // luma blocks of the scan, padding included
+    int visibleH, visibleV;                 // of them inside the picture
+    const huffman_table *dc[4], *ac[4];
+    const unsigned char *data;              // entropy coded data
+    const unsigned char *end;
+} motion_scan;
+
+typedef struct _motion_detector motion_detector;
+struct _motion_detector {
+    input *in;
+    motion_config config;
+    pthread_t thread;
+    volatile int stop;
+
+    /* the state outputs read */
+    pthread_mutex_t mutex;
+    motion_state state;
+
+    /* the model, only the thread touches it */
+    huffman_table tables[8];                // DC and AC of the four table slots
+    short *level;                          // mean luma of the blocks of the frame
+    int *background;                        // with MOTION_FRACTION fraction bits
+    int columns, rows;                      // blocks of level and background
+    int learned;                            // frames in the background
+    int unreadable;                         // frames which could not be read
+};
+
+/******************************************************************************
+Description.: parse the argument of --motion, a threshold in percent and
+              optionally the zones, like 5 or 5,4x3
+Input Value.: * arg...: the argument
+              * config: gets the settings
+Return Value: 0 if ok, -1 if the argument is invalid
+******************************************************************************/
+int motion_parse(const char *arg, motion_config *config)
+{
+    char *end;
+
+    config->threshold = strtod(arg, &end);
+    config->columns = 3;
+    config->rows = 3;
+    if(end == arg || config->threshold <= 0 || config->threshold > 100)
+        return -1;
+
+    if(*end == ',') {
+        config->columns = strtol(end + 1, &end, 10);
+        if(*end != 'x')
+            return -1;
+        config->rows = strtol(end + 1, &end, 10);
+    }
+    if(*end != '\0' || config->columns < 1 || config->rows < 1 ||
+       config->columns * config->rows > MOTION_ZONES)
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: decode the DC coefficient of a block and step over its AC
+              coefficients
+Input Value.: * reader.: the bit reader
+              * dc, ac.: huffman tables of the component
+              * lastDC.: DC predictor of the component, gets the coefficient
+Return Value: 0 if ok, -1 on broken data
+******************************************************************************/
+static inline int decode_dc(bit_reader *reader, const huffman_table *dc, const huffman_table *ac, int *lastDC)
+{
+    int k, size, symbol, value;
+
+    /* a code and its value take at most 32 bits */
+    if(reader->count < 32)
+        huffman_fill(reader);
+    if((size = huffman_decode(reader, dc)) < 0 || size > 16)
+        return -1;
+    if(size > 0) {
+        value = huffman_get_bits(reader, size);
+        *lastDC += HUFF_EXTEND(value, size);
+    }
+
+    for(k = 1; k < 64; k++) {
+        if(reader->count < 32)
+            huffman_fill(reader);
+        if((symbol = huffman_decode(reader, ac)) < 0)
+            return -1;
+
+        size = symbol & 0x0f;
+        if(size == 0) {
+            if(symbol != 0xf0)
+                break;              /* end of block */
+            k += 15;
+            continue;
+        }
+        k += symbol >> 4;
+        if(k > 63)
+            return -1;
+        reader->bits <<= size;
+        reader->count -= size;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: read the tables and the frame header up to the entropy coded
+              data of the first scan, which has to hold the luma
+Input Value.: * d........: the detector, its tables are updated
+              * data, len: the JPEG
+              * scan.....: gets the layout of the scan
+Return Value: 0 if ok, -1 if the JPEG is broken or not supported
+******************************************************************************/
+static int parse_scan(motion_detector *d, const unsigned char *data, int len, motion_scan *scan)
+{
+    const unsigned char *p = data, *end = data + len, *segment = NULL;
+    int length = 0, i, n, tab, precision, components = 0;
+    int quant_dc[4] = { 0, 0, 0, 0 }, id[4], sampling_h[4], sampling_v[4], quant[4];
+    int max_h = 1, max_v = 1, c;
+    unsigned char marker;
+
+    memset(scan, 0, sizeof(*scan));
+
+    if(len < 4 || p[0] != 0xff || p[1] != 0xd8)
+        return -1;
+    p += 2;
+
+    /* walk the segments up to the scan */
+    while(1) {
+        while(p < end && *p != 0xff)
+            p++;
+        while(p < end && *p == 0xff)
+            p++;
+        if(p + 2 >= end)
+            return -1;
+        marker = *p++;
+        if(marker == 0xd8 || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+            continue;
+        if(marker == 0xd9)
+            return -1;
+
+        length = (p[0] << 8) | p[1];
+        if(length < 2 || p + length > end)
+            return -1;
+        segment = p + 2;
+        length -= 2;
+        p += length + 2;
+
+        if(marker == 0xdb) {
+            /* only the DC of each table is needed */
+            for(i = 0; i < length; i += 1 + 64 * (precision + 1)) {
+                precision = segment[i] >> 4;
+                if(precision > 1 || i + 1 + 64 * (precision + 1) > length)
+                    return -1;
+                quant_dc[segment[i] & 0x03] = precision ? (segment[i + 1] << 8) | segment[i + 2] : segment[i + 1];
+            }
+        } else if(marker == 0xc4) {
+            for(i = 0; i < length; i += n + 1) {
+                tab = ((segment[i] & 0x03) << 1) | ((segment[i] >> 4) & 1);
+                if((n = huffman_build_table(&d->tables[tab], segment + i + 1, length - i - 1)) < 0)
+                    return -1;
+            }
+        } else if(marker == 0xdd) {
+            if(length < 2)
+                return -1;
+            scan->restart_interval = (segment[0] << 8) | segment[1];
+        } else if(marker == 0xc0 || marker == 0xc1) {
+            if(length < 6)
+                return -1;
+            scan->height = (segment[1] << 8) | segment[2];
+            scan->width = (segment[3] << 8) | segment[4];
+            components = segment[5];
+            if(components < 1 || components > 4 || length < 6 + 3 * components)
+                return -1;
+            for(i = 0; i < components; i++) {
+                id[i] = segment[6 + 3 * i];
+                sampling_h[i] = segment[7 + 3 * i] >> 4;
+                sampling_v[i] = segment[7 + 3 * i] & 0x0f;
+                quant[i] = segment[8 + 3 * i] & 0x03;
+                if(sampling_h[i] < 1 || sampling_h[i] > 4 || sampling_v[i] < 1 || sampling_v[i] > 4)
+                    return -1;
+                max_h = MAX(max_h, sampling_h[i]);
+                max_v = MAX(max_v, sampling_v[i]);
+            }
+        } else if(marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            return -1;              /* progressive, lossless or arithmetic coding */
+        } else if(marker == 0xda) {
+            break;
+        }
+    }
+
+    if(components == 0 || scan->width <= 0 || scan->height <= 0 || length < 1 + 2 * segment[0])
+        return -1;
+
+    /* the scan has all components interleaved, or it is the scan of the luma alone */
+    scan->components = segment[0];
+    if(scan->components != components && scan->components != 1)
+        return -1;
+    for(i = 0; i < scan->components; i++) {
+        for(c = 0; c < components && id[c] != segment[1 + 2 * i]; c++);
+        if(c == components || (i == 0 && c != 0))
+            return -1;
+        scan->dc[i] = &d->tables[(segment[2 + 2 * i] >> 4 & 0x03) << 1];
+        scan->ac[i] = &d->tables[((segment[2 + 2 * i] & 0x03) << 1) | 1];
+        if(scan->dc[i]->length == 0 || scan->ac[i]->length == 0)
+            return -1;
+        scan->blocksH[i] = (scan->components == 1) ? 1 : sampling_h[c];
+        scan->blocksV[i] = (scan->components == 1) ? 1 : sampling_v[c];
+    }
+    if((scan->quant = quant_dc[quant[0]]) == 0)
+        return -1;
+
+    /* the luma blocks inside the picture */
+    scan->visibleH = ((scan->width * sampling_h[0] + max_h - 1) / max_h + 7) / 8;
+    scan->visibleV = ((scan->height * sampling_v[0] + max_v - 1) / max_v + 7) / 8;
+    if(scan->components == 1) {
+        scan->mcux = scan->columns = scan->visibleH;
+        scan->mcuy = scan->rows = scan->visibleV;
+    } else {
+        scan->mcux = (scan->width + 8 * max_h - 1) / (8 * max_h);
+        scan->mcuy = (scan->height + 8 * max_v - 1) / (8 * max_v);
+        scan->columns = scan->mcux * sampling_h[0];
+        scan->rows = scan->mcuy * sampling_v[0];
+    }
+
+    scan->data = p;
+    scan->end = end;
+    return 0;
+}
+
+/******************************************************************************
+Description.: read the mean luma of the blocks of a frame into d->level
+Input Value.: * d....: the detector
+              * frame: the frame
+              * scan.: gets the layout of its scan
+Return Value: 0 if ok, -1 if the frame could not be read
+******************************************************************************/
+static int read_levels(motion_detector *d, input_frame *frame, motion_scan *scan)
+{
+    int lastDC[4] = { 0, 0, 0, 0 }, mcu, i, bx, by, x, y;
+    bit_reader reader;
+    short *level;
+    int *background;
+
+    if(parse_scan(d, frame->buf, frame->size, scan) < 0)
+        return -1;
+
+    /* a picture of another size starts the background over */
+    if(scan->columns != d->columns || scan->rows != d->rows) {
+        if((level = realloc(d->level, scan->columns * scan->rows * sizeof(short))) != NULL)
+            d->level = level;
+        if((background = realloc(d->background, scan->columns * scan->rows * sizeof(int))) != NULL)
+            d->background = background;
+        if(level == NULL || background == NULL) {
+            d->columns = d->rows = 0;
+            return -1;
+        }
+        d->columns = scan->columns;
+        d->rows = scan->rows;
+        d->learned = 0;
+    }
+
+    reader.data = scan->data;
+    reader.end = scan->end;
+    reader.bits = 0;
+    reader.count = 0;
+    for(mcu = 0; mcu < scan->mcux * scan->mcuy; mcu++) {
+        if(scan->restart_interval > 0 && mcu > 0 && mcu % scan->restart_interval == 0) {
+            if(huffman_restart(&reader, scan->end) < 0)
+                return -1;
+            memset(lastDC, 0, sizeof(lastDC));
+        }
+
+        x = mcu % scan->mcux * scan->blocksH[0];
+        y = mcu / scan->mcux * scan->blocksV[0];
+        for(by = 0; by < scan->blocksV[0]; by++) {
+            for(bx = 0; bx < scan->blocksH[0]; bx++) {
+                if(decode_dc(&reader, scan->dc[0], scan->ac[0], &lastDC[0]) < 0)
+                    return -1;
+                /* the DC is eight times the mean of the block, less 128 */
+                d->level[(y + by) * scan->columns + x + bx] = lastDC[0] * scan->quant / 8;
+            }
+        }
+
+        for(i = 1; i < scan->components; i++) {
+            for(by = 0; by < scan->blocksH[i] * scan->blocksV[i]; by++) {
+                if(decode_dc(&reader, scan->dc[i], scan->ac[i], &lastDC[i]) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: compare the blocks of a frame to the background, move the
+              background towards them and publish the state
+Input Value.: * d....: the detector
+              * frame: the frame
+              * scan.: layout of its scan, d->level holds its blocks
+Return Value: -
+******************************************************************************/
+static void update_model(motion_detector *d, input_frame *frame, const motion_scan *scan)
+{
+    int blocks[MOTION_ZONES], changed[MOTION_ZONES];
+    int columns = d->config.columns, rows = d->config.rows;
+    int x, y, i, z, diff, total = 0, moved = 0, active = 0;
+    double zone[MOTION_ZONES];
+
+    memset(blocks, 0, sizeof(blocks));
+    memset(changed, 0, sizeof(changed));
+
+    for(y = 0; y < scan->visibleV; y++) {
+        for(x = 0; x < scan->visibleH; x++) {
+            i = y * scan->columns + x;
+            z = y * rows / scan->visibleV * columns + x * columns / scan->visibleH;
+            diff = d->level[i] * (1 << MOTION_FRACTION) - d->background[i];
+            if(d->learned == 0)
+                diff = 0, d->background[i] = d->level[i] * (1 << MOTION_FRACTION);
+
+            blocks[z]++;
+            if(ABS(diff) > MOTION_LEVEL << MOTION_FRACTION) {
+                changed[z]++;
+                moved++;
+            }
+            total++;
+            d->background[i] += diff / (1 << MOTION_LEARN);
+        }
+    }
+
+    /* the light changed, not the scene */
+    if(moved * 100 >= MOTION_GLOBAL * total) {
+        DBG("input %d: most of the picture changed, the background starts over\n", d->in->param.id);
+        for(y = 0; y < scan->visibleV; y++) {
+            for(x = 0; x < scan->visibleH; x++) {
+                i = y * scan->columns + x;
+                d->background[i] = d->level[i] * (1 << MOTION_FRACTION);
+            }
+        }
+        memset(changed, 0, sizeof(changed));
+        moved = 0;
+    }
+    d->learned++;
+
+    for(z = 0; z < columns * rows; z++) {
+        zone[z] = blocks[z] > 0 ? changed[z] * 100.0 / blocks[z] : 0.0;
+        if(zone[z] >= d->config.threshold)
+            active = 1;
+    }
+
+    pthread_mutex_lock(&d->mutex);
+    if(active && !d->state.active)
+        d->state.events++;
+    d->state.seq = frame->seq;
+    d->state.timestamp = frame->timestamp;
+    d->state.active = active;
+    d->state.score = total > 0 ? moved * 100.0 / total : 0.0;
+    memcpy(d->state.zone, zone, columns * rows * sizeof(double));
+    pthread_mutex_unlock(&d->mutex);
+}
+
+/******************************************************************************
+Description.: the thread of a detector, it takes the newest frame of its input
+              each time it is done with the last one
+Input Value.: the detector
+Return Value: NULL
+******************************************************************************/
+static void *motion_thread(void *arg)
+{
+    motion_detector *d = arg;
+    frame_subscription sub;
+    input_frame *frame;
+    motion_scan scan;
+
+    frame_subscribe(&sub, d->in, FRAME_LATEST, NULL);
+    while(!d->stop) {
+        if((frame = frame_next(&sub, 500)) == NULL)
+            continue;
+
+        if(read_levels(d, frame, &scan) == 0) {
+            update_model(d, frame, &scan);
+        } else if(d->unreadable++ == 0) {
+            LOG("input %d: motion detection needs baseline JPEG frames, frame %llu is left out\n",
+                d->in->param.id, frame->seq);
+        }
+        frame_unref(frame);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: start the motion detection of an input, if --motion was given
+              for it
+Input Value.: the input, its frames are published already or soon
+Return Value: 0 if ok or not wanted, -1 on errors
+******************************************************************************/
+int motion_start(input *in)
+{
+    motion_detector *d;
+    int rc;
+
+    if(in->motion_config.threshold <= 0 || in->motion != NULL)
+        return 0;
+
+    if((d = calloc(1, sizeof(motion_detector))) == NULL) {
+        LOG("not enough memory\n");
+        return -1;
+    }
+    d->in = in;
+    d->config = in->motion_config;
+    d->state.columns = d->config.columns;
+    d->state.rows = d->config.rows;
+    pthread_mutex_init(&d->mutex, NULL);
+
+    if((rc = pthread_create(&d->thread, NULL, motion_thread, d)) != 0) {
+        LOG("could not start the motion detection of input %d: %s\n", in->param.id, strerror(rc));
+        pthread_mutex_destroy(&d->mutex);
+        free(d);
+        return -1;
+    }
+    in->motion = d;
+
+    LOG("motion of input %d: %g %% of a zone, %dx%d zones\n", in->param.id,
+        d->config.threshold, d->config.columns, d->config.rows);
+    return 0;
+}
+
+/******************************************************************************
+Description.: stop the motion detection of an input, its last state stays
+              readable
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+void motion_stop(input *in)
+{
+    motion_detector *d = in->motion;
+
+    if(d == NULL || d->stop)
+        return;
+
+    d->stop = 1;
+    pthread_join(d->thread, NULL);
+}
+
+/******************************************************************************
+Description.: read the motion state of an input
+Input Value.: * in...: the input
+              * state: gets the state
+Return Value: 0 if ok, -1 if the input has no motion detection
+******************************************************************************/
+int motion_get(input *in, motion_state *state)
+{
+    motion_detector *d = in->motion;
+
+    if(d == NULL)
+        return -1;
+
+    pthread_mutex_lock(&d->mutex);
+    *state = d->state;
+    pthread_mutex_unlock(&d->mutex);
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * NUMA placement of frames and threads
+ *
+ * The cores of each node are read once from /sys/devices/system/node. A
+ * thread is bound to a node by its affinity, narrowed down to the cores of
+ * the node it may already use, and by a memory policy which prefers the
+ * node, so the pages it touches first come from there. Blocks allocated
+ * for a node by another thread are given the policy with mbind().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "mjpg_streamer.h"
+
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static int node_count = 1;
+static signed char cpu_node[CPU_SETSIZE];   // -1 for cores of no node
+static cpu_set_t node_cpus[NUMA_MAX_NODES];
+
+/******************************************************************************
+Description.: parse a list of cores like 0-2,5
+Input Value.: * list: the list
+              * cpus: gets the cores
+Return Value: 0 if ok, -1 if the list is malformed
+******************************************************************************/
+int numa_parse_cpus(const char *list, cpu_set_t *cpus)
+{
+    char *end;
+    long first, last;
+
+    CPU_ZERO(cpus);
+    while(1) {
+        first = last = strtol(list, &end, 10);
+        if(end == list || first < 0)
+            return -1;
+        if(*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if(end == list || last < first)
+                return -1;
+        }
+        if(last >= CPU_SETSIZE)
+            return -1;
+        for(; first <= last; first++)
+            CPU_SET(first, cpus);
+
+        if(*end != ',')
+            return (*end == '\0') ? 0 : -1;
+        list = end + 1;
+    }
+}
+
+/******************************************************************************
+Description.: read the cores of the nodes
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void numa_read(void)
+{
+    char path[64], line[1024];
+    FILE *f;
+    int node, cpu;
+
+    memset(cpu_node, -1, sizeof(cpu_node));
+    for(node = 0; node < NUMA_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if((f = fopen(path, "r")) == NULL)
+            break;
+        if(fgets(line, sizeof(line), f) == NULL)
+            line[0] = '\0';
+        fclose(f);
+
+        line[strcspn(line, "\n")] = '\0';
+        if(numa_parse_cpus(line, &node_cpus[node]) < 0)
+            CPU_ZERO(&node_cpus[node]);
+        for(cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, &node_cpus[node]))
+                cpu_node[cpu] = node;
+        }
+    }
+
+    node_count = (node > 0) ? node : 1;
+}
+
+/******************************************************************************
+Description.: number of NUMA nodes
+Input Value.: -
+Return Value: the nodes, 1 on systems which are not NUMA
+******************************************************************************/
+int numa_node_count(void)
+{
+    pthread_once(&numa_once, numa_read);
+    return node_count;
+}
+
+/******************************************************************************
+Description.: the node of a core
+Input Value.: the core
+Return Value: its node, -1 if it is not known
+******************************************************************************/
+int numa_node_of_cpu(int cpu)
+{
+    pthread_once(&numa_once, numa_read);
+    return (cpu >= 0 && cpu < CPU_SETSIZE) ? cpu_node[cpu] : -1;
+}
+
+/******************************************************************************
+Description.: the node of the core the calling thread runs on
+Input Value.: -
+Return Value: the node, -1 if it is not known
+******************************************************************************/
+int numa_current_node(void)
+{
+    return numa_node_of_cpu(sched_getcpu());
+}
+
+/******************************************************************************
+Description.: the node of the cores which receive the packets of a socket,
+              which is the node of the NIC unless its interrupts were moved
+Input Value.: a connected socket which received data
+Return Value: the node, -1 if it is not known
+******************************************************************************/
+int numa_socket_node(int fd)
+{
+    #ifdef SO_INCOMING_CPU
+    socklen_t length;
+    int cpu = -1;
+
+    length = sizeof(cpu);
+    if(getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &length) == 0 && cpu >= 0)
+        return numa_node_of_cpu(cpu);
+    #endif
+    return -1;
+}
+
+/******************************************************************************
+Description.: run the calling thread on a node and prefer its memory, the
+              threads it starts take both
+Input Value.: the node
+Return Value: 0 if ok, -1 if it is no node or the thread may not use any
+              core of it
+******************************************************************************/
+int numa_bind(int node)
+{
+    unsigned long mask;
+    cpu_set_t cpus, allowed;
+
+    if(node < 0 || node >= numa_node_count())
+        return -1;
+
+    /* --cpus of the plugin still applies */
+    if(pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) != 0)
+        return -1;
+    CPU_AND(&cpus, &allowed, &node_cpus[node]);
+    if(CPU_COUNT(&cpus) == 0)
+        return -1;
+    if(node_count > 1 && pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        return -1;
+
+    mask = 1UL << node;
+    if(node_count > 1 && syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) < 0)
+        DBG("could not prefer the memory of node %d: %s\n", node, strerror(errno));
+    return 0;
+}
+
+/******************************************************************************
+Description.: have the pages of a mapping, which are not touched yet, come
+              from a node
+Input Value.: * addr..: the mapping
+              * length: its length
+              * node..: the node
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+int numa_prefer(void *addr, size_t length, int node)
+{
+    unsigned long mask;
+
+    if(node < 0 || node >= numa_node_count())
+        return -1;
+    if(node_count == 1)
+        return 0;
+
+    mask = 1UL << node;
+    return (syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) < 0) ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: read the argument of --numa
+Input Value.: * arg.: a node or nic
+              * node: gets the node or NUMA_NIC
+Return Value: 0 if ok, -1 if it is no node of the system
+******************************************************************************/
+int numa_parse_node(const char *arg, int *node)
+{
+    char *end;
+    long n;
+
+    if(strcmp(arg, "nic") == 0) {
+        *node = NUMA_NIC;
+        return 0;
+    }
+
+    n = strtol(arg, &end, 10);
+    if(end == arg || *end != '\0' || n < 0 || n >= numa_node_count())
+        return -1;
+
+    *node = n;
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+/*
+ * the NUMA nodes of the system as /sys tells them, without libnuma. A
+ * system which does not tell has one node with all cores. Nodes from
+ * NUMA_MAX_NODES up are not told apart from node 0.
+ *
+ * An input given --numa allocates its frames on that node, with nic on the
+ * node whose cores receive the packets of its connection, see
+ * frame_alloc_on(). Consumers place themselves by the node of a frame.
+ */
+#define NUMA_MAX_NODES 16
+#define NUMA_NIC (-2)
+
+int numa_node_count(void);
+int numa_node_of_cpu(int cpu);
+int numa_current_node(void);
+int numa_socket_node(int fd);
+int numa_bind(int node);
+int numa_prefer(void *addr, size_t length, int node);
+int numa_parse_node(const char *arg, int *node);
+
+#ifdef CPU_SETSIZE
+int numa_parse_cpus(const char *list, cpu_set_t *cpus);
+#endif
+
+#endif
@@ -21,9 +21,11 @@
 *******************************************************************************/
 
 #include <syslog.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include "../mjpg_streamer.h"
 #define INPUT_PLUGIN_PREFIX " i: "
-#define IPRINT(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", INPUT_PLUGIN_PREFIX); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
+#define IPRINT(...) { static log_site _site = LOG_SITE; log_print(&_site, LOG_INFO, INPUT_PLUGIN_PREFIX, __VA_ARGS__); }
 
 /* parameters for input plugin */
 typedef struct _input_parameter input_parameter;
@@ -41,6 +43,145 @@ struct _input_resolution {
     unsigned int height;
 };
 
+/*
+ * a single JPEG frame as published by an input plugin
+ *
+ * Once a frame has been handed to input_publish_frame() it must be treated
+ * as read-only. Output plugins take a reference instead of copying the data
+ * and drop it with frame_unref() when they are done, the last reference
+ * frees the frame.
+ */
+/* number of frames an input keeps around for consumers that fall behind */
+#define INPUT_RING_SIZE 8
+
+/* room for the metadata segment of a frame, see --metadata */
+#define FRAME_APP_SIZE 384
+
+/* pieces of a frame for writev(), see frame_iovec() */
+#define FRAME_IOVECS 3
+
+/*
+ * the layout of the pixels of a raw frame, the picture a JPEG frame was
+ * compressed from, see frame_raw_copy(). The planes follow each other in buf.
+ */
+#define RAW_PLANES 3
+
+typedef struct {
+    unsigned int pixelformat;   // V4L2_PIX_FMT_*, 0 for frames which are no raw frames
+    int width, height;
+    int planes;
+    int stride[RAW_PLANES];     // bytes per line of each plane
+    int offset[RAW_PLANES];     // of each plane in buf
+    int dmabuf;                 // DMABUF fd holding the same pixels, -1 if there is none
+} raw_format;
+
+/*
+ * a picture decoded from the JPEG of a frame, see frame_decode(). It belongs
+ * to the frame and is shared by all plugins which ask for it.
+ */
+typedef enum {
+    DECODE_YUV420 = 0,      // planar Y, Cb and Cr, the chroma at half the width and height
+    DECODE_GREY,            // the luma only
+    DECODE_RGB24            // packed R, G, B
+} frame_decode_t;
+
+typedef struct _decoded_picture decoded_picture;
+struct _decoded_picture {
+    int format;                 // frame_decode_t
+    int denom;                  // the picture is 1/denom of the size of the frame
+    int width, height;
+    unsigned char *plane[3];    // Y, Cb, Cr, or the packed pixels in plane[0]
+    int stride[3];              // bytes between the lines of each plane
+
+    /* only to be touched by frame_decode() */
+    int state;
+    unsigned char *buffer;
+    size_t size;                // of buffer
+    decoded_picture *next;      // of the same frame
+};
+
+typedef struct _input_frame input_frame;
+struct _input_frame {
+    unsigned char *buf;         // JPEG data
+    int size;                   // number of valid bytes in buf
+    int capacity;               // number of allocated bytes in buf
+    struct timeval timestamp;   // capture time of this frame
+    unsigned long long seq;     // sequence number, set by input_publish_frame()
+    int refcount;               // only to be touched by frame_ref()/frame_unref()
+    int pool_class;             // size class of the frame pool, -1 if not pooled
+    int numa_node;              // node of its memory, -1 if not known
+    unsigned int burst;         // burst of stills it was captured in, 0 if none
+    int burst_index;            // position in its burst, from 0
+
+    /* frames of frame_wrap() hand their data back with this, NULL otherwise */
+    void (*release)(void *arg);
+    void *release_arg;
+
+    /* monotonic_usec() when the frame passed each stage, 0 if unknown */
+    unsigned long long capture_usec;    // the driver captured it, from its kernel timestamp
+    unsigned long long dequeue_usec;    // the input took it from the driver
+    unsigned long long encoded_usec;    // it was compressed or copied into this frame
+    unsigned long long publish_usec;    // set by input_publish_frame()
+
+    /*
+     * a segment which belongs right after the SOI marker of buf, like the EXIF
+     * data input_publish_frame() adds. It is not copied into buf, outputs
+     * write the pieces of frame_iovec() or use frame_length() and frame_copy().
+     */
+    int app_size;                       // 0 without a segment
+    unsigned char app[FRAME_APP_SIZE];
+
+    /*
+     * the picture before it was compressed, for consumers which would decode
+     * the JPEG otherwise. It is a frame of its own with the same sequence
+     * number and timestamp, as captured, before a --transform. Inputs only
+     * attach it while someone subscribed with input_raw_subscribe().
+     */
+    input_frame *raw;                   // NULL without
+    raw_format format;                  // of a raw frame
+
+    decoded_picture *decoded;           // the pictures of frame_decode(), NULL before the first
+};
+
+/*
+ * histogram with power of two buckets, bucket i counts the values below
+ * 2^(shift + i), the last bucket all bigger ones
+ */
+#define HISTOGRAM_BUCKETS 16
+typedef struct {
+    int shift;
+    unsigned long long bucket[HISTOGRAM_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum;
+} histogram;
+
+/* counters of an input, read with __sync builtins as they change any time */
+typedef struct {
+    unsigned long long frames;          // frames published
+    unsigned long long bytes;           // bytes of all published frames
+    histogram encode_usec;              // compression time, if the plugin reports it
+    histogram dequeue_latency_usec;     // capture to dequeue, if the plugin reports both
+    histogram encode_latency_usec;      // dequeue to encoded
+    histogram publish_latency_usec;     // encoded to published
+    unsigned long long db_contended;    // times the db mutex was taken by someone else
+    unsigned long long db_wait_usec;    // time spent waiting for it then
+    unsigned long long capture_dropped; // frames the capture device dropped, if the plugin can tell
+    unsigned long long corrupt_dropped; // broken frames the plugin dropped
+    unsigned long long repeat_dropped;  // frames the plugin dropped as repeats of the previous one
+    unsigned long long device_failures; // times the device stopped working
+    unsigned long long device_reopens;  // times the plugin got it working again
+    int device_down;                    // the device failed and is not working again yet
+    int capture_buffers;                // buffers queued to the capture device, 0 if unknown
+    double target_fps;                  // rate of a paced input, see pacer in utils.h
+    double paced_fps;                   // rate it reached over the last second
+    unsigned long long pacing_late;     // frames it was too late for
+    unsigned long long playout_target_usec; // longest delay of the playout buffer of a relay, 0 without
+    unsigned long long playout_delay_usec;  // the delay it adapted to
+    unsigned long long jitter_usec;     // smoothed deviation of the frame intervals of the upstream
+    int playout_depth;                  // frames in the playout buffer
+    unsigned long long governor_skipped; // frames the governor skipped or dropped
+} input_stats;
+
 typedef struct _input_format input_format;
 struct _input_format {
     struct v4l2_fmtdesc format;
@@ -49,6 +190,43 @@ struct _input_format {
     char currentResolution;
 };
 
+/* metadata input_publish_frame() adds to the frames, see metadata.c */
+typedef enum {
+    METADATA_NONE = 0,
+    METADATA_EXIF,          // APP1 segment with EXIF tags
+    METADATA_COM            // COM segment with a line of text
+} frame_metadata_t;
+
+/* lossless rotations and flips of the frames of an input, see transform.c */
+typedef enum {
+    TRANSFORM_NONE = 0,
+    TRANSFORM_HFLIP,
+    TRANSFORM_VFLIP,
+    TRANSFORM_ROTATE180,
+    TRANSFORM_TRANSPOSE,
+    TRANSFORM_ROTATE90,     // clockwise
+    TRANSFORM_ROTATE270,
+    TRANSFORM_TRANSVERSE
+} frame_transform_t;
+
+/* motion detection on the frames of an input, see motion.c */
+#define MOTION_ZONES 64
+
+typedef struct {
+    double threshold;       // percent of the blocks of a zone which have to change, 0 for none
+    int columns, rows;      // zones the picture is divided into
+} motion_config;
+
+typedef struct {
+    unsigned long long seq;         // frame the state was found in, 0 before the first
+    struct timeval timestamp;       // its capture time
+    int active;                     // a zone changed by the threshold or more
+    double score;                   // percent of the blocks of the picture which changed
+    unsigned long long events;      // times the motion started
+    int columns, rows;
+    double zone[MOTION_ZONES];      // percent of the blocks of each zone, row by row
+} motion_state;
+
 /* structure to store variables/functions for input plugin */
 typedef struct _input input;
 struct _input {
@@ -65,25 +243,259 @@ struct _input {
 
     struct v4l2_jpegcompression jpegcomp;
 
-    /* signal fresh frames */
+    /*
+     * signal fresh frames. The consumers in frame.c wait on the waiters
+     * list, each one is woken for the frame it waits for, db_update is
+     * broadcast for plugins which wait on it themselves.
+     */
     pthread_mutex_t db;
     pthread_cond_t  db_update;
+    struct _frame_waiter *waiters;
+
+    /*
+     * the last INPUT_RING_SIZE published frames, frame number seq lives in
+     * ring[seq % INPUT_RING_SIZE] and the ring holds one reference to each
+     * of them. current points to the newest frame, seq is its number.
+     */
+    input_frame *ring[INPUT_RING_SIZE];
+    input_frame *current;
+    unsigned long long seq;
+
+    /* readers inside input_peek_frame(), counted per epoch */
+    int peekers[2];
+    unsigned int epoch;
 
-    /* global JPG frame, this is more or less the "database" */
+    /*
+     * global JPG frame, this is more or less the "database"
+     * kept for compatibility: input_publish_frame() points these to the data
+     * of the current frame, new code should use input_get_frame() instead
+     */
     unsigned char *buf;
     int size;
 
     /* v4l2_buffer timestamp */
     struct timeval timestamp;
 
+    input_stats stats;
+
     input_format *in_formats;
     int formatCount;
     int currentFormat; // holds the current format number
     
     void *context; // private data for the plugin
 
+    int transform; // frame_transform_t applied by input_publish_frame()
+    int metadata;  // frame_metadata_t added by input_publish_frame()
+    motion_config motion_config;           // --motion
+    struct _motion_detector *motion;       // NULL without motion detection
+    struct _live_stream *live;             // NULL until an output streams it, see live.c
+    struct _command_queue *commands;       // NULL until the first queued command, see command.c
+    int replay_sec;                        // --replay: seconds of frames kept, 0 for none
+    struct _replay_ring *replay;           // NULL without --replay, see replay.c
+    int raw_subscribers;                   // consumers of raw frames, see input_raw_subscribe()
+    int numa_node;                         // --numa: node of its frames, NUMA_NIC or -1 for any
+    int subscribers;                       // consumers of the frames, see input_subscribe()
+    int idle;                              // the input stopped capturing for lack of subscribers
+    void (*wake)(input *in);               // set by inputs which idle, called on the first subscription
+    int priority;                          // --priority: the governor degrades lower ones first
+    int degrade;                           // degrade_level the governor put it on, see governor.h
+    int encodes;                           // the plugin calls governor_skip() before it encodes
+    unsigned int governor_count;           // frames seen by governor_skip() or governor_drop()
+
     int (*init)(input_parameter *, int id);
     int (*stop)(int);
     int (*run)(int);
     int (*cmd)(int plugin, unsigned int control_id, unsigned int group, int value, char *value_str);
-};
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* frame publication API, implemented in frame.c */
+input_frame *frame_alloc(int capacity);
+input_frame *frame_alloc_on(int capacity, int node);
+input_frame *frame_wrap(unsigned char *data, int size, void (*release)(void *arg), void *arg);
+int frame_pool_reserve(int capacity, int count);
+input_frame *frame_ref(input_frame *frame);
+void frame_unref(input_frame *frame);
+int frame_length(const input_frame *frame);
+int frame_iovec(const input_frame *frame, size_t offset, struct iovec *iov);
+int frame_copy(const input_frame *frame, unsigned char *dest);
+input_frame *frame_flatten(input_frame *frame);
+void input_publish_frame(input *in, input_frame *frame);
+int input_publish(input *in, const unsigned char *data, int size, const struct timeval *timestamp);
+input_frame *input_get_frame(input *in);
+input_frame *input_peek_frame(input *in);
+input_frame *input_wait_frame(input *in, unsigned long long *seq);
+input_frame *input_next_frame(input *in, unsigned long long seq, unsigned long long *dropped);
+input_frame *input_wait_next_frame(input *in, unsigned long long *seq, unsigned long long *dropped);
+input_frame *input_timed_next_frame(input *in, unsigned long long *seq, unsigned long long *dropped, int msec);
+
+/* consumers of an input, implemented in frame.c */
+void input_subscribe(input *in);
+void input_unsubscribe(input *in);
+int input_subscribed(input *in);
+void input_set_idle(input *in, int idle);
+int input_idle(input *in);
+input_frame *input_wake_frame(input *in, int msec);
+
+/* raw frames next to the JPEG frames, implemented in frame.c */
+void input_raw_subscribe(input *in);
+void input_raw_unsubscribe(input *in);
+int input_raw_wanted(input *in);
+input_frame *frame_raw_copy(const raw_format *format, const unsigned char *const *planes, const int *lengths);
+void frame_attach_raw(input_frame *frame, input_frame *raw);
+
+/* decoded pictures of the frames, implemented in decode.c */
+int frame_picture_size(const input_frame *frame, int *width, int *height);
+const decoded_picture *frame_decode(input_frame *frame, int format, int width, int height);
+void frame_decode_free(input_frame *frame);
+
+/* frame metadata, implemented in metadata.c */
+int metadata_parse(const char *name);
+void frame_metadata(input *in, input_frame *frame);
+
+/* motion detection, implemented in motion.c */
+int motion_parse(const char *arg, motion_config *config);
+int motion_start(input *in);
+void motion_stop(input *in);
+int motion_get(input *in, motion_state *state);
+
+/*
+ * LL-HLS segments of an input, implemented in live.c. A producer hands over
+ * its CMAF header and parts, readers get the playlist and references to
+ * the frames holding the parts, LIVE_PARTS of them at most.
+ */
+#define LIVE_PARTS 64
+
+typedef struct _live_stream live_stream;
+int live_start(input *in, unsigned int timescale, unsigned int part_msec, unsigned int segment_sec);
+void live_stop(input *in);
+int live_header(input *in, const struct iovec *iov, int count);
+int live_part(input *in, const struct iovec *iov, int count, unsigned int duration, int independent);
+int live_playlist(input *in, long long msn, int part, int msec, char *buffer, int size);
+int live_get(input *in, long long msn, int part, int msec, input_frame **parts);
+
+/*
+ * commands of the outputs for an input, implemented in command.c. A thread
+ * of the input carries them out in order, so a slow control does not hold
+ * up the caller. A command still queued for the same control takes the
+ * value of a newer one instead. COMMAND_WAIT waits for the result of cmd().
+ */
+#define COMMAND_WAIT 1
+
+typedef struct _command_queue command_queue;
+int input_command(input *in, unsigned int control_id, unsigned int group, int value, const char *value_str, int flags);
+unsigned long long input_commands_done(input *in);
+
+/*
+ * the frames of the last replay_sec seconds of an input, implemented in
+ * replay.c. Readers get references to them, oldest first.
+ */
+typedef struct _replay_ring replay_ring;
+int replay_start(input *in);
+void replay_keep(input *in, input_frame *frame);
+int replay_get(input *in, unsigned long long usec, input_frame ***frames);
+input_frame *replay_find(input *in, unsigned long long seq);
+
+/* frame transformations, implemented in transform.c */
+int transform_parse(const char *name);
+const char *transform_name(int transform);
+input_frame *frame_transform(input_frame *frame, int transform);
+
+/* plugins publishing several streams take more inputs, implemented in
+ * mjpg_streamer.c, several plugins may call it at once from init() */
+int input_add(input *in);
+
+/* statistics helpers, implemented in frame.c */
+unsigned long long monotonic_usec(void);
+void frame_wall_time(const input_frame *frame, struct timeval *tv);
+void histogram_observe(histogram *h, unsigned long long value);
+
+/*
+ * slice-parallel JPEG encoding, implemented in encoder.c
+ *
+ * jpeg_slice_fn stores the lines first to first + lines - 1 of a picture as
+ * a complete JPEG in buffer and returns its length or -1 on errors.
+ */
+typedef int (*jpeg_slice_fn)(void *arg, int first, int lines, unsigned char *buffer, int size);
+typedef struct _jpeg_encoder jpeg_encoder;
+jpeg_encoder *jpeg_encoder_new(int threads);
+int jpeg_encoder_encode(jpeg_encoder *enc, jpeg_slice_fn fn, void *arg, int height, unsigned char *buffer, int size);
+void jpeg_encoder_free(jpeg_encoder *enc);
+
+/*
+ * JPEG encoding on a V4L2 memory-to-memory device, implemented in m2m.c
+ *
+ * m2m_encoder_new() returns NULL if there is no device for this format,
+ * plugins compress in software then.
+ */
+typedef struct _m2m_encoder m2m_encoder;
+m2m_encoder *m2m_encoder_new(const char *device, int width, int height, unsigned int pixelformat,
+                             int bytesperline, int quality, int buffers);
+int m2m_encoder_encode(m2m_encoder *m, int index, int dmabuf, const unsigned char *data, int size,
+                       unsigned char *buffer, int max);
+void m2m_encoder_free(m2m_encoder *m);
+
+/*
+ * JPEG encoder backends, implemented in jpegenc.c
+ *
+ * One function compresses raw pictures with libjpeg, with libjpeg in slices
+ * on several threads, with TurboJPEG or on a mem2mem device. JPEG_BACKEND_AUTO
+ * lets each of them compress a few of the first pictures and keeps the
+ * fastest. A backend that can not take the pictures hands them to libjpeg.
+ * Huffman optimization and progressive JPEGs are only done by libjpeg.
+ */
+#define JPEG_BACKEND_AUTO       0
+#define JPEG_BACKEND_LIBJPEG    1
+#define JPEG_BACKEND_SLICES     2
+#define JPEG_BACKEND_TURBOJPEG  3
+#define JPEG_BACKEND_M2M        4
+#define JPEG_BACKENDS           5
+
+#define JPEG_OPTIMIZE       0x01    // optimal huffman tables for each picture
+#define JPEG_PROGRESSIVE    0x02
+
+typedef struct {
+    int backend;                // JPEG_BACKEND_*
+    int flags;                  // JPEG_OPTIMIZE, JPEG_PROGRESSIVE
+    const char *device;         // of the mem2mem encoder, NULL to search for one
+    jpeg_encoder *encoder;      // threads for the slices, NULL to start some
+    int threads;                // number of threads started, 0 for one per core
+} jpeg_backend_options;
+
+/* a YUYV, UYVY, YUV420, NV12, NV16, RGB24, BGR24, RGB565 or GREY picture */
+typedef struct {
+    raw_format format;          // offset is not used, format.dmabuf is read by mem2mem devices
+    const unsigned char *plane[RAW_PLANES];
+    int size;                   // bytes from plane[0] to the end of the picture
+    int index;                  // capture buffer holding the picture, -1 if there is none
+    int buffers;                // number of capture buffers, the DMABUF slots of a mem2mem device
+} jpeg_picture;
+
+typedef struct _jpeg_backend jpeg_backend;
+int jpeg_backend_parse(const char *name);
+const char *jpeg_backend_name(int backend);
+jpeg_backend *jpeg_backend_new(const jpeg_backend_options *opts);
+int jpeg_backend_encode(jpeg_backend *b, const jpeg_picture *pic, int quality, unsigned char *buffer, int size);
+int jpeg_backend_current(jpeg_backend *b);
+void jpeg_backend_reset(jpeg_backend *b);
+void jpeg_backend_free(jpeg_backend *b);
+
+/*
+ * quality control for software JPEG encoders, implemented in encoder.c
+ *
+ * rate_control_update() is told the size of every encoded frame and returns
+ * the quality for the next one, lowering it while the frames exceed the
+ * bitrate or frame size limit and raising it again up to the configured
+ * quality once they fit. The "JPEG quality" control of the input shows it.
+ */
+typedef struct {
+    int kbps;                       // bitrate to stay below, 0 for no limit
+    int max_size;                   // bytes a frame should stay below, 0 for no limit
+    int max_quality;                // the configured quality, never exceeded
+    double quality;                 // quality of the next frame
+    double interval;                // moving average of the time between frames in us
+    unsigned long long last_usec;   // when the last frame was counted
+    struct _control *ctrl;          // the quality control of the input
+} rate_control;
+void rate_control_init(rate_control *rc, input *in, int quality, int kbps, int max_size);
+void rate_control_set_quality(rate_control *rc, int quality);
+int rate_control_update(rate_control *rc, int size);
@@ -0,0 +1,170 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "file_list.h"
+
+/******************************************************************************
+Description.: tell whether a name is one of the JPEG files to serve
+Input Value.: name of the file
+Return Value: 1 if it is, 0 otherwise
+******************************************************************************/
+static int is_jpeg(const char *name)
+{
+    return (strstr(name, ".jpg") != NULL) || (strstr(name, ".JPG") != NULL);
+}
+
+/******************************************************************************
+Description.: binary search for a name
+Input Value.: * list: the sorted list
+              * name: to look for
+              * found: set to 1 if the name is in the list
+Return Value: the position of the name, or where it has to be inserted
+******************************************************************************/
+static int find_name(file_list *list, const char *name, int *found)
+{
+    int low = 0, high = list->count, middle, order;
+
+    *found = 0;
+
+    /* files mostly arrive in order, so check the end first */
+    if(high > 0 && (order = strcoll(list->names[high - 1], name)) <= 0) {
+        *found = (order == 0);
+        return (order == 0) ? high - 1 : high;
+    }
+
+    while(low < high) {
+        middle = (low + high) / 2;
+        order = strcoll(list->names[middle], name);
+        if(order == 0) {
+            *found = 1;
+            return middle;
+        }
+        if(order < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/******************************************************************************
+Description.: read the JPEG files of a folder into an empty list
+Input Value.: * list..: to fill
+              * folder: to scan
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+int file_list_scan(file_list *list, const char *folder)
+{
+    struct dirent **entries;
+    int count, i;
+
+    memset(list, 0, sizeof(*list));
+
+    if((count = scandir(folder, &entries, 0, alphasort)) < 0)
+        return -1;
+
+    if((list->names = malloc((count + 1) * sizeof(char *))) == NULL) {
+        while(count--)
+            free(entries[count]);
+        free(entries);
+        return -1;
+    }
+    list->capacity = count + 1;
+
+    for(i = 0; i < count; i++) {
+        if(is_jpeg(entries[i]->d_name) &&
+           (list->names[list->count] = strdup(entries[i]->d_name)) != NULL)
+            list->count++;
+        free(entries[i]);
+    }
+    free(entries);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: insert a new file at its place, names which are no JPEG files
+              or already known are left out
+Input Value.: * list: the list
+              * name: of the file
+Return Value: the position of the new file, -1 if it was not added
+******************************************************************************/
+int file_list_add(file_list *list, const char *name)
+{
+    char **names, *copy;
+    int capacity, position, found;
+
+    if(!is_jpeg(name))
+        return -1;
+
+    position = find_name(list, name, &found);
+    if(found)
+        return -1;
+
+    if(list->count == list->capacity) {
+        capacity = list->capacity ? 2 * list->capacity : 1024;
+        if((names = realloc(list->names, capacity * sizeof(char *))) == NULL)
+            return -1;
+        list->names = names;
+        list->capacity = capacity;
+    }
+
+    if((copy = strdup(name)) == NULL)
+        return -1;
+
+    memmove(list->names + position + 1, list->names + position, (list->count - position) * sizeof(char *));
+    list->names[position] = copy;
+    list->count++;
+
+    return position;
+}
+
+/******************************************************************************
+Description.: drop a file which was deleted or moved away
+Input Value.: * list: the list
+              * name: of the file
+Return Value: the position the file had, -1 if it was not in the list
+******************************************************************************/
+int file_list_remove(file_list *list, const char *name)
+{
+    int position, found;
+
+    position = find_name(list, name, &found);
+    if(!found)
+        return -1;
+
+    free(list->names[position]);
+    list->count--;
+    memmove(list->names + position, list->names + position + 1, (list->count - position) * sizeof(char *));
+
+    return position;
+}
+
+void file_list_free(file_list *list)
+{
+    while(list->count > 0)
+        free(list->names[--list->count]);
+    free(list->names);
+    list->names = NULL;
+    list->capacity = 0;
+}
@@ -0,0 +1,40 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef FILE_LIST_H
+#define FILE_LIST_H
+
+/*
+ * the JPEG files of a folder, sorted like alphasort() does. The folder is
+ * scanned once, afterwards the list follows the inotify events of it.
+ */
+typedef struct _file_list {
+    char **names;
+    int count;
+    int capacity;
+} file_list;
+
+int file_list_scan(file_list *list, const char *folder);
+int file_list_add(file_list *list, const char *name);
+int file_list_remove(file_list *list, const char *name);
+void file_list_free(file_list *list);
+
+#endif
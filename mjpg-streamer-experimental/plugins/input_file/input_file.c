@@ -30,18 +30,34 @@
 #include <sys/inotify.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "../../mjpg_streamer.h"
 #include "../../utils.h"
 
+#include "mjpg_index.h"
+#include "file_list.h"
+
 #define INPUT_PLUGIN_NAME "FILE input plugin"
 
 typedef enum _read_mode {
     NewFilesOnly,
-    ExistingFiles
+    ExistingFiles,
+    MjpgFile
 } read_mode;
 
+/* the mapped mjpg file, each frame published from it holds a reference */
+typedef struct _mjpg_mapping {
+    unsigned char *addr;
+    size_t length;
+    int refcount;
+} mjpg_mapping;
+
+#define POSITION_CONTROL_ID 1
+
 /* private functions and variables to this plugin */
 static pthread_t   worker;
 static globals     *pglobal;
@@ -49,6 +65,8 @@ static globals     *pglobal;
 void *worker_thread(void *);
 void worker_cleanup(void *);
 void help(void);
+static int open_mjpg_file(int id);
+static void play_mjpg_file(void);
 
 static double delay = 1.0;
 static char *folder = NULL;
@@ -56,6 +74,14 @@ static char *filename = NULL;
 static int rm = 0;
 static int plugin_number;
 static read_mode mode = NewFilesOnly;
+static int prefetch = 4;
+static int delay_set = 0;
+static char *mjpg_file = NULL;
+static double start = 0;
+static int loop = 0;
+static mjpg_mapping *mapping = NULL;
+static mjpg_index frames;
+static volatile int seek_to = -1;
 
 /* global variables for this plugin */
 static int fd, rc, wd, size;
@@ -91,6 +117,15 @@ int input_init(input_parameter *param, int id)
             {"name", required_argument, 0, 0},
             {"e", no_argument, 0, 0},
             {"existing", no_argument, 0, 0},
+            {"p", required_argument, 0, 0},
+            {"prefetch", required_argument, 0, 0},
+            {"m", required_argument, 0, 0},
+            {"mjpeg", required_argument, 0, 0},
+            {"s", required_argument, 0, 0},
+            {"start", required_argument, 0, 0},
+            {"l", no_argument, 0, 0},
+            {"loop", no_argument, 0, 0},
+            {"fps", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -119,6 +154,7 @@ int input_init(input_parameter *param, int id)
         case 3:
             DBG("case 2,3\n");
             delay = atof(optarg);
+            delay_set = 1;
             break;
 
             /* f, folder */
@@ -151,6 +187,39 @@ int input_init(input_parameter *param, int id)
             DBG("case 10,11\n");
             mode = ExistingFiles;
             break;
+            /* p, prefetch */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            prefetch = atoi(optarg);
+            if(prefetch < 0)
+                prefetch = 0;
+            break;
+            /* m, mjpeg */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            mjpg_file = strdup(optarg);
+            mode = MjpgFile;
+            break;
+            /* s, start */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            start = atof(optarg);
+            break;
+            /* l, loop */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            loop = 1;
+            break;
+            /* fps */
+        case 20:
+            DBG("case 20\n");
+            delay = (atof(optarg) > 0) ? 1 / atof(optarg) : 0;
+            delay_set = 1;
+            break;
         default:
             DBG("default case\n");
             help();
@@ -160,6 +229,9 @@ int input_init(input_parameter *param, int id)
 
     pglobal = param->global;
 
+    if(mode == MjpgFile)
+        return open_mjpg_file(id);
+
     /* check for required parameters */
     if(folder == NULL) {
         IPRINT("ERROR: no folder specified\n");
@@ -170,6 +242,9 @@ int input_init(input_parameter *param, int id)
     IPRINT("forced delay......: %.4f\n", delay);
     IPRINT("delete file.......: %s\n", (rm) ? "yes, delete" : "no, do not delete");
     IPRINT("filename must be..: %s\n", (filename == NULL) ? "-no filter for certain filename set-" : filename);
+    if(mode == ExistingFiles) {
+        IPRINT("files to prefetch.: %d\n", prefetch);
+    }
 
     param->global->in[id].name = malloc((strlen(INPUT_PLUGIN_NAME) + 1) * sizeof(char));
     sprintf(param->global->in[id].name, INPUT_PLUGIN_NAME);
@@ -177,6 +252,24 @@ int input_init(input_parameter *param, int id)
     return 0;
 }
 
+/******************************************************************************
+Description.: process commands, with -m the position can be set in seconds
+Input Value.: * plugin.....: number of the input plugin
+              * control_id.: the control
+              * group......: IN_CMD_GENERIC
+              * value......: seconds from the start of the file
+Return Value: 0 if ok, -1 for unknown controls
+******************************************************************************/
+int input_cmd(int plugin, unsigned int control_id, unsigned int group, int value, char *value_string)
+{
+    if(mode != MjpgFile || group != IN_CMD_GENERIC || control_id != POSITION_CONTROL_ID)
+        return -1;
+
+    DBG("seeking to %d s\n", value);
+    seek_to = (value < 0) ? 0 : value;
+    return 0;
+}
+
 int input_stop(int id)
 {
     DBG("will cancel input thread\n");
@@ -186,16 +279,21 @@ int input_stop(int id)
 
 int input_run(int id)
 {
-    pglobal->in[id].buf = NULL;
-
     if (mode == NewFilesOnly) {
         rc = fd = inotify_init();
+    } else if (mode == ExistingFiles) {
+        /* the list of files follows the folder without scanning it again */
+        rc = fd = inotify_init1(IN_NONBLOCK);
+    }
+
+    if (mode != MjpgFile) {
         if(rc == -1) {
             perror("could not initilialize inotify");
             return 1;
         }
 
-        rc = wd = inotify_add_watch(fd, folder, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+        rc = wd = inotify_add_watch(fd, folder, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR |
+                                    ((mode == ExistingFiles) ? IN_DELETE | IN_MOVED_FROM : 0));
         if(rc == -1) {
             perror("could not add watch");
             return 1;
@@ -210,7 +308,6 @@ int input_run(int id)
     }
 
     if(pthread_create(&worker, 0, worker_thread, NULL) != 0) {
-        free(pglobal->in[id].buf);
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
@@ -227,14 +324,334 @@ void help(void)
     " Help for input plugin..: "INPUT_PLUGIN_NAME"\n" \
     " ---------------------------------------------------------------\n" \
     " The following parameters can be passed to this plugin:\n\n" \
-    " [-d | --delay ]........: delay (in seconds) to pause between frames\n" \
+    " [-d | --delay ]........: time (in seconds) between frames\n" \
+    " [-fps ]................: frames per second instead of the delay, like 29.97\n" \
     " [-f | --folder ].......: folder to watch for new JPEG files\n" \
     " [-r | --remove ].......: remove/delete JPEG file after reading\n" \
     " [-n | --name ].........: ignore changes unless filename matches\n" \
     " [-e | --existing ].....: serve the existing *.jpg files from the specified directory\n" \
+    " [-p | --prefetch ].....: with -e, read this many of the next files ahead (default 4)\n" \
+    " [-m | --mjpeg ]........: play this file of concatenated JPEGs instead of a folder,\n" \
+    "                          paced by the timestamps of its index unless -d is given\n" \
+    " [-s | --start ]........: with -m, start this many seconds into the file\n" \
+    " [-l | --loop ].........: with -m, start over at the end of the file\n" \
     " ---------------------------------------------------------------\n");
 }
 
+/* a file of the existing files, mapped into memory for one frame */
+typedef struct _file_mapping {
+    void *addr;
+    size_t length;
+} file_mapping;
+
+static void unmap_file(void *arg)
+{
+    file_mapping *mapping = arg;
+
+    munmap(mapping->addr, mapping->length);
+    free(mapping);
+}
+
+/******************************************************************************
+Description.: ask the kernel to read a file into the page cache in the
+              background, so mapping it later does not wait for the disk
+Input Value.: name of the file
+Return Value: -
+******************************************************************************/
+static void prefetch_file(const char *path)
+{
+    int file = open(path, O_RDONLY);
+
+    if(file == -1)
+        return;
+    posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+    close(file);
+}
+
+/******************************************************************************
+Description.: map an existing file and wrap the mapping as a frame, the
+              outputs read the page cache directly and the mapping goes away
+              with the last reference
+Input Value.: name of the file
+Return Value: the frame or NULL on error
+******************************************************************************/
+static input_frame *map_file(const char *path)
+{
+    file_mapping *mapping;
+    input_frame *frame;
+    struct stat stats;
+    void *addr;
+    int file;
+
+    if((file = open(path, O_RDONLY)) == -1) {
+        perror("could not open file for reading");
+        return NULL;
+    }
+
+    if(fstat(file, &stats) == -1) {
+        perror("could not read statistics of file");
+        close(file);
+        return NULL;
+    }
+
+    if(stats.st_size == 0) {
+        fprintf(stderr, "%s is empty\n", path);
+        close(file);
+        return NULL;
+    }
+
+    /* the pages are faulted in here, not while the outputs send them */
+    addr = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, 0);
+    close(file);
+    if(addr == MAP_FAILED) {
+        perror("could not map file");
+        return NULL;
+    }
+
+    if((mapping = malloc(sizeof(file_mapping))) == NULL) {
+        munmap(addr, stats.st_size);
+        return NULL;
+    }
+    mapping->addr = addr;
+    mapping->length = stats.st_size;
+
+    if((frame = frame_wrap(addr, stats.st_size, unmap_file, mapping)) == NULL) {
+        unmap_file(mapping);
+        return NULL;
+    }
+    return frame;
+}
+
+/******************************************************************************
+Description.: apply the pending inotify events of the folder to the list of
+              existing files, the file to serve next stays the same
+Input Value.: * files..: the list
+              * current: position of the file to serve next
+Return Value: 0 if ok, -1 if the folder can not be watched anymore
+******************************************************************************/
+static int update_file_list(file_list *files, int *current)
+{
+    struct inotify_event *event;
+    char *next;
+    int length, position;
+
+    while((length = read(fd, ev, size)) > 0) {
+        for(next = (char *)ev; next < (char *)ev + length; next += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event *)next;
+
+            if(event->mask & (IN_IGNORED | IN_UNMOUNT)) {
+                fprintf(stderr, "event mask suggests to stop\n");
+                return -1;
+            }
+
+            /* events got lost, only a new scan tells which files are there */
+            if(event->mask & IN_Q_OVERFLOW) {
+                DBG("inotify queue overflowed, scanning the folder again\n");
+                file_list_free(files);
+                if(file_list_scan(files, folder) < 0) {
+                    perror("error during scandir\n");
+                    return -1;
+                }
+                continue;
+            }
+
+            if(event->len == 0)
+                continue;
+
+            if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                if((position = file_list_add(files, event->name)) >= 0 && position < *current)
+                    (*current)++;
+            } else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                if((position = file_list_remove(files, event->name)) >= 0 && position < *current)
+                    (*current)--;
+            }
+        }
+    }
+
+    if(length == -1 && errno != EAGAIN) {
+        perror("reading inotify events failed\n");
+        return -1;
+    }
+
+    if(*current >= files->count)
+        *current = 0;
+
+    return 0;
+}
+
+static void release_mapping(void *arg)
+{
+    mjpg_mapping *m = arg;
+
+    if(__sync_sub_and_fetch(&m->refcount, 1) != 0)
+        return;
+    munmap(m->addr, m->length);
+    free(m);
+}
+
+/* microseconds of a frame from the start of the file */
+static unsigned long long frame_position(int i)
+{
+    if(frames.timed && !delay_set)
+        return frames.entries[i].timestamp - frames.entries[0].timestamp;
+    return 1000 * 1000 * delay * i;
+}
+
+/* the first frame at or after a position */
+static int find_frame(unsigned long long position)
+{
+    if(frames.timed && !delay_set)
+        return mjpg_index_find(&frames, frames.entries[0].timestamp + position);
+    if(delay == 0)
+        return 0;
+    return (position / (1000 * 1000 * delay) < frames.count) ? position / (1000 * 1000 * delay) : frames.count - 1;
+}
+
+/******************************************************************************
+Description.: map the mjpg file, get its index and add the position control
+Input Value.: id of the input
+Return Value: 0 if ok, 1 on error
+******************************************************************************/
+static int open_mjpg_file(int id)
+{
+    struct stat stats;
+    control position;
+    void *addr;
+    int file;
+
+    IPRINT("mjpg file.........: %s\n", mjpg_file);
+
+    if((file = open(mjpg_file, O_RDONLY)) == -1) {
+        perror("could not open the mjpg file");
+        return 1;
+    }
+    if(fstat(file, &stats) == -1 || stats.st_size == 0) {
+        IPRINT("ERROR: %s is empty or can not be read\n", mjpg_file);
+        close(file);
+        return 1;
+    }
+
+    addr = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(addr == MAP_FAILED) {
+        perror("could not map the mjpg file");
+        return 1;
+    }
+    madvise(addr, stats.st_size, MADV_SEQUENTIAL);
+
+    if((mapping = malloc(sizeof(mjpg_mapping))) == NULL) {
+        munmap(addr, stats.st_size);
+        return 1;
+    }
+    mapping->addr = addr;
+    mapping->length = stats.st_size;
+    mapping->refcount = 1;
+
+    if(mjpg_index_open(&frames, mjpg_file, mapping->addr, mapping->length) < 0 || frames.count == 0) {
+        IPRINT("ERROR: no frames found in %s\n", mjpg_file);
+        mjpg_index_free(&frames);
+        release_mapping(mapping);
+        mapping = NULL;
+        return 1;
+    }
+
+    IPRINT("frames............: %d\n", frames.count);
+    if(frames.timed && !delay_set) {
+        IPRINT("pacing............: timestamps of the index, %.1f s\n", frame_position(frames.count - 1) / 1000000.0);
+    } else {
+        IPRINT("forced delay......: %.4f\n", delay);
+    }
+    IPRINT("start.............: %.1f s\n", start);
+    IPRINT("loop..............: %s\n", loop ? "yes" : "no");
+
+    /* the position can be changed while playing */
+    memset(&position, 0, sizeof(position));
+    position.group = IN_CMD_GENERIC;
+    position.menuitems = NULL;
+    position.value = start;
+    position.ctrl.id = POSITION_CONTROL_ID;
+    position.ctrl.type = V4L2_CTRL_TYPE_INTEGER;
+    strcpy((char*) position.ctrl.name, "Position (s)");
+    position.ctrl.minimum = 0;
+    position.ctrl.maximum = frame_position(frames.count - 1) / 1000000;
+    position.ctrl.step = 1;
+    position.ctrl.default_value = 0;
+    position.ctrl.flags = V4L2_CTRL_FLAG_SLIDER;
+
+    pglobal->in[id].in_parameters = malloc(sizeof(control));
+    pglobal->in[id].in_parameters[0] = position;
+    pglobal->in[id].parametercount = 1;
+
+    pglobal->in[id].name = strdup(INPUT_PLUGIN_NAME);
+    return 0;
+}
+
+/******************************************************************************
+Description.: publish the frames of the mjpg file straight from the mapping,
+              at the pace of their timestamps or of the delay
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void play_mjpg_file(void)
+{
+    unsigned long long base_usec = 0, base_position = 0, position, due, now;
+    int current = find_frame(1000 * 1000 * start);
+    pacer rate;
+    struct timeval timestamp;
+    mjpg_index_entry *entry;
+    input_frame *frame;
+
+    /* only measures, the frames are due by their position; the target is
+     * the average rate of the file */
+    pacer_init(&rate, 0, &pglobal->in[plugin_number]);
+    if(frame_position(frames.count - 1) > 0)
+        pglobal->in[plugin_number].stats.target_fps = (frames.count - 1) * 1000000.0 / frame_position(frames.count - 1);
+
+    while(!pglobal->stop) {
+        if(seek_to >= 0) {
+            current = find_frame(1000ULL * 1000 * seek_to);
+            seek_to = -1;
+            base_usec = 0;
+        }
+
+        if(current == frames.count) {
+            if(!loop) {
+                IPRINT("end of %s\n", mjpg_file);
+                break;
+            }
+            current = 0;
+            base_usec = 0;
+        }
+
+        /* the schedule starts over after a seek, a long gap in the
+         * recording or when we fell behind by more than a second */
+        position = frame_position(current);
+        now = monotonic_usec();
+        due = base_usec + (position - base_position);
+        if(base_usec == 0 || position < base_position || due > now + 10 * 1000 * 1000 || due + 1000 * 1000 < now) {
+            base_usec = now;
+            base_position = position;
+            due = now;
+        }
+        if(due > now)
+            sleep_until_usec(due);
+        pacer_wait(&rate);
+
+        entry = &frames.entries[current++];
+        __sync_add_and_fetch(&mapping->refcount, 1);
+        if((frame = frame_wrap(mapping->addr + entry->offset, entry->size, release_mapping, mapping)) == NULL) {
+            release_mapping(mapping);
+            break;
+        }
+
+        gettimeofday(&timestamp, NULL);
+        frame->timestamp = timestamp;
+        input_publish_frame(&pglobal->in[plugin_number], frame);
+
+        pglobal->in[plugin_number].in_parameters[0].value = position / 1000000;
+    }
+}
+
 /* the single writer thread */
 void *worker_thread(void *arg)
 {
@@ -242,23 +659,38 @@ void *worker_thread(void *arg)
     int file;
     size_t filesize = 0;
     struct stat stats;
-    struct dirent **fileList;
-    int fileCount = 0;
+    file_list files = { NULL, 0, 0 };
+    struct pollfd watch;
     int currentFileNumber = 0;
-    char hasJpgFile = 0;
     struct timeval timestamp;
+    input_frame *frame;
+    pacer pace;
+    int i;
 
     if (mode == ExistingFiles) {
-        fileCount = scandir(folder, &fileList, 0, alphasort);
-        if (fileCount < 0) {
+        /* the only full scan, the watch set up before keeps the list current */
+        if (file_list_scan(&files, folder) < 0) {
            perror("error during scandir\n");
            return NULL;
         }
+
+        /* the first files are read ahead, later each step adds one */
+        for(i = 0; i < prefetch && i < files.count; i++) {
+            snprintf(buffer, sizeof(buffer), "%s%s", folder, files.names[i]);
+            prefetch_file(buffer);
+        }
     }
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
+    if (mode == MjpgFile) {
+        play_mjpg_file();
+        goto thread_quit;
+    }
+
+    pacer_init(&pace, (delay > 0) ? 1 / delay : 0, &pglobal->in[plugin_number]);
+
     while(!pglobal->stop) {
         if (mode == NewFilesOnly) {
             /* wait for new frame, read will block until something happens */
@@ -289,27 +721,48 @@ void *worker_thread(void *arg)
             }
             DBG("new file detected: %s\n", buffer);
         } else {
-            if ((strstr(fileList[currentFileNumber]->d_name, ".jpg") != NULL) ||
-                (strstr(fileList[currentFileNumber]->d_name, ".JPG") != NULL)) {
-                hasJpgFile = 1;
-                DBG("serving file: %s\n", fileList[currentFileNumber]->d_name);
-                snprintf(buffer, sizeof(buffer), "%s%s", folder, fileList[currentFileNumber]->d_name);
-                currentFileNumber++;
-                if (currentFileNumber == fileCount)
-                    currentFileNumber = 0;
-            } else {
-                currentFileNumber++;
-                if (currentFileNumber == fileCount) {
-                    if(hasJpgFile == 0) {
-                        perror("No files with jpg/JPG extension in the folder\n");
-                        goto thread_quit;
-                    } else {
-                        // There are some jpeg files, the last one just happens not to be one
-                        currentFileNumber = 0;
-                    }
-                }
+            if (update_file_list(&files, &currentFileNumber) < 0)
+                break;
+
+            if (files.count == 0) {
+                fprintf(stderr, "No files with jpg/JPG extension in the folder, waiting for some\n");
+                watch.fd = fd;
+                watch.events = POLLIN;
+                poll(&watch, 1, -1);
+                continue;
+            }
+
+            if (prefetch > 0 && prefetch < files.count) {
+                snprintf(buffer, sizeof(buffer), "%s%s", folder, files.names[(currentFileNumber + prefetch) % files.count]);
+                prefetch_file(buffer);
+            }
+
+            DBG("serving file: %s\n", files.names[currentFileNumber]);
+            snprintf(buffer, sizeof(buffer), "%s%s", folder, files.names[currentFileNumber]);
+            currentFileNumber++;
+            if (currentFileNumber == files.count)
+                currentFileNumber = 0;
+
+            /* the file may be gone already, its event removes it soon */
+            if((frame = map_file(buffer)) == NULL) {
+                pacer_wait(&pace);
                 continue;
             }
+
+            gettimeofday(&timestamp, NULL);
+            frame->timestamp = timestamp;
+            DBG("new frame mapped (size: %d)\n", frame->size);
+            input_publish_frame(&pglobal->in[plugin_number], frame);
+
+            if(rm) {
+                rc = unlink(buffer);
+                if(rc == -1) {
+                    perror("could not remove/delete file");
+                }
+            }
+
+            pacer_wait(&pace);
+            continue;
         }
 
         /* open file for reading */
@@ -329,34 +782,26 @@ void *worker_thread(void *arg)
 
         filesize = stats.st_size;
 
-        /* copy frame from file to global buffer */
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
-
-        /* allocate memory for frame */
-        if(pglobal->in[plugin_number].buf != NULL)
-            free(pglobal->in[plugin_number].buf);
-
-        pglobal->in[plugin_number].buf = malloc(filesize + (1 << 16));
-
-        if(pglobal->in[plugin_number].buf == NULL) {
+        /* read the file into a fresh frame */
+        if((frame = frame_alloc(filesize)) == NULL) {
             fprintf(stderr, "could not allocate memory\n");
+            close(file);
             break;
         }
 
-        if((pglobal->in[plugin_number].size = read(file, pglobal->in[plugin_number].buf, filesize)) == -1) {
+        if((frame->size = read(file, frame->buf, filesize)) == -1) {
             perror("could not read from file");
-            free(pglobal->in[plugin_number].buf); pglobal->in[plugin_number].buf = NULL; pglobal->in[plugin_number].size = 0;
-            pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+            frame_unref(frame);
             close(file);
             break;
         }
 
         gettimeofday(&timestamp, NULL);
-        pglobal->in[plugin_number].timestamp = timestamp;
-        DBG("new frame copied (size: %d)\n", pglobal->in[plugin_number].size);
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-        pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+        frame->timestamp = timestamp;
+        DBG("new frame copied (size: %d)\n", frame->size);
+
+        /* hand the frame over to the output plugins and signal fresh_frame */
+        input_publish_frame(&pglobal->in[plugin_number], frame);
 
         close(file);
 
@@ -368,15 +813,11 @@ void *worker_thread(void *arg)
             }
         }
 
-        if(delay != 0)
-            usleep(1000 * 1000 * delay);
+        pacer_wait(&pace);
     }
 
 thread_quit:
-    while (fileCount--) {
-       free(fileList[fileCount]);
-    }
-    free(fileList);
+    file_list_free(&files);
 
     DBG("leaving input thread, calling cleanup function now\n");
     /* call cleanup handler, signal with the parameter */
@@ -397,11 +838,14 @@ void worker_cleanup(void *arg)
     first_run = 0;
     DBG("cleaning up resources allocated by input thread\n");
 
-    if(pglobal->in[plugin_number].buf != NULL) free(pglobal->in[plugin_number].buf);
-
     free(ev);
 
-    if (mode == NewFilesOnly) {
+    if (mode == MjpgFile) {
+        mjpg_index_free(&frames);
+        release_mapping(mapping);
+    }
+
+    if (mode != MjpgFile) {
         rc = inotify_rm_watch(fd, wd);
         if(rc == -1) {
             perror("could not close watch descriptor");
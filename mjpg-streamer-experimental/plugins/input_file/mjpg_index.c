@@ -0,0 +1,301 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "mjpg_index.h"
+
+/******************************************************************************
+Description.: append a frame to the index, the array grows geometrically
+Input Value.: * index.....: the index
+              * offset....: of the frame in the file
+              * size......: of the frame
+              * timestamp.: in microseconds, 0 if unknown
+Return Value: 0 if ok, -1 without memory
+******************************************************************************/
+static int add_entry(mjpg_index *index, off_t offset, int size, unsigned long long timestamp)
+{
+    mjpg_index_entry *entries;
+    int capacity;
+
+    if(index->count == index->capacity) {
+        capacity = index->capacity ? 2 * index->capacity : 1024;
+        if((entries = realloc(index->entries, capacity * sizeof(mjpg_index_entry))) == NULL)
+            return -1;
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+
+    index->entries[index->count].offset = offset;
+    index->entries[index->count].size = size;
+    index->entries[index->count].timestamp = timestamp;
+    index->count++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: find the end of the JPEG at data by walking its segments, an
+              EOI inside the thumbnail of an APP segment is skipped that way
+Input Value.: * data..: the JPEG, starting with its SOI
+              * length: bytes available at data
+Return Value: the length of the JPEG including its EOI, -1 if it is broken
+******************************************************************************/
+static long jpeg_length(const unsigned char *data, size_t length)
+{
+    const unsigned char *ff;
+    size_t i = 2;
+    int marker;
+
+    if(length < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return -1;
+
+    while(i + 2 <= length) {
+        if(data[i] != 0xFF)
+            return -1;
+
+        marker = data[i + 1];
+        if(marker == 0xFF) {            /* fill byte */
+            i++;
+            continue;
+        }
+        if(marker == 0xD9)              /* EOI */
+            return i + 2;
+        if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            i += 2;
+            continue;
+        }
+
+        if(i + 4 > length || ((data[i + 2] << 8) | data[i + 3]) < 2)
+            return -1;
+        i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+
+        if(marker != 0xDA)
+            continue;
+
+        /* entropy coded data up to the next marker, stuffed bytes and
+         * restart markers belong to it */
+        while(i + 1 < length) {
+            if((ff = memchr(data + i, 0xFF, length - i - 1)) == NULL) {
+                i = length;
+                break;
+            }
+            i = ff - data;
+            marker = data[i + 1];
+            if(marker == 0x00 || (marker >= 0xD0 && marker <= 0xD7))
+                i += 2;
+            else if(marker == 0xFF)
+                i++;
+            else
+                break;
+        }
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: find the frames of the file by looking for SOI markers and
+              walking each JPEG up to its EOI, garbage in between is skipped
+Input Value.: * index.: the empty index to fill
+              * data..: the mapped file
+              * length: its length
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int scan_file(mjpg_index *index, const unsigned char *data, size_t length)
+{
+    const unsigned char *soi;
+    size_t position = 0;
+    long size;
+
+    while(position + 4 <= length) {
+        if((soi = memmem(data + position, length - position, "\xFF\xD8\xFF", 3)) == NULL)
+            break;
+        position = soi - data;
+
+        if((size = jpeg_length(soi, length - position)) < 0 || size > INT_MAX) {
+            position += 2;
+            continue;
+        }
+
+        if(add_entry(index, position, size, 0) < 0)
+            return -1;
+        position += size;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: read the sidecar index, if it was written after the file and
+              matches its size
+Input Value.: * index.: the empty index to fill
+              * name..: of the index file
+              * data..: the mapped file
+              * length: its length
+Return Value: 0 if the index can be used, -1 otherwise
+******************************************************************************/
+static int load_index(mjpg_index *index, const char *name, const unsigned char *data, size_t length)
+{
+    char line[128];
+    long long offset;
+    unsigned long long timestamp;
+    int size;
+    off_t end = 0, scanned = -1;
+    FILE *file;
+
+    if((file = fopen(name, "r")) == NULL)
+        return -1;
+
+    while(fgets(line, sizeof(line), file) != NULL) {
+        if(line[0] == '#') {
+            if(sscanf(line, "# length %lld", &offset) == 1)
+                scanned = offset;
+            continue;
+        }
+
+        /* frames must follow each other and stay inside the file */
+        if(sscanf(line, "%lld %d %llu", &offset, &size, &timestamp) != 3 ||
+           offset < end || size <= 0 || (size_t)offset + size > length ||
+           add_entry(index, offset, size, timestamp) < 0) {
+            fclose(file);
+            return -1;
+        }
+        end = offset + size;
+    }
+    fclose(file);
+
+    /* a recording which went on or a rewritten file needs a new index,
+     * a scanned one may end before garbage at the end of the file */
+    if(index->count == 0 || (size_t)(scanned >= 0 ? scanned : end) != length)
+        return -1;
+    if(data[index->entries[0].offset] != 0xFF || data[index->entries[0].offset + 1] != 0xD8)
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: write the index next to the file for the next start
+Input Value.: * index.: the index
+              * name..: of the index file
+              * length: of the mjpg file
+Return Value: -
+******************************************************************************/
+static void save_index(mjpg_index *index, const char *name, size_t length)
+{
+    FILE *file;
+    int i;
+
+    if((file = fopen(name, "w")) == NULL) {
+        IPRINT("could not write the index %s, it is built again next time\n", name);
+        return;
+    }
+
+    fputs(MJPG_INDEX_HEADER, file);
+    fprintf(file, "# length %lld\n", (long long)length);
+    for(i = 0; i < index->count; i++)
+        fprintf(file, "%lld %d %llu\n", (long long)index->entries[i].offset, index->entries[i].size, index->entries[i].timestamp);
+
+    if(fclose(file) != 0) {
+        IPRINT("could not write the index %s\n", name);
+        unlink(name);
+    }
+}
+
+/******************************************************************************
+Description.: get the frames of an mjpg file, from its index file or by
+              scanning it, a new index is saved for the next time
+Input Value.: * index.: to fill
+              * path..: of the mjpg file
+              * data..: the mapped file
+              * length: its length
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+int mjpg_index_open(mjpg_index *index, const char *path, const unsigned char *data, size_t length)
+{
+    struct stat file_stats, index_stats;
+    char *name;
+    int i;
+
+    memset(index, 0, sizeof(*index));
+
+    if((name = malloc(strlen(path) + strlen(MJPG_INDEX_SUFFIX) + 1)) == NULL)
+        return -1;
+    sprintf(name, "%s%s", path, MJPG_INDEX_SUFFIX);
+
+    if(stat(path, &file_stats) == 0 && stat(name, &index_stats) == 0 &&
+       index_stats.st_mtime >= file_stats.st_mtime &&
+       load_index(index, name, data, length) == 0) {
+        IPRINT("index.............: %s\n", name);
+    } else {
+        IPRINT("index.............: scanning %s\n", path);
+        mjpg_index_free(index);
+        if(scan_file(index, data, length) < 0) {
+            free(name);
+            return -1;
+        }
+        save_index(index, name, length);
+    }
+    free(name);
+
+    index->timed = index->count > 0;
+    for(i = 0; i < index->count; i++) {
+        if(index->entries[i].timestamp == 0)
+            index->timed = 0;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: look up a position of a timed index
+Input Value.: * index....: the index
+              * timestamp: in microseconds
+Return Value: the first frame at or after the timestamp, the last one if
+              there is none
+******************************************************************************/
+int mjpg_index_find(mjpg_index *index, unsigned long long timestamp)
+{
+    int low = 0, high = index->count - 1, middle;
+
+    while(low < high) {
+        middle = (low + high) / 2;
+        if(index->entries[middle].timestamp < timestamp)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void mjpg_index_free(mjpg_index *index)
+{
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
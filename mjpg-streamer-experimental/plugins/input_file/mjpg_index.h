@@ -0,0 +1,52 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef MJPG_INDEX_H
+#define MJPG_INDEX_H
+
+#include <sys/types.h>
+
+/*
+ * the frames of a file of concatenated JPEGs, like output_file --mjpeg
+ * records them. The index is kept next to the file as <file>.idx, a text
+ * file with a line "offset size timestamp" per frame, the timestamp in
+ * microseconds or 0 if it is not known.
+ */
+#define MJPG_INDEX_SUFFIX ".idx"
+#define MJPG_INDEX_HEADER "# mjpg-streamer index: offset size timestamp_usec\n"
+
+typedef struct _mjpg_index_entry {
+    off_t offset;
+    int size;
+    unsigned long long timestamp;
+} mjpg_index_entry;
+
+typedef struct _mjpg_index {
+    mjpg_index_entry *entries;
+    int count;
+    int capacity;
+    int timed;      // all frames carry a timestamp
+} mjpg_index;
+
+int mjpg_index_open(mjpg_index *index, const char *path, const unsigned char *data, size_t length);
+int mjpg_index_find(mjpg_index *index, unsigned long long timestamp);
+void mjpg_index_free(mjpg_index *index);
+
+#endif
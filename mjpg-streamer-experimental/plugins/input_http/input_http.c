@@ -51,7 +51,10 @@ void worker_cleanup(void *);
 
 #define INPUT_PLUGIN_NAME "HTTP Input plugin"
 
-struct extractor_state  proxy;
+/* one state per upstream, all of them are served by the worker thread */
+static struct extractor_state proxies[MAX_UPSTREAMS];
+static struct extractor_state *states[MAX_UPSTREAMS];
+static int proxy_count;
 
 /*** plugin interface functions ***/
 
@@ -64,7 +67,10 @@ Return Value: 0 if everything is ok
 
 int input_init(input_parameter *param, int plugin_no)
 {
-    int i;
+    char *urls[MAX_UPSTREAMS];
+    int i, url_count;
+
+    plugin_number = plugin_no;
 
     if(pthread_mutex_init(&controls_mutex, NULL) != 0) {
         IPRINT("could not initialize mutex variable\n");
@@ -77,16 +83,61 @@ int input_init(input_parameter *param, int plugin_no)
     for(i = 0; i < param->argc; i++) {
         DBG("argv[%d]=%s\n", i, param->argv[i]);
     }
-    init_mjpg_proxy( &proxy );
+    init_mjpg_proxy(&proxies[0]);
 
     reset_getopt();
-    if (parse_cmd_line(&proxy, param->argc, param->argv))
+    if (parse_cmd_line(&proxies[0], param->argc, param->argv, urls, &url_count))
        return 1;
 
     pglobal = param->global;
+    proxies[0].id = plugin_no;
+    proxy_count = 1;
+
+    /* without --url the stream of --host and --port is relayed */
+    for(i = 0; i < url_count; i++) {
+        struct extractor_state *state = &proxies[i];
+
+        if(i > 0) {
+            init_mjpg_proxy(state);
+            state->timeout_ms = proxies[0].timeout_ms;
+            state->poll_usec = proxies[0].poll_usec;
+            state->jitter_usec = proxies[0].jitter_usec;
+            if((state->id = input_add(&pglobal->in[plugin_no])) < 0) {
+                IPRINT("no input left for %s\n", urls[i]);
+                close_mjpg_proxy(state);
+                return 1;
+            }
+            proxy_count++;
+        }
+        if(set_url(state, urls[i]) < 0) {
+            IPRINT("invalid URL: %s\n", urls[i]);
+            return 1;
+        }
+    }
 
-    IPRINT("host.............: %s\n", proxy.hostname);
-    IPRINT("port.............: %s\n", proxy.port);
+    for(i = 0; i < proxy_count; i++) {
+        IPRINT("input %d..........: http://%s:%s%s%s\n", proxies[i].id,
+               proxies[i].hostname, proxies[i].port, proxies[i].path,
+               proxies[i].credentials ? " (with credentials)" : "");
+    }
+    IPRINT("stall timeout....: %d ms\n", proxies[0].timeout_ms);
+    if(proxies[0].poll_usec > 0) {
+        IPRINT("polling..........: %.2f fps, %d requests in flight\n", 1000000.0 / proxies[0].poll_usec, POLL_DEPTH);
+    }
+    if(proxies[0].jitter_usec > 0) {
+        IPRINT("playout buffer...: up to %llu ms, %d frames\n", proxies[0].jitter_usec / 1000, JITTER_FRAMES);
+    }
+
+    /* the inputs of the plugin share its --numa */
+    for(i = 0; i < proxy_count; i++) {
+        proxies[i].numa = pglobal->in[plugin_no].numa_node;
+        proxies[i].stats = &pglobal->in[proxies[i].id].stats;
+    }
+    if(proxies[0].numa == NUMA_NIC) {
+        IPRINT("frames on node...: of the network card\n");
+    } else if(proxies[0].numa >= 0) {
+        IPRINT("frames on node...: %d\n", proxies[0].numa);
+    }
 
     return 0;
 }
@@ -98,6 +149,10 @@ Return Value: 0
 ******************************************************************************/
 int input_stop(int id)
 {
+    /* the other upstreams share the worker of the first */
+    if(id != plugin_number)
+        return 0;
+
     DBG("will cancel input thread\n");
     pthread_cancel(worker);
     return 0;
@@ -110,14 +165,10 @@ Return Value: 0
 ******************************************************************************/
 int input_run(int id)
 {
-    pglobal->in[id].buf = malloc(256 * 1024);
-    if(pglobal->in[id].buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
-    }
+    if(id != plugin_number)
+        return 0;
 
     if(pthread_create(&worker, 0, worker_thread, NULL) != 0) {
-        free(pglobal->in[id].buf);
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
@@ -127,28 +178,25 @@ int input_run(int id)
 }
 
 
-void on_image_received(char * data, int length){
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
-
-        pglobal->in[plugin_number].size = length;
-        memcpy(pglobal->in[plugin_number].buf, data, pglobal->in[plugin_number].size);
-
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-        pthread_mutex_unlock(&pglobal->in[plugin_number].db);
-
+void on_image_received(struct extractor_state * state, input_frame * frame){
+        /* the JPG picture was received into the frame, signal fresh_frame */
+        gettimeofday(&frame->timestamp, NULL);
+        input_publish_frame(&pglobal->in[state->id], frame);
 }
 
 void *worker_thread(void *arg)
 {
+    int i;
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
-    proxy.on_image_received = on_image_received;
-    proxy.should_stop =  & pglobal->stop;
-    connect_and_stream(&proxy);
+    for(i = 0; i < proxy_count; i++) {
+        proxies[i].on_image_received = on_image_received;
+        proxies[i].should_stop = &pglobal->stop;
+        states[i] = &proxies[i];
+    }
+    connect_and_stream(states, proxy_count, &pglobal->stop);
 
     IPRINT("leaving input thread, calling cleanup function now\n");
     pthread_cleanup_pop(1);
@@ -164,6 +212,7 @@ Return Value: -
 void worker_cleanup(void *arg)
 {
     static unsigned char first_run = 1;
+    int i;
 
     if(!first_run) {
         DBG("already cleaned up resources\n");
@@ -172,8 +221,8 @@ void worker_cleanup(void *arg)
 
     first_run = 0;
     DBG("cleaning up resources allocated by input thread\n");
-    close_mjpg_proxy(&proxy);
-    if(pglobal->in[plugin_number].buf != NULL) free(pglobal->in[plugin_number].buf);
+    for(i = 0; i < proxy_count; i++)
+        close_mjpg_proxy(&proxies[i]);
 }
 
 
@@ -0,0 +1,159 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jitter.h"
+
+void jitter_init(jitter_buffer * jb, unsigned long long target_usec, input_stats * stats) {
+    memset(jb, 0, sizeof(*jb));
+    jb->target_usec = target_usec;
+    jb->stats = stats;
+    if (stats != NULL)
+        stats->playout_target_usec = target_usec;
+}
+
+// the shortest transit is looked for again, after a break in the stream or a
+// jump of the clock of the upstream
+static void restart_transit(jitter_buffer * jb, long long transit, unsigned long long now) {
+    jb->transit[0] = jb->transit[1] = transit;
+    jb->window_usec = now;
+}
+
+// measures how far the interval of the picture which arrived now is off
+static void measure(jitter_buffer * jb, unsigned long long timestamp_usec, unsigned long long now) {
+    unsigned long long gap = now - jb->arrival_usec, expected, deviation;
+    long long transit = (long long)now - (long long)timestamp_usec;
+    int timed = timestamp_usec != 0 && jb->timestamp_usec != 0 && timestamp_usec > jb->timestamp_usec &&
+                timestamp_usec - jb->timestamp_usec < JITTER_GAP_USEC;
+
+    if (!jb->started || gap > JITTER_GAP_USEC) {
+        restart_transit(jb, transit, now);
+        return;
+    }
+
+    if (timestamp_usec != 0) {
+        if (!timed)
+            restart_transit(jb, transit, now);
+        else if (now - jb->window_usec >= JITTER_WINDOW_USEC) {
+            jb->transit[1] = jb->transit[0];
+            jb->transit[0] = transit;
+            jb->window_usec = now;
+        } else if (transit < jb->transit[0]) {
+            jb->transit[0] = transit;
+        }
+    }
+
+    // the upstream tells the interval, otherwise it is the one of the arrivals on average
+    expected = timed ? timestamp_usec - jb->timestamp_usec : jb->interval_usec;
+    if (expected > 0) {
+        deviation = gap > expected ? gap - expected : expected - gap;
+        jb->jitter_usec = (15 * jb->jitter_usec + deviation) / 16;
+    }
+    if (timed)
+        gap = expected;
+    jb->interval_usec = jb->interval_usec ? (7 * jb->interval_usec + gap) / 8 : gap;
+}
+
+// takes a complete picture, returns the oldest one to be published right away
+// if the buffer is full, NULL otherwise
+input_frame * jitter_put(jitter_buffer * jb, input_frame * frame, unsigned long long timestamp_usec, unsigned long long now) {
+    unsigned long long wanted, play;
+    long long transit;
+    input_frame * out = NULL;
+    jitter_slot * slot;
+
+    measure(jb, timestamp_usec, now);
+
+    // the delay grows at once and shrinks slowly, so it hardly moves the pictures
+    wanted = 3 * jb->jitter_usec;
+    if (wanted > jb->target_usec)
+        wanted = jb->target_usec;
+    if (wanted > jb->delay_usec)
+        jb->delay_usec = wanted;
+    else
+        jb->delay_usec -= (jb->delay_usec - wanted) / 64;
+
+    transit = jb->transit[0] < jb->transit[1] ? jb->transit[0] : jb->transit[1];
+    if (timestamp_usec != 0)
+        play = (unsigned long long)((long long)timestamp_usec + transit) + jb->delay_usec;
+    else if (jb->started)
+        play = jb->play_usec + jb->interval_usec;
+    else
+        play = now;
+    if (play < now)
+        play = now;
+    if (play > now + jb->delay_usec)
+        play = now + jb->delay_usec;
+    // the pictures are never reordered
+    if (play < jb->play_usec)
+        play = jb->play_usec;
+
+    if (jb->count == JITTER_FRAMES) {
+        out = jb->slots[jb->head].frame;
+        jb->head = (jb->head + 1) % JITTER_FRAMES;
+        jb->count--;
+    }
+    slot = &jb->slots[(jb->head + jb->count) % JITTER_FRAMES];
+    slot->frame = frame;
+    slot->play_usec = play;
+    jb->count++;
+
+    jb->started = 1;
+    jb->arrival_usec = now;
+    jb->timestamp_usec = timestamp_usec;
+    jb->play_usec = play;
+
+    if (jb->stats != NULL) {
+        jb->stats->jitter_usec = jb->jitter_usec;
+        jb->stats->playout_delay_usec = jb->delay_usec;
+        jb->stats->playout_depth = jb->count;
+    }
+    return out;
+}
+
+// returns the next picture which is due, NULL if there is none
+input_frame * jitter_get(jitter_buffer * jb, unsigned long long now) {
+    input_frame * frame;
+
+    if (jb->count == 0 || jb->slots[jb->head].play_usec > now)
+        return NULL;
+
+    frame = jb->slots[jb->head].frame;
+    jb->head = (jb->head + 1) % JITTER_FRAMES;
+    jb->count--;
+    if (jb->stats != NULL)
+        jb->stats->playout_depth = jb->count;
+    return frame;
+}
+
+// tells when the next picture is due, 0 if the buffer is empty
+unsigned long long jitter_next(jitter_buffer * jb) {
+    return jb->count > 0 ? jb->slots[jb->head].play_usec : 0;
+}
+
+void jitter_free(jitter_buffer * jb) {
+    while (jb->count > 0) {
+        frame_unref(jb->slots[jb->head].frame);
+        jb->head = (jb->head + 1) % JITTER_FRAMES;
+        jb->count--;
+    }
+}
@@ -0,0 +1,69 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef JITTER_H
+#define JITTER_H
+
+#include "../../mjpg_streamer.h"
+
+/*
+ * a playout buffer, which holds the pictures of an upstream for a moment and
+ * publishes them at an even pace although they arrive in bursts. With the
+ * X-Timestamp of the upstream a picture is played at its timestamp plus the
+ * shortest transit seen lately plus the delay, without it one interval after
+ * the previous one, but no sooner than it arrived and no later than the delay
+ * after that. The delay follows three times the jitter of the frame
+ * intervals, up to the target of --jitter, and shrinks only slowly.
+ */
+#define JITTER_FRAMES 32
+#define JITTER_WINDOW_USEC 4000000ULL
+#define JITTER_GAP_USEC 2000000ULL
+
+typedef struct {
+    input_frame * frame;
+    unsigned long long play_usec;       // monotonic_usec() it is published at
+} jitter_slot;
+
+typedef struct {
+    unsigned long long target_usec;     // longest delay, 0 publishes right away
+    unsigned long long delay_usec;      // the current one
+    jitter_slot slots[JITTER_FRAMES];
+    int head, count;
+
+    // of the previous picture, the timestamp is 0 without X-Timestamp
+    int started;
+    unsigned long long arrival_usec, timestamp_usec, play_usec;
+    unsigned long long interval_usec;   // smoothed frame interval
+    unsigned long long jitter_usec;     // smoothed deviation from it
+
+    // the shortest transit (arrival - timestamp) of this and of the last window
+    long long transit[2];
+    unsigned long long window_usec;     // start of this window
+
+    input_stats * stats;                // gets the jitter, delay and depth, or NULL
+} jitter_buffer;
+
+void jitter_init(jitter_buffer * jb, unsigned long long target_usec, input_stats * stats);
+input_frame * jitter_put(jitter_buffer * jb, input_frame * frame, unsigned long long timestamp_usec, unsigned long long now);
+input_frame * jitter_get(jitter_buffer * jb, unsigned long long now);
+unsigned long long jitter_next(jitter_buffer * jb);
+void jitter_free(jitter_buffer * jb);
+
+#endif
@@ -41,6 +41,24 @@ int min(int a, int b) {
         return b;
 }
 
+void base64_encode(const unsigned char * data, int length, char * out) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned int v;
+    int i;
+
+    for (i = 0; i < length; i += 3) {
+        v = data[i] << 16;
+        if (i + 1 < length) v |= data[i + 1] << 8;
+        if (i + 2 < length) v |= data[i + 2];
+
+        *out++ = alphabet[(v >> 18) & 0x3f];
+        *out++ = alphabet[(v >> 12) & 0x3f];
+        *out++ = (i + 1 < length) ? alphabet[(v >> 6) & 0x3f] : '=';
+        *out++ = (i + 2 < length) ? alphabet[v & 0x3f] : '=';
+    }
+    *out = '\0';
+}
+
 
 void search_pattern_reset(struct search_pattern * pattern) {
     pattern->current_matched_char = pattern->string;
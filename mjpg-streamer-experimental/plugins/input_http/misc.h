@@ -22,6 +22,9 @@
 int min(int a, int b);
 void write_image(char * image, int length);
 
+// out takes 4 * ((length + 2) / 3) + 1 bytes
+void base64_encode(const unsigned char * data, int length, char * out);
+
 // dumb 4 byte storing to detect double CRLF
 int is_crlf(int bytes);
 
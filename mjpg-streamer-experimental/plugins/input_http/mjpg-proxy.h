@@ -20,7 +20,9 @@
 #ifndef MJPG_PROXY_H
 #define MJPG_PROXY_H
 
+#include "../../mjpg_streamer.h"
 #include "misc.h"
+#include "jitter.h"
 
 
 #ifndef DBG
@@ -31,35 +33,94 @@
 #endif
 #endif
 
-#define BUFFER_SIZE 1024 * 256
+/* a --url takes an argument, the plugin can not get more of them */
+#define MAX_UPSTREAMS MAX_PLUGIN_ARGUMENTS
+#define MAX_IMAGE_SIZE (32 * 1024 * 1024)
+#define MIN_IMAGE_SIZE (64 * 1024)
+#define HEADER_SIZE 1024
+#define BOUNDARY_SIZE 128
+/* requests a polled upstream has in flight at once */
+#define POLL_DEPTH 2
 
 struct extractor_state {
     
     char * port;
     char * hostname;
+    char * path;
+    char * credentials;     // base64 of user:password, NULL without authentication
+    int id;                 // the input the images are published to
+    int numa;               // node of the frames, NUMA_NIC or -1 for any
+    int node;               // node of the frames of this connection
 
-    // this is current result
-    char buffer [BUFFER_SIZE];
+    // this is current result, a pooled frame which grows as needed and is
+    // handed over to on_image_received once it is complete
+    input_frame * frame;
     int length;
+    int last_length;        // of the previous image, to size the next frame
 
     // this is inner state of a parser
 
     int sockfd;
+    int connected;          // FALSE, while connecting or TRUE
+    struct resolver * resolve;      // the name being resolved by a thread, NULL without
+    struct addrinfo * addresses;    // of the last resolution, kept for reconnecting
+    unsigned long long retry_usec;  // monotonic_usec() of the next connection attempt
+    int backoff_ms;         // delay before the attempt after that
+    unsigned long long data_usec;   // monotonic_usec() when data arrived last
+    int timeout_ms;         // reconnect after this long without data, 0 never
+    int broken;             // the response can not be used, reconnect
     int part;
-    int last_four_bytes;
-    struct search_pattern contentlength;
-    struct search_pattern boundary;
+
+    // the header line being read and the number of lines of this header
+    char header [HEADER_SIZE];
+    int header_length;
+    int header_lines;
+    int response;           // the header is the one of the HTTP response
+    int body;               // the response header is over, the parts follow
+    int status;             // of the response
+
+    // the transfer coding of an HTTP/1.1 response
+    int chunked;
+    int chunk_left;         // data bytes of the current chunk still to come
+    int chunk_size;         // size of the next chunk, while its line is read
+    int chunk_digits;       // the size line had digits
+    int chunk_extension;    // the rest of the size line is ignored
+
+    int content_length;     // of the current part, -1 if the server did not send it
+    unsigned long long timestamp_usec;  // X-Timestamp of the current part, 0 without
+    int skip;               // bytes of a part too big for a frame still to drop
+    int overflow;           // the part without length did not fit, it is dropped
+    char boundary [BOUNDARY_SIZE];  // CRLF and the delimiter line of the parts
+
+    // --poll: snapshots requested at a rate on the keep-alive connection, the
+    // next request is sent before the previous response is in
+    unsigned long long poll_usec;       // interval of the requests, 0 for a stream
+    unsigned long long next_poll_usec;  // monotonic_usec() the next request is due
+    unsigned long long sent_usec[POLL_DEPTH];  // of the requests in flight, oldest first
+    int in_flight;
+    unsigned long long rtt_usec;        // smoothed time from a request to its picture
+    unsigned long long window_usec;     // start of the second the rate is measured in
+    int window_frames;
+    input_stats * stats;                // of the input, for the rate and late responses
+
+    // --jitter: the pictures are published from a playout buffer
+    unsigned long long jitter_usec;     // longest delay, 0 publishes them as they arrive
+    jitter_buffer jitter;
 
     int * should_stop;
-    void (*on_image_received)(char * data, int length);
+    void (*on_image_received)(struct extractor_state * state, input_frame * frame);
         
 };
 
 void init_mjpg_proxy(struct extractor_state  * state);
 
-int parse_cmd_line(struct extractor_state * out_state, int argc, char * argv []);
+int parse_cmd_line(struct extractor_state * out_state, int argc, char * argv [], char ** urls, int * url_count);
+
+int set_url(struct extractor_state * state, const char * url);
+
+int set_credentials(struct extractor_state * state, const char * credentials);
 
-void connect_and_stream(struct extractor_state * state);
+void connect_and_stream(struct extractor_state ** states, int count, int * should_stop);
 
 void close_mjpg_proxy(struct extractor_state * state);
 
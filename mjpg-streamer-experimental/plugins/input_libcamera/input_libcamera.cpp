@@ -29,19 +29,22 @@
 #include <syslog.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <errno.h>
 #include <signal.h>
 
 #include <linux/videodev2.h>
+#include <linux/dma-buf.h>
 
 #include <libcamera/libcamera.h>
 #include <memory>
 #include <iostream>
 #include <chrono>
 #include <queue>
+#include <map>
+#include <optional>
 #include <mutex>
-
-#include <jpeglib.h>
+#include <condition_variable>
 
 extern "C" {
 #include "../../mjpg_streamer.h"
@@ -68,6 +71,50 @@ static int height = 480;
 static int fps = 30;
 static int quality = 85;
 static int camera_id = 0;
+static const char *m2m_device = nullptr;
+static bool use_m2m = false;
+static int backend = -1;        // JPEG_BACKEND_*, -1 for libjpeg or m2m with -m2m
+static int threads = 0;         // of the slices, 0 for one per core
+static int kbps = 0;
+static int max_size = 0;
+static int buffer_count = 0;    // 0 leaves the number of requests to libcamera
+
+/* full resolution stream published as a second input, off with a width of 0 */
+static int still_width = 0;
+static int still_height = 0;
+static int still_fps = 1;
+static int still_quality = 85;
+static int still_id = -1;
+
+/* picks the quality of the next frame with -kbps or -maxsize */
+static rate_control rate;
+static int encode_quality = 85;
+
+/* the planes of a FrameBuffer, mapped once for the lifetime of the allocator */
+struct PlaneMapping {
+    int fd;
+    uint8_t *base;              // start of the mapping
+    size_t map_length;          // length of the mapping
+    const uint8_t *data[3];     // first byte of each plane
+    size_t length;              // length of all planes
+};
+
+/* a stream of the camera and the compressor kept for all of its frames */
+struct StreamEncoder {
+    int id;                     // the input the frames are published to
+    Stream *stream;
+    int width;
+    int height;
+    unsigned int stride;        // bytes per row of the first plane
+    bool yuv;                   // YUV420 instead of RGB888
+    int frames;                 // frames published so far
+
+    jpeg_backend *jpeg;         // compresses the frames, nullptr until the camera starts
+    int capacity;               // size of the frames the JPEGs are written to
+};
+
+static StreamEncoder preview;
+static StreamEncoder still;
 
 /* libcamera objects */
 class CameraContext {
@@ -77,11 +124,17 @@ public:
     std::unique_ptr<FrameBufferAllocator> allocator;
     std::unique_ptr<CameraConfiguration> config;
     std::vector<std::unique_ptr<Request>> requests;
+    std::vector<FrameBuffer *> preview_buffers;     // the preview buffer of each request
+    std::vector<FrameBuffer *> free_stills;         // still buffers not queued right now
+    unsigned long long next_still_usec;
+    std::map<const FrameBuffer *, PlaneMapping> mappings;
     std::queue<Request *> completed_requests;
     std::mutex queue_mutex;
+    std::condition_variable queue_cond;     // signals completed requests
+    int64_t last_sequence;                  // sensor frame of the last request, -1 before the first
     bool running;
 
-    CameraContext() : running(false) {}
+    CameraContext() : next_still_usec(0), last_sequence(-1), running(false) {}
 };
 
 static CameraContext *ctx = nullptr;
@@ -102,8 +155,91 @@ void help(void) {
     " [-y | --height]........: height of frame capture, default: %d\n" \
     " [-quality].............: set JPEG quality 0-100, default: %d\n" \
     " [-camera]...............: camera device number, default: %d\n" \
+    " [-m2m]..................: compress with a V4L2 mem2mem JPEG encoder,\n" \
+    "                           \"auto\" or its device\n" \
+    " [-encoder].............: compress with libjpeg, slices, turbojpeg, m2m\n" \
+    "                          or the fastest of them with auto, default:\n" \
+    "                          libjpeg, m2m with -m2m\n" \
+    " [-threads].............: threads of the slices, default: one per core\n" \
+    " [-kbps]................: lower the quality to stay below this bitrate\n" \
+    " [-maxsize].............: lower the quality to keep frames below this\n" \
+    "                          many bytes\n" \
+    " [-buffers].............: number of capture requests (2-32), default:\n" \
+    "                          chosen by libcamera\n" \
+    " [-still]...............: also capture WIDTHxHEIGHT frames from the same\n" \
+    "                          sensor and publish them as the next input\n" \
+    " [-stillfps]............: full resolution frames per second, default: %d\n" \
     " ---------------------------------------------------------------\n",
-    fps, width, height, quality, camera_id);
+    fps, width, height, quality, camera_id, still_fps);
+}
+
+/******************************************************************************
+Description.: map the planes of every buffer of the allocator, so frames
+              are read without a mmap per frame
+Input Value.: buffers - the buffers of the stream
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+static int map_buffers(const std::vector<std::unique_ptr<FrameBuffer>> &buffers) {
+    for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+        const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+        PlaneMapping m;
+        size_t end = 0;
+
+        if (planes.size() > 3) {
+            IPRINT("Unexpected number of planes: %zu\n", planes.size());
+            return -1;
+        }
+
+        /* the planes of a frame share one dmabuf, possibly at an offset */
+        m.fd = planes[0].fd.get();
+        for (const FrameBuffer::Plane &plane : planes) {
+            if (plane.fd.get() != m.fd) {
+                IPRINT("Planes in separate dmabufs are not supported\n");
+                return -1;
+            }
+            end = MAX(end, (size_t)plane.offset + plane.length);
+        }
+
+        m.map_length = end;
+        m.base = (uint8_t *)mmap(NULL, m.map_length, PROT_READ, MAP_SHARED, m.fd, 0);
+        if (m.base == MAP_FAILED) {
+            IPRINT("Failed to mmap frame buffer: %s\n", strerror(errno));
+            return -1;
+        }
+        for (unsigned int i = 0; i < 3; i++)
+            m.data[i] = (i < planes.size()) ? m.base + planes[i].offset : NULL;
+        m.length = end - planes[0].offset;
+
+        ctx->mappings[buffer.get()] = m;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: unmap all buffers mapped by map_buffers
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void unmap_buffers() {
+    for (auto &entry : ctx->mappings)
+        munmap(entry.second.base, entry.second.map_length);
+    ctx->mappings.clear();
+}
+
+/******************************************************************************
+Description.: begin or end reading a mapped dmabuf, cached mappings are
+              invalidated at the start so the CPU sees what the ISP wrote
+Input Value.: fd - the dmabuf
+              flags - DMA_BUF_SYNC_START or DMA_BUF_SYNC_END
+Return Value: -
+******************************************************************************/
+static void sync_buffer(int fd, __u64 flags) {
+    struct dma_buf_sync sync;
+
+    sync.flags = flags | DMA_BUF_SYNC_READ;
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0 && (errno == EINTR || errno == EAGAIN))
+        ;
 }
 
 /******************************************************************************
@@ -117,8 +253,34 @@ static void requestComplete(Request *request) {
     if (request->status() == Request::RequestCancelled)
         return;
 
-    std::lock_guard<std::mutex> lock(ctx->queue_mutex);
-    ctx->completed_requests.push(request);
+    {
+        std::lock_guard<std::mutex> lock(ctx->queue_mutex);
+        ctx->completed_requests.push(request);
+    }
+    ctx->queue_cond.notify_one();
+}
+
+/******************************************************************************
+Description.: take the configuration the camera chose for a stream
+Input Value.: enc - the encoder of the stream
+              config - its configuration after validation
+              id - the input its frames are published to
+Return Value: 0 on success, -1 if the format can not be encoded
+******************************************************************************/
+static int setup_stream(StreamEncoder *enc, StreamConfiguration &config, int id) {
+    if (config.pixelFormat != formats::RGB888 && config.pixelFormat != formats::YUV420) {
+        IPRINT("Pixel format %s is not supported\n", config.pixelFormat.toString().c_str());
+        return -1;
+    }
+
+    enc->id = id;
+    enc->stream = config.stream();
+    enc->width = config.size.width;
+    enc->height = config.size.height;
+    enc->stride = config.stride;
+    enc->yuv = (config.pixelFormat == formats::YUV420);
+    enc->frames = 0;
+    return 0;
 }
 
 /******************************************************************************
@@ -170,19 +332,36 @@ static int init_camera() {
 
     IPRINT("Using camera: %s\n", camera_name.c_str());
 
-    /* Configure camera */
-    ctx->config = ctx->camera->generateConfiguration({StreamRole::VideoRecording});
+    /*
+     * Configure camera. With a still stream it is the main output of the ISP
+     * and the preview its second one, which some pipelines only offer in
+     * YUV420 and never larger than the main output.
+     */
+    if (still_id >= 0)
+        ctx->config = ctx->camera->generateConfiguration({StreamRole::StillCapture, StreamRole::Viewfinder});
+    else
+        ctx->config = ctx->camera->generateConfiguration({StreamRole::VideoRecording});
     if (!ctx->config) {
         IPRINT("Failed to generate camera configuration\n");
         return -1;
     }
 
-    StreamConfiguration &streamConfig = ctx->config->at(0);
+    StreamConfiguration &streamConfig = ctx->config->at(still_id >= 0 ? 1 : 0);
     streamConfig.size.width = width;
     streamConfig.size.height = height;
 
     /* Use RGB888 format */
     streamConfig.pixelFormat = formats::RGB888;
+    if (buffer_count > 0)
+        streamConfig.bufferCount = buffer_count;
+
+    if (still_id >= 0) {
+        StreamConfiguration &stillConfig = ctx->config->at(0);
+        stillConfig.size.width = still_width;
+        stillConfig.size.height = still_height;
+        stillConfig.pixelFormat = formats::RGB888;
+        stillConfig.bufferCount = 2;
+    }
 
     /* Validate configuration */
     CameraConfiguration::Status validation = ctx->config->validate();
@@ -211,7 +390,9 @@ static int init_camera() {
            streamConfig.pixelFormat.toString().c_str(),
            streamConfig.size.width, streamConfig.size.height,
            streamConfig.stride);
-    IPRINT("Will encode to JPEG in software\n");
+
+    if (setup_stream(&preview, streamConfig, plugin_number) < 0)
+        return -1;
 
     /* Allocate buffers */
     ctx->allocator = std::make_unique<FrameBufferAllocator>(ctx->camera);
@@ -222,20 +403,67 @@ static int init_camera() {
         return -1;
     }
 
-    /* Create requests */
+    if (map_buffers(ctx->allocator->buffers(stream)) < 0)
+        return -1;
+
+    if (still_id >= 0) {
+        StreamConfiguration &stillConfig = ctx->config->at(0);
+
+        IPRINT("Still stream: %s (%dx%d, stride: %u)\n",
+               stillConfig.pixelFormat.toString().c_str(),
+               stillConfig.size.width, stillConfig.size.height,
+               stillConfig.stride);
+
+        if (setup_stream(&still, stillConfig, still_id) < 0)
+            return -1;
+
+        if (ctx->allocator->allocate(still.stream) < 0) {
+            IPRINT("Failed to allocate still buffers\n");
+            return -1;
+        }
+
+        if (map_buffers(ctx->allocator->buffers(still.stream)) < 0)
+            return -1;
+
+        for (const std::unique_ptr<FrameBuffer> &buffer : ctx->allocator->buffers(still.stream))
+            ctx->free_stills.push_back(buffer.get());
+    }
+
+    pglobal->in[plugin_number].stats.capture_buffers = ctx->allocator->buffers(stream).size();
+    IPRINT("Capture requests..: %zu\n", ctx->allocator->buffers(stream).size());
+
+    /* the still stream is compressed in software, the mem2mem device is kept for the preview */
+    jpeg_backend_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.backend = (backend >= 0) ? backend : (use_m2m ? JPEG_BACKEND_M2M : JPEG_BACKEND_LIBJPEG);
+    opts.device = m2m_device;
+    opts.threads = threads;
+    IPRINT("JPEG backend......: %s\n", jpeg_backend_name(opts.backend));
+    if ((preview.jpeg = jpeg_backend_new(&opts)) == nullptr)
+        return -1;
+    if (still_id >= 0) {
+        if (opts.backend == JPEG_BACKEND_M2M)
+            opts.backend = JPEG_BACKEND_LIBJPEG;
+        if ((still.jpeg = jpeg_backend_new(&opts)) == nullptr)
+            return -1;
+    }
+
+    /* Create requests, still buffers are added to some of them when they are queued */
     const std::vector<std::unique_ptr<FrameBuffer>> &buffers = ctx->allocator->buffers(stream);
     for (unsigned int i = 0; i < buffers.size(); ++i) {
-        std::unique_ptr<Request> request = ctx->camera->createRequest();
+        std::unique_ptr<Request> request = ctx->camera->createRequest(i);
         if (!request) {
             IPRINT("Failed to create request\n");
             return -1;
         }
 
         const std::unique_ptr<FrameBuffer> &buffer = buffers[i];
+        buffer->setCookie(i);
         if (request->addBuffer(stream, buffer.get())) {
             IPRINT("Failed to add buffer to request\n");
             return -1;
         }
+        ctx->preview_buffers.push_back(buffer.get());
 
         /* Set frame rate control */
         ControlList &controls = request->controls();
@@ -253,6 +481,33 @@ static int init_camera() {
     return 0;
 }
 
+/******************************************************************************
+Description.: Queue a request again, with a still buffer if one is due
+Input Value.: request - a completed request
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+static int requeue_request(Request *request) {
+    if (still_id < 0) {
+        request->reuse(Request::ReuseBuffers);
+        return ctx->camera->queueRequest(request) ? -1 : 0;
+    }
+
+    request->reuse();
+    if (request->addBuffer(preview.stream, ctx->preview_buffers[request->cookie()]))
+        return -1;
+
+    /* the ISP writes full resolution frames only as often as -stillfps asks */
+    unsigned long long now = monotonic_usec();
+    if (!ctx->free_stills.empty() && now >= ctx->next_still_usec) {
+        if (request->addBuffer(still.stream, ctx->free_stills.back()) == 0) {
+            ctx->free_stills.pop_back();
+            ctx->next_still_usec = now + 1000000 / still_fps;
+        }
+    }
+
+    return ctx->camera->queueRequest(request) ? -1 : 0;
+}
+
 /******************************************************************************
 Description.: Start camera capture
 Input Value.: -
@@ -299,6 +554,11 @@ static void stop_camera() {
     }
 
     ctx->camera->requestCompleted.disconnect(requestComplete);
+    jpeg_backend_free(preview.jpeg);
+    preview.jpeg = nullptr;
+    jpeg_backend_free(still.jpeg);
+    still.jpeg = nullptr;
+    unmap_buffers();
     ctx->allocator.reset();
     ctx->requests.clear();
 
@@ -313,179 +573,169 @@ static void stop_camera() {
 }
 
 /******************************************************************************
-Description.: Encode RGB to JPEG with R/B swap
-Input Value.: rgb_data - pointer to RGB888 data
-              width, height - image dimensions
-              jpeg_data - output buffer pointer (will be allocated)
-              jpeg_size - output size pointer
-Return Value: 0 on success, -1 on error
+Description.: Encode a frame to JPEG, straight into a frame for the outputs
+Input Value.: enc - the encoder of the stream
+              pic - the picture
+              quality - the JPEG quality
+Return Value: the frame, NULL on error
 ******************************************************************************/
-static int rgb_to_jpeg(const uint8_t *rgb_data, int img_width, int img_height,
-                       uint8_t **jpeg_data, size_t *jpeg_size) {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    JSAMPROW row_pointer[1];
-    unsigned long outlen = 0;
-    uint8_t *outbuffer = NULL;
-
-    if (!rgb_data) {
-        IPRINT("RGB data is NULL\n");
-        return -1;
-    }
-
-    /* Allocate line buffer for R/B swap */
-    uint8_t *line_buffer = (uint8_t *)malloc(img_width * 3);
-    if (!line_buffer) {
-        IPRINT("Failed to allocate line buffer\n");
-        return -1;
-    }
-
-    /* Initialize JPEG compression */
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-
-    /* Set output to memory */
-    jpeg_mem_dest(&cinfo, &outbuffer, &outlen);
-
-    /* Set parameters for RGB output */
-    cinfo.image_width = img_width;
-    cinfo.image_height = img_height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-
-    /* Start compression */
-    jpeg_start_compress(&cinfo, TRUE);
+static input_frame *encode_frame(StreamEncoder *enc, const jpeg_picture *pic, int quality) {
+    input_frame *frame;
+    int backend_now = jpeg_backend_current(enc->jpeg);
+
+    /* a quarter of the raw frame is plenty for all but the highest qualities */
+    if (enc->capacity == 0)
+        enc->capacity = enc->width * enc->height * 3 / 4;
+    /* a mem2mem device gives up on a JPEG which does not fit */
+    if ((backend_now == JPEG_BACKEND_M2M || backend_now == JPEG_BACKEND_AUTO) && enc->capacity < pic->size)
+        enc->capacity = pic->size;
+
+    /* frames come from the pool, a JPEG which did not fit is encoded again into a larger one */
+    while (1) {
+        if ((frame = frame_alloc(enc->capacity)) == NULL) {
+            IPRINT("Failed to allocate memory for frame\n");
+            return NULL;
+        }
 
-    /* Compress each scanline with R/B swap */
-    while (cinfo.next_scanline < cinfo.image_height) {
-        const uint8_t *src = rgb_data + (cinfo.next_scanline * img_width * 3);
-        uint8_t *dst = line_buffer;
+        frame->size = jpeg_backend_encode(enc->jpeg, pic, quality, frame->buf, frame->capacity);
+        if (frame->size > 0)
+            return frame;
 
-        /* Swap R and B channels */
-        for (int x = 0; x < img_width; x++) {
-            dst[0] = src[2];  // R ← B
-            dst[1] = src[1];  // G ← G
-            dst[2] = src[0];  // B ← R
-            src += 3;
-            dst += 3;
+        frame_unref(frame);
+        if (enc->capacity >= (int)(enc->stride * enc->height * 2)) {
+            IPRINT("JPEG does not fit into %d bytes\n", enc->capacity);
+            return NULL;
         }
-
-        row_pointer[0] = line_buffer;
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        enc->capacity *= 2;
     }
-
-    /* Finish compression */
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-
-    free(line_buffer);
-
-    /* Return result */
-    *jpeg_data = outbuffer;
-    *jpeg_size = outlen;
-
-    return 0;
 }
 
 /******************************************************************************
-Description.: Copy a picture from the buffer and signal fresh_frame
-Input Value.: -
-Return Value: -
+Description.: Copy the planes of a frame for the consumers of raw frames, the
+              buffer goes back to the camera after the frame is published
+Input Value.: enc - the encoder of the stream
+              planes - the planes of the frame
+Return Value: the raw frame, NULL without memory
 ******************************************************************************/
-static void copy_frame(const uint8_t *buffer, size_t length) {
-    pthread_mutex_lock(&pglobal->in[plugin_number].db);
-
-    /* Free old buffer */
-    if (pglobal->in[plugin_number].buf != NULL) {
-        free(pglobal->in[plugin_number].buf);
-    }
-
-    /* Allocate new buffer */
-    pglobal->in[plugin_number].buf = (unsigned char *)malloc(length);
-    if (pglobal->in[plugin_number].buf == NULL) {
-        IPRINT("Failed to allocate memory for frame\n");
-        pthread_mutex_unlock(&pglobal->in[plugin_number].db);
-        return;
+static input_frame *copy_raw_frame(StreamEncoder *enc, const uint8_t *const *planes) {
+    raw_format format;
+    int lengths[RAW_PLANES];
+
+    memset(&format, 0, sizeof(format));
+    format.pixelformat = enc->yuv ? V4L2_PIX_FMT_YUV420 : V4L2_PIX_FMT_BGR24;
+    format.width = enc->width;
+    format.height = enc->height;
+    format.planes = enc->yuv ? 3 : 1;
+    format.stride[0] = enc->stride;
+    format.dmabuf = -1;
+    lengths[0] = enc->stride * enc->height;
+    if (enc->yuv) {
+        format.stride[1] = format.stride[2] = enc->stride / 2;
+        lengths[1] = lengths[2] = (enc->stride / 2) * ((enc->height + 1) / 2);
     }
 
-    /* Copy frame data */
-    memcpy(pglobal->in[plugin_number].buf, buffer, length);
-    pglobal->in[plugin_number].size = length;
-
-    /* Update timestamp */
-    gettimeofday(&pglobal->in[plugin_number].timestamp, NULL);
-
-    /* Signal fresh frame */
-    pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-    pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+    return frame_raw_copy(&format, planes, lengths);
 }
 
 /******************************************************************************
-Description.: Read RGB data from frame buffer and encode to JPEG
-Input Value.: fb - frame buffer
+Description.: Read a frame from its buffer, encode it to JPEG and publish it
+Input Value.: enc - the encoder of the stream the buffer belongs to
+              fb - frame buffer
 Return Value: -
 ******************************************************************************/
-static void process_frame(FrameBuffer *fb) {
-    static int frame_num = 0;
-    frame_num++;
-
-    /* Get number of planes */
-    unsigned int num_planes = fb->planes().size();
+static void process_frame(StreamEncoder *enc, FrameBuffer *fb) {
+    bool first = (enc->frames == 0);
 
-    if (frame_num == 1) {
-        IPRINT("Frame has %u planes\n", num_planes);
+    if (first) {
+        IPRINT("Frame has %zu planes\n", fb->planes().size());
     }
 
-    /* Handle single-plane RGB888 format */
-    if (num_planes != 1) {
-        IPRINT("Unexpected number of planes: %u (expected 1 for RGB888)\n", num_planes);
+    /* a degraded input leaves some of the previews it would compress */
+    if (enc == &preview && governor_skip(&pglobal->in[enc->id]))
         return;
-    }
 
-    /* Map RGB plane */
-    const FrameBuffer::Plane &rgb_plane = fb->planes()[0];
-    size_t rgb_size = rgb_plane.length;
-    void *rgb_mem = mmap(NULL, rgb_size, PROT_READ, MAP_SHARED, rgb_plane.fd.get(), 0);
-    if (rgb_mem == MAP_FAILED) {
-        IPRINT("Failed to mmap RGB plane\n");
+    /* planes, mapped by init_camera */
+    std::map<const FrameBuffer *, PlaneMapping>::const_iterator it = ctx->mappings.find(fb);
+    if (it == ctx->mappings.end()) {
+        IPRINT("Frame buffer is not mapped\n");
         return;
     }
+    const PlaneMapping &mapping = it->second;
+    size_t frame_size = mapping.length;
 
-    if (frame_num == 1) {
-        IPRINT("Mapped RGB plane: %zu bytes (expected: %zu)\n", rgb_size, (size_t)width * height * 3);
-
-        /* Debug: Print first 10 pixels */
-        const uint8_t *debug_data = (const uint8_t *)rgb_mem;
-        IPRINT("First 10 pixels (raw data):\n");
-        for (int i = 0; i < 10; i++) {
-            IPRINT("  Pixel %d: [%3d, %3d, %3d]\n", i,
-                   debug_data[i*3], debug_data[i*3+1], debug_data[i*3+2]);
-        }
+    if (enc->yuv ? (mapping.data[2] == NULL) : (fb->planes().size() != 1)) {
+        IPRINT("Unexpected number of planes: %zu\n", fb->planes().size());
+        return;
     }
 
-    /* Encode RGB to JPEG (with R/B swap) */
-    uint8_t *jpeg_data = NULL;
-    size_t jpeg_size = 0;
-
-    if (rgb_to_jpeg((const uint8_t *)rgb_mem, width, height, &jpeg_data, &jpeg_size) == 0) {
-        /* Copy JPEG data to global buffer */
-        copy_frame(jpeg_data, jpeg_size);
+    /* the CPU reads the frame from here on, invalidate stale cache lines */
+    sync_buffer(mapping.fd, DMA_BUF_SYNC_START);
 
-        /* Free JPEG buffer (allocated by jpeg_mem_dest) */
-        free(jpeg_data);
+    if (first) {
+        IPRINT("Mapped frame: %zu bytes, %dx%d\n", frame_size, enc->width, enc->height);
+    }
 
-        if (frame_num == 1) {
-            IPRINT("First frame encoded successfully: %zu bytes\n", jpeg_size);
+    /* RGB888 of libcamera is stored as B, G, R like BGR24 of V4L2, a
+     * hardware encoder reads the preview from its dmabuf */
+    jpeg_picture pic;
+    memset(&pic, 0, sizeof(pic));
+    pic.format.pixelformat = enc->yuv ? V4L2_PIX_FMT_YUV420 : V4L2_PIX_FMT_BGR24;
+    pic.format.width = enc->width;
+    pic.format.height = enc->height;
+    pic.format.planes = enc->yuv ? 3 : 1;
+    pic.format.stride[0] = enc->stride;
+    if (enc->yuv)
+        pic.format.stride[1] = pic.format.stride[2] = enc->stride / 2;
+    pic.format.dmabuf = (enc == &preview) ? mapping.fd : -1;
+    for (int i = 0; i < RAW_PLANES; i++)
+        pic.plane[i] = mapping.data[i];
+    pic.size = frame_size;
+    pic.index = (enc == &preview) ? (int)fb->cookie() : -1;
+    pic.buffers = (enc == &preview) ? ctx->preview_buffers.size() : 0;
+
+    /* Encode to JPEG, straight into a frame for the outputs */
+    unsigned long long encode_start = monotonic_usec();
+    input_frame *frame = encode_frame(enc, &pic, (enc == &preview) ?
+                                      governor_quality(&pglobal->in[enc->id], encode_quality) : still_quality);
+    if (frame)
+        histogram_observe(&pglobal->in[enc->id].stats.encode_usec, monotonic_usec() - encode_start);
+    if (frame && input_raw_wanted(&pglobal->in[enc->id]))
+        frame_attach_raw(frame, copy_raw_frame(enc, mapping.data));
+    sync_buffer(mapping.fd, DMA_BUF_SYNC_END);
+
+    if (frame) {
+        int jpeg_size = frame->size;
+
+        gettimeofday(&frame->timestamp, NULL);
+        input_publish_frame(&pglobal->in[enc->id], frame);
+        if (enc == &preview && jpeg_backend_current(enc->jpeg) != JPEG_BACKEND_M2M)
+            encode_quality = rate_control_update(&rate, jpeg_size);
+
+        if (first) {
+            IPRINT("First frame encoded successfully: %d bytes\n", jpeg_size);
         }
+        enc->frames++;
     } else {
-        IPRINT("Frame %d: Failed to encode JPEG\n", frame_num);
+        IPRINT("Frame %d: Failed to encode JPEG\n", enc->frames + 1);
     }
+}
 
-    /* Unmap RGB plane */
-    munmap(rgb_mem, rgb_size);
+/******************************************************************************
+Description.: count the frames of the sensor which found no free request,
+              from gaps in the sequence numbers of the completed requests
+Input Value.: request - a completed request
+Return Value: -
+******************************************************************************/
+static void count_dropped(Request *request) {
+    std::optional<int64_t> sequence = request->metadata().get(controls::SensorSequence);
+
+    if (!sequence)
+        return;
+
+    if (ctx->last_sequence >= 0 && *sequence > ctx->last_sequence + 1)
+        __sync_fetch_and_add(&pglobal->in[plugin_number].stats.capture_dropped,
+                             (unsigned long long)(*sequence - ctx->last_sequence - 1));
+    ctx->last_sequence = *sequence;
 }
 
 /******************************************************************************
@@ -515,37 +765,59 @@ void *worker_thread(void *arg) {
     /* Main loop */
     IPRINT("Entering main capture loop...\n");
     int frame_count = 0;
-    while (!pglobal->stop) {
-        Request *request = nullptr;
+    bool failed = false;
+    while (!pglobal->stop && !failed) {
+        std::vector<Request *> ready;
 
-        /* Get completed request */
+        /* wait for completed requests, waking up now and then to notice a stop */
         {
-            std::lock_guard<std::mutex> lock(ctx->queue_mutex);
-            if (!ctx->completed_requests.empty()) {
-                request = ctx->completed_requests.front();
+            std::unique_lock<std::mutex> lock(ctx->queue_mutex);
+            ctx->queue_cond.wait_for(lock, 100ms, [] { return !ctx->completed_requests.empty(); });
+            while (!ctx->completed_requests.empty()) {
+                ready.push_back(ctx->completed_requests.front());
                 ctx->completed_requests.pop();
             }
         }
 
-        if (request) {
-            frame_count++;
-            if (frame_count % 30 == 1) {  /* Print every 30 frames */
-                IPRINT("Processing frame #%d\n", frame_count);
+        if (ready.empty())
+            continue;
+
+        /*
+         * Only the newest preview is encoded, older ones go back to the camera
+         * right away. So a slow encoder costs frames of the stream but never
+         * leaves the camera without buffers, which would cost more of them.
+         */
+        for (size_t n = 0; n < ready.size(); n++) {
+            Request *request = ready[n];
+            bool newest = (n == ready.size() - 1);
+
+            count_dropped(request);
+
+            if (newest) {
+                frame_count++;
+                if (frame_count % 30 == 1) {  /* Print every 30 frames */
+                    IPRINT("Processing frame #%d\n", frame_count);
+                }
+            } else {
+                DBG("skipping a stale frame\n");
             }
 
-            /* Process frame */
-            FrameBuffer *buffer = request->buffers().begin()->second;
-            process_frame(buffer);
+            /* Process the frames, a still buffer is free again afterwards */
+            for (const auto &entry : request->buffers()) {
+                if (entry.first == still.stream && still_id >= 0) {
+                    process_frame(&still, entry.second);
+                    ctx->free_stills.push_back(entry.second);
+                } else if (newest) {
+                    process_frame(&preview, entry.second);
+                }
+            }
 
             /* Requeue request */
-            request->reuse(Request::ReuseBuffers);
-            if (ctx->camera->queueRequest(request)) {
+            if (requeue_request(request) < 0) {
                 IPRINT("Failed to requeue request\n");
+                failed = true;
                 break;
             }
-        } else {
-            /* No frames available, sleep briefly */
-            usleep(1000);
         }
     }
 
@@ -572,11 +844,6 @@ void worker_cleanup(void *arg) {
 
     first_run = 0;
     DBG("Cleaning up resources allocated by worker thread\n");
-
-    if (pglobal->in[plugin_number].buf != NULL) {
-        free(pglobal->in[plugin_number].buf);
-        pglobal->in[plugin_number].buf = NULL;
-    }
 }
 
 /******************************************************************************
@@ -640,12 +907,87 @@ extern "C" int input_init(input_parameter *param, int id) {
                 return 1;
             }
             camera_id = atoi(param->argv[++i]);
+        } else if (strcmp(arg, "-m2m") == 0) {
+            if (i + 1 >= param->argc) {
+                IPRINT("No value specified for m2m\n");
+                return 1;
+            }
+            use_m2m = true;
+            if (strcmp(param->argv[++i], "auto") != 0)
+                m2m_device = param->argv[i];
+        } else if (strcmp(arg, "-encoder") == 0) {
+            if (i + 1 >= param->argc) {
+                IPRINT("No value specified for encoder\n");
+                return 1;
+            }
+            if ((backend = jpeg_backend_parse(param->argv[++i])) < 0) {
+                IPRINT("Unknown JPEG encoder %s\n", param->argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "-threads") == 0) {
+            if (i + 1 >= param->argc) {
+                IPRINT("No value specified for threads\n");
+                return 1;
+            }
+            threads = MAX(atoi(param->argv[++i]), 0);
+        } else if (strcmp(arg, "-kbps") == 0) {
+            if (i + 1 >= param->argc) {
+                IPRINT("No value specified for kbps\n");
+                return 1;
+            }
+            kbps = MAX(atoi(param->argv[++i]), 0);
+        } else if (strcmp(arg, "-maxsize") == 0) {
+            if (i + 1 >= param->argc) {
+                IPRINT("No value specified for maxsize\n");
+                return 1;
+            }
+            max_size = MAX(atoi(param->argv[++i]), 0);
+        } else if (strcmp(arg, "-buffers") == 0) {
+            if (i + 1 >= param->argc) {
+                IPRINT("No value specified for buffers\n");
+                return 1;
+            }
+            buffer_count = atoi(param->argv[++i]);
+            if (buffer_count < 2 || buffer_count > 32) {
+                IPRINT("-buffers must be between 2 and 32\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "-still") == 0) {
+            if (i + 1 >= param->argc ||
+                sscanf(param->argv[++i], "%dx%d", &still_width, &still_height) != 2 ||
+                still_width <= 0 || still_height <= 0) {
+                IPRINT("-still needs a resolution like 2592x1944\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "-stillfps") == 0) {
+            if (i + 1 >= param->argc) {
+                IPRINT("No value specified for stillfps\n");
+                return 1;
+            }
+            still_fps = MAX(atoi(param->argv[++i]), 1);
         }
     }
 
+    /* the full resolution frames are published by an input of their own */
+    if (still_width > 0) {
+        if ((still_id = input_add(&pglobal->in[id])) < 0) {
+            IPRINT("Could not add an input for the still stream\n");
+            return 1;
+        }
+        still_quality = quality;
+    }
+
+    /* the quality is shown and set through the "JPEG quality" control */
+    rate_control_init(&rate, &pglobal->in[id], quality, kbps, max_size);
+    encode_quality = quality;
+
     IPRINT("Desired Resolution: %d x %d @ %d fps\n", width, height, fps);
     IPRINT("JPEG Quality......: %d\n", quality);
     IPRINT("Camera ID.........: %d\n", camera_id);
+    if (kbps > 0 || max_size > 0)
+        IPRINT("Rate control......: %d kbit/s, %d bytes per frame (0 = no limit)\n", kbps, max_size);
+    if (still_id >= 0)
+        IPRINT("Still stream......: %d x %d @ %d fps as input %d\n", still_width, still_height, still_fps, still_id);
     IPRINT("---------------------------------------------------------------\n");
 
     return 0;
@@ -680,8 +1022,9 @@ Return Value: 0
 extern "C" int input_run(int id) {
     IPRINT("input_run() called with id=%d\n", id);
 
-    pglobal->in[id].buf = NULL;
-    pglobal->in[id].size = 0;
+    /* the worker of the first input serves the still stream too */
+    if (id != plugin_number)
+        return 0;
 
     IPRINT("Creating worker thread...\n");
     if (pthread_create(&worker, 0, worker_thread, NULL) != 0) {
@@ -704,6 +1047,19 @@ extern "C" int input_cmd(int plugin, unsigned int control_id, unsigned int group
     DBG("Received command: plugin %d, control %d, group %d, value %d\n",
         plugin, control_id, group, value);
 
-    /* Commands not yet implemented */
+    /* the software encoder takes a new quality with the next frame */
+    if (group == IN_CMD_JPEG_QUALITY) {
+        if (value < 0 || value > 100)
+            return -1;
+        if (plugin == still_id) {
+            still_quality = value;
+            return 0;
+        }
+        rate_control_set_quality(&rate, value);
+        encode_quality = value;
+        return 0;
+    }
+
+    /* Other commands not yet implemented */
     return 0;
 }
@@ -0,0 +1,721 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+  This input plugin tiles the newest frames of other inputs into one picture,
+  so a wall of monitors needs a single stream.
+
+  The tiles are put together from the DCT blocks of the frames, like
+  transform.c turns them: a frame with the size of a tile and the sampling of
+  the mosaic has its blocks copied, quantized again if its tables differ.
+  Only a frame of another size or sampling is decoded, scaled to the tile and
+  encoded with the tables of the mosaic before its blocks are copied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <syslog.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#define INPUT_PLUGIN_NAME "Mosaic input plugin"
+#define MAX_SOURCES 64
+
+/* longjmp target for errors of libjpeg, the default handler would exit */
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} mosaic_error_mgr;
+
+/* encodes into a growing buffer */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    unsigned char *out;
+    size_t out_size;
+} mosaic_dest_mgr;
+
+static pthread_t worker;
+static globals *pglobal;
+static int plugin_number;
+
+static int sources[MAX_SOURCES];
+static int source_count;
+static int columns, rows;
+static int tile_width, tile_height;     // 0 for the size of the first frame
+static double fps = 5;
+
+/* the frames the last mosaic was made of */
+static unsigned long long used_seq[MAX_SOURCES];
+
+void *worker_thread(void *);
+
+/******************************************************************************
+Description.: print a help message
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void help(void)
+{
+    fprintf(stderr, " ---------------------------------------------------------------\n" \
+            " Help for input plugin..: "INPUT_PLUGIN_NAME"\n" \
+            " ---------------------------------------------------------------\n" \
+            " The following parameters can be passed to this plugin:\n\n" \
+            " [-i | --inputs ]........: inputs to show, like 0,1,2,3, left to\n" \
+            "                           right and top to bottom\n" \
+            " [-g | --grid ]..........: columns and rows like 3x2, by default\n" \
+            "                           a square which holds all inputs\n" \
+            " [-t | --tile ]..........: size of a tile like 640x360, by default\n" \
+            "                           the size of the first input's frames\n" \
+            " [-f | --fps ]...........: mosaics per second, 5 by default\n" \
+            " ---------------------------------------------------------------\n");
+}
+
+static void mosaic_error_exit(j_common_ptr cinfo)
+{
+    mosaic_error_mgr *err = (mosaic_error_mgr *)cinfo->err;
+
+    #ifdef DEBUG
+    (*cinfo->err->output_message)(cinfo);
+    #endif
+    longjmp(err->setjmp_buffer, 1);
+}
+
+static void dest_init(j_compress_ptr cinfo)
+{
+    mosaic_dest_mgr *dest = (mosaic_dest_mgr *)cinfo->dest;
+
+    dest->pub.next_output_byte = dest->out;
+    dest->pub.free_in_buffer = dest->out_size;
+}
+
+static boolean dest_empty(j_compress_ptr cinfo)
+{
+    mosaic_dest_mgr *dest = (mosaic_dest_mgr *)cinfo->dest;
+    unsigned char *out;
+
+    /* libjpeg calls this only with a completely full buffer */
+    if((out = realloc(dest->out, dest->out_size * 2)) == NULL)
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+
+    dest->pub.next_output_byte = out + dest->out_size;
+    dest->pub.free_in_buffer = dest->out_size;
+    dest->out = out;
+    dest->out_size *= 2;
+    return TRUE;
+}
+
+static void dest_term(j_compress_ptr cinfo)
+{
+}
+
+/******************************************************************************
+Description.: set up a growing buffer for a compressor
+Input Value.: * dest: the destination, dest->out has to be freed afterwards
+              * size: first size of the buffer
+Return Value: 0 if ok, -1 without memory
+******************************************************************************/
+static int dest_setup(mosaic_dest_mgr *dest, size_t size)
+{
+    dest->out_size = size;
+    if((dest->out = malloc(dest->out_size)) == NULL)
+        return -1;
+
+    dest->pub.init_destination = dest_init;
+    dest->pub.empty_output_buffer = dest_empty;
+    dest->pub.term_destination = dest_term;
+    return 0;
+}
+
+/******************************************************************************
+Description.: tell whether the blocks of a frame can be copied into a tile
+Input Value.: * cinfo: the mosaic
+              * dinfo: the frame, with its header read
+              * tw, th: size of a tile in pixels
+Return Value: 1 if the frame has the sampling of the mosaic and, cut to whole
+              MCUs, the size of the tile
+******************************************************************************/
+static int fits(j_compress_ptr cinfo, j_decompress_ptr dinfo, JDIMENSION tw, JDIMENSION th)
+{
+    JDIMENSION mcu_w = dinfo->max_h_samp_factor * DCTSIZE, mcu_h = dinfo->max_v_samp_factor * DCTSIZE;
+    int ci;
+
+    if(dinfo->num_components != cinfo->num_components || dinfo->jpeg_color_space != cinfo->jpeg_color_space ||
+       dinfo->data_precision != BITS_IN_JSAMPLE ||
+       dinfo->image_width / mcu_w * mcu_w != tw || dinfo->image_height / mcu_h * mcu_h != th)
+        return 0;
+
+    for(ci = 0; ci < dinfo->num_components; ci++) {
+        if(dinfo->comp_info[ci].h_samp_factor != cinfo->comp_info[ci].h_samp_factor ||
+           dinfo->comp_info[ci].v_samp_factor != cinfo->comp_info[ci].v_samp_factor)
+            return 0;
+    }
+    return 1;
+}
+
+/******************************************************************************
+Description.: copy the blocks of a frame into a tile of the mosaic
+Input Value.: * cinfo: the mosaic
+              * dst..: its block arrays
+              * tile.: number of the tile
+              * dinfo: the frame, which fits()
+              * src..: its block arrays from jpeg_read_coefficients()
+Return Value: -
+******************************************************************************/
+static void copy_tile(j_compress_ptr cinfo, jvirt_barray_ptr *dst, int tile,
+                      j_decompress_ptr dinfo, jvirt_barray_ptr *src)
+{
+    JDIMENSION bw, bh, x, y;
+    int ci, r, k, vs, requant;
+    jpeg_component_info *comp;
+    UINT16 *qs, *qd;
+
+    for(ci = 0; ci < cinfo->num_components; ci++) {
+        comp = &cinfo->comp_info[ci];
+        bw = cinfo->image_width / columns / (cinfo->max_h_samp_factor * DCTSIZE) * comp->h_samp_factor;
+        bh = cinfo->image_height / rows / (cinfo->max_v_samp_factor * DCTSIZE) * comp->v_samp_factor;
+        vs = comp->v_samp_factor;
+
+        /* a coefficient stands for a multiple of its quantizer */
+        qd = cinfo->quant_tbl_ptrs[comp->quant_tbl_no]->quantval;
+        qs = dinfo->comp_info[ci].quant_table->quantval;
+        requant = memcmp(qs, qd, DCTSIZE2 * sizeof(UINT16)) != 0;
+
+        for(y = 0; y < bh; y += vs) {
+            JBLOCKARRAY out = (*cinfo->mem->access_virt_barray)((j_common_ptr)cinfo, dst[ci],
+                              tile / columns * bh + y, vs, TRUE);
+            JBLOCKARRAY in = (*dinfo->mem->access_virt_barray)((j_common_ptr)dinfo, src[ci], y, vs, FALSE);
+
+            for(r = 0; r < vs; r++) {
+                JBLOCKROW to = out[r] + tile % columns * bw;
+
+                if(!requant) {
+                    memcpy(to, in[r], bw * sizeof(JBLOCK));
+                    continue;
+                }
+                for(x = 0; x < bw; x++) {
+                    for(k = 0; k < DCTSIZE2; k++) {
+                        int v = in[r][x][k] * qs[k];
+
+                        to[x][k] = (v >= 0) ? (v + qd[k] / 2) / qd[k] : -((-v + qd[k] / 2) / qd[k]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/******************************************************************************
+Description.: fill a tile with black, for an input without frames
+Input Value.: * cinfo: the mosaic
+              * dst..: its block arrays
+              * tile.: number of the tile
+Return Value: -
+******************************************************************************/
+static void black_tile(j_compress_ptr cinfo, jvirt_barray_ptr *dst, int tile)
+{
+    JDIMENSION bw, bh, x, y;
+    int ci, r, vs;
+    jpeg_component_info *comp;
+    JCOEF dc;
+
+    for(ci = 0; ci < cinfo->num_components; ci++) {
+        comp = &cinfo->comp_info[ci];
+        bw = cinfo->image_width / columns / (cinfo->max_h_samp_factor * DCTSIZE) * comp->h_samp_factor;
+        bh = cinfo->image_height / rows / (cinfo->max_v_samp_factor * DCTSIZE) * comp->v_samp_factor;
+        vs = comp->v_samp_factor;
+
+        /* the DC of a block is 8 times its mean around 128, chroma stays neutral */
+        dc = (ci == 0) ? -(8 * 128 + cinfo->quant_tbl_ptrs[comp->quant_tbl_no]->quantval[0] / 2) /
+                         cinfo->quant_tbl_ptrs[comp->quant_tbl_no]->quantval[0] : 0;
+
+        for(y = 0; y < bh; y += vs) {
+            JBLOCKARRAY out = (*cinfo->mem->access_virt_barray)((j_common_ptr)cinfo, dst[ci],
+                              tile / columns * bh + y, vs, TRUE);
+
+            for(r = 0; r < vs; r++) {
+                JBLOCKROW to = out[r] + tile % columns * bw;
+
+                memset(to, 0, bw * sizeof(JBLOCK));
+                for(x = 0; x < bw; x++)
+                    to[x][0] = dc;
+            }
+        }
+    }
+}
+
+/******************************************************************************
+Description.: decode a frame at the smallest scale of libjpeg which covers the
+              tile, pick its pixels for the tile and encode them with the
+              tables and sampling of the mosaic
+Input Value.: * cinfo: the mosaic
+              * rinfo: the decoder the mosaic got its parameters from
+              * dinfo: the frame, with its header read
+              * tinfo: encoder of the tile, with its destination
+Return Value: -
+******************************************************************************/
+static void scale_tile(j_compress_ptr cinfo, j_decompress_ptr rinfo, j_decompress_ptr dinfo,
+                       j_compress_ptr tinfo)
+{
+    JDIMENSION tw = cinfo->image_width / columns, th = cinfo->image_height / rows;
+    JDIMENSION x, y, line = 0;
+    JSAMPARRAY in, out;
+    int c, n = cinfo->num_components;
+
+    dinfo->out_color_space = (n == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    dinfo->dct_method = JDCT_IFAST;
+    dinfo->do_fancy_upsampling = FALSE;
+    dinfo->scale_denom = 8;
+    for(dinfo->scale_num = 1; dinfo->scale_num < 8; dinfo->scale_num++) {
+        if(dinfo->image_width * dinfo->scale_num >= tw * 8 && dinfo->image_height * dinfo->scale_num >= th * 8)
+            break;
+    }
+    jpeg_start_decompress(dinfo);
+
+    in = (*dinfo->mem->alloc_sarray)((j_common_ptr)dinfo, JPOOL_IMAGE, dinfo->output_width * n, 1);
+    out = (*dinfo->mem->alloc_sarray)((j_common_ptr)dinfo, JPOOL_IMAGE, tw * n, 1);
+
+    jpeg_copy_critical_parameters(rinfo, tinfo);
+    tinfo->image_width = tw;
+    tinfo->image_height = th;
+    tinfo->in_color_space = dinfo->out_color_space;
+    tinfo->dct_method = JDCT_IFAST;
+    jpeg_start_compress(tinfo, TRUE);
+
+    /* nearest pixels, lines of the scaled frame are skipped on the way */
+    for(y = 0; y < th; y++) {
+        JDIMENSION want = (JDIMENSION)((unsigned long long)y * dinfo->output_height / th);
+
+        while(line <= want) {
+            jpeg_read_scanlines(dinfo, in, 1);
+            line++;
+        }
+        for(x = 0; x < tw; x++) {
+            JDIMENSION sx = (JDIMENSION)((unsigned long long)x * dinfo->output_width / tw);
+
+            for(c = 0; c < n; c++)
+                out[0][x * n + c] = in[0][sx * n + c];
+        }
+        jpeg_write_scanlines(tinfo, out, 1);
+    }
+
+    jpeg_finish_compress(tinfo);
+    jpeg_abort_decompress(dinfo);
+}
+
+/******************************************************************************
+Description.: put one frame into its tile of the mosaic
+Input Value.: * cinfo: the mosaic
+              * dst..: its block arrays
+              * rinfo: the decoder the mosaic got its parameters from
+              * tile.: number of the tile
+              * frame: the frame, NULL for a black tile
+Return Value: 0 if the frame was used, 1 if it had to be scaled, -1 if it
+              could not be decoded and the tile is black
+******************************************************************************/
+static int put_tile(j_compress_ptr cinfo, jvirt_barray_ptr *dst, j_decompress_ptr rinfo,
+                    int tile, input_frame *frame)
+{
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct tinfo;
+    mosaic_error_mgr err;
+    mosaic_dest_mgr dest = { .out = NULL };
+    jvirt_barray_ptr *src;
+    int scaled = 0;
+
+    if(frame == NULL) {
+        black_tile(cinfo, dst, tile);
+        return 0;
+    }
+
+    /* a broken frame costs its tile, not the mosaic */
+    dinfo.err = tinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = mosaic_error_exit;
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&tinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_compress(&tinfo);
+        jpeg_destroy_decompress(&dinfo);
+        free(dest.out);
+        black_tile(cinfo, dst, tile);
+        return -1;
+    }
+
+    jpeg_mem_src(&dinfo, frame->buf, frame->size);
+    jpeg_read_header(&dinfo, TRUE);
+
+    if(!fits(cinfo, &dinfo, cinfo->image_width / columns, cinfo->image_height / rows)) {
+        /* the scaled tile fits, its blocks are copied like those of a frame */
+        if(dest_setup(&dest, 64 * 1024) < 0)
+            ERREXIT1(&dinfo, JERR_OUT_OF_MEMORY, 0);
+        tinfo.dest = &dest.pub;
+        scale_tile(cinfo, rinfo, &dinfo, &tinfo);
+        jpeg_mem_src(&dinfo, dest.out, dest.out_size - dest.pub.free_in_buffer);
+        jpeg_read_header(&dinfo, TRUE);
+        scaled = 1;
+    }
+
+    src = jpeg_read_coefficients(&dinfo);
+    copy_tile(cinfo, dst, tile, &dinfo, src);
+
+    jpeg_destroy_compress(&tinfo);
+    jpeg_destroy_decompress(&dinfo);
+    free(dest.out);
+    return scaled;
+}
+
+/******************************************************************************
+Description.: put the frames together into one picture
+Input Value.: * frames: a frame or NULL for each tile
+              * ref...: the frame the mosaic takes its tables and sampling from
+Return Value: the mosaic, NULL on errors
+******************************************************************************/
+static input_frame *compose(input_frame **frames, input_frame *ref)
+{
+    struct jpeg_decompress_struct rinfo;
+    struct jpeg_compress_struct cinfo;
+    mosaic_error_mgr err;
+    mosaic_dest_mgr dest;
+    jvirt_barray_ptr dst[MAX_COMPONENTS];
+    JDIMENSION mcu_w, mcu_h, tw, th;
+    input_frame *result = NULL;
+    int ci, i, scaled = 0;
+    static int was_scaled = -1;
+
+    if(dest_setup(&dest, ref->size * columns * rows + 1024) < 0)
+        return NULL;
+
+    rinfo.err = cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = mosaic_error_exit;
+
+    jpeg_create_decompress(&rinfo);
+    jpeg_create_compress(&cinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&rinfo);
+        free(dest.out);
+        return NULL;
+    }
+    cinfo.dest = &dest.pub;
+
+    jpeg_mem_src(&rinfo, ref->buf, ref->size);
+    jpeg_read_header(&rinfo, TRUE);
+    if((rinfo.jpeg_color_space != JCS_YCbCr || rinfo.num_components != 3) &&
+       (rinfo.jpeg_color_space != JCS_GRAYSCALE || rinfo.num_components != 1))
+        ERREXIT(&rinfo, JERR_CONVERSION_NOTIMPL);
+
+    /* tiles of whole MCUs, of the reference frame unless --tile is given */
+    mcu_w = rinfo.max_h_samp_factor * DCTSIZE;
+    mcu_h = rinfo.max_v_samp_factor * DCTSIZE;
+    tw = (tile_width > 0 ? (JDIMENSION)tile_width : rinfo.image_width) / mcu_w * mcu_w;
+    th = (tile_height > 0 ? (JDIMENSION)tile_height : rinfo.image_height) / mcu_h * mcu_h;
+    if(tw == 0 || th == 0)
+        ERREXIT(&rinfo, JERR_EMPTY_IMAGE);
+    if(tw * columns > JPEG_MAX_DIMENSION || th * rows > JPEG_MAX_DIMENSION)
+        ERREXIT1(&rinfo, JERR_IMAGE_TOO_BIG, JPEG_MAX_DIMENSION);
+
+    jpeg_copy_critical_parameters(&rinfo, &cinfo);
+    cinfo.image_width = tw * columns;
+    cinfo.image_height = th * rows;
+
+    for(ci = 0; ci < cinfo.num_components; ci++) {
+        jpeg_component_info *comp = &cinfo.comp_info[ci];
+
+        dst[ci] = (*cinfo.mem->request_virt_barray)((j_common_ptr)&cinfo, JPOOL_IMAGE, FALSE,
+                  tw / mcu_w * comp->h_samp_factor * columns, th / mcu_h * comp->v_samp_factor * rows,
+                  comp->v_samp_factor);
+    }
+
+    /* this realizes the arrays, the blocks are read by jpeg_finish_compress() */
+    jpeg_write_coefficients(&cinfo, dst);
+
+    /* the arrays have to be written from top to bottom, so do the tiles */
+    for(i = 0; i < columns * rows; i++) {
+        if(put_tile(&cinfo, dst, &rinfo, i, (i < source_count) ? frames[i] : NULL) != 0)
+            scaled = 1;
+    }
+
+    jpeg_finish_compress(&cinfo);
+
+    if((result = frame_alloc(dest.out_size - dest.pub.free_in_buffer)) != NULL) {
+        result->size = dest.out_size - dest.pub.free_in_buffer;
+        memcpy(result->buf, dest.out, result->size);
+    }
+
+    if(scaled != was_scaled) {
+        IPRINT("mosaic............: %ux%u, %s\n", cinfo.image_width, cinfo.image_height,
+               scaled ? "scaling tiles which do not fit" : "copying the blocks of all tiles");
+        was_scaled = scaled;
+    }
+
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&rinfo);
+    free(dest.out);
+    return result;
+}
+
+/******************************************************************************
+Description.: put the newest frames of the inputs together at the rate asked
+              for, as long as one of them has a new frame
+Input Value.: arg is not used
+Return Value: NULL
+******************************************************************************/
+void *worker_thread(void *arg)
+{
+    input_frame *frames[MAX_SOURCES], *ref, *mosaic;
+    unsigned long long started;
+    int i, changed, state, wanted, subscribed = 0;
+    pacer pace;
+
+    pacer_init(&pace, fps, &pglobal->in[plugin_number]);
+
+    while(!pglobal->stop) {
+        pacer_wait(&pace);
+
+        /* the sources only need to capture while someone consumes the mosaic */
+        wanted = input_subscribed(&pglobal->in[plugin_number]);
+        if(wanted != subscribed) {
+            for(i = 0; i < source_count; i++) {
+                if(sources[i] >= pglobal->incnt)
+                    continue;
+                if(wanted)
+                    input_subscribe(&pglobal->in[sources[i]]);
+                else
+                    input_unsubscribe(&pglobal->in[sources[i]]);
+            }
+            subscribed = wanted;
+            input_set_idle(&pglobal->in[plugin_number], !wanted);
+        }
+        if(!wanted)
+            continue;
+
+        /* a frame half put together would keep the references of its sources */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+        ref = NULL;
+        changed = 0;
+        for(i = 0; i < source_count; i++) {
+            frames[i] = (sources[i] < pglobal->incnt) ? frame_flatten(input_get_frame(&pglobal->in[sources[i]])) : NULL;
+            if(frames[i] != NULL && ref == NULL)
+                ref = frames[i];
+            if((frames[i] != NULL ? frames[i]->seq : 0) != used_seq[i])
+                changed = 1;
+        }
+
+        if(ref != NULL && changed) {
+            started = monotonic_usec();
+            if((mosaic = compose(frames, ref)) != NULL) {
+                /* the mosaic is as old as its newest picture */
+                for(i = 0; i < source_count; i++) {
+                    if(frames[i] == NULL)
+                        continue;
+                    used_seq[i] = frames[i]->seq;
+                    if(timercmp(&frames[i]->timestamp, &mosaic->timestamp, >)) {
+                        mosaic->timestamp = frames[i]->timestamp;
+                        mosaic->capture_usec = frames[i]->capture_usec;
+                    }
+                }
+                mosaic->dequeue_usec = started;
+                mosaic->encoded_usec = monotonic_usec();
+                input_publish_frame(&pglobal->in[plugin_number], mosaic);
+            } else {
+                IPRINT("could not put the frames together\n");
+            }
+        }
+
+        for(i = 0; i < source_count; i++) {
+            if(frames[i] != NULL)
+                frame_unref(frames[i]);
+        }
+        pthread_setcancelstate(state, NULL);
+    }
+
+    IPRINT("leaving input thread\n");
+    return NULL;
+}
+
+/*** plugin interface functions ***/
+/******************************************************************************
+Description.: parse input parameters
+Input Value.: param contains the command line string and a pointer to globals
+Return Value: 0 if everything is ok
+******************************************************************************/
+int input_init(input_parameter *param, int id)
+{
+    char *list = NULL, *next;
+    int i;
+
+    param->argv[0] = INPUT_PLUGIN_NAME;
+    plugin_number = id;
+
+    /* show all parameters for DBG purposes */
+    for(i = 0; i < param->argc; i++) {
+        DBG("argv[%d]=%s\n", i, param->argv[i]);
+    }
+
+    reset_getopt();
+    while(1) {
+        int option_index = 0, c = 0;
+        static struct option long_options[] = {
+            {"h", no_argument, 0, 0},
+            {"help", no_argument, 0, 0},
+            {"i", required_argument, 0, 0},
+            {"inputs", required_argument, 0, 0},
+            {"g", required_argument, 0, 0},
+            {"grid", required_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"tile", required_argument, 0, 0},
+            {"f", required_argument, 0, 0},
+            {"fps", required_argument, 0, 0},
+            {0, 0, 0, 0}
+        };
+
+        c = getopt_long_only(param->argc, param->argv, "", long_options, &option_index);
+
+        /* no more options to parse */
+        if(c == -1) break;
+
+        /* unrecognized option */
+        if(c == '?') {
+            help();
+            return 1;
+        }
+
+        switch(option_index) {
+            /* h, help */
+        case 0:
+        case 1:
+            DBG("case 0,1\n");
+            help();
+            return 1;
+            break;
+
+            /* i, inputs */
+        case 2:
+        case 3:
+            DBG("case 2,3\n");
+            list = optarg;
+            break;
+
+            /* g, grid */
+        case 4:
+        case 5:
+            DBG("case 4,5\n");
+            if(sscanf(optarg, "%dx%d", &columns, &rows) != 2 || columns < 1 || rows < 1) {
+                IPRINT("the grid has to be given like 3x2\n");
+                return 1;
+            }
+            break;
+
+            /* t, tile */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            parse_resolution_opt(optarg, &tile_width, &tile_height);
+            break;
+
+            /* f, fps */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            if((fps = atof(optarg)) <= 0) {
+                IPRINT("the rate has to be above 0\n");
+                return 1;
+            }
+            break;
+        }
+    }
+
+    pglobal = param->global;
+
+    for(next = list; next != NULL && *next != '\0'; next += (*next == ',')) {
+        char *end;
+        long n = strtol(next, &end, 10);
+
+        if(end == next || n < 0 || n == id || source_count == MAX_SOURCES) {
+            IPRINT("the inputs have to be up to %d numbers of other inputs, like 0,1,2,3\n", MAX_SOURCES);
+            return 1;
+        }
+        sources[source_count++] = n;
+        next = end;
+    }
+    if(source_count == 0) {
+        help();
+        return 1;
+    }
+
+    if(columns == 0) {
+        columns = (int)ceil(sqrt(source_count));
+        rows = (source_count + columns - 1) / columns;
+    }
+    if(columns * rows < source_count) {
+        IPRINT("a grid of %dx%d has no room for %d inputs\n", columns, rows, source_count);
+        return 1;
+    }
+
+    IPRINT("inputs............: %s\n", list);
+    IPRINT("grid..............: %dx%d\n", columns, rows);
+    if(tile_width > 0) {
+        IPRINT("tile..............: %dx%d\n", tile_width, tile_height);
+    } else {
+        IPRINT("tile..............: size of the frames of input %d\n", sources[0]);
+    }
+    IPRINT("rate..............: %.3f fps\n", fps);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops the execution of the worker thread
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int input_stop(int id)
+{
+    DBG("will cancel input thread\n");
+    pthread_cancel(worker);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts the worker thread
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int input_run(int id)
+{
+    if(pthread_create(&worker, 0, worker_thread, NULL) != 0) {
+        fprintf(stderr, "could not start worker thread\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(worker);
+
+    return 0;
+}
@@ -34,6 +34,16 @@ void filter_process(void* filter_ctx, Mat &src, Mat &dst) {
     dst = src;
 }
 
+/**
+    Optional: if the plugin exports this function as well, input_opencv
+    captures into UMat frames and calls it instead of filter_process. The
+    frames then stay on the OpenCL device until they are encoded.
+
+    void filter_process_umat(void* filter_ctx, UMat &src, UMat &dst) {
+        dst = src;
+    }
+*/
+
 /**
     Called when the input plugin is cleaning up
 */
@@ -345,6 +345,56 @@ bool NDArrayConverter::toMat(PyObject *o, Mat &m)
     return true;
 }
 
+// the capsule of a wrapped Mat holds a reference to its data
+static void release_mat(PyObject *capsule)
+{
+    delete (Mat*)PyCapsule_GetPointer(capsule, "cv::Mat");
+}
+
+// a numpy array that uses the memory of the Mat instead of a copy of it
+static PyObject* wrapMat(const cv::Mat& m)
+{
+    int depth = m.depth(), cn = m.channels();
+    int typenum = depth == CV_8U ? NPY_UBYTE : depth == CV_8S ? NPY_BYTE :
+                  depth == CV_16U ? NPY_USHORT : depth == CV_16S ? NPY_SHORT :
+                  depth == CV_32S ? NPY_INT : depth == CV_32F ? NPY_FLOAT :
+                  depth == CV_64F ? NPY_DOUBLE : -1;
+#ifndef CV_MAX_DIM
+    const int CV_MAX_DIM = 32;
+#endif
+    npy_intp sizes[CV_MAX_DIM+1], strides[CV_MAX_DIM+1];
+    int i, dims = m.dims;
+    PyObject *o, *base;
+
+    if( typenum < 0 )
+        return NULL;
+
+    for( i = 0; i < dims; i++ )
+    {
+        sizes[i] = m.size[i];
+        strides[i] = m.step[i];
+    }
+    if( cn > 1 )
+    {
+        sizes[dims] = cn;
+        strides[dims] = m.elemSize1();
+        dims++;
+    }
+
+    o = PyArray_New(&PyArray_Type, dims, sizes, typenum, strides, m.data, 0, NPY_ARRAY_WRITEABLE, NULL);
+    if( !o )
+        return NULL;
+
+    // the array keeps the data alive through a reference of the Mat
+    base = PyCapsule_New(new Mat(m), "cv::Mat", release_mat);
+    if( !base || PyArray_SetBaseObject((PyArrayObject*)o, base) < 0 )
+    {
+        Py_DECREF(o);
+        return NULL;
+    }
+    return o;
+}
+
 PyObject* NDArrayConverter::toNDArray(const cv::Mat& m)
 {
     if( !m.data )
@@ -352,6 +402,12 @@ PyObject* NDArrayConverter::toNDArray(const cv::Mat& m)
     Mat temp, *p = (Mat*)&m;
     if(!p->u || p->allocator != &g_numpyAllocator)
     {
+        // frames of other allocators are shared with numpy, not copied
+        PyObject* o = wrapMat(m);
+        if( o )
+            return o;
+        PyErr_Clear();
+
         temp.allocator = &g_numpyAllocator;
         ERRWRAP2(m.copyTo(temp));
         p = &temp;
@@ -25,14 +25,15 @@ extern "C" {
 
 static int python_loaded = 0;
 
+// the thread state of the interpreter while no filter holds the GIL
+static PyThreadState *pMainThread = NULL;
+
 struct Context {
     NDArrayConverter converter;
     
     PyObject *pModule;
     PyObject *filter_fn;
     PyObject *lastRetval;
-    
-    PyThreadState *pMainThread;
 };
 
 
@@ -56,32 +57,11 @@ static PyObject* get_import(const char * args) {
     return obj;
 }
 
-/**
-    Initializes the filter. If you return something, it will be passed to the
-    filter_process function, and should be freed by the filter_free function
-*/
-bool filter_init(const char * args, void** filter_ctx) {
+// imports the module and gets the filter function, the GIL must be held
+static bool load_filter(Context *ctx, const char * args) {
     
     PyObject *sys, *sys_path = NULL;
     PyObject *pModuleDir, *pModuleName, *pFunc;
-    Context * ctx;
-    char * dupargs, *mod_name, *mod_dir;
-    
-    if (strlen(args) < 3) {
-        fprintf(stderr, "Need to specify python filter module via --fargs\n");
-        return false;
-    }
-    
-    // don't initialize python more than once
-    if (python_loaded == 0) {
-        Py_Initialize();
-        PyEval_InitThreads();
-    }
-    
-    ctx = new Context();
-    *filter_ctx = ctx;
-    
-    python_loaded += 1;
     
     if (!NDArrayConverter::init_numpy()) {
         fprintf(stderr, "Error loading numpy!\n");
@@ -141,11 +121,48 @@ bool filter_init(const char * args, void** filter_ctx) {
         return false;
     }
     
-    // done with initialization, let go of the GIL
-    ctx->pMainThread = PyEval_SaveThread();
     return true;
 }
 
+/**
+    Initializes the filter. If you return something, it will be passed to the
+    filter_process function, and should be freed by the filter_free function
+    
+    input_opencv calls this once for every filter thread, each context then
+    has a filter function of its own.
+*/
+bool filter_init(const char * args, void** filter_ctx) {
+    
+    Context * ctx;
+    bool loaded;
+    
+    if (strlen(args) < 3) {
+        fprintf(stderr, "Need to specify python filter module via --fargs\n");
+        return false;
+    }
+    
+    ctx = new Context();
+    *filter_ctx = ctx;
+    
+    // don't initialize python more than once
+    if (python_loaded == 0) {
+        Py_Initialize();
+        PyEval_InitThreads();
+        
+        loaded = load_filter(ctx, args);
+        
+        // done with initialization, let go of the GIL
+        pMainThread = PyEval_SaveThread();
+    } else {
+        PyGILState_STATE gil_state = PyGILState_Ensure();
+        loaded = load_filter(ctx, args);
+        PyGILState_Release(gil_state);
+    }
+    
+    python_loaded += 1;
+    return loaded;
+}
+
 
 void dbgMat(const char * wat, Mat &m) {
     fprintf(stderr, "%s: ref %d, alloc @ %p; ptr %p %p\n", wat, m.u ? m.u->refcount : 0, m.allocator,
@@ -159,9 +176,11 @@ Mat filter_init_frame(void *filter_ctx) {
     // this function ensures that the initial mat is using the numpy allocator,
     // which avoids copies each time the source image is captured
     Mat mat;
+    PyGILState_STATE gil_state = PyGILState_Ensure();
     PyObject *mm = ctx->converter.toNDArray(mat);
     ctx->converter.toMat(mm, mat);
     Py_DECREF(mm);
+    PyGILState_Release(gil_state);
     return mat;
 }
 
@@ -211,6 +230,15 @@ void filter_process(void* filter_ctx, Mat &src, Mat &dst) {
 }
 
 
+// drops the python objects of a context, the GIL must be held
+static void free_context(Context *ctx) {
+    Py_XDECREF(ctx->lastRetval);
+    Py_XDECREF(ctx->filter_fn);
+    Py_XDECREF(ctx->pModule);
+    
+    delete ctx;
+}
+
 /**
     Called when the input plugin is cleaning up (will get called during
     initialization if initialization fails).
@@ -219,23 +247,22 @@ void filter_free(void* filter_ctx) {
     
     Context * ctx = (Context*)filter_ctx;
     
-    if (ctx->pMainThread != NULL) {
-        PyEval_RestoreThread(ctx->pMainThread);
-    }
+    python_loaded -= 1;
     
-    Py_XDECREF(ctx->lastRetval);
-    Py_XDECREF(ctx->filter_fn);
-    Py_XDECREF(ctx->pModule);
+    // the other contexts keep the interpreter, this one only needs the GIL
+    if (python_loaded > 0) {
+        PyGILState_STATE gil_state = PyGILState_Ensure();
+        free_context(ctx);
+        PyGILState_Release(gil_state);
+        return;
+    }
     
-    delete ctx;
+    PyEval_RestoreThread(pMainThread);
+    pMainThread = NULL;
     
-    python_loaded -= 1;
+    free_context(ctx);
     
-    if (python_loaded == 0) {
-        // TODO: weird threading KeyError... probably because this is not called
-        //       from the same thread as filter_init
-        Py_Finalize();
-    }
+    // TODO: weird threading KeyError... probably because this is not called
+    //       from the same thread as filter_init
+    Py_Finalize();
 }
-
-
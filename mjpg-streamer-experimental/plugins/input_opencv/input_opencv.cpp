@@ -23,8 +23,11 @@
 #include <getopt.h>
 #include <dlfcn.h>
 #include <pthread.h>
+#include <deque>
+#include <map>
 
 #include "input_opencv.h"
+#include "../input_uvc/huffman.h"
 
 #include "opencv2/opencv.hpp"
 
@@ -42,15 +45,39 @@ typedef struct {
         br_set, br,
         sa_set, sa,
         gain_set, gain,
-        ex_set, ex;
+        ex_set, ex,
+        kbps_set, kbps,
+        maxsize_set, maxsize,
+        filters_set, filters,
+        encoders_set, encoders;
 } context_settings;
 
 // filter functions
 typedef bool (*filter_init_fn)(const char * args, void** filter_ctx);
 typedef Mat (*filter_init_frame_fn)(void* filter_ctx);
 typedef void (*filter_process_fn)(void* filter_ctx, Mat &src, Mat &dst);
+typedef void (*filter_process_umat_fn)(void* filter_ctx, UMat &src, UMat &dst);
 typedef void (*filter_free_fn)(void* filter_ctx);
 
+/* a frame on its way through the stages of the pipeline */
+typedef struct {
+    unsigned long long seq;     // order of capture, frames are published in it
+    struct timeval timestamp;
+    Mat src, dst;
+    UMat usrc, udst;            // used instead with filter_process_umat
+    vector<uchar> *jpeg;        // NULL if the frame could not be encoded
+    input_frame *raw;           // the filtered picture for raw consumers, may be NULL
+} stage_frame;
+
+/* bounded queue between two stages, a full queue blocks the stage before */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    deque<stage_frame*> frames;
+    size_t max;
+    bool closed;
+} stage_queue;
+
 
 typedef struct {
     pthread_t   worker;
@@ -64,21 +91,96 @@ typedef struct {
     filter_init_fn filter_init;
     filter_init_frame_fn filter_init_frame;
     filter_process_fn filter_process;
+    filter_process_umat_fn filter_process_umat;   // optional, keeps frames on the device
     filter_free_fn filter_free;
     
+    rate_control rate;      /* picks the quality with -kbps or -maxsize */
+    
+    /* -filters and -encoders run the stages in threads of their own */
+    vector<void*> filter_ctxs;   // one per filter thread, the first is filter_ctx
+    int encoders;
+    vector<pthread_t> threads;
+    stage_queue filter_queue, encode_queue;
+    
+    /* encoded frames wait here until all frames captured before are published */
+    pthread_mutex_t reorder_lock;
+    map<unsigned long long, stage_frame*> reorder;
+    unsigned long long next_seq;
+    volatile int quality;        // picked by the rate control for the next frames
+    struct _filter_worker *workers;
+    input *in;
+    
+    /* without a filter the MJPEG frames of the camera are published as they come */
+    bool passthrough;
+    int huffman;                 // the frames carry huffman tables, -1 until the first one
+    
+    /* -encoder compresses with a JPEG backend of mjpg_streamer instead of imencode */
+    int backend;                 // JPEG_BACKEND_*, -1 for imencode
+    jpeg_backend *jpeg;          // the one of the capture thread, encoder threads have their own
 } context;
 
+/* what a filter thread works with */
+typedef struct _filter_worker {
+    context *pctx;
+    void *filter_ctx;
+} filter_worker;
+
 
 void *worker_thread(void *);
 void worker_cleanup(void *);
+static bool start_passthrough(context *pctx);
 
 #define INPUT_PLUGIN_NAME "OpenCV Input plugin"
 static char plugin_name[] = INPUT_PLUGIN_NAME;
 
+/*
+ * imencode writes into a vector which each published frame keeps until its
+ * last reference is gone, the vector is then reused for one of the next frames
+ */
+#define SPARE_JPEG_BUFFERS (INPUT_RING_SIZE + 2)
+static pthread_mutex_t spare_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<vector<uchar>*> spare_jpeg_buffers;
+
 static void null_filter(void* filter_ctx, Mat &src, Mat &dst) {
     dst = src;
 }
 
+/******************************************************************************
+Description.: get a vector to encode a frame into
+Input Value.: -
+Return Value: a spare vector or a new one
+******************************************************************************/
+static vector<uchar> *get_jpeg_buffer() {
+    vector<uchar> *buffer = NULL;
+
+    pthread_mutex_lock(&spare_lock);
+    if (!spare_jpeg_buffers.empty()) {
+        buffer = spare_jpeg_buffers.back();
+        spare_jpeg_buffers.pop_back();
+    }
+    pthread_mutex_unlock(&spare_lock);
+
+    return buffer != NULL ? buffer : new vector<uchar>();
+}
+
+/******************************************************************************
+Description.: release hook of the frames, keeps the vector for the next frames
+Input Value.: the vector of the frame
+Return Value: -
+******************************************************************************/
+static void release_jpeg_buffer(void *arg) {
+    vector<uchar> *buffer = (vector<uchar>*)arg;
+
+    pthread_mutex_lock(&spare_lock);
+    if (spare_jpeg_buffers.size() < SPARE_JPEG_BUFFERS) {
+        spare_jpeg_buffers.push_back(buffer);
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&spare_lock);
+
+    delete buffer;
+}
+
 static void help() {
     
     fprintf(stderr,
@@ -96,6 +198,13 @@ static void help() {
     fprintf(stderr,
     " [-f | --fps ]..........: frames per second\n" \
     " [-q | --quality ] .....: set quality of JPEG encoding\n" \
+    " [-kbps ]...............: lower the quality to stay below this bitrate\n" \
+    " [-maxsize ]............: lower the quality to keep frames below this\n" \
+    "                          many bytes\n" \
+    " [-filters ]............: run the filter in this many threads\n" \
+    " [-encoders ]...........: encode frames in this many threads\n" \
+    " [-encoder ]............: compress with libjpeg, slices, turbojpeg, m2m or\n" \
+    "                          the fastest of them with auto, default: imencode\n" \
     " ---------------------------------------------------------------\n" \
     " Optional parameters (may not be supported by all cameras):\n\n"
     " [-br ].................: Set image brightness (integer)\n"\
@@ -145,6 +254,7 @@ int input_init(input_parameter *param, int plugin_no)
     context_settings *settings;
     
     pctx = new context();
+    pctx->backend = -1;
     
     settings = pctx->init_settings = init_settings();
     pglobal = param->global;
@@ -180,6 +290,11 @@ int input_init(input_parameter *param, int plugin_no)
             {"ex", required_argument, 0, 0},
             {"filter", required_argument, 0, 0},
             {"fargs", required_argument, 0, 0},
+            {"kbps", required_argument, 0, 0},
+            {"maxsize", required_argument, 0, 0},
+            {"filters", required_argument, 0, 0},
+            {"encoders", required_argument, 0, 0},
+            {"encoder", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
     
@@ -243,6 +358,29 @@ int input_init(input_parameter *param, int plugin_no)
             filter_args = optarg;
             break;
             
+        /* kbps, maxsize */
+        OPTION_INT(17, kbps)
+            break;
+        OPTION_INT(18, maxsize)
+            break;
+            
+        /* filters, encoders */
+        OPTION_INT(19, filters)
+            settings->filters = MIN(MAX(settings->filters, 1), 16);
+            break;
+        OPTION_INT(20, encoders)
+            settings->encoders = MIN(MAX(settings->encoders, 1), 16);
+            break;
+            
+        /* encoder */
+        case 21:
+            if ((pctx->backend = jpeg_backend_parse(optarg)) < 0) {
+                IPRINT("unknown JPEG encoder %s\n", optarg);
+                help();
+                return 1;
+            }
+            break;
+            
         default:
             help();
             return 1;
@@ -272,6 +410,11 @@ int input_init(input_parameter *param, int plugin_no)
         goto fatal_error;
     }
     
+    /* the quality is shown through the "JPEG quality" control */
+    rate_control_init(&pctx->rate, in, settings->quality, MAX(settings->kbps, 0), MAX(settings->maxsize, 0));
+    if (settings->kbps_set || settings->maxsize_set)
+        IPRINT("rate control..... : %d kbit/s, %d bytes per frame\n", settings->kbps, settings->maxsize);
+    
     pctx->capture.set(CAP_PROP_FRAME_WIDTH, width);
     pctx->capture.set(CAP_PROP_FRAME_HEIGHT, height);
     
@@ -313,19 +456,49 @@ int input_init(input_parameter *param, int plugin_no)
         
         // optional functions
         pctx->filter_init_frame = (filter_init_frame_fn)dlsym(pctx->filter_handle, "filter_init_frame");
+        pctx->filter_process_umat = (filter_process_umat_fn)dlsym(pctx->filter_handle, "filter_process_umat");
+        if (pctx->filter_process_umat != NULL) {
+            IPRINT("filter frames.... : UMat, OpenCL %s\n", ocl::useOpenCL() ? "enabled" : "not available");
+        }
         
         // initialize it
         if (!pctx->filter_init(filter_args, &pctx->filter_ctx)) {
             goto fatal_error;
         }
+        pctx->filter_ctxs.push_back(pctx->filter_ctx);
+        
+        // each further filter thread gets a context of its own
+        for (i = 1; i < settings->filters; i++) {
+            void *filter_ctx = NULL;
+            bool initialized = pctx->filter_init(filter_args, &filter_ctx);
+            
+            // a context that failed is freed as well, like the first one
+            pctx->filter_ctxs.push_back(filter_ctx);
+            if (!initialized) {
+                goto fatal_error;
+            }
+        }
         
     } else {
         pctx->filter_handle = NULL;
         pctx->filter_ctx = NULL;
         pctx->filter_process = null_filter;
         pctx->filter_free = NULL;
+        pctx->filter_ctxs.assign(MAX(settings->filters, 1), (void*)NULL);
+        
+        /* nothing needs the pixels unless the quality is to be changed */
+        if (!settings->quality_set && !settings->kbps_set && !settings->maxsize_set)
+            pctx->passthrough = start_passthrough(pctx);
     }
     
+    if (settings->filters_set || settings->encoders_set) {
+        pctx->encoders = MAX(settings->encoders, 1);
+        IPRINT("pipeline......... : %d filter, %d encoder threads\n",
+               (int)pctx->filter_ctxs.size(), pctx->encoders);
+    }
+    if (pctx->backend >= 0)
+        IPRINT("JPEG backend..... : %s\n", jpeg_backend_name(pctx->backend));
+    
     return 0;
     
 fatal_error:
@@ -334,6 +507,43 @@ fatal_error:
     exit(EXIT_FAILURE);
 }
 
+/******************************************************************************
+Description.: ask the capture device for its compressed frames instead of
+              decoded pictures, only the V4L2 backend hands them over
+Input Value.: the context
+Return Value: true if the frames are read undecoded from now on
+******************************************************************************/
+static bool start_passthrough(context *pctx)
+{
+    bool raw;
+    
+    if (!pctx->capture.set(CAP_PROP_FOURCC, VideoWriter::fourcc('M', 'J', 'P', 'G')))
+        return false;
+    
+    /* older OpenCV versions know only the one or the other */
+    raw = pctx->capture.set(CAP_PROP_CONVERT_RGB, 0);
+    raw = pctx->capture.set(CAP_PROP_FORMAT, -1) || raw;
+    if (!raw)
+        return false;
+    
+    pctx->huffman = -1;
+    IPRINT("passthrough...... : the MJPEG frames of the camera\n");
+    return true;
+}
+
+/******************************************************************************
+Description.: go back to decoded pictures, the camera does not send JPEG
+Input Value.: the context
+Return Value: -
+******************************************************************************/
+static void stop_passthrough(context *pctx)
+{
+    pctx->capture.set(CAP_PROP_FORMAT, CV_8UC3);
+    pctx->capture.set(CAP_PROP_CONVERT_RGB, 1);
+    pctx->passthrough = false;
+    IPRINT("the camera does not send JPEG frames, they are decoded and encoded again\n");
+}
+
 /******************************************************************************
 Description.: stops the execution of the worker thread
 Input Value.: -
@@ -361,9 +571,6 @@ int input_run(int id)
     input * in = &pglobal->in[id];
     context *pctx = (context*)in->context;
     
-    in->buf = NULL;
-    in->size = 0;
-    
     if(pthread_create(&pctx->worker, 0, worker_thread, in) != 0) {
         worker_cleanup(in);
         fprintf(stderr, "could not start worker thread\n");
@@ -374,6 +581,567 @@ int input_run(int id)
     return 0;
 }
 
+/******************************************************************************
+Description.: hand an encoded frame over to the outputs
+Input Value.: * in.......: the input to publish to
+              * jpeg.....: the buffer, owned by the frame afterwards
+              * timestamp: when the frame was captured
+              * raw......: the raw frame to attach, handed over, may be NULL
+Return Value: 0 if ok, -1 if the frame could not be allocated
+******************************************************************************/
+static int publish_jpeg(input *in, vector<uchar> *jpeg, const struct timeval *timestamp, input_frame *raw)
+{
+    // std::vector is guaranteed to be contiguous
+    input_frame *frame = frame_wrap(&(*jpeg)[0], jpeg->size(), release_jpeg_buffer, jpeg);
+    if (frame == NULL) {
+        release_jpeg_buffer(jpeg);
+        frame_unref(raw);
+        return -1;
+    }
+    
+    frame->timestamp = *timestamp;
+    frame_attach_raw(frame, raw);
+    input_publish_frame(in, frame);
+    return 0;
+}
+
+/******************************************************************************
+Description.: copy a MJPEG frame of the camera into a buffer of its own, with
+              the huffman tables most UVC cameras leave out. The capture
+              buffer goes back to the driver with the next read.
+Input Value.: * pctx: the context
+              * raw.: the frame as read in passthrough mode
+              * jpeg: gets the JPEG
+Return Value: false if the frame is no JPEG
+******************************************************************************/
+static bool copy_passthrough(context *pctx, const Mat &raw, vector<uchar> &jpeg)
+{
+    const unsigned char *data = raw.data, *sof;
+    size_t size = raw.total() * raw.elemSize(), i;
+    
+    if (!raw.isContinuous() || size < 4 || data[0] != 0xff || data[1] != 0xd8)
+        return false;
+    
+    /* a camera either always sends the tables or never */
+    if (pctx->huffman < 0) {
+        pctx->huffman = 0;
+        for (i = 2; i + 1 < size && i < 2048 && !(data[i] == 0xff && data[i + 1] == 0xda); i++) {
+            if (data[i] == 0xff && data[i + 1] == 0xc4) {
+                pctx->huffman = 1;
+                break;
+            }
+        }
+    }
+    
+    if (pctx->huffman) {
+        jpeg.assign(data, data + size);
+        return true;
+    }
+    
+    /* the tables go in front of the frame header */
+    for (sof = data + 2; sof + 1 < data + size && !(sof[0] == 0xff && sof[1] == 0xc0); sof++);
+    if (sof + 1 >= data + size)
+        return false;
+    
+    jpeg.reserve(size + sizeof(dht_data));
+    jpeg.assign(data, sof);
+    jpeg.insert(jpeg.end(), dht_data, dht_data + sizeof(dht_data));
+    jpeg.insert(jpeg.end(), sof, data + size);
+    return true;
+}
+
+/******************************************************************************
+Description.: publish the MJPEG frames of the camera without decoding them,
+              until reading fails or a frame turns out not to be a JPEG
+Input Value.: * in..: the input
+              * pctx: its context
+Return Value: true if the camera stopped, false to decode its frames instead
+******************************************************************************/
+static bool passthrough_capture(input *in, context *pctx)
+{
+    struct timeval timestamp;
+    Mat raw;
+    
+    while (!pglobal->stop) {
+        if (!pctx->capture.read(raw))
+            return true;
+        gettimeofday(&timestamp, NULL);
+        
+        vector<uchar> *jpeg_buffer = get_jpeg_buffer();
+        if (!copy_passthrough(pctx, raw, *jpeg_buffer)) {
+            release_jpeg_buffer(jpeg_buffer);
+            stop_passthrough(pctx);
+            return false;
+        }
+        
+        if (publish_jpeg(in, jpeg_buffer, &timestamp, NULL) != 0) {
+            IPRINT("could not allocate memory\n");
+        }
+    }
+    
+    return true;
+}
+
+/******************************************************************************
+Description.: set up a queue between two stages
+Input Value.: * q..: the queue
+              * max: number of frames it holds before the stage before waits
+Return Value: -
+******************************************************************************/
+static void queue_init(stage_queue *q, size_t max)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->max = max;
+    q->closed = false;
+}
+
+/******************************************************************************
+Description.: append a frame, waits while the queue is full
+Input Value.: * q....: the queue
+              * frame: the frame, owned by the queue if it was added
+Return Value: true if the frame was added, false if the queue was closed
+******************************************************************************/
+static bool queue_push(stage_queue *q, stage_frame *frame)
+{
+    bool added = false;
+    int state;
+    
+    /* a cancelled capture thread must not leave the lock taken */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    pthread_mutex_lock(&q->lock);
+    while (!q->closed && q->frames.size() >= q->max)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    if (!q->closed) {
+        q->frames.push_back(frame);
+        pthread_cond_signal(&q->not_empty);
+        added = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    pthread_setcancelstate(state, NULL);
+    
+    return added;
+}
+
+/******************************************************************************
+Description.: take the oldest frame, waits while the queue is empty
+Input Value.: the queue
+Return Value: the frame or NULL once the queue was closed
+******************************************************************************/
+static stage_frame *queue_pop(stage_queue *q)
+{
+    stage_frame *frame = NULL;
+    
+    pthread_mutex_lock(&q->lock);
+    while (!q->closed && q->frames.empty())
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    if (!q->closed) {
+        frame = q->frames.front();
+        q->frames.pop_front();
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    
+    return frame;
+}
+
+/******************************************************************************
+Description.: wake up all threads waiting for a queue and let them leave
+Input Value.: the queue
+Return Value: -
+******************************************************************************/
+static void queue_close(stage_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/******************************************************************************
+Description.: free a frame of the pipeline
+Input Value.: the frame
+Return Value: -
+******************************************************************************/
+static void stage_frame_free(stage_frame *frame)
+{
+    if (frame->jpeg != NULL)
+        release_jpeg_buffer(frame->jpeg);
+    frame_unref(frame->raw);
+    delete frame;
+}
+
+/******************************************************************************
+Description.: publish an encoded frame once all frames before it are out,
+              frames of the encoder threads finish in any order
+Input Value.: * pctx.: the context
+              * frame: the frame, freed by this function
+Return Value: -
+******************************************************************************/
+static void publish_in_order(context *pctx, stage_frame *frame)
+{
+    map<unsigned long long, stage_frame*>::iterator it;
+    
+    pthread_mutex_lock(&pctx->reorder_lock);
+    pctx->reorder[frame->seq] = frame;
+    
+    while ((it = pctx->reorder.find(pctx->next_seq)) != pctx->reorder.end()) {
+        frame = it->second;
+        pctx->reorder.erase(it);
+        pctx->next_seq++;
+        
+        if (frame->jpeg != NULL) {
+            /* the next frames are encoded with the quality the rate control picks */
+            pctx->quality = rate_control_update(&pctx->rate, frame->jpeg->size());
+            
+            if (publish_jpeg(pctx->in, frame->jpeg, &frame->timestamp, frame->raw) != 0) {
+                IPRINT("could not allocate memory\n");
+            }
+            frame->jpeg = NULL;
+            frame->raw = NULL;
+        }
+        frame_unref(frame->raw);
+        delete frame;
+    }
+    pthread_mutex_unlock(&pctx->reorder_lock);
+}
+
+/******************************************************************************
+Description.: read the next frame of the camera, into a UMat if the filter
+              takes those, so it stays on the device from here on
+Input Value.: * pctx: the context
+              * src.: the frame for filter_process
+              * usrc: the frame for filter_process_umat
+Return Value: false if no frame could be read
+******************************************************************************/
+static bool capture_frame(context *pctx, Mat &src, UMat &usrc)
+{
+    if (pctx->filter_process_umat != NULL)
+        return pctx->capture.read(usrc);
+    return pctx->capture.read(src);
+}
+
+/******************************************************************************
+Description.: run the filter on a frame
+Input Value.: * pctx......: the context
+              * filter_ctx: the context of the filter
+              * src, dst..: the frame and the result for filter_process
+              * usrc, udst: the same for filter_process_umat
+Return Value: -
+******************************************************************************/
+static void filter_frame(context *pctx, void *filter_ctx, Mat &src, Mat &dst, UMat &usrc, UMat &udst)
+{
+    if (pctx->filter_process_umat != NULL)
+        pctx->filter_process_umat(filter_ctx, usrc, udst);
+    else
+        pctx->filter_process(filter_ctx, src, dst);
+}
+
+/******************************************************************************
+Description.: copy a filtered frame for the consumers of raw frames, if some
+              subscribed to the input
+Input Value.: * pctx.....: the context
+              * in.......: the input
+              * dst, udst: the result of the filter
+Return Value: the raw frame, NULL if nobody wants it or it is neither BGR
+              nor gray
+******************************************************************************/
+static input_frame *copy_raw_frame(context *pctx, input *in, Mat &dst, UMat &udst)
+{
+    raw_format format;
+    Mat picture;
+    const unsigned char *plane;
+    int length;
+    
+    if (!input_raw_wanted(in))
+        return NULL;
+    
+    picture = (pctx->filter_process_umat != NULL) ? udst.getMat(ACCESS_READ) : dst;
+    if (picture.empty() || (picture.type() != CV_8UC3 && picture.type() != CV_8UC1))
+        return NULL;
+    
+    memset(&format, 0, sizeof(format));
+    format.pixelformat = (picture.type() == CV_8UC3) ? V4L2_PIX_FMT_BGR24 : V4L2_PIX_FMT_GREY;
+    format.width = picture.cols;
+    format.height = picture.rows;
+    format.planes = 1;
+    format.stride[0] = picture.step;
+    format.dmabuf = -1;
+    plane = picture.data;
+    length = picture.step * picture.rows;
+    
+    return frame_raw_copy(&format, &plane, &length);
+}
+
+/******************************************************************************
+Description.: set up the JPEG backend of a thread which encodes frames
+Input Value.: the context
+Return Value: the backend, NULL to compress with imencode
+******************************************************************************/
+static jpeg_backend *new_backend(context *pctx)
+{
+    jpeg_backend_options opts;
+    
+    if (pctx->backend < 0)
+        return NULL;
+    
+    memset(&opts, 0, sizeof(opts));
+    opts.backend = pctx->backend;
+    /* several encoder threads are parallel enough without slices */
+    opts.threads = (pctx->encoders > 1) ? 1 : 0;
+    return jpeg_backend_new(&opts);
+}
+
+/******************************************************************************
+Description.: compress a BGR or grey picture with a JPEG backend
+Input Value.: * backend: the backend
+              * picture: the picture
+              * jpeg...: filled with the JPEG
+              * quality: the JPEG quality
+Return Value: false if the picture could not be encoded
+******************************************************************************/
+static bool backend_encode(jpeg_backend *backend, const Mat &picture, vector<uchar> &jpeg, int quality)
+{
+    jpeg_picture pic;
+    int len;
+    
+    memset(&pic, 0, sizeof(pic));
+    pic.format.pixelformat = (picture.type() == CV_8UC3) ? V4L2_PIX_FMT_BGR24 : V4L2_PIX_FMT_GREY;
+    pic.format.width = picture.cols;
+    pic.format.height = picture.rows;
+    pic.format.planes = 1;
+    pic.format.stride[0] = picture.step;
+    pic.format.dmabuf = -1;
+    pic.plane[0] = picture.data;
+    pic.size = picture.step * picture.rows;
+    pic.index = -1;
+    
+    /* a JPEG hardly ever gets larger than the picture */
+    jpeg.resize(pic.size);
+    if ((len = jpeg_backend_encode(backend, &pic, quality, jpeg.data(), jpeg.size())) <= 0)
+        return false;
+    jpeg.resize(len);
+    return true;
+}
+
+/******************************************************************************
+Description.: compress a filtered frame, a UMat is only downloaded here
+Input Value.: * pctx.............: the context
+              * backend..........: JPEG backend, NULL to use imencode
+              * dst, udst........: the result of the filter
+              * jpeg.............: filled with the JPEG
+              * compression_params: imencode options
+Return Value: false if the frame could not be encoded
+******************************************************************************/
+static bool encode_frame(context *pctx, jpeg_backend *backend, Mat &dst, UMat &udst, vector<uchar> &jpeg,
+                         const vector<int> &compression_params)
+{
+    bool encoded;
+    
+    /* other pictures than 8 bit BGR or grey are left to imencode */
+    if (backend != NULL) {
+        if (pctx->filter_process_umat != NULL) {
+            Mat picture = udst.getMat(ACCESS_READ);
+            if (picture.type() == CV_8UC3 || picture.type() == CV_8UC1)
+                return backend_encode(backend, picture, jpeg, compression_params[1]);
+        } else if (dst.type() == CV_8UC3 || dst.type() == CV_8UC1) {
+            return backend_encode(backend, dst, jpeg, compression_params[1]);
+        }
+    }
+    
+    if (pctx->filter_process_umat != NULL)
+        encoded = imencode(".jpg", udst, jpeg, compression_params);
+    else
+        encoded = imencode(".jpg", dst, jpeg, compression_params);
+    
+    return encoded && !jpeg.empty();
+}
+
+/******************************************************************************
+Description.: filter stage, runs the filter on the captured frames
+Input Value.: the filter_worker
+Return Value: NULL
+******************************************************************************/
+static void *filter_thread(void *arg)
+{
+    filter_worker *worker = (filter_worker*)arg;
+    context *pctx = worker->pctx;
+    stage_frame *frame;
+    
+    while ((frame = queue_pop(&pctx->filter_queue)) != NULL) {
+        filter_frame(pctx, worker->filter_ctx, frame->src, frame->dst, frame->usrc, frame->udst);
+        
+        if (!queue_push(&pctx->encode_queue, frame)) {
+            stage_frame_free(frame);
+            break;
+        }
+    }
+    
+    return NULL;
+}
+
+/******************************************************************************
+Description.: encode stage, compresses the filtered frames
+Input Value.: the context
+Return Value: NULL
+******************************************************************************/
+static void *encode_thread(void *arg)
+{
+    context *pctx = (context*)arg;
+    vector<int> compression_params(2);
+    jpeg_backend *backend = new_backend(pctx);
+    stage_frame *frame;
+    
+    compression_params[0] = CV_IMWRITE_JPEG_QUALITY;
+    
+    while ((frame = queue_pop(&pctx->encode_queue)) != NULL) {
+        compression_params[1] = governor_quality(pctx->in, pctx->quality);
+        
+        frame->jpeg = get_jpeg_buffer();
+        if (!encode_frame(pctx, backend, frame->dst, frame->udst, *frame->jpeg, compression_params)) {
+            IPRINT("could not encode the frame\n");
+            release_jpeg_buffer(frame->jpeg);
+            frame->jpeg = NULL;
+        } else {
+            frame->raw = copy_raw_frame(pctx, pctx->in, frame->dst, frame->udst);
+        }
+        
+        // the pictures are not needed anymore, the frame may wait for a while
+        frame->src.release();
+        frame->dst.release();
+        frame->usrc.release();
+        frame->udst.release();
+        
+        // failed frames are passed on too, the frames after them would wait forever
+        publish_in_order(pctx, frame);
+    }
+    
+    jpeg_backend_free(backend);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: start the filter and encoder threads
+Input Value.: * in.....: the input the frames are published to
+              * pctx...: its context
+              * quality: the JPEG quality to start with
+Return Value: 0 if ok, -1 if no thread could be started
+******************************************************************************/
+static int pipeline_start(input *in, context *pctx, int quality)
+{
+    size_t filters = pctx->filter_ctxs.size();
+    filter_worker *workers = new filter_worker[filters];
+    pthread_t thread;
+    size_t i;
+    
+    /* two frames per thread keep every thread busy */
+    queue_init(&pctx->filter_queue, 2 * filters);
+    queue_init(&pctx->encode_queue, 2 * pctx->encoders);
+    pthread_mutex_init(&pctx->reorder_lock, NULL);
+    pctx->next_seq = 0;
+    pctx->quality = quality;
+    pctx->workers = workers;
+    pctx->in = in;
+    
+    for (i = 0; i < filters; i++) {
+        workers[i].pctx = pctx;
+        workers[i].filter_ctx = pctx->filter_ctxs[i];
+        if (pthread_create(&thread, NULL, filter_thread, &workers[i]) == 0)
+            pctx->threads.push_back(thread);
+    }
+    if (pctx->threads.empty())
+        return -1;
+    
+    for (i = 0; i < (size_t)pctx->encoders; i++) {
+        if (pthread_create(&thread, NULL, encode_thread, pctx) == 0)
+            pctx->threads.push_back(thread);
+    }
+    if (pctx->threads.size() == filters)
+        return -1;
+    
+    return 0;
+}
+
+/******************************************************************************
+Description.: stop the threads of the pipeline and free the frames in it
+Input Value.: the context
+Return Value: -
+******************************************************************************/
+static void pipeline_stop(context *pctx)
+{
+    map<unsigned long long, stage_frame*>::iterator it;
+    size_t i;
+    
+    if (pctx->workers == NULL)
+        return;
+    
+    queue_close(&pctx->filter_queue);
+    queue_close(&pctx->encode_queue);
+    
+    for (i = 0; i < pctx->threads.size(); i++)
+        pthread_join(pctx->threads[i], NULL);
+    pctx->threads.clear();
+    
+    while (!pctx->filter_queue.frames.empty()) {
+        stage_frame_free(pctx->filter_queue.frames.front());
+        pctx->filter_queue.frames.pop_front();
+    }
+    while (!pctx->encode_queue.frames.empty()) {
+        stage_frame_free(pctx->encode_queue.frames.front());
+        pctx->encode_queue.frames.pop_front();
+    }
+    for (it = pctx->reorder.begin(); it != pctx->reorder.end(); it++)
+        stage_frame_free(it->second);
+    pctx->reorder.clear();
+    
+    delete[] pctx->workers;
+    pctx->workers = NULL;
+}
+
+/******************************************************************************
+Description.: capture stage of the pipeline, the filter and encoder threads
+              do the rest
+Input Value.: the context
+Return Value: -
+******************************************************************************/
+static void pipeline_capture(context *pctx)
+{
+    unsigned long long seq = 0;
+    
+    while (!pglobal->stop) {
+        stage_frame *frame = new stage_frame();
+        
+        // every frame needs a picture of its own while the others are in the pipeline
+        if (pctx->filter_init_frame != NULL)
+            frame->src = pctx->filter_init_frame(pctx->filter_ctx);
+        
+        /* the filter and encoder threads end with the capture, not on their own */
+        if (!capture_frame(pctx, frame->src, frame->usrc)) {
+            IPRINT("could not capture a frame, stopping the pipeline\n");
+            delete frame;
+            pipeline_stop(pctx);
+            break;
+        }
+        
+        /* a degraded input leaves some of the pictures it would compress */
+        if (governor_skip(pctx->in)) {
+            delete frame;
+            continue;
+        }
+        
+        gettimeofday(&frame->timestamp, NULL);
+        frame->seq = seq++;
+        frame->jpeg = NULL;
+        
+        if (!queue_push(&pctx->filter_queue, frame)) {
+            delete frame;
+            break;
+        }
+    }
+}
+
 void *worker_thread(void *arg)
 {
     input * in = (input*)arg;
@@ -413,35 +1181,59 @@ void *worker_thread(void *arg)
     settings = NULL;
     
     Mat src, dst;
-    vector<uchar> jpeg_buffer;
+    UMat usrc, udst;
+    
+    /* the frames of the camera go out as they are, if they are JPEG */
+    bool done = pctx->passthrough && passthrough_capture(in, pctx);
+    
+    /* capture, filter and encode in threads of their own */
+    if (!done && pctx->encoders > 0) {
+        if (pipeline_start(in, pctx, compression_params[1]) != 0) {
+            fprintf(stderr, "could not start the pipeline threads\n");
+            exit(EXIT_FAILURE);
+        }
+        pipeline_capture(pctx);
+    }
     
     // this exists so that the numpy allocator can assign a custom allocator to
     // the mat, so that it doesn't need to copy the data each time
-    if (pctx->filter_init_frame != NULL)
+    if (!done && pctx->encoders == 0 && pctx->filter_init_frame != NULL)
         src = pctx->filter_init_frame(pctx->filter_ctx);
+    if (!done && pctx->encoders == 0)
+        pctx->jpeg = new_backend(pctx);
     
-    while (!pglobal->stop) {
-        if (!pctx->capture.read(src))
+    /* or one after the other in this thread */
+    while (!done && pctx->encoders == 0 && !pglobal->stop) {
+        if (!capture_frame(pctx, src, usrc))
             break; // TODO
+        
+        /* a degraded input leaves some of the pictures it would compress */
+        if (governor_skip(in))
+            continue;
+        
+        struct timeval timestamp;
+        gettimeofday(&timestamp, NULL);
             
         // call the filter function
-        pctx->filter_process(pctx->filter_ctx, src, dst);
+        filter_frame(pctx, pctx->filter_ctx, src, dst, usrc, udst);
             
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&in->db);
-        
-        // take whatever Mat it returns, and write it to jpeg buffer
-        imencode(".jpg", dst, jpeg_buffer, compression_params);
-        
-        // TODO: what to do if imencode returns an error?
+        // take whatever Mat it returns, and write it to a buffer of its own,
+        // the outputs keep reading the previous frames meanwhile
+        vector<uchar> *jpeg_buffer = get_jpeg_buffer();
+        compression_params[1] = governor_quality(in, compression_params[1]);
+        if (!encode_frame(pctx, pctx->jpeg, dst, udst, *jpeg_buffer, compression_params)) {
+            IPRINT("could not encode the frame\n");
+            release_jpeg_buffer(jpeg_buffer);
+            continue;
+        }
         
-        // std::vector is guaranteed to be contiguous
-        in->buf = &jpeg_buffer[0];
-        in->size = jpeg_buffer.size();
+        /* the next frame is encoded with the quality the rate control picks */
+        compression_params[1] = rate_control_update(&pctx->rate, jpeg_buffer->size());
         
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&in->db_update);
-        pthread_mutex_unlock(&in->db);
+        /* hand the buffer over to a frame and signal fresh_frame */
+        if (publish_jpeg(in, jpeg_buffer, &timestamp, copy_raw_frame(pctx, in, dst, udst)) != 0) {
+            IPRINT("could not allocate memory\n");
+        }
     }
     
     IPRINT("leaving input thread, calling cleanup function now\n");
@@ -460,9 +1252,18 @@ void worker_cleanup(void *arg)
     input * in = (input*)arg;
     if (in->context != NULL) {
         context *pctx = (context*)in->context;
+        size_t i;
         
-        if (pctx->filter_free != NULL && pctx->filter_ctx != NULL) {
-            pctx->filter_free(pctx->filter_ctx);
+        /* the threads of the pipeline still use the filters */
+        pipeline_stop(pctx);
+        
+        if (pctx->filter_free != NULL) {
+            for (i = 0; i < pctx->filter_ctxs.size(); i++) {
+                if (pctx->filter_ctxs[i] != NULL)
+                    pctx->filter_free(pctx->filter_ctxs[i]);
+            }
+            if (pctx->filter_ctxs.empty() && pctx->filter_ctx != NULL)
+                pctx->filter_free(pctx->filter_ctx);
             pctx->filter_free = NULL;
         }
         
@@ -471,6 +1272,9 @@ void worker_cleanup(void *arg)
             pctx->filter_handle = NULL;
         }
         
+        jpeg_backend_free(pctx->jpeg);
+        pctx->jpeg = NULL;
+        
         delete pctx;
         in->context = NULL;
     }
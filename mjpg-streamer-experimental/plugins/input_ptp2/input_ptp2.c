@@ -26,6 +26,7 @@
 #include <pthread.h>
 #include <gphoto2/gphoto2-camera.h>
 #include "input_ptp2.h"
+#include "../../utils.h"
 
 #define INPUT_PLUGIN_NAME "PTP2 input plugin"
 
@@ -39,6 +40,21 @@ Camera* camera;
 char* selected_port;
 int delay;
 
+/*
+ * previews are published by reference, each frame keeps its CameraFile
+ * until the last output let go of it. The ring of the input holds
+ * INPUT_RING_SIZE frames, the rest are on their way to the outputs.
+ */
+#define PREVIEW_FILES (INPUT_RING_SIZE + 4)
+
+typedef struct _preview_file {
+	CameraFile* file;
+	int busy;
+	int pooled;
+} preview_file;
+
+static preview_file previews[PREVIEW_FILES];
+
 int input_init(input_parameter *param, int id)
 {
 	int i;
@@ -120,7 +136,7 @@ void help()
 	" ---------------------------------------------------------------\n"
 	" The following parameters can be passed to this plugin:\n\n"
 	" [-h ]..........: print this help\n"
-	" [-u X ]........: delay between frames in us (default 0)\n"
+	" [-u X ]........: delay between the starts of frames in us (default 0)\n"
 	" [-d X ]........: camera address in [usb:xxx,yyy] form; use\n"
 	"                  gphoto2 --auto-detect to get a list of\n"
 	"                  available cameras\n"
@@ -208,7 +224,6 @@ int input_run(int id)
 	// starting thread
 	if(pthread_create(&thread, 0, capture, NULL) != 0)
 	{
-		free(global->in[id].buf);
 		IPRINT("could not start worker thread\n");
 		exit(EXIT_FAILURE);
 	}
@@ -217,32 +232,93 @@ int input_run(int id)
 	return 0;
 }
 
-void* capture(void* arg)
+/******************************************************************************
+Description.: hand a CameraFile back once no frame refers to its data anymore
+Input Value.: the preview_file of the frame
+Return Value: -
+******************************************************************************/
+static void release_preview(void* arg)
 {
-	int res;
-	int i = 0;
-	CameraFile* file;
+	preview_file* preview = arg;
+
+	if(preview->pooled)
+		__atomic_store_n(&preview->busy, 0, __ATOMIC_RELEASE);
+	else
+	{
+		gp_file_unref(preview->file);
+		free(preview);
+	}
+}
+
+/******************************************************************************
+Description.: get a CameraFile to capture the next preview into, a file of the
+              pool if one is free, otherwise a new one which is dropped again
+              with its frame
+Input Value.: -
+Return Value: the file or NULL on error
+******************************************************************************/
+static preview_file* get_preview(void)
+{
+	preview_file* preview;
+	int i;
+
+	for(i = 0; i < PREVIEW_FILES; i++)
+	{
+		if(previews[i].file == NULL && gp_file_new(&previews[i].file) != GP_OK)
+		{
+			previews[i].file = NULL;
+			continue;
+		}
+		previews[i].pooled = 1;
+		if(__atomic_load_n(&previews[i].busy, __ATOMIC_ACQUIRE) == 0)
+		{
+			previews[i].busy = 1;
+			return &previews[i];
+		}
+	}
 
-	int jpeg_buffer_size = 256 * 1024;
-	global->in[plugin_id].buf = malloc(jpeg_buffer_size);
-	if(global->in[plugin_id].buf == NULL)
+	if((preview = calloc(1, sizeof(preview_file))) == NULL)
+		return NULL;
+	if(gp_file_new(&preview->file) != GP_OK)
 	{
-		IPRINT(INPUT_PLUGIN_NAME " - could not allocate memory\n");
+		free(preview);
 		return NULL;
 	}
+	return preview;
+}
+
+void* capture(void* arg)
+{
+	int res;
+	int i = 0;
+	preview_file* preview;
+	input_frame* frame;
+	pacer pace;
+
+	pacer_init(&pace, delay > 0 ? 1000000.0 / delay : 0, &global->in[plugin_id]);
 
 	pthread_cleanup_push(cleanup, NULL);
 	while(!global->stop)
 	{
-		unsigned long int xsize;
+		unsigned long int xsize = 0;
 		const char* xdata;
+
+		if((preview = get_preview()) == NULL)
+		{
+			IPRINT(INPUT_PLUGIN_NAME " - could not allocate memory\n");
+			return NULL;
+		}
+
 		pthread_mutex_lock(&control_mutex);
-		res = gp_file_new(&file);
-		CAMERA_CHECK_GP(res, "gp_file_new");
-		res = gp_camera_capture_preview(camera, file, context);
+		res = gp_camera_capture_preview(camera, preview->file, context);
+		pthread_mutex_unlock(&control_mutex);
+		if(res != GP_OK)
+			release_preview(preview);
 		CAMERA_CHECK_GP(res, "gp_camera_capture_preview");
-		pthread_mutex_lock(&global->in[plugin_id].db);
-		res = gp_file_get_data_and_size(file, &xdata, &xsize);
+		res = gp_file_get_data_and_size(preview->file, &xdata, &xsize);
+		if(res != GP_OK || xsize == 0)
+			release_preview(preview);
+		CAMERA_CHECK_GP(res, "gp_file_get_data_and_size");
 		if(xsize == 0)
 		{
 			if(i++ > 3)
@@ -252,36 +328,31 @@ void* capture(void* arg)
 			}
 			int value = 0;
 			IPRINT("Read 0 bytes from camera; restarting it\n");
+			pthread_mutex_lock(&control_mutex);
 			camera_set("capture", &value);
 			sleep(3);
 			value = 1;
 			camera_set("capture", &value);
+			pthread_mutex_unlock(&control_mutex);
+			continue;
 		}
-		else
-			i = 0;
-		CAMERA_CHECK_GP(res, "gp_file_get_data_and_size");
+		i = 0;
 
-		if(jpeg_buffer_size <= xsize) {
-			jpeg_buffer_size = xsize + xsize * 10/100;
-			unsigned char *tmp_buff = realloc(global->in[plugin_id].buf,jpeg_buffer_size);
-			if(tmp_buff == NULL)
-			{
-				IPRINT(INPUT_PLUGIN_NAME " - could not allocate memory\n");
-				return NULL;
-			}
-			global->in[plugin_id].buf = tmp_buff;
+		/*
+		 * publish the data of the CameraFile itself, the outputs send it
+		 * while the camera transfers the next preview into another file
+		 */
+		if((frame = frame_wrap((unsigned char *)xdata, xsize, release_preview, preview)) == NULL)
+		{
+			release_preview(preview);
+			IPRINT(INPUT_PLUGIN_NAME " - could not allocate memory\n");
+			return NULL;
 		}
-
-
-		memcpy(global->in[plugin_id].buf, xdata, xsize);
-		res = gp_file_unref(file);
-		pthread_mutex_unlock(&control_mutex);
-		CAMERA_CHECK_GP(res, "gp_file_unref");
-		global->in[plugin_id].size = xsize;
-		DBG("Read %d bytes from camera.\n", global->in[plugin_id].size);
-		pthread_cond_broadcast(&global->in[plugin_id].db_update);
-		pthread_mutex_unlock(&global->in[plugin_id].db);
-		usleep(delay);
+		gettimeofday(&frame->timestamp, NULL);
+		frame->dequeue_usec = monotonic_usec();
+		input_publish_frame(&global->in[plugin_id], frame);
+		DBG("Read %lu bytes from camera.\n", xsize);
+		pacer_wait(&pace);
 	}
 	pthread_cleanup_pop(1);
 
@@ -315,9 +386,9 @@ void cleanup(void *arg)
 	IPRINT("PTP2 capture - Cleaning up\n");
 	camera_set("capture", &value);
 	gp_camera_exit(camera, context);
+	/* files still referenced by frames are dropped with the process */
 	gp_camera_unref(camera);
 	gp_context_unref(context);
-	free(global->in[plugin_id].buf);
 }
 
 int input_cmd(int plugin, unsigned int control_id, unsigned int group, int value)
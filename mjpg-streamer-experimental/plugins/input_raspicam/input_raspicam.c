@@ -58,6 +58,16 @@
 #define STILLS_FRAME_RATE_DEN 1
 /// Video render needs at least 2 buffers.
 #define VIDEO_OUTPUT_BUFFERS_NUM 3
+/// JPEG buffers of the encoder, the outputs may hold all but two of them
+#define ENCODER_OUTPUT_BUFFERS_NUM 8
+/// hardware resizer for the second resolution
+#define MMAL_COMPONENT_RESIZER "vc.ril.isp"
+/// keeps the camera running between bursts when there is no preview
+#define MMAL_COMPONENT_NULL_SINK "vc.null_sink"
+/// the generic control which triggers a burst
+#define BURST_CONTROL_ID 1
+/// most stills of a burst
+#define BURST_MAX 100
 
 #define INPUT_PLUGIN_NAME "raspicam input plugin"
 
@@ -76,6 +86,7 @@ static int plugin_number;
 void *worker_thread(void *);
 void worker_cleanup(void *);
 void help(void);
+static void add_burst_control(input *in);
 
 static int fps = 5;
 static int width = 640;
@@ -84,8 +95,19 @@ static int quality = 85;
 static int usestills = 0;
 static int wantPreview = 0;
 static int wantTimestamp = 0;
+static int lores_width = 0;     // second resolution, 0 if there is none
+static int lores_height = 0;
+static int lores_id = -1;       // the input its frames are published to
+static int burst_count = 0;     // stills of a burst, 0 without -burst
 static RASPICAM_CAMERA_PARAMETERS c_params;
 
+/* bursts asked for with the burst control, taken by the worker */
+static pthread_mutex_t burst_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t burst_cond = PTHREAD_COND_INITIALIZER;
+static int burst_next = 0;      // stills of the next burst, 0 if none was asked for
+static unsigned long long burst_trigger_usec; // monotonic_usec() it was asked for
+static unsigned int burst_id = 0; // of the last burst
+
 static struct timeval timestamp;
 
 /** Struct used to pass information in encoder port userdata to callback
@@ -96,8 +118,19 @@ typedef struct
   VCOS_SEMAPHORE_T complete_semaphore; /// semaphore which is posted when we reach end of frame (indicates end of capture or fault)
   MMAL_POOL_T *pool; /// pointer to our state in case required in callback
   uint32_t offset;
+  input_frame *frame; /// frame which is currently assembled
+  int id; /// input the frames are published to
+  MMAL_PORT_T *port; /// output port of the encoder
+  int held_buffers; /// buffers published without a copy which the outputs still hold
+  int held_max; /// above this frames are copied, so the encoder keeps buffers
+  int closing; /// the port is going away, released buffers stay in the pool
+  unsigned int burst; /// burst of the still being taken, 0 outside of bursts
+  int burst_index; /// its position in the burst
 } PORT_USERDATA;
 
+/* one JPEG encoder per resolution, kept static as frames may outlive the worker */
+static PORT_USERDATA encoder_data[2];
+
 
 
 /*** plugin interface functions ***/
@@ -165,6 +198,8 @@ int input_init(input_parameter *param, int plugin_no)
       {"awbgainR", required_argument, 0, 0},          // 30
       {"awbgainB", required_argument, 0, 0},          // 31
       {"roi", required_argument, 0, 0},               // 32
+      {"lores", required_argument, 0, 0},             // 33
+      {"burst", required_argument, 0, 0},             // 34
       {0, 0, 0, 0}
     };
 
@@ -308,6 +343,24 @@ int input_init(input_parameter *param, int plugin_no)
         // roi
         sscanf(optarg, "%lf,%lf,%lf,%lf", &c_params.roi.x, &c_params.roi.y, &c_params.roi.w, &c_params.roi.h);
         break;
+      case 33:
+        // second resolution, encoded by a second JPEG encoder
+        if (sscanf(optarg, "%dx%d", &lores_width, &lores_height) != 2 || lores_width <= 0 || lores_height <= 0)
+        {
+          IPRINT("-lores needs a resolution like 640x480\n");
+          return 1;
+        }
+        break;
+      case 34:
+        // stills taken back to back when the burst control is set
+        burst_count = atoi(optarg);
+        if (burst_count < 1 || burst_count > BURST_MAX)
+        {
+          IPRINT("-burst needs 1 to %d stills\n", BURST_MAX);
+          return 1;
+        }
+        usestills = 1;
+        break;
       default:
         DBG("default case\n");
         help();
@@ -317,14 +370,88 @@ int input_init(input_parameter *param, int plugin_no)
 
   pglobal = param->global;
 
+  /* the second resolution is published by an input of its own */
+  if (lores_width > 0)
+  {
+    if (usestills)
+    {
+      IPRINT("-lores needs video mode, it can not be used with -usestills or -burst\n");
+      return 1;
+    }
+    if ((lores_id = input_add(&pglobal->in[plugin_no])) < 0)
+    {
+      IPRINT("could not add an input for the second resolution\n");
+      return 1;
+    }
+  }
+
   IPRINT("fps.............: %i\n", fps);
   IPRINT("resolution........: %i x %i\n", width, height);
+  if (lores_id >= 0)
+    IPRINT("second resolution.: %i x %i as input %i\n", lores_width, lores_height, lores_id);
+  if (burst_count > 0)
+  {
+    IPRINT("burst.............: %i stills at %i fps on command\n", burst_count, fps);
+    add_burst_control(&pglobal->in[plugin_no]);
+  }
   IPRINT("camera parameters..............:\n\n");
   raspicamcontrol_dump_parameters(&c_params);
 
   return 0;
 }
 
+/******************************************************************************
+  Description.: offer the generic control which triggers a burst
+  Input Value.: the input
+  Return Value: -
+ ******************************************************************************/
+static void add_burst_control(input *in)
+{
+  control burst;
+
+  memset(&burst, 0, sizeof(burst));
+  burst.group = IN_CMD_GENERIC;
+  burst.menuitems = NULL;
+  burst.value = burst_count;
+  burst.ctrl.id = BURST_CONTROL_ID;
+  burst.ctrl.type = V4L2_CTRL_TYPE_INTEGER;
+  strcpy((char *)burst.ctrl.name, "Burst stills");
+  burst.ctrl.minimum = 1;
+  burst.ctrl.maximum = BURST_MAX;
+  burst.ctrl.step = 1;
+  burst.ctrl.default_value = burst_count;
+
+  if ((in->in_parameters = malloc(sizeof(control))) == NULL)
+    return;
+  in->in_parameters[0] = burst;
+  in->parametercount = 1;
+}
+
+/******************************************************************************
+  Description.: process commands, with -burst setting the burst control takes
+                that many stills. A burst asked for while one is taken
+                follows it, later ones replace it.
+  Input Value.: * plugin.....: number of the input plugin
+                * control_id.: the control
+                * group......: IN_CMD_GENERIC
+                * value......: stills of the burst, its default if out of range
+  Return Value: 0 if ok, -1 for unknown controls
+ ******************************************************************************/
+int input_cmd(int plugin, unsigned int control_id, unsigned int group, int value, char *value_string)
+{
+  if (burst_count == 0 || group != IN_CMD_GENERIC || control_id != BURST_CONTROL_ID)
+    return -1;
+
+  pthread_mutex_lock(&burst_mutex);
+  if (burst_next == 0)
+    burst_trigger_usec = monotonic_usec();
+  burst_next = (value >= 1 && value <= BURST_MAX) ? value : burst_count;
+  pthread_cond_signal(&burst_cond);
+  pthread_mutex_unlock(&burst_mutex);
+
+  return 0;
+}
+
 /******************************************************************************
   Description.: stops the execution of the worker thread
   Input Value.: -
@@ -332,6 +459,10 @@ int input_init(input_parameter *param, int plugin_no)
  ******************************************************************************/
 int input_stop(int id)
 {
+  /* the worker of the first input serves the second resolution too */
+  if (id != plugin_number)
+    return 0;
+
   DBG("will cancel input thread\n");
   pthread_cancel(worker);
 
@@ -367,6 +498,76 @@ void print_mmal_status(MMAL_STATUS_T status)
   }
 }
 
+/**
+ * Frame release function for encoder buffers published without a copy
+ *
+ * Runs when the last output dropped the frame. The buffer goes back to the
+ * pool, in video mode it is handed to the encoder again right away.
+ *
+ * @param arg the MMAL_BUFFER_HEADER_T of the frame
+ */
+static void encoder_buffer_release(void *arg)
+{
+  MMAL_BUFFER_HEADER_T *buffer = (MMAL_BUFFER_HEADER_T *)arg;
+  PORT_USERDATA *pData = (PORT_USERDATA *)buffer->user_data;
+
+  mmal_buffer_header_mem_unlock(buffer);
+  mmal_buffer_header_release(buffer);
+  __sync_fetch_and_sub(&pData->held_buffers, 1);
+
+  // bursts keep all buffers at the encoder, so no still waits for one
+  if ((!usestills || burst_count > 0) && !pData->closing && pData->port->is_enabled)
+  {
+    MMAL_BUFFER_HEADER_T *new_buffer = mmal_queue_get(pData->pool->queue);
+
+    if (new_buffer && mmal_port_send_buffer(pData->port, new_buffer) != MMAL_SUCCESS)
+      DBG("Failed returning a buffer to the encoder port \n");
+  }
+}
+
+/**
+ * Publish a JPEG that arrived in a single encoder buffer without copying it
+ *
+ * The frame holds a reference of the buffer until the outputs are done. If
+ * too many buffers are held already the caller copies the frame instead.
+ *
+ * @param pData the state of the encoder
+ * @param buffer the buffer holding the complete JPEG
+ * @return 0 if the buffer was published, -1 if it has to be copied
+ */
+static int encoder_buffer_publish(PORT_USERDATA *pData, MMAL_BUFFER_HEADER_T *buffer)
+{
+  input_frame *frame;
+
+  if (__sync_add_and_fetch(&pData->held_buffers, 1) > pData->held_max)
+  {
+    __sync_fetch_and_sub(&pData->held_buffers, 1);
+    return -1;
+  }
+
+  mmal_buffer_header_mem_lock(buffer);
+  frame = frame_wrap(buffer->data, buffer->length, encoder_buffer_release, buffer);
+  if (frame == NULL)
+  {
+    mmal_buffer_header_mem_unlock(buffer);
+    __sync_fetch_and_sub(&pData->held_buffers, 1);
+    return -1;
+  }
+  buffer->user_data = pData;
+  mmal_buffer_header_acquire(buffer);
+  frame->burst = pData->burst;
+  frame->burst_index = pData->burst_index;
+
+  if(wantTimestamp)
+  {
+    gettimeofday(&timestamp, NULL);
+    frame->timestamp = timestamp;
+  }
+
+  input_publish_frame(&pglobal->in[pData->id], frame);
+  return 0;
+}
+
 /******************************************************************************
   Callback from mmal JPEG encoder
  ******************************************************************************/
@@ -379,43 +580,71 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
 
   if (pData)
   {
-    if (buffer->length)
+    /* a whole JPEG in one buffer goes to the outputs as it is */
+    if (buffer->length && pData->offset == 0 &&
+        (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END) &&
+        !(buffer->flags & MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED) &&
+        encoder_buffer_publish(pData, buffer) == 0)
+    {
+      complete = 1;
+    }
+    else if (buffer->length)
     {
       mmal_buffer_header_mem_lock(buffer);
 
       //fprintf(stderr, "The flags are %x of length %i offset %i\n", buffer->flags, buffer->length, pData->offset);
 
       //Write bytes
-      /* copy JPG picture to global buffer */
-      if(pData->offset == 0)
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
+      /* collect the JPG picture in a private frame, no lock required */
+      if(pData->frame == NULL)
+        pData->frame = frame_alloc(buffer->alloc_size);
+
+      /* JPEGs spanning several buffers move to a larger frame */
+      if(pData->frame != NULL && pData->offset + buffer->length > pData->frame->capacity)
+      {
+        input_frame *larger = frame_alloc(2 * (pData->offset + buffer->length));
+
+        if(larger != NULL)
+          memcpy(larger->buf, pData->frame->buf, pData->offset);
+        frame_unref(pData->frame);
+        pData->frame = larger;
+      }
 
-      memcpy(pData->offset + pglobal->in[plugin_number].buf, buffer->data, buffer->length);
-      pData->offset += buffer->length;
+      if(pData->frame != NULL)
+      {
+        memcpy(pData->offset + pData->frame->buf, buffer->data, buffer->length);
+        pData->offset += buffer->length;
+      }
       //fwrite(buffer->data, 1, buffer->length, pData->file_handle);
       mmal_buffer_header_mem_unlock(buffer);
     }
 
     // Now flag if we have completed
-    if (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED))
+    if (!complete && buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED))
     {
-      //set frame size
-      pglobal->in[plugin_number].size = pData->offset;
-
-      //Set frame timestamp
-      if(wantTimestamp)
+      if(pData->frame != NULL)
       {
-        gettimeofday(&timestamp, NULL);
-        pglobal->in[plugin_number].timestamp = timestamp;
+        //set frame size
+        pData->frame->size = pData->offset;
+        pData->frame->burst = pData->burst;
+        pData->frame->burst_index = pData->burst_index;
+
+        //Set frame timestamp
+        if(wantTimestamp)
+        {
+          gettimeofday(&timestamp, NULL);
+          pData->frame->timestamp = timestamp;
+        }
+
+        /* hand the frame over to the output plugins and signal fresh_frame */
+        input_publish_frame(&pglobal->in[pData->id], pData->frame);
+        pData->frame = NULL;
       }
 
       //mark frame complete
       complete = 1;
 
       pData->offset = 0;
-      /* signal fresh_frame */
-      pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-      pthread_mutex_unlock(&pglobal->in[plugin_number].db);
     }
   }
   else
@@ -423,7 +652,7 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
     DBG("Received a encoder buffer callback with no state\n");
   }
 
-  // release buffer back to the pool
+  // release buffer back to the pool, unless a frame holds it
   mmal_buffer_header_release(buffer);
 
   // and send one back to the port (if still open)
@@ -485,16 +714,11 @@ static void camera_control_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
  ******************************************************************************/
 int input_run(int id)
 {
-  pglobal->in[id].buf = malloc(width * height * 3);
-  if (pglobal->in[id].buf == NULL)
-  {
-    fprintf(stderr, "could not allocate memory\n");
-    exit(EXIT_FAILURE);
-  }
+  if (id != plugin_number)
+    return 0;
 
   if (pthread_create(&worker, 0, worker_thread, NULL) != 0)
   {
-    free(pglobal->in[id].buf);
     fprintf(stderr, "could not start worker thread\n");
     exit(EXIT_FAILURE);
   }
@@ -552,6 +776,10 @@ void help(void)
       " [-usestills]...........: uses stills mode instead of video mode \n"\
       " [-preview].............: Enable full screen preview\n"\
       " [-timestamp]...........: Get timestamp for each frame\n"
+      " [-lores]...............: also encode WIDTHxHEIGHT frames on the GPU\n"\
+      "                          and publish them as the next input\n"\
+      " [-burst]...............: take this many stills at -fps when the\n"\
+      "                          \"Burst stills\" control is set, implies -usestills\n"\
       " \n"\
       " -sh  : Set image sharpness (-100 to 100)\n"\
       " -co  : Set image contrast (-100 to 100)\n"\
@@ -574,6 +802,337 @@ void help(void)
 
 }
 
+/**
+ * Create a JPEG encoder and the pool of its output buffers
+ *
+ * The encoder takes its input format from the port it gets connected to,
+ * its frames are published to the input given by id.
+ *
+ * @param pData the state of the encoder, set up by this function
+ * @param id the input the frames are published to
+ * @return the enabled encoder component or NULL on errors
+ */
+static MMAL_COMPONENT_T *create_encoder(PORT_USERDATA *pData, int id)
+{
+  MMAL_COMPONENT_T *encoder = NULL;
+  MMAL_PORT_T *encoder_input, *encoder_output;
+  MMAL_STATUS_T status;
+
+  status = mmal_component_create(MMAL_COMPONENT_DEFAULT_IMAGE_ENCODER, &encoder);
+
+  if (status != MMAL_SUCCESS)
+  {
+    fprintf(stderr, "Unable to create JPEG encoder component\n");
+    return NULL;
+  }
+
+  if (!encoder->input_num || !encoder->output_num)
+  {
+    fprintf(stderr, "Unable to create JPEG encoder input/output ports\n");
+    mmal_component_destroy(encoder);
+    return NULL;
+  }
+
+  encoder_input = encoder->input[0];
+  encoder_output = encoder->output[0];
+
+  // We want same format on input and output
+  mmal_format_copy(encoder_output->format, encoder_input->format);
+
+  // Specify out output format JPEG
+  encoder_output->format->encoding = MMAL_ENCODING_JPEG;
+
+  encoder_output->buffer_size = encoder_output->buffer_size_recommended;
+
+
+  if (encoder_output->buffer_size < encoder_output->buffer_size_min)
+    encoder_output->buffer_size = encoder_output->buffer_size_min;
+
+  fprintf(stderr,"Encoder Buffer Size %i\n", encoder_output->buffer_size);
+
+  encoder_output->buffer_num = encoder_output->buffer_num_recommended;
+
+  if (encoder_output->buffer_num < encoder_output->buffer_num_min)
+    encoder_output->buffer_num = encoder_output->buffer_num_min;
+
+  // Frames the outputs hold keep their buffer, so the encoder needs more of them
+  if (encoder_output->buffer_num < ENCODER_OUTPUT_BUFFERS_NUM)
+    encoder_output->buffer_num = ENCODER_OUTPUT_BUFFERS_NUM;
+
+  // Commit the port changes to the output port
+  status = mmal_port_format_commit(encoder_output);
+
+  if (status != MMAL_SUCCESS)
+  {
+    fprintf(stderr, "Unable to set video format output ports\n");
+    mmal_component_destroy(encoder);
+    return NULL;
+  }
+
+  // Set the JPEG quality level
+  status = mmal_port_parameter_set_uint32(encoder_output, MMAL_PARAMETER_JPEG_Q_FACTOR, quality);
+
+  if (status != MMAL_SUCCESS)
+  {
+    fprintf(stderr, "Unable to set JPEG quality\n");
+    mmal_component_destroy(encoder);
+    return NULL;
+  }
+
+
+  // Enable encoder component
+  status = mmal_component_enable(encoder);
+
+  if (status)
+  {
+    fprintf(stderr, "Unable to enable encoder component\n");
+    mmal_component_destroy(encoder);
+    return NULL;
+  }
+
+
+  DBG("Encoder enabled, creating pool\n");
+
+  /* Create pool of buffer headers for the output port to consume */
+  pData->pool = mmal_port_pool_create(encoder_output, encoder_output->buffer_num, encoder_output->buffer_size);
+
+  if (!pData->pool)
+  {
+    fprintf(stderr, "Failed to create buffer header pool for encoder output port\n");
+    mmal_component_destroy(encoder);
+    return NULL;
+  }
+
+  // Set up our userdata - this is passed though to the callback where we need the information.
+  // Null until we open our filename
+  pData->file_handle = NULL;
+  pData->offset = 0;
+  pData->frame = NULL;
+  pData->id = id;
+  pData->port = encoder_output;
+  pData->held_buffers = 0;
+  pData->held_max = encoder_output->buffer_num - 2;
+  pData->closing = 0;
+  pData->burst = 0;
+  pData->burst_index = 0;
+
+  vcos_assert(vcos_semaphore_create(&pData->complete_semaphore, "RaspiStill-sem", 0) == VCOS_SUCCESS);
+
+  encoder_output->userdata = (struct MMAL_PORT_USERDATA_T *)pData;
+
+  return encoder;
+}
+
+/**
+ * Disable and destroy a JPEG encoder made by create_encoder
+ *
+ * @param encoder the encoder component, may be NULL
+ * @param pData the state of the encoder
+ */
+static void destroy_encoder(MMAL_COMPONENT_T *encoder, PORT_USERDATA *pData)
+{
+  if (!encoder)
+    return;
+
+  if (encoder->output[0] && encoder->output[0]->is_enabled)
+    mmal_port_disable(encoder->output[0]);
+
+  mmal_component_disable(encoder);
+
+  // Get rid of any port buffers first
+  // frames still held by the outputs keep the pool, it goes away with the process
+  pData->closing = 1;
+  if (pData->pool && pData->held_buffers == 0)
+  {
+    mmal_port_pool_destroy(encoder->output[0], pData->pool);
+  }
+
+  vcos_semaphore_delete(&pData->complete_semaphore);
+  mmal_component_destroy(encoder);
+}
+
+/**
+ * Hand all free buffers of an encoder to its output port
+ *
+ * @param pData the state of the encoder
+ */
+static void send_encoder_buffers(PORT_USERDATA *pData)
+{
+  int num = mmal_queue_length(pData->pool->queue);
+  int q;
+
+  for (q=0;q<num;q++)
+  {
+    MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(pData->pool->queue);
+
+    if (!buffer)
+      fprintf(stderr, "Unable to get a required buffer from pool queue");
+
+    if (mmal_port_send_buffer(pData->port, buffer)!= MMAL_SUCCESS)
+      fprintf(stderr, "Unable to send a buffer to encoder output port");
+  }
+}
+
+/**
+ * Feed a second JPEG encoder with a smaller copy of the video frames
+ *
+ * camera video port -> splitter -> encoder (full resolution)
+ *                               -> resizer -> lores encoder
+ *
+ * @param camera_video_port the video port of the camera
+ * @param encoder the full resolution encoder
+ * @param lores_encoder the encoder of the second resolution
+ * @param splitter set to the splitter component
+ * @param resizer set to the resizer component
+ * @param connections set to the four connections made
+ * @return MMAL_SUCCESS or the status of the step that failed
+ */
+static MMAL_STATUS_T connect_splitter(MMAL_PORT_T *camera_video_port, MMAL_COMPONENT_T *encoder,
+                                      MMAL_COMPONENT_T *lores_encoder, MMAL_COMPONENT_T **splitter,
+                                      MMAL_COMPONENT_T **resizer, MMAL_CONNECTION_T **connections)
+{
+  MMAL_STATUS_T status;
+  MMAL_ES_FORMAT_T *format;
+  int i;
+
+  if ((status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER, splitter)) != MMAL_SUCCESS ||
+      (*splitter)->output_num < 2)
+  {
+    fprintf(stderr, "Unable to create video splitter\n");
+    return status != MMAL_SUCCESS ? status : MMAL_ENOSYS;
+  }
+
+  if ((status = mmal_component_create(MMAL_COMPONENT_RESIZER, resizer)) != MMAL_SUCCESS ||
+      !(*resizer)->input_num || !(*resizer)->output_num)
+  {
+    fprintf(stderr, "Unable to create resizer\n");
+    return status != MMAL_SUCCESS ? status : MMAL_ENOSYS;
+  }
+
+  // The splitter hands the frames of the camera to both of its outputs as they are
+  mmal_format_copy((*splitter)->input[0]->format, camera_video_port->format);
+  (*splitter)->input[0]->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+  if ((status = mmal_port_format_commit((*splitter)->input[0])) != MMAL_SUCCESS)
+  {
+    fprintf(stderr, "Unable to set splitter input format\n");
+    return status;
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    mmal_format_copy((*splitter)->output[i]->format, (*splitter)->input[0]->format);
+    (*splitter)->output[i]->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+    if ((status = mmal_port_format_commit((*splitter)->output[i])) != MMAL_SUCCESS)
+    {
+      fprintf(stderr, "Unable to set splitter output format\n");
+      return status;
+    }
+  }
+
+  // The resizer scales the second copy down in hardware
+  mmal_format_copy((*resizer)->input[0]->format, (*splitter)->output[1]->format);
+  if ((status = mmal_port_format_commit((*resizer)->input[0])) != MMAL_SUCCESS)
+  {
+    fprintf(stderr, "Unable to set resizer input format\n");
+    return status;
+  }
+
+  format = (*resizer)->output[0]->format;
+  mmal_format_copy(format, (*resizer)->input[0]->format);
+  format->es->video.width = VCOS_ALIGN_UP(lores_width, 32);
+  format->es->video.height = VCOS_ALIGN_UP(lores_height, 16);
+  format->es->video.crop.x = 0;
+  format->es->video.crop.y = 0;
+  format->es->video.crop.width = lores_width;
+  format->es->video.crop.height = lores_height;
+  (*resizer)->output[0]->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+  if ((status = mmal_port_format_commit((*resizer)->output[0])) != MMAL_SUCCESS)
+  {
+    fprintf(stderr, "Unable to set resizer output format\n");
+    return status;
+  }
+
+  if ((status = mmal_component_enable(*splitter)) != MMAL_SUCCESS ||
+      (status = mmal_component_enable(*resizer)) != MMAL_SUCCESS)
+  {
+    fprintf(stderr, "Unable to enable splitter or resizer\n");
+    return status;
+  }
+
+  if ((status = connect_ports(camera_video_port, (*splitter)->input[0], &connections[0])) != MMAL_SUCCESS)
+    return status;
+  if ((status = connect_ports((*splitter)->output[0], encoder->input[0], &connections[1])) != MMAL_SUCCESS)
+    return status;
+  if ((status = connect_ports((*splitter)->output[1], (*resizer)->input[0], &connections[2])) != MMAL_SUCCESS)
+    return status;
+  return connect_ports((*resizer)->output[0], lores_encoder->input[0], &connections[3]);
+}
+
+/**
+ * Wait up to a second for a burst to be asked for
+ *
+ * @param trigger_usec set to monotonic_usec() of the command
+ * @return the stills of the burst, 0 if there was none
+ */
+static int burst_wait(unsigned long long *trigger_usec)
+{
+  struct timespec deadline;
+  int count;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 1;
+
+  pthread_mutex_lock(&burst_mutex);
+  while (burst_next == 0 && !pglobal->stop)
+  {
+    if (pthread_cond_timedwait(&burst_cond, &burst_mutex, &deadline) == ETIMEDOUT)
+      break;
+  }
+  count = burst_next;
+  *trigger_usec = burst_trigger_usec;
+  burst_next = 0;
+  pthread_mutex_unlock(&burst_mutex);
+
+  return count;
+}
+
+/**
+ * Take the stills of a burst back to back
+ *
+ * The camera runs all the time in burst mode, each capture is taken from
+ * the next frame of the sensor without switching modes or settling the
+ * exposure again. The frames carry the burst and their position in it.
+ *
+ * @param still_port the capture port of the camera
+ * @param count the number of stills
+ * @param trigger_usec monotonic_usec() the burst was asked for
+ */
+static void burst_take(MMAL_PORT_T *still_port, int count, unsigned long long trigger_usec)
+{
+  PORT_USERDATA *pData = &encoder_data[0];
+  int i;
+
+  if (++burst_id == 0)
+    burst_id = 1;
+  pData->burst = burst_id;
+
+  for (i = 0; i < count && !pglobal->stop; i++)
+  {
+    pData->burst_index = i;
+    if (mmal_port_parameter_set_boolean(still_port, MMAL_PARAMETER_CAPTURE, 1) != MMAL_SUCCESS)
+    {
+      fprintf(stderr, "starting burst capture failed\n");
+      break;
+    }
+    vcos_semaphore_wait(&pData->complete_semaphore);
+    if (i == 0)
+      DBG("burst %u: first still %llu ms after the command\n", burst_id, (monotonic_usec() - trigger_usec) / 1000);
+  }
+
+  DBG("burst %u: %d stills in %llu ms\n", burst_id, i, (monotonic_usec() - trigger_usec) / 1000);
+  pData->burst = 0;
+}
+
 /******************************************************************************
   Description.: setup mmal and callback
   Input Value.: arg is not used
@@ -608,10 +1167,13 @@ void *worker_thread(void *arg)
 
   //Encoder variables
   MMAL_COMPONENT_T *encoder = 0;
-  MMAL_PORT_T *encoder_input = NULL;
-  MMAL_PORT_T *encoder_output = NULL;
-  MMAL_POOL_T *pool;
-  MMAL_CONNECTION_T *encoder_connection;
+  MMAL_CONNECTION_T *encoder_connection = NULL;
+
+  //Second resolution
+  MMAL_COMPONENT_T *lores_encoder = NULL;
+  MMAL_COMPONENT_T *splitter = NULL;
+  MMAL_COMPONENT_T *resizer = NULL;
+  MMAL_CONNECTION_T *splitter_connections[4] = { NULL, NULL, NULL, NULL };
 
   //fps count
   struct timespec t_start, t_finish;
@@ -658,7 +1220,7 @@ void *worker_thread(void *arg)
       .max_stills_w = width,
       .max_stills_h = height,
       .stills_yuv422 = 0,
-      .one_shot_stills = (usestills ? 1 : 0),
+      .one_shot_stills = ((usestills && burst_count == 0) ? 1 : 0),
       .max_preview_video_w = width,
       .max_preview_video_h = height,
       .num_preview_video_frames = 3,
@@ -669,6 +1231,11 @@ void *worker_thread(void *arg)
     mmal_port_parameter_set(camera->control, &cam_config.hdr);
   }
 
+  // Bursts take the stills from the running sensor
+  if (burst_count > 0 &&
+      mmal_port_parameter_set_boolean(camera->control, MMAL_PARAMETER_CAMERA_BURST_CAPTURE, 1) != MMAL_SUCCESS)
+    fprintf(stderr, "burst capture mode couldn't be set\n");
+
   //Set camera parameters
   if (raspicamcontrol_set_all_parameters(camera, &c_params))
     fprintf(stderr, "camera parameters couldn't be set\n");
@@ -688,8 +1255,11 @@ void *worker_thread(void *arg)
 
   status = mmal_port_format_commit(camera_preview_port);
 
-  // Create preview component
-  status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &preview);
+  // Create preview component, for bursts without preview a sink which keeps the camera running
+  if (wantPreview || burst_count == 0)
+    status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &preview);
+  else
+    status = mmal_component_create(MMAL_COMPONENT_NULL_SINK, &preview);
 
   if (status != MMAL_SUCCESS)
   {
@@ -760,7 +1330,8 @@ void *worker_thread(void *arg)
   format->es->video.crop.y = 0;
   format->es->video.crop.width = width;
   format->es->video.crop.height = height;
-  format->es->video.frame_rate.num = STILLS_FRAME_RATE_NUM;
+  // the stills of a burst come at the frame rate
+  format->es->video.frame_rate.num = burst_count > 0 ? fps : STILLS_FRAME_RATE_NUM;
   format->es->video.frame_rate.den = STILLS_FRAME_RATE_DEN;
 
   status = mmal_port_format_commit(camera_still_port);
@@ -799,101 +1370,25 @@ void *worker_thread(void *arg)
   DBG("Camera enabled, creating encoder\n");
 
   //Create Encoder
-  status = mmal_component_create(MMAL_COMPONENT_DEFAULT_IMAGE_ENCODER, &encoder);
-
-  if (status != MMAL_SUCCESS)
+  encoder = create_encoder(&encoder_data[0], plugin_number);
+  if (!encoder)
   {
-    fprintf(stderr, "Unable to create JPEG encoder component\n");
     mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
     exit(EXIT_FAILURE);
   }
 
-  if (!encoder->input_num || !encoder->output_num)
+  if (lores_id >= 0)
   {
-    fprintf(stderr, "Unable to create JPEG encoder input/output ports\n");
-    mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
-    exit(EXIT_FAILURE);
-  }
-
-  encoder_input = encoder->input[0];
-  encoder_output = encoder->output[0];
-
-  // We want same format on input and output
-  mmal_format_copy(encoder_output->format, encoder_input->format);
-
-  // Specify out output format JPEG
-  encoder_output->format->encoding = MMAL_ENCODING_JPEG;
-
-  encoder_output->buffer_size = encoder_output->buffer_size_recommended;
-
-
-  if (encoder_output->buffer_size < encoder_output->buffer_size_min)
-    encoder_output->buffer_size = encoder_output->buffer_size_min;
-
-  fprintf(stderr,"Encoder Buffer Size %i\n", encoder_output->buffer_size);
-
-  encoder_output->buffer_num = encoder_output->buffer_num_recommended;
-
-  if (encoder_output->buffer_num < encoder_output->buffer_num_min)
-    encoder_output->buffer_num = encoder_output->buffer_num_min;
-
-  // Commit the port changes to the output port
-  status = mmal_port_format_commit(encoder_output);
-
-  if (status != MMAL_SUCCESS)
-  {
-    fprintf(stderr, "Unable to set video format output ports\n");
-    mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
-    exit(EXIT_FAILURE);
-  }
-
-  // Set the JPEG quality level
-  status = mmal_port_parameter_set_uint32(encoder_output, MMAL_PARAMETER_JPEG_Q_FACTOR, quality);
-
-  if (status != MMAL_SUCCESS)
-  {
-    fprintf(stderr, "Unable to set JPEG quality\n");
-    mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
-    exit(EXIT_FAILURE);
-  }
-
-
-  // Enable encoder component
-  status = mmal_component_enable(encoder);
-
-  if (status)
-  {
-    fprintf(stderr, "Unable to enable encoder component\n");
-    mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
-    exit(EXIT_FAILURE);
-  }
-
-
-  DBG("Encoder enabled, creating pool and connecting ports\n");
-
-  /* Create pool of buffer headers for the output port to consume */
-  pool = mmal_port_pool_create(encoder_output, encoder_output->buffer_num, encoder_output->buffer_size);
-
-  if (!pool)
-  {
-    fprintf(stderr, "Failed to create buffer header pool for encoder output port\n");
-    mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
-    exit(EXIT_FAILURE);
+    lores_encoder = create_encoder(&encoder_data[1], lores_id);
+    if (!lores_encoder)
+    {
+      destroy_encoder(encoder, &encoder_data[0]);
+      mmal_component_destroy(camera);
+      exit(EXIT_FAILURE);
+    }
   }
 
-  if (wantPreview)
+  if (wantPreview || burst_count > 0)
   {
     // Connect camera to preview
     status = connect_ports(camera_preview_port, preview_input_port, &camera_preview_connection);
@@ -905,6 +1400,8 @@ void *worker_thread(void *arg)
   // Now connect the camera to the encoder
   if(usestills){
     status = connect_ports(camera_still_port, encoder->input[0], &encoder_connection);
+  } else if (lores_encoder) {
+    status = connect_splitter(camera_video_port, encoder, lores_encoder, &splitter, &resizer, splitter_connections);
   } else {
     status = connect_ports(camera_video_port, encoder->input[0], &encoder_connection);
   }
@@ -917,60 +1414,54 @@ void *worker_thread(void *arg)
     if (preview)
       mmal_component_destroy(preview);
     mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
+    destroy_encoder(encoder, &encoder_data[0]);
+    destroy_encoder(lores_encoder, &encoder_data[1]);
     exit(EXIT_FAILURE);
   }
 
-  // Set up our userdata - this is passed though to the callback where we need the information.
-  // Null until we open our filename
-  PORT_USERDATA callback_data;
-  callback_data.file_handle = NULL;
-  callback_data.pool = pool;
-  callback_data.offset = 0;
-
-  vcos_assert(vcos_semaphore_create(&callback_data.complete_semaphore, "RaspiStill-sem", 0) == VCOS_SUCCESS);
-
-  encoder->output[0]->userdata = (struct MMAL_PORT_USERDATA_T *)&callback_data;
-
-
-
   // Enable the encoder output port and tell it its callback function
   status = mmal_port_enable(encoder->output[0], encoder_buffer_callback);
+  if (status == MMAL_SUCCESS && lores_encoder)
+    status = mmal_port_enable(lores_encoder->output[0], encoder_buffer_callback);
   if (status)
   {
     fprintf(stderr, "Unable to enable encoder component\n");
     mmal_component_destroy(camera);
-    if (encoder)
-      mmal_component_destroy(encoder);
+    destroy_encoder(encoder, &encoder_data[0]);
+    destroy_encoder(lores_encoder, &encoder_data[1]);
     exit(EXIT_FAILURE);
   }
 
-  if(usestills){
+  if (burst_count > 0)
+  {
+    unsigned long long trigger_usec;
+    int count;
+
+    DBG("Waiting for bursts\n");
+    // The encoder gets its buffers back as soon as the outputs release them
+    send_encoder_buffers(&encoder_data[0]);
+
+    while(!pglobal->stop)
+    {
+      if ((count = burst_wait(&trigger_usec)) > 0)
+        burst_take(camera_still_port, count, trigger_usec);
+    }
+  }
+  else if(usestills){
     DBG("Starting stills output\n");
 
     //setup fps
     clock_gettime(CLOCK_MONOTONIC, &t_start);
     frames = 0;
-    int delay = (1000 * 1000) / fps;
+    pacer pace;
+    pacer_init(&pace, fps, &pglobal->in[plugin_number]);
 
     while(!pglobal->stop) {
-      //Wait the delay
-      usleep(delay);
+      //Wait for the next deadline, the capture time does not add to it
+      pacer_wait(&pace);
 
       // Send all the buffers to the encoder output port
-      int num = mmal_queue_length(pool->queue);
-      int q;
-      for (q=0;q<num;q++)
-      {
-        MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(pool->queue);
-
-        if (!buffer)
-          fprintf(stderr, "Unable to get a required buffer from pool queue");
-
-        if (mmal_port_send_buffer(encoder->output[0], buffer)!= MMAL_SUCCESS)
-          fprintf(stderr, "Unable to send a buffer to encoder output port");
-      }
+      send_encoder_buffers(&encoder_data[0]);
 
       if (mmal_port_parameter_set_boolean(camera_still_port, MMAL_PARAMETER_CAPTURE, 1) != MMAL_SUCCESS)
       {
@@ -981,7 +1472,7 @@ void *worker_thread(void *arg)
         // Wait for capture to complete
         // For some reason using vcos_semaphore_wait_timeout sometimes returns immediately with bad parameter error
         // even though it appears to be all correct, so reverting to untimed one until figure out why its erratic
-        vcos_semaphore_wait(&callback_data.complete_semaphore);
+        vcos_semaphore_wait(&encoder_data[0].complete_semaphore);
         //DBG("Jpeg Captured\n");
         frames++;
       }
@@ -1005,24 +1496,15 @@ void *worker_thread(void *arg)
     //Video Mode
     DBG("Starting video output\n");
     // Send all the buffers to the encoder output port
-    int num = mmal_queue_length(pool->queue);
-    int q;
-    for (q=0;q<num;q++)
-    {
-      MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(pool->queue);
-      if (!buffer)
-        fprintf(stderr, "Unable to get a required buffer from pool queue");
-      if (mmal_port_send_buffer(encoder->output[0], buffer)!= MMAL_SUCCESS)
-        fprintf(stderr, "Unable to send a buffer to encoder output port");
-    }
+    send_encoder_buffers(&encoder_data[0]);
+    if (lores_encoder)
+      send_encoder_buffers(&encoder_data[1]);
     if (mmal_port_parameter_set_boolean(camera_video_port, MMAL_PARAMETER_CAPTURE, 1) != MMAL_SUCCESS)
       fprintf(stderr, "starting capture failed");
 
     while(!pglobal->stop) usleep(1000);
   }
 
-  vcos_semaphore_delete(&callback_data.complete_semaphore);
-
   //Close everything MMAL
   if (usestills)
   {
@@ -1039,28 +1521,42 @@ void *worker_thread(void *arg)
 
   if (encoder->output[0] && encoder->output[0]->is_enabled)
     mmal_port_disable(encoder->output[0]);
+  if (lores_encoder && lores_encoder->output[0]->is_enabled)
+    mmal_port_disable(lores_encoder->output[0]);
 
-  mmal_connection_destroy(encoder_connection);
+  if (encoder_connection)
+    mmal_connection_destroy(encoder_connection);
+  for (i = 0; i < 4; i++)
+  {
+    if (splitter_connections[i])
+      mmal_connection_destroy(splitter_connections[i]);
+  }
 
   // Disable components
-  if (encoder)
-    mmal_component_disable(encoder);
+  if (splitter)
+    mmal_component_disable(splitter);
+  if (resizer)
+    mmal_component_disable(resizer);
   if (preview)
     mmal_component_disable(preview);
   if (camera)
     mmal_component_disable(camera);
 
-  //Destroy encoder component
-  // Get rid of any port buffers first
-  if (pool)
+  //Destroy encoder components
+  destroy_encoder(encoder, &encoder_data[0]);
+  encoder = NULL;
+  destroy_encoder(lores_encoder, &encoder_data[1]);
+  lores_encoder = NULL;
+
+  if (splitter)
   {
-    mmal_port_pool_destroy(encoder->output[0], pool);
+    mmal_component_destroy(splitter);
+    splitter = NULL;
   }
-
-  if (encoder)
+  if (resizer)
   {
-    mmal_component_destroy(encoder);
-    encoder = NULL;
+    mmal_component_destroy(resizer);
+    resizer = NULL;
   }
   if (preview)
   {
@@ -1097,9 +1593,6 @@ void worker_cleanup(void *arg)
 
   first_run = 0;
   DBG("cleaning up resources allocated by input thread\n");
-
-  if(pglobal->in[plugin_number].buf != NULL)
-    free(pglobal->in[plugin_number].buf);
 }
 
 
@@ -0,0 +1,362 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+  This input plugin reads the frames another mjpg_streamer exports with
+  output_shm. It waits for a segment to appear and follows it when the
+  exporting process is restarted, so it also connects the processes of
+  mjpg_streamer --shards.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "../output_shm/output_shm.h"
+
+#define INPUT_PLUGIN_NAME "SHM input plugin"
+
+/* a segment and the input its frames are published as */
+typedef struct {
+    int id;
+    char *name;
+    shm_header *header;         // NULL while the segment is not mapped
+    size_t length;
+    unsigned long long seq;     // newest frame published from the segment
+    int waiting;                // "waiting for" was printed
+    pthread_t thread;
+} shm_source;
+
+static globals *pglobal;
+static int plugin_number;
+static shm_source *sources;
+static int source_count;
+
+/******************************************************************************
+Description.: print a help message
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void help(void)
+{
+    fprintf(stderr, " ---------------------------------------------------------------\n" \
+            " Help for input plugin..: "INPUT_PLUGIN_NAME"\n" \
+            " ---------------------------------------------------------------\n" \
+            " The following parameters can be passed to this plugin:\n\n" \
+            " [-n | --name ]..........: segments of output_shm to read, separated\n" \
+            "                           by commas, /mjpg-streamer-0 by default.\n" \
+            "                           Each one after the first is an input of\n" \
+            "                           its own.\n" \
+            " ---------------------------------------------------------------\n");
+}
+
+/******************************************************************************
+Description.: tell whether the process writing the segment still runs, it
+              stays mapped after a crash and a restarted one creates a new
+              segment of the same name
+Input Value.: the header of the segment
+Return Value: 1 if the writer runs, 0 otherwise
+******************************************************************************/
+static int writer_alive(shm_header *header)
+{
+    pid_t writer = __atomic_load_n(&header->writer, __ATOMIC_ACQUIRE);
+
+    return writer != 0 && (kill(writer, 0) == 0 || errno != ESRCH);
+}
+
+/******************************************************************************
+Description.: map a segment once its writer has set it up
+Input Value.: the source
+Return Value: 0 if it is mapped, -1 if it is not there (yet)
+******************************************************************************/
+static int attach(shm_source *s)
+{
+    shm_header *header;
+    struct stat st;
+    int fd;
+
+    if((fd = shm_open(s->name, O_RDWR, 0)) < 0) {
+        if(!s->waiting++)
+            IPRINT("waiting for %s: %s\n", s->name, strerror(errno));
+        return -1;
+    }
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(shm_header) ||
+       (header = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    /* the magic is written last, a segment of another version is skipped */
+    if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || header->version != SHM_VERSION ||
+       !writer_alive(header) || header->slots < 2 ||
+       (size_t)header->data_offset + (size_t)header->slots * header->slot_size > (size_t)st.st_size) {
+        munmap(header, st.st_size);
+        return -1;
+    }
+
+    IPRINT("input %d reads %s of %s (pid %u)\n", s->id, s->name, header->plugin, header->writer);
+    s->header = header;
+    s->length = st.st_size;
+    s->seq = 0;
+    s->waiting = 0;
+    return 0;
+}
+
+static void detach(shm_source *s)
+{
+    munmap(s->header, s->length);
+    s->header = NULL;
+}
+
+/******************************************************************************
+Description.: sleep until the writer announces a frame after the one seen
+Input Value.: * s.......: the source
+              * timeout.: the longest sleep
+Return Value: -
+******************************************************************************/
+static void wait_frame(shm_source *s, const struct timespec *timeout)
+{
+    shm_header *header = s->header;
+    uint32_t wake = __atomic_load_n(&header->wake, __ATOMIC_SEQ_CST);
+
+    __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&header->seq, __ATOMIC_ACQUIRE) == s->seq)
+        syscall(SYS_futex, &header->wake, FUTEX_WAIT, wake, timeout, NULL, 0);
+    __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/******************************************************************************
+Description.: copy a frame out of its slot, see output_shm.h for the seqlock
+Input Value.: * s..: the source
+              * seq: number of the frame
+Return Value: the frame, NULL if it was overwritten meanwhile
+******************************************************************************/
+static input_frame *read_frame(shm_source *s, unsigned long long seq)
+{
+    shm_slot *slot = shm_slot_of(s->header, seq);
+    size_t capacity = s->header->slot_size - sizeof(shm_slot);
+    input_frame *frame;
+    uint32_t lock;
+
+    lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+    if((lock & 1) || slot->seq != seq || slot->size == 0 || slot->size > capacity)
+        return NULL;
+    if((frame = frame_alloc(slot->size)) == NULL)
+        return NULL;
+
+    frame->size = slot->size;
+    memcpy(frame->buf, shm_slot_data(slot), frame->size);
+    frame->timestamp.tv_sec = slot->timestamp_sec;
+    frame->timestamp.tv_usec = slot->timestamp_usec;
+    frame->capture_usec = slot->capture_usec;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&slot->lock, __ATOMIC_RELAXED) != lock || frame->size > frame->capacity) {
+        frame_unref(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+/******************************************************************************
+Description.: publish the newest frame of a segment whenever there is one
+Input Value.: the source
+Return Value: NULL
+******************************************************************************/
+static void *source_thread(void *arg)
+{
+    struct timespec timeout = { 1, 0 };
+    shm_source *s = arg;
+    input_frame *frame;
+    unsigned long long seq;
+
+    while(!pglobal->stop) {
+        if(s->header == NULL && attach(s) < 0) {
+            usleep(200 * 1000);
+            continue;
+        }
+
+        seq = __atomic_load_n(&s->header->seq, __ATOMIC_ACQUIRE);
+        if(seq == s->seq || seq == 0) {
+            wait_frame(s, &timeout);
+            if(__atomic_load_n(&s->header->seq, __ATOMIC_ACQUIRE) == s->seq && !writer_alive(s->header)) {
+                IPRINT("the writer of %s stopped\n", s->name);
+                detach(s);
+            }
+            continue;
+        }
+
+        /* a frame overwritten while it was copied is skipped, the next one
+         * is newer anyway */
+        s->seq = seq;
+        if((frame = read_frame(s, seq)) != NULL) {
+            input_publish_frame(&pglobal->in[s->id], frame);
+        }
+    }
+
+    IPRINT("leaving input thread of %s\n", s->name);
+    if(s->header != NULL)
+        detach(s);
+    return NULL;
+}
+
+/*** plugin interface functions ***/
+/******************************************************************************
+Description.: parse input parameters
+Input Value.: param contains the command line string and a pointer to globals
+Return Value: 0 if everything is ok
+******************************************************************************/
+int input_init(input_parameter *param, int id)
+{
+    char *names = "/mjpg-streamer-0", *list, *name, *next;
+    int i;
+
+    param->argv[0] = INPUT_PLUGIN_NAME;
+    plugin_number = id;
+
+    /* show all parameters for DBG purposes */
+    for(i = 0; i < param->argc; i++) {
+        DBG("argv[%d]=%s\n", i, param->argv[i]);
+    }
+
+    reset_getopt();
+    while(1) {
+        int option_index = 0, c = 0;
+        static struct option long_options[] = {
+            {"h", no_argument, 0, 0},
+            {"help", no_argument, 0, 0},
+            {"n", required_argument, 0, 0},
+            {"name", required_argument, 0, 0},
+            {0, 0, 0, 0}
+        };
+
+        c = getopt_long_only(param->argc, param->argv, "", long_options, &option_index);
+
+        /* no more options to parse */
+        if(c == -1) break;
+
+        /* unrecognized option */
+        if(c == '?') {
+            help();
+            return 1;
+        }
+
+        switch(option_index) {
+            /* h, help */
+        case 0:
+        case 1:
+            DBG("case 0,1\n");
+            help();
+            return 1;
+            break;
+
+            /* n, name */
+        case 2:
+        case 3:
+            DBG("case 2,3\n");
+            names = optarg;
+            break;
+        }
+    }
+
+    pglobal = param->global;
+
+    if((list = strdup(names)) == NULL ||
+       (sources = calloc(strlen(names) / 2 + 1, sizeof(shm_source))) == NULL) {
+        IPRINT("not enough memory\n");
+        return 1;
+    }
+    for(name = strtok_r(list, ",", &next); name != NULL; name = strtok_r(NULL, ",", &next)) {
+        shm_source *s = &sources[source_count];
+
+        if(source_count == 0) {
+            s->id = id;
+        } else if((s->id = input_add(&pglobal->in[id])) < 0) {
+            IPRINT("no input left for %s\n", name);
+            return 1;
+        }
+        s->name = name;
+        source_count++;
+        IPRINT("input %d..........: %s\n", s->id, s->name);
+    }
+    if(source_count == 0) {
+        help();
+        return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops the execution of the source threads
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int input_stop(int id)
+{
+    int i;
+
+    /* the other segments are read by threads of the first input */
+    if(id != plugin_number)
+        return 0;
+
+    DBG("will cancel input threads\n");
+    for(i = 0; i < source_count; i++)
+        pthread_cancel(sources[i].thread);
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts a thread for each segment
+Input Value.: -
+Return Value: 0
+******************************************************************************/
+int input_run(int id)
+{
+    int i;
+
+    if(id != plugin_number)
+        return 0;
+
+    for(i = 0; i < source_count; i++) {
+        if(pthread_create(&sources[i].thread, 0, source_thread, &sources[i]) != 0) {
+            fprintf(stderr, "could not start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(sources[i].thread);
+    }
+    return 0;
+}
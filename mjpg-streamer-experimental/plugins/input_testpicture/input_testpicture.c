@@ -54,7 +54,21 @@ void *worker_thread(void *);
 void worker_cleanup(void *);
 void help(void);
 
-static int delay = 1000;
+static double delay = 1000;
+
+/*
+ * generator mode: frames of a fixed size, the picture padded with COM
+ * segments, and a COM segment telling the sequence number and the time
+ */
+#define GENERATE_MIN (10 * 1024)
+#define GENERATE_MAX (4 * 1024 * 1024)
+#define INFO_FORMAT "mjpg-streamer seq=%020llu time=%010ld.%06ld"
+#define INFO_LENGTH (sizeof("mjpg-streamer seq= time=.") - 1 + 20 + 10 + 6)
+#define COM_MAX_PAYLOAD 65533
+
+static int generate_size = 0;
+static unsigned char *templates[2];
+static int info_offset;
 
 /* details of converted JPG pictures */
 struct pic {
@@ -76,6 +90,137 @@ static struct pictures {
 
 struct pictures *pics;
 
+/******************************************************************************
+Description.: parse a frame size like 500k or 2M
+Input Value.: text to parse
+Return Value: the size in bytes, -1 if it is not a number
+******************************************************************************/
+static int parse_size(const char *text)
+{
+    char *end;
+    long size = strtol(text, &end, 10);
+
+    if(end == text || size < 0)
+        return -1;
+
+    switch(*end) {
+    case 'k':
+    case 'K':
+        size *= 1024;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        size *= 1024 * 1024;
+        end++;
+        break;
+    }
+
+    return (*end == '\0' && size <= GENERATE_MAX) ? size : -1;
+}
+
+/******************************************************************************
+Description.: compose the frame of generator mode for a picture: SOI, the info
+              COM segment, padding COM segments and the rest of the picture
+Input Value.: * out.: buffer of generate_size bytes
+              * p...: the picture
+Return Value: -
+******************************************************************************/
+static void compose_frame(unsigned char *out, const struct pic *p)
+{
+    int padding = generate_size - 2 - (4 + INFO_LENGTH) - (p->size - 2);
+    int info = INFO_LENGTH, chunk, i = 0;
+
+    /* too little for a segment of its own, lengthen the info with spaces */
+    if(padding < 4) {
+        info += padding;
+        padding = 0;
+    }
+
+    out[i++] = 0xFF;
+    out[i++] = 0xD8;
+    out[i++] = 0xFF;
+    out[i++] = 0xFE;
+    out[i++] = (info + 2) >> 8;
+    out[i++] = (info + 2) & 0xFF;
+    info_offset = i;
+    memset(out + i, ' ', info);
+    i += info;
+
+    while(padding > 0) {
+        chunk = (padding > 4 + COM_MAX_PAYLOAD) ? 4 + COM_MAX_PAYLOAD : padding;
+        /* never leave a rest which can not be a segment */
+        if(padding - chunk > 0 && padding - chunk < 4)
+            chunk -= 4;
+
+        out[i++] = 0xFF;
+        out[i++] = 0xFE;
+        out[i++] = (chunk - 2) >> 8;
+        out[i++] = (chunk - 2) & 0xFF;
+        memset(out + i, 0, chunk - 4);
+        i += chunk - 4;
+        padding -= chunk;
+    }
+
+    memcpy(out + i, p->data + 2, p->size - 2);
+}
+
+/******************************************************************************
+Description.: prepare generator mode, a picture which does not fit into the
+              frame size is replaced by the largest one that does
+Input Value.: -
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int init_generator(void)
+{
+    int i;
+
+    for(i = 0; pics->sequence[0].size + 4 + INFO_LENGTH > generate_size ||
+               pics->sequence[1].size + 4 + INFO_LENGTH > generate_size; i++) {
+        if(i == LENGTH_OF(picture_lookup))
+            return -1;
+        pics = &picture_lookup[i];
+    }
+
+    for(i = 0; i < LENGTH_OF(templates); i++) {
+        if((templates[i] = malloc(generate_size)) == NULL)
+            return -1;
+        compose_frame(templates[i], &pics->sequence[i]);
+    }
+
+    /* the ring holds that many, some more are on their way to the outputs */
+    frame_pool_reserve(generate_size, INPUT_RING_SIZE + 4);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: publish the next frame of generator mode
+Input Value.: * picture: which of the templates to use
+              * seq....: sequence number to write into the frame
+Return Value: 0 if ok, -1 without memory
+******************************************************************************/
+static int publish_generated(int picture, unsigned long long seq)
+{
+    char info[INFO_LENGTH + 1];
+    input_frame *frame;
+
+    if((frame = frame_alloc(generate_size)) == NULL)
+        return -1;
+
+    memcpy(frame->buf, templates[picture], generate_size);
+    frame->size = generate_size;
+    gettimeofday(&frame->timestamp, NULL);
+
+    snprintf(info, sizeof(info), INFO_FORMAT, seq, (long)frame->timestamp.tv_sec, (long)frame->timestamp.tv_usec);
+    memcpy(frame->buf + info_offset, info, INFO_LENGTH);
+    frame->encoded_usec = monotonic_usec();
+
+    input_publish_frame(&pglobal->in[plugin_number], frame);
+
+    return 0;
+}
+
 /*** plugin interface functions ***/
 
 /******************************************************************************
@@ -112,6 +257,9 @@ int input_init(input_parameter *param, int plugin_no)
             {"delay", required_argument, 0, 0},
             {"r", required_argument, 0, 0},
             {"resolution", required_argument, 0, 0},
+            {"fps", required_argument, 0, 0},
+            {"g", required_argument, 0, 0},
+            {"generate", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -139,7 +287,7 @@ int input_init(input_parameter *param, int plugin_no)
         case 2:
         case 3:
             DBG("case 2,3\n");
-            delay = atoi(optarg);
+            delay = atof(optarg);
             break;
 
             /* r, resolution */
@@ -154,6 +302,22 @@ int input_init(input_parameter *param, int plugin_no)
             }
             break;
 
+            /* fps */
+        case 6:
+            DBG("case 6\n");
+            delay = (atof(optarg) > 0) ? 1000 / atof(optarg) : 0;
+            break;
+
+            /* g, generate */
+        case 7:
+        case 8:
+            DBG("case 7,8\n");
+            if((generate_size = parse_size(optarg)) < GENERATE_MIN) {
+                fprintf(stderr, "the frame size must be between 10k and 4M\n");
+                return 1;
+            }
+            break;
+
         default:
             DBG("default case\n");
             help();
@@ -162,9 +326,18 @@ int input_init(input_parameter *param, int plugin_no)
     }
 
     pglobal = param->global;
+    plugin_number = plugin_no;
 
-    IPRINT("delay.............: %i\n", delay);
+    if(generate_size > 0 && init_generator() != 0) {
+        IPRINT("could not prepare frames of %d bytes\n", generate_size);
+        return 1;
+    }
+
+    IPRINT("delay.............: %.3f ms (%.3f fps)\n", delay, (delay > 0) ? 1000 / delay : 0);
     IPRINT("resolution........: %s\n", pics->resolution);
+    if(generate_size > 0) {
+        IPRINT("generated frames..: %d bytes\n", generate_size);
+    }
 
     return 0;
 }
@@ -189,14 +362,7 @@ Return Value: 0
 ******************************************************************************/
 int input_run(int id)
 {
-    pglobal->in[id].buf = malloc(256 * 1024);
-    if(pglobal->in[id].buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
-    }
-
     if(pthread_create(&worker, 0, worker_thread, NULL) != 0) {
-        free(pglobal->in[id].buf);
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
@@ -216,8 +382,12 @@ void help(void)
     " Help for input plugin..: "INPUT_PLUGIN_NAME"\n" \
     " ---------------------------------------------------------------\n" \
     " The following parameters can be passed to this plugin:\n\n" \
-    " [-d | --delay ]........: delay to pause between frames\n" \
+    " [-d | --delay ]........: time between frames in ms, fractions are allowed\n" \
+    " [-f | --fps ]..........: frames per second instead of the delay, like 29.97\n" \
     " [-r | --resolution]....: can be 960x720, 640x480, 320x240, 160x120\n"
+    " [-g | --generate ].....: publish frames of this size, 10k to 4M, with the\n" \
+    "                          sequence number and time in a COM segment,\n" \
+    "                          -d 0 publishes them as fast as possible\n" \
     " ---------------------------------------------------------------\n");
 }
 
@@ -230,24 +400,26 @@ Return Value: NULL
 void *worker_thread(void *arg)
 {
     int i = 0;
+    unsigned long long seq = 0;
+    pacer pace;
+
+    pacer_init(&pace, (delay > 0) ? 1000 / delay : 0, &pglobal->in[plugin_number]);
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
     while(!pglobal->stop) {
 
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
-
+        /* copy JPG picture into a new frame and signal fresh_frame */
         i = (i + 1) % LENGTH_OF(pics->sequence);
-        pglobal->in[plugin_number].size = pics->sequence[i].size;
-        memcpy(pglobal->in[plugin_number].buf, pics->sequence[i].data, pglobal->in[plugin_number].size);
-
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-        pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+        if(generate_size > 0) {
+            if(publish_generated(i, ++seq) != 0)
+                fprintf(stderr, "could not allocate memory\n");
+        } else if(input_publish(&pglobal->in[plugin_number], pics->sequence[i].data, pics->sequence[i].size, NULL) != 0) {
+            fprintf(stderr, "could not allocate memory\n");
+        }
 
-        usleep(1000 * delay);
+        pacer_wait(&pace);
     }
 
     IPRINT("leaving input thread, calling cleanup function now\n");
@@ -273,7 +445,8 @@ void worker_cleanup(void *arg)
     first_run = 0;
     DBG("cleaning up resources allocated by input thread\n");
 
-    if(pglobal->in[plugin_number].buf != NULL) free(pglobal->in[plugin_number].buf);
+    free(templates[0]);
+    free(templates[1]);
 }
 
 
@@ -0,0 +1,650 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "capcache.h"
+#include "../../utils.h"
+
+#define CAPCACHE_MAGIC "MJPGCAP1"
+#define CAPCACHE_MAX_FILE (4 * 1024 * 1024)
+#define CAPCACHE_MAX_FORMATS 64
+#define CAPCACHE_MAX_RESOLUTIONS 1024
+#define CAPCACHE_MAX_CONTROLS 1024
+#define CAPCACHE_MAX_MENU 1024
+#define CAPCACHE_DELAY 10           // seconds after the start until the revalidation
+
+/* the start of a file, a different kernel or driver version gets a new file */
+typedef struct {
+    char magic[8];
+    uint32_t fmtdesc_size, queryctrl_size, querymenu_size;
+    uint32_t version;
+    uint8_t driver[16];
+    uint8_t card[32];
+} capcache_header;
+
+struct _capcache {
+    char path[PATH_MAX];            // the file
+    char device[PATH_MAX];          // the device, opened again by the revalidation
+    unsigned char *data;            // the contents of the file
+    size_t size;
+
+    /* parsed from data until they are handed to the input */
+    input_format *formats;
+    int format_count;
+    control *controls;
+    int control_count;
+
+    pthread_t thread;
+    int running;
+    volatile int stop;
+};
+
+typedef struct {
+    unsigned char *data;
+    size_t size, capacity;
+    int failed;
+} cache_buffer;
+
+typedef struct {
+    const unsigned char *p;
+    size_t left;
+} cache_reader;
+
+/******************************************************************************
+Description.: append to a buffer, which gets failed if there is not enough
+              memory
+Input Value.: * b...: the buffer
+              * data: the bytes to append
+              * size: their number
+Return Value: -
+******************************************************************************/
+static void put(cache_buffer *b, const void *data, size_t size)
+{
+    if(b->failed)
+        return;
+
+    if(b->size + size > b->capacity) {
+        size_t capacity = MAX(b->capacity * 2, b->size + size + 4096);
+        unsigned char *p = realloc(b->data, capacity);
+        if(p == NULL) {
+            b->failed = 1;
+            return;
+        }
+        b->data = p;
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void put_u32(cache_buffer *b, uint32_t value)
+{
+    put(b, &value, sizeof(value));
+}
+
+/******************************************************************************
+Description.: take bytes from a file being parsed
+Input Value.: * r...: the reader
+              * data: gets the bytes
+              * size: their number
+Return Value: 0 if ok, -1 if the file is too short
+******************************************************************************/
+static int get(cache_reader *r, void *data, size_t size)
+{
+    if(size > r->left)
+        return -1;
+    memcpy(data, r->p, size);
+    r->p += size;
+    r->left -= size;
+    return 0;
+}
+
+static int get_u32(cache_reader *r, uint32_t *value)
+{
+    return get(r, value, sizeof(*value));
+}
+
+/******************************************************************************
+Description.: read the first line of a sysfs attribute
+Input Value.: * path: the attribute
+              * buf.: gets the line without the newline
+              * size: the size of buf
+Return Value: 0 if ok, -1 if the attribute does not exist
+******************************************************************************/
+static int read_attribute(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "r");
+
+    if(f == NULL)
+        return -1;
+    if(fgets(buf, size, f) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return (buf[0] != '\0') ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: find the cache file of a device, named after the vendor, product
+              and firmware version of its USB device, or after the driver and
+              the name of other devices
+Input Value.: * vd..: the device, its capabilities are queried already
+              * path: gets the file
+              * size: the size of path
+Return Value: 0 if ok, -1 without a cache folder
+******************************************************************************/
+static int cache_path(struct vdIn *vd, char *path, size_t size)
+{
+    char attribute[128], vendor[16], product[16], release[16], name[64];
+    struct stat st;
+    size_t i;
+
+    if(vd->capcache_folder == NULL)
+        return -1;
+
+    if(stat(vd->videodevice, &st) == 0 && S_ISCHR(st.st_mode)) {
+        /* the device of the video node is the USB interface, its parent the USB device */
+        #define USB_ATTRIBUTE(name, buf) \
+            (snprintf(attribute, sizeof(attribute), "/sys/dev/char/%u:%u/device/../" name, \
+                      major(st.st_rdev), minor(st.st_rdev)), \
+             read_attribute(attribute, buf, sizeof(buf)))
+        if(USB_ATTRIBUTE("idVendor", vendor) == 0 && USB_ATTRIBUTE("idProduct", product) == 0 &&
+           USB_ATTRIBUTE("bcdDevice", release) == 0) {
+            snprintf(path, size, "%s/%s-%s-%s.caps", vd->capcache_folder, vendor, product, release);
+            return 0;
+        }
+        #undef USB_ATTRIBUTE
+    }
+
+    snprintf(name, sizeof(name), "%s-%s", vd->cap.driver, vd->cap.card);
+    for(i = 0; name[i] != '\0'; i++) {
+        if(!isalnum((unsigned char)name[i]) && name[i] != '-')
+            name[i] = '_';
+    }
+    snprintf(path, size, "%s/%s.caps", vd->capcache_folder, name);
+    return 0;
+}
+
+/******************************************************************************
+Description.: write the formats and V4L2 controls of an input the way they
+              are stored in a cache file. The values of the controls are
+              left out, they are read at every start.
+Input Value.: * cap: the capabilities of the device
+              * in.: the input
+              * b..: gets the file
+Return Value: 0 if ok, -1 if there is not enough memory
+******************************************************************************/
+static int serialize(const struct v4l2_capability *cap, input *in, cache_buffer *b)
+{
+    capcache_header header;
+    int i, count = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPCACHE_MAGIC, sizeof(header.magic));
+    header.fmtdesc_size = sizeof(struct v4l2_fmtdesc);
+    header.queryctrl_size = sizeof(struct v4l2_queryctrl);
+    header.querymenu_size = sizeof(struct v4l2_querymenu);
+    header.version = cap->version;
+    memcpy(header.driver, cap->driver, sizeof(header.driver));
+    memcpy(header.card, cap->card, sizeof(header.card));
+    put(b, &header, sizeof(header));
+
+    put_u32(b, in->formatCount);
+    for(i = 0; i < in->formatCount; i++) {
+        input_format *f = &in->in_formats[i];
+        int j;
+
+        put(b, &f->format, sizeof(f->format));
+        put_u32(b, f->resolutionCount);
+        for(j = 0; j < f->resolutionCount; j++) {
+            put_u32(b, f->supportedResolutions[j].width);
+            put_u32(b, f->supportedResolutions[j].height);
+        }
+    }
+
+    for(i = 0; i < in->parametercount; i++) {
+        if(in->in_parameters[i].group == IN_CMD_V4L2)
+            count++;
+    }
+    put_u32(b, count);
+    for(i = 0; i < in->parametercount; i++) {
+        control *c = &in->in_parameters[i];
+        uint32_t menus = 0;
+
+        if(c->group != IN_CMD_V4L2)
+            continue;
+        if(c->ctrl.type == V4L2_CTRL_TYPE_MENU && c->menuitems != NULL && c->ctrl.maximum >= 0)
+            menus = c->ctrl.maximum + 1;
+        put(b, &c->ctrl, sizeof(c->ctrl));
+        put_u32(b, menus);
+        put(b, c->menuitems, menus * sizeof(struct v4l2_querymenu));
+    }
+
+    return b->failed ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: free the formats and controls of an input
+Input Value.: * formats......: the formats
+              * format_count.: their number
+              * controls.....: the controls
+              * control_count: their number
+Return Value: -
+******************************************************************************/
+static void free_capabilities(input_format *formats, int format_count, control *controls, int control_count)
+{
+    int i;
+
+    for(i = 0; formats != NULL && i < format_count; i++)
+        free(formats[i].supportedResolutions);
+    free(formats);
+    for(i = 0; controls != NULL && i < control_count; i++)
+        free(controls[i].menuitems);
+    free(controls);
+}
+
+/******************************************************************************
+Description.: parse the formats and controls of a cache file
+Input Value.: * cache: the cache, gets the formats and controls
+              * cap..: the capabilities of the device, the file must be
+                       written for the same driver and card
+Return Value: 0 if ok, -1 if the file does not fit
+******************************************************************************/
+static int parse(capcache *cache, const struct v4l2_capability *cap)
+{
+    cache_reader r = { cache->data, cache->size };
+    capcache_header header;
+    uint32_t count, i, j;
+
+    if(get(&r, &header, sizeof(header)) < 0 ||
+       memcmp(header.magic, CAPCACHE_MAGIC, sizeof(header.magic)) != 0 ||
+       header.fmtdesc_size != sizeof(struct v4l2_fmtdesc) ||
+       header.queryctrl_size != sizeof(struct v4l2_queryctrl) ||
+       header.querymenu_size != sizeof(struct v4l2_querymenu) ||
+       header.version != cap->version ||
+       memcmp(header.driver, cap->driver, sizeof(header.driver)) != 0 ||
+       memcmp(header.card, cap->card, sizeof(header.card)) != 0)
+        return -1;
+
+    if(get_u32(&r, &count) < 0 || count > CAPCACHE_MAX_FORMATS)
+        return -1;
+    if(count > 0 && (cache->formats = calloc(count, sizeof(input_format))) == NULL)
+        return -1;
+    for(i = 0; i < count; i++) {
+        input_format *f = &cache->formats[i];
+        uint32_t resolutions;
+
+        cache->format_count++;
+        f->currentResolution = -1;
+        if(get(&r, &f->format, sizeof(f->format)) < 0 ||
+           get_u32(&r, &resolutions) < 0 || resolutions > CAPCACHE_MAX_RESOLUTIONS)
+            return -1;
+        if(resolutions > 0 &&
+           (f->supportedResolutions = calloc(resolutions, sizeof(input_resolution))) == NULL)
+            return -1;
+        f->resolutionCount = resolutions;
+        for(j = 0; j < resolutions; j++) {
+            if(get_u32(&r, &f->supportedResolutions[j].width) < 0 ||
+               get_u32(&r, &f->supportedResolutions[j].height) < 0)
+                return -1;
+        }
+    }
+
+    if(get_u32(&r, &count) < 0 || count > CAPCACHE_MAX_CONTROLS)
+        return -1;
+    /* one more, so a camera without controls has some as well */
+    if((cache->controls = calloc(count + 1, sizeof(control))) == NULL)
+        return -1;
+    for(i = 0; i < count; i++) {
+        control *c = &cache->controls[i];
+        uint32_t menus;
+
+        cache->control_count++;
+        if(get(&r, &c->ctrl, sizeof(c->ctrl)) < 0 || get_u32(&r, &menus) < 0)
+            return -1;
+        if(menus > 0) {
+            if(c->ctrl.type != V4L2_CTRL_TYPE_MENU || c->ctrl.maximum < 0 ||
+               c->ctrl.maximum >= CAPCACHE_MAX_MENU || menus != (uint32_t)c->ctrl.maximum + 1)
+                return -1;
+            if((c->menuitems = calloc(menus, sizeof(struct v4l2_querymenu))) == NULL ||
+               get(&r, c->menuitems, menus * sizeof(struct v4l2_querymenu)) < 0)
+                return -1;
+        }
+        c->group = IN_CMD_V4L2;
+        c->class_id = (c->ctrl.id & 0xFFFF0000);
+#ifndef V4L2_CTRL_FLAG_NEXT_CTRL
+        c->class_id = V4L2_CTRL_CLASS_USER;
+#endif
+    }
+
+    return (r.left == 0) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: write a cache file, through a temporary file so readers never
+              see a partial one
+Input Value.: * path: the file
+              * b...: its contents
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int write_file(const char *path, const cache_buffer *b)
+{
+    char tmp[PATH_MAX + 16];
+    size_t done = 0;
+    ssize_t n;
+    int fd;
+
+    /* cameras of the same model may save theirs at the same time */
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    if((fd = mkstemp(tmp)) < 0) {
+        IPRINT("can not write the capability cache %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    fchmod(fd, 0644);
+    while(done < b->size) {
+        if((n = write(fd, b->data + done, b->size - done)) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    if(close(fd) < 0 || done < b->size || rename(tmp, path) < 0) {
+        IPRINT("can not write the capability cache %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: read the cache file of a device
+Input Value.: the device, its capabilities are queried already
+Return Value: the cache, NULL without a cache folder or a valid file
+******************************************************************************/
+capcache *capcache_open(struct vdIn *vd)
+{
+    capcache *cache;
+    struct stat st;
+    ssize_t n;
+    int fd;
+
+    if((cache = calloc(1, sizeof(capcache))) == NULL)
+        return NULL;
+    if(cache_path(vd, cache->path, sizeof(cache->path)) < 0) {
+        free(cache);
+        return NULL;
+    }
+
+    if((fd = open(cache->path, O_RDONLY | O_CLOEXEC)) < 0) {
+        DBG("no capability cache %s yet\n", cache->path);
+        free(cache);
+        return NULL;
+    }
+    if(fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > CAPCACHE_MAX_FILE ||
+       (cache->data = malloc(st.st_size)) == NULL ||
+       (n = read(fd, cache->data, st.st_size)) != st.st_size) {
+        close(fd);
+        capcache_free(cache);
+        return NULL;
+    }
+    close(fd);
+    cache->size = st.st_size;
+
+    if(parse(cache, &vd->cap) < 0) {
+        IPRINT("the capability cache %s does not fit %s, enumerating it\n", cache->path, vd->videodevice);
+        capcache_free(cache);
+        return NULL;
+    }
+
+    snprintf(cache->device, sizeof(cache->device), "%s", vd->videodevice);
+    IPRINT("Capability cache..: %s\n", cache->path);
+    return cache;
+}
+
+/******************************************************************************
+Description.: hand the cached formats to an input, instead of enumerating them
+Input Value.: * cache..: the cache, may be NULL
+              * pglobal: the globals
+              * id.....: the input
+              * format.: the format the device is opened with, it gets current
+Return Value: 0 if ok, -1 if they have to be enumerated
+******************************************************************************/
+int capcache_formats(capcache *cache, globals *pglobal, int id, int format)
+{
+    input *in = &pglobal->in[id];
+    int i;
+
+    if(cache == NULL || cache->format_count == 0)
+        return -1;
+
+    in->in_formats = cache->formats;
+    in->formatCount = cache->format_count;
+    cache->formats = NULL;
+    cache->format_count = 0;
+
+    for(i = 0; i < in->formatCount; i++) {
+        if(in->in_formats[i].format.pixelformat == (unsigned int)format) {
+            in->currentFormat = i;
+            in->in_formats[i].currentResolution = in->in_formats[i].resolutionCount - 1;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: hand the cached controls to an input and read their values,
+              with one VIDIOC_G_EXT_CTRLS for each control class
+Input Value.: * cache..: the cache, may be NULL
+              * vd.....: the device
+              * pglobal: the globals
+              * id.....: the input, it has no controls yet
+Return Value: 0 if ok, -1 if they have to be enumerated
+******************************************************************************/
+int capcache_controls(capcache *cache, struct vdIn *vd, globals *pglobal, int id)
+{
+    input *in = &pglobal->in[id];
+    struct v4l2_ext_control *ext;
+    struct v4l2_ext_controls ext_ctrls;
+    int *index;
+    int i, j, n;
+
+    if(cache == NULL || cache->controls == NULL)
+        return -1;
+
+    ext = calloc(cache->control_count, sizeof(struct v4l2_ext_control));
+    index = calloc(cache->control_count, sizeof(int));
+    if(ext == NULL || index == NULL) {
+        free(ext);
+        free(index);
+        return -1;
+    }
+
+    free(in->in_parameters);
+    in->in_parameters = cache->controls;
+    in->parametercount = cache->control_count;
+    cache->controls = NULL;
+    cache->control_count = 0;
+
+    /* controls which can not be read get their default from control_read_value() */
+    for(i = 0; i < in->parametercount; i++) {
+        control *c = &in->in_parameters[i];
+        index[i] = (c->ctrl.type == V4L2_CTRL_TYPE_BUTTON || (c->ctrl.flags & V4L2_CTRL_FLAG_WRITE_ONLY));
+        if(index[i])
+            control_read_value(vd, c);
+    }
+
+    for(i = 0; i < in->parametercount; i++) {
+        if(index[i])
+            continue;
+
+        for(j = i, n = 0; j < in->parametercount; j++) {
+            if(index[j] || V4L2_CTRL_ID2CLASS(in->in_parameters[j].ctrl.id) !=
+                           V4L2_CTRL_ID2CLASS(in->in_parameters[i].ctrl.id))
+                continue;
+            memset(&ext[n], 0, sizeof(ext[n]));
+            ext[n].id = in->in_parameters[j].ctrl.id;
+            index[j] = -1 - n++;
+        }
+
+        memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+        ext_ctrls.ctrl_class = V4L2_CTRL_ID2CLASS(in->in_parameters[i].ctrl.id);
+        ext_ctrls.count = n;
+        ext_ctrls.controls = ext;
+        n = (xioctl(vd->fd, VIDIOC_G_EXT_CTRLS, &ext_ctrls) == 0);
+
+        for(j = i; j < in->parametercount; j++) {
+            control *c = &in->in_parameters[j];
+            if(index[j] >= 0)
+                continue;
+            if(!n)
+                control_read_value(vd, c);
+            else if(c->ctrl.type == V4L2_CTRL_TYPE_INTEGER64)
+                c->value = ext[-1 - index[j]].value64;
+            else
+                c->value = ext[-1 - index[j]].value;
+            index[j] = 1;
+        }
+    }
+
+    free(ext);
+    free(index);
+    return 0;
+}
+
+/******************************************************************************
+Description.: write the cache file of a device after its enumeration
+Input Value.: * vd.....: the device
+              * pglobal: the globals
+              * id.....: the input with the enumerated formats and controls
+Return Value: 0 if ok, -1 without a cache folder or on errors
+******************************************************************************/
+int capcache_save(struct vdIn *vd, globals *pglobal, int id)
+{
+    char path[PATH_MAX];
+    cache_buffer b = {0};
+    int ret = -1;
+
+    if(cache_path(vd, path, sizeof(path)) < 0)
+        return -1;
+
+    mkdir(vd->capcache_folder, 0755);
+    if(serialize(&vd->cap, &pglobal->in[id], &b) == 0 && write_file(path, &b) == 0) {
+        IPRINT("Capability cache..: %s written\n", path);
+        ret = 0;
+    }
+    free(b.data);
+    return ret;
+}
+
+/******************************************************************************
+Description.: enumerate the device again on a descriptor of its own, it stays
+              untouched by setResolution(), and renew the file if it differs
+Input Value.: the cache
+Return Value: NULL
+******************************************************************************/
+static void *revalidate_thread(void *arg)
+{
+    capcache *cache = arg;
+    struct vdIn probe;
+    input in;
+    globals probe_globals;
+    cache_buffer b = {0};
+    int i;
+
+    for(i = 0; i < CAPCACHE_DELAY * 10 && !cache->stop; i++)
+        usleep(100 * 1000);
+    if(cache->stop)
+        return NULL;
+
+    memset(&probe, 0, sizeof(probe));
+    memset(&in, 0, sizeof(in));
+    memset(&probe_globals, 0, sizeof(probe_globals));
+    probe_globals.in = &in;
+    probe_globals.incnt = 1;
+
+    if((probe.fd = OPEN_VIDEO(cache->device, O_RDWR | O_NONBLOCK)) < 0) {
+        DBG("can not open %s to check its capability cache\n", cache->device);
+        return NULL;
+    }
+
+    if(xioctl(probe.fd, VIDIOC_QUERYCAP, &probe.cap) == 0 &&
+       enumerateFormats(&probe, &probe_globals, 0, 0) == 0) {
+        enumerateV4l2Controls(&probe, &probe_globals, 0);
+        if(!cache->stop && serialize(&probe.cap, &in, &b) == 0 &&
+           (b.size != cache->size || memcmp(b.data, cache->data, b.size) != 0) &&
+           write_file(cache->path, &b) == 0) {
+            IPRINT("the capabilities of %s changed, %s is renewed for the next start\n",
+                   cache->device, cache->path);
+        } else {
+            DBG("the capability cache %s is up to date\n", cache->path);
+        }
+    }
+
+    CLOSE_VIDEO(probe.fd);
+    free_capabilities(in.in_formats, in.formatCount, in.in_parameters, in.parametercount);
+    free(b.data);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: check the cache file of a device in the background, a while
+              after the start
+Input Value.: the cache the input was set up from, may be NULL
+Return Value: -
+******************************************************************************/
+void capcache_revalidate(capcache *cache)
+{
+    if(cache == NULL || cache->running)
+        return;
+
+    if(pthread_create(&cache->thread, NULL, revalidate_thread, cache) != 0) {
+        DBG("can not start the revalidation of %s\n", cache->path);
+        return;
+    }
+    cache->running = 1;
+}
+
+/******************************************************************************
+Description.: free a cache, after its revalidation has ended
+Input Value.: the cache, may be NULL
+Return Value: -
+******************************************************************************/
+void capcache_free(capcache *cache)
+{
+    if(cache == NULL)
+        return;
+
+    if(cache->running) {
+        cache->stop = 1;
+        pthread_join(cache->thread, NULL);
+    }
+    free_capabilities(cache->formats, cache->format_count, cache->controls, cache->control_count);
+    free(cache->data);
+    free(cache);
+}
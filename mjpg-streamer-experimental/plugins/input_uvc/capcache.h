@@ -0,0 +1,44 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef CAPCACHE_H
+#define CAPCACHE_H
+
+#include "v4l2uvc.h"
+
+/*
+ * the formats, frame sizes and control descriptions of a camera kept in a
+ * file of the folder given with -capcache, one per USB vendor, product and
+ * firmware (bcdDevice), so a known camera is set up without the hundreds of
+ * ioctls, each a USB request, their enumeration takes. Only the control
+ * values are read at startup. A while after the start the device is
+ * enumerated once more in the background and the file is renewed if it was
+ * out of date, the changes are used from the next start.
+ */
+typedef struct _capcache capcache;
+
+capcache *capcache_open(struct vdIn *vd);
+int capcache_formats(capcache *cache, globals *pglobal, int id, int format);
+int capcache_controls(capcache *cache, struct vdIn *vd, globals *pglobal, int id);
+int capcache_save(struct vdIn *vd, globals *pglobal, int id);
+void capcache_revalidate(capcache *cache);
+void capcache_free(capcache *cache);
+
+#endif
@@ -29,12 +29,14 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <time.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <syslog.h>
@@ -43,19 +45,25 @@
 #include <linux/videodev2.h>
 
 #include "../../utils.h"
+#include "../../probes.h"
 #include "v4l2uvc.h" // this header will includes the ../../mjpg_streamer.h
 
 #ifndef NO_LIBJPEG
-    #include "jpeg_utils.h"
     #include "huffman.h"
 #endif
 
 #include "dynctrl.h"
+#include "usbbw.h"
 
 //#include "uvcvideo.h"
 
 #define INPUT_PLUGIN_NAME "UVC webcam grabber"
 
+/* a camera which failed is opened again after this long, twice as long
+ * after each failed attempt */
+#define MIN_BACKOFF_MS 500
+#define MAX_BACKOFF_MS (30 * 1000)
+
 static const struct {
     const char *string;
     const v4l2_std_id vstd;
@@ -75,7 +83,20 @@ static int wantTimestamp = 0;
 static struct timeval timestamp;
 static int softfps = -1;
 static unsigned int timeout = 5;
+static unsigned int idle = 0;
 static unsigned int dv_timings = 0;
+static int threads = 0;
+static int use_m2m = 0;
+static char *m2m_device = NULL;
+static int encoder = -1;
+static int zerocopy = 0;
+static int buffers = NB_BUFFER;
+static int optimize = 0;
+static int progressive = 0;
+static int kbps = 0;
+static int max_size = 0;
+static char *capcache_folder = NULL;
+static int usbbw = 0;
 
 static const struct {
   const char * k;
@@ -125,6 +146,134 @@ static context_settings * init_settings() {
 }
 
 
+/******************************************************************************
+Description.: allocate the context of a camera and attach it to its input
+Input Value.: * id......: the input of the camera
+              * settings: its initial settings, freed by cam_thread()
+Return Value: the context, exits if there is no memory
+******************************************************************************/
+static context *new_context(int id, context_settings *settings)
+{
+    context *pctx;
+
+    pctx = calloc(1, sizeof(context));
+    if (pctx == NULL) {
+        IPRINT("error allocating context");
+        exit(EXIT_FAILURE);
+    }
+
+    pctx->id = id;
+    pctx->pglobal = pglobal;
+    pctx->init_settings = settings;
+    pctx->watched = -1;
+    pglobal->in[id].context = pctx;
+
+    /* initialize the mutes variable */
+    if(pthread_mutex_init(&pctx->controls_mutex, NULL) != 0 ||
+       pthread_cond_init(&pctx->switched, NULL) != 0) {
+        IPRINT("could not initialize mutex variable\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return pctx;
+}
+
+/*
+ * the options a camera is opened with. Other plugins initialized at the
+ * same time parse their options into the statics meanwhile, so they are
+ * copied before.
+ */
+typedef struct {
+    int width, height, fps, format;
+    v4l2_std_id tvnorm;
+    unsigned int dv_timings;
+    int dynctrls, zerocopy, buffers;
+    int flags;              /* JPEG_OPTIMIZE, JPEG_PROGRESSIVE */
+    int encoder;            /* JPEG_BACKEND_* */
+    char *m2m_device;
+    int kbps, max_size;
+    int threads;
+    char *capcache_folder;
+    unsigned int idle;      /* -idle, seconds */
+    int usbbw;              /* -usbbw, percent of a bus */
+} camera_options;
+
+/******************************************************************************
+Description.: open the video device of a camera and register its controls
+Input Value.: * pctx: the context of the camera
+              * dev.: the video device
+              * opts: the options, the resolution and format are passed to
+                      init_videoIn()
+Return Value: -, exits if the device can not be used
+******************************************************************************/
+static void open_camera(context *pctx, char *dev, camera_options *opts)
+{
+    int id = pctx->id, format = opts->format;
+
+    /* allocate webcam datastructure */
+    pctx->videoIn = calloc(1, sizeof(struct vdIn));
+    if(pctx->videoIn == NULL) {
+        IPRINT("not enough memory for videoIn\n");
+        exit(EXIT_FAILURE);
+    }
+
+    IPRINT("Using V4L2 device.: %s\n", dev);
+
+    DBG("vdIn pn: %d\n", id);
+    /* open video device and prepare data structure */
+    pctx->videoIn->dv_timings = opts->dv_timings;
+    pctx->videoIn->zerocopy = opts->zerocopy;
+    pctx->videoIn->buffer_count = opts->buffers;
+    pctx->videoIn->capcache_folder = opts->capcache_folder;
+    pctx->idle = opts->idle;
+    #ifndef NO_LIBJPEG
+    /* a hardware encoder reads raw frames straight from the capture buffers */
+    pctx->videoIn->hold_buffer = (opts->encoder == JPEG_BACKEND_M2M || opts->encoder == JPEG_BACKEND_AUTO) &&
+                                 format != V4L2_PIX_FMT_MJPEG && format != V4L2_PIX_FMT_JPEG;
+    #endif
+    if(init_videoIn(pctx->videoIn, dev, opts->width, opts->height, opts->fps, format, 1, pctx->pglobal, id, opts->tvnorm) < 0) {
+        IPRINT("init_VideoIn failed\n");
+        closelog();
+        exit(EXIT_FAILURE);
+    }
+
+    IPRINT("Capture buffers...: %d\n", pctx->videoIn->nb_buffers);
+    pglobal->in[id].stats.capture_buffers = pctx->videoIn->nb_buffers;
+
+    pctx->quality = pctx->init_settings->quality;
+
+    /*
+     * recent linux-uvc driver (revision > ~#125) requires to use dynctrls
+     * for pan/tilt/focus/...
+     * dynctrls must get initialized
+     */
+    if(opts->dynctrls)
+        initDynCtrls(pctx->videoIn->fd);
+    
+    enumerateControls(pctx->videoIn, pctx->pglobal, id); // enumerate V4L2 controls after UVC extended mapping
+
+    #ifndef NO_LIBJPEG
+    /* libjpeg takes a new quality with every frame */
+    if(format != V4L2_PIX_FMT_MJPEG && format != V4L2_PIX_FMT_JPEG) {
+        rate_control_init(&pctx->rate, &pglobal->in[id], pctx->quality, opts->kbps, opts->max_size);
+        if(opts->kbps > 0 || opts->max_size > 0)
+            IPRINT("Rate control......: %d kbit/s, %d bytes per frame (0 = no limit)\n", opts->kbps, opts->max_size);
+    }
+    #endif
+}
+
+/******************************************************************************
+Description.: called by the core for the first subscriber of an input of a
+              camera with -idle, the capture thread starts it again
+Input Value.: the input
+Return Value: -
+******************************************************************************/
+static void wake_camera(input *in)
+{
+    video_wakeup(((context *)in->context)->videoIn);
+}
+
+
 /*** plugin interface functions ***/
 /******************************************************************************
 Description.: This function initializes the plugin. It parses the commandline-
@@ -137,27 +286,18 @@ Return Value: 0 if everything is fine
 ******************************************************************************/
 int input_init(input_parameter *param, int id)
 {
-    char *dev = "/dev/video0", *s;
-    int width = 640, height = 480, fps = -1, format = V4L2_PIX_FMT_MJPEG, i;
+    char *devices = NULL, *name, *next, *names[MAX_CAMERAS];
+    int width = 640, height = 480, fps = -1, format = V4L2_PIX_FMT_MJPEG, i, count = 0;
+    usb_camera *usb[MAX_CAMERAS];
     v4l2_std_id tvnorm = V4L2_STD_UNKNOWN;
     context *pctx;
     context_settings *settings;
-    
-    pctx = calloc(1, sizeof(context));
-    if (pctx == NULL) {
-        IPRINT("error allocating context");
-        exit(EXIT_FAILURE);
-    }
-    
-    settings = pctx->init_settings = init_settings();
-    pglobal = param->global;
-    pglobal->in[id].context = pctx;
+    camera_group *group;
+    camera_options opts;
 
-    /* initialize the mutes variable */
-    if(pthread_mutex_init(&pctx->controls_mutex, NULL) != 0) {
-        IPRINT("could not initialize mutex variable\n");
-        exit(EXIT_FAILURE);
-    }
+    pglobal = param->global;
+    pctx = new_context(id, init_settings());
+    settings = pctx->init_settings;
 
     param->argv[0] = INPUT_PLUGIN_NAME;
 
@@ -215,6 +355,18 @@ int input_init(input_parameter *param, int id)
             {"softfps", required_argument, 0, 0},
             {"timeout", required_argument, 0, 0},
             {"dv_timings", no_argument, 0, 0},
+            {"threads", required_argument, 0, 0},
+            {"m2m", required_argument, 0, 0},
+            {"zerocopy", no_argument, 0, 0},
+            {"buffers", required_argument, 0, 0},
+            {"optimize", no_argument, 0, 0},
+            {"progressive", no_argument, 0, 0},
+            {"kbps", required_argument, 0, 0},
+            {"maxsize", required_argument, 0, 0},
+            {"capcache", required_argument, 0, 0},
+            {"idle", required_argument, 0, 0},
+            {"encoder", required_argument, 0, 0},
+            {"usbbw", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -244,7 +396,7 @@ int input_init(input_parameter *param, int id)
         case 2:
         case 3:
             DBG("case 2,3\n");
-            dev = realpath(optarg, NULL);
+            devices = strdup(optarg);
             break;
 
         /* r, resolution */
@@ -320,6 +472,10 @@ int input_init(input_parameter *param, int id)
                 format = V4L2_PIX_FMT_RGB24;
             } else if (strcmp(optarg, "RGBP") == 0) {
                 format = V4L2_PIX_FMT_RGB565;
+            } else if (strcmp(optarg, "NV12") == 0) {
+                format = V4L2_PIX_FMT_NV12;
+            } else if (strcmp(optarg, "NV16") == 0) {
+                format = V4L2_PIX_FMT_NV16;
             } else {
               fprintf(stderr," i: FOURCC codec '%s' not supported\n", optarg);
             }
@@ -387,6 +543,59 @@ int input_init(input_parameter *param, int id)
             DBG("case 42\n");
             dv_timings = 1;
             break;
+        case 43:
+            DBG("case 43\n");
+            threads = MAX(atoi(optarg), 1);
+            break;
+        case 44:
+            DBG("case 44\n");
+            use_m2m = 1;
+            m2m_device = (strcmp(optarg, "auto") == 0) ? NULL : strdup(optarg);
+            break;
+        case 45:
+            DBG("case 45\n");
+            zerocopy = 1;
+            break;
+        case 46:
+            DBG("case 46\n");
+            buffers = MIN(MAX(atoi(optarg), 2), MAX_BUFFERS);
+            break;
+        case 47:
+            DBG("case 47\n");
+            optimize = 1;
+            break;
+        case 48:
+            DBG("case 48\n");
+            progressive = 1;
+            break;
+        case 49:
+            DBG("case 49\n");
+            kbps = MAX(atoi(optarg), 0);
+            break;
+        case 50:
+            DBG("case 50\n");
+            max_size = MAX(atoi(optarg), 0);
+            break;
+        case 51:
+            DBG("case 51\n");
+            capcache_folder = strdup(optarg);
+            break;
+        case 52:
+            DBG("case 52\n");
+            idle = MAX(atoi(optarg), 0);
+            break;
+        case 53:
+            DBG("case 53\n");
+            if((encoder = jpeg_backend_parse(optarg)) < 0) {
+                IPRINT("unknown JPEG encoder %s\n", optarg);
+                help();
+                return 1;
+            }
+            break;
+        case 54:
+            DBG("case 54\n");
+            usbbw = MIN(MAX(atoi(optarg), 0), 100);
+            break;
        default:
            DBG("default case\n");
            help();
@@ -394,18 +603,15 @@ int input_init(input_parameter *param, int id)
       }
     }
     DBG("input id: %d\n", id);
-    pctx->id = id;
-    pctx->pglobal = param->global;
 
-    /* allocate webcam datastructure */
-    pctx->videoIn = calloc(1, sizeof(struct vdIn));
-    if(pctx->videoIn == NULL) {
-        IPRINT("not enough memory for videoIn\n");
+    group = calloc(1, sizeof(camera_group));
+    if(group == NULL) {
+        IPRINT("not enough memory for the camera group\n");
         exit(EXIT_FAILURE);
     }
-    
+    group->epfd = -1;
+
     /* display the parsed values */
-    IPRINT("Using V4L2 device.: %s\n", dev);
     IPRINT("Desired Resolution: %i x %i\n", width, height);
     IPRINT("Frames Per Second.: %i\n", fps);
     char *fmtString = NULL;
@@ -428,6 +634,12 @@ int input_init(input_parameter *param, int id)
             case V4L2_PIX_FMT_RGB565:
                 fmtString = "RGB565";
                 break;
+            case V4L2_PIX_FMT_NV12:
+                fmtString = "NV12";
+                break;
+            case V4L2_PIX_FMT_NV16:
+                fmtString = "NV16";
+                break;
         #endif
         default:
             fmtString = "Unknown format";
@@ -445,29 +657,151 @@ int input_init(input_parameter *param, int id)
         IPRINT("TV-Norm...........: DEFAULT\n");
     }
 
-    DBG("vdIn pn: %d\n", id);
-    /* open video device and prepare data structure */
-    pctx->videoIn->dv_timings = dv_timings;
-    if(init_videoIn(pctx->videoIn, dev, width, height, fps, format, 1, pctx->pglobal, id, tvnorm) < 0) {
-        IPRINT("init_VideoIn failed\n");
-        closelog();
-        exit(EXIT_FAILURE);
-    }
-
     if (softfps > 0) {
         IPRINT("Framedrop FPS.....: %d\n", softfps);
     }
 
-    /*
-     * recent linux-uvc driver (revision > ~#125) requires to use dynctrls
-     * for pan/tilt/focus/...
-     * dynctrls must get initialized
-     */
-    if(dynctrls)
-        initDynCtrls(pctx->videoIn->fd);
-    
-    enumerateControls(pctx->videoIn, pctx->pglobal, id); // enumerate V4L2 controls after UVC extended mapping
-    
+    if (idle > 0) {
+        IPRINT("Idle after........: %u s without subscribers\n", idle);
+    }
+
+    if (usbbw > 0) {
+        IPRINT("USB bandwidth.....: planned for %d%% of each bus\n", usbbw);
+    }
+
+    opts.width = width;
+    opts.height = height;
+    opts.fps = fps;
+    opts.format = format;
+    opts.tvnorm = tvnorm;
+    opts.dv_timings = dv_timings;
+    opts.dynctrls = dynctrls;
+    opts.zerocopy = zerocopy;
+    opts.buffers = buffers;
+    opts.flags = (optimize ? JPEG_OPTIMIZE : 0) | (progressive ? JPEG_PROGRESSIVE : 0);
+    /* -m2m picks the encoder unless -encoder does, slices go on one thread without -threads */
+    if(encoder >= 0) {
+        opts.encoder = encoder;
+    } else {
+        opts.encoder = use_m2m ? JPEG_BACKEND_M2M : JPEG_BACKEND_SLICES;
+    }
+    opts.m2m_device = m2m_device;
+    opts.kbps = kbps;
+    opts.max_size = max_size;
+    opts.threads = threads;
+    if(threads == 0 && (encoder == JPEG_BACKEND_SLICES || encoder == JPEG_BACKEND_AUTO))
+        opts.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    opts.capcache_folder = capcache_folder;
+    opts.idle = idle;
+    opts.usbbw = usbbw;
+
+    /* opening the devices takes long, the other cameras go on meanwhile */
+    plugin_options_parsed();
+
+    if(devices == NULL)
+        devices = strdup("/dev/video0");
+    for(name = strtok_r(devices, ",", &next); name != NULL; name = strtok_r(NULL, ",", &next)) {
+        if(count == MAX_CAMERAS) {
+            IPRINT("too many cameras, ignoring %s\n", name);
+            break;
+        }
+        if((names[count] = realpath(name, NULL)) == NULL)
+            names[count] = strdup(name);
+        count++;
+    }
+    free(devices);
+
+    /* with -usbbw the modes of all cameras are planned before the first one is opened */
+    memset(usb, 0, sizeof(usb));
+    if(opts.usbbw > 0) {
+        for(i = 0; i < count; i++) {
+            if((usb[i] = malloc(sizeof(usb_camera))) == NULL ||
+               usb_probe(usb[i], names[i], format, width, height, fps) < 0) {
+                IPRINT("could not enumerate the modes of %s\n", names[i]);
+                free(usb[i]);
+                usb[i] = NULL;
+            }
+        }
+        usb_plan(usb, count, opts.usbbw);
+    }
+
+    /* the first camera of the list uses this input, each further one gets an input of its own */
+    for(i = 0; i < count; i++) {
+        camera_options mode = opts;
+
+        if(group->count > 0) {
+            int cam;
+            if((cam = input_add(&pglobal->in[id])) < 0) {
+                IPRINT("too many cameras, ignoring %s\n", names[i]);
+                break;
+            }
+            pctx = new_context(cam, memcpy(init_settings(), settings, sizeof(context_settings)));
+        }
+        pctx->group = group;
+        group->cameras[group->count++] = pctx;
+
+        if(usb[i] != NULL && usb[i]->count > 0) {
+            const usb_mode *planned = &usb[i]->modes[usb[i]->current];
+            IPRINT("Planned for %s: %dx%d at %d fps, %s\n", names[i], planned->width, planned->height,
+                   planned->fps, (planned->format == V4L2_PIX_FMT_MJPEG || planned->format == V4L2_PIX_FMT_JPEG) ? "JPEG" : fmtString);
+            mode.format = planned->format;
+            mode.width = planned->width;
+            mode.height = planned->height;
+            mode.fps = planned->fps;
+            pctx->usb = usb[i];
+            usb[i] = NULL;
+        }
+        open_camera(pctx, names[i], &mode);
+        if(opts.idle > 0)
+            pglobal->in[pctx->id].wake = wake_camera;
+    }
+    for(i = 0; i < count; i++) {
+        free(names[i]);
+        if(usb[i] != NULL) {
+            usb_free(usb[i]);
+            free(usb[i]);
+        }
+    }
+
+    #ifndef NO_LIBJPEG
+    /* frames the camera does not deliver as JPEG are compressed in slices */
+    if(format != V4L2_PIX_FMT_MJPEG && format != V4L2_PIX_FMT_JPEG) {
+        jpeg_backend_options backend;
+        int n = opts.threads;
+
+        /* the thread of several cameras needs the encoder threads of all cores */
+        if(n == 0)
+            n = (group->count > 1) ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+        if(n > 1 && (opts.encoder == JPEG_BACKEND_SLICES || opts.encoder == JPEG_BACKEND_AUTO)) {
+            if((group->encoder = jpeg_encoder_new(n)) == NULL) {
+                IPRINT("could not start the encoder threads\n");
+            } else {
+                IPRINT("Encoder threads...: %d\n", n);
+            }
+        }
+
+        /* the cameras share the threads, each one has its own compressors */
+        memset(&backend, 0, sizeof(backend));
+        backend.backend = opts.encoder;
+        backend.flags = opts.flags;
+        backend.device = opts.m2m_device;
+        backend.encoder = group->encoder;
+        backend.threads = 1;
+        IPRINT("JPEG backend......: %s\n", jpeg_backend_name(opts.encoder));
+        for(i = 0; i < group->count; i++) {
+            /* -usbbw may have picked MJPEG for some of them */
+            if(group->cameras[i]->videoIn->formatIn == V4L2_PIX_FMT_MJPEG ||
+               group->cameras[i]->videoIn->formatIn == V4L2_PIX_FMT_JPEG)
+                continue;
+            if((group->cameras[i]->jpeg = jpeg_backend_new(&backend)) == NULL) {
+                IPRINT("not enough memory for the JPEG encoder\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    #endif
+
     return 0;
 }
 
@@ -480,9 +814,13 @@ int input_stop(int id)
 {
     input * in = &pglobal->in[id];
     context *pctx = (context*)in->context;
-    
-    DBG("will cancel camera thread #%02d\n", id);
-    pthread_cancel(pctx->threadID);
+    camera_group *group = pctx->group;
+
+    /* the cameras of a group share one thread */
+    if(group->cancelled++ == 0) {
+        DBG("will cancel camera thread #%02d\n", group->cameras[0]->id);
+        pthread_cancel(group->threadID);
+    }
     return 0;
 }
 
@@ -495,17 +833,20 @@ int input_run(int id)
 {
     input * in = &pglobal->in[id];
     context *pctx = (context*)in->context;
-    
-    in->buf = malloc(pctx->videoIn->framesizeIn);
-    if(in->buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
-    }
+    camera_group *group = pctx->group;
+
+    /* frames for the JPEG encoder are framesizeIn bytes, have some of them ready */
+    if(pctx->videoIn->formatIn != V4L2_PIX_FMT_MJPEG)
+        frame_pool_reserve(pctx->videoIn->framesizeIn, 2);
+
+    /* the first camera of a group starts the thread serving all of them */
+    if(pctx != group->cameras[0])
+        return 0;
 
     DBG("launching camera thread #%02d\n", id);
-    /* create thread and pass context to thread function */
-    pthread_create(&(pctx->threadID), NULL, cam_thread, in);
-    pthread_detach(pctx->threadID);
+    /* create thread and pass the camera group to thread function */
+    pthread_create(&(group->threadID), NULL, cam_thread, group);
+    pthread_detach(group->threadID);
     return 0;
 }
 
@@ -523,7 +864,8 @@ void help(void)
     " Help for input plugin..: "INPUT_PLUGIN_NAME"\n" \
     " ---------------------------------------------------------------\n" \
     " The following parameters can be passed to this plugin:\n\n" \
-    " [-d | --device ].......: video device to open (your camera)\n" \
+    " [-d | --device ].......: video device to open (your camera), a comma\n" \
+    "                          separated list serves several cameras\n" \
     " [-r | --resolution ]...: the resolution of the video device,\n" \
     "                          can be one of the following strings:\n" \
     "                          ");
@@ -545,12 +887,38 @@ void help(void)
     " [-u | --uyvy ] ........: Use UYVY format, default: MJPEG (uses more cpu power)\n" \
     " [-y | --yuv  ] ........: Use YUV format, default: MJPEG (uses more cpu power)\n" \
     " [-fourcc ] ............: Use FOURCC codec 'argopt', \n" \
-    "                          currently supported codecs are: RGB24, RGBP \n" \
+    "                          currently supported codecs are: RGB24, RGBP, NV12, NV16 \n" \
     " [-timestamp ]..........: Populate frame timestamp with system time\n" \
     " [-softfps] ............: Drop frames to try and achieve this fps\n" \
     "                          set your camera to its maximum fps to avoid stuttering\n" \
-    " [-timeout] ............: Timeout for device querying (seconds)\n" \
+    " [-timeout] ............: Open the device again after this many seconds\n" \
+    "                          without a frame, default: 5\n" \
     " [-dv_timings] .........: Enable DV timings queriyng and events processing\n" \
+    " [-threads ]............: Compress YUV and RGB frames in slices on this many\n" \
+    "                          threads, default: 1, all cores for several cameras\n" \
+    " [-m2m ]................: Compress YUV and RGB frames with a V4L2 mem2mem\n" \
+    "                          JPEG encoder, \"auto\" or its device\n" \
+    " [-encoder ]............: Compress YUV and RGB frames with libjpeg, slices,\n" \
+    "                          turbojpeg, m2m or the fastest of them with auto,\n" \
+    "                          default: slices, m2m with -m2m\n" \
+    " [-zerocopy ]...........: Capture MJPEG frames straight into the frames given\n" \
+    "                          to the outputs, needs more memory\n" \
+    " [-buffers ]............: number of capture buffers (2-32), default: 4,\n" \
+    "                          more absorb slow frames, fewer lower the latency\n" \
+    " [-optimize ]...........: Compute optimal huffman tables for each frame,\n" \
+    "                          smaller YUV and RGB frames for some CPU time\n" \
+    " [-progressive ]........: Compress YUV and RGB frames as progressive JPEGs\n" \
+    " [-kbps ]...............: Lower the quality of YUV and RGB frames to stay\n" \
+    "                          below this bitrate\n" \
+    " [-maxsize ]............: Lower the quality of YUV and RGB frames to keep\n" \
+    "                          them below this many bytes\n" \
+    " [-capcache ]...........: Keep the formats and controls of each camera model\n" \
+    "                          in this folder, so they are not enumerated again\n" \
+    " [-idle ]...............: Stop capturing after this many seconds without\n" \
+    "                          subscribers, until the next one comes, default: 0\n" \
+    "                          to capture all the time\n" \
+    " [-usbbw ]..............: Plan the modes of the cameras so they fit into\n" \
+    "                          this percentage of the bandwidth of their USB bus\n" \
     " ---------------------------------------------------------------\n");
 
     fprintf(stderr, "\n"\
@@ -574,27 +942,86 @@ void help(void)
 }
 
 /******************************************************************************
-Description.: this thread worker grabs a frame and copies it to the global buffer
-Input Value.: unused
-Return Value: unused, always NULL
+Description.: describe the picture of a YUYV, UYVY, RGB24, RGB565, NV12 or
+              NV16 frame, in the capture buffer if it is held and in
+              vd->framebuffer if not. The chroma of NV12 and NV16 follows the
+              luma there, except in held buffers of two memory planes.
+Input Value.: * vd.: the device with the picture uvcGrab() got
+              * pic: filled in
+Return Value: pic
 ******************************************************************************/
-void *cam_thread(void *arg)
+#ifndef NO_LIBJPEG
+static jpeg_picture *raw_picture(struct vdIn *vd, jpeg_picture *pic)
+{
+    memset(pic, 0, sizeof(*pic));
+    pic->format.pixelformat = vd->formatIn;
+    pic->format.width = vd->width;
+    pic->format.height = vd->height;
+    pic->format.planes = 1;
+    pic->format.stride[0] = vd->stride[0];
+    if(pic->format.stride[0] == 0)
+        pic->format.stride[0] = vd->width * ((vd->formatIn == V4L2_PIX_FMT_RGB24) ? 3 : 2);
+    pic->format.dmabuf = vd->held ? vd->dmabuf[vd->buf.index] : -1;
+    pic->plane[0] = vd->held ? vd->mem[vd->buf.index] : vd->framebuffer;
+    if(video_chroma_lines(vd->formatIn, vd->height) > 0) {
+        pic->format.planes = 2;
+        pic->format.stride[1] = vd->stride[1];
+        if(vd->held && vd->mem_chroma[vd->buf.index] != NULL)
+            pic->plane[1] = vd->mem_chroma[vd->buf.index];
+        else
+            pic->plane[1] = pic->plane[0] + vd->stride[0] * vd->height;
+    }
+    pic->size = MIN(vd->buf.bytesused, (unsigned int)vd->framesizeIn);
+    pic->index = vd->held ? (int)vd->buf.index : -1;
+    pic->buffers = (vd->dmabuf[0] >= 0) ? vd->nb_buffers : 0;
+    return pic;
+}
+
+/******************************************************************************
+Description.: copy the picture of a raw frame for the consumers of raw
+              frames, its capture buffer is queued again right after
+              compressing it
+Input Value.: the device with the picture uvcGrab() got
+Return Value: the raw frame, NULL without memory
+******************************************************************************/
+static input_frame *copy_raw_frame(struct vdIn *vd)
+{
+    jpeg_picture pic;
+    int lengths[RAW_PLANES];
+
+    raw_picture(vd, &pic);
+    pic.format.dmabuf = -1;
+    lengths[0] = pic.size;
+    if(pic.format.planes > 1) {
+        lengths[0] = pic.format.stride[0] * pic.format.height;
+        lengths[1] = pic.format.stride[1] * video_chroma_lines(pic.format.pixelformat, pic.format.height);
+    }
+    return frame_raw_copy(&pic.format, pic.plane, lengths);
+}
+#endif
+
+/* data of the epoll events, the index of the camera and the kind of fd */
+#define EVENT_DEVICE(i) ((uint64_t)(i) << 1)
+#define EVENT_WAKEUP(i) (((uint64_t)(i) << 1) | 1)
+
+/******************************************************************************
+Description.: set the initial V4L2 controls given on the command line
+Input Value.: the context of the camera, its init_settings are freed
+Return Value: -
+******************************************************************************/
+static void apply_settings(context *pcontext)
 {
-    input * in = (input*)arg;
-    context *pcontext = (context*)in->context;
     context_settings *settings = pcontext->init_settings;
-    
-    unsigned int every_count = 0;
-    int quality = settings->quality;
-    
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(cam_cleanup, in);
-    
+    int ids[IN_CMD_BATCH_MAX], values[IN_CMD_BATCH_MAX], results[IN_CMD_BATCH_MAX];
+    const char *names[IN_CMD_BATCH_MAX];
+    int i, count = 0;
+
+    /* collected first, the camera gets them in as few ioctls as possible */
     #define V4L_OPT_SET(vid, var, desc) \
-      if (input_cmd(pcontext->id, vid, IN_CMD_V4L2, settings->var, NULL) != 0) {\
-          fprintf(stderr, "Failed to set " desc "\n"); \
-      } else { \
-          printf(" i: %-18s: %d\n", desc, settings->var); \
+      if (count < IN_CMD_BATCH_MAX) { \
+          ids[count] = vid; \
+          values[count] = settings->var; \
+          names[count++] = desc; \
       }
     
     #define V4L_INT_OPT(vid, var, desc) \
@@ -659,168 +1086,644 @@ void *cam_thread(void *arg)
         }
     }
     
+    if (count > 0)
+        v4l2SetControls(pcontext->videoIn, ids, values, results, count, pcontext->id, pglobal);
+    for (i = 0; i < count; i++) {
+        if (results[i] != 0) {
+            fprintf(stderr, "Failed to set %s\n", names[i]);
+        } else {
+            printf(" i: %-18s: %d\n", names[i], values[i]);
+        }
+    }
+
     free(settings);
     settings = NULL;
     pcontext->init_settings = NULL;
+}
 
-    if (softfps > 0) {
-        pcontext->videoIn->soft_framedrop = 1;
-        pcontext->videoIn->frame_period_time = 1000/softfps;
+/******************************************************************************
+Description.: carry out a resolution change input_cmd() asked for. The
+              capture thread does it between two frames, so it never races
+              with uvcGrab() and no buffer is held. The outputs keep the
+              last frame of the old size meanwhile and the following frames
+              simply have the new one, which they tell from the frames.
+Input Value.: the context of the camera
+Return Value: 0 if the camera streams, -1 if it can not be used anymore
+******************************************************************************/
+static int switch_camera(context *pcontext)
+{
+    struct vdIn *vd = pcontext->videoIn;
+    int width, height, ret;
+
+    pthread_mutex_lock(&pcontext->controls_mutex);
+    width = pcontext->switch_width;
+    height = pcontext->switch_height;
+    pthread_mutex_unlock(&pcontext->controls_mutex);
+    if(width == 0)
+        return 0;
+
+    /* a closed camera keeps its size */
+    ret = (pcontext->retry_usec != 0) ? -1 : switchResolution(vd, width, height);
+    if(ret == 0) {
+        IPRINT("resolution of input %d: %dx%d\n", pcontext->id, vd->width, vd->height);
     }
 
-    if (video_enable(pcontext->videoIn)) {
-        IPRINT("Can\'t enable video in first time\n");
-        goto endloop;
-    }
+    pthread_mutex_lock(&pcontext->controls_mutex);
+    pcontext->switch_result = (ret == 0) ? 0 : -1;
+    pcontext->switch_width = pcontext->switch_height = 0;
+    pthread_cond_broadcast(&pcontext->switched);
+    pthread_mutex_unlock(&pcontext->controls_mutex);
+
+    /* the stream is off, reopening the device is all that is left */
+    if(ret == -2 && setResolution(vd, vd->width, vd->height) < 0)
+        return -1;
+    return 0;
+}
 
-    while(!pglobal->stop) {
-        while(pcontext->videoIn->streamingState == STREAMING_PAUSED) {
-            usleep(1); // maybe not the best way so FIXME
+/******************************************************************************
+Description.: ask the capture thread of a camera to change its resolution and
+              wait until it did
+Input Value.: * pctx.........: the context of the camera
+              * width, height: the resolution
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int request_resolution(context *pctx, int width, int height)
+{
+    struct timespec deadline;
+    int ret = -1;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout + 1;
+
+    pthread_mutex_lock(&pctx->controls_mutex);
+    while(pctx->switch_width != 0 &&
+          pthread_cond_timedwait(&pctx->switched, &pctx->controls_mutex, &deadline) == 0);
+    if(pctx->switch_width == 0 && pctx->active) {
+        pctx->switch_width = width;
+        pctx->switch_height = height;
+        video_wakeup(pctx->videoIn);
+        while(pctx->switch_width != 0 &&
+              pthread_cond_timedwait(&pctx->switched, &pctx->controls_mutex, &deadline) == 0);
+        if(pctx->switch_width == 0) {
+            ret = pctx->switch_result;
+        } else {
+            DBG("the capture thread did not change the resolution\n");
+            pctx->switch_width = pctx->switch_height = 0;
         }
+    }
+    pthread_mutex_unlock(&pctx->controls_mutex);
 
-        fd_set rd_fds; // for capture
-        fd_set ex_fds; // for capture
-        fd_set wr_fds; // for output
+    return ret;
+}
 
-        FD_ZERO(&rd_fds);
-        FD_SET(pcontext->videoIn->fd, &rd_fds);
+/******************************************************************************
+Description.: check a MJPEG frame of the camera before it gets published.
+              Frames without EOI marker are cut off, a frame byte for byte
+              the same as the previous one is a buffer the camera handed out
+              again. Frames of equal size are rare, so memcmp() mostly is not
+              even called and otherwise stops at the first entropy coded bytes
+              of a different picture.
+Input Value.: * pcontext: the context of the camera
+              * frame...: the frame, its size is cut to the EOI marker
+Return Value: 0 to publish the frame, -1 to drop it
+******************************************************************************/
+static int check_picture(context *pcontext, input_frame *frame)
+{
+    input_stats *stats = &pglobal->in[pcontext->id].stats;
+    int size = jpeg_complete(pcontext->videoIn, frame->buf, frame->size);
 
-        FD_ZERO(&ex_fds);
-        FD_SET(pcontext->videoIn->fd, &ex_fds);
+    if(size == 0) {
+        DBG("dropping a truncated frame\n");
+        __sync_fetch_and_add(&stats->corrupt_dropped, 1);
+        return -1;
+    }
+    frame->size = size;
 
-        FD_ZERO(&wr_fds);
-        FD_SET(pcontext->videoIn->fd, &wr_fds);
+    if(pcontext->previous != NULL && pcontext->previous->size == frame->size &&
+       memcmp(pcontext->previous->buf, frame->buf, frame->size) == 0) {
+        DBG("dropping a repeated frame\n");
+        __sync_fetch_and_add(&stats->repeat_dropped, 1);
+        return -1;
+    }
+
+    frame_unref(pcontext->previous);
+    pcontext->previous = frame_ref(frame);
+    return 0;
+}
 
-        struct timeval tv;
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
+/******************************************************************************
+Description.: stop a camera with -idle once nobody subscribed to its input for
+              that long. Its last frame stays the current one of the input.
+Input Value.: * pcontext: the context of the camera
+              * now.....: monotonic_usec()
+Return Value: -
+******************************************************************************/
+static void idle_camera(context *pcontext, unsigned long long now)
+{
+    input *in = &pglobal->in[pcontext->id];
 
-        int sel = select(pcontext->videoIn->fd + 1, &rd_fds, &wr_fds, &ex_fds, &tv);
-        DBG("select() = %d\n", sel);
+    /* the device was opened again after an error while it idled */
+    if(pcontext->idling) {
+        pcontext->idling = 0;
+        input_set_idle(in, 0);
+    }
 
-        if (sel < 0) {
-            if (errno == EINTR) {
-                continue;
+    if(input_subscribed(in)) {
+        pcontext->unwanted_usec = 0;
+        return;
+    }
+    if(pcontext->unwanted_usec == 0) {
+        pcontext->unwanted_usec = now;
+        return;
+    }
+    if(now - pcontext->unwanted_usec < pcontext->idle * 1000000ULL)
+        return;
+
+    /* a camera which does not stop is asked again after another while */
+    pcontext->unwanted_usec = now;
+    if(video_pause(pcontext->videoIn) < 0)
+        return;
+
+    IPRINT("input %d idles without subscribers\n", pcontext->id);
+    pcontext->idling = 1;
+    input_set_idle(in, 1);
+}
+
+/******************************************************************************
+Description.: start a camera stopped by idle_camera() for a new subscriber,
+              or just take note that a resolution change started it already
+Input Value.: the context of the camera
+Return Value: 0 if the camera streams or still idles, -1 if it can not be used
+              anymore
+******************************************************************************/
+static int wake_idle_camera(context *pcontext)
+{
+    struct vdIn *vd = pcontext->videoIn;
+    input *in = &pglobal->in[pcontext->id];
+
+    if(vd->streamingState == STREAMING_PAUSED) {
+        if(!input_subscribed(in))
+            return 0;
+        IPRINT("input %d has a subscriber again\n", pcontext->id);
+    }
+
+    pcontext->idling = 0;
+    pcontext->unwanted_usec = 0;
+    input_set_idle(in, 0);
+    return video_resume(vd);
+}
+
+/******************************************************************************
+Description.: take a frame from a camera, compress or copy it to a fresh
+              frame and hand that to the output plugins
+Input Value.: * pcontext: the context of the camera
+              * readable: a frame is ready to be dequeued
+              * priority: a V4L2 event is pending
+Return Value: 0 on success, -1 if the camera can not be used anymore
+******************************************************************************/
+static int serve_camera(context *pcontext, int readable, int priority)
+{
+    struct vdIn *vd = pcontext->videoIn;
+    input_frame *frame = NULL;
+
+    if (readable) {
+        DBG("Grabbing a frame...\n");
+        /* grab a frame */
+        if(uvcGrab(pcontext->videoIn) < 0) {
+            IPRINT("Error grabbing frames\n");
+            return -1;
+        }
+        pcontext->last_frame = monotonic_usec();
+        __sync_fetch_and_add(&pglobal->in[pcontext->id].stats.capture_dropped, pcontext->videoIn->lost);
+        pglobal->in[pcontext->id].stats.capture_buffers = pcontext->videoIn->nb_buffers;
+
+        if ( pcontext->every_count < every - 1 ) {
+            DBG("dropping %d frame for every=%d\n", pcontext->every_count + 1, every);
+            ++pcontext->every_count;
+            goto other_select_handlers;
+        } else {
+            pcontext->every_count = 0;
+        }
+
+        /* a degraded input leaves some of the pictures it would compress */
+        #ifndef NO_LIBJPEG
+        if(video_raw_format(pcontext->videoIn->formatIn) && governor_skip(&pglobal->in[pcontext->id]))
+            goto other_select_handlers;
+        #endif
+
+        //DBG("received frame of size: %d from plugin: %d\n", pcontext->videoIn->tmpbytesused, pcontext->id);
+
+        /*
+         * Workaround for broken, corrupted frames:
+         * Under low light conditions corrupted frames may get captured.
+         * The good thing is such frames are quite small compared to the regular pictures.
+         * For example a VGA (640x480) webcam picture is normally >= 8kByte large,
+         * corrupted frames are smaller.
+         */
+        if(pcontext->videoIn->tmpbytesused < minimum_size) {
+            DBG("dropping too small frame, assuming it as broken\n");
+            goto other_select_handlers;
+        }
+
+        // Overwrite timestamp (e.g. where camera is providing 0 values)
+        // Do it here so that this timestamp can be used in frameskipping
+        if(wantTimestamp)
+        {
+            gettimeofday(&timestamp, NULL);
+            pcontext->videoIn->tmptimestamp = timestamp;
+        }
+
+        // use software frame dropping on low fps
+        if (pcontext->videoIn->soft_framedrop == 1) {
+            unsigned long last = pglobal->in[pcontext->id].timestamp.tv_sec * 1000 +
+                                (pglobal->in[pcontext->id].timestamp.tv_usec/1000); // convert to ms
+            unsigned long current = pcontext->videoIn->tmptimestamp.tv_sec * 1000 +
+                                    pcontext->videoIn->tmptimestamp.tv_usec/1000; // convert to ms
+
+            // if the requested time did not esplashed skip the frame
+            if ((current - last) < pcontext->videoIn->frame_period_time) {
+                DBG("Last frame taken %d ms ago so drop it\n", (current - last));
+                goto other_select_handlers;
             }
-            perror("select() error");
-            goto endloop;
-        } else if (sel == 0) {
-            IPRINT("select() timeout\n");
-            if (dv_timings) {
-                if (setResolution(pcontext->videoIn, pcontext->videoIn->width, pcontext->videoIn->height) < 0) {
-                    goto endloop;
-                }
-                continue;
+            DBG("Lagg: %ld\n", (current - last) - pcontext->videoIn->frame_period_time);
+        }
+
+        /* only this thread publishes, the frame gets the next number */
+        PROBE(capture, pcontext->id, pglobal->in[pcontext->id].seq + 1,
+              pcontext->videoIn->capture_usec, pcontext->videoIn->dequeue_usec);
+        PROBE(encode_start, pcontext->id, pglobal->in[pcontext->id].seq + 1);
+
+        /*
+         * If capturing in YUV mode convert to JPEG now.
+         * This compression requires many CPU cycles, so try to avoid YUV format.
+         * Getting JPEGs straight from the webcam, is one of the major advantages of
+         * Linux-UVC compatible devices.
+         *
+         * The picture is compressed or copied into a fresh frame, this
+         * happens without holding any lock.
+         */
+        #ifndef NO_LIBJPEG
+        if (video_raw_format(pcontext->videoIn->formatIn)) {
+            if((frame = frame_alloc(pcontext->videoIn->framesizeIn)) == NULL) {
+                IPRINT("could not allocate frame\n");
+                return -1;
+            }
+            DBG("compressing frame from input: %d\n", (int)pcontext->id);
+            unsigned long long encode_start = monotonic_usec();
+            jpeg_picture picture;
+            int backend;
+            frame->size = jpeg_backend_encode(pcontext->jpeg, raw_picture(vd, &picture),
+                                              governor_quality(&pglobal->in[pcontext->id], pcontext->quality),
+                                              frame->buf, frame->capacity);
+            backend = jpeg_backend_current(pcontext->jpeg);
+            if(frame->size > 0 && backend != JPEG_BACKEND_M2M)
+                pcontext->quality = rate_control_update(&pcontext->rate, frame->size);
+            /* the capture buffers are only held for the hardware encoder */
+            if(backend != JPEG_BACKEND_M2M && backend != JPEG_BACKEND_AUTO)
+                vd->hold_buffer = 0;
+            histogram_observe(&pglobal->in[pcontext->id].stats.encode_usec, monotonic_usec() - encode_start);
+
+            /* the pixels go along for consumers which would decode the JPEG again */
+            if(frame->size > 0 && input_raw_wanted(&pglobal->in[pcontext->id]))
+                frame_attach_raw(frame, copy_raw_frame(vd));
+        } else {
+        #endif
+            if(pcontext->videoIn->frame != NULL) {
+                /* the camera wrote the picture into this frame */
+                frame = pcontext->videoIn->frame;
+                pcontext->videoIn->frame = NULL;
             } else {
-                goto endloop;
+                /* leave room for the huffman table memcpy_picture() may insert */
+                if((frame = frame_alloc(pcontext->videoIn->tmpbytesused + DHT_SPACE)) == NULL) {
+                    IPRINT("could not allocate frame\n");
+                    return -1;
+                }
+                DBG("copying frame from input: %d\n", (int)pcontext->id);
+                frame->size = memcpy_picture(vd, frame->buf, pcontext->videoIn->tmpbuffer, pcontext->videoIn->tmpbytesused);
+            }
+            if(check_picture(pcontext, frame) < 0) {
+                frame_unref(frame);
+                goto other_select_handlers;
             }
+        #ifndef NO_LIBJPEG
         }
+        #endif
+        /* copy this frame's timestamp to user space */
+        frame->timestamp = pcontext->videoIn->tmptimestamp;
+        frame->capture_usec = pcontext->videoIn->capture_usec;
+        frame->dequeue_usec = pcontext->videoIn->dequeue_usec;
+        frame->encoded_usec = monotonic_usec();
+        PROBE(encode_end, pcontext->id, pglobal->in[pcontext->id].seq + 1, frame->size);
 
-        if (FD_ISSET(pcontext->videoIn->fd, &rd_fds)) {
-            DBG("Grabbing a frame...\n");
-            /* grab a frame */
-            if(uvcGrab(pcontext->videoIn) < 0) {
-                IPRINT("Error grabbing frames\n");
-                goto endloop;
-            }
+#if 0
+        /* motion detection can be done just by comparing the picture size, but it is not very accurate!! */
+        if((prev_size - global->size)*(prev_size - global->size) > 4 * 1024 * 1024) {
+            DBG("motion detected (delta: %d kB)\n", (prev_size - global->size) / 1024);
+        }
+        prev_size = global->size;
+#endif
 
-            if ( every_count < every - 1 ) {
-                DBG("dropping %d frame for every=%d\n", every_count + 1, every);
-                ++every_count;
-                goto other_select_handlers;
-            } else {
-                every_count = 0;
+        /* hand the frame over to the output plugins and signal fresh_frame */
+        input_publish_frame(&pglobal->in[pcontext->id], frame);
+    }
+
+other_select_handlers:
+    /* give a frame the hardware encoder read in place back to the camera */
+    if(uvcRelease(pcontext->videoIn) < 0) {
+        return -1;
+    }
+
+    if (dv_timings) {
+        if (priority) {
+            IPRINT("FD exception\n");
+            if (video_handle_event(pcontext->videoIn) < 0) {
+                return -1;
             }
+        }
+    }
 
-            //DBG("received frame of size: %d from plugin: %d\n", pcontext->videoIn->tmpbytesused, pcontext->id);
-
-            /*
-             * Workaround for broken, corrupted frames:
-             * Under low light conditions corrupted frames may get captured.
-             * The good thing is such frames are quite small compared to the regular pictures.
-             * For example a VGA (640x480) webcam picture is normally >= 8kByte large,
-             * corrupted frames are smaller.
-             */
-            if(pcontext->videoIn->tmpbytesused < minimum_size) {
-                DBG("dropping too small frame, assuming it as broken\n");
-                goto other_select_handlers;
+    return 0;
+}
+
+/******************************************************************************
+Description.: take a camera out of the epoll set after an unrecoverable error,
+              the other cameras of the group keep running
+Input Value.: * group: the camera group
+              * i....: index of the camera
+Return Value: -
+******************************************************************************/
+static void stop_camera(camera_group *group, int i)
+{
+    context *pcontext = group->cameras[i];
+
+    IPRINT("no more frames from input %d\n", pcontext->id);
+    if (pcontext->watched >= 0) {
+        epoll_ctl(group->epfd, EPOLL_CTL_DEL, pcontext->watched, NULL);
+        pcontext->watched = -1;
+    }
+    epoll_ctl(group->epfd, EPOLL_CTL_DEL, pcontext->videoIn->wakeup, NULL);
+    pcontext->active = 0;
+}
+
+/******************************************************************************
+Description.: close a camera which stopped working, a camera glitching or
+              dropping off the USB bus for a moment. The capture thread opens
+              it again later, see recover_camera(), the outputs keep their
+              clients and the last frame meanwhile.
+Input Value.: * group: the camera group
+              * i....: index of the camera
+Return Value: -
+******************************************************************************/
+static void fail_camera(camera_group *group, int i)
+{
+    context *pcontext = group->cameras[i];
+    input_stats *stats = &pglobal->in[pcontext->id].stats;
+
+    if (pcontext->watched >= 0) {
+        epoll_ctl(group->epfd, EPOLL_CTL_DEL, pcontext->watched, NULL);
+        pcontext->watched = -1;
+    }
+    video_close(pcontext->videoIn);
+
+    if (pcontext->retry_usec == 0) {
+        IPRINT("input %d failed, opening %s again\n", pcontext->id, pcontext->videoIn->videodevice);
+        __sync_fetch_and_add(&stats->device_failures, 1);
+        stats->device_down = 1;
+    }
+
+    /* a camera which delivered frames is tried again right away */
+    pcontext->retry_usec = monotonic_usec() + (unsigned long long)pcontext->backoff_ms * 1000;
+    pcontext->backoff_ms = pcontext->backoff_ms ? MIN(2 * pcontext->backoff_ms, MAX_BACKOFF_MS) : MIN_BACKOFF_MS;
+}
+
+/******************************************************************************
+Description.: open a camera closed by fail_camera() again with the formats
+              found at the start and the controls it had
+Input Value.: * group: the camera group
+              * i....: index of the camera
+Return Value: -
+******************************************************************************/
+static void recover_camera(camera_group *group, int i)
+{
+    context *pcontext = group->cameras[i];
+    struct vdIn *vd = pcontext->videoIn;
+    input_stats *stats = &pglobal->in[pcontext->id].stats;
+
+    if (video_reopen(vd) < 0) {
+        DBG("%s can not be opened yet\n", vd->videodevice);
+        fail_camera(group, i);
+        return;
+    }
+
+    if (v4l2RestoreControls(vd, pcontext->id, pglobal) < 0) {
+        IPRINT("some controls of input %d could not be restored\n", pcontext->id);
+    }
+    /* the encoder read the buffers of the old descriptor */
+    if (pcontext->jpeg != NULL)
+        jpeg_backend_reset(pcontext->jpeg);
+
+    IPRINT("input %d is back, %dx%d\n", pcontext->id, vd->width, vd->height);
+    __sync_fetch_and_add(&stats->device_reopens, 1);
+    stats->device_down = 0;
+    pcontext->retry_usec = 0;
+    pcontext->last_frame = monotonic_usec();
+}
+
+/******************************************************************************
+Description.: start the stream of a camera. With -usbbw a camera whose bus
+              has no room for it steps down to the next smaller mode of its
+              format until it fits.
+Input Value.: the context of the camera
+Return Value: 0 if the camera streams, -1 otherwise
+******************************************************************************/
+static int enable_camera(context *pcontext)
+{
+    struct vdIn *vd = pcontext->videoIn;
+    const usb_mode *mode;
+
+    while (video_enable(vd) < 0) {
+        if (errno != ENOSPC || pcontext->usb == NULL || (mode = usb_step_down(pcontext->usb)) == NULL)
+            return -1;
+        IPRINT("no room on USB bus %d for input %d, trying %dx%d at %d fps\n",
+               pcontext->usb->bus, pcontext->id, mode->width, mode->height, mode->fps);
+        if (video_set_mode(vd, mode->width, mode->height, mode->fps) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: this thread worker grabs the frames of all cameras of a group
+              and copies them to the global buffers of their inputs
+Input Value.: the camera group
+Return Value: unused, always NULL
+******************************************************************************/
+void *cam_thread(void *arg)
+{
+    camera_group *group = (camera_group*)arg;
+    struct epoll_event ev, events[2 * MAX_CAMERAS];
+    int i, j, n, active = 0;
+
+    /* set cleanup handler to cleanup allocated resources */
+    pthread_cleanup_push(cam_cleanup, group);
+
+    /*
+     * one epoll set waits for the frames, V4L2 events and changes of the
+     * streaming state of all cameras, the latter are signalled through
+     * videoIn->wakeup
+     */
+    if ((group->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        goto endloop;
+    }
+
+    for (i = 0; i < group->count; i++) {
+        context *pcontext = group->cameras[i];
+
+        apply_settings(pcontext);
+
+        if (softfps > 0) {
+            pcontext->videoIn->soft_framedrop = 1;
+            pcontext->videoIn->frame_period_time = 1000/softfps;
+        }
+
+        if (enable_camera(pcontext) < 0) {
+            /* with -usbbw a camera the bus has no room for tries again later, the others stream */
+            if (pcontext->usb == NULL) {
+                IPRINT("Can\'t enable video in first time\n");
+                goto endloop;
             }
+            fail_camera(group, i);
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = EVENT_WAKEUP(i);
+        if (epoll_ctl(group->epfd, EPOLL_CTL_ADD, pcontext->videoIn->wakeup, &ev) < 0) {
+            perror("epoll_ctl");
+            goto endloop;
+        }
 
-            // Overwrite timestamp (e.g. where camera is providing 0 values)
-            // Do it here so that this timestamp can be used in frameskipping
-            if(wantTimestamp)
-            {
-                gettimeofday(&timestamp, NULL);
-                pcontext->videoIn->tmptimestamp = timestamp;
+        pcontext->last_frame = monotonic_usec();
+        pcontext->active = 1;
+        active++;
+    }
+
+    while(!pglobal->stop && active > 0) {
+        int readable[MAX_CAMERAS], priority[MAX_CAMERAS], rearm[MAX_CAMERAS];
+        unsigned long long now = monotonic_usec();
+        int wait = -1;
+
+        for (i = 0; i < group->count; i++) {
+            context *pcontext = group->cameras[i];
+            struct vdIn *vd = pcontext->videoIn;
+
+            readable[i] = priority[i] = rearm[i] = 0;
+            if (!pcontext->active)
+                continue;
+
+            /* a failed camera only waits for its next attempt */
+            if (pcontext->retry_usec != 0) {
+                int left = (pcontext->retry_usec > now) ? (int)((pcontext->retry_usec - now + 999) / 1000) : 0;
+                if (wait < 0 || left < wait)
+                    wait = left;
+                continue;
             }
 
-            // use software frame dropping on low fps
-            if (pcontext->videoIn->soft_framedrop == 1) {
-                unsigned long last = pglobal->in[pcontext->id].timestamp.tv_sec * 1000 +
-                                    (pglobal->in[pcontext->id].timestamp.tv_usec/1000); // convert to ms
-                unsigned long current = pcontext->videoIn->tmptimestamp.tv_sec * 1000 +
-                                        pcontext->videoIn->tmptimestamp.tv_usec/1000; // convert to ms
-
-                // if the requested time did not esplashed skip the frame
-                if ((current - last) < pcontext->videoIn->frame_period_time) {
-                    DBG("Last frame taken %d ms ago so drop it\n", (current - last));
-                    goto other_select_handlers;
+            /* while paused only the wakeup is watched, the device is reopened meanwhile */
+            if (vd->streamingState == STREAMING_ON && pcontext->watched < 0) {
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN | (dv_timings ? EPOLLPRI : 0);
+                ev.data.u64 = EVENT_DEVICE(i);
+                if (epoll_ctl(group->epfd, EPOLL_CTL_ADD, vd->fd, &ev) < 0) {
+                    perror("epoll_ctl");
+                    stop_camera(group, i);
+                    active--;
+                    continue;
                 }
-                DBG("Lagg: %ld\n", (current - last) - pcontext->videoIn->frame_period_time);
+                pcontext->watched = vd->fd;
             }
 
-            /* copy JPG picture to global buffer */
-            pthread_mutex_lock(&pglobal->in[pcontext->id].db);
-
-            /*
-             * If capturing in YUV mode convert to JPEG now.
-             * This compression requires many CPU cycles, so try to avoid YUV format.
-             * Getting JPEGs straight from the webcam, is one of the major advantages of
-             * Linux-UVC compatible devices.
-             */
-            #ifndef NO_LIBJPEG
-            if ((pcontext->videoIn->formatIn == V4L2_PIX_FMT_YUYV) ||
-            (pcontext->videoIn->formatIn == V4L2_PIX_FMT_UYVY) ||
-            (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB24) ||
-            (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB565) ) {
-                DBG("compressing frame from input: %d\n", (int)pcontext->id);
-                pglobal->in[pcontext->id].size = compress_image_to_jpeg(pcontext->videoIn, pglobal->in[pcontext->id].buf, pcontext->videoIn->framesizeIn, quality);
-                /* copy this frame's timestamp to user space */
-                pglobal->in[pcontext->id].timestamp = pcontext->videoIn->tmptimestamp;
-            } else {
-            #endif
-                DBG("copying frame from input: %d\n", (int)pcontext->id);
-                pglobal->in[pcontext->id].size = memcpy_picture(pglobal->in[pcontext->id].buf, pcontext->videoIn->tmpbuffer, pcontext->videoIn->tmpbytesused);
-                /* copy this frame's timestamp to user space */
-                pglobal->in[pcontext->id].timestamp = pcontext->videoIn->tmptimestamp;
-            #ifndef NO_LIBJPEG
+            /* wake up for the first camera running into its timeout */
+            if (pcontext->watched >= 0) {
+                unsigned long long deadline = pcontext->last_frame + timeout * 1000000ULL;
+                int left = (deadline > now) ? (int)((deadline - now + 999) / 1000) : 0;
+                if (wait < 0 || left < wait)
+                    wait = left;
             }
-            #endif
+        }
 
-#if 0
-            /* motion detection can be done just by comparing the picture size, but it is not very accurate!! */
-            if((prev_size - global->size)*(prev_size - global->size) > 4 * 1024 * 1024) {
-                DBG("motion detected (delta: %d kB)\n", (prev_size - global->size) / 1024);
+        n = epoll_wait(group->epfd, events, 2 * MAX_CAMERAS, wait);
+        DBG("epoll_wait() = %d\n", n);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            prev_size = global->size;
-#endif
+            perror("epoll_wait() error");
+            goto endloop;
+        }
 
-            /* signal fresh_frame */
-            pthread_cond_broadcast(&pglobal->in[pcontext->id].db_update);
-            pthread_mutex_unlock(&pglobal->in[pcontext->id].db);
+        for (j = 0; j < n; j++) {
+            i = events[j].data.u64 >> 1;
+            if (events[j].data.u64 & 1) {
+                uint64_t count;
+                if (read(group->cameras[i]->videoIn->wakeup, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    perror("read wakeup");
+                }
+                rearm[i] = 1;
+            } else {
+                readable[i] |= (events[j].events & (EPOLLIN | EPOLLERR)) != 0;
+                priority[i] |= (events[j].events & EPOLLPRI) != 0;
+            }
         }
 
-other_select_handlers:
+        now = monotonic_usec();
+        for (i = 0; i < group->count; i++) {
+            context *pcontext = group->cameras[i];
+            struct vdIn *vd = pcontext->videoIn;
+
+            if (!pcontext->active)
+                continue;
 
-        if (dv_timings) {
-            if (FD_ISSET(pcontext->videoIn->fd, &wr_fds)) {
-                IPRINT("Writing?!\n");
+            if (pcontext->retry_usec != 0) {
+                if (rearm[i])
+                    switch_camera(pcontext);
+                if (now >= pcontext->retry_usec)
+                    recover_camera(group, i);
+                continue;
             }
 
-            if (FD_ISSET(pcontext->videoIn->fd, &ex_fds)) {
-                IPRINT("FD exception\n");
-                if (video_handle_event(pcontext->videoIn) < 0) {
-                    goto endloop;
+            /* the state changed, the device may have been reopened as well */
+            if (rearm[i]) {
+                if (pcontext->watched >= 0) {
+                    epoll_ctl(group->epfd, EPOLL_CTL_DEL, pcontext->watched, NULL);
+                    pcontext->watched = -1;
+                }
+                pcontext->last_frame = now;
+                if (switch_camera(pcontext) < 0 || (pcontext->idling && wake_idle_camera(pcontext) < 0))
+                    fail_camera(group, i);
+                continue;
+            }
+
+            if (pcontext->watched >= 0 && !readable[i] && !priority[i] &&
+                now - pcontext->last_frame >= timeout * 1000000ULL) {
+                IPRINT("timeout waiting for a frame of input %d\n", pcontext->id);
+                if (dv_timings && setResolution(vd, vd->width, vd->height) == 0) {
+                    pcontext->last_frame = now;
+                } else {
+                    fail_camera(group, i);
+                }
+                continue;
+            }
+
+            if (readable[i] || priority[i]) {
+                if (serve_camera(pcontext, readable[i], priority[i]) < 0) {
+                    fail_camera(group, i);
+                } else if (readable[i]) {
+                    pcontext->backoff_ms = 0;
+                    if (pcontext->idle > 0)
+                        idle_camera(pcontext, now);
                 }
             }
         }
@@ -835,27 +1738,39 @@ endloop:
 }
 
 /******************************************************************************
-Description.:
-Input Value.:
-Return Value:
+Description.: release the cameras of a group and the resources of its thread
+Input Value.: the camera group
+Return Value: -
 ******************************************************************************/
 void cam_cleanup(void *arg)
 {
-    input * in = (input*)arg;
-    context *pctx = (context*)in->context;
-    
+    camera_group *group = (camera_group*)arg;
+    int i;
+
     IPRINT("cleaning up resources allocated by input thread\n");
 
-    if (pctx->videoIn != NULL) {
-        close_v4l2(pctx->videoIn);
-        free(pctx->videoIn->tmpbuffer);
-        free(pctx->videoIn);
-        pctx->videoIn = NULL;
+    jpeg_encoder_free(group->encoder);
+    group->encoder = NULL;
+    if (group->epfd >= 0) {
+        close(group->epfd);
+        group->epfd = -1;
+    }
+
+    for (i = 0; i < group->count; i++) {
+        context *pctx = group->cameras[i];
+
+        jpeg_backend_free(pctx->jpeg);
+        pctx->jpeg = NULL;
+        frame_unref(pctx->previous);
+        pctx->previous = NULL;
+
+        if (pctx->videoIn != NULL) {
+            close_v4l2(pctx->videoIn);
+            free(pctx->videoIn->tmpbuffer);
+            free(pctx->videoIn);
+            pctx->videoIn = NULL;
+        }
     }
-    
-    free(in->buf);
-    in->buf = NULL;
-    in->size = 0;
 }
 
 /******************************************************************************
@@ -889,14 +1804,39 @@ int input_cmd(int plugin_number, unsigned int control_id, unsigned int group, in
             return -1;
         } break;
     case IN_CMD_V4L2: {
+            /* the value is also kept in in_parameters by v4l2SetControl */
             ret = v4l2SetControl(pctx->videoIn, control_id, value, plugin_number, pglobal);
-            if(ret == 0) {
-                in->in_parameters[i].value = value;
-            } else {
+            if(ret != 0) {
                 DBG("v4l2SetControl failed: %d\n", ret);
             }
             return ret;
         } break;
+    case IN_CMD_V4L2_BATCH: {
+            /* value_string is "id=value&id=value...", ids may be hex */
+            int ids[IN_CMD_BATCH_MAX], values[IN_CMD_BATCH_MAX];
+            int count = 0;
+            char *p = value_string, *end;
+
+            while(p != NULL && *p != '\0' && count < IN_CMD_BATCH_MAX) {
+                ids[count] = strtol(p, &end, 0);
+                if(end == p || *end != '=')
+                    return -1;
+                p = end + 1;
+                values[count] = strtol(p, &end, 0);
+                if(end == p || (*end != '&' && *end != '\0'))
+                    return -1;
+                count++;
+                p = (*end == '&') ? end + 1 : end;
+            }
+            if(count == 0 || (p != NULL && *p != '\0'))
+                return -1;
+
+            ret = v4l2SetControls(pctx->videoIn, ids, values, NULL, count, plugin_number, pglobal);
+            if(ret != 0) {
+                DBG("v4l2SetControls failed for some of %d controls\n", count);
+            }
+            return ret;
+        } break;
     case IN_CMD_RESOLUTION: {
         // the value points to the current formats nth resolution
         if(value > (in->in_formats[in->currentFormat].resolutionCount - 1)) {
@@ -905,14 +1845,20 @@ int input_cmd(int plugin_number, unsigned int control_id, unsigned int group, in
         }
         int height = in->in_formats[in->currentFormat].supportedResolutions[value].height;
         int width = in->in_formats[in->currentFormat].supportedResolutions[value].width;
-        ret = setResolution(pctx->videoIn, width, height);
+        ret = request_resolution(pctx, width, height);
         if(ret == 0) {
             in->in_formats[in->currentFormat].currentResolution = value;
         }
         return ret;
     } break;
     case IN_CMD_JPEG_QUALITY:
-        if((value >= 0) && (value < 101)) {
+        if((value >= 0) && (value < 101) && pctx->videoIn->formatIn != V4L2_PIX_FMT_MJPEG &&
+           pctx->videoIn->formatIn != V4L2_PIX_FMT_JPEG) {
+            /* raw frames are compressed here, the rate control keeps below this quality */
+            rate_control_set_quality(&pctx->rate, value);
+            pctx->quality = value;
+            ret = 0;
+        } else if((value >= 0) && (value < 101)) {
             in->jpegcomp.quality = value;
             if(IOCTL_VIDEO(pctx->videoIn->fd, VIDIOC_S_JPEGCOMP, &in->jpegcomp) != EINVAL) {
                 DBG("JPEG quality is set to %d\n", value);
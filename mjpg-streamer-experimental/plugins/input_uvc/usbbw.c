@@ -0,0 +1,405 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "v4l2uvc.h"
+#include "usbbw.h"
+#include "../../utils.h"
+
+#define USB_MAX_BUSES 32
+
+/*
+ * an MJPEG camera asks for the bandwidth of its largest frames, which are
+ * about a quarter of the raw YUYV frame for most of them
+ */
+#define USB_MJPEG_RATIO 4
+
+/* the bandwidth planned on each bus by all instances of the plugin */
+static struct {
+    int bus;
+    unsigned long long planned;
+} buses[USB_MAX_BUSES];
+static int bus_count = 0;
+static pthread_mutex_t buses_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+Description.: read a number from a sysfs attribute of the USB device of a
+              video device
+Input Value.: * st..: the video device
+              * name: the attribute
+Return Value: the number, -1 if the device is not on USB
+******************************************************************************/
+static double usb_attribute(const struct stat *st, const char *name)
+{
+    char path[128], buf[32];
+    FILE *f;
+
+    /* the device of the video node is the USB interface, its parent the USB device */
+    snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/../%s",
+             major(st->st_rdev), minor(st->st_rdev), name);
+    if((f = fopen(path, "r")) == NULL)
+        return -1;
+    if(fgets(buf, sizeof(buf), f) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return strtod(buf, NULL);
+}
+
+/******************************************************************************
+Description.: find the bus of a camera and the periodic bandwidth it offers,
+              80% of a high speed bus may be reserved for isochronous
+              transfers, 90% of the others
+Input Value.: * cam: gets the bus, its budget and the limit of an endpoint
+              * st.: the video device
+Return Value: -
+******************************************************************************/
+static void usb_bus(usb_camera *cam, const struct stat *st)
+{
+    double speed = usb_attribute(st, "speed");
+
+    cam->bus = (int)usb_attribute(st, "busnum");
+    if(speed >= 5000) {
+        /* SuperSpeed, 8b/10b coded, bursts of 16 packets of 1 kB three times per microframe */
+        cam->budget = (unsigned long long)(speed * 100000) * 9 / 10;
+        cam->endpoint = 3ULL * 16 * 1024 * 8000;
+    } else if(speed >= 480) {
+        /* three packets of 1 kB in each of the 8000 microframes */
+        cam->budget = 480000000ULL / 8 * 8 / 10;
+        cam->endpoint = 3ULL * 1024 * 8000;
+    } else if(speed >= 12) {
+        cam->budget = 12000000ULL / 8 * 9 / 10;
+        cam->endpoint = 1023ULL * 1000;
+    } else {
+        /* low speed devices have no isochronous transfers, other devices no USB */
+        cam->bus = -1;
+    }
+}
+
+/******************************************************************************
+Description.: estimate the bandwidth a camera reserves for a mode
+Input Value.: * cam.: the camera, for the limit of its endpoint
+              * mode: the mode
+Return Value: bytes per second
+******************************************************************************/
+static unsigned long long usb_bandwidth(const usb_camera *cam, const usb_mode *mode)
+{
+    unsigned long long bytes = (unsigned long long)mode->width * mode->height * mode->fps;
+
+    switch(mode->format) {
+    case V4L2_PIX_FMT_MJPEG:
+    case V4L2_PIX_FMT_JPEG:
+        bytes = bytes * 2 / USB_MJPEG_RATIO;
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        bytes *= 3;
+        break;
+    case V4L2_PIX_FMT_NV12:
+        bytes = bytes * 3 / 2;
+        break;
+    default:
+        bytes *= 2;
+        break;
+    }
+
+    /* the driver picks the largest alternate setting at most */
+    return MIN(bytes, cam->endpoint);
+}
+
+static int is_jpeg(unsigned int format)
+{
+    return format == V4L2_PIX_FMT_MJPEG || format == V4L2_PIX_FMT_JPEG;
+}
+
+/* the most pixels per second first, the larger picture and MJPEG at a tie */
+static int compare_modes(const void *a, const void *b)
+{
+    const usb_mode *x = a, *y = b;
+    unsigned long long rx = (unsigned long long)x->width * x->height * x->fps;
+    unsigned long long ry = (unsigned long long)y->width * y->height * y->fps;
+
+    if(rx != ry)
+        return (rx > ry) ? -1 : 1;
+    if(x->width * x->height != y->width * y->height)
+        return (x->width * x->height > y->width * y->height) ? -1 : 1;
+    return is_jpeg(y->format) - is_jpeg(x->format);
+}
+
+/******************************************************************************
+Description.: add the frame rates of a frame size to the modes of a camera
+Input Value.: * cam...: the camera
+              * fd....: its device
+              * format: the format of the size
+              * width.: the frame size
+              * height
+              * fps...: the highest rate to take, -1 for all
+Return Value: -
+******************************************************************************/
+static void add_rates(usb_camera *cam, int fd, unsigned int format, int width, int height, int fps)
+{
+    struct v4l2_frmivalenum ival;
+    usb_mode *mode;
+    int rate, found = 0;
+
+    memset(&ival, 0, sizeof(ival));
+    ival.pixel_format = format;
+    ival.width = width;
+    ival.height = height;
+    while(cam->count < USB_MAX_MODES) {
+        if(xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) < 0)
+            break;
+        if(ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            rate = (ival.discrete.numerator > 0) ?
+                   (ival.discrete.denominator + ival.discrete.numerator / 2) / ival.discrete.numerator : 0;
+        } else {
+            /* the shortest interval of a range, or the rate asked for */
+            rate = (ival.stepwise.min.numerator > 0) ? ival.stepwise.min.denominator / ival.stepwise.min.numerator : 0;
+            if(fps > 0)
+                rate = MIN(rate, fps);
+        }
+        if(rate > 0 && (fps <= 0 || rate <= fps)) {
+            mode = &cam->modes[cam->count++];
+            mode->format = format;
+            mode->width = width;
+            mode->height = height;
+            mode->fps = rate;
+            mode->bytes = usb_bandwidth(cam, mode);
+            found = 1;
+        }
+        if(ival.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+            break;
+        ival.index++;
+    }
+
+    /* without its rates the size is taken at the rate asked for, the camera may coerce it */
+    if(!found && cam->count < USB_MAX_MODES && ival.index == 0) {
+        mode = &cam->modes[cam->count++];
+        mode->format = format;
+        mode->width = width;
+        mode->height = height;
+        mode->fps = (fps > 0) ? fps : 30;
+        mode->bytes = usb_bandwidth(cam, mode);
+    }
+}
+
+/******************************************************************************
+Description.: enumerate the modes a camera may be opened with, its formats
+              MJPEG and the one asked for in the sizes up to the one asked
+              for and rates up to the one asked for
+Input Value.: * cam...: gets the bus and the modes, the best first
+              * device: the video device
+              * format: the format asked for
+              * width.: the resolution asked for
+              * height
+              * fps...: the frame rate asked for, -1 for any
+Return Value: 0 if ok, -1 if the device can not be opened
+******************************************************************************/
+int usb_probe(usb_camera *cam, const char *device, unsigned int format, int width, int height, int fps)
+{
+    struct v4l2_fmtdesc fmtdesc;
+    struct v4l2_frmsizeenum fsenum;
+    struct stat st;
+    int fd, i, j;
+
+    memset(cam, 0, sizeof(*cam));
+    snprintf(cam->device, sizeof(cam->device), "%s", device);
+    cam->bus = -1;
+    if(stat(device, &st) == 0 && S_ISCHR(st.st_mode))
+        usb_bus(cam, &st);
+    if(cam->bus < 0)
+        return 0;
+
+    if((cam->modes = calloc(USB_MAX_MODES, sizeof(usb_mode))) == NULL)
+        return -1;
+    if((fd = OPEN_VIDEO(device, O_RDWR)) < 0) {
+        usb_free(cam);
+        return -1;
+    }
+
+    memset(&fmtdesc, 0, sizeof(fmtdesc));
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for(; xioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0; fmtdesc.index++) {
+        if(!is_jpeg(fmtdesc.pixelformat) && fmtdesc.pixelformat != format)
+            continue;
+        /* a raw format is never chosen for a camera asked for MJPEG, it would need an encoder */
+        if(is_jpeg(format) && !is_jpeg(fmtdesc.pixelformat))
+            continue;
+
+        memset(&fsenum, 0, sizeof(fsenum));
+        fsenum.pixel_format = fmtdesc.pixelformat;
+        for(; xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fsenum) == 0; fsenum.index++) {
+            if(fsenum.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+                add_rates(cam, fd, fmtdesc.pixelformat, MIN(width, (int)fsenum.stepwise.max_width),
+                          MIN(height, (int)fsenum.stepwise.max_height), fps);
+                break;
+            }
+            if((int)fsenum.discrete.width <= width && (int)fsenum.discrete.height <= height)
+                add_rates(cam, fd, fmtdesc.pixelformat, fsenum.discrete.width, fsenum.discrete.height, fps);
+        }
+    }
+    CLOSE_VIDEO(fd);
+
+    /* MJPEG takes the place of a raw format in the same size and rate */
+    qsort(cam->modes, cam->count, sizeof(usb_mode), compare_modes);
+    for(i = 0, j = 0; i < cam->count; i++) {
+        if(j > 0 && cam->modes[i].width == cam->modes[j - 1].width &&
+           cam->modes[i].height == cam->modes[j - 1].height && cam->modes[i].fps == cam->modes[j - 1].fps)
+            continue;
+        cam->modes[j++] = cam->modes[i];
+    }
+    cam->count = j;
+    return 0;
+}
+
+/******************************************************************************
+Description.: find the bandwidth planned on a bus, with buses_mutex
+Input Value.: the bus
+Return Value: the entry of the bus, NULL if there are too many buses
+******************************************************************************/
+static unsigned long long *planned_on(int bus)
+{
+    int i;
+
+    for(i = 0; i < bus_count; i++) {
+        if(buses[i].bus == bus)
+            return &buses[i].planned;
+    }
+    if(bus_count == USB_MAX_BUSES)
+        return NULL;
+    buses[bus_count].bus = bus;
+    buses[bus_count].planned = 0;
+    return &buses[bus_count++].planned;
+}
+
+/******************************************************************************
+Description.: the next mode of a camera which needs less bandwidth
+Input Value.: * cam...: the camera
+              * format: 0 for any format, else the format the mode must have
+Return Value: the index of the mode, -1 if there is none
+******************************************************************************/
+static int lower_mode(const usb_camera *cam, unsigned int format)
+{
+    int i;
+
+    for(i = cam->current + 1; i < cam->count; i++) {
+        if(cam->modes[i].bytes < cam->modes[cam->current].bytes &&
+           (format == 0 || cam->modes[i].format == format))
+            return i;
+    }
+    return -1;
+}
+
+/******************************************************************************
+Description.: pick the modes of cameras so the bandwidth they reserve fits
+              into their buses. Each starts with its best mode, then the one
+              reserving the most on a bus which is too full steps down to its
+              next mode which needs less, until the bus has room for all.
+Input Value.: * cams...: the cameras, their current mode is set
+              * count..: their number
+              * percent: share of the periodic bandwidth of a bus to plan with
+Return Value: -
+******************************************************************************/
+void usb_plan(usb_camera **cams, int count, int percent)
+{
+    unsigned long long total, budget, *planned;
+    int i, j, lower, victim, cameras;
+
+    pthread_mutex_lock(&buses_mutex);
+    for(i = 0; i < count; i++)
+        cams[i]->current = 0;
+
+    for(i = 0; i < count; i++) {
+        /* each bus is planned once, with its first camera of the list */
+        for(j = 0; j < i && (cams[j]->count == 0 || cams[j]->bus != cams[i]->bus); j++);
+        if(cams[i]->count == 0 || j < i || (planned = planned_on(cams[i]->bus)) == NULL)
+            continue;
+        budget = cams[i]->budget * percent / 100;
+
+        while(1) {
+            total = *planned;
+            victim = -1;
+            cameras = 0;
+            for(j = i; j < count; j++) {
+                if(cams[j]->count == 0 || cams[j]->bus != cams[i]->bus)
+                    continue;
+                cameras++;
+                total += cams[j]->modes[cams[j]->current].bytes;
+                if(lower_mode(cams[j], 0) >= 0 &&
+                   (victim < 0 || cams[j]->modes[cams[j]->current].bytes > cams[victim]->modes[cams[victim]->current].bytes))
+                    victim = j;
+            }
+            if(total <= budget)
+                break;
+            if(victim < 0) {
+                IPRINT("USB bus %d needs %llu of %llu kB/s even in the lowest modes\n",
+                       cams[i]->bus, total / 1000, budget / 1000);
+                break;
+            }
+            lower = lower_mode(cams[victim], 0);
+            cams[victim]->current = lower;
+        }
+
+        IPRINT("USB bus %d.........: %llu of %llu kB/s planned, %d camera(s) here\n",
+               cams[i]->bus, total / 1000, budget / 1000, cameras);
+        *planned = total;
+    }
+    pthread_mutex_unlock(&buses_mutex);
+}
+
+/******************************************************************************
+Description.: step down to the next mode of a camera in its format, after
+              VIDIOC_STREAMON found its bus full
+Input Value.: the camera
+Return Value: the new mode, NULL if there is none
+******************************************************************************/
+const usb_mode *usb_step_down(usb_camera *cam)
+{
+    unsigned long long *planned;
+    int lower;
+
+    if(cam->count == 0 || (lower = lower_mode(cam, cam->modes[cam->current].format)) < 0)
+        return NULL;
+
+    pthread_mutex_lock(&buses_mutex);
+    if((planned = planned_on(cam->bus)) != NULL)
+        *planned = *planned - cam->modes[cam->current].bytes + cam->modes[lower].bytes;
+    cam->current = lower;
+    pthread_mutex_unlock(&buses_mutex);
+    return &cam->modes[lower];
+}
+
+/******************************************************************************
+Description.: free the modes of a camera
+Input Value.: the camera
+Return Value: -
+******************************************************************************/
+void usb_free(usb_camera *cam)
+{
+    free(cam->modes);
+    cam->modes = NULL;
+    cam->count = 0;
+}
@@ -0,0 +1,63 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef USBBW_H
+#define USBBW_H
+
+#include <limits.h>
+
+/*
+ * the isochronous bandwidth of the cameras on a USB bus with -usbbw. Each
+ * camera reserves bandwidth for the format, size and frame rate it streams
+ * with, and VIDIOC_STREAMON fails with ENOSPC for the camera which finds the
+ * bus full. The modes of all cameras are enumerated before they are opened,
+ * the bandwidth of each estimated, and the cameras of one bus are planned
+ * together: each starts with the best mode it offers within -r and -f, the
+ * one needing the most bandwidth steps down until the bus has room for all.
+ * MJPEG is taken instead of a raw format at the same size and rate.
+ *
+ * The buses are known to all instances of the plugin, cameras of another
+ * -i input_uvc.so count with the bandwidth they planned, which stays
+ * reserved until the program ends.
+ */
+#define USB_MAX_MODES 256
+
+typedef struct {
+    unsigned int format;
+    int width, height, fps;
+    unsigned long long bytes;       /* estimated bytes per second on the bus */
+} usb_mode;
+
+typedef struct _usb_camera {
+    char device[PATH_MAX];
+    int bus;                        /* busnum of the USB bus, -1 if not on USB */
+    unsigned long long budget;      /* periodic bandwidth of the bus, bytes per second */
+    unsigned long long endpoint;    /* most a single endpoint gets */
+    usb_mode *modes;                /* the best first */
+    int count;
+    int current;                    /* the mode the camera is opened with */
+} usb_camera;
+
+int usb_probe(usb_camera *cam, const char *device, unsigned int format, int width, int height, int fps);
+void usb_plan(usb_camera **cams, int count, int percent);
+const usb_mode *usb_step_down(usb_camera *cam);
+void usb_free(usb_camera *cam);
+
+#endif
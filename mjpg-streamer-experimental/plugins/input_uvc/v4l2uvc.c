@@ -26,8 +26,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include "v4l2uvc.h"
+#include "../../utils.h"
 #include "huffman.h"
 #include "dynctrl.h"
+#include "capcache.h"
 
 static int debug = 0;
 
@@ -87,8 +89,15 @@ int xioctl(int fd, int IOCTL_X, void *arg)
 }
 
 static int init_v4l2(struct vdIn *vd);
+static void take_layout(struct vdIn *vd, const struct v4l2_format *fmt);
 static int init_framebuffer(struct vdIn *vd);
 static void free_framebuffer(struct vdIn *vd);
+static void export_buffers(struct vdIn *vd);
+static void free_exported_buffers(struct vdIn *vd);
+static int init_userptr(struct vdIn *vd);
+static void free_userptr(struct vdIn *vd);
+static int init_buffers(struct vdIn *vd);
+static void free_buffers(struct vdIn *vd);
 
 int init_videoIn(struct vdIn *vd, char *device, int width,
                  int height, int fps, int format, int grabmethod, globals *pglobal, int id, v4l2_std_id vstd)
@@ -99,6 +108,10 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
         return -1;
     if(grabmethod < 0 || grabmethod > 1)
         grabmethod = 1;     //mmap by default;
+    if((vd->wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        perror("eventfd");
+        return -1;
+    }
     vd->videodevice = NULL;
     vd->status = NULL;
     vd->pictName = NULL;
@@ -116,6 +129,8 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
 	vd->vstd = vstd;
     vd->grabmethod = grabmethod;
     vd->soft_framedrop = 0;
+    if(vd->buffer_count <= 0)
+        vd->buffer_count = NB_BUFFER;
 
     if(init_v4l2(vd) < 0) {
         goto error;
@@ -134,11 +149,44 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
         DBG("VIDIOC_ENUMINPUT failed\n");
     }
 
-    // enumerating formats
+    // enumerating formats, or taking them from the capability cache
+    vd->capcache = capcache_open(vd);
+    if(capcache_formats(vd->capcache, pglobal, id, format) < 0 &&
+       enumerateFormats(vd, pglobal, id, format) < 0) {
+        goto error;
+    }
+
+    if (init_framebuffer(vd) < 0) {
+        goto error;
+    }
+
+    return 0;
+error:
+    free_framebuffer(vd);
+    capcache_free(vd->capcache);
+    vd->capcache = NULL;
+    free(pglobal->in[id].in_parameters);
+    free(vd->videodevice);
+    free(vd->status);
+    free(vd->pictName);
+    close(vd->wakeup);
+    CLOSE_VIDEO(vd->fd);
+    return -1;
+}
 
+/******************************************************************************
+Description.: enumerate the formats of a device and their frame sizes
+Input Value.: * vd.....: the device
+              * pglobal: the globals, the formats go to in[id].in_formats
+              * id.....: the input
+              * format.: the format the device is opened with, it gets current
+Return Value: 0 if ok, -1 if there is not enough memory
+******************************************************************************/
+int enumerateFormats(struct vdIn *vd, globals *pglobal, int id, int format)
+{
     struct v4l2_format currentFormat;
     memset(&currentFormat, 0, sizeof(struct v4l2_format));
-    currentFormat.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    currentFormat.type = vd->buftype;
     if (xioctl(vd->fd, VIDIOC_G_FMT, &currentFormat) == 0) {
         DBG("Current size: %dx%d\n",
              currentFormat.fmt.pix.width,
@@ -150,7 +198,7 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
         struct v4l2_fmtdesc fmtdesc;
         memset(&fmtdesc, 0, sizeof(struct v4l2_fmtdesc));
         fmtdesc.index = pglobal->in[id].formatCount;
-        fmtdesc.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmtdesc.type  = vd->buftype;
         if(xioctl(vd->fd, VIDIOC_ENUM_FMT, &fmtdesc) < 0) {
             break;
         }
@@ -212,19 +260,153 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
         }
     }
 
-    if (init_framebuffer(vd) < 0) {
-        goto error;
+    return 0;
+}
+
+/******************************************************************************
+Description.: tell whether the frames of a capture format are compressed by
+              the plugin
+Input Value.: V4L2_PIX_FMT_* of the frames
+Return Value: 1 for the raw formats, 0 for JPEG and unknown ones
+******************************************************************************/
+int video_raw_format(int format)
+{
+    switch(format) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_RGB24:
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
+        return 1;
+    default:
+        return 0;
     }
+}
 
+/******************************************************************************
+Description.: count the lines of the interleaved chroma plane of NV12 and NV16
+Input Value.: * format: V4L2_PIX_FMT_* of the frames
+              * height: of the pictures
+Return Value: the lines, 0 for formats without a chroma plane
+******************************************************************************/
+int video_chroma_lines(int format, int height)
+{
+    if(format == V4L2_PIX_FMT_NV12)
+        return (height + 1) / 2;
+    if(format == V4L2_PIX_FMT_NV16)
+        return height;
     return 0;
-error:
-    free_framebuffer(vd);
-    free(pglobal->in[id].in_parameters);
-    free(vd->videodevice);
-    free(vd->status);
-    free(vd->pictName);
-    CLOSE_VIDEO(vd->fd);
-    return -1;
+}
+
+/******************************************************************************
+Description.: fill a format for the capture queue, which is multi-planar for
+              devices which only have that one
+Input Value.: * vd...........: the device, vd->formatIn is asked for
+              * fmt..........: filled in
+              * width, height: the resolution
+Return Value: -
+******************************************************************************/
+static void fill_format(struct vdIn *vd, struct v4l2_format *fmt, int width, int height)
+{
+    memset(fmt, 0, sizeof(struct v4l2_format));
+    fmt->type = vd->buftype;
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        fmt->fmt.pix_mp.width = width;
+        fmt->fmt.pix_mp.height = height;
+        fmt->fmt.pix_mp.pixelformat = vd->formatIn;
+        fmt->fmt.pix_mp.field = V4L2_FIELD_ANY;
+    } else {
+        fmt->fmt.pix.width = width;
+        fmt->fmt.pix.height = height;
+        fmt->fmt.pix.pixelformat = vd->formatIn;
+        fmt->fmt.pix.field = V4L2_FIELD_ANY;
+    }
+}
+
+/******************************************************************************
+Description.: read the resolution and the pixel format of a format back,
+              NV12M and NV16M are NV12 and NV16 with the chroma in a memory
+              plane of its own and count as those
+Input Value.: * vd...........: the device
+              * fmt..........: the format the driver returned
+              * width, height: the resolution is stored here
+Return Value: the pixel format
+******************************************************************************/
+static int format_of(struct vdIn *vd, const struct v4l2_format *fmt, int *width, int *height)
+{
+    unsigned int pixelformat;
+
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        *width = fmt->fmt.pix_mp.width;
+        *height = fmt->fmt.pix_mp.height;
+        pixelformat = fmt->fmt.pix_mp.pixelformat;
+    } else {
+        *width = fmt->fmt.pix.width;
+        *height = fmt->fmt.pix.height;
+        pixelformat = fmt->fmt.pix.pixelformat;
+    }
+
+    if(pixelformat == V4L2_PIX_FMT_NV12M)
+        return V4L2_PIX_FMT_NV12;
+    if(pixelformat == V4L2_PIX_FMT_NV16M)
+        return V4L2_PIX_FMT_NV16;
+    return pixelformat;
+}
+
+/******************************************************************************
+Description.: take the strides and the memory planes of the capture buffers
+              from the format the driver returned
+Input Value.: * vd.: the device
+              * fmt: the format
+Return Value: -
+******************************************************************************/
+static void take_layout(struct vdIn *vd, const struct v4l2_format *fmt)
+{
+    int i, pixelformat, width, height;
+
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        const struct v4l2_pix_format_mplane *mp = &fmt->fmt.pix_mp;
+
+        vd->mem_planes = MAX(1, MIN(mp->num_planes, 2));
+        vd->stride[0] = mp->plane_fmt[0].bytesperline;
+        vd->stride[1] = (vd->mem_planes > 1) ? mp->plane_fmt[1].bytesperline : vd->stride[0];
+        vd->sizeimage = 0;
+        for(i = 0; i < vd->mem_planes; i++)
+            vd->sizeimage += mp->plane_fmt[i].sizeimage;
+    } else {
+        vd->mem_planes = 1;
+        vd->stride[0] = vd->stride[1] = fmt->fmt.pix.bytesperline;
+        vd->sizeimage = fmt->fmt.pix.sizeimage;
+    }
+
+    /* drivers may leave the lines of NV12 and NV16 unpadded without saying so */
+    pixelformat = format_of(vd, fmt, &width, &height);
+    if(video_chroma_lines(pixelformat, height) > 0) {
+        if(vd->stride[0] == 0)
+            vd->stride[0] = width;
+        if(vd->stride[1] == 0)
+            vd->stride[1] = vd->stride[0];
+    }
+}
+
+/******************************************************************************
+Description.: clear vd->buf for a capture buffer, the planes of multi-planar
+              devices go along in vd->buf_planes
+Input Value.: * vd....: the device
+              * memory: V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR
+Return Value: -
+******************************************************************************/
+static void clear_buffer(struct vdIn *vd, unsigned int memory)
+{
+    memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
+    vd->buf.type = vd->buftype;
+    vd->buf.memory = memory;
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(vd->buf_planes, 0, sizeof(vd->buf_planes));
+        vd->buf.m.planes = vd->buf_planes;
+        vd->buf.length = VIDEO_MAX_PLANES;
+    }
 }
 
 static int init_framebuffer(struct vdIn *vd) {
@@ -251,6 +433,13 @@ static int init_framebuffer(struct vdIn *vd) {
             vd->framebuffer =
                 (unsigned char *) calloc(1, (size_t) vd->framesizeIn);
             break;
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV16:
+            /* the chroma follows the luma, as it does in a buffer of one memory plane */
+            vd->framesizeIn = vd->stride[0] * vd->height + vd->stride[1] * video_chroma_lines(vd->formatIn, vd->height);
+            vd->framebuffer =
+                (unsigned char *) calloc(1, (size_t) vd->framesizeIn);
+            break;
         default:
             fprintf(stderr, "Unknown vd->formatIn\n");
             return -1;
@@ -267,10 +456,280 @@ static void free_framebuffer(struct vdIn *vd) {
     vd->framebuffer = NULL;
 }
 
-static int init_v4l2(struct vdIn *vd)
+/******************************************************************************
+Description.: export the capture buffers as DMABUF file descriptors, so a
+              hardware encoder can read the frames without a copy
+Input Value.: the device, only buffers of vd->hold_buffer devices are exported
+Return Value: -
+******************************************************************************/
+static void export_buffers(struct vdIn *vd)
+{
+    struct v4l2_exportbuffer expbuf;
+    int i;
+
+    for(i = 0; i < vd->nb_buffers; i++) {
+        vd->dmabuf[i] = -1;
+        /* a hardware encoder takes a picture in one piece */
+        if(!vd->hold_buffer || vd->mem_planes > 1)
+            continue;
+
+        memset(&expbuf, 0, sizeof(struct v4l2_exportbuffer));
+        expbuf.type = vd->buftype;
+        expbuf.index = i;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+        if(xioctl(vd->fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+            DBG("could not export buffer %d\n", i);
+            continue;
+        }
+        vd->dmabuf[i] = expbuf.fd;
+    }
+}
+
+/******************************************************************************
+Description.: close the file descriptors of exported capture buffers
+Input Value.: the device
+Return Value: -
+******************************************************************************/
+static void free_exported_buffers(struct vdIn *vd)
+{
+    int i;
+
+    for(i = 0; i < vd->nb_buffers; i++) {
+        if(vd->dmabuf[i] >= 0)
+            close(vd->dmabuf[i]);
+        vd->dmabuf[i] = -1;
+    }
+}
+
+/******************************************************************************
+Description.: queue a frame of the frame pool as capture buffer, the camera
+              writes behind DHT_SPACE bytes which are left for the huffman
+              table memcpy_picture() would insert
+Input Value.: * vd...: the device
+              * index: number of the capture buffer
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int queue_userptr(struct vdIn *vd, int index)
+{
+    struct v4l2_buffer buf;
+    input_frame *frame = vd->frames[index];
+
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.index = index;
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_USERPTR;
+    buf.m.userptr = (unsigned long)(frame->buf + DHT_SPACE);
+    buf.length = frame->capacity - DHT_SPACE;
+
+    return xioctl(vd->fd, VIDIOC_QBUF, &buf);
+}
+
+/******************************************************************************
+Description.: let the camera capture MJPEG frames straight into frames of
+              the frame pool, they are handed to the outputs without a copy
+Input Value.: the device
+Return Value: 0 on success, -1 if the driver does not support it
+******************************************************************************/
+static int init_userptr(struct vdIn *vd)
+{
+    int i, size = (vd->sizeimage > 0) ? (int)vd->sizeimage : vd->width * vd->height * 2;
+
+    memset(&vd->rb, 0, sizeof(struct v4l2_requestbuffers));
+    vd->rb.count = vd->buffer_count;
+    vd->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vd->rb.memory = V4L2_MEMORY_USERPTR;
+
+    if(xioctl(vd->fd, VIDIOC_REQBUFS, &vd->rb) < 0 || vd->rb.count < 2) {
+        DBG("the driver does not capture into user memory\n");
+        return -1;
+    }
+    vd->nb_buffers = MIN(vd->rb.count, MAX_BUFFERS);
+
+    for(i = 0; i < vd->nb_buffers; i++) {
+        if((vd->frames[i] = frame_alloc(size + DHT_SPACE)) == NULL ||
+           queue_userptr(vd, i) < 0) {
+            DBG("could not queue user memory\n");
+            free_userptr(vd);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: release the frames of the capture buffers, the device must not
+              be streaming
+Input Value.: the device
+Return Value: -
+******************************************************************************/
+static void free_userptr(struct vdIn *vd)
+{
+    int i;
+
+    for(i = 0; i < vd->nb_buffers; i++) {
+        frame_unref(vd->frames[i]);
+        vd->frames[i] = NULL;
+    }
+
+    memset(&vd->rb, 0, sizeof(struct v4l2_requestbuffers));
+    vd->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vd->rb.memory = V4L2_MEMORY_USERPTR;
+    xioctl(vd->fd, VIDIOC_REQBUFS, &vd->rb);
+    vd->rb.memory = V4L2_MEMORY_MMAP;
+}
+
+/******************************************************************************
+Description.: request, map and queue the capture buffers for the current
+              format, or let the camera capture into frames with -zerocopy
+Input Value.: the device
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int init_buffers(struct vdIn *vd)
+{
+    int i;
+    int ret = 0;
+
+    /*
+     * capture MJPEG into the frames themselves if asked to
+     */
+    if(vd->zerocopy) {
+        if((vd->formatIn == V4L2_PIX_FMT_MJPEG || vd->formatIn == V4L2_PIX_FMT_JPEG) &&
+           vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE && init_userptr(vd) == 0) {
+            export_buffers(vd);
+            return 0;
+        }
+        fprintf(stderr, " i: The device can not capture into frames, copying them\n");
+        vd->zerocopy = 0;
+    }
+
+    /*
+     * request buffers
+     */
+    memset(&vd->rb, 0, sizeof(struct v4l2_requestbuffers));
+    vd->rb.count = vd->buffer_count;
+    vd->rb.type = vd->buftype;
+    vd->rb.memory = V4L2_MEMORY_MMAP;
+
+    ret = xioctl(vd->fd, VIDIOC_REQBUFS, &vd->rb);
+    if(ret < 0) {
+        perror("Unable to allocate buffers");
+        return -1;
+    }
+
+    /* the driver may grant more or fewer buffers than asked for */
+    if(vd->rb.count < 2) {
+        fprintf(stderr, "The driver granted only %u buffers\n", vd->rb.count);
+        return -1;
+    }
+    vd->nb_buffers = MIN(vd->rb.count, MAX_BUFFERS);
+    if(vd->rb.count != (unsigned int)vd->buffer_count)
+        fprintf(stderr, " i: The driver granted %u buffers instead of %d\n", vd->rb.count, vd->buffer_count);
+
+    /*
+     * map the buffers
+     */
+    for(i = 0; i < vd->nb_buffers; i++) {
+        unsigned int length, offset;
+
+        clear_buffer(vd, V4L2_MEMORY_MMAP);
+        vd->buf.index = i;
+        ret = xioctl(vd->fd, VIDIOC_QUERYBUF, &vd->buf);
+        if(ret < 0) {
+            perror("Unable to query buffer");
+            return -1;
+        }
+
+        if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            length = vd->buf_planes[0].length;
+            offset = vd->buf_planes[0].m.mem_offset;
+        } else {
+            length = vd->buf.length;
+            offset = vd->buf.m.offset;
+        }
+        if(debug)
+            fprintf(stderr, "length: %u offset: %u\n", length, offset);
+
+        vd->mem[i] = mmap(0 /* start anywhere */ ,
+                          length, PROT_READ | PROT_WRITE, MAP_SHARED, vd->fd,
+                          offset);
+        if(vd->mem[i] == MAP_FAILED) {
+            perror("Unable to map buffer");
+            vd->mem[i] = NULL;
+            return -1;
+        }
+        vd->mem_length[i] = length;
+        if(debug)
+            fprintf(stderr, "Buffer mapped at address %p.\n", vd->mem[i]);
+
+        /* the chroma of NV12M and NV16M is mapped on its own */
+        vd->mem_chroma[i] = NULL;
+        if(vd->mem_planes > 1) {
+            vd->mem_chroma[i] = mmap(0, vd->buf_planes[1].length, PROT_READ | PROT_WRITE, MAP_SHARED, vd->fd,
+                                     vd->buf_planes[1].m.mem_offset);
+            if(vd->mem_chroma[i] == MAP_FAILED) {
+                perror("Unable to map the chroma plane of a buffer");
+                vd->mem_chroma[i] = NULL;
+                return -1;
+            }
+            vd->chroma_length[i] = vd->buf_planes[1].length;
+        }
+    }
+
+    export_buffers(vd);
+
+    /*
+     * Queue the buffers.
+     */
+    for(i = 0; i < vd->nb_buffers; ++i) {
+        clear_buffer(vd, V4L2_MEMORY_MMAP);
+        vd->buf.index = i;
+        ret = xioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
+        if(ret < 0) {
+            perror("Unable to queue buffer");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: give the capture buffers back to the driver, the device must not
+              be streaming
+Input Value.: the device
+Return Value: -
+******************************************************************************/
+static void free_buffers(struct vdIn *vd)
 {
     int i;
+
+    free_exported_buffers(vd);
+    if(vd->zerocopy) {
+        free_userptr(vd);
+        return;
+    }
+
+    /* the mappings go away even if the device is gone already */
+    for(i = 0; i < vd->nb_buffers; i++) {
+        if(vd->mem[i] != NULL)
+            munmap(vd->mem[i], vd->mem_length[i]);
+        vd->mem[i] = NULL;
+        if(vd->mem_chroma[i] != NULL)
+            munmap(vd->mem_chroma[i], vd->chroma_length[i]);
+        vd->mem_chroma[i] = NULL;
+    }
+
+    memset(&vd->rb, 0, sizeof(struct v4l2_requestbuffers));
+    vd->rb.type = vd->buftype;
+    vd->rb.memory = V4L2_MEMORY_MMAP;
+    xioctl(vd->fd, VIDIOC_REQBUFS, &vd->rb);
+}
+
+static int init_v4l2(struct vdIn *vd)
+{
     int ret = 0;
+    int width, height, pixelformat;
+    unsigned int caps;
     if((vd->fd = OPEN_VIDEO(vd->videodevice, O_RDWR)) == -1) {
         perror("ERROR opening V4L interface");
         DBG("errno: %d", errno);
@@ -284,7 +743,13 @@ static int init_v4l2(struct vdIn *vd)
         goto fatal;
     }
 
-    if((vd->cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) == 0) {
+    /* the cameras of SoCs often capture with the multi-planar API only */
+    caps = (vd->cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? vd->cap.device_caps : vd->cap.capabilities;
+    if(caps & V4L2_CAP_VIDEO_CAPTURE) {
+        vd->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if(caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        vd->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else {
         fprintf(stderr, "Error opening device %s: video capture not supported.\n",
                 vd->videodevice);
         goto fatal;;
@@ -325,12 +790,7 @@ static int init_v4l2(struct vdIn *vd)
     /*
      * set format in
      */
-    memset(&vd->fmt, 0, sizeof(struct v4l2_format));
-    vd->fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->fmt.fmt.pix.width = vd->width;
-    vd->fmt.fmt.pix.height = vd->height;
-    vd->fmt.fmt.pix.pixelformat = vd->formatIn;
-    vd->fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    fill_format(vd, &vd->fmt, vd->width, vd->height);
     ret = xioctl(vd->fd, VIDIOC_S_FMT, &vd->fmt);
     if(ret < 0) {
         fprintf(stderr, "Unable to set format: %d res: %dx%d\n", vd->formatIn, vd->width, vd->height);
@@ -340,51 +800,59 @@ static int init_v4l2(struct vdIn *vd)
     /* 
      * Check reoslution 
      */
-    if((vd->fmt.fmt.pix.width != vd->width) ||
-            (vd->fmt.fmt.pix.height != vd->height)) {
-       fprintf(stderr, " i: The specified resolution is unavailable, using: width %d height %d instead \n", vd->fmt.fmt.pix.width, vd->fmt.fmt.pix.height);
-        vd->width = vd->fmt.fmt.pix.width;
-        vd->height = vd->fmt.fmt.pix.height;
+    pixelformat = format_of(vd, &vd->fmt, &width, &height);
+    if((width != vd->width) ||
+            (height != vd->height)) {
+       fprintf(stderr, " i: The specified resolution is unavailable, using: width %d height %d instead \n", width, height);
+        vd->width = width;
+        vd->height = height;
     }
     /*
      * Check format
      */
-    if(vd->formatIn != vd->fmt.fmt.pix.pixelformat) {
+    if(vd->formatIn != pixelformat) {
       char fmtStringRequested[8];
       char fmtStringObtained[8];
-      fcc2s(fmtStringObtained,8,vd->fmt.fmt.pix.pixelformat);
+      fcc2s(fmtStringObtained,8,pixelformat);
       fcc2s(fmtStringRequested,8,vd->formatIn);
       fprintf(stderr, " i: Could not obtain the requested pixelformat: %s , driver gave us: %s\n",fmtStringRequested,fmtStringObtained);
       fprintf(stderr, "    ... will try to handle this by checking against supported formats. \n");
 
-      switch(vd->fmt.fmt.pix.pixelformat){
+      switch(pixelformat){
       case V4L2_PIX_FMT_JPEG:
 	// Fall-through intentional
       case V4L2_PIX_FMT_MJPEG:
 	fprintf(stderr, "    ... Falling back to the faster MJPG mode (consider changing cmd line options).\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
 	break;
       case V4L2_PIX_FMT_YUYV:
 	fprintf(stderr, "    ... Falling back to YUV mode (consider using -yuv option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
         break;
       case V4L2_PIX_FMT_UYVY:
 	fprintf(stderr, "    ... Falling back to UYVY mode (consider using -uyvy option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
         break;
       case V4L2_PIX_FMT_RGB24:
 	fprintf(stderr, "    ... Falling back to RGB24 mode (consider using -fourcc RGB24 option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
 	break;
       case V4L2_PIX_FMT_RGB565:
 	fprintf(stderr, "    ... Falling back to RGB565 mode (consider using -fourcc RGBP option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
+	break;
+      case V4L2_PIX_FMT_NV12:
+      case V4L2_PIX_FMT_NV16:
+	fprintf(stderr, "    ... Falling back to %s mode (consider using -fourcc %s option). Note that this requires much more CPU power\n",
+	        fmtStringObtained, fmtStringObtained);
+	vd->formatIn = pixelformat;
 	break;
       default:
 	goto fatal;
 	break;
       }
     }
+    take_layout(vd, &vd->fmt);
  
     /*
      * set framerate
@@ -394,7 +862,7 @@ static int init_v4l2(struct vdIn *vd)
         struct v4l2_streamparm *setfps;
         setfps = (struct v4l2_streamparm *) calloc(1, sizeof(struct v4l2_streamparm));
         memset(setfps, 0, sizeof(struct v4l2_streamparm));
-        setfps->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        setfps->type = vd->buftype;
 
         /*
         * first query streaming parameters to determine that the FPS selection is supported
@@ -403,7 +871,7 @@ static int init_v4l2(struct vdIn *vd)
         if (ret == 0) {
             if (setfps->parm.capture.capability & V4L2_CAP_TIMEPERFRAME) {
                 memset(setfps, 0, sizeof(struct v4l2_streamparm));
-                setfps->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+                setfps->type = vd->buftype;
                 setfps->parm.capture.timeperframe.numerator = 1;
                 setfps->parm.capture.timeperframe.denominator = vd->fps==-1?255:vd->fps; // if no default fps set set it to maximum
 
@@ -426,72 +894,32 @@ static int init_v4l2(struct vdIn *vd)
         }
     }
 
-    /*
-     * request buffers
-     */
-    memset(&vd->rb, 0, sizeof(struct v4l2_requestbuffers));
-    vd->rb.count = NB_BUFFER;
-    vd->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->rb.memory = V4L2_MEMORY_MMAP;
-
-    ret = xioctl(vd->fd, VIDIOC_REQBUFS, &vd->rb);
-    if(ret < 0) {
-        perror("Unable to allocate buffers");
+    if(init_buffers(vd) < 0)
         goto fatal;
-    }
+    return 0;
+fatal:
+    fprintf(stderr, "Init v4L2 failed !! exit fatal\n");
+    return -1;
 
-    /*
-     * map the buffers
-     */
-    for(i = 0; i < NB_BUFFER; i++) {
-        memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-        vd->buf.index = i;
-        vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vd->buf.memory = V4L2_MEMORY_MMAP;
-        ret = xioctl(vd->fd, VIDIOC_QUERYBUF, &vd->buf);
-        if(ret < 0) {
-            perror("Unable to query buffer");
-            goto fatal;
-        }
+}
 
-        if(debug)
-            fprintf(stderr, "length: %u offset: %u\n", vd->buf.length, vd->buf.m.offset);
-
-        vd->mem[i] = mmap(0 /* start anywhere */ ,
-                          vd->buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, vd->fd,
-                          vd->buf.m.offset);
-        if(vd->mem[i] == MAP_FAILED) {
-            perror("Unable to map buffer");
-            goto fatal;
-        }
-        if(debug)
-            fprintf(stderr, "Buffer mapped at address %p.\n", vd->mem[i]);
-    }
-
-    /*
-     * Queue the buffers.
-     */
-    for(i = 0; i < NB_BUFFER; ++i) {
-        memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-        vd->buf.index = i;
-        vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vd->buf.memory = V4L2_MEMORY_MMAP;
-        ret = xioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
-        if(ret < 0) {
-            perror("Unable to queue buffer");
-            goto fatal;;
-        }
-    }
-    return 0;
-fatal:
-    fprintf(stderr, "Init v4L2 failed !! exit fatal\n");
-    return -1;
+/******************************************************************************
+Description.: wake up the camera thread after streamingState changed or
+              when it has something else to do, see switch_camera()
+Input Value.: the device
+Return Value: -
+******************************************************************************/
+void video_wakeup(struct vdIn *vd)
+{
+    uint64_t one = 1;
 
+    if(write(vd->wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("Unable to signal the camera thread");
 }
 
 int video_enable(struct vdIn *vd)
 {
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int type = vd->buftype;
     int ret;
 
     ret = xioctl(vd->fd, VIDIOC_STREAMON, &type);
@@ -500,12 +928,16 @@ int video_enable(struct vdIn *vd)
         return ret;
     }
     vd->streamingState = STREAMING_ON;
+    vd->have_sequence = 0;
+    vd->huffman = -1;
+    vd->eoi = 0;
+    video_wakeup(vd);
     return 0;
 }
 
 static int video_disable(struct vdIn *vd, streaming_state disabledState)
 {
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int type = vd->buftype;
     int ret;
     DBG("STopping capture\n");
     ret = xioctl(vd->fd, VIDIOC_STREAMOFF, &type);
@@ -515,6 +947,7 @@ static int video_disable(struct vdIn *vd, streaming_state disabledState)
     }
     DBG("STopping capture done\n");
     vd->streamingState = disabledState;
+    video_wakeup(vd);
     return 0;
 }
 
@@ -587,16 +1020,34 @@ int is_huffman(unsigned char *buf)
 }
 
 /******************************************************************************
-Description.:
-Input Value.:
-Return Value:
+Description.: tell whether the pictures of a stream carry huffman tables. A
+              camera either always sends them or never, so only the first
+              frame after the stream was started is scanned.
+Input Value.: * vd.: the device
+              * buf: the picture
+Return Value: 1 if the tables are there, 0 if they have to be added
 ******************************************************************************/
-int memcpy_picture(unsigned char *out, unsigned char *buf, int size)
+static int stream_has_huffman(struct vdIn *vd, unsigned char *buf)
+{
+    if(vd->huffman < 0)
+        vd->huffman = is_huffman(buf);
+    return vd->huffman;
+}
+
+/******************************************************************************
+Description.: copy a MJPEG picture and add the huffman table if it lacks one
+Input Value.: * vd..: the device
+              * out.: the destination, DHT_SPACE larger than the picture
+              * buf.: the picture
+              * size: its size
+Return Value: the size of the copy, 0 if the picture has no SOF marker
+******************************************************************************/
+int memcpy_picture(struct vdIn *vd, unsigned char *out, unsigned char *buf, int size)
 {
     unsigned char *ptdeb, *ptlimit, *ptcur = buf;
     int sizein, pos = 0;
 
-    if(!is_huffman(buf)) {
+    if(!stream_has_huffman(vd, buf)) {
         ptdeb = ptcur = buf;
         ptlimit = buf + size;
         while((((ptcur[0] << 8) | ptcur[1]) != 0xffc0) && (ptcur < ptlimit))
@@ -614,18 +1065,103 @@ int memcpy_picture(unsigned char *out, unsigned char *buf, int size)
     return pos;
 }
 
-int uvcGrab(struct vdIn *vd)
+/******************************************************************************
+Description.: check that a MJPEG picture starts with SOI and ends with EOI.
+              Cameras pad their frames, with zeros mostly, so the last 0xff
+              byte has to start the EOI marker. memrchr() skips the padding
+              a word at a time, in entropy coded data 0xff is always followed
+              by 0x00 or a RST marker. Truncated pictures lack the EOI, but
+              some cameras never send one, so a missing EOI only counts once
+              the stream ended a frame with it.
+Input Value.: * vd..: the device
+              * buf.: the picture
+              * size: its size
+Return Value: the size of the picture up to its EOI marker, the size if the
+              camera sends no EOI markers and 0 if the picture is broken
+******************************************************************************/
+int jpeg_complete(struct vdIn *vd, const unsigned char *buf, int size)
 {
+    const unsigned char *last;
+
+    if(size < 4 || buf[0] != 0xff || buf[1] != 0xd8)
+        return 0;
+
+    last = memrchr(buf + 2, 0xff, size - 3);
+    if(last != NULL && last[1] == 0xd9) {
+        vd->eoi = 1;
+        return last + 2 - buf;
+    }
+    return vd->eoi ? 0 : size;
+}
+
+/******************************************************************************
+Description.: take the frame a MJPEG picture was captured into and queue a
+              fresh one in its place. A missing huffman table is inserted in
+              front of the SOF marker by moving the few bytes before it into
+              the space left in front of the picture.
+Input Value.: the device, vd->buf holds the dequeued buffer
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
 #define HEADERFRAME1 0xaf
+
+static int grab_userptr(struct vdIn *vd)
+{
+    input_frame *frame = vd->frames[vd->buf.index], *fresh;
+    unsigned char *data = frame->buf + DHT_SPACE, *ptcur = data;
+    unsigned char *ptlimit = data + vd->buf.bytesused;
+    int sizein;
+
+    if(vd->buf.bytesused <= HEADERFRAME1) {
+        fprintf(stderr, "Ignoring empty buffer ...\n");
+        return queue_userptr(vd, vd->buf.index);
+    }
+
+    vd->tmpbytesused = vd->buf.bytesused;
+    vd->tmptimestamp = vd->buf.timestamp;
+
+    /* keep the frame if there is no replacement and copy the picture */
+    if((fresh = frame_alloc(frame->capacity)) == NULL) {
+        vd->tmpbytesused = MIN(vd->buf.bytesused, (unsigned int)vd->framesizeIn);
+        memcpy(vd->tmpbuffer, data, vd->tmpbytesused);
+        return queue_userptr(vd, vd->buf.index);
+    }
+
+    vd->frames[vd->buf.index] = fresh;
+    if(queue_userptr(vd, vd->buf.index) < 0) {
+        perror("Unable to requeue buffer");
+        vd->frames[vd->buf.index] = frame;
+        frame_unref(fresh);
+        return -1;
+    }
+
+    frame->buf = data;
+    frame->size = vd->buf.bytesused;
+    if(!stream_has_huffman(vd, data)) {
+        while((((ptcur[0] << 8) | ptcur[1]) != 0xffc0) && (ptcur < ptlimit))
+            ptcur++;
+        if(ptcur < ptlimit) {
+            sizein = ptcur - data;
+            frame->buf = data - sizeof(dht_data);
+            memmove(frame->buf, data, sizein);
+            memcpy(frame->buf + sizein, dht_data, sizeof(dht_data));
+            frame->size += sizeof(dht_data);
+        }
+    }
+    frame->capacity -= frame->buf - (unsigned char *)(frame + 1);
+    vd->frame = frame;
+
+    return 0;
+}
+
+int uvcGrab(struct vdIn *vd)
+{
     int ret;
 
     if(vd->streamingState == STREAMING_OFF) {
         if(video_enable(vd))
             goto err;
     }
-    memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-    vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->buf.memory = V4L2_MEMORY_MMAP;
+    clear_buffer(vd, vd->zerocopy ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP);
 
     ret = xioctl(vd->fd, VIDIOC_DQBUF, &vd->buf);
     if(ret < 0) {
@@ -633,6 +1169,31 @@ int uvcGrab(struct vdIn *vd)
         goto err;
     }
 
+    /* a frame of a multi-planar device is as long as its planes together */
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        vd->buf.bytesused = vd->buf_planes[0].bytesused;
+        if(vd->mem_planes > 1)
+            vd->buf.bytesused += vd->buf_planes[1].bytesused;
+    }
+
+    /* the kernel stamps frames with CLOCK_MONOTONIC, the clock of monotonic_usec() */
+    vd->dequeue_usec = monotonic_usec();
+    vd->capture_usec = 0;
+    if((vd->buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        vd->capture_usec = (unsigned long long)vd->buf.timestamp.tv_sec * 1000000ULL + vd->buf.timestamp.tv_usec;
+
+    /* the sequence numbers have gaps where the driver had no buffer to fill */
+    vd->lost = 0;
+    if(vd->have_sequence && vd->buf.sequence - vd->sequence > 1) {
+        vd->lost = vd->buf.sequence - vd->sequence - 1;
+        DBG("the driver dropped %u frames\n", vd->lost);
+    }
+    vd->sequence = vd->buf.sequence;
+    vd->have_sequence = 1;
+
+    if(vd->zerocopy)
+        return grab_userptr(vd);
+
     switch(vd->formatIn) {
     case V4L2_PIX_FMT_JPEG:
         // Fall-through intentional
@@ -663,13 +1224,38 @@ int uvcGrab(struct vdIn *vd)
     case V4L2_PIX_FMT_RGB565:
     case V4L2_PIX_FMT_YUYV:
     case V4L2_PIX_FMT_UYVY:
+        vd->tmpbytesused = vd->buf.bytesused;
+        vd->tmptimestamp = vd->buf.timestamp;
+        /* the frame is read from the capture buffer itself, uvcRelease() requeues it */
+        if(vd->hold_buffer) {
+            vd->held = 1;
+            return 0;
+        }
         if(vd->buf.bytesused > vd->framesizeIn) {
             memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) vd->framesizeIn);
         } else {
             memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) vd->buf.bytesused);
         }
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
         vd->tmpbytesused = vd->buf.bytesused;
         vd->tmptimestamp = vd->buf.timestamp;
+        if(vd->hold_buffer) {
+            vd->held = 1;
+            return 0;
+        }
+        if(vd->mem_planes > 1) {
+            /* the chroma goes behind the luma, as in a buffer of one memory plane */
+            size_t luma = (size_t)vd->stride[0] * vd->height;
+
+            memcpy(vd->framebuffer, vd->mem[vd->buf.index], MIN(luma, vd->buf_planes[0].bytesused));
+            memcpy(vd->framebuffer + luma, vd->mem_chroma[vd->buf.index],
+                   MIN(vd->framesizeIn - luma, vd->buf_planes[1].bytesused));
+            vd->buf.bytesused = vd->framesizeIn;
+        } else {
+            memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) MIN(vd->buf.bytesused, (unsigned int)vd->framesizeIn));
+        }
         break;
     default:
         goto err;
@@ -689,10 +1275,37 @@ err:
     return -1;
 }
 
+/******************************************************************************
+Description.: requeue the capture buffer of a frame uvcGrab() held back
+Input Value.: the device
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+int uvcRelease(struct vdIn *vd)
+{
+    frame_unref(vd->frame);
+    vd->frame = NULL;
+
+    if(!vd->held)
+        return 0;
+
+    vd->held = 0;
+    if(xioctl(vd->fd, VIDIOC_QBUF, &vd->buf) < 0) {
+        perror("Unable to requeue buffer");
+        return -1;
+    }
+
+    return 0;
+}
+
 int close_v4l2(struct vdIn *vd)
 {
+    free_exported_buffers(vd);
     if(vd->streamingState == STREAMING_ON)
         video_disable(vd, STREAMING_OFF);
+    frame_unref(vd->frame);
+    vd->frame = NULL;
+    if(vd->zerocopy)
+        free_userptr(vd);
     free_framebuffer(vd);
     free(vd->videodevice);
     free(vd->status);
@@ -700,6 +1313,10 @@ int close_v4l2(struct vdIn *vd)
     vd->videodevice = NULL;
     vd->status = NULL;
     vd->pictName = NULL;
+    close(vd->wakeup);
+    vd->wakeup = -1;
+    capcache_free(vd->capcache);
+    vd->capcache = NULL;
 
     return 0;
 }
@@ -750,82 +1367,220 @@ int v4l2GetControl(struct vdIn *vd, int control)
     return control_s.value;
 }
 
-int v4l2SetControl(struct vdIn *vd, int control_id, int value, int plugin_number, globals *pglobal)
+/******************************************************************************
+Description.: set a single control, the way for drivers which refuse a batch
+Input Value.: * vd..: the device
+              * c...: the control
+              * ext.: the control and its new value
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int set_one_control(struct vdIn *vd, control *c, struct v4l2_ext_control *ext)
 {
+    struct v4l2_ext_controls ext_ctrls = {0};
     struct v4l2_control control_s;
-    int min, max;
-    int ret = 0;
-    int err;
-    int i;
-    int got = -1;
-    DBG("Looking for the 0x%08x V4L2 control\n", control_id);
-    for (i = 0; i<pglobal->in[plugin_number].parametercount; i++) {
-        if (pglobal->in[plugin_number].in_parameters[i].ctrl.id == control_id) {
-            got = 0;
-            break;
+
+    if(c->class_id == V4L2_CTRL_CLASS_USER) {
+        control_s.id = ext->id;
+        control_s.value = ext->value;
+        if(xioctl(vd->fd, VIDIOC_S_CTRL, &control_s) < 0) {
+            DBG("VIDIOC_S_CTRL failed\n");
+            return -1;
         }
+        return 0;
     }
 
-    if (got == 0) { // we have found the control with the specified id
-        DBG("V4L2 ctrl 0x%08x found\n", control_id);
-        if (pglobal->in[plugin_number].in_parameters[i].class_id == V4L2_CTRL_CLASS_USER) {
-            DBG("Control type: USER\n");
-            min = pglobal->in[plugin_number].in_parameters[i].ctrl.minimum;
-            max = pglobal->in[plugin_number].in_parameters[i].ctrl.maximum;
+    ext_ctrls.ctrl_class = V4L2_CTRL_ID2CLASS(ext->id);
+    ext_ctrls.count = 1;
+    ext_ctrls.controls = ext;
+    if(xioctl(vd->fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls) < 0) {
+        LOG("control id: 0x%08x failed to set value (error %i)\n", ext->id, errno);
+        return -1;
+    }
+    return 0;
+}
 
-            if((value >= min) && (value <= max)) {
-                control_s.id = control_id;
-                control_s.value = value;
-                if((err = xioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
-                    DBG("VIDIOC_S_CTRL failed\n");
-                    return -1;
-                } else {
-                    DBG("V4L2 ctrl 0x%08x new value: %d\n", control_id, value);
-                    pglobal->in[plugin_number].in_parameters[i].value = value;
-                }
-            } else {
-                LOG("Value (%d) out of range (%d .. %d)\n", value, min, max);
-            }
-            return 0;
-        } else { // not user class controls
-            DBG("Control type: EXTENDED\n");
-            struct v4l2_ext_controls ext_ctrls = {0};
-            struct v4l2_ext_control ext_ctrl = {0};
-            ext_ctrl.id = pglobal->in[plugin_number].in_parameters[i].ctrl.id;
+/******************************************************************************
+Description.: set several controls at once with a VIDIOC_S_EXT_CTRLS for each
+              control class. On UVC every ioctl is a USB control transfer
+              which takes milliseconds, so controls which have the value
+              already are left out, unless the driver may change them itself.
+              If a control appears more than once its last value counts.
+Input Value.: * vd...........: the device
+              * ids..........: the controls
+              * values.......: their new values
+              * results......: get 0 or -1 for each control, may be NULL
+              * count........: number of controls
+              * plugin_number: the input, its in_parameters keep the values
+              * pglobal......: the globals
+Return Value: 0 if all controls are set, -1 otherwise
+******************************************************************************/
+static int set_controls(struct vdIn *vd, const int *ids, const int *values, int *results, int count,
+                        int plugin_number, globals *pglobal, int force)
+{
+    input *in = &pglobal->in[plugin_number];
+    struct v4l2_ext_controls ext_ctrls;
+    struct v4l2_ext_control *ext;
+    int *index, *batch;
+    control *c;
+    int i, j, n, rc = 0;
+
+    ext = calloc(count, sizeof(struct v4l2_ext_control));
+    index = calloc(count, sizeof(int));
+    batch = calloc(count, sizeof(int));
+    if(ext == NULL || index == NULL || batch == NULL) {
+        free(ext);
+        free(index);
+        free(batch);
+        return -1;
+    }
 
-            switch(pglobal->in[plugin_number].in_parameters[i].ctrl.type) {
-#ifdef V4L2_CTRL_TYPE_STRING
-                case V4L2_CTRL_TYPE_STRING:
-                    //string gets set on VIDIOC_G_EXT_CTRLS
-                    //add the maximum size to value
-                    ext_ctrl.size = value;
-                    DBG("STRING extended controls are currently broken\n");
-                    //ext_ctrl.string = control->string; // FIXMEE
-                    break;
-#endif
-                case V4L2_CTRL_TYPE_INTEGER64:
-                    ext_ctrl.value64 = value;
-                    break;
-                default:
-                    ext_ctrl.value = value;
-                    break;
+    /* find the controls, index is -1 for those which need no ioctl */
+    for(i = 0; i < count; i++) {
+        if(results != NULL)
+            results[i] = 0;
+        index[i] = -1;
+
+        DBG("Looking for the 0x%08x V4L2 control\n", ids[i]);
+        for(j = 0; j < in->parametercount; j++) {
+            if(in->in_parameters[j].ctrl.id == (unsigned int)ids[i])
+                break;
+        }
+        if(j == in->parametercount) {
+            LOG("Invalid V4L2_set_control request for the id: 0x%08x. Control cannot be found in the list\n", ids[i]);
+            if(results != NULL)
+                results[i] = -1;
+            rc = -1;
+            continue;
+        }
+
+        c = &in->in_parameters[j];
+        if(c->ctrl.type == V4L2_CTRL_TYPE_INTEGER || c->ctrl.type == V4L2_CTRL_TYPE_BOOLEAN ||
+           c->ctrl.type == V4L2_CTRL_TYPE_MENU) {
+            if(values[i] < c->ctrl.minimum || values[i] > c->ctrl.maximum) {
+                LOG("Value (%d) out of range (%d .. %d)\n", values[i], c->ctrl.minimum, c->ctrl.maximum);
+                continue;
             }
+        }
+        #ifdef V4L2_CTRL_TYPE_STRING
+        if(c->ctrl.type == V4L2_CTRL_TYPE_STRING) {
+            DBG("STRING extended controls are currently broken\n");
+            continue;
+        }
+        #endif
 
-            ext_ctrls.count = 1;
-            ext_ctrls.controls = &ext_ctrl;
-            ret = xioctl(vd->fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls);
-            if(ret) {
-                LOG("control id: 0x%08x failed to set value (error %i)\n", ext_ctrl.id, ret);
-                return -1;
-            } else {
-                DBG("control id: 0x%08x new value: %d\n", ext_ctrl.id, ext_ctrl.value);
+        if(!force && c->value == values[i] && c->ctrl.type != V4L2_CTRL_TYPE_BUTTON &&
+           !(c->ctrl.flags & (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_WRITE_ONLY))) {
+            DBG("V4L2 ctrl 0x%08x has the value %d already\n", ids[i], values[i]);
+            continue;
+        }
+
+        /* an earlier change of the same control is overridden */
+        for(n = 0; n < i; n++) {
+            if(index[n] == j)
+                index[n] = -1;
+        }
+        index[i] = j;
+    }
+
+    /* the controls of a class go out together, in the order of the first one */
+    for(i = 0; i < count; i++) {
+        if(index[i] < 0)
+            continue;
+
+        for(j = i, n = 0; j < count; j++) {
+            if(index[j] < 0 || V4L2_CTRL_ID2CLASS(ids[j]) != V4L2_CTRL_ID2CLASS(ids[i]))
+                continue;
+            memset(&ext[n], 0, sizeof(ext[n]));
+            ext[n].id = ids[j];
+            if(in->in_parameters[index[j]].ctrl.type == V4L2_CTRL_TYPE_INTEGER64)
+                ext[n].value64 = values[j];
+            else
+                ext[n].value = values[j];
+            batch[n++] = j;
+        }
+
+        memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+        ext_ctrls.ctrl_class = V4L2_CTRL_ID2CLASS(ids[i]);
+        ext_ctrls.count = n;
+        ext_ctrls.controls = ext;
+        if(xioctl(vd->fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls) == 0) {
+            for(j = 0; j < n; j++) {
+                DBG("V4L2 ctrl 0x%08x new value: %d\n", ids[batch[j]], values[batch[j]]);
+                in->in_parameters[index[batch[j]]].value = values[batch[j]];
+            }
+        } else {
+            /* a driver without extended user controls, or one of them failed */
+            DBG("VIDIOC_S_EXT_CTRLS of %d controls failed, setting them one by one\n", n);
+            for(j = 0; j < n; j++) {
+                if(set_one_control(vd, &in->in_parameters[index[batch[j]]], &ext[j]) < 0) {
+                    if(results != NULL)
+                        results[batch[j]] = -1;
+                    rc = -1;
+                } else {
+                    in->in_parameters[index[batch[j]]].value = values[batch[j]];
+                }
             }
-            return 0;
         }
-    } else {
-        LOG("Invalid V4L2_set_control request for the id: 0x%08x. Control cannot be found in the list\n", control_id);
+
+        for(j = 0; j < n; j++)
+            index[batch[j]] = -1;
+    }
+
+    free(ext);
+    free(index);
+    free(batch);
+    return rc;
+}
+
+int v4l2SetControls(struct vdIn *vd, const int *ids, const int *values, int *results, int count,
+                    int plugin_number, globals *pglobal)
+{
+    return set_controls(vd, ids, values, results, count, plugin_number, pglobal, 0);
+}
+
+/******************************************************************************
+Description.: set the controls of a reopened device to the values they had,
+              those at their defaults are left out
+Input Value.: * vd...........: the device
+              * plugin_number: the input, its in_parameters keep the values
+              * pglobal......: the globals
+Return Value: 0 if all controls are set, -1 otherwise
+******************************************************************************/
+int v4l2RestoreControls(struct vdIn *vd, int plugin_number, globals *pglobal)
+{
+    input *in = &pglobal->in[plugin_number];
+    int *ids, *values, i, n = 0, rc;
+
+    if(in->parametercount <= 0)
+        return 0;
+    ids = calloc(in->parametercount, sizeof(int));
+    values = calloc(in->parametercount, sizeof(int));
+    if(ids == NULL || values == NULL) {
+        free(ids);
+        free(values);
         return -1;
     }
+
+    for(i = 0; i < in->parametercount; i++) {
+        control *c = &in->in_parameters[i];
+
+        if(c->group != IN_CMD_V4L2 || c->value == c->ctrl.default_value ||
+           c->ctrl.type == V4L2_CTRL_TYPE_BUTTON ||
+           (c->ctrl.flags & (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE)))
+            continue;
+        ids[n] = c->ctrl.id;
+        values[n++] = c->value;
+    }
+
+    rc = (n > 0) ? set_controls(vd, ids, values, NULL, n, plugin_number, pglobal, 1) : 0;
+    free(ids);
+    free(values);
+    return rc;
+}
+
+int v4l2SetControl(struct vdIn *vd, int control_id, int value, int plugin_number, globals *pglobal)
+{
+    return v4l2SetControls(vd, &control_id, &value, NULL, 1, plugin_number, pglobal);
 }
 
 int v4l2ResetControl(struct vdIn *vd, int control)
@@ -849,64 +1604,31 @@ int v4l2ResetControl(struct vdIn *vd, int control)
     return 0;
 }
 
-void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglobal, int id)
+/******************************************************************************
+Description.: read the current value of a control into its in_parameters entry
+Input Value.: * vd: the device
+              * c.: the control, class_id must be set
+Return Value: 0 if ok, -1 if the value could not be read
+******************************************************************************/
+int control_read_value(struct vdIn *vd, control *c)
 {
-    struct v4l2_control c;
-    memset(&c, 0, sizeof(struct v4l2_control));
-    c.id = ctrl->id;
-
-    if (pglobal->in[id].in_parameters == NULL) {
-        pglobal->in[id].in_parameters = (control*)calloc(1, sizeof(control));
-    } else {
-        pglobal->in[id].in_parameters =
-        (control*)realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
-    }
-
-    if (pglobal->in[id].in_parameters == NULL) {
-        DBG("Calloc failed\n");
-        return;
-    }
-
-    memcpy(&pglobal->in[id].in_parameters[pglobal->in[id].parametercount].ctrl, ctrl, sizeof(struct v4l2_queryctrl));
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].group = IN_CMD_V4L2;
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = c.value;
-    if(ctrl->type == V4L2_CTRL_TYPE_MENU) {
-        pglobal->in[id].in_parameters[pglobal->in[id].parametercount].menuitems =
-            (struct v4l2_querymenu*)malloc((ctrl->maximum + 1) * sizeof(struct v4l2_querymenu));
-        int i;
-        for(i = ctrl->minimum; i <= ctrl->maximum; i++) {
-            struct v4l2_querymenu qm;
-            memset(&qm, 0 , sizeof(struct v4l2_querymenu));
-            qm.id = ctrl->id;
-            qm.index = i;
-            if(xioctl(vd->fd, VIDIOC_QUERYMENU, &qm) == 0) {
-                memcpy(&pglobal->in[id].in_parameters[pglobal->in[id].parametercount].menuitems[i], &qm, sizeof(struct v4l2_querymenu));
-                DBG("Menu item %d: %s\n", qm.index, qm.name);
-            } else {
-                DBG("Unable to get menu item for %s, index=%d\n", ctrl->name, qm.index);
-            }
-        }
-    } else {
-        pglobal->in[id].in_parameters[pglobal->in[id].parametercount].menuitems = NULL;
-    }
+    struct v4l2_queryctrl *ctrl = &c->ctrl;
+    struct v4l2_control ctrl_s;
+    int ret = -1;
 
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 0;
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].class_id = (ctrl->id & 0xFFFF0000);
-#ifndef V4L2_CTRL_FLAG_NEXT_CTRL
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].class_id = V4L2_CTRL_CLASS_USER;
-#endif
+    memset(&ctrl_s, 0, sizeof(struct v4l2_control));
+    ctrl_s.id = ctrl->id;
 
-    int ret = -1;
-    if (pglobal->in[id].in_parameters[pglobal->in[id].parametercount].class_id == V4L2_CTRL_CLASS_USER) {
-        DBG("V4L2 parameter found: %s value %d Class: USER \n", ctrl->name, c.value);
-        ret = xioctl(vd->fd, VIDIOC_G_CTRL, &c);
+    if (c->class_id == V4L2_CTRL_CLASS_USER) {
+        DBG("V4L2 parameter found: %s Class: USER \n", ctrl->name);
+        ret = xioctl(vd->fd, VIDIOC_G_CTRL, &ctrl_s);
         if(ret == 0) {
-            pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = c.value;
+            c->value = ctrl_s.value;
         } else {
             DBG("Unable to get the value of %s retcode: %d  %s\n", ctrl->name, ret, strerror(errno));
         }
     } else {
-        DBG("V4L2 parameter found: %s value %d Class: EXTENDED \n", ctrl->name, c.value);
+        DBG("V4L2 parameter found: %s Class: EXTENDED \n", ctrl->name);
         struct v4l2_ext_controls ext_ctrls = {0};
         struct v4l2_ext_control ext_ctrl = {0};
         ext_ctrl.id = ctrl->id;
@@ -923,15 +1645,15 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
         if(ret) {
             switch (ext_ctrl.id) {
                 case V4L2_CID_PAN_RESET:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 1;
+                    c->value = 1;
                     DBG("Setting PAN reset value to 1\n");
                     break;
                 case V4L2_CID_TILT_RESET:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 1;
+                    c->value = 1;
                     DBG("Setting the Tilt reset value to 2\n");
                     break;
                 case V4L2_CID_PANTILT_RESET_LOGITECH:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 3;
+                    c->value = 3;
                     DBG("Setting the PAN/TILT reset value to 3\n");
                     break;
                 default:
@@ -944,19 +1666,68 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
                 case V4L2_CTRL_TYPE_STRING:
                     //string gets set on VIDIOC_G_EXT_CTRLS
                     //add the maximum size to value
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = ext_ctrl.size;
+                    c->value = ext_ctrl.size;
                     break;
 #endif
                 case V4L2_CTRL_TYPE_INTEGER64:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = ext_ctrl.value64;
+                    c->value = ext_ctrl.value64;
                     break;
                 default:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = ext_ctrl.value;
+                    c->value = ext_ctrl.value;
                     break;
             }
         }
     }
 
+    return ret ? -1 : 0;
+}
+
+void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglobal, int id)
+{
+    control *c;
+
+    if (pglobal->in[id].in_parameters == NULL) {
+        pglobal->in[id].in_parameters = (control*)calloc(1, sizeof(control));
+    } else {
+        pglobal->in[id].in_parameters =
+        (control*)realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
+    }
+
+    if (pglobal->in[id].in_parameters == NULL) {
+        DBG("Calloc failed\n");
+        return;
+    }
+
+    c = &pglobal->in[id].in_parameters[pglobal->in[id].parametercount];
+    memcpy(&c->ctrl, ctrl, sizeof(struct v4l2_queryctrl));
+    c->group = IN_CMD_V4L2;
+    if(ctrl->type == V4L2_CTRL_TYPE_MENU) {
+        /* zeroed, so items the driver does not know compare equal in the capability cache */
+        c->menuitems = (struct v4l2_querymenu*)calloc(ctrl->maximum + 1, sizeof(struct v4l2_querymenu));
+        int i;
+        for(i = ctrl->minimum; i <= ctrl->maximum; i++) {
+            struct v4l2_querymenu qm;
+            memset(&qm, 0 , sizeof(struct v4l2_querymenu));
+            qm.id = ctrl->id;
+            qm.index = i;
+            if(xioctl(vd->fd, VIDIOC_QUERYMENU, &qm) == 0) {
+                memcpy(&c->menuitems[i], &qm, sizeof(struct v4l2_querymenu));
+                DBG("Menu item %d: %s\n", qm.index, qm.name);
+            } else {
+                DBG("Unable to get menu item for %s, index=%d\n", ctrl->name, qm.index);
+            }
+        }
+    } else {
+        c->menuitems = NULL;
+    }
+
+    c->value = 0;
+    c->class_id = (ctrl->id & 0xFFFF0000);
+#ifndef V4L2_CTRL_FLAG_NEXT_CTRL
+    c->class_id = V4L2_CTRL_CLASS_USER;
+#endif
+
+    control_read_value(vd, c);
     pglobal->in[id].parametercount++;
 }
 
@@ -970,16 +1741,14 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
 int setResolution(struct vdIn *vd, int width, int height)
 {
     vd->streamingState = STREAMING_PAUSED;
+    video_wakeup(vd);
     if (video_disable(vd, STREAMING_PAUSED) < 0) {
         IPRINT("Unable to disable streaming\n");
         return -1;
     }
 
     DBG("Unmap buffers\n");
-    int i;
-    for (i = 0; i < NB_BUFFER; i++) {
-        munmap(vd->mem[i], vd->buf.length);
-    }
+    free_buffers(vd);
 
     if (CLOSE_VIDEO(vd->fd) == 0) {
         DBG("Device closed successfully\n");
@@ -1006,6 +1775,219 @@ int setResolution(struct vdIn *vd, int width, int height)
     return 0;
 }
 
+/******************************************************************************
+Description.: open a camera which did not start streaming again with another
+              size and frame rate in the same format
+Input Value.: * vd...........: the device, not streaming
+              * width, height: the resolution
+              * fps..........: the frame rate
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+int video_set_mode(struct vdIn *vd, int width, int height, int fps)
+{
+    free_buffers(vd);
+    CLOSE_VIDEO(vd->fd);
+
+    vd->width = width;
+    vd->height = height;
+    vd->fps = fps;
+    if(init_v4l2(vd) < 0)
+        return -1;
+
+    free_framebuffer(vd);
+    if(init_framebuffer(vd) < 0) {
+        IPRINT("Can\'t reallocate framebuffer\n");
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: close a device which stopped working, a camera which went off
+              the USB bus for instance. Everything else of vd stays, so
+              video_reopen() can open it again with the same settings.
+Input Value.: the device
+Return Value: -
+******************************************************************************/
+void video_close(struct vdIn *vd)
+{
+    if(vd->fd < 0)
+        return;
+
+    if(vd->streamingState == STREAMING_ON)
+        video_disable(vd, STREAMING_OFF);
+    frame_unref(vd->frame);
+    vd->frame = NULL;
+    vd->held = 0;
+    free_buffers(vd);
+    CLOSE_VIDEO(vd->fd);
+    vd->fd = -1;
+}
+
+/******************************************************************************
+Description.: stop a camera nobody watches, the device stays open and keeps
+              its settings. The buffers go back to the driver, so a camera
+              which powers down while it does not stream may do so.
+Input Value.: the device
+Return Value: 0 on success, -1 if the camera keeps streaming
+******************************************************************************/
+int video_pause(struct vdIn *vd)
+{
+    if(vd->streamingState != STREAMING_ON)
+        return -1;
+
+    if(video_disable(vd, STREAMING_PAUSED) < 0)
+        return -1;
+    frame_unref(vd->frame);
+    vd->frame = NULL;
+    vd->held = 0;
+    free_buffers(vd);
+    return 0;
+}
+
+/******************************************************************************
+Description.: start a camera stopped by video_pause() again
+Input Value.: the device
+Return Value: 0 on success, -1 if the device can not be used anymore
+******************************************************************************/
+int video_resume(struct vdIn *vd)
+{
+    if(vd->streamingState != STREAMING_PAUSED)
+        return 0;
+
+    if(init_buffers(vd) < 0 || video_enable(vd) < 0)
+        return -1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: open a device closed by video_close() again and start it. The
+              formats and controls found when the plugin started are kept,
+              the device is not enumerated again.
+Input Value.: the device
+Return Value: 0 on success, -1 if the device is still not usable
+******************************************************************************/
+int video_reopen(struct vdIn *vd)
+{
+    int width = vd->width, height = vd->height, format = vd->formatIn;
+
+    if(init_v4l2(vd) < 0) {
+        video_close(vd);
+        return -1;
+    }
+
+    /* the driver may pick another size than before */
+    if(vd->width != width || vd->height != height || vd->formatIn != format) {
+        free_framebuffer(vd);
+        if(init_framebuffer(vd) < 0) {
+            IPRINT("Can\'t reallocate framebuffer\n");
+            video_close(vd);
+            return -1;
+        }
+    }
+
+    vd->lost = 0;
+    if(video_enable(vd) < 0) {
+        video_close(vd);
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: change the resolution of a streaming camera without closing it,
+              called by the capture thread between two frames. The driver is
+              asked with VIDIOC_TRY_FMT first and the buffers for the new size
+              are allocated before the stream stops, so a size the camera
+              does not offer or missing memory leave the stream as it was.
+              Only the buffers of the driver are set up again while the
+              stream is off, which takes a frame or two.
+Input Value.: * vd...........: the device, no buffer may be held
+              * width, height: the new resolution, the driver may pick the
+                               closest one it supports
+Return Value: 0 on success, -1 if the stream is unchanged, -2 if it could not
+              be started again
+******************************************************************************/
+int switchResolution(struct vdIn *vd, int width, int height)
+{
+    struct v4l2_format fmt;
+    unsigned char *tmpbuffer = vd->tmpbuffer, *framebuffer = vd->framebuffer;
+    int old_width = vd->width, old_height = vd->height, old_size = vd->framesizeIn;
+    int ret = 0, got_width, got_height;
+
+    fill_format(vd, &fmt, width, height);
+    if(xioctl(vd->fd, VIDIOC_TRY_FMT, &fmt) < 0) {
+        /* drivers may lack VIDIOC_TRY_FMT, VIDIOC_S_FMT tells then */
+        if(errno != ENOTTY) {
+            IPRINT("The camera does not offer %dx%d\n", width, height);
+            return -1;
+        }
+    } else if(format_of(vd, &fmt, &got_width, &got_height) != vd->formatIn) {
+        IPRINT("The camera does not offer %dx%d in its current format\n", width, height);
+        return -1;
+    } else {
+        width = got_width;
+        height = got_height;
+    }
+    if(width == vd->width && height == vd->height)
+        return 0;
+
+    vd->width = width;
+    vd->height = height;
+    /* the frame buffer of NV12 and NV16 depends on the strides */
+    take_layout(vd, &fmt);
+    vd->tmpbuffer = vd->framebuffer = NULL;
+    if(init_framebuffer(vd) < 0) {
+        IPRINT("Can\'t allocate the buffers for %dx%d\n", width, height);
+        ret = -1;
+        goto restore;
+    }
+
+    if(video_disable(vd, STREAMING_PAUSED) < 0) {
+        ret = -1;
+        goto restore;
+    }
+    free_buffers(vd);
+
+    if(xioctl(vd->fd, VIDIOC_S_FMT, &fmt) == 0 && format_of(vd, &fmt, &got_width, &got_height) == vd->formatIn &&
+       got_width == width && got_height == height) {
+        vd->fmt = fmt;
+        take_layout(vd, &fmt);
+        /* without VIDIOC_TRY_FMT the strides of NV12 and NV16 are only known now */
+        if(video_chroma_lines(vd->formatIn, height) > 0) {
+            free_framebuffer(vd);
+            if(init_framebuffer(vd) < 0) {
+                IPRINT("Can\'t allocate the buffers for %dx%d\n", width, height);
+                free(tmpbuffer);
+                free(framebuffer);
+                return -2;
+            }
+        }
+        if(init_buffers(vd) < 0 || video_enable(vd) < 0) {
+            IPRINT("Can\'t start the video again after switching to %dx%d\n", width, height);
+            ret = -2;
+        }
+        free(tmpbuffer);
+        free(framebuffer);
+        DBG("Resolution switched to %dx%d\n", width, height);
+        return ret;
+    }
+
+    /* back to the old format, which the driver took before */
+    IPRINT("Unable to set the resolution %dx%d\n", width, height);
+    ret = (xioctl(vd->fd, VIDIOC_S_FMT, &vd->fmt) < 0 || init_buffers(vd) < 0 || video_enable(vd) < 0) ? -2 : -1;
+
+restore:
+    free_framebuffer(vd);
+    vd->tmpbuffer = tmpbuffer;
+    vd->framebuffer = framebuffer;
+    vd->width = old_width;
+    vd->height = old_height;
+    vd->framesizeIn = old_size;
+    take_layout(vd, &vd->fmt);
+    return ret;
+}
+
 /*
  *
  * Enumarates all V4L2 controls using various methods.
@@ -1013,13 +1995,11 @@ int setResolution(struct vdIn *vd, int width, int height)
  *
  */
 
-void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
+void enumerateV4l2Controls(struct vdIn *vd, globals *pglobal, int id)
 {
     // enumerating v4l2 controls
     struct v4l2_queryctrl ctrl;
     memset(&ctrl, 0, sizeof(struct v4l2_queryctrl));
-    pglobal->in[id].parametercount = 0;
-    pglobal->in[id].in_parameters = malloc(0 * sizeof(control));
     /* Enumerate the v4l2 controls
      Try the extended control API first */
 #ifdef V4L2_CTRL_FLAG_NEXT_CTRL
@@ -1056,6 +2036,22 @@ void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
         }
     }
 
+}
+
+void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
+{
+    pglobal->in[id].parametercount = 0;
+    pglobal->in[id].in_parameters = malloc(0 * sizeof(control));
+
+    /* the descriptions of a known camera come from the capability cache,
+       which is checked against the device in the background then */
+    if(capcache_controls(vd->capcache, vd, pglobal, id) == 0) {
+        capcache_revalidate(vd->capcache);
+    } else {
+        enumerateV4l2Controls(vd, pglobal, id);
+        capcache_save(vd, pglobal, id);
+    }
+
     memset(&pglobal->in[id].jpegcomp, 0, sizeof(struct v4l2_jpegcompression));
     if(xioctl(vd->fd, VIDIOC_G_JPEGCOMP, &pglobal->in[id].jpegcomp) != EINVAL) {
         DBG("JPEG compression details:\n");
@@ -36,12 +36,18 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/eventfd.h>
 
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
 
 #include "../../mjpg_streamer.h"
+/* capture buffers requested by default and at most */
 #define NB_BUFFER 4
+#define MAX_BUFFERS 32
+
+/* upper bound for the size of the DHT segment added by memcpy_picture() */
+#define DHT_SPACE 1024
 
 
 #define IOCTL_RETRY 4
@@ -81,11 +87,20 @@ struct vdIn {
     struct v4l2_capability cap;
     struct v4l2_format fmt;
     struct v4l2_buffer buf;
+    struct v4l2_plane buf_planes[VIDEO_MAX_PLANES]; /* vd->buf.m.planes of multi-planar devices */
     struct v4l2_requestbuffers rb;
-    void *mem[NB_BUFFER];
+    unsigned int buftype;           /* V4L2_BUF_TYPE_VIDEO_CAPTURE or V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE */
+    int mem_planes;                 /* memory planes of a buffer, 2 for NV12M and NV16M */
+    unsigned int stride[2];         /* bytesperline of the luma and of the chroma of NV12 and NV16 */
+    unsigned int sizeimage;         /* of all memory planes of a buffer */
+    void *mem[MAX_BUFFERS];
+    unsigned int mem_length[MAX_BUFFERS];
+    void *mem_chroma[MAX_BUFFERS];  /* the second memory plane, NULL with only one */
+    unsigned int chroma_length[MAX_BUFFERS];
     unsigned char *tmpbuffer;
     unsigned char *framebuffer;
     streaming_state streamingState;
+    int wakeup;                     /* eventfd signalled when streamingState changes */
     int grabmethod;
     int width;
     int height;
@@ -111,10 +126,27 @@ struct vdIn {
     int recordtime;
     uint32_t tmpbytesused;
     struct timeval tmptimestamp;
+    unsigned long long capture_usec; /* kernel capture time of the last frame, 0 if not monotonic */
+    unsigned long long dequeue_usec; /* monotonic_usec() when it was dequeued */
     v4l2_std_id vstd;
     unsigned long frame_period_time; // in ms
     unsigned char soft_framedrop;
     unsigned int dv_timings;
+    int buffer_count;               /* capture buffers to request */
+    int nb_buffers;                 /* capture buffers the driver granted */
+    unsigned int sequence;          /* v4l2_buffer.sequence of the last frame */
+    int have_sequence;              /* sequence is valid */
+    unsigned int lost;              /* frames the driver dropped before the last one */
+    int dmabuf[MAX_BUFFERS];        /* exported capture buffers, -1 if not exported */
+    int hold_buffer;                /* raw frames stay in the capture buffer until uvcRelease() */
+    int held;                       /* vd->buf is dequeued and waits for uvcRelease() */
+    int zerocopy;                   /* MJPEG frames are captured into frames of the frame pool */
+    input_frame *frames[MAX_BUFFERS]; /* the frames queued for capture with zerocopy */
+    input_frame *frame;             /* the frame uvcGrab() captured into, NULL if it was copied */
+    int huffman;                    /* the camera sends huffman tables, -1 until the first frame of a stream */
+    int eoi;                        /* the camera ended a frame of this stream with an EOI marker */
+    const char *capcache_folder;    /* folder of the capability cache, NULL without */
+    struct _capcache *capcache;     /* the cached capabilities of the device, NULL if none */
 };
 
 /* optional initial settings */
@@ -136,31 +168,79 @@ typedef struct {
         cb_set, cb_auto, cb;
 } context_settings;
 
-/* context of each camera thread */
+#define MAX_CAMERAS 16
+
+typedef struct _camera_group camera_group;
+
+/* context of each camera */
 typedef struct {
     int id;
     globals *pglobal;
-    pthread_t threadID;
     pthread_mutex_t controls_mutex;
     struct vdIn *videoIn;
     context_settings *init_settings;
+    camera_group *group;            /* the cameras sharing this capture thread */
+    int quality;                    /* JPEG quality for raw frames */
+    rate_control rate;              /* picks the quality with -kbps or -maxsize */
+    unsigned int every_count;       /* frames dropped since the last one used with -e */
+    jpeg_backend *jpeg;             /* compresses raw frames, NULL for MJPEG cameras */
+    int active;                     /* still served, cleared after unrecoverable errors */
+    int watched;                    /* the device fd in the epoll set, -1 if none */
+    unsigned long long last_frame;  /* monotonic_usec() of the last frame or wakeup */
+    input_frame *previous;          /* the last MJPEG frame published, to drop repeats of it */
+    pthread_cond_t switched;        /* the capture thread took a resolution change, with controls_mutex */
+    int switch_width, switch_height; /* the resolution input_cmd() asks for, 0 while none is pending */
+    int switch_result;              /* 0 if the last change worked, -1 if not */
+    unsigned long long retry_usec;  /* when to open a failed camera again, 0 while it works */
+    int backoff_ms;                 /* wait before the attempt after that one */
+    unsigned long long unwanted_usec; /* since when nobody subscribed, 0 while someone does */
+    unsigned int idle;              /* -idle, seconds without subscribers before it stops, 0 never */
+    int idling;                     /* stopped by -idle until the next subscription */
+    struct _usb_camera *usb;        /* the modes planned with -usbbw, NULL without */
 } context;
 
+/* the cameras of one plugin instance, captured and encoded by one thread */
+struct _camera_group {
+    int count;
+    context *cameras[MAX_CAMERAS];
+    pthread_t threadID;
+    int cancelled;                  /* input_stop() was called for one of them */
+    jpeg_encoder *encoder;          /* compresses frames on several threads, may be NULL */
+    int epfd;                       /* epoll set of the capture thread */
+};
+
 int init_videoIn(struct vdIn *vd, char *device, int width, int height, int fps, int format, int grabmethod, globals *pglobal, int id, v4l2_std_id vstd);
+int enumerateFormats(struct vdIn *vd, globals *pglobal, int id, int format);
 void enumerateControls(struct vdIn *vd, globals *pglobal, int id);
+void enumerateV4l2Controls(struct vdIn *vd, globals *pglobal, int id);
 void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglobal, int id);
+int control_read_value(struct vdIn *vd, control *c);
 int setResolution(struct vdIn *vd, int width, int height);
+int switchResolution(struct vdIn *vd, int width, int height);
+int video_set_mode(struct vdIn *vd, int width, int height, int fps);
 
-int memcpy_picture(unsigned char *out, unsigned char *buf, int size);
+int video_raw_format(int format);
+int video_chroma_lines(int format, int height);
+int memcpy_picture(struct vdIn *vd, unsigned char *out, unsigned char *buf, int size);
+int jpeg_complete(struct vdIn *vd, const unsigned char *buf, int size);
 int uvcGrab(struct vdIn *vd);
+int uvcRelease(struct vdIn *vd);
 int close_v4l2(struct vdIn *vd);
 
 int video_enable(struct vdIn *vd);
+void video_wakeup(struct vdIn *vd);
+void video_close(struct vdIn *vd);
+int video_pause(struct vdIn *vd);
+int video_resume(struct vdIn *vd);
+int video_reopen(struct vdIn *vd);
 int video_set_dv_timings(struct vdIn *vd);
 int video_handle_event(struct vdIn *vd);
 
 int v4l2GetControl(struct vdIn *vd, int control);
 int v4l2SetControl(struct vdIn *vd, int control, int value, int plugin_number, globals *pglobal);
+int v4l2SetControls(struct vdIn *vd, const int *ids, const int *values, int *results, int count,
+                    int plugin_number, globals *pglobal);
+int v4l2RestoreControls(struct vdIn *vd, int plugin_number, globals *pglobal);
 int v4l2UpControl(struct vdIn *vd, int control);
 int v4l2DownControl(struct vdIn *vd, int control);
 int v4l2ToggleControl(struct vdIn *vd, int control);
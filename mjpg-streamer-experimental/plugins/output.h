@@ -20,9 +20,10 @@
 #                                                                              #
 *******************************************************************************/
 
+#include <semaphore.h>
 #include "../mjpg_streamer.h"
 #define OUTPUT_PLUGIN_PREFIX " o: "
-#define OPRINT(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", OUTPUT_PLUGIN_PREFIX); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
+#define OPRINT(...) { static log_site _site = LOG_SITE; log_print(&_site, LOG_INFO, OUTPUT_PLUGIN_PREFIX, __VA_ARGS__); }
 
 /* parameters for output plugin */
 typedef struct _output_parameter output_parameter;
@@ -36,6 +37,15 @@ struct _output_parameter {
 
 
 
+/* statistics of an output plugin for the /metrics of output_http, they stay
+ * zero for plugins which do not keep them */
+typedef struct {
+    unsigned long long frames;      // frames the output is done with
+    unsigned long long bytes;       // bytes of those frames
+    unsigned long long overruns;    // frames skipped because the output fell behind
+    int backlog;                    // frames accepted, but not done with yet
+} output_stats;
+
 /* structure to store variables/functions for output plugin */
 typedef struct _output output;
 struct _output {
@@ -48,9 +58,64 @@ struct _output {
     struct _control *out_parameters;
     int parametercount;
 
+    output_stats stats;
+
     int (*init)(output_parameter *param, int id);
     int (*stop)(int);
     int (*run)(int);
     int (*cmd)(int plugin, unsigned int control_id, unsigned int group, int value, char *value_str);
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*
+ * a consumer of the frames of an input, implemented in frame.c. A
+ * subscription in FRAME_LATEST mode gets the newest frame and skips the ones
+ * published since the last, which suits displays and live streams. In
+ * FRAME_NEXT mode it gets every frame as long as it does not fall behind by
+ * more than INPUT_RING_SIZE frames, which suits recordings. Frames are
+ * referenced, not copied, and skipped ones are counted. A subscription
+ * counts as a consumer of the input until frame_unsubscribe(), an input
+ * without any may stop capturing until the next one subscribes.
+ */
+typedef enum {
+    FRAME_LATEST,
+    FRAME_NEXT
+} frame_mode;
+
+typedef struct _frame_subscription frame_subscription;
+struct _frame_subscription {
+    input *in;
+    frame_mode mode;
+    output_stats *stats;            // gets the skipped frames as overruns, may be NULL
+    unsigned long long seq;         // of the frame handed out last, 0 starts over without skips
+    unsigned long long received;    // frames handed out
+    unsigned long long skipped;     // frames skipped before the last one
+    unsigned long long dropped;     // frames skipped altogether
+    int every;                      // only every n-th frame is due, 0 or 1 for all
 };
 
+void frame_subscribe(frame_subscription *sub, input *in, frame_mode mode, output_stats *stats);
+void frame_unsubscribe(frame_subscription *sub);
+input_frame *frame_next(frame_subscription *sub, int msec);
+
+/*
+ * a consumer waiting for a frame, on the waiters list of its input. Only
+ * the waiters a frame is due for are woken when it is published, one by
+ * one: a consumer still busy with the last frame or skipping frames is not
+ * woken at all. frame_next() and the input_*_frame() functions wait with a
+ * semaphore and get the frame handed over. An event loop arms a waiter of
+ * its own with frame_watch() and gets its eventfd written instead.
+ */
+typedef struct _frame_waiter frame_waiter;
+struct _frame_waiter {
+    frame_waiter *prev, *next;
+    input *in;
+    unsigned long long seq;         // woken by the first frame after this one
+    int queued;                     // on the list of the input
+    int fd;                         // eventfd of frame_watch(), -1 for the semaphore
+    sem_t wake;                     // posted once frame is handed over
+    input_frame *frame;
+};
+
+int frame_watch(frame_waiter *w, input *in, unsigned long long seq, int fd);
+void frame_unwatch(frame_waiter *w);
+
@@ -49,8 +49,49 @@
 static pthread_t worker;
 static globals *pglobal;
 static int fd, delay;
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static int input_number;
+static int step = 0;
+static sharpness_roi roi[MAX_SHARPNESS_ROIS];
+static int roiCount = 0;
+
+/* search for the focus */
+enum {SEARCH_SWEEP, SEARCH_CLIMB};
+enum {PHASE_START, PHASE_COARSE, PHASE_FINE, PHASE_DONE};
+
+#define MAX_SCORERS 8
+#define MAX_PROBES 128
+
+static int searchMode = SEARCH_CLIMB;
+static int settle = 150;                    // ms the lens needs after a move
+static int scorerCount = 2;
+static int focusMin = 0, focusMax = 255;
+static int closedLoop = 0;                  // the input can move the focus
+
+/* a focus position and the score of the first frame taken there */
+typedef struct {
+    int position;
+    input_frame *frame;                     // waiting for a scorer, NULL once taken
+    int done;
+    double score;
+} probe;
+
+static probe probes[MAX_PROBES];
+static int probeCount = 0;
+static int probesTaken = 0;                 // the scorers took the probes before this one
+static int poolStop = 0;
+static pthread_t scorers[MAX_SCORERS];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t score_ready = PTHREAD_COND_INITIALIZER;
+
+typedef struct {
+    int phase;
+    int direction;
+    int step;                               // of the phase, halved by the fine phase
+    int next;                               // position of the next coarse probe
+    int best;
+} search;
 
 /******************************************************************************
 Description.: print a help message
@@ -64,9 +105,291 @@ void help(void)
             " ---------------------------------------------------------------\n" \
             " The following parameters can be passed to this plugin:\n\n" \
             " [-d | --delay ].........: delay after saving pictures in ms\n" \
+            " [-i | --input ].........: read frames from the specified input plugin\n" \
+            " [-r | --roi ]...........: x,y,w,h[:weight] rectangle in percent of the\n" \
+            "                           frame to judge the focus by, up to 8, the scores\n" \
+            "                           are combined by their weights. Without one the\n" \
+            "                           whole frame counts, weighted to the center\n" \
+            " [-s | --step ]..........: step of the coarse search, 1/25 of the focus range\n" \
+            "                           by default, it is refined around its best position\n" \
+            "                           with halved steps\n" \
+            " [-m | --mode ]..........: climb from the last focus until the sharpness falls\n" \
+            "                           or sweep the whole range, climb by default\n" \
+            " [-st | --settle ].......: ms the lens needs to settle after a move, frames\n" \
+            "                           captured earlier are ignored\n" \
+            " [-w | --workers ].......: threads scoring frames while the lens moves on\n" \
             " ---------------------------------------------------------------\n");
 }
 
+/******************************************************************************
+Description.: score a frame by the regions or by the center of the frame
+Input Value.: * f: the frame
+Return Value: the sharpness, negative if the frame could not be parsed
+******************************************************************************/
+static double score_frame(input_frame *f)
+{
+    if(roiCount > 0)
+        return getFrameSharpnessROI(f->buf, f->size, roi, roiCount, NULL);
+    return getFrameSharpnessValue(f->buf, f->size);
+}
+
+/******************************************************************************
+Description.: a scorer thread, it scores the frames of the probes in turn
+Input Value.: unused
+Return Value: NULL
+******************************************************************************/
+static void *scorer_thread(void *arg)
+{
+    input_frame *f;
+    double score;
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    while(!poolStop) {
+        if(probesTaken == probeCount) {
+            pthread_cond_wait(&probe_ready, &pool_lock);
+            continue;
+        }
+
+        i = probesTaken++;
+        f = probes[i].frame;
+        probes[i].frame = NULL;
+        pthread_mutex_unlock(&pool_lock);
+
+        score = score_frame(f);
+        DBG("focus %d has a sharpness of %f\n", probes[i].position, score);
+        frame_unref(f);
+
+        pthread_mutex_lock(&pool_lock);
+        probes[i].score = score;
+        probes[i].done = 1;
+        pthread_cond_broadcast(&score_ready);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: forget the probes of the last search
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void reset_probes(void)
+{
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    for(i = 0; i < probeCount; i++) {
+        frame_unref(probes[i].frame);
+        probes[i].frame = NULL;
+    }
+    probeCount = 0;
+    probesTaken = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void unlock_pool(void *arg)
+{
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/******************************************************************************
+Description.: wait for the scores of the probes before one
+Input Value.: * count: of the probes that must be scored
+Return Value: -
+******************************************************************************/
+static void wait_scores(int count)
+{
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    pthread_cleanup_push(unlock_pool, NULL);
+    for(i = 0; i < count; i++) {
+        while(!probes[i].done)
+            pthread_cond_wait(&score_ready, &pool_lock);
+    }
+    pthread_cleanup_pop(1);
+}
+
+/******************************************************************************
+Description.: find the best scored probe, the caller waited for them
+Input Value.: * count: of the probes to look at
+Return Value: the index of the best probe, -1 if there is none
+******************************************************************************/
+static int best_probe(int count)
+{
+    int i, best = -1;
+
+    for(i = 0; i < count; i++) {
+        if(probes[i].done && (best < 0 || probes[i].score > probes[best].score))
+            best = i;
+    }
+    return best;
+}
+
+/******************************************************************************
+Description.: check if a position was probed in this search already
+Input Value.: * position: the focus position
+Return Value: 1 if so, 0 otherwise
+******************************************************************************/
+static int probed(int position)
+{
+    int i;
+
+    for(i = 0; i < probeCount; i++) {
+        if(probes[i].position == position)
+            return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: plan the next focus position. The coarse phase steps on while
+              the frame of the previous position is being scored, a climb
+              stops once the scores fell twice in a row. The fine phase
+              probes both sides of the best position with halved steps.
+Input Value.: * s: the search
+Return Value: the next position, -1 once the search is done
+******************************************************************************/
+static int next_position(search *s)
+{
+    int i, best, falls, position;
+
+    while(1) {
+        switch(s->phase) {
+        case PHASE_START:
+            s->phase = PHASE_COARSE;
+            if(searchMode == SEARCH_SWEEP) {
+                s->direction = -1;
+                s->next = focusMax;
+            } else {
+                s->direction = (s->best + s->step <= focusMax) ? 1 : -1;
+                s->next = s->best;
+            }
+            break;
+
+        case PHASE_COARSE:
+            if(searchMode == SEARCH_CLIMB && probeCount == 2) {
+                /* the climb goes the other way if the first step got worse */
+                wait_scores(2);
+                if(probes[1].score < probes[0].score) {
+                    s->direction = -s->direction;
+                    s->next = probes[0].position + s->direction * s->step;
+                }
+            } else if(searchMode == SEARCH_CLIMB && probeCount > 2) {
+                /* only the last probe may still be scored */
+                wait_scores(probeCount - 1);
+                best = best_probe(probeCount - 1);
+                for(falls = 0, i = probeCount - 2; i > best && falls < 2; i--)
+                    falls++;
+                if(falls >= 2)
+                    s->next = -1;
+            }
+
+            if(s->next >= focusMin && s->next <= focusMax && probeCount < MAX_PROBES / 2) {
+                position = s->next;
+                s->next += s->direction * s->step;
+                return position;
+            }
+
+            s->phase = PHASE_FINE;
+            s->step /= 2;
+            break;
+
+        case PHASE_FINE:
+            wait_scores(probeCount);
+            if(s->step < 1 || probeCount + 2 > MAX_PROBES) {
+                s->phase = PHASE_DONE;
+                break;
+            }
+
+            /* both sides of the best position are probed before the step halves */
+            best = probes[best_probe(probeCount)].position;
+            position = MAX(best - s->step, focusMin);
+            if(!probed(position))
+                return position;
+            position = MIN(best + s->step, focusMax);
+            if(!probed(position))
+                return position;
+            s->step /= 2;
+            break;
+
+        default:
+            wait_scores(probeCount);
+            if((best = best_probe(probeCount)) >= 0)
+                s->best = probes[best].position;
+            return -1;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: move the lens of the input
+Input Value.: * position: the focus position
+Return Value: 0 if ok, -1 if the input could not move it
+******************************************************************************/
+static int set_focus(int position)
+{
+    input *in = &pglobal->in[input_number];
+
+    /* the input may have been removed while the program runs */
+    if(!closedLoop || in->handle == NULL)
+        return -1;
+    if(in->cmd(input_number, V4L2_CID_FOCUS_ABSOLUTE, IN_CMD_V4L2, position, NULL) != 0) {
+        OPRINT("the input could not move the focus, only the sharpness is reported\n");
+        closedLoop = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: look up the focus control of the input and switch off its
+              own autofocus, the search needs to move the lens itself
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void find_focus_control(void)
+{
+    input *in = &pglobal->in[input_number];
+    int i;
+
+    closedLoop = 0;
+    if(in->cmd == NULL)
+        return;
+
+    for(i = 0; i < in->parametercount; i++) {
+        if(in->in_parameters[i].ctrl.id == V4L2_CID_FOCUS_AUTO)
+            in->cmd(input_number, V4L2_CID_FOCUS_AUTO, IN_CMD_V4L2, 0, NULL);
+        if(in->in_parameters[i].ctrl.id == V4L2_CID_FOCUS_ABSOLUTE) {
+            focusMin = in->in_parameters[i].ctrl.minimum;
+            focusMax = in->in_parameters[i].ctrl.maximum;
+            closedLoop = focusMax > focusMin;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: wait for a frame the input captured after the lens settled
+Input Value.: * sub..: subscription to the frames of the input
+              * moved: monotonic_usec() of the move
+Return Value: referenced frame
+******************************************************************************/
+static input_frame *wait_settled_frame(frame_subscription *sub, unsigned long long moved)
+{
+    unsigned long long captured;
+    input_frame *f;
+
+    while(1) {
+        f = frame_next(sub, -1);
+        captured = f->capture_usec ? f->capture_usec : f->publish_usec;
+        if(captured >= moved + 1000ULL * settle)
+            return f;
+        frame_unref(f);
+    }
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -75,6 +398,7 @@ Return Value: -
 void worker_cleanup(void *arg)
 {
     static unsigned char first_run = 1;
+    int i;
 
     if(!first_run) {
         DBG("already cleaned up resources\n");
@@ -84,80 +408,114 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    free(frame);
+    pthread_mutex_lock(&pool_lock);
+    poolStop = 1;
+    pthread_cond_broadcast(&probe_ready);
+    pthread_mutex_unlock(&pool_lock);
+    for(i = 0; i < scorerCount; i++)
+        pthread_join(scorers[i], NULL);
+    reset_probes();
+
+    frame_unref(frame);
+    frame = NULL;
     close(fd);
 }
 
-
-
 /******************************************************************************
 Description.: this is the main worker thread
-              it loops forever, grabs a fresh frame and calculates focus
+              it searches the focus, each position the lens moves to is
+              judged by the first frame captured after the lens settled.
+              While a scorer judges that frame the lens already moves on.
+              Once the focus is found the sharpness is watched, the search
+              starts again if it changes too much.
 Input Value.:
 Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int frame_size = 0;
+    unsigned long long started = 0, moved;
     double sv = -1.0, max_sv = 100.0, delta = 500;
-    int focus = 255, step = 10, max_focus = 100, search_focus = 1;
-
-    if((frame = malloc(256 * 1024)) == NULL) {
-        OPRINT("not enough memory for worker thread\n");
-        exit(EXIT_FAILURE);
-    }
+    int position, search_focus = 1;
+    frame_subscription sub;
+    search s;
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
-    while(!pglobal->stop) {
-        DBG("waiting for fresh frame\n");
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+    find_focus_control();
+    if(step <= 0)
+        step = MAX((focusMax - focusMin) / 25, 1);
+    if(!closedLoop)
+        OPRINT("the input has no focus control, only the sharpness is reported\n");
+    OPRINT("focus range.......: %d..%d step %d\n", focusMin, focusMax, step);
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+    /* frames moving the lens or waiting for the delay are skipped on purpose */
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, NULL);
+    s.best = (focusMin + focusMax) / 2;
 
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+    while(!pglobal->stop) {
+        if(search_focus && closedLoop) {
+            if(started == 0) {
+                DBG("starting to search for focus from %d\n", s.best);
+                reset_probes();
+                s.phase = PHASE_START;
+                s.step = step;
+                started = monotonic_usec();
+            }
 
-        /* process frame */
-        sv = getFrameSharpnessValue(frame, frame_size);
-        DBG("sharpness is: %f\n", sv);
+            if((position = next_position(&s)) >= 0) {
+                DBG("moving the focus to: %d\n", position);
+                if(set_focus(position) < 0)
+                    continue;
+                moved = monotonic_usec();
+
+                /* the frame goes to the scorers, the lens moves on meanwhile */
+                frame_unref(frame);
+                frame = wait_settled_frame(&sub, moved);
+                pthread_mutex_lock(&pool_lock);
+                probes[probeCount].position = position;
+                probes[probeCount].frame = frame;
+                probes[probeCount].done = 0;
+                probeCount++;
+                pthread_cond_signal(&probe_ready);
+                pthread_mutex_unlock(&pool_lock);
+                frame = NULL;
+                continue;
+            }
 
-        if(search_focus || (ABS(sv - max_sv) > delta)) {
-            DBG("adjusting focus: %d\n", focus);
+            OPRINT("focus found at %d after %d positions in %llu ms\n", s.best, probeCount, (monotonic_usec() - started) / 1000);
+            search_focus = 0;
+            started = 0;
 
-            /* entered because focus changed */
-            if(!search_focus) {
-                DBG("starting to search for focus\n");
-                max_focus    = 255;
-                focus        = 255;
-                max_sv       = -1.0;
-                search_focus = 1;
+            /* the sharpness is watched from the first frame back at the best position */
+            if(set_focus(s.best) == 0) {
+                moved = monotonic_usec();
+                frame_unref(frame);
+                frame = wait_settled_frame(&sub, moved);
+                max_sv = score_frame(frame);
             }
+            continue;
+        }
 
-            if(focus <= 0) {
-                focus = max_focus;
-                DBG("max focus found at: %d\n", max_focus);
-                search_focus = 0;
-            }
+        DBG("waiting for fresh frame\n");
+        /* release the previous frame and take a reference to a fresh one */
+        frame_unref(frame);
+        frame = NULL;
+        frame = frame_next(&sub, -1);
 
-            if(search_focus) {
-                if(sv > max_sv) {
-                    /* sharpness is better then max now */
-                    DBG("found better focus at: %d\n", focus);
-                    max_focus = focus;
-                    max_sv = sv;
-                }
+        /* process frame */
+        sv = score_frame(frame);
+        DBG("sharpness is: %f\n", sv);
 
-                focus = MIN(MAX(focus - step, 0), 255);
-                DBG("decrement focus now to: %d\n", focus);
-                //focus = pglobal->in.cmd(IN_CMD_FOCUS_SET, focus);
-            }
+        if(!closedLoop) {
+            max_sv = sv;
+        } else if(ABS(sv - max_sv) > delta) {
+            DBG("the sharpness changed from %f to %f\n", max_sv, sv);
+            search_focus = 1;
+            continue;
         }
 
-        if((delay > 0) && !search_focus) {
+        if(delay > 0) {
             usleep(1000 * delay);
         }
     }
@@ -198,6 +556,16 @@ int output_init(output_parameter *param)
             {"delay", required_argument, 0, 0},
             {"i", required_argument, 0, 0},
             {"input", required_argument, 0, 0},
+            {"r", required_argument, 0, 0},
+            {"roi", required_argument, 0, 0},
+            {"s", required_argument, 0, 0},
+            {"step", required_argument, 0, 0},
+            {"m", required_argument, 0, 0},
+            {"mode", required_argument, 0, 0},
+            {"st", required_argument, 0, 0},
+            {"settle", required_argument, 0, 0},
+            {"w", required_argument, 0, 0},
+            {"workers", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -232,12 +600,64 @@ int output_init(output_parameter *param)
         case 5:
             input_number = atoi(optarg);
             break;
+            /* r, roi */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            if(roiCount == MAX_SHARPNESS_ROIS) {
+                OPRINT("ERROR: only %d regions are supported\n", MAX_SHARPNESS_ROIS);
+                return 1;
+            }
+            roi[roiCount].weight = 1.0;
+            if(sscanf(optarg, "%d,%d,%d,%d:%lf", &roi[roiCount].x, &roi[roiCount].y,
+                      &roi[roiCount].width, &roi[roiCount].height, &roi[roiCount].weight) < 4 ||
+               roi[roiCount].width <= 0 || roi[roiCount].height <= 0 || roi[roiCount].weight < 0.0) {
+                OPRINT("ERROR: a region is given as x,y,w,h[:weight] in percent\n");
+                return 1;
+            }
+            roiCount++;
+            break;
+            /* s, step */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            step = MAX(atoi(optarg), 1);
+            break;
+            /* m, mode */
+        case 10:
+        case 11:
+            DBG("case 10,11\n");
+            if(strcmp(optarg, "sweep") == 0) {
+                searchMode = SEARCH_SWEEP;
+            } else if(strcmp(optarg, "climb") == 0) {
+                searchMode = SEARCH_CLIMB;
+            } else {
+                OPRINT("ERROR: the mode is sweep or climb\n");
+                return 1;
+            }
+            break;
+            /* st, settle */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            settle = MAX(atoi(optarg), 0);
+            break;
+            /* w, workers */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            scorerCount = MIN(MAX(atoi(optarg), 1), MAX_SCORERS);
+            break;
         }
     }
 
     pglobal = param->global;
 
     OPRINT("delay.............: %d\n", delay);
+    OPRINT("search............: %s, settle %d ms, %d scorers\n", searchMode == SEARCH_SWEEP ? "sweep" : "climb", settle, scorerCount);
+    for(i = 0; i < roiCount; i++) {
+        OPRINT("region............: %d,%d %dx%d%% weight %.2f\n", roi[i].x, roi[i].y, roi[i].width, roi[i].height, roi[i].weight);
+    }
     return 0;
 }
 
@@ -260,7 +680,16 @@ Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
+    int i;
+
     DBG("launching worker thread\n");
+    for(i = 0; i < scorerCount; i++) {
+        if(pthread_create(&scorers[i], NULL, scorer_thread, NULL) != 0) {
+            OPRINT("could not start a scorer\n");
+            scorerCount = i;
+            break;
+        }
+    }
     pthread_create(&worker, 0, worker_thread, NULL);
     pthread_detach(worker);
     return 0;
@@ -22,307 +22,420 @@
 *******************************************************************************/
 
 #include <stdio.h>
-#include <assert.h>
-#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <stdlib.h>
 
+#include "../../huffman.h"
 #include "processJPEG_onlyCenter.h"
 
-double getFrameSharpnessValue(unsigned char *data, int len)
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+/* the sharpness only looks at the first AC coefficients in zigzag order */
+#define SHARPNESS_COEFFICIENTS 20
+
+/* the nonzero coefficients of a block that count for the sharpness */
+typedef struct {
+    int count;
+    unsigned char index[SHARPNESS_COEFFICIENTS];
+    float value[SHARPNESS_COEFFICIENTS];
+} coefficients;
+
+/* an interleaved baseline scan */
+typedef struct {
+    int width, height;
+    int components;
+    int scaleH[3], scaleV[3];
+    int Hmax, Vmax;
+    int mcux, mcuy;                         // MCUs per row and column
+    int restart_interval;                   // MCUs, 0 without restart markers
+    float QT[64];                           // of the luma
+    const huffman_table *dc[3], *ac[3];
+    const unsigned char *data;              // entropy coded data
+    const unsigned char *end;
+} jpeg_scan;
+
+/*
+ * cameras send the same DHT with every frame, the tables are only built
+ * again when a definition changes. 0 and 2 are DC tables, 1 and 3 AC tables.
+ * Each thread scoring frames keeps its own.
+ */
+static __thread huffman_table tables[4];
+
+/******************************************************************************
+Description.: decode a block, the first AC coefficients are dequantized
+Input Value.: * reader.: the bit reader
+              * dc, ac.: huffman tables of the component
+              * lastDC.: DC predictor of the component
+              * QT.....: quantization table, NULL to only skip the block
+              * block..: gets the nonzero coefficients up to SHARPNESS_COEFFICIENTS
+Return Value: 0 if ok, -1 on broken data
+******************************************************************************/
+static int decode_block(bit_reader *reader, const huffman_table *dc, const huffman_table *ac, int *lastDC,
+                        const float *QT, coefficients *block)
 {
-    int Gpos = 0;
-    char c; unsigned short int cnt; int i;
-    int cnt2 = 0;
-    unsigned char uc;
-    assert(sizeof(cnt) == 2);
-    assert(sizeof(int) == 4);
-    unsigned char *buffer;
-    double sumAC[64];
-    double sumSqrAC[64];
-
-    int width = -1; int height = -1;
-    int huffman_DCY = -1; int huffman_ACY = -1;
-    int quant_Y = -1;
-    int scaleH_Y = 0; int scaleV_Y = 0;
-
-    unsigned char dht_lookup_bitlen[4][162];
-    unsigned int dht_lookup_bits[4][162];
-    unsigned int dht_lookup_mask[4][162];
-    unsigned char dht_lookup_code[4][162];
-    unsigned char dht_lookup_size[4];
-
-    float *QT[4] = { NULL, NULL, NULL, NULL };
-
-    unsigned int mask[17] = { 0x00000000, 0x00000001, 0x00000003, 0x00000007, 0x0000000f, 0x0000001f, 0x0000003f, 0x0000007f, 0x000000ff, 0x000001ff, 0x000003ff, 0x000007ff, 0x00000fff, 0x00001fff, 0x00003fff, 0x00007fff, 0x0000ffff };
-
-    char fgetc_(void) {
-        return data[Gpos++];
+    int k, size, symbol, value;
+
+    block->count = 0;
+
+    huffman_fill(reader);
+    if((size = huffman_decode(reader, dc)) < 0 || size > 16)
+        return -1;
+    if(size > 0) {
+        huffman_fill(reader);
+        value = huffman_get_bits(reader, size);
+        *lastDC += HUFF_EXTEND(value, size);
     }
 
-    while(!(Gpos >= len)) {
-        c = fgetc_();
-        while(c != '\xff') {
-            c = fgetc_();
-        }
-        c = fgetc_();
-        if(c == '\xd8' || c == '\xe0' || c == '\x00') {
+    for(k = 1; k < 64; k++) {
+        huffman_fill(reader);
+        if((symbol = huffman_decode(reader, ac)) < 0)
+            return -1;
+
+        size = symbol & 0x0f;
+        if(size == 0) {
+            if(symbol != 0xf0)
+                break;              /* end of block */
+            k += 15;
             continue;
-        } else if(c == '\xdb') { // read in quantization table
-            c = fgetc_(); cnt = (unsigned char)(c) * 256;
-            c = fgetc_(); cnt += (unsigned char)(c);
-            assert(cnt == 67);
-            uc = fgetc_(); if((uc >> 4) != 0) {
-                fprintf(stderr, "16bit quantization table not supported\n");
-                exit(-1);
-            }
-            int tab = uc & 0x0f;
-            QT[tab] = (float *)malloc(64 * sizeof(float));
-            unsigned char hc = 0; int j;
-            for(j = 0; j < 64; j++) {
-                uc = fgetc_(); QT[tab][j] = (float)uc;
-                hc ^= uc;
-            }
-        } else if(c == '\xc4') { // read in huffmann table
-            // 0 and 2 are DC tables (0-15), 1 and 3 are AC tables (0-255)
-            c = fgetc_(); cnt = (unsigned char)(c) * 256;
-            c = fgetc_(); cnt += (unsigned char)(c);
-            buffer = data + Gpos; Gpos += cnt - 2;
-
-            // parse huffman table...
-            int pos = 0; unsigned short int tab = 0;
-            do {
-                uc = buffer[pos]; pos++;
-                tab = (uc >> 4) + (uc & 0x0f) * 2;
-                tab = (uc & 0x0f) * 2 + (uc >> 4);
-                int pos2 = pos + 16;
-                unsigned char DhtCodesLen[16];
-                int i_len; int table_ind = 0;
-                int code_val = 0; int ind_code;
-                for(i_len = 1; i_len <= 16; i_len++) {
-                    DhtCodesLen[i_len-1] = (unsigned char)(buffer[pos+i_len-1]);
-                    for(ind_code = 0; ind_code < DhtCodesLen[i_len-1]; ind_code++) {
-                        dht_lookup_code[tab][table_ind] = buffer[pos2++];
-                        dht_lookup_bits[tab][table_ind] = (code_val << (32 - i_len));
-                        dht_lookup_mask[tab][table_ind] = ((1 << (i_len)) - 1) << (32 - i_len);
-                        dht_lookup_bitlen[tab][table_ind] = i_len;
-
-                        table_ind++; code_val++;
-                    }
-                    code_val <<= 1;
-                }
-                dht_lookup_size[tab] = table_ind;
-                pos = pos2;
-            } while(pos < cnt - 2);
-        } else if(c == '\xda') { // start frame, followed by entropy-coded data
-            c = fgetc_(); assert(c == '\x00');
-            c = fgetc_(); assert(c == '\x0c'); // length: 12
-            c = fgetc_(); assert(c == '\x03'); // three components
-            for(i = 0; i < 3; i++) {
-                int comp_id;
-                c = fgetc_(); comp_id = c;
-                c = fgetc_();
-                if(comp_id == 1) { // Y
-                    huffman_DCY = (unsigned)(c) >> 4;
-                    huffman_ACY = (unsigned)(c) & 0x0f;
-                }
-            }
-            // Y: 0/0, Cb & Cr: 1/1
-            c = fgetc_(); c = fgetc_(); c = fgetc_(); // skip three bytes
-
-            int data; uc = fgetc_(); int bitlen = 16; int bits_used = 0;
-            data = uc << 24; uc = fgetc_(); data |= uc << 16;
-
-            // read one XC coefficient from any table via huffmann code
-            int readXC(int tab) {
-                while(bitlen < 16) {
-                    uc = fgetc_();
-                    data = data | (uc << (24 - bitlen));
-                    bitlen += 8;
-                    if(((char)uc) == '\xff') {
-                        uc = fgetc_();
-                        if(((char)uc) == '\x00') {
-                            uc = fgetc_();
-                        }
-                        data = data | (uc << (24 - bitlen));
-                        bitlen += 8;
-                    }
-                }
-                int ind = 0; int done = 0; int res = -1;
-                while(done == 0) {
-                    if((data & dht_lookup_mask[tab][ind]) == dht_lookup_bits[tab][ind]) {
-                        res = dht_lookup_code[tab][ind];
-                        bits_used = dht_lookup_bitlen[tab][ind];
-                        done = 1;
-                    }
-                    ind++;
+        }
+        k += symbol >> 4;
+        if(k > 63)
+            return -1;
+        value = huffman_get_bits(reader, size);
+        value = HUFF_EXTEND(value, size);
 
-                    if(ind >= dht_lookup_size[tab]) {
-                        /*fprintf(stderr,"Code not found in huffmann table.\n");*/ return -1;
-                    }
-                }
-                data = data << bits_used; bitlen -= bits_used;
-                while(bitlen < 16) {
-                    uc = fgetc_();
-                    data = data | (uc << (24 - bitlen));
-                    bitlen += 8;
-                    if(((char)uc) == '\xff') {
-                        uc = fgetc_();
-                        if(((char)uc) == '\x00') {
-                            uc = fgetc_();
-                        }
-                        data = data | (uc << (24 - bitlen));
-                        bitlen += 8;
-                    }
-                }
-                return res;
-            }
+        /* zeros add nothing to the sums */
+        if(QT == NULL || k > SHARPNESS_COEFFICIENTS)
+            continue;
+        block->index[block->count] = k;
+        block->value[block->count] = value * QT[k];
+        block->count++;
+    }
 
-            int readTable(int tabDC, int tabAC, int * lastDC, int * table) {
-                int j;
-                for(j = 0; j < 64; j++) {
-                    table[j] = 0;
-                }
-                int size_val = readXC(tabDC); if(size_val < 0) {
-                    return -1;
-                }
-                int DC = (data >> (32 - size_val)) & mask[size_val]; data <<= size_val; bitlen -= size_val; // true value is next size_val bits
-                DC = HUFF_EXTEND(DC, size_val); DC += *lastDC; *lastDC = DC;
-                table[0] = DC;
-                j = 0; int EOB = 0;
-                while(j < 63 && (EOB == 0)) {
-                    int comb = readXC(tabAC); if(comb < 0) {
-                        return -1;
-                    }
-                    int val = comb & 0x0f;
-                    int repeat = comb >> 4;
-                    if(val == 0) {
-                        if(repeat == 0x0f) {
-                            j += 16;
-                        } else {
-                            EOB = 1;
-                        }
-                    } else {
-                        j += repeat;
-                        DC = (data >> (32 - val)) & mask[val]; data <<= val; bitlen -= val;
-                        DC = HUFF_EXTEND(DC, val); table[j+1] = DC; j++;
-                    }
-                }
-                if(j <= 63) {
-                    return 0;
-                } else {
-                    /*fprintf(stderr,"ERROR: too many AC entries: %d\n",j);*/ return -1;
-                }
-            }
+    return 0;
+}
 
-            cnt = ((int)(width / 8 / scaleH_Y + 0.5)) * ((int)(height / 8 / scaleV_Y + 0.5));
+/******************************************************************************
+Description.: read the tables and the frame header up to the entropy coded
+              data of an interleaved baseline scan
+Input Value.: * data, len: the JPEG
+              * scan.....: gets the layout of the scan
+Return Value: 0 if ok, -1 if the JPEG is broken or not supported
+******************************************************************************/
+static int parse_jpeg(const unsigned char *data, int len, jpeg_scan *scan)
+{
+    const unsigned char *p = data, *end = data + len, *segment = NULL;
+    unsigned char marker;
+    int length = 0, i, j, n, tab;
+    int component_id[4] = { 0, 0, 0, 0 }, quant[4] = { 0, 0, 0, 0 };
 
-            int ctx = (int)(width / 8 + 0.5); int cty = (int)(height / 8 + 0.5);
-            ctx /= 2; cty /= 2; int rad = ctx / 2; if(cty < ctx) {
-                rad = cty / 2;
-            }
-            rad = rad * rad;
-            int xp = 0; int yp = 0;
+    float QT[4][64];
+    int has_QT[4] = { 0, 0, 0, 0 };
 
-            int lastDCY = 0; int lastDCCr = 0; int lastDCCb = 0;
-            int j; for(j = 0; j < 64; j++) {
-                sumAC[j] = 0.0;
-                sumSqrAC[j] = 0.0;
-            }
-            for(i = 0; i < cnt; i++) {
-                int table[128];
+    memset(scan, 0, sizeof(*scan));
+    scan->Hmax = scan->Vmax = 1;
 
-                if(readTable(huffman_DCY, huffman_ACY + 1, &lastDCY, table) < 0) {
-                    goto err;
-                }
+    if(len < 4 || p[0] != 0xff || p[1] != 0xd8)
+        return -1;
+    p += 2;
 
-                // weight by distance to center (gaussian?)
-                double xp_ = xp - ctx; double yp_ = yp - ctx;
-                double weight = exp(-(xp_ * xp_) / rad - (yp_ * yp_) / rad);
-                for(j = 0; j < 64; j++) {
-                    double x = (table[j] * QT[0][j]) * (table[j] * QT[0][j]) * weight;
-                    sumAC[j] += x;
-                    sumSqrAC[j] += x * x;
-                }
-                cnt2++;
-                xp++;
-                if(readTable(huffman_DCY, huffman_ACY + 1, &lastDCY, table) < 0) {
-                    goto err;
-                }
-                xp_ = xp - ctx; yp_ = yp - ctx;
-                weight = exp(-(xp_ * xp_) / rad - (yp_ * yp_) / rad);
-                for(j = 0; j < 64; j++) {
-                    double x = (table[j] * QT[0][j]) * (table[j] * QT[0][j]) * weight;
-                    sumAC[j] += x;
-                    sumSqrAC[j] += x * x;
-                }
-                cnt2++;
+    /* walk the segments up to the scan */
+    while(1) {
+        while(p < end && *p != 0xff)
+            p++;
+        while(p < end && *p == 0xff)
+            p++;
+        if(p + 2 >= end)
+            return -1;
+        marker = *p++;
+        if(marker == 0xd8 || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+            continue;
+        if(marker == 0xd9)
+            return -1;
 
-                // ignore  C components
-                if(readTable(2, 3, &lastDCCr, table) < 0) {
-                    goto err;
-                }
-                if(readTable(2, 3, &lastDCCb, table) < 0) {
-                    goto err;
-                }
+        length = (p[0] << 8) | p[1];
+        if(length < 2 || p + length > end)
+            return -1;
+        segment = p + 2;
+        length -= 2;
+        p += length + 2;
 
-                xp++; if(xp == (int)(width / 8 + 0.5)) {
-                    xp = 0;
-                    yp++;
+        if(marker == 0xdb) { // read in quantization tables
+            for(i = 0; i + 65 <= length; i += 65) {
+                if((segment[i] >> 4) != 0) {
+                    fprintf(stderr, "16bit quantization table not supported\n");
+                    return -1;
                 }
+                tab = segment[i] & 0x03;
+                for(j = 0; j < 64; j++)
+                    QT[tab][j] = (float)segment[i + 1 + j];
+                has_QT[tab] = 1;
             }
-        } else if(c == '\xd9') { // end of file
-        } else if(c == '\xc0') { // start of frame
-            c = fgetc_(); cnt = (unsigned char)(c) * 256;
-            c = fgetc_(); cnt += (unsigned char)(c);
-
-            uc = fgetc_();
-            c = fgetc_(); cnt = (unsigned char)(c) * 256;
-            c = fgetc_(); cnt += (unsigned char)(c);
-            height = cnt;
-            c = fgetc_(); cnt = (unsigned char)(c) * 256;
-            c = fgetc_(); cnt += (unsigned char)(c);
-            width = cnt;
-            uc = fgetc_();
-            assert((int)uc == 3);
-
-            int j;
-            for(j = 0; j < uc; j++) {
-                c = fgetc_(); int id = (unsigned)c;
-                c = fgetc_();
-                if(c != '\x11') {
-                    if(id == 1) {
-                        scaleH_Y = ((unsigned)c) >> 4;
-                        scaleV_Y = ((unsigned)c) & 0x0f;
-                    } else {
-                        fprintf(stderr, "Sampling > 1 not supported for non-Y channels.\n");
-                        exit(-2);
-                    }
-                }
-                c = fgetc_();
-                if(id == 1) {
-                    quant_Y = (unsigned)c;
-                }
+        } else if(marker == 0xc4) { // read in huffman tables
+            for(i = 0; i < length; i += n + 1) {
+                tab = (segment[i] & 0x0f) * 2 + (segment[i] >> 4);
+                if(tab > 3 || (n = huffman_build_table(&tables[tab], segment + i + 1, length - i - 1)) < 0)
+                    return -1;
+            }
+        } else if(marker == 0xdd) { // restart interval
+            if(length < 2)
+                return -1;
+            scan->restart_interval = (segment[0] << 8) | segment[1];
+        } else if(marker == 0xc0 || marker == 0xc1) { // start of frame, huffman coded
+            if(length < 6)
+                return -1;
+            scan->height = (segment[1] << 8) | segment[2];
+            scan->width = (segment[3] << 8) | segment[4];
+            scan->components = segment[5];
+            if(scan->components != 3 || length < 6 + 3 * scan->components)
+                return -1;
+            for(i = 0; i < scan->components; i++) {
+                component_id[i] = segment[6 + 3 * i];
+                scan->scaleH[i] = segment[7 + 3 * i] >> 4;
+                scan->scaleV[i] = segment[7 + 3 * i] & 0x0f;
+                quant[i] = segment[8 + 3 * i] & 0x03;
+                if(scan->scaleH[i] < 1 || scan->scaleH[i] > 4 || scan->scaleV[i] < 1 || scan->scaleV[i] > 4)
+                    return -1;
+                scan->Hmax = MAX(scan->Hmax, scan->scaleH[i]);
+                scan->Vmax = MAX(scan->Vmax, scan->scaleV[i]);
+            }
+            if(scan->scaleH[1] != 1 || scan->scaleV[1] != 1 || scan->scaleH[2] != 1 || scan->scaleV[2] != 1) {
+                fprintf(stderr, "Sampling > 1 not supported for non-Y channels.\n");
+                return -1;
             }
-        } else {
+        } else if(marker >= 0xc2 && marker <= 0xcf && marker != 0xc8) {
+            return -1;              /* progressive or arithmetic coding */
+        } else if(marker == 0xda) { // start of scan, followed by entropy-coded data
+            break;
         }
     }
+
+    /* the scan must be interleaved, with the luma first */
+    if(scan->width <= 0 || scan->height <= 0 || length < 1 + 2 * scan->components ||
+       segment[0] != scan->components || !has_QT[quant[0]])
+        return -1;
+
+    for(i = 0; i < scan->components; i++) {
+        if(segment[1 + 2 * i] != component_id[i])
+            return -1;
+        scan->dc[i] = &tables[(segment[2 + 2 * i] >> 4) * 2 & 3];
+        scan->ac[i] = &tables[((segment[2 + 2 * i] & 0x0f) * 2 + 1) & 3];
+        if(scan->dc[i]->length == 0 || scan->ac[i]->length == 0)
+            return -1;
+    }
+
+    memcpy(scan->QT, QT[quant[0]], sizeof(scan->QT));
+    scan->mcux = (scan->width + 8 * scan->Hmax - 1) / (8 * scan->Hmax);
+    scan->mcuy = (scan->height + 8 * scan->Vmax - 1) / (8 * scan->Vmax);
+    scan->data = p;
+    scan->end = end;
+    return 0;
+}
+
+/******************************************************************************
+Description.: the sharpness of the sums, low frequencies weigh less
+Input Value.: * sumAC.: sums of the squared coefficients
+              * blocks: that went into the sums
+Return Value: the sharpness
+******************************************************************************/
+static double weighted_sum(double *sumAC, int blocks)
+{
     int j; int lenCurSeq = 2; int lenPrevTotal = 1; int valCurSeq = 1;
     double sum = 0.0;
-    for(j = 0; j < 4; j++) {
-        free(QT[j]);
-    }
-    for(j = 1; j < 21; j++) {
+
+    if(blocks == 0)
+        return 0.0;
+
+    for(j = 1; j <= SHARPNESS_COEFFICIENTS; j++) {
         if(j >= lenPrevTotal + lenCurSeq) {
             lenCurSeq++;
             lenPrevTotal = j;
             valCurSeq++;
         }
-        sumAC[j] /= (double)(cnt2);
+        sumAC[j] /= (double)(blocks);
         sum += (double)valCurSeq * sumAC[j];
     }
     return sum;
+}
+
+double getFrameSharpnessValue(unsigned char *data, int len)
+{
+    jpeg_scan scan;
+    coefficients block;
+    double sumAC[64], weight, xp_, yp_;
+    int i, j, cnt2 = 0;
+
+    if(parse_jpeg(data, len, &scan) < 0)
+        return -1.0;
+
+    int ctx = (int)(scan.width / 8 + 0.5); int cty = (int)(scan.height / 8 + 0.5);
+    ctx /= 2; cty /= 2; int rad = ctx / 2; if(cty < ctx) {
+        rad = cty / 2;
+    }
+    rad = rad * rad;
+
+    int lastDC[3] = { 0, 0, 0 };
+    bit_reader reader = { scan.data, scan.end, 0, 0 };
+    int mcu, bx, by, xp, yp;
+
+    memset(sumAC, 0, sizeof(sumAC));
+    for(mcu = 0; mcu < scan.mcux * scan.mcuy; mcu++) {
+        if(scan.restart_interval > 0 && mcu > 0 && mcu % scan.restart_interval == 0) {
+            if(huffman_restart(&reader, scan.end) < 0)
+                return -1.0;
+            memset(lastDC, 0, sizeof(lastDC));
+        }
+
+        for(by = 0; by < scan.scaleV[0]; by++) {
+            for(bx = 0; bx < scan.scaleH[0]; bx++) {
+                if(decode_block(&reader, scan.dc[0], scan.ac[0], &lastDC[0], scan.QT, &block) < 0)
+                    return -1.0;
+                cnt2++;
+                if(block.count == 0)
+                    continue;
+
+                // weight by distance to center (gaussian?)
+                xp = mcu % scan.mcux * scan.scaleH[0] + bx;
+                yp = mcu / scan.mcux * scan.scaleV[0] + by;
+                xp_ = xp - ctx; yp_ = yp - ctx;
+                weight = exp(-(xp_ * xp_) / rad - (yp_ * yp_) / rad);
+                for(j = 0; j < block.count; j++)
+                    sumAC[block.index[j]] += (block.value[j] * block.value[j]) * weight;
+            }
+        }
+
+        // ignore  C components
+        for(i = 1; i < scan.components; i++) {
+            if(decode_block(&reader, scan.dc[i], scan.ac[i], &lastDC[i], NULL, &block) < 0)
+                return -1.0;
+        }
+    }
+
+    return weighted_sum(sumAC, cnt2);
+}
+
+/* a region in blocks of the luma and the MCUs it touches */
+typedef struct {
+    int x0, y0, x1, y1;
+    int first, last;
+    double sumAC[SHARPNESS_COEFFICIENTS + 1];
+    int blocks;
+} region;
+
+/******************************************************************************
+Description.: check if the MCUs of an interval touch a region
+Input Value.: * scan.........: the layout of the scan
+              * regions, count: the regions
+              * from, to.....: first and last MCU of the interval
+Return Value: 1 if a block of the interval is in a region, 0 otherwise
+******************************************************************************/
+static int interval_needed(const jpeg_scan *scan, const region *regions, int count, int from, int to)
+{
+    int i, row, x0, x1;
+
+    for(i = 0; i < count; i++) {
+        if(to < regions[i].first || from > regions[i].last)
+            continue;
+        for(row = from / scan->mcux; row <= to / scan->mcux; row++) {
+            if(row < regions[i].y0 / scan->scaleV[0] || row > (regions[i].y1 - 1) / scan->scaleV[0])
+                continue;
+            x0 = (row == from / scan->mcux) ? from % scan->mcux : 0;
+            x1 = (row == to / scan->mcux) ? to % scan->mcux : scan->mcux - 1;
+            if(x1 >= regions[i].x0 / scan->scaleH[0] && x0 <= (regions[i].x1 - 1) / scan->scaleH[0])
+                return 1;
+        }
+    }
+    return 0;
+}
+
+double getFrameSharpnessROI(unsigned char *data, int len, const sharpness_roi *roi, int count, double *scores)
+{
+    jpeg_scan scan;
+    coefficients block;
+    region regions[MAX_SHARPNESS_ROIS];
+    double sum = 0.0, weights = 0.0, score;
+    int blocksx, blocksy, first, last, interval, lastDC[3] = { 0, 0, 0 };
+    int i, j, r, mcu, bx, by, xp, yp;
+    bit_reader reader;
+
+    if(count < 1 || count > MAX_SHARPNESS_ROIS || parse_jpeg(data, len, &scan) < 0)
+        return -1.0;
 
-err:
-    return -1.0;
+    /* the rectangles in blocks, each one at least a block */
+    blocksx = (scan.width + 7) / 8;
+    blocksy = (scan.height + 7) / 8;
+    first = scan.mcux * scan.mcuy;
+    last = 0;
+    for(r = 0; r < count; r++) {
+        regions[r].x0 = MIN(MAX(roi[r].x, 0), 99) * blocksx / 100;
+        regions[r].y0 = MIN(MAX(roi[r].y, 0), 99) * blocksy / 100;
+        regions[r].x1 = MIN(MAX(roi[r].x + roi[r].width, 0), 100) * blocksx / 100;
+        regions[r].y1 = MIN(MAX(roi[r].y + roi[r].height, 0), 100) * blocksy / 100;
+        regions[r].x1 = MAX(regions[r].x1, regions[r].x0 + 1);
+        regions[r].y1 = MAX(regions[r].y1, regions[r].y0 + 1);
+        regions[r].first = regions[r].y0 / scan.scaleV[0] * scan.mcux + regions[r].x0 / scan.scaleH[0];
+        regions[r].last = (regions[r].y1 - 1) / scan.scaleV[0] * scan.mcux + (regions[r].x1 - 1) / scan.scaleH[0];
+        memset(regions[r].sumAC, 0, sizeof(regions[r].sumAC));
+        regions[r].blocks = 0;
+        first = MIN(first, regions[r].first);
+        last = MAX(last, regions[r].last);
+    }
+
+    /*
+     * without restart markers the scan is decoded up to the last region,
+     * with them the intervals without a region are skipped by looking for
+     * their markers only
+     */
+    interval = scan.restart_interval > 0 ? scan.restart_interval : scan.mcux * scan.mcuy;
+    reader.data = scan.data;
+    reader.end = scan.end;
+    reader.bits = 0;
+    reader.count = 0;
+    for(mcu = 0; mcu <= last; mcu += interval) {
+        if(mcu > 0 && huffman_restart(&reader, scan.end) < 0)
+            return -1.0;
+        if(!interval_needed(&scan, regions, count, mcu, MIN(mcu + interval, scan.mcux * scan.mcuy) - 1))
+            continue;
+
+        memset(lastDC, 0, sizeof(lastDC));
+        for(i = mcu; i < mcu + interval && i <= last; i++) {
+            for(by = 0; by < scan.scaleV[0]; by++) {
+                for(bx = 0; bx < scan.scaleH[0]; bx++) {
+                    xp = i % scan.mcux * scan.scaleH[0] + bx;
+                    yp = i / scan.mcux * scan.scaleV[0] + by;
+                    if(decode_block(&reader, scan.dc[0], scan.ac[0], &lastDC[0], i >= first ? scan.QT : NULL, &block) < 0)
+                        return -1.0;
+
+                    for(r = 0; r < count; r++) {
+                        if(xp < regions[r].x0 || xp >= regions[r].x1 || yp < regions[r].y0 || yp >= regions[r].y1)
+                            continue;
+                        regions[r].blocks++;
+                        for(j = 0; j < block.count; j++)
+                            regions[r].sumAC[block.index[j]] += block.value[j] * block.value[j];
+                    }
+                }
+            }
+
+            for(j = 1; j < scan.components; j++) {
+                if(decode_block(&reader, scan.dc[j], scan.ac[j], &lastDC[j], NULL, &block) < 0)
+                    return -1.0;
+            }
+        }
+    }
+
+    for(r = 0; r < count; r++) {
+        score = weighted_sum(regions[r].sumAC, regions[r].blocks);
+        if(scores != NULL)
+            scores[r] = score;
+        sum += roi[r].weight * score;
+        weights += roi[r].weight;
+    }
+    return weights > 0.0 ? sum / weights : 0.0;
 }
@@ -1,4 +1,12 @@
 #define HUFF_EXTEND(x,s)  ((x) < (1<<((s)-1)) ? (x) + (((-1)<<(s)) + 1) : (x))
 
-// haven't done restart markers, but these don't seem to appear
+#define MAX_SHARPNESS_ROIS 8
+
+/* a rectangle of the frame in percent of its size */
+typedef struct {
+    int x, y, width, height;
+    double weight;          // of its score in the combined score
+} sharpness_roi;
+
 double getFrameSharpnessValue(unsigned char *data, int len);
+double getFrameSharpnessROI(unsigned char *data, int len, const sharpness_roi *roi, int count, double *scores);
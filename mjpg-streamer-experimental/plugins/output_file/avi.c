@@ -0,0 +1,437 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "avi.h"
+
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+#define AVI_INDEX_OF_INDEXES 0
+#define AVI_INDEX_OF_CHUNKS 1
+
+/* RIFF, hdrl with avih and strl (strh, strf and indx), odml and movi */
+#define INDX_SIZE (24 + 16 * AVI_SEGMENTS)
+#define DMLH_SIZE 248
+#define HDRL_SIZE (4 + (8 + 56) + (12 + (8 + 56) + (8 + 40) + (8 + INDX_SIZE)) + (12 + 8 + DMLH_SIZE))
+#define HEADER_SIZE (12 + 8 + HDRL_SIZE + 12)
+
+static unsigned char *put16(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static unsigned char *put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+    return p + 4;
+}
+
+static unsigned char *put64(unsigned char *p, unsigned long long value)
+{
+    return put32(put32(p, value), value >> 32);
+}
+
+static unsigned char *fourcc(unsigned char *p, const char *code)
+{
+    memcpy(p, code, 4);
+    return p + 4;
+}
+
+static int write_all(int fd, const void *data, size_t size, off_t offset)
+{
+    ssize_t rc;
+
+    while(size > 0) {
+        if((rc = pwrite(fd, data, size, offset)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        data = (const char *)data + rc;
+        size -= rc;
+        offset += rc;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: read the size of the picture from the frame header of a JPEG
+Input Value.: * avi.: gets width and height
+              * data: the JPEG
+              * size: its length
+Return Value: -
+******************************************************************************/
+static void picture_size(avi_file *avi, const unsigned char *data, int size)
+{
+    int i = 2;
+
+    while(i + 9 <= size && data[i] == 0xFF) {
+        if(data[i + 1] >= 0xC0 && data[i + 1] <= 0xCF && data[i + 1] != 0xC4 &&
+           data[i + 1] != 0xC8 && data[i + 1] != 0xCC) {
+            avi->height = (data[i + 5] << 8) | data[i + 6];
+            avi->width = (data[i + 7] << 8) | data[i + 8];
+            return;
+        }
+        i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+    }
+}
+
+/******************************************************************************
+Description.: compose the headers from what is known about the recording
+Input Value.: * avi...: the recording
+              * header: buffer of HEADER_SIZE bytes
+Return Value: -
+******************************************************************************/
+static void build_header(avi_file *avi, unsigned char *header)
+{
+    unsigned int usec_per_frame = 40000;
+    unsigned char *p = header;
+    int i;
+
+    if(avi->frames > 1 && avi->last_usec > avi->first_usec)
+        usec_per_frame = (avi->last_usec - avi->first_usec) / (avi->frames - 1);
+    if(usec_per_frame == 0)
+        usec_per_frame = 1;
+
+    memset(header, 0, HEADER_SIZE);
+
+    p = fourcc(p, "RIFF");
+    p = put32(p, avi->first_riff_size);
+    p = fourcc(p, "AVI ");
+    p = fourcc(p, "LIST");
+    p = put32(p, HDRL_SIZE);
+    p = fourcc(p, "hdrl");
+
+    p = fourcc(p, "avih");
+    p = put32(p, 56);
+    p = put32(p, usec_per_frame);
+    p = put32(p, (unsigned long long)avi->max_size * 1000000 / usec_per_frame);
+    p = put32(p, 0);
+    p = put32(p, AVIF_HASINDEX);
+    p = put32(p, avi->first_frames);
+    p = put32(p, 0);
+    p = put32(p, 1);
+    p = put32(p, avi->max_size);
+    p = put32(p, avi->width);
+    p = put32(p, avi->height);
+    p += 16;
+
+    p = fourcc(p, "LIST");
+    p = put32(p, 4 + (8 + 56) + (8 + 40) + (8 + INDX_SIZE));
+    p = fourcc(p, "strl");
+
+    p = fourcc(p, "strh");
+    p = put32(p, 56);
+    p = fourcc(p, "vids");
+    p = fourcc(p, "MJPG");
+    p = put32(p, 0);
+    p = put32(p, 0);
+    p = put32(p, 0);
+    p = put32(p, usec_per_frame);
+    p = put32(p, 1000000);
+    p = put32(p, 0);
+    p = put32(p, avi->frames);
+    p = put32(p, avi->max_size);
+    p = put32(p, 0xFFFFFFFF);
+    p = put32(p, 0);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, avi->width);
+    p = put16(p, avi->height);
+
+    p = fourcc(p, "strf");
+    p = put32(p, 40);
+    p = put32(p, 40);
+    p = put32(p, avi->width);
+    p = put32(p, avi->height);
+    p = put16(p, 1);
+    p = put16(p, 24);
+    p = fourcc(p, "MJPG");
+    p = put32(p, avi->width * avi->height * 3);
+    p += 16;
+
+    /* the super index, a slot for each RIFF */
+    p = fourcc(p, "indx");
+    p = put32(p, INDX_SIZE);
+    p = put16(p, 4);
+    *p++ = 0;
+    *p++ = AVI_INDEX_OF_INDEXES;
+    p = put32(p, avi->segment_count);
+    p = fourcc(p, "00dc");
+    p += 12;
+    for(i = 0; i < AVI_SEGMENTS; i++) {
+        p = put64(p, avi->segments[i].offset);
+        p = put32(p, avi->segments[i].size);
+        p = put32(p, avi->segments[i].frames);
+    }
+
+    p = fourcc(p, "LIST");
+    p = put32(p, 4 + 8 + DMLH_SIZE);
+    p = fourcc(p, "odml");
+    p = fourcc(p, "dmlh");
+    p = put32(p, DMLH_SIZE);
+    p = put32(p, avi->frames);
+    p += DMLH_SIZE - 4;
+
+    p = fourcc(p, "LIST");
+    p = put32(p, avi->first_movi_size);
+    p = fourcc(p, "movi");
+}
+
+/******************************************************************************
+Description.: start a RIFF after the first one
+Input Value.: the recording
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int begin_riff(avi_file *avi)
+{
+    unsigned char header[24], *p = header;
+
+    p = fourcc(p, "RIFF");
+    p = put32(p, 0);
+    p = fourcc(p, "AVIX");
+    p = fourcc(p, "LIST");
+    p = put32(p, 0);
+    p = fourcc(p, "movi");
+
+    if(write_all(avi->fd, header, sizeof(header), avi->position) < 0)
+        return -1;
+
+    avi->riff = avi->position;
+    avi->movi = avi->position + 12;
+    avi->position += sizeof(header);
+    return 0;
+}
+
+/******************************************************************************
+Description.: finish the current RIFF with the standard index of its frames,
+              the first one gets an idx1 as well
+Input Value.: the recording
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int end_riff(avi_file *avi)
+{
+    unsigned char *index, *p;
+    unsigned char size[4];
+    size_t length;
+    int i;
+
+    length = 8 + 24 + 8 * avi->count;
+    if(avi->riff == 0 && 8 + 16 * avi->count > length)
+        length = 8 + 16 * avi->count;
+    if((index = malloc(length)) == NULL)
+        return -1;
+
+    p = fourcc(index, "ix00");
+    p = put32(p, 24 + 8 * avi->count);
+    p = put16(p, 2);
+    *p++ = 0;
+    *p++ = AVI_INDEX_OF_CHUNKS;
+    p = put32(p, avi->count);
+    p = fourcc(p, "00dc");
+    p = put64(p, avi->movi);
+    p = put32(p, 0);
+    for(i = 0; i < avi->count; i++) {
+        p = put32(p, avi->chunks[i].offset - avi->movi);
+        p = put32(p, avi->chunks[i].size);
+    }
+
+    if(write_all(avi->fd, index, p - index, avi->position) < 0)
+        goto failed;
+    avi->segments[avi->segment_count].offset = avi->position;
+    avi->segments[avi->segment_count].size = p - index;
+    avi->segments[avi->segment_count].frames = avi->count;
+    avi->segment_count++;
+    avi->position += p - index;
+
+    /* the movi list ends with the index */
+    put32(size, avi->position - avi->movi - 8);
+    if(write_all(avi->fd, size, 4, avi->movi + 4) < 0)
+        goto failed;
+
+    if(avi->riff == 0) {
+        avi->first_movi_size = avi->position - avi->movi - 8;
+        avi->first_frames = avi->count;
+
+        /* offsets of idx1 count from the movi of the list */
+        p = fourcc(index, "idx1");
+        p = put32(p, 16 * avi->count);
+        for(i = 0; i < avi->count; i++) {
+            p = fourcc(p, "00dc");
+            p = put32(p, AVIIF_KEYFRAME);
+            p = put32(p, avi->chunks[i].offset - 8 - (avi->movi + 8));
+            p = put32(p, avi->chunks[i].size);
+        }
+        if(write_all(avi->fd, index, p - index, avi->position) < 0)
+            goto failed;
+        avi->position += p - index;
+        avi->first_riff_size = avi->position - 8;
+    } else {
+        put32(size, avi->position - avi->riff - 8);
+        if(write_all(avi->fd, size, 4, avi->riff + 4) < 0)
+            goto failed;
+    }
+
+    free(index);
+    avi->count = 0;
+    return 0;
+
+failed:
+    free(index);
+    return -1;
+}
+
+/******************************************************************************
+Description.: create a recording, its headers are written again on closing it
+Input Value.: * avi.: to set up
+              * path: of the file
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+int avi_open(avi_file *avi, const char *path)
+{
+    unsigned char header[HEADER_SIZE];
+
+    memset(avi, 0, sizeof(*avi));
+
+    if((avi->fd = open(path, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+        return -1;
+
+    build_header(avi, header);
+    if(write_all(avi->fd, header, HEADER_SIZE, 0) < 0) {
+        close(avi->fd);
+        return -1;
+    }
+
+    avi->position = HEADER_SIZE;
+    avi->movi = HEADER_SIZE - 12;
+    return 0;
+}
+
+/******************************************************************************
+Description.: append a frame as a chunk of the movi list
+Input Value.: * avi.: the recording
+              * data: the JPEG
+              * size: its length
+              * usec: its timestamp
+Return Value: 0 if ok, -1 on error, errno is EFBIG if the file is full
+******************************************************************************/
+int avi_write_frame(avi_file *avi, const unsigned char *data, int size, unsigned long long usec)
+{
+    unsigned char header[8], pad = 0;
+    struct iovec iov[3];
+    avi_chunk *chunks;
+    ssize_t length = 8 + size + (size & 1), rc;
+    int capacity;
+
+    /* the next RIFF, every one of them has to stay in the limit */
+    if(avi->position + length + 8 + 24 + 8 * (avi->count + 1) + 16 * (avi->count + 1) - avi->riff > AVI_RIFF_SIZE) {
+        if(avi->segment_count + 1 >= AVI_SEGMENTS) {
+            errno = EFBIG;
+            return -1;
+        }
+        if(end_riff(avi) < 0 || begin_riff(avi) < 0)
+            return -1;
+    }
+
+    if(avi->count == avi->capacity) {
+        capacity = avi->capacity ? 2 * avi->capacity : 1024;
+        if((chunks = realloc(avi->chunks, capacity * sizeof(avi_chunk))) == NULL)
+            return -1;
+        avi->chunks = chunks;
+        avi->capacity = capacity;
+    }
+
+    fourcc(header, "00dc");
+    put32(header + 4, size);
+    iov[0].iov_base = header;
+    iov[0].iov_len = 8;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = size;
+    iov[2].iov_base = &pad;
+    iov[2].iov_len = size & 1;
+
+    do {
+        rc = pwritev(avi->fd, iov, 3, avi->position);
+    } while(rc < 0 && errno == EINTR);
+    if(rc != length) {
+        if(rc >= 0)
+            errno = ENOSPC;
+        return -1;
+    }
+
+    if(avi->frames == 0) {
+        picture_size(avi, data, size);
+        avi->first_usec = usec;
+    }
+    avi->last_usec = usec;
+    if(size > avi->max_size)
+        avi->max_size = size;
+
+    avi->chunks[avi->count].offset = avi->position + 8;
+    avi->chunks[avi->count].size = size;
+    avi->count++;
+    avi->frames++;
+    avi->position += length;
+    return 0;
+}
+
+/******************************************************************************
+Description.: write the indexes and the final headers and close the file
+Input Value.: the recording
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+int avi_close(avi_file *avi)
+{
+    unsigned char header[HEADER_SIZE];
+    int rc = 0;
+
+    if(avi->fd < 0)
+        return 0;
+
+    if(end_riff(avi) < 0)
+        rc = -1;
+
+    build_header(avi, header);
+    if(write_all(avi->fd, header, HEADER_SIZE, 0) < 0)
+        rc = -1;
+
+    /* the file may have been allocated beyond its end */
+    if(ftruncate(avi->fd, avi->position) < 0)
+        rc = -1;
+
+    if(close(avi->fd) < 0)
+        rc = -1;
+
+    free(avi->chunks);
+    avi->chunks = NULL;
+    avi->fd = -1;
+    return rc;
+}
@@ -0,0 +1,75 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef AVI_H
+#define AVI_H
+
+#include <sys/types.h>
+
+/*
+ * an MJPEG recording in an OpenDML AVI. Each RIFF of at most AVI_RIFF_SIZE
+ * bytes ends with a standard index of its frames, the super index in the
+ * header points to them. The first RIFF has an idx1 for old players too.
+ * The headers get their final values when the file is closed.
+ */
+#define AVI_RIFF_SIZE (1024 * 1024 * 1024)
+#define AVI_SEGMENTS 256
+
+typedef struct _avi_chunk {
+    off_t offset;       // of the frame data in the file
+    int size;
+} avi_chunk;
+
+typedef struct _avi_segment {
+    off_t offset;       // of its standard index
+    int size;           // of the standard index
+    int frames;
+} avi_segment;
+
+typedef struct _avi_file {
+    int fd;
+    int width, height;
+    int frames;
+    int max_size;
+    unsigned long long first_usec, last_usec;
+
+    off_t position;     // end of the file
+    off_t riff;         // start of the current RIFF
+    off_t movi;         // start of its movi list
+
+    /* the frames of the current RIFF */
+    avi_chunk *chunks;
+    int count;
+    int capacity;
+
+    /* kept for the headers of the first RIFF */
+    int first_frames;
+    unsigned int first_riff_size, first_movi_size;
+
+    avi_segment segments[AVI_SEGMENTS];
+    int segment_count;
+} avi_file;
+
+int avi_open(avi_file *avi, const char *path);
+int avi_write_frame(avi_file *avi, const unsigned char *data, int size, unsigned long long usec);
+int avi_close(avi_file *avi);
+
+#endif
@@ -0,0 +1,185 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "change.h"
+
+/* a pixel of the thumbnail changed if its luma differs by more than this */
+#define CHANGE_LEVEL 24
+
+/******************************************************************************
+Description.: a fast hash of the frame, eight bytes at a time
+Input Value.: * data: the frame
+              * size: its length
+Return Value: the hash
+******************************************************************************/
+static unsigned long long frame_hash(const unsigned char *data, int size)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL ^ size, word;
+    int i;
+
+    for(i = 0; i + 8 <= size; i += 8) {
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for(; i < size; i++)
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+
+    return h;
+}
+
+#ifndef NO_LIBJPEG
+/******************************************************************************
+Description.: copy the luma of a frame at 1/8 of its size into d->current,
+              the picture is decoded once for all plugins, see frame_decode()
+Input Value.: * d....: the detector
+              * frame: the frame
+Return Value: 0 if ok, -1 if the frame could not be decoded
+******************************************************************************/
+static int decode_thumbnail(change_detector *d, input_frame *frame)
+{
+    const decoded_picture *pic;
+    unsigned char *buffer;
+    int y;
+
+    /* at 1/8 each block is its DC coefficient */
+    if((pic = frame_decode(frame, DECODE_GREY, 1, 1)) == NULL)
+        return -1;
+
+    if(pic->width * pic->height > d->capacity) {
+        if((buffer = realloc(d->current, pic->width * pic->height)) == NULL)
+            return -1;
+        d->current = buffer;
+        d->capacity = pic->width * pic->height;
+    }
+
+    for(y = 0; y < pic->height; y++)
+        memcpy(d->current + y * pic->width, pic->plane[0] + y * pic->stride[0], pic->width);
+
+    /* a thumbnail of another size does not compare */
+    if(pic->width != d->width || pic->height != d->height) {
+        d->width = pic->width;
+        d->height = pic->height;
+        free(d->thumbnail);
+        d->thumbnail = NULL;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: compare the thumbnail of the frame to the one of the last
+              frame kept
+Input Value.: the detector
+Return Value: 1 if enough pixels changed, 0 otherwise
+******************************************************************************/
+static int thumbnail_changed(change_detector *d)
+{
+    int i, pixels = d->width * d->height, changed = 0;
+
+    if(d->thumbnail == NULL)
+        return 1;
+
+    for(i = 0; i < pixels; i++)
+        changed += (ABS(d->current[i] - d->thumbnail[i]) > CHANGE_LEVEL);
+    return changed * 100.0 >= d->threshold * pixels;
+}
+
+/******************************************************************************
+Description.: the thumbnail of the frame kept becomes the reference
+Input Value.: the detector
+Return Value: -
+******************************************************************************/
+static void keep_thumbnail(change_detector *d)
+{
+    unsigned char *swap = d->thumbnail;
+
+    d->thumbnail = d->current;
+    d->current = swap;
+    d->capacity = (swap != NULL) ? d->width * d->height : 0;
+}
+#endif
+
+/******************************************************************************
+Description.: set up a detector
+Input Value.: * d.........: the detector
+              * threshold.: percent of the thumbnail which has to change
+              * keep_alive: seconds after which a frame is kept anyway, 0
+                            to skip unchanged frames forever
+Return Value: -
+******************************************************************************/
+void change_init(change_detector *d, double threshold, int keep_alive)
+{
+    memset(d, 0, sizeof(*d));
+    d->threshold = threshold;
+    d->keep_alive = keep_alive;
+}
+
+/******************************************************************************
+Description.: tell whether a frame differs enough from the last one kept
+Input Value.: * d....: the detector
+              * frame: the frame
+              * usec.: its time in microseconds
+Return Value: 1 if the frame is to be kept, 0 if it can be skipped
+******************************************************************************/
+int change_detect(change_detector *d, input_frame *frame, unsigned long long usec)
+{
+    unsigned long long hash = frame_hash(frame->buf, frame->size);
+    int changed = 1;
+    #ifndef NO_LIBJPEG
+    int decoded = 0;
+    #endif
+
+    if(d->kept_usec != 0 && hash == d->hash) {
+        changed = 0;
+    #ifndef NO_LIBJPEG
+    } else if(decode_thumbnail(d, frame) == 0) {
+        decoded = 1;
+        changed = thumbnail_changed(d);
+    #endif
+    }
+
+    if(!changed && d->keep_alive > 0 && usec >= d->kept_usec + d->keep_alive * 1000000ULL)
+        changed = 1;
+
+    if(changed) {
+        #ifndef NO_LIBJPEG
+        if(decoded)
+            keep_thumbnail(d);
+        #endif
+        d->hash = hash;
+        d->kept_usec = usec;
+    }
+    return changed;
+}
+
+void change_free(change_detector *d)
+{
+    free(d->thumbnail);
+    free(d->current);
+    memset(d, 0, sizeof(*d));
+}
@@ -0,0 +1,47 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef CHANGE_H
+#define CHANGE_H
+
+#include "../../mjpg_streamer.h"
+
+/*
+ * skips frames of a static scene. A frame is compared to the last one kept:
+ * an identical frame is found by its hash, otherwise the frame is decoded
+ * at 1/8 of its size, which takes just the DC coefficients of the blocks,
+ * and the luma of this thumbnail is compared pixel by pixel.
+ */
+typedef struct _change_detector {
+    double threshold;               // percent of the thumbnail which has to change
+    int keep_alive;                 // seconds after which a frame is kept anyway, 0 never
+    unsigned long long hash;        // of the last frame kept
+    unsigned long long kept_usec;
+    unsigned char *thumbnail;       // of the last frame kept
+    unsigned char *current;         // of the frame being checked
+    int width, height, capacity;
+} change_detector;
+
+void change_init(change_detector *d, double threshold, int keep_alive);
+int change_detect(change_detector *d, input_frame *frame, unsigned long long usec);
+void change_free(change_detector *d);
+
+#endif
@@ -0,0 +1,464 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "avi.h"
+#include "mirror.h"
+#include "../input_file/mjpg_index.h"
+
+enum { JOB_WRITE, JOB_DELETE, JOB_CLOSE };
+
+/* something for the thread of a mirror to do */
+typedef struct _mirror_job {
+    int op;
+    input_frame *frame;         // to write, referenced
+    char *name;                 // relative to the folder of the mirror
+    struct _mirror_job *next;
+} mirror_job;
+
+struct _mirror {
+    char *folder;
+    int mode;
+    int depth;                  // frames which may wait
+    int policy;
+    int stop;
+
+    /* the jobs in their order, deletions are never dropped */
+    mirror_job *first, *last;
+    int frames;
+    unsigned long long dropped;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t update;
+
+    /* the recording, used by the thread only */
+    char *recording;
+    int fd;
+    FILE *index;
+    long long offset;
+    avi_file avi;
+    int failing;
+};
+
+/******************************************************************************
+Description.: report the first failure of a mirror, a stalled share would
+              flood the log otherwise
+Input Value.: * m...: the mirror
+              * what: the operation
+              * path: the file
+Return Value: -
+******************************************************************************/
+static void mirror_failed(mirror *m, const char *what, const char *path)
+{
+    if(!m->failing)
+        LOG("mirror %s: could not %s %s: %s\n", m->folder, what, path, strerror(errno));
+    m->failing = 1;
+}
+
+/******************************************************************************
+Description.: create the directories above a file of the mirror
+Input Value.: the path of the file
+Return Value: -
+******************************************************************************/
+static void make_parents(char *path)
+{
+    char *slash = strrchr(path, '/');
+
+    if(slash == NULL || slash == path)
+        return;
+
+    *slash = '\0';
+    if(mkdir(path, 0755) < 0 && errno == ENOENT) {
+        make_parents(path);
+        mkdir(path, 0755);
+    }
+    *slash = '/';
+}
+
+/******************************************************************************
+Description.: open a file of the mirror, directories missing are created
+Input Value.: the path of the file
+Return Value: the file descriptor, -1 on error
+******************************************************************************/
+static int open_file(char *path)
+{
+    int file;
+
+    file = open(path, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(file < 0 && errno == ENOENT) {
+        make_parents(path);
+        file = open(path, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+    return file;
+}
+
+static int write_all(int file, const unsigned char *data, int size)
+{
+    ssize_t rc;
+
+    while(size > 0) {
+        if((rc = write(file, data, size)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += rc;
+        size -= rc;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: finish the recording of the mirror
+Input Value.: the mirror
+Return Value: -
+******************************************************************************/
+static void close_mirror_recording(mirror *m)
+{
+    if(m->mode == MIRROR_AVI && avi_close(&m->avi) < 0)
+        mirror_failed(m, "finish", m->recording);
+    if(m->fd >= 0) {
+        close(m->fd);
+        m->fd = -1;
+    }
+    if(m->index != NULL) {
+        fclose(m->index);
+        m->index = NULL;
+    }
+    free(m->recording);
+    m->recording = NULL;
+}
+
+/******************************************************************************
+Description.: write a frame, as a picture or to the recording, which starts
+              over with the recording of another name
+Input Value.: * m...: the mirror
+              * f...: the frame
+              * path: of the picture or the recording
+Return Value: -
+******************************************************************************/
+static void write_frame(mirror *m, input_frame *f, char *path, const char *name)
+{
+    unsigned long long usec = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
+    char *index;
+    int file;
+
+    if(m->mode == MIRROR_PICTURES) {
+        if((file = open_file(path)) < 0) {
+            mirror_failed(m, "open", path);
+            return;
+        }
+        if(write_all(file, f->buf, f->size) < 0) {
+            mirror_failed(m, "write", path);
+        } else {
+            m->failing = 0;
+        }
+        close(file);
+        return;
+    }
+
+    if(m->recording == NULL || strcmp(m->recording, name) != 0) {
+        close_mirror_recording(m);
+        m->recording = strdup(name);
+        m->offset = 0;
+
+        if(m->mode == MIRROR_AVI) {
+            make_parents(path);
+            if(avi_open(&m->avi, path) < 0)
+                mirror_failed(m, "open", path);
+        } else if((m->fd = open_file(path)) < 0) {
+            mirror_failed(m, "open", path);
+        } else if((index = malloc(strlen(path) + 5)) != NULL) {
+            sprintf(index, "%s.idx", path);
+            if((m->index = fopen(index, "w")) != NULL)
+                fputs(MJPG_INDEX_HEADER, m->index);
+            free(index);
+        }
+    }
+
+    if(m->mode == MIRROR_AVI) {
+        if(m->avi.fd < 0 || avi_write_frame(&m->avi, f->buf, f->size, usec) < 0) {
+            mirror_failed(m, "write", path);
+            return;
+        }
+    } else {
+        if(m->fd < 0 || write_all(m->fd, f->buf, f->size) < 0) {
+            mirror_failed(m, "write", path);
+            return;
+        }
+        if(m->index != NULL)
+            fprintf(m->index, "%lld %d %llu\n", m->offset, f->size, usec);
+        m->offset += f->size;
+    }
+    m->failing = 0;
+}
+
+/******************************************************************************
+Description.: the thread of a mirror, it works through the jobs in order
+Input Value.: the mirror
+Return Value: NULL
+******************************************************************************/
+static void *mirror_thread(void *arg)
+{
+    mirror *m = arg;
+    mirror_job *job;
+    char path[1024], *slash;
+
+    pthread_mutex_lock(&m->mutex);
+    while(!m->stop) {
+        if((job = m->first) == NULL) {
+            pthread_cond_wait(&m->update, &m->mutex);
+            continue;
+        }
+        if((m->first = job->next) == NULL)
+            m->last = NULL;
+        if(job->op == JOB_WRITE)
+            m->frames--;
+        pthread_mutex_unlock(&m->mutex);
+
+        if(job->name != NULL)
+            snprintf(path, sizeof(path), "%s/%s", m->folder, job->name);
+
+        switch(job->op) {
+        case JOB_WRITE:
+            write_frame(m, job->frame, path, job->name);
+            break;
+        case JOB_DELETE:
+            /* the directories of partitions go with their last picture */
+            if(unlink(path) == 0) {
+                while((slash = strrchr(path, '/')) != NULL && slash - path > (int)strlen(m->folder)) {
+                    *slash = '\0';
+                    if(rmdir(path) < 0)
+                        break;
+                }
+            }
+            break;
+        case JOB_CLOSE:
+            close_mirror_recording(m);
+            break;
+        }
+
+        frame_unref(job->frame);
+        free(job->name);
+        free(job);
+
+        pthread_mutex_lock(&m->mutex);
+    }
+    pthread_mutex_unlock(&m->mutex);
+
+    close_mirror_recording(m);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: queue a job for the thread of a mirror, a frame is dropped if
+              too many wait already
+Input Value.: * m....: the mirror
+              * op...: what to do
+              * frame: to write, may be NULL
+              * name.: of the file, may be NULL
+Return Value: -
+******************************************************************************/
+static void add_job(mirror *m, int op, input_frame *frame, const char *name)
+{
+    mirror_job *job, *prev, *old;
+
+    if((job = calloc(1, sizeof(mirror_job))) == NULL)
+        return;
+    if(name != NULL && (job->name = strdup(name)) == NULL) {
+        free(job);
+        return;
+    }
+    job->op = op;
+
+    pthread_mutex_lock(&m->mutex);
+    if(op == JOB_WRITE && m->frames == m->depth) {
+        m->dropped++;
+        if((m->dropped & (m->dropped - 1)) == 0) {
+            LOG("mirror %s is too slow, %llu frames dropped\n", m->folder, m->dropped);
+        }
+
+        if(m->policy == MIRROR_DROP_NEW) {
+            pthread_mutex_unlock(&m->mutex);
+            free(job->name);
+            free(job);
+            return;
+        }
+
+        /* the oldest frame waiting makes room */
+        for(prev = NULL, old = m->first; old->op != JOB_WRITE; prev = old, old = old->next);
+        if(prev != NULL)
+            prev->next = old->next;
+        else
+            m->first = old->next;
+        if(m->last == old)
+            m->last = prev;
+        m->frames--;
+        frame_unref(old->frame);
+        free(old->name);
+        free(old);
+    }
+
+    job->frame = frame_ref(frame);
+    if(op == JOB_WRITE)
+        m->frames++;
+    if(m->last != NULL)
+        m->last->next = job;
+    else
+        m->first = job;
+    m->last = job;
+    pthread_cond_signal(&m->update);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+/******************************************************************************
+Description.: start a mirror
+Input Value.: * spec: folder[:depth[:new|old]], depth frames may wait, 64 by
+                      default, then the newest or the oldest is dropped
+              * mode: MIRROR_PICTURES, MIRROR_MJPG or MIRROR_AVI
+Return Value: the mirror, NULL on error
+******************************************************************************/
+mirror *mirror_new(const char *spec, int mode)
+{
+    mirror *m;
+    char *colon;
+
+    if((m = calloc(1, sizeof(mirror))) == NULL || (m->folder = strdup(spec)) == NULL) {
+        free(m);
+        return NULL;
+    }
+    m->mode = mode;
+    m->depth = 64;
+    m->policy = MIRROR_DROP_NEW;
+    m->fd = -1;
+    m->avi.fd = -1;
+
+    if((colon = strchr(m->folder, ':')) != NULL) {
+        *colon++ = '\0';
+        m->depth = MAX(atoi(colon), 1);
+        if((colon = strchr(colon, ':')) != NULL && strcmp(colon + 1, "old") == 0)
+            m->policy = MIRROR_DROP_OLD;
+    }
+    if(strlen(m->folder) > 1 && m->folder[strlen(m->folder) - 1] == '/')
+        m->folder[strlen(m->folder) - 1] = '\0';
+
+    pthread_mutex_init(&m->mutex, NULL);
+    pthread_cond_init(&m->update, NULL);
+    if(pthread_create(&m->thread, NULL, mirror_thread, m) != 0) {
+        pthread_mutex_destroy(&m->mutex);
+        pthread_cond_destroy(&m->update);
+        free(m->folder);
+        free(m);
+        return NULL;
+    }
+
+    OPRINT("mirror............: %s, %d frames waiting at most, dropping the %s\n",
+           m->folder, m->depth, (m->policy == MIRROR_DROP_OLD) ? "oldest" : "newest");
+    return m;
+}
+
+const char *mirror_folder(mirror *m)
+{
+    return m->folder;
+}
+
+/******************************************************************************
+Description.: write a frame to the mirror too
+Input Value.: * m...: the mirror
+              * f...: the frame, the mirror takes a reference
+              * name: of the picture or the recording, relative to the folder
+Return Value: -
+******************************************************************************/
+void mirror_frame(mirror *m, input_frame *f, const char *name)
+{
+    add_job(m, JOB_WRITE, f, name);
+}
+
+/******************************************************************************
+Description.: delete a picture of the mirror, after the ringbuffer deleted it
+Input Value.: * m...: the mirror
+              * name: of the picture, relative to the folder
+Return Value: -
+******************************************************************************/
+void mirror_delete(mirror *m, const char *name)
+{
+    add_job(m, JOB_DELETE, NULL, name);
+}
+
+/******************************************************************************
+Description.: finish the recording of the mirror, after the one of the plugin
+Input Value.: the mirror
+Return Value: -
+******************************************************************************/
+void mirror_close(mirror *m)
+{
+    add_job(m, JOB_CLOSE, NULL, NULL);
+}
+
+/******************************************************************************
+Description.: stop the thread of a mirror, frames still waiting are dropped,
+              a stalled share must not block the shutdown for long
+Input Value.: the mirror, may be NULL
+Return Value: -
+******************************************************************************/
+void mirror_free(mirror *m)
+{
+    struct timespec deadline;
+    mirror_job *job;
+
+    if(m == NULL)
+        return;
+
+    pthread_mutex_lock(&m->mutex);
+    m->stop = 1;
+    pthread_cond_signal(&m->update);
+    pthread_mutex_unlock(&m->mutex);
+
+    /* a thread stuck in a write to a share which went away is cancelled */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 2;
+    if(pthread_timedjoin_np(m->thread, NULL, &deadline) != 0) {
+        LOG("mirror %s does not respond, giving up on it\n", m->folder);
+        pthread_cancel(m->thread);
+        pthread_join(m->thread, NULL);
+    }
+
+    while((job = m->first) != NULL) {
+        m->first = job->next;
+        frame_unref(job->frame);
+        free(job->name);
+        free(job);
+    }
+    pthread_mutex_destroy(&m->mutex);
+    pthread_cond_destroy(&m->update);
+    free(m->folder);
+    free(m);
+}
@@ -0,0 +1,45 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef MIRROR_H
+#define MIRROR_H
+
+/*
+ * a second folder output_file writes the same pictures or recordings to.
+ * Each mirror has a thread and a queue of its own, the frames are shared by
+ * reference. A full queue drops frames of this mirror only, the newest with
+ * MIRROR_DROP_NEW or the oldest waiting one with MIRROR_DROP_OLD.
+ */
+#define MAX_MIRRORS 4
+
+enum { MIRROR_PICTURES, MIRROR_MJPG, MIRROR_AVI };
+enum { MIRROR_DROP_NEW, MIRROR_DROP_OLD };
+
+typedef struct _mirror mirror;
+
+mirror *mirror_new(const char *spec, int mode);
+const char *mirror_folder(mirror *m);
+void mirror_frame(mirror *m, input_frame *f, const char *name);
+void mirror_delete(mirror *m, const char *name);
+void mirror_close(mirror *m);
+void mirror_free(mirror *m);
+
+#endif
@@ -34,26 +34,139 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/time.h>
 #include <syslog.h>
 #include <dirent.h>
 
 #include "output_file.h"
+#include "uring.h"
+#include "avi.h"
+#include "change.h"
 
 #include "../../utils.h"
 #include "../../mjpg_streamer.h"
 
+#include "mirror.h"
+#include "repack.h"
+#include "../input_file/mjpg_index.h"
+
 #define OUTPUT_PLUGIN_NAME "FILE output plugin"
 
 static pthread_t worker;
 static globals *pglobal;
-static int fd, delay, ringbuffer_size = -1, ringbuffer_exceed = 0, max_frame_size;
+static int fd = -1, delay, ringbuffer_size = -1, ringbuffer_exceed = 0;
 static char *folder = "/tmp";
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static char *command = NULL;
+static command_queue *commands = NULL;
+static int commandDepth = 16, commandCoalesce = 0;
 static int input_number = 0;
 static char *mjpgFileName = NULL;
 static char *linkFileName = NULL;
 
+/* the index of a recording, in the format input_file -m reads: a line
+ * "offset size timestamp_usec" per frame */
+static FILE *indexFile = NULL;
+
+/* pictures in a directory per hour, with an index of their times */
+static int partition = 0;
+static char partitionDir[1024] = "";
+static int partitionIndex = -1;
+
+/* frames of a static scene are skipped */
+static double changeThreshold = 0;
+static int changeKeep = 60;
+static change_detector detector;
+
+/* more folders, each written by a thread of its own */
+static char *mirrorSpecs[MAX_MIRRORS];
+static mirror *mirrors[MAX_MIRRORS];
+static int mirrorCount = 0;
+static char recordingName[1024];           // relative to the folder
+
+/* closed hours and recordings are coded again, losslessly and smaller */
+static int repackMode = -1;
+static repacker *repack = NULL;
+
+/* pictures of the ringbuffer oldest first, a circular array */
+static char **ringNames = NULL;
+static int ringHead = 0, ringCount = 0, ringCapacity = 0;
+static long long mjpgOffset = 0;
+
+/* a recording with a name ending in .avi gets a proper container */
+static int aviMode = 0;
+static avi_file avi = { .fd = -1 };
+
+/* the next file of a recording starts after this many bytes or seconds */
+static long long rotateSize = 0;
+static int rotateTime = 0;
+static unsigned long long recordingStart = 0;
+
+/* recordings grow by extents of this size, allocated ahead of the writes */
+static long long preallocateSize = 0;
+static long long allocated = 0;
+
+/* the data of a recording is synced to the disk this often */
+static int syncInterval = 0;
+static unsigned long long lastSync = 0;
+
+/* frames of an mjpg recording are coalesced into large writes, which may
+ * bypass the page cache with O_DIRECT */
+#define DIRECT_ALIGN 4096
+static int writeBufferSize = 0;
+static int writeTime = 1000;
+static int directIO = 0;
+static unsigned char *writeBuffer = NULL;
+static int writeLength = 0, writeDone = 0;
+static long long writeStart = 0;
+static unsigned long long writeSince = 0;
+
+static void close_recording(void);
+
+static int plugin_id;
+static unsigned long long saved = 0, pictures = 0;
+
+/* triggered recording: the frames of the pre-roll wait for an event, which
+ * records them and all frames of the post-roll after the last trigger */
+static int preRoll = 0;
+static long long preRollSize = 0;
+static int postRoll = 0;
+static int triggerPort = 0, triggerSocket = -1;
+static int motionTrigger = 0;
+static pthread_t trigger;
+static input_frame **preFrames = NULL;
+static int preHead = 0, preCount = 0, preCapacity = 0;
+static long long preBytes = 0;
+static pthread_mutex_t preMutex = PTHREAD_MUTEX_INITIALIZER;
+static int recording = 0;
+static unsigned long long eventEnd = 0;
+static pthread_mutex_t eventMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the memory budget shortens the pre-roll, after the caches */
+static input_frame *pre_roll_pop(void);
+static long long pre_roll_evict(void *arg, long long bytes);
+static memory_account preMemory = MEMORY_ACCOUNT("pre-roll", MEMORY_BUFFER, pre_roll_evict, NULL);
+
+/* frames being written at once with io_uring, 0 writes them one by one */
+static int queue_depth = 0;
+
+#ifdef IO_URING
+/* a frame on its way to the disk, it stays referenced until it got there */
+typedef struct _pending_write {
+    input_frame *frame;
+    char name[1024];    // the file in single file mode
+    int completions;    // requests of the frame still to complete
+    int failed;
+} pending_write;
+
+enum { OP_OPEN, OP_WRITE, OP_CLOSE };
+
+static uring ring;
+static pending_write *pending = NULL;
+
+static void stop_uring(void);
+#endif
+
 /******************************************************************************
 Description.: print a help message
 Input Value.: -
@@ -66,7 +179,20 @@ void help(void)
             " ---------------------------------------------------------------\n" \
             " The following parameters can be passed to this plugin:\n\n" \
             " [-f | --folder ]........: folder to save pictures\n" \
-            " [-m | --mjpeg ].........: save the frames to an mjpg file \n" \
+            " [-m | --mjpeg ].........: save the frames to an mjpg file, or to an AVI if\n" \
+            "                           the name ends with .avi, strftime() formats are\n" \
+            "                           replaced\n" \
+            " [-rs | --rotate-size ]..: start a new recording after this many MB\n" \
+            " [-rt | --rotate-time ]..: start a new recording after this many seconds\n" \
+            " [-pa | --preallocate ]..: allocate the recording in extents of this many\n" \
+            "                           MB, the size of -rs gives whole segments\n" \
+            " [-sy | --sync ].........: sync the recording to the disk every this many\n" \
+            "                           seconds, by default the kernel decides\n" \
+            " [-wb | --write-buffer ].: collect the frames of an mjpg file in a buffer of\n" \
+            "                           this many KB and write it at once\n" \
+            " [-wt | --write-time ]...: write the buffer at least every this many ms,\n" \
+            "                           1000 by default\n" \
+            " [-od | --direct ].......: write the buffer with O_DIRECT, past the page cache\n" \
             " [-l | --link ]..........: link the last picture in ringbuffer as this fixed named file\n" \
             " [-d | --delay ].........: delay after saving pictures in ms\n" \
             " [-i | --input ].........: read frames from the specified input plugin\n" \
@@ -74,6 +200,33 @@ void help(void)
             " [-s | --size ]..........: size of ring buffer (max number of pictures to hold)\n" \
             " [-e | --exceed ]........: allow ringbuffer to exceed limit by this amount\n" \
             " [-c | --command ].......: execute command after saving picture\n"\
+            " [-cq | --command-queue ]: pictures which may wait for the command, more\n" \
+            "                           are skipped, 16 by default\n" \
+            " [-cc | --command-coalesce ]: run the command at most every this many ms,\n" \
+            "                           with the latest picture\n" \
+            " [-ch | --changes ]......: skip frames unless this many percent of the\n" \
+            "                           picture changed since the last frame stored\n" \
+            " [-ck | --change-keep ]..: store a frame at least every this many seconds\n" \
+            "                           anyway, 60 by default, 0 never\n" \
+            " [-pt | --partition ]....: store the pictures in a directory per hour, each\n" \
+            "                           with an index for output_http ?action=recorded\n" \
+            " [-q | --queue ].........: write up to this many frames at once with io_uring,\n" \
+            "                           frames are skipped while all are on their way\n" \
+            " The following arguments record only around events, triggered by the command\n" \
+            " of the plugin, a UDP message or motion\n" \
+            " [-po | --post-roll ]....: record this many seconds after the last trigger\n" \
+            " [-pr | --pre-roll ].....: keep this many seconds before a trigger in memory\n" \
+            " [-pb | --pre-roll-size ]: keep at most this many MB before a trigger\n" \
+            " [-tu | --trigger-udp ]..: UDP port to listen for triggers\n" \
+            " [-mt | --motion-trigger ]: trigger while the input sees motion, it needs\n" \
+            "                           the --motion option of mjpg_streamer\n" \
+            " [-mi | --mirror ].......: write the pictures or the recording to this folder\n" \
+            "                           too, as folder[:frames[:new|old]], up to 4 times.\n" \
+            "                           Once this many frames wait, 64 by default, the\n" \
+            "                           newest or the oldest is dropped for this folder\n" \
+            " [-rp | --repack ].......: code the pictures of closed hours and mjpg\n" \
+            "                           recordings again in the background, with\n" \
+            "                           huffman, progressive or arithmetic coding\n" \
             " ---------------------------------------------------------------\n");
 }
 
@@ -85,11 +238,26 @@ Return Value: -
 void worker_cleanup(void *arg)
 {
     static unsigned char first_run = 1;
+    input_frame *f;
+    int i;
+
+    #ifdef IO_URING
+    stop_uring();
+    #endif
 
     if (mjpgFileName != NULL) {
-        close(fd);
+        close_recording();
     }
 
+    for(i = 0; i < mirrorCount; i++) {
+        mirror_free(mirrors[i]);
+        mirrors[i] = NULL;
+    }
+    mirrorCount = 0;
+
+    repack_free(repack);
+    repack = NULL;
+
     if(!first_run) {
         DBG("already cleaned up resources\n");
         return;
@@ -98,10 +266,40 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    if(frame != NULL) {
-        free(frame);
-    }
+    frame_unref(frame);
+    frame = NULL;
     close(fd);
+
+    free(writeBuffer);
+    writeBuffer = NULL;
+
+    command_queue_free(commands);
+    commands = NULL;
+
+    change_free(&detector);
+
+    if(partitionIndex >= 0) {
+        close(partitionIndex);
+        partitionIndex = -1;
+    }
+
+    pthread_mutex_lock(&preMutex);
+    while((f = pre_roll_pop()) != NULL)
+        frame_unref(f);
+    free(preFrames);
+    preFrames = NULL;
+    preCapacity = 0;
+    pthread_mutex_unlock(&preMutex);
+    memory_unregister(&preMemory);
+
+    while(ringCount > 0) {
+        free(ringNames[ringHead]);
+        ringHead = (ringHead + 1) % ringCapacity;
+        ringCount--;
+    }
+    free(ringNames);
+    ringNames = NULL;
+    ringCapacity = 0;
 }
 
 /******************************************************************************
@@ -145,193 +343,1232 @@ int check_for_filename(const struct dirent *entry)
 }
 
 /******************************************************************************
-Description.: delete oldest files, just keep "size" most recent files
-              This funtion MAY delete the wrong files if the time is not valid
-Input Value.: how many files to keep
+Description.: append a picture to the ringbuffer, the list of pictures grows
+              as a circular array
+Input Value.: name of the picture, the ringbuffer takes it over
+Return Value: 0 if ok, -1 without memory
+******************************************************************************/
+static int ringbuffer_push(char *name)
+{
+    char **names;
+    int capacity, i;
+
+    if(ringCount == ringCapacity) {
+        capacity = ringCapacity ? 2 * ringCapacity : 1024;
+        if((names = malloc(capacity * sizeof(char *))) == NULL)
+            return -1;
+        for(i = 0; i < ringCount; i++)
+            names[i] = ringNames[(ringHead + i) % ringCapacity];
+        free(ringNames);
+        ringNames = names;
+        ringCapacity = capacity;
+        ringHead = 0;
+    }
+
+    ringNames[(ringHead + ringCount) % ringCapacity] = name;
+    ringCount++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: compares a directory entry with the name of a day or an hour
+              directory of the partitions
+Input Value.: directory entry
+Return Value: 0 if string do not match, 1 if they match
+******************************************************************************/
+static int check_for_day(const struct dirent *entry)
+{
+    int year, month, day;
+    char rest;
+
+    return sscanf(entry->d_name, "%4d-%2d-%2d%c", &year, &month, &day, &rest) == 3;
+}
+
+static int check_for_hour(const struct dirent *entry)
+{
+    int hour;
+    char rest;
+
+    return sscanf(entry->d_name, "%2d%c", &hour, &rest) == 1;
+}
+
+/******************************************************************************
+Description.: append the pictures of a directory to the ringbuffer
+              This funtion MAY sort the files wrongly if the time is not valid
+Input Value.: the directory
 Return Value: -
 ******************************************************************************/
-void maintain_ringbuffer(int size)
+static void load_pictures(const char *path)
 {
     struct dirent **namelist;
-    int n, i;
     char buffer[1<<16];
-
-    /* do nothing if ringbuffer is not set or wrong value is set */
-    if(size < 0) return;
+    char *name;
+    int n, i;
 
     /* get a sorted list of directory items */
-    n = scandir(folder, &namelist, check_for_filename, alphasort);
+    n = scandir(path, &namelist, check_for_filename, alphasort);
     if(n < 0) {
         perror("scandir");
         return;
     }
 
-    DBG("found %d directory entries\n", n);
+    DBG("found %d directory entries in %s\n", n, path);
+
+    for(i = 0; i < n; i++) {
+        snprintf(buffer, sizeof(buffer), "%s/%s", path, namelist[i]->d_name);
+        if((name = strdup(buffer)) == NULL || ringbuffer_push(name) < 0)
+            free(name);
+        free(namelist[i]);
+    }
+    free(namelist);
+}
+
+/******************************************************************************
+Description.: fill the ringbuffer with the pictures already in the folder or
+              its partitions, just once at the start
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void load_ringbuffer(void)
+{
+    struct dirent **days, **hours;
+    char path[1024];
+    int n, m, i, j;
+
+    if(!partition) {
+        load_pictures(folder);
+        return;
+    }
+
+    if((n = scandir(folder, &days, check_for_day, alphasort)) < 0) {
+        perror("scandir");
+        return;
+    }
+    for(i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/%s", folder, days[i]->d_name);
+        if((m = scandir(path, &hours, check_for_hour, alphasort)) >= 0) {
+            for(j = 0; j < m; j++) {
+                snprintf(path, sizeof(path), "%s/%s/%s", folder, days[i]->d_name, hours[j]->d_name);
+                load_pictures(path);
+                free(hours[j]);
+            }
+            free(hours);
+        }
+        free(days[i]);
+    }
+    free(days);
+}
+
+/******************************************************************************
+Description.: remove the directory of an hour after its last picture was
+              deleted, and the one of its day after the last hour
+Input Value.: the name of the last picture
+Return Value: -
+******************************************************************************/
+static void remove_partition(const char *name)
+{
+    char path[1024], *slash;
+
+    snprintf(path, sizeof(path), "%s", name);
+    if((slash = strrchr(path, '/')) == NULL)
+        return;
+    *slash = '\0';
+
+    /* the current hour stays */
+    if(strcmp(path, partitionDir) == 0)
+        return;
+
+    snprintf(slash, sizeof(path) - (slash - path), "/%s", RECORDED_INDEX);
+    unlink(path);
+    *slash = '\0';
+    if(rmdir(path) < 0)
+        return;
+
+    if((slash = strrchr(path, '/')) != NULL) {
+        *slash = '\0';
+        rmdir(path);
+    }
+}
+
+/******************************************************************************
+Description.: open the directory and the index for a picture of this hour
+Input Value.: the local time of the picture
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int open_partition(struct tm *now)
+{
+    char pattern[1024], dir[1024], path[1100], *slash;
+
+    snprintf(pattern, sizeof(pattern), "%s/%s", folder, RECORDED_DIR);
+    if(strftime(dir, sizeof(dir), pattern, now) == 0) {
+        OPRINT("strftime returned 0\n");
+        return -1;
+    }
+    if(strcmp(dir, partitionDir) == 0)
+        return 0;
+
+    if(partitionIndex >= 0) {
+        close(partitionIndex);
+        partitionIndex = -1;
+    }
+    if(partitionDir[0] != '\0')
+        repack_directory(repack, partitionDir);
+
+    /* the day first, then its hour */
+    snprintf(path, sizeof(path), "%s", dir);
+    if((slash = strrchr(path, '/')) != NULL)
+        *slash = '\0';
+    if((mkdir(path, 0755) < 0 && errno != EEXIST) || (mkdir(dir, 0755) < 0 && errno != EEXIST)) {
+        OPRINT("could not create the directory %s\n", dir);
+        perror("mkdir()");
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, RECORDED_INDEX);
+    if((partitionIndex = open(path, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+        OPRINT("could not open the index %s\n", path);
+        return -1;
+    }
+
+    snprintf(partitionDir, sizeof(partitionDir), "%s", dir);
+    return 0;
+}
+
+/******************************************************************************
+Description.: delete oldest files, just keep "size" most recent files
+Input Value.: how many files to keep
+Return Value: -
+******************************************************************************/
+void maintain_ringbuffer(int size)
+{
+    char *name;
+    int i;
 
-    /* delete the first (thus oldest) number of files */
-    for(i = 0; i < (n - size); i++) {
+    /* do nothing if ringbuffer is not set or wrong value is set */
+    if(size < 0) return;
 
-        /* put together the folder name and the directory item */
-        snprintf(buffer, sizeof(buffer), "%s/%s", folder, namelist[i]->d_name);
+    /* delete the oldest files */
+    while(ringCount > size) {
+        name = ringNames[ringHead];
+        ringHead = (ringHead + 1) % ringCapacity;
+        ringCount--;
 
-        DBG("delete: %s\n", buffer);
+        DBG("delete: %s\n", name);
 
         /* mark item for deletion */
-        if(unlink(buffer) == -1) {
+        repack_lock(repack);
+        if(unlink(name) == -1) {
             perror("could not delete file");
         }
+        for(i = 0; i < mirrorCount; i++)
+            mirror_delete(mirrors[i], name + strlen(folder) + 1);
+
+        /* the pictures of the next hour are left */
+        if(partition && (ringCount == 0 ||
+                         strncmp(name, ringNames[ringHead], strrchr(name, '/') - name + 1) != 0))
+            remove_partition(name);
+        repack_unlock(repack);
+        free(name);
+    }
+}
 
-        /* free allocated memory for name */
-        free(namelist[i]);
+/******************************************************************************
+Description.: the steps after a picture was saved to its own file: link it,
+              call the command and maintain the ringbuffer
+Input Value.: name of the file
+Return Value: -
+******************************************************************************/
+static void picture_saved(const char *name)
+{
+    char buffer[1024], *copy;
+
+    saved++;
+
+    if(ringbuffer_size >= 0) {
+        if((copy = strdup(name)) == NULL || ringbuffer_push(copy) < 0)
+            free(copy);
     }
 
-    /* keep the rest, but we still have to free every result */
-    for(i = MAX(n - size, 0); i < n; i++) {
-        DBG("keep: %s\n", namelist[i]->d_name);
-        free(namelist[i]);
+    /* link the picture as fixed name file */
+    if (linkFileName) {
+        snprintf(buffer, sizeof(buffer), "%s/%s", folder, linkFileName);
+        unlink(buffer);
+        (void) link(name, buffer);
     }
 
-    /* free last just allocated resources */
-    free(namelist);
+    /* call the command if user specified one, pass current filename as argument,
+     * it runs from a thread of its own so no frame is missed meanwhile */
+    if(commands != NULL) {
+        command_queue_push(commands, name);
+    }
+
+    /*
+     * maintain ringbuffer
+     * do not maintain ringbuffer for each picture, the pictures above the
+     * size are deleted in batches of "exceed" files
+     */
+    if(ringbuffer_exceed <= 0) {
+        /* keep ringbuffer excactly at specified size */
+        maintain_ringbuffer(ringbuffer_size);
+    } else if(saved == 1 || saved % (ringbuffer_exceed + 1) == 0) {
+        DBG("saved: %llu, will clean-up now\n", saved);
+        maintain_ringbuffer(ringbuffer_size);
+    }
 }
 
+#ifdef IO_URING
 /******************************************************************************
-Description.: this is the main worker thread
-              it loops forever, grabs a fresh frame and stores it to file
-Input Value.:
-Return Value:
+Description.: set up io_uring for the writes. Single files are opened into a
+              slot of a file table, written and closed by linked requests,
+              which is tried once, since older kernels lack these slots.
+Input Value.: -
+Return Value: 0 if ok, -1 if the frames have to be written synchronously
 ******************************************************************************/
-void *worker_thread(void *arg)
+static int start_uring(void)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int i, failed = 0;
+
+    /* three requests and completions for each frame at most */
+    if(uring_init(&ring, 4 * queue_depth) < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+
+    if(mjpgFileName == NULL) {
+        if(uring_register_files(&ring, queue_depth) < 0) {
+            perror("io_uring_register");
+            uring_exit(&ring);
+            return -1;
+        }
+
+        sqe = uring_get_sqe(&ring);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)"/dev/null";
+        sqe->open_flags = O_WRONLY;
+        sqe->file_index = 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = uring_get_sqe(&ring);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = 1;
+
+        if(uring_submit(&ring, 2) < 0) {
+            failed = 1;
+        } else {
+            for(i = 0; i < 2 && (cqe = uring_peek_cqe(&ring)) != NULL; i++) {
+                failed |= (cqe->res < 0);
+                uring_cqe_seen(&ring);
+            }
+        }
+        if(failed) {
+            OPRINT("the kernel can not open files with io_uring\n");
+            uring_exit(&ring);
+            return -1;
+        }
+    }
+
+    if((pending = calloc(queue_depth, sizeof(pending_write))) == NULL) {
+        uring_exit(&ring);
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: handle the completed requests, a frame is done once all of its
+              requests completed
+Input Value.: number of completions to wait for
+Return Value: 0 if ok, -1 if a frame could not be written
+******************************************************************************/
+static int reap_writes(unsigned wait)
+{
+    struct io_uring_cqe *cqe;
+    pending_write *p;
+    int rc = 0;
+
+    if(wait > 0 && uring_submit(&ring, wait) < 0) {
+        perror("io_uring_enter");
+        return -1;
+    }
+
+    while((cqe = uring_peek_cqe(&ring)) != NULL) {
+        p = &pending[cqe->user_data >> 2];
+
+        /* requests linked after a failed one are cancelled */
+        if(cqe->res < 0 && cqe->res != -ECANCELED) {
+            OPRINT("%s failed: %s\n", ((cqe->user_data & 3) == OP_OPEN) ? "open()" :
+                   ((cqe->user_data & 3) == OP_WRITE) ? "write()" : "close()", strerror(-cqe->res));
+            p->failed = 1;
+        } else if(cqe->res < 0 || ((cqe->user_data & 3) == OP_WRITE && cqe->res != p->frame->size)) {
+            p->failed = 1;
+        }
+        uring_cqe_seen(&ring);
+
+        if(--p->completions > 0)
+            continue;
+
+        if(p->failed) {
+            OPRINT("could not write to file %s\n", (mjpgFileName == NULL) ? p->name : mjpgFileName);
+            rc = -1;
+        } else {
+            pglobal->out[plugin_id].stats.frames++;
+            pglobal->out[plugin_id].stats.bytes += p->frame->size;
+            if(mjpgFileName == NULL)
+                picture_saved(p->name);
+        }
+
+        frame_unref(p->frame);
+        p->frame = NULL;
+        pglobal->out[plugin_id].stats.backlog--;
+    }
+
+    return rc;
+}
+
+/******************************************************************************
+Description.: start writing a frame, it is referenced until it was written
+Input Value.: * f...: the frame
+              * name: of the file to write it to, NULL to append it to the
+                      mjpg file
+Return Value: 0 if ok, 1 if all writes are still busy, -1 on error
+******************************************************************************/
+static int queue_write(input_frame *f, const char *name)
+{
+    struct io_uring_sqe *sqe;
+    pending_write *p;
+    int i;
+
+    for(i = 0; i < queue_depth && pending[i].frame != NULL; i++);
+    if(i == queue_depth)
+        return 1;
+
+    p = &pending[i];
+    p->frame = frame_ref(f);
+    p->failed = 0;
+
+    if(name != NULL) {
+        snprintf(p->name, sizeof(p->name), "%s", name);
+
+        sqe = uring_get_sqe(&ring);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)p->name;
+        sqe->open_flags = O_CREAT | O_RDWR | O_TRUNC;
+        sqe->len = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+        sqe->file_index = i + 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (i << 2) | OP_OPEN;
+
+        sqe = uring_get_sqe(&ring);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = i;
+        sqe->addr = (unsigned long)f->buf;
+        sqe->len = f->size;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+        sqe->user_data = (i << 2) | OP_WRITE;
+
+        sqe = uring_get_sqe(&ring);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = i + 1;
+        sqe->user_data = (i << 2) | OP_CLOSE;
+
+        p->completions = 3;
+    } else {
+        /* several frames of the recording are written at their offsets */
+        sqe = uring_get_sqe(&ring);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long)f->buf;
+        sqe->len = f->size;
+        sqe->off = mjpgOffset;
+        sqe->user_data = (i << 2) | OP_WRITE;
+
+        p->completions = 1;
+    }
+    pglobal->out[plugin_id].stats.backlog++;
+
+    if(uring_submit(&ring, 0) < 0) {
+        perror("io_uring_enter");
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: wait until all frames on their way are written
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void drain_writes(void)
+{
+    int i, completions = 0;
+
+    if(pending == NULL)
+        return;
+
+    for(i = 0; i < queue_depth; i++) {
+        if(pending[i].frame != NULL)
+            completions += pending[i].completions;
+    }
+    if(completions > 0)
+        reap_writes(completions);
+}
+
+/******************************************************************************
+Description.: wait until all frames are written and close the ring
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void stop_uring(void)
+{
+    if(pending == NULL)
+        return;
+
+    drain_writes();
+    uring_exit(&ring);
+    free(pending);
+    pending = NULL;
+}
+#endif
+
+/******************************************************************************
+Description.: write the collected frames to the mjpg file. With O_DIRECT the
+              write is padded to whole blocks, the partial last block stays
+              in the buffer and is written again with the next data.
+Input Value.: -
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int flush_buffer(void)
+{
+    int length = writeLength, tail = 0, done = 0;
+    ssize_t rc;
+
+    if(writeBuffer == NULL || writeLength == writeDone)
+        return 0;
+
+    if(directIO) {
+        tail = writeLength % DIRECT_ALIGN;
+        if(tail > 0) {
+            length += DIRECT_ALIGN - tail;
+            memset(writeBuffer + writeLength, 0, length - writeLength);
+        }
+    }
+
+    while(done < length) {
+        if((rc = pwrite(fd, writeBuffer + done, length - done, writeStart + done)) < 0) {
+            if(errno == EINTR)
+                continue;
+            OPRINT("could not write to file %s\n", mjpgFileName);
+            perror("write()");
+            return -1;
+        }
+        done += rc;
+    }
+
+    writeStart += writeLength - tail;
+    memmove(writeBuffer, writeBuffer + writeLength - tail, tail);
+    writeLength = writeDone = tail;
+    return 0;
+}
+
+/******************************************************************************
+Description.: append a frame to the buffer, it is written once it is full
+              or the oldest data waited long enough
+Input Value.: * data: the frame
+              * size: its length
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int buffer_write(const unsigned char *data, int size)
+{
+    int n;
+
+    if(writeLength == writeDone)
+        writeSince = monotonic_usec();
+
+    while(size > 0) {
+        n = (size < writeBufferSize - writeLength) ? size : writeBufferSize - writeLength;
+        memcpy(writeBuffer + writeLength, data, n);
+        writeLength += n;
+        data += n;
+        size -= n;
+
+        if(writeLength == writeBufferSize && flush_buffer() < 0)
+            return -1;
+    }
+
+    if(writeLength > writeDone && monotonic_usec() >= writeSince + writeTime * 1000ULL)
+        return flush_buffer();
+    return 0;
+}
+
+/******************************************************************************
+Description.: number the name of a file of a recording which exists already,
+              like a file started within the same second as the one before,
+              name_1.mjpg, name_2.mjpg and so on
+Input Value.: * name: of the file, gets the number
+              * size: room at name
+Return Value: -
+******************************************************************************/
+static void number_recording(char *name, size_t size)
+{
+    char numbered[1024 + 16];
+    const char *extension;
+    int i, len;
+
+    if(access(name, F_OK) != 0)
+        return;
+
+    if((extension = strrchr(name, '.')) == NULL || strchr(extension, '/') != NULL)
+        extension = name + strlen(name);
+    for(i = 1; i < 1000; i++) {
+        len = snprintf(numbered, sizeof(numbered), "%.*s_%d%s", (int)(extension - name), name, i, extension);
+        if(len < 0 || (size_t)len >= size)
+            return;
+        if(access(numbered, F_OK) != 0) {
+            memcpy(name, numbered, len + 1);
+            return;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: open the next file of the recording, the time replaces the
+              strftime() formats of its name. Rotated recordings without
+              formats get the time appended to their names, files of them
+              which would replace one get a number.
+Input Value.: * when...: time the recording starts at
+              * rotated: the file follows another one of the recording
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int open_recording(time_t when, int rotated)
+{
+    char pattern[1024], name[1024], *indexName;
+    const char *extension;
+    struct tm *now;
+
+    if((rotated || rotateSize > 0 || rotateTime > 0) && strchr(mjpgFileName, '%') == NULL) {
+        if((extension = strrchr(mjpgFileName, '.')) == NULL)
+            extension = mjpgFileName + strlen(mjpgFileName);
+        snprintf(pattern, sizeof(pattern), "%s/%.*s_%%Y_%%m_%%d_%%H_%%M_%%S%s",
+                 folder, (int)(extension - mjpgFileName), mjpgFileName, extension);
+    } else {
+        snprintf(pattern, sizeof(pattern), "%s/%s", folder, mjpgFileName);
+    }
+
+    if((now = localtime(&when)) == NULL || strftime(name, sizeof(name), pattern, now) == 0) {
+        OPRINT("could not compose the name of the recording\n");
+        return -1;
+    }
+    if(rotated || rotateSize > 0 || rotateTime > 0)
+        number_recording(name, sizeof(name));
+
+    OPRINT("output file.......: %s\n", name);
+    snprintf(recordingName, sizeof(recordingName), "%s", name + strlen(folder) + 1);
+    mjpgOffset = 0;
+    recordingStart = 0;
+    allocated = 0;
+    lastSync = monotonic_usec();
+
+    if(aviMode) {
+        if(avi_open(&avi, name) < 0) {
+            OPRINT("could not open the file %s\n", name);
+            return -1;
+        }
+        return 0;
+    }
+
+    writeLength = writeDone = 0;
+    writeStart = 0;
+
+    if(directIO && (fd = open(name, O_CREAT | O_RDWR | O_TRUNC | O_DIRECT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+        OPRINT("could not open the file %s with O_DIRECT, using the page cache\n", name);
+        directIO = 0;
+    }
+    if(!directIO && (fd = open(name, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+        OPRINT("could not open the file %s\n", name);
+        return -1;
+    }
+
+    /* the timestamps let input_file play the recording at its pace */
+    if((indexName = malloc(strlen(name) + 5)) != NULL)
+        sprintf(indexName, "%s.idx", name);
+    if(indexName == NULL || (indexFile = fopen(indexName, "w")) == NULL) {
+        OPRINT("could not open the index of %s\n", name);
+    } else {
+        fputs(MJPG_INDEX_HEADER, indexFile);
+    }
+    free(indexName);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: finish the file of the recording, an AVI gets its index
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void close_recording(void)
 {
-    int ok = 1, frame_size = 0, rc = 0;
+    char path[2100];
+    int i;
+
+    #ifdef IO_URING
+    drain_writes();
+    #endif
+
+    for(i = 0; i < mirrorCount; i++)
+        mirror_close(mirrors[i]);
+
+    if(aviMode) {
+        if(avi_close(&avi) < 0)
+            perror("could not finish the AVI");
+        return;
+    }
+
+    if(fd >= 0) {
+        flush_buffer();
+
+        /* the rest of the last extent and the padding of O_DIRECT are given back */
+        if((allocated > mjpgOffset || directIO) && ftruncate(fd, mjpgOffset) < 0)
+            perror("could not truncate the recording");
+        close(fd);
+        fd = -1;
+        if(indexFile != NULL)
+            fflush(indexFile);
+        snprintf(path, sizeof(path), "%s/%s", folder, recordingName);
+        repack_recording(repack, path);
+    }
+    if(indexFile != NULL) {
+        fclose(indexFile);
+        indexFile = NULL;
+    }
+}
+
+/******************************************************************************
+Description.: allocate the blocks for the next bytes of the recording, it
+              grows by whole extents, so the file is not fragmented by the
+              writes of other files in between
+Input Value.: number of bytes about to be written
+Return Value: -
+******************************************************************************/
+static void preallocate(int bytes)
+{
+    long long end = (aviMode ? avi.position : mjpgOffset) + bytes;
+    long long length = preallocateSize;
+
+    if(preallocateSize <= 0 || end <= allocated)
+        return;
+
+    /* a rotated recording needs no more than its size */
+    if(rotateSize > 0 && allocated + length > rotateSize)
+        length = rotateSize - allocated;
+    if(allocated + length < end)
+        length = end - allocated;
+
+    if(fallocate(aviMode ? avi.fd : fd, 0, allocated, length) < 0) {
+        perror("could not preallocate the recording, it grows with the writes");
+        preallocateSize = 0;
+        return;
+    }
+    allocated += length;
+}
+
+/******************************************************************************
+Description.: sync the data of the recording and its index to the disk once
+              the interval passed
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void sync_recording(void)
+{
+    unsigned long long now = monotonic_usec();
+
+    if(syncInterval <= 0 || now - lastSync < syncInterval * 1000000ULL)
+        return;
+    lastSync = now;
+
+    flush_buffer();
+    if(fdatasync(aviMode ? avi.fd : fd) < 0)
+        perror("fdatasync()");
+    if(indexFile != NULL && (fflush(indexFile) != 0 || fdatasync(fileno(indexFile)) < 0))
+        perror("could not sync the index");
+}
+
+/******************************************************************************
+Description.: tell whether a frame belongs into the next file of the
+              recording already
+Input Value.: the frame
+Return Value: 1 if the recording has to rotate, 0 otherwise
+******************************************************************************/
+static int rotation_due(input_frame *f)
+{
+    unsigned long long usec = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
+    long long size = aviMode ? avi.position : mjpgOffset;
+
+    if(recordingStart == 0) {
+        recordingStart = usec;
+        return 0;
+    }
+
+    if(rotateSize > 0 && size + f->size > rotateSize)
+        return 1;
+    return (rotateTime > 0 && usec >= recordingStart + rotateTime * 1000000ULL);
+}
+
+/******************************************************************************
+Description.: save a frame, with io_uring it is only started here
+Input Value.: * f...: the frame
+              * name: of its own file, NULL to append it to the mjpg file
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int save_frame(input_frame *f, const char *name)
+{
+    unsigned long long usec;
+    int file, rc;
+
+    #ifdef IO_URING
+    if(pending != NULL)
+        return (queue_write(f, name) < 0) ? -1 : 0;
+    #endif
+
+    if(name == NULL && aviMode) {
+        /* an AVI has room for AVI_SEGMENTS GB, the next file takes the rest */
+        usec = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
+        rc = avi_write_frame(&avi, f->buf, f->size, usec);
+        if(rc < 0 && errno == EFBIG) {
+            close_recording();
+            if((rc = open_recording(time(NULL), 1)) == 0)
+                rc = avi_write_frame(&avi, f->buf, f->size, usec);
+        }
+        if(rc < 0) {
+            OPRINT("could not write to the AVI\n");
+            perror("write()");
+            return -1;
+        }
+    } else if(name == NULL && writeBuffer != NULL) {
+        if(buffer_write(f->buf, f->size) < 0)
+            return -1;
+    } else if(name == NULL) {
+        /* save picture to the mjpg file */
+        if(write(fd, f->buf, f->size) < 0) {
+            OPRINT("could not write to file %s\n", mjpgFileName);
+            perror("write()");
+            return -1;
+        }
+    } else {
+        /* open file for write */
+        if((file = open(name, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+            OPRINT("could not open the file %s\n", name);
+            return -1;
+        }
+
+        /* save picture to file */
+        if(write(file, f->buf, f->size) < 0) {
+            OPRINT("could not write to file %s\n", name);
+            perror("write()");
+            close(file);
+            return -1;
+        }
+
+        close(file);
+    }
+
+    pglobal->out[plugin_id].stats.frames++;
+    pglobal->out[plugin_id].stats.bytes += f->size;
+    if(name != NULL)
+        picture_saved(name);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: store a frame as its own file or append it to the recording
+Input Value.: the frame
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int store_frame(input_frame *f)
+{
+    unsigned long long usec = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
     char buffer1[1024] = {0}, buffer2[1024] = {0};
-    unsigned long long counter = 0;
+    struct timeval captured;
+    recorded_entry entry;
     time_t t;
     struct tm *now;
-    unsigned char *tmp_framebuffer = NULL;
+    int i;
 
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(worker_cleanup, NULL);
+    if(changeThreshold > 0 && !change_detect(&detector, f, usec ? usec : monotonic_usec())) {
+        DBG("skipping an unchanged frame\n");
+        return 0;
+    }
 
-    while(ok >= 0 && !pglobal->stop) {
-        DBG("waiting for fresh frame\n");
+    if (mjpgFileName == NULL) { // single files with ringbuffer mode
+        /* the wall clock time of the capture, frames of a pre-roll are written later */
+        frame_wall_time(f, &captured);
+        t = captured.tv_sec;
+        now = localtime(&t);
+        if(now == NULL) {
+            perror("localtime");
+            return -1;
+        }
 
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        if(partition && open_partition(now) < 0)
+            return -1;
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+        /* prepare string, add time and date values */
+        if(strftime(buffer1, sizeof(buffer1), "%%s/" RECORDED_NAME, now) == 0) {
+            OPRINT("strftime returned 0\n");
+            return -1;
+        }
 
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+        /* finish filename by adding the foldername and a counter value */
+        snprintf(buffer2, sizeof(buffer2), buffer1, partition ? partitionDir : folder, pictures);
 
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
+        entry.timestamp = captured.tv_sec * 1000000ULL + captured.tv_usec;
+        entry.number = pictures;
+        pictures++;
+
+        DBG("writing file: %s\n", buffer2);
+
+        /* a mirror falls behind on its own, it does not hold up the folder */
+        for(i = 0; i < mirrorCount; i++)
+            mirror_frame(mirrors[i], f, buffer2 + strlen(folder) + 1);
+
+        if(save_frame(f, buffer2) < 0)
+            return -1;
+
+        if(partition && write(partitionIndex, &entry, sizeof(entry)) != sizeof(entry))
+            OPRINT("could not add %s to the index\n", buffer2);
+        return 0;
+    }
+
+    // recording to MJPG file
+    /* the frame starts the next file if this one is long enough */
+    if(rotation_due(f)) {
+        close_recording();
+        if(open_recording(time(NULL), 1) < 0)
+            return -1;
+        recordingStart = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
+    }
+
+    for(i = 0; i < mirrorCount; i++)
+        mirror_frame(mirrors[i], f, recordingName);
+
+    /* an AVI chunk adds its header and padding */
+    preallocate(f->size + 9);
+
+    if(save_frame(f, NULL) < 0)
+        return -1;
+
+    if(indexFile != NULL) {
+        fprintf(indexFile, "%lld %d %llu\n", mjpgOffset, f->size,
+                f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec);
+    }
+    mjpgOffset += f->size;
+
+    sync_recording();
+    return 0;
+}
+
+/******************************************************************************
+Description.: start or extend an event, its recording lasts until the
+              post-roll after the last trigger
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void trigger_event(void)
+{
+    pthread_mutex_lock(&eventMutex);
+    eventEnd = monotonic_usec() + postRoll * 1000000ULL;
+    pthread_mutex_unlock(&eventMutex);
+    DBG("event triggered\n");
+}
+
+/******************************************************************************
+Description.: take the oldest frame out of the pre-roll, preMutex is held
+Input Value.: -
+Return Value: the frame with the reference of the pre-roll, NULL if it is empty
+******************************************************************************/
+static input_frame *pre_roll_pop(void)
+{
+    input_frame *f;
+
+    if(preCount == 0)
+        return NULL;
 
-            frame = tmp_framebuffer;
+    f = preFrames[preHead];
+    preHead = (preHead + 1) % preCapacity;
+    preCount--;
+    preBytes -= f->size;
+    memory_add(&preMemory, -(long long)f->size);
+    return f;
+}
+
+/******************************************************************************
+Description.: keep a frame in the pre-roll, the oldest ones are released
+              once it is longer or larger than allowed
+Input Value.: the frame, the pre-roll takes its own reference
+Return Value: -
+******************************************************************************/
+static void keep_frame(input_frame *f)
+{
+    input_frame **frames;
+    unsigned long long newest, oldest;
+    int capacity, i;
+
+    if(preRoll <= 0 && preRollSize <= 0)
+        return;
+
+    pthread_mutex_lock(&preMutex);
+    if(preCount == preCapacity) {
+        capacity = preCapacity ? 2 * preCapacity : 64;
+        if((frames = malloc(capacity * sizeof(input_frame *))) == NULL) {
+            pthread_mutex_unlock(&preMutex);
+            return;
         }
+        for(i = 0; i < preCount; i++)
+            frames[i] = preFrames[(preHead + i) % preCapacity];
+        free(preFrames);
+        preFrames = frames;
+        preCapacity = capacity;
+        preHead = 0;
+    }
 
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+    preFrames[(preHead + preCount) % preCapacity] = frame_ref(f);
+    preCount++;
+    preBytes += f->size;
+    memory_add(&preMemory, f->size);
+
+    newest = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
+    while(preCount > 0) {
+        f = preFrames[preHead];
+        oldest = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
+        if(!(preRoll > 0 && newest > oldest + preRoll * 1000000ULL) &&
+           !(preRollSize > 0 && preBytes > preRollSize))
+            break;
 
-        /* allow others to access the global buffer again */
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        frame_unref(pre_roll_pop());
+    }
+    pthread_mutex_unlock(&preMutex);
+}
 
-        if (mjpgFileName == NULL) { // single files with ringbuffer mode
-            /* prepare filename */
-            memset(buffer1, 0, sizeof(buffer1));
-            memset(buffer2, 0, sizeof(buffer2));
+/******************************************************************************
+Description.: release the oldest frames of the pre-roll for the memory budget
+Input Value.: * arg..: unused
+              * bytes: to free
+Return Value: bytes freed
+******************************************************************************/
+static long long pre_roll_evict(void *arg, long long bytes)
+{
+    long long freed = 0;
+    input_frame *f;
 
-            /* get current time */
-            t = time(NULL);
-            now = localtime(&t);
-            if(now == NULL) {
-                perror("localtime");
-                return NULL;
-            }
+    pthread_mutex_lock(&preMutex);
+    while(freed < bytes && (f = pre_roll_pop()) != NULL) {
+        freed += f->size;
+        frame_unref(f);
+    }
+    pthread_mutex_unlock(&preMutex);
 
-            /* prepare string, add time and date values */
-            if(strftime(buffer1, sizeof(buffer1), "%%s/%Y_%m_%d_%H_%M_%S_picture_%%09llu.jpg", now) == 0) {
-                OPRINT("strftime returned 0\n");
-                free(frame); frame = NULL;
-                return NULL;
-            }
+    return freed;
+}
 
-            /* finish filename by adding the foldername and a counter value */
-            snprintf(buffer2, sizeof(buffer2), buffer1, folder, counter);
+/******************************************************************************
+Description.: store the frames of the pre-roll once an event starts
+Input Value.: -
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int flush_pre_roll(void)
+{
+    input_frame *f;
+    int rc = 0;
 
-            counter++;
+    while(1) {
+        pthread_mutex_lock(&preMutex);
+        f = pre_roll_pop();
+        pthread_mutex_unlock(&preMutex);
+        if(f == NULL)
+            break;
 
-            DBG("writing file: %s\n", buffer2);
+        #ifdef IO_URING
+        /* the whole pre-roll goes to the disk, nothing is skipped */
+        while(rc == 0 && pending != NULL && pglobal->out[plugin_id].stats.backlog == queue_depth)
+            rc = reap_writes(1);
+        #endif
 
-            /* open file for write */
-            if((fd = open(buffer2, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
-                OPRINT("could not open the file %s\n", buffer2);
-                return NULL;
-            }
+        if(rc == 0)
+            rc = store_frame(f);
+        frame_unref(f);
+    }
 
-            /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
-                OPRINT("could not write to file %s\n", buffer2);
-                perror("write()");
-                close(fd);
-                return NULL;
-            }
+    return rc;
+}
 
-            close(fd);
+/******************************************************************************
+Description.: handle a frame of a triggered recording, it is stored during an
+              event and kept in the pre-roll otherwise
+Input Value.: the frame
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int triggered_frame(input_frame *f)
+{
+    int active;
+
+    pthread_mutex_lock(&eventMutex);
+    active = monotonic_usec() < eventEnd;
+    pthread_mutex_unlock(&eventMutex);
+
+    if(active && !recording) {
+        OPRINT("event.............: recording %d frames of the pre-roll\n", preCount);
+        recording = 1;
+        if(mjpgFileName != NULL && open_recording(time(NULL), 1) < 0)
+            return -1;
+        if(flush_pre_roll() < 0)
+            return -1;
+    } else if(!active && recording) {
+        OPRINT("event.............: finished\n");
+        recording = 0;
+        if(mjpgFileName != NULL)
+            close_recording();
+    }
 
-            /* link the picture as fixed name file */
-            if (linkFileName) {
-                snprintf(buffer1, sizeof(buffer1), "%s/%s", folder, linkFileName);
-                unlink(buffer1);
-                (void) link(buffer2, buffer1);
-            }
+    if(!recording) {
+        keep_frame(f);
+        return 0;
+    }
 
-            /* call the command if user specified one, pass current filename as argument */
-            if(command != NULL) {
-                memset(buffer1, 0, sizeof(buffer1));
+    if(store_frame(f) < 0)
+        return -1;
 
-                /* buffer2 still contains the filename, pass it to the command as parameter */
-                snprintf(buffer1, sizeof(buffer1), "%s \"%s\"", command, buffer2);
-                DBG("calling command %s", buffer1);
+    /* if specified, wait now */
+    if(delay > 0) {
+        usleep(1000 * delay);
+    }
+    return 0;
+}
 
-                /* in addition provide the filename as environment variable */
-                if((rc = setenv("MJPG_FILE", buffer2, 1)) != 0) {
-                    LOG("setenv failed (return value %d)\n", rc);
-                }
+/******************************************************************************
+Description.: close the UDP socket of the trigger thread
+Input Value.: unused argument
+Return Value: -
+******************************************************************************/
+static void trigger_cleanup(void *arg)
+{
+    if(triggerSocket >= 0) {
+        close(triggerSocket);
+        triggerSocket = -1;
+    }
+}
 
-                /* execute the command now */
-                if((rc = system(buffer1)) != 0) {
-                    LOG("command failed (return value %d)\n", rc);
-                }
-            }
+/******************************************************************************
+Description.: wait for UDP messages, each one triggers an event and is sent
+              back to the sender
+Input Value.: unused argument
+Return Value: NULL
+******************************************************************************/
+static void *trigger_thread(void *arg)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    char udpbuffer[1024];
+    ssize_t bytes;
+
+    pthread_cleanup_push(trigger_cleanup, NULL);
+
+    while(!pglobal->stop) {
+        addr_len = sizeof(addr);
+        bytes = recvfrom(triggerSocket, udpbuffer, sizeof(udpbuffer), 0, (struct sockaddr*)&addr, &addr_len);
+        if(bytes < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("recvfrom");
+            break;
+        }
+
+        trigger_event();
+
+        // send back client's message that came in udpbuffer
+        sendto(triggerSocket, udpbuffer, bytes, 0, (struct sockaddr*)&addr, addr_len);
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: this is the main worker thread
+              it loops forever, grabs a fresh frame and stores it to file
+Input Value.:
+Return Value:
+******************************************************************************/
+void *worker_thread(void *arg)
+{
+    int ok = 1, wait;
+    frame_subscription sub;
+    motion_state motion;
+
+    /* set cleanup handler to cleanup allocated resources */
+    pthread_cleanup_push(worker_cleanup, NULL);
 
-            /*
-             * maintain ringbuffer
-             * do not maintain ringbuffer for each picture, this saves resources since
-             * each run of the maintainance function involves sorting/malloc/free operations
-             */
-            if(ringbuffer_exceed <= 0) {
-                /* keep ringbuffer excactly at specified siOUTPUT_PLUGIN_NAMEze */
-                maintain_ringbuffer(ringbuffer_size);
-            } else if(counter == 1 || counter % (ringbuffer_exceed + 1) == 0) {
-                DBG("counter: %llu, will clean-up now\n", counter);
-                maintain_ringbuffer(ringbuffer_size);
+    /* a recording or pre-roll should contain every frame, not just the latest */
+    if(mjpgFileName == NULL && postRoll <= 0)
+        frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, NULL);
+    else
+        frame_subscribe(&sub, &pglobal->in[input_number], FRAME_NEXT, &pglobal->out[plugin_id].stats);
+
+    while(ok >= 0 && !pglobal->stop) {
+        DBG("waiting for fresh frame\n");
+
+        /* release the previous frame and take a reference to a fresh one */
+        frame_unref(frame);
+        frame = NULL;
+        if(writeLength > writeDone) {
+            /* the buffer is written in time even if no frame comes */
+            wait = (writeSince + writeTime * 1000ULL > monotonic_usec()) ?
+                   (writeSince + writeTime * 1000ULL - monotonic_usec()) / 1000 : 0;
+            if((frame = frame_next(&sub, wait)) == NULL) {
+                if(flush_buffer() < 0)
+                    break;
+                continue;
             }
-        } else { // recording to MJPG file
-            /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
-                OPRINT("could not write to file %s\n", buffer2);
-                perror("write()");
-                close(fd);
-                return NULL;
+        } else {
+            frame = frame_next(&sub, -1);
+        }
+        if(sub.mode == FRAME_NEXT && sub.skipped > 0)
+            DBG("recording fell behind, %llu frames dropped\n", sub.skipped);
+
+        /* files, the AVI and the disk writes take the JPEG in one piece */
+        if(frame != NULL && (frame = frame_flatten(frame)) == NULL) {
+            pglobal->out[plugin_id].stats.overruns++;
+            continue;
+        }
+
+        #ifdef IO_URING
+        if(pending != NULL) {
+            /* finish the frames written since, then the disk gets the new one
+             * unless it still works on as many as allowed, a frame waiting
+             * for an event is only kept in memory */
+            if(reap_writes(0) < 0)
+                break;
+            if(pglobal->out[plugin_id].stats.backlog == queue_depth && (postRoll <= 0 || recording)) {
+                pglobal->out[plugin_id].stats.overruns++;
+                continue;
             }
         }
+        #endif
+
+        if(postRoll > 0) {
+            /* motion in the frames of the input triggers like a UDP message */
+            if(motionTrigger && motion_get(&pglobal->in[input_number], &motion) == 0 && motion.active)
+                trigger_event();
+            if(triggered_frame(frame) < 0)
+                break;
+            continue;
+        }
+
+        if(store_frame(frame) < 0)
+            break;
 
         /* if specified, wait now */
         if(delay > 0) {
@@ -390,6 +1627,46 @@ int output_init(output_parameter *param, int id)
             {"link", required_argument, 0, 0},
             {"c", required_argument, 0, 0},
             {"command", required_argument, 0, 0},
+            {"q", required_argument, 0, 0},
+            {"queue", required_argument, 0, 0},
+            {"rs", required_argument, 0, 0},
+            {"rotate-size", required_argument, 0, 0},
+            {"rt", required_argument, 0, 0},
+            {"rotate-time", required_argument, 0, 0},
+            {"pa", required_argument, 0, 0},
+            {"preallocate", required_argument, 0, 0},
+            {"sy", required_argument, 0, 0},
+            {"sync", required_argument, 0, 0},
+            {"po", required_argument, 0, 0},
+            {"post-roll", required_argument, 0, 0},
+            {"pr", required_argument, 0, 0},
+            {"pre-roll", required_argument, 0, 0},
+            {"pb", required_argument, 0, 0},
+            {"pre-roll-size", required_argument, 0, 0},
+            {"tu", required_argument, 0, 0},
+            {"trigger-udp", required_argument, 0, 0},
+            {"wb", required_argument, 0, 0},
+            {"write-buffer", required_argument, 0, 0},
+            {"wt", required_argument, 0, 0},
+            {"write-time", required_argument, 0, 0},
+            {"od", no_argument, 0, 0},
+            {"direct", no_argument, 0, 0},
+            {"pt", no_argument, 0, 0},
+            {"partition", no_argument, 0, 0},
+            {"cq", required_argument, 0, 0},
+            {"command-queue", required_argument, 0, 0},
+            {"cc", required_argument, 0, 0},
+            {"command-coalesce", required_argument, 0, 0},
+            {"ch", required_argument, 0, 0},
+            {"changes", required_argument, 0, 0},
+            {"ck", required_argument, 0, 0},
+            {"change-keep", required_argument, 0, 0},
+            {"mi", required_argument, 0, 0},
+            {"mirror", required_argument, 0, 0},
+            {"mt", no_argument, 0, 0},
+            {"motion-trigger", no_argument, 0, 0},
+            {"rp", required_argument, 0, 0},
+            {"repack", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -467,6 +1744,136 @@ int output_init(output_parameter *param, int id)
             DBG("case 16,17\n");
             command = strdup(optarg);
             break;
+            /* q queue */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            queue_depth = atoi(optarg);
+            break;
+            /* rs rotate-size */
+        case 20:
+        case 21:
+            DBG("case 20,21\n");
+            rotateSize = atoll(optarg) * 1024 * 1024;
+            break;
+            /* rt rotate-time */
+        case 22:
+        case 23:
+            DBG("case 22,23\n");
+            rotateTime = atoi(optarg);
+            break;
+            /* pa preallocate */
+        case 24:
+        case 25:
+            DBG("case 24,25\n");
+            preallocateSize = atoll(optarg) * 1024 * 1024;
+            break;
+            /* sy sync */
+        case 26:
+        case 27:
+            DBG("case 26,27\n");
+            syncInterval = atoi(optarg);
+            break;
+            /* po post-roll */
+        case 28:
+        case 29:
+            DBG("case 28,29\n");
+            postRoll = atoi(optarg);
+            break;
+            /* pr pre-roll */
+        case 30:
+        case 31:
+            DBG("case 30,31\n");
+            preRoll = atoi(optarg);
+            break;
+            /* pb pre-roll-size */
+        case 32:
+        case 33:
+            DBG("case 32,33\n");
+            preRollSize = atoll(optarg) * 1024 * 1024;
+            break;
+            /* tu trigger-udp */
+        case 34:
+        case 35:
+            DBG("case 34,35\n");
+            triggerPort = atoi(optarg);
+            break;
+            /* wb write-buffer */
+        case 36:
+        case 37:
+            DBG("case 36,37\n");
+            writeBufferSize = atoi(optarg) * 1024;
+            break;
+            /* wt write-time */
+        case 38:
+        case 39:
+            DBG("case 38,39\n");
+            writeTime = atoi(optarg);
+            break;
+            /* od direct */
+        case 40:
+        case 41:
+            DBG("case 40,41\n");
+            directIO = 1;
+            break;
+            /* pt partition */
+        case 42:
+        case 43:
+            DBG("case 42,43\n");
+            partition = 1;
+            break;
+            /* cq command-queue */
+        case 44:
+        case 45:
+            DBG("case 44,45\n");
+            commandDepth = atoi(optarg);
+            break;
+            /* cc command-coalesce */
+        case 46:
+        case 47:
+            DBG("case 46,47\n");
+            commandCoalesce = atoi(optarg);
+            break;
+            /* ch changes */
+        case 48:
+        case 49:
+            DBG("case 48,49\n");
+            changeThreshold = atof(optarg);
+            break;
+            /* ck change-keep */
+        case 50:
+        case 51:
+            DBG("case 50,51\n");
+            changeKeep = atoi(optarg);
+            break;
+
+            /* mi, mirror */
+        case 52:
+        case 53:
+            DBG("case 52,53\n");
+            if(mirrorCount == MAX_MIRRORS) {
+                OPRINT("ERROR: at most %d mirrors\n", MAX_MIRRORS);
+                return 1;
+            }
+            mirrorSpecs[mirrorCount++] = optarg;
+            break;
+
+            /* mt, motion-trigger */
+        case 54:
+        case 55:
+            DBG("case 54,55\n");
+            motionTrigger = 1;
+            break;
+
+            /* rp, repack */
+        case 56:
+        case 57:
+            DBG("case 56,57\n");
+            if((repackMode = repack_mode(optarg)) < 0) {
+                OPRINT("ERROR: unknown or unsupported repacking %s\n", optarg);
+                return 1;
+            }
+            break;
         }
     }
 
@@ -478,28 +1885,148 @@ int output_init(output_parameter *param, int id)
     OPRINT("output folder.....: %s\n", folder);
     OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
     OPRINT("delay after save..: %d\n", delay);
+    if(changeThreshold > 0) {
+        change_init(&detector, changeThreshold, changeKeep);
+        #ifdef NO_LIBJPEG
+        OPRINT("changes...........: only identical frames are skipped without libjpeg\n");
+        #else
+        OPRINT("changes...........: %g %% of the picture, kept every %d s\n", changeThreshold, changeKeep);
+        #endif
+    }
+    if(postRoll > 0) {
+        OPRINT("post-roll.........: %d s\n", postRoll);
+        if(preRoll > 0) {
+            OPRINT("pre-roll..........: %d s\n", preRoll);
+        }
+        if(preRollSize > 0) {
+            OPRINT("pre-roll size.....: %lld MB\n", preRollSize / (1024 * 1024));
+        }
+    } else if(preRoll > 0 || preRollSize > 0 || triggerPort > 0 || motionTrigger) {
+        OPRINT("ERROR: a triggered recording needs the --post-roll\n");
+        return 1;
+    }
+    if(triggerPort > 0) {
+        struct sockaddr_in addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(triggerPort);
+        if((triggerSocket = socket(PF_INET, SOCK_DGRAM, 0)) < 0 ||
+           bind(triggerSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            perror("could not listen for triggers");
+            return 1;
+        }
+        OPRINT("trigger UDP port..: %d\n", triggerPort);
+    }
+    if(motionTrigger) {
+        motion_state motion;
+
+        if(motion_get(&pglobal->in[input_number], &motion) < 0) {
+            OPRINT("ERROR: input %d has no motion detection, give it --motion\n", input_number);
+            return 1;
+        }
+        OPRINT("motion trigger....: %dx%d zones\n", motion.columns, motion.rows);
+    }
     if  (mjpgFileName == NULL) {
+        if(partition) {
+            OPRINT("partitions........: %s/%s\n", folder, RECORDED_DIR);
+        }
+        if(ringbuffer_size >= 0)
+            load_ringbuffer();
         if(ringbuffer_size > 0) {
             OPRINT("ringbuffer size...: %d to %d\n", ringbuffer_size, ringbuffer_size + ringbuffer_exceed);
         } else {
             OPRINT("ringbuffer size...: %s\n", "no ringbuffer");
         }
     } else {
-        char *fnBuffer = malloc(strlen(mjpgFileName) + strlen(folder) + 3);
-        sprintf(fnBuffer, "%s/%s", folder, mjpgFileName);
+        aviMode = strlen(mjpgFileName) > 4 && strcasecmp(mjpgFileName + strlen(mjpgFileName) - 4, ".avi") == 0;
+        if(rotateSize > 0) {
+            OPRINT("rotate after......: %lld MB\n", rotateSize / (1024 * 1024));
+        }
+        if(rotateTime > 0) {
+            OPRINT("rotate after......: %d s\n", rotateTime);
+        }
+        if(preallocateSize > 0) {
+            OPRINT("preallocate.......: %lld MB\n", preallocateSize / (1024 * 1024));
+        }
+        if(syncInterval > 0) {
+            OPRINT("sync every........: %d s\n", syncInterval);
+        }
+        if(writeBufferSize > 0 && aviMode) {
+            OPRINT("write buffer......: an AVI is written frame by frame\n");
+            directIO = 0;
+        } else if(writeBufferSize > 0) {
+            /* whole blocks for O_DIRECT */
+            writeBufferSize = (writeBufferSize + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+            if(posix_memalign((void **)&writeBuffer, DIRECT_ALIGN, writeBufferSize) != 0) {
+                OPRINT("could not allocate the write buffer\n");
+                return 1;
+            }
+            OPRINT("write buffer......: %d KB, written at least every %d ms%s\n",
+                   writeBufferSize / 1024, writeTime, directIO ? " with O_DIRECT" : "");
+        } else if(directIO) {
+            OPRINT("ERROR: O_DIRECT needs a --write-buffer\n");
+            return 1;
+        }
+        /* a triggered recording opens a file per event */
+        if(postRoll <= 0 && open_recording(time(NULL), 0) < 0)
+            return 1;
+    }
+
+    if(repackMode >= 0) {
+        if(mjpgFileName == NULL ? !partition : aviMode) {
+            OPRINT("repacking.........: only for --partition pictures and mjpg recordings\n");
+        } else if((repack = repack_new(repackMode)) == NULL) {
+            OPRINT("could not start the repacking\n");
+            return 1;
+        } else {
+            OPRINT("repacking.........: closed %s, with the idle priority\n",
+                   mjpgFileName == NULL ? "hours" : "recordings");
+        }
+    }
 
-        OPRINT("output file.......: %s\n", fnBuffer);
-        if((fd = open(fnBuffer, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
-            OPRINT("could not open the file %s\n", fnBuffer);
-            free(fnBuffer);
+    for(i = 0; i < mirrorCount; i++) {
+        if((mirrors[i] = mirror_new(mirrorSpecs[i], mjpgFileName == NULL ? MIRROR_PICTURES :
+                                    aviMode ? MIRROR_AVI : MIRROR_MJPG)) == NULL) {
+            OPRINT("could not start the mirror %s\n", mirrorSpecs[i]);
+            mirrorCount = i;
             return 1;
         }
-        free(fnBuffer);
     }
 
-    param->global->out[id].parametercount = 2;
+    if(command != NULL) {
+        if((commands = command_queue_new(command, commandDepth, commandCoalesce)) == NULL) {
+            OPRINT("could not start the thread of the command\n");
+            return 1;
+        }
+        if(commandCoalesce > 0) {
+            OPRINT("command...........: %s, at most every %d ms\n", command, commandCoalesce);
+        } else {
+            OPRINT("command...........: %s, up to %d pictures waiting\n", command, commandDepth);
+        }
+    }
 
-    param->global->out[id].out_parameters = (control*) calloc(2, sizeof(control));
+    plugin_id = id;
+    if(queue_depth > 0 && aviMode) {
+        OPRINT("write queue.......: an AVI is written synchronously\n");
+    } else if(queue_depth > 0 && writeBuffer != NULL) {
+        OPRINT("write queue.......: the write buffer is written synchronously\n");
+    } else if(queue_depth > 0) {
+        #ifdef IO_URING
+        if(start_uring() == 0) {
+            OPRINT("write queue.......: %d frames with io_uring\n", queue_depth);
+        } else {
+            OPRINT("write queue.......: writing synchronously\n");
+        }
+        #else
+        OPRINT("write queue.......: io_uring is not supported by this build, writing synchronously\n");
+        #endif
+    }
+
+    param->global->out[id].parametercount = 3;
+
+    param->global->out[id].out_parameters = (control*) calloc(3, sizeof(control));
 
     control take_ctrl;
 	take_ctrl.group = IN_CMD_GENERIC;
@@ -533,6 +2060,22 @@ int output_init(output_parameter *param, int id)
 
 	param->global->out[id].out_parameters[1] = filename_ctrl;
 
+    control trigger_ctrl;
+	trigger_ctrl.group = IN_CMD_GENERIC;
+	trigger_ctrl.menuitems = NULL;
+	trigger_ctrl.value = 1;
+	trigger_ctrl.class_id = 0;
+
+	trigger_ctrl.ctrl.id = OUT_FILE_CMD_TRIGGER;
+	trigger_ctrl.ctrl.type = V4L2_CTRL_TYPE_BUTTON;
+	strcpy((char*) trigger_ctrl.ctrl.name, "Trigger recording");
+	trigger_ctrl.ctrl.minimum = 0;
+	trigger_ctrl.ctrl.maximum = 1;
+	trigger_ctrl.ctrl.step = 1;
+	trigger_ctrl.ctrl.default_value = 0;
+
+	param->global->out[id].out_parameters[2] = trigger_ctrl;
+
 
     return 0;
 }
@@ -546,6 +2089,8 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    if(triggerSocket >= 0)
+        pthread_cancel(trigger);
     return 0;
 }
 
@@ -559,6 +2104,10 @@ int output_run(int id)
     DBG("launching worker thread\n");
     pthread_create(&worker, 0, worker_thread, NULL);
     pthread_detach(worker);
+    if(triggerSocket >= 0) {
+        pthread_create(&trigger, 0, trigger_thread, NULL);
+        pthread_detach(trigger);
+    }
     return 0;
 }
 
@@ -574,35 +2123,13 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
 					switch(control_id) {
                             case OUT_FILE_CMD_TAKE: {
                                 if (valueStr != NULL) {
-                                    int frame_size = 0;
-                                    unsigned char *tmp_framebuffer = NULL;
+                                    input_frame *snapshot;
 
-                                    if(pthread_mutex_lock(&pglobal->in[input_number].db)) {
-                                        DBG("Unable to lock mutex\n");
+                                    /* reference the current frame, copied only to take in its metadata */
+                                    if((snapshot = frame_flatten(input_get_frame(&pglobal->in[input_number]))) == NULL) {
+                                        DBG("No frame available yet\n");
                                         return -1;
                                     }
-                                    /* read buffer */
-                                    frame_size = pglobal->in[input_number].size;
-
-                                    /* check if buffer for frame is large enough, increase it if necessary */
-                                    if(frame_size > max_frame_size) {
-                                        DBG("increasing buffer size to %d\n", frame_size);
-
-                                        max_frame_size = frame_size + (1 << 16);
-                                        if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                                            pthread_mutex_unlock(&pglobal->in[input_number].db);
-                                            LOG("not enough memory\n");
-                                            return -1;
-                                        }
-
-                                        frame = tmp_framebuffer;
-                                    }
-
-                                    /* copy frame to our local buffer now */
-                                    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-
-                                    /* allow others to access the global buffer again */
-                                    pthread_mutex_unlock(&pglobal->in[input_number].db);
 
                                     DBG("writing file: %s\n", valueStr);
 
@@ -610,23 +2137,33 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
                                     /* open file for write */
                                     if((fd = open(valueStr, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
                                         OPRINT("could not open the file %s\n", valueStr);
+                                        frame_unref(snapshot);
                                         return -1;
                                     }
 
                                     /* save picture to file */
-                                    if(write(fd, frame, frame_size) < 0) {
+                                    if(write(fd, snapshot->buf, snapshot->size) < 0) {
                                         OPRINT("could not write to file %s\n", valueStr);
                                         perror("write()");
                                         close(fd);
+                                        frame_unref(snapshot);
                                         return -1;
                                     }
 
                                     close(fd);
+                                    frame_unref(snapshot);
                                 } else {
                                     DBG("No filename specified\n");
                                     return -1;
                                 }
                             } break;
+                            case OUT_FILE_CMD_TRIGGER: {
+                                if(postRoll <= 0) {
+                                    DBG("Not a triggered recording\n");
+                                    return -1;
+                                }
+                                trigger_event();
+                            } break;
                             case OUT_FILE_CMD_FILENAME: {
                                 DBG("Not yet implemented\n");
                                 return -1;
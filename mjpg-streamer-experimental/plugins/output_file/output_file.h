@@ -3,5 +3,24 @@
 
 #define OUT_FILE_CMD_TAKE           1
 #define OUT_FILE_CMD_FILENAME       2
+#define OUT_FILE_CMD_TRIGGER        3
+
+#include <stdint.h>
+
+/*
+ * with --partition the pictures are stored in a directory per hour, below
+ * the folder in RECORDED_DIR. Each of them has an index RECORDED_INDEX, an
+ * array of recorded_entry in the byte order of the host and in the order of
+ * the pictures. The local time of an entry replaces the strftime() formats
+ * of RECORDED_NAME, its number the counter.
+ */
+#define RECORDED_DIR    "%Y-%m-%d/%H"
+#define RECORDED_INDEX  "index.bin"
+#define RECORDED_NAME   "%Y_%m_%d_%H_%M_%S_picture_%%09llu.jpg"
+
+typedef struct _recorded_entry {
+    uint64_t timestamp;     // capture time in microseconds since the epoch
+    uint64_t number;        // counter in the name of the picture
+} recorded_entry;
 
 #endif
@@ -0,0 +1,725 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "repack.h"
+#include "../input_file/mjpg_index.h"
+
+/* ioprio_set() has no wrapper in the C library */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+#define REPACK_SUFFIX ".repack"
+
+enum { JOB_DIRECTORY, JOB_RECORDING };
+
+/* a closed directory or recording waiting for the thread */
+typedef struct _repack_job {
+    int op;
+    char *path;
+    struct _repack_job *next;
+} repack_job;
+
+struct _repacker {
+    int mode;
+    int stop;
+
+    repack_job *first, *last;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t update;
+
+    /* held while a file is replaced, the ringbuffer deletes its pictures with it */
+    pthread_mutex_t files;
+
+    /* of the job being done, used by the thread only */
+    unsigned long long before, after;
+    int pictures, kept;
+};
+
+/******************************************************************************
+Description.: find a mode by its name
+Input Value.: huffman, progressive or arithmetic
+Return Value: REPACK_HUFFMAN, ..., -1 if the name is unknown or the mode is
+              not supported by the libjpeg of this build
+******************************************************************************/
+int repack_mode(const char *name)
+{
+    if(strcmp(name, "huffman") == 0)
+        return REPACK_HUFFMAN;
+    if(strcmp(name, "progressive") == 0)
+        return REPACK_PROGRESSIVE;
+    #if !defined(NO_LIBJPEG) && defined(C_ARITH_CODING_SUPPORTED) && defined(D_ARITH_CODING_SUPPORTED)
+    if(strcmp(name, "arithmetic") == 0)
+        return REPACK_ARITHMETIC;
+    #endif
+    return -1;
+}
+
+#ifndef NO_LIBJPEG
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} repack_error_mgr;
+
+static void repack_error_exit(j_common_ptr cinfo)
+{
+    repack_error_mgr *err = (repack_error_mgr *)cinfo->err;
+    longjmp(err->setjmp_buffer, 1);
+}
+
+/* warnings of broken data are counted, the picture is left alone then */
+static void repack_message(j_common_ptr cinfo, int level)
+{
+    if(level < 0)
+        cinfo->err->num_warnings++;
+}
+
+/******************************************************************************
+Description.: compare the coefficients, tables and sampling of two pictures
+Input Value.: * a, ca: the first picture and its coefficients
+              * b, cb: the second one
+Return Value: 1 if they decode to the same picture, 0 if not
+******************************************************************************/
+static int same_coefficients(j_decompress_ptr a, jvirt_barray_ptr *ca, j_decompress_ptr b, jvirt_barray_ptr *cb)
+{
+    jpeg_component_info *x, *y;
+    JBLOCKARRAY ra, rb;
+    JDIMENSION row;
+    int ci;
+
+    if(a->image_width != b->image_width || a->image_height != b->image_height ||
+       a->num_components != b->num_components || a->jpeg_color_space != b->jpeg_color_space)
+        return 0;
+
+    for(ci = 0; ci < a->num_components; ci++) {
+        x = &a->comp_info[ci];
+        y = &b->comp_info[ci];
+        if(x->h_samp_factor != y->h_samp_factor || x->v_samp_factor != y->v_samp_factor ||
+           x->width_in_blocks != y->width_in_blocks || x->height_in_blocks != y->height_in_blocks ||
+           x->quant_table == NULL || y->quant_table == NULL ||
+           memcmp(x->quant_table->quantval, y->quant_table->quantval, sizeof(x->quant_table->quantval)) != 0)
+            return 0;
+
+        for(row = 0; row < x->height_in_blocks; row++) {
+            ra = (*a->mem->access_virt_barray)((j_common_ptr)a, ca[ci], row, 1, FALSE);
+            rb = (*b->mem->access_virt_barray)((j_common_ptr)b, cb[ci], row, 1, FALSE);
+            if(memcmp(ra[0], rb[0], x->width_in_blocks * sizeof(JBLOCK)) != 0)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/******************************************************************************
+Description.: code a JPEG again from its coefficients, with the markers it
+              has, and check the result decodes to the same coefficients
+Input Value.: * r.......: the repacker, for its mode
+              * in......: the JPEG
+              * size....: its size
+              * out.....: gets the new JPEG, to be freed by the caller
+              * out_size: gets its size
+Return Value: 0 if ok, -1 if the picture could not be repacked
+******************************************************************************/
+static int repack_jpeg(repacker *r, const unsigned char *in, unsigned long size,
+                       unsigned char **out, unsigned long *out_size)
+{
+    struct jpeg_decompress_struct dinfo, vinfo;
+    struct jpeg_compress_struct cinfo;
+    repack_error_mgr err;
+    jvirt_barray_ptr *coef, *check;
+    jpeg_saved_marker_ptr marker;
+    int m, ok;
+
+    *out = NULL;
+    *out_size = 0;
+
+    dinfo.err = cinfo.err = vinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = repack_error_exit;
+    err.pub.emit_message = repack_message;
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+    jpeg_create_decompress(&vinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_decompress(&vinfo);
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        free(*out);
+        *out = NULL;
+        return -1;
+    }
+
+    /* EXIF, comments and everything else of the picture go along */
+    jpeg_mem_src(&dinfo, (unsigned char *)in, size);
+    jpeg_save_markers(&dinfo, JPEG_COM, 0xffff);
+    for(m = 0; m < 16; m++)
+        jpeg_save_markers(&dinfo, JPEG_APP0 + m, 0xffff);
+    jpeg_read_header(&dinfo, TRUE);
+    coef = jpeg_read_coefficients(&dinfo);
+    if(err.pub.num_warnings > 0)
+        longjmp(err.setjmp_buffer, 1);
+
+    jpeg_copy_critical_parameters(&dinfo, &cinfo);
+    cinfo.optimize_coding = TRUE;
+    if(r->mode == REPACK_PROGRESSIVE)
+        jpeg_simple_progression(&cinfo);
+    #ifdef C_ARITH_CODING_SUPPORTED
+    /* arithmetic coding adapts by itself, it takes no Huffman tables */
+    if(r->mode == REPACK_ARITHMETIC) {
+        cinfo.arith_code = TRUE;
+        cinfo.optimize_coding = FALSE;
+    }
+    #endif
+    jpeg_mem_dest(&cinfo, out, out_size);
+    jpeg_write_coefficients(&cinfo, coef);
+
+    /* markers libjpeg writes by itself are not copied twice */
+    for(marker = dinfo.marker_list; marker != NULL; marker = marker->next) {
+        if(cinfo.write_JFIF_header && marker->marker == JPEG_APP0 &&
+           marker->data_length >= 5 && memcmp(marker->data, "JFIF", 5) == 0)
+            continue;
+        if(cinfo.write_Adobe_marker && marker->marker == JPEG_APP0 + 14 &&
+           marker->data_length >= 5 && memcmp(marker->data, "Adobe", 5) == 0)
+            continue;
+        jpeg_write_marker(&cinfo, marker->marker, marker->data, marker->data_length);
+    }
+    jpeg_finish_compress(&cinfo);
+
+    /* the new picture has to decode to the very same coefficients */
+    jpeg_mem_src(&vinfo, *out, *out_size);
+    jpeg_read_header(&vinfo, TRUE);
+    check = jpeg_read_coefficients(&vinfo);
+    ok = (err.pub.num_warnings == 0 && same_coefficients(&dinfo, coef, &vinfo, check));
+
+    jpeg_finish_decompress(&vinfo);
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_decompress(&vinfo);
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+
+    if(!ok) {
+        LOG("a repacked picture did not verify, it is kept as it was\n");
+        free(*out);
+        *out = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: repack a JPEG if it gets smaller
+Input Value.: * r.......: the repacker
+              * in......: the JPEG
+              * size....: its size
+              * out.....: gets the JPEG to store, in itself or a new one the
+                          caller frees
+              * out_size: gets its size
+Return Value: -
+******************************************************************************/
+static void repack_picture(repacker *r, const unsigned char *in, unsigned long size,
+                           unsigned char **out, unsigned long *out_size)
+{
+    r->pictures++;
+    r->before += size;
+    if(repack_jpeg(r, in, size, out, out_size) < 0 || *out_size >= size) {
+        free(*out);
+        *out = (unsigned char *)in;
+        *out_size = size;
+        r->kept++;
+    }
+    r->after += *out_size;
+}
+
+static int write_all(int fd, const unsigned char *data, size_t size)
+{
+    ssize_t n;
+
+    while(size > 0) {
+        if((n = write(fd, data, size)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: read a file, keeping it out of the page cache
+Input Value.: * path: the file
+              * st..: gets its status
+              * size: gets its size
+Return Value: the contents, to be freed by the caller, NULL on errors
+******************************************************************************/
+static unsigned char *read_file(const char *path, struct stat *st, unsigned long *size)
+{
+    unsigned char *data = NULL;
+    ssize_t n;
+    size_t done = 0;
+    int file;
+
+    if((file = open(path, O_RDONLY)) < 0)
+        return NULL;
+    if(fstat(file, st) == 0 && st->st_size > 0 && (data = malloc(st->st_size)) != NULL) {
+        while(done < (size_t)st->st_size && ((n = read(file, data + done, st->st_size - done)) > 0 ||
+                                             (n < 0 && errno == EINTR)))
+            done += MAX(n, 0);
+    }
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+
+    if(data != NULL && done != (size_t)st->st_size) {
+        free(data);
+        data = NULL;
+    }
+    *size = done;
+    return data;
+}
+
+/******************************************************************************
+Description.: open the file taking the place of another one
+Input Value.: * path: the file to write, the original with REPACK_SUFFIX
+              * st..: status of the original
+Return Value: the descriptor, -1 on errors
+******************************************************************************/
+static int open_replacement(const char *path, const struct stat *st)
+{
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, st->st_mode & 0777);
+
+    if(file < 0)
+        OPRINT("could not create %s: %s\n", path, strerror(errno));
+    return file;
+}
+
+/******************************************************************************
+Description.: finish a replacement, it is on the disk before it is renamed
+              and keeps the times of the original
+Input Value.: * file: the replacement
+              * st..: status of the original
+Return Value: 0 if ok, -1 on errors, the file is closed anyway
+******************************************************************************/
+static int close_replacement(int file, const struct stat *st)
+{
+    struct timespec times[2];
+    int rc;
+
+    times[0] = st->st_atim;
+    times[1] = st->st_mtim;
+    rc = (fdatasync(file) == 0 && futimens(file, times) == 0) ? 0 : -1;
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    if(close(file) < 0)
+        rc = -1;
+    return rc;
+}
+
+/* the original is still the file that was read, the ringbuffer may have deleted it */
+static int unchanged(const char *path, const struct stat *old)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 && st.st_ino == old->st_ino && st.st_size == old->st_size &&
+           st.st_mtim.tv_sec == old->st_mtim.tv_sec && st.st_mtim.tv_nsec == old->st_mtim.tv_nsec;
+}
+
+/******************************************************************************
+Description.: repack a picture of its own
+Input Value.: * r...: the repacker
+              * path: the picture
+Return Value: -
+******************************************************************************/
+static void repack_file(repacker *r, const char *path)
+{
+    char temp[PATH_MAX];
+    unsigned char *data, *out;
+    unsigned long size, out_size;
+    struct stat st;
+    int file, rc = -1;
+
+    /* a shortened name could be that of another file */
+    if(snprintf(temp, sizeof(temp), "%s" REPACK_SUFFIX, path) >= (int)sizeof(temp)) {
+        OPRINT("the name of %s is too long, it is not repacked\n", path);
+        return;
+    }
+
+    if((data = read_file(path, &st, &size)) == NULL)
+        return;
+    repack_picture(r, data, size, &out, &out_size);
+    if(out == data) {
+        free(data);
+        return;
+    }
+
+    if((file = open_replacement(temp, &st)) >= 0) {
+        rc = write_all(file, out, out_size);
+        if(close_replacement(file, &st) < 0)
+            rc = -1;
+
+        pthread_mutex_lock(&r->files);
+        if(rc == 0 && unchanged(path, &st))
+            rc = rename(temp, path);
+        else
+            rc = -1;
+        pthread_mutex_unlock(&r->files);
+        if(rc < 0)
+            unlink(temp);
+    }
+    if(rc < 0)
+        r->after += size - out_size;
+
+    free(out);
+    free(data);
+}
+
+static int check_for_picture(const struct dirent *entry)
+{
+    size_t len = strlen(entry->d_name);
+
+    return len > 4 && strcmp(entry->d_name + len - 4, ".jpg") == 0;
+}
+
+/******************************************************************************
+Description.: repack the pictures of a closed hour directory
+Input Value.: * r...: the repacker
+              * path: the directory
+Return Value: -
+******************************************************************************/
+static void repack_pictures(repacker *r, const char *path)
+{
+    struct dirent **list = NULL;
+    char file[PATH_MAX];
+    int i, n;
+
+    if((n = scandir(path, &list, check_for_picture, alphasort)) < 0)
+        return;
+    for(i = 0; i < n; i++) {
+        if(!r->stop) {
+            snprintf(file, sizeof(file), "%s/%s", path, list[i]->d_name);
+            repack_file(r, file);
+        }
+        free(list[i]);
+    }
+    free(list);
+}
+
+/******************************************************************************
+Description.: repack an mjpg recording frame by frame along its index, the
+              index is written again with the new offsets
+Input Value.: * r...: the repacker
+              * path: the recording
+Return Value: -
+******************************************************************************/
+static void repack_mjpg(repacker *r, const char *path)
+{
+    char index[PATH_MAX], temp[PATH_MAX], temp_index[PATH_MAX], line[128];
+    unsigned char *data = NULL, *out;
+    unsigned long out_size;
+    unsigned long long usec;
+    long long offset, position = 0;
+    struct stat st, index_st;
+    FILE *in = NULL, *new_index = NULL;
+    int file = -1, dest = -1, size, capacity = 0, rc = -1;
+
+    /* a shortened name could be that of another file, nothing is touched then */
+    if(snprintf(index, sizeof(index), "%s.idx", path) >= (int)sizeof(index) ||
+       snprintf(temp, sizeof(temp), "%s" REPACK_SUFFIX, path) >= (int)sizeof(temp) ||
+       snprintf(temp_index, sizeof(temp_index), "%s" REPACK_SUFFIX, index) >= (int)sizeof(temp_index)) {
+        OPRINT("the name of %s is too long, it is not repacked\n", path);
+        return;
+    }
+
+    if((in = fopen(index, "r")) == NULL || fstat(fileno(in), &index_st) < 0) {
+        OPRINT("%s has no index, it is not repacked\n", path);
+        goto out;
+    }
+    if((file = open(path, O_RDONLY)) < 0 || fstat(file, &st) < 0 ||
+       (dest = open_replacement(temp, &st)) < 0 || (new_index = fopen(temp_index, "w")) == NULL)
+        goto out;
+
+    fputs(MJPG_INDEX_HEADER, new_index);
+    rc = 0;
+    while(rc == 0 && !r->stop && fgets(line, sizeof(line), in) != NULL) {
+        if(line[0] == '#' || sscanf(line, "%lld %d %llu", &offset, &size, &usec) != 3 || size <= 0)
+            continue;
+        if(size > capacity) {
+            free(data);
+            if((data = malloc(size)) == NULL) {
+                rc = -1;
+                break;
+            }
+            capacity = size;
+        }
+        if(pread(file, data, size, offset) != size) {
+            rc = -1;
+            break;
+        }
+
+        repack_picture(r, data, size, &out, &out_size);
+        rc = write_all(dest, out, out_size);
+        fprintf(new_index, "%lld %lu %llu\n", position, out_size, usec);
+        position += out_size;
+        if(out != data)
+            free(out);
+    }
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+
+    /* the recording and then its index take the places of the old ones */
+    if(rc == 0 && r->stop)
+        rc = -1;
+    if(close_replacement(dest, &st) < 0 || fflush(new_index) != 0 || fdatasync(fileno(new_index)) < 0)
+        rc = -1;
+    dest = -1;
+    if(rc == 0 && r->after < r->before) {
+        pthread_mutex_lock(&r->files);
+        if(unchanged(path, &st) && unchanged(index, &index_st) && rename(temp, path) == 0) {
+            if(rename(temp_index, index) < 0)
+                OPRINT("the index of %s is out of date: %s\n", path, strerror(errno));
+        } else {
+            rc = -1;
+        }
+        pthread_mutex_unlock(&r->files);
+    } else {
+        rc = -1;
+    }
+
+out:
+    if(rc < 0) {
+        if(dest >= 0)
+            close(dest);
+        if(new_index != NULL)
+            unlink(temp_index);
+        unlink(temp);
+        r->after = r->before;
+    }
+    if(new_index != NULL)
+        fclose(new_index);
+    if(in != NULL)
+        fclose(in);
+    if(file >= 0)
+        close(file);
+    free(data);
+}
+
+/******************************************************************************
+Description.: the thread of the repacker, it works through the closed
+              directories and recordings with the lowest priority
+Input Value.: the repacker
+Return Value: NULL
+******************************************************************************/
+static void *repack_thread(void *arg)
+{
+    struct sched_param param;
+    repacker *r = arg;
+    repack_job *job;
+
+    /* only CPU and disk time nothing else wants */
+    memset(&param, 0, sizeof(param));
+    if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        LOG("could not give the repacking the idle priority\n");
+    if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+        LOG("could not give the repacking the idle I/O class: %s\n", strerror(errno));
+
+    pthread_mutex_lock(&r->mutex);
+    while(!r->stop) {
+        if((job = r->first) == NULL) {
+            pthread_cond_wait(&r->update, &r->mutex);
+            continue;
+        }
+        if((r->first = job->next) == NULL)
+            r->last = NULL;
+        pthread_mutex_unlock(&r->mutex);
+
+        r->before = r->after = 0;
+        r->pictures = r->kept = 0;
+        if(job->op == JOB_DIRECTORY)
+            repack_pictures(r, job->path);
+        else
+            repack_mjpg(r, job->path);
+        if(r->pictures > 0)
+            OPRINT("repacked %s: %llu kB to %llu kB, %d of %d pictures as they were\n",
+                   job->path, r->before / 1024, r->after / 1024, r->kept, r->pictures);
+
+        free(job->path);
+        free(job);
+        pthread_mutex_lock(&r->mutex);
+    }
+    pthread_mutex_unlock(&r->mutex);
+    return NULL;
+}
+#endif
+
+/******************************************************************************
+Description.: start the thread repacking closed recordings
+Input Value.: REPACK_HUFFMAN, REPACK_PROGRESSIVE or REPACK_ARITHMETIC
+Return Value: the repacker, NULL on errors or without libjpeg
+******************************************************************************/
+repacker *repack_new(int mode)
+{
+    #ifdef NO_LIBJPEG
+    return NULL;
+    #else
+    repacker *r;
+
+    if((r = calloc(1, sizeof(repacker))) == NULL)
+        return NULL;
+    r->mode = mode;
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_mutex_init(&r->files, NULL);
+    pthread_cond_init(&r->update, NULL);
+    if(pthread_create(&r->thread, NULL, repack_thread, r) != 0) {
+        pthread_mutex_destroy(&r->mutex);
+        pthread_mutex_destroy(&r->files);
+        pthread_cond_destroy(&r->update);
+        free(r);
+        return NULL;
+    }
+    return r;
+    #endif
+}
+
+/******************************************************************************
+Description.: queue a closed directory or recording
+Input Value.: * r...: the repacker, may be NULL
+              * op..: JOB_DIRECTORY or JOB_RECORDING
+              * path: the directory or recording
+Return Value: -
+******************************************************************************/
+static void add_job(repacker *r, int op, const char *path)
+{
+    repack_job *job;
+
+    if(r == NULL || (job = calloc(1, sizeof(repack_job))) == NULL)
+        return;
+    if((job->path = strdup(path)) == NULL) {
+        free(job);
+        return;
+    }
+    job->op = op;
+
+    pthread_mutex_lock(&r->mutex);
+    if(r->last != NULL)
+        r->last->next = job;
+    else
+        r->first = job;
+    r->last = job;
+    pthread_cond_signal(&r->update);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+/******************************************************************************
+Description.: repack the pictures of an hour directory, once the hour is over
+Input Value.: * r...: the repacker, may be NULL
+              * path: the directory
+Return Value: -
+******************************************************************************/
+void repack_directory(repacker *r, const char *path)
+{
+    add_job(r, JOB_DIRECTORY, path);
+}
+
+/******************************************************************************
+Description.: repack an mjpg recording, once it is closed
+Input Value.: * r...: the repacker, may be NULL
+              * path: the recording, its index is next to it
+Return Value: -
+******************************************************************************/
+void repack_recording(repacker *r, const char *path)
+{
+    add_job(r, JOB_RECORDING, path);
+}
+
+/******************************************************************************
+Description.: keep the repacker from replacing files, while the ringbuffer
+              deletes them
+Input Value.: the repacker, may be NULL
+Return Value: -
+******************************************************************************/
+void repack_lock(repacker *r)
+{
+    if(r != NULL)
+        pthread_mutex_lock(&r->files);
+}
+
+void repack_unlock(repacker *r)
+{
+    if(r != NULL)
+        pthread_mutex_unlock(&r->files);
+}
+
+/******************************************************************************
+Description.: stop the repacker, the jobs still waiting are dropped. A thread
+              the system gives no time stops at its next picture, it is
+              cancelled if that takes too long.
+Input Value.: the repacker, may be NULL
+Return Value: -
+******************************************************************************/
+void repack_free(repacker *r)
+{
+    struct timespec deadline;
+    repack_job *job;
+
+    if(r == NULL)
+        return;
+
+    pthread_mutex_lock(&r->mutex);
+    r->stop = 1;
+    pthread_cond_signal(&r->update);
+    pthread_mutex_unlock(&r->mutex);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 2;
+    if(pthread_timedjoin_np(r->thread, NULL, &deadline) != 0) {
+        pthread_cancel(r->thread);
+        pthread_join(r->thread, NULL);
+    }
+
+    while((job = r->first) != NULL) {
+        r->first = job->next;
+        free(job->path);
+        free(job);
+    }
+    pthread_mutex_destroy(&r->mutex);
+    pthread_mutex_destroy(&r->files);
+    pthread_cond_destroy(&r->update);
+    free(r);
+}
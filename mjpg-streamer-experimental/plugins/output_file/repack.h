@@ -0,0 +1,51 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef REPACK_H
+#define REPACK_H
+
+/*
+ * lossless recompression of closed recordings in the background. Cameras
+ * code their JPEGs with generic huffman tables, the pictures of an hour
+ * directory once the hour is over and mjpg recordings once they are closed
+ * are coded again from their DCT coefficients with tables optimized for
+ * each picture, or progressive or with arithmetic coding. Each result is
+ * decoded again and used only if its coefficients and tables are the same
+ * bit for bit, the pictures stay exactly as they were but take less space.
+ * A file replaces the original only if it got smaller, an mjpg recording
+ * along with its index.
+ *
+ * The thread runs with SCHED_IDLE and the idle I/O class, so it only takes
+ * the CPU and disk time nothing else wants, and keeps its files out of the
+ * page cache.
+ */
+enum { REPACK_HUFFMAN, REPACK_PROGRESSIVE, REPACK_ARITHMETIC };
+
+typedef struct _repacker repacker;
+
+int repack_mode(const char *name);
+repacker *repack_new(int mode);
+void repack_directory(repacker *r, const char *path);
+void repack_recording(repacker *r, const char *path);
+void repack_lock(repacker *r);
+void repack_unlock(repacker *r);
+void repack_free(repacker *r);
+
+#endif
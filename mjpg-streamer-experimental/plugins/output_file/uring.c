@@ -0,0 +1,206 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#ifdef IO_URING
+
+/******************************************************************************
+Description.: set up a ring and map its queues
+Input Value.: * ring...: to set up
+              * entries: size of the submission queue
+Return Value: 0 if ok, -1 with errno set otherwise
+******************************************************************************/
+int uring_init(uring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    int error;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    if((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0)
+        return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* newer kernels map both rings at once */
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED)
+        goto failed;
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto failed;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto failed;
+    }
+
+    ring->sq_head = (unsigned *)((char *)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + params.cq_off.cqes);
+
+    return 0;
+
+failed:
+    error = errno;
+    if(ring->sq_ring == MAP_FAILED)
+        ring->sq_ring = NULL;
+    uring_exit(ring);
+    errno = error;
+    return -1;
+}
+
+/******************************************************************************
+Description.: register an empty table of files, requests can open files into
+              its slots and refer to them without a file descriptor
+Input Value.: * ring.: the ring
+              * count: number of slots
+Return Value: 0 if ok, -1 with errno set otherwise
+******************************************************************************/
+int uring_register_files(uring *ring, int count)
+{
+    int *files, i, rc;
+
+    if((files = malloc(count * sizeof(int))) == NULL)
+        return -1;
+    for(i = 0; i < count; i++)
+        files[i] = -1;
+
+    rc = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, files, count);
+    free(files);
+
+    return (rc < 0) ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: get the next free submission queue entry
+Input Value.: the ring
+Return Value: the cleared entry, NULL if the queue is full
+******************************************************************************/
+struct io_uring_sqe *uring_get_sqe(uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->sq_pending;
+    struct io_uring_sqe *sqe;
+
+    if(tail - head > *ring->sq_mask)
+        return NULL;
+
+    sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    ring->sq_pending++;
+
+    return sqe;
+}
+
+/******************************************************************************
+Description.: hand the prepared entries to the kernel
+Input Value.: * ring: the ring
+              * wait: number of completions to wait for
+Return Value: 0 if ok, -1 with errno set otherwise
+******************************************************************************/
+int uring_submit(uring *ring, unsigned wait)
+{
+    unsigned count = ring->sq_pending;
+    int rc;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + count, __ATOMIC_RELEASE);
+    ring->sq_pending = 0;
+
+    if(count == 0 && wait == 0)
+        return 0;
+
+    do {
+        rc = syscall(__NR_io_uring_enter, ring->fd, count, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while(rc < 0 && errno == EINTR);
+
+    return (rc < 0) ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: look at the oldest completion without waiting
+Input Value.: the ring
+Return Value: the completion or NULL if there is none
+******************************************************************************/
+struct io_uring_cqe *uring_peek_cqe(uring *ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+/******************************************************************************
+Description.: give the completion of uring_peek_cqe() back to the kernel
+Input Value.: the ring
+Return Value: -
+******************************************************************************/
+void uring_cqe_seen(uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void uring_exit(uring *ring)
+{
+    if(ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring != NULL)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if(ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+#endif
@@ -26,16 +26,26 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
 
 #include <linux/version.h>
 #include <linux/types.h>          /* for videodev2.h */
@@ -43,6 +53,7 @@
 
 #include "../../mjpg_streamer.h"
 #include "../../utils.h"
+#include "../../probes.h"
 
 #include "httpd.h"
 
@@ -54,19 +65,16 @@
 
 
 static globals *pglobal;
-extern context servers[MAX_OUTPUT_PLUGINS];
-int piggy_fine = 2; // FIXME make it command line parameter
+extern context *servers;
 
-/******************************************************************************
-Description.: initializes the iobuffer structure properly
-Input Value.: pointer to already allocated iobuffer
-Return Value: iobuf
-******************************************************************************/
-void init_iobuffer(iobuffer *iobuf)
-{
-    memset(iobuf->buffer, 0, sizeof(iobuf->buffer));
-    iobuf->level = 0;
-}
+#ifdef MANAGMENT
+/* shared by all servers of the plugin */
+struct _client_infos client_infos = {
+    .last = &client_infos.first,
+    .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+#endif
+int piggy_fine = 2; // FIXME make it command line parameter
 
 /******************************************************************************
 Description.: initializes the request structure properly
@@ -79,6 +87,11 @@ void init_request(request *req)
     req->parameter   = NULL;
     req->client      = NULL;
     req->credentials = NULL;
+    req->if_none_match = NULL;
+    req->accept_gzip = 0;
+    req->keep_alive = 0;
+    req->ws_key = NULL;
+    req->nowait = 0;
 }
 
 /******************************************************************************
@@ -93,107 +106,8 @@ void free_request(request *req)
     if(req->client != NULL) free(req->client);
     if(req->credentials != NULL) free(req->credentials);
     if(req->query_string != NULL) free(req->query_string);
-}
-
-/******************************************************************************
-Description.: read with timeout, implemented without using signals
-              tries to read len bytes and returns if enough bytes were read
-              or the timeout was triggered. In case of timeout the return
-              value may differ from the requested bytes "len".
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
-                         before storing values.
-              * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
-******************************************************************************/
-int _read(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
-{
-    int copied = 0, rc, i;
-    fd_set fds;
-    struct timeval tv;
-
-    memset(buffer, 0, len);
-
-    while((copied < len)) {
-        i = MIN(iobuf->level, len - copied);
-        memcpy(buffer + copied, iobuf->buffer + IO_BUFFER - iobuf->level, i);
-
-        iobuf->level -= i;
-        copied += i;
-        if(copied >= len)
-            return copied;
-
-        /* select will return in case of timeout or new data arrived */
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        if((rc = select(fd + 1, &fds, NULL, NULL, &tv)) <= 0) {
-            if(rc < 0)
-                exit(EXIT_FAILURE);
-
-            /* this must be a timeout */
-            return copied;
-        }
-
-        init_iobuffer(iobuf);
-
-        /*
-         * there should be at least one byte, because select signalled it.
-         * But: It may happen (very seldomly), that the socket gets closed remotly between
-         * the select() and the following read. That is the reason for not relying
-         * on reading at least one byte.
-         */
-        if((iobuf->level = read(fd, &iobuf->buffer, IO_BUFFER)) <= 0) {
-            /* an error occured */
-            return -1;
-        }
-
-        /* align data to the end of the buffer if less than IO_BUFFER bytes were read */
-        memmove(iobuf->buffer + (IO_BUFFER - iobuf->level), iobuf->buffer, iobuf->level);
-    }
-
-    return 0;
-}
-
-/******************************************************************************
-Description.: Read a single line from the provided fildescriptor.
-              This funtion will return under two conditions:
-              * line end was reached
-              * timeout occured
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
-                         before storing values.
-              * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
-******************************************************************************/
-/* read just a single line or timeout */
-int _readline(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
-{
-    char c = '\0', *out = buffer;
-    int i;
-
-    memset(buffer, 0, len);
-
-    for(i = 0; i < len && c != '\n'; i++) {
-        if(_read(fd, iobuf, &c, 1, timeout) <= 0) {
-            /* timeout or error occured */
-            return -1;
-        }
-        *out++ = c;
-    }
-
-    return i;
+    if(req->if_none_match != NULL) free(req->if_none_match);
+    if(req->ws_key != NULL) free(req->ws_key);
 }
 
 /******************************************************************************
@@ -308,43 +222,77 @@ int unescape(char *string)
 #ifdef MANAGMENT
 
 /******************************************************************************
-Description.: Adds a new client information struct to the ino list.
+Description.: FNV-1a hash of a client address
+Input Value.: the address
+Return Value: the hash
+******************************************************************************/
+static unsigned int client_hash(const char *address)
+{
+    unsigned int h = 2166136261u;
+
+    while(*address != '\0') {
+        h ^= (unsigned char) * address++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/******************************************************************************
+Description.: Looks up a client in its hash bucket, without locking
+Input Value.: * bucket.: the bucket
+              * address: Client IP address as a string
+Return Value: the entry or NULL
+******************************************************************************/
+static client_info *find_client(client_info **bucket, const char *address)
+{
+    client_info *c;
+
+    for(c = __sync_fetch_and_add(bucket, 0); c != NULL; c = c->next) {
+        if(strcmp(c->address, address) == 0)
+            return c;
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: Adds a new client information struct to the info table.
 Input Value.: Client IP address as a string
 Return Value: Returns with the newly added info or with a pointer to the existing item
 ******************************************************************************/
 client_info *add_client(char *address)
 {
-    unsigned int i = 0;
-    int name_length = strlen(address) + 1;
+    client_info **bucket = &client_infos.buckets[client_hash(address) & (CLIENT_BUCKETS - 1)];
+    client_info *current_client_info;
 
-    pthread_mutex_lock(&client_infos.mutex);
+    /* known clients are found without taking the mutex */
+    if((current_client_info = find_client(bucket, address)) != NULL)
+        return current_client_info;
 
-    for (; i<client_infos.client_count; i++) {
-        if (strcmp(client_infos.infos[i]->address, address) == 0) {
-            pthread_mutex_unlock(&client_infos.mutex);
-            return client_infos.infos[i];
-        }
-    }
+    pthread_mutex_lock(&client_infos.mutex);
 
-    client_info *current_client_info = malloc(sizeof(client_info));
-    if (current_client_info == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
+    /* someone else may have added it meanwhile */
+    if((current_client_info = find_client(bucket, address)) != NULL) {
         pthread_mutex_unlock(&client_infos.mutex);
-        return NULL;
+        return current_client_info;
     }
 
-    current_client_info->address = malloc(name_length * sizeof(char));
-    if (current_client_info->address == NULL) {
+    current_client_info = calloc(1, sizeof(client_info));
+    if (current_client_info == NULL ||
+        (current_client_info->address = strdup(address)) == NULL) {
         fprintf(stderr, "could not allocate memory\n");
+        free(current_client_info);
         pthread_mutex_unlock(&client_infos.mutex);
         return NULL;
     }
 
-    strcpy(current_client_info->address, address);
-    memset(&(current_client_info->last_take_time), 0, sizeof(struct timeval)); // set last time to zero
-
-    client_infos.infos = realloc(client_infos.infos, (client_infos.client_count + 1) * sizeof(client_info*));
-    client_infos.infos[client_infos.client_count] = current_client_info;
+    /* the entry must be complete before readers can see it */
+    current_client_info->next = *bucket;
+    __sync_synchronize();
+    *bucket = current_client_info;
+    *client_infos.last = current_client_info;
+    client_infos.last = &current_client_info->added;
     client_infos.client_count += 1;
 
     pthread_mutex_unlock(&client_infos.mutex);
@@ -352,316 +300,1277 @@ client_info *add_client(char *address)
 }
 
 /******************************************************************************
-Description.: Looks in the client_infos for the current ip address.
-Input Value.: Client IP address as a string
+Description.: Checks when a frame was served to the client the last time.
+Input Value.: the client
 Return Value: If a frame was served to it within the specified interval it returns 1
               If not it returns with 0
 ******************************************************************************/
 int check_client_status(client_info *client)
 {
-    unsigned int i = 0;
-    pthread_mutex_lock(&client_infos.mutex);
-    for (; i<client_infos.client_count; i++) {
-        if (client_infos.infos[i] == client) {
-            long msec;
-            struct timeval tim;
-            gettimeofday(&tim, NULL);
-            msec  =(tim.tv_sec - client_infos.infos[i]->last_take_time.tv_sec)*1000;
-            msec +=(tim.tv_usec - client_infos.infos[i]->last_take_time.tv_usec)/1000;
-            DBG("diff: %ld\n", msec);
-            if ((msec < 1000) && (msec > 0)) { // FIXME make it parameter
-                DBG("CHEATER\n");
-                pthread_mutex_unlock(&client_infos.mutex);
-                return 1;
-            } else {
-                pthread_mutex_unlock(&client_infos.mutex);
-                return 0;
-            }
-        }
+    long long msec;
+    struct timeval tim;
+
+    if(client == NULL)
+        return 0;
+
+    gettimeofday(&tim, NULL);
+    msec = ((long long)tim.tv_sec * 1000000 + tim.tv_usec -
+            (long long)__sync_fetch_and_add(&client->last_take_time, 0)) / 1000;
+    DBG("diff: %lld\n", msec);
+    if ((msec < 1000) && (msec > 0)) { // FIXME make it parameter
+        DBG("CHEATER\n");
+        return 1;
     }
-    DBG("Client not found in the client list! How did it happend?? This is a BUG\n");
-    pthread_mutex_unlock(&client_infos.mutex);
+
     return 0;
 }
 
+/******************************************************************************
+Description.: Punish a client that asked too early, it has to wait longer
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+void delay_client(client_info *client)
+{
+    if(client != NULL)
+        __sync_fetch_and_add(&client->last_take_time, (unsigned long long)piggy_fine * 1000000);
+}
+
 void update_client_timestamp(client_info *client)
 {
     struct timeval tim;
-    pthread_mutex_lock(&client_infos.mutex);
+
+    if(client == NULL)
+        return;
+
     gettimeofday(&tim, NULL);
-    memcpy(&client->last_take_time, &tim, sizeof(struct timeval));
-    pthread_mutex_unlock(&client_infos.mutex);
+    __sync_lock_test_and_set(&client->last_take_time, (unsigned long long)tim.tv_sec * 1000000 + tim.tv_usec);
 }
-#endif
 
 /******************************************************************************
-Description.: Send a complete HTTP response and a single JPG-frame.
-Input Value.: fildescriptor fd to send the answer to
+Description.: Account a stream frame sent to a client
+Input Value.: * client.: the client
+              * dropped: number of frames skipped before this one because the
+                         client could not keep up
 Return Value: -
 ******************************************************************************/
-void send_snapshot(cfd *context_fd, int input_number)
+void update_client_frames(client_info *client, unsigned long long dropped)
 {
-    unsigned char *frame = NULL;
-    int frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
-
-    /* wait for a fresh frame */
-    pthread_mutex_lock(&pglobal->in[input_number].db);
-    pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-    /* read buffer */
-    frame_size = pglobal->in[input_number].size;
-
-    /* allocate a buffer for this single frame */
-    if((frame = malloc(frame_size + 1)) == NULL) {
-        free(frame);
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-        send_error(context_fd->fd, 500, "not enough memory");
+    if(client == NULL)
         return;
-    }
-    /* copy v4l2_buffer timeval to user space */
-    timestamp = pglobal->in[input_number].timestamp;
-
-    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-    DBG("got frame (size: %d kB)\n", frame_size / 1024);
-
-    pthread_mutex_unlock(&pglobal->in[input_number].db);
-
-    #ifdef MANAGMENT
-    update_client_timestamp(context_fd->client);
-    #endif
 
-    /* write the response */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Access-Control-Allow-Origin: *\r\n" \
-            STD_HEADER \
-            "Content-type: image/jpeg\r\n" \
-            "X-Timestamp: %d.%06d\r\n" \
-            "\r\n", (int) timestamp.tv_sec, (int) timestamp.tv_usec);
+    __sync_fetch_and_add(&client->frames_sent, 1);
+    if(dropped > 0)
+        __sync_fetch_and_add(&client->frames_dropped, dropped);
+}
 
-    /* send header and image now */
-    if (write(context_fd->fd, buffer, strlen(buffer)) < 0 ||
-        write(context_fd->fd, frame, frame_size) < 0) {
-        free(frame);
+/******************************************************************************
+Description.: Account the bytes waiting in the socket queue of a stream
+Input Value.: * client: the client
+              * last..: what was accounted for this stream before, updated
+              * queued: bytes in the queue now
+Return Value: -
+******************************************************************************/
+void update_client_queue(client_info *client, int *last, int queued)
+{
+    if(client == NULL)
         return;
-    }
 
-    free(frame);
+    __sync_fetch_and_add(&client->queued, (long long)(queued - *last));
+    *last = queued;
 }
 
 /******************************************************************************
-Description.: Send a complete HTTP response and a stream of JPG-frames.
-Input Value.: fildescriptor fd to send the answer to
+Description.: Account a stream started or ended for a client
+Input Value.: * client: the client
+              * memory: bytes the stream takes, its thread stack or event loop
+                        entry, negative when it ends
+              * queued: what update_client_queue() accounted last for it,
+                        0 when it starts
 Return Value: -
 ******************************************************************************/
-void send_stream(cfd *context_fd, int input_number)
+void update_client_stream(client_info *client, long long memory, int queued)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
-
-    DBG("preparing header\n");
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Access-Control-Allow-Origin: *\r\n" \
-            STD_HEADER \
-            "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
-            "\r\n" \
-            "--" BOUNDARY "\r\n");
-
-    if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
+    if(client == NULL)
         return;
-    }
-
-    DBG("Headers send, sending stream now\n");
 
-    while(!pglobal->stop) {
+    __sync_fetch_and_add(&client->streams, memory < 0 ? -1 : 1);
+    __sync_fetch_and_add(&client->memory, memory);
+    __sync_fetch_and_sub(&client->queued, (long long)queued);
+}
+#endif
 
-        /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+/******************************************************************************
+Description.: Prepare the zerocopy bookkeeping of a client socket
+Input Value.: * fd....: the client socket
+              * zc....: state to initialize
+              * enable: nonzero to try MSG_ZEROCOPY, kernels or sockets not
+                        supporting it silently fall back to regular sends
+Return Value: -
+******************************************************************************/
+void zerocopy_init(int fd, zerocopy_state *zc, int enable)
+{
+    int on = 1;
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+    memset(zc, 0, sizeof(zerocopy_state));
 
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+    #ifdef SO_ZEROCOPY
+    if(enable && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0)
+        zc->enabled = 1;
+    else if(enable)
+        DBG("MSG_ZEROCOPY not supported, copying frames\n");
+    #endif
+}
 
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
-                return;
-            }
+/******************************************************************************
+Description.: Send the rest of a frame, without copying it if possible. The
+              frame is referenced until the kernel reports it is done.
+Input Value.: * fd....: the client socket
+              * zc....: zerocopy state of the socket
+              * frame.: frame to send
+              * offset: number of bytes of the frame already sent
+              * flags.: additional flags for send()
+Return Value: number of bytes sent or -1 on error
+******************************************************************************/
+ssize_t zerocopy_send(int fd, zerocopy_state *zc, input_frame *frame, size_t offset, int flags)
+{
+    size_t len = frame->size - offset;
+    struct iovec iov[FRAME_IOVECS];
+    struct msghdr msg = { .msg_iov = iov };
+    ssize_t n;
+
+    /* SOI and the metadata segment are small, they are copied */
+    if(frame->app_size > 0) {
+        if(offset < 2 + (size_t)frame->app_size) {
+            msg.msg_iovlen = frame_iovec(frame, offset, iov) - 1;
+            return sendmsg(fd, &msg, flags | MSG_MORE);
+        }
+        offset -= frame->app_size;
+        len = frame->size - offset;
+    }
 
-            frame = tmp;
+    #ifdef MSG_ZEROCOPY
+    if(zc->enabled && frame->size >= ZEROCOPY_MIN_SIZE && zc->count < ZEROCOPY_PENDING) {
+        n = send(fd, frame->buf + offset, len, flags | MSG_ZEROCOPY);
+        if(n >= 0) {
+            /* every successful call gets the next notification id */
+            int slot = (zc->first + zc->count) % ZEROCOPY_PENDING;
+            zc->pending[slot] = frame_ref(frame);
+            zc->done[slot] = 0;
+            zc->count++;
+            zc->next_id++;
+            return n;
         }
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
+        /* out of option memory for pinned pages, copy this time */
+        if(errno != ENOBUFS)
+            return n;
+    }
+    #endif
 
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
+    return send(fd, frame->buf + offset, len, flags);
+}
 
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+/******************************************************************************
+Description.: Handle the completion notifications of zerocopy sends without
+              blocking and release the frames the kernel is done with
+Input Value.: * fd: the client socket
+              * zc: zerocopy state of the socket
+Return Value: -
+******************************************************************************/
+void zerocopy_reap(int fd, zerocopy_state *zc)
+{
+    #ifdef MSG_ZEROCOPY
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    unsigned int index;
+
+    while(zc->count > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
 
-        #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
-        #endif
+        for(cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                 (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
 
-        /*
-         * print the individual mimetype and the length
-         * sending the content-length fixes random stream disruption observed
-         * with firefox
-         */
-        sprintf(buffer, "Content-Type: image/jpeg\r\n" \
-                "Content-Length: %d\r\n" \
-                "X-Timestamp: %d.%06d\r\n" \
-                "\r\n", frame_size, (int)timestamp.tv_sec, (int)timestamp.tv_usec);
-        DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
 
-        DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
+            /* the sends ee_info up to ee_data are complete */
+            for(index = 0; index < (unsigned int)zc->count; index++) {
+                if(zc->first_id + index - serr->ee_info <= serr->ee_data - serr->ee_info)
+                    zc->done[(zc->first + index) % ZEROCOPY_PENDING] = 1;
+            }
 
-        DBG("sending boundary\n");
-        sprintf(buffer, "\r\n--" BOUNDARY "\r\n");
-        if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
+            /* the kernel had to copy anyway (e.g. loopback), stop pinning pages */
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->enabled = 0;
+        }
     }
 
-    free(frame);
+    while(zc->count > 0 && zc->done[zc->first]) {
+        frame_unref(zc->pending[zc->first]);
+        zc->pending[zc->first] = NULL;
+        zc->first = (zc->first + 1) % ZEROCOPY_PENDING;
+        zc->first_id++;
+        zc->count--;
+    }
+    #endif
 }
 
-#ifdef WXP_COMPAT
 /******************************************************************************
-Description.: Sends a mjpg stream in the same format as the WebcamXP does
-Input Value.: fildescriptor fd to send the answer to
+Description.: Wait a short time for outstanding zerocopy sends and release
+              all frames, called before the socket gets closed
+Input Value.: * fd: the client socket
+              * zc: zerocopy state of the socket
 Return Value: -
 ******************************************************************************/
-void send_stream_wxp(cfd *context_fd, int input_number)
+void zerocopy_release(int fd, zerocopy_state *zc)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    struct pollfd pfd;
+    int tries;
 
-    DBG("preparing header\n");
+    for(tries = 0; zc->count > 0 && tries < 100; tries++) {
+        zerocopy_reap(fd, zc);
+        if(zc->count == 0)
+            break;
 
-    time_t curDate, expiresDate;
-    curDate = time(NULL);
-    expiresDate = curDate - 1380; // teh expires date is before the current date with 23 minute (1380) sec
-
-    char curDateBuffer[80];
-    char expDateBuffer[80];
-
-    strftime(curDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&curDate));
-    strftime(expDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&expiresDate));
-    sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
-                    "Connection: keep-alive\r\n" \
-                    "Content-Type: multipart/x-mixed-replace; boundary=--myboundary\r\n" \
-                    "Content-Length: 9999999\r\n" \
-                    "Cache-control: no-cache, must revalidate\r\n" \
-                    "Date: %s\r\n" \
-                    "Expires: %s\r\n" \
-                    "Pragma: no-cache\r\n" \
-                    "Server: webcamXP\r\n"
-                    "\r\n",
-                    curDateBuffer,
-                    expDateBuffer);
-
-    if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
-        return;
+        /* notifications show up as POLLERR */
+        pfd.fd = fd;
+        pfd.events = 0;
+        poll(&pfd, 1, 10);
     }
 
-    DBG("Headers send, sending stream now\n");
+    while(zc->count > 0) {
+        frame_unref(zc->pending[zc->first]);
+        zc->first = (zc->first + 1) % ZEROCOPY_PENDING;
+        zc->count--;
+    }
+}
 
-    while(!pglobal->stop) {
+/******************************************************************************
+Description.: Send a frame with the header in front of it and the trailer
+              behind it, using a single system call unless the socket
+              accepts only part of the data
+Input Value.: * context_fd: the client
+              * zc........: zerocopy state of the socket, may be NULL
+              * head......: header to send before the frame
+              * head_len..: length of the header
+              * frame.....: the frame
+              * tail......: trailer after the frame, may be NULL
+              * tail_len..: length of the trailer
+Return Value: 0 if everything was sent, -1 on error
+******************************************************************************/
+int write_part(cfd *context_fd, zerocopy_state *zc, char *head, int head_len, input_frame *frame, char *tail, int tail_len)
+{
+    return write_part_at(context_fd, zc, head, head_len, frame, 0, tail, tail_len);
+}
 
-        /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+/******************************************************************************
+Description.: Send the end of a frame with a header in front of it and the
+              trailer behind it, like write_part()
+Input Value.: * context_fd: the client
+              * zc........: zerocopy state of the socket, may be NULL
+              * head......: header to send before the frame
+              * head_len..: length of the header
+              * frame.....: the frame
+              * offset....: of the first byte of the frame to send
+              * tail......: trailer after the frame, may be NULL
+              * tail_len..: length of the trailer
+Return Value: 0 if everything was sent, -1 on error
+******************************************************************************/
+int write_part_at(cfd *context_fd, zerocopy_state *zc, char *head, int head_len, input_frame *frame, size_t offset, char *tail, int tail_len)
+{
+    struct iovec iov[2 + FRAME_IOVECS];
+    int cnt = 0, on = 1, off = 0, rc = 0;
+    size_t done;
+    ssize_t n;
+
+    iov[cnt].iov_base = head;
+    iov[cnt++].iov_len = head_len;
+    cnt += frame_iovec(frame, offset, iov + cnt);
+    if(tail != NULL && tail_len > 0) {
+        iov[cnt].iov_base = tail;
+        iov[cnt++].iov_len = tail_len;
+    }
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+    /* with -k only full segments go out until the part is complete */
+    if(context_fd->pc->conf.cork)
+        setsockopt(context_fd->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
 
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+    /*
+     * zerocopy needs the frame in a call of its own, the headers are small
+     * and live in buffers which get reused right away so they are copied
+     */
+    if(zc != NULL && zc->enabled) {
+        for(done = 0; rc == 0 && done < (size_t)head_len; done += n) {
+            if((n = send(context_fd->fd, head + done, head_len - done, MSG_MORE)) < 0 && errno != EINTR)
+                rc = -1;
+            n = MAX(n, 0);
+        }
+        for(done = offset; rc == 0 && done < (size_t)frame_length(frame); done += n) {
+            if((n = zerocopy_send(context_fd->fd, zc, frame, done, (tail_len > 0) ? MSG_MORE : 0)) < 0 && errno != EINTR)
+                rc = -1;
+            n = MAX(n, 0);
+        }
+        for(done = 0; rc == 0 && done < (size_t)tail_len; done += n) {
+            if((n = send(context_fd->fd, tail + done, tail_len - done, 0)) < 0 && errno != EINTR)
+                rc = -1;
+            n = MAX(n, 0);
+        }
+        zerocopy_reap(context_fd->fd, zc);
+        cnt = 0;
+    }
 
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
-                return;
-            }
+    while(cnt > 0) {
+        if((n = writev(context_fd->fd, iov, cnt)) < 0) {
+            if(errno == EINTR)
+                continue;
+            rc = -1;
+            break;
+        }
 
-            frame = tmp;
+        /* skip what has been written and retry with the rest */
+        while(cnt > 0 && (size_t)n >= iov[0].iov_len) {
+            n -= iov[0].iov_len;
+            memmove(&iov[0], &iov[1], (--cnt) * sizeof(struct iovec));
         }
+        if(cnt > 0) {
+            iov[0].iov_base = (char *)iov[0].iov_base + n;
+            iov[0].iov_len -= n;
+        }
+    }
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
+    if(context_fd->pc->conf.cork)
+        setsockopt(context_fd->fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
 
-        #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
-        #endif
+    return rc;
+}
+
+/******************************************************************************
+Description.: Value of the Connection header field of an answer
+Input Value.: nonzero if the connection stays open for further requests
+Return Value: the value
+******************************************************************************/
+const char *connection_field(int keep_alive)
+{
+    return keep_alive ? "keep-alive" : "close";
+}
 
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
+/******************************************************************************
+Description.: Write all pieces, also if the socket takes only some of them at
+              a time
+Input Value.: * fd.: fildescriptor to write to
+              * iov: the pieces, they get changed
+              * cnt: their number
+Return Value: 0 if everything was written, -1 on errors
+******************************************************************************/
+static int writev_all(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t n;
 
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+    while(cnt > 0) {
+        if((n = writev(fd, iov, cnt)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
 
-        memset(buffer, 0, 50*sizeof(char));
-        sprintf(buffer, "mjpeg %07d12345", frame_size);
-        DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, 50) < 0) break;
+        while(cnt > 0 && (size_t)n >= iov[0].iov_len) {
+            n -= iov[0].iov_len;
+            memmove(&iov[0], &iov[1], (--cnt) * sizeof(struct iovec));
+        }
+        if(cnt > 0) {
+            iov[0].iov_base = (char *)iov[0].iov_base + n;
+            iov[0].iov_len -= n;
+        }
+    }
+    return 0;
+}
 
-        DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
+/******************************************************************************
+Description.: Send a complete HTTP response with a body built in memory
+Input Value.: * fd........: fildescriptor to send the answer to
+              * keep_alive: nonzero to keep the connection open afterwards
+              * mimetype..: content type of the body
+              * body......: the body
+              * len.......: length of the body
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+static int send_reply(int fd, int keep_alive, const char *mimetype, const char *body, size_t len)
+{
+    char header[BUFFER_SIZE];
+    struct iovec iov[2];
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = sprintf(header, "HTTP/1.%d 200 OK\r\n" \
+                             "Content-type: %s\r\n" \
+                             "Content-Length: %zu\r\n" \
+                             "Connection: %s\r\n" \
+                             STD_HEADER_FIELDS \
+                             "\r\n", HTTP_MINOR(keep_alive), mimetype, len, connection_field(keep_alive));
+    iov[1].iov_base = (void *)body;
+    iov[1].iov_len = len;
+
+    if(writev_all(fd, iov, 2) < 0) {
+        DBG("unable to send the answer\n");
+        return -1;
     }
 
-    free(frame);
+    return keep_alive ? 0 : -1;
 }
-#endif
 
 /******************************************************************************
-Description.: Send error messages and headers.
-Input Value.: * fd.....: is the filedescriptor to send the message to
-              * which..: HTTP error code, most popular is 404
-              * message: append this string to the displayed response
-Return Value: -
+Description.: the X-Burst header field of a still taken in a burst
+Input Value.: * field: gets the field, BURST_FIELD_SIZE bytes
+              * frame: the frame
+Return Value: field, empty for frames which are not part of a burst
 ******************************************************************************/
-void send_error(int fd, int which, char *message)
+static char *burst_field(char *field, const input_frame *frame)
+{
+    field[0] = '\0';
+    if(frame->burst != 0)
+        snprintf(field, BURST_FIELD_SIZE, "X-Burst: %u/%d\r\n", frame->burst, frame->burst_index);
+    return field;
+}
+
+/******************************************************************************
+Description.: Send a complete HTTP response and a single JPG-frame. The ETag
+              of the answer names the frame, a client which already has the
+              current frame gets a 304 answer without the image.
+Input Value.: * context_fd...: the client to send the answer to
+              * input_number.: input plugin to take the frame from
+              * keep_alive...: nonzero to keep the connection open afterwards
+              * if_none_match: If-None-Match header field of the request, may be NULL
+              * nowait.......: nonzero to not wait if the input has no frame yet
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_snapshot(cfd *context_fd, int input_number, int keep_alive, const char *if_none_match, int nowait)
 {
+    input_frame *frame;
+    unsigned long long seq = 0;
     char buffer[BUFFER_SIZE] = {0};
+    char etag[64], burst[BURST_FIELD_SIZE];
+    int len;
+
+    /* answer with the current frame right away, only wait if there is none yet.
+     * An idle input is woken for a snapshot of the present instead. */
+    if(input_idle(&pglobal->in[input_number]))
+        frame = input_wake_frame(&pglobal->in[input_number], SNAPSHOT_WAKE_MSEC);
+    else
+        frame = input_peek_frame(&pglobal->in[input_number]);
+    if(frame == NULL) {
+        if(nowait) {
+            send_error(context_fd->fd, 503, "no frame available yet");
+            return -1;
+        }
+        frame = input_wait_frame(&pglobal->in[input_number], &seq);
+    }
+    DBG("got frame (size: %d kB)\n", frame->size / 1024);
+
+    /* the timestamp keeps tags unique when the sequence starts over after a restart */
+    snprintf(etag, sizeof(etag), "\"%d-%llx-%lx\"", input_number, frame->seq, (long)frame->timestamp.tv_sec);
+
+    if(if_none_match != NULL && strstr(if_none_match, etag) != NULL) {
+        frame_unref(frame);
+        DBG("client has the current frame already\n");
+        len = sprintf(buffer, "HTTP/1.%d 304 Not Modified\r\n" \
+                "Access-Control-Allow-Origin: *\r\n" \
+                "Connection: %s\r\n" \
+                SNAPSHOT_HEADER_FIELDS \
+                "ETag: %s\r\n" \
+                "\r\n", HTTP_MINOR(keep_alive), connection_field(keep_alive), etag);
+        if(write(context_fd->fd, buffer, len) != len)
+            keep_alive = 0;
+        return keep_alive ? 0 : -1;
+    }
 
-    if(which == 401) {
-        sprintf(buffer, "HTTP/1.0 401 Unauthorized\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "WWW-Authenticate: Basic realm=\"MJPG-Streamer\"\r\n" \
-                "\r\n" \
-                "401: Not Authenticated!\r\n" \
-                "%s", message);
-    } else if(which == 404) {
-        sprintf(buffer, "HTTP/1.0 404 Not Found\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "404: Not Found!\r\n" \
-                "%s", message);
-    } else if(which == 500) {
+    #ifdef MANAGMENT
+    update_client_timestamp(context_fd->client);
+    #endif
+
+    /* write the response */
+    len = sprintf(buffer, "HTTP/1.%d 200 OK\r\n" \
+            "Access-Control-Allow-Origin: *\r\n" \
+            "Connection: %s\r\n" \
+            SNAPSHOT_HEADER_FIELDS \
+            "ETag: %s\r\n" \
+            "Content-type: image/jpeg\r\n" \
+            "Content-Length: %d\r\n" \
+            "X-Timestamp: %d.%06d\r\n" \
+            "%s" \
+            "\r\n", HTTP_MINOR(keep_alive), connection_field(keep_alive), etag, frame_length(frame),
+            (int) frame->timestamp.tv_sec, (int) frame->timestamp.tv_usec, burst_field(burst, frame));
+
+    /* send header and image now */
+    if(write_part(context_fd, NULL, buffer, len, frame, NULL, 0) < 0)
+        keep_alive = 0;
+
+    frame_unref(frame);
+    return keep_alive ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: Prepare the HTTP response header of a stream
+Input Value.: * buffer: where to store the header, BUFFER_SIZE bytes
+              * wxp...: nonzero for the WebcamXP compatible format
+Return Value: length of the header
+******************************************************************************/
+int stream_header(char *buffer, int wxp)
+{
+    #ifdef WXP_COMPAT
+    if(wxp) {
+        time_t curDate, expiresDate;
+        curDate = time(NULL);
+        expiresDate = curDate - 1380; // teh expires date is before the current date with 23 minute (1380) sec
+
+        char curDateBuffer[80];
+        char expDateBuffer[80];
+
+        strftime(curDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&curDate));
+        strftime(expDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&expiresDate));
+        return sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
+                        "Connection: keep-alive\r\n" \
+                        "Content-Type: multipart/x-mixed-replace; boundary=--myboundary\r\n" \
+                        "Content-Length: 9999999\r\n" \
+                        "Cache-control: no-cache, must revalidate\r\n" \
+                        "Date: %s\r\n" \
+                        "Expires: %s\r\n" \
+                        "Pragma: no-cache\r\n" \
+                        "Server: webcamXP\r\n"
+                        "\r\n",
+                        curDateBuffer,
+                        expDateBuffer);
+    }
+    #endif
+
+    return sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
+            "Access-Control-Allow-Origin: *\r\n" \
+            STD_HEADER \
+            "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
+            "\r\n" \
+            "--" BOUNDARY "\r\n");
+}
+
+/******************************************************************************
+Description.: Prepare the header which precedes each frame of a stream
+Input Value.: * buffer: where to store the header, BUFFER_SIZE bytes
+              * frame.: the frame to announce
+              * wxp...: nonzero for the WebcamXP compatible format
+Return Value: length of the header
+******************************************************************************/
+int stream_part_header(char *buffer, input_frame *frame, int wxp)
+{
+    char burst[BURST_FIELD_SIZE];
+
+    #ifdef WXP_COMPAT
+    if(wxp) {
+        /* WebcamXP uses a fixed size header */
+        memset(buffer, 0, 50*sizeof(char));
+        sprintf(buffer, "mjpeg %07d12345", frame_length(frame));
+        return 50;
+    }
+    #endif
+
+    /*
+     * print the individual mimetype and the length
+     * sending the content-length fixes random stream disruption observed
+     * with firefox
+     */
+    return sprintf(buffer, "Content-Type: image/jpeg\r\n" \
+            "Content-Length: %d\r\n" \
+            "X-Timestamp: %d.%06d\r\n" \
+            "%s" \
+            "\r\n", frame_length(frame), (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec,
+            burst_field(burst, frame));
+}
+
+/******************************************************************************
+Description.: Prepare what precedes the abbreviated image of a frame of a
+              tables=1 stream: a part with the tables if they changed, the
+              header of the part of the frame and the segments of the image
+              ahead of its scan. The scan follows from a->offset of the frame.
+Input Value.: * buffer: where to store it, BUFFER_SIZE + JPEG_TABLES_SIZE +
+                        JPEG_HEAD_SIZE bytes
+              * frame.: the frame to announce
+              * a.....: the tables of the client after jpeg_abbreviate()
+Return Value: length of the header
+******************************************************************************/
+int abbreviated_part_header(char *buffer, input_frame *frame, const jpeg_tables *a)
+{
+    char burst[BURST_FIELD_SIZE];
+    int len = 0;
+
+    if(a->changed) {
+        len = sprintf(buffer, "Content-Type: application/x-jpeg-tables\r\n" \
+                      "Content-Length: %d\r\n" \
+                      "\r\n", a->tables_len);
+        memcpy(buffer + len, a->tables, a->tables_len);
+        len += a->tables_len;
+        len += sprintf(buffer + len, "\r\n--" BOUNDARY "\r\n");
+    }
+
+    len += sprintf(buffer + len, "Content-Type: image/x-jpeg-abbreviated\r\n" \
+                   "Content-Length: %d\r\n" \
+                   "X-Timestamp: %d.%06d\r\n" \
+                   "%s" \
+                   "\r\n", jpeg_abbreviated_length(a, frame),
+                   (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec, burst_field(burst, frame));
+    memcpy(buffer + len, a->head, a->head_len);
+    return len + a->head_len;
+}
+
+/******************************************************************************
+Description.: Decide if a frame should be sent to a client which limited the
+              frame rate of its stream. The frame timestamps, not the time of
+              sending, are used so a client which lags behind keeps its rate.
+Input Value.: * throttle: the limits of the client, updated if the frame is due
+              * frame...: the candidate frame
+Return Value: 1 if the frame is due, 0 if it should be skipped
+******************************************************************************/
+int stream_frame_due(stream_throttle *throttle, input_frame *frame)
+{
+    struct timeval interval, ahead;
+    long usec;
+
+    if(throttle->every > 1 && throttle->seq != 0 &&
+       frame->seq < throttle->seq + throttle->every)
+        return 0;
+
+    if(throttle->fps > 0) {
+        usec = 1000000L / throttle->fps;
+        interval.tv_sec = usec / 1000000L;
+        interval.tv_usec = usec % 1000000L;
+
+        if(timercmp(&frame->timestamp, &throttle->next, <)) {
+            /* a timestamp further back than one interval means the clock jumped */
+            timersub(&throttle->next, &frame->timestamp, &ahead);
+            if(!timercmp(&ahead, &interval, >))
+                return 0;
+            timerclear(&throttle->next);
+        }
+
+        /* keep the rate steady, but do not try to catch up after a pause */
+        timeradd(&throttle->next, &interval, &throttle->next);
+        if(timercmp(&throttle->next, &frame->timestamp, <))
+            timeradd(&frame->timestamp, &interval, &throttle->next);
+    }
+
+    throttle->seq = frame->seq;
+    return 1;
+}
+
+/******************************************************************************
+Description.: Read a numeric parameter like "&fps=2" of a request line
+Input Value.: * line: the request line
+              * name: parameter name including the "=", e.g. "fps="
+Return Value: the value, 0 if the parameter is missing or not a positive number
+******************************************************************************/
+static int query_parameter(const char *line, const char *name)
+{
+    const char *p = line;
+    size_t len = strlen(name);
+    long value;
+
+    while((p = strstr(p, name)) != NULL) {
+        if(p > line && (p[-1] == '&' || p[-1] == '?')) {
+            value = strtol(p + len, NULL, 10);
+            return (value > 0 && value <= INT_MAX) ? (int)value : 0;
+        }
+        p += len;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Read the list of inputs like "&inputs=0,2,3" of a request line
+Input Value.: * line..: the request line
+              * inputs: gets the input numbers, MAX_STREAM_INPUTS of them
+Return Value: the number of inputs, 0 if the parameter is missing, -1 if
+              it is not a list of different, existing inputs
+******************************************************************************/
+static int inputs_parameter(const char *line, int *inputs)
+{
+    const char *p = line;
+    char *end;
+    long value;
+    int count = 0, i;
+
+    while((p = strstr(p, "inputs=")) != NULL) {
+        if(p > line && (p[-1] == '&' || p[-1] == '?'))
+            break;
+        p += strlen("inputs=");
+    }
+
+    if(p == NULL)
+        return 0;
+
+    p += strlen("inputs=");
+    do {
+        if(*p == ',')
+            p++;
+        value = strtol(p, &end, 10);
+        if(end == p || value < 0 || value >= pglobal->incnt || count == MAX_STREAM_INPUTS)
+            return -1;
+        for(i = 0; i < count; i++) {
+            if(inputs[i] == value)
+                return -1;
+        }
+        inputs[count++] = value;
+        p = end;
+    } while(*p == ',');
+
+    return count;
+}
+
+/* separates the frames of a stream */
+static char boundary[] = "\r\n--" BOUNDARY "\r\n";
+
+/******************************************************************************
+Description.: Let writes to a stream client fail if the client does not take
+              any data for the configured stall timeout
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+void stream_set_timeout(cfd *context_fd)
+{
+    struct timeval tv;
+
+    if(context_fd->pc->conf.stall_timeout <= 0)
+        return;
+
+    tv.tv_sec = context_fd->pc->conf.stall_timeout;
+    tv.tv_usec = 0;
+    if(setsockopt(context_fd->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)
+        perror("setsockopt(SO_SNDTIMEO) failed");
+}
+
+/******************************************************************************
+Description.: Pace a stream socket before the next part, so the frame leaves
+              across conf.pacing percent of the frame interval of the input
+              instead of in one burst. TCP spreads the packets itself with
+              SO_MAX_PACING_RATE on Linux 4.13 and newer, older kernels need
+              the fq qdisc. The rate only grows the moment a larger frame
+              comes, it is lowered once it is a third above the needed one.
+Input Value.: * pc....: the server context
+              * fd....: the client socket
+              * pacing: pacing state of the stream
+              * frame.: the frame of the part
+Return Value: -
+******************************************************************************/
+void stream_pace(context *pc, int fd, stream_pacing *pacing, input_frame *frame)
+{
+    unsigned long long usec, rate;
+    unsigned int value;
+
+    if(pc->conf.pacing == 0 || pacing->failed || frame->publish_usec == 0)
+        return;
+
+    /* the interval of the input, frames skipped by the client do not stretch it */
+    if(pacing->seq != 0 && frame->seq > pacing->seq && frame->publish_usec > pacing->usec) {
+        usec = (frame->publish_usec - pacing->usec) / (frame->seq - pacing->seq);
+        if(usec <= PACING_MAX_INTERVAL)
+            pacing->interval = (pacing->interval == 0) ? usec : (pacing->interval * 7 + usec) / 8;
+    }
+    pacing->seq = frame->seq;
+    pacing->usec = frame->publish_usec;
+
+    /* the first frames go out as they are until the interval is known */
+    if(pacing->interval == 0)
+        return;
+
+    rate = (unsigned long long)frame_length(frame) * 1000000ULL * 100 / (pacing->interval * pc->conf.pacing);
+    rate = MAX(rate, PACING_MIN_RATE);
+    rate = MIN(rate, UINT_MAX);
+
+    if(rate <= pacing->rate && rate * 4 >= (unsigned long long)pacing->rate * 3)
+        return;
+
+    value = rate;
+    if(setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) < 0) {
+        DBG("no pacing for fd %d: %s\n", fd, strerror(errno));
+        pacing->failed = 1;
+        return;
+    }
+    pacing->rate = value;
+    __sync_fetch_and_add(&pc->stats.paced, 1);
+}
+
+/******************************************************************************
+Description.: Count the bytes still queued in the socket of a stream client
+              before the next part, a growing queue means a slow network
+Input Value.: * pc...: the server context
+              * fd...: the client socket
+              * input: input plugin the frame comes from
+              * frame: the frame of the part
+Return Value: the bytes in the queue, 0 if the socket does not tell
+******************************************************************************/
+int stream_stats_begin(context *pc, int fd, int input, input_frame *frame)
+{
+    int queued;
+
+    if(ioctl(fd, SIOCOUTQ, &queued) == 0)
+        histogram_observe(&pc->stats.queue_bytes, queued);
+    else
+        queued = 0;
+    PROBE(send_start, input, frame->seq, pc->id, fd);
+    return queued;
+}
+
+/******************************************************************************
+Description.: Count a part sent to a stream client, and how old its frame
+              was once the kernel had all of it
+Input Value.: * pc.....: the server context
+              * fd.....: the client socket
+              * input..: input plugin the frame comes from
+              * frame..: the frame of the part
+              * dropped: frames skipped before this one
+              * usec...: time it took to hand the part over to the kernel
+Return Value: -
+******************************************************************************/
+void stream_stats_part(context *pc, int fd, int input, input_frame *frame, unsigned long long dropped, unsigned long long usec)
+{
+    unsigned long long now = monotonic_usec();
+
+    PROBE(send_end, input, frame->seq, pc->id, fd, frame_length(frame));
+
+    __sync_fetch_and_add(&pc->stats.frames_sent, 1);
+    __sync_fetch_and_add(&pc->stats.frames_dropped, dropped);
+    __sync_fetch_and_add(&pc->stats.bytes_sent, frame_length(frame));
+    if(frame->numa_node >= 0) {
+        if(frame->numa_node == numa_current_node())
+            __sync_fetch_and_add(&pc->stats.numa_local, frame_length(frame));
+        else
+            __sync_fetch_and_add(&pc->stats.numa_remote, frame_length(frame));
+    }
+    histogram_observe(&pc->stats.send_usec, usec);
+
+    if(frame->publish_usec != 0 && now >= frame->publish_usec)
+        histogram_observe(&pc->stats.publish_age_usec, now - frame->publish_usec);
+    if(frame->capture_usec != 0 && now >= frame->capture_usec)
+        histogram_observe(&pc->stats.capture_age_usec, now - frame->capture_usec);
+}
+
+/******************************************************************************
+Description.: Send a complete HTTP response and a stream of JPG-frames.
+Input Value.: fildescriptor fd to send the answer to
+Return Value: -
+******************************************************************************/
+void send_stream(cfd *context_fd, int input_number)
+{
+    input_frame *frame;
+    frame_subscription sub;
+    crop_variant *crop;
+    unsigned long long dropped = 0, skipped, start;
+    char buffer[BUFFER_SIZE + JPEG_TABLES_SIZE + JPEG_HEAD_SIZE] = {0};
+    jpeg_tables *tables = NULL;
+    zerocopy_state zc;
+    stream_pacing pacing;
+    int len, n;
+    #ifdef MANAGMENT
+    int accounted = 0;  /* bytes of the socket queue accounted to the client */
+    #endif
+
+    DBG("preparing header\n");
+    len = stream_header(buffer, 0);
+
+    if(write(context_fd->fd, buffer, len) < 0) {
+        return;
+    }
+
+    /* a client asking for abbreviated frames which can not be served gets whole ones */
+    if(context_fd->tables && (tables = calloc(1, sizeof(jpeg_tables))) == NULL)
+        DBG("no memory for the tables, sending whole frames\n");
+
+    DBG("Headers send, sending stream now\n");
+    zerocopy_init(context_fd->fd, &zc, context_fd->pc->conf.zerocopy);
+    memset(&pacing, 0, sizeof(pacing));
+    stream_set_timeout(context_fd);
+    admit_stream_start(context_fd);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, CLIENT_STACK_SIZE, 0);
+    #endif
+    scale_subscribe(input_number, context_fd->scale);
+    quality_subscribe(input_number, context_fd->quality);
+    crop = crop_subscribe(input_number, &context_fd->crop);
+    /* skipped frames are counted per client, not as overruns of the plugin */
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, NULL);
+    sub.every = context_fd->throttle.every;
+
+    while(!pglobal->stop) {
+
+        /*
+         * wait for fresh frames, this takes a reference instead of copying.
+         * A client slower than the input skips to the newest frame.
+         */
+        frame = frame_next(&sub, -1);
+        DBG("got frame (size: %d kB)\n", frame->size / 1024);
+
+        /* frames skipped to honour the requested rate are not dropped ones */
+        if(!stream_frame_due(&context_fd->throttle, frame) ||
+           !variant_due(input_number, context_fd->scale, context_fd->quality, crop, frame)) {
+            frame_unref(frame);
+            continue;
+        }
+
+        skipped = sub.skipped;
+        dropped += skipped;
+
+        /* clients asking for the same size, quality or region share one copy */
+        frame = scale_frame(input_number, context_fd->scale, frame);
+        frame = quality_frame(input_number, context_fd->quality, frame);
+        frame = crop_frame(crop, frame);
+        adapt_update(context_fd, input_number, &sub, frame, skipped);
+
+        stream_pace(context_fd->pc, context_fd->fd, &pacing, frame);
+        #ifdef MANAGMENT
+        update_client_timestamp(context_fd->client);
+        update_client_frames(context_fd->client, skipped);
+        update_client_queue(context_fd->client, &accounted,
+                            stream_stats_begin(context_fd->pc, context_fd->fd, input_number, frame));
+        #else
+        stream_stats_begin(context_fd->pc, context_fd->fd, input_number, frame);
+        #endif
+
+        /* part header, frame and boundary go out together */
+        DBG("sending frame\n");
+        start = monotonic_usec();
+        if(tables != NULL && jpeg_abbreviate(tables, frame) == 0) {
+            len = abbreviated_part_header(buffer, frame, tables);
+            n = write_part_at(context_fd, &zc, buffer, len, frame, tables->offset, boundary, sizeof(boundary) - 1);
+        } else {
+            len = stream_part_header(buffer, frame, 0);
+            n = write_part(context_fd, &zc, buffer, len, frame, boundary, sizeof(boundary) - 1);
+        }
+        if(n < 0) {
+            DBG("client stalled or disconnected, %llu frames dropped\n", dropped);
+            frame_unref(frame);
+            break;
+        }
+        stream_stats_part(context_fd->pc, context_fd->fd, input_number, frame, skipped, monotonic_usec() - start);
+        frame_unref(frame);
+    }
+
+    frame_unsubscribe(&sub);
+    scale_unsubscribe(input_number, context_fd->scale);
+    quality_unsubscribe(input_number, context_fd->quality);
+    crop_unsubscribe(crop);
+    __sync_fetch_and_sub(&context_fd->pc->stats.stream_clients, 1);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, -CLIENT_STACK_SIZE, accounted);
+    #endif
+    zerocopy_release(context_fd->fd, &zc);
+    free(tables);
+}
+
+#ifdef WXP_COMPAT
+/******************************************************************************
+Description.: Sends a mjpg stream in the same format as the WebcamXP does
+Input Value.: fildescriptor fd to send the answer to
+Return Value: -
+******************************************************************************/
+void send_stream_wxp(cfd *context_fd, int input_number)
+{
+    input_frame *frame;
+    frame_subscription sub;
+    crop_variant *crop;
+    unsigned long long dropped = 0, skipped, start;
+    char buffer[BUFFER_SIZE] = {0};
+    zerocopy_state zc;
+    stream_pacing pacing;
+    int len;
+    #ifdef MANAGMENT
+    int accounted = 0;  /* bytes of the socket queue accounted to the client */
+    #endif
+
+    DBG("preparing header\n");
+    len = stream_header(buffer, 1);
+
+    if(write(context_fd->fd, buffer, len) < 0) {
+        return;
+    }
+
+    DBG("Headers send, sending stream now\n");
+    zerocopy_init(context_fd->fd, &zc, context_fd->pc->conf.zerocopy);
+    memset(&pacing, 0, sizeof(pacing));
+    stream_set_timeout(context_fd);
+    admit_stream_start(context_fd);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, CLIENT_STACK_SIZE, 0);
+    #endif
+    scale_subscribe(input_number, context_fd->scale);
+    quality_subscribe(input_number, context_fd->quality);
+    crop = crop_subscribe(input_number, &context_fd->crop);
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, NULL);
+    sub.every = context_fd->throttle.every;
+
+    while(!pglobal->stop) {
+
+        /*
+         * wait for fresh frames, this takes a reference instead of copying.
+         * A client slower than the input skips to the newest frame.
+         */
+        frame = frame_next(&sub, -1);
+        DBG("got frame (size: %d kB)\n", frame->size / 1024);
+
+        /* frames skipped to honour the requested rate are not dropped ones */
+        if(!stream_frame_due(&context_fd->throttle, frame) ||
+           !variant_due(input_number, context_fd->scale, context_fd->quality, crop, frame)) {
+            frame_unref(frame);
+            continue;
+        }
+
+        skipped = sub.skipped;
+        dropped += skipped;
+
+        /* clients asking for the same size, quality or region share one copy */
+        frame = scale_frame(input_number, context_fd->scale, frame);
+        frame = quality_frame(input_number, context_fd->quality, frame);
+        frame = crop_frame(crop, frame);
+        adapt_update(context_fd, input_number, &sub, frame, skipped);
+
+        stream_pace(context_fd->pc, context_fd->fd, &pacing, frame);
+        #ifdef MANAGMENT
+        update_client_timestamp(context_fd->client);
+        update_client_frames(context_fd->client, skipped);
+        update_client_queue(context_fd->client, &accounted,
+                            stream_stats_begin(context_fd->pc, context_fd->fd, input_number, frame));
+        #else
+        stream_stats_begin(context_fd->pc, context_fd->fd, input_number, frame);
+        #endif
+
+        len = stream_part_header(buffer, frame, 1);
+        DBG("sending frame\n");
+        start = monotonic_usec();
+        if(write_part(context_fd, &zc, buffer, len, frame, NULL, 0) < 0) {
+            DBG("client stalled or disconnected, %llu frames dropped\n", dropped);
+            frame_unref(frame);
+            break;
+        }
+        stream_stats_part(context_fd->pc, context_fd->fd, input_number, frame, skipped, monotonic_usec() - start);
+        frame_unref(frame);
+    }
+
+    frame_unsubscribe(&sub);
+    scale_unsubscribe(input_number, context_fd->scale);
+    quality_unsubscribe(input_number, context_fd->quality);
+    crop_unsubscribe(crop);
+    __sync_fetch_and_sub(&context_fd->pc->stats.stream_clients, 1);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, -CLIENT_STACK_SIZE, accounted);
+    #endif
+    zerocopy_release(context_fd->fd, &zc);
+}
+#endif
+
+/* a frame waiting to be sent on a stream of several inputs */
+typedef struct {
+    int input;              /* index into inputs of the cfd */
+    input_frame *frame;
+    unsigned long long skipped;
+} stream_input_part;
+
+/******************************************************************************
+Description.: Send a stream of the frames of several inputs on one connection,
+              each part names its input with a X-Input header. One eventfd
+              is armed for all inputs, frames published at the same time go
+              out in the order they were published.
+Input Value.: * context_fd: the client, with the inputs of ?action=stream&inputs=
+Return Value: -
+******************************************************************************/
+void send_stream_inputs(cfd *context_fd)
+{
+    int count = context_fd->input_count, *inputs = context_fd->inputs;
+    frame_subscription sub[MAX_STREAM_INPUTS];
+    frame_waiter waiter[MAX_STREAM_INPUTS];
+    stream_throttle throttle[MAX_STREAM_INPUTS];
+    crop_variant *crop[MAX_STREAM_INPUTS];
+    unsigned long long seen[MAX_STREAM_INPUTS];
+    stream_input_part part[MAX_STREAM_INPUTS], next;
+    unsigned long long dropped = 0, start, value;
+    char buffer[BUFFER_SIZE] = {0};
+    struct pollfd pfd;
+    zerocopy_state zc;
+    input_frame *frame;
+    int len, ready, i, j, efd, failed = 0;
+    #ifdef MANAGMENT
+    int accounted = 0;  /* bytes of the socket queue accounted to the client */
+    #endif
+
+    if((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        send_error(context_fd->fd, 500, "could not wait for the inputs");
+        return;
+    }
+
+    len = stream_header(buffer, 0);
+    if(write(context_fd->fd, buffer, len) < 0) {
+        close(efd);
+        return;
+    }
+
+    zerocopy_init(context_fd->fd, &zc, context_fd->pc->conf.zerocopy);
+    stream_set_timeout(context_fd);
+    admit_stream_start(context_fd);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, CLIENT_STACK_SIZE, 0);
+    #endif
+    memset(waiter, 0, sizeof(waiter));
+    for(i = 0; i < count; i++) {
+        scale_subscribe(inputs[i], context_fd->scale);
+        quality_subscribe(inputs[i], context_fd->quality);
+        crop[i] = crop_subscribe(inputs[i], &context_fd->crop);
+        frame_subscribe(&sub[i], &pglobal->in[inputs[i]], FRAME_LATEST, NULL);
+        throttle[i] = context_fd->throttle;
+        seen[i] = 0;
+    }
+
+    while(!pglobal->stop && !failed) {
+        /* take the frames published since the last round, arm the waiters of the others */
+        ready = 0;
+        for(i = 0; i < count; i++) {
+            if(!frame_watch(&waiter[i], &pglobal->in[inputs[i]], seen[i], efd) ||
+               (frame = frame_next(&sub[i], 0)) == NULL)
+                continue;
+            seen[i] = frame->seq;
+
+            if(!stream_frame_due(&throttle[i], frame) ||
+               !variant_due(inputs[i], context_fd->scale, context_fd->quality, crop[i], frame)) {
+                frame_unref(frame);
+                continue;
+            }
+
+            /* sorted by the time they were published */
+            next.input = i;
+            next.frame = frame;
+            next.skipped = sub[i].skipped;
+            for(j = ready; j > 0 && part[j - 1].frame->publish_usec > frame->publish_usec; j--)
+                part[j] = part[j - 1];
+            part[j] = next;
+            ready++;
+        }
+
+        if(ready == 0) {
+            pfd.fd = efd;
+            pfd.events = POLLIN;
+            if(poll(&pfd, 1, 1000) > 0 && read(efd, &value, sizeof(value)) < 0)
+                DBG("could not read eventfd\n");
+            continue;
+        }
+
+        for(j = 0; j < ready; j++) {
+            i = part[j].input;
+            frame = part[j].frame;
+            if(failed) {
+                frame_unref(frame);
+                continue;
+            }
+            dropped += part[j].skipped;
+
+            /* clients asking for the same size, quality or region share one copy */
+            frame = scale_frame(inputs[i], context_fd->scale, frame);
+            frame = quality_frame(inputs[i], context_fd->quality, frame);
+            frame = crop_frame(crop[i], frame);
+
+            #ifdef MANAGMENT
+            update_client_timestamp(context_fd->client);
+            update_client_frames(context_fd->client, part[j].skipped);
+            update_client_queue(context_fd->client, &accounted,
+                                stream_stats_begin(context_fd->pc, context_fd->fd, inputs[i], frame));
+            #else
+            stream_stats_begin(context_fd->pc, context_fd->fd, inputs[i], frame);
+            #endif
+
+            len = sprintf(buffer, "X-Input: %d\r\n", inputs[i]);
+            len += stream_part_header(buffer + len, frame, 0);
+            start = monotonic_usec();
+            if(write_part(context_fd, &zc, buffer, len, frame, boundary, sizeof(boundary) - 1) < 0) {
+                DBG("client stalled or disconnected, %llu frames dropped\n", dropped);
+                failed = 1;
+            } else {
+                stream_stats_part(context_fd->pc, context_fd->fd, inputs[i], frame, part[j].skipped, monotonic_usec() - start);
+            }
+            frame_unref(frame);
+        }
+    }
+
+    for(i = 0; i < count; i++) {
+        frame_unwatch(&waiter[i]);
+        frame_unsubscribe(&sub[i]);
+        scale_unsubscribe(inputs[i], context_fd->scale);
+        quality_unsubscribe(inputs[i], context_fd->quality);
+        crop_unsubscribe(crop[i]);
+    }
+    __sync_fetch_and_sub(&context_fd->pc->stats.stream_clients, 1);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, -CLIENT_STACK_SIZE, accounted);
+    #endif
+    zerocopy_release(context_fd->fd, &zc);
+    close(efd);
+}
+
+/******************************************************************************
+Description.: Send error messages and headers.
+Input Value.: * fd.....: is the filedescriptor to send the message to
+              * which..: HTTP error code, most popular is 404
+              * message: append this string to the displayed response
+Return Value: -
+******************************************************************************/
+void send_error(int fd, int which, char *message)
+{
+    char buffer[BUFFER_SIZE] = {0};
+
+    if(which == 401) {
+        sprintf(buffer, "HTTP/1.0 401 Unauthorized\r\n" \
+                "Content-type: text/plain\r\n" \
+                STD_HEADER \
+                "WWW-Authenticate: Basic realm=\"MJPG-Streamer\"\r\n" \
+                "\r\n" \
+                "401: Not Authenticated!\r\n" \
+                "%s", message);
+    } else if(which == 404) {
+        sprintf(buffer, "HTTP/1.0 404 Not Found\r\n" \
+                "Content-type: text/plain\r\n" \
+                STD_HEADER \
+                "\r\n" \
+                "404: Not Found!\r\n" \
+                "%s", message);
+    } else if(which == 500) {
         sprintf(buffer, "HTTP/1.0 500 Internal Server Error\r\n" \
                 "Content-type: text/plain\r\n" \
                 STD_HEADER \
                 "\r\n" \
                 "500: Internal Server Error!\r\n" \
                 "%s", message);
+    } else if(which == 503) {
+        sprintf(buffer, "HTTP/1.0 503 Service Unavailable\r\n" \
+                "Content-type: text/plain\r\n" \
+                STD_HEADER \
+                "\r\n" \
+                "503: Service Unavailable!\r\n" \
+                "%s", message);
+    } else if(which == 502) {
+        sprintf(buffer, "HTTP/1.0 502 Bad Gateway\r\n" \
+                "Content-type: text/plain\r\n" \
+                STD_HEADER \
+                "\r\n" \
+                "502: Bad Gateway!\r\n" \
+                "%s", message);
+    } else if(which == 504) {
+        sprintf(buffer, "HTTP/1.0 504 Gateway Timeout\r\n" \
+                "Content-type: text/plain\r\n" \
+                STD_HEADER \
+                "\r\n" \
+                "504: Gateway Timeout!\r\n" \
+                "%s", message);
     } else if(which == 400) {
         sprintf(buffer, "HTTP/1.0 400 Bad Request\r\n" \
                 "Content-type: text/plain\r\n" \
@@ -695,16 +1604,18 @@ Description.: Send HTTP header and copy the content of a file. To keep things
               simple, just a single folder gets searched for the file. Just
               files with known extension and supported mimetype get served.
               If no parameter was given, the file "index.html" will be copied.
-Input Value.: * fd.......: filedescriptor to send data to
-              * id.......: specifies which server-context is the right one
-              * parameter: string that consists of the filename
-Return Value: -
+Input Value.: * fd........: filedescriptor to send data to
+              * id........: specifies which server-context is the right one
+              * parameter.: string that consists of the filename
+              * keep_alive: nonzero to keep the connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
 ******************************************************************************/
-void send_file(int id, int fd, char *parameter)
+int send_file(int id, int fd, char *parameter, int keep_alive)
 {
     char buffer[BUFFER_SIZE] = {0};
     char *extension, *mimetype = NULL;
     int i, lfd;
+    struct stat st;
     config conf = servers[id].conf;
 
     /* in case no parameter was given */
@@ -722,7 +1633,7 @@ void send_file(int id, int fd, char *parameter)
 
     if(lastDot == 0) {
         send_error(fd, 400, "No file extension found");
-        return;
+        return -1;
     } else {
         extension = parameter + lastDot;
         DBG("%s EXTENSION: %s\n", parameter, extension);
@@ -736,44 +1647,160 @@ void send_file(int id, int fd, char *parameter)
         }
     }
 
-    /* in case of unknown mimetype or extension leave */
-    if(mimetype == NULL) {
-        send_error(fd, 404, "MIME-TYPE not known");
-        return;
+    /* in case of unknown mimetype or extension leave */
+    if(mimetype == NULL) {
+        send_error(fd, 404, "MIME-TYPE not known");
+        return -1;
+    }
+
+    /* now filename, mimetype and extension are known */
+    DBG("trying to serve file \"%s\", extension: \"%s\" mime: \"%s\"\n", parameter, extension, mimetype);
+
+    /* build the absolute path to the file */
+    strncat(buffer, conf.www_folder, sizeof(buffer) - 1);
+    strncat(buffer, parameter, sizeof(buffer) - strlen(buffer) - 1);
+
+    /* try to open that file */
+    if((lfd = open(buffer, O_RDONLY)) < 0) {
+        DBG("file %s not accessible\n", buffer);
+        send_error(fd, 404, "Could not open file");
+        return -1;
+    }
+    DBG("opened file: %s\n", buffer);
+
+    /* a persistent connection needs the length to find the end of the file */
+    if(fstat(lfd, &st) < 0)
+        keep_alive = 0;
+
+    /* prepare HTTP header */
+    if(keep_alive) {
+        sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
+                "Content-type: %s\r\n" \
+                "Content-Length: %lld\r\n" \
+                "Connection: keep-alive\r\n" \
+                STD_HEADER_FIELDS \
+                "\r\n", mimetype, (long long)st.st_size);
+    } else {
+        sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
+                "Content-type: %s\r\n" \
+                STD_HEADER \
+                "\r\n", mimetype);
+    }
+    i = strlen(buffer);
+
+    /* first transmit HTTP-header, afterwards transmit content of file */
+    do {
+        if(write(fd, buffer, i) < 0) {
+            close(lfd);
+            return -1;
+        }
+    } while((i = read(lfd, buffer, sizeof(buffer))) > 0);
+
+    /* close file, job done */
+    close(lfd);
+    return keep_alive ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: Send the first picture output_file --partition recorded at or
+              after a time. It is looked up in the index of the hour of the
+              time and the following hour, without listing any directory.
+Input Value.: * id........: specifies which server-context is the right one
+              * fd........: filedescriptor to send data to
+              * parameter.: query string with t=<seconds since the epoch>
+              * keep_alive: nonzero to keep the connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+static int send_recorded(int id, int fd, char *parameter, int keep_alive)
+{
+    char buffer[BUFFER_SIZE], pattern[BUFFER_SIZE], name[BUFFER_SIZE];
+    unsigned long long wanted;
+    recorded_entry entry;
+    struct stat st;
+    struct tm now;
+    time_t t;
+    char *pt, *end;
+    int i, count, low, high, middle, ifd, lfd = -1, hour;
+    config conf = servers[id].conf;
+
+    if(conf.recorded == NULL) {
+        send_error(fd, 501, "no recorded folder configured");
+        return -1;
+    }
+
+    if(parameter == NULL || (pt = strstr(parameter, "t=")) == NULL ||
+       (wanted = strtod(pt + 2, &end) * 1000000.0) == 0 || end == pt + 2) {
+        send_error(fd, 400, "&t= must give the time in seconds since the epoch");
+        return -1;
+    }
+
+    for(hour = 0; hour < 2 && lfd < 0; hour++) {
+        t = wanted / 1000000 + hour * 3600;
+        snprintf(pattern, sizeof(pattern), "%s/%s/%s", conf.recorded, RECORDED_DIR, RECORDED_INDEX);
+        if(localtime_r(&t, &now) == NULL || strftime(buffer, sizeof(buffer), pattern, &now) == 0 ||
+           (ifd = open(buffer, O_RDONLY)) < 0)
+            continue;
+
+        /* the first entry at the time, the next hour starts with its first one */
+        count = (fstat(ifd, &st) == 0) ? st.st_size / sizeof(recorded_entry) : 0;
+        low = 0;
+        high = count;
+        while(hour == 0 && low < high) {
+            middle = (low + high) / 2;
+            if(pread(ifd, &entry, sizeof(entry), middle * sizeof(entry)) != sizeof(entry))
+                break;
+            if(entry.timestamp < wanted)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        /* pictures of the ringbuffer may be deleted already */
+        for(i = low; i < count && lfd < 0; i++) {
+            if(pread(ifd, &entry, sizeof(entry), i * sizeof(entry)) != sizeof(entry))
+                break;
+            t = entry.timestamp / 1000000;
+            snprintf(pattern, sizeof(pattern), "%%%%s/%s/%s", RECORDED_DIR, RECORDED_NAME);
+            if(localtime_r(&t, &now) == NULL || strftime(buffer, sizeof(buffer), pattern, &now) == 0)
+                break;
+            snprintf(name, sizeof(name), buffer, conf.recorded, (unsigned long long)entry.number);
+            lfd = open(name, O_RDONLY);
+        }
+        close(ifd);
+    }
+
+    if(lfd < 0) {
+        send_error(fd, 404, "nothing recorded at that time");
+        return -1;
     }
+    DBG("serving recorded picture %s\n", name);
 
-    /* now filename, mimetype and extension are known */
-    DBG("trying to serve file \"%s\", extension: \"%s\" mime: \"%s\"\n", parameter, extension, mimetype);
-
-    /* build the absolute path to the file */
-    strncat(buffer, conf.www_folder, sizeof(buffer) - 1);
-    strncat(buffer, parameter, sizeof(buffer) - strlen(buffer) - 1);
-
-    /* try to open that file */
-    if((lfd = open(buffer, O_RDONLY)) < 0) {
-        DBG("file %s not accessible\n", buffer);
-        send_error(fd, 404, "Could not open file");
-        return;
+    if(fstat(lfd, &st) < 0) {
+        close(lfd);
+        send_error(fd, 500, "could not read the picture");
+        return -1;
     }
-    DBG("opened file: %s\n", buffer);
 
-    /* prepare HTTP header */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", mimetype);
-    i = strlen(buffer);
+    i = sprintf(buffer, "HTTP/1.%d 200 OK\r\n" \
+                "Access-Control-Allow-Origin: *\r\n" \
+                "Connection: %s\r\n" \
+                SNAPSHOT_HEADER_FIELDS \
+                "Content-type: image/jpeg\r\n" \
+                "Content-Length: %lld\r\n" \
+                "X-Timestamp: %d.%06d\r\n" \
+                "\r\n", HTTP_MINOR(keep_alive), connection_field(keep_alive), (long long)st.st_size,
+                (int)(entry.timestamp / 1000000), (int)(entry.timestamp % 1000000));
 
     /* first transmit HTTP-header, afterwards transmit content of file */
     do {
         if(write(fd, buffer, i) < 0) {
             close(lfd);
-            return;
+            return -1;
         }
     } while((i = read(lfd, buffer, sizeof(buffer))) > 0);
 
-    /* close file, job done */
     close(lfd);
+    return keep_alive ? 0 : -1;
 }
 
 /******************************************************************************
@@ -855,6 +1882,257 @@ void execute_cgi(int id, int fd, char *parameter, char *query_string)
 }
 
 
+/* a text buffer growing as needed */
+typedef struct {
+    char *data;
+    size_t len, size;
+} text_buffer;
+
+/******************************************************************************
+Description.: append formatted text to a buffer, enlarging it if needed
+Input Value.: * b.....: the buffer, data is NULL after an allocation failed
+              * format: printf format and its arguments
+Return Value: -
+******************************************************************************/
+static void text_printf(text_buffer *b, const char *format, ...)
+{
+    va_list ap;
+    char *data;
+    int n;
+
+    while(b->data != NULL) {
+        va_start(ap, format);
+        n = vsnprintf(b->data + b->len, b->size - b->len, format, ap);
+        va_end(ap);
+
+        if(n < 0)
+            return;
+        if((size_t)n < b->size - b->len) {
+            b->len += n;
+            return;
+        }
+
+        if((data = realloc(b->data, b->size * 2 + n)) == NULL) {
+            free(b->data);
+            b->data = NULL;
+            return;
+        }
+        b->data = data;
+        b->size = b->size * 2 + n;
+    }
+}
+
+/******************************************************************************
+Description.: append a label value, quotes and backslashes are escaped
+Input Value.: * b....: the buffer
+              * value: the label value, may be NULL
+Return Value: -
+******************************************************************************/
+static void text_label(text_buffer *b, const char *value)
+{
+    if(value == NULL)
+        return;
+
+    for(; *value != '\0'; value++) {
+        if(*value == '"' || *value == '\\')
+            text_printf(b, "\\%c", *value);
+        else if(*value == '\n')
+            text_printf(b, "\\n");
+        else
+            text_printf(b, "%c", *value);
+    }
+}
+
+/*
+ * serialized JSON descriptions of the plugins. Building them walks all
+ * controls and formats, so they are kept until a command could have changed
+ * them. A command raises the generation of its plugin, the next request
+ * rebuilds the description. Requests in progress hold a reference.
+ */
+typedef struct {
+    int refs;
+    size_t len;
+    char data[];
+} json_blob;
+
+typedef struct {
+    json_blob *blob;
+    unsigned int generation;    /* generation the blob was built for */
+    unsigned long long commands;    /* commands of the input done when last checked */
+} json_cache;
+
+static pthread_mutex_t json_mutex = PTHREAD_MUTEX_INITIALIZER;
+static json_cache *input_json, *output_json, program_json;
+static unsigned int *input_generation, *output_generation, program_generation;
+static unsigned long long program_actions;     /* of the governor when program_generation was last bumped */
+
+/******************************************************************************
+Description.: release a reference to a serialized description
+Input Value.: the blob, may be NULL
+Return Value: -
+******************************************************************************/
+static void json_blob_unref(json_blob *blob)
+{
+    if(blob != NULL && __sync_sub_and_fetch(&blob->refs, 1) == 0)
+        free(blob);
+}
+
+/******************************************************************************
+Description.: Send a description from the cache, building it first if it is
+              missing or outdated
+Input Value.: * fd........: the client socket
+              * keep_alive: keep the connection open afterwards
+              * cache.....: the cache entry of the description
+              * generation: current generation of the plugin
+              * build.....: function writing the description into a buffer
+              * number....: plugin number passed to build
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+static int send_cached_JSON(int fd, int keep_alive, json_cache *cache, unsigned int *generation,
+                            void (*build)(text_buffer *, int), int number)
+{
+    json_blob *blob = NULL;
+    text_buffer b;
+    unsigned int built_for;
+    int result;
+
+    pthread_mutex_lock(&json_mutex);
+    if(cache->blob != NULL && cache->generation == *generation) {
+        blob = cache->blob;
+        blob->refs++;
+    }
+    built_for = *generation;
+    pthread_mutex_unlock(&json_mutex);
+
+    if(blob == NULL) {
+        /* room for the blob header in front of the text */
+        b.len = offsetof(json_blob, data);
+        b.size = BUFFER_SIZE;
+        if((b.data = malloc(b.size)) == NULL)
+            return -1;
+
+        build(&b, number);
+        if(b.data == NULL)
+            return -1;
+
+        blob = (json_blob *)b.data;
+        blob->len = b.len - offsetof(json_blob, data);
+        blob->refs = 1;
+
+        /* a command in the meantime makes the new blob outdated already */
+        pthread_mutex_lock(&json_mutex);
+        if(built_for == *generation) {
+            json_blob_unref(cache->blob);
+            cache->blob = blob;
+            cache->generation = built_for;
+            blob->refs++;
+        }
+        pthread_mutex_unlock(&json_mutex);
+    }
+
+    result = send_reply(fd, keep_alive, "application/x-javascript", blob->data, blob->len);
+    json_blob_unref(blob);
+    return result;
+}
+
+/******************************************************************************
+Description.: Mark the description of a plugin as outdated, called after a
+              command was passed to it
+Input Value.: * dest.....: 0 for an input, 1 for an output plugin, 2 for the
+                           program after plugins were added or removed
+              * plugin_no: number of the plugin
+Return Value: -
+******************************************************************************/
+static void invalidate_JSON(int dest, int plugin_no)
+{
+    if(dest == Dest_Program) {
+        pthread_mutex_lock(&json_mutex);
+        program_generation++;
+        pthread_mutex_unlock(&json_mutex);
+        return;
+    }
+
+    if(plugin_no < 0 || plugin_no >= ((dest == 0) ? pglobal->incnt : pglobal->outcnt))
+        return;
+
+    pthread_mutex_lock(&json_mutex);
+    if(dest == 0)
+        input_generation[plugin_no]++;
+    else
+        output_generation[plugin_no]++;
+    pthread_mutex_unlock(&json_mutex);
+}
+
+/******************************************************************************
+Description.: add or remove a plugin, a command sent to the program itself
+Input Value.: * command_id: one of PROGRAM_CMD_*
+              * plugin_no.: number of the plugin to remove
+              * spec......: the plugin to add and its parameters
+Return Value: number of an added plugin, 0 if one was removed, -1 on errors
+******************************************************************************/
+static int program_command(int command_id, int plugin_no, char *spec)
+{
+    int res = -1;
+
+    switch(command_id) {
+    case PROGRAM_CMD_ADD_INPUT:
+        res = plugin_add(Dest_Input, spec);
+        break;
+    case PROGRAM_CMD_ADD_OUTPUT:
+        res = plugin_add(Dest_Output, spec);
+        break;
+    case PROGRAM_CMD_REMOVE_INPUT:
+        if((res = plugin_remove(Dest_Input, plugin_no)) == 0)
+            invalidate_JSON(Dest_Input, plugin_no);
+        break;
+    case PROGRAM_CMD_REMOVE_OUTPUT:
+        if((res = plugin_remove(Dest_Output, plugin_no)) == 0)
+            invalidate_JSON(Dest_Output, plugin_no);
+        break;
+    default:
+        DBG("unknown program command: %d\n", command_id);
+        return -1;
+    }
+
+    invalidate_JSON(Dest_Program, 0);
+    return res;
+}
+
+/******************************************************************************
+Description.: set several V4L2 controls of an input given as id=...&value=...
+              pairs in one command, with a single IN_CMD_V4L2_BATCH command,
+              so the plugin can hand them to the device together. Inputs
+              which do not know that command get the controls one by one.
+Input Value.: * plugin_no: the input
+              * parameter: the parameters of the command
+              * flags....: COMMAND_WAIT to wait for the result
+              * res......: gets the result of the command
+Return Value: 0 if the command had more than one control and is done,
+              -1 if it is a command for a single control
+******************************************************************************/
+static int command_batch(int plugin_no, char *parameter, int flags, int *res)
+{
+    char batch[IN_CMD_BATCH_MAX * 24];
+    char *p = parameter, *next, *value;
+    int count = 0, len = 0, id, ivalue;
+
+    while((p = strstr(p, "id=")) != NULL && count < IN_CMD_BATCH_MAX) {
+        p += strlen("id=");
+        next = strstr(p, "id=");
+        value = strstr(p, "value=");
+        id = strtol(p, NULL, 10);
+        ivalue = (value != NULL && (next == NULL || value < next)) ?
+                 strtol(value + strlen("value="), NULL, 10) : 0;
+        len += snprintf(batch + len, sizeof(batch) - len, "%s%d=%d", count > 0 ? "&" : "", id, ivalue);
+        count++;
+    }
+    if(count < 2)
+        return -1;
+
+    *res = input_command(&pglobal->in[plugin_no], 0, IN_CMD_V4L2_BATCH, 0, batch, flags);
+    return 0;
+}
+
 /******************************************************************************
 Description.: Perform a command specified by parameter. Send response to fd.
 Input Value.: * fd.......: filedescriptor to send HTTP response to.
@@ -865,8 +2143,8 @@ Return Value: -
 void command(int id, int fd, char *parameter)
 {
     char buffer[BUFFER_SIZE] = {0};
-    char *command = NULL, *svalue = NULL, *value, *command_id_string;
-    int res = 0, ivalue = 0, command_id = -1,  len = 0;
+    char *command = NULL, *svalue = NULL, *value, *command_id_string, *wait;
+    int res = 0, ivalue = 0, command_id = -1,  len = 0, flags = COMMAND_WAIT;
 
     DBG("parameter is: %s\n", parameter);
 
@@ -885,6 +2163,18 @@ void command(int id, int fd, char *parameter)
         id: the control id
         group: the control's group eg. V4L2 control, jpg control, etc. This is optional
         value: value the control
+
+        several V4L2 controls of an input may be set together, each id
+        followed by its value, e.g. dest=0&group=1&id=9963776&value=128&id=9963777&value=32
+
+        the commands of an input are queued for it, the response comes
+        once they are done. With wait=0 it comes at once, telling only
+        whether the command was queued.
+
+        the program itself takes the PROGRAM_CMD_* commands, they remove the
+        plugin given with plugin, or add the one given with spec. spec must
+        be the last variable, it takes the rest of the line,
+        e.g. dest=2&id=1&spec=input_uvc.so%20-d%20/dev/video1
     */
 
     /* search for required variable "command" */
@@ -986,22 +2276,34 @@ void command(int id, int fd, char *parameter)
         value = NULL;
     }
 
+    if((wait = strstr(parameter, "wait=")) != NULL && strtol(wait + strlen("wait="), NULL, 10) == 0)
+        flags = 0;
+
     switch(dest) {
     case Dest_Input:
-        if(plugin_no < pglobal->incnt) {
-            res = pglobal->in[plugin_no].cmd(plugin_no, command_id, group, ivalue, value);
+        if(plugin_no >= 0 && plugin_no < pglobal->incnt &&
+           pglobal->in[plugin_no].handle != NULL && pglobal->in[plugin_no].cmd != NULL) {
+            /* the thread of the input sets the controls, this one does not wait for the device */
+            if(group != IN_CMD_V4L2 || command_batch(plugin_no, parameter, flags, &res) != 0)
+                res = input_command(&pglobal->in[plugin_no], command_id, group, ivalue, value, flags);
+            invalidate_JSON(0, plugin_no);
         } else {
             DBG("Invalid plugin number: %d because only %d input plugins loaded", plugin_no,  pglobal->incnt-1);
         }
         break;
     case Dest_Output:
-        if(plugin_no < pglobal->outcnt) {
+        if(plugin_no >= 0 && plugin_no < pglobal->outcnt &&
+           pglobal->out[plugin_no].handle != NULL && pglobal->out[plugin_no].cmd != NULL) {
             res = pglobal->out[plugin_no].cmd(plugin_no, command_id, group, ivalue, value);
+            invalidate_JSON(1, plugin_no);
         } else {
             DBG("Invalid plugin number: %d because only %d output plugins loaded", plugin_no,  pglobal->incnt-1);
         }
         break;
     case Dest_Program:
+        if((value = strstr(parameter, "spec=")) != NULL)
+            value += strlen("spec=");
+        res = program_command(command_id, plugin_no, value);
         break;
     default:
         fprintf(stderr, "Illegal command destination: %d\n", dest);
@@ -1022,6 +2324,100 @@ void command(int id, int fd, char *parameter)
     if(svalue != NULL) free(svalue);
 }
 
+/******************************************************************************
+Description.: Start a detached thread serving clients, with the small stack
+              of CLIENT_STACK_SIZE instead of the default one
+Input Value.: * function: the thread function
+              * arg.....: its argument
+Return Value: 0 if the thread runs, -1 otherwise
+******************************************************************************/
+int client_thread_start(void *(*function)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int err;
+
+    if(pthread_attr_init(&attr) != 0)
+        return -1;
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, CLIENT_STACK_SIZE);
+    err = pthread_create(&thread, &attr, function, arg);
+    pthread_attr_destroy(&attr);
+
+    return (err != 0) ? -1 : 0;
+}
+
+/* a stream which moves from a worker of the request pool to its own thread */
+typedef struct {
+    cfd lcfd;
+    int input_number;
+    answer_t type;
+} stream_job;
+
+/******************************************************************************
+Description.: Serve a stream in a thread of its own
+Input Value.: the stream_job, it is freed by this function
+Return Value: always NULL
+******************************************************************************/
+static void *stream_thread(void *arg)
+{
+    stream_job *job = arg;
+
+    switch(job->type) {
+    #ifdef WXP_COMPAT
+    case A_STREAM_WXP:
+        send_stream_wxp(&job->lcfd, job->input_number);
+        break;
+    #endif
+    case A_WEBSOCKET:
+        send_websocket(&job->lcfd, job->input_number);
+        break;
+    case A_REPLAY:
+        send_replay(&job->lcfd, job->input_number);
+        break;
+    default:
+        if(job->lcfd.input_count > 0)
+            send_stream_inputs(&job->lcfd);
+        else
+            send_stream(&job->lcfd, job->input_number);
+        break;
+    }
+
+    close_client(&job->lcfd);
+    free(job);
+
+    DBG("leaving HTTP stream thread\n");
+    return NULL;
+}
+
+/******************************************************************************
+Description.: Let a pool worker pass a stream on to a new thread, a stream
+              would occupy it for as long as the client watches
+Input Value.: * lcfd........: the connected client
+              * input_number: input plugin to stream from
+              * type........: A_STREAM, A_STREAM_WXP, A_WEBSOCKET or A_REPLAY
+Return Value: 0 if the new thread serves the stream, -1 otherwise
+******************************************************************************/
+static int stream_detach(cfd *lcfd, int input_number, answer_t type)
+{
+    stream_job *job;
+
+    if(!lcfd->pooled || (job = malloc(sizeof(stream_job))) == NULL)
+        return -1;
+
+    job->lcfd = *lcfd;
+    job->lcfd.pooled = 0;
+    job->input_number = input_number;
+    job->type = type;
+
+    if(client_thread_start(stream_thread, job) < 0) {
+        free(job);
+        return -1;
+    }
+
+    return 0;
+}
+
 /******************************************************************************
 Description.: Serve a connected TCP-client. This thread function is called
               for each connect of a HTTP client like a webbrowser. It determines
@@ -1035,13 +2431,14 @@ Return Value: always NULL
 /* thread for clients that connected to this server */
 void *client_thread(void *arg)
 {
-    int cnt;
-    char query_suffixed = 0;
-    int input_number = 0;
+    char query_suffixed;
+    int input_number;
     char buffer[BUFFER_SIZE] = {0}, *pb = buffer;
     iobuffer iobuf;
     request req;
     cfd lcfd; /* local-connected-file-descriptor */
+    int keep_alive;
+    int requests = 0;
 
     /* we really need the fildescriptor and it must be freeable by us */
     if(arg != NULL) {
@@ -1050,377 +2447,597 @@ void *client_thread(void *arg)
     } else
         return NULL;
 
-    /* initializes the structures */
-    init_iobuffer(&iobuf);
-    init_request(&req);
-
-    /* What does the client want to receive? Read the request. */
-    memset(buffer, 0, sizeof(buffer));
-    if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-        close(lcfd.fd);
+    #ifdef HTTPS
+    /* afterwards the socket is used like a plain one */
+    if(lcfd.pc->tls != NULL && tls_accept(&lcfd) < 0) {
+        close_client(&lcfd);
         return NULL;
     }
-
-    req.query_string = NULL;
-
-    /* determine what to deliver */
-    if(strstr(buffer, "GET /?action=snapshot") != NULL) {
-        req.type = A_SNAPSHOT;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #ifdef WXP_COMPAT
-    } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".jpg") != NULL)) {
-        req.type = A_SNAPSHOT_WXP;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #endif
-    } else if(strstr(buffer, "POST /stream") != NULL) {
-        req.type = A_STREAM;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    } else if(strstr(buffer, "GET /?action=stream") != NULL) {
-        req.type = A_STREAM;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #ifdef WXP_COMPAT
-    } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".mjpg") != NULL)) {
-        req.type = A_STREAM_WXP;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
     #endif
-    } else if(strstr(buffer, "GET /?action=take") != NULL) {
-        int len;
-        req.type = A_TAKE;
-        query_suffixed = 255;
-
-        /* advance by the length of known string */
-        if((pb = strstr(buffer, "GET /?action=take")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            query_suffixed = 0;
-            return NULL;
-        }
-        pb += strlen("GET /?action=take"); // a pb points to thestring after the first & after command
 
-        /* only accept certain characters */
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
-        }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+    /* the iobuffer keeps bytes of pipelined requests between the requests */
+    init_iobuffer(&iobuf);
 
-        if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
-            LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
+    /*
+     * serve requests until one of them or its answer needs the connection to
+     * be closed, an idle client gets closed by the timeout of http_read_header()
+     */
+    do {
+        /* initializes the structures */
+        init_request(&req);
+        query_suffixed = 0;
+        input_number = 0;
+        keep_alive = -1;
+
+        /* What does the client want to receive? Read the request. */
+        if(http_read_header(lcfd.fd, &iobuf, 5) < 0) {
+            close_client(&lcfd);
             return NULL;
         }
-    } else if((strstr(buffer, "GET /input") != NULL) && (strstr(buffer, ".json") != NULL)) {
-        req.type = A_INPUT_JSON;
-        query_suffixed = 255;
-    } else if((strstr(buffer, "GET /output") != NULL) && (strstr(buffer, ".json") != NULL)) {
-        req.type = A_OUTPUT_JSON;
-        query_suffixed = 255;
-    } else if(strstr(buffer, "GET /program.json") != NULL) {
-        req.type = A_PROGRAM_JSON;
-    #ifdef MANAGMENT
-    } else if(strstr(buffer, "GET /clients.json") != NULL) {
-        req.type = A_CLIENTS_JSON;
-    #endif
-    } else if(strstr(buffer, "GET /?action=command") != NULL) {
-        int len;
-        req.type = A_COMMAND;
-
-        /* advance by the length of known string */
-        if((pb = strstr(buffer, "GET /?action=command")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
+
+        /* the first request was paid for when the connection was accepted */
+        if(requests++ > 0 && admit_request(&lcfd) < 0) {
+            DBG("too many requests, closing a persistent connection\n");
+            send_error(lcfd.fd, 503, "too many requests from this address");
+            close_client(&lcfd);
             return NULL;
         }
-        pb += strlen("GET /?action=command"); // a pb points to thestring after the first & after command
+        http_header_line(&iobuf, buffer, sizeof(buffer) - 1);
 
-        /* only accept certain characters */
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
+        req.query_string = NULL;
 
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
-        }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+        /* HTTP/1.1 connections are persistent unless the client objects */
+        req.keep_alive = (strstr(buffer, " HTTP/1.1") != NULL);
 
-        if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
-            LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
-            return NULL;
-        }
+        /* determine what to deliver */
+        if(strstr(buffer, "GET /?action=snapshot") != NULL) {
+            req.type = A_SNAPSHOT;
+            query_suffixed = 255;
+            req.nowait = (strstr(buffer, "&wait=0") != NULL);
+            #ifdef MANAGMENT
+            if (check_client_status(lcfd.client)) {
+                req.type = A_UNKNOWN;
+                delay_client(lcfd.client);
+                send_error(lcfd.fd, 403, "frame already sent");
+                query_suffixed = 0;
+            }
+            #endif
+        #ifdef WXP_COMPAT
+        } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".jpg") != NULL)) {
+            req.type = A_SNAPSHOT_WXP;
+            query_suffixed = 255;
+            #ifdef MANAGMENT
+            if (check_client_status(lcfd.client)) {
+                req.type = A_UNKNOWN;
+                delay_client(lcfd.client);
+                send_error(lcfd.fd, 403, "frame already sent");
+                query_suffixed = 0;
+            }
+            #endif
+        #endif
+        } else if(strstr(buffer, "POST /stream") != NULL) {
+            req.type = A_STREAM;
+            query_suffixed = 255;
+            #ifdef MANAGMENT
+            if (check_client_status(lcfd.client)) {
+                req.type = A_UNKNOWN;
+                delay_client(lcfd.client);
+                send_error(lcfd.fd, 403, "frame already sent");
+                query_suffixed = 0;
+            }
+            #endif
+        } else if((pb = strstr(buffer, "GET /?action=recorded")) != NULL) {
+            int len;
+            req.type = A_RECORDED;
+
+            /* the time is the only parameter */
+            pb += strlen("GET /?action=recorded");
+            len = MIN(MAX(strspn(pb, "&t=1234567890."), 0), 100);
+            req.parameter = malloc(len + 1);
+            if(req.parameter == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            memset(req.parameter, 0, len + 1);
+            strncpy(req.parameter, pb, len);
+        } else if((pb = strstr(buffer, "GET /?action=replay")) != NULL ||
+                  (pb = strstr(buffer, "GET /?action=clip")) != NULL ||
+                  (pb = strstr(buffer, "GET /?action=frame")) != NULL) {
+            int len;
+            pb += strlen("GET /?action=");
+            req.type = (*pb == 'r') ? A_REPLAY : (*pb == 'c') ? A_CLIP : A_FRAME;
+            query_suffixed = 255;
+
+            /* seconds, fast, format and seq are all there is to them */
+            pb += strcspn(pb, "_&? ");
+            len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyz_=&1234567890"), 0), 100);
+            req.parameter = malloc(len + 1);
+            if(req.parameter == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            memset(req.parameter, 0, len + 1);
+            strncpy(req.parameter, pb, len);
+        } else if(strstr(buffer, "GET /?action=ws") != NULL) {
+            req.type = A_WEBSOCKET;
+            query_suffixed = 255;
+        } else if(strstr(buffer, "GET /?action=stream") != NULL) {
+            req.type = A_STREAM;
+            query_suffixed = 255;
+            #ifdef MANAGMENT
+            if (check_client_status(lcfd.client)) {
+                req.type = A_UNKNOWN;
+                delay_client(lcfd.client);
+                send_error(lcfd.fd, 403, "frame already sent");
+                query_suffixed = 0;
+            }
+            #endif
+        #ifdef WXP_COMPAT
+        } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".mjpg") != NULL)) {
+            req.type = A_STREAM_WXP;
+            query_suffixed = 255;
+            #ifdef MANAGMENT
+            if (check_client_status(lcfd.client)) {
+                req.type = A_UNKNOWN;
+                delay_client(lcfd.client);
+                send_error(lcfd.fd, 403, "frame already sent");
+                query_suffixed = 0;
+            }
+            #endif
+        #endif
+        } else if(strstr(buffer, "GET /?action=take") != NULL) {
+            int len;
+            req.type = A_TAKE;
+            query_suffixed = 255;
+
+            /* advance by the length of known string */
+            if((pb = strstr(buffer, "GET /?action=take")) == NULL) {
+                DBG("HTTP request seems to be malformed\n");
+                send_error(lcfd.fd, 400, "Malformed HTTP request");
+                close_client(&lcfd);
+                query_suffixed = 0;
+                return NULL;
+            }
+            pb += strlen("GET /?action=take"); // a pb points to thestring after the first & after command
 
-        DBG("command parameter (len: %d): \"%s\"\n", len, req.parameter);
-    } else {
-        int len;
+            /* only accept certain characters */
+            len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
+            req.parameter = malloc(len + 1);
+            if(req.parameter == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            memset(req.parameter, 0, len + 1);
+            strncpy(req.parameter, pb, len);
+
+            if(unescape(req.parameter) == -1) {
+                free(req.parameter);
+                send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
+                LOG("could not properly unescape command parameter string\n");
+                close_client(&lcfd);
+                return NULL;
+            }
+        } else if((strstr(buffer, "GET /input") != NULL) && (strstr(buffer, ".json") != NULL)) {
+            req.type = A_INPUT_JSON;
+            query_suffixed = 255;
+        } else if((strstr(buffer, "GET /output") != NULL) && (strstr(buffer, ".json") != NULL)) {
+            req.type = A_OUTPUT_JSON;
+            query_suffixed = 255;
+        } else if(strstr(buffer, "GET /program.json") != NULL) {
+            req.type = A_PROGRAM_JSON;
+        } else if((strstr(buffer, "GET /motion") != NULL) && (strstr(buffer, ".json") != NULL)) {
+            req.type = A_MOTION_JSON;
+            query_suffixed = 255;
+        } else if(strstr(buffer, "GET /metrics") != NULL || strstr(buffer, "GET /?action=metrics") != NULL) {
+            req.type = A_METRICS;
+        } else if(strstr(buffer, "GET /trace") != NULL || strstr(buffer, "GET /?action=trace") != NULL) {
+            req.type = A_TRACE;
+        } else if((pb = strstr(buffer, "GET /hls/")) != NULL || (pb = strstr(buffer, "GET /hls_")) != NULL) {
+            int len;
+            req.type = A_HLS;
+            query_suffixed = 255;
+
+            /* the file in the folder of the input, with the query of LL-HLS */
+            pb += strlen("GET /hls");
+            pb += strspn(pb, "_1234567890");
+            pb += (*pb == '/');
+            len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&?.1234567890"), 0), 100);
+            req.parameter = malloc(len + 1);
+            if(req.parameter == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            memset(req.parameter, 0, len + 1);
+            strncpy(req.parameter, pb, len);
+        #ifdef MANAGMENT
+        } else if(strstr(buffer, "GET /clients.json") != NULL) {
+            req.type = A_CLIENTS_JSON;
+        #endif
+        } else if(strstr(buffer, "GET /?action=command") != NULL) {
+            int len;
+            req.type = A_COMMAND;
+
+            /* advance by the length of known string */
+            if((pb = strstr(buffer, "GET /?action=command")) == NULL) {
+                DBG("HTTP request seems to be malformed\n");
+                send_error(lcfd.fd, 400, "Malformed HTTP request");
+                close_client(&lcfd);
+                return NULL;
+            }
+            pb += strlen("GET /?action=command"); // a pb points to thestring after the first & after command
 
-        DBG("try to serve a file\n");
-        req.type = A_FILE;
+            /* only accept certain characters, the parameters of a plugin to add take more */
+            len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 255);
 
-        if((pb = strstr(buffer, "GET /")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
-        }
+            req.parameter = malloc(len + 1);
+            if(req.parameter == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            memset(req.parameter, 0, len + 1);
+            strncpy(req.parameter, pb, len);
+
+            if(unescape(req.parameter) == -1) {
+                free(req.parameter);
+                send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
+                LOG("could not properly unescape command parameter string\n");
+                close_client(&lcfd);
+                return NULL;
+            }
 
-        pb += strlen("GET /");
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890"), 0), 100);
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
-        }
+            DBG("command parameter (len: %d): \"%s\"\n", len, req.parameter);
+        } else {
+            int len;
 
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+            DBG("try to serve a file\n");
+            req.type = A_FILE;
 
-        if (strstr(pb, ".cgi") != NULL) {
-            req.type = A_CGI;
-            pb = strchr(pb, '?');
-            if (pb != NULL) {
-                pb++; // skip the ?
-                len = strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890=&");
-                req.query_string = malloc(len + 1);
-                if (req.query_string == NULL)
-                    exit(EXIT_FAILURE);
-                memset(req.query_string, 0, len + 1);
-                strncpy(req.query_string, pb, len);
-            } else {
-                req.query_string = malloc(2);
-                if (req.query_string == NULL)
-                    exit(EXIT_FAILURE);
-                sprintf(req.query_string, " ");
+            if((pb = strstr(buffer, "GET /")) == NULL) {
+                DBG("HTTP request seems to be malformed\n");
+                send_error(lcfd.fd, 400, "Malformed HTTP request");
+                close_client(&lcfd);
+                return NULL;
+            }
+
+            pb += strlen("GET /");
+            len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890"), 0), 100);
+            req.parameter = malloc(len + 1);
+            if(req.parameter == NULL) {
+                exit(EXIT_FAILURE);
+            }
+
+            memset(req.parameter, 0, len + 1);
+            strncpy(req.parameter, pb, len);
+
+            if (strstr(pb, ".cgi") != NULL) {
+                req.type = A_CGI;
+                pb = strchr(pb, '?');
+                if (pb != NULL) {
+                    pb++; // skip the ?
+                    len = strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890=&");
+                    req.query_string = malloc(len + 1);
+                    if (req.query_string == NULL)
+                        exit(EXIT_FAILURE);
+                    memset(req.query_string, 0, len + 1);
+                    strncpy(req.query_string, pb, len);
+                } else {
+                    req.query_string = malloc(2);
+                    if (req.query_string == NULL)
+                        exit(EXIT_FAILURE);
+                    sprintf(req.query_string, " ");
+                }
             }
+            DBG("parameter (len: %d): \"%s\"\n", len, req.parameter);
         }
-        DBG("parameter (len: %d): \"%s\"\n", len, req.parameter);
-    }
 
-    /*
-     * Since when we are working with multiple input plugins
-     * there are some url which could have a _[plugin number suffix]
-     * For compatibility reasons it could be left in that case the output will be
-     * generated from the 0. input plugin
-     */
-    if(query_suffixed) {
-        char *sch = strchr(buffer, '_');
-        if(sch != NULL) {  // there is an _ in the url so the input number should be present
-            DBG("Suffix character: %s\n", sch + 1); // FIXME if more than 10 input plugin is added
-            char numStr[3];
-            memset(numStr, 0, 3);
-            strncpy(numStr, sch + 1, 1);
-            input_number = atoi(numStr);
-
-            if ((req.type == A_SNAPSHOT_WXP) || (req.type == A_STREAM_WXP)) { // webcamxp adds offset to the camera number
-                input_number--;
+        /*
+         * Since when we are working with multiple input plugins
+         * there are some url which could have a _[plugin number suffix]
+         * For compatibility reasons it could be left in that case the output will be
+         * generated from the 0. input plugin
+         */
+        if(query_suffixed) {
+            char *sch = strchr(buffer, '_');
+            if(sch != NULL) {  // there is an _ in the url so the input number should be present
+                DBG("Suffix character: %s\n", sch + 1);
+                input_number = strtol(sch + 1, NULL, 10);
+
+                if ((req.type == A_SNAPSHOT_WXP) || (req.type == A_STREAM_WXP)) { // webcamxp adds offset to the camera number
+                    input_number--;
+                }
             }
+            DBG("plugin_no: %d\n", input_number);
         }
-        DBG("plugin_no: %d\n", input_number);
-    }
 
-    /*
-     * parse the rest of the HTTP-request
-     * the end of the request-header is marked by a single, empty line with "\r\n"
-     */
-    do {
-        memset(buffer, 0, sizeof(buffer));
+        /* clients may ask for a lower frame rate than the input delivers */
+        memset(&lcfd.throttle, 0, sizeof(lcfd.throttle));
+        lcfd.scale = 1;
+        lcfd.quality = 0;
+        memset(&lcfd.crop, 0, sizeof(lcfd.crop));
+        lcfd.input_count = 0;
+        lcfd.replay_sec = 0;
+        lcfd.replay_fast = 0;
+        lcfd.tables = 0;
+        adapt_init(&lcfd.adapt, 0, 0);
+        if(req.type == A_TRACE)
+            lcfd.replay_sec = query_parameter(buffer, "seconds=");
+        if(req.type == A_REPLAY) {
+            lcfd.replay_sec = query_parameter(buffer, "seconds=");
+            lcfd.replay_fast = (query_parameter(buffer, "fast=") > 0);
+        }
+        if(req.type == A_STREAM || req.type == A_STREAM_WXP || req.type == A_WEBSOCKET) {
+            lcfd.throttle.fps = query_parameter(buffer, "fps=");
+            lcfd.throttle.every = query_parameter(buffer, "every=");
+            lcfd.tables = (query_parameter(buffer, "tables=") > 0);
+            DBG("stream limited to %d fps, every %d. frame\n", lcfd.throttle.fps, lcfd.throttle.every);
+
+            if((lcfd.scale = scale_parameter(buffer)) < 0) {
+                send_error(lcfd.fd, 400, "scale must be 1/2, 1/4 or 1/8");
+                req.type = A_UNKNOWN;
+            } else if(crop_parameter(buffer, &lcfd.crop) < 0) {
+                send_error(lcfd.fd, 400, "crop must be x,y,width,height");
+                req.type = A_UNKNOWN;
+            } else if(lcfd.crop.w > 0 && lcfd.scale != 1) {
+                send_error(lcfd.fd, 400, "crop and scale can not be combined");
+                req.type = A_UNKNOWN;
+            } else if((lcfd.quality = quality_parameter(buffer)) < 0) {
+                send_error(lcfd.fd, 400, "q must be low, mid or high");
+                req.type = A_UNKNOWN;
+            } else if(lcfd.quality > 0 && (lcfd.scale != 1 || lcfd.crop.w > 0)) {
+                send_error(lcfd.fd, 400, "q can not be combined with scale or crop");
+                req.type = A_UNKNOWN;
+            } else if(req.type == A_STREAM && (lcfd.input_count = inputs_parameter(buffer, lcfd.inputs)) < 0) {
+                send_error(lcfd.fd, 400, "inputs must be a list of different input numbers");
+                lcfd.input_count = 0;
+                req.type = A_UNKNOWN;
+            }
 
-        if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-            free_request(&req);
-            close(lcfd.fd);
-            return NULL;
+            /* a stream which did not ask for a variant of its own may follow its link */
+            if((lcfd.pc->conf.adaptive || query_parameter(buffer, "adapt=") > 0) &&
+               lcfd.scale == 1 && lcfd.quality == 0 && lcfd.crop.w == 0 && lcfd.input_count == 0)
+                adapt_init(&lcfd.adapt, 1, lcfd.throttle.every);
+        }
+
+        /*
+         * parse the rest of the HTTP-request, the header is complete in the
+         * iobuffer already and ends with a single, empty line
+         */
+        while(http_header_line(&iobuf, buffer, sizeof(buffer) - 1) > 0) {
+            if(strcasestr(buffer, "User-Agent: ") != NULL) {
+                req.client = strdup(buffer + strlen("User-Agent: "));
+            } else if(strcasestr(buffer, "Authorization: Basic ") != NULL) {
+                req.credentials = strdup(buffer + strlen("Authorization: Basic "));
+                decodeBase64(req.credentials);
+                DBG("username:password: %s\n", req.credentials);
+            } else if(strcasestr(buffer, "If-None-Match: ") != NULL && req.if_none_match == NULL) {
+                req.if_none_match = strdup(buffer + strlen("If-None-Match: "));
+            } else if(strcasestr(buffer, "Sec-WebSocket-Key: ") != NULL && req.ws_key == NULL) {
+                req.ws_key = strdup(buffer + strlen("Sec-WebSocket-Key: "));
+            } else if(strcasestr(buffer, "Accept-Encoding: ") != NULL) {
+                req.accept_gzip = (strstr(buffer, "gzip") != NULL);
+            } else if(strcasestr(buffer, "Connection: ") != NULL) {
+                if(strcasestr(buffer, "close") != NULL)
+                    req.keep_alive = 0;
+                else if(strcasestr(buffer, "keep-alive") != NULL)
+                    req.keep_alive = 1;
+            }
         }
-
-        if(strcasestr(buffer, "User-Agent: ") != NULL) {
-            req.client = strdup(buffer + strlen("User-Agent: "));
-        } else if(strcasestr(buffer, "Authorization: Basic ") != NULL) {
-            req.credentials = strdup(buffer + strlen("Authorization: Basic "));
-            decodeBase64(req.credentials);
-            DBG("username:password: %s\n", req.credentials);
+        http_header_done(&iobuf);
+
+        /* check for username and password if parameter -c was given */
+        if(lcfd.pc->conf.credentials != NULL) {
+            if(req.credentials == NULL || strcmp(lcfd.pc->conf.credentials, req.credentials) != 0) {
+                DBG("access denied\n");
+                send_error(lcfd.fd, 401, "username and password do not match to configuration");
+                close_client(&lcfd);
+                free_request(&req);
+                return NULL;
+            }
+            DBG("access granted\n");
         }
 
-    } while(cnt > 2 && !(buffer[0] == '\r' && buffer[1] == '\n'));
+        /* now it's time to answer */
+        if (query_suffixed) {
+            if (req.type == A_OUTPUT_JSON) {
+                if(input_number < 0 || input_number >= pglobal->outcnt) {
+                    DBG("Output number: %d out of range (valid: 0..%d)\n", input_number, pglobal->outcnt-1);
+                    send_error(lcfd.fd, 404, "Invalid output plugin number");
+                    req.type = A_UNKNOWN;
+                }
+            } else {
+                if(input_number < 0 || input_number >= pglobal->incnt) {
+                    DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, pglobal->incnt-1);
+                    send_error(lcfd.fd, 404, "Invalid input plugin number");
+                    req.type = A_UNKNOWN;
+                }
+            }
+        }
 
-    /* check for username and password if parameter -c was given */
-    if(lcfd.pc->conf.credentials != NULL) {
-        if(req.credentials == NULL || strcmp(lcfd.pc->conf.credentials, req.credentials) != 0) {
-            DBG("access denied\n");
-            send_error(lcfd.fd, 401, "username and password do not match to configuration");
-            close(lcfd.fd);
-            free_request(&req);
-            return NULL;
+        /* the stream limit, before a thread or an event loop takes the stream */
+        if((req.type == A_STREAM || req.type == A_STREAM_WXP || req.type == A_WEBSOCKET ||
+            req.type == A_REPLAY) && admit_stream(&lcfd) < 0) {
+            DBG("stream limit reached\n");
+            send_error(lcfd.fd, 503, "the server serves as many streams as it may");
+            req.type = A_UNKNOWN;
         }
-        DBG("access granted\n");
-    }
 
-    /* now it's time to answer */
-    if (query_suffixed) {
-        if (req.type == A_OUTPUT_JSON) {
-            if(!(input_number < pglobal->outcnt)) {
-                DBG("Output number: %d out of range (valid: 0..%d)\n", input_number, pglobal->outcnt-1);
-                send_error(lcfd.fd, 404, "Invalid output plugin number");
-                req.type = A_UNKNOWN;
+        switch(req.type) {
+        case A_SNAPSHOT_WXP:
+        case A_SNAPSHOT:
+            DBG("Request for snapshot from input: %d\n", input_number);
+            keep_alive = send_snapshot(&lcfd, input_number, req.keep_alive, req.if_none_match, req.nowait);
+            break;
+        case A_STREAM:
+            if(lcfd.input_count > 0) {
+                DBG("Request for a stream of %d inputs\n", lcfd.input_count);
+                if(stream_detach(&lcfd, input_number, A_STREAM) == 0) {
+                    free_request(&req);
+                    return NULL;
+                }
+                send_stream_inputs(&lcfd);
+                break;
             }
-        } else {
-            if(!(input_number < pglobal->incnt)) {
-                DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, pglobal->incnt-1);
-                send_error(lcfd.fd, 404, "Invalid input plugin number");
-                req.type = A_UNKNOWN;
+            DBG("Request for stream from input: %d\n", input_number);
+            if(event_loop_add_stream(&lcfd, input_number, 0) == 0 ||
+               stream_detach(&lcfd, input_number, A_STREAM) == 0) {
+                /* the event loop or the stream thread owns the socket now */
+                free_request(&req);
+                return NULL;
             }
-        }
-    }
-
-    switch(req.type) {
-    case A_SNAPSHOT_WXP:
-    case A_SNAPSHOT:
-        DBG("Request for snapshot from input: %d\n", input_number);
-        send_snapshot(&lcfd, input_number);
-        break;
-    case A_STREAM:
-        DBG("Request for stream from input: %d\n", input_number);
-        send_stream(&lcfd, input_number);
-        break;
-    #ifdef WXP_COMPAT
-    case A_STREAM_WXP:
-        DBG("Request for WXP compat stream from input: %d\n", input_number);
-        send_stream_wxp(&lcfd, input_number);
-        break;
-    #endif
-    case A_COMMAND:
-        if(lcfd.pc->conf.nocommands) {
-            send_error(lcfd.fd, 501, "this server is configured to not accept commands");
+            send_stream(&lcfd, input_number);
             break;
-        }
-        command(lcfd.pc->id, lcfd.fd, req.parameter);
-        break;
-    case A_INPUT_JSON:
-        DBG("Request for the Input plugin descriptor JSON file\n");
-        send_input_JSON(lcfd.fd, input_number);
-        break;
-    case A_OUTPUT_JSON:
-        DBG("Request for the Output plugin descriptor JSON file\n");
-        send_output_JSON(lcfd.fd, input_number);
-        break;
-    case A_PROGRAM_JSON:
-        DBG("Request for the program descriptor JSON file\n");
-        send_program_JSON(lcfd.fd);
-        break;
-    #ifdef MANAGMENT
-    case A_CLIENTS_JSON:
-        DBG("Request for the clients JSON file\n");
-        send_clients_JSON(lcfd.fd);
-        break;
-    #endif
-    case A_FILE:
-        if(lcfd.pc->conf.www_folder == NULL)
-            send_error(lcfd.fd, 501, "no www-folder configured");
-        else
-            send_file(lcfd.pc->id, lcfd.fd, req.parameter);
-        break;
-    /*
-        With the take argument we try to save the current image to file before we transmit it to the user.
-        This is done trough the output_file plugin.
-        If it not loaded, or the file could not be saved then we won't transmit the frame.
-    */
-    case A_TAKE: {
-        int i, ret = 0, found = 0;
-        for (i = 0; i<pglobal->outcnt; i++) {
-            if (pglobal->out[i].name != NULL) {
-                if (strstr(pglobal->out[i].name, "FILE output plugin")) {
-                    found = 255;
-                    DBG("output_file found id: %d\n", i);
-                    char *filename = NULL;
-                    char *filenamearg = NULL;
-                    int len = 0;
-                    DBG("Buffer: %s \n", req.parameter);
-                    if((filename = strstr(req.parameter, "filename=")) != NULL) {
-                        filename += strlen("filename=");
-                        char *fn = strchr(filename, '&');
-                        if (fn == NULL)
-                            len = strlen(filename);
-                        else
-                            len = (int)(fn - filename);
-                        filenamearg = (char*)calloc(len, sizeof(char));
-                        memcpy(filenamearg, filename, len);
-                        DBG("Filename = %s\n", filenamearg);
-                        //int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int value, char *valueStr)
-                        ret = pglobal->out[i].cmd(i, OUT_FILE_CMD_TAKE, IN_CMD_GENERIC, 0, filenamearg);
-                    } else {
-                        DBG("filename is not specified int the URL\n");
-                        send_error(lcfd.fd, 404, "The &filename= must present for the take command in the URL");
+        #ifdef WXP_COMPAT
+        case A_STREAM_WXP:
+            DBG("Request for WXP compat stream from input: %d\n", input_number);
+            if(event_loop_add_stream(&lcfd, input_number, 1) == 0 ||
+               stream_detach(&lcfd, input_number, A_STREAM_WXP) == 0) {
+                free_request(&req);
+                return NULL;
+            }
+            send_stream_wxp(&lcfd, input_number);
+            break;
+        #endif
+        case A_WEBSOCKET:
+            DBG("Request for WebSocket stream from input: %d\n", input_number);
+            if(req.ws_key == NULL) {
+                send_error(lcfd.fd, 400, "WebSocket handshake expected");
+                break;
+            }
+            if(websocket_accept(lcfd.fd, req.ws_key) < 0)
+                break;
+            if(stream_detach(&lcfd, input_number, A_WEBSOCKET) == 0) {
+                free_request(&req);
+                return NULL;
+            }
+            send_websocket(&lcfd, input_number);
+            break;
+        case A_COMMAND:
+            if(lcfd.pc->conf.nocommands) {
+                send_error(lcfd.fd, 501, "this server is configured to not accept commands");
+                break;
+            }
+            command(lcfd.pc->id, lcfd.fd, req.parameter);
+            break;
+        case A_INPUT_JSON:
+            DBG("Request for the Input plugin descriptor JSON file\n");
+            keep_alive = send_input_JSON(lcfd.fd, input_number, req.keep_alive);
+            break;
+        case A_OUTPUT_JSON:
+            DBG("Request for the Output plugin descriptor JSON file\n");
+            keep_alive = send_output_JSON(lcfd.fd, input_number, req.keep_alive);
+            break;
+        case A_PROGRAM_JSON:
+            DBG("Request for the program descriptor JSON file\n");
+            keep_alive = send_program_JSON(lcfd.fd, req.keep_alive);
+            break;
+        case A_MOTION_JSON:
+            DBG("Request for the motion of input %d\n", input_number);
+            keep_alive = send_motion_JSON(lcfd.fd, input_number, req.keep_alive);
+            break;
+        case A_RECORDED:
+            DBG("Request for a recorded picture\n");
+            keep_alive = send_recorded(lcfd.pc->id, lcfd.fd, req.parameter, req.keep_alive);
+            break;
+        case A_HLS:
+            DBG("Request for %s of the live stream of input %d\n", req.parameter, input_number);
+            keep_alive = send_hls(&lcfd, input_number, req.parameter, req.keep_alive);
+            break;
+        case A_REPLAY:
+            DBG("Request for a replay of the last %d s of input %d\n", lcfd.replay_sec, input_number);
+            if(stream_detach(&lcfd, input_number, A_REPLAY) == 0) {
+                free_request(&req);
+                return NULL;
+            }
+            send_replay(&lcfd, input_number);
+            break;
+        case A_CLIP:
+            DBG("Request for a clip of input %d\n", input_number);
+            keep_alive = send_clip(&lcfd, input_number, req.parameter, req.keep_alive);
+            break;
+        case A_FRAME:
+            DBG("Request for a kept frame of input %d\n", input_number);
+            keep_alive = send_replay_frame(&lcfd, input_number, req.parameter, req.keep_alive);
+            break;
+        case A_METRICS:
+            DBG("Request for the metrics\n");
+            keep_alive = send_metrics(lcfd.fd, req.keep_alive);
+            break;
+        case A_TRACE:
+            DBG("Request for the last %d s of the flight recorder\n", lcfd.replay_sec);
+            keep_alive = send_trace(lcfd.fd, req.keep_alive, lcfd.replay_sec);
+            break;
+        #ifdef MANAGMENT
+        case A_CLIENTS_JSON:
+            DBG("Request for the clients JSON file\n");
+            keep_alive = send_clients_JSON(lcfd.fd, req.keep_alive);
+            break;
+        #endif
+        case A_FILE:
+            if(lcfd.pc->conf.www_folder == NULL)
+                send_error(lcfd.fd, 501, "no www-folder configured");
+            else if(www_cache_send(lcfd.pc, lcfd.fd, &req) == 0)
+                keep_alive = req.keep_alive ? 0 : -1;
+            else
+                keep_alive = send_file(lcfd.pc->id, lcfd.fd, req.parameter, req.keep_alive);
+            break;
+        /*
+            With the take argument we try to save the current image to file before we transmit it to the user.
+            This is done trough the output_file plugin.
+            If it not loaded, or the file could not be saved then we won't transmit the frame.
+        */
+        case A_TAKE: {
+            int i, ret = 0, found = 0;
+            for (i = 0; i<pglobal->outcnt; i++) {
+                if (pglobal->out[i].name != NULL && pglobal->out[i].handle != NULL) {
+                    if (strstr(pglobal->out[i].name, "FILE output plugin")) {
+                        found = 255;
+                        DBG("output_file found id: %d\n", i);
+                        char *filename = NULL;
+                        char *filenamearg = NULL;
+                        int len = 0;
+                        DBG("Buffer: %s \n", req.parameter);
+                        if((filename = strstr(req.parameter, "filename=")) != NULL) {
+                            filename += strlen("filename=");
+                            char *fn = strchr(filename, '&');
+                            if (fn == NULL)
+                                len = strlen(filename);
+                            else
+                                len = (int)(fn - filename);
+                            filenamearg = (char*)calloc(len, sizeof(char));
+                            memcpy(filenamearg, filename, len);
+                            DBG("Filename = %s\n", filenamearg);
+                            //int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int value, char *valueStr)
+                            ret = pglobal->out[i].cmd(i, OUT_FILE_CMD_TAKE, IN_CMD_GENERIC, 0, filenamearg);
+                        } else {
+                            DBG("filename is not specified int the URL\n");
+                            send_error(lcfd.fd, 404, "The &filename= must present for the take command in the URL");
+                        }
+                        break;
                     }
-                    break;
                 }
             }
-        }
 
-        if (found == 0) {
-            LOG("FILE CHANGE TEST output plugin not loaded\n");
-            send_error(lcfd.fd, 404, "FILE output plugin not loaded, taking snapshot not possible");
-        } else {
-            if (ret == 0) {
-                send_snapshot(&lcfd, input_number);
+            if (found == 0) {
+                LOG("FILE CHANGE TEST output plugin not loaded\n");
+                send_error(lcfd.fd, 404, "FILE output plugin not loaded, taking snapshot not possible");
             } else {
-                send_error(lcfd.fd, 404, "Taking snapshot failed!");
+                if (ret == 0) {
+                    send_snapshot(&lcfd, input_number, 0, NULL, 0);
+                } else {
+                    send_error(lcfd.fd, 404, "Taking snapshot failed!");
+                }
             }
+            } break;
+        case A_CGI:
+            DBG("cgi script: %s requested\n", req.parameter);
+            if(lcfd.pc->fcgi != NULL)
+                fcgi_execute(lcfd.pc, lcfd.fd, req.parameter, req.query_string);
+            else
+                execute_cgi(lcfd.pc->id, lcfd.fd, req.parameter, req.query_string);
+            break;
+        default:
+            DBG("unknown request\n");
         }
-        } break;
-    case A_CGI:
-        DBG("cgi script: %s requested\n", req.parameter);
-        execute_cgi(lcfd.pc->id, lcfd.fd, req.parameter, req.query_string);
-        break;
-    default:
-        DBG("unknown request\n");
-    }
 
-    close(lcfd.fd);
-    free_request(&req);
+        free_request(&req);
+    } while(keep_alive == 0);
+
+    close_client(&lcfd);
 
     DBG("leaving HTTP client thread\n");
     return NULL;
@@ -1440,62 +3057,26 @@ void server_cleanup(void *arg)
 
     for(i = 0; i < MAX_SD_LEN; i++)
         close(pcontext->sd[i]);
+
+    fcgi_pool_stop(pcontext);
 }
 
 /******************************************************************************
-Description.: Open a TCP socket and wait for clients to connect. If clients
-              connect, start a new thread for each accepted connection.
-Input Value.: arg is a pointer to the globals struct
-Return Value: always NULL, will only return on exit
+Description.: Open a listening TCP socket for each address family
+Input Value.: * pcontext.: the server context, the sockets are appended to sd[]
+              * aip......: the addresses to listen on
+              * reuseport: nonzero to share the port with further listeners
+Return Value: number of sockets opened
 ******************************************************************************/
-void *server_thread(void *arg)
+static int open_listeners(context *pcontext, struct addrinfo *aip, int reuseport)
 {
-    int on;
-    pthread_t client;
-    struct addrinfo *aip, *aip2;
-    struct addrinfo hints;
-    struct sockaddr_storage client_addr;
-    socklen_t addr_len = sizeof(struct sockaddr_storage);
-    fd_set selectfds;
-    int max_fds = 0;
-    char name[NI_MAXHOST];
-    int err;
-    int i;
-
-    context *pcontext = arg;
-    pglobal = pcontext->pglobal;
-
-    /* set cleanup handler to cleanup resources */
-    pthread_cleanup_push(server_cleanup, pcontext);
-
-    bzero(&hints, sizeof(hints));
-    hints.ai_family = PF_UNSPEC;
-    hints.ai_flags = AI_PASSIVE;
-    hints.ai_socktype = SOCK_STREAM;
-
-    snprintf(name, sizeof(name), "%d", ntohs(pcontext->conf.port));
-    if((err = getaddrinfo(pcontext->conf.hostname, name, &hints, &aip)) != 0) {
-        perror(gai_strerror(err));
-        exit(EXIT_FAILURE);
-    }
-
-    for(i = 0; i < MAX_SD_LEN; i++)
-        pcontext->sd[i] = -1;
-
-    #ifdef MANAGMENT
-    if (pthread_mutex_init(&client_infos.mutex, NULL)) {
-        perror("Mutex initialization failed");
-        exit(EXIT_FAILURE);
-    }
-
-    client_infos.client_count = 0;
-    client_infos.infos = NULL;
-    #endif
+    struct addrinfo *aip2;
+    int on, i = pcontext->sd_len;
 
     /* open sockets for server (1 socket / address family) */
-    i = 0;
-    for(aip2 = aip; aip2 != NULL; aip2 = aip2->ai_next) {
+    for(aip2 = aip; aip2 != NULL && i < MAX_SD_LEN; aip2 = aip2->ai_next) {
         if((pcontext->sd[i] = socket(aip2->ai_family, aip2->ai_socktype, 0)) < 0) {
+            pcontext->sd[i] = -1;
             continue;
         }
 
@@ -1505,6 +3086,11 @@ void *server_thread(void *arg)
             perror("setsockopt(SO_REUSEADDR) failed\n");
         }
 
+        /* the kernel spreads the connections across all sockets of the port */
+        if(reuseport && setsockopt(pcontext->sd[i], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            perror("setsockopt(SO_REUSEPORT) failed\n");
+        }
+
         /* IPv6 socket should listen to IPv6 only, otherwise we will get "socket already in use" */
         on = 1;
         if(aip2->ai_family == AF_INET6 && setsockopt(pcontext->sd[i], IPPROTO_IPV6, IPV6_V6ONLY,
@@ -1517,90 +3103,317 @@ void *server_thread(void *arg)
 
         if(bind(pcontext->sd[i], aip2->ai_addr, aip2->ai_addrlen) < 0) {
             perror("bind");
+            close(pcontext->sd[i]);
             pcontext->sd[i] = -1;
             continue;
         }
 
-        if(listen(pcontext->sd[i], 10) < 0) {
+        if(listen(pcontext->sd[i], pcontext->conf.backlog) < 0) {
             perror("listen");
+            close(pcontext->sd[i]);
             pcontext->sd[i] = -1;
         } else {
             i++;
-            if(i >= MAX_SD_LEN) {
-                OPRINT("%s(): maximum number of server sockets exceeded", __FUNCTION__);
-                i--;
-                break;
-            }
         }
     }
 
-    pcontext->sd_len = i;
-
-    if(pcontext->sd_len < 1) {
-        OPRINT("%s(): bind(%d) failed\n", __FUNCTION__, htons(pcontext->conf.port));
-        closelog();
-        exit(EXIT_FAILURE);
+    if(aip2 != NULL) {
+        OPRINT("%s(): maximum number of server sockets exceeded\n", __FUNCTION__);
     }
 
-    /* create a child for every client that connects */
-    while(!pglobal->stop) {
-        //int *pfd = (int *)malloc(sizeof(int));
-        cfd *pcfd = malloc(sizeof(cfd));
+    i -= pcontext->sd_len;
+    pcontext->sd_len += i;
+    return i;
+}
 
-        if(pcfd == NULL) {
-            fprintf(stderr, "failed to allocate (a very small amount of) memory\n");
-            exit(EXIT_FAILURE);
+/******************************************************************************
+Description.: Tell the resident memory of the process, read again from
+              /proc/self/statm at most every RESIDENT_INTERVAL_USEC
+Input Value.: -
+Return Value: the resident bytes, 0 if they are unknown
+******************************************************************************/
+static long long resident_bytes(void)
+{
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static unsigned long long checked;
+    static long long resident;
+    unsigned long long now = monotonic_usec();
+    unsigned long size, pages;
+    FILE *f;
+
+    pthread_mutex_lock(&mutex);
+    if(checked == 0 || now - checked >= RESIDENT_INTERVAL_USEC) {
+        checked = now;
+        resident = 0;
+        if((f = fopen("/proc/self/statm", "r")) != NULL) {
+            if(fscanf(f, "%lu %lu", &size, &pages) == 2)
+                resident = (long long)pages * sysconf(_SC_PAGESIZE);
+            fclose(f);
         }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return resident;
+}
+
+/******************************************************************************
+Description.: Wait for clients to connect to some of the listening sockets and
+              start serving them
+Input Value.: * pcontext: the server context
+              * first...: index of the first socket in sd[]
+              * count...: number of sockets
+Return Value: -
+******************************************************************************/
+static void accept_clients(context *pcontext, int first, int count)
+{
+    struct sockaddr_storage client_addr;
+    socklen_t addr_len;
+    fd_set selectfds;
+    int max_fds = 0;
+    char name[NI_MAXHOST];
+    int err;
+    int i;
 
+    /* create a child for every client that connects */
+    while(!pglobal->stop) {
         DBG("waiting for clients to connect\n");
 
         do {
             FD_ZERO(&selectfds);
 
-            for(i = 0; i < MAX_SD_LEN; i++) {
-                if(pcontext->sd[i] != -1) {
-                    FD_SET(pcontext->sd[i], &selectfds);
+            for(i = first; i < first + count; i++) {
+                FD_SET(pcontext->sd[i], &selectfds);
 
-                    if(pcontext->sd[i] > max_fds)
-                        max_fds = pcontext->sd[i];
-                }
+                if(pcontext->sd[i] > max_fds)
+                    max_fds = pcontext->sd[i];
             }
 
             err = select(max_fds + 1, &selectfds, NULL, NULL, NULL);
 
+            if(err < 0 && errno == EBADF) {
+                /* the sockets were closed by server_cleanup() */
+                return;
+            }
+
             if(err < 0 && errno != EINTR) {
                 perror("select");
                 exit(EXIT_FAILURE);
             }
         } while(err <= 0);
 
-        for(i = 0; i < max_fds + 1; i++) {
-            if(pcontext->sd[i] != -1 && FD_ISSET(pcontext->sd[i], &selectfds)) {
-                pcfd->fd = accept(pcontext->sd[i], (struct sockaddr *)&client_addr, &addr_len);
+        for(i = first; i < first + count; i++) {
+            if(FD_ISSET(pcontext->sd[i], &selectfds)) {
+                cfd *pcfd = malloc(sizeof(cfd));
+
+                if(pcfd == NULL) {
+                    fprintf(stderr, "failed to allocate (a very small amount of) memory\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                addr_len = sizeof(struct sockaddr_storage);
+                if((pcfd->fd = accept(pcontext->sd[i], (struct sockaddr *)&client_addr, &addr_len)) < 0) {
+                    free(pcfd);
+                    continue;
+                }
                 pcfd->pc = pcontext;
 
+                /* turned away before it takes a thread or any buffers */
+                if(pcontext->conf.memory > 0 && resident_bytes() > pcontext->conf.memory) {
+                    DBG("memory budget exceeded, refusing a client\n");
+                    __sync_fetch_and_add(&pcontext->stats.refused, 1);
+                    if(pcontext->tls == NULL)
+                        send_error(pcfd->fd, 503, "the server is at its memory limit");
+                    close(pcfd->fd);
+                    free(pcfd);
+                    continue;
+                }
+
+                /* the limits of the address, also before anything is allocated for it */
+                if((err = admit_client(pcontext, (struct sockaddr *)&client_addr, pcfd)) != 0) {
+                    DBG("admission control refused a client, reason %d\n", err);
+                    if(err == REJECT_RATE && pcontext->tls == NULL) {
+                        send_error(pcfd->fd, 503, "too many requests from this address");
+                    } else {
+                        /* a reset, no FIN_WAIT or TIME_WAIT left behind */
+                        struct linger reset = { .l_onoff = 1, .l_linger = 0 };
+                        setsockopt(pcfd->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+                    }
+                    close(pcfd->fd);
+                    free(pcfd);
+                    continue;
+                }
+
                 /* start new thread that will handle this TCP connected client */
                 DBG("create thread to handle client that just established a connection\n");
 
-                if(getnameinfo((struct sockaddr *)&client_addr, addr_len, name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
-                    DBG("serving client: %s\n", name);
-                }
+                if(getnameinfo((struct sockaddr *)&client_addr, addr_len, name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
+                    DBG("serving client: %s\n", name);
+                }
+
+                #if defined(MANAGMENT)
+                pcfd->client = add_client(name);
+                #endif
+                pcfd->pooled = 0;
+
+                /* an idle worker of the pool is cheaper than a new thread */
+                if(request_pool_add(pcontext, pcfd) == 0)
+                    continue;
+
+                if(client_thread_start(client_thread, pcfd) < 0) {
+                    DBG("could not launch another client thread\n");
+                    close_client(pcfd);
+                    free(pcfd);
+                    continue;
+                }
+            }
+        }
+    }
+}
+
+/* the sockets of an additional SO_REUSEPORT listener */
+typedef struct {
+    context *pc;
+    int first;
+    int count;
+} listener;
+
+/******************************************************************************
+Description.: Accept clients on the sockets of an additional listener
+Input Value.: the listener, it is freed by this function
+Return Value: always NULL
+******************************************************************************/
+static void *listener_thread(void *arg)
+{
+    listener *l = arg;
+
+    accept_clients(l->pc, l->first, l->count);
+
+    free(l);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: allocate the tables the servers share, sized for all plugins
+              the program can have, the first server to be initialized does it
+Input Value.: the globals
+Return Value: 0 if ok, -1 without memory
+******************************************************************************/
+int httpd_init(globals *global)
+{
+    if(servers != NULL)
+        return 0;
+
+    servers = calloc(OUTPUT_TABLE_SIZE, sizeof(context));
+    input_json = calloc(INPUT_TABLE_SIZE, sizeof(json_cache));
+    output_json = calloc(OUTPUT_TABLE_SIZE, sizeof(json_cache));
+    input_generation = calloc(INPUT_TABLE_SIZE, sizeof(unsigned int));
+    output_generation = calloc(OUTPUT_TABLE_SIZE, sizeof(unsigned int));
+
+    if(servers == NULL || input_json == NULL || output_json == NULL ||
+       input_generation == NULL || output_generation == NULL) {
+        free(servers);
+        free(input_json);
+        free(output_json);
+        free(input_generation);
+        free(output_generation);
+        servers = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Open a TCP socket and wait for clients to connect. If clients
+              connect, start a new thread for each accepted connection.
+Input Value.: arg is a pointer to the globals struct
+Return Value: always NULL, will only return on exit
+******************************************************************************/
+void *server_thread(void *arg)
+{
+    pthread_t thread;
+    struct addrinfo *aip;
+    struct addrinfo hints;
+    char name[NI_MAXHOST];
+    int err;
+    int i, j, count;
+    listener *l;
+
+    context *pcontext = arg;
+    pglobal = pcontext->pglobal;
+
+    /* set cleanup handler to cleanup resources */
+    pthread_cleanup_push(server_cleanup, pcontext);
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_socktype = SOCK_STREAM;
+
+    snprintf(name, sizeof(name), "%d", ntohs(pcontext->conf.port));
+    if((err = getaddrinfo(pcontext->conf.hostname, name, &hints, &aip)) != 0) {
+        perror(gai_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    for(i = 0; i < MAX_SD_LEN; i++)
+        pcontext->sd[i] = -1;
+    pcontext->sd_len = 0;
+
+
+    count = open_listeners(pcontext, aip, pcontext->conf.listeners > 1);
+
+    if(count < 1) {
+        OPRINT("%s(): bind(%d) failed\n", __FUNCTION__, htons(pcontext->conf.port));
+        closelog();
+        exit(EXIT_FAILURE);
+    }
+
+    /* streams get served by a few event loop threads if requested */
+    if(pcontext->conf.event_loop > 0 && event_loop_start(pcontext) != 0) {
+        OPRINT("could not start the event loop, falling back to a thread per client\n");
+        pcontext->conf.event_loop = 0;
+        pcontext->workers = NULL;
+    }
+
+    /* short requests get served by a pool of threads if requested */
+    if(pcontext->conf.workers > 0 && request_pool_start(pcontext) != 0) {
+        OPRINT("could not start the request threads, falling back to a thread per client\n");
+        pcontext->conf.workers = 0;
+        pcontext->pool = NULL;
+    }
+
+    /* each further listener gets sockets and a thread of its own */
+    for(i = 1; i < pcontext->conf.listeners; i++) {
+        if((l = malloc(sizeof(listener))) == NULL)
+            break;
+
+        l->pc = pcontext;
+        l->first = pcontext->sd_len;
+        if((l->count = open_listeners(pcontext, aip, 1)) < 1) {
+            free(l);
+            break;
+        }
 
-                #if defined(MANAGMENT)
-                pcfd->client = add_client(name);
-                #endif
+        if(pthread_create(&thread, NULL, listener_thread, l) != 0) {
+            DBG("could not launch listener thread %d\n", i);
 
-                if(pthread_create(&client, NULL, &client_thread, pcfd) != 0) {
-                    DBG("could not launch another client thread\n");
-                    close(pcfd->fd);
-                    free(pcfd);
-                    continue;
-                }
-                pthread_detach(client);
+            /* nobody would accept the connections the kernel puts there */
+            for(j = l->first; j < l->first + l->count; j++) {
+                close(pcontext->sd[j]);
+                pcontext->sd[j] = -1;
             }
+            pcontext->sd_len = l->first;
+            free(l);
+            break;
         }
+        pthread_detach(thread);
     }
 
+    freeaddrinfo(aip);
+
+    accept_clients(pcontext, 0, count);
+
     DBG("leaving server thread, calling cleanup function now\n");
     pthread_cleanup_pop(1);
 
@@ -1608,297 +3421,220 @@ void *server_thread(void *arg)
 }
 
 /******************************************************************************
-Description.: Send a JSON file which is contains information about the input plugin's
-              acceptable parameters
-Input Value.: fildescriptor fd to send the answer to
+Description.: Write the JSON description of the controls and formats of an
+              input plugin
+Input Value.: * b...........: the buffer
+              * input_number: number of the input plugin
 Return Value: -
 ******************************************************************************/
-void send_input_JSON(int fd, int input_number)
+static void input_JSON(text_buffer *b, int input_number)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
-
-    DBG("Serving the input plugin %d descriptor JSON file\n", input_number);
-
-
-    sprintf(buffer + strlen(buffer),
-            "{\n"
-            "\"controls\": [\n");
-    if(pglobal->in[input_number].in_parameters != NULL) {
-        for(i = 0; i < pglobal->in[input_number].parametercount; i++) {
-
-            char *menuString = NULL;
-            if(pglobal->in[input_number].in_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                if(pglobal->in[input_number].in_parameters[i].menuitems != NULL) {
-                    int j, k = 1;
-                    for(j = pglobal->in[input_number].in_parameters[i].ctrl.minimum; j <= pglobal->in[input_number].in_parameters[i].ctrl.maximum; j++) {
-                        char *tempName = NULL; // temporary storage for name sanity checking
-
-                        int prevSize = 0;
-                        int itemLength = strlen((char*)&pglobal->in[input_number].in_parameters[i].menuitems[j].name);
-                        tempName = (char*)calloc(itemLength + 1, sizeof(char));  // allocate space for the sanity checking
-                        if (tempName == NULL) {
-                            DBG("Realloc/calloc failed: %s\n", strerror(errno));
-                            return;
-                        }
-
-                        check_JSON_string((char*)&pglobal->in[input_number].in_parameters[i].menuitems[j].name, tempName); // sanity check the string after non printable characters
-
-                        itemLength += strlen("\"\": \"\"");
-
-                        if (menuString == NULL) {
-                            menuString = calloc(itemLength + 5, sizeof(char));
-                        } else {
-                            menuString = realloc(menuString, (strlen(menuString) + itemLength + 5) * (sizeof(char)));
-                        }
-
-                        if (menuString == NULL) {
-                            DBG("Realloc/calloc failed: %s\n", strerror(errno));
-                            return;
-                        }
-                        prevSize = strlen(menuString);
+    input *in = &pglobal->in[input_number];
+    char name[sizeof(in->in_parameters[0].menuitems[0].name) + 1];
+    int i, j;
+
+    text_printf(b, "{\n"
+                "\"controls\": [\n");
+    if(in->in_parameters != NULL) {
+        for(i = 0; i < in->parametercount; i++) {
+            text_printf(b, "{\n"
+                        "\"name\": \"%s\",\n"
+                        "\"id\": \"%d\",\n"
+                        "\"type\": \"%d\",\n"
+                        "\"min\": \"%d\",\n"
+                        "\"max\": \"%d\",\n"
+                        "\"step\": \"%d\",\n"
+                        "\"default\": \"%d\",\n"
+                        "\"value\": \"%d\",\n"
+                        "\"dest\": \"0\",\n"
+                        "\"flags\": \"%d\",\n"
+                        "\"group\": \"%d\"",
+                        in->in_parameters[i].ctrl.name,
+                        in->in_parameters[i].ctrl.id,
+                        in->in_parameters[i].ctrl.type,
+                        in->in_parameters[i].ctrl.minimum,
+                        in->in_parameters[i].ctrl.maximum,
+                        in->in_parameters[i].ctrl.step,
+                        in->in_parameters[i].ctrl.default_value,
+                        in->in_parameters[i].value,
+                        // 0 is the code of the input plugin
+                        in->in_parameters[i].ctrl.flags,
+                        in->in_parameters[i].group);
 
-                        if(j != pglobal->in[input_number].in_parameters[i].ctrl.maximum) {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\", ", j , tempName);
-                        } else {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\"", j , tempName);
-                        }
-                        k++;
-                        free(tempName);
+            // append the menu object to the menu typecontrols
+            if(in->in_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
+                text_printf(b, ",\n"
+                            "\"menu\": {");
+                if(in->in_parameters[i].menuitems != NULL) {
+                    for(j = in->in_parameters[i].ctrl.minimum; j <= in->in_parameters[i].ctrl.maximum; j++) {
+                        // sanity check the string after non printable characters
+                        memset(name, 0, sizeof(name));
+                        strncpy(name, (char *)in->in_parameters[i].menuitems[j].name, sizeof(name) - 1);
+                        check_JSON_string(name, name);
+                        text_printf(b, "\"%d\": \"%s\"%s", j, name, (j != in->in_parameters[i].ctrl.maximum) ? ", " : "");
                     }
                 }
-            }
-
-            sprintf(buffer + strlen(buffer),
-                    "{\n"
-                    "\"name\": \"%s\",\n"
-                    "\"id\": \"%d\",\n"
-                    "\"type\": \"%d\",\n"
-                    "\"min\": \"%d\",\n"
-                    "\"max\": \"%d\",\n"
-                    "\"step\": \"%d\",\n"
-                    "\"default\": \"%d\",\n"
-                    "\"value\": \"%d\",\n"
-                    "\"dest\": \"0\",\n"
-                    "\"flags\": \"%d\",\n"
-                    "\"group\": \"%d\"",
-                    pglobal->in[input_number].in_parameters[i].ctrl.name,
-                    pglobal->in[input_number].in_parameters[i].ctrl.id,
-                    pglobal->in[input_number].in_parameters[i].ctrl.type,
-                    pglobal->in[input_number].in_parameters[i].ctrl.minimum,
-                    pglobal->in[input_number].in_parameters[i].ctrl.maximum,
-                    pglobal->in[input_number].in_parameters[i].ctrl.step,
-                    pglobal->in[input_number].in_parameters[i].ctrl.default_value,
-                    pglobal->in[input_number].in_parameters[i].value,
-                    // 0 is the code of the input plugin
-                    pglobal->in[input_number].in_parameters[i].ctrl.flags,
-                    pglobal->in[input_number].in_parameters[i].group
-                   );
-
-            // append the menu object to the menu typecontrols
-            if(pglobal->in[input_number].in_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                sprintf(buffer + strlen(buffer),
-                        ",\n"
-                        "\"menu\": {%s}\n"
-                        "}",
-                        menuString);
+                text_printf(b, "}\n"
+                            "}");
             } else {
-                sprintf(buffer + strlen(buffer),
-                        "\n"
-                        "}");
+                text_printf(b, "\n"
+                            "}");
             }
 
-            if(i != (pglobal->in[input_number].parametercount - 1)) {
-                sprintf(buffer + strlen(buffer), ",\n");
-            }
-            free(menuString);
+            if(i != (in->parametercount - 1))
+                text_printf(b, ",\n");
         }
     } else {
         DBG("The input plugin has no paramters\n");
     }
-    sprintf(buffer + strlen(buffer),
-            "\n],\n"
-            /*"},\n"*/);
-
-    sprintf(buffer + strlen(buffer),
-            //"{\n"
-            "\"formats\": [\n");
-    if(pglobal->in[input_number].in_formats != NULL) {
-        for(i = 0; i < pglobal->in[input_number].formatCount; i++) {
-            char *resolutionsString = NULL;
-            int resolutionsStringLength = 0;
-            int j = 0;
-            for(j = 0; j < pglobal->in[input_number].in_formats[i].resolutionCount; j++) {
-                char buffer_num[6];
-                memset(buffer_num, '\0', 6);
-                // JSON format example:
-                // {"0": "320x240", "1": "640x480", "2": "960x720"}
-                sprintf(buffer_num, "%d", j);
-                resolutionsStringLength += strlen(buffer_num);
-                sprintf(buffer_num, "%d", pglobal->in[input_number].in_formats[i].supportedResolutions[j].width);
-                resolutionsStringLength += strlen(buffer_num);
-                sprintf(buffer_num, "%d", pglobal->in[input_number].in_formats[i].supportedResolutions[j].height);
-                resolutionsStringLength += strlen(buffer_num);
-                if(j != (pglobal->in[input_number].in_formats[i].resolutionCount - 1)) {
-                    resolutionsStringLength += (strlen("\"\": \"x\", ") + 5);
-                    if (resolutionsString == NULL)
-                        resolutionsString = calloc(resolutionsStringLength, sizeof(char*));
-                    else
-                        resolutionsString = realloc(resolutionsString, resolutionsStringLength * sizeof(char*));
-                    if (resolutionsString == NULL) {
-                        DBG("Realloc/calloc failed\n");
-                        return;
-                    }
-
-                    sprintf(resolutionsString + strlen(resolutionsString),
-                            "\"%d\": \"%dx%d\", ",
-                            j,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].width,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].height);
-                } else {
-                    resolutionsStringLength += (strlen("\"\": \"x\"")+5);
-                    if (resolutionsString == NULL)
-                        resolutionsString = calloc(resolutionsStringLength, sizeof(char*));
-                    else
-                        resolutionsString = realloc(resolutionsString, resolutionsStringLength * sizeof(char*));
-                    if (resolutionsString == NULL) {
-                        DBG("Realloc/calloc failed\n");
-                        return;
-                    }
-                    sprintf(resolutionsString + strlen(resolutionsString),
-                            "\"%d\": \"%dx%d\"",
-                            j,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].width,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].height);
-                }
-            }
-
-            sprintf(buffer + strlen(buffer),
-                    "{\n"
-                    "\"id\": \"%d\",\n"
-                    "\"name\": \"%s\",\n"
+    text_printf(b, "\n],\n"
+                "\"formats\": [\n");
+
+    if(in->in_formats != NULL) {
+        for(i = 0; i < in->formatCount; i++) {
+            text_printf(b, "{\n"
+                        "\"id\": \"%d\",\n"
+                        "\"name\": \"%s\",\n"
 #ifdef V4L2_FMT_FLAG_COMPRESSED
-                    "\"compressed\": \"%s\",\n"
+                        "\"compressed\": \"%s\",\n"
 #endif
 #ifdef V4L2_FMT_FLAG_EMULATED
-                    "\"emulated\": \"%s\",\n"
+                        "\"emulated\": \"%s\",\n"
 #endif
-                    "\"current\": \"%s\",\n"
-                    "\"resolutions\": {%s}\n"
-                    ,
-                    pglobal->in[input_number].in_formats[i].format.index,
-                    pglobal->in[input_number].in_formats[i].format.description,
+                        "\"current\": \"%s\",\n"
+                        "\"resolutions\": {",
+                        in->in_formats[i].format.index,
+                        in->in_formats[i].format.description,
 #ifdef V4L2_FMT_FLAG_COMPRESSED
-                    pglobal->in[input_number].in_formats[i].format.flags & V4L2_FMT_FLAG_COMPRESSED ? "true" : "false",
+                        in->in_formats[i].format.flags & V4L2_FMT_FLAG_COMPRESSED ? "true" : "false",
 #endif
 #ifdef V4L2_FMT_FLAG_EMULATED
-                    pglobal->in[input_number].in_formats[i].format.flags & V4L2_FMT_FLAG_EMULATED ? "true" : "false",
+                        in->in_formats[i].format.flags & V4L2_FMT_FLAG_EMULATED ? "true" : "false",
 #endif
-                    pglobal->in[input_number].in_formats[i].currentResolution != -1 ? "true" : "false",
-                    resolutionsString
-                   );
-
-            if(pglobal->in[input_number].in_formats[i].currentResolution != -1) {
-                sprintf(buffer + strlen(buffer),
-                        ",\n\"currentResolution\": \"%d\"\n",
-                        pglobal->in[input_number].in_formats[i].currentResolution
-                       );
+                        in->in_formats[i].currentResolution != -1 ? "true" : "false");
+
+            // JSON format example:
+            // {"0": "320x240", "1": "640x480", "2": "960x720"}
+            for(j = 0; j < in->in_formats[i].resolutionCount; j++) {
+                text_printf(b, "\"%d\": \"%dx%d\"%s", j,
+                            in->in_formats[i].supportedResolutions[j].width,
+                            in->in_formats[i].supportedResolutions[j].height,
+                            (j != (in->in_formats[i].resolutionCount - 1)) ? ", " : "");
             }
+            text_printf(b, "}\n");
 
-            if(i != (pglobal->in[input_number].formatCount - 1)) {
-                sprintf(buffer + strlen(buffer), "},\n");
-            } else {
-                sprintf(buffer + strlen(buffer), "}\n");
-            }
+            if(in->in_formats[i].currentResolution != -1)
+                text_printf(b, ",\n\"currentResolution\": \"%d\"\n", in->in_formats[i].currentResolution);
 
-            free(resolutionsString);
+            text_printf(b, (i != (in->formatCount - 1)) ? "},\n" : "}\n");
         }
     }
-    sprintf(buffer + strlen(buffer),
-            "\n]\n"
-            "}\n");
-    i = strlen(buffer);
-
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the control JSON file\n");
-    }
+    text_printf(b, "\n]\n"
+                "}\n");
 }
 
-
-void send_program_JSON(int fd)
+/******************************************************************************
+Description.: Send a JSON file which is contains information about the input plugin's
+              acceptable parameters
+Input Value.: fildescriptor fd to send the answer to, keep_alive to keep the
+              connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_input_JSON(int fd, int input_number, int keep_alive)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    int i, k;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
+    unsigned long long done = input_commands_done(&pglobal->in[input_number]);
 
-    DBG("Serving the program descriptor JSON file\n");
+    DBG("Serving the input plugin %d descriptor JSON file\n", input_number);
 
+    /* commands queued with wait=0 set the controls after they were invalidated */
+    pthread_mutex_lock(&json_mutex);
+    if(input_json[input_number].commands != done) {
+        input_json[input_number].commands = done;
+        input_generation[input_number]++;
+    }
+    pthread_mutex_unlock(&json_mutex);
 
-    sprintf(buffer + strlen(buffer),
-            "{\n"
-            /*"\"program\": [\n"
-            "{\n"*/
-            "\"inputs\":[\n");
+    return send_cached_JSON(fd, keep_alive, &input_json[input_number], &input_generation[input_number],
+                            input_JSON, input_number);
+}
+
+/******************************************************************************
+Description.: Write the JSON description of the loaded plugins
+Input Value.: * b.....: the buffer
+              * unused: -
+Return Value: -
+******************************************************************************/
+static void program_JSON(text_buffer *b, int unused)
+{
+    governor_state governor;
+    int k;
+
+    text_printf(b, "{\n"
+                "\"inputs\":[\n");
     for(k = 0; k < pglobal->incnt; k++) {
-        sprintf(buffer + strlen(buffer),
-                "{\n"
-                "\"id\": \"%d\",\n"
-                "\"name\": \"%s\",\n"
-                "\"plugin\": \"%s\",\n"
-                "\"args\": \"%s\"\n"
-                "}",
-                pglobal->in[k].param.id,
-                pglobal->in[k].name,
-                pglobal->in[k].plugin,
-                pglobal->in[k].param.parameters);
-        if(k != (pglobal->incnt - 1))
-            sprintf(buffer + strlen(buffer), ", \n");
-        else
-            sprintf(buffer + strlen(buffer), "\n");
-    }
-    sprintf(buffer + strlen(buffer),
-            /*"]\n"
-            "}\n"
-            "]\n"*/
-            "],\n");
-    sprintf(buffer + strlen(buffer),
-            "\"outputs\":[\n");
+        text_printf(b, "{\n"
+                    "\"id\": \"%d\",\n"
+                    "\"name\": \"%s\",\n"
+                    "\"plugin\": \"%s\",\n"
+                    "\"args\": \"%s\",\n"
+                    "\"active\": \"%d\",\n"
+                    "\"priority\": \"%d\",\n"
+                    "\"degraded\": \"%s\"\n"
+                    "}",
+                    pglobal->in[k].param.id,
+                    pglobal->in[k].name,
+                    pglobal->in[k].plugin,
+                    pglobal->in[k].param.parameters,
+                    pglobal->in[k].handle != NULL,
+                    pglobal->in[k].priority,
+                    degrade_name(pglobal->in[k].degrade));
+        text_printf(b, (k != (pglobal->incnt - 1)) ? ", \n" : "\n");
+    }
+    text_printf(b, "],\n"
+                "\"outputs\":[\n");
     for(k = 0; k < pglobal->outcnt; k++) {
-        sprintf(buffer + strlen(buffer),
-                "{\n"
-                "\"id\": \"%d\",\n"
-                "\"name\": \"%s\",\n"
-                "\"plugin\": \"%s\",\n"
-                "\"args\": \"%s\"\n"
-                "}",
-                pglobal->out[k].param.id,
-                pglobal->out[k].name,
-                pglobal->out[k].plugin,
-                pglobal->out[k].param.parameters);
-        if(k != (pglobal->outcnt - 1))
-            sprintf(buffer + strlen(buffer), ", \n");
-        else
-            sprintf(buffer + strlen(buffer), "\n");
+        text_printf(b, "{\n"
+                    "\"id\": \"%d\",\n"
+                    "\"name\": \"%s\",\n"
+                    "\"plugin\": \"%s\",\n"
+                    "\"args\": \"%s\",\n"
+                    "\"active\": \"%d\"\n"
+                    "}",
+                    pglobal->out[k].param.id,
+                    pglobal->out[k].name,
+                    pglobal->out[k].plugin,
+                    pglobal->out[k].param.parameters,
+                    pglobal->out[k].handle != NULL);
+        text_printf(b, (k != (pglobal->outcnt - 1)) ? ", \n" : "\n");
     }
-    sprintf(buffer + strlen(buffer),
-            /*"]\n"
-            "}\n"
-            "]\n"*/
-            "]}\n");
-    i = strlen(buffer);
+    governor_get(&governor);
+    text_printf(b, "],\n"
+                "\"governor\": {\n"
+                "\"running\": \"%d\",\n"
+                "\"max_temperature\": \"%g\",\n"
+                "\"max_load\": \"%g\",\n"
+                "\"actions\": \"%llu\"\n"
+                "}}\n",
+                governor.running, governor.max_temperature, governor.max_load, governor.actions);
+}
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the program JSON file\n");
+int send_program_JSON(int fd, int keep_alive)
+{
+    governor_state governor;
+
+    DBG("Serving the program descriptor JSON file\n");
+
+    /* the levels of the inputs are part of it, the governor changed them */
+    governor_get(&governor);
+    pthread_mutex_lock(&json_mutex);
+    if(governor.actions != program_actions) {
+        program_actions = governor.actions;
+        program_generation++;
     }
+    pthread_mutex_unlock(&json_mutex);
+
+    /* program_generation changes when plugins are added or removed */
+    return send_cached_JSON(fd, keep_alive, &program_json, &program_generation, program_JSON, 0);
 }
 
 /******************************************************************************
@@ -1921,156 +3657,718 @@ void check_JSON_string(char *source, char *destination)
 }
 
 /******************************************************************************
-Description.: Send a JSON file which is contains information about the output plugin's
-              acceptable parameters
-Input Value.: fildescriptor fd to send the answer to
+Description.: Write the JSON description of the controls of an output plugin
+Input Value.: * b............: the buffer
+              * output_number: number of the output plugin
 Return Value: -
 ******************************************************************************/
-void send_output_JSON(int fd, int input_number)
+static void output_JSON(text_buffer *b, int output_number)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
-
-    DBG("Serving the output plugin %d descriptor JSON file\n", input_number);
-
-    sprintf(buffer + strlen(buffer),
-            "{\n"
-            "\"controls\": [\n");
-    if(pglobal->out[input_number].out_parameters != NULL) {
-        for(i = 0; i < pglobal->out[input_number].parametercount; i++) {
-            char *menuString = calloc(0, 0);
-            if(pglobal->out[input_number].out_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                if(pglobal->out[input_number].out_parameters[i].menuitems != NULL) {
-                    int j, k = 1;
-                    for(j = pglobal->out[input_number].out_parameters[i].ctrl.minimum; j <= pglobal->out[input_number].out_parameters[i].ctrl.maximum; j++) {
-                        int prevSize = strlen(menuString);
-                        int itemLength = strlen((char*)&pglobal->out[input_number].out_parameters[i].menuitems[j].name)  + strlen("\"\": \"\"");
-                        if (menuString == NULL) {
-                            menuString = calloc(itemLength, sizeof(char));
-                        } else {
-                            menuString = realloc(menuString, (strlen(menuString) + itemLength) * (sizeof(char)));
-                        }
-
-                        if (menuString == NULL) {
-                            DBG("Realloc/calloc failed: %s\n", strerror(errno));
-                            return;
-                        }
-
-                        if(j != pglobal->out[input_number].out_parameters[i].ctrl.maximum) {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\", ", j , (char*)&pglobal->out[input_number].out_parameters[i].menuitems[j].name);
-                        } else {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\"", j , (char*)&pglobal->out[input_number].out_parameters[i].menuitems[j].name);
-                        }
-                        k++;
+    output *out = &pglobal->out[output_number];
+    int i, j;
+
+    text_printf(b, "{\n"
+                "\"controls\": [\n");
+    if(out->out_parameters != NULL) {
+        for(i = 0; i < out->parametercount; i++) {
+            text_printf(b, "{\n"
+                        "\"name\": \"%s\",\n"
+                        "\"id\": \"%d\",\n"
+                        "\"type\": \"%d\",\n"
+                        "\"min\": \"%d\",\n"
+                        "\"max\": \"%d\",\n"
+                        "\"step\": \"%d\",\n"
+                        "\"default\": \"%d\",\n"
+                        "\"value\": \"%d\",\n"
+                        "\"dest\": \"1\",\n"
+                        "\"flags\": \"%d\",\n"
+                        "\"group\": \"%d\"",
+                        out->out_parameters[i].ctrl.name,
+                        out->out_parameters[i].ctrl.id,
+                        out->out_parameters[i].ctrl.type,
+                        out->out_parameters[i].ctrl.minimum,
+                        out->out_parameters[i].ctrl.maximum,
+                        out->out_parameters[i].ctrl.step,
+                        out->out_parameters[i].ctrl.default_value,
+                        out->out_parameters[i].value,
+                        // 1 is the code of the output plugin
+                        out->out_parameters[i].ctrl.flags,
+                        out->out_parameters[i].group);
+
+            if(out->out_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
+                text_printf(b, ",\n"
+                            "\"menu\": {");
+                if(out->out_parameters[i].menuitems != NULL) {
+                    for(j = out->out_parameters[i].ctrl.minimum; j <= out->out_parameters[i].ctrl.maximum; j++) {
+                        text_printf(b, "\"%d\": \"%s\"%s", j, (char *)&out->out_parameters[i].menuitems[j].name,
+                                    (j != out->out_parameters[i].ctrl.maximum) ? ", " : "");
                     }
                 }
-            }
-
-            sprintf(buffer + strlen(buffer),
-                    "{\n"
-                    "\"name\": \"%s\",\n"
-                    "\"id\": \"%d\",\n"
-                    "\"type\": \"%d\",\n"
-                    "\"min\": \"%d\",\n"
-                    "\"max\": \"%d\",\n"
-                    "\"step\": \"%d\",\n"
-                    "\"default\": \"%d\",\n"
-                    "\"value\": \"%d\",\n"
-                    "\"dest\": \"1\",\n"
-                    "\"flags\": \"%d\",\n"
-                    "\"group\": \"%d\"",
-                    pglobal->out[input_number].out_parameters[i].ctrl.name,
-                    pglobal->out[input_number].out_parameters[i].ctrl.id,
-                    pglobal->out[input_number].out_parameters[i].ctrl.type,
-                    pglobal->out[input_number].out_parameters[i].ctrl.minimum,
-                    pglobal->out[input_number].out_parameters[i].ctrl.maximum,
-                    pglobal->out[input_number].out_parameters[i].ctrl.step,
-                    pglobal->out[input_number].out_parameters[i].ctrl.default_value,
-                    pglobal->out[input_number].out_parameters[i].value,
-                    // 1 is the code of the output plugin
-                    pglobal->out[input_number].out_parameters[i].ctrl.flags,
-                    pglobal->out[input_number].out_parameters[i].group
-                   );
-
-            if(pglobal->out[input_number].out_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                sprintf(buffer + strlen(buffer),
-                        ",\n"
-                        "\"menu\": {%s}\n"
-                        "}",
-                        menuString);
+                text_printf(b, "}\n"
+                            "}");
             } else {
-                sprintf(buffer + strlen(buffer),
-                        "\n"
-                        "}");
+                text_printf(b, "\n"
+                            "}");
             }
 
-            if(i != (pglobal->out[input_number].parametercount - 1)) {
-                sprintf(buffer + strlen(buffer), ",\n");
-            }
-            free(menuString);
+            if(i != (out->parametercount - 1))
+                text_printf(b, ",\n");
         }
     } else {
-        DBG("The output plugin %d has no paramters\n", input_number);
+        DBG("The output plugin %d has no paramters\n", output_number);
     }
-    sprintf(buffer + strlen(buffer),
-            "\n]\n"
-            /*"},\n"*/);
+    text_printf(b, "\n]\n"
+                "}\n");
+}
 
-    sprintf(buffer + strlen(buffer),
-            "}\n");
-    i = strlen(buffer);
+/******************************************************************************
+Description.: Send a JSON file which is contains information about the output plugin's
+              acceptable parameters
+Input Value.: fildescriptor fd to send the answer to, keep_alive to keep the
+              connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_output_JSON(int fd, int input_number, int keep_alive)
+{
+    DBG("Serving the output plugin %d descriptor JSON file\n", input_number);
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the control JSON file\n");
-    }
+    return send_cached_JSON(fd, keep_alive, &output_json[input_number], &output_generation[input_number],
+                            output_JSON, input_number);
 }
 
 #ifdef MANAGMENT
-void send_clients_JSON(int fd)
+int send_clients_JSON(int fd, int keep_alive)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    unsigned long i = 0 ;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
+    text_buffer b;
+    client_info *c;
+    int result;
 
     DBG("Serving the clients JSON file\n");
 
-    sprintf(buffer + strlen(buffer),
+    b.len = 0;
+    b.size = BUFFER_SIZE * 16;
+    if((b.data = malloc(b.size)) == NULL)
+        return -1;
+
+    text_printf(&b,
             "{\n"
             "\"clients\": [\n");
 
-    for (; i<client_infos.client_count; i++) {
-        sprintf(buffer + strlen(buffer),
+    for(c = __sync_fetch_and_add(&client_infos.first, 0); c != NULL; c = c->added) {
+        text_printf(&b,
             "{\n"
             "\"address\": \"%s\",\n"
-            "\"timestamp\": %ld\n"
+            "\"timestamp\": %ld,\n"
+            "\"sent\": %llu,\n"
+            "\"dropped\": %llu,\n"
+            "\"streams\": %d,\n"
+            "\"queued\": %lld,\n"
+            "\"memory\": %lld\n"
             "}\n",
-            client_infos.infos[i]->address,
-            (unsigned long)client_infos.infos[i]->last_take_time.tv_sec);
+            c->address,
+            (unsigned long)(c->last_take_time / 1000000),
+            c->frames_sent,
+            c->frames_dropped,
+            c->streams,
+            c->queued,
+            c->memory + c->queued);
+
+        if(c->added != NULL) {
+            text_printf(&b, ",\n");
+        }
+    }
+
+    text_printf(&b,
+            "]"
+            "\n}\n");
+
+    if(b.data == NULL)
+        return -1;
+
+    result = send_reply(fd, keep_alive, "application/x-javascript", b.data, b.len);
+    free(b.data);
+    return result;
+}
+#endif
+
+/******************************************************************************
+Description.: Send the motion state of an input, it changes with every frame
+              and is not cached
+Input Value.: fildescriptor fd to send the answer to, the input, keep_alive
+              to keep the connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_motion_JSON(int fd, int input_number, int keep_alive)
+{
+    motion_state state;
+    text_buffer b;
+    int z, result;
+
+    if(motion_get(&pglobal->in[input_number], &state) < 0) {
+        send_error(fd, 404, "no motion detection for this input, see --motion");
+        return -1;
+    }
+
+    b.len = 0;
+    b.size = BUFFER_SIZE;
+    if((b.data = malloc(b.size)) == NULL)
+        return -1;
+
+    text_printf(&b, "{\n"
+                "\"input\": %d,\n"
+                "\"seq\": %llu,\n"
+                "\"timestamp\": %ld.%06ld,\n"
+                "\"active\": %s,\n"
+                "\"score\": %.2f,\n"
+                "\"events\": %llu,\n"
+                "\"columns\": %d,\n"
+                "\"rows\": %d,\n"
+                "\"zones\": [",
+                input_number, state.seq,
+                (long)state.timestamp.tv_sec, (long)state.timestamp.tv_usec,
+                state.active ? "true" : "false", state.score, state.events,
+                state.columns, state.rows);
+    for(z = 0; z < state.columns * state.rows; z++)
+        text_printf(&b, (z > 0) ? ", %.2f" : "%.2f", state.zone[z]);
+    text_printf(&b, "]\n}\n");
+
+    if(b.data == NULL)
+        return -1;
+
+    result = send_reply(fd, keep_alive, "application/x-javascript", b.data, b.len);
+    free(b.data);
+    return result;
+}
 
-        if(i != (client_infos.client_count - 1)) {
-            sprintf(buffer + strlen(buffer), ",\n");
+/* room for an LL-HLS playlist */
+#define HLS_PLAYLIST_SIZE 32768
+
+/* a blocking playlist reload or a part not there yet is waited for that long */
+#define HLS_WAIT_MSEC 6000
+
+/******************************************************************************
+Description.: Send the LL-HLS playlist, the CMAF header, a segment or a part of
+              the live stream of an input, see output_mp4 --live. Playlists
+              are held back until they reach the _HLS_msn and _HLS_part of the
+              query, parts until they exist. The media keeps its name for good
+              and may be cached, a CDN fetches each piece once.
+Input Value.: * context_fd..: the client
+              * input_number: the input
+              * parameter...: the file, like index.m3u8?_HLS_msn=12&_HLS_part=3,
+                              init.mp4, 12.m4s or 12.3.m4s
+              * keep_alive..: nonzero to keep the connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_hls(cfd *context_fd, int input_number, const char *parameter, int keep_alive)
+{
+    input *in = &pglobal->in[input_number];
+    input_frame *parts[LIVE_PARTS];
+    char buffer[BUFFER_SIZE], name[64], *playlist;
+    struct iovec iov[2];
+    long long msn = -1;
+    const char *q;
+    int n, i, len, rc = 0, end = 0, part = -1, length = 0;
+
+    snprintf(name, sizeof(name), "%.*s", (int)strcspn(parameter, "?"), parameter);
+
+    if(strcmp(name, "index.m3u8") == 0) {
+        if((q = strstr(parameter, "_HLS_msn=")) != NULL)
+            msn = strtoll(q + strlen("_HLS_msn="), NULL, 10);
+        if((q = strstr(parameter, "_HLS_part=")) != NULL)
+            part = atoi(q + strlen("_HLS_part="));
+        if(msn < 0 && part >= 0) {
+            send_error(context_fd->fd, 400, "_HLS_part needs _HLS_msn");
+            return -1;
+        }
+
+        if((playlist = malloc(HLS_PLAYLIST_SIZE)) == NULL)
+            return -1;
+        if((len = live_playlist(in, msn, part, HLS_WAIT_MSEC, playlist, HLS_PLAYLIST_SIZE)) <= 0) {
+            free(playlist);
+            if(len < 0)
+                send_error(context_fd->fd, 404, "no live stream for this input, see output_mp4 --live");
+            else if(msn >= 0)
+                send_error(context_fd->fd, 400, "the live stream does not reach this segment soon");
+            else
+                send_error(context_fd->fd, 503, "the live stream has no segment yet");
+            return -1;
         }
+
+        /* a held back playlist is the same for all clients asking for it */
+        iov[1].iov_base = playlist;
+        iov[1].iov_len = len;
+        iov[0].iov_base = buffer;
+        iov[0].iov_len = snprintf(buffer, sizeof(buffer), "HTTP/1.%d 200 OK\r\n" \
+                                  "Access-Control-Allow-Origin: *\r\n" \
+                                  "Connection: %s\r\n" \
+                                  "Server: MJPG-Streamer/0.2\r\n" \
+                                  "Cache-Control: %s\r\n" \
+                                  "Content-type: application/vnd.apple.mpegurl\r\n" \
+                                  "Content-Length: %d\r\n" \
+                                  "\r\n", HTTP_MINOR(keep_alive), connection_field(keep_alive),
+                                  (msn >= 0) ? "public, max-age=60" : "no-cache", len);
+        rc = writev_all(context_fd->fd, iov, 2);
+        free(playlist);
+        return (rc == 0 && keep_alive) ? 0 : -1;
     }
 
-    sprintf(buffer + strlen(buffer),
-            "]");
+    if(strcmp(name, "init.mp4") == 0) {
+        n = live_get(in, -1, -1, 0, parts);
+    } else if((sscanf(name, "%lld.%d.m4s%n", &msn, &part, &end) == 2 && end > 0 && name[end] == '\0') ||
+              (part = -1, end = 0, sscanf(name, "%lld.m4s%n", &msn, &end) == 1 && end > 0 && name[end] == '\0')) {
+        if(msn < 0 || part < -1) {
+            send_error(context_fd->fd, 404, "no such segment");
+            return -1;
+        }
+        n = live_get(in, msn, part, HLS_WAIT_MSEC, parts);
+    } else {
+        send_error(context_fd->fd, 404, "the live stream has index.m3u8, init.mp4 and .m4s files");
+        return -1;
+    }
 
-    sprintf(buffer + strlen(buffer),
-            "\n}\n");
-    i = strlen(buffer);
+    if(n <= 0) {
+        send_error(context_fd->fd, 404, (n < 0) ? "no live stream for this input, see output_mp4 --live" :
+                   "this part of the live stream is not there anymore or not yet");
+        return -1;
+    }
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the control JSON file\n");
+    for(i = 0; i < n; i++)
+        length += frame_length(parts[i]);
+
+    len = snprintf(buffer, sizeof(buffer), "HTTP/1.%d 200 OK\r\n" \
+                   "Access-Control-Allow-Origin: *\r\n" \
+                   "Connection: %s\r\n" \
+                   "Server: MJPG-Streamer/0.2\r\n" \
+                   "Cache-Control: %s\r\n" \
+                   "Content-type: video/mp4\r\n" \
+                   "Content-Length: %d\r\n" \
+                   "\r\n", HTTP_MINOR(keep_alive), connection_field(keep_alive),
+                   (msn >= 0) ? "public, max-age=60" : "no-cache", length);
+
+    /* the parts of a segment follow each other */
+    for(i = 0; i < n; i++) {
+        if(rc == 0 && write_part(context_fd, NULL, buffer, (i == 0) ? len : 0, parts[i], NULL, 0) < 0)
+            rc = -1;
+        frame_unref(parts[i]);
     }
+    return (rc == 0 && keep_alive) ? 0 : -1;
 }
-#endif
 
+/******************************************************************************
+Description.: append the samples of a histogram
+Input Value.: * b.....: the buffer
+              * name..: name of the metric
+              * labels: labels of the samples
+              * h.....: the histogram
+              * scale.: unit of the reported values, 1e-6 turns microseconds
+                        into seconds
+Return Value: -
+******************************************************************************/
+static void text_histogram(text_buffer *b, const char *name, const char *labels, histogram *h, double scale)
+{
+    unsigned long long cumulative = 0;
+    int i;
+
+    for(i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+        cumulative += h->bucket[i];
+        text_printf(b, "%s_bucket{%s,le=\"%g\"} %llu\n", name, labels, (double)(1ULL << (h->shift + i)) * scale, cumulative);
+    }
+    text_printf(b, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, h->count);
+    text_printf(b, "%s_sum{%s} %g\n", name, labels, (double)h->sum * scale);
+    text_printf(b, "%s_count{%s} %llu\n", name, labels, h->count);
+}
+
+/******************************************************************************
+Description.: Send the frame events of the flight recorder as a trace in the
+              Chrome trace event format, for Perfetto or chrome://tracing
+Input Value.: * fd........: fildescriptor to send the answer to
+              * keep_alive: keep the connection open afterwards
+              * seconds...: how far back, 0 for FLIGHT_SECONDS
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_trace(int fd, int keep_alive, int seconds)
+{
+    char *data = NULL;
+    size_t len = 0;
+    FILE *f;
+    int n, result;
+
+    DBG("Serving the trace\n");
+
+    if((f = open_memstream(&data, &len)) == NULL) {
+        send_error(fd, 500, "not enough memory");
+        return -1;
+    }
+    n = flight_write(f, (seconds > 0) ? seconds : FLIGHT_SECONDS);
+    if(fclose(f) != 0 || n < 0) {
+        free(data);
+        send_error(fd, 500, "not enough memory");
+        return -1;
+    }
+
+    result = send_reply(fd, keep_alive, "application/json", data, len);
+    free(data);
+    return result;
+}
+
+/******************************************************************************
+Description.: Send the counters of the inputs and of the HTTP servers in the
+              text format of Prometheus
+Input Value.: fildescriptor fd to send the answer to, keep_alive to keep the
+              connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_metrics(int fd, int keep_alive)
+{
+    text_buffer b;
+    char labels[64];
+    memory_usage usage[32];
+    governor_state governor;
+    context *pc;
+    int i, n, result;
+    #ifdef MANAGMENT
+    client_info *c;
+    #endif
+
+    DBG("Serving the metrics\n");
+
+    b.len = 0;
+    b.size = BUFFER_SIZE * 4;
+    if((b.data = malloc(b.size)) == NULL)
+        return -1;
+
+    text_printf(&b, "# HELP mjpg_input_frames_total Frames published by the input.\n"
+                "# TYPE mjpg_input_frames_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        text_printf(&b, "mjpg_input_frames_total{input=\"%d\",name=\"", i);
+        text_label(&b, pglobal->in[i].name);
+        text_printf(&b, "\"} %llu\n", pglobal->in[i].stats.frames);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_bytes_total Bytes of the frames published by the input.\n"
+                "# TYPE mjpg_input_bytes_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_bytes_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.bytes);
+
+    text_printf(&b, "# HELP mjpg_input_encode_seconds Time spent compressing a frame to JPEG.\n"
+                "# TYPE mjpg_input_encode_seconds histogram\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        snprintf(labels, sizeof(labels), "input=\"%d\"", i);
+        text_histogram(&b, "mjpg_input_encode_seconds", labels, &pglobal->in[i].stats.encode_usec, 1e-6);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_latency_seconds Time a frame spent in each stage of the input.\n"
+                "# TYPE mjpg_input_latency_seconds histogram\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        snprintf(labels, sizeof(labels), "input=\"%d\",stage=\"dequeue\"", i);
+        text_histogram(&b, "mjpg_input_latency_seconds", labels, &pglobal->in[i].stats.dequeue_latency_usec, 1e-6);
+        snprintf(labels, sizeof(labels), "input=\"%d\",stage=\"encode\"", i);
+        text_histogram(&b, "mjpg_input_latency_seconds", labels, &pglobal->in[i].stats.encode_latency_usec, 1e-6);
+        snprintf(labels, sizeof(labels), "input=\"%d\",stage=\"publish\"", i);
+        text_histogram(&b, "mjpg_input_latency_seconds", labels, &pglobal->in[i].stats.publish_latency_usec, 1e-6);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_db_contended_total Times the frame lock of the input was busy.\n"
+                "# TYPE mjpg_input_db_contended_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_db_contended_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.db_contended);
+
+    text_printf(&b, "# HELP mjpg_input_db_wait_seconds_total Time spent waiting for the frame lock of the input.\n"
+                "# TYPE mjpg_input_db_wait_seconds_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_db_wait_seconds_total{input=\"%d\"} %g\n", i, (double)pglobal->in[i].stats.db_wait_usec * 1e-6);
+
+    text_printf(&b, "# HELP mjpg_input_capture_dropped_total Frames the capture device dropped for lack of a free buffer.\n"
+                "# TYPE mjpg_input_capture_dropped_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_capture_dropped_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.capture_dropped);
+
+    text_printf(&b, "# HELP mjpg_input_corrupt_dropped_total Broken frames the input dropped.\n"
+                "# TYPE mjpg_input_corrupt_dropped_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_corrupt_dropped_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.corrupt_dropped);
+
+    text_printf(&b, "# HELP mjpg_input_repeat_dropped_total Frames the input dropped as repeats of the previous one.\n"
+                "# TYPE mjpg_input_repeat_dropped_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_repeat_dropped_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.repeat_dropped);
+
+    text_printf(&b, "# HELP mjpg_input_device_failures_total Times the device of the input stopped working.\n"
+                "# TYPE mjpg_input_device_failures_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_device_failures_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.device_failures);
+
+    text_printf(&b, "# HELP mjpg_input_device_reopens_total Times the input got its device working again.\n"
+                "# TYPE mjpg_input_device_reopens_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_device_reopens_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.device_reopens);
+
+    text_printf(&b, "# HELP mjpg_input_device_down The device of the input failed and does not work again yet.\n"
+                "# TYPE mjpg_input_device_down gauge\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_device_down{input=\"%d\"} %d\n", i, pglobal->in[i].stats.device_down);
+
+    text_printf(&b, "# HELP mjpg_input_subscribers Consumers of the frames of the input.\n"
+                "# TYPE mjpg_input_subscribers gauge\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_subscribers{input=\"%d\"} %d\n", i, pglobal->in[i].subscribers);
+
+    text_printf(&b, "# HELP mjpg_input_idle The input stopped capturing for lack of subscribers.\n"
+                "# TYPE mjpg_input_idle gauge\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_idle{input=\"%d\"} %d\n", i, input_idle(&pglobal->in[i]));
+
+    text_printf(&b, "# HELP mjpg_input_capture_buffers Buffers queued to the capture device.\n"
+                "# TYPE mjpg_input_capture_buffers gauge\n");
+    for(i = 0; i < pglobal->incnt; i++)
+        text_printf(&b, "mjpg_input_capture_buffers{input=\"%d\"} %d\n", i, pglobal->in[i].stats.capture_buffers);
+
+    text_printf(&b, "# HELP mjpg_input_target_fps Frame rate a paced input aims for.\n"
+                "# TYPE mjpg_input_target_fps gauge\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].stats.target_fps > 0)
+            text_printf(&b, "mjpg_input_target_fps{input=\"%d\"} %g\n", i, pglobal->in[i].stats.target_fps);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_paced_fps Frame rate a paced input reached over the last second.\n"
+                "# TYPE mjpg_input_paced_fps gauge\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].stats.target_fps > 0)
+            text_printf(&b, "mjpg_input_paced_fps{input=\"%d\"} %g\n", i, pglobal->in[i].stats.paced_fps);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_pacing_late_total Frames a paced input was too late for, starting a new schedule.\n"
+                "# TYPE mjpg_input_pacing_late_total counter\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].stats.target_fps > 0)
+            text_printf(&b, "mjpg_input_pacing_late_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.pacing_late);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_jitter_seconds Smoothed deviation of the frame intervals of a relayed upstream.\n"
+                "# TYPE mjpg_input_jitter_seconds gauge\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].stats.playout_target_usec > 0)
+            text_printf(&b, "mjpg_input_jitter_seconds{input=\"%d\"} %g\n", i, pglobal->in[i].stats.jitter_usec / 1e6);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_playout_delay_seconds Delay the playout buffer of a relay adapted to.\n"
+                "# TYPE mjpg_input_playout_delay_seconds gauge\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].stats.playout_target_usec > 0)
+            text_printf(&b, "mjpg_input_playout_delay_seconds{input=\"%d\"} %g\n", i, pglobal->in[i].stats.playout_delay_usec / 1e6);
+    }
+
+    text_printf(&b, "# HELP mjpg_input_playout_depth Frames in the playout buffer of a relay.\n"
+                "# TYPE mjpg_input_playout_depth gauge\n");
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].stats.playout_target_usec > 0)
+            text_printf(&b, "mjpg_input_playout_depth{input=\"%d\"} %d\n", i, pglobal->in[i].stats.playout_depth);
+    }
+
+    governor_get(&governor);
+    if(governor.running) {
+        text_printf(&b, "# HELP mjpg_input_degrade_level Level the governor degraded the input to, 0 for none.\n"
+                    "# TYPE mjpg_input_degrade_level gauge\n");
+        for(i = 0; i < pglobal->incnt; i++)
+            text_printf(&b, "mjpg_input_degrade_level{input=\"%d\",level=\"%s\"} %d\n", i,
+                        degrade_name(pglobal->in[i].degrade), pglobal->in[i].degrade);
+
+        text_printf(&b, "# HELP mjpg_input_governor_skipped_total Frames the governor skipped or dropped.\n"
+                    "# TYPE mjpg_input_governor_skipped_total counter\n");
+        for(i = 0; i < pglobal->incnt; i++)
+            text_printf(&b, "mjpg_input_governor_skipped_total{input=\"%d\"} %llu\n", i, pglobal->in[i].stats.governor_skipped);
+
+        text_printf(&b, "# HELP mjpg_governor_temperature_celsius Temperature of the hottest thermal zone, -1 without one.\n"
+                    "# TYPE mjpg_governor_temperature_celsius gauge\n"
+                    "mjpg_governor_temperature_celsius %g\n", governor.temperature);
+        text_printf(&b, "# HELP mjpg_governor_load_percent Percent of the time the CPUs were busy in the last second.\n"
+                    "# TYPE mjpg_governor_load_percent gauge\n"
+                    "mjpg_governor_load_percent %g\n", governor.load);
+        text_printf(&b, "# HELP mjpg_governor_late_inputs Inputs which missed their encode deadline in the last second.\n"
+                    "# TYPE mjpg_governor_late_inputs gauge\n"
+                    "mjpg_governor_late_inputs %d\n", governor.late);
+        text_printf(&b, "# HELP mjpg_governor_actions_total Inputs the governor degraded or restored by a level.\n"
+                    "# TYPE mjpg_governor_actions_total counter\n"
+                    "mjpg_governor_actions_total %llu\n", governor.actions);
+    }
+
+    text_printf(&b, "# HELP mjpg_output_frames_total Frames an output plugin is done with.\n"
+                "# TYPE mjpg_output_frames_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++)
+        text_printf(&b, "mjpg_output_frames_total{output=\"%d\"} %llu\n", i, pglobal->out[i].stats.frames);
+
+    text_printf(&b, "# HELP mjpg_output_bytes_total Bytes of the frames an output plugin is done with.\n"
+                "# TYPE mjpg_output_bytes_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++)
+        text_printf(&b, "mjpg_output_bytes_total{output=\"%d\"} %llu\n", i, pglobal->out[i].stats.bytes);
+
+    text_printf(&b, "# HELP mjpg_output_overruns_total Frames an output plugin skipped because it fell behind.\n"
+                "# TYPE mjpg_output_overruns_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++)
+        text_printf(&b, "mjpg_output_overruns_total{output=\"%d\"} %llu\n", i, pglobal->out[i].stats.overruns);
+
+    text_printf(&b, "# HELP mjpg_output_backlog Frames an output plugin accepted, but is not done with yet.\n"
+                "# TYPE mjpg_output_backlog gauge\n");
+    for(i = 0; i < pglobal->outcnt; i++)
+        text_printf(&b, "mjpg_output_backlog{output=\"%d\"} %d\n", i, pglobal->out[i].stats.backlog);
+
+    text_printf(&b, "# HELP mjpg_http_frames_sent_total Stream frames sent to clients.\n"
+                "# TYPE mjpg_http_frames_sent_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        if(servers[i].pglobal != NULL)
+            text_printf(&b, "mjpg_http_frames_sent_total{output=\"%d\"} %llu\n", i, servers[i].stats.frames_sent);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_frames_dropped_total Stream frames skipped because a client was too slow.\n"
+                "# TYPE mjpg_http_frames_dropped_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        if(servers[i].pglobal != NULL)
+            text_printf(&b, "mjpg_http_frames_dropped_total{output=\"%d\"} %llu\n", i, servers[i].stats.frames_dropped);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_bytes_sent_total Bytes of the stream frames sent to clients.\n"
+                "# TYPE mjpg_http_bytes_sent_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        if(servers[i].pglobal != NULL)
+            text_printf(&b, "mjpg_http_bytes_sent_total{output=\"%d\"} %llu\n", i, servers[i].stats.bytes_sent);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_numa_bytes_total Bytes of the stream frames by the NUMA node they were sent from.\n"
+                "# TYPE mjpg_http_numa_bytes_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        if(servers[i].pglobal == NULL)
+            continue;
+        text_printf(&b, "mjpg_http_numa_bytes_total{output=\"%d\",placement=\"local\"} %llu\n", i, servers[i].stats.numa_local);
+        text_printf(&b, "mjpg_http_numa_bytes_total{output=\"%d\",placement=\"remote\"} %llu\n", i, servers[i].stats.numa_remote);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_stream_clients Clients currently receiving a stream.\n"
+                "# TYPE mjpg_http_stream_clients gauge\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        if(servers[i].pglobal != NULL)
+            text_printf(&b, "mjpg_http_stream_clients{output=\"%d\"} %d\n", i, servers[i].stats.stream_clients);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_send_seconds Time to hand a stream frame over to the kernel.\n"
+                "# TYPE mjpg_http_send_seconds histogram\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL)
+            continue;
+        snprintf(labels, sizeof(labels), "output=\"%d\"", i);
+        text_histogram(&b, "mjpg_http_send_seconds", labels, &pc->stats.send_usec, 1e-6);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_frame_age_seconds Age of a stream frame when the kernel took its last byte.\n"
+                "# TYPE mjpg_http_frame_age_seconds histogram\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL)
+            continue;
+        snprintf(labels, sizeof(labels), "output=\"%d\",since=\"publish\"", i);
+        text_histogram(&b, "mjpg_http_frame_age_seconds", labels, &pc->stats.publish_age_usec, 1e-6);
+        snprintf(labels, sizeof(labels), "output=\"%d\",since=\"capture\"", i);
+        text_histogram(&b, "mjpg_http_frame_age_seconds", labels, &pc->stats.capture_age_usec, 1e-6);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_send_queue_bytes Bytes still queued in the socket before a stream frame.\n"
+                "# TYPE mjpg_http_send_queue_bytes histogram\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL)
+            continue;
+        snprintf(labels, sizeof(labels), "output=\"%d\"", i);
+        text_histogram(&b, "mjpg_http_send_queue_bytes", labels, &pc->stats.queue_bytes, 1);
+    }
+
+    #ifdef HTTPS
+    text_printf(&b, "# HELP mjpg_http_tls_connections_total TLS connections by where they were encrypted.\n"
+                "# TYPE mjpg_http_tls_connections_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL || pc->tls == NULL)
+            continue;
+        text_printf(&b, "mjpg_http_tls_connections_total{output=\"%d\",mode=\"kernel\"} %llu\n", i, pc->stats.tls_kernel);
+        text_printf(&b, "mjpg_http_tls_connections_total{output=\"%d\",mode=\"userspace\"} %llu\n", i, pc->stats.tls_userspace);
+    }
+    #endif
+
+    text_printf(&b, "# HELP mjpg_http_refused_total Connections refused for the memory budget.\n"
+                "# TYPE mjpg_http_refused_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL || pc->conf.memory == 0)
+            continue;
+        text_printf(&b, "mjpg_http_refused_total{output=\"%d\"} %llu\n", i, pc->stats.refused);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_rejected_total Clients turned away by admission control.\n"
+                "# TYPE mjpg_http_rejected_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL || (pc->admit == NULL && pc->conf.max_streams == 0))
+            continue;
+        text_printf(&b, "mjpg_http_rejected_total{output=\"%d\",reason=\"connections\"} %llu\n", i, pc->stats.rejected[REJECT_CONNECTIONS]);
+        text_printf(&b, "mjpg_http_rejected_total{output=\"%d\",reason=\"rate\"} %llu\n", i, pc->stats.rejected[REJECT_RATE]);
+        text_printf(&b, "mjpg_http_rejected_total{output=\"%d\",reason=\"streams\"} %llu\n", i, pc->stats.rejected[REJECT_STREAMS]);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_pacing_changes_total Pacing rates set on stream sockets.\n"
+                "# TYPE mjpg_http_pacing_changes_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL || pc->conf.pacing == 0)
+            continue;
+        text_printf(&b, "mjpg_http_pacing_changes_total{output=\"%d\"} %llu\n", i, pc->stats.paced);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_adaptive_switches_total Tier switches of adaptive streams.\n"
+                "# TYPE mjpg_http_adaptive_switches_total counter\n");
+    for(i = 0; i < pglobal->outcnt; i++) {
+        pc = &servers[i];
+        if(pc->pglobal == NULL)
+            continue;
+        text_printf(&b, "mjpg_http_adaptive_switches_total{output=\"%d\"} %llu\n", i, pc->stats.adapted);
+    }
+
+    text_printf(&b, "# HELP mjpg_http_resident_bytes Resident memory of the process.\n"
+                "# TYPE mjpg_http_resident_bytes gauge\n"
+                "mjpg_http_resident_bytes %lld\n", resident_bytes());
+
+    n = memory_report(usage, LENGTH_OF(usage));
+    text_printf(&b, "# HELP mjpg_memory_bytes Memory held by each subsystem.\n"
+                "# TYPE mjpg_memory_bytes gauge\n");
+    for(i = 0; i < n; i++)
+        text_printf(&b, "mjpg_memory_bytes{subsystem=\"%s\"} %lld\n", usage[i].name, usage[i].used);
+    text_printf(&b, "# HELP mjpg_memory_evicted_bytes_total Memory evicted from each subsystem for the budget.\n"
+                "# TYPE mjpg_memory_evicted_bytes_total counter\n");
+    for(i = 0; i < n; i++)
+        text_printf(&b, "mjpg_memory_evicted_bytes_total{subsystem=\"%s\"} %lld\n", usage[i].name, usage[i].evicted);
+    text_printf(&b, "# HELP mjpg_memory_budget_bytes The memory budget, 0 without one.\n"
+                "# TYPE mjpg_memory_budget_bytes gauge\n"
+                "mjpg_memory_budget_bytes %lld\n", memory_budget());
+
+    #ifdef MANAGMENT
+    text_printf(&b, "# HELP mjpg_http_client_frames_sent_total Stream frames sent to a client address.\n"
+                "# TYPE mjpg_http_client_frames_sent_total counter\n");
+    for(c = __sync_fetch_and_add(&client_infos.first, 0); c != NULL; c = c->added) {
+        text_printf(&b, "mjpg_http_client_frames_sent_total{address=\"");
+        text_label(&b, c->address);
+        text_printf(&b, "\"} %llu\n", c->frames_sent);
+    }
+    text_printf(&b, "# HELP mjpg_http_client_frames_dropped_total Stream frames skipped for a client address.\n"
+                "# TYPE mjpg_http_client_frames_dropped_total counter\n");
+    for(c = __sync_fetch_and_add(&client_infos.first, 0); c != NULL; c = c->added) {
+        text_printf(&b, "mjpg_http_client_frames_dropped_total{address=\"");
+        text_label(&b, c->address);
+        text_printf(&b, "\"} %llu\n", c->frames_dropped);
+    }
+    #endif
+
+    if(b.data == NULL)
+        return -1;
+
+    result = send_reply(fd, keep_alive, "text/plain; version=0.0.4", b.data, b.len);
+    free(b.data);
+    return result;
+}
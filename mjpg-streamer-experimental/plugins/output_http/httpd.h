@@ -20,12 +20,15 @@
 #                                                                              #
 *******************************************************************************/
 
-#define IO_BUFFER 256
+#define REQUEST_BUFFER 8192
 #define BUFFER_SIZE 1024
 
 /* the boundary is used for the M-JPEG stream, it separates the multipart stream of pictures */
 #define BOUNDARY "boundarydonotcross"
 
+/* room for the X-Burst header field of a still taken in a burst */
+#define BURST_FIELD_SIZE 48
+
 /*
  * this defines the buffer size for a JPG-frame
  * selecting to large values will allocate much wasted RAM for each buffer
@@ -43,12 +46,101 @@
  * Many browser seem to ignore, or at least not always obey those headers
  * since i observed caching of files from time to time.
  */
-#define STD_HEADER "Connection: close\r\n" \
-    "Server: MJPG-Streamer/0.2\r\n" \
+#define STD_HEADER "Connection: close\r\n" STD_HEADER_FIELDS
+
+/* the standard header without the Connection field, for persistent connections */
+#define STD_HEADER_FIELDS "Server: MJPG-Streamer/0.2\r\n" \
     "Cache-Control: no-store, no-cache, must-revalidate, pre-check=0, post-check=0, max-age=0\r\n" \
     "Pragma: no-cache\r\n" \
     "Expires: Mon, 3 Jan 2000 12:34:56 GMT\r\n"
 
+/*
+ * Persistent connections are answered with HTTP/1.1, some clients like curl
+ * fall back to HTTP/1.0 requests without keep-alive after HTTP/1.0 answers.
+ */
+#define HTTP_MINOR(keep_alive) ((keep_alive) ? 1 : 0)
+
+/*
+ * snapshots carry an ETag naming the frame, so browsers may keep them but
+ * have to ask whether a newer frame exists before showing them again
+ */
+#define SNAPSHOT_HEADER_FIELDS "Server: MJPG-Streamer/0.2\r\n" \
+    "Cache-Control: no-cache\r\n"
+
+/*
+ * Frames smaller than this are copied into the socket even with -z,
+ * pinning their pages costs more than the copy.
+ * At most ZEROCOPY_PENDING zerocopy sends are in flight per client.
+ */
+#define ZEROCOPY_MIN_SIZE (16*1024)
+#define ZEROCOPY_PENDING 64
+
+/*
+ * stack of the threads serving clients. A request takes a few kB of it, the
+ * default of 8 MB per thread mostly costs address space, which runs out on
+ * 32 bit devices with a few hundred clients. Frames are never copied onto it.
+ */
+#define CLIENT_STACK_SIZE (256*1024)
+
+/*
+ * --pacing ignores gaps between frames longer than this, like a paused input,
+ * and never paces a socket slower than PACING_MIN_RATE bytes per second
+ */
+#define PACING_MAX_INTERVAL 1000000
+#define PACING_MIN_RATE (16*1024)
+
+/*
+ * -F starts at most FCGI_MAX_PROCESSES processes per FastCGI script, dead
+ * ones are started again at most once per FCGI_RESTART_USEC. The CGI header
+ * of an answer may take FCGI_HEADER_SIZE bytes. When the server stops, the
+ * processes which ignore SIGTERM are killed after FCGI_KILL_USEC.
+ */
+#define FCGI_MAX_PROCESSES 32
+#define FCGI_RESTART_USEC 1000000
+#define FCGI_HEADER_SIZE 4096
+#define FCGI_KILL_USEC 2000000
+
+/*
+ * addresses the admission control of -I and -R keeps track of, a power of
+ * two, and the slots an address may take
+ */
+#define ADMIT_SLOTS 4096
+#define ADMIT_PROBES 16
+
+/* why the admission control turned a client away, see httpd_admit.c */
+#define REJECT_CONNECTIONS 1    /* its address has -I connections open */
+#define REJECT_RATE 2           /* its address makes more requests than -R */
+#define REJECT_STREAMS 3        /* the server serves -S streams */
+#define REJECT_REASONS 4
+
+/*
+ * streams with tables=1 keep the JFIF, quantization and Huffman segments of
+ * the last frame, up to JPEG_TABLES_SIZE bytes. The segments an abbreviated
+ * image keeps in front of its scan may take JPEG_HEAD_SIZE.
+ */
+#define JPEG_TABLES_SIZE 2048
+#define JPEG_HEAD_SIZE (2 + FRAME_APP_SIZE + 512)
+
+/* inputs a single ?action=stream&inputs= may ask for */
+#define MAX_STREAM_INPUTS 16
+
+/*
+ * an adaptive stream waits ADAPT_SETTLE_USEC after a switch before it judges
+ * the new tier, and ADAPT_HOLD_USEC without late parts before it tries the
+ * next better one. A better tier given up within ADAPT_PROBE_USEC doubles
+ * the wait for the next try, up to ADAPT_MAX_HOLD_USEC.
+ */
+#define ADAPT_SETTLE_USEC 1000000ULL
+#define ADAPT_HOLD_USEC 4000000ULL
+#define ADAPT_PROBE_USEC 10000000ULL
+#define ADAPT_MAX_HOLD_USEC 64000000ULL
+
+/* --memory looks at the resident memory of the process at most this often */
+#define RESIDENT_INTERVAL_USEC 500000
+
+/* a snapshot of an idle input waits this long for the camera to start again */
+#define SNAPSHOT_WAKE_MSEC 3000
+
 /*
  * Maximum number of server sockets (i.e. protocol families) to listen.
  */
@@ -94,6 +186,15 @@ typedef enum {
     A_INPUT_JSON,
     A_OUTPUT_JSON,
     A_PROGRAM_JSON,
+    A_MOTION_JSON,
+    A_METRICS,
+    A_TRACE,
+    A_WEBSOCKET,
+    A_RECORDED,
+    A_HLS,
+    A_REPLAY,
+    A_CLIP,
+    A_FRAME,
     #ifdef MANAGMENT
     A_CLIENTS_JSON
     #endif
@@ -109,12 +210,20 @@ typedef struct {
     char *client;
     char *credentials;
     char *query_string;
+    char *if_none_match;
+    int accept_gzip;
+    int keep_alive;     /* the client wants to send further requests */
+    char *ws_key;       /* Sec-WebSocket-Key of an upgrade request */
+    int nowait;         /* snapshot with wait=0, do not wait for a first frame */
 } request;
 
 /* the iobuffer structure is used to read from the HTTP-client */
 typedef struct {
-    int level;              /* how full is the buffer */
-    char buffer[IO_BUFFER]; /* the data */
+    int level;                   /* how full is the buffer */
+    int parsed;                  /* start of the first line not scanned yet */
+    int header;                  /* length of the complete header, 0 before */
+    int next;                    /* next line for http_header_line() */
+    char buffer[REQUEST_BUFFER]; /* the header first, pipelined requests after it */
 } iobuffer;
 
 /* store configuration for each server instance */
@@ -124,8 +233,54 @@ typedef struct {
     char *credentials;
     char *www_folder;
     char nocommands;
+    char cork;          /* set TCP_CORK while a frame is being sent */
+    char zerocopy;      /* send frames with MSG_ZEROCOPY */
+    int stall_timeout;  /* seconds a stream may not make progress, 0 to wait forever */
+    int event_loop;     /* number of event loop threads, 0 for a thread per client */
+    int workers;        /* number of threads serving requests, 0 for a thread per client */
+    int listeners;      /* number of SO_REUSEPORT listeners with an accept thread each */
+    int backlog;        /* length of the queue of pending connections of each listener */
+    char *certificate;  /* PEM file with the certificate chain, enables HTTPS */
+    char *private_key;  /* PEM file with the key, NULL if it is in the certificate file */
+    char *recorded;     /* folder of output_file --partition served by ?action=recorded */
+    long long memory;   /* refuse clients while the process has more resident bytes, 0 for no limit */
+    int pacing;         /* percent of the frame interval a frame is spread across, 0 to send it at once */
+    char adaptive;      /* streams without scale, q or crop adapt to the link of their client */
+    int fastcgi;        /* FastCGI processes per CGI script, 0 to run a script per request */
+    int fastcgi_timeout; /* seconds a FastCGI request may take */
+    int ip_connections; /* connections an address may have open, 0 for no limit */
+    int rate;           /* requests per second of an address, 0 for no limit */
+    int burst;          /* requests an address may make at once */
+    int max_streams;    /* streams the server serves at a time, 0 for no limit */
 } config;
 
+/* counters of a server, exported by ?action=metrics */
+typedef struct {
+    unsigned long long frames_sent;     /* stream parts sent to clients */
+    unsigned long long frames_dropped;  /* frames skipped because clients were too slow */
+    unsigned long long bytes_sent;      /* bytes of the frames sent */
+    unsigned long long numa_local;      /* of those, sent from the NUMA node of the frame */
+    unsigned long long numa_remote;     /* sent from another node */
+    int stream_clients;                 /* streams being served */
+    histogram send_usec;                /* time to hand a part over to the kernel */
+    histogram queue_bytes;              /* bytes still queued in the socket before a part */
+    histogram publish_age_usec;         /* time from publishing a frame until it was sent */
+    histogram capture_age_usec;         /* time from capturing a frame until it was sent */
+    unsigned long long tls_kernel;      /* TLS connections encrypted by the kernel */
+    unsigned long long tls_userspace;   /* TLS connections encrypted by a proxy thread */
+    unsigned long long refused;         /* connections refused for the --memory budget */
+    unsigned long long paced;           /* pacing rates set on stream sockets */
+    unsigned long long adapted;         /* tier switches of adaptive streams */
+    unsigned long long rejected[REJECT_REASONS]; /* clients turned away by admission control */
+} http_stats;
+
+typedef struct _event_worker event_worker;
+typedef struct _www_cache www_cache;
+typedef struct _request_pool request_pool;
+typedef struct _tls_server tls_server;
+typedef struct _fcgi_pool fcgi_pool;
+typedef struct _admit_table admit_table;
+
 /* context of each server thread */
 typedef struct {
     int sd[MAX_SD_LEN];
@@ -135,27 +290,140 @@ typedef struct {
     pthread_t threadID;
 
     config conf;
+
+    /* event loop threads which serve the streams, see httpd_event.c */
+    event_worker *workers;
+    unsigned int next_worker;
+
+    /* files of the www folder kept in memory, see httpd_cache.c */
+    www_cache *cache;
+
+    /* threads serving short requests, see httpd_pool.c */
+    request_pool *pool;
+
+    /* certificate and key for HTTPS, see httpd_tls.c */
+    tls_server *tls;
+
+    /* processes serving the CGI scripts with -F, see httpd_fcgi.c */
+    fcgi_pool *fcgi;
+
+    /* connections and request rates of the client addresses, see httpd_admit.c */
+    admit_table *admit;
+
+    http_stats stats;
 } context;
 
 
+/* the tables a client of an abbreviated stream has, see httpd_tables.c */
+typedef struct {
+    unsigned char tables[JPEG_TABLES_SIZE]; /* SOI, the table segments, EOI */
+    int tables_len;                     /* 0 before the first tables */
+    int changed;                        /* the last frame came with other tables */
+    unsigned char head[JPEG_HEAD_SIZE]; /* SOI and the other segments before the scan */
+    int head_len;
+    size_t offset;                      /* where the frame continues after head */
+} jpeg_tables;
+
 #if defined(MANAGMENT)
 /*
  * this struct is used to hold information from the clients address, and last picture take time
  */
 typedef struct _client_info {
-    struct _client_info *next;
+    struct _client_info *next;          /* next entry of the same hash bucket */
+    struct _client_info *added;         /* next entry in the order they were added */
     char *address;
-    struct timeval last_take_time;
+    unsigned long long last_take_time;  /* usec since the epoch, updated atomically */
+    unsigned long long frames_sent;     /* stream frames sent to this address */
+    unsigned long long frames_dropped;  /* skipped because the client was too slow */
+    int streams;                        /* streams being sent to this address */
+    long long memory;                   /* bytes the threads or event loop entries of them take */
+    long long queued;                   /* bytes waiting in their socket queues */
 } client_info;
 
-struct {
-    client_info **infos;
+#define CLIENT_BUCKETS 1024             /* a power of two */
+
+/*
+ * entries are never removed, so lookups and walks need no lock, the mutex
+ * only serializes adding
+ */
+struct _client_infos {
+    client_info *buckets[CLIENT_BUCKETS];
+    client_info *first;
+    client_info **last;
     unsigned int client_count;
     pthread_mutex_t mutex;
-} client_infos;
+};
+
+/* defined in httpd.c */
+extern struct _client_infos client_infos;
 
 #endif
 
+/*
+ * frames sent with MSG_ZEROCOPY must stay untouched until the kernel reports
+ * that it is done with them, this keeps a reference to them in the meantime
+ */
+typedef struct {
+    int enabled;
+    unsigned int next_id;                       /* id of the next zerocopy send */
+    unsigned int first_id;                      /* id of pending[first] */
+    int first, count;
+    input_frame *pending[ZEROCOPY_PENDING];
+    char done[ZEROCOPY_PENDING];
+} zerocopy_state;
+
+/*
+ * per client limit of the frame rate of a stream, requested with the
+ * "fps" and "every" parameters of ?action=stream
+ */
+typedef struct {
+    int fps;                                    /* at most this many frames per second, 0 for no limit */
+    int every;                                  /* only every n-th frame of the input, 0 or 1 for all */
+    struct timeval next;                        /* frames older than this are not due yet */
+    unsigned long long seq;                     /* sequence number of the last frame sent */
+} stream_throttle;
+
+/*
+ * pacing of a stream socket with SO_MAX_PACING_RATE, so that a frame is
+ * spread across a part of the frame interval instead of leaving in one burst
+ */
+typedef struct {
+    unsigned long long seq;         /* sequence number of the last frame sent */
+    unsigned long long usec;        /* when it was published */
+    unsigned long long interval;    /* average usec between frames of the input */
+    unsigned int rate;              /* bytes per second set on the socket, 0 for none */
+    int failed;                     /* the socket takes no pacing rate */
+} stream_pacing;
+
+/*
+ * a stream which picks the tier of its frames from the throughput of the
+ * link of its client, see httpd_adapt.c. It is requested with "adapt=1" of
+ * ?action=stream, or given to all streams with --adaptive.
+ */
+typedef struct {
+    int enabled;
+    int tier;                       /* rung of the ladder, 0 for the frames as they are */
+    int every;                      /* every n-th frame the client asked for, the tier multiplies it */
+    unsigned long long seq;         /* sequence number of the last frame sent */
+    unsigned long long usec;        /* when it was published */
+    unsigned long long interval;    /* average usec between frames of the input */
+    unsigned long long size;        /* average bytes of a part of the tier */
+    unsigned long long capacity;    /* bytes per second the link delivered as the bottleneck, 0 if unknown */
+    int late;                       /* share of the recent parts which were late, in 1/256 */
+    unsigned long long switched;    /* monotonic_usec() of the last switch */
+    unsigned long long raised;      /* of the last step to a better tier, 0 after a step down */
+    unsigned long long good_since;  /* no part was late since then */
+    unsigned long long hold;        /* usec without late parts before a better tier is tried */
+} stream_adapt;
+
+/* left, top, width and height of the region of a cropped stream */
+typedef struct {
+    int x, y, w, h;
+} crop_rect;
+
+/* the frames cropped to one region, shared by its clients */
+typedef struct _crop_variant crop_variant;
+
 /*
  * this struct is just defined to allow passing all necessary details to a worker thread
  * "cfd" is for connected/accepted filedescriptor
@@ -166,23 +434,137 @@ typedef struct {
     #ifdef MANAGMENT
     client_info *client;
     #endif
+    stream_throttle throttle;
+    int scale;          /* denominator of the size of a stream, 1 for full size */
+    crop_rect crop;     /* region of a stream, a width of 0 for the whole picture */
+    int quality;        /* requantized tier of a stream, 0 for the frames as they are */
+    stream_adapt adapt; /* scale, quality and every follow the link of the client */
+    int pooled;         /* served by a worker of the request pool */
+    int admitted;       /* slot of its address in the admission table, -1 if not counted */
+    int stream_reserved;    /* admit_stream() counted a stream which has not started yet */
+    int tables;         /* tables=1, frames go out as abbreviated JPEGs */
+    int inputs[MAX_STREAM_INPUTS];  /* of ?action=stream&inputs= */
+    int input_count;    /* number of them, 0 for a stream of a single input */
+    int replay_sec;     /* seconds of ?action=replay or ?action=trace, 0 for all kept */
+    int replay_fast;    /* the replay goes out without the pace of the input */
 } cfd;
 
 
 
 /* prototypes */
+int httpd_init(globals *global);
 void *server_thread(void *arg);
+void *client_thread(void *arg);
+int client_thread_start(void *(*function)(void *), void *arg);
 void send_error(int fd, int which, char *message);
-void send_output_JSON(int fd, int plugin_number);
-void send_input_JSON(int fd, int plugin_number);
-void send_program_JSON(int fd);
+const char *connection_field(int keep_alive);
+int send_output_JSON(int fd, int plugin_number, int keep_alive);
+int send_input_JSON(int fd, int plugin_number, int keep_alive);
+int send_program_JSON(int fd, int keep_alive);
+int send_motion_JSON(int fd, int input_number, int keep_alive);
+int send_hls(cfd *context_fd, int input_number, const char *parameter, int keep_alive);
 void check_JSON_string(char *source, char *destination);
+int stream_header(char *buffer, int wxp);
+int stream_part_header(char *buffer, input_frame *frame, int wxp);
+int abbreviated_part_header(char *buffer, input_frame *frame, const jpeg_tables *a);
+int stream_frame_due(stream_throttle *throttle, input_frame *frame);
+void stream_set_timeout(cfd *context_fd);
+int write_part(cfd *context_fd, zerocopy_state *zc, char *head, int head_len, input_frame *frame, char *tail, int tail_len);
+int write_part_at(cfd *context_fd, zerocopy_state *zc, char *head, int head_len, input_frame *frame, size_t offset, char *tail, int tail_len);
+void stream_pace(context *pc, int fd, stream_pacing *pacing, input_frame *frame);
+int stream_stats_begin(context *pc, int fd, int input, input_frame *frame);
+void stream_stats_part(context *pc, int fd, int input, input_frame *frame, unsigned long long dropped, unsigned long long usec);
+int send_metrics(int fd, int keep_alive);
+int send_trace(int fd, int keep_alive, int seconds);
+void zerocopy_init(int fd, zerocopy_state *zc, int enable);
+ssize_t zerocopy_send(int fd, zerocopy_state *zc, input_frame *frame, size_t offset, int flags);
+void zerocopy_reap(int fd, zerocopy_state *zc);
+void zerocopy_release(int fd, zerocopy_state *zc);
+
+/* httpd_event.c */
+int event_loop_start(context *pc);
+int event_loop_add_stream(cfd *context_fd, int input_number, int wxp);
+
+/* httpd_replay.c */
+void send_replay(cfd *context_fd, int input_number);
+int send_clip(cfd *context_fd, int input_number, const char *parameter, int keep_alive);
+int send_replay_frame(cfd *context_fd, int input_number, const char *parameter, int keep_alive);
+
+/* httpd_ws.c */
+int websocket_accept(int fd, const char *key);
+void send_websocket(cfd *context_fd, int input_number);
+
+#ifdef HTTPS
+/* httpd_tls.c */
+int tls_server_init(context *pc);
+int tls_accept(cfd *context_fd);
+#endif
+
+/* httpd_request.c */
+void init_iobuffer(iobuffer *iobuf);
+int http_parse_header(iobuffer *iobuf);
+int http_read_header(int fd, iobuffer *iobuf, int timeout);
+int http_header_line(iobuffer *iobuf, char *line, size_t len);
+void http_header_done(iobuffer *iobuf);
+
+/* httpd_pool.c */
+int request_pool_start(context *pc);
+int request_pool_add(context *pc, cfd *pcfd);
+
+/* httpd_tables.c */
+int jpeg_abbreviate(jpeg_tables *a, const input_frame *frame);
+int jpeg_abbreviated_length(const jpeg_tables *a, const input_frame *frame);
+
+/* httpd_admit.c */
+struct sockaddr;
+int admit_init(context *pc);
+int admit_client(context *pc, const struct sockaddr *addr, cfd *client);
+int admit_request(cfd *client);
+int admit_stream(cfd *client);
+void admit_stream_start(cfd *client);
+void admit_release(context *pc, int slot);
+void close_client(cfd *client);
+
+/* httpd_fcgi.c */
+int fcgi_pool_init(context *pc);
+void fcgi_execute(context *pc, int fd, const char *parameter, const char *query_string);
+void fcgi_pool_stop(context *pc);
+
+/* httpd_cache.c */
+int www_cache_load(context *pc);
+int www_cache_send(context *pc, int fd, request *req);
+void www_cache_stop(context *pc);
+
+/* httpd_scale.c */
+int scale_parameter(const char *line);
+int scale_subscribe(int input_number, int denom);
+void scale_unsubscribe(int input_number, int denom);
+input_frame *scale_frame(int input_number, int denom, input_frame *frame);
+void scale_stop(void);
+int quality_parameter(const char *line);
+int quality_subscribe(int input_number, int tier);
+void quality_unsubscribe(int input_number, int tier);
+input_frame *quality_frame(int input_number, int tier, input_frame *frame);
+int crop_parameter(const char *line, crop_rect *rect);
+crop_variant *crop_subscribe(int input_number, crop_rect *rect);
+void crop_unsubscribe(crop_variant *v);
+input_frame *crop_frame(crop_variant *v, input_frame *frame);
+int variant_due(int input_number, int denom, int tier, crop_variant *crop, input_frame *frame);
+
+/* httpd_adapt.c */
+void adapt_init(stream_adapt *a, int enabled, int every);
+void adapt_every(cfd *context_fd, int every);
+void adapt_update(cfd *context_fd, int input_number, frame_subscription *sub, input_frame *frame, unsigned long long skipped);
 
 #ifdef MANAGMENT
 client_info *add_client(char *address);
 int check_client_status(client_info *client);
+void delay_client(client_info *client);
 void update_client_timestamp(client_info *client);
-void send_clients_JSON(int fd);
+void update_client_frames(client_info *client, unsigned long long dropped);
+void update_client_queue(client_info *client, int *last, int queued);
+void update_client_stream(client_info *client, long long memory, int queued);
+int send_clients_JSON(int fd, int keep_alive);
 #endif
 
 
@@ -0,0 +1,265 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Adaptive streams (parameter adapt=1, or --adaptive for all streams)
+ *
+ * Instead of a fixed scale or quality an adaptive stream climbs up and down
+ * a ladder of the variants of httpd_scale.c, and below the smallest one of
+ * fewer frames. A part is late when frames were skipped because the client
+ * still took the one before, or when more than half a part of the frames
+ * before is still waiting in the socket. Once most of the recent parts were
+ * late the stream steps down, as far as the delivery rate TCP measured for
+ * the link suggests. After a while without late parts it tries the next
+ * better tier; one which does not hold makes it wait longer for the next try.
+ * Switches happen between two frames, the variants are shared with all other
+ * clients of the same tier.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+/* frames further apart do not count for the interval of the input */
+#define ADAPT_MAX_INTERVAL 1000000ULL
+
+/*
+ * the tiers from the best down, the quality is a tier of quality_frame().
+ * share is about the bytes per second a tier needs, in 1/1000 of the first.
+ */
+static const struct {
+    int scale;
+    int quality;
+    int every;
+    int share;
+} ladder[] = {
+    { 1, 0, 1, 1000 },          /* the frames as they are */
+    { 1, 3, 1,  700 },          /* q=high */
+    { 1, 2, 1,  450 },          /* q=mid */
+    { 2, 0, 1,  250 },          /* scale=1/2 */
+    { 4, 0, 1,   80 },          /* scale=1/4 */
+    { 8, 0, 1,   30 },          /* scale=1/8 */
+    { 8, 0, 2,   15 },          /* and every 2nd frame */
+    { 8, 0, 4,    8 },          /* and every 4th frame */
+};
+
+#define ADAPT_TIERS ((int)LENGTH_OF(ladder))
+
+/******************************************************************************
+Description.: set up the adaptation of a stream
+Input Value.: * a......: the state of the stream
+              * enabled: nonzero to adapt
+              * every..: every n-th frame the client asked for, 0 for all
+Return Value: -
+******************************************************************************/
+void adapt_init(stream_adapt *a, int enabled, int every)
+{
+    memset(a, 0, sizeof(*a));
+    a->enabled = enabled;
+    a->every = MAX(every, 1);
+    a->hold = ADAPT_HOLD_USEC;
+}
+
+/******************************************************************************
+Description.: change the every n-th frame the client asked for, the tier of
+              an adaptive stream keeps skipping its frames on top of it
+Input Value.: * context_fd: the client
+              * every.....: the new value, 0 for all frames
+Return Value: -
+******************************************************************************/
+void adapt_every(cfd *context_fd, int every)
+{
+    stream_adapt *a = &context_fd->adapt;
+
+    if(!a->enabled) {
+        context_fd->throttle.every = every;
+        return;
+    }
+
+    a->every = MAX(every, 1);
+    context_fd->throttle.every = a->every * ladder[a->tier].every;
+}
+
+/******************************************************************************
+Description.: what the socket tells about the link: the bytes not sent yet
+              and the rate TCP delivered the last data at
+Input Value.: * fd.......: the client socket
+              * backlog..: gets the bytes waiting, 0 if the socket does not tell
+              * rate.....: gets bytes per second, 0 if unknown
+              * limited..: gets nonzero if the rate was limited by the sender,
+                           not by the link
+Return Value: -
+******************************************************************************/
+static void link_state(int fd, unsigned long long *backlog, unsigned long long *rate, int *limited)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    int queued;
+
+    *backlog = 0;
+    *rate = 0;
+    *limited = 1;
+
+    /* older kernels fill in less of it, HTTPS proxies are no TCP sockets */
+    memset(&info, 0, sizeof(info));
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+        len = 0;
+
+    if(len >= offsetof(struct tcp_info, tcpi_notsent_bytes) + sizeof(info.tcpi_notsent_bytes))
+        *backlog = info.tcpi_notsent_bytes;
+    else if(ioctl(fd, SIOCOUTQ, &queued) == 0)
+        *backlog = queued;
+
+    if(len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate)) {
+        *rate = info.tcpi_delivery_rate;
+        *limited = info.tcpi_delivery_rate_app_limited;
+    }
+}
+
+/******************************************************************************
+Description.: move a stream to another tier, its variants are subscribed
+              before the ones of the old tier are released
+Input Value.: * context_fd..: the client
+              * input_number: the input of the stream
+              * sub.........: the subscription of the stream
+              * tier........: the new tier
+              * now.........: monotonic_usec()
+Return Value: 0 if ok, -1 if the tier is not supported
+******************************************************************************/
+static int switch_tier(cfd *context_fd, int input_number, frame_subscription *sub, int tier, unsigned long long now)
+{
+    stream_adapt *a = &context_fd->adapt;
+
+    if(scale_subscribe(input_number, ladder[tier].scale) < 0)
+        return -1;
+    if(quality_subscribe(input_number, ladder[tier].quality) < 0) {
+        scale_unsubscribe(input_number, ladder[tier].scale);
+        return -1;
+    }
+    scale_unsubscribe(input_number, context_fd->scale);
+    quality_unsubscribe(input_number, context_fd->quality);
+
+    DBG("stream of fd %d from tier %d to %d\n", context_fd->fd, a->tier, tier);
+    context_fd->scale = ladder[tier].scale;
+    context_fd->quality = ladder[tier].quality;
+    context_fd->throttle.every = a->every * ladder[tier].every;
+    sub->every = context_fd->throttle.every;
+
+    a->tier = tier;
+    a->switched = now;
+    a->good_since = now;
+    a->size = 0;
+    a->late = 0;
+    a->capacity = 0;
+    __sync_fetch_and_add(&context_fd->pc->stats.adapted, 1);
+    return 0;
+}
+
+/******************************************************************************
+Description.: judge how the link keeps up with a part about to be sent and
+              pick the tier of the next frames
+Input Value.: * context_fd..: the client, scale, quality and every of the
+                              stream may change
+              * input_number: the input of the stream
+              * sub.........: the subscription of the stream
+              * frame.......: the part, already of the tier
+              * skipped.....: frames skipped before it
+Return Value: -
+******************************************************************************/
+void adapt_update(cfd *context_fd, int input_number, frame_subscription *sub, input_frame *frame, unsigned long long skipped)
+{
+    stream_adapt *a = &context_fd->adapt;
+    unsigned long long now, usec, backlog, rate, need, period;
+    int limited, late, tier;
+
+    if(!a->enabled)
+        return;
+
+    now = monotonic_usec();
+    if(a->switched == 0)
+        a->switched = a->good_since = now;
+
+    /* the interval of the input, frames the stream skips do not stretch it */
+    if(a->seq != 0 && frame->seq > a->seq && frame->publish_usec > a->usec) {
+        usec = (frame->publish_usec - a->usec) / (frame->seq - a->seq);
+        if(usec <= ADAPT_MAX_INTERVAL)
+            a->interval = (a->interval == 0) ? usec : (a->interval * 7 + usec) / 8;
+    }
+    a->seq = frame->seq;
+    a->usec = frame->publish_usec;
+    a->size = (a->size == 0) ? frame_length(frame) : (a->size * 7 + frame_length(frame)) / 8;
+
+    link_state(context_fd->fd, &backlog, &rate, &limited);
+    if(rate > 0 && !limited)
+        a->capacity = (a->capacity == 0) ? rate : (a->capacity * 3 + rate) / 4;
+
+    late = (skipped > 0 || backlog > a->size / 2);
+    a->late = (a->late * 7 + (late ? 256 : 0)) / 8;
+    if(late)
+        a->good_since = now;
+
+    /* a new tier first has to show how it does */
+    if(now - a->switched < ADAPT_SETTLE_USEC || a->interval == 0)
+        return;
+
+    /* bytes per second the tier needs to send every frame due */
+    period = a->interval * context_fd->throttle.every;
+    if(context_fd->throttle.fps > 0)
+        period = MAX(period, 1000000ULL / context_fd->throttle.fps);
+    need = a->size * 1000000ULL / MAX(period, 1);
+
+    if(a->late > 128 && a->tier < ADAPT_TIERS - 1) {
+        /* down by one, or further if the link is known to be too slow for that */
+        tier = a->tier + 1;
+        while(a->capacity > 0 && tier < ADAPT_TIERS - 1 &&
+              need * ladder[tier].share / ladder[a->tier].share > a->capacity * 4 / 5)
+            tier++;
+
+        /* a better tier which did not hold is tried later next time */
+        if(a->raised != 0 && now - a->raised < ADAPT_PROBE_USEC)
+            a->hold = MIN(a->hold * 2, ADAPT_MAX_HOLD_USEC);
+        else
+            a->hold = ADAPT_HOLD_USEC;
+        a->raised = 0;
+
+        while(tier < ADAPT_TIERS && switch_tier(context_fd, input_number, sub, tier, now) < 0)
+            tier++;
+    } else if(a->tier > 0 && a->late < 32 && now - a->good_since >= a->hold) {
+        for(tier = a->tier - 1; tier >= 0; tier--) {
+            if(switch_tier(context_fd, input_number, sub, tier, now) == 0) {
+                a->raised = now;
+                break;
+            }
+        }
+    }
+}
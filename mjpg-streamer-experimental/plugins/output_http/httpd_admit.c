@@ -0,0 +1,309 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Admission control of the server (options -I, -R, -B and -S)
+ *
+ * A client opening hundreds of connections or polling snapshots as fast as it
+ * can would take a thread, a stack and buffers for each of them before any of
+ * the other checks run. The listener looks the address of a new connection up
+ * in a small table instead, right after accept(), and turns it away there when
+ * the address already has -I connections open or its token bucket is empty. A
+ * bucket holds up to -B tokens and gains -R of them per second, each accepted
+ * connection and each further request on a persistent one takes a token.
+ * Connections over the cap are reset without a word, those over the rate get
+ * a plain 503. -S caps the streams of the server, a slot is reserved once
+ * the request says it is one and taken over when the stream starts.
+ *
+ * The table has ADMIT_SLOTS entries under a single mutex, held for a few
+ * compares. Entries of addresses without connections and with a full bucket
+ * carry no state and are taken over by other addresses. When all slots an
+ * address may use are taken, it is let in without accounting rather than
+ * locking out legitimate viewers.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+typedef struct {
+    unsigned char addr[16];         /* IPv4 addresses take the first 4 bytes */
+    int used;                       /* the entry belongs to addr */
+    int connections;                /* open connections of the address */
+    double tokens;                  /* requests it may make right now */
+    unsigned long long refilled;    /* monotonic_usec() tokens were added last */
+} admit_entry;
+
+struct _admit_table {
+    pthread_mutex_t mutex;
+    admit_entry entries[ADMIT_SLOTS];
+};
+
+/******************************************************************************
+Description.: set up the admission control of a server if one of its limits
+              is set
+Input Value.: the server context
+Return Value: 0 on success, -1 without memory
+******************************************************************************/
+int admit_init(context *pc)
+{
+    admit_table *table;
+
+    if(pc->conf.ip_connections == 0 && pc->conf.rate == 0)
+        return 0;
+
+    if((table = calloc(1, sizeof(admit_table))) == NULL)
+        return -1;
+    pthread_mutex_init(&table->mutex, NULL);
+
+    pc->admit = table;
+    return 0;
+}
+
+/******************************************************************************
+Description.: add the tokens a bucket gained since it was refilled last
+Input Value.: * pc..: the server context
+              * e...: the entry of the address
+              * now.: monotonic_usec()
+Return Value: -
+******************************************************************************/
+static void refill(context *pc, admit_entry *e, unsigned long long now)
+{
+    e->tokens += (now - e->refilled) * pc->conf.rate / 1e6;
+    if(e->tokens > pc->conf.burst)
+        e->tokens = pc->conf.burst;
+    e->refilled = now;
+}
+
+/******************************************************************************
+Description.: take a token of the bucket of an entry, with the lock held
+Input Value.: * pc..: the server context
+              * e...: the entry of the address
+              * now.: monotonic_usec()
+Return Value: 0 if there was one, -1 if the address makes too many requests
+******************************************************************************/
+static int take_token(context *pc, admit_entry *e, unsigned long long now)
+{
+    if(pc->conf.rate == 0)
+        return 0;
+
+    refill(pc, e, now);
+    if(e->tokens < 1.0)
+        return -1;
+    e->tokens -= 1.0;
+    return 0;
+}
+
+/******************************************************************************
+Description.: look the address of a new connection up and count the
+              connection if it may be served
+Input Value.: * pc....: the server context
+              * addr..: address of the client
+              * client: its cfd, admitted gets the slot of the address
+Return Value: 0 to serve the client, otherwise REJECT_CONNECTIONS or
+              REJECT_RATE
+******************************************************************************/
+int admit_client(context *pc, const struct sockaddr *addr, cfd *client)
+{
+    admit_table *table = pc->admit;
+    unsigned long long now = monotonic_usec();
+    unsigned char key[16] = {0};
+    unsigned int hash = 2166136261u;
+    admit_entry *e, *free_entry = NULL;
+    int i, slot = -1, ret = 0;
+
+    client->admitted = -1;
+    client->stream_reserved = 0;
+    if(table == NULL)
+        return 0;
+
+    /* IPv4 clients of an IPv6 socket count as the IPv4 address they are */
+    if(addr->sa_family == AF_INET) {
+        memcpy(key, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+    } else if(addr->sa_family == AF_INET6) {
+        const struct in6_addr *a6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+        if(IN6_IS_ADDR_V4MAPPED(a6))
+            memcpy(key, a6->s6_addr + 12, 4);
+        else
+            memcpy(key, a6->s6_addr, 16);
+    } else {
+        return 0;
+    }
+
+    for(i = 0; i < 16; i++)
+        hash = (hash ^ key[i]) * 16777619u;
+
+    pthread_mutex_lock(&table->mutex);
+    for(i = 0; i < ADMIT_PROBES; i++) {
+        e = &table->entries[(hash + i) & (ADMIT_SLOTS - 1)];
+        if(e->used && memcmp(e->addr, key, sizeof(key)) == 0) {
+            slot = (hash + i) & (ADMIT_SLOTS - 1);
+            break;
+        }
+        /* an address without connections and with a full bucket left no trace */
+        if(free_entry == NULL && e->used && e->connections == 0) {
+            refill(pc, e, now);
+            if(pc->conf.rate == 0 || e->tokens >= pc->conf.burst)
+                e->used = 0;
+        }
+        if(free_entry == NULL && !e->used) {
+            free_entry = e;
+            slot = (hash + i) & (ADMIT_SLOTS - 1);
+        }
+    }
+
+    if(slot < 0) {
+        DBG("admission table full, serving a client without accounting\n");
+        pthread_mutex_unlock(&table->mutex);
+        return 0;
+    }
+
+    e = &table->entries[slot];
+    if(!e->used) {
+        memcpy(e->addr, key, sizeof(key));
+        e->used = 1;
+        e->connections = 0;
+        e->tokens = pc->conf.burst;
+        e->refilled = now;
+    }
+
+    if(pc->conf.ip_connections > 0 && e->connections >= pc->conf.ip_connections) {
+        ret = REJECT_CONNECTIONS;
+    } else if(take_token(pc, e, now) < 0) {
+        ret = REJECT_RATE;
+    } else {
+        e->connections++;
+        client->admitted = slot;
+    }
+    pthread_mutex_unlock(&table->mutex);
+
+    if(ret != 0)
+        __sync_fetch_and_add(&pc->stats.rejected[ret], 1);
+    return ret;
+}
+
+/******************************************************************************
+Description.: take a token for a further request on a persistent connection
+Input Value.: the client
+Return Value: 0 to answer the request, -1 if its address makes too many
+******************************************************************************/
+int admit_request(cfd *client)
+{
+    admit_table *table = client->pc->admit;
+    int ret;
+
+    if(table == NULL || client->admitted < 0)
+        return 0;
+
+    pthread_mutex_lock(&table->mutex);
+    ret = take_token(client->pc, &table->entries[client->admitted], monotonic_usec());
+    pthread_mutex_unlock(&table->mutex);
+
+    if(ret < 0)
+        __sync_fetch_and_add(&client->pc->stats.rejected[REJECT_RATE], 1);
+    return ret;
+}
+
+/******************************************************************************
+Description.: reserve a slot of the stream limit of the server before a
+              stream starts, the stream counts from now on so concurrent
+              requests can not pass the limit together
+Input Value.: the client
+Return Value: 0 if the stream may start, -1 if the server has -S of them
+******************************************************************************/
+int admit_stream(cfd *client)
+{
+    context *pc = client->pc;
+    int streams;
+
+    if(client->stream_reserved)
+        return 0;
+
+    do {
+        streams = __atomic_load_n(&pc->stats.stream_clients, __ATOMIC_RELAXED);
+        if(pc->conf.max_streams > 0 && streams >= pc->conf.max_streams) {
+            __sync_fetch_and_add(&pc->stats.rejected[REJECT_STREAMS], 1);
+            return -1;
+        }
+    } while(!__sync_bool_compare_and_swap(&pc->stats.stream_clients, streams, streams + 1));
+
+    client->stream_reserved = 1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: a stream starts, it takes over the slot admit_stream() reserved
+              and gives it back when it ends
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+void admit_stream_start(cfd *client)
+{
+    if(!client->stream_reserved)
+        __sync_fetch_and_add(&client->pc->stats.stream_clients, 1);
+    client->stream_reserved = 0;
+}
+
+/******************************************************************************
+Description.: the connection of a client was closed, it no longer counts
+              for its address
+Input Value.: * pc...: the server context
+              * slot.: cfd.admitted of the client
+Return Value: -
+******************************************************************************/
+void admit_release(context *pc, int slot)
+{
+    admit_table *table = pc->admit;
+
+    if(table == NULL || slot < 0)
+        return;
+
+    pthread_mutex_lock(&table->mutex);
+    table->entries[slot].connections--;
+    pthread_mutex_unlock(&table->mutex);
+}
+
+/******************************************************************************
+Description.: close the connection of a client
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+void close_client(cfd *client)
+{
+    close(client->fd);
+    admit_release(client->pc, client->admitted);
+    client->admitted = -1;
+
+    /* a stream which never started */
+    if(client->stream_reserved)
+        __sync_fetch_and_sub(&client->pc->stats.stream_clients, 1);
+    client->stream_reserved = 0;
+}
@@ -0,0 +1,445 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * In-memory cache of the www folder
+ *
+ * The files of the www folder are read once when the plugin is initialized.
+ * Each file is kept together with its complete HTTP response header, so it is
+ * answered with a single writev and without touching the disk, which may be
+ * busy with the camera. A "<file>.gz" next to a file is sent instead to
+ * clients accepting gzip. Files which are not cached, e.g. because they were
+ * created later, are still served from disk by send_file().
+ *
+ * Over the memory budget the files are dropped from the cache and served
+ * from disk as well. Requests hold the lock of the cache for reading while
+ * they send, the eviction only happens when it is free.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+#define WWW_CACHE_BUCKETS 64            /* must be a power of two */
+#define WWW_CACHE_MAX_FILE (4*1024*1024) /* larger files are served from disk */
+
+/*
+ * a cached response, header and body in one buffer. The Connection field is
+ * left out, it is inserted after the status line when sending. The status
+ * line starts with "HTTP/1.0", persistent connections get "HTTP/1.1".
+ */
+typedef struct {
+    char *data;
+    size_t len;
+} www_response;
+
+typedef struct _www_file www_file;
+struct _www_file {
+    www_file *next;             /* next file of the same bucket */
+    char *name;                 /* path relative to the www folder */
+    char etag[48];
+    www_response plain;
+    www_response gzip;          /* pre-compressed variant, data is NULL if none */
+    www_response not_modified;  /* answer to a matching If-None-Match */
+};
+
+struct _www_cache {
+    pthread_rwlock_t lock;
+    www_file *buckets[WWW_CACHE_BUCKETS];
+    int count;
+    memory_account memory;
+};
+
+/******************************************************************************
+Description.: FNV-1a hash of a file name
+Input Value.: the file name
+Return Value: the hash
+******************************************************************************/
+static unsigned int name_hash(const char *name)
+{
+    unsigned int h = 2166136261u;
+
+    while(*name != '\0') {
+        h ^= (unsigned char) * name++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/******************************************************************************
+Description.: look up the mimetype of a file name by its extension
+Input Value.: the file name
+Return Value: the mimetype or NULL if it is not supported
+******************************************************************************/
+static const char *name_mimetype(const char *name)
+{
+    const char *extension = strrchr(name, '.');
+    int i;
+
+    if(extension == NULL || extension == name)
+        return NULL;
+
+    for(i = 0; i < LENGTH_OF(mimetypes); i++) {
+        if(strcmp(mimetypes[i].dot_extension, extension) == 0)
+            return mimetypes[i].mimetype;
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: read a file into a buffer which has room for a header in front
+Input Value.: * path....: the file to read
+              * st......: stat of the file
+              * reserved: bytes to keep free in front of the content
+Return Value: the buffer or NULL on errors
+******************************************************************************/
+static char *read_file(const char *path, struct stat *st, size_t reserved)
+{
+    char *data;
+    size_t done = 0;
+    ssize_t n;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if((data = malloc(reserved + st->st_size)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    while(done < (size_t)st->st_size) {
+        if((n = read(fd, data + reserved + done, st->st_size - done)) < 0 && errno == EINTR)
+            continue;
+        if(n <= 0) {
+            free(data);
+            close(fd);
+            return NULL;
+        }
+        done += n;
+    }
+
+    close(fd);
+    return data;
+}
+
+/******************************************************************************
+Description.: read a file and put its header in front of it
+Input Value.: * response: where to store the result
+              * path....: the file to read
+              * st......: stat of the file
+              * header..: the HTTP header, without the terminating empty line
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int build_response(www_response *response, const char *path, struct stat *st, const char *header)
+{
+    char length[64];
+    size_t header_len;
+
+    snprintf(length, sizeof(length), "Content-Length: %lld\r\n\r\n", (long long)st->st_size);
+    header_len = strlen(header) + strlen(length);
+
+    if((response->data = read_file(path, st, header_len)) == NULL)
+        return -1;
+
+    memcpy(response->data, header, strlen(header));
+    memcpy(response->data + strlen(header), length, strlen(length));
+    response->len = header_len + st->st_size;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: the memory taken by a cached file
+Input Value.: the file
+Return Value: the bytes of its responses
+******************************************************************************/
+static long long file_bytes(const www_file *f)
+{
+    return f->plain.len + f->gzip.len + f->not_modified.len;
+}
+
+/******************************************************************************
+Description.: release a cached file
+Input Value.: the file
+Return Value: -
+******************************************************************************/
+static void file_free(www_file *f)
+{
+    free(f->name);
+    free(f->plain.data);
+    free(f->gzip.data);
+    free(f->not_modified.data);
+    free(f);
+}
+
+/******************************************************************************
+Description.: read one file of the www folder into the cache
+Input Value.: * cache: the cache
+              * folder: the www folder, ending with a slash
+              * name.: the file name within the folder
+Return Value: 0 if the file was cached, -1 otherwise
+******************************************************************************/
+static int cache_file(www_cache *cache, const char *folder, const char *name)
+{
+    char path[BUFFER_SIZE], header[BUFFER_SIZE], modified[64];
+    const char *mimetype;
+    struct stat st, gz;
+    struct tm tm;
+    www_file *f;
+    unsigned int bucket;
+
+    if((mimetype = name_mimetype(name)) == NULL)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s%s", folder, name);
+    if(stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size > WWW_CACHE_MAX_FILE)
+        return -1;
+
+    if((f = calloc(1, sizeof(www_file))) == NULL)
+        return -1;
+
+    if((f->name = strdup(name)) == NULL) {
+        file_free(f);
+        return -1;
+    }
+
+    /* changes of size or modification time give a new ETag */
+    snprintf(f->etag, sizeof(f->etag), "\"%llx-%llx\"",
+             (unsigned long long)st.st_size, (unsigned long long)st.st_mtime);
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    /*
+     * the content does not change while the server runs, so clients may keep
+     * it as long as they check with the ETag before using it
+     */
+    snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n" \
+             "Content-type: %s\r\n" \
+             "Server: MJPG-Streamer/0.2\r\n" \
+             "Cache-Control: no-cache\r\n" \
+             "ETag: %s\r\n" \
+             "Last-Modified: %s\r\n" \
+             "Vary: Accept-Encoding\r\n", mimetype, f->etag, modified);
+
+    if(build_response(&f->plain, path, &st, header) < 0) {
+        file_free(f);
+        return -1;
+    }
+
+    /* a pre-compressed variant is optional */
+    snprintf(path, sizeof(path), "%s%s.gz", folder, name);
+    if(stat(path, &gz) == 0 && S_ISREG(gz.st_mode) && gz.st_size <= WWW_CACHE_MAX_FILE) {
+        strncat(header, "Content-Encoding: gzip\r\n", sizeof(header) - strlen(header) - 1);
+        if(build_response(&f->gzip, path, &gz, header) < 0)
+            f->gzip.data = NULL;
+    }
+
+    if(asprintf(&f->not_modified.data, "HTTP/1.0 304 Not Modified\r\n" \
+                "Server: MJPG-Streamer/0.2\r\n" \
+                "Cache-Control: no-cache\r\n" \
+                "ETag: %s\r\n" \
+                "\r\n", f->etag) < 0) {
+        f->not_modified.data = NULL;
+        file_free(f);
+        return -1;
+    }
+    f->not_modified.len = strlen(f->not_modified.data);
+
+    bucket = name_hash(name) & (WWW_CACHE_BUCKETS - 1);
+    f->next = cache->buckets[bucket];
+    cache->buckets[bucket] = f;
+    cache->count++;
+    memory_add(&cache->memory, file_bytes(f));
+
+    DBG("cached %s (%lld bytes%s)\n", name, (long long)st.st_size, (f->gzip.data != NULL) ? ", gzip" : "");
+    return 0;
+}
+
+/******************************************************************************
+Description.: drop files from the cache for the memory budget
+Input Value.: * arg..: the cache
+              * bytes: to free
+Return Value: bytes freed
+******************************************************************************/
+static long long cache_evict(void *arg, long long bytes)
+{
+    www_cache *cache = arg;
+    long long freed = 0;
+    www_file *f;
+    int i;
+
+    /* a client being sent a file holds the lock, try again next time */
+    if(pthread_rwlock_trywrlock(&cache->lock) != 0)
+        return 0;
+
+    for(i = 0; i < WWW_CACHE_BUCKETS && freed < bytes; i++) {
+        while((f = cache->buckets[i]) != NULL && freed < bytes) {
+            cache->buckets[i] = f->next;
+            cache->count--;
+            freed += file_bytes(f);
+            memory_add(&cache->memory, -file_bytes(f));
+            DBG("dropped %s from the cache\n", f->name);
+            file_free(f);
+        }
+    }
+    pthread_rwlock_unlock(&cache->lock);
+
+    return freed;
+}
+
+/******************************************************************************
+Description.: read the files of the www folder of a server into memory
+Input Value.: the server context, conf.www_folder must be set
+Return Value: number of cached files, -1 on errors
+******************************************************************************/
+int www_cache_load(context *pc)
+{
+    www_cache *cache;
+    struct dirent *entry;
+    DIR *dir;
+
+    if(pc->conf.www_folder == NULL)
+        return -1;
+
+    if((dir = opendir(pc->conf.www_folder)) == NULL) {
+        perror("could not open the www folder");
+        return -1;
+    }
+
+    if((cache = calloc(1, sizeof(www_cache))) == NULL) {
+        closedir(dir);
+        return -1;
+    }
+    pthread_rwlock_init(&cache->lock, NULL);
+    cache->memory = (memory_account)MEMORY_ACCOUNT("www", MEMORY_CACHE, cache_evict, cache);
+
+    /* the requests can not name subfolders, so the folder itself is enough */
+    while((entry = readdir(dir)) != NULL) {
+        if(entry->d_name[0] == '.')
+            continue;
+        cache_file(cache, pc->conf.www_folder, entry->d_name);
+    }
+    closedir(dir);
+
+    pc->cache = cache;
+    return cache->count;
+}
+
+/******************************************************************************
+Description.: stop counting the cache of a stopped server against the memory
+              budget. The files stay, client threads may still send them.
+Input Value.: the server context
+Return Value: -
+******************************************************************************/
+void www_cache_stop(context *pc)
+{
+    if(pc->cache != NULL)
+        memory_unregister(&pc->cache->memory);
+}
+
+/******************************************************************************
+Description.: answer a request for a file of the www folder from the cache
+Input Value.: * pc.: the server context
+              * fd.: the client socket
+              * req: the request, parameter holds the file name
+Return Value: 0 if the request was answered, -1 if the file is not cached
+******************************************************************************/
+int www_cache_send(context *pc, int fd, request *req)
+{
+    const char *name = req->parameter;
+    www_response *response;
+    www_file *f;
+    struct iovec iov[4];
+    int cnt = 4;
+    ssize_t n;
+
+    if(pc->cache == NULL)
+        return -1;
+
+    if(name == NULL || name[0] == '\0')
+        name = "index.html";
+
+    pthread_rwlock_rdlock(&pc->cache->lock);
+    for(f = pc->cache->buckets[name_hash(name) & (WWW_CACHE_BUCKETS - 1)]; f != NULL; f = f->next) {
+        if(strcmp(f->name, name) == 0)
+            break;
+    }
+    if(f == NULL) {
+        pthread_rwlock_unlock(&pc->cache->lock);
+        return -1;
+    }
+
+    if(req->if_none_match != NULL && strstr(req->if_none_match, f->etag) != NULL)
+        response = &f->not_modified;
+    else if(req->accept_gzip && f->gzip.data != NULL)
+        response = &f->gzip;
+    else
+        response = &f->plain;
+
+    DBG("serving %s from the cache\n", name);
+    iov[0].iov_base = req->keep_alive ? "HTTP/1.1" : "HTTP/1.0";
+    iov[0].iov_len = strlen("HTTP/1.0");
+    iov[1].iov_base = response->data + iov[0].iov_len;
+    iov[1].iov_len = strchr(response->data, '\n') + 1 - (char *)iov[1].iov_base;
+    iov[2].iov_base = req->keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    iov[2].iov_len = strlen(iov[2].iov_base);
+    iov[3].iov_base = (char *)iov[1].iov_base + iov[1].iov_len;
+    iov[3].iov_len = response->len - iov[0].iov_len - iov[1].iov_len;
+
+    while(cnt > 0) {
+        if((n = writev(fd, iov, cnt)) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        while(cnt > 0 && (size_t)n >= iov[0].iov_len) {
+            n -= iov[0].iov_len;
+            memmove(&iov[0], &iov[1], (--cnt) * sizeof(struct iovec));
+        }
+        if(cnt > 0) {
+            iov[0].iov_base = (char *)iov[0].iov_base + n;
+            iov[0].iov_len -= n;
+        }
+    }
+    pthread_rwlock_unlock(&pc->cache->lock);
+
+    return 0;
+}
@@ -0,0 +1,768 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Event loop mode of the HTTP server (option -e)
+ *
+ * Requests are still parsed by a short lived client thread. Once it is clear
+ * the client wants a stream, the socket is switched to non-blocking mode and
+ * handed over to one of a few event loop threads, the client thread exits.
+ * Each event loop thread serves all of its streams with epoll, they all send
+ * the same referenced frame, a slow client simply skips to the newest frame
+ * once it has caught up.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+#define EVENT_MAX_EVENTS 64
+
+/* a stream served by an event loop thread */
+typedef struct _event_client event_client;
+struct _event_client {
+    event_client *prev, *next;
+    int fd;
+    int input;
+    int wxp;
+    int admitted;                 /* cfd.admitted of the connection */
+    #ifdef MANAGMENT
+    client_info *client;
+    int accounted;                /* bytes of the socket queue accounted to it */
+    #endif
+
+    input_frame *frame;           /* frame being sent, NULL while waiting */
+    unsigned long long seq;       /* sequence number of the last frame */
+    stream_throttle throttle;     /* frame rate requested by the client */
+    stream_pacing pacing;         /* SO_MAX_PACING_RATE of the socket */
+    char head[BUFFER_SIZE];       /* HTTP or part header in front of frame */
+    int head_len;
+    int tail_len;                 /* bytes of the boundary after frame */
+    size_t sent;                  /* bytes of head, frame and tail written */
+    int polling_out;              /* EPOLLOUT is registered */
+    int corked;                   /* TCP_CORK is set */
+    int closing;                  /* waiting for zerocopy sends before closing */
+    zerocopy_state zc;
+
+    time_t progress;              /* last time data could be written */
+    unsigned long long dropped;   /* frames skipped because the client was slow */
+    unsigned long long part_dropped; /* frames skipped before the current one */
+    unsigned long long part_start;   /* when sending the current frame started */
+};
+
+struct _event_worker {
+    context *pc;
+    pthread_t threadID;
+    int epfd;
+    int evfd;                     /* wakes the thread for new frames or clients */
+    int node;                     /* NUMA node the thread runs on, -1 for any */
+    frame_waiter **watches;       /* per input, armed while a client waits for a frame */
+
+    pthread_mutex_t lock;         /* protects pending */
+    event_client *pending;        /* handed over by client threads */
+    event_client *clients;        /* owned by the event loop thread */
+    event_client *closing;        /* disconnected, kernel still owns frames */
+    event_client *dead;           /* dropped, freed after the current events */
+};
+
+static const char boundary[] = "\r\n--" BOUNDARY "\r\n";
+
+/******************************************************************************
+Description.: seconds of a clock which does not jump with the wall time
+Input Value.: -
+Return Value: the current time
+******************************************************************************/
+static time_t now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/******************************************************************************
+Description.: wake up an event loop thread
+Input Value.: the worker to wake
+Return Value: -
+******************************************************************************/
+static void worker_wakeup(event_worker *w)
+{
+    uint64_t one = 1;
+
+    if(write(w->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        DBG("could not signal event loop thread\n");
+}
+
+/******************************************************************************
+Description.: remove a client from a doubly linked list of a worker
+Input Value.: * list: head of the list
+              * c...: client to unlink
+Return Value: -
+******************************************************************************/
+static void client_unlink(event_client **list, event_client *c)
+{
+    if(c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        *list = c->next;
+    if(c->next != NULL)
+        c->next->prev = c->prev;
+    c->prev = c->next = NULL;
+}
+
+/******************************************************************************
+Description.: close the socket of a client. Events for it may still be
+              pending, so the client itself is only freed by
+              worker_free_dead().
+Input Value.: * w: worker owning the client
+              * c: client to close, already unlinked
+Return Value: -
+******************************************************************************/
+static void client_close(event_worker *w, event_client *c)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    admit_release(w->pc, c->admitted);
+    c->fd = -1;
+
+    c->next = w->dead;
+    w->dead = c;
+}
+
+/******************************************************************************
+Description.: disconnect a client. If the kernel still uses frames sent
+              without copying them the socket stays open until the
+              completions arrived.
+Input Value.: * w: worker owning the client
+              * c: client to drop
+Return Value: -
+******************************************************************************/
+static void client_drop(event_worker *w, event_client *c)
+{
+    struct epoll_event ev;
+
+    DBG("dropping stream client fd %d, %llu frames dropped\n", c->fd, c->dropped);
+
+    client_unlink(&w->clients, c);
+    __sync_fetch_and_sub(&w->pc->stats.stream_clients, 1);
+    #ifdef MANAGMENT
+    update_client_stream(c->client, -(long long)sizeof(event_client), c->accounted);
+    #endif
+    input_unsubscribe(&w->pc->pglobal->in[c->input]);
+    frame_unref(c->frame);
+    c->frame = NULL;
+
+    zerocopy_reap(c->fd, &c->zc);
+    if(c->zc.count > 0) {
+        shutdown(c->fd, SHUT_RDWR);
+
+        /* notifications raise EPOLLERR, edge triggered to not spin on EPOLLHUP */
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLET;
+        ev.data.ptr = c;
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+
+        c->closing = 1;
+        c->next = w->closing;
+        if(w->closing != NULL)
+            w->closing->prev = c;
+        w->closing = c;
+        return;
+    }
+
+    client_close(w, c);
+}
+
+/******************************************************************************
+Description.: close the dropped clients the kernel has released all frames of
+Input Value.: the worker
+Return Value: -
+******************************************************************************/
+static void worker_reap_closing(event_worker *w)
+{
+    event_client *c, *next;
+
+    for(c = w->closing; c != NULL; c = next) {
+        next = c->next;
+
+        zerocopy_reap(c->fd, &c->zc);
+        if(c->zc.count == 0) {
+            client_unlink(&w->closing, c);
+            client_close(w, c);
+        }
+    }
+}
+
+/******************************************************************************
+Description.: free the clients dropped while handling the last events
+Input Value.: the worker
+Return Value: -
+******************************************************************************/
+static void worker_free_dead(event_worker *w)
+{
+    event_client *c;
+
+    while((c = w->dead) != NULL) {
+        w->dead = c->next;
+        free(c);
+    }
+}
+
+/******************************************************************************
+Description.: switch the interest in writability of a client on or off
+Input Value.: * w..: worker owning the client
+              * c..: the client
+              * out: nonzero to wait until the socket is writable
+Return Value: -
+******************************************************************************/
+static void client_poll_out(event_worker *w, event_client *c, int out)
+{
+    struct epoll_event ev;
+
+    if(c->polling_out == out)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | (out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->polling_out = out;
+}
+
+/******************************************************************************
+Description.: write the pending data of a client, sending the frame without
+              copying it, header and boundary are small and get copied
+Input Value.: * w....: worker owning the client
+              * c....: client to serve
+              * total: number of bytes of the whole part
+Return Value: 1 if everything was sent, 0 if the socket is full, -1 on error
+******************************************************************************/
+static int client_write_zerocopy(event_worker *w, event_client *c, size_t total)
+{
+    size_t frame_end = c->head_len + frame_length(c->frame);
+    ssize_t rc;
+
+    while(c->sent < total) {
+        if(c->sent < (size_t)c->head_len)
+            rc = send(c->fd, c->head + c->sent, c->head_len - c->sent, MSG_MORE);
+        else if(c->sent < frame_end)
+            rc = zerocopy_send(c->fd, &c->zc, c->frame, c->sent - c->head_len, (c->tail_len > 0) ? MSG_MORE : 0);
+        else
+            rc = send(c->fd, boundary + (c->sent - frame_end), total - c->sent, 0);
+
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        c->sent += rc;
+        c->progress = now_monotonic();
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+Description.: write as much of the pending data of a client as possible
+Input Value.: * w: worker owning the client
+              * c: client to serve
+Return Value: 1 if everything was sent, 0 if the socket is full, -1 on error
+******************************************************************************/
+static int client_write(event_worker *w, event_client *c)
+{
+    struct iovec iov[2 + FRAME_IOVECS];
+    size_t skip, total;
+    int cnt, on = 1, off = 0;
+    ssize_t rc;
+
+    total = c->head_len + (c->frame != NULL ? frame_length(c->frame) : 0) + c->tail_len;
+
+    /* zerocopy needs the frame in a call of its own */
+    if(c->zc.enabled && c->frame != NULL)
+        return client_write_zerocopy(w, c, total);
+
+    /* with -k the part stays corked until it is complete */
+    if(w->pc->conf.cork && !c->corked && c->sent < total) {
+        setsockopt(c->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+        c->corked = 1;
+    }
+
+    while(c->sent < total) {
+        skip = c->sent;
+        cnt = 0;
+
+        if(skip < (size_t)c->head_len) {
+            iov[cnt].iov_base = c->head + skip;
+            iov[cnt++].iov_len = c->head_len - skip;
+            skip = 0;
+        } else {
+            skip -= c->head_len;
+        }
+
+        if(c->frame != NULL) {
+            if(skip < (size_t)frame_length(c->frame)) {
+                cnt += frame_iovec(c->frame, skip, iov + cnt);
+                skip = 0;
+            } else {
+                skip -= frame_length(c->frame);
+            }
+        }
+
+        if(c->tail_len > 0 && skip < (size_t)c->tail_len) {
+            iov[cnt].iov_base = (char *)boundary + skip;
+            iov[cnt++].iov_len = c->tail_len - skip;
+        }
+
+        rc = writev(c->fd, iov, cnt);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        c->sent += rc;
+        c->progress = now_monotonic();
+    }
+
+    if(c->corked) {
+        setsockopt(c->fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        c->corked = 0;
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+Description.: have the eventfd of the worker written once the input of a
+              client publishes a frame after seq, the worker is not woken
+              for inputs none of its clients waits for
+Input Value.: * w..: the worker
+              * c..: the client which waits
+              * seq: the last frame which is not due for it
+Return Value: 1 if such a frame is there already, 0 otherwise
+******************************************************************************/
+static int client_watch(event_worker *w, event_client *c, unsigned long long seq)
+{
+    frame_waiter **watch = &w->watches[c->input];
+
+    if(*watch == NULL && (*watch = calloc(1, sizeof(frame_waiter))) == NULL) {
+        /* the client goes on once another frame wakes the worker */
+        return 0;
+    }
+
+    return frame_watch(*watch, &w->pc->pglobal->in[c->input], seq, w->evfd);
+}
+
+/******************************************************************************
+Description.: send data to a client until its socket is full, then continue
+              with the newest frame of its input if there is one
+Input Value.: * w: worker owning the client
+              * c: the client
+Return Value: 0 if the client is still connected, -1 if it was dropped
+******************************************************************************/
+static int client_serve(event_worker *w, event_client *c)
+{
+    globals *pglobal = w->pc->pglobal;
+    input_frame *frame;
+    int rc;
+
+    while(1) {
+        if((rc = client_write(w, c)) < 0) {
+            client_drop(w, c);
+            return -1;
+        }
+
+        if(rc == 0) {
+            client_poll_out(w, c, 1);
+            return 0;
+        }
+
+        /* everything sent, continue with the next frame */
+        if(c->frame != NULL)
+            stream_stats_part(w->pc, c->fd, c->input, c->frame, c->part_dropped, monotonic_usec() - c->part_start);
+        frame_unref(c->frame);
+        c->frame = NULL;
+        c->head_len = c->tail_len = 0;
+        c->sent = 0;
+
+        frame = input_peek_frame(&pglobal->in[c->input]);
+        if(frame == NULL || frame->seq <= c->seq) {
+            frame_unref(frame);
+            if(client_watch(w, c, c->seq))
+                continue;
+            client_poll_out(w, c, 0);
+            return 0;
+        }
+
+        /* not due for a rate limited client, look again at the next frame due */
+        if(!stream_frame_due(&c->throttle, frame)) {
+            c->seq = frame->seq;
+            frame_unref(frame);
+            if(client_watch(w, c, c->throttle.every > 1 ? c->throttle.seq + c->throttle.every - 1 : c->seq))
+                continue;
+            client_poll_out(w, c, 0);
+            return 0;
+        }
+
+        /* frames published while the last one was sent are skipped */
+        c->part_dropped = (c->seq != 0 && frame->seq > c->seq + 1) ? frame->seq - c->seq - 1 : 0;
+        c->dropped += c->part_dropped;
+
+        stream_pace(w->pc, c->fd, &c->pacing, frame);
+        #ifdef MANAGMENT
+        update_client_timestamp(c->client);
+        update_client_frames(c->client, c->part_dropped);
+        update_client_queue(c->client, &c->accounted, stream_stats_begin(w->pc, c->fd, c->input, frame));
+        #else
+        stream_stats_begin(w->pc, c->fd, c->input, frame);
+        #endif
+        c->part_start = monotonic_usec();
+
+        c->frame = frame;
+        c->seq = frame->seq;
+        c->head_len = stream_part_header(c->head, frame, c->wxp);
+        c->tail_len = c->wxp ? 0 : strlen(boundary);
+    }
+}
+
+/******************************************************************************
+Description.: disconnect clients which did not take any data for longer than
+              the stall timeout while a frame was waiting for them
+Input Value.: the worker
+Return Value: -
+******************************************************************************/
+static void worker_drop_stalled(event_worker *w)
+{
+    event_client *c, *next;
+    time_t now = now_monotonic();
+
+    for(c = w->clients; c != NULL; c = next) {
+        next = c->next;
+
+        if(c->sent < (size_t)c->head_len + (c->frame != NULL ? frame_length(c->frame) : 0) + c->tail_len &&
+           now - c->progress > w->pc->conf.stall_timeout) {
+            DBG("stream client fd %d stalled\n", c->fd);
+            client_drop(w, c);
+        }
+    }
+}
+
+/******************************************************************************
+Description.: take over the clients handed to this thread
+Input Value.: the worker
+Return Value: -
+******************************************************************************/
+static void worker_accept_pending(event_worker *w)
+{
+    struct epoll_event ev;
+    event_client *c, *next;
+
+    pthread_mutex_lock(&w->lock);
+    c = w->pending;
+    w->pending = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    for(; c != NULL; c = next) {
+        next = c->next;
+
+        c->prev = NULL;
+        c->next = w->clients;
+        if(w->clients != NULL)
+            w->clients->prev = c;
+        w->clients = c;
+        #ifdef MANAGMENT
+        update_client_stream(c->client, sizeof(event_client), 0);
+        #endif
+
+        zerocopy_init(c->fd, &c->zc, w->pc->conf.zerocopy);
+        c->progress = now_monotonic();
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+            perror("epoll_ctl");
+            client_drop(w, c);
+            continue;
+        }
+
+        /* send the HTTP header */
+        client_serve(w, c);
+    }
+}
+
+/******************************************************************************
+Description.: the event loop thread, serves all streams assigned to it
+Input Value.: the worker
+Return Value: always NULL
+******************************************************************************/
+static void *worker_thread(void *arg)
+{
+    event_worker *w = arg;
+    struct epoll_event events[EVENT_MAX_EVENTS];
+    event_client *c, *next;
+    char discard[256];
+    uint64_t cnt;
+    time_t checked = now_monotonic();
+    int i, n;
+
+    if(w->node >= 0 && numa_bind(w->node) < 0) {
+        OPRINT("event loop thread can not run on NUMA node %d\n", w->node);
+        w->node = -1;
+    }
+
+    while(!w->pc->pglobal->stop) {
+        n = epoll_wait(w->epfd, events, EVENT_MAX_EVENTS, 1000);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for(i = 0; i < n; i++) {
+            c = events[i].data.ptr;
+
+            /* fresh frames or new clients */
+            if(c == NULL) {
+                if(read(w->evfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+                    DBG("could not read eventfd\n");
+
+                worker_accept_pending(w);
+                for(c = w->clients; c != NULL; c = next) {
+                    next = c->next;
+                    if(c->frame == NULL && c->head_len == 0)
+                        client_serve(w, c);
+                }
+                continue;
+            }
+
+            if(c->fd < 0 || c->closing)
+                continue;
+
+            /* zerocopy completions are reported as errors as well */
+            if(events[i].events & EPOLLERR) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+
+                zerocopy_reap(c->fd, &c->zc);
+                if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+                    client_drop(w, c);
+                    continue;
+                }
+            }
+
+            /* streaming clients do not send anything, this is a disconnect */
+            if(events[i].events & (EPOLLHUP | EPOLLRDHUP)) {
+                client_drop(w, c);
+                continue;
+            }
+
+            if(events[i].events & EPOLLIN) {
+                ssize_t rc = read(c->fd, discard, sizeof(discard));
+                if(rc == 0 || (rc < 0 && errno != EAGAIN && errno != EINTR)) {
+                    client_drop(w, c);
+                    continue;
+                }
+            }
+
+            if(events[i].events & EPOLLOUT)
+                client_serve(w, c);
+        }
+
+        /* look for stalled clients once per second */
+        if(w->pc->conf.stall_timeout > 0 && now_monotonic() != checked) {
+            checked = now_monotonic();
+            worker_drop_stalled(w);
+        }
+
+        if(w->closing != NULL)
+            worker_reap_closing(w);
+        worker_free_dead(w);
+    }
+
+    for(i = 0; i < INPUT_TABLE_SIZE; i++) {
+        if(w->watches[i] != NULL)
+            frame_unwatch(w->watches[i]);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: start the event loop threads of a server
+Input Value.: server context, conf.event_loop tells the number of threads
+Return Value: 0 if everything is ok, -1 on error
+******************************************************************************/
+int event_loop_start(context *pc)
+{
+    struct epoll_event ev;
+    event_worker *w;
+    int i, nodes = numa_node_count();
+
+    if((pc->workers = calloc(pc->conf.event_loop, sizeof(event_worker))) == NULL)
+        return -1;
+
+    for(i = 0; i < pc->conf.event_loop; i++) {
+        w = &pc->workers[i];
+        w->pc = pc;
+        /* the threads are spread across the nodes, streams go to a thread on the node of their frames */
+        w->node = nodes > 1 ? i % nodes : -1;
+        pthread_mutex_init(&w->lock, NULL);
+        if((w->watches = calloc(INPUT_TABLE_SIZE, sizeof(frame_waiter *))) == NULL)
+            return -1;
+
+        if((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+           (w->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            perror("could not create event loop");
+            return -1;
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev) < 0) {
+            perror("epoll_ctl");
+            return -1;
+        }
+
+        if(pthread_create(&w->threadID, NULL, worker_thread, w) != 0) {
+            OPRINT("could not start event loop thread\n");
+            return -1;
+        }
+        pthread_detach(w->threadID);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: pick an event loop thread on the NUMA node of the frames of an
+              input, so they are not read across the interconnect
+Input Value.: * pc: server context
+              * w.: the thread picked round robin
+              * in: the input
+Return Value: the first thread after w on that node, w if there is none or
+              the node is not known
+******************************************************************************/
+static event_worker *worker_on_node(context *pc, event_worker *w, input *in)
+{
+    input_frame *frame;
+    int node, i, start;
+
+    if(w->node < 0 || (frame = input_peek_frame(in)) == NULL)
+        return w;
+    node = frame->numa_node;
+    frame_unref(frame);
+
+    if(node < 0 || w->node == node)
+        return w;
+
+    start = w - pc->workers;
+    for(i = 1; i < pc->conf.event_loop; i++) {
+        event_worker *other = &pc->workers[(start + i) % pc->conf.event_loop];
+        if(other->node == node)
+            return other;
+    }
+    return w;
+}
+
+/******************************************************************************
+Description.: hand a client which requested a stream over to an event loop
+              thread. On success the caller must not touch the socket anymore.
+Input Value.: * context_fd..: the connected client
+              * input_number: input plugin to stream from
+              * wxp.........: nonzero for the WebcamXP compatible format
+Return Value: 0 if the client was handed over, -1 otherwise
+******************************************************************************/
+int event_loop_add_stream(cfd *context_fd, int input_number, int wxp)
+{
+    context *pc = context_fd->pc;
+    event_worker *w;
+    event_client *c;
+    int flags;
+
+    /* scaling, requantizing or cropping a frame would hold up all other streams
+     * of the loop, abbreviated ones keep the tables of their client */
+    if(pc->workers == NULL || context_fd->scale != 1 || context_fd->quality > 0 || context_fd->crop.w > 0 ||
+       context_fd->adapt.enabled || context_fd->tables)
+        return -1;
+
+    if((flags = fcntl(context_fd->fd, F_GETFL, 0)) < 0 ||
+       fcntl(context_fd->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    if((c = calloc(1, sizeof(event_client))) == NULL) {
+        fcntl(context_fd->fd, F_SETFL, flags);
+        return -1;
+    }
+
+    c->fd = context_fd->fd;
+    c->input = input_number;
+    c->wxp = wxp;
+    c->throttle = context_fd->throttle;
+    c->admitted = context_fd->admitted;
+    #ifdef MANAGMENT
+    c->client = context_fd->client;
+    #endif
+    c->head_len = stream_header(c->head, wxp);
+
+    /* waiters do not count as consumers, the client does for its lifetime */
+    input_subscribe(&pc->pglobal->in[input_number]);
+    /* the worker gives the stream back in client_drop() */
+    admit_stream_start(context_fd);
+
+    /* spread the streams across the event loop threads */
+    w = &pc->workers[__sync_fetch_and_add(&pc->next_worker, 1) % pc->conf.event_loop];
+    w = worker_on_node(pc, w, &pc->pglobal->in[input_number]);
+
+    pthread_mutex_lock(&w->lock);
+    c->next = w->pending;
+    w->pending = c;
+    pthread_mutex_unlock(&w->lock);
+
+    worker_wakeup(w);
+
+    return 0;
+}
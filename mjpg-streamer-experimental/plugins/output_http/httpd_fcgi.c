@@ -0,0 +1,736 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * FastCGI processes for the CGI scripts of the www folder (option -F)
+ *
+ * Without it every request for a .cgi file runs the script through popen(),
+ * which forks the whole server with its threads and frame buffers. With it
+ * each script is started once as a FastCGI application: a few processes
+ * share a listening UNIX socket handed to them as their stdin, as the
+ * FastCGI specification wants, and each request is a connection to that
+ * socket carrying the CGI variables in FCGI_PARAMS records. The answer comes
+ * back in FCGI_STDOUT records and is sent to the client as it arrives.
+ *
+ * The processes live until the plugin stops, dead ones are started again by
+ * the next request. At most as many requests as a script has processes are
+ * sent to it at a time, the others wait for one of them. Scripts have to
+ * speak FastCGI, e.g. through libfcgi or a FastCGI module of their language.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+extern char **environ;
+
+/* the parts of the FastCGI protocol a responder needs */
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_RESPONDER 1
+#define FCGI_RECORD_HEADER 8
+#define FCGI_REQUEST_ID 1           /* a single request per connection */
+
+/* a script and the processes serving it */
+typedef struct _fcgi_app fcgi_app;
+struct _fcgi_app {
+    fcgi_app *next;
+    char *path;
+    struct sockaddr_un addr;        /* abstract address of its socket */
+    socklen_t addr_len;
+    int listen_fd;                  /* kept to start processes again */
+    pid_t pids[FCGI_MAX_PROCESSES]; /* 0 for a slot without a process */
+    unsigned long long started;     /* monotonic_usec() of the last start */
+    int busy;                       /* requests being served */
+};
+
+struct _fcgi_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t idle;            /* a request finished, on CLOCK_MONOTONIC */
+    fcgi_app *apps;
+    int count;                      /* scripts started, names their sockets */
+    int stopping;                   /* no more requests are taken */
+};
+
+/* the CGI answer of a script on its way to the client */
+typedef struct {
+    int fd;                         /* of the client */
+    int started;                    /* the header was sent */
+    int length;                     /* bytes of the header collected so far */
+    char header[FCGI_HEADER_SIZE];
+} fcgi_answer;
+
+/******************************************************************************
+Description.: set up the FastCGI processes of a server, they are only started
+              with the first request for their script
+Input Value.: the server context, conf.fastcgi is the number of processes
+Return Value: 0 on success, -1 without memory
+******************************************************************************/
+int fcgi_pool_init(context *pc)
+{
+    fcgi_pool *pool;
+    pthread_condattr_t attr;
+
+    if((pool = calloc(1, sizeof(fcgi_pool))) == NULL)
+        return -1;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->idle, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pc->fcgi = pool;
+    return 0;
+}
+
+/******************************************************************************
+Description.: count the requests being served, with the lock of the pool held
+Input Value.: the pool
+Return Value: the number of requests
+******************************************************************************/
+static int pool_busy(fcgi_pool *pool)
+{
+    fcgi_app *app;
+    int busy = 0;
+
+    for(app = pool->apps; app != NULL; app = app->next)
+        busy += app->busy;
+    return busy;
+}
+
+/******************************************************************************
+Description.: end the FastCGI processes of a script, those which do not leave
+              on SIGTERM within FCGI_KILL_USEC are killed
+Input Value.: the script
+Return Value: -
+******************************************************************************/
+static void stop_processes(fcgi_app *app)
+{
+    unsigned long long deadline = monotonic_usec() + FCGI_KILL_USEC;
+    int i, running;
+
+    for(i = 0; i < FCGI_MAX_PROCESSES; i++) {
+        if(app->pids[i] > 0)
+            kill(app->pids[i], SIGTERM);
+    }
+
+    do {
+        running = 0;
+        for(i = 0; i < FCGI_MAX_PROCESSES; i++) {
+            if(app->pids[i] > 0 && waitpid(app->pids[i], NULL, WNOHANG) != 0)
+                app->pids[i] = 0;
+            running += (app->pids[i] > 0);
+        }
+    } while(running > 0 && monotonic_usec() < deadline && usleep(10000) == 0);
+
+    for(i = 0; i < FCGI_MAX_PROCESSES; i++) {
+        if(app->pids[i] > 0) {
+            OPRINT("FastCGI process %d of %s ignores SIGTERM, killing it\n", (int)app->pids[i], app->path);
+            kill(app->pids[i], SIGKILL);
+            waitpid(app->pids[i], NULL, 0);
+            app->pids[i] = 0;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: stop the FastCGI processes of a server once the requests being
+              served are done, waiting at most the timeout of a request.
+              Client threads may still come by, so the pool itself stays and
+              answers them that the server is stopping.
+Input Value.: the server context
+Return Value: -
+******************************************************************************/
+void fcgi_pool_stop(context *pc)
+{
+    fcgi_pool *pool = pc->fcgi;
+    unsigned long long deadline;
+    struct timespec ts;
+    fcgi_app *apps, *app, *next;
+
+    if(pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    if(pool->stopping) {
+        pthread_mutex_unlock(&pool->mutex);
+        return;
+    }
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->idle);
+
+    deadline = monotonic_usec() + pc->conf.fastcgi_timeout * 1000000ULL;
+    ts.tv_sec = deadline / 1000000ULL;
+    ts.tv_nsec = (deadline % 1000000ULL) * 1000;
+    while(pool_busy(pool) > 0) {
+        if(pthread_cond_timedwait(&pool->idle, &pool->mutex, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    /* the scripts of requests still running are only stopped, not freed */
+    apps = pool->apps;
+    pool->apps = NULL;
+    for(app = apps; app != NULL; app = next) {
+        next = app->next;
+        stop_processes(app);
+        if(app->busy > 0) {
+            app->next = pool->apps;
+            pool->apps = app;
+            continue;
+        }
+        close(app->listen_fd);
+        free(app->path);
+        free(app);
+    }
+    if(pool->apps != NULL)
+        OPRINT("FastCGI requests are still running while the server stops\n");
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/******************************************************************************
+Description.: find the processes of a script or create its socket, with the
+              lock of the pool held
+Input Value.: * pool: the pool
+              * path: of the script
+Return Value: the script, NULL if its socket could not be created
+******************************************************************************/
+static fcgi_app *find_app(fcgi_pool *pool, const char *path)
+{
+    fcgi_app *app;
+
+    for(app = pool->apps; app != NULL; app = app->next) {
+        if(strcmp(app->path, path) == 0)
+            return app;
+    }
+
+    if((app = calloc(1, sizeof(fcgi_app))) == NULL || (app->path = strdup(path)) == NULL) {
+        free(app);
+        return NULL;
+    }
+
+    /* an abstract address, which goes away with the last descriptor of the socket */
+    app->addr.sun_family = AF_UNIX;
+    app->addr_len = offsetof(struct sockaddr_un, sun_path) + 1 +
+                    snprintf(app->addr.sun_path + 1, sizeof(app->addr.sun_path) - 1,
+                             "mjpg-streamer-fcgi-%d-%d", (int)getpid(), pool->count);
+    if((app->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+       bind(app->listen_fd, (struct sockaddr *)&app->addr, app->addr_len) < 0 ||
+       listen(app->listen_fd, FCGI_MAX_PROCESSES) < 0) {
+        OPRINT("could not create the FastCGI socket of %s: %s\n", path, strerror(errno));
+        if(app->listen_fd >= 0)
+            close(app->listen_fd);
+        free(app->path);
+        free(app);
+        return NULL;
+    }
+
+    pool->count++;
+    app->next = pool->apps;
+    pool->apps = app;
+    return app;
+}
+
+/******************************************************************************
+Description.: start a FastCGI process of a script, with its socket as stdin
+              and the signals at their defaults
+Input Value.: the script
+Return Value: the process, 0 if it could not be started
+******************************************************************************/
+static pid_t spawn_process(fcgi_app *app)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t signals;
+    char *argv[] = { app->path, NULL };
+    pid_t pid;
+    int rc;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, app->listen_fd, STDIN_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    #if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+    /* the sockets of clients must not stay open in the scripts */
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+    #endif
+
+    posix_spawnattr_init(&attr);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    rc = posix_spawn(&pid, app->path, &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if(rc != 0) {
+        OPRINT("could not start the FastCGI script %s: %s\n", app->path, strerror(rc));
+        return 0;
+    }
+    DBG("started FastCGI process %d for %s\n", (int)pid, app->path);
+    return pid;
+}
+
+/******************************************************************************
+Description.: reap the dead processes of a script and start the missing
+              ones, at most once per FCGI_RESTART_USEC so a script which is
+              no FastCGI application is not started again with every request
+Input Value.: * app......: the script, with the lock of the pool held
+              * processes: the number of processes it should have
+Return Value: number of processes running
+******************************************************************************/
+static int start_processes(fcgi_app *app, int processes)
+{
+    unsigned long long now = monotonic_usec();
+    int i, running = 0, start;
+
+    for(i = 0; i < processes; i++) {
+        if(app->pids[i] > 0 && waitpid(app->pids[i], NULL, WNOHANG) != 0) {
+            DBG("FastCGI process %d of %s is gone\n", (int)app->pids[i], app->path);
+            app->pids[i] = 0;
+        }
+        running += (app->pids[i] > 0);
+    }
+
+    start = (app->started == 0 || now - app->started >= FCGI_RESTART_USEC);
+    for(i = 0; start && running < processes && i < processes; i++) {
+        if(app->pids[i] == 0 && (app->pids[i] = spawn_process(app)) > 0)
+            running++;
+        app->started = now;
+    }
+
+    return running;
+}
+
+/******************************************************************************
+Description.: append a name-value pair of FCGI_PARAMS
+Input Value.: * buf..: the record content
+              * pos..: where the pair goes
+              * size.: of buf
+              * name.: of the variable
+              * value: its value
+Return Value: position after the pair, -1 if it does not fit
+******************************************************************************/
+static int put_param(unsigned char *buf, int pos, int size, const char *name, const char *value)
+{
+    size_t lengths[2] = { strlen(name), strlen(value) };
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        if(pos + 4 > size)
+            return -1;
+        if(lengths[i] < 128) {
+            buf[pos++] = lengths[i];
+        } else {
+            buf[pos++] = 0x80 | ((lengths[i] >> 24) & 0x7f);
+            buf[pos++] = lengths[i] >> 16;
+            buf[pos++] = lengths[i] >> 8;
+            buf[pos++] = lengths[i];
+        }
+    }
+    if(pos + lengths[0] + lengths[1] > (size_t)size)
+        return -1;
+
+    memcpy(buf + pos, name, lengths[0]);
+    memcpy(buf + pos + lengths[0], value, lengths[1]);
+    return pos + lengths[0] + lengths[1];
+}
+
+/******************************************************************************
+Description.: fill in the header of a record
+Input Value.: * buf...: at least FCGI_RECORD_HEADER bytes
+              * type..: of the record
+              * length: of its content
+Return Value: FCGI_RECORD_HEADER
+******************************************************************************/
+static int put_record(unsigned char *buf, int type, int length)
+{
+    buf[0] = FCGI_VERSION_1;
+    buf[1] = type;
+    buf[2] = FCGI_REQUEST_ID >> 8;
+    buf[3] = FCGI_REQUEST_ID & 0xff;
+    buf[4] = length >> 8;
+    buf[5] = length & 0xff;
+    buf[6] = 0;
+    buf[7] = 0;
+    return FCGI_RECORD_HEADER;
+}
+
+/******************************************************************************
+Description.: read a number of bytes from the socket of a script
+Input Value.: * sd......: the socket
+              * buf.....: destination
+              * len.....: bytes to read
+              * deadline: monotonic_usec() when the request times out
+Return Value: 0 on success, -1 if the script closed the connection or on
+              errors, -2 after the deadline
+******************************************************************************/
+static int read_until(int sd, unsigned char *buf, size_t len, unsigned long long deadline)
+{
+    struct pollfd pfd = { .fd = sd, .events = POLLIN };
+    unsigned long long now;
+    ssize_t n;
+
+    while(len > 0) {
+        if((now = monotonic_usec()) >= deadline)
+            return -2;
+        if(poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) == 0)
+            return -2;
+
+        if((n = read(sd, buf, len)) < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if(n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: write all bytes to the client
+Input Value.: * fd..: the client
+              * data: the bytes
+              * len.: their number
+Return Value: 0 on success, -1 if the client went away
+******************************************************************************/
+static int write_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = write(fd, data, len)) < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: send the collected CGI header of an answer as an HTTP header,
+              with the status of its Status field. Answers which are HTTP
+              already, like those of nph scripts, go out as they are.
+Input Value.: * a..: the answer
+              * end: length of the header including its empty line
+Return Value: 0 on success, -1 if the client went away
+******************************************************************************/
+static int answer_start(fcgi_answer *a, int end)
+{
+    char out[2 * FCGI_HEADER_SIZE + 128], code[128];
+    const char *status = "200 OK";
+    char *line, *next, *eol;
+    int len, found;
+
+    a->started = 1;
+    if(strncmp(a->header, "HTTP/", 5) == 0)
+        return write_all(a->fd, a->header, a->length);
+
+    /* the status first, the other fields follow, the header stays as it is */
+    for(line = a->header; line < a->header + end; line = next) {
+        eol = memchr(line, '\n', a->header + end - line);
+        next = (eol != NULL) ? eol + 1 : a->header + end;
+        if(strncasecmp(line, "Status:", 7) == 0) {
+            for(status = line + 7; status < next && *status == ' '; status++);
+            found = (int)((eol != NULL ? eol : next) - status);
+            if(found > 0 && status[found - 1] == '\r')
+                found--;
+            snprintf(code, sizeof(code), "%.*s", found, status);
+            status = code;
+        } else if(strncasecmp(line, "Location:", 9) == 0 && strcmp(status, "200 OK") == 0) {
+            status = "302 Found";
+        }
+    }
+
+    len = snprintf(out, sizeof(out), "HTTP/1.0 %s\r\n"
+                   "Connection: close\r\n"
+                   "Server: MJPG-Streamer/0.2\r\n", status);
+    for(line = a->header; line < a->header + end; line = next) {
+        eol = memchr(line, '\n', a->header + end - line);
+        next = (eol != NULL) ? eol + 1 : a->header + end;
+        found = (int)((eol != NULL ? eol : next) - line);
+        if(found > 0 && line[found - 1] == '\r')
+            found--;
+        if(found == 0 || strncasecmp(line, "Status:", 7) == 0)
+            continue;
+        len += snprintf(out + len, sizeof(out) - len, "%.*s\r\n", found, line);
+    }
+    len += snprintf(out + len, sizeof(out) - len, "\r\n");
+
+    if(write_all(a->fd, out, len) < 0)
+        return -1;
+    return write_all(a->fd, a->header + end, a->length - end);
+}
+
+/******************************************************************************
+Description.: pass a part of the output of a script on to the client, its
+              header is collected first
+Input Value.: * a...: the answer
+              * data: the output
+              * len.: its length
+Return Value: 0 on success, -1 if the client went away, 502 if the header
+              is too long
+******************************************************************************/
+static int answer_data(fcgi_answer *a, const char *data, int len)
+{
+    int i;
+
+    if(a->started)
+        return write_all(a->fd, data, len);
+
+    if(a->length + len > (int)sizeof(a->header))
+        return 502;
+    memcpy(a->header + a->length, data, len);
+    a->length += len;
+
+    /* the header ends with an empty line, with or without carriage returns */
+    for(i = MAX(a->length - len - 2, 0); i + 1 < a->length; i++) {
+        if(a->header[i] != '\n')
+            continue;
+        if(a->header[i + 1] == '\n')
+            return answer_start(a, i + 2);
+        if(i + 2 < a->length && a->header[i + 1] == '\r' && a->header[i + 2] == '\n')
+            return answer_start(a, i + 3);
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: send a request to a script and its answer to the client
+Input Value.: * pc..........: the server context
+              * app.........: the script
+              * fd..........: the client
+              * parameter...: the requested file name
+              * query_string: query parameters
+              * deadline....: monotonic_usec() when the request times out
+Return Value: 0 if the answer was sent or the client went away, otherwise
+              the HTTP status to answer with
+******************************************************************************/
+static int fcgi_request(context *pc, fcgi_app *app, int fd, const char *parameter,
+                        const char *query_string, unsigned long long deadline)
+{
+    unsigned char msg[FCGI_RECORD_HEADER * 5 + REQUEST_BUFFER + 2 * BUFFER_SIZE];
+    unsigned char buf[4096];
+    fcgi_answer *a;
+    char value[BUFFER_SIZE];
+    int sd, pos, n, length, left, ret = 502;
+
+    /* FCGI_BEGIN_REQUEST, the variables, their end and an empty stdin */
+    pos = put_record(msg, FCGI_BEGIN_REQUEST, 8);
+    memset(msg + pos, 0, 8);
+    msg[pos + 1] = FCGI_RESPONDER;
+    pos += 8 + FCGI_RECORD_HEADER;
+    length = pos;
+    pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "GATEWAY_INTERFACE", "CGI/1.1");
+    if(pos > 0)
+        pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "SERVER_SOFTWARE", "mjpg-streamer");
+    if(pos > 0)
+        pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "SERVER_PROTOCOL", "HTTP/1.1");
+    snprintf(value, sizeof(value), "%d", ntohs(pc->conf.port));
+    if(pos > 0)
+        pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "SERVER_PORT", value);
+    if(pos > 0)
+        pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "REQUEST_METHOD", "GET");
+    snprintf(value, sizeof(value), "/%s", parameter);
+    if(pos > 0)
+        pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "SCRIPT_NAME", value);
+    if(pos > 0)
+        pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "SCRIPT_FILENAME", app->path);
+    if(pos > 0)
+        pos = put_param(msg, pos, sizeof(msg) - 2 * FCGI_RECORD_HEADER, "QUERY_STRING", query_string);
+    if(pos < 0 || pos - length > 0xffff)
+        return 500;
+    put_record(msg + length - FCGI_RECORD_HEADER, FCGI_PARAMS, pos - length);
+    pos += put_record(msg + pos, FCGI_PARAMS, 0);
+    pos += put_record(msg + pos, FCGI_STDIN, 0);
+
+    if((sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return 500;
+    if(connect(sd, (struct sockaddr *)&app->addr, app->addr_len) < 0 ||
+       send(sd, msg, pos, MSG_NOSIGNAL) != pos) {
+        close(sd);
+        return 502;
+    }
+
+    if((a = malloc(sizeof(fcgi_answer))) == NULL) {
+        close(sd);
+        return 500;
+    }
+    a->fd = fd;
+    a->started = 0;
+    a->length = 0;
+
+    /* the records of the answer until FCGI_END_REQUEST */
+    while((n = read_until(sd, buf, FCGI_RECORD_HEADER, deadline)) == 0 && buf[0] == FCGI_VERSION_1) {
+        int type = buf[1], padding = buf[6];
+
+        left = (buf[4] << 8) | buf[5];
+        if(type == FCGI_END_REQUEST) {
+            ret = 0;
+            break;
+        }
+        while(n == 0 && left > 0) {
+            length = MIN(left, (int)sizeof(buf));
+            if((n = read_until(sd, buf, length, deadline)) < 0)
+                break;
+            left -= length;
+            if(type == FCGI_STDOUT) {
+                if((n = answer_data(a, (char *)buf, length)) != 0)
+                    n = (n < 0) ? -1 : -3;
+            } else if(type == FCGI_STDERR) {
+                OPRINT("%s: %.*s\n", parameter, (length > 0 && buf[length - 1] == '\n') ? length - 1 : length, buf);
+            }
+        }
+        if(n == 0 && padding > 0)
+            n = read_until(sd, buf, padding, deadline);
+        if(n != 0)
+            break;
+    }
+    close(sd);
+
+    if(n == -2) {
+        OPRINT("the FastCGI script %s did not answer within %d s\n", parameter, pc->conf.fastcgi_timeout);
+        ret = 504;
+    }
+
+    /* an answer of nothing but header fields, or nothing at all */
+    if(!a->started && ret == 0) {
+        if(a->length == 0)
+            ret = 502;
+        else if(answer_start(a, a->length) < 0)
+            ret = 0;
+    }
+    if(a->started)
+        ret = 0;
+
+    free(a);
+    return ret;
+}
+
+/******************************************************************************
+Description.: answer a request for a CGI script with its FastCGI processes,
+              which are started if they are not running
+Input Value.: * pc..........: the server context
+              * fd..........: the client
+              * parameter...: the requested file name
+              * query_string: query parameters
+Return Value: -
+******************************************************************************/
+void fcgi_execute(context *pc, int fd, const char *parameter, const char *query_string)
+{
+    fcgi_pool *pool = pc->fcgi;
+    unsigned long long deadline = monotonic_usec() + pc->conf.fastcgi_timeout * 1000000ULL;
+    struct timespec ts;
+    char path[BUFFER_SIZE];
+    fcgi_app *app;
+    int ret;
+
+    snprintf(path, sizeof(path), "%s%s", (pc->conf.www_folder != NULL) ? pc->conf.www_folder : "", parameter);
+    if(pc->conf.www_folder == NULL || access(path, X_OK) != 0) {
+        DBG("file %s not accessible\n", path);
+        send_error(fd, 404, "Could not open file");
+        return;
+    }
+
+    /* the request popen() was given has a blank for no query */
+    if(query_string == NULL || strcmp(query_string, " ") == 0)
+        query_string = "";
+
+    pthread_mutex_lock(&pool->mutex);
+    if(pool->stopping) {
+        pthread_mutex_unlock(&pool->mutex);
+        send_error(fd, 503, "The server is stopping");
+        return;
+    }
+    if((app = find_app(pool, path)) == NULL) {
+        pthread_mutex_unlock(&pool->mutex);
+        send_error(fd, 500, "The FastCGI script could not be started");
+        return;
+    }
+    if(start_processes(app, pc->conf.fastcgi) == 0) {
+        pthread_mutex_unlock(&pool->mutex);
+        send_error(fd, 502, "The FastCGI script is not running");
+        return;
+    }
+
+    /* each process takes a request at a time */
+    ts.tv_sec = deadline / 1000000ULL;
+    ts.tv_nsec = (deadline % 1000000ULL) * 1000;
+    while(app->busy >= pc->conf.fastcgi) {
+        if(pthread_cond_timedwait(&pool->idle, &pool->mutex, &ts) == ETIMEDOUT) {
+            pthread_mutex_unlock(&pool->mutex);
+            send_error(fd, 503, "All FastCGI processes of the script are busy");
+            return;
+        }
+        /* the script may be freed meanwhile */
+        if(pool->stopping) {
+            pthread_mutex_unlock(&pool->mutex);
+            send_error(fd, 503, "The server is stopping");
+            return;
+        }
+    }
+    app->busy++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if((ret = fcgi_request(pc, app, fd, parameter, query_string, deadline)) != 0)
+        send_error(fd, ret, (ret == 504) ? "The FastCGI script did not answer in time" :
+                   "The FastCGI script failed to answer");
+
+    /* a stopping pool waits for the last request */
+    pthread_mutex_lock(&pool->mutex);
+    app->busy--;
+    if(pool->stopping)
+        pthread_cond_broadcast(&pool->idle);
+    else
+        pthread_cond_signal(&pool->idle);
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,228 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Worker threads for short requests (option -W)
+ *
+ * Instead of creating a thread for every accepted connection, the server
+ * thread hands it to one of a few preallocated workers through a lock-free
+ * queue. A connection is only queued if a worker is idle, otherwise it gets a
+ * thread of its own as before, so a burst of slow clients can not delay the
+ * others. Streams leave the worker right after the request was parsed, either
+ * to the event loop or to a thread of their own.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+/* a slot of the queue, seq tells whether it is free or holds a connection */
+typedef struct {
+    unsigned long seq;
+    cfd *item;
+} pool_slot;
+
+struct _request_pool {
+    pool_slot *slots;
+    unsigned long mask;           /* number of slots - 1, a power of two */
+    unsigned long head;           /* next slot to fill */
+    unsigned long tail;           /* next slot to take */
+    int idle;                     /* workers waiting, minus reserved slots */
+    sem_t ready;                  /* counts queued connections */
+};
+
+/******************************************************************************
+Description.: put a connection into the queue, there must be a free slot
+Input Value.: * pool: the pool
+              * item: the connection
+Return Value: 0 on success, -1 if the queue is full
+******************************************************************************/
+static int queue_push(request_pool *pool, cfd *item)
+{
+    pool_slot *slot;
+    unsigned long pos;
+    long diff;
+
+    while(1) {
+        pos = pool->head;
+        slot = &pool->slots[pos & pool->mask];
+        diff = (long)(__sync_fetch_and_add(&slot->seq, 0) - pos);
+
+        if(diff == 0) {
+            if(__sync_bool_compare_and_swap(&pool->head, pos, pos + 1))
+                break;
+        } else if(diff < 0) {
+            return -1;
+        }
+    }
+
+    slot->item = item;
+    __sync_synchronize();
+    slot->seq = pos + 1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: take a connection from the queue
+Input Value.: the pool
+Return Value: the connection or NULL if the queue is empty
+******************************************************************************/
+static cfd *queue_pop(request_pool *pool)
+{
+    pool_slot *slot;
+    unsigned long pos;
+    cfd *item;
+    long diff;
+
+    while(1) {
+        pos = pool->tail;
+        slot = &pool->slots[pos & pool->mask];
+        diff = (long)(__sync_fetch_and_add(&slot->seq, 0) - (pos + 1));
+
+        if(diff == 0) {
+            if(__sync_bool_compare_and_swap(&pool->tail, pos, pos + 1))
+                break;
+        } else if(diff < 0) {
+            return NULL;
+        }
+    }
+
+    item = slot->item;
+    __sync_synchronize();
+    slot->seq = pos + pool->mask + 1;
+
+    return item;
+}
+
+/******************************************************************************
+Description.: a worker of the pool, serves one connection after the other
+Input Value.: the pool
+Return Value: never returns
+******************************************************************************/
+static void *worker_thread(void *arg)
+{
+    request_pool *pool = arg;
+    cfd *pcfd;
+
+    while(1) {
+        __sync_fetch_and_add(&pool->idle, 1);
+
+        while(sem_wait(&pool->ready) < 0 && errno == EINTR);
+
+        if((pcfd = queue_pop(pool)) == NULL)
+            continue;
+
+        /* client_thread frees pcfd */
+        client_thread(pcfd);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: start the worker threads of a server
+Input Value.: the server context, conf.workers is the number of threads
+Return Value: 0 if at least one worker runs, -1 otherwise
+******************************************************************************/
+int request_pool_start(context *pc)
+{
+    request_pool *pool;
+    unsigned long size = 1;
+    int i, started = 0;
+
+    if((pool = calloc(1, sizeof(request_pool))) == NULL)
+        return -1;
+
+    /* an idle worker is reserved for each queued connection, so this never fills up */
+    while(size < (unsigned long)pc->conf.workers)
+        size <<= 1;
+
+    if((pool->slots = calloc(size, sizeof(pool_slot))) == NULL ||
+       sem_init(&pool->ready, 0, 0) < 0) {
+        free(pool->slots);
+        free(pool);
+        return -1;
+    }
+
+    pool->mask = size - 1;
+    for(i = 0; i < (int)size; i++)
+        pool->slots[i].seq = i;
+
+    for(i = 0; i < pc->conf.workers; i++) {
+        if(client_thread_start(worker_thread, pool) < 0) {
+            DBG("could not launch worker thread %d\n", i);
+            break;
+        }
+        started++;
+    }
+
+    if(started == 0) {
+        sem_destroy(&pool->ready);
+        free(pool->slots);
+        free(pool);
+        return -1;
+    }
+
+    pc->pool = pool;
+    return 0;
+}
+
+/******************************************************************************
+Description.: hand an accepted connection to an idle worker
+Input Value.: * pc..: the server context
+              * pcfd: the connection, it belongs to the worker on success
+Return Value: 0 if a worker serves the connection, -1 if none is idle
+******************************************************************************/
+int request_pool_add(context *pc, cfd *pcfd)
+{
+    request_pool *pool = pc->pool;
+
+    if(pool == NULL)
+        return -1;
+
+    /* reserve an idle worker */
+    if(__sync_fetch_and_sub(&pool->idle, 1) <= 0) {
+        __sync_fetch_and_add(&pool->idle, 1);
+        return -1;
+    }
+
+    pcfd->pooled = 1;
+    if(queue_push(pool, pcfd) < 0) {
+        pcfd->pooled = 0;
+        __sync_fetch_and_add(&pool->idle, 1);
+        return -1;
+    }
+
+    sem_post(&pool->ready);
+    return 0;
+}
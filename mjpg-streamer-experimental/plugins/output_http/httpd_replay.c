@@ -0,0 +1,399 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * instant replay of the frames an input keeps with --replay
+ *
+ * ?action=replay streams the last seconds=N seconds as a regular M-JPEG
+ * stream, spaced like they were published or with fast=1 as fast as the
+ * client takes them, and ends with the newest of them. ?action=clip sends
+ * them as a download, concatenated JPEGs or with format=avi as an MJPEG
+ * AVI, built around the frames while it is sent. ?action=frame&seq=N gets
+ * frame N, also without --replay while it is among the last frames of the
+ * input. The parts and frames carry their number in X-Sequence.
+ *
+ * Everything comes from the references of the ring, there is no disk I/O.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+/* a clip of more than this is refused, an AVI without OpenDML ends there */
+#define CLIP_MAX_SIZE (1024LL * 1024 * 1024)
+
+/* hdrl with avih and strl (strh and strf) */
+#define AVI_HDRL_SIZE (4 + (8 + 56) + (12 + (8 + 56) + (8 + 40)))
+#define AVI_HEADER_SIZE (12 + 8 + AVI_HDRL_SIZE + 12)
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+
+static const char boundary[] = "\r\n--" BOUNDARY "\r\n";
+
+static unsigned char *put16(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static unsigned char *put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+    return p + 4;
+}
+
+static unsigned char *fourcc(unsigned char *p, const char *code)
+{
+    memcpy(p, code, 4);
+    return p + 4;
+}
+
+/******************************************************************************
+Description.: take the frames of the last seconds of an input, answering the
+              client if there are none
+Input Value.: * context_fd..: the client
+              * input_number: the input
+              * seconds.....: how far to go back, 0 for the whole ring
+              * frames......: gets the frames, see replay_get()
+Return Value: number of frames, 0 if the client got an error
+******************************************************************************/
+static int replay_frames(cfd *context_fd, int input_number, int seconds, input_frame ***frames)
+{
+    globals *pglobal = context_fd->pc->pglobal;
+    int count = replay_get(&pglobal->in[input_number], seconds * 1000000ULL, frames);
+
+    if(count < 0)
+        send_error(context_fd->fd, 404, "no replay for this input, see --replay");
+    else if(count == 0)
+        send_error(context_fd->fd, 503, "no frame available yet");
+    return MAX(count, 0);
+}
+
+/******************************************************************************
+Description.: release the frames of replay_frames()
+Input Value.: * frames: the frames
+              * count.: their number
+Return Value: -
+******************************************************************************/
+static void replay_release(input_frame **frames, int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++)
+        frame_unref(frames[i]);
+    free(frames);
+}
+
+/******************************************************************************
+Description.: Send the frames of the last seconds of an input as a stream,
+              spaced like they were published unless the client asked for
+              them as fast as possible. The stream ends after the newest one.
+Input Value.: * context_fd..: the client, with the seconds and the pace of
+                              ?action=replay
+              * input_number: the input
+Return Value: -
+******************************************************************************/
+void send_replay(cfd *context_fd, int input_number)
+{
+    globals *pglobal = context_fd->pc->pglobal;
+    char buffer[BUFFER_SIZE];
+    input_frame **frames, *frame;
+    unsigned long long start, due, now;
+    int count, len, i;
+
+    if((count = replay_frames(context_fd, input_number, context_fd->replay_sec, &frames)) == 0)
+        return;
+
+    len = stream_header(buffer, 0);
+    if(write(context_fd->fd, buffer, len) < 0) {
+        replay_release(frames, count);
+        return;
+    }
+
+    stream_set_timeout(context_fd);
+    admit_stream_start(context_fd);
+    start = monotonic_usec();
+    for(i = 0; i < count && !pglobal->stop; i++) {
+        frame = frames[i];
+
+        /* the frames keep the distance they were published at */
+        if(!context_fd->replay_fast) {
+            due = start + (frame->publish_usec - frames[0]->publish_usec);
+            if((now = monotonic_usec()) < due)
+                usleep(due - now);
+        }
+
+        len = sprintf(buffer, "X-Sequence: %llu\r\n", frame->seq);
+        len += stream_part_header(buffer + len, frame, 0);
+        stream_stats_begin(context_fd->pc, context_fd->fd, input_number, frame);
+        now = monotonic_usec();
+        if(write_part(context_fd, NULL, buffer, len, frame, (char *)boundary, sizeof(boundary) - 1) < 0) {
+            DBG("client of the replay disconnected\n");
+            break;
+        }
+        stream_stats_part(context_fd->pc, context_fd->fd, input_number, frame, 0, monotonic_usec() - now);
+    }
+    __sync_fetch_and_sub(&context_fd->pc->stats.stream_clients, 1);
+    replay_release(frames, count);
+}
+
+/******************************************************************************
+Description.: prepare the headers of an MJPEG AVI up to the start of the
+              frames of its movi list
+Input Value.: * header: gets the headers, AVI_HEADER_SIZE bytes
+              * frames: the frames
+              * count.: their number
+              * movi..: size of the data of the movi list
+              * riff..: size of the data of the RIFF
+Return Value: -
+******************************************************************************/
+static void avi_header(unsigned char *header, input_frame **frames, int count,
+                       unsigned int movi, unsigned int riff)
+{
+    unsigned long long duration = frames[count - 1]->publish_usec - frames[0]->publish_usec;
+    /* frames closer than a microsecond still last one */
+    unsigned int usec = (count > 1 && duration > 0) ? MAX(duration / (count - 1), 1) : 40000;
+    unsigned int max = 0;
+    unsigned char *p = header;
+    int width = 0, height = 0, i;
+
+    for(i = 0; i < count; i++)
+        max = MAX(max, (unsigned int)frame_length(frames[i]));
+    frame_picture_size(frames[count - 1], &width, &height);
+
+    p = fourcc(p, "RIFF");
+    p = put32(p, riff);
+    p = fourcc(p, "AVI ");
+
+    p = fourcc(p, "LIST");
+    p = put32(p, AVI_HDRL_SIZE);
+    p = fourcc(p, "hdrl");
+
+    p = fourcc(p, "avih");
+    p = put32(p, 56);
+    p = put32(p, usec);
+    p = put32(p, (unsigned long long)max * 1000000 / usec);
+    p = put32(p, 0);
+    p = put32(p, AVIF_HASINDEX);
+    p = put32(p, count);
+    p = put32(p, 0);
+    p = put32(p, 1);
+    p = put32(p, max);
+    p = put32(p, width);
+    p = put32(p, height);
+    memset(p, 0, 16);
+    p += 16;
+
+    p = fourcc(p, "LIST");
+    p = put32(p, 4 + (8 + 56) + (8 + 40));
+    p = fourcc(p, "strl");
+
+    p = fourcc(p, "strh");
+    p = put32(p, 56);
+    p = fourcc(p, "vids");
+    p = fourcc(p, "MJPG");
+    p = put32(p, 0);
+    p = put32(p, 0);
+    p = put32(p, 0);
+    p = put32(p, usec);
+    p = put32(p, 1000000);
+    p = put32(p, 0);
+    p = put32(p, count);
+    p = put32(p, max);
+    p = put32(p, 0xffffffff);
+    p = put32(p, 0);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, width);
+    p = put16(p, height);
+
+    p = fourcc(p, "strf");
+    p = put32(p, 40);
+    p = put32(p, 40);
+    p = put32(p, width);
+    p = put32(p, height);
+    p = put16(p, 1);
+    p = put16(p, 24);
+    p = fourcc(p, "MJPG");
+    p = put32(p, width * height * 3);
+    memset(p, 0, 16);
+    p += 16;
+
+    p = fourcc(p, "LIST");
+    p = put32(p, movi);
+    fourcc(p, "movi");
+}
+
+/******************************************************************************
+Description.: Send the frames of the last seconds of an input as a download,
+              concatenated JPEGs or an MJPEG AVI
+Input Value.: * context_fd..: the client
+              * input_number: the input
+              * parameter...: the parameters of ?action=clip, seconds=N and
+                              format=mjpg or avi
+              * keep_alive..: nonzero to keep the connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_clip(cfd *context_fd, int input_number, const char *parameter, int keep_alive)
+{
+    char buffer[BUFFER_SIZE];
+    unsigned char header[AVI_HEADER_SIZE], chunk[8], *index = NULL, *p;
+    static char pad[1] = {0};
+    input_frame **frames;
+    const char *q;
+    long long length = 0, movi = 4;
+    int count, avi, seconds = 0, len, size, i, rc = 0;
+
+    if((q = strstr(parameter, "seconds=")) != NULL)
+        seconds = MAX(atoi(q + strlen("seconds=")), 0);
+    avi = (strstr(parameter, "format=avi") != NULL);
+
+    if((count = replay_frames(context_fd, input_number, seconds, &frames)) == 0)
+        return -1;
+
+    /* the chunks of an AVI are padded to an even size, an index follows them */
+    for(i = 0; i < count; i++) {
+        size = frame_length(frames[i]);
+        length += size;
+        movi += 8 + size + (size & 1);
+    }
+    if(avi)
+        length = AVI_HEADER_SIZE + (movi - 4) + 8 + 16LL * count;
+    if(length > CLIP_MAX_SIZE) {
+        replay_release(frames, count);
+        send_error(context_fd->fd, 400, "the clip is too large, ask for fewer seconds");
+        return -1;
+    }
+
+    if(avi) {
+        if((index = malloc(8 + 16 * count)) == NULL) {
+            replay_release(frames, count);
+            send_error(context_fd->fd, 500, "not enough memory");
+            return -1;
+        }
+        avi_header(header, frames, count, movi, length - 8);
+
+        /* the offsets of idx1 count from the movi fourcc */
+        p = fourcc(index, "idx1");
+        p = put32(p, 16 * count);
+        for(i = 0, movi = 4; i < count; i++) {
+            size = frame_length(frames[i]);
+            p = fourcc(p, "00dc");
+            p = put32(p, AVIIF_KEYFRAME);
+            p = put32(p, movi);
+            p = put32(p, size);
+            movi += 8 + size + (size & 1);
+        }
+    }
+
+    len = snprintf(buffer, sizeof(buffer), "HTTP/1.%d 200 OK\r\n" \
+                   "Access-Control-Allow-Origin: *\r\n" \
+                   "Connection: %s\r\n" \
+                   STD_HEADER_FIELDS \
+                   "Content-type: %s\r\n" \
+                   "Content-Disposition: attachment; filename=\"replay_%d_%llu.%s\"\r\n" \
+                   "Content-Length: %lld\r\n" \
+                   "\r\n", HTTP_MINOR(keep_alive), connection_field(keep_alive),
+                   avi ? "video/x-msvideo" : "video/x-motion-jpeg", input_number, frames[0]->seq,
+                   avi ? "avi" : "mjpg", length);
+    if(write(context_fd->fd, buffer, len) != len ||
+       (avi && write(context_fd->fd, header, sizeof(header)) != sizeof(header)))
+        rc = -1;
+
+    for(i = 0; i < count && rc == 0; i++) {
+        size = frame_length(frames[i]);
+        if(avi) {
+            put32(fourcc(chunk, "00dc"), size);
+            rc = write_part(context_fd, NULL, (char *)chunk, sizeof(chunk), frames[i], pad, size & 1);
+        } else {
+            rc = write_part(context_fd, NULL, NULL, 0, frames[i], NULL, 0);
+        }
+    }
+    if(avi && rc == 0 && write(context_fd->fd, index, 8 + 16 * count) != 8 + 16 * count)
+        rc = -1;
+
+    free(index);
+    replay_release(frames, count);
+    return (rc == 0 && keep_alive) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: Send a frame of an input by its sequence number
+Input Value.: * context_fd..: the client
+              * input_number: the input
+              * parameter...: the parameters of ?action=frame, with seq=N
+              * keep_alive..: nonzero to keep the connection open afterwards
+Return Value: 0 if the connection can be used for further requests, -1 otherwise
+******************************************************************************/
+int send_replay_frame(cfd *context_fd, int input_number, const char *parameter, int keep_alive)
+{
+    char buffer[BUFFER_SIZE];
+    input_frame *frame;
+    const char *q;
+    char *end;
+    unsigned long long seq;
+    int len;
+
+    if((q = strstr(parameter, "seq=")) == NULL ||
+       (seq = strtoull(q + strlen("seq="), &end, 10)) == 0 || end == q + strlen("seq=")) {
+        send_error(context_fd->fd, 400, "seq must be the number of a frame");
+        return -1;
+    }
+    if((frame = replay_find(&context_fd->pc->pglobal->in[input_number], seq)) == NULL) {
+        send_error(context_fd->fd, 404, "the frame is not kept anymore or not there yet");
+        return -1;
+    }
+
+    /* a frame does not change, it may be kept for good */
+    len = snprintf(buffer, sizeof(buffer), "HTTP/1.%d 200 OK\r\n" \
+                   "Access-Control-Allow-Origin: *\r\n" \
+                   "Connection: %s\r\n" \
+                   "Server: MJPG-Streamer/0.2\r\n" \
+                   "Cache-Control: private, max-age=3600\r\n" \
+                   "Content-type: image/jpeg\r\n" \
+                   "Content-Length: %d\r\n" \
+                   "X-Timestamp: %d.%06d\r\n" \
+                   "X-Sequence: %llu\r\n" \
+                   "\r\n", HTTP_MINOR(keep_alive), connection_field(keep_alive), frame_length(frame),
+                   (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec, frame->seq);
+
+    if(write_part(context_fd, NULL, buffer, len, frame, NULL, 0) < 0)
+        keep_alive = 0;
+    frame_unref(frame);
+    return keep_alive ? 0 : -1;
+}
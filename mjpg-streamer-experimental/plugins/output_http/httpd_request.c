@@ -0,0 +1,214 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Reading and parsing the header of HTTP requests
+ *
+ * The bytes of a connection are read into its iobuffer as they come, a read
+ * usually gets the whole header of a request at once. http_parse_header()
+ * looks for the empty line ending the header with memchr(), which the C
+ * library implements with vector instructions, and remembers how far it got,
+ * so bytes arriving in pieces are scanned only once. It does not read itself:
+ * http_read_header() feeds it for the threads serving a connection, a loop
+ * polling many sockets can append what it read to the iobuffer and call it
+ * again until the header is complete. Bytes after the header belong to
+ * pipelined requests and stay in the buffer for the next one.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+/******************************************************************************
+Description.: initializes the iobuffer structure properly
+Input Value.: pointer to already allocated iobuffer
+Return Value: -
+******************************************************************************/
+void init_iobuffer(iobuffer *iobuf)
+{
+    iobuf->level = 0;
+    iobuf->parsed = 0;
+    iobuf->header = 0;
+    iobuf->next = 0;
+}
+
+/******************************************************************************
+Description.: looks for the end of the request header in the bytes read so far,
+              the scan goes on where the previous call stopped. Empty lines in
+              front of a request are dropped, like RFC 7230 asks for.
+Input Value.: iobuf: buffer of the connection
+Return Value: length of the header including its empty line, 0 if it is not
+              complete yet or -1 if it does not fit into the buffer
+******************************************************************************/
+int http_parse_header(iobuffer *iobuf)
+{
+    char *p, *end, *nl;
+
+    if(iobuf->header > 0)
+        return iobuf->header;
+
+    if(iobuf->parsed == 0) {
+        int skip = 0;
+
+        while(skip < iobuf->level && (iobuf->buffer[skip] == '\r' || iobuf->buffer[skip] == '\n'))
+            skip++;
+        if(skip > 0) {
+            memmove(iobuf->buffer, iobuf->buffer + skip, iobuf->level - skip);
+            iobuf->level -= skip;
+        }
+    }
+
+    /* p is the start of a line, the lines in front of it end with '\n' */
+    p = iobuf->buffer + iobuf->parsed;
+    end = iobuf->buffer + iobuf->level;
+    while(p < end) {
+        /* the header ends with an empty line */
+        if(p[0] == '\n') {
+            iobuf->header = p + 1 - iobuf->buffer;
+            return iobuf->header;
+        }
+        if(p[0] == '\r' && p + 1 < end && p[1] == '\n') {
+            iobuf->header = p + 2 - iobuf->buffer;
+            return iobuf->header;
+        }
+
+        if((nl = memchr(p, '\n', end - p)) == NULL)
+            break;
+        p = nl + 1;
+    }
+    iobuf->parsed = p - iobuf->buffer;
+
+    return (iobuf->level < REQUEST_BUFFER) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: reads from the client until the header of a request is complete,
+              without using signals
+Input Value.: * fd.....: fildescriptor to read from
+              * iobuf..: buffer of the connection, may hold bytes of the request
+                         already
+              * timeout: seconds to wait for further bytes
+Return Value: length of the header or -1 in case of timeout, error, a closed
+              connection or a header too large for the buffer
+******************************************************************************/
+int http_read_header(int fd, iobuffer *iobuf, int timeout)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int rc, flags = MSG_DONTWAIT;
+    ssize_t n;
+
+    while((rc = http_parse_header(iobuf)) == 0) {
+        /*
+         * the bytes are there most of the time, only if they are not
+         * the thread waits for them
+         */
+        n = recv(fd, iobuf->buffer + iobuf->level, REQUEST_BUFFER - iobuf->level, flags);
+        if(n > 0) {
+            iobuf->level += n;
+            continue;
+        }
+        if(n == 0)
+            return -1;
+        if(errno == EINTR)
+            continue;
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+
+        if((rc = poll(&pfd, 1, timeout * 1000)) < 0 && errno == EINTR)
+            continue;
+        if(rc <= 0) {
+            /* this must be a timeout */
+            return -1;
+        }
+    }
+
+    if(rc < 0) {
+        DBG("request header larger than %d bytes\n", REQUEST_BUFFER);
+    }
+
+    return rc;
+}
+
+/******************************************************************************
+Description.: copies the next line of a complete request header, the request
+              line comes first
+Input Value.: * iobuf..: buffer of the connection, http_parse_header() found
+                         the end of the header already
+              * line...: where to store the line with its line end, a line
+                         longer than the buffer gets cut off
+              * len....: bytes of line to use, one more is needed for the
+                         terminating zero
+Return Value: length of the line or 0 at the end of the header
+******************************************************************************/
+int http_header_line(iobuffer *iobuf, char *line, size_t len)
+{
+    char *p = iobuf->buffer + iobuf->next, *nl;
+    size_t n;
+
+    *line = '\0';
+    if(iobuf->next >= iobuf->header || p[0] == '\n' || (p[0] == '\r' && p[1] == '\n')) {
+        iobuf->next = iobuf->header;
+        return 0;
+    }
+
+    /* every line of a complete header ends with '\n' */
+    nl = memchr(p, '\n', iobuf->buffer + iobuf->header - p);
+    n = MIN((size_t)(nl + 1 - p), len);
+    memcpy(line, p, n);
+    line[n] = '\0';
+    iobuf->next = nl + 1 - iobuf->buffer;
+
+    return n;
+}
+
+/******************************************************************************
+Description.: drops the header of the request served, bytes of pipelined
+              requests after it move to the front of the buffer
+Input Value.: iobuf: buffer of the connection
+Return Value: -
+******************************************************************************/
+void http_header_done(iobuffer *iobuf)
+{
+    int rest = iobuf->level - iobuf->header;
+
+    if(iobuf->header > 0 && rest > 0)
+        memmove(iobuf->buffer, iobuf->buffer + iobuf->header, rest);
+    iobuf->level = (iobuf->header > 0) ? rest : 0;
+    iobuf->parsed = 0;
+    iobuf->header = 0;
+    iobuf->next = 0;
+}
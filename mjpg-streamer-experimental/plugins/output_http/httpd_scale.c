@@ -0,0 +1,1154 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Downscaled streams (parameter scale=1/2, 1/4 or 1/8) and cropped streams
+ * (parameter crop=x,y,width,height)
+ *
+ * libjpeg decodes a frame at the reduced size right in the DCT domain, which
+ * is much cheaper than decoding it fully, and the result is encoded again.
+ * A crop is lossless like the one of jpegtran: the coefficients of the blocks
+ * inside the region are copied to a new JPEG, nothing is decoded at all. The
+ * region starts at an MCU boundary, so it may grow a little to the left and
+ * top.
+ *
+ * Streams of a lower quality (parameter q=low, mid or high) are requantized:
+ * the coefficients are read from the entropy coded data, moved to the
+ * coarser quantization tables of the tier and entropy coded again. There is
+ * no IDCT and no color conversion, but with libjpeg-turbo the entropy coding
+ * dominates: a 1280x720 frame took 5.6-6.0 ms against 6.0-6.5 ms for
+ * decoding and encoding it. The saving grows with a plain libjpeg. A tier
+ * never gets finer tables than the frame has, a frame of a lower quality
+ * than the tier keeps that quality.
+ *
+ * This happens once per frame and variant for all clients that asked for it:
+ * the first one to see a new frame scales or crops it while the others wait
+ * on the lock of the variant and take a reference to the result. A variant
+ * only holds memory while at least one client is subscribed to it.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#include <jerror.h>
+#endif
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+#define SCALE_QUALITY 80
+#define SCALE_VARIANTS 3        /* 1/2, 1/4 and 1/8 */
+
+/* the quality tiers in the order of their numbers, 0 is the frame as it is */
+static const struct {
+    const char *name;
+    int quality;                /* of the tables, as with jpeg_set_quality() */
+} quality_tiers[] = {
+    { "low",  25 },
+    { "mid",  50 },
+    { "high", 80 },
+};
+
+/******************************************************************************
+Description.: Read the scale parameter like "&scale=1/4" of a request line
+Input Value.: the request line
+Return Value: the denominator of the scale, 1 if the parameter is missing,
+              -1 if the scale is not supported
+******************************************************************************/
+int scale_parameter(const char *line)
+{
+    const char *p = line;
+    int denom;
+
+    while((p = strstr(p, "scale=")) != NULL) {
+        if(p > line && (p[-1] == '&' || p[-1] == '?'))
+            break;
+        p += strlen("scale=");
+    }
+
+    if(p == NULL)
+        return 1;
+
+    p += strlen("scale=");
+    if(strncmp(p, "1/", 2) != 0)
+        return -1;
+
+    denom = atoi(p + 2);
+    #ifdef NO_LIBJPEG
+    return (denom == 1) ? 1 : -1;
+    #else
+    return (denom == 1 || denom == 2 || denom == 4 || denom == 8) ? denom : -1;
+    #endif
+}
+
+/******************************************************************************
+Description.: Read the crop parameter like "&crop=640,360,1280,720" of a
+              request line: left, top, width and height of the region
+Input Value.: * line: the request line
+              * rect: where to store the region, a width of 0 stands for the
+                      whole picture
+Return Value: 0 on success, -1 if the region is not valid or cropping is not
+              supported
+******************************************************************************/
+int crop_parameter(const char *line, crop_rect *rect)
+{
+    const char *p = line;
+
+    memset(rect, 0, sizeof(crop_rect));
+    while((p = strstr(p, "crop=")) != NULL) {
+        if(p > line && (p[-1] == '&' || p[-1] == '?'))
+            break;
+        p += strlen("crop=");
+    }
+
+    if(p == NULL)
+        return 0;
+
+    #ifdef NO_LIBJPEG
+    return -1;
+    #else
+    if(sscanf(p + strlen("crop="), "%d,%d,%d,%d", &rect->x, &rect->y, &rect->w, &rect->h) != 4 ||
+       rect->x < 0 || rect->y < 0 || rect->w <= 0 || rect->h <= 0) {
+        memset(rect, 0, sizeof(crop_rect));
+        return -1;
+    }
+
+    return 0;
+    #endif
+}
+
+/******************************************************************************
+Description.: Read the quality parameter like "&q=low" of a request line
+Input Value.: the request line
+Return Value: the number of the tier, 1 for the lowest, 0 if the parameter is
+              missing, -1 if the tier is unknown or not supported
+******************************************************************************/
+int quality_parameter(const char *line)
+{
+    const char *p = line;
+    int i;
+
+    while((p = strstr(p, "q=")) != NULL) {
+        if(p > line && (p[-1] == '&' || p[-1] == '?'))
+            break;
+        p += strlen("q=");
+    }
+
+    if(p == NULL)
+        return 0;
+
+    p += strlen("q=");
+    for(i = 0; i < LENGTH_OF(quality_tiers); i++) {
+        if(strncmp(p, quality_tiers[i].name, strlen(quality_tiers[i].name)) == 0 &&
+           strchr("& \r\n", p[strlen(quality_tiers[i].name)]) != NULL) {
+            #ifdef NO_LIBJPEG
+            return -1;
+            #else
+            return i + 1;
+            #endif
+        }
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: Decide if a stream takes a frame while the governor renews the
+              scaled, cropped and requantized frames of its input less often
+Input Value.: * input_number: the input the frame is from
+              * denom.......: denominator of the scale of the stream
+              * tier........: its quality tier
+              * crop........: its region, NULL for the whole picture
+              * frame.......: the candidate frame
+Return Value: 1 if the frame is due, 0 if the stream should skip it
+******************************************************************************/
+int variant_due(int input_number, int denom, int tier, crop_variant *crop, input_frame *frame)
+{
+    /* the frames as they are cost nothing to pass on */
+    if(denom == 1 && tier == 0 && crop == NULL)
+        return 1;
+
+    return governor_variant_due(input_number, frame->seq);
+}
+
+#ifdef NO_LIBJPEG
+
+int quality_subscribe(int input_number, int tier)
+{
+    return (tier == 0) ? 0 : -1;
+}
+
+void quality_unsubscribe(int input_number, int tier)
+{
+}
+
+input_frame *quality_frame(int input_number, int tier, input_frame *frame)
+{
+    return frame;
+}
+
+crop_variant *crop_subscribe(int input_number, crop_rect *rect)
+{
+    return NULL;
+}
+
+void crop_unsubscribe(crop_variant *v)
+{
+}
+
+input_frame *crop_frame(crop_variant *v, input_frame *frame)
+{
+    return frame;
+}
+
+int scale_subscribe(int input_number, int denom)
+{
+    return (denom == 1) ? 0 : -1;
+}
+
+void scale_unsubscribe(int input_number, int denom)
+{
+}
+
+input_frame *scale_frame(int input_number, int denom, input_frame *frame)
+{
+    return frame;
+}
+
+void scale_stop(void)
+{
+}
+
+#else
+
+/* the scaled frames of an input for one denominator */
+typedef struct {
+    pthread_mutex_t mutex;
+    int subscribers;
+    input_frame *frame;             /* the latest scaled frame */
+    unsigned char *out;             /* encoder output, kept between frames */
+    size_t out_size;
+} scale_variant;
+
+/* longjmp target for errors of libjpeg, the default handler would exit */
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} scale_error_mgr;
+
+/* encodes into the growing buffer of a variant */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    unsigned char **out;
+    size_t *out_size;
+} scale_dest_mgr;
+
+/*
+ * the variants of each input, allocated by the first client subscribing to
+ * a scale or a quality tier of it. An input keeps them, a client only looks
+ * them up after it subscribed.
+ */
+static scale_variant *variants[INPUT_TABLE_SIZE];
+static scale_variant *tiers[INPUT_TABLE_SIZE];
+static pthread_mutex_t variants_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * the encoder output of the variants. An idle variant gives it up for the
+ * memory budget and allocates it again with its next frame.
+ */
+static long long variants_evict(void *arg, long long bytes);
+static memory_account variant_memory = MEMORY_ACCOUNT("variants", MEMORY_CACHE, variants_evict, NULL);
+
+/******************************************************************************
+Description.: allocate the encoder output of a variant
+Input Value.: * out.....: gets the buffer
+              * out_size: gets its size
+              * size....: to allocate
+Return Value: 0 if ok, -1 without memory
+******************************************************************************/
+static int out_alloc(unsigned char **out, size_t *out_size, size_t size)
+{
+    if((*out = malloc(size)) == NULL)
+        return -1;
+
+    *out_size = size;
+    memory_add(&variant_memory, size);
+    return 0;
+}
+
+/******************************************************************************
+Description.: free the encoder output of a variant
+Input Value.: * out.....: the buffer, may be NULL
+              * out_size: its size
+Return Value: the bytes freed
+******************************************************************************/
+static long long out_free(unsigned char **out, size_t *out_size)
+{
+    long long size = (*out != NULL) ? (long long)*out_size : 0;
+
+    free(*out);
+    *out = NULL;
+    *out_size = 0;
+    memory_add(&variant_memory, -size);
+    return size;
+}
+
+/******************************************************************************
+Description.: find a variant in the table of an input
+Input Value.: * table.......: the variants of all inputs
+              * input_number: the input
+              * i...........: the variant of the input
+              * count.......: variants an input has
+              * create......: allocate the variants of the input if needed
+Return Value: the variant or NULL
+******************************************************************************/
+static scale_variant *variant_in(scale_variant **table, int input_number, int i, int count, int create)
+{
+    scale_variant *row;
+    int j;
+
+    if(input_number < 0 || input_number >= INPUT_TABLE_SIZE || i < 0 || i >= count)
+        return NULL;
+
+    /* the lock also publishes the initialized row to the subscriber */
+    if(create) {
+        pthread_mutex_lock(&variants_mutex);
+        if(table[input_number] == NULL && (row = calloc(count, sizeof(scale_variant))) != NULL) {
+            for(j = 0; j < count; j++)
+                pthread_mutex_init(&row[j].mutex, NULL);
+            table[input_number] = row;
+        }
+        pthread_mutex_unlock(&variants_mutex);
+    }
+
+    return (table[input_number] != NULL) ? &table[input_number][i] : NULL;
+}
+
+/******************************************************************************
+Description.: find the variant of an input for a denominator
+Input Value.: * input_number: the input
+              * denom.......: 2, 4 or 8
+              * create......: allocate the variants of the input if needed
+Return Value: the variant or NULL
+******************************************************************************/
+static scale_variant *variant_of(int input_number, int denom, int create)
+{
+    switch(denom) {
+    case 2: return variant_in(variants, input_number, 0, SCALE_VARIANTS, create);
+    case 4: return variant_in(variants, input_number, 1, SCALE_VARIANTS, create);
+    case 8: return variant_in(variants, input_number, 2, SCALE_VARIANTS, create);
+    }
+    return NULL;
+}
+
+static void scale_error_exit(j_common_ptr cinfo)
+{
+    scale_error_mgr *err = (scale_error_mgr *)cinfo->err;
+
+    #ifdef DEBUG
+    (*cinfo->err->output_message)(cinfo);
+    #endif
+    longjmp(err->setjmp_buffer, 1);
+}
+
+/* the whole frame is in memory, the source never needs to be refilled */
+static void src_init(j_decompress_ptr cinfo)
+{
+}
+
+static boolean src_fill(j_decompress_ptr cinfo)
+{
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+
+    /* a truncated frame ends here, libjpeg warns and fills the rest */
+    WARNMS(cinfo, JWRN_JPEG_EOF);
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+static void src_skip(j_decompress_ptr cinfo, long num_bytes)
+{
+    if(num_bytes <= 0)
+        return;
+
+    if((size_t)num_bytes > cinfo->src->bytes_in_buffer) {
+        src_fill(cinfo);
+        return;
+    }
+
+    cinfo->src->next_input_byte += num_bytes;
+    cinfo->src->bytes_in_buffer -= num_bytes;
+}
+
+static void src_term(j_decompress_ptr cinfo)
+{
+}
+
+static void dest_init(j_compress_ptr cinfo)
+{
+    scale_dest_mgr *dest = (scale_dest_mgr *)cinfo->dest;
+
+    dest->pub.next_output_byte = *dest->out;
+    dest->pub.free_in_buffer = *dest->out_size;
+}
+
+static boolean dest_empty(j_compress_ptr cinfo)
+{
+    scale_dest_mgr *dest = (scale_dest_mgr *)cinfo->dest;
+    unsigned char *out;
+
+    /* libjpeg calls this only with a completely full buffer */
+    if((out = realloc(*dest->out, *dest->out_size * 2)) == NULL)
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    memory_add(&variant_memory, *dest->out_size);
+
+    dest->pub.next_output_byte = out + *dest->out_size;
+    dest->pub.free_in_buffer = *dest->out_size;
+    *dest->out = out;
+    *dest->out_size *= 2;
+    return TRUE;
+}
+
+static void dest_term(j_compress_ptr cinfo)
+{
+}
+
+/******************************************************************************
+Description.: set up the source and destination of libjpeg for the buffers of
+              a variant
+Input Value.: * src.....: source manager to read from the frame
+              * dest....: destination manager writing to out
+              * source..: the original frame
+              * out.....: buffer of the variant, grows as needed
+              * out_size: its size
+Return Value: -
+******************************************************************************/
+static void buffers_init(struct jpeg_source_mgr *src, scale_dest_mgr *dest, input_frame *source, unsigned char **out, size_t *out_size)
+{
+    src->init_source = src_init;
+    src->fill_input_buffer = src_fill;
+    src->skip_input_data = src_skip;
+    src->resync_to_restart = jpeg_resync_to_restart;
+    src->term_source = src_term;
+    src->next_input_byte = source->buf;
+    src->bytes_in_buffer = source->size;
+
+    dest->pub.init_destination = dest_init;
+    dest->pub.empty_output_buffer = dest_empty;
+    dest->pub.term_destination = dest_term;
+    dest->out = out;
+    dest->out_size = out_size;
+}
+
+/******************************************************************************
+Description.: copy the encoded variant into a frame of its own
+Input Value.: * out...: the encoded JPEG
+              * len...: its length
+              * source: the original frame
+Return Value: the new frame or NULL
+******************************************************************************/
+static input_frame *variant_frame(unsigned char *out, size_t len, input_frame *source)
+{
+    input_frame *frame;
+
+    if((frame = frame_alloc(len)) != NULL) {
+        memcpy(frame->buf, out, len);
+        frame->size = len;
+        frame->timestamp = source->timestamp;
+        frame->seq = source->seq;
+        /* the age of a variant counts from the original */
+        frame->capture_usec = source->capture_usec;
+        frame->dequeue_usec = source->dequeue_usec;
+        frame->encoded_usec = source->encoded_usec;
+        frame->publish_usec = source->publish_usec;
+        frame->burst = source->burst;
+        frame->burst_index = source->burst_index;
+        /* the metadata of the original stays valid */
+        frame->app_size = source->app_size;
+        memcpy(frame->app, source->app, source->app_size);
+    }
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: decode a frame at a reduced size and encode it again
+Input Value.: * v.....: the variant, its mutex must be held
+              * denom.: 2, 4 or 8
+              * source: the full size frame
+Return Value: the scaled frame or NULL on errors
+******************************************************************************/
+static input_frame *scale_encode(scale_variant *v, int denom, input_frame *source)
+{
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_source_mgr src;
+    scale_dest_mgr dest;
+    scale_error_mgr err;
+    JSAMPROW volatile row = NULL;
+    input_frame *frame;
+    size_t len;
+
+    if(v->out == NULL && out_alloc(&v->out, &v->out_size, MAX(source->size / denom, 4096)) < 0)
+        return NULL;
+
+    /* both share the error handler, a broken frame must not exit the program */
+    dinfo.err = cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = scale_error_exit;
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        free(row);
+        return NULL;
+    }
+
+    buffers_init(&src, &dest, source, &v->out, &v->out_size);
+    dinfo.src = &src;
+
+    jpeg_read_header(&dinfo, TRUE);
+
+    /* scaling happens in the inverse DCT, the color conversion is skipped */
+    dinfo.scale_num = 1;
+    dinfo.scale_denom = denom;
+    dinfo.dct_method = JDCT_IFAST;
+    dinfo.do_fancy_upsampling = FALSE;
+    if(dinfo.jpeg_color_space == JCS_YCbCr)
+        dinfo.out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(&dinfo);
+
+    cinfo.dest = &dest.pub;
+
+    cinfo.image_width = dinfo.output_width;
+    cinfo.image_height = dinfo.output_height;
+    cinfo.input_components = dinfo.output_components;
+    cinfo.in_color_space = dinfo.out_color_space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, SCALE_QUALITY, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+
+    if((row = malloc(dinfo.output_width * dinfo.output_components)) == NULL)
+        ERREXIT1(&cinfo, JERR_OUT_OF_MEMORY, 0);
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while(dinfo.output_scanline < dinfo.output_height) {
+        JSAMPROW rows[1] = { row };
+        jpeg_read_scanlines(&dinfo, rows, 1);
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+
+    len = v->out_size - dest.pub.free_in_buffer;
+    frame = variant_frame(v->out, len, source);
+
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    free(row);
+    return frame;
+}
+
+/******************************************************************************
+Description.: Register a client for a scale, the scaled frames are kept
+              while there are clients
+Input Value.: * input_number: the input
+              * denom.......: denominator of the scale, 1 for full size
+Return Value: 0 on success, -1 if the scale is not supported
+******************************************************************************/
+int scale_subscribe(int input_number, int denom)
+{
+    scale_variant *v;
+
+    if(denom == 1)
+        return 0;
+
+    if((v = variant_of(input_number, denom, 1)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&v->mutex);
+    v->subscribers++;
+    pthread_mutex_unlock(&v->mutex);
+    return 0;
+}
+
+/******************************************************************************
+Description.: Unregister a client, the last one releases the scaled frames
+Input Value.: * input_number: the input
+              * denom.......: denominator of the scale, 1 for full size
+Return Value: -
+******************************************************************************/
+void scale_unsubscribe(int input_number, int denom)
+{
+    scale_variant *v;
+
+    if(denom == 1 || (v = variant_of(input_number, denom, 0)) == NULL)
+        return;
+
+    pthread_mutex_lock(&v->mutex);
+    if(--v->subscribers == 0) {
+        frame_unref(v->frame);
+        v->frame = NULL;
+        out_free(&v->out, &v->out_size);
+    }
+    pthread_mutex_unlock(&v->mutex);
+}
+
+/******************************************************************************
+Description.: Get the scaled version of a frame, it is only computed by the
+              first client asking for it
+Input Value.: * input_number: the input the frame is from
+              * denom.......: denominator of the scale, 1 for full size
+              * frame.......: the full size frame, the reference is taken over
+Return Value: a reference to the scaled frame, the full size frame if it
+              could not be scaled
+******************************************************************************/
+input_frame *scale_frame(int input_number, int denom, input_frame *frame)
+{
+    scale_variant *v;
+    input_frame *scaled;
+
+    if(denom == 1 || (v = variant_of(input_number, denom, 0)) == NULL)
+        return frame;
+
+    pthread_mutex_lock(&v->mutex);
+
+    /* a client lagging behind gets the newer frame another one asked for */
+    if(v->frame == NULL || v->frame->seq < frame->seq) {
+        if((scaled = scale_encode(v, denom, frame)) == NULL) {
+            pthread_mutex_unlock(&v->mutex);
+            DBG("could not scale frame %llu\n", frame->seq);
+            return frame;
+        }
+        frame_unref(v->frame);
+        v->frame = scaled;
+    }
+
+    scaled = frame_ref(v->frame);
+    pthread_mutex_unlock(&v->mutex);
+
+    frame_unref(frame);
+    return scaled;
+}
+
+/******************************************************************************
+Description.: move the coefficients of the blocks of a component to another
+              quantization table, rounding to the nearest step. The division
+              is a multiplication with the reciprocal of the step, exact for
+              all values a coefficient times its step can take.
+Input Value.: * dinfo: decompressor holding the coefficients
+              * coef.: the coefficients of the component
+              * comp.: the component
+              * from.: the table they are quantized with
+              * to...: the table of the tier, not finer than from
+Return Value: -
+******************************************************************************/
+static void requantize_component(j_decompress_ptr dinfo, jvirt_barray_ptr coef, jpeg_component_info *comp,
+                                 const JQUANT_TBL *from, const JQUANT_TBL *to)
+{
+    JBLOCKARRAY rows;
+    JCOEFPTR block;
+    JDIMENSION row, x;
+    unsigned long long reciprocal[DCTSIZE2];
+    unsigned int scale[DCTSIZE2], half[DCTSIZE2], value;
+    int i, k, n = 0, index[DCTSIZE2];
+
+    /* only the coefficients whose step changes are touched */
+    for(k = 0; k < DCTSIZE2; k++) {
+        if(to->quantval[k] == from->quantval[k])
+            continue;
+        index[n] = k;
+        scale[n] = from->quantval[k];
+        half[n] = to->quantval[k] / 2;
+        reciprocal[n++] = ((1ULL << 32) + to->quantval[k] - 1) / to->quantval[k];
+    }
+    if(n == 0)
+        return;
+
+    for(row = 0; row < comp->height_in_blocks; row += comp->v_samp_factor) {
+        rows = (*dinfo->mem->access_virt_barray)((j_common_ptr)dinfo, coef, row, comp->v_samp_factor, TRUE);
+        for(i = 0; i < comp->v_samp_factor && row + i < comp->height_in_blocks; i++) {
+            for(x = 0; x < comp->width_in_blocks; x++) {
+                block = rows[i][x];
+                for(k = 0; k < n; k++) {
+                    if(block[index[k]] == 0)
+                        continue;
+                    value = ABS(block[index[k]]) * scale[k] + half[k];
+                    value = (value * reciprocal[k]) >> 32;
+                    block[index[k]] = (block[index[k]] < 0) ? -(int)value : (int)value;
+                }
+            }
+        }
+    }
+}
+
+/******************************************************************************
+Description.: requantize a frame to the tables of a tier, in the DCT domain
+Input Value.: * v.....: the variant, its mutex must be held
+              * tier..: the number of the tier
+              * source: the frame
+Return Value: the requantized frame or NULL on errors
+******************************************************************************/
+static input_frame *quality_encode(scale_variant *v, int tier, input_frame *source)
+{
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_source_mgr src;
+    scale_dest_mgr dest;
+    scale_error_mgr err;
+    jvirt_barray_ptr *coef;
+    JQUANT_TBL *to;
+    input_frame *frame;
+    int ci, k, slot;
+
+    if(v->out == NULL && out_alloc(&v->out, &v->out_size, MAX(source->size / 2, 4096)) < 0)
+        return NULL;
+
+    dinfo.err = cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = scale_error_exit;
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        return NULL;
+    }
+
+    buffers_init(&src, &dest, source, &v->out, &v->out_size);
+    dinfo.src = &src;
+    cinfo.dest = &dest.pub;
+
+    jpeg_read_header(&dinfo, TRUE);
+    coef = jpeg_read_coefficients(&dinfo);
+    jpeg_copy_critical_parameters(&dinfo, &cinfo);
+
+    /* the standard tables of the tier, the luma one in slot 0, the chroma one in slot 1 */
+    jpeg_set_quality(&cinfo, quality_tiers[tier - 1].quality, TRUE);
+    for(ci = 0; ci < cinfo.num_components; ci++) {
+        slot = (ci == 0) ? 0 : 1;
+        to = cinfo.quant_tbl_ptrs[slot];
+        for(k = 0; k < DCTSIZE2; k++)
+            to->quantval[k] = MAX(to->quantval[k], dinfo.comp_info[ci].quant_table->quantval[k]);
+    }
+
+    /* with the tables complete, the coefficients move to them */
+    for(ci = 0; ci < cinfo.num_components; ci++) {
+        slot = (ci == 0) ? 0 : 1;
+        cinfo.comp_info[ci].quant_tbl_no = slot;
+        requantize_component(&dinfo, coef[ci], &dinfo.comp_info[ci], dinfo.comp_info[ci].quant_table,
+                             cinfo.quant_tbl_ptrs[slot]);
+    }
+
+    jpeg_write_coefficients(&cinfo, coef);
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+
+    frame = variant_frame(v->out, v->out_size - dest.pub.free_in_buffer, source);
+
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    return frame;
+}
+
+/******************************************************************************
+Description.: Register a client for a quality tier, the requantized frames
+              are kept while there are clients
+Input Value.: * input_number: the input
+              * tier........: the number of the tier, 0 for the frames as
+                              they are
+Return Value: 0 on success, -1 if the tier is not supported
+******************************************************************************/
+int quality_subscribe(int input_number, int tier)
+{
+    scale_variant *v;
+
+    if(tier == 0)
+        return 0;
+
+    if((v = variant_in(tiers, input_number, tier - 1, LENGTH_OF(quality_tiers), 1)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&v->mutex);
+    v->subscribers++;
+    pthread_mutex_unlock(&v->mutex);
+    return 0;
+}
+
+/******************************************************************************
+Description.: Unregister a client, the last one releases the frames of the tier
+Input Value.: * input_number: the input
+              * tier........: the number of the tier, 0 for the frames as
+                              they are
+Return Value: -
+******************************************************************************/
+void quality_unsubscribe(int input_number, int tier)
+{
+    scale_variant *v;
+
+    if(tier == 0 || (v = variant_in(tiers, input_number, tier - 1, LENGTH_OF(quality_tiers), 0)) == NULL)
+        return;
+
+    pthread_mutex_lock(&v->mutex);
+    if(--v->subscribers == 0) {
+        frame_unref(v->frame);
+        v->frame = NULL;
+        out_free(&v->out, &v->out_size);
+    }
+    pthread_mutex_unlock(&v->mutex);
+}
+
+/******************************************************************************
+Description.: Get the requantized version of a frame, it is only computed by
+              the first client asking for it
+Input Value.: * input_number: the input the frame is from
+              * tier........: the number of the tier, 0 for the frames as
+                              they are
+              * frame.......: the frame, the reference is taken over
+Return Value: a reference to the requantized frame, the frame itself if it
+              could not be requantized
+******************************************************************************/
+input_frame *quality_frame(int input_number, int tier, input_frame *frame)
+{
+    scale_variant *v;
+    input_frame *requantized;
+
+    if(tier == 0 || (v = variant_in(tiers, input_number, tier - 1, LENGTH_OF(quality_tiers), 0)) == NULL)
+        return frame;
+
+    pthread_mutex_lock(&v->mutex);
+
+    /* a client lagging behind gets the newer frame another one asked for */
+    if(v->frame == NULL || v->frame->seq < frame->seq) {
+        if((requantized = quality_encode(v, tier, frame)) == NULL) {
+            pthread_mutex_unlock(&v->mutex);
+            DBG("could not requantize frame %llu\n", frame->seq);
+            return frame;
+        }
+        frame_unref(v->frame);
+        v->frame = requantized;
+    }
+
+    requantized = frame_ref(v->frame);
+    pthread_mutex_unlock(&v->mutex);
+
+    frame_unref(frame);
+    return requantized;
+}
+
+/* the cropped frames of an input for one region */
+struct _crop_variant {
+    pthread_mutex_t mutex;
+    int input_number;
+    crop_rect rect;
+    int subscribers;                /* protected by crops_mutex */
+    input_frame *frame;             /* the latest cropped frame */
+    unsigned char *out;             /* encoder output, kept between frames */
+    size_t out_size;
+    struct _crop_variant *next;
+};
+
+/* the regions clients watch, of all inputs */
+static crop_variant *crops;
+static pthread_mutex_t crops_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+Description.: number of blocks of a component along one side of a region,
+              rounded up to whole MCUs
+Input Value.: * size: width or height of the region in pixels
+              * samp: sampling factor of the component along this side
+              * mcu.: pixels of an MCU along this side
+Return Value: the number of blocks
+******************************************************************************/
+static JDIMENSION region_blocks(JDIMENSION size, int samp, JDIMENSION mcu)
+{
+    return (size + mcu - 1) / mcu * samp;
+}
+
+/******************************************************************************
+Description.: copy the blocks of a region into a new JPEG, without decoding
+Input Value.: * v.....: the variant, its mutex must be held
+              * source: the full frame
+Return Value: the cropped frame or NULL on errors or a region outside of the
+              picture
+******************************************************************************/
+static input_frame *crop_encode(crop_variant *v, input_frame *source)
+{
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_source_mgr src;
+    scale_dest_mgr dest;
+    scale_error_mgr err;
+    jvirt_barray_ptr *src_coef, dst_coef[MAX_COMPONENTS];
+    jpeg_component_info *comp;
+    JDIMENSION mcu_w, mcu_h, x, y, w, h, width, height, row;
+    input_frame *frame = NULL;
+    int ci, i;
+
+    if(v->out == NULL && out_alloc(&v->out, &v->out_size, MAX(source->size / 4, 4096)) < 0)
+        return NULL;
+
+    dinfo.err = cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = scale_error_exit;
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        return NULL;
+    }
+
+    buffers_init(&src, &dest, source, &v->out, &v->out_size);
+    dinfo.src = &src;
+    cinfo.dest = &dest.pub;
+
+    jpeg_read_header(&dinfo, TRUE);
+
+    /* the region starts at an MCU, like with jpegtran -crop */
+    mcu_w = dinfo.max_h_samp_factor * DCTSIZE;
+    mcu_h = dinfo.max_v_samp_factor * DCTSIZE;
+    if(v->rect.x >= dinfo.image_width || v->rect.y >= dinfo.image_height) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        return NULL;
+    }
+    x = v->rect.x / mcu_w;
+    y = v->rect.y / mcu_h;
+    width = MIN((JDIMENSION)(v->rect.x + v->rect.w), dinfo.image_width) - x * mcu_w;
+    height = MIN((JDIMENSION)(v->rect.y + v->rect.h), dinfo.image_height) - y * mcu_h;
+
+    /* arrays for the blocks of the region, covering whole MCUs like the source */
+    for(ci = 0; ci < dinfo.num_components; ci++) {
+        comp = &dinfo.comp_info[ci];
+        w = region_blocks(width, comp->h_samp_factor, mcu_w);
+        h = region_blocks(height, comp->v_samp_factor, mcu_h);
+        dst_coef[ci] = (*dinfo.mem->request_virt_barray)((j_common_ptr)&dinfo, JPOOL_IMAGE, FALSE, w, h, comp->v_samp_factor);
+    }
+
+    src_coef = jpeg_read_coefficients(&dinfo);
+
+    for(ci = 0; ci < dinfo.num_components; ci++) {
+        comp = &dinfo.comp_info[ci];
+        w = region_blocks(width, comp->h_samp_factor, mcu_w);
+        h = region_blocks(height, comp->v_samp_factor, mcu_h);
+
+        for(row = 0; row < h; row += comp->v_samp_factor) {
+            JBLOCKARRAY dst = (*dinfo.mem->access_virt_barray)((j_common_ptr)&dinfo, dst_coef[ci], row, comp->v_samp_factor, TRUE);
+            JBLOCKARRAY in = (*dinfo.mem->access_virt_barray)((j_common_ptr)&dinfo, src_coef[ci],
+                             row + y * comp->v_samp_factor, comp->v_samp_factor, FALSE);
+
+            for(i = 0; i < comp->v_samp_factor; i++)
+                memcpy(dst[i], in[i] + x * comp->h_samp_factor, w * sizeof(JBLOCK));
+        }
+    }
+
+    /* same tables and sampling, only the size differs */
+    jpeg_copy_critical_parameters(&dinfo, &cinfo);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    jpeg_write_coefficients(&cinfo, dst_coef);
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+
+    frame = variant_frame(v->out, v->out_size - dest.pub.free_in_buffer, source);
+
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    return frame;
+}
+
+/******************************************************************************
+Description.: Register a client for a region of an input, clients asking for
+              the same region share its variant
+Input Value.: * input_number: the input
+              * rect........: the region, a width of 0 for the whole picture
+Return Value: the variant or NULL for the whole picture and on errors
+******************************************************************************/
+crop_variant *crop_subscribe(int input_number, crop_rect *rect)
+{
+    crop_variant *v;
+
+    if(rect->w == 0)
+        return NULL;
+
+    pthread_mutex_lock(&crops_mutex);
+    for(v = crops; v != NULL; v = v->next) {
+        if(v->input_number == input_number && memcmp(&v->rect, rect, sizeof(crop_rect)) == 0)
+            break;
+    }
+
+    if(v == NULL && (v = calloc(1, sizeof(crop_variant))) != NULL) {
+        pthread_mutex_init(&v->mutex, NULL);
+        v->input_number = input_number;
+        v->rect = *rect;
+        v->next = crops;
+        crops = v;
+    }
+
+    if(v != NULL)
+        v->subscribers++;
+    pthread_mutex_unlock(&crops_mutex);
+
+    return v;
+}
+
+/******************************************************************************
+Description.: Unregister a client, the last one frees the variant
+Input Value.: v: the variant returned by crop_subscribe(), may be NULL
+Return Value: -
+******************************************************************************/
+void crop_unsubscribe(crop_variant *v)
+{
+    crop_variant **p;
+
+    if(v == NULL)
+        return;
+
+    pthread_mutex_lock(&crops_mutex);
+    if(--v->subscribers > 0) {
+        pthread_mutex_unlock(&crops_mutex);
+        return;
+    }
+    for(p = &crops; *p != v; p = &(*p)->next);
+    *p = v->next;
+    pthread_mutex_unlock(&crops_mutex);
+
+    /* nobody else knows the variant any more */
+    frame_unref(v->frame);
+    out_free(&v->out, &v->out_size);
+    pthread_mutex_destroy(&v->mutex);
+    free(v);
+}
+
+/******************************************************************************
+Description.: Get the cropped version of a frame, it is only computed by the
+              first client asking for it
+Input Value.: * v....: the variant returned by crop_subscribe(), may be NULL
+              * frame: the full frame, the reference is taken over
+Return Value: a reference to the cropped frame, the full frame if it could not
+              be cropped
+******************************************************************************/
+input_frame *crop_frame(crop_variant *v, input_frame *frame)
+{
+    input_frame *cropped;
+
+    if(v == NULL)
+        return frame;
+
+    pthread_mutex_lock(&v->mutex);
+
+    /* a client lagging behind gets the newer frame another one asked for */
+    if(v->frame == NULL || v->frame->seq < frame->seq) {
+        if((cropped = crop_encode(v, frame)) == NULL) {
+            pthread_mutex_unlock(&v->mutex);
+            DBG("could not crop frame %llu\n", frame->seq);
+            return frame;
+        }
+        frame_unref(v->frame);
+        v->frame = cropped;
+    }
+
+    cropped = frame_ref(v->frame);
+    pthread_mutex_unlock(&v->mutex);
+
+    frame_unref(frame);
+    return cropped;
+}
+
+/******************************************************************************
+Description.: free the encoder output of a variant unless it is busy
+Input Value.: * mutex...: of the variant
+              * out.....: the buffer
+              * out_size: its size
+Return Value: the bytes freed
+******************************************************************************/
+static long long evict_out(pthread_mutex_t *mutex, unsigned char **out, size_t *out_size)
+{
+    long long size;
+
+    /* one encoding a frame keeps its buffer this time */
+    if(pthread_mutex_trylock(mutex) != 0)
+        return 0;
+    size = out_free(out, out_size);
+    pthread_mutex_unlock(mutex);
+    return size;
+}
+
+/******************************************************************************
+Description.: give up the encoder output of the variants and their account
+              once the last server stopped
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void scale_stop(void)
+{
+    variants_evict(NULL, LLONG_MAX);
+    memory_unregister(&variant_memory);
+}
+
+/******************************************************************************
+Description.: free the encoder output of the variants for the memory budget
+Input Value.: * arg..: unused
+              * bytes: to free
+Return Value: bytes freed
+******************************************************************************/
+static long long variants_evict(void *arg, long long bytes)
+{
+    long long freed = 0;
+    scale_variant *row;
+    crop_variant *c;
+    int i, j;
+
+    for(i = 0; i < INPUT_TABLE_SIZE && freed < bytes; i++) {
+        if((row = variants[i]) != NULL) {
+            for(j = 0; j < SCALE_VARIANTS; j++)
+                freed += evict_out(&row[j].mutex, &row[j].out, &row[j].out_size);
+        }
+        if((row = tiers[i]) != NULL) {
+            for(j = 0; j < LENGTH_OF(quality_tiers); j++)
+                freed += evict_out(&row[j].mutex, &row[j].out, &row[j].out_size);
+        }
+    }
+
+    /* a region is freed only after it left the list */
+    pthread_mutex_lock(&crops_mutex);
+    for(c = crops; c != NULL && freed < bytes; c = c->next)
+        freed += evict_out(&c->mutex, &c->out, &c->out_size);
+    pthread_mutex_unlock(&crops_mutex);
+
+    return freed;
+}
+
+#endif
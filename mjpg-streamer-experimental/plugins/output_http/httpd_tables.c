@@ -0,0 +1,135 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Abbreviated JPEG streams (tables=1)
+ *
+ * Every frame of an input carries the same JFIF segment, quantization and
+ * Huffman tables, easily 600 bytes, which is a good part of a small frame at
+ * a high frame rate. A stream with tables=1 sends them once as an abbreviated
+ * table specification (SOI, the table segments, EOI) and again whenever they
+ * change, e.g. when an adaptive stream moves to another quality. Each frame
+ * then goes out as an abbreviated image without them. A client gets the full
+ * picture back by putting the segments between the SOI and EOI of the last
+ * tables right after the SOI of the frame. Frames which can not be split, or
+ * carry no tables at all, are sent whole.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+#define M_SOI  0xd8
+#define M_EOI  0xd9
+#define M_SOS  0xda
+#define M_DQT  0xdb
+#define M_DHT  0xc4
+#define M_APP0 0xe0
+
+/******************************************************************************
+Description.: split a frame into its tables and the abbreviated image. The
+              frame itself is not changed, the image is the header collected
+              in a->head followed by the frame from a->offset on.
+Input Value.: * a....: the tables the client got so far, updated
+              * frame: the frame to send
+Return Value: 0 if the frame can be sent abbreviated, a->changed tells if the
+              tables have to go out first, -1 to send the frame as it is
+******************************************************************************/
+int jpeg_abbreviate(jpeg_tables *a, const input_frame *frame)
+{
+    unsigned char tables[JPEG_TABLES_SIZE];
+    const unsigned char *buf = frame->buf;
+    int pos = 2, len, table, t = 2, h = 2;
+
+    if(frame->size < 4 || buf[0] != 0xff || buf[1] != M_SOI)
+        return -1;
+
+    tables[0] = a->head[0] = 0xff;
+    tables[1] = a->head[1] = M_SOI;
+
+    /* the segment published along with the frame belongs to this picture */
+    if(frame->app_size > 0) {
+        memcpy(a->head + h, frame->app, frame->app_size);
+        h += frame->app_size;
+    }
+
+    /* the segments up to the scan, the tables go one way and the rest the other */
+    while(pos + 4 <= frame->size && buf[pos] == 0xff && buf[pos + 1] != M_SOS) {
+        if(buf[pos + 1] == 0xff) {
+            pos++;
+            continue;
+        }
+
+        len = 2 + ((buf[pos + 2] << 8) | buf[pos + 3]);
+        if(len < 4 || pos + len > frame->size)
+            return -1;
+
+        table = (buf[pos + 1] == M_DQT || buf[pos + 1] == M_DHT ||
+                 (buf[pos + 1] == M_APP0 && len >= 9 && memcmp(buf + pos + 4, "JFIF", 5) == 0));
+        if(table) {
+            if(t + len + 2 > JPEG_TABLES_SIZE)
+                return -1;
+            memcpy(tables + t, buf + pos, len);
+            t += len;
+        } else {
+            if(h + len > JPEG_HEAD_SIZE)
+                return -1;
+            memcpy(a->head + h, buf + pos, len);
+            h += len;
+        }
+        pos += len;
+    }
+
+    /* no scan, or nothing to leave out */
+    if(pos + 4 > frame->size || buf[pos] != 0xff || buf[pos + 1] != M_SOS || t == 2)
+        return -1;
+
+    tables[t++] = 0xff;
+    tables[t++] = M_EOI;
+
+    a->changed = (t != a->tables_len || memcmp(tables, a->tables, t) != 0);
+    if(a->changed) {
+        memcpy(a->tables, tables, t);
+        a->tables_len = t;
+    }
+    a->head_len = h;
+    a->offset = frame->app_size + pos;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: length of the abbreviated image of the last jpeg_abbreviate()
+Input Value.: * a....: the tables of the client
+              * frame: the frame
+Return Value: bytes of the image
+******************************************************************************/
+int jpeg_abbreviated_length(const jpeg_tables *a, const input_frame *frame)
+{
+    return a->head_len + frame_length(frame) - (int)a->offset;
+}
@@ -0,0 +1,314 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * HTTPS (options -C and -K, build option ENABLE_HTTPS)
+ *
+ * OpenSSL performs the handshake, afterwards the keys are handed to the
+ * kernel (kTLS) which encrypts and decrypts the records itself. The socket
+ * then behaves like a plain one, so the rest of the server writes frames to
+ * it as before and no copy of them passes through userspace.
+ *
+ * If the kernel can not take over both directions, e.g. because the tls
+ * module is missing, a proxy thread encrypts in userspace and talks to the
+ * server through a socketpair.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+#define TLS_HANDSHAKE_TIMEOUT 5         /* seconds */
+
+/* ciphers the kernel can take over */
+#define TLS_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:" \
+    "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+#define TLS_CIPHERSUITES "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+
+struct _tls_server {
+    SSL_CTX *ctx;
+};
+
+/* a connection encrypted in userspace */
+typedef struct {
+    SSL *ssl;
+    int fd;                     /* the TCP connection */
+    int pair;                   /* our end of the socketpair */
+} tls_proxy;
+
+/******************************************************************************
+Description.: print the errors OpenSSL queued
+Input Value.: what failed
+Return Value: -
+******************************************************************************/
+static void tls_print_errors(const char *what)
+{
+    unsigned long e;
+    char buffer[256];
+
+    while((e = ERR_get_error()) != 0) {
+        ERR_error_string_n(e, buffer, sizeof(buffer));
+        OPRINT("%s: %s\n", what, buffer);
+    }
+}
+
+/******************************************************************************
+Description.: set the timeouts for reading and writing of a socket
+Input Value.: * fd.....: the socket
+              * seconds: the timeout, 0 to wait forever
+Return Value: -
+******************************************************************************/
+static void tls_set_timeouts(int fd, int seconds)
+{
+    struct timeval tv;
+
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/******************************************************************************
+Description.: Load the certificate and the key of a server
+Input Value.: the server context, conf.certificate must be set
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+int tls_server_init(context *pc)
+{
+    tls_server *tls;
+    SSL_CTX *ctx;
+    const char *key = (pc->conf.private_key != NULL) ? pc->conf.private_key : pc->conf.certificate;
+
+    if((ctx = SSL_CTX_new(TLS_server_method())) == NULL) {
+        tls_print_errors("SSL_CTX_new");
+        return -1;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    #if OPENSSL_VERSION_NUMBER < 0x30200000L
+    /* older versions hand only the sending direction of TLS 1.3 to the kernel */
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    #endif
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_cipher_list(ctx, TLS_CIPHERS);
+    SSL_CTX_set_ciphersuites(ctx, TLS_CIPHERSUITES);
+
+    /* session tickets would be sent after the handshake, when the kernel owns the socket */
+    SSL_CTX_set_num_tickets(ctx, 0);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    if(SSL_CTX_use_certificate_chain_file(ctx, pc->conf.certificate) != 1 ||
+       SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+       SSL_CTX_check_private_key(ctx) != 1) {
+        tls_print_errors("could not load the certificate");
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+
+    if((tls = calloc(1, sizeof(tls_server))) == NULL) {
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+
+    tls->ctx = ctx;
+    pc->tls = tls;
+    return 0;
+}
+
+/******************************************************************************
+Description.: write all of a buffer to a socket
+Input Value.: * fd.....: the socket
+              * buffer.: the data
+              * len....: number of bytes
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int write_all(int fd, const char *buffer, size_t len)
+{
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = write(fd, buffer, len)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: encrypt and decrypt a connection the kernel could not take over
+Input Value.: the tls_proxy, it is freed by this function
+Return Value: always NULL
+******************************************************************************/
+static void *tls_proxy_thread(void *arg)
+{
+    tls_proxy *p = arg;
+    struct pollfd fds[2];
+    char buffer[16384];
+    int n;
+
+    fds[0].fd = p->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = p->pair;
+    fds[1].events = POLLIN;
+
+    while(1) {
+        /* OpenSSL may hold decrypted data the socket does not signal anymore */
+        if(SSL_pending(p->ssl) == 0) {
+            if(poll(fds, 2, -1) < 0) {
+                if(errno == EINTR)
+                    continue;
+                break;
+            }
+        } else {
+            fds[0].revents = POLLIN;
+            fds[1].revents = 0;
+        }
+
+        if(fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if((n = SSL_read(p->ssl, buffer, sizeof(buffer))) <= 0) {
+                if(SSL_get_error(p->ssl, n) == SSL_ERROR_WANT_READ)
+                    continue;
+                break;
+            }
+            if(write_all(p->pair, buffer, n) < 0)
+                break;
+        }
+
+        if(fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if((n = read(p->pair, buffer, sizeof(buffer))) <= 0) {
+                if(n < 0 && errno == EINTR)
+                    continue;
+                break;
+            }
+            if(SSL_write(p->ssl, buffer, n) <= 0)
+                break;
+        }
+    }
+
+    SSL_shutdown(p->ssl);
+    SSL_free(p->ssl);
+    close(p->fd);
+    close(p->pair);
+    free(p);
+
+    DBG("leaving TLS proxy thread\n");
+    return NULL;
+}
+
+/******************************************************************************
+Description.: Perform the TLS handshake with a client that just connected.
+              Afterwards context_fd->fd can be used like a plain socket,
+              either it is encrypted by the kernel or it was replaced by a
+              socketpair to a proxy thread.
+Input Value.: the client
+Return Value: 0 on success, -1 if the handshake failed
+******************************************************************************/
+int tls_accept(cfd *context_fd)
+{
+    tls_server *tls = context_fd->pc->tls;
+    tls_proxy *p;
+    int pair[2];
+    SSL *ssl;
+
+    if((ssl = SSL_new(tls->ctx)) == NULL)
+        return -1;
+
+    SSL_set_fd(ssl, context_fd->fd);
+    tls_set_timeouts(context_fd->fd, TLS_HANDSHAKE_TIMEOUT);
+
+    if(SSL_accept(ssl) != 1) {
+        DBG("TLS handshake failed\n");
+        ERR_clear_error();
+        SSL_free(ssl);
+        return -1;
+    }
+
+    tls_set_timeouts(context_fd->fd, 0);
+
+    /* the kernel has the keys now, the socket does not need OpenSSL anymore */
+    if(BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        DBG("TLS connection offloaded to the kernel\n");
+        __sync_fetch_and_add(&context_fd->pc->stats.tls_kernel, 1);
+        SSL_free(ssl);
+        return 0;
+    }
+
+    DBG("kTLS not available, encrypting in userspace\n");
+    if((p = malloc(sizeof(tls_proxy))) == NULL) {
+        SSL_free(ssl);
+        return -1;
+    }
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        perror("socketpair");
+        free(p);
+        SSL_free(ssl);
+        return -1;
+    }
+
+    /* a client which stops reading must not keep the proxy forever */
+    if(context_fd->pc->conf.stall_timeout > 0) {
+        struct timeval tv;
+        tv.tv_sec = context_fd->pc->conf.stall_timeout;
+        tv.tv_usec = 0;
+        setsockopt(context_fd->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    p->ssl = ssl;
+    p->fd = context_fd->fd;
+    p->pair = pair[0];
+
+    if(client_thread_start(tls_proxy_thread, p) < 0) {
+        DBG("could not launch TLS proxy thread\n");
+        close(pair[0]);
+        close(pair[1]);
+        free(p);
+        SSL_free(ssl);
+        return -1;
+    }
+
+    __sync_fetch_and_add(&context_fd->pc->stats.tls_userspace, 1);
+    context_fd->fd = pair[1];
+    return 0;
+}
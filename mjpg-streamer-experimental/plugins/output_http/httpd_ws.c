@@ -0,0 +1,490 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * WebSocket streams (?action=ws)
+ *
+ * After the upgrade every frame is sent as a text message with its metadata,
+ * followed by a binary message holding the JPEG. The client may send text
+ * messages back: "pause", "resume", "fps=N" and "every=N". Like the other
+ * streams a client slower than the input skips to the newest frame.
+ *
+ * With tables=1 the frames are abbreviated JPEGs, see httpd_tables.c. The
+ * tables come as a text message {"tables": size} and a binary message with
+ * them ahead of the first frame and of each frame with other tables, the
+ * metadata of abbreviated frames has "abbreviated": 1.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_MESSAGE_MAX 256          /* longest message accepted from a client */
+
+#define WS_TEXT   0x1
+#define WS_BINARY 0x2
+#define WS_CLOSE  0x8
+#define WS_PING   0x9
+#define WS_PONG   0xa
+
+/* messages received from a client, collected until they are complete */
+typedef struct {
+    unsigned char data[WS_MESSAGE_MAX + 14];
+    size_t len;
+    int paused;
+} ws_input;
+
+/******************************************************************************
+Description.: SHA-1 digest, only needed for the opening handshake
+Input Value.: * data.: the message
+              * len..: length of the message
+              * digest: where to store the 20 bytes of the digest
+Return Value: -
+******************************************************************************/
+static void sha1(const unsigned char *data, size_t len, unsigned char digest[20])
+{
+    unsigned int h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    unsigned int w[80], a, b, c, d, e, f, k, t;
+    unsigned char block[64];
+    unsigned long long bits = (unsigned long long)len * 8;
+    size_t padded = ((len + 8) / 64 + 1) * 64, pos, j;
+    int i;
+
+    for(pos = 0; pos < padded; pos += 64) {
+        /* the message, a single 1 bit, zeros and the length in bits */
+        for(i = 0; i < 64; i++) {
+            j = pos + i;
+            if(j < len)
+                block[i] = data[j];
+            else if(j == len)
+                block[i] = 0x80;
+            else if(j >= padded - 8)
+                block[i] = bits >> (8 * (padded - 1 - j));
+            else
+                block[i] = 0;
+        }
+
+        for(i = 0; i < 16; i++)
+            w[i] = (block[4 * i] << 24) | (block[4 * i + 1] << 16) | (block[4 * i + 2] << 8) | block[4 * i + 3];
+        for(i = 16; i < 80; i++) {
+            t = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (t << 1) | (t >> 31);
+        }
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+        for(i = 0; i < 80; i++) {
+            if(i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if(i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if(i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for(i = 0; i < 20; i++)
+        digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+/******************************************************************************
+Description.: base64 encoding, only needed for the opening handshake
+Input Value.: * data: the bytes to encode
+              * len.: number of bytes
+              * out.: where to store the text, 4 * ((len + 2) / 3) + 1 bytes
+Return Value: -
+******************************************************************************/
+static void base64_encode(const unsigned char *data, size_t len, char *out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned int v;
+    size_t i;
+
+    for(i = 0; i < len; i += 3) {
+        v = data[i] << 16;
+        if(i + 1 < len) v |= data[i + 1] << 8;
+        if(i + 2 < len) v |= data[i + 2];
+
+        *out++ = alphabet[(v >> 18) & 0x3f];
+        *out++ = alphabet[(v >> 12) & 0x3f];
+        *out++ = (i + 1 < len) ? alphabet[(v >> 6) & 0x3f] : '=';
+        *out++ = (i + 2 < len) ? alphabet[v & 0x3f] : '=';
+    }
+    *out = '\0';
+}
+
+/******************************************************************************
+Description.: Answer the opening handshake of a WebSocket client
+Input Value.: * fd.: the client socket
+              * key: value of the Sec-WebSocket-Key header field
+Return Value: 0 if the connection was upgraded, -1 otherwise
+******************************************************************************/
+int websocket_accept(int fd, const char *key)
+{
+    char buffer[BUFFER_SIZE], accept[32];
+    unsigned char digest[20];
+    size_t len;
+    int n;
+
+    /* the key is followed by the line ending and maybe some blanks */
+    len = strcspn(key, " \t\r\n");
+    if(len == 0 || len > 64)
+        return -1;
+
+    n = snprintf(buffer, sizeof(buffer), "%.*s" WS_GUID, (int)len, key);
+    sha1((unsigned char *)buffer, n, digest);
+    base64_encode(digest, sizeof(digest), accept);
+
+    n = snprintf(buffer, sizeof(buffer), "HTTP/1.1 101 Switching Protocols\r\n" \
+                 "Upgrade: websocket\r\n" \
+                 "Connection: Upgrade\r\n" \
+                 "Sec-WebSocket-Accept: %s\r\n" \
+                 "Server: MJPG-Streamer/0.2\r\n" \
+                 "\r\n", accept);
+
+    if(write(fd, buffer, n) != n) {
+        DBG("could not send the WebSocket handshake\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Prepare the header of a message sent to the client, the server
+              does not mask its messages
+Input Value.: * buffer.: where to store the header, up to 10 bytes
+              * opcode.: type of the message
+              * len....: length of the payload
+Return Value: length of the header
+******************************************************************************/
+static int ws_header(unsigned char *buffer, int opcode, unsigned long long len)
+{
+    int i;
+
+    buffer[0] = 0x80 | opcode;
+
+    if(len < 126) {
+        buffer[1] = len;
+        return 2;
+    }
+
+    if(len < 65536) {
+        buffer[1] = 126;
+        buffer[2] = len >> 8;
+        buffer[3] = len;
+        return 4;
+    }
+
+    buffer[1] = 127;
+    for(i = 0; i < 8; i++)
+        buffer[2 + i] = len >> (56 - 8 * i);
+    return 10;
+}
+
+/******************************************************************************
+Description.: Send a short message, e.g. to answer a ping or a close
+Input Value.: * fd.....: the client socket
+              * opcode.: type of the message
+              * payload: the payload
+              * len....: length of the payload, below 126
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int ws_send(int fd, int opcode, const unsigned char *payload, size_t len)
+{
+    unsigned char buffer[2 + 125];
+    int n;
+
+    n = ws_header(buffer, opcode, len);
+    memcpy(buffer + n, payload, len);
+    n += len;
+
+    return (write(fd, buffer, n) == n) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: Act on a text message of the client
+Input Value.: * context_fd: the client
+              * ws........: state of the client
+              * text......: the message, zero terminated
+Return Value: -
+******************************************************************************/
+static void ws_command(cfd *context_fd, ws_input *ws, const char *text)
+{
+    if(strcmp(text, "pause") == 0) {
+        ws->paused = 1;
+    } else if(strcmp(text, "resume") == 0) {
+        ws->paused = 0;
+    } else if(strncmp(text, "fps=", 4) == 0) {
+        context_fd->throttle.fps = MAX(atoi(text + 4), 0);
+        timerclear(&context_fd->throttle.next);
+    } else if(strncmp(text, "every=", 6) == 0) {
+        adapt_every(context_fd, MAX(atoi(text + 6), 0));
+    } else {
+        DBG("unknown WebSocket command: %s\n", text);
+        return;
+    }
+
+    DBG("WebSocket client: %s\n", text);
+}
+
+/******************************************************************************
+Description.: Read and handle the messages the client sent so far, without
+              waiting for more
+Input Value.: * context_fd: the client
+              * ws........: state of the client
+Return Value: 0 if the client is still connected, -1 if it closed the connection
+******************************************************************************/
+static int ws_receive(cfd *context_fd, ws_input *ws)
+{
+    unsigned char *mask, *payload;
+    size_t header, len, i;
+    ssize_t n;
+    int opcode;
+
+    n = recv(context_fd->fd, ws->data + ws->len, sizeof(ws->data) - ws->len, MSG_DONTWAIT);
+    if(n == 0)
+        return -1;
+    if(n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    ws->len += n;
+
+    while(ws->len >= 2) {
+        opcode = ws->data[0] & 0x0f;
+        len = ws->data[1] & 0x7f;
+        header = 2;
+
+        /* clients must mask their messages, long ones are not expected */
+        if(!(ws->data[1] & 0x80) || len == 127) {
+            DBG("invalid WebSocket message\n");
+            return -1;
+        }
+        if(len == 126) {
+            if(ws->len < 4)
+                break;
+            len = (ws->data[2] << 8) | ws->data[3];
+            header = 4;
+        }
+        if(len > WS_MESSAGE_MAX) {
+            DBG("WebSocket message of %zu bytes is too long\n", len);
+            return -1;
+        }
+        if(ws->len < header + 4 + len)
+            break;
+
+        mask = ws->data + header;
+        payload = mask + 4;
+        for(i = 0; i < len; i++)
+            payload[i] ^= mask[i % 4];
+
+        switch(opcode) {
+        case WS_TEXT: {
+            char text[WS_MESSAGE_MAX + 1];
+            memcpy(text, payload, len);
+            text[len] = '\0';
+            ws_command(context_fd, ws, text);
+            break;
+        }
+        case WS_PING:
+            if(ws_send(context_fd->fd, WS_PONG, payload, MIN(len, 125)) < 0)
+                return -1;
+            break;
+        case WS_CLOSE:
+            /* answer with the status code of the client */
+            ws_send(context_fd->fd, WS_CLOSE, payload, MIN(len, 2));
+            return -1;
+        default:
+            break;
+        }
+
+        ws->len -= header + 4 + len;
+        memmove(ws->data, payload + len, ws->len);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Send a stream of JPG-frames to a client which completed the
+              WebSocket handshake. Each frame is preceded by a text message
+              with its sequence number, timestamp, size and the number of
+              frames skipped before it.
+Input Value.: * context_fd..: the client
+              * input_number: input plugin to stream from
+Return Value: -
+******************************************************************************/
+void send_websocket(cfd *context_fd, int input_number)
+{
+    globals *pglobal = context_fd->pc->pglobal;
+    input_frame *frame;
+    frame_subscription sub;
+    crop_variant *crop;
+    unsigned long long dropped = 0, skipped, start;
+    unsigned char buffer[BUFFER_SIZE + JPEG_TABLES_SIZE + JPEG_HEAD_SIZE];
+    jpeg_tables *tables = NULL;
+    char meta[160];
+    struct pollfd pfd;
+    zerocopy_state zc;
+    stream_pacing pacing;
+    ws_input ws;
+    int len, n, size, abbreviated;
+    #ifdef MANAGMENT
+    int accounted = 0;  /* bytes of the socket queue accounted to the client */
+    #endif
+
+    memset(&ws, 0, sizeof(ws));
+    if(context_fd->tables && (tables = calloc(1, sizeof(jpeg_tables))) == NULL)
+        DBG("no memory for the tables, sending whole frames\n");
+    memset(&pacing, 0, sizeof(pacing));
+    zerocopy_init(context_fd->fd, &zc, context_fd->pc->conf.zerocopy);
+    stream_set_timeout(context_fd);
+    admit_stream_start(context_fd);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, CLIENT_STACK_SIZE, 0);
+    #endif
+    scale_subscribe(input_number, context_fd->scale);
+    quality_subscribe(input_number, context_fd->quality);
+    crop = crop_subscribe(input_number, &context_fd->crop);
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, NULL);
+
+    while(!pglobal->stop) {
+        /* a paused client only needs to be watched for further messages,
+         * it does not keep the input capturing meanwhile */
+        if(ws.paused) {
+            frame_unsubscribe(&sub);
+            pfd.fd = context_fd->fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 1000);
+            if(ws_receive(context_fd, &ws) < 0)
+                break;
+            if(!ws.paused)
+                frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, NULL);
+            continue;
+        }
+
+        frame = frame_next(&sub, -1);
+
+        /* messages which arrived while waiting apply to this frame already */
+        if(ws_receive(context_fd, &ws) < 0) {
+            frame_unref(frame);
+            break;
+        }
+
+        if(ws.paused || !stream_frame_due(&context_fd->throttle, frame) ||
+           !variant_due(input_number, context_fd->scale, context_fd->quality, crop, frame)) {
+            frame_unref(frame);
+            continue;
+        }
+
+        skipped = sub.skipped;
+        dropped += skipped;
+
+        /* clients asking for the same size, quality or region share one copy */
+        frame = scale_frame(input_number, context_fd->scale, frame);
+        frame = quality_frame(input_number, context_fd->quality, frame);
+        frame = crop_frame(crop, frame);
+        adapt_update(context_fd, input_number, &sub, frame, skipped);
+
+        /* changed tables go out first */
+        len = 0;
+        abbreviated = (tables != NULL && jpeg_abbreviate(tables, frame) == 0);
+        if(abbreviated && tables->changed) {
+            n = snprintf(meta, sizeof(meta), "{\"tables\": %d}", tables->tables_len);
+            len = ws_header(buffer, WS_TEXT, n);
+            memcpy(buffer + len, meta, n);
+            len += n;
+            len += ws_header(buffer + len, WS_BINARY, tables->tables_len);
+            memcpy(buffer + len, tables->tables, tables->tables_len);
+            len += tables->tables_len;
+        }
+
+        /* the metadata message and the header of the binary message go out with the frame */
+        size = abbreviated ? jpeg_abbreviated_length(tables, frame) : frame_length(frame);
+        n = snprintf(meta, sizeof(meta), "{\"seq\": %llu, \"timestamp\": %d.%06d, \"size\": %d, \"dropped\": %llu%s}",
+                     frame->seq, (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec, size, skipped,
+                     abbreviated ? ", \"abbreviated\": 1" : "");
+        len += ws_header(buffer + len, WS_TEXT, n);
+        memcpy(buffer + len, meta, n);
+        len += n;
+        len += ws_header(buffer + len, WS_BINARY, size);
+        if(abbreviated) {
+            memcpy(buffer + len, tables->head, tables->head_len);
+            len += tables->head_len;
+        }
+
+        stream_pace(context_fd->pc, context_fd->fd, &pacing, frame);
+        #ifdef MANAGMENT
+        update_client_timestamp(context_fd->client);
+        update_client_frames(context_fd->client, skipped);
+        update_client_queue(context_fd->client, &accounted,
+                            stream_stats_begin(context_fd->pc, context_fd->fd, input_number, frame));
+        #else
+        stream_stats_begin(context_fd->pc, context_fd->fd, input_number, frame);
+        #endif
+        start = monotonic_usec();
+        if(write_part_at(context_fd, &zc, (char *)buffer, len, frame, abbreviated ? tables->offset : 0, NULL, 0) < 0) {
+            DBG("client stalled or disconnected, %llu frames dropped\n", dropped);
+            frame_unref(frame);
+            break;
+        }
+        stream_stats_part(context_fd->pc, context_fd->fd, input_number, frame, skipped, monotonic_usec() - start);
+        frame_unref(frame);
+    }
+
+    frame_unsubscribe(&sub);
+    scale_unsubscribe(input_number, context_fd->scale);
+    quality_unsubscribe(input_number, context_fd->quality);
+    crop_unsubscribe(crop);
+    __sync_fetch_and_sub(&context_fd->pc->stats.stream_clients, 1);
+    #ifdef MANAGMENT
+    update_client_stream(context_fd->client, -CLIENT_STACK_SIZE, accounted);
+    #endif
+    zerocopy_release(context_fd->fd, &zc);
+    free(tables);
+}
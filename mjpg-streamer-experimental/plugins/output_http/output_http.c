@@ -45,7 +45,10 @@
 /*
  * keep context for each server
  */
-context servers[MAX_OUTPUT_PLUGINS];
+context *servers;
+
+/* servers running, the variants are shared by all of them */
+static int running;
 
 /******************************************************************************
 Description.: print help for this plugin to stdout
@@ -64,6 +67,38 @@ void help(void)
 	    " [-l ] --listen ]........: Listen on Hostname / IP\n" \
             " [-c | --credentials ]...: ask for \"username:password\" on connect\n" \
             " [-n | --nocommands ]....: disable execution of commands\n"
+            " [-e | --event-loop ]....: serve streams from this number of event\n" \
+            "                           loop threads instead of a thread per client\n" \
+            " [-k | --cork ]..........: send frames in full TCP segments (TCP_CORK)\n" \
+            " [-z | --zerocopy ]......: send frames with MSG_ZEROCOPY if supported\n" \
+            " [-t | --timeout ].......: disconnect stream clients which did not\n" \
+            "                           take any data for this many seconds (default 10)\n"
+            " [-W | --workers ].......: serve requests from a pool of this many\n" \
+            "                           threads instead of a thread per connection\n" \
+            " [-L | --listeners ].....: accept connections with this many threads,\n" \
+            "                           each with SO_REUSEPORT sockets of its own\n" \
+            " [-b | --backlog ].......: length of the queue of pending connections\n" \
+            "                           of each listener (default 10)\n"
+            " [-C | --cert ]..........: serve HTTPS with the certificate chain\n" \
+            "                           of this PEM file\n" \
+            " [-K | --key ]...........: PEM file with the private key, if it is\n" \
+            "                           not in the certificate file\n"
+            " [-r | --recorded ]......: folder of output_file --partition to serve\n" \
+            "                           pictures from with ?action=recorded&t=\n" \
+            " [-M | --memory ]........: refuse new connections while the process\n" \
+            "                           has more than this many MB resident\n" \
+            " [-P | --pacing ]........: spread each stream frame across this percent\n" \
+            "                           of the frame interval instead of bursting it\n"
+            " [-A | --adaptive ]......: lower the quality, size and frame rate of\n" \
+            "                           streams to what the link of a client takes\n"
+            " [-F | --fastcgi ].......: serve the CGI scripts with this many FastCGI\n" \
+            "                           processes each instead of a process per request\n" \
+            " [-T | --fastcgi-timeout ]: seconds a FastCGI request may take\n" \
+            " [-I | --ip-connections ]: connections an address may have open\n" \
+            " [-R | --rate ]..........: requests per second an address may make\n" \
+            " [-B | --burst ].........: requests an address may make at once\n" \
+            "                           within --rate (default one second of it)\n" \
+            " [-S | --streams ].......: streams the server serves at a time\n" \
             " ---------------------------------------------------------------\n");
 }
 
@@ -83,6 +118,17 @@ int output_init(output_parameter *param, int id)
     int  port;
     char *credentials, *www_folder, *hostname = NULL;
     char nocommands;
+    int event_loop = 0, workers = 0;
+    int listeners = 1, backlog = 10;
+    char cork = 0, zerocopy = 0;
+    int stall_timeout = 10;
+    char *certificate = NULL, *private_key = NULL;
+    char *recorded = NULL;
+    long long memory = 0;
+    int pacing = 0;
+    char adaptive = 0;
+    int fastcgi = 0, fastcgi_timeout = 10;
+    int ip_connections = 0, rate = 0, burst = 0, max_streams = 0;
 
     DBG("output #%02d\n", param->id);
 
@@ -115,6 +161,44 @@ int output_init(output_parameter *param, int id)
             {"www", required_argument, 0, 0},
             {"n", no_argument, 0, 0},
             {"nocommands", no_argument, 0, 0},
+            {"e", required_argument, 0, 0},
+            {"event-loop", required_argument, 0, 0},
+            {"k", no_argument, 0, 0},
+            {"cork", no_argument, 0, 0},
+            {"z", no_argument, 0, 0},
+            {"zerocopy", no_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"timeout", required_argument, 0, 0},
+            {"W", required_argument, 0, 0},
+            {"workers", required_argument, 0, 0},
+            {"L", required_argument, 0, 0},
+            {"listeners", required_argument, 0, 0},
+            {"b", required_argument, 0, 0},
+            {"backlog", required_argument, 0, 0},
+            {"C", required_argument, 0, 0},
+            {"cert", required_argument, 0, 0},
+            {"K", required_argument, 0, 0},
+            {"key", required_argument, 0, 0},
+            {"r", required_argument, 0, 0},
+            {"recorded", required_argument, 0, 0},
+            {"M", required_argument, 0, 0},
+            {"memory", required_argument, 0, 0},
+            {"P", required_argument, 0, 0},
+            {"pacing", required_argument, 0, 0},
+            {"A", no_argument, 0, 0},
+            {"adaptive", no_argument, 0, 0},
+            {"F", required_argument, 0, 0},
+            {"fastcgi", required_argument, 0, 0},
+            {"T", required_argument, 0, 0},
+            {"fastcgi-timeout", required_argument, 0, 0},
+            {"I", required_argument, 0, 0},
+            {"ip-connections", required_argument, 0, 0},
+            {"R", required_argument, 0, 0},
+            {"rate", required_argument, 0, 0},
+            {"B", required_argument, 0, 0},
+            {"burst", required_argument, 0, 0},
+            {"S", required_argument, 0, 0},
+            {"streams", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -175,9 +259,160 @@ int output_init(output_parameter *param, int id)
             DBG("case 10,11\n");
             nocommands = 1;
             break;
+
+            /* e, event-loop */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            event_loop = atoi(optarg);
+            if(event_loop < 0) {
+                help();
+                return 1;
+            }
+            break;
+
+            /* k, cork */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            cork = 1;
+            break;
+
+            /* z, zerocopy */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            zerocopy = 1;
+            break;
+
+            /* t, timeout */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            stall_timeout = atoi(optarg);
+            break;
+
+            /* W, workers */
+        case 20:
+        case 21:
+            DBG("case 20,21\n");
+            workers = MAX(atoi(optarg), 0);
+            break;
+
+            /* L, listeners */
+        case 22:
+        case 23:
+            DBG("case 22,23\n");
+            listeners = MAX(atoi(optarg), 1);
+            break;
+
+            /* b, backlog */
+        case 24:
+        case 25:
+            DBG("case 24,25\n");
+            backlog = MAX(atoi(optarg), 1);
+            break;
+
+            /* C, cert */
+        case 26:
+        case 27:
+            DBG("case 26,27\n");
+            certificate = strdup(optarg);
+            break;
+
+            /* K, key */
+        case 28:
+        case 29:
+            DBG("case 28,29\n");
+            private_key = strdup(optarg);
+            break;
+
+            /* r, recorded */
+        case 30:
+        case 31:
+            DBG("case 30,31\n");
+            recorded = strdup(optarg);
+            break;
+
+            /* M, memory */
+        case 32:
+        case 33:
+            DBG("case 32,33\n");
+            memory = MAX(atoll(optarg), 0) * 1024 * 1024;
+            break;
+
+            /* P, pacing */
+        case 34:
+        case 35:
+            DBG("case 34,35\n");
+            pacing = MIN(MAX(atoi(optarg), 0), 100);
+            break;
+
+            /* A, adaptive */
+        case 36:
+        case 37:
+            DBG("case 36,37\n");
+            adaptive = 1;
+            break;
+
+            /* F, fastcgi */
+        case 38:
+        case 39:
+            DBG("case 38,39\n");
+            fastcgi = MIN(MAX(atoi(optarg), 0), FCGI_MAX_PROCESSES);
+            break;
+
+            /* T, fastcgi-timeout */
+        case 40:
+        case 41:
+            DBG("case 40,41\n");
+            fastcgi_timeout = MAX(atoi(optarg), 1);
+            break;
+
+            /* I, ip-connections */
+        case 42:
+        case 43:
+            DBG("case 42,43\n");
+            ip_connections = MAX(atoi(optarg), 0);
+            break;
+
+            /* R, rate */
+        case 44:
+        case 45:
+            DBG("case 44,45\n");
+            rate = MAX(atoi(optarg), 0);
+            break;
+
+            /* B, burst */
+        case 46:
+        case 47:
+            DBG("case 46,47\n");
+            burst = MAX(atoi(optarg), 1);
+            break;
+
+            /* S, streams */
+        case 48:
+        case 49:
+            DBG("case 48,49\n");
+            max_streams = MAX(atoi(optarg), 0);
+            break;
         }
     }
 
+    /* a second of requests at once unless told otherwise */
+    if(burst == 0)
+        burst = MAX(rate, 1);
+
+    /* the kernel does not take MSG_ZEROCOPY on TLS sockets */
+    if(certificate != NULL)
+        zerocopy = 0;
+
+    /* the instances share the tables, sized for all plugins */
+    if(httpd_init(param->global) < 0) {
+        OPRINT("not enough memory\n");
+        return 1;
+    }
+
     servers[param->id].id = param->id;
     servers[param->id].pglobal = param->global;
     servers[param->id].conf.port = port;
@@ -185,12 +420,115 @@ int output_init(output_parameter *param, int id)
     servers[param->id].conf.credentials = credentials;
     servers[param->id].conf.www_folder = www_folder;
     servers[param->id].conf.nocommands = nocommands;
+    servers[param->id].conf.event_loop = event_loop;
+    servers[param->id].conf.cork = cork;
+    servers[param->id].conf.zerocopy = zerocopy;
+    servers[param->id].conf.stall_timeout = stall_timeout;
+    servers[param->id].conf.workers = workers;
+    servers[param->id].conf.listeners = listeners;
+    servers[param->id].conf.backlog = backlog;
+    servers[param->id].conf.certificate = certificate;
+    servers[param->id].conf.private_key = private_key;
+    servers[param->id].conf.recorded = recorded;
+    servers[param->id].conf.memory = memory;
+    servers[param->id].conf.pacing = pacing;
+    servers[param->id].conf.adaptive = adaptive;
+    servers[param->id].conf.fastcgi = fastcgi;
+    servers[param->id].conf.fastcgi_timeout = fastcgi_timeout;
+    servers[param->id].conf.ip_connections = ip_connections;
+    servers[param->id].conf.rate = rate;
+    servers[param->id].conf.burst = burst;
+    servers[param->id].conf.max_streams = max_streams;
+    servers[param->id].workers = NULL;
+    servers[param->id].next_worker = 0;
+    servers[param->id].cache = NULL;
+    servers[param->id].pool = NULL;
+    servers[param->id].tls = NULL;
+    servers[param->id].fcgi = NULL;
+    servers[param->id].admit = NULL;
+    memset(&servers[param->id].stats, 0, sizeof(http_stats));
+    servers[param->id].stats.send_usec.shift = 6;       // 64 us up to about a second
+    servers[param->id].stats.queue_bytes.shift = 10;    // 1 kB up to 32 MB
+    servers[param->id].stats.publish_age_usec.shift = 8; // 256 us up to about 4 seconds
+    servers[param->id].stats.capture_age_usec.shift = 8;
 
     OPRINT("www-folder-path......: %s\n", (www_folder == NULL) ? "disabled" : www_folder);
+    if(www_folder != NULL) {
+        OPRINT("www files cached.....: %d\n", www_cache_load(&servers[param->id]));
+    }
     OPRINT("HTTP TCP port........: %d\n", ntohs(port));
     OPRINT("HTTP Listen Address..: %s\n", hostname);
     OPRINT("username:password....: %s\n", (credentials == NULL) ? "disabled" : credentials);
     OPRINT("commands.............: %s\n", (nocommands) ? "disabled" : "enabled");
+    OPRINT("TCP_CORK.............: %s\n", (cork) ? "enabled" : "disabled");
+    OPRINT("MSG_ZEROCOPY.........: %s\n", (zerocopy) ? "enabled" : "disabled");
+    OPRINT("stall timeout........: %d s\n", stall_timeout);
+    if(event_loop > 0) {
+        OPRINT("event loop threads...: %d\n", event_loop);
+    } else {
+        OPRINT("event loop threads...: disabled\n");
+    }
+    if(workers > 0) {
+        OPRINT("request threads......: %d\n", workers);
+    } else {
+        OPRINT("request threads......: one per connection\n");
+    }
+    OPRINT("listeners............: %d (backlog %d)\n", listeners, backlog);
+    OPRINT("recorded folder......: %s\n", (recorded == NULL) ? "disabled" : recorded);
+    if(memory > 0) {
+        OPRINT("memory budget........: %lld MB\n", memory / (1024 * 1024));
+    } else {
+        OPRINT("memory budget........: unlimited\n");
+    }
+    if(pacing > 0) {
+        OPRINT("stream pacing........: %d %% of the frame interval\n", pacing);
+    } else {
+        OPRINT("stream pacing........: disabled\n");
+    }
+    OPRINT("adaptive streams.....: %s\n", (adaptive) ? "all" : "with adapt=1");
+    if(fastcgi > 0) {
+        if(fcgi_pool_init(&servers[param->id]) != 0) {
+            OPRINT("not enough memory\n");
+            return 1;
+        }
+        OPRINT("FastCGI processes....: %d per script, %d s timeout\n", fastcgi, fastcgi_timeout);
+    } else {
+        OPRINT("FastCGI processes....: disabled, a process per CGI request\n");
+    }
+    if(admit_init(&servers[param->id]) != 0) {
+        OPRINT("not enough memory\n");
+        return 1;
+    }
+    if(ip_connections > 0) {
+        OPRINT("connections per IP...: %d\n", ip_connections);
+    } else {
+        OPRINT("connections per IP...: unlimited\n");
+    }
+    if(rate > 0) {
+        OPRINT("requests per IP......: %d/s, bursts of %d\n", rate, burst);
+    } else {
+        OPRINT("requests per IP......: unlimited\n");
+    }
+    if(max_streams > 0) {
+        OPRINT("streams..............: at most %d\n", max_streams);
+    } else {
+        OPRINT("streams..............: unlimited\n");
+    }
+
+    if(certificate != NULL) {
+        #ifdef HTTPS
+        if(tls_server_init(&servers[param->id]) != 0) {
+            OPRINT("could not set up HTTPS\n");
+            return 1;
+        }
+        OPRINT("HTTPS certificate....: %s\n", certificate);
+        #else
+        OPRINT("HTTPS is not supported, build with ENABLE_HTTPS\n");
+        return 1;
+        #endif
+    } else {
+        OPRINT("HTTPS................: disabled\n");
+    }
 
     param->global->out[id].name = malloc((strlen(OUTPUT_PLUGIN_NAME) + 1) * sizeof(char));
     sprintf(param->global->out[id].name, OUTPUT_PLUGIN_NAME);
@@ -212,6 +550,10 @@ int output_stop(int id)
     DBG("will cancel server thread #%02d\n", id);
     pthread_cancel(servers[id].threadID);
 
+    www_cache_stop(&servers[id]);
+    if(__sync_sub_and_fetch(&running, 1) == 0)
+        scale_stop();
+
     return 0;
 }
 
@@ -227,6 +569,7 @@ int output_run(int id)
     /* create thread and pass context to thread function */
     pthread_create(&(servers[id].threadID), NULL, server_thread, &(servers[id]));
     pthread_detach(servers[id].threadID);
+    __sync_add_and_fetch(&running, 1);
 
     return 0;
 }
@@ -0,0 +1,790 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "mp4.h"
+
+/* the boxes of the header and of a fragment are put together in memory */
+typedef struct {
+    unsigned char *buf;
+    size_t length;
+    size_t capacity;
+} mp4_box;
+
+/* NAL unit types of each codec */
+#define H264_IDR 5
+#define H264_SPS 7
+#define H264_PPS 8
+#define H264_AUD 9
+#define HEVC_IRAP_FIRST 16
+#define HEVC_IRAP_LAST 23
+#define HEVC_VPS 32
+#define HEVC_SPS 33
+#define HEVC_PPS 34
+#define HEVC_AUD 35
+
+/* sample_depends_on and sample_is_non_sync_sample of the fragments */
+#define MP4_SYNC_SAMPLE 0x02000000
+#define MP4_OTHER_SAMPLE 0x01010000
+
+static void put8(mp4_box *b, unsigned int v)
+{
+    if(b->length < b->capacity)
+        b->buf[b->length] = v;
+    b->length++;
+}
+
+static void put16(mp4_box *b, unsigned int v)
+{
+    put8(b, v >> 8);
+    put8(b, v);
+}
+
+static void put32(mp4_box *b, unsigned int v)
+{
+    put16(b, v >> 16);
+    put16(b, v);
+}
+
+static void put64(mp4_box *b, unsigned long long v)
+{
+    put32(b, v >> 32);
+    put32(b, v);
+}
+
+static void put_bytes(mp4_box *b, const void *data, size_t size)
+{
+    if(b->length + size <= b->capacity)
+        memcpy(b->buf + b->length, data, size);
+    b->length += size;
+}
+
+static void put_zeros(mp4_box *b, size_t size)
+{
+    while(size-- > 0)
+        put8(b, 0);
+}
+
+/* a box or full box is started with a size filled in by box_end() */
+static size_t box_start(mp4_box *b, const char *type)
+{
+    size_t start = b->length;
+
+    put32(b, 0);
+    put_bytes(b, type, 4);
+    return start;
+}
+
+static size_t full_box_start(mp4_box *b, const char *type, int version, unsigned int flags)
+{
+    size_t start = box_start(b, type);
+
+    put32(b, (version << 24) | flags);
+    return start;
+}
+
+static void box_end(mp4_box *b, size_t start)
+{
+    size_t end = b->length;
+
+    if(end > b->capacity)
+        return;
+    b->length = start;
+    put32(b, end - start);
+    b->length = end;
+}
+
+/* the unity matrix of mvhd and tkhd */
+static void put_matrix(mp4_box *b)
+{
+    put32(b, 0x00010000); put32(b, 0); put32(b, 0);
+    put32(b, 0); put32(b, 0x00010000); put32(b, 0);
+    put32(b, 0); put32(b, 0); put32(b, 0x40000000);
+}
+
+/******************************************************************************
+Description.: write the header or a fragment completely, to the file or to
+              the sink of a stream
+Input Value.: * mp4........: the recording
+              * iov........: the pieces
+              * count......: their number
+              * header.....: nonzero for the header
+              * duration...: of a fragment
+              * independent: nonzero if a fragment starts with a keyframe
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int write_all(mp4_file *mp4, const struct iovec *iov, int count, int header,
+                     unsigned int duration, int independent)
+{
+    const unsigned char *data;
+    size_t size;
+    ssize_t n;
+    int i;
+
+    if(mp4->sink != NULL)
+        return mp4->sink(mp4->sink_arg, iov, count, header, duration, independent);
+
+    for(i = 0; i < count; i++) {
+        data = iov[i].iov_base;
+        size = iov[i].iov_len;
+        while(size > 0) {
+            if((n = write(mp4->fd, data, size)) < 0) {
+                if(errno == EINTR)
+                    continue;
+                return -1;
+            }
+            data += n;
+            size -= n;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: find the next NAL unit of an Annex B stream
+Input Value.: * p...: where to search from
+              * end.: end of the stream
+              * size: gets the length of the NAL unit
+Return Value: the start of the NAL unit after its start code, NULL if there is
+              none
+******************************************************************************/
+static const unsigned char *next_nal(const unsigned char *p, const unsigned char *end, int *size)
+{
+    const unsigned char *nal, *q;
+
+    for(; p + 3 <= end; p++) {
+        if(p[0] == 0 && p[1] == 0 && p[2] == 1)
+            break;
+    }
+    if(p + 3 > end)
+        return NULL;
+
+    nal = p + 3;
+    for(q = nal; q + 3 <= end; q++) {
+        if(q[0] == 0 && q[1] == 0 && (q[2] == 1 || q[2] == 0))
+            break;
+    }
+    if(q + 3 > end)
+        q = end;
+
+    /* zeros before the next start code belong to it */
+    while(q > nal && q[-1] == 0)
+        q--;
+    *size = q - nal;
+    return nal;
+}
+
+/******************************************************************************
+Description.: the type of a NAL unit
+Input Value.: * mp4: the recording
+              * nal: the NAL unit
+Return Value: nal_unit_type
+******************************************************************************/
+static int nal_type(mp4_file *mp4, const unsigned char *nal)
+{
+    return (mp4->codec == MP4_HEVC) ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+}
+
+/******************************************************************************
+Description.: tell whether a NAL unit is left out of the samples
+Input Value.: * mp4.: the recording
+              * type: its NAL unit type
+Return Value: 1 for parameter sets and access unit delimiters
+******************************************************************************/
+static int header_nal(mp4_file *mp4, int type)
+{
+    if(mp4->codec == MP4_HEVC)
+        return type == HEVC_VPS || type == HEVC_SPS || type == HEVC_PPS || type == HEVC_AUD;
+    return type == H264_SPS || type == H264_PPS || type == H264_AUD;
+}
+
+/******************************************************************************
+Description.: keep a parameter set for the sample description
+Input Value.: * mp4.: the recording
+              * type: its NAL unit type
+              * nal.: the NAL unit
+              * size: its length
+Return Value: -
+******************************************************************************/
+static void keep_parameter_set(mp4_file *mp4, int type, const unsigned char *nal, int size)
+{
+    unsigned char *dst;
+    int *dst_size;
+
+    if(mp4->codec == MP4_HEVC) {
+        if(type == HEVC_VPS) {
+            dst = mp4->vps;
+            dst_size = &mp4->vps_size;
+        } else if(type == HEVC_SPS) {
+            dst = mp4->sps;
+            dst_size = &mp4->sps_size;
+        } else if(type == HEVC_PPS) {
+            dst = mp4->pps;
+            dst_size = &mp4->pps_size;
+        } else {
+            return;
+        }
+    } else if(type == H264_SPS) {
+        dst = mp4->sps;
+        dst_size = &mp4->sps_size;
+    } else if(type == H264_PPS) {
+        dst = mp4->pps;
+        dst_size = &mp4->pps_size;
+    } else {
+        return;
+    }
+
+    if(size <= MP4_PARAMETER_SIZE) {
+        memcpy(dst, nal, size);
+        *dst_size = size;
+    }
+}
+
+/******************************************************************************
+Description.: write the sample description of H.264, the profile and level
+              come from the SPS
+Input Value.: * mp4: the recording
+              * b..: the header
+Return Value: 0 if ok, -1 if the SPS is too short to tell them
+******************************************************************************/
+static int put_avcc(mp4_file *mp4, mp4_box *b)
+{
+    size_t box;
+    int profile;
+
+    /* the NAL header, profile_idc, the constraint flags and level_idc */
+    if(mp4->sps_size < 4 || mp4->pps_size <= 0)
+        return -1;
+    profile = mp4->sps[1];
+
+    box = box_start(b, "avcC");
+    put8(b, 1);
+    put8(b, profile);
+    put8(b, mp4->sps[2]);
+    put8(b, mp4->sps[3]);
+    put8(b, 0xfc | 3);              // 4 bytes of the NAL unit lengths
+    put8(b, 0xe0 | 1);
+    put16(b, mp4->sps_size);
+    put_bytes(b, mp4->sps, mp4->sps_size);
+    put8(b, 1);
+    put16(b, mp4->pps_size);
+    put_bytes(b, mp4->pps, mp4->pps_size);
+
+    /* the high profiles tell their sampling, it is 8 bit 4:2:0 here */
+    if(profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+        put8(b, 0xfc | 1);
+        put8(b, 0xf8);
+        put8(b, 0xf8);
+        put8(b, 0);
+    }
+    box_end(b, box);
+    return 0;
+}
+
+/******************************************************************************
+Description.: write the sample description of HEVC, the profile, tier and
+              level come from the SPS
+Input Value.: * mp4: the recording
+              * b..: the header
+Return Value: -
+******************************************************************************/
+static void put_hvcc(mp4_file *mp4, mp4_box *b)
+{
+    const unsigned char *sets[3] = { mp4->vps, mp4->sps, mp4->pps };
+    const int sizes[3] = { mp4->vps_size, mp4->sps_size, mp4->pps_size };
+    const int types[3] = { HEVC_VPS, HEVC_SPS, HEVC_PPS };
+    unsigned char rbsp[15];
+    size_t box;
+    int i, n, zeros;
+
+    /* the NAL header, a byte with the number of sublayers and the general
+     * profile_tier_level, without the emulation prevention bytes */
+    memset(rbsp, 0, sizeof(rbsp));
+    for(i = 0, n = 0, zeros = 0; i < mp4->sps_size && n < (int)sizeof(rbsp); i++) {
+        if(zeros >= 2 && mp4->sps[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = (mp4->sps[i] == 0) ? zeros + 1 : 0;
+        rbsp[n++] = mp4->sps[i];
+    }
+
+    box = box_start(b, "hvcC");
+    put8(b, 1);
+    put_bytes(b, rbsp + 3, 12);     // profile space to level
+    put16(b, 0xf000);               // no min_spatial_segmentation
+    put8(b, 0xfc);
+    put8(b, 0xfc | 1);              // 4:2:0
+    put8(b, 0xf8);                  // 8 bits
+    put8(b, 0xf8);
+    put16(b, 0);
+    put8(b, (((rbsp[2] >> 1) & 7) + 1) << 3 | (rbsp[2] & 1) << 2 | 3);
+    put8(b, 3);
+    for(i = 0; i < 3; i++) {
+        put8(b, 0x80 | types[i]);
+        put16(b, 1);
+        put16(b, sizes[i]);
+        put_bytes(b, sets[i], sizes[i]);
+    }
+    box_end(b, box);
+}
+
+/******************************************************************************
+Description.: write ftyp and moov, with the track and its sample description
+Input Value.: the recording
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int write_header(mp4_file *mp4)
+{
+    unsigned char buf[4096];
+    mp4_box b = { buf, 0, sizeof(buf) };
+    struct iovec iov;
+    size_t moov, trak, mdia, minf, dinf, dref, stbl, stsd, entry, mvex, box;
+    char name[32];
+
+    box = box_start(&b, "ftyp");
+    put_bytes(&b, "isom", 4);
+    put32(&b, 0x200);
+    put_bytes(&b, "isomiso6mp41", 12);
+    put_bytes(&b, (mp4->codec == MP4_HEVC) ? "hvc1" : "avc1", 4);
+    box_end(&b, box);
+
+    moov = box_start(&b, "moov");
+
+    box = full_box_start(&b, "mvhd", 0, 0);
+    put32(&b, 0);                   // creation and modification time
+    put32(&b, 0);
+    put32(&b, 1000);
+    put32(&b, 0);                   // the duration is that of the fragments
+    put32(&b, 0x00010000);
+    put16(&b, 0x0100);
+    put_zeros(&b, 10);
+    put_matrix(&b);
+    put_zeros(&b, 24);
+    put32(&b, 2);                   // next track
+    box_end(&b, box);
+
+    trak = box_start(&b, "trak");
+    box = full_box_start(&b, "tkhd", 0, 3);
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, 1);                   // track ID
+    put32(&b, 0);
+    put32(&b, 0);
+    put_zeros(&b, 8);
+    put16(&b, 0);                   // layer, alternate group, volume
+    put16(&b, 0);
+    put16(&b, 0);
+    put16(&b, 0);
+    put_matrix(&b);
+    put32(&b, mp4->width << 16);
+    put32(&b, mp4->height << 16);
+    box_end(&b, box);
+
+    mdia = box_start(&b, "mdia");
+    box = full_box_start(&b, "mdhd", 0, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, MP4_TIMESCALE);
+    put32(&b, 0);
+    put16(&b, 0x55c4);              // "und"
+    put16(&b, 0);
+    box_end(&b, box);
+
+    box = full_box_start(&b, "hdlr", 0, 0);
+    put32(&b, 0);
+    put_bytes(&b, "vide", 4);
+    put_zeros(&b, 12);
+    put_bytes(&b, "VideoHandler", 13);
+    box_end(&b, box);
+
+    minf = box_start(&b, "minf");
+    box = full_box_start(&b, "vmhd", 0, 1);
+    put_zeros(&b, 8);
+    box_end(&b, box);
+
+    dinf = box_start(&b, "dinf");
+    dref = full_box_start(&b, "dref", 0, 0);
+    put32(&b, 1);
+    box = full_box_start(&b, "url ", 0, 1);
+    box_end(&b, box);
+    box_end(&b, dref);
+    box_end(&b, dinf);
+
+    stbl = box_start(&b, "stbl");
+    stsd = full_box_start(&b, "stsd", 0, 0);
+    put32(&b, 1);
+    entry = box_start(&b, (mp4->codec == MP4_HEVC) ? "hvc1" : "avc1");
+    put_zeros(&b, 6);
+    put16(&b, 1);                   // data reference
+    put_zeros(&b, 16);
+    put16(&b, mp4->width);
+    put16(&b, mp4->height);
+    put32(&b, 0x00480000);          // 72 dpi
+    put32(&b, 0x00480000);
+    put32(&b, 0);
+    put16(&b, 1);                   // frames per sample
+    memset(name, 0, sizeof(name));
+    snprintf(name + 1, sizeof(name) - 1, "mjpg-streamer");
+    name[0] = strlen(name + 1);
+    put_bytes(&b, name, sizeof(name));
+    put16(&b, 0x0018);
+    put16(&b, 0xffff);
+    if(mp4->codec == MP4_HEVC)
+        put_hvcc(mp4, &b);
+    else if(put_avcc(mp4, &b) < 0)
+        return -1;
+    box_end(&b, entry);
+    box_end(&b, stsd);
+
+    /* the samples are all in the fragments */
+    box = full_box_start(&b, "stts", 0, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box = full_box_start(&b, "stsc", 0, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box = full_box_start(&b, "stsz", 0, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box = full_box_start(&b, "stco", 0, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box_end(&b, stbl);
+    box_end(&b, minf);
+    box_end(&b, mdia);
+    box_end(&b, trak);
+
+    mvex = box_start(&b, "mvex");
+    box = full_box_start(&b, "trex", 0, 0);
+    put32(&b, 1);
+    put32(&b, 1);
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box_end(&b, mvex);
+    box_end(&b, moov);
+
+    if(b.length > b.capacity)
+        return -1;
+    iov.iov_base = b.buf;
+    iov.iov_len = b.length;
+    return write_all(mp4, &iov, 1, 1, 0, 0);
+}
+
+/******************************************************************************
+Description.: decode time of a sample, relative to the first of the file
+Input Value.: * mp4.: the recording
+              * usec: time of the sample
+Return Value: the time in MP4_TIMESCALE
+******************************************************************************/
+static unsigned long long decode_time(mp4_file *mp4, unsigned long long usec)
+{
+    if(usec < mp4->first_usec)
+        return 0;
+    return (usec - mp4->first_usec) * MP4_TIMESCALE / 1000000;
+}
+
+/******************************************************************************
+Description.: write the samples collected so far as a fragment
+Input Value.: * mp4.: the recording
+              * next: time of the sample after them, 0 if there is none yet
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int write_fragment(mp4_file *mp4, unsigned long long next)
+{
+    mp4_box b;
+    size_t moof, traf, box, offset;
+    unsigned long long time, end;
+    unsigned int duration = mp4->default_duration;
+    unsigned char mdat[8];
+    struct iovec iov[3];
+    int i, rc;
+
+    if(mp4->count == 0)
+        return 0;
+
+    b.capacity = 128 + 12 * mp4->count;
+    b.length = 0;
+    if((b.buf = malloc(b.capacity)) == NULL)
+        return -1;
+
+    moof = box_start(&b, "moof");
+    box = full_box_start(&b, "mfhd", 0, 0);
+    put32(&b, mp4->sequence);
+    box_end(&b, box);
+
+    traf = box_start(&b, "traf");
+    box = full_box_start(&b, "tfhd", 0, 0x020000);     // offsets from the moof
+    put32(&b, 1);
+    box_end(&b, box);
+    box = full_box_start(&b, "tfdt", 1, 0);
+    put64(&b, mp4->next_time);
+    box_end(&b, box);
+
+    /* durations, sizes and flags of the samples */
+    box = full_box_start(&b, "trun", 0, 0x000701);
+    put32(&b, mp4->count);
+    offset = b.length;
+    put32(&b, 0);
+    time = mp4->next_time;
+    for(i = 0; i < mp4->count; i++) {
+        /* timestamps running backwards still give increasing decode times */
+        if(i + 1 < mp4->count || next != 0) {
+            end = decode_time(mp4, (i + 1 < mp4->count) ? mp4->samples[i + 1].usec : next);
+            duration = (end > time) ? end - time : 1;
+        }
+        put32(&b, duration);
+        put32(&b, mp4->samples[i].size);
+        put32(&b, mp4->samples[i].keyframe ? MP4_SYNC_SAMPLE : MP4_OTHER_SAMPLE);
+        time += duration;
+    }
+    box_end(&b, box);
+    box_end(&b, traf);
+    box_end(&b, moof);
+
+    if(b.length > b.capacity) {
+        free(b.buf);
+        return -1;
+    }
+
+    /* the data of the samples follows the header of the mdat */
+    end = b.length;
+    b.length = offset;
+    put32(&b, end + 8);
+    b.length = end;
+
+    mdat[0] = (mp4->size + 8) >> 24;
+    mdat[1] = (mp4->size + 8) >> 16;
+    mdat[2] = (mp4->size + 8) >> 8;
+    mdat[3] = (mp4->size + 8);
+    memcpy(mdat + 4, "mdat", 4);
+
+    iov[0].iov_base = b.buf;
+    iov[0].iov_len = b.length;
+    iov[1].iov_base = mdat;
+    iov[1].iov_len = sizeof(mdat);
+    iov[2].iov_base = mp4->data;
+    iov[2].iov_len = mp4->size;
+    rc = write_all(mp4, iov, 3, 0, time - mp4->next_time, mp4->samples[0].keyframe);
+    free(b.buf);
+
+    mp4->sequence++;
+    mp4->next_time = time;
+    mp4->count = 0;
+    mp4->size = 0;
+    return rc;
+}
+
+/******************************************************************************
+Description.: set up a recording, before the first file
+Input Value.: * mp4...: the recording
+              * codec.: MP4_H264 or MP4_HEVC
+              * width.: width of the pictures
+              * height: height of the pictures
+              * fps...: rate of the pictures, for the duration of a last one
+Return Value: -
+******************************************************************************/
+void mp4_init(mp4_file *mp4, int codec, int width, int height, double fps)
+{
+    memset(mp4, 0, sizeof(*mp4));
+    mp4->fd = -1;
+    mp4->codec = codec;
+    mp4->width = width;
+    mp4->height = height;
+    mp4->default_duration = (fps > 0) ? MP4_TIMESCALE / fps : MP4_TIMESCALE / 30;
+}
+
+/******************************************************************************
+Description.: start a file, its pictures begin with the next IDR picture
+Input Value.: * mp4.: the recording
+              * path: name of the file
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+int mp4_open(mp4_file *mp4, const char *path)
+{
+    if((mp4->fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+        return -1;
+
+    mp4->started = 0;
+    mp4->sequence = 1;
+    mp4->next_time = 0;
+    mp4->count = 0;
+    mp4->size = 0;
+    return 0;
+}
+
+/******************************************************************************
+Description.: start a stream instead of a file, its pictures begin with the
+              next IDR picture
+Input Value.: * mp4......: the recording
+              * sink.....: gets the header and the fragments
+              * arg......: passed to the sink
+              * part_usec: fragments end before they get longer, 0 for a
+                           fragment per group of pictures
+Return Value: -
+******************************************************************************/
+void mp4_stream(mp4_file *mp4, mp4_sink sink, void *arg, unsigned long long part_usec)
+{
+    mp4->sink = sink;
+    mp4->sink_arg = arg;
+    mp4->part_usec = part_usec;
+    mp4->started = 0;
+    mp4->sequence = 1;
+    mp4->next_time = 0;
+    mp4->count = 0;
+    mp4->size = 0;
+}
+
+/******************************************************************************
+Description.: add an encoded picture to the file
+Input Value.: * mp4.: the recording
+              * data: the picture in Annex B format, with the parameter sets
+                      before IDR pictures
+              * size: its length
+              * usec: its capture time
+Return Value: 1 if it was added, 0 if it was left out as the file waits for
+              an IDR picture, -1 on errors
+******************************************************************************/
+int mp4_write(mp4_file *mp4, const unsigned char *data, int size, unsigned long long usec)
+{
+    const unsigned char *nal, *p = data, *end = data + size;
+    int length, type, picture = 0, keyframe = 0;
+    mp4_sample *samples;
+    unsigned char *buf;
+    size_t need;
+
+    /* the parameter sets go to the sample description */
+    while((nal = next_nal(p, end, &length)) != NULL) {
+        p = nal + length;
+        if(length < 2)
+            continue;
+        type = nal_type(mp4, nal);
+        if(header_nal(mp4, type)) {
+            keep_parameter_set(mp4, type, nal, length);
+            continue;
+        }
+        picture = 1;
+        if(mp4->codec == MP4_HEVC ? (type >= HEVC_IRAP_FIRST && type <= HEVC_IRAP_LAST) : type == H264_IDR)
+            keyframe = 1;
+    }
+    if(!picture || (mp4->fd < 0 && mp4->sink == NULL))
+        return 0;
+
+    if(!mp4->started) {
+        if(!keyframe || mp4->sps_size == 0 || mp4->pps_size == 0 ||
+           (mp4->codec == MP4_HEVC && mp4->vps_size == 0))
+            return 0;
+        if(write_header(mp4) < 0)
+            return -1;
+        mp4->started = 1;
+        mp4->first_usec = usec;
+    } else if(keyframe || (mp4->part_usec > 0 && mp4->count > 0 &&
+                           usec + mp4->default_duration * 1000000ULL / MP4_TIMESCALE >
+                           mp4->samples[0].usec + mp4->part_usec)) {
+        /* a part of a stream ends before the picture which would make it too long */
+        if(write_fragment(mp4, usec) < 0)
+            return -1;
+    }
+
+    /* each NAL unit gets its length instead of a start code, which may be
+     * a byte shorter, a NAL unit takes at least 5 bytes */
+    if((need = mp4->size + size + size / 4 + 64) > mp4->capacity) {
+        if(need < mp4->capacity * 2)
+            need = mp4->capacity * 2;
+        if((buf = realloc(mp4->data, need)) == NULL)
+            return -1;
+        mp4->data = buf;
+        mp4->capacity = need;
+    }
+    if(mp4->count == mp4->sample_capacity) {
+        if((samples = realloc(mp4->samples, (mp4->count + 64) * sizeof(mp4_sample))) == NULL)
+            return -1;
+        mp4->samples = samples;
+        mp4->sample_capacity = mp4->count + 64;
+    }
+
+    mp4->samples[mp4->count].size = 0;
+    for(p = data; (nal = next_nal(p, end, &length)) != NULL; p = nal + length) {
+        if(length < 2)
+            continue;
+        if(header_nal(mp4, nal_type(mp4, nal)))
+            continue;
+        buf = mp4->data + mp4->size;
+        buf[0] = length >> 24;
+        buf[1] = length >> 16;
+        buf[2] = length >> 8;
+        buf[3] = length;
+        memcpy(buf + 4, nal, length);
+        mp4->size += 4 + length;
+        mp4->samples[mp4->count].size += 4 + length;
+    }
+    mp4->samples[mp4->count].keyframe = keyframe;
+    mp4->samples[mp4->count].usec = usec;
+    mp4->count++;
+    return 1;
+}
+
+/******************************************************************************
+Description.: finish the file or stream with the fragment of the last pictures
+Input Value.: the recording
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+int mp4_close(mp4_file *mp4)
+{
+    int rc = 0;
+
+    if(mp4->fd < 0 && mp4->sink == NULL)
+        return 0;
+
+    if(mp4->started && write_fragment(mp4, 0) < 0)
+        rc = -1;
+    if(mp4->fd >= 0 && close(mp4->fd) < 0)
+        rc = -1;
+    mp4->fd = -1;
+    mp4->sink = NULL;
+    mp4->count = 0;
+    mp4->size = 0;
+    return rc;
+}
+
+/******************************************************************************
+Description.: free the buffers of a recording, after mp4_close()
+Input Value.: the recording
+Return Value: -
+******************************************************************************/
+void mp4_free(mp4_file *mp4)
+{
+    free(mp4->data);
+    free(mp4->samples);
+    mp4->data = NULL;
+    mp4->samples = NULL;
+    mp4->capacity = 0;
+    mp4->sample_capacity = 0;
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef MP4_H
+#define MP4_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*
+ * an H.264 or HEVC recording in a fragmented MP4. The header is written with
+ * the first IDR picture, each group of pictures follows in a fragment of its
+ * own once the next one starts, so a file cut off by a crash or a full disk
+ * plays up to its last complete fragment. Nothing is written back into the
+ * file, which also makes it readable while it grows.
+ *
+ * A stream started with mp4_stream() hands the header and the fragments to
+ * a function instead, as CMAF header and chunks for live streaming. Its
+ * fragments also end before they would get longer than part_usec.
+ */
+#define MP4_H264 0
+#define MP4_HEVC 1
+
+#define MP4_TIMESCALE 90000
+#define MP4_PARAMETER_SIZE 256
+
+typedef struct _mp4_sample {
+    unsigned int size;
+    int keyframe;
+    unsigned long long usec;
+} mp4_sample;
+
+/* gets the pieces of the header or of a fragment of a stream, the duration
+ * of a fragment in MP4_TIMESCALE and whether it starts with a keyframe */
+typedef int (*mp4_sink)(void *arg, const struct iovec *iov, int count, int header,
+                        unsigned int duration, int independent);
+
+typedef struct _mp4_file {
+    int fd;
+    mp4_sink sink;                  // NULL for files
+    void *sink_arg;
+    unsigned long long part_usec;   // longest fragment of a stream, 0 for a fragment per GOP
+    int codec;
+    int width, height;
+    unsigned int default_duration;  // of a last sample, in MP4_TIMESCALE
+
+    /* the latest parameter sets, kept for the next file */
+    unsigned char vps[MP4_PARAMETER_SIZE], sps[MP4_PARAMETER_SIZE], pps[MP4_PARAMETER_SIZE];
+    int vps_size, sps_size, pps_size;
+
+    int started;                    // the header is written
+    unsigned int sequence;          // of the next fragment
+    unsigned long long first_usec;  // time of the first sample of the file
+    unsigned long long next_time;   // decode time of the next fragment
+
+    /* the samples of the fragment, as length prefixed NAL units */
+    unsigned char *data;
+    size_t size, capacity;
+    mp4_sample *samples;
+    int count, sample_capacity;
+} mp4_file;
+
+void mp4_init(mp4_file *mp4, int codec, int width, int height, double fps);
+int mp4_open(mp4_file *mp4, const char *path);
+void mp4_stream(mp4_file *mp4, mp4_sink sink, void *arg, unsigned long long part_usec);
+int mp4_write(mp4_file *mp4, const unsigned char *data, int size, unsigned long long usec);
+int mp4_close(mp4_file *mp4);
+void mp4_free(mp4_file *mp4);
+
+#endif
@@ -0,0 +1,679 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+  This output plugin records the frames of an input as H.264 or HEVC, encoded
+  by a V4L2 memory-to-memory device, into fragmented MP4 files. Viewers keep
+  getting the JPEGs while a recording takes a fraction of their size.
+
+  Each frame is decoded once, with libjpeg as raw 4:2:0 planes without a
+  color conversion, into the picture other plugins of the frame share, and
+  copied into a buffer of the encoder. The worker thread takes the frames
+  from the input and decodes them while the device encodes the previous
+  ones, a second thread takes the encoded pictures from the device and
+  writes them, so neither the input nor the disk waits for the encoder. Frames the encoder has no room for are counted as overruns.
+
+  With --live the pictures also go to the LL-HLS segments of the input in
+  live.c, as CMAF parts of a continuous stream, which output_http serves.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <syslog.h>
+#include <time.h>
+#include <math.h>
+#include <sys/uio.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+#include "../../utils.h"
+#include "../../mjpg_streamer.h"
+
+#include "venc.h"
+#include "mp4.h"
+
+#define OUTPUT_PLUGIN_NAME "MP4 output plugin"
+
+/* time the encoder may take for a picture, in ms */
+#define ENCODE_TIMEOUT 2000
+
+/* longjmp target for errors of libjpeg, the default handler would exit */
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} mp4_error_mgr;
+
+static pthread_t worker, writer;
+static int writerRunning = 0;
+static globals *pglobal;
+static int plugin_id;
+static int input_number = 0;
+
+static char *folder = "/tmp";
+static char *fileName = "%Y_%m_%d_%H_%M_%S.mp4";
+static char *device = NULL;
+static int codec = VENC_H264;
+static int kbps = 2000;
+static int gop = 0;             // 2 seconds if not given
+static double fps = 0;          // the rate of the input if not given
+static int rotateTime = 0;
+static int partTime = 0;        // ms of the LL-HLS parts, 0 without --live
+static int record = 1;          // write files, not with --live alone
+
+/* the size of the recording, of the first frame */
+static int width, height;
+static venc *encoder = NULL;
+static mp4_file mp4;
+static mp4_file stream;         // of --live
+static time_t fileStart;
+
+/******************************************************************************
+Description.: print a help message
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void help(void)
+{
+    fprintf(stderr, " ---------------------------------------------------------------\n" \
+            " Help for output plugin..: "OUTPUT_PLUGIN_NAME"\n" \
+            " ---------------------------------------------------------------\n" \
+            " The following parameters can be passed to this plugin:\n\n" \
+            " [-f | --folder ]........: folder of the recordings\n" \
+            " [-m | --mp4 ]...........: name of the files, with strftime() formats,\n" \
+            "                           %%Y_%%m_%%d_%%H_%%M_%%S.mp4 by default\n" \
+            " [-i | --input ].........: read frames from the specified input plugin\n" \
+            " [-c | --codec ].........: h264 (default) or hevc\n" \
+            " [-d | --device ]........: the V4L2 mem2mem encoder, by default the\n" \
+            "                           first one for the codec\n" \
+            " [-b | --bitrate ].......: kbit/s, 2000 by default\n" \
+            " [-g | --gop ]...........: frames from one keyframe to the next,\n" \
+            "                           those of 2 seconds by default\n" \
+            " [-fps ].................: rate of the frames for the rate control,\n" \
+            "                           that of a paced input or 30 by default\n" \
+            " [-rt | --rotate-time ]..: start a new file at the first keyframe\n" \
+            "                           after this many seconds\n" \
+            " [-l | --live ]..........: stream LL-HLS parts of this many ms through\n" \
+            "                           output_http, files are only written if\n" \
+            "                           -f or -m is given as well\n" \
+            " ---------------------------------------------------------------\n");
+}
+
+static void mp4_error_exit(j_common_ptr cinfo)
+{
+    mp4_error_mgr *err = (mp4_error_mgr *)cinfo->err;
+
+    #ifdef DEBUG
+    (*cinfo->err->output_message)(cinfo);
+    #endif
+    longjmp(err->setjmp_buffer, 1);
+}
+
+/******************************************************************************
+Description.: copy a frame into a picture of the encoder, decoded as 4:2:0
+              planes without a color conversion. The decoded picture is the
+              one of the frame other plugins get as well, see frame_decode().
+Input Value.: * frame: the frame
+              * pic..: the picture
+Return Value: 0 if ok, -1 if the frame is broken or has another size
+******************************************************************************/
+static int decode_picture(input_frame *frame, venc_picture *pic)
+{
+    const decoded_picture *yuv;
+    const unsigned char *cb, *cr;
+    unsigned char *u, *v;
+    int x, y, n = width / 2;
+
+    if((yuv = frame_decode(frame, DECODE_YUV420, 0, 0)) == NULL)
+        return -1;
+    if((yuv->width & ~1) != width || (yuv->height & ~1) != height)
+        return -1;
+
+    for(y = 0; y < height; y++)
+        memcpy(pic->plane[0] + y * pic->stride[0], yuv->plane[0] + y * yuv->stride[0], width);
+
+    for(y = 0; y < height / 2; y++) {
+        cb = yuv->plane[1] + y * yuv->stride[1];
+        cr = yuv->plane[2] + y * yuv->stride[2];
+        u = pic->plane[1] + y * pic->stride[1];
+        if(pic->interleaved) {
+            for(x = 0; x < n; x++) {
+                u[2 * x] = cb[x];
+                u[2 * x + 1] = cr[x];
+            }
+        } else {
+            v = pic->plane[2] + y * pic->stride[2];
+            memcpy(u, cb, n);
+            memcpy(v, cr, n);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: number the name of a file of a recording which exists already,
+              like a file started within the same second as the one before,
+              name_1.mp4, name_2.mp4 and so on
+Input Value.: * name: of the file, gets the number
+              * size: room at name
+Return Value: -
+******************************************************************************/
+static void number_recording(char *name, size_t size)
+{
+    char numbered[1024 + 16];
+    const char *extension;
+    int i, len;
+
+    if(access(name, F_OK) != 0)
+        return;
+
+    if((extension = strrchr(name, '.')) == NULL || strchr(extension, '/') != NULL)
+        extension = name + strlen(name);
+    for(i = 1; i < 1000; i++) {
+        len = snprintf(numbered, sizeof(numbered), "%.*s_%d%s", (int)(extension - name), name, i, extension);
+        if(len < 0 || (size_t)len >= size)
+            return;
+        if(access(numbered, F_OK) != 0) {
+            memcpy(name, numbered, len + 1);
+            return;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: open the next file of the recording, the time replaces the
+              strftime() formats of its name. Rotated recordings without
+              formats get the time appended to their names, files of them
+              which would replace one get a number.
+Input Value.: time the file starts at
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int open_file(time_t when)
+{
+    char pattern[1024], name[1024];
+    const char *extension;
+    struct tm *now;
+
+    if(rotateTime > 0 && strchr(fileName, '%') == NULL) {
+        if((extension = strrchr(fileName, '.')) == NULL)
+            extension = fileName + strlen(fileName);
+        snprintf(pattern, sizeof(pattern), "%s/%.*s_%%Y_%%m_%%d_%%H_%%M_%%S%s",
+                 folder, (int)(extension - fileName), fileName, extension);
+    } else {
+        snprintf(pattern, sizeof(pattern), "%s/%s", folder, fileName);
+    }
+
+    if((now = localtime(&when)) == NULL || strftime(name, sizeof(name), pattern, now) == 0) {
+        OPRINT("could not compose the name of the recording\n");
+        return -1;
+    }
+    if(rotateTime > 0)
+        number_recording(name, sizeof(name));
+
+    if(mp4_open(&mp4, name) < 0) {
+        OPRINT("could not open the file %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    OPRINT("output file.......: %s\n", name);
+    fileStart = when;
+    return 0;
+}
+
+/******************************************************************************
+Description.: hand the header and the parts of the live stream to the input
+Input Value.: see mp4_sink
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int live_sink(void *arg, const struct iovec *iov, int count, int header,
+                     unsigned int duration, int independent)
+{
+    if(header)
+        return live_header(arg, iov, count);
+    return live_part(arg, iov, count, duration, independent);
+}
+
+/******************************************************************************
+Description.: tell whether an encoded picture starts a group of pictures
+Input Value.: the packet
+Return Value: 1 for IDR pictures, 0 otherwise
+******************************************************************************/
+static int starts_gop(venc_packet *pkt)
+{
+    const unsigned char *p;
+    int type;
+
+    if(pkt->keyframe)
+        return 1;
+
+    /* not every device flags its keyframes */
+    for(p = pkt->data; p + 3 < pkt->data + pkt->size; p++) {
+        if(p[0] != 0 || p[1] != 0 || p[2] != 1)
+            continue;
+        type = (codec == VENC_HEVC) ? (p[3] >> 1) & 0x3f : p[3] & 0x1f;
+        if((codec == VENC_HEVC) ? (type >= 16 && type <= 23) : type == 5)
+            return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: write the encoded pictures until the encoder has drained or the
+              program stops
+Input Value.: unused
+Return Value: NULL
+******************************************************************************/
+static void *writer_thread(void *arg)
+{
+    unsigned long long usec;
+    venc_packet pkt;
+    int ret;
+
+    while((ret = venc_receive(encoder, &pkt, 200)) >= 0) {
+        if(ret == 0) {
+            /* the encoder could not drain */
+            if(pglobal->stop)
+                break;
+            continue;
+        }
+
+        if(pkt.size > 0) {
+            /* a new file starts with a keyframe */
+            if(record && rotateTime > 0 && time(NULL) >= fileStart + rotateTime && starts_gop(&pkt)) {
+                if(mp4_close(&mp4) < 0)
+                    OPRINT("could not finish the recording: %s\n", strerror(errno));
+                open_file(time(NULL));
+            }
+            usec = pkt.timestamp.tv_sec * 1000000ULL + pkt.timestamp.tv_usec;
+            if(mp4_write(&mp4, pkt.data, pkt.size, usec) < 0)
+                OPRINT("could not write the recording: %s\n", strerror(errno));
+            if(partTime > 0 && mp4_write(&stream, pkt.data, pkt.size, usec) < 0)
+                OPRINT("could not add to the live stream\n");
+        }
+
+        if(pkt.last)
+            break;
+        if(venc_release(encoder, &pkt) < 0)
+            break;
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: set up the encoder and the first file for the size of the first
+              frame and start the writer
+Input Value.: the first frame
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int start_recording(input_frame *frame)
+{
+    struct jpeg_decompress_struct dinfo;
+    mp4_error_mgr err;
+    unsigned long long part;
+    double rate = fps;
+
+    dinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = mp4_error_exit;
+    jpeg_create_decompress(&dinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_decompress(&dinfo);
+        return -1;
+    }
+    jpeg_mem_src(&dinfo, frame->buf, frame->size);
+    jpeg_read_header(&dinfo, TRUE);
+    width = dinfo.image_width & ~1;
+    height = dinfo.image_height & ~1;
+    jpeg_destroy_decompress(&dinfo);
+
+    if(rate <= 0 && (rate = pglobal->in[input_number].stats.target_fps) <= 0)
+        rate = 30;
+    if(gop <= 0)
+        gop = (rate * 2 > 1) ? rate * 2 : 1;
+
+    if((encoder = venc_new(device, codec, width, height, rate, kbps, gop)) == NULL) {
+        OPRINT("ERROR: found no %s encoder for %dx%d pictures\n", (codec == VENC_HEVC) ? "HEVC" : "H.264",
+               width, height);
+        return -1;
+    }
+    OPRINT("recording.........: %dx%d at %.2f fps, %d kbit/s, a keyframe every %d frames\n",
+           width, height, rate, kbps, gop);
+
+    mp4_init(&mp4, (codec == VENC_HEVC) ? MP4_HEVC : MP4_H264, width, height, rate);
+    if(record && open_file(time(NULL)) < 0)
+        return -1;
+
+    if(partTime > 0) {
+        /* a part holds one picture at least */
+        part = MAX(partTime * 1000ULL, 1000000 / rate);
+        if(live_start(&pglobal->in[input_number], MP4_TIMESCALE, (part + 999) / 1000, ceil(gop / rate)) < 0)
+            return -1;
+        mp4_init(&stream, (codec == VENC_HEVC) ? MP4_HEVC : MP4_H264, width, height, rate);
+        mp4_stream(&stream, live_sink, &pglobal->in[input_number], part);
+        OPRINT("live stream.......: parts of %llu ms on input %d\n", (part + 999) / 1000, input_number);
+    }
+
+    if(pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+        OPRINT("could not start the writer thread\n");
+        return -1;
+    }
+    writerRunning = 1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: stop the writer, finish the file and close the encoder
+Input Value.: unused argument
+Return Value: -
+******************************************************************************/
+void worker_cleanup(void *arg)
+{
+    static unsigned char first_run = 1;
+
+    if(!first_run) {
+        DBG("already cleaned up resources\n");
+        return;
+    }
+    first_run = 0;
+
+    if(writerRunning) {
+        pthread_cancel(writer);
+        pthread_join(writer, NULL);
+        writerRunning = 0;
+    }
+    if(mp4_close(&mp4) < 0)
+        OPRINT("could not finish the recording: %s\n", strerror(errno));
+    mp4_free(&mp4);
+    if(partTime > 0) {
+        mp4_close(&stream);
+        mp4_free(&stream);
+        live_stop(&pglobal->in[input_number]);
+    }
+    venc_free(encoder);
+    encoder = NULL;
+}
+
+/******************************************************************************
+Description.: take every frame of the input, decode it into the encoder and
+              let the encoder drain when the program stops
+Input Value.: unused
+Return Value: NULL
+******************************************************************************/
+void *worker_thread(void *arg)
+{
+    frame_subscription sub;
+    input_frame *frame;
+    venc_picture pic;
+    int ret, skipped = 0;
+
+    mp4.fd = -1;
+    stream.fd = -1;
+    pthread_cleanup_push(worker_cleanup, NULL);
+
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_NEXT, &pglobal->out[plugin_id].stats);
+
+    while(!pglobal->stop) {
+        if((frame = frame_next(&sub, 200)) == NULL)
+            continue;
+
+        /* buf holds the JPEG without the metadata segment, it is decoded as it is */
+        if(encoder == NULL && start_recording(frame) < 0) {
+            frame_unref(frame);
+            break;
+        }
+
+        /* the thread waits here while the device has all pictures */
+        if((ret = venc_get_picture(encoder, &pic, ENCODE_TIMEOUT)) <= 0) {
+            OPRINT("the encoder %s\n", (ret == 0) ? "does not finish its pictures" : "failed");
+            pglobal->out[plugin_id].stats.overruns++;
+        } else if(decode_picture(frame, &pic) < 0) {
+            if(!skipped++)
+                OPRINT("frames of another size than %dx%d or broken frames are left out\n", width, height);
+        } else if(venc_put_picture(encoder, &frame->timestamp) < 0) {
+            pglobal->out[plugin_id].stats.overruns++;
+        }
+        frame_unref(frame);
+    }
+
+    /* the writer gets the pictures still in the device and a last one */
+    if(encoder != NULL && venc_drain(encoder) < 0)
+        DBG("the encoder can not drain\n");
+    if(writerRunning) {
+        pthread_join(writer, NULL);
+        writerRunning = 0;
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+/*** plugin interface functions ***/
+/******************************************************************************
+Description.: this function is called first, in order to initialize
+              this plugin and pass a parameter string
+Input Value.: parameters
+Return Value: 0 if everything is OK, non-zero otherwise
+******************************************************************************/
+int output_init(output_parameter *param, int id)
+{
+    int i, fileSet = 0;
+
+    pglobal = param->global;
+    plugin_id = id;
+    pglobal->out[id].name = malloc((1 + strlen(OUTPUT_PLUGIN_NAME)) * sizeof(char));
+    sprintf(pglobal->out[id].name, "%s", OUTPUT_PLUGIN_NAME);
+    DBG("OUT plugin %d name: %s\n", id, pglobal->out[id].name);
+
+    param->argv[0] = OUTPUT_PLUGIN_NAME;
+
+    /* show all parameters for DBG purposes */
+    for(i = 0; i < param->argc; i++) {
+        DBG("argv[%d]=%s\n", i, param->argv[i]);
+    }
+
+    reset_getopt();
+    while(1) {
+        int option_index = 0, c = 0;
+        static struct option long_options[] = {
+            {"h", no_argument, 0, 0},
+            {"help", no_argument, 0, 0},
+            {"f", required_argument, 0, 0},
+            {"folder", required_argument, 0, 0},
+            {"m", required_argument, 0, 0},
+            {"mp4", required_argument, 0, 0},
+            {"i", required_argument, 0, 0},
+            {"input", required_argument, 0, 0},
+            {"c", required_argument, 0, 0},
+            {"codec", required_argument, 0, 0},
+            {"d", required_argument, 0, 0},
+            {"device", required_argument, 0, 0},
+            {"b", required_argument, 0, 0},
+            {"bitrate", required_argument, 0, 0},
+            {"g", required_argument, 0, 0},
+            {"gop", required_argument, 0, 0},
+            {"fps", required_argument, 0, 0},
+            {"rt", required_argument, 0, 0},
+            {"rotate-time", required_argument, 0, 0},
+            {"l", required_argument, 0, 0},
+            {"live", required_argument, 0, 0},
+            {0, 0, 0, 0}
+        };
+
+        c = getopt_long_only(param->argc, param->argv, "", long_options, &option_index);
+
+        /* no more options to parse */
+        if(c == -1) break;
+
+        /* unrecognized option */
+        if(c == '?') {
+            help();
+            return 1;
+        }
+
+        switch(option_index) {
+            /* h, help */
+        case 0:
+        case 1:
+            DBG("case 0,1\n");
+            help();
+            return 1;
+            break;
+
+            /* f, folder */
+        case 2:
+        case 3:
+            DBG("case 2,3\n");
+            folder = strdup(optarg);
+            fileSet = 1;
+            if(strlen(folder) > 1 && folder[strlen(folder) - 1] == '/')
+                folder[strlen(folder) - 1] = '\0';
+            break;
+
+            /* m, mp4 */
+        case 4:
+        case 5:
+            DBG("case 4,5\n");
+            fileName = strdup(optarg);
+            fileSet = 1;
+            break;
+
+            /* i, input */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            input_number = atoi(optarg);
+            break;
+
+            /* c, codec */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            if(strcasecmp(optarg, "h264") == 0) {
+                codec = VENC_H264;
+            } else if(strcasecmp(optarg, "hevc") == 0 || strcasecmp(optarg, "h265") == 0) {
+                codec = VENC_HEVC;
+            } else {
+                OPRINT("ERROR: the codec has to be h264 or hevc\n");
+                return 1;
+            }
+            break;
+
+            /* d, device */
+        case 10:
+        case 11:
+            DBG("case 10,11\n");
+            device = strdup(optarg);
+            break;
+
+            /* b, bitrate */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            if((kbps = atoi(optarg)) <= 0) {
+                OPRINT("ERROR: the bitrate has to be above 0\n");
+                return 1;
+            }
+            break;
+
+            /* g, gop */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            gop = atoi(optarg);
+            break;
+
+            /* fps */
+        case 16:
+            DBG("case 16\n");
+            fps = atof(optarg);
+            break;
+
+            /* rt, rotate-time */
+        case 17:
+        case 18:
+            DBG("case 17,18\n");
+            rotateTime = atoi(optarg);
+            break;
+
+            /* l, live */
+        case 19:
+        case 20:
+            DBG("case 19,20\n");
+            if((partTime = atoi(optarg)) <= 0) {
+                OPRINT("ERROR: the parts of the live stream need a duration in ms\n");
+                return 1;
+            }
+            break;
+        }
+    }
+
+    /* --live alone streams without files */
+    record = (partTime == 0 || fileSet);
+
+    if(!(input_number < pglobal->incnt)) {
+        OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", input_number, pglobal->incnt);
+        return 1;
+    }
+
+    OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
+    if(record) {
+        OPRINT("output folder.....: %s\n", folder);
+        OPRINT("file name.........: %s\n", fileName);
+    }
+    OPRINT("codec.............: %s, %d kbit/s\n", (codec == VENC_HEVC) ? "HEVC" : "H.264", kbps);
+    OPRINT("encoder...........: %s\n", (device != NULL) ? device : "the first one found");
+    if(rotateTime > 0) {
+        OPRINT("rotate after......: %d s\n", rotateTime);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: calling this function stops the worker thread
+Input Value.: -
+Return Value: always 0
+******************************************************************************/
+int output_stop(int id)
+{
+    DBG("will cancel worker thread\n");
+    pthread_cancel(worker);
+    return 0;
+}
+
+/******************************************************************************
+Description.: calling this function creates and starts the worker thread
+Input Value.: -
+Return Value: always 0
+******************************************************************************/
+int output_run(int id)
+{
+    DBG("launching worker thread\n");
+    pthread_create(&worker, 0, worker_thread, NULL);
+    pthread_detach(worker);
+    return 0;
+}
@@ -0,0 +1,654 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * The device is set up like the stateful encoder interface of V4L2 asks for:
+ * the coded format first, then the raw one, the frame interval and the
+ * visible size, which may be smaller than the coded size the device wants for
+ * its buffers. The parameter sets are repeated before each IDR picture, so
+ * each file of a rotated recording gets them, and B-frames are turned off as
+ * the recording has no composition offsets.
+ *
+ * Like m2m.c for JPEGs, single- and multi-planar devices are supported as
+ * long as the raw format fits into one plane.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "venc.h"
+
+/* devices probed if none is given */
+#define VENC_PROBE_DEVICES 64
+
+/* buffers of each queue */
+#define VENC_BUFFERS 4
+
+typedef struct {
+    void *mem;
+    size_t length;
+} venc_buffer;
+
+struct _venc {
+    int fd;
+    int mplane;                 // the device uses the multi-planar API
+    unsigned int out_type;
+    unsigned int cap_type;
+
+    /* OUTPUT queue, the raw pictures */
+    unsigned int pixelformat;   // V4L2_PIX_FMT_YUV420 or V4L2_PIX_FMT_NV12
+    int bytesperline;
+    int coded_height;           // lines of the luma plane in a buffer
+    venc_buffer out[VENC_BUFFERS];
+    int out_count;
+    int out_free[VENC_BUFFERS]; // buffers not queued to the device
+    int free_count;
+    int held;                   // given out by venc_get_picture(), -1 if none
+
+    /* CAPTURE queue, the packets */
+    venc_buffer cap[VENC_BUFFERS];
+    int cap_count;
+};
+
+/******************************************************************************
+Description.: ioctl which is restarted after signals
+Input Value.: like ioctl()
+Return Value: like ioctl()
+******************************************************************************/
+static int venc_ioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while(ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: check if a queue of the device supports a pixel format
+Input Value.: * fd.........: the device
+              * type.......: the queue
+              * pixelformat: the format
+Return Value: 1 if it does, 0 if not
+******************************************************************************/
+static int venc_has_format(int fd, unsigned int type, unsigned int pixelformat)
+{
+    struct v4l2_fmtdesc desc;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.type = type;
+    while(venc_ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0) {
+        if(desc.pixelformat == pixelformat)
+            return 1;
+        desc.index++;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: check if a device encodes 4:2:0 pictures into a coded format
+Input Value.: * e....: the encoder, gets the API and the raw format
+              * coded: V4L2_PIX_FMT_H264 or V4L2_PIX_FMT_HEVC
+Return Value: 0 if the device can be used, -1 if not
+******************************************************************************/
+static int venc_probe(venc *e, unsigned int coded)
+{
+    struct v4l2_capability cap;
+    unsigned int caps;
+
+    memset(&cap, 0, sizeof(cap));
+    if(venc_ioctl(e->fd, VIDIOC_QUERYCAP, &cap) < 0)
+        return -1;
+
+    caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if(!(caps & V4L2_CAP_STREAMING))
+        return -1;
+
+    if(caps & V4L2_CAP_VIDEO_M2M_MPLANE)
+        e->mplane = 1;
+    else if(caps & V4L2_CAP_VIDEO_M2M)
+        e->mplane = 0;
+    else
+        return -1;
+
+    e->out_type = e->mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    e->cap_type = e->mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(!venc_has_format(e->fd, e->cap_type, coded))
+        return -1;
+
+    if(venc_has_format(e->fd, e->out_type, V4L2_PIX_FMT_YUV420))
+        e->pixelformat = V4L2_PIX_FMT_YUV420;
+    else if(venc_has_format(e->fd, e->out_type, V4L2_PIX_FMT_NV12))
+        e->pixelformat = V4L2_PIX_FMT_NV12;
+    else
+        return -1;
+
+    DBG("%s is a video encoder\n", cap.card);
+    return 0;
+}
+
+/******************************************************************************
+Description.: prepare a v4l2_buffer for a queue of the encoder
+Input Value.: * e......: the encoder
+              * buf....: the buffer to fill in
+              * plane..: storage for the plane of multi-planar devices
+              * type...: the queue
+              * index..: number of the buffer
+Return Value: -
+******************************************************************************/
+static void venc_buffer_init(venc *e, struct v4l2_buffer *buf, struct v4l2_plane *plane,
+                             unsigned int type, int index)
+{
+    memset(buf, 0, sizeof(*buf));
+    memset(plane, 0, sizeof(*plane));
+    buf->type = type;
+    buf->memory = V4L2_MEMORY_MMAP;
+    buf->index = index;
+    if(e->mplane) {
+        buf->m.planes = plane;
+        buf->length = 1;
+    }
+}
+
+/******************************************************************************
+Description.: set a control of the encoder, devices lacking it are fine
+Input Value.: * e....: the encoder
+              * id...: V4L2_CID_*
+              * value: its value
+Return Value: -
+******************************************************************************/
+static void venc_control(venc *e, unsigned int id, int value)
+{
+    struct v4l2_control ctrl;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = id;
+    ctrl.value = value;
+    if(venc_ioctl(e->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+        DBG("the video encoder does not support control %08x\n", id);
+    }
+}
+
+/******************************************************************************
+Description.: set the formats of both queues
+Input Value.: * e.....: the encoder
+              * coded.: V4L2_PIX_FMT_H264 or V4L2_PIX_FMT_HEVC
+              * width.: width of the pictures
+              * height: height of the pictures
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int venc_set_formats(venc *e, unsigned int coded, int width, int height)
+{
+    struct v4l2_format fmt;
+    struct v4l2_selection sel;
+    int coded_width;
+
+    /* the coded format comes first, it decides on the raw formats */
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = e->cap_type;
+    if(e->mplane) {
+        fmt.fmt.pix_mp.width = width;
+        fmt.fmt.pix_mp.height = height;
+        fmt.fmt.pix_mp.pixelformat = coded;
+        fmt.fmt.pix_mp.num_planes = 1;
+    } else {
+        fmt.fmt.pix.width = width;
+        fmt.fmt.pix.height = height;
+        fmt.fmt.pix.pixelformat = coded;
+    }
+    if(venc_ioctl(e->fd, VIDIOC_S_FMT, &fmt) < 0) {
+        perror("VIDIOC_S_FMT on the video encoder");
+        return -1;
+    }
+
+    /* the device may round the raw size up to its macroblocks */
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = e->out_type;
+    if(e->mplane) {
+        fmt.fmt.pix_mp.width = width;
+        fmt.fmt.pix_mp.height = height;
+        fmt.fmt.pix_mp.pixelformat = e->pixelformat;
+        fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+        fmt.fmt.pix_mp.num_planes = 1;
+    } else {
+        fmt.fmt.pix.width = width;
+        fmt.fmt.pix.height = height;
+        fmt.fmt.pix.pixelformat = e->pixelformat;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    }
+    if(venc_ioctl(e->fd, VIDIOC_S_FMT, &fmt) < 0) {
+        perror("VIDIOC_S_FMT on the video encoder");
+        return -1;
+    }
+
+    if(e->mplane) {
+        if(fmt.fmt.pix_mp.pixelformat != e->pixelformat || fmt.fmt.pix_mp.num_planes != 1)
+            return -1;
+        coded_width = fmt.fmt.pix_mp.width;
+        e->coded_height = fmt.fmt.pix_mp.height;
+        e->bytesperline = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+    } else {
+        if(fmt.fmt.pix.pixelformat != e->pixelformat)
+            return -1;
+        coded_width = fmt.fmt.pix.width;
+        e->coded_height = fmt.fmt.pix.height;
+        e->bytesperline = fmt.fmt.pix.bytesperline;
+    }
+    if(coded_width < width || e->coded_height < height || e->bytesperline < width)
+        return -1;
+
+    /* only the visible part of a rounded size is encoded */
+    if(coded_width != width || e->coded_height != height) {
+        memset(&sel, 0, sizeof(sel));
+        sel.type = e->out_type;
+        sel.target = V4L2_SEL_TGT_CROP;
+        sel.r.width = width;
+        sel.r.height = height;
+        if(venc_ioctl(e->fd, VIDIOC_S_SELECTION, &sel) < 0) {
+            DBG("the video encoder can not crop to %dx%d\n", width, height);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: allocate and map the buffers of a queue
+Input Value.: * e......: the encoder
+              * type...: the queue
+              * buffers: the mappings
+              * count..: set to the number of buffers
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+static int venc_map_buffers(venc *e, unsigned int type, venc_buffer *buffers, int *count)
+{
+    struct v4l2_requestbuffers rb;
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    unsigned int offset;
+    int i;
+
+    memset(&rb, 0, sizeof(rb));
+    rb.count = VENC_BUFFERS;
+    rb.type = type;
+    rb.memory = V4L2_MEMORY_MMAP;
+    if(venc_ioctl(e->fd, VIDIOC_REQBUFS, &rb) < 0 || rb.count < 1) {
+        perror("VIDIOC_REQBUFS on the video encoder");
+        return -1;
+    }
+
+    for(i = 0; i < (int)rb.count && i < VENC_BUFFERS; i++) {
+        venc_buffer_init(e, &buf, &plane, type, i);
+        if(venc_ioctl(e->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            perror("VIDIOC_QUERYBUF on the video encoder");
+            return -1;
+        }
+
+        buffers[i].length = e->mplane ? plane.length : buf.length;
+        offset = e->mplane ? plane.m.mem_offset : buf.m.offset;
+        buffers[i].mem = mmap(NULL, buffers[i].length, PROT_READ | PROT_WRITE, MAP_SHARED, e->fd, offset);
+        if(buffers[i].mem == MAP_FAILED) {
+            perror("mmap of the video encoder buffer");
+            buffers[i].mem = NULL;
+            return -1;
+        }
+        (*count)++;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: wait for a buffer and dequeue it
+Input Value.: * e......: the encoder
+              * buf....: prepared with venc_buffer_init(), filled in by the device
+              * events.: POLLIN for CAPTURE, POLLOUT for OUTPUT
+              * timeout: in ms
+Return Value: 1 on success, 0 on timeouts, -1 on errors
+******************************************************************************/
+static int venc_dequeue(venc *e, struct v4l2_buffer *buf, short events, int timeout)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = e->fd;
+    pfd.events = events;
+
+    while(venc_ioctl(e->fd, VIDIOC_DQBUF, buf) < 0) {
+        if(errno != EAGAIN)
+            return -1;
+        do {
+            ret = poll(&pfd, 1, timeout);
+        } while(ret < 0 && errno == EINTR);
+        if(ret <= 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+Description.: Open a hardware video encoder
+Input Value.: * device: the mem2mem device, NULL to use the first one which
+                        encodes this codec
+              * codec.: VENC_H264 or VENC_HEVC
+              * width.: width of the pictures
+              * height: height of the pictures
+              * fps....: rate of the pictures
+              * kbps...: bitrate
+              * gop....: pictures from one IDR picture to the next
+Return Value: the encoder, NULL if there is no suitable device
+******************************************************************************/
+venc *venc_new(const char *device, int codec, int width, int height, double fps, int kbps, int gop)
+{
+    struct v4l2_streamparm parm;
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    unsigned int coded;
+    char name[32];
+    venc *e;
+    int i, type;
+
+    #ifdef V4L2_PIX_FMT_HEVC
+    coded = (codec == VENC_HEVC) ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+    #else
+    if(codec == VENC_HEVC) {
+        fprintf(stderr, "HEVC is not known to the V4L2 headers of this build\n");
+        return NULL;
+    }
+    coded = V4L2_PIX_FMT_H264;
+    #endif
+
+    if((e = calloc(1, sizeof(venc))) == NULL)
+        return NULL;
+    e->fd = -1;
+    e->held = -1;
+
+    /* look for the first device which encodes this codec */
+    for(i = 0; e->fd < 0 && i < (device != NULL ? 1 : VENC_PROBE_DEVICES); i++) {
+        if(device == NULL) {
+            snprintf(name, sizeof(name), "/dev/video%d", i);
+        } else {
+            snprintf(name, sizeof(name), "%s", device);
+        }
+
+        if((e->fd = open(name, O_RDWR | O_NONBLOCK)) < 0) {
+            if(device != NULL)
+                perror(name);
+            continue;
+        }
+
+        if(venc_probe(e, coded) < 0) {
+            if(device != NULL)
+                fprintf(stderr, "%s is no %s encoder for 4:2:0 pictures\n", name,
+                        (codec == VENC_HEVC) ? "HEVC" : "H.264");
+            close(e->fd);
+            e->fd = -1;
+        }
+    }
+
+    if(e->fd < 0) {
+        free(e);
+        return NULL;
+    }
+
+    if(venc_set_formats(e, coded, width, height) < 0) {
+        fprintf(stderr, "%s does not encode %dx%d pictures\n", name, width, height);
+        goto fail;
+    }
+
+    /* the rate control needs the rate the pictures come at */
+    memset(&parm, 0, sizeof(parm));
+    parm.type = e->out_type;
+    parm.parm.output.timeperframe.numerator = 1000;
+    parm.parm.output.timeperframe.denominator = fps * 1000;
+    if(venc_ioctl(e->fd, VIDIOC_S_PARM, &parm) < 0) {
+        DBG("the video encoder does not support setting the frame rate\n");
+    }
+
+    venc_control(e, V4L2_CID_MPEG_VIDEO_BITRATE, kbps * 1000);
+    venc_control(e, V4L2_CID_MPEG_VIDEO_GOP_SIZE, gop);
+    venc_control(e, V4L2_CID_MPEG_VIDEO_B_FRAMES, 0);
+    venc_control(e, V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1);
+    venc_control(e, V4L2_CID_MPEG_VIDEO_HEADER_MODE, V4L2_MPEG_VIDEO_HEADER_MODE_JOINED_WITH_1ST_FRAME);
+    if(codec == VENC_H264)
+        venc_control(e, V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, gop);
+
+    if(venc_map_buffers(e, e->out_type, e->out, &e->out_count) < 0 ||
+       venc_map_buffers(e, e->cap_type, e->cap, &e->cap_count) < 0)
+        goto fail;
+
+    for(i = 0; i < e->out_count; i++)
+        e->out_free[e->free_count++] = i;
+
+    for(i = 0; i < e->cap_count; i++) {
+        venc_buffer_init(e, &buf, &plane, e->cap_type, i);
+        if(venc_ioctl(e->fd, VIDIOC_QBUF, &buf) < 0) {
+            perror("VIDIOC_QBUF on the video encoder");
+            goto fail;
+        }
+    }
+
+    type = e->out_type;
+    if(venc_ioctl(e->fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("VIDIOC_STREAMON on the video encoder");
+        goto fail;
+    }
+    type = e->cap_type;
+    if(venc_ioctl(e->fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("VIDIOC_STREAMON on the video encoder");
+        goto fail;
+    }
+
+    OPRINT("video encoder.....: %s, %s from %s, %d+%d buffers\n", name,
+           (codec == VENC_HEVC) ? "HEVC" : "H.264",
+           (e->pixelformat == V4L2_PIX_FMT_NV12) ? "NV12" : "YUV420", e->out_count, e->cap_count);
+    return e;
+
+fail:
+    venc_free(e);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: get a buffer of the OUTPUT queue to put the next picture into,
+              the same one again until it is handed over with
+              venc_put_picture()
+Input Value.: * e......: the encoder
+              * pic....: gets the planes of the buffer
+              * timeout: time to wait for the device to finish a picture in ms
+Return Value: 1 if there is a buffer, 0 on timeouts, -1 on errors
+******************************************************************************/
+int venc_get_picture(venc *e, venc_picture *pic, int timeout)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    unsigned char *mem;
+    int ret;
+
+    if(e->held < 0 && e->free_count > 0) {
+        e->held = e->out_free[--e->free_count];
+    } else if(e->held < 0) {
+        venc_buffer_init(e, &buf, &plane, e->out_type, 0);
+        if((ret = venc_dequeue(e, &buf, POLLOUT, timeout)) <= 0)
+            return ret;
+        e->held = buf.index;
+    }
+
+    /* the chroma planes follow the luma lines of the coded height */
+    mem = e->out[e->held].mem;
+    pic->plane[0] = mem;
+    pic->stride[0] = e->bytesperline;
+    pic->plane[1] = mem + e->bytesperline * e->coded_height;
+    if(e->pixelformat == V4L2_PIX_FMT_NV12) {
+        pic->stride[1] = e->bytesperline;
+        pic->plane[2] = NULL;
+        pic->stride[2] = 0;
+        pic->interleaved = 1;
+    } else {
+        pic->stride[1] = pic->stride[2] = e->bytesperline / 2;
+        pic->plane[2] = pic->plane[1] + e->bytesperline / 2 * (e->coded_height / 2);
+        pic->interleaved = 0;
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+Description.: hand the picture of venc_get_picture() over to the device
+Input Value.: * e........: the encoder
+              * timestamp: of the picture, the device gives it to its packet
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+int venc_put_picture(venc *e, const struct timeval *timestamp)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    unsigned int used;
+
+    if(e->held < 0)
+        return -1;
+
+    used = MIN((size_t)e->bytesperline * e->coded_height * 3 / 2, e->out[e->held].length);
+    venc_buffer_init(e, &buf, &plane, e->out_type, e->held);
+    buf.field = V4L2_FIELD_NONE;
+    buf.timestamp = *timestamp;
+    if(e->mplane)
+        plane.bytesused = used;
+    else
+        buf.bytesused = used;
+
+    if(venc_ioctl(e->fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("VIDIOC_QBUF on the video encoder");
+        return -1;
+    }
+
+    e->held = -1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: let the device encode the pictures it has and mark its last
+              packet
+Input Value.: the encoder
+Return Value: 0 on success, -1 if the device can not drain
+******************************************************************************/
+int venc_drain(venc *e)
+{
+    struct v4l2_encoder_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = V4L2_ENC_CMD_STOP;
+    return venc_ioctl(e->fd, VIDIOC_ENCODER_CMD, &cmd);
+}
+
+/******************************************************************************
+Description.: take the next packet from the CAPTURE queue
+Input Value.: * e......: the encoder
+              * pkt....: gets the packet, hand it back with venc_release()
+              * timeout: in ms
+Return Value: 1 if there is a packet, 0 on timeouts, -1 on errors and after
+              the last packet
+******************************************************************************/
+int venc_receive(venc *e, venc_packet *pkt, int timeout)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    unsigned int used, offset;
+    int ret;
+
+    venc_buffer_init(e, &buf, &plane, e->cap_type, 0);
+    if((ret = venc_dequeue(e, &buf, POLLIN, timeout)) <= 0)
+        return ret;
+
+    used = e->mplane ? plane.bytesused : buf.bytesused;
+    offset = e->mplane ? plane.data_offset : 0;
+    if((buf.flags & V4L2_BUF_FLAG_ERROR) || used <= offset || used > e->cap[buf.index].length)
+        used = offset = 0;
+
+    pkt->index = buf.index;
+    pkt->data = (unsigned char *)e->cap[buf.index].mem + offset;
+    pkt->size = used - offset;
+    pkt->keyframe = (buf.flags & V4L2_BUF_FLAG_KEYFRAME) != 0;
+    pkt->last = (buf.flags & V4L2_BUF_FLAG_LAST) != 0;
+    pkt->timestamp = buf.timestamp;
+    return 1;
+}
+
+/******************************************************************************
+Description.: give the buffer of a packet back to the device
+Input Value.: * e..: the encoder
+              * pkt: from venc_receive()
+Return Value: 0 on success, -1 on errors
+******************************************************************************/
+int venc_release(venc *e, venc_packet *pkt)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+
+    venc_buffer_init(e, &buf, &plane, e->cap_type, pkt->index);
+    if(venc_ioctl(e->fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("VIDIOC_QBUF on the video encoder");
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: Stop and close a hardware video encoder
+Input Value.: the encoder, may be NULL
+Return Value: -
+******************************************************************************/
+void venc_free(venc *e)
+{
+    int i, type;
+
+    if(e == NULL)
+        return;
+
+    if(e->fd >= 0) {
+        type = e->out_type;
+        venc_ioctl(e->fd, VIDIOC_STREAMOFF, &type);
+        type = e->cap_type;
+        venc_ioctl(e->fd, VIDIOC_STREAMOFF, &type);
+    }
+    for(i = 0; i < e->out_count; i++)
+        munmap(e->out[i].mem, e->out[i].length);
+    for(i = 0; i < e->cap_count; i++)
+        munmap(e->cap[i].mem, e->cap[i].length);
+    if(e->fd >= 0)
+        close(e->fd);
+    free(e);
+}
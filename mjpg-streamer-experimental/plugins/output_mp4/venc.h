@@ -0,0 +1,66 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef VENC_H
+#define VENC_H
+
+#include <sys/time.h>
+
+/*
+ * H.264 and HEVC encoding on a V4L2 memory-to-memory device, a stateful
+ * encoder like those of the Raspberry Pi, Rockchip or i.MX 8.
+ *
+ * Pictures go through several buffers of the OUTPUT queue, so one thread
+ * decodes the next picture into a free buffer while the device encodes the
+ * previous ones, and another thread takes the packets from the CAPTURE queue.
+ * Only the OUTPUT functions may be called from the first thread and only the
+ * CAPTURE functions from the second one.
+ */
+#define VENC_H264 0
+#define VENC_HEVC 1
+
+typedef struct _venc venc;
+
+/* a raw 4:2:0 picture in a buffer of the device */
+typedef struct {
+    unsigned char *plane[3];    // Y, Cb, Cr; for NV12 Cb holds both and Cr is NULL
+    int stride[3];
+    int interleaved;            // Cb and Cr alternate in plane[1]
+} venc_picture;
+
+/* an encoded picture in Annex B format, valid until venc_release() */
+typedef struct {
+    int index;
+    const unsigned char *data;
+    int size;
+    int keyframe;
+    int last;                   // the device has nothing more after a drain
+    struct timeval timestamp;   // of the picture
+} venc_packet;
+
+venc *venc_new(const char *device, int codec, int width, int height, double fps, int kbps, int gop);
+int venc_get_picture(venc *e, venc_picture *pic, int timeout);
+int venc_put_picture(venc *e, const struct timeval *timestamp);
+int venc_drain(venc *e);
+int venc_receive(venc *e, venc_packet *pkt, int timeout);
+int venc_release(venc *e, venc_packet *pkt);
+void venc_free(venc *e);
+
+#endif
@@ -25,37 +25,49 @@
   Writen by Dimitrios Zachariadis
   Version 0.1, May 2010
 
-  It provides a mechanism to take snapshots with a trigger from a UDP packet.
-  The UDP msg contains the path for the snapshot jpeg file
-  It echoes the message received back to the sender, after taking the snapshot
+  It serves the frames of an input plugin over RTSP. Each client gets the
+  frames as RTP/JPEG after RFC 2435, over UDP or interleaved in the RTSP
+  connection, with RTCP sender reports mapping the RTP timestamps to the
+  capture times of the frames.
+
+  The UDP sessions share one RTP stream: a frame is packetized once and the
+  same packets go to every client, a multicast group counts as one client.
+  Interleaved sessions have a stream and a thread of their own, so a slow
+  connection only holds up itself.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <strings.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/socket.h>
-#include <resolv.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/types.h>
-#include <sys/stat.h>
+#include <sys/time.h>
 #include <getopt.h>
 #include <pthread.h>
-#include <fcntl.h>
+#include <poll.h>
 #include <time.h>
 #include <syslog.h>
 
-#include <dirent.h>
-
-
 #include "../../utils.h"
 #include "../../mjpg_streamer.h"
 
+#include "rtp_jpeg.h"
+
 #define OUTPUT_PLUGIN_NAME "RTSP output plugin"
 
+/* seconds a UDP client may stay silent, RTCP receiver reports count too */
+#define SESSION_TIMEOUT 60
+/* seconds between two RTCP sender reports */
+#define REPORT_INTERVAL 5
+#define REQUEST_SIZE 4096
+
 enum RTSP_State {
     RTSP_State_Setup,
     RTSP_State_Playing,
@@ -63,14 +75,60 @@ enum RTSP_State {
     RTSP_State_Teardown,
 };
 
-static pthread_t worker;
+/* the packets of an RTP source, one per interleaved session and one for UDP */
+typedef struct _rtp_stream {
+    uint32_t ssrc;
+    uint16_t seq;
+    uint32_t rtp_offset;
+    uint32_t packets, octets;
+    int broken;                     // the frames of the input could not be sent
+} rtp_stream;
+
+/* a connection to the server with the RTP session it controls */
+typedef struct _rtsp_client {
+    int fd;                         // the RTSP connection
+    struct sockaddr_in peer;
+    pthread_mutex_t send_lock;      // replies and interleaved packets share fd
+    char request[REQUEST_SIZE + 1];
+    int length;
+
+    enum RTSP_State state;
+    char session[17];               // empty before SETUP
+    int interleaved;                // RTP over fd, else over UDP
+    int multicast;                  // the UDP goes to the group
+    int channel;                    // interleaved channel of RTP, RTCP uses the next
+    int client_port[2];
+    struct sockaddr_in dest[2];     // of RTP and RTCP for unicast UDP
+    unsigned long long activity;    // monotonic_usec() of the last sign of life
+
+    rtp_stream stream;              // of an interleaved session
+    pthread_t thread;
+    int streaming;                  // the stream thread runs
+} rtsp_client;
+
+static pthread_t server;
 static globals *pglobal;
-static int fd, max_frame_size;
-static unsigned char *frame = NULL;
-static char *command = NULL;
+static int plugin_id;
 static int input_number = 0;
+static int listen_fd = -1;
+static int clients = 0, max_clients = 8;
+static int mtu = 1400;
 
-// UDP port
+/* the stream of the UDP sessions, sent by the sender thread */
+static pthread_t sender;
+static rtp_stream shared;
+static int rtp_socket = -1, rtcp_socket = -1;
+static int server_port[2];
+static rtsp_client **playing = NULL;    // unicast UDP sessions
+static int playing_count = 0, multicast_count = 0;
+static pthread_mutex_t playing_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the group multicast sessions get, its port for RTP and the next for RTCP */
+static struct sockaddr_in group;
+static int multicast_port = 5004, ttl = 16;
+static char *multicast_group = NULL;
+
+// TCP port of RTSP
 static int port = 554;
 
 /******************************************************************************
@@ -84,156 +142,878 @@ void help(void)
             " Help for output plugin..: "OUTPUT_PLUGIN_NAME"\n" \
             " ---------------------------------------------------------------\n" \
             " The following parameters can be passed to this plugin:\n\n" \
-            " [-p | --port ]..........: UDP port to listen for picture requests. UDP message is the filename to save\n\n" \
+            " [-p | --port ]..........: TCP port of the RTSP server, 554 by default\n" \
+            " [-n | --clients ].......: clients served at the same time, 8 by default\n" \
+            " [-mt | --mtu ]..........: largest RTP packet in bytes, 1400 by default\n" \
+            " [-mc | --multicast ]....: offer multicast sessions to this group[:port],\n" \
+            "                           the port is 5004 by default\n" \
+            " [-tl | --ttl ]..........: time to live of multicast packets, 16 by default\n" \
             " [-i | --input ].......: read frames from the specified input plugin (first input plugin between the arguments is the 0th)\n\n" \
+            " The frames are sent as RTP/JPEG (RFC 2435) over UDP or interleaved in the\n" \
+            " RTSP connection. Only baseline JPEGs with 4:2:2 or 4:2:0 sampling and the\n" \
+            " standard Huffman tables can be sent this way, like webcams and libjpeg\n" \
+            " produce them.\n" \
             " ---------------------------------------------------------------\n");
 }
 
+static unsigned char *put_u32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+    return p + 4;
+}
+
+static int send_all(int fd, const void *data, int size)
+{
+    const char *p = data;
+    ssize_t rc;
+
+    while(size > 0) {
+        if((rc = send(fd, p, size, MSG_NOSIGNAL)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += rc;
+        size -= rc;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: the RTP timestamp of a time
+Input Value.: * s...: the stream
+              * usec: the time in microseconds since the epoch
+Return Value: the timestamp at RTP_JPEG_CLOCK
+******************************************************************************/
+static uint32_t rtp_time(rtp_stream *s, unsigned long long usec)
+{
+    return s->rtp_offset + (uint32_t)(usec * (RTP_JPEG_CLOCK / 1000) / 1000);
+}
+
+static unsigned long long wall_usec(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000ULL + now.tv_usec;
+}
+
+static void init_stream(rtp_stream *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->ssrc = random();
+    s->seq = random();
+    s->rtp_offset = random();
+}
+
 /******************************************************************************
-Description.: clean up allocated resources
-Input Value.: unused argument
+Description.: build an RTCP sender report, with the CNAME RFC 3550 asks for
+Input Value.: * s.....: the stream
+              * packet: to fill, 64 bytes
+Return Value: the size of the report
+******************************************************************************/
+static int build_report(rtp_stream *s, unsigned char *packet)
+{
+    static const char cname[] = "mjpg-streamer";
+    unsigned long long now = wall_usec();
+    unsigned char *p = packet;
+    int sdes;
+
+    /* SR: NTP time, RTP time at the same moment, packets and octets sent */
+    *p++ = 0x80;
+    *p++ = 200;
+    *p++ = 0;
+    *p++ = 6;
+    p = put_u32(p, s->ssrc);
+    p = put_u32(p, now / 1000000 + 2208988800U);
+    p = put_u32(p, ((now % 1000000) << 32) / 1000000);
+    p = put_u32(p, rtp_time(s, now));
+    p = put_u32(p, s->packets);
+    p = put_u32(p, s->octets);
+
+    /* SDES with the CNAME, padded to 32 bit words */
+    sdes = (8 + 2 + strlen(cname) + 1 + 3) / 4 * 4;
+    memset(p, 0, sdes);
+    p[0] = 0x81;
+    p[1] = 202;
+    p[3] = sdes / 4 - 1;
+    put_u32(p + 4, s->ssrc);
+    p[8] = 1;
+    p[9] = strlen(cname);
+    memcpy(p + 10, cname, strlen(cname));
+    p += sdes;
+
+    return p - packet;
+}
+
+/******************************************************************************
+Description.: split a frame into RTP/JPEG packets with their RTP headers,
+              every packet but the last one has the size of the MTU, so
+              the packets lie at fixed distances in the buffer
+Input Value.: * s.......: the stream
+              * f.......: the frame
+              * room....: bytes to leave in front of each packet
+              * buffer..: grows to hold the packets
+              * capacity: of the buffer
+              * last....: gets the size of the last packet
+Return Value: the number of packets, -1 if the frame can not be sent
+******************************************************************************/
+static int packetize(rtp_stream *s, input_frame *f, int room, unsigned char **buffer, int *capacity, int *last)
+{
+    unsigned long long usec = f->timestamp.tv_sec * 1000000ULL + f->timestamp.tv_usec;
+    uint32_t timestamp = rtp_time(s, usec ? usec : wall_usec());
+    unsigned char *p;
+    rtp_jpeg jpeg;
+    int offset = 0, count = 0, size = 0, needed;
+
+    if(rtp_jpeg_parse(&jpeg, f->buf, f->size) < 0) {
+        if(!s->broken)
+            OPRINT("the frames of input %d are no baseline JPEGs RTP can carry\n", input_number);
+        s->broken = 1;
+        return -1;
+    }
+    s->broken = 0;
+
+    /* the first packet carries the tables as well */
+    needed = (jpeg.scan_size / (mtu - RTP_HEADER_SIZE - 12) + 2) * (room + mtu);
+    if(needed > *capacity) {
+        if((p = realloc(*buffer, needed)) == NULL)
+            return -1;
+        *buffer = p;
+        *capacity = needed;
+    }
+
+    do {
+        p = *buffer + count * (room + mtu) + room;
+        size = rtp_jpeg_packet(&jpeg, &offset, p, mtu);
+        rtp_header(p, offset == jpeg.scan_size, s->seq++, timestamp, s->ssrc);
+        s->packets++;
+        s->octets += size - RTP_HEADER_SIZE;
+        count++;
+    } while(offset < jpeg.scan_size);
+
+    *last = size;
+    return count;
+}
+
+static void interleave(unsigned char *header, int channel, int size)
+{
+    header[0] = '$';
+    header[1] = channel;
+    header[2] = size >> 8;
+    header[3] = size & 0xFF;
+}
+
+/******************************************************************************
+Description.: the thread of a playing interleaved session, it sends the
+              frames of the input until the session is paused or torn down
+Input Value.: the client
+Return Value: NULL
+******************************************************************************/
+static void *stream_thread(void *arg)
+{
+    rtsp_client *c = arg;
+    unsigned long long reported = 0;
+    unsigned char *buffer = NULL, report[4 + 64];
+    int capacity = 0, count, last, i, size, rc = 0;
+    frame_subscription sub;
+    input_frame *f;
+
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_NEXT, &pglobal->out[plugin_id].stats);
+
+    while(rc == 0 && c->state == RTSP_State_Playing && !pglobal->stop) {
+        if(monotonic_usec() - reported >= REPORT_INTERVAL * 1000000ULL) {
+            size = build_report(&c->stream, report + 4);
+            interleave(report, c->channel + 1, size);
+            pthread_mutex_lock(&c->send_lock);
+            rc = send_all(c->fd, report, size + 4);
+            pthread_mutex_unlock(&c->send_lock);
+            reported = monotonic_usec();
+        }
+
+        if((f = frame_next(&sub, 500)) == NULL)
+            continue;
+
+        /* the packets with their interleaved headers follow each other */
+        if((count = packetize(&c->stream, f, 4, &buffer, &capacity, &last)) > 0) {
+            for(i = 0; i < count; i++)
+                interleave(buffer + i * (mtu + 4), c->channel, (i == count - 1) ? last : mtu);
+            pthread_mutex_lock(&c->send_lock);
+            rc = send_all(c->fd, buffer, (count - 1) * (mtu + 4) + 4 + last);
+            pthread_mutex_unlock(&c->send_lock);
+
+            __sync_fetch_and_add(&pglobal->out[plugin_id].stats.frames, 1);
+            __sync_fetch_and_add(&pglobal->out[plugin_id].stats.bytes, f->size);
+        }
+        frame_unref(f);
+    }
+
+    frame_unsubscribe(&sub);
+    free(buffer);
+    return NULL;
+}
+
+#ifdef UDP_SEGMENT
+/******************************************************************************
+Description.: send the packets of a frame to a client with UDP GSO, the
+              kernel splits a buffer into packets of the MTU
+Input Value.: * buffer: the packets, back to back
+              * count.: how many
+              * last..: size of the last one
+              * to....: the address of the client
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int send_segments(unsigned char *buffer, int count, int last, struct sockaddr_in *to)
+{
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int i, n, most = MIN(64, 65000 / mtu);
+
+    for(i = 0; i < count; i += n) {
+        n = MIN(most, count - i);
+        iov.iov_base = buffer + i * mtu;
+        iov.iov_len = (i + n == count) ? (n - 1) * mtu + last : n * mtu;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = to;
+        msg.msg_namelen = sizeof(*to);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if(n > 1) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t *)CMSG_DATA(cmsg) = mtu;
+        }
+        if(sendmsg(rtp_socket, &msg, 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+#endif
+
+/******************************************************************************
+Description.: send the same packets to several clients, with UDP GSO if the
+              kernel can, the others are batched with sendmmsg()
+Input Value.: * buffer.: the packets, back to back
+              * count..: how many
+              * last...: size of the last one
+              * to.....: the addresses of the clients, reordered
+              * clients: how many
 Return Value: -
 ******************************************************************************/
-void worker_cleanup(void *arg)
+static void send_batch(unsigned char *buffer, int count, int last, struct sockaddr_in *to, int clients)
 {
-    static unsigned char first_run = 1;
+    static struct mmsghdr *msgs = NULL;
+    static struct iovec *iovs = NULL;
+    static int capacity = 0;
+    #ifdef UDP_SEGMENT
+    /* a multicast route may not take GSO even if the unicast ones do */
+    static int gso = 1, group_gso = 1;
+    struct sockaddr_in swap;
+    int multicast;
+    #endif
+    int i, j, n = 0, rc, rest = 0;
+
+    #ifdef UDP_SEGMENT
+    /* the clients GSO did not reach are moved to the front */
+    for(j = 0; j < clients; j++) {
+        multicast = IN_MULTICAST(ntohl(to[j].sin_addr.s_addr));
+        if(count > 1 && gso && (group_gso || !multicast)) {
+            if(send_segments(buffer, count, last, &to[j]) == 0)
+                continue;
+            if(errno == EMSGSIZE && multicast) {
+                group_gso = 0;
+            } else if(errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+                OPRINT("UDP GSO is not available, sending the packets with sendmmsg()\n");
+                gso = 0;
+            } else {
+                continue;   /* lost like any UDP packet */
+            }
+        }
+        swap = to[rest];
+        to[rest++] = to[j];
+        to[j] = swap;
+    }
+    clients = rest;
+    #endif
 
-    if(!first_run) {
-        DBG("already cleaned up resources\n");
-        return;
+    if(count * clients > capacity) {
+        free(msgs);
+        free(iovs);
+        capacity = count * clients;
+        msgs = calloc(capacity, sizeof(struct mmsghdr));
+        iovs = calloc(capacity, sizeof(struct iovec));
+        if(msgs == NULL || iovs == NULL) {
+            free(msgs);
+            free(iovs);
+            msgs = NULL;
+            iovs = NULL;
+            capacity = 0;
+            return;
+        }
     }
 
-    first_run = 0;
-    OPRINT("cleaning up resources allocated by worker thread\n");
+    for(j = 0; j < clients; j++) {
+        for(i = 0; i < count; i++, n++) {
+            iovs[n].iov_base = buffer + i * mtu;
+            iovs[n].iov_len = (i == count - 1) ? last : mtu;
+            memset(&msgs[n], 0, sizeof(struct mmsghdr));
+            msgs[n].msg_hdr.msg_name = &to[j];
+            msgs[n].msg_hdr.msg_namelen = sizeof(to[j]);
+            msgs[n].msg_hdr.msg_iov = &iovs[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+        }
+    }
 
-    if(frame != NULL) {
-        free(frame);
+    /* a packet the kernel refuses is skipped, like a lost one */
+    for(i = 0; i < n; i += (rc > 0) ? rc : 1) {
+        rc = sendmmsg(rtp_socket, msgs + i, MIN(n - i, 1024), 0);
     }
-    close(fd);
 }
 
 /******************************************************************************
-Description.: this is the main worker thread
-              it loops forever, grabs a fresh frame and stores it to file
-Input Value.:
-Return Value:
+Description.: note the receiver reports of unicast clients, they keep the
+              sessions alive
+Input Value.: -
+Return Value: -
 ******************************************************************************/
-void *worker_thread(void *arg)
+static void receive_reports(void)
 {
-    int ok = 1, frame_size = 0, rc = 0;
-    char buffer1[1024] = {0};
-    unsigned char *tmp_framebuffer = NULL;
+    struct sockaddr_in from;
+    socklen_t length = sizeof(from);
+    char report[1500];
+    int i;
 
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(worker_cleanup, NULL);
+    while(recvfrom(rtcp_socket, report, sizeof(report), MSG_DONTWAIT, (struct sockaddr *)&from, &length) >= 0) {
+        pthread_mutex_lock(&playing_lock);
+        for(i = 0; i < playing_count; i++) {
+            if(playing[i]->dest[1].sin_addr.s_addr == from.sin_addr.s_addr &&
+               playing[i]->dest[1].sin_port == from.sin_port)
+                playing[i]->activity = monotonic_usec();
+        }
+        pthread_mutex_unlock(&playing_lock);
+        length = sizeof(from);
+    }
+}
 
-    // set UDP server data structures ---------------------------
-    if(port <= 0) {
-        OPRINT("a valid UDP port must be provided\n");
+/******************************************************************************
+Description.: the sender thread, it packetizes each frame once and sends it
+              to the UDP sessions, the multicast group gets it once
+Input Value.: -
+Return Value: NULL
+******************************************************************************/
+static void *sender_thread(void *arg)
+{
+    unsigned long long reported = 0;
+    struct sockaddr_in *rtp_to, *rtcp_to;
+    unsigned char *buffer = NULL, report[64];
+    int capacity = 0, count, last, n, i, size;
+    frame_subscription sub;
+    struct pollfd pfd;
+    input_frame *f;
+
+    rtp_to = calloc(max_clients + 1, sizeof(struct sockaddr_in));
+    rtcp_to = calloc(max_clients + 1, sizeof(struct sockaddr_in));
+    if(rtp_to == NULL || rtcp_to == NULL) {
+        free(rtp_to);
+        free(rtcp_to);
         return NULL;
     }
-    struct sockaddr_in addr;
-    int sd;
-    int bytes;
-    unsigned int addr_len = sizeof(addr);
-    char udpbuffer[1024] = {0};
-    sd = socket(PF_INET, SOCK_DGRAM, 0);
-    bzero(&addr, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
-    if(bind(sd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
-        perror("bind");
-    // -----------------------------------------------------------
 
-    while(ok >= 0 && !pglobal->stop) {
-        DBG("waiting for a UDP message\n");
+    /* frames skipped while nobody plays are no overruns, they are counted below */
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_NEXT, NULL);
 
-        // UDP receive ---------------------------------------------
-        memset(udpbuffer, 0, sizeof(udpbuffer));
-        bytes = recvfrom(sd, udpbuffer, sizeof(udpbuffer), 0, (struct sockaddr*)&addr, &addr_len);
-        // ---------------------------------------------------------
+    while(!pglobal->stop) {
+        /* without UDP sessions the sender does not keep the input capturing */
+        pthread_mutex_lock(&playing_lock);
+        n = playing_count + multicast_count;
+        pthread_mutex_unlock(&playing_lock);
+        if(n == 0) {
+            frame_unsubscribe(&sub);
+            pfd.fd = rtcp_socket;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 100);
+            receive_reports();
+            continue;
+        }
+        if(sub.in == NULL)
+            frame_subscribe(&sub, &pglobal->in[input_number], FRAME_NEXT, NULL);
 
+        if((f = frame_next(&sub, 500)) == NULL) {
+            receive_reports();
+            continue;
+        }
+        receive_reports();
 
+        /* the addresses are copied, the sessions may go while they are sent to */
+        pthread_mutex_lock(&playing_lock);
+        for(n = 0; n < playing_count; n++) {
+            rtp_to[n] = playing[n]->dest[0];
+            rtcp_to[n] = playing[n]->dest[1];
+        }
+        if(multicast_count > 0) {
+            rtp_to[n] = group;
+            rtcp_to[n] = group;
+            rtcp_to[n].sin_port = htons(multicast_port + 1);
+            n++;
+        }
+        pthread_mutex_unlock(&playing_lock);
 
-        DBG("waiting for fresh frame\n");
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        if(n == 0) {
+            frame_unref(f);
+            continue;
+        }
+        if(sub.skipped > 0)
+            __sync_fetch_and_add(&pglobal->out[plugin_id].stats.overruns, sub.skipped);
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+        if((count = packetize(&shared, f, 0, &buffer, &capacity, &last)) > 0) {
+            send_batch(buffer, count, last, rtp_to, n);
+            __sync_fetch_and_add(&pglobal->out[plugin_id].stats.frames, 1);
+            __sync_fetch_and_add(&pglobal->out[plugin_id].stats.bytes, f->size);
+        }
+        frame_unref(f);
 
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+        if(monotonic_usec() - reported >= REPORT_INTERVAL * 1000000ULL) {
+            size = build_report(&shared, report);
+            for(i = 0; i < n; i++)
+                sendto(rtcp_socket, report, size, 0, (struct sockaddr *)&rtcp_to[i], sizeof(rtcp_to[i]));
+            reported = monotonic_usec();
+        }
+    }
 
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
+    frame_unsubscribe(&sub);
+    free(buffer);
+    free(rtp_to);
+    free(rtcp_to);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: let the sender thread send to a UDP session or stop it
+Input Value.: * c...: the client
+              * play: start or stop
+Return Value: -
+******************************************************************************/
+static void play_udp(rtsp_client *c, int play)
+{
+    int i;
+
+    pthread_mutex_lock(&playing_lock);
+    if(c->multicast) {
+        multicast_count += play ? 1 : -1;
+    } else if(play) {
+        c->activity = monotonic_usec();
+        playing[playing_count++] = c;
+    } else {
+        for(i = 0; i < playing_count && playing[i] != c; i++);
+        if(i < playing_count)
+            playing[i] = playing[--playing_count];
+    }
+    pthread_mutex_unlock(&playing_lock);
+}
+
+static void stop_stream(rtsp_client *c, enum RTSP_State state)
+{
+    if(c->state == RTSP_State_Playing && !c->interleaved)
+        play_udp(c, 0);
+    c->state = state;
+    if(c->streaming) {
+        pthread_join(c->thread, NULL);
+        c->streaming = 0;
+    }
+}
 
-            frame = tmp_framebuffer;
+/******************************************************************************
+Description.: find a header of the request
+Input Value.: * request: the request
+              * name...: of the header, with the colon
+Return Value: the value, NULL if the header is missing
+******************************************************************************/
+static const char *header(const char *request, const char *name)
+{
+    const char *line;
+
+    for(line = strstr(request, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if(strncasecmp(line, name, strlen(name)) == 0) {
+            line += strlen(name);
+            while(*line == ' ')
+                line++;
+            return line;
         }
+    }
+    return NULL;
+}
 
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+/******************************************************************************
+Description.: send the response to a request
+Input Value.: * c......: the client
+              * cseq...: of the request
+              * status.: code and reason, like "200 OK"
+              * headers: more headers, each ending with CRLF
+              * body...: the content, may be NULL
+Return Value: 0 if ok, -1 if the client is gone
+******************************************************************************/
+static int reply(rtsp_client *c, int cseq, const char *status, const char *headers, const char *body)
+{
+    char response[2048];
+    int size, rc;
 
-        /* allow others to access the global buffer again */
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+    size = snprintf(response, sizeof(response),
+                    "RTSP/1.0 %s\r\n"
+                    "CSeq: %d\r\n"
+                    "Server: mjpg-streamer\r\n"
+                    "%s",
+                    status, cseq, headers);
+    if(c->session[0] != '\0' && size < (int)sizeof(response))
+        size += snprintf(response + size, sizeof(response) - size, "Session: %s;timeout=%d\r\n", c->session, SESSION_TIMEOUT);
+    if(body != NULL && size < (int)sizeof(response))
+        size += snprintf(response + size, sizeof(response) - size, "Content-Length: %d\r\n", (int)strlen(body));
+    if(size < (int)sizeof(response))
+        size += snprintf(response + size, sizeof(response) - size, "\r\n%s", body != NULL ? body : "");
+    if(size >= (int)sizeof(response))
+        size = sizeof(response) - 1;
 
-        /* only save a file if a name came in with the UDP message */
-        if(strlen(udpbuffer) > 0) {
-            DBG("writing file: %s\n", udpbuffer);
+    pthread_mutex_lock(&c->send_lock);
+    rc = send_all(c->fd, response, size);
+    pthread_mutex_unlock(&c->send_lock);
+    return rc;
+}
 
-            /* open file for write. Path must pre-exist */
-            if((fd = open(udpbuffer, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
-                OPRINT("could not open the file %s\n", udpbuffer);
-                return NULL;
-            }
+/******************************************************************************
+Description.: answer a SETUP, the transport is UDP unicast or interleaved
+Input Value.: * c......: the client
+              * cseq...: of the request
+              * request: the request
+Return Value: 0 if ok, -1 if the client is gone
+******************************************************************************/
+static int setup(rtsp_client *c, int cseq, const char *request)
+{
+    const char *transport = header(request, "Transport:"), *value;
+    char headers[256], address[INET_ADDRSTRLEN];
+    int i;
 
-            /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
-                OPRINT("could not write to file %s\n", udpbuffer);
-                perror("write()");
-                close(fd);
-                return NULL;
-            }
+    if(c->state == RTSP_State_Playing)
+        return reply(c, cseq, "455 Method Not Valid in This State", "", NULL);
+    if(transport == NULL || strncmp(transport, "RTP/AVP", 7) != 0)
+        return reply(c, cseq, "461 Unsupported Transport", "", NULL);
 
-            close(fd);
+    value = strstr(transport, "multicast");
+    c->interleaved = 0;
+    c->multicast = 0;
+
+    if(strncmp(transport, "RTP/AVP/TCP", 11) == 0) {
+        c->interleaved = 1;
+        c->channel = 0;
+        if((value = strstr(transport, "interleaved=")) != NULL)
+            c->channel = atoi(value + 12);
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d;ssrc=%08X\r\n",
+                 c->channel, c->channel + 1, c->stream.ssrc);
+    } else if(value != NULL && value < strchr(transport, '\r')) {
+        if(multicast_group == NULL)
+            return reply(c, cseq, "461 Unsupported Transport", "", NULL);
+        c->multicast = 1;
+        inet_ntop(AF_INET, &group.sin_addr, address, sizeof(address));
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP;multicast;destination=%s;port=%d-%d;ttl=%d;ssrc=%08X\r\n",
+                 address, multicast_port, multicast_port + 1, ttl, shared.ssrc);
+    } else {
+        if((value = strstr(transport, "client_port=")) == NULL)
+            return reply(c, cseq, "461 Unsupported Transport", "", NULL);
+        c->client_port[0] = atoi(value + 12);
+        c->client_port[1] = c->client_port[0] + 1;
+        if((value = strchr(value, '-')) != NULL && value[1] >= '0' && value[1] <= '9')
+            c->client_port[1] = atoi(value + 1);
+        if(c->client_port[0] <= 0 || c->client_port[0] > 65535 || c->client_port[1] <= 0 || c->client_port[1] > 65535)
+            return reply(c, cseq, "461 Unsupported Transport", "", NULL);
+
+        for(i = 0; i < 2; i++) {
+            c->dest[i] = c->peer;
+            c->dest[i].sin_port = htons(c->client_port[i]);
         }
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d;ssrc=%08X\r\n",
+                 c->client_port[0], c->client_port[1], server_port[0], server_port[1], shared.ssrc);
+    }
+
+    if(c->session[0] == '\0')
+        snprintf(c->session, sizeof(c->session), "%08lX%08lX", random() & 0xFFFFFFFF, random() & 0xFFFFFFFF);
+    c->state = RTSP_State_Setup;
+    return reply(c, cseq, "200 OK", headers, NULL);
+}
+
+/******************************************************************************
+Description.: answer a request of the client
+Input Value.: * c......: the client
+              * request: the request, its headers at least
+Return Value: 0 if ok, -1 if the connection is to be closed
+******************************************************************************/
+static int handle_request(rtsp_client *c, const char *request)
+{
+    char method[32], url[512], headers[768], body[512], address[INET_ADDRSTRLEN];
+    const char *value, *slash;
+    struct sockaddr_in local;
+    socklen_t length = sizeof(local);
+    int cseq = 0;
+
+    if(sscanf(request, "%31s %511s RTSP/", method, url) != 2)
+        return reply(c, 0, "400 Bad Request", "", NULL);
+    if((value = header(request, "CSeq:")) != NULL)
+        cseq = atoi(value);
+    DBG("RTSP %s %s\n", method, url);
+
+    /* requests after the SETUP have to name the session */
+    value = header(request, "Session:");
+    if(strcmp(method, "PLAY") == 0 || strcmp(method, "PAUSE") == 0 || strcmp(method, "TEARDOWN") == 0 ||
+       (value != NULL && strcmp(method, "SETUP") != 0)) {
+        if(c->session[0] == '\0' || value == NULL || strncmp(value, c->session, strlen(c->session)) != 0)
+            return reply(c, cseq, "454 Session Not Found", "", NULL);
+    }
 
-        // send back client's message that came in udpbuffer
-        sendto(sd, udpbuffer, bytes, 0, (struct sockaddr*)&addr, sizeof(addr));
+    if(strcmp(method, "OPTIONS") == 0) {
+        return reply(c, cseq, "200 OK", "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER\r\n", NULL);
+    }
 
-        /* call the command if user specified one, pass current filename as argument */
-        if(command != NULL) {
-            memset(buffer1, 0, sizeof(buffer1));
+    if(strcmp(method, "DESCRIBE") == 0) {
+        getsockname(c->fd, (struct sockaddr *)&local, &length);
+        inet_ntop(AF_INET, &local.sin_addr, address, sizeof(address));
+        snprintf(body, sizeof(body),
+                 "v=0\r\n"
+                 "o=- %u 1 IN IP4 %s\r\n"
+                 "s=mjpg-streamer\r\n"
+                 "c=IN IP4 0.0.0.0\r\n"
+                 "t=0 0\r\n"
+                 "a=control:*\r\n"
+                 "a=range:npt=0-\r\n"
+                 "m=video 0 RTP/AVP %d\r\n"
+                 "a=control:track0\r\n",
+                 shared.ssrc, address, RTP_PAYLOAD_JPEG);
+        slash = (url[0] != '\0' && url[strlen(url) - 1] == '/') ? "" : "/";
+        snprintf(headers, sizeof(headers), "Content-Base: %s%s\r\nContent-Type: application/sdp\r\n", url, slash);
+        return reply(c, cseq, "200 OK", headers, body);
+    }
 
-            /* udpbuffer still contains the filename, pass it to the command as parameter */
-            snprintf(buffer1, sizeof(buffer1), "%s \"%s\"", command, udpbuffer);
-            DBG("calling command %s", buffer1);
+    if(strcmp(method, "SETUP") == 0)
+        return setup(c, cseq, request);
 
-            /* in addition provide the filename as environment variable */
-            if((rc = setenv("MJPG_FILE", udpbuffer, 1)) != 0) {
-                LOG("setenv failed (return value %d)\n", rc);
+    if(strcmp(method, "PLAY") == 0) {
+        if(c->state == RTSP_State_Teardown)
+            return reply(c, cseq, "455 Method Not Valid in This State", "", NULL);
+        snprintf(headers, sizeof(headers), "Range: npt=0.000-\r\nRTP-Info: url=%s;seq=%u;rtptime=%u\r\n", url,
+                 c->interleaved ? c->stream.seq : shared.seq,
+                 rtp_time(c->interleaved ? &c->stream : &shared, wall_usec()));
+        if(c->state != RTSP_State_Playing && !c->interleaved) {
+            play_udp(c, 1);
+            c->state = RTSP_State_Playing;
+        } else if(c->state != RTSP_State_Playing) {
+            c->state = RTSP_State_Playing;
+            if(pthread_create(&c->thread, NULL, stream_thread, c) != 0) {
+                c->state = RTSP_State_Setup;
+                return reply(c, cseq, "500 Internal Server Error", "", NULL);
             }
+            c->streaming = 1;
+        }
+        return reply(c, cseq, "200 OK", headers, NULL);
+    }
 
-            /* execute the command now */
-            if((rc = system(buffer1)) != 0) {
-                LOG("command failed (return value %d)\n", rc);
+    if(strcmp(method, "PAUSE") == 0) {
+        stop_stream(c, RTSP_State_Paused);
+        return reply(c, cseq, "200 OK", "", NULL);
+    }
+
+    if(strcmp(method, "TEARDOWN") == 0) {
+        stop_stream(c, RTSP_State_Teardown);
+        reply(c, cseq, "200 OK", "", NULL);
+        c->session[0] = '\0';
+        return 0;
+    }
+
+    /* a keep-alive of the session */
+    if(strcmp(method, "GET_PARAMETER") == 0 || strcmp(method, "SET_PARAMETER") == 0)
+        return reply(c, cseq, "200 OK", "", NULL);
+
+    return reply(c, cseq, "501 Not Implemented", "", NULL);
+}
+
+/******************************************************************************
+Description.: take the next request out of the buffer of the client, the
+              RTCP of interleaved clients is skipped on the way
+Input Value.: the client
+Return Value: size of the request with its content, 0 if it is incomplete,
+              -1 if it is too long
+******************************************************************************/
+static int next_request(rtsp_client *c)
+{
+    const char *end, *value;
+    int size;
+
+    while(c->length >= 4 && c->request[0] == '$') {
+        size = 4 + ((unsigned char)c->request[2] << 8 | (unsigned char)c->request[3]);
+        if(c->length < size)
+            return 0;
+        c->length -= size;
+        memmove(c->request, c->request + size, c->length);
+    }
+    c->request[c->length] = '\0';
+
+    if((end = strstr(c->request, "\r\n\r\n")) == NULL)
+        return (c->length == REQUEST_SIZE) ? -1 : 0;
+
+    size = end + 4 - c->request;
+    if((value = header(c->request, "Content-Length:")) != NULL && value < end)
+        size += atoi(value);
+    if(size > REQUEST_SIZE)
+        return -1;
+    return (size <= c->length) ? size : 0;
+}
+
+/******************************************************************************
+Description.: the thread of a client, it answers its requests until it
+              closes the connection or a UDP session times out
+Input Value.: the client
+Return Value: NULL
+******************************************************************************/
+static void *client_thread(void *arg)
+{
+    rtsp_client *c = arg;
+    struct pollfd fds;
+    int size;
+
+    c->activity = monotonic_usec();
+
+    while(!pglobal->stop) {
+        fds.fd = c->fd;
+        fds.events = POLLIN;
+        if(poll(&fds, 1, 1000) < 0 && errno != EINTR)
+            break;
+
+        /* requests and receiver reports keep a unicast UDP session alive */
+        if(!c->interleaved && !c->multicast && c->state == RTSP_State_Playing &&
+           monotonic_usec() - c->activity > SESSION_TIMEOUT * 1000000ULL) {
+            OPRINT("RTSP session %s timed out\n", c->session);
+            break;
+        }
+        if(!(fds.revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        if((size = recv(c->fd, c->request + c->length, REQUEST_SIZE - c->length, 0)) <= 0)
+            break;
+        c->length += size;
+        c->activity = monotonic_usec();
+
+        while((size = next_request(c)) > 0) {
+            char saved = c->request[size];
+
+            c->request[size] = '\0';
+            if(handle_request(c, c->request) < 0) {
+                size = -1;
+                break;
             }
+            c->request[size] = saved;
+            c->length -= size;
+            memmove(c->request, c->request + size, c->length);
         }
+        if(size < 0)
+            break;
     }
 
-    // close UDP port
-    if(port > 0)
-        close(sd);
+    stop_stream(c, RTSP_State_Teardown);
+    close(c->fd);
+    pthread_mutex_destroy(&c->send_lock);
+    free(c);
+    __sync_fetch_and_sub(&clients, 1);
+    return NULL;
+}
+
+static void server_cleanup(void *arg)
+{
+    OPRINT("cleaning up resources allocated by server thread\n");
+    if(listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+}
 
-    /* cleanup now */
-    pthread_cleanup_pop(1);
+/******************************************************************************
+Description.: open a UDP socket the sessions share
+Input Value.: * fd..: gets the socket
+              * port: gets its port
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int open_udp(int *fd, int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if((*fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+       bind(*fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       getsockname(*fd, (struct sockaddr *)&addr, &length) < 0)
+        return -1;
+    *port = ntohs(addr.sin_port);
+    return 0;
+}
+
+/******************************************************************************
+Description.: the server thread, it accepts the clients and starts a thread
+              for each
+Input Value.: -
+Return Value: NULL
+******************************************************************************/
+static void *server_thread(void *arg)
+{
+    struct sockaddr_in addr;
+    socklen_t length;
+    struct timeval timeout = { .tv_sec = 5 };
+    rtsp_client *c;
+    pthread_t thread;
+    int fd;
+
+    pthread_cleanup_push(server_cleanup, NULL);
+
+    while(!pglobal->stop) {
+        length = sizeof(addr);
+        if((fd = accept(listen_fd, (struct sockaddr *)&addr, &length)) < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            break;
+        }
+
+        if(__sync_add_and_fetch(&clients, 1) > max_clients || (c = calloc(1, sizeof(rtsp_client))) == NULL) {
+            DBG("refusing an RTSP client, %d are served already\n", max_clients);
+            __sync_fetch_and_sub(&clients, 1);
+            close(fd);
+            continue;
+        }
+
+        /* a client which stops reading must not hold its stream forever */
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        c->fd = fd;
+        c->peer = addr;
+        init_stream(&c->stream);
+        pthread_mutex_init(&c->send_lock, NULL);
+
+        if(pthread_create(&thread, NULL, client_thread, c) != 0) {
+            pthread_mutex_destroy(&c->send_lock);
+            close(fd);
+            free(c);
+            __sync_fetch_and_sub(&clients, 1);
+            continue;
+        }
+        pthread_detach(thread);
+    }
 
+    pthread_cleanup_pop(1);
     return NULL;
 }
 
@@ -244,9 +1024,10 @@ Description.: this function is called first, in order to initialise
 Input Value.: parameters
 Return Value: 0 if everything is ok, non-zero otherwise
 ******************************************************************************/
-int output_init(output_parameter *param)
+int output_init(output_parameter *param, int id)
 {
-    int i;
+    struct sockaddr_in addr;
+    int i, on = 1;
 
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
@@ -266,6 +1047,14 @@ int output_init(output_parameter *param)
             {"port", required_argument, 0, 0},
             {"i", required_argument, 0, 0},
             {"input", required_argument, 0, 0},
+            {"n", required_argument, 0, 0},
+            {"clients", required_argument, 0, 0},
+            {"mt", required_argument, 0, 0},
+            {"mtu", required_argument, 0, 0},
+            {"mc", required_argument, 0, 0},
+            {"multicast", required_argument, 0, 0},
+            {"tl", required_argument, 0, 0},
+            {"ttl", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -299,43 +1088,129 @@ int output_init(output_parameter *param)
             DBG("case 4,5\n");
             input_number = atoi(optarg);
             break;
+            /* n, clients */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            max_clients = MAX(atoi(optarg), 1);
+            break;
+            /* mt, mtu */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            mtu = atoi(optarg);
+            break;
+            /* mc, multicast */
+        case 10:
+        case 11:
+            DBG("case 10,11\n");
+            multicast_group = optarg;
+            break;
+            /* tl, ttl */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            ttl = atoi(optarg);
+            break;
         }
     }
 
     pglobal = param->global;
+    plugin_id = id;
     if(!(input_number < pglobal->incnt)) {
         OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", input_number, pglobal->incnt);
         return 1;
     }
+    /* the headers of the first packet of a frame and some data */
+    if(mtu < RTP_HEADER_SIZE + 8 + 4 + 4 + 128 + 64 || mtu > 65000) {
+        OPRINT("ERROR: an MTU of %d bytes does not work\n", mtu);
+        return 1;
+    }
+    if(port <= 0) {
+        OPRINT("a valid TCP port must be provided\n");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if((listen_fd = socket(PF_INET, SOCK_STREAM, 0)) < 0 ||
+       setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+       bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+       listen(listen_fd, 10) != 0) {
+        perror("could not open the RTSP port");
+        if(listen_fd >= 0)
+            close(listen_fd);
+        listen_fd = -1;
+        return 1;
+    }
+    srandom(time(NULL) ^ getpid());
+    init_stream(&shared);
+
+    if((playing = calloc(max_clients, sizeof(rtsp_client *))) == NULL ||
+       open_udp(&rtp_socket, &server_port[0]) < 0 || open_udp(&rtcp_socket, &server_port[1]) < 0) {
+        perror("could not open the UDP ports");
+        return 1;
+    }
+
+    if(multicast_group != NULL) {
+        char *colon = strchr(multicast_group, ':');
+
+        if(colon != NULL) {
+            *colon = '\0';
+            multicast_port = atoi(colon + 1);
+        }
+        memset(&group, 0, sizeof(group));
+        group.sin_family = AF_INET;
+        group.sin_port = htons(multicast_port);
+        if(inet_pton(AF_INET, multicast_group, &group.sin_addr) != 1 || !IN_MULTICAST(ntohl(group.sin_addr.s_addr)) ||
+           multicast_port <= 0 || multicast_port > 65534) {
+            OPRINT("ERROR: %s:%d is no multicast group\n", multicast_group, multicast_port);
+            return 1;
+        }
+        if(setsockopt(rtp_socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+           setsockopt(rtcp_socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+            perror("could not set the TTL of multicast packets");
+            return 1;
+        }
+    }
 
     OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
-    OPRINT("UDP port..........: %d\n", port);
+    OPRINT("RTSP port.........: %d\n", port);
+    OPRINT("clients...........: %d\n", max_clients);
+    OPRINT("MTU...............: %d\n", mtu);
+    OPRINT("UDP ports.........: %d-%d\n", server_port[0], server_port[1]);
+    if(multicast_group != NULL) {
+        OPRINT("multicast.........: %s:%d, TTL %d\n", multicast_group, multicast_port, ttl);
+    }
     return 0;
 }
 
 /******************************************************************************
-Description.: calling this function stops the worker thread
+Description.: calling this function stops the server thread
 Input Value.: -
 Return Value: always 0
 ******************************************************************************/
 int output_stop(int id)
 {
-    DBG("will cancel worker thread\n");
-    pthread_cancel(worker);
+    DBG("will cancel server thread\n");
+    pthread_cancel(server);
+    pthread_cancel(sender);
     return 0;
 }
 
 /******************************************************************************
-Description.: calling this function creates and starts the worker thread
+Description.: calling this function creates and starts the server thread
 Input Value.: -
 Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
-    DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    DBG("launching server thread\n");
+    pthread_create(&server, 0, server_thread, NULL);
+    pthread_detach(server);
+    pthread_create(&sender, 0, sender_thread, NULL);
+    pthread_detach(sender);
     return 0;
 }
-
-
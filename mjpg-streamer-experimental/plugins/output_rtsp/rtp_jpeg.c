@@ -0,0 +1,207 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <string.h>
+
+#include "rtp_jpeg.h"
+
+#define JPEG_HEADER_SIZE 8
+#define RESTART_HEADER_SIZE 4
+#define QUANT_HEADER_SIZE 4
+
+/******************************************************************************
+Description.: take the values of the RTP/JPEG header from the headers of a
+              JPEG, only baseline YUV frames can be sent
+Input Value.: * jpeg: to fill, points into data afterwards
+              * data: the JPEG
+              * size: its size
+Return Value: 0 if ok, -1 if the frame can not be sent this way
+******************************************************************************/
+int rtp_jpeg_parse(rtp_jpeg *jpeg, const unsigned char *data, int size)
+{
+    const unsigned char *segment, *table;
+    int i = 2, length, marker, done, qt[3] = { 0, 1, 1 }, found = 0;
+
+    memset(jpeg, 0, sizeof(*jpeg));
+    jpeg->type = -1;
+
+    if(size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return -1;
+
+    while(i + 4 <= size) {
+        if(data[i] != 0xFF)
+            return -1;
+        marker = data[i + 1];
+        if(marker == 0xFF) {
+            i++;
+            continue;
+        }
+        length = (data[i + 2] << 8) | data[i + 3];
+        segment = data + i + 4;
+        if(length < 2 || i + 2 + length > size)
+            return -1;
+        length -= 2;
+
+        switch(marker) {
+        case 0xDB:  /* DQT, one or more tables */
+            for(done = 0; done + 65 <= length; done += 65) {
+                table = segment + done;
+                if((table[0] >> 4) != 0 || (table[0] & 0x0F) > 1)
+                    return -1;  /* 16 bit precision or a third table */
+                memcpy(jpeg->qtables + 64 * (table[0] & 0x0F), table + 1, 64);
+                found |= 1 << (table[0] & 0x0F);
+            }
+            break;
+
+        case 0xC0:  /* SOF0, baseline */
+        case 0xC1:
+            if(length < 15 || segment[0] != 8 || segment[5] != 3)
+                return -1;
+            jpeg->height = (segment[1] << 8) | segment[2];
+            jpeg->width = (segment[3] << 8) | segment[4];
+            if(segment[7] == 0x21)
+                jpeg->type = 0;
+            else if(segment[7] == 0x22)
+                jpeg->type = 1;
+            if(segment[10] != 0x11 || segment[13] != 0x11)
+                jpeg->type = -1;
+            qt[0] = segment[8];
+            qt[1] = segment[11];
+            qt[2] = segment[14];
+            break;
+
+        case 0xC2:  /* progressive and the others */
+        case 0xC3:
+        case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB:
+        case 0xCD: case 0xCE: case 0xCF:
+            return -1;
+
+        case 0xDD:  /* DRI */
+            if(length < 2)
+                return -1;
+            jpeg->restart_interval = (segment[0] << 8) | segment[1];
+            break;
+
+        case 0xDA:  /* SOS, the scan runs up to the EOI */
+            jpeg->scan = segment + length;
+            jpeg->scan_size = data + size - jpeg->scan;
+            while(jpeg->scan_size >= 2 && !(jpeg->scan[jpeg->scan_size - 2] == 0xFF &&
+                                            jpeg->scan[jpeg->scan_size - 1] == 0xD9))
+                jpeg->scan_size--;
+            if(jpeg->scan_size >= 2)
+                jpeg->scan_size -= 2;
+            else
+                jpeg->scan_size = data + size - jpeg->scan;
+
+            /* the receiver uses table 0 for Y and table 1 for both chroma components */
+            if(jpeg->type < 0 || jpeg->width > 2040 || jpeg->height > 2040 ||
+               qt[0] > 1 || qt[1] != qt[2] || !(found & (1 << qt[0])) || !(found & (1 << qt[1])))
+                return -1;
+            if(qt[0] != 0 || qt[1] != 1) {
+                unsigned char tables[128];
+                memcpy(tables, jpeg->qtables + 64 * qt[0], 64);
+                memcpy(tables + 64, jpeg->qtables + 64 * qt[1], 64);
+                memcpy(jpeg->qtables, tables, sizeof(tables));
+            }
+            if(jpeg->restart_interval > 0)
+                jpeg->type += 64;
+            return 0;
+        }
+
+        i += 4 + length;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: the next packet of a frame, the first one carries the tables
+Input Value.: * jpeg..: the parsed frame
+              * offset: of the part of the scan to send, advanced by it
+              * packet: to fill after the RTP header
+              * max...: size of the packet including the RTP header
+Return Value: size of the packet including the RTP header, the last packet
+              of the frame is the one which moves offset to the end
+******************************************************************************/
+int rtp_jpeg_packet(rtp_jpeg *jpeg, int *offset, unsigned char *packet, int max)
+{
+    unsigned char *p = packet + RTP_HEADER_SIZE;
+    int size;
+
+    /* main JPEG header: type specific, fragment offset, type, Q, width, height */
+    *p++ = 0;
+    *p++ = (*offset >> 16) & 0xFF;
+    *p++ = (*offset >> 8) & 0xFF;
+    *p++ = *offset & 0xFF;
+    *p++ = jpeg->type;
+    *p++ = 255;
+    *p++ = (jpeg->width + 7) / 8;
+    *p++ = (jpeg->height + 7) / 8;
+
+    if(jpeg->restart_interval > 0) {
+        /* the frame is not split at restart markers, so F and L are set and the count is 0x3FFF */
+        *p++ = jpeg->restart_interval >> 8;
+        *p++ = jpeg->restart_interval & 0xFF;
+        *p++ = 0xFF;
+        *p++ = 0xFF;
+    }
+
+    if(*offset == 0) {
+        *p++ = 0;   /* MBZ */
+        *p++ = 0;   /* 8 bit precision of both tables */
+        *p++ = 0;
+        *p++ = sizeof(jpeg->qtables);
+        memcpy(p, jpeg->qtables, sizeof(jpeg->qtables));
+        p += sizeof(jpeg->qtables);
+    }
+
+    size = jpeg->scan_size - *offset;
+    if(size > max - (p - packet))
+        size = max - (p - packet);
+    memcpy(p, jpeg->scan + *offset, size);
+    *offset += size;
+
+    return p - packet + size;
+}
+
+/******************************************************************************
+Description.: write the RTP header in front of a packet
+Input Value.: * packet...: to start with the header
+              * marker...: the packet ends the frame
+              * seq......: sequence number of the packet
+              * timestamp: of the frame at RTP_JPEG_CLOCK
+              * ssrc.....: of the stream
+Return Value: -
+******************************************************************************/
+void rtp_header(unsigned char *packet, int marker, uint16_t seq, uint32_t timestamp, uint32_t ssrc)
+{
+    packet[0] = 0x80;
+    packet[1] = (marker ? 0x80 : 0) | RTP_PAYLOAD_JPEG;
+    packet[2] = seq >> 8;
+    packet[3] = seq & 0xFF;
+    packet[4] = timestamp >> 24;
+    packet[5] = (timestamp >> 16) & 0xFF;
+    packet[6] = (timestamp >> 8) & 0xFF;
+    packet[7] = timestamp & 0xFF;
+    packet[8] = ssrc >> 24;
+    packet[9] = (ssrc >> 16) & 0xFF;
+    packet[10] = (ssrc >> 8) & 0xFF;
+    packet[11] = ssrc & 0xFF;
+}
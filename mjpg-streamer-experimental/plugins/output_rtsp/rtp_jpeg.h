@@ -0,0 +1,51 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef RTP_JPEG_H
+#define RTP_JPEG_H
+
+#include <stdint.h>
+
+/*
+ * RTP payload of JPEG frames after RFC 2435. The headers of the JPEG are
+ * replaced by the few values of the RTP/JPEG header, the receiver builds
+ * them again. The quantization tables travel with each frame (Q 255), the
+ * Huffman tables are assumed to be the ones of the JPEG standard, as
+ * libjpeg and the MJPEG of webcams use them.
+ */
+#define RTP_HEADER_SIZE 12
+#define RTP_PAYLOAD_JPEG 26
+#define RTP_JPEG_CLOCK 90000
+
+typedef struct _rtp_jpeg {
+    int type;                       // 0 for 4:2:2, 1 for 4:2:0, + 64 with restart markers
+    int width, height;              // in pixels
+    int restart_interval;
+    unsigned char qtables[128];     // luminance and chrominance, zig-zag order
+    const unsigned char *scan;      // the entropy coded data
+    int scan_size;
+} rtp_jpeg;
+
+int rtp_jpeg_parse(rtp_jpeg *jpeg, const unsigned char *data, int size);
+int rtp_jpeg_packet(rtp_jpeg *jpeg, int *offset, unsigned char *packet, int max);
+void rtp_header(unsigned char *packet, int marker, uint16_t seq, uint32_t timestamp, uint32_t ssrc);
+
+#endif
@@ -0,0 +1,389 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+  This output plugin exports the frames of inputs into POSIX shared memory
+  for consumers on the same host, each input into a segment of its own with
+  the layout output_shm.h describes. A frame is copied once into the
+  segment, however many processes map it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "../../utils.h"
+#include "../../mjpg_streamer.h"
+
+#include "output_shm.h"
+
+#define OUTPUT_PLUGIN_NAME "SHM output plugin"
+
+/* an input and the segment it is exported into */
+typedef struct {
+    int input;
+    char *name;
+    shm_header *header;
+    size_t length;
+    int too_large;          // frames which did not fit into a slot
+    pthread_t thread;
+} shm_export;
+
+static globals *pglobal;
+static int plugin_id;
+static char *prefix = "/mjpg-streamer-";
+static char *inputs = NULL;
+static int slots = 4;
+static int slotSize = 2048;         // kB
+static mode_t mode = 0600;
+static shm_export *exports = NULL;
+static int exportCount = 0;
+
+/******************************************************************************
+Description.: print a help message
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void help(void)
+{
+    fprintf(stderr, " ---------------------------------------------------------------\n" \
+            " Help for output plugin..: "OUTPUT_PLUGIN_NAME"\n" \
+            " ---------------------------------------------------------------\n" \
+            " The following parameters can be passed to this plugin:\n\n" \
+            " [-i | --input ].........: inputs to export, e.g. 0,2, all by default\n" \
+            " [-p | --prefix ]........: the segment of input n is <prefix>n,\n" \
+            "                           /mjpg-streamer-n by default\n" \
+            " [-n | --slots ].........: frames each segment holds, 4 by default\n" \
+            " [-s | --size ]..........: kB for each frame, 2048 by default, larger\n" \
+            "                           frames are skipped\n" \
+            " [-m | --mode ]..........: permissions of the segments, 0600 by default\n" \
+            " ---------------------------------------------------------------\n");
+}
+
+/******************************************************************************
+Description.: create the segment of an input
+Input Value.: the export, its input is set
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int open_segment(shm_export *e)
+{
+    size_t size = ((size_t)slotSize * 1024 + sizeof(shm_slot) + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+    shm_header *header;
+    int fd;
+
+    if(asprintf(&e->name, "%s%d", prefix, e->input) < 0)
+        return -1;
+    e->length = sizeof(shm_header) + slots * size;
+
+    /* a segment left behind by an earlier run starts over */
+    shm_unlink(e->name);
+    if((fd = shm_open(e->name, O_RDWR | O_CREAT | O_EXCL, mode)) < 0) {
+        OPRINT("could not create the segment %s: %s\n", e->name, strerror(errno));
+        return -1;
+    }
+    fchmod(fd, mode);
+    if(ftruncate(fd, e->length) < 0 ||
+       (header = mmap(NULL, e->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        OPRINT("could not map the segment %s: %s\n", e->name, strerror(errno));
+        close(fd);
+        shm_unlink(e->name);
+        return -1;
+    }
+    close(fd);
+
+    header->version = SHM_VERSION;
+    header->slots = slots;
+    header->slot_size = size;
+    header->data_offset = sizeof(shm_header);
+    header->writer = getpid();
+    snprintf(header->plugin, sizeof(header->plugin), "%s", pglobal->in[e->input].plugin);
+    /* readers check the magic last */
+    __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    e->header = header;
+    return 0;
+}
+
+/******************************************************************************
+Description.: write a frame into its slot under the seqlock and tell the
+              readers about it
+Input Value.: * e....: the export
+              * frame: the frame
+Return Value: -
+******************************************************************************/
+static void export_frame(shm_export *e, input_frame *frame)
+{
+    shm_header *header = e->header;
+    shm_slot *slot = shm_slot_of(header, frame->seq);
+
+    /* odd before any of the data changes */
+    __atomic_store_n(&slot->lock, slot->lock + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->size = frame_copy(frame, shm_slot_data(slot));
+    slot->seq = frame->seq;
+    slot->timestamp_sec = frame->timestamp.tv_sec;
+    slot->timestamp_usec = frame->timestamp.tv_usec;
+    slot->capture_usec = frame->capture_usec;
+
+    __atomic_store_n(&slot->lock, slot->lock + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->seq, frame->seq, __ATOMIC_RELEASE);
+
+    /* only sleeping readers cost a system call */
+    __atomic_add_fetch(&header->wake, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST) != 0)
+        syscall(SYS_futex, &header->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/******************************************************************************
+Description.: mark the segment as abandoned and remove its name, readers
+              which mapped it keep their mapping
+Input Value.: the export
+Return Value: -
+******************************************************************************/
+static void export_cleanup(void *arg)
+{
+    shm_export *e = arg;
+
+    OPRINT("cleaning up resources allocated by the export of input %d\n", e->input);
+    __atomic_store_n(&e->header->writer, 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&e->header->wake, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &e->header->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    shm_unlink(e->name);
+    munmap(e->header, e->length);
+}
+
+/******************************************************************************
+Description.: copy every frame of an input into its segment
+Input Value.: the export
+Return Value: NULL
+******************************************************************************/
+static void *export_thread(void *arg)
+{
+    shm_export *e = arg;
+    output_stats *stats = &pglobal->out[plugin_id].stats;
+    size_t capacity = e->header->slot_size - sizeof(shm_slot);
+    frame_subscription sub;
+    input_frame *frame;
+
+    pthread_cleanup_push(export_cleanup, e);
+
+    frame_subscribe(&sub, &pglobal->in[e->input], FRAME_NEXT, stats);
+    while(!pglobal->stop) {
+        if((frame = frame_next(&sub, -1)) == NULL)
+            continue;
+
+        if((size_t)frame_length(frame) > capacity) {
+            if(e->too_large++ == 0)
+                OPRINT("a frame of %d bytes does not fit into %s, raise --size\n", frame_length(frame), e->name);
+            __sync_fetch_and_add(&stats->overruns, 1);
+        } else {
+            export_frame(e, frame);
+            __sync_fetch_and_add(&stats->frames, 1);
+            __sync_fetch_and_add(&stats->bytes, frame_length(frame));
+        }
+        frame_unref(frame);
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+/*** plugin interface functions ***/
+/******************************************************************************
+Description.: this function is called first, in order to initialize
+              this plugin and pass a parameter string
+Input Value.: parameters
+Return Value: 0 if everything is OK, non-zero otherwise
+******************************************************************************/
+int output_init(output_parameter *param, int id)
+{
+    char *list, *item, *next;
+    int i;
+
+    param->argv[0] = OUTPUT_PLUGIN_NAME;
+    plugin_id = id;
+
+    /* show all parameters for DBG purposes */
+    for(i = 0; i < param->argc; i++) {
+        DBG("argv[%d]=%s\n", i, param->argv[i]);
+    }
+
+    reset_getopt();
+    while(1) {
+        int option_index = 0, c = 0;
+        static struct option long_options[] = {
+            {"h", no_argument, 0, 0},
+            {"help", no_argument, 0, 0},
+            {"i", required_argument, 0, 0},
+            {"input", required_argument, 0, 0},
+            {"p", required_argument, 0, 0},
+            {"prefix", required_argument, 0, 0},
+            {"n", required_argument, 0, 0},
+            {"slots", required_argument, 0, 0},
+            {"s", required_argument, 0, 0},
+            {"size", required_argument, 0, 0},
+            {"m", required_argument, 0, 0},
+            {"mode", required_argument, 0, 0},
+            {0, 0, 0, 0}
+        };
+
+        c = getopt_long_only(param->argc, param->argv, "", long_options, &option_index);
+
+        /* no more options to parse */
+        if(c == -1) break;
+
+        /* unrecognized option */
+        if(c == '?') {
+            help();
+            return 1;
+        }
+
+        switch(option_index) {
+            /* h, help */
+        case 0:
+        case 1:
+            DBG("case 0,1\n");
+            help();
+            return 1;
+            break;
+
+            /* i, input */
+        case 2:
+        case 3:
+            DBG("case 2,3\n");
+            inputs = strdup(optarg);
+            break;
+
+            /* p, prefix */
+        case 4:
+        case 5:
+            DBG("case 4,5\n");
+            prefix = strdup(optarg);
+            break;
+
+            /* n, slots */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            slots = atoi(optarg);
+            break;
+
+            /* s, size */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            slotSize = atoi(optarg);
+            break;
+
+            /* m, mode */
+        case 10:
+        case 11:
+            DBG("case 10,11\n");
+            mode = strtol(optarg, NULL, 8) & 0777;
+            break;
+        }
+    }
+
+    pglobal = param->global;
+    if(prefix[0] != '/' || strchr(prefix + 1, '/') != NULL) {
+        OPRINT("ERROR: the prefix %s must start with / and contain no other one\n", prefix);
+        return 1;
+    }
+    if(slots < 2 || slotSize <= 0 || slotSize > 512 * 1024) {
+        OPRINT("ERROR: %d slots of %d kB do not work\n", slots, slotSize);
+        return 1;
+    }
+
+    if((exports = calloc(pglobal->incnt, sizeof(shm_export))) == NULL) {
+        OPRINT("not enough memory\n");
+        return 1;
+    }
+    if(inputs == NULL) {
+        for(i = 0; i < pglobal->incnt; i++)
+            exports[exportCount++].input = i;
+    } else {
+        list = strdup(inputs);
+        for(item = strtok_r(list, ",", &next); item != NULL; item = strtok_r(NULL, ",", &next)) {
+            i = atoi(item);
+            if(i < 0 || i >= pglobal->incnt || exportCount == pglobal->incnt) {
+                OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", i, pglobal->incnt);
+                free(list);
+                return 1;
+            }
+            exports[exportCount++].input = i;
+        }
+        free(list);
+    }
+
+    for(i = 0; i < exportCount; i++) {
+        if(open_segment(&exports[i]) < 0)
+            return 1;
+        OPRINT("input plugin.....: %d: %s -> %s\n", exports[i].input, pglobal->in[exports[i].input].plugin, exports[i].name);
+    }
+    OPRINT("slots............: %d of %d kB\n", slots, slotSize);
+    OPRINT("permissions......: %04o\n", (unsigned int)mode);
+    return 0;
+}
+
+/******************************************************************************
+Description.: calling this function stops the export threads
+Input Value.: -
+Return Value: always 0
+******************************************************************************/
+int output_stop(int id)
+{
+    int i;
+
+    DBG("will cancel export threads\n");
+    for(i = 0; i < exportCount; i++)
+        pthread_cancel(exports[i].thread);
+    return 0;
+}
+
+/******************************************************************************
+Description.: calling this function creates and starts an export thread for
+              each input
+Input Value.: -
+Return Value: always 0
+******************************************************************************/
+int output_run(int id)
+{
+    int i;
+
+    DBG("launching export threads\n");
+    for(i = 0; i < exportCount; i++) {
+        pthread_create(&exports[i].thread, 0, export_thread, &exports[i]);
+        pthread_detach(exports[i].thread);
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef OUTPUT_SHM_H
+#define OUTPUT_SHM_H
+
+#include <stdint.h>
+
+/*
+ * the layout of the POSIX shared memory segment output_shm exports an input
+ * into, /mjpg-streamer-<input> unless --prefix tells otherwise. A process on
+ * the same host maps it and takes the frames where they are, read only is
+ * enough for readers which do not sleep on wake:
+ *
+ *   shm_header | slot 0: shm_slot, JPEG | slot 1: shm_slot, JPEG | ...
+ *
+ * Frame seq of the input is written into the slot seq % slots. The header
+ * tells the newest complete frame, each slot is guarded by a seqlock:
+ *
+ *   do {
+ *       lock = atomic load-acquire slot->lock
+ *       if lock is odd, the slot is being written: try again
+ *       use slot->size bytes at shm_slot_data(slot), check slot->seq
+ *       acquire fence
+ *   } while(slot->lock != lock)
+ *
+ * A frame is only overwritten slots - 1 frames later, so a reader working
+ * on it in place has that long before the lock tells it to drop the work.
+ * Readers do not need a system call per frame: they can poll seq, or sleep
+ * on wake with FUTEX_WAIT after incrementing waiters, the writer only calls
+ * FUTEX_WAKE while waiters is not 0.
+ */
+#define SHM_MAGIC 0x47504a4d        /* "MJPG" */
+#define SHM_VERSION 1
+#define SHM_ALIGN 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;                 /* frames the segment holds */
+    uint32_t slot_size;             /* from one slot to the next, a multiple of SHM_ALIGN */
+    uint32_t data_offset;           /* of the first slot from the start of the segment */
+    uint32_t writer;                /* pid of mjpg_streamer, 0 once it stopped exporting */
+    uint64_t seq;                   /* number of the newest complete frame, 0 before the first */
+    uint32_t wake;                  /* futex, incremented with every frame */
+    uint32_t waiters;               /* readers sleeping on wake */
+    char plugin[64];                /* the input plugin, like input_uvc.so */
+} __attribute__((aligned(SHM_ALIGN))) shm_header;
+
+typedef struct {
+    uint32_t lock;                  /* seqlock, odd while the slot is written */
+    uint32_t size;                  /* bytes of the JPEG */
+    uint64_t seq;                   /* frame number of the input */
+    int64_t timestamp_sec;          /* wall clock capture time */
+    int64_t timestamp_usec;
+    uint64_t capture_usec;          /* monotonic capture time, 0 if unknown */
+} __attribute__((aligned(SHM_ALIGN))) shm_slot;
+
+static inline shm_slot *shm_slot_of(shm_header *header, uint64_t seq)
+{
+    return (shm_slot *)((char *)header + header->data_offset + (seq % header->slots) * header->slot_size);
+}
+
+static inline unsigned char *shm_slot_data(shm_slot *slot)
+{
+    return (unsigned char *)(slot + 1);
+}
+
+#endif
@@ -28,6 +28,9 @@
   It provides a mechanism to take snapshots with a trigger from a UDP packet.
   The UDP msg contains the path for the snapshot jpeg file
   It echoes the message received back to the sender, after taking the snapshot
+
+  It can push the frames to unicast or multicast destinations as well, split
+  into the datagrams udp_stream.h describes.
 */
 
 #include <stdio.h>
@@ -40,6 +43,7 @@
 #include <sys/socket.h>
 #include <resolv.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <getopt.h>
@@ -53,19 +57,38 @@
 #include "../../utils.h"
 #include "../../mjpg_streamer.h"
 
+#include "udp_stream.h"
+
 #define OUTPUT_PLUGIN_NAME "UDP output plugin"
 
 static pthread_t worker;
 static globals *pglobal;
-static int fd, delay, max_frame_size;
+static int fd, delay;
 static char *folder = "/tmp";
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static char *command = NULL;
+static command_queue *commands = NULL;
+static int commandDepth = 16, commandCoalesce = 0;
 static int input_number = 0;
+static int plugin_id;
 
 // UDP port
 static int port = 0;
 
+/* the frames pushed to the destinations */
+#define MAX_DESTINATIONS 8
+static pthread_t streamer;
+static struct sockaddr_in destinations[MAX_DESTINATIONS];
+static int destinationCount = 0;
+static int packetSize = 1400, fec = 0, ttl = 16;
+static int streamSocket = -1;
+static input_frame *streamFrame = NULL;
+static udp_stream_header *headers = NULL;
+static unsigned char *parity = NULL;
+static struct iovec *vectors = NULL;
+static struct mmsghdr *messages = NULL;
+static int fragmentCapacity = 0;
+
 /******************************************************************************
 Description.: print a help message
 Input Value.: -
@@ -80,7 +103,17 @@ void help(void)
             " [-f | --folder ]........: folder to save pictures\n" \
             " [-d | --delay ].........: delay after saving pictures in ms\n" \
             " [-c | --command ].......: execute command after saveing picture\n" \
+            " [-cq | --command-queue ]: pictures which may wait for the command, more\n" \
+            "                           are skipped, 16 by default\n" \
+            " [-cc | --command-coalesce ]: run the command at most every this many ms,\n" \
+            "                           with the latest picture\n" \
             " [-p | --port ]..........: UDP port to listen for picture requests. UDP message is the filename to save\n\n" \
+            " [-s | --stream ]........: push the frames to this host:port, unicast or\n" \
+            "                           multicast, up to 8 times\n" \
+            " [-ps | --packet-size ]..: size of the datagrams, 1400 bytes by default\n" \
+            " [-fe | --fec ]..........: send a parity datagram after this many, a\n" \
+            "                           receiver can repair one lost datagram of each\n" \
+            " [-tl | --ttl ]..........: time to live of multicast datagrams, 16 by default\n" \
             " [-i | --input ].......: read frames from the specified input plugin (first input plugin between the arguments is the 0th)\n\n" \
             " ---------------------------------------------------------------\n");
 }
@@ -102,10 +135,12 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    if(frame != NULL) {
-        free(frame);
-    }
+    frame_unref(frame);
+    frame = NULL;
     close(fd);
+
+    command_queue_free(commands);
+    commands = NULL;
 }
 
 /******************************************************************************
@@ -116,9 +151,8 @@ Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int ok = 1, frame_size = 0, rc = 0;
-    char buffer1[1024] = {0};
-    unsigned char *tmp_framebuffer = NULL;
+    int ok = 1;
+    frame_subscription sub;
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
@@ -142,6 +176,9 @@ void *worker_thread(void *arg)
         perror("bind");
     // -----------------------------------------------------------
 
+    /* a request gets the frame of its time, the ones in between do not matter */
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, NULL);
+
     while(ok >= 0 && !pglobal->stop) {
         DBG("waiting for a UDP message\n");
 
@@ -153,31 +190,12 @@ void *worker_thread(void *arg)
 
 
         DBG("waiting for fresh frame\n");
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
-
-            frame = tmp_framebuffer;
-        }
-
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-
-        /* allow others to access the global buffer again */
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        /* release the previous frame and take a reference to a fresh one */
+        frame_unref(frame);
+        frame = NULL;
+        frame = frame_flatten(frame_next(&sub, -1));
+        if(frame == NULL)
+            continue;
 
         /* only save a file if a name came in with the UDP message */
         if(strlen(udpbuffer) > 0) {
@@ -190,7 +208,7 @@ void *worker_thread(void *arg)
             }
 
             /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
+            if(write(fd, frame->buf, frame->size) < 0) {
                 OPRINT("could not write to file %s\n", udpbuffer);
                 perror("write()");
                 close(fd);
@@ -203,23 +221,10 @@ void *worker_thread(void *arg)
         // send back client's message that came in udpbuffer
         sendto(sd, udpbuffer, bytes, 0, (struct sockaddr*)&addr, sizeof(addr));
 
-        /* call the command if user specified one, pass current filename as argument */
-        if(command != NULL) {
-            memset(buffer1, 0, sizeof(buffer1));
-
-            /* udpbuffer still contains the filename, pass it to the command as parameter */
-            snprintf(buffer1, sizeof(buffer1), "%s \"%s\"", command, udpbuffer);
-            DBG("calling command %s", buffer1);
-
-            /* in addition provide the filename as environment variable */
-            if((rc = setenv("MJPG_FILE", udpbuffer, 1)) != 0) {
-                LOG("setenv failed (return value %d)\n", rc);
-            }
-
-            /* execute the command now */
-            if((rc = system(buffer1)) != 0) {
-                LOG("command failed (return value %d)\n", rc);
-            }
+        /* call the command if user specified one, pass current filename as argument,
+         * it runs from a thread of its own so no request is missed meanwhile */
+        if(commands != NULL) {
+            command_queue_push(commands, udpbuffer);
         }
 
         /* if specified, wait now */
@@ -238,6 +243,204 @@ void *worker_thread(void *arg)
     return NULL;
 }
 
+/******************************************************************************
+Description.: clean up the resources of the stream thread
+Input Value.: unused argument
+Return Value: -
+******************************************************************************/
+static void stream_cleanup(void *arg)
+{
+    frame_unref(streamFrame);
+    streamFrame = NULL;
+    if(streamSocket >= 0)
+        close(streamSocket);
+    streamSocket = -1;
+
+    free(headers);
+    free(parity);
+    free(vectors);
+    free(messages);
+    headers = NULL;
+    parity = NULL;
+    vectors = NULL;
+    messages = NULL;
+    fragmentCapacity = 0;
+}
+
+/******************************************************************************
+Description.: make room for the datagrams of a frame
+Input Value.: number of datagrams, data and parity
+Return Value: 0 if ok, -1 without memory
+******************************************************************************/
+static int reserve_fragments(int count)
+{
+    if(count <= fragmentCapacity)
+        return 0;
+
+    free(headers);
+    free(parity);
+    free(vectors);
+    free(messages);
+    headers = calloc(count, sizeof(udp_stream_header));
+    parity = malloc((size_t)count * (packetSize - sizeof(udp_stream_header)));
+    vectors = calloc(2 * count, sizeof(struct iovec));
+    messages = calloc((size_t)count * destinationCount, sizeof(struct mmsghdr));
+    if(headers == NULL || parity == NULL || vectors == NULL || messages == NULL) {
+        stream_cleanup(NULL);
+        return -1;
+    }
+    fragmentCapacity = count;
+    return 0;
+}
+
+/******************************************************************************
+Description.: split a frame into datagrams, the data ones point into the
+              frame, each group of fec is followed by its parity
+Input Value.: * f.....: the frame
+              * number: of the frame
+Return Value: number of datagrams, -1 on error
+******************************************************************************/
+static int fragment_frame(input_frame *f, uint32_t number)
+{
+    int payload = packetSize - sizeof(udp_stream_header);
+    int count = (f->size + payload - 1) / payload, groups = 0, total, i, j, k, n = 0, length;
+    unsigned char *p;
+
+    if(count == 0 || count > 65535)
+        return -1;
+    if(fec > 0)
+        groups = (count + fec - 1) / fec;
+    total = count + groups;
+    if(reserve_fragments(total) < 0)
+        return -1;
+
+    for(i = 0; i < count; i++) {
+        length = MIN(payload, f->size - i * payload);
+
+        headers[n].magic = UDP_STREAM_MAGIC;
+        headers[n].flags = 0;
+        headers[n].index = htons(i);
+        headers[n].count = htons(count);
+        headers[n].fec = htons(fec);
+        headers[n].frame = htonl(number);
+        headers[n].size = htonl(f->size);
+        vectors[2 * n].iov_base = &headers[n];
+        vectors[2 * n].iov_len = sizeof(udp_stream_header);
+        vectors[2 * n + 1].iov_base = f->buf + i * payload;
+        vectors[2 * n + 1].iov_len = length;
+        n++;
+
+        if(fec == 0 || ((i + 1) % fec != 0 && i + 1 != count))
+            continue;
+
+        /* the parity of the group just sent, as long as its first fragment */
+        j = i - i % fec;
+        p = parity + (size_t)(i / fec) * payload;
+        length = MIN(payload, f->size - j * payload);
+        memset(p, 0, length);
+        for(; j <= i; j++) {
+            unsigned char *data = f->buf + j * payload;
+            int size = MIN(payload, f->size - j * payload);
+            for(k = 0; k < size; k++)
+                p[k] ^= data[k];
+        }
+
+        headers[n] = headers[n - 1];
+        headers[n].flags = UDP_STREAM_PARITY;
+        headers[n].index = htons(i - i % fec);
+        vectors[2 * n].iov_base = &headers[n];
+        vectors[2 * n].iov_len = sizeof(udp_stream_header);
+        vectors[2 * n + 1].iov_base = p;
+        vectors[2 * n + 1].iov_len = length;
+        n++;
+    }
+
+    return n;
+}
+
+/******************************************************************************
+Description.: the stream thread, it pushes the newest frame to all
+              destinations, the datagrams of a frame are sent in batches
+Input Value.: -
+Return Value: NULL
+******************************************************************************/
+void *stream_thread(void *arg)
+{
+    frame_subscription sub;
+    uint32_t number = 0;
+    int count, size, i, j, n, rc;
+
+    pthread_cleanup_push(stream_cleanup, NULL);
+
+    if((streamSocket = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+    } else if(setsockopt(streamSocket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        perror("could not set the TTL of multicast datagrams");
+    }
+
+    /* frames the destinations could not get in time count as overruns */
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, &pglobal->out[plugin_id].stats);
+
+    while(streamSocket >= 0 && !pglobal->stop) {
+        /* a display wants the latest frame, frames it can not take are skipped */
+        frame_unref(streamFrame);
+        streamFrame = NULL;
+        /* the fragments point into the frame, its metadata included */
+        if((streamFrame = frame_flatten(frame_next(&sub, -1))) == NULL)
+            continue;
+
+        /* without memory for the fragments the frame is gone as well */
+        size = streamFrame->size;
+        if((count = fragment_frame(streamFrame, number++)) < 0) {
+            OPRINT("could not split a frame of %d bytes\n", size);
+            continue;
+        }
+
+        for(n = 0, j = 0; j < destinationCount; j++) {
+            for(i = 0; i < count; i++, n++) {
+                memset(&messages[n], 0, sizeof(struct mmsghdr));
+                messages[n].msg_hdr.msg_name = &destinations[j];
+                messages[n].msg_hdr.msg_namelen = sizeof(destinations[j]);
+                messages[n].msg_hdr.msg_iov = &vectors[2 * i];
+                messages[n].msg_hdr.msg_iovlen = 2;
+            }
+        }
+
+        /* a datagram the kernel refuses is skipped, like a lost one */
+        for(i = 0; i < n; i += (rc > 0) ? rc : 1) {
+            rc = sendmmsg(streamSocket, messages + i, MIN(n - i, 1024), 0);
+        }
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: add a destination to push the frames to
+Input Value.: host:port
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int add_destination(const char *destination)
+{
+    struct addrinfo hints, *result;
+    char host[256];
+    const char *colon = strrchr(destination, ':');
+
+    if(destinationCount == MAX_DESTINATIONS || colon == NULL || colon - destination >= (int)sizeof(host))
+        return -1;
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - destination), destination);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(host, colon + 1, &hints, &result) != 0)
+        return -1;
+    memcpy(&destinations[destinationCount++], result->ai_addr, sizeof(struct sockaddr_in));
+    freeaddrinfo(result);
+    return 0;
+}
+
 /*** plugin interface functions ***/
 /******************************************************************************
 Description.: this function is called first, in order to initialise
@@ -245,10 +448,12 @@ Description.: this function is called first, in order to initialise
 Input Value.: parameters
 Return Value: 0 if everything is ok, non-zero otherwise
 ******************************************************************************/
-int output_init(output_parameter *param)
+int output_init(output_parameter *param, int id)
 {
     int i;
 
+    plugin_id = id;
+
     delay = 0;
 
     param->argv[0] = OUTPUT_PLUGIN_NAME;
@@ -275,6 +480,18 @@ int output_init(output_parameter *param)
             {"port", required_argument, 0, 0},
             {"i", required_argument, 0, 0},
             {"input", required_argument, 0, 0},
+            {"cq", required_argument, 0, 0},
+            {"command-queue", required_argument, 0, 0},
+            {"cc", required_argument, 0, 0},
+            {"command-coalesce", required_argument, 0, 0},
+            {"s", required_argument, 0, 0},
+            {"stream", required_argument, 0, 0},
+            {"ps", required_argument, 0, 0},
+            {"packet-size", required_argument, 0, 0},
+            {"fe", required_argument, 0, 0},
+            {"fec", required_argument, 0, 0},
+            {"tl", required_argument, 0, 0},
+            {"ttl", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -333,6 +550,45 @@ int output_init(output_parameter *param)
             DBG("case 10,11\n");
             input_number = atoi(optarg);
             break;
+            /* cq, command-queue */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            commandDepth = atoi(optarg);
+            break;
+            /* cc, command-coalesce */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            commandCoalesce = atoi(optarg);
+            break;
+            /* s, stream */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            if(add_destination(optarg) < 0) {
+                OPRINT("ERROR: could not stream to %s\n", optarg);
+                return 1;
+            }
+            break;
+            /* ps, packet-size */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            packetSize = atoi(optarg);
+            break;
+            /* fe, fec */
+        case 20:
+        case 21:
+            DBG("case 20,21\n");
+            fec = MAX(atoi(optarg), 0);
+            break;
+            /* tl, ttl */
+        case 22:
+        case 23:
+            DBG("case 22,23\n");
+            ttl = atoi(optarg);
+            break;
         }
     }
 
@@ -345,11 +601,31 @@ int output_init(output_parameter *param)
     OPRINT("output folder.....: %s\n", folder);
     OPRINT("delay after save..: %d\n", delay);
     OPRINT("command...........: %s\n", (command == NULL) ? "disabled" : command);
+    if(command != NULL && (commands = command_queue_new(command, commandDepth, commandCoalesce)) == NULL) {
+        OPRINT("could not start the thread of the command\n");
+        return 1;
+    }
     if(port > 0) {
         OPRINT("UDP port..........: %d\n", port);
     } else {
         OPRINT("UDP port..........: %s\n", "disabled");
     }
+    if(packetSize <= (int)sizeof(udp_stream_header) || packetSize > 65507) {
+        OPRINT("ERROR: datagrams of %d bytes do not work\n", packetSize);
+        return 1;
+    }
+    for(i = 0; i < destinationCount; i++) {
+        char address[INET_ADDRSTRLEN];
+
+        inet_ntop(AF_INET, &destinations[i].sin_addr, address, sizeof(address));
+        OPRINT("stream to.........: %s:%d\n", address, ntohs(destinations[i].sin_port));
+    }
+    if(destinationCount > 0) {
+        OPRINT("datagrams.........: %d bytes\n", packetSize);
+        if(fec > 0) {
+            OPRINT("parity............: one after %d datagrams\n", fec);
+        }
+    }
     return 0;
 }
 
@@ -361,7 +637,10 @@ Return Value: always 0
 int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
-    pthread_cancel(worker);
+    if(port > 0 || destinationCount == 0)
+        pthread_cancel(worker);
+    if(destinationCount > 0)
+        pthread_cancel(streamer);
     return 0;
 }
 
@@ -373,8 +652,15 @@ Return Value: always 0
 int output_run(int id)
 {
     DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    /* the stream alone needs no port for requests */
+    if(port > 0 || destinationCount == 0) {
+        pthread_create(&worker, 0, worker_thread, NULL);
+        pthread_detach(worker);
+    }
+    if(destinationCount > 0) {
+        pthread_create(&streamer, 0, stream_thread, NULL);
+        pthread_detach(streamer);
+    }
     return 0;
 }
 
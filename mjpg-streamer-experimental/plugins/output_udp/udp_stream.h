@@ -0,0 +1,52 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef UDP_STREAM_H
+#define UDP_STREAM_H
+
+#include <stdint.h>
+
+/*
+ * the datagrams output_udp pushes its frames with. A frame is split into
+ * fragments of the same size, the last one may be shorter, each behind a
+ * header of 16 bytes in network byte order.
+ *
+ * With forward error correction every group of fec data fragments is
+ * followed by a parity fragment, the XOR of the group with the fragments
+ * padded to the full size by zeros. Its index is the one of the first
+ * fragment of the group. A receiver missing one fragment of a group gets
+ * it back as the XOR of the parity and the others, the size of the frame
+ * tells how long the last fragment is.
+ */
+#define UDP_STREAM_MAGIC 'M'
+#define UDP_STREAM_PARITY 0x01
+
+typedef struct _udp_stream_header {
+    uint8_t magic;          // UDP_STREAM_MAGIC
+    uint8_t flags;          // UDP_STREAM_PARITY for a parity fragment
+    uint16_t index;         // of the fragment, of the first of the group for parity
+    uint16_t count;         // data fragments of the frame
+    uint16_t fec;           // data fragments per parity fragment, 0 without
+    uint32_t frame;         // number of the frame
+    uint32_t size;          // bytes of the frame
+} udp_stream_header;
+
+#endif
@@ -0,0 +1,783 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Only the atomic API of KMS is used: the first commit sets the mode, every
+ * following one flips the plane to the next buffer and returns right away.
+ * The buffer is written while the flip before it is still pending, three
+ * buffers let that happen without touching the one on the screen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "kms.h"
+
+/* buffers of the picture plane */
+#define KMS_BUFFERS 3
+
+/* planes of a CRTC looked at */
+#define KMS_MAX_PLANES 16
+
+/* how long a flip may take before the display counts as stuck */
+#define KMS_FLIP_TIMEOUT 1000
+
+typedef struct {
+    uint32_t handle;
+    uint32_t fb;
+    uint64_t size;
+    unsigned char *map;
+    uint32_t pitch[KMS_PLANES];
+    uint32_t offset[KMS_PLANES];
+} kms_buffer;
+
+/* the properties set by the commits */
+typedef struct {
+    uint32_t fb_id, crtc_id;
+    uint32_t src_x, src_y, src_w, src_h;
+    uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+} plane_properties;
+
+typedef struct {
+    uint32_t id;
+    int type;                   // DRM_PLANE_TYPE_*
+    plane_properties prop;
+    uint32_t *formats;
+    int format_count;
+} kms_plane;
+
+struct _kms_display {
+    int fd;
+    uint32_t connector, connector_crtc_id;
+    uint32_t crtc, crtc_mode_id, crtc_active;
+    uint32_t mode_blob;
+    int width, height;          // of the mode
+    int active;                 // the mode is set
+
+    kms_plane planes[KMS_MAX_PLANES];
+    int plane_count;
+    kms_plane *primary;
+    kms_buffer background;      // black, on the primary plane below an overlay
+
+    /* the buffers of the pictures and the plane they are shown on */
+    uint32_t fourcc;
+    int picture_width, picture_height;
+    kms_buffer buffers[KMS_BUFFERS];
+    kms_buffer retired;         // of the previous format, on the screen until the next flip
+    kms_plane *plane;
+    kms_plane *old_plane;       // to be turned off with the next commit
+    uint32_t src_x, src_y, src_w, src_h;
+    int dst_x, dst_y, dst_w, dst_h;
+
+    int shown;                  // buffer on the screen, -1 if none
+    int pending;                // buffer of the flip not done yet, -1 if none
+};
+
+/******************************************************************************
+Description.: find a property of a KMS object
+Input Value.: * fd....: the device
+              * object: its id
+              * type..: DRM_MODE_OBJECT_*
+              * name..: of the property
+              * value.: gets the value of the property if not NULL
+Return Value: the id of the property, 0 if the object has no such property
+******************************************************************************/
+static uint32_t property_id(int fd, uint32_t object, uint32_t type, const char *name, uint64_t *value)
+{
+    drmModeObjectPropertiesPtr props;
+    drmModePropertyPtr prop;
+    uint32_t id = 0;
+    uint32_t i;
+
+    if((props = drmModeObjectGetProperties(fd, object, type)) == NULL)
+        return 0;
+
+    for(i = 0; i < props->count_props && id == 0; i++) {
+        if((prop = drmModeGetProperty(fd, props->props[i])) == NULL)
+            continue;
+        if(strcmp(prop->name, name) == 0) {
+            id = prop->prop_id;
+            if(value != NULL)
+                *value = props->prop_values[i];
+        }
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
+/******************************************************************************
+Description.: pick a connected connector, its mode and a CRTC for it
+Input Value.: * d............: the display, gets the ids and the mode
+              * width, height: size of the mode wanted, 0 for the preferred one
+              * mode.........: gets the mode
+Return Value: the index of the CRTC, -1 if no display is connected
+******************************************************************************/
+static int choose_output(kms_display *d, int width, int height, drmModeModeInfo *mode)
+{
+    drmModeResPtr res;
+    drmModeConnectorPtr conn = NULL;
+    drmModeEncoderPtr enc;
+    int i, j, chosen = -1, crtc = -1;
+
+    if((res = drmModeGetResources(d->fd)) == NULL) {
+        OPRINT("the DRM device has no KMS resources\n");
+        return -1;
+    }
+
+    for(i = 0; i < res->count_connectors && conn == NULL; i++) {
+        if((conn = drmModeGetConnector(d->fd, res->connectors[i])) == NULL)
+            continue;
+        if(conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0) {
+            drmModeFreeConnector(conn);
+            conn = NULL;
+        }
+    }
+    if(conn == NULL) {
+        OPRINT("no display is connected\n");
+        drmModeFreeResources(res);
+        return -1;
+    }
+
+    /* the mode asked for, else the preferred one of the display */
+    for(i = 0; i < conn->count_modes && chosen < 0; i++) {
+        if(width > 0 && conn->modes[i].hdisplay == width && conn->modes[i].vdisplay == height)
+            chosen = i;
+    }
+    if(chosen < 0 && width > 0) {
+        OPRINT("the display has no mode of %dx%d\n", width, height);
+    }
+    for(i = 0; i < conn->count_modes && chosen < 0; i++) {
+        if(conn->modes[i].type & DRM_MODE_TYPE_PREFERRED)
+            chosen = i;
+    }
+    *mode = conn->modes[(chosen < 0) ? 0 : chosen];
+
+    /* the CRTC the connector is driven by, else any one of its encoders can use */
+    for(i = 0; i < conn->count_encoders && crtc < 0; i++) {
+        if((enc = drmModeGetEncoder(d->fd, conn->encoders[i])) == NULL)
+            continue;
+        for(j = 0; j < res->count_crtcs && crtc < 0; j++) {
+            if(enc->crtc_id != 0 && res->crtcs[j] == enc->crtc_id)
+                crtc = j;
+        }
+        for(j = 0; j < res->count_crtcs && crtc < 0; j++) {
+            if(enc->possible_crtcs & (1 << j))
+                crtc = j;
+        }
+        drmModeFreeEncoder(enc);
+    }
+
+    d->connector = conn->connector_id;
+    if(crtc >= 0)
+        d->crtc = res->crtcs[crtc];
+    else
+        OPRINT("no CRTC can drive the display\n");
+
+    drmModeFreeConnector(conn);
+    drmModeFreeResources(res);
+    return crtc;
+}
+
+/******************************************************************************
+Description.: collect the planes which can be shown on the CRTC
+Input Value.: * d....: the display
+              * index: of the CRTC
+Return Value: 0 if ok, -1 if there is no primary plane
+******************************************************************************/
+static int find_planes(kms_display *d, int index)
+{
+    drmModePlaneResPtr res;
+    drmModePlanePtr plane;
+    kms_plane *p;
+    plane_properties *prop;
+    uint64_t type;
+    uint32_t i;
+
+    if((res = drmModeGetPlaneResources(d->fd)) == NULL)
+        return -1;
+
+    for(i = 0; i < res->count_planes && d->plane_count < KMS_MAX_PLANES; i++) {
+        if((plane = drmModeGetPlane(d->fd, res->planes[i])) == NULL)
+            continue;
+        if(!(plane->possible_crtcs & (1 << index)) ||
+           property_id(d->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) == 0 ||
+           type == DRM_PLANE_TYPE_CURSOR) {
+            drmModeFreePlane(plane);
+            continue;
+        }
+        p = &d->planes[d->plane_count];
+        if((p->formats = malloc(plane->count_formats * sizeof(uint32_t))) == NULL) {
+            drmModeFreePlane(plane);
+            continue;
+        }
+
+        p->id = plane->plane_id;
+        p->type = type;
+        memcpy(p->formats, plane->formats, plane->count_formats * sizeof(uint32_t));
+        p->format_count = plane->count_formats;
+
+        prop = &p->prop;
+        prop->fb_id = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "FB_ID", NULL);
+        prop->crtc_id = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", NULL);
+        prop->src_x = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "SRC_X", NULL);
+        prop->src_y = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "SRC_Y", NULL);
+        prop->src_w = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "SRC_W", NULL);
+        prop->src_h = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "SRC_H", NULL);
+        prop->crtc_x = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "CRTC_X", NULL);
+        prop->crtc_y = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", NULL);
+        prop->crtc_w = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "CRTC_W", NULL);
+        prop->crtc_h = property_id(d->fd, p->id, DRM_MODE_OBJECT_PLANE, "CRTC_H", NULL);
+
+        if(p->type == DRM_PLANE_TYPE_PRIMARY && d->primary == NULL)
+            d->primary = p;
+        d->plane_count++;
+        drmModeFreePlane(plane);
+    }
+
+    drmModeFreePlaneResources(res);
+    return (d->primary != NULL) ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: the layout of a format in a dumb buffer
+Input Value.: * fourcc.......: DRM_FORMAT_*
+              * width, height: of the picture
+              * bpp..........: gets the bits per pixel of the dumb buffer
+              * lines........: gets the lines of the dumb buffer
+              * line.........: gets the bytes of a line of each plane
+              * rows.........: gets the lines of each plane
+Return Value: the number of planes, 0 if the format is not supported
+******************************************************************************/
+static int format_layout(uint32_t fourcc, int width, int height, int *bpp, int *lines, int *line, int *rows)
+{
+    switch(fourcc) {
+    case DRM_FORMAT_YUYV:
+    case DRM_FORMAT_UYVY:
+    case DRM_FORMAT_RGB565:
+        *bpp = 16;
+        break;
+    case DRM_FORMAT_RGB888:
+    case DRM_FORMAT_BGR888:
+        *bpp = 24;
+        break;
+    case DRM_FORMAT_XRGB8888:
+        *bpp = 32;
+        break;
+    case DRM_FORMAT_YUV420:
+        /* the chroma planes at half the pitch of the luma below it */
+        *bpp = 8;
+        *lines = height + (height + 1) / 2;
+        line[0] = width;
+        line[1] = line[2] = (width + 1) / 2;
+        rows[0] = height;
+        rows[1] = rows[2] = (height + 1) / 2;
+        return 3;
+    case DRM_FORMAT_NV12:
+        *bpp = 8;
+        *lines = height + (height + 1) / 2;
+        line[0] = line[1] = width;
+        rows[0] = height;
+        rows[1] = (height + 1) / 2;
+        return 2;
+    default:
+        return 0;
+    }
+
+    *lines = height;
+    line[0] = width * *bpp / 8;
+    rows[0] = height;
+    return 1;
+}
+
+/******************************************************************************
+Description.: free a dumb buffer and its framebuffer
+Input Value.: * d: the display
+              * b: the buffer
+Return Value: -
+******************************************************************************/
+static void free_buffer(kms_display *d, kms_buffer *b)
+{
+    struct drm_mode_destroy_dumb destroy;
+
+    if(b->fb != 0)
+        drmModeRmFB(d->fd, b->fb);
+    if(b->map != NULL)
+        munmap(b->map, b->size);
+    if(b->handle != 0) {
+        memset(&destroy, 0, sizeof(destroy));
+        destroy.handle = b->handle;
+        drmIoctl(d->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+    memset(b, 0, sizeof(*b));
+}
+
+/******************************************************************************
+Description.: allocate a dumb buffer with a framebuffer for a format
+Input Value.: * d............: the display
+              * b............: the buffer
+              * fourcc.......: DRM_FORMAT_*
+              * width, height: of the framebuffer
+              * map..........: map the buffer to write into it
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int create_buffer(kms_display *d, kms_buffer *b, uint32_t fourcc, int width, int height, int map)
+{
+    struct drm_mode_create_dumb create;
+    struct drm_mode_map_dumb mapping;
+    uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+    int line[KMS_PLANES], rows[KMS_PLANES], planes, bpp, lines, i;
+
+    memset(b, 0, sizeof(*b));
+    if((planes = format_layout(fourcc, width, height, &bpp, &lines, line, rows)) == 0)
+        return -1;
+
+    memset(&create, 0, sizeof(create));
+    create.width = width;
+    create.height = lines;
+    create.bpp = bpp;
+    if(drmIoctl(d->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+        OPRINT("could not allocate a buffer of %dx%d: %s\n", width, height, strerror(errno));
+        return -1;
+    }
+    b->handle = create.handle;
+    b->size = create.size;
+
+    /* a chroma plane of YUV420 has half the pitch, those of NV12 the same */
+    for(i = 0; i < planes; i++) {
+        b->pitch[i] = (planes == 3 && i > 0) ? create.pitch / 2 : create.pitch;
+        b->offset[i] = (i == 0) ? 0 : b->offset[i - 1] + b->pitch[i - 1] * rows[i - 1];
+        handles[i] = b->handle;
+        pitches[i] = b->pitch[i];
+        offsets[i] = b->offset[i];
+    }
+
+    if(drmModeAddFB2(d->fd, width, height, fourcc, handles, pitches, offsets, &b->fb, 0) < 0) {
+        OPRINT("could not add a framebuffer of %dx%d: %s\n", width, height, strerror(errno));
+        free_buffer(d, b);
+        return -1;
+    }
+
+    if(map) {
+        memset(&mapping, 0, sizeof(mapping));
+        mapping.handle = b->handle;
+        if(drmIoctl(d->fd, DRM_IOCTL_MODE_MAP_DUMB, &mapping) < 0 ||
+           (b->map = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd, mapping.offset)) == MAP_FAILED) {
+            OPRINT("could not map a buffer: %s\n", strerror(errno));
+            b->map = NULL;
+            free_buffer(d, b);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: called by drmHandleEvent() when a flip is done
+Input Value.: like the page_flip_handler of drmEventContext
+Return Value: -
+******************************************************************************/
+static void flip_done(int fd, unsigned int sequence, unsigned int sec, unsigned int usec, void *arg)
+{
+    kms_display *d = arg;
+
+    d->shown = d->pending;
+    d->pending = -1;
+}
+
+/******************************************************************************
+Description.: wait until the pending flip is done
+Input Value.: the display
+Return Value: 0 if ok, -1 if the flip did not happen
+******************************************************************************/
+static int wait_flip(kms_display *d)
+{
+    drmEventContext events;
+    struct pollfd pfd;
+    int ret;
+
+    memset(&events, 0, sizeof(events));
+    events.version = 2;
+    events.page_flip_handler = flip_done;
+
+    while(d->pending >= 0) {
+        pfd.fd = d->fd;
+        pfd.events = POLLIN;
+        if((ret = poll(&pfd, 1, KMS_FLIP_TIMEOUT)) < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0) {
+            OPRINT("the display did not flip to the last picture\n");
+            d->pending = -1;
+            return -1;
+        }
+        drmHandleEvent(d->fd, &events);
+    }
+
+    if(d->shown >= 0)
+        free_buffer(d, &d->retired);
+    return 0;
+}
+
+/******************************************************************************
+Description.: add the properties of a plane to a commit
+Input Value.: * req....: the commit
+              * p......: the plane
+              * fb.....: the framebuffer to show, 0 to turn the plane off
+              * crtc...: the CRTC
+              * src_*..: the part of the framebuffer, in 16.16 fixed point
+              * dst_*..: where it goes on the screen
+Return Value: -
+******************************************************************************/
+static void add_plane(drmModeAtomicReqPtr req, const kms_plane *p, uint32_t fb, uint32_t crtc,
+                      uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h,
+                      int dst_x, int dst_y, int dst_w, int dst_h)
+{
+    drmModeAtomicAddProperty(req, p->id, p->prop.fb_id, fb);
+    drmModeAtomicAddProperty(req, p->id, p->prop.crtc_id, (fb != 0) ? crtc : 0);
+    if(fb == 0)
+        return;
+    drmModeAtomicAddProperty(req, p->id, p->prop.src_x, src_x);
+    drmModeAtomicAddProperty(req, p->id, p->prop.src_y, src_y);
+    drmModeAtomicAddProperty(req, p->id, p->prop.src_w, src_w);
+    drmModeAtomicAddProperty(req, p->id, p->prop.src_h, src_h);
+    drmModeAtomicAddProperty(req, p->id, p->prop.crtc_x, dst_x);
+    drmModeAtomicAddProperty(req, p->id, p->prop.crtc_y, dst_y);
+    drmModeAtomicAddProperty(req, p->id, p->prop.crtc_w, dst_w);
+    drmModeAtomicAddProperty(req, p->id, p->prop.crtc_h, dst_h);
+}
+
+/******************************************************************************
+Description.: show a buffer on the picture plane, the first commit also sets
+              the mode and puts the background below an overlay plane
+Input Value.: * d....: the display
+              * index: of the buffer
+              * test.: only check if the driver would take the commit
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int commit(kms_display *d, int index, int test)
+{
+    drmModeAtomicReqPtr req;
+    uint32_t flags;
+    int ret;
+
+    if((req = drmModeAtomicAlloc()) == NULL)
+        return -1;
+
+    flags = test ? DRM_MODE_ATOMIC_TEST_ONLY : (DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK);
+    if(!d->active) {
+        drmModeAtomicAddProperty(req, d->connector, d->connector_crtc_id, d->crtc);
+        drmModeAtomicAddProperty(req, d->crtc, d->crtc_mode_id, d->mode_blob);
+        drmModeAtomicAddProperty(req, d->crtc, d->crtc_active, 1);
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+    if(d->plane != d->primary && (!d->active || d->old_plane == d->primary))
+        add_plane(req, d->primary, d->background.fb, d->crtc, 0, 0,
+                  (uint32_t)d->width << 16, (uint32_t)d->height << 16, 0, 0, d->width, d->height);
+    if(d->old_plane != NULL && d->old_plane != d->plane && d->old_plane != d->primary)
+        add_plane(req, d->old_plane, 0, d->crtc, 0, 0, 0, 0, 0, 0, 0, 0);
+    add_plane(req, d->plane, d->buffers[index].fb, d->crtc, d->src_x, d->src_y, d->src_w, d->src_h,
+              d->dst_x, d->dst_y, d->dst_w, d->dst_h);
+
+    ret = drmModeAtomicCommit(d->fd, req, flags, d);
+    drmModeAtomicFree(req);
+    if(ret < 0)
+        return -1;
+
+    if(!test) {
+        d->active = 1;
+        d->old_plane = NULL;
+        d->pending = index;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: check if a plane can show a format
+Input Value.: * p.....: the plane
+              * fourcc: DRM_FORMAT_*
+Return Value: 1 if it can, 0 if not
+******************************************************************************/
+static int plane_has_format(const kms_plane *p, uint32_t fourcc)
+{
+    int i;
+
+    for(i = 0; i < p->format_count; i++) {
+        if(p->formats[i] == fourcc)
+            return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: where the picture goes on the screen, scaled to fit it with
+              the same aspect ratio, or 1:1 in the middle and cut to the screen
+Input Value.: * d....: the display
+              * scale: let the plane scale the picture
+Return Value: -
+******************************************************************************/
+static void place_picture(kms_display *d, int scale)
+{
+    int w = d->picture_width, h = d->picture_height;
+
+    d->src_x = d->src_y = 0;
+    if(scale) {
+        if((long long)w * d->height > (long long)h * d->width) {
+            d->dst_w = d->width;
+            d->dst_h = (int)((long long)h * d->width / w) & ~1;
+        } else {
+            d->dst_w = (int)((long long)w * d->height / h) & ~1;
+            d->dst_h = d->height;
+        }
+    } else {
+        if(w > d->width) {
+            d->src_x = (w - d->width) / 2;
+            w = d->width;
+        }
+        if(h > d->height) {
+            d->src_y = (h - d->height) / 2;
+            h = d->height;
+        }
+        d->dst_w = w;
+        d->dst_h = h;
+    }
+
+    d->dst_x = (d->width - d->dst_w) / 2;
+    d->dst_y = (d->height - d->dst_h) / 2;
+    d->src_x <<= 16;
+    d->src_y <<= 16;
+    d->src_w = (uint32_t)w << 16;
+    d->src_h = (uint32_t)h << 16;
+}
+
+/******************************************************************************
+Description.: set up the buffers and the plane for pictures of a new format
+              or size, an overlay plane is preferred over the primary one,
+              scaling over showing the picture 1:1
+Input Value.: * d............: the display
+              * fourcc.......: DRM_FORMAT_*
+              * width, height: of the pictures
+Return Value: 0 if ok, -1 if the pictures can not be shown
+******************************************************************************/
+static int configure(kms_display *d, uint32_t fourcc, int width, int height)
+{
+    kms_plane *previous = (d->old_plane != NULL) ? d->old_plane : d->plane;
+    int i, pass, scale;
+
+    wait_flip(d);
+
+    /* the buffer on the screen stays until the first new one replaces it */
+    if(d->shown >= 0) {
+        free_buffer(d, &d->retired);
+        d->retired = d->buffers[d->shown];
+        memset(&d->buffers[d->shown], 0, sizeof(kms_buffer));
+        d->shown = -1;
+    }
+    for(i = 0; i < KMS_BUFFERS; i++)
+        free_buffer(d, &d->buffers[i]);
+
+    d->fourcc = 0;
+    d->picture_width = width;
+    d->picture_height = height;
+    for(i = 0; i < KMS_BUFFERS; i++) {
+        if(create_buffer(d, &d->buffers[i], fourcc, width, height, 1) < 0)
+            return -1;
+    }
+
+    /* overlay planes first, then the primary one */
+    for(pass = 0; pass < 2; pass++) {
+        for(d->plane = d->planes; d->plane < d->planes + d->plane_count; d->plane++) {
+            if((d->plane->type == DRM_PLANE_TYPE_PRIMARY) != pass || !plane_has_format(d->plane, fourcc))
+                continue;
+            d->old_plane = (previous != d->plane) ? previous : NULL;
+            for(scale = 1; scale >= 0; scale--) {
+                place_picture(d, scale);
+                if(commit(d, 0, 1) == 0) {
+                    DBG("%dx%d on plane %u at %dx%d\n", width, height, d->plane->id, d->dst_w, d->dst_h);
+                    d->fourcc = fourcc;
+                    return 0;
+                }
+            }
+        }
+    }
+
+    OPRINT("no plane of the display shows pictures of %dx%d in %.4s\n", width, height, (char *)&fourcc);
+    d->plane = previous;
+    d->old_plane = NULL;
+    return -1;
+}
+
+/******************************************************************************
+Description.: open a DRM device and pick the display and mode
+Input Value.: * device.......: like /dev/dri/card0
+              * width, height: size of the mode wanted, 0 for the preferred one
+Return Value: the display, NULL on error
+******************************************************************************/
+kms_display *kms_open(const char *device, int width, int height)
+{
+    kms_display *d;
+    drmModeModeInfo mode;
+    int crtc;
+
+    if((d = calloc(1, sizeof(*d))) == NULL)
+        return NULL;
+    d->shown = d->pending = -1;
+
+    if((d->fd = open(device, O_RDWR | O_CLOEXEC)) < 0) {
+        OPRINT("could not open %s: %s\n", device, strerror(errno));
+        free(d);
+        return NULL;
+    }
+
+    if(drmSetClientCap(d->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) < 0 ||
+       drmSetClientCap(d->fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0) {
+        OPRINT("%s has no atomic modesetting\n", device);
+        kms_close(d);
+        return NULL;
+    }
+
+    if((crtc = choose_output(d, width, height, &mode)) < 0) {
+        kms_close(d);
+        return NULL;
+    }
+    if(find_planes(d, crtc) < 0) {
+        OPRINT("the CRTC has no primary plane\n");
+        kms_close(d);
+        return NULL;
+    }
+
+    d->width = mode.hdisplay;
+    d->height = mode.vdisplay;
+    d->connector_crtc_id = property_id(d->fd, d->connector, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL);
+    d->crtc_mode_id = property_id(d->fd, d->crtc, DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+    d->crtc_active = property_id(d->fd, d->crtc, DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+
+    /* a dumb buffer starts out zeroed, which is black */
+    if(drmModeCreatePropertyBlob(d->fd, &mode, sizeof(mode), &d->mode_blob) < 0 ||
+       create_buffer(d, &d->background, DRM_FORMAT_XRGB8888, d->width, d->height, 0) < 0) {
+        OPRINT("could not set up the mode %s\n", mode.name);
+        kms_close(d);
+        return NULL;
+    }
+    d->plane = d->primary;
+
+    OPRINT("display..........: %s, %dx%d@%d, %d planes\n", device, d->width, d->height,
+           mode.vrefresh, d->plane_count);
+    return d;
+}
+
+/******************************************************************************
+Description.: the size of the mode
+Input Value.: * d............: the display
+              * width, height: get the size
+Return Value: -
+******************************************************************************/
+void kms_size(kms_display *d, int *width, int *height)
+{
+    *width = d->width;
+    *height = d->height;
+}
+
+/******************************************************************************
+Description.: copy a picture into a free buffer and flip to it with the next
+              vertical blank, it only waits for the flip of the one before
+Input Value.: * d............: the display
+              * fourcc.......: DRM_FORMAT_* of the picture
+              * width, height: of the picture
+              * plane........: the planes of the picture
+              * stride.......: bytes between the lines of each plane
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+int kms_show(kms_display *d, uint32_t fourcc, int width, int height,
+             unsigned char *const *plane, const int *stride)
+{
+    kms_buffer *b;
+    int line[KMS_PLANES], rows[KMS_PLANES], planes, bpp, lines, index, p, y;
+
+    /* framebuffers with subsampled chroma have an even size */
+    if(fourcc == DRM_FORMAT_YUV420 || fourcc == DRM_FORMAT_NV12) {
+        width &= ~1;
+        height &= ~1;
+    } else if(fourcc == DRM_FORMAT_YUYV || fourcc == DRM_FORMAT_UYVY) {
+        width &= ~1;
+    }
+
+    if(fourcc != d->fourcc || width != d->picture_width || height != d->picture_height) {
+        if(configure(d, fourcc, width, height) < 0)
+            return -1;
+    }
+
+    for(index = 0; index == d->shown || index == d->pending; index++);
+    b = &d->buffers[index];
+
+    planes = format_layout(fourcc, width, height, &bpp, &lines, line, rows);
+    for(p = 0; p < planes; p++) {
+        for(y = 0; y < rows[p]; y++)
+            memcpy(b->map + b->offset[p] + (size_t)y * b->pitch[p], plane[p] + (size_t)y * stride[p], line[p]);
+    }
+
+    if(wait_flip(d) < 0)
+        return -1;
+    if(commit(d, index, 0) < 0) {
+        OPRINT("could not flip to the picture: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: free the buffers and close the device, the display goes dark
+Input Value.: the display, may be NULL
+Return Value: -
+******************************************************************************/
+void kms_close(kms_display *d)
+{
+    int i;
+
+    if(d == NULL)
+        return;
+
+    wait_flip(d);
+    for(i = 0; i < KMS_BUFFERS; i++)
+        free_buffer(d, &d->buffers[i]);
+    free_buffer(d, &d->retired);
+    free_buffer(d, &d->background);
+    for(i = 0; i < d->plane_count; i++)
+        free(d->planes[i].formats);
+    if(d->mode_blob != 0)
+        drmModeDestroyPropertyBlob(d->fd, d->mode_blob);
+
+    close(d->fd);
+    free(d);
+}
@@ -0,0 +1,44 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef KMS_H
+#define KMS_H
+
+#include <stdint.h>
+#include <drm_fourcc.h>
+
+/*
+ * a display driven through DRM/KMS without a window system. The pictures are
+ * written into dumb buffers and page flipped onto a plane of the CRTC, an
+ * overlay plane if there is one for the format. The plane scales them to the
+ * screen, keeping their aspect ratio; one which can not scale shows them 1:1
+ * in the middle of the screen.
+ */
+#define KMS_PLANES 3
+
+typedef struct _kms_display kms_display;
+
+kms_display *kms_open(const char *device, int width, int height);
+void kms_size(kms_display *d, int *width, int *height);
+int kms_show(kms_display *d, uint32_t fourcc, int width, int height,
+             unsigned char *const *plane, const int *stride);
+void kms_close(kms_display *d);
+
+#endif
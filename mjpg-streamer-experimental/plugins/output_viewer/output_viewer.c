@@ -27,19 +27,35 @@
 #include <pthread.h>
 #include <syslog.h>
 
-#include <SDL/SDL.h>
-#include <jpeglib.h>
+#include <SDL.h>
 
 
 #include "../../utils.h"
 #include "../../mjpg_streamer.h"
 
+#ifdef HAVE_DRM
+#include "kms.h"
+#endif
+
 #define OUTPUT_PLUGIN_NAME "VIEWER output plugin"
 
 static pthread_t worker;
 static globals *pglobal;
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static int input_number = 0;
+static int plugin_id = 0;
+
+static int windowWidth = 0, windowHeight = 0;
+static int fullscreen = 0;
+static int vsync = 1;
+static SDL_Window *window = NULL;
+static SDL_Renderer *renderer = NULL;
+static SDL_Texture *texture = NULL;
+static int raw_subscribed = 0;
+static char *drm_device = NULL;
+#ifdef HAVE_DRM
+static kms_display *display = NULL;
+#endif
 
 /******************************************************************************
 Description.: print a help message
@@ -50,12 +66,22 @@ void help(void)
 {
     fprintf(stderr, " ---------------------------------------------------------------\n" \
             " Help for output plugin..: "OUTPUT_PLUGIN_NAME"\n" \
+            " ---------------------------------------------------------------\n" \
+            " The following parameters can be passed to this plugin:\n\n" \
+            " [-i | --input ].........: read frames from the specified input plugin\n" \
+            " [-r | --resolution ]....: size of the window, WxH, frames are decoded\n" \
+            "                           at about that size\n" \
+            " [-f | --fullscreen ]....: fill the screen\n" \
+            " [-nv | --no-vsync ].....: present the frames without waiting for the\n" \
+            "                           vertical blank\n" \
+            " [-drm ].................: show the frames on a DRM/KMS device like\n" \
+            "                           /dev/dri/card0 instead of a window\n" \
             " ---------------------------------------------------------------\n");
 }
 
 /******************************************************************************
 Description.: clean up allocated resources
-Input Value.: unused argument
+Input Value.: -
 Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
@@ -70,196 +96,217 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    free(frame);
+    frame_unref(frame);
+    frame = NULL;
+    if(raw_subscribed)
+        input_raw_unsubscribe(&pglobal->in[input_number]);
+    raw_subscribed = 0;
+
+    if(texture != NULL)
+        SDL_DestroyTexture(texture);
+    if(renderer != NULL)
+        SDL_DestroyRenderer(renderer);
+    if(window != NULL)
+        SDL_DestroyWindow(window);
+    texture = NULL;
+    renderer = NULL;
+    window = NULL;
+    #ifdef HAVE_DRM
+    kms_close(display);
+    display = NULL;
+    #endif
     SDL_Quit();
 }
 
-typedef struct {
-    struct jpeg_source_mgr pub;
+/******************************************************************************
+Description.: have a texture of a format and size, it is created again when
+              the size or the format of the frames changes
+Input Value.: * renderer: of the window
+              * texture.: the streaming texture, may be replaced
+              * format..: the SDL pixel format
+              * w, h....: the size of the frames
+Return Value: 0 if ok, 1 on error
+******************************************************************************/
+static int prepare_texture(SDL_Renderer *renderer, SDL_Texture **texture, Uint32 format, int w, int h)
+{
+    Uint32 current;
+    int width, height;
+
+    if(*texture != NULL) {
+        SDL_QueryTexture(*texture, &current, NULL, &width, &height);
+        if(current != format || width != w || height != h) {
+            SDL_DestroyTexture(*texture);
+            *texture = NULL;
+        }
+    }
 
-    Uint8 *jpegdata;
-    int jpegsize;
-} my_source_mgr;
+    if(*texture == NULL) {
+        DBG("texture of %dx%d, %s\n", w, h, SDL_GetPixelFormatName(format));
+        *texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, w, h);
+        if(*texture == NULL) {
+            OPRINT("could not create a texture: %s\n", SDL_GetError());
+            return 1;
+        }
+        SDL_RenderSetLogicalSize(renderer, w, h);
+    }
 
-static void init_source(j_decompress_ptr cinfo)
-{
-    return;
+    return 0;
 }
 
-static int fill_input_buffer(j_decompress_ptr cinfo)
+/******************************************************************************
+Description.: upload the decoded frame
+Input Value.: * renderer: of the window
+              * texture.: the streaming texture, may be replaced
+              * pic.....: the picture decoded from the frame
+Return Value: 0 if ok, 1 on error
+******************************************************************************/
+static int upload_image(SDL_Renderer *renderer, SDL_Texture **texture, const decoded_picture *pic)
 {
-    my_source_mgr * src = (my_source_mgr *) cinfo->src;
+    Uint32 format = (pic->format == DECODE_YUV420) ? SDL_PIXELFORMAT_IYUV : SDL_PIXELFORMAT_RGB24;
 
-    src->pub.next_input_byte = src->jpegdata;
-    src->pub.bytes_in_buffer = src->jpegsize;
+    if(prepare_texture(renderer, texture, format, pic->width, pic->height))
+        return 1;
 
-    return TRUE;
+    if(pic->format == DECODE_YUV420)
+        return SDL_UpdateYUVTexture(*texture, NULL, pic->plane[0], pic->stride[0],
+                                    pic->plane[1], pic->stride[1],
+                                    pic->plane[2], pic->stride[2]) != 0;
+    return SDL_UpdateTexture(*texture, NULL, pic->plane[0], pic->stride[0]) != 0;
 }
 
-static void skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+/******************************************************************************
+Description.: the SDL pixel format a raw frame can be shown with as it is
+Input Value.: the raw frame
+Return Value: the format, SDL_PIXELFORMAT_UNKNOWN if the JPEG has to be decoded
+******************************************************************************/
+static Uint32 raw_texture_format(const input_frame *raw)
 {
-    my_source_mgr * src = (my_source_mgr *) cinfo->src;
-
-    if(num_bytes > 0) {
-        src->pub.next_input_byte += (size_t) num_bytes;
-        src->pub.bytes_in_buffer -= (size_t) num_bytes;
+    switch(raw->format.pixelformat) {
+    case V4L2_PIX_FMT_YUYV:
+        return SDL_PIXELFORMAT_YUY2;
+    case V4L2_PIX_FMT_UYVY:
+        return SDL_PIXELFORMAT_UYVY;
+    case V4L2_PIX_FMT_RGB24:
+        return SDL_PIXELFORMAT_RGB24;
+    case V4L2_PIX_FMT_BGR24:
+        return SDL_PIXELFORMAT_BGR24;
+    case V4L2_PIX_FMT_RGB565:
+        return SDL_PIXELFORMAT_RGB565;
+    case V4L2_PIX_FMT_YUV420:
+        return (raw->format.planes == 3) ? SDL_PIXELFORMAT_IYUV : SDL_PIXELFORMAT_UNKNOWN;
     }
+    return SDL_PIXELFORMAT_UNKNOWN;
 }
 
-static void term_source(j_decompress_ptr cinfo)
-{
-    return;
-}
-
-static void jpeg_init_src(j_decompress_ptr cinfo, Uint8 *jpegdata, int jpegsize)
+/******************************************************************************
+Description.: upload a raw frame, which needs no decoding
+Input Value.: * renderer: of the window
+              * texture.: the streaming texture, may be replaced
+              * raw.....: the raw frame
+              * format..: its SDL pixel format
+Return Value: 0 if ok, 1 on error
+******************************************************************************/
+static int upload_raw(SDL_Renderer *renderer, SDL_Texture **texture, const input_frame *raw, Uint32 format)
 {
-    my_source_mgr *src;
-
-    if(cinfo->src == NULL) {  /* first time for this JPEG object? */
-        cinfo->src = (struct jpeg_source_mgr *)(*cinfo->mem->alloc_small)((j_common_ptr) cinfo, JPOOL_PERMANENT, sizeof(my_source_mgr));
-        src = (my_source_mgr *) cinfo->src;
-    }
+    const raw_format *f = &raw->format;
 
-    src = (my_source_mgr *) cinfo->src;
-    src->pub.init_source = init_source;
-    src->pub.fill_input_buffer = fill_input_buffer;
-    src->pub.skip_input_data = skip_input_data;
-    src->pub.resync_to_restart = jpeg_resync_to_restart;
-    src->pub.term_source = term_source;
-    src->pub.bytes_in_buffer = 0; /* forces fill_input_buffer on first read */
-    src->pub.next_input_byte = NULL; /* until buffer loaded */
-
-    src->jpegdata = jpegdata;
-    src->jpegsize = jpegsize;
-}
+    if(prepare_texture(renderer, texture, format, f->width, f->height))
+        return 1;
 
-static void my_error_exit(j_common_ptr cinfo)
-{
-    DBG("JPEG data contains an error\n");
+    if(format == SDL_PIXELFORMAT_IYUV)
+        return SDL_UpdateYUVTexture(*texture, NULL, raw->buf + f->offset[0], f->stride[0],
+                                    raw->buf + f->offset[1], f->stride[1],
+                                    raw->buf + f->offset[2], f->stride[2]) != 0;
+    return SDL_UpdateTexture(*texture, NULL, raw->buf + f->offset[0], f->stride[0]) != 0;
 }
 
-static void my_error_output_message(j_common_ptr cinfo)
+#ifdef HAVE_DRM
+/******************************************************************************
+Description.: the DRM format a raw frame can be shown with as it is
+Input Value.: the raw frame
+Return Value: the format, 0 if the JPEG has to be decoded
+******************************************************************************/
+static uint32_t raw_drm_format(const input_frame *raw)
 {
-    DBG("JPEG data contains an error\n");
+    switch(raw->format.pixelformat) {
+    case V4L2_PIX_FMT_YUYV:
+        return DRM_FORMAT_YUYV;
+    case V4L2_PIX_FMT_UYVY:
+        return DRM_FORMAT_UYVY;
+    /* the formats of DRM name the bytes of a little endian word, last first */
+    case V4L2_PIX_FMT_RGB24:
+        return DRM_FORMAT_BGR888;
+    case V4L2_PIX_FMT_BGR24:
+        return DRM_FORMAT_RGB888;
+    case V4L2_PIX_FMT_RGB565:
+        return DRM_FORMAT_RGB565;
+    case V4L2_PIX_FMT_YUV420:
+        return (raw->format.planes == 3) ? DRM_FORMAT_YUV420 : 0;
+    case V4L2_PIX_FMT_NV12:
+        return (raw->format.planes == 2) ? DRM_FORMAT_NV12 : 0;
+    }
+    return 0;
 }
 
-typedef struct {
-    int height;
-    int width;
-    unsigned char *buffer;
-    int buffersize;
-} decompressed_image;
-
-int decompress_jpeg(unsigned char *jpeg, int jpegsize, decompressed_image *image)
+/******************************************************************************
+Description.: show the frames on a DRM/KMS display, a JPEG is decoded at
+              the size of the screen and the plane scales it from there
+Input Value.: the subscription to the input
+Return Value: -
+******************************************************************************/
+static void show_on_display(frame_subscription *sub)
 {
-    struct jpeg_decompress_struct cinfo;
-    JSAMPROW rowptr[1];
-    struct jpeg_error_mgr jerr;
-
-    /* create an error handler that does not terminate MJPEG-streamer */
-    cinfo.err = jpeg_std_error(&jerr);
-    jerr.error_exit = my_error_exit;
-    jerr.output_message = my_error_output_message;
-
-    /* create the decompressor structures */
-    jpeg_create_decompress(&cinfo);
+    const decoded_picture *pic;
+    unsigned char *plane[RAW_PLANES];
+    int width, height, p, ret;
+    uint32_t format;
 
-    /* initalize the structures of decompressor */
-    jpeg_init_src(&cinfo, jpeg, jpegsize);
-
-    /* read the JPEG header data */
-    if(jpeg_read_header(&cinfo, TRUE) < 0) {
-        jpeg_destroy_decompress(&cinfo);
-        DBG("could not read the header\n");
-        return 1;
-    }
-
-    /*
-     * I just expect RGB colored JPEGs, so the num_components must be three
-     */
-    if(cinfo.num_components != 3) {
-        jpeg_destroy_decompress(&cinfo);
-        DBG("unsupported number of components (~colorspace)\n");
-        return 1;
-    }
+    if((display = kms_open(drm_device, windowWidth, windowHeight)) == NULL)
+        return;
+    kms_size(display, &width, &height);
 
-    /* just use RGB output and adjust decompression parameters */
-    cinfo.out_color_space = JCS_RGB;
-    cinfo.quantize_colors = FALSE;
-    /* to scale the decompressed image, the fraction could be changed here */
-    cinfo.scale_num   = 1;
-    cinfo.scale_denom = 1;
-    cinfo.dct_method = JDCT_FASTEST;
-    cinfo.do_fancy_upsampling = FALSE;
-
-    jpeg_calc_output_dimensions(&cinfo);
-
-    /* store the image information */
-    image->width = cinfo.output_width;
-    image->height = cinfo.output_height;
-
-    /*
-     * just allocate a new buffer if not already allocated
-     * pay a lot attention, that the calling function has to ensure, that the buffer
-     * must be large enough
-     */
-    if(image->buffer == NULL) {
-        image->buffersize = image->width * image->height * cinfo.num_components;
-        /* the calling function has to ensure that this buffer will become freed after use! */
-        image->buffer = malloc(image->buffersize);
-        if(image->buffer == NULL) {
-            jpeg_destroy_decompress(&cinfo);
-            DBG("allocating memory failed\n");
-            return 1;
+    while(!pglobal->stop) {
+        DBG("waiting for fresh frame\n");
+        frame_unref(frame);
+        frame = NULL;
+        frame = frame_next(sub, -1);
+
+        if(frame->raw != NULL && (format = raw_drm_format(frame->raw)) != 0) {
+            for(p = 0; p < frame->raw->format.planes; p++)
+                plane[p] = frame->raw->buf + frame->raw->format.offset[p];
+            ret = kms_show(display, format, frame->raw->format.width, frame->raw->format.height,
+                           plane, frame->raw->format.stride);
+        } else {
+            if((pic = frame_decode(frame, DECODE_YUV420, width, height)) == NULL &&
+               (pic = frame_decode(frame, DECODE_RGB24, width, height)) == NULL) {
+                DBG("could not properly decompress JPEG data\n");
+                continue;
+            }
+            format = (pic->format == DECODE_YUV420) ? DRM_FORMAT_YUV420 : DRM_FORMAT_BGR888;
+            ret = kms_show(display, format, pic->width, pic->height, pic->plane, pic->stride);
         }
-    }
-
-    /* start to decompress */
-    if(jpeg_start_decompress(&cinfo) < 0) {
-        jpeg_destroy_decompress(&cinfo);
-        DBG("could not start decompression\n");
-        return 1;
-    }
-
-    while(cinfo.output_scanline < cinfo.output_height) {
-        rowptr[0] = (JSAMPROW)(Uint8 *)image->buffer + cinfo.output_scanline * image->width * cinfo.num_components;
-
-        if(jpeg_read_scanlines(&cinfo, rowptr, (JDIMENSION) 1) < 0) {
-            jpeg_destroy_decompress(&cinfo);
-            DBG("could not decompress this line\n");
-            return 1;
+        if(ret < 0) {
+            DBG("could not show the frame\n");
+            continue;
         }
-    }
 
-    if(jpeg_finish_decompress(&cinfo) < 0) {
-        jpeg_destroy_decompress(&cinfo);
-        DBG("could not finish compression\n");
-        return 1;
+        pglobal->out[plugin_id].stats.frames++;
+        pglobal->out[plugin_id].stats.bytes += frame->size;
     }
-
-    /* all is done */
-    jpeg_destroy_decompress(&cinfo);
-
-    return 0;
 }
+#endif
 
 /******************************************************************************
-Description.: this is the main worker thread
-              it loops forever, grabs a fresh frame, decompressed the JPEG
-              and displays the decoded data using SDL
-Input Value.:
-Return Value:
+Description.: show the frames in an SDL window until it is closed
+Input Value.: the subscription to the input
+Return Value: -
 ******************************************************************************/
-void *worker_thread(void *arg)
+static void show_in_window(frame_subscription *sub)
 {
-    int frame_size = 0, firstrun = 1;
-
-    SDL_Surface *screen = NULL, *image = NULL;
-    decompressed_image rgbimage;
-
-    /* initialze the buffer for the decompressed image */
-    rgbimage.buffersize = 0;
-    rgbimage.buffer = NULL;
+    int width = 0, height = 0, frame_width, frame_height, closed = 0;
+    const decoded_picture *pic = NULL;
+    Uint32 raw_format;
+    SDL_Event event;
 
     /* initialze the SDL video subsystem */
     if(SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -267,68 +314,105 @@ void *worker_thread(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    /* just allocate a large buffer for the JPEGs */
-    if((frame = malloc(4096 * 1024)) == NULL) {
-        OPRINT("not enough memory for worker thread\n");
-        exit(EXIT_FAILURE);
-    }
-
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(worker_cleanup, NULL);
-
     while(!pglobal->stop) {
         DBG("waiting for fresh frame\n");
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        /* release the previous frame and take a reference to a fresh one */
+        frame_unref(frame);
+        frame = NULL;
+        frame = frame_next(sub, -1);
+
+        /* a raw frame is shown as it is, JPEGs are decoded at the size the window shows them */
+        raw_format = (frame->raw != NULL) ? raw_texture_format(frame->raw) : SDL_PIXELFORMAT_UNKNOWN;
+        if(raw_format != SDL_PIXELFORMAT_UNKNOWN) {
+            frame_width = frame->raw->format.width;
+            frame_height = frame->raw->format.height;
+        } else {
+            /* straight to YUV if the planes of the JPEG can be shown as 4:2:0 */
+            if(renderer != NULL)
+                SDL_GetRendererOutputSize(renderer, &width, &height);
+            if((pic = frame_decode(frame, DECODE_YUV420, width, height)) == NULL &&
+               (pic = frame_decode(frame, DECODE_RGB24, width, height)) == NULL) {
+                DBG("could not properly decompress JPEG data\n");
+                continue;
+            }
+            frame_width = pic->width;
+            frame_height = pic->height;
+        }
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+        if(window == NULL) {
+            /* the window starts at the requested size or at the size of the frames */
+            window = SDL_CreateWindow("MJPG-Streamer Viewer", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                      windowWidth > 0 ? windowWidth : frame_width,
+                                      windowHeight > 0 ? windowHeight : frame_height,
+                                      SDL_WINDOW_RESIZABLE | (fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
+            if(window == NULL) {
+                OPRINT("could not open a window: %s\n", SDL_GetError());
+                return;
+            }
+            renderer = SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+            if(renderer == NULL) {
+                OPRINT("could not create a renderer: %s\n", SDL_GetError());
+                return;
+            }
+        }
 
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        /* closing the window only stops the viewer */
+        while(SDL_PollEvent(&event)) {
+            if(event.type == SDL_QUIT)
+                closed = 1;
+        }
+        if(closed) {
+            OPRINT("the window was closed\n");
+            return;
+        }
 
-        /* decompress the JPEG and store results in memory */
-        if(decompress_jpeg(frame, frame_size, &rgbimage)) {
-            DBG("could not properly decompress JPEG data\n");
+        if((raw_format != SDL_PIXELFORMAT_UNKNOWN) ? upload_raw(renderer, &texture, frame->raw, raw_format) :
+                                                     upload_image(renderer, &texture, pic)) {
+            DBG("could not upload the frame: %s\n", SDL_GetError());
             continue;
         }
 
-        if(firstrun) {
-            /* create the primary surface (the visible window) */
-            screen = SDL_SetVideoMode(rgbimage.width, rgbimage.height, 0, SDL_ANYFORMAT | SDL_HWSURFACE);
-            SDL_WM_SetCaption("MJPG-Streamer Viewer", NULL);
-
-            /* create a SDL surface to display the data */
-            image = SDL_AllocSurface(SDL_SWSURFACE, rgbimage.width, rgbimage.height, 24,
-#if SDL_BYTEORDER == SDL_LIL_ENDIAN
-                                     0x0000FF, 0x00FF00, 0xFF0000,
-#else
-                                     0xFF0000, 0x00FF00, 0x0000FF,
-#endif
-                                     0);
-
-            /* copy the decoded data across */
-            memcpy(image->pixels, rgbimage.buffer, rgbimage.width * rgbimage.height * 3);
-            free(rgbimage.buffer);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        SDL_RenderPresent(renderer);
+        pglobal->out[plugin_id].stats.frames++;
+        pglobal->out[plugin_id].stats.bytes += frame->size;
+    }
+}
 
-            /* now, that we know the dimensions, we can directly copy to the right surface */
-            rgbimage.buffer = image->pixels;
-            rgbimage.buffersize = rgbimage.width * rgbimage.height * 3;
+/******************************************************************************
+Description.: this is the main worker thread
+              it loops forever, grabs a fresh frame, decompressed the JPEG
+              and displays the decoded data using SDL or DRM/KMS. Presenting
+              waits for the vertical blank, frames published meanwhile are
+              skipped.
+Input Value.:
+Return Value:
+******************************************************************************/
+void *worker_thread(void *arg)
+{
+    frame_subscription sub;
 
-            firstrun = 0;
-        }
+    /* set cleanup handler to cleanup allocated resources */
+    pthread_cleanup_push(worker_cleanup, NULL);
 
-        /* copy the image to the primary surface */
-        SDL_BlitSurface(image, NULL, screen, NULL);
+    /* frames shown too late for the screen count as overruns */
+    frame_subscribe(&sub, &pglobal->in[input_number], FRAME_LATEST, &pglobal->out[plugin_id].stats);
 
-        /* redraw the whole surface */
-        SDL_Flip(screen);
+    /* the pictures of the input need no decoding, unless they are turned */
+    if(pglobal->in[input_number].transform == TRANSFORM_NONE) {
+        input_raw_subscribe(&pglobal->in[input_number]);
+        raw_subscribed = 1;
     }
 
-    pthread_cleanup_pop(1);
+    #ifdef HAVE_DRM
+    if(drm_device != NULL)
+        show_on_display(&sub);
+    else
+    #endif
+        show_in_window(&sub);
 
-    /* get rid of the image */
-    SDL_FreeSurface(image);
+    pthread_cleanup_pop(1);
 
     return NULL;
 }
@@ -340,7 +424,7 @@ Description.: this function is called first, in order to initialise
 Input Value.: parameters
 Return Value: 0 if everything is ok, non-zero otherwise
 ******************************************************************************/
-int output_init(output_parameter *param)
+int output_init(output_parameter *param, int id)
 {
     int i;
 
@@ -360,6 +444,13 @@ int output_init(output_parameter *param)
             {"help", no_argument, 0, 0},
             {"i", required_argument, 0, 0},
             {"input", required_argument, 0, 0},
+            {"r", required_argument, 0, 0},
+            {"resolution", required_argument, 0, 0},
+            {"f", no_argument, 0, 0},
+            {"fullscreen", no_argument, 0, 0},
+            {"nv", no_argument, 0, 0},
+            {"no-vsync", no_argument, 0, 0},
+            {"drm", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -388,15 +479,56 @@ int output_init(output_parameter *param)
             DBG("case 2,3\n");
             input_number = atoi(optarg);
             break;
+            /* r, resolution */
+        case 4:
+        case 5:
+            DBG("case 4,5\n");
+            if(sscanf(optarg, "%dx%d", &windowWidth, &windowHeight) != 2 || windowWidth <= 0 || windowHeight <= 0) {
+                OPRINT("ERROR: the resolution is given as WxH\n");
+                return 1;
+            }
+            break;
+            /* f, fullscreen */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            fullscreen = 1;
+            break;
+            /* nv, no-vsync */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            vsync = 0;
+            break;
+            /* drm */
+        case 10:
+            DBG("case 10\n");
+            #ifdef HAVE_DRM
+            drm_device = strdup(optarg);
+            #else
+            OPRINT("ERROR: the plugin was built without DRM/KMS\n");
+            return 1;
+            #endif
+            break;
         }
     }
 
     pglobal = param->global;
+    plugin_id = id;
     if(!(input_number < pglobal->incnt)) {
         OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", input_number, pglobal->incnt);
         return 1;
     }
     OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
+    if(windowWidth > 0) {
+        OPRINT("window size......: %dx%d\n", windowWidth, windowHeight);
+    }
+    if(drm_device != NULL) {
+        OPRINT("DRM device.......: %s\n", drm_device);
+    } else {
+        OPRINT("fullscreen.......: %s\n", fullscreen ? "yes" : "no");
+        OPRINT("vsync............: %s\n", vsync ? "yes" : "no");
+    }
 
     return 0;
 }
@@ -37,6 +37,8 @@
 #include <syslog.h>
 #include <dirent.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <zmq.h>
 
 #include <linux/types.h>          /* for videodev2.h */
@@ -50,26 +52,45 @@
 
 #define OUTPUT_PLUGIN_NAME "UDPSERVER output plugin"
 
-#define MAX_ZMQ_BUFFER_SIZE 10
+#define MAX_ZMQ_BUFFER_SIZE 64
+#define MAX_ZMQ_INPUTS 16
+#define ZMQ_TOPIC_SIZE 64
+
+/* an input published by the plugin, its frames are batched on a topic of their own */
+typedef struct _zmq_stream {
+    int input;
+    char topic[ZMQ_TOPIC_SIZE];
+    frame_subscription sub;
+    frame_waiter waiter;
+    input_frame *frames[MAX_ZMQ_BUFFER_SIZE];
+    Pb__Package package;
+    Pb__Package__Frame frame[MAX_ZMQ_BUFFER_SIZE];
+    Pb__Package__Frame *frame_list[MAX_ZMQ_BUFFER_SIZE];
+    int pos;                              // frames in the batch
+    unsigned long long batch_start;       // of its first frame
+} zmq_stream;
 
 static pthread_t worker;
 static globals *pglobal;
 static int fd, ringbuffer_size = -1, ringbuffer_exceed = 0, max_frame_size;
 static char *folder = "/tmp";
-static unsigned char *frame = NULL;
-static unsigned char *frames[MAX_ZMQ_BUFFER_SIZE];
 static char *command = NULL;
-static int input_number = 0;
+static zmq_stream streams[MAX_ZMQ_INPUTS];
+static int stream_count = 0;
+static int plugin_id;
 static char *mjpgFileName = NULL;
 static char *zmqAddress = NULL;
+static char *topicPrefix = "frames";      // a single input is published on it, several below it
 static int zmqBufferSize = 3;
-static int zmqBufferPos = 0;
-static Pb__Package pbPackage = PB__PACKAGE__INIT; // Package
+static int multipart = 0;                 // the JPEGs follow the metadata as parts of their own
+static int batchTime = 0;                 // ms a batch may wait for more frames, 0 until it is full
+static int highWaterMark = -1;            // messages queued for a subscriber, -1 for the default of zmq
+static int conflate = 0;                  // only the latest message waits for a subscriber
+static unsigned long long counter = 0;    // frames packaged so far
+static int efd = -1;                      // written by the inputs once they publish
 
 static void *context;
 static void *publisher;
-static void *buf;                         // Buffer to store serialized data
-static int bufferSize;
 
 static clock_t begin, end;
 
@@ -87,11 +108,23 @@ void help(void)
             " The following parameters can be passed to this plugin:\n\n" \
             " [-f | --folder ]........: folder to save pictures\n" \
             " [-m | --mjpeg ].........: save the frames to an mjpg file \n" \
-            " [-i | --input ].........: read frames from the specified input plugin\n" \
+            " [-i | --input ].........: read frames from the specified input plugins, given\n" \
+            "                           as a list like 0,2,3 or more than once\n" \
+            " [-t | --topic ].........: topic of a single input or prefix of the topics\n" \
+            "                           <prefix>/<input> of several, \"frames\" by default\n" \
             " The following arguments are takes effect only if the current mode is not MJPG\n" \
             " [-s | --size ]..........: size of ring buffer (max number of pictures to hold)\n" \
             " [-e | --exceed ]........: allow ringbuffer to exceed limit by this amount\n" \
             " [-c | --command ].......: execute command after saving picture\n"\
+            " [-mp | --multipart ]....: send the JPEGs as message parts of their own after\n"\
+            "                           a package with the timestamps, without copying them\n"\
+            " [-b | --buffer_size ]...: frames per message, 3 by default, up to 64\n"\
+            " [-bt | --batch-time ]...: send a message after this many ms even if it has\n"\
+            "                           fewer frames\n"\
+            " [-hwm | --high-water-mark ]: messages queued for a slow subscriber, more are\n"\
+            "                           dropped by zmq\n"\
+            " [-cf | --conflate ].....: keep only the latest message for a slow subscriber,\n"\
+            "                           the topic and the package are sent as one part\n"\
             " ---------------------------------------------------------------\n");
 }
 
@@ -103,7 +136,8 @@ Return Value: -
 void worker_cleanup(void *arg)
 {
     static unsigned char first_run = 1;
-    int i;
+    zmq_stream *s;
+    int i, j;
 
     if (mjpgFileName != NULL) {
         close(fd);
@@ -117,24 +151,102 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up ressources allocated by worker thread\n");
 
-    if(frame != NULL) {
-        free(frame);
+    for(i = 0; i < stream_count; i++) {
+        s = &streams[i];
+        frame_unwatch(&s->waiter);
+        frame_unsubscribe(&s->sub);
+        for(j = 0; j < MAX_ZMQ_BUFFER_SIZE; j++) {
+            frame_unref(s->frames[j]);
+            s->frames[j] = NULL;
+        }
     }
     close(fd);
+    if(efd >= 0)
+        close(efd);
 
     // cleanup zmq
     zmq_close (publisher);
     zmq_ctx_destroy (context);
+}
 
-    // Free the allocated serialized buffer
-    free(buf);
+/******************************************************************************
+Description.: zmq is done with the JPEG of a frame, called from its I/O thread
+Input Value.: * data: the JPEG
+              * hint: the frame, referenced for the message
+Return Value: -
+******************************************************************************/
+static void release_frame(void *data, void *hint)
+{
+    frame_unref((input_frame *)hint);
+}
 
-    // Free protobuf message
-    for (i = 0; i < pbPackage.n_frame; ++i)
-    {
-        free(pbPackage.frame[i]);
+static void release_buffer(void *data, void *hint)
+{
+    free(data);
+}
+
+/******************************************************************************
+Description.: publish the frames collected in the package of a stream. Zmq
+              takes the buffers of the messages, so a serialized package is
+              not copied again and in multipart mode the JPEGs are not copied
+              at all.
+Input Value.: the stream, its package is sent on its topic
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int publish_frames(zmq_stream *s)
+{
+    zmq_msg_t message;
+    const char *topic = s->topic;
+    unsigned len, prefix = conflate ? strlen(topic) : 0;
+    unsigned char *packed;
+    int i;
+
+    /* zmq conflates single part messages only, the topic goes in front then */
+    len = pb__package__get_packed_size(&s->package);
+    if((packed = malloc(prefix + len + 1)) == NULL) {
+        LOG("not enough memory\n");
+        return -1;
+    }
+    memcpy(packed, topic, prefix);
+    pb__package__pack(&s->package, packed + prefix);
+    DBG("packing data: %u %s\n", len, multipart ? "without the JPEGs" : "");
+
+    if(!conflate && zmq_send(publisher, topic, strlen(topic), ZMQ_SNDMORE) == -1) {
+        free(packed);
+        return -1;
+    }
+
+    zmq_msg_init_data(&message, packed, prefix + len, release_buffer, NULL);
+    if(zmq_msg_send(&message, publisher, multipart ? ZMQ_SNDMORE : 0) == -1) {
+        zmq_msg_close(&message);
+        return -1;
+    }
+
+    for(i = 0; multipart && i < s->package.n_frame; i++) {
+        zmq_msg_init_data(&message, s->frames[i]->buf, s->frames[i]->size, release_frame, frame_ref(s->frames[i]));
+        if(zmq_msg_send(&message, publisher, (i < s->package.n_frame - 1) ? ZMQ_SNDMORE : 0) == -1) {
+            /* closing gives the frame back, a started multipart message is dropped by zmq */
+            zmq_msg_close(&message);
+            return -1;
+        }
     }
-    free(pbPackage.frame);
+    return 0;
+}
+
+/******************************************************************************
+Description.: publish the frames batched for a stream, its batch starts over
+Input Value.: the stream
+Return Value: -
+******************************************************************************/
+static void send_batch(zmq_stream *s)
+{
+    DBG("transmitting ZMQ: %d frames on %s\n", s->pos, s->topic);
+    s->package.n_frame = s->pos;
+    if (publish_frames(s) < 0) {
+        DBG("ZMQ Transmission failure");
+    }
+    s->package.n_frame = zmqBufferSize;
+    s->pos = 0;
 }
 
 /******************************************************************************
@@ -229,197 +341,230 @@ void maintain_ringbuffer(int size)
 }
 
 /******************************************************************************
-Description.: this is the main worker thread
-              it loops forever, grabs a fresh frame and stores it to file
-Input Value.:
-Return Value:
+Description.: put a frame of a stream into its batch, or into the MJPG file,
+              and publish the batch once it is full
+Input Value.: * s....: the stream
+              * frame: referenced frame of its input, taken over
+Return Value: 0 if ok, -1 if the file could not be written
 ******************************************************************************/
-void *worker_thread(void *arg)
+static int take_frame(zmq_stream *s, input_frame *frame)
 {
-    int ok = 1, frame_size = 0, rc = 0;
     char buffer1[1024] = {0}, buffer2[1024] = {0};
-    unsigned long long counter = 0;
-    unsigned char *tmp_framebuffer = NULL;
+    struct timeval timestamp;
+    int rc = 0;
 
-    //  Prepare our context and publisher
-    //char zmqAddress[20];
-    if (zmqAddress == NULL) {
-        LOG("No ZMQ address specified");
+    if (s->sub.skipped > 0) {
+        DBG("%llu frames of input %d were dropped before they could be batched\n", s->sub.skipped, s->input);
     }
-
-    context = zmq_ctx_new ();
-    publisher = zmq_socket (context, ZMQ_PUB);
-    //snprintf(zmqAddress, 20u, "epgm://eth0;239.1.1.1:%i", zmqPort);
-
-    if (zmq_bind (publisher, zmqAddress) == -1) {
-        LOG("Couldn't create zmq socket.\n");
+    /* the messages point into the frame, a metadata segment has to be in it */
+    if ((frame = frame_flatten(frame)) == NULL) {
+        return 0;
     }
+    if (s->pos == 0)
+        s->batch_start = monotonic_usec();
+    /* it stays alive until its slot is reused */
+    frame_unref(s->frames[s->pos]);
+    s->frames[s->pos] = frame;
 
-    unsigned len;                      // Length of serialized data
-    char topic[] = "frames";
-    struct timeval timestamp;
-    int i;
+    /* the serialization buffer is sized for the biggest frame seen so far */
+    if(frame->size > max_frame_size) {
+        DBG("increasing buffer size to %d\n", frame->size);
 
-    buf = NULL;
-    for (i = 0; i < MAX_ZMQ_BUFFER_SIZE; ++i)
-    {
-        frames[i] = NULL;
-    }
+        max_frame_size = frame->size + (1 << 16);
 
-    pbPackage.n_frame = zmqBufferSize;
-    if ((pbPackage.frame = malloc(sizeof(Pb__Package__Frame*) * pbPackage.n_frame)) == NULL) {
-        LOG("not enough memory\n");
-    }
-    for (i = 0; i < pbPackage.n_frame; ++i)
-    {
-        if ((pbPackage.frame[i] = malloc(sizeof(Pb__Package__Frame))) == NULL) {
-            LOG("not enough memory\n");
+        if ((setvbuf(stdout, NULL, _IOFBF, max_frame_size)) != 0) {
+            DBG("setvbuf failed.\n");
         }
-        pb__package__frame__init(pbPackage.frame[i]);
     }
-    /* set cleanup handler to cleanup allocated ressources */
-    pthread_cleanup_push(worker_cleanup, NULL);
 
-    while(ok >= 0 && !pglobal->stop) {
-        DBG("waiting for fresh frame\n");
+    timestamp = frame->timestamp;
 
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+    if (mjpgFileName == NULL) { // single files with ringbuffer mode
+        DBG("Packaging data: %lld\n", counter);
+        counter++;
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+        begin = clock();
 
-        /* set the right frame to store the data */
-        frame = frames[zmqBufferPos];
+        /* fill protobuf data */
+        s->frame[s->pos].timestamp_unix = (u_int32_t)time(NULL);
+        s->frame[s->pos].timestamp_s = (u_int32_t)timestamp.tv_sec;
+        s->frame[s->pos].timestamp_us = (u_int32_t)timestamp.tv_usec;
+        /* in multipart mode the package only tells when the frames were taken */
+        s->frame[s->pos].blob.data = multipart ? NULL : frame->buf;
+        s->frame[s->pos].blob.len = multipart ? 0 : frame->size;
 
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if((frame_size > max_frame_size) || (frame == NULL)) {
-            DBG("increasing buffer size to %d\n", frame_size);
+        s->pos++;
 
-            if (frame_size > max_frame_size) {
-                max_frame_size = frame_size + (1 << 16);
-            }
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
+        if (s->pos == zmqBufferSize)
+        {
+            send_batch(s);
+        }
 
-            if ((setvbuf(stdout, NULL, _IOFBF, max_frame_size)) != 0) {
-                DBG("setvbuf failed.\n");
-            }
+        end = clock();
+        DBG("Time1: %f\n", (double)(end-begin) / CLOCKS_PER_SEC);
+        begin = clock();
 
-            frame = tmp_framebuffer;
-        }
+        /* call the command if user specified one, pass current filename as argument */
+        if(command != NULL) {
+            memset(buffer1, 0, sizeof(buffer1));
+
+            /* buffer2 still contains the filename, pass it to the command as parameter */
+            snprintf(buffer1, sizeof(buffer1), "%s \"%s\"", command, buffer2);
+            DBG("calling command %s", buffer1);
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
+            /* in addition provide the filename as environment variable */
+            if((rc = setenv("MJPG_FILE", buffer2, 1)) != 0) {
+                LOG("setenv failed (return value %d)\n", rc);
+            }
 
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+            /* execute the command now */
+            if((rc = system(buffer1)) != 0) {
+                LOG("command failed (return value %d)\n", rc);
+            }
+        }
 
-        /* resync again with the frame buffer */
-        frames[zmqBufferPos] = frame;
+        end = clock();
+        DBG("Time2: %f\n", (double)(end-begin) / CLOCKS_PER_SEC);
+        begin = clock();
+
+        /*
+         * maintain ringbuffer
+         * do not maintain ringbuffer for each picture, this saves ressources since
+         * each run of the maintainance function involves sorting/malloc/free operations
+         */
+        if(ringbuffer_exceed <= 0) {
+            /* keep ringbuffer excactly at specified siOUTPUT_PLUGIN_NAMEze */
+            maintain_ringbuffer(ringbuffer_size);
+        } else if(counter == 1 || counter % (ringbuffer_exceed + 1) == 0) {
+            DBG("counter: %llu, will clean-up now\n", counter);
+            maintain_ringbuffer(ringbuffer_size);
+        }
 
-        /* allow others to access the global buffer again */
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        end = clock();
+        DBG("Time3: %f\n", (double)(end-begin) / CLOCKS_PER_SEC);
+
+    } else { // recording to MJPG file
+        DBG("Entered else branch!\n");
+        /* save picture to file */
+        //if(write(fileno(stdout), frame->buf, frame->size) < 0) {
+        if(fwrite(frame->buf, sizeof(unsigned char), frame->size, stdout) < 0) {
+            OPRINT("could not write to file %s\n", buffer2);
+            perror("fwrite()");
+            return -1;
+        }
+    }
+    return 0;
+}
 
-        if (mjpgFileName == NULL) { // single files with ringbuffer mode
-            DBG("Packaging data: %lld\n", counter);
-            counter++;
+/******************************************************************************
+Description.: this is the main worker thread. It takes the frames of all
+              inputs of the plugin as they are published and sends them out
+              through one socket, with one zmq I/O thread for all of them.
+Input Value.:
+Return Value:
+******************************************************************************/
+void *worker_thread(void *arg)
+{
+    int ok = 1, i, j;
+    unsigned long long now, deadline, value;
+    long long wait;
+    struct pollfd pfd;
+    input_frame *frame;
+    zmq_stream *s;
 
-            begin = clock();
+    //  Prepare our context and publisher
+    //char zmqAddress[20];
+    if (zmqAddress == NULL) {
+        LOG("No ZMQ address specified");
+    }
 
-            /* allocate enough memory to store a serialized string */
-            if ((buf == NULL) || (bufferSize < (max_frame_size * zmqBufferSize + 20)))
-            {
-                bufferSize = (max_frame_size * zmqBufferSize + 20);
-                buf = realloc(buf, bufferSize);
-                if (buf == NULL) {
-                    LOG("Not enough memory");
-                }
-            }
+    if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        LOG("could not create an eventfd: %s\n", strerror(errno));
+        return NULL;
+    }
 
-            /* fill protobuf data */
-            pbPackage.frame[zmqBufferPos]->timestamp_unix = (u_int32_t)time(NULL);
-            pbPackage.frame[zmqBufferPos]->timestamp_s = (u_int32_t)timestamp.tv_sec;
-            pbPackage.frame[zmqBufferPos]->timestamp_us = (u_int32_t)timestamp.tv_usec;
-            pbPackage.frame[zmqBufferPos]->blob.data = frame;
-            pbPackage.frame[zmqBufferPos]->blob.len = frame_size;
-
-            zmqBufferPos++;
-
-            if (zmqBufferPos == zmqBufferSize)
-            {
-                DBG("transmitting ZMQ: %lld\n", counter);
-                /* pack protobuf data */
-                len = pb__package__get_packed_size(&pbPackage);
-                DBG("packing data: %i %i", max_frame_size, len);
-                pb__package__pack(&pbPackage, buf);
-
-                DBG("sending data");
-                // send data using zmq
-                if ((zmq_send(publisher, topic, strlen(topic), ZMQ_SNDMORE) == -1) || (zmq_send(publisher, buf, len, 0) == -1)) {
-                    DBG("ZMQ Transmission failure");
-                }
+    /* the sockets of a context share its I/O threads, one is enough for a single socket */
+    context = zmq_ctx_new ();
+    if (zmq_ctx_set(context, ZMQ_IO_THREADS, 1) == -1) {
+        LOG("could not set the I/O threads: %s\n", zmq_strerror(errno));
+    }
+    publisher = zmq_socket (context, ZMQ_PUB);
 
-                zmqBufferPos = 0;
-            }
+    /* a slow subscriber loses messages at the socket, the worker never waits for it */
+    if (highWaterMark >= 0 && zmq_setsockopt(publisher, ZMQ_SNDHWM, &highWaterMark, sizeof(highWaterMark)) == -1) {
+        LOG("could not set the high water mark: %s\n", zmq_strerror(errno));
+    }
+    if (conflate && zmq_setsockopt(publisher, ZMQ_CONFLATE, &conflate, sizeof(conflate)) == -1) {
+        LOG("could not conflate the messages: %s\n", zmq_strerror(errno));
+    }
+    //snprintf(zmqAddress, 20u, "epgm://eth0;239.1.1.1:%i", zmqPort);
 
-            end = clock();
-            DBG("Time1: %f\n", (double)(end-begin) / CLOCKS_PER_SEC);
-            begin = clock();
+    if (zmq_bind (publisher, zmqAddress) == -1) {
+        LOG("Couldn't create zmq socket.\n");
+    }
 
-            /* call the command if user specified one, pass current filename as argument */
-            if(command != NULL) {
-                memset(buffer1, 0, sizeof(buffer1));
+    for (i = 0; i < stream_count; ++i)
+    {
+        s = &streams[i];
+        s->pos = 0;
+        memset(&s->waiter, 0, sizeof(s->waiter));
+        for (j = 0; j < MAX_ZMQ_BUFFER_SIZE; ++j)
+        {
+            s->frames[j] = NULL;
+            pb__package__frame__init(&s->frame[j]);
+            s->frame_list[j] = &s->frame[j];
+        }
+        pb__package__init(&s->package);
+        s->package.n_frame = zmqBufferSize;
+        s->package.frame = s->frame_list;
 
-                /* buffer2 still contains the filename, pass it to the command as parameter */
-                snprintf(buffer1, sizeof(buffer1), "%s \"%s\"", command, buffer2);
-                DBG("calling command %s", buffer1);
+        /* every frame goes into a batch, the ones lost on the way are overruns */
+        frame_subscribe(&s->sub, &pglobal->in[s->input], FRAME_NEXT, &pglobal->out[plugin_id].stats);
+    }
 
-                /* in addition provide the filename as environment variable */
-                if((rc = setenv("MJPG_FILE", buffer2, 1)) != 0) {
-                    LOG("setenv failed (return value %d)\n", rc);
-                }
+    /* set cleanup handler to cleanup allocated ressources */
+    pthread_cleanup_push(worker_cleanup, NULL);
 
-                /* execute the command now */
-                if((rc = system(buffer1)) != 0) {
-                    LOG("command failed (return value %d)\n", rc);
-                }
+    while(ok >= 0 && !pglobal->stop) {
+        DBG("waiting for fresh frames\n");
+
+        /* take the frames published since the last round, arm the waiters of the inputs without one */
+        for (i = 0; i < stream_count && ok >= 0; i++) {
+            s = &streams[i];
+            while (ok >= 0 && frame_watch(&s->waiter, s->sub.in, s->sub.seq, efd) &&
+                   (frame = frame_next(&s->sub, 0)) != NULL) {
+                ok = take_frame(s, frame);
             }
+        }
 
-            end = clock();
-            DBG("Time2: %f\n", (double)(end-begin) / CLOCKS_PER_SEC);
-            begin = clock();
-
-            /*
-             * maintain ringbuffer
-             * do not maintain ringbuffer for each picture, this saves ressources since
-             * each run of the maintainance function involves sorting/malloc/free operations
-             */
-            if(ringbuffer_exceed <= 0) {
-                /* keep ringbuffer excactly at specified siOUTPUT_PLUGIN_NAMEze */
-                maintain_ringbuffer(ringbuffer_size);
-            } else if(counter == 1 || counter % (ringbuffer_exceed + 1) == 0) {
-                DBG("counter: %llu, will clean-up now\n", counter);
-                maintain_ringbuffer(ringbuffer_size);
+        /* a batch which waited long enough goes out with the frames it has */
+        deadline = 0;
+        if (mjpgFileName == NULL && batchTime > 0) {
+            now = monotonic_usec();
+            for (i = 0; i < stream_count; i++) {
+                s = &streams[i];
+                if (s->pos == 0)
+                    continue;
+                if (s->batch_start + batchTime * 1000ULL <= now) {
+                    send_batch(s);
+                } else if (deadline == 0 || s->batch_start + batchTime * 1000ULL < deadline) {
+                    deadline = s->batch_start + batchTime * 1000ULL;
+                }
             }
+        }
+        if (ok < 0)
+            break;
 
-            end = clock();
-            DBG("Time3: %f\n", (double)(end-begin) / CLOCKS_PER_SEC);
-
-        } else { // recording to MJPG file
-            DBG("Entered else branch!\n");
-            /* save picture to file */
-            //if(write(fileno(stdout), frame, frame_size) < 0) {
-            if(fwrite(frame, sizeof(unsigned char), frame_size, stdout) < 0) {
-                OPRINT("could not write to file %s\n", buffer2);
-                perror("fwrite()");
-                close(fd);
-                return NULL;
-            }
+        wait = 1000;
+        if (deadline != 0) {
+            wait = ((long long)(deadline - monotonic_usec()) + 999) / 1000;
+            if (wait < 0)
+                wait = 0;
         }
+        pfd.fd = efd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, wait) > 0 && read(efd, &value, sizeof(value)) < 0)
+            DBG("could not read eventfd\n");
     }
 
     /* cleanup now */
@@ -428,6 +573,35 @@ void *worker_thread(void *arg)
     return NULL;
 }
 
+/******************************************************************************
+Description.: add the inputs of a list like "0,2,3" to the streams
+Input Value.: the list
+Return Value: 0 if ok, -1 if an input is not a number, too much or given twice
+******************************************************************************/
+static int add_inputs(const char *list)
+{
+    const char *p = list;
+    char *end;
+    long value;
+    int i;
+
+    do {
+        if(*p == ',')
+            p++;
+        value = strtol(p, &end, 10);
+        if(end == p || value < 0 || stream_count == MAX_ZMQ_INPUTS)
+            return -1;
+        for(i = 0; i < stream_count; i++) {
+            if(streams[i].input == value)
+                return -1;
+        }
+        streams[stream_count++].input = value;
+        p = end;
+    } while(*p == ',');
+
+    return (*p == '\0') ? 0 : -1;
+}
+
 /*** plugin interface functions ***/
 /******************************************************************************
 Description.: this function is called first, in order to initialize
@@ -439,6 +613,7 @@ int output_init(output_parameter *param, int id)
 {
 	int i;
     pglobal = param->global;
+    plugin_id = id;
     pglobal->out[id].name = malloc((1+strlen(OUTPUT_PLUGIN_NAME))*sizeof(char));
     sprintf(pglobal->out[id].name, "%s", OUTPUT_PLUGIN_NAME);
     DBG("OUT plugin %d name: %s\n", id, pglobal->out[id].name);
@@ -471,6 +646,16 @@ int output_init(output_parameter *param, int id)
             {"address", required_argument, 0, 0},
             {"b", required_argument, 0, 0},
             {"buffer_size", required_argument, 0, 0},
+            {"mp", no_argument, 0, 0},
+            {"multipart", no_argument, 0, 0},
+            {"hwm", required_argument, 0, 0},
+            {"high-water-mark", required_argument, 0, 0},
+            {"cf", no_argument, 0, 0},
+            {"conflate", no_argument, 0, 0},
+            {"bt", required_argument, 0, 0},
+            {"batch-time", required_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"topic", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -521,7 +706,10 @@ int output_init(output_parameter *param, int id)
         case 8:
         case 9:
             DBG("case 8,9\n");
-            input_number = atoi(optarg);
+            if(add_inputs(optarg) < 0) {
+                OPRINT("ERROR: the inputs %s are not a list of up to %d different inputs\n", optarg, MAX_ZMQ_INPUTS);
+                return 1;
+            }
             break;
             /* m mjpeg */
         case 10:
@@ -541,16 +729,90 @@ int output_init(output_parameter *param, int id)
             DBG("case 14,15\n");
             zmqBufferSize = atoi(optarg);
             break;
+            /* mp, multipart */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            multipart = 1;
+            break;
+            /* hwm, high-water-mark */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            highWaterMark = atoi(optarg);
+            break;
+            /* cf, conflate */
+        case 20:
+        case 21:
+            DBG("case 20,21\n");
+            conflate = 1;
+            break;
+            /* bt, batch-time */
+        case 22:
+        case 23:
+            DBG("case 22,23\n");
+            batchTime = atoi(optarg);
+            break;
+            /* t, topic */
+        case 24:
+        case 25:
+            DBG("case 24,25\n");
+            topicPrefix = strdup(optarg);
+            break;
         }
     }
 
-    if(!(input_number < pglobal->incnt)) {
-        OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", input_number, param->global->incnt);
+    /* the first input without -i, as before */
+    if(stream_count == 0) {
+        streams[stream_count++].input = 0;
+    }
+    for(i = 0; i < stream_count; i++) {
+        if(!(streams[i].input < pglobal->incnt)) {
+            OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", streams[i].input, param->global->incnt);
+            return 1;
+        }
+    }
+    if(mjpgFileName != NULL && stream_count > 1) {
+        OPRINT("ERROR: an mjpg file holds the frames of one input\n");
+        return 1;
+    }
+    if(strlen(topicPrefix) + 12 > ZMQ_TOPIC_SIZE) {
+        OPRINT("ERROR: the topic is longer than %d characters\n", ZMQ_TOPIC_SIZE - 12);
+        return 1;
+    }
+
+    /* a single input keeps the topic subscribers know, several get one each below it */
+    for(i = 0; i < stream_count; i++) {
+        if(stream_count == 1) {
+            snprintf(streams[i].topic, ZMQ_TOPIC_SIZE, "%s", topicPrefix);
+        } else {
+            snprintf(streams[i].topic, ZMQ_TOPIC_SIZE, "%s/%d", topicPrefix, streams[i].input);
+        }
+    }
+
+    if(zmqBufferSize < 1 || zmqBufferSize > MAX_ZMQ_BUFFER_SIZE) {
+        OPRINT("ERROR: a message holds 1 to %d frames\n", MAX_ZMQ_BUFFER_SIZE);
+        return 1;
+    }
+    if(conflate && multipart) {
+        OPRINT("ERROR: zmq can not conflate the parts of the JPEGs\n");
         return 1;
     }
 
     OPRINT("output folder.....: %s\n", folder);
-    OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
+    for(i = 0; i < stream_count; i++) {
+        OPRINT("input plugin.....: %d: %s, topic %s\n", streams[i].input, pglobal->in[streams[i].input].plugin, streams[i].topic);
+    }
+    OPRINT("frames per message: %d%s\n", zmqBufferSize, multipart ? ", as parts of their own" : "");
+    if(batchTime > 0) {
+        OPRINT("batch time........: %d ms\n", batchTime);
+    }
+    if(highWaterMark >= 0) {
+        OPRINT("high water mark...: %d messages\n", highWaterMark);
+    }
+    if(conflate) {
+        OPRINT("conflate..........: only the latest message waits\n");
+    }
     if  (mjpgFileName == NULL) {
         if(ringbuffer_size > 0) {
             OPRINT("ringbuffer size...: %d to %d\n", ringbuffer_size, ringbuffer_size + ringbuffer_exceed);
@@ -647,35 +909,13 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
 					switch(control_id) {
                             case OUT_FILE_CMD_TAKE: {
                                 if (valueStr != NULL) {
-                                    int frame_size = 0;
-                                    unsigned char *tmp_framebuffer = NULL;
+                                    input_frame *snapshot;
 
-                                    if(pthread_mutex_lock(&pglobal->in[input_number].db)) {
-                                        DBG("Unable to lock mutex\n");
+                                    /* reference the current frame, no copy needed */
+                                    if((snapshot = frame_flatten(input_get_frame(&pglobal->in[streams[0].input]))) == NULL) {
+                                        DBG("No frame available yet\n");
                                         return -1;
                                     }
-                                    /* read buffer */
-                                    frame_size = pglobal->in[input_number].size;
-
-                                    /* check if buffer for frame is large enough, increase it if necessary */
-                                    if(frame_size > max_frame_size) {
-                                        DBG("increasing buffer size to %d\n", frame_size);
-
-                                        max_frame_size = frame_size + (1 << 16);
-                                        if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                                            pthread_mutex_unlock(&pglobal->in[input_number].db);
-                                            LOG("not enough memory\n");
-                                            return -1;
-                                        }
-
-                                        frame = tmp_framebuffer;
-                                    }
-
-                                    /* copy frame to our local buffer now */
-                                    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-
-                                    /* allow others to access the global buffer again */
-                                    pthread_mutex_unlock(&pglobal->in[input_number].db);
 
                                     DBG("writing file: %s\n", valueStr);
 
@@ -683,19 +923,22 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
                                     /* open file for write */
                                     if((fd = open(valueStr, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
                                         OPRINT("could not open the file %s\n", valueStr);
+                                        frame_unref(snapshot);
                                         return -1;
                                     }
 
                                     /* save picture to file */
-                                    //if(write(fileno(stdout), frame, frame_size) < 0) {
-                                    if(fwrite(frame, sizeof(unsigned char), frame_size, stdout) < 0) {
+                                    //if(write(fileno(stdout), snapshot->buf, snapshot->size) < 0) {
+                                    if(fwrite(snapshot->buf, sizeof(unsigned char), snapshot->size, stdout) < 0) {
                                         OPRINT("could not write to file %s\n", valueStr);
                                         perror("fwrite()");
                                         close(fd);
+                                        frame_unref(snapshot);
                                         return -1;
                                     }
 
                                     close(fd);
+                                    frame_unref(snapshot);
                                 } else {
                                     DBG("No filename specified\n");
                                     return -1;
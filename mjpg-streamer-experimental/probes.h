@@ -0,0 +1,60 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT probes on the way of a frame through the program, for tracers like
+ * bpftrace, perf or SystemTap on a running system. Each probe is a nop and
+ * a note in the ELF file, the tracer patches the nop only while attached.
+ * Without <sys/sdt.h> at build time the probes compile away.
+ *
+ * provider mjpg_streamer, every probe gets the input number and the
+ * sequence number of the frame first:
+ *
+ *   capture(input, seq, capture_usec, dequeue_usec)
+ *   encode_start(input, seq)
+ *   encode_end(input, seq, size)
+ *   publish(input, seq, size, publish_usec)
+ *   acquire(input, seq, skipped)
+ *   send_start(input, seq, output, fd)
+ *   send_end(input, seq, output, fd, size)
+ *
+ * Inputs fire the first three with the number their frame is going to get
+ * from input_publish_frame(). Times are monotonic_usec().
+ *
+ * Each probe also records its event into the flight recorder of flight.h,
+ * which costs a few nanoseconds and works without a tracer.
+ */
+#include "flight.h"
+
+#ifdef USDT_PROBES
+#include <sys/sdt.h>
+#define PROBE(name, ...) do { \
+        STAP_PROBEV(mjpg_streamer, name, __VA_ARGS__); \
+        FLIGHT_##name(__VA_ARGS__); \
+    } while(0)
+#else
+#define PROBE(name, ...) FLIGHT_##name(__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,259 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * the frames of the last seconds of an input, kept in memory for an instant
+ * replay
+ *
+ * With --replay input_publish_frame() hands each frame to the ring of its
+ * input, which keeps a reference until the frame is older than the time it
+ * was given. Nothing is copied, the frames are those the clients get live.
+ * Readers take references to the frames they want and send them without
+ * holding the lock, output_http serves them as a stream, as a clip or one
+ * by one by their sequence number. The frames follow each other without a
+ * gap, so frame seq is found at its distance from the oldest one.
+ *
+ * The ring counts as a subscriber of its input, an input which idles
+ * without clients keeps capturing for it. With a memory budget the oldest
+ * frames go first, after the pool, the caches and the pre-event buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "mjpg_streamer.h"
+#include "memory.h"
+#include "utils.h"
+
+struct _replay_ring {
+    pthread_mutex_t lock;
+    unsigned long long usec;        // a frame is kept that long after it was published
+    input_frame **frames;           // frames[head] is the oldest one
+    int head, count, capacity;
+    replay_ring *next;              // of all inputs, under replay_setup
+};
+
+static pthread_mutex_t replay_setup = PTHREAD_MUTEX_INITIALIZER;
+static replay_ring *rings;
+
+static long long replay_evict(void *arg, long long bytes);
+static memory_account replay_memory = MEMORY_ACCOUNT("replay", MEMORY_RING, replay_evict, NULL);
+
+/******************************************************************************
+Description.: take the oldest frame out of a ring, its lock is held
+Input Value.: the ring
+Return Value: the frame with the reference of the ring, NULL if it is empty
+******************************************************************************/
+static input_frame *replay_pop(replay_ring *r)
+{
+    input_frame *frame;
+
+    if(r->count == 0)
+        return NULL;
+
+    frame = r->frames[r->head];
+    r->head = (r->head + 1) % r->capacity;
+    r->count--;
+    memory_add(&replay_memory, -(long long)frame_length(frame));
+    return frame;
+}
+
+/******************************************************************************
+Description.: release the oldest frames of the rings for the memory budget
+Input Value.: * arg..: unused
+              * bytes: to free
+Return Value: bytes freed
+******************************************************************************/
+static long long replay_evict(void *arg, long long bytes)
+{
+    long long freed = 0;
+    input_frame *frame;
+    replay_ring *r;
+
+    pthread_mutex_lock(&replay_setup);
+    for(r = rings; r != NULL && freed < bytes; r = r->next) {
+        pthread_mutex_lock(&r->lock);
+        while(freed < bytes && (frame = replay_pop(r)) != NULL) {
+            freed += frame_length(frame);
+            frame_unref(frame);
+        }
+        pthread_mutex_unlock(&r->lock);
+    }
+    pthread_mutex_unlock(&replay_setup);
+
+    return freed;
+}
+
+/******************************************************************************
+Description.: set up the ring of an input, if --replay was given for it
+Input Value.: the input, its frames are published already or soon
+Return Value: 0 if ok or not wanted, -1 on errors
+******************************************************************************/
+int replay_start(input *in)
+{
+    replay_ring *r;
+
+    if(in->replay_sec <= 0 || in->replay != NULL)
+        return 0;
+
+    if((r = calloc(1, sizeof(replay_ring))) == NULL) {
+        LOG("not enough memory\n");
+        return -1;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    r->usec = in->replay_sec * 1000000ULL;
+
+    pthread_mutex_lock(&replay_setup);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&replay_setup);
+
+    /* the ring wants every frame, also while no client watches */
+    input_subscribe(in);
+    __atomic_store_n(&in->replay, r, __ATOMIC_RELEASE);
+
+    LOG("replay of input %d: the last %d s\n", in->param.id, in->replay_sec);
+    return 0;
+}
+
+/******************************************************************************
+Description.: keep a published frame in the ring of its input, the frames
+              which got too old are released
+Input Value.: * in...: the input
+              * frame: the frame, the ring takes a reference of its own
+Return Value: -
+******************************************************************************/
+void replay_keep(input *in, input_frame *frame)
+{
+    replay_ring *r = __atomic_load_n(&in->replay, __ATOMIC_ACQUIRE);
+    input_frame **frames, *old;
+    int capacity, i;
+
+    if(r == NULL)
+        return;
+
+    pthread_mutex_lock(&r->lock);
+    if(r->count == r->capacity) {
+        capacity = r->capacity ? 2 * r->capacity : 64;
+        if((frames = malloc(capacity * sizeof(input_frame *))) == NULL) {
+            pthread_mutex_unlock(&r->lock);
+            return;
+        }
+        for(i = 0; i < r->count; i++)
+            frames[i] = r->frames[(r->head + i) % r->capacity];
+        free(r->frames);
+        r->frames = frames;
+        r->capacity = capacity;
+        r->head = 0;
+    }
+
+    /* a frame the ring missed would leave a gap, the ring starts over then */
+    if(r->count > 0 && r->frames[(r->head + r->count - 1) % r->capacity]->seq + 1 != frame->seq) {
+        while((old = replay_pop(r)) != NULL)
+            frame_unref(old);
+    }
+
+    r->frames[(r->head + r->count) % r->capacity] = frame_ref(frame);
+    r->count++;
+    memory_add(&replay_memory, frame_length(frame));
+
+    while(r->count > 1 && r->frames[r->head]->publish_usec + r->usec < frame->publish_usec)
+        frame_unref(replay_pop(r));
+    pthread_mutex_unlock(&r->lock);
+}
+
+/******************************************************************************
+Description.: take references to the frames of the last seconds of an input
+Input Value.: * in....: the input
+              * usec..: how far to go back, 0 for all frames of the ring
+              * frames: gets an array of the frames, oldest first, to be
+                        released with free() after frame_unref() of each one
+Return Value: number of frames, 0 if there is none yet, -1 without --replay
+              or memory
+******************************************************************************/
+int replay_get(input *in, unsigned long long usec, input_frame ***frames)
+{
+    replay_ring *r = __atomic_load_n(&in->replay, __ATOMIC_ACQUIRE);
+    unsigned long long newest;
+    int first, count, i;
+
+    *frames = NULL;
+    if(r == NULL)
+        return -1;
+
+    pthread_mutex_lock(&r->lock);
+    if(r->count == 0) {
+        pthread_mutex_unlock(&r->lock);
+        return 0;
+    }
+
+    newest = r->frames[(r->head + r->count - 1) % r->capacity]->publish_usec;
+    for(first = 0; usec > 0 && first < r->count - 1; first++) {
+        if(r->frames[(r->head + first) % r->capacity]->publish_usec + usec >= newest)
+            break;
+    }
+    count = r->count - first;
+
+    if((*frames = malloc(count * sizeof(input_frame *))) == NULL) {
+        pthread_mutex_unlock(&r->lock);
+        LOG("not enough memory\n");
+        return -1;
+    }
+    for(i = 0; i < count; i++)
+        (*frames)[i] = frame_ref(r->frames[(r->head + first + i) % r->capacity]);
+    pthread_mutex_unlock(&r->lock);
+
+    return count;
+}
+
+/******************************************************************************
+Description.: look up a frame of an input by its sequence number, in the ring
+              of --replay or among the last frames every input keeps
+Input Value.: * in.: the input
+              * seq: sequence number of the frame
+Return Value: referenced frame, NULL if it is gone or not there yet
+******************************************************************************/
+input_frame *replay_find(input *in, unsigned long long seq)
+{
+    replay_ring *r = __atomic_load_n(&in->replay, __ATOMIC_ACQUIRE);
+    input_frame *frame = NULL;
+    unsigned long long oldest;
+
+    if(r != NULL) {
+        pthread_mutex_lock(&r->lock);
+        if(r->count > 0) {
+            oldest = r->frames[r->head]->seq;
+            if(seq >= oldest && seq - oldest < (unsigned long long)r->count)
+                frame = frame_ref(r->frames[(r->head + (seq - oldest)) % r->capacity]);
+        }
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    /* the frame following seq - 1, unless it is a later one */
+    if(frame == NULL && seq > 0 && (frame = input_next_frame(in, seq - 1, NULL)) != NULL && frame->seq != seq) {
+        frame_unref(frame);
+        frame = NULL;
+    }
+    return frame;
+}
@@ -0,0 +1,481 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+#include "supervisor.h"
+
+/* a shard which failed within this time waits twice as long before the
+ * next start, up to RESTART_MAX_DELAY */
+#define RESTART_STABLE_USEC (60 * 1000000ULL)
+#define RESTART_MAX_DELAY 60
+
+/* a shard gets the descriptor it reports to shard_ready() with in this */
+#define SHARD_READY_ENV "MJPG_STREAMER_READY"
+
+/* the option -i or -o of a plugin and the options which apply to it */
+typedef struct {
+    char **argv;
+    int argc;
+    int pinned;                 // --cpus was given
+} plugin_args;
+
+typedef struct {
+    const char *name;           // for the messages
+    char **argv;
+    int argc;
+    pid_t pid;                  // 0 while it does not run
+    unsigned long long started; // monotonic_usec() of the last start
+    unsigned long long restart; // when to start it again
+    int delay;                  // seconds to wait before the next start
+    char *prefix;               // of the segments of an input shard
+    int exports;                // number of them
+} shard;
+
+static plugin_args *plugins;
+static int plugin_count;
+
+/* options of the program every shard gets */
+static plugin_args program_args;
+
+/* the executable, the shards show up under its name */
+static char program[PATH_MAX];
+
+/******************************************************************************
+Description.: append an argument
+Input Value.: * argv.: the arguments, they end with NULL
+              * argc.: their number
+              * value: to append, it is copied
+Return Value: -, the program exits without memory
+******************************************************************************/
+static void add_arg(char ***argv, int *argc, const char *value)
+{
+    char **grown;
+
+    if((grown = realloc(*argv, (*argc + 2) * sizeof(char *))) == NULL ||
+       (grown[*argc] = strdup(value)) == NULL) {
+        fprintf(stderr, "not enough memory\n");
+        exit(EXIT_FAILURE);
+    }
+    grown[++*argc] = NULL;
+    *argv = grown;
+}
+
+/******************************************************************************
+Description.: record an input or output given on the command line
+Input Value.: * option: 'i' or 'o'
+              * spec..: the plugin and its parameters
+Return Value: -
+******************************************************************************/
+void shard_plugin(int option, const char *spec)
+{
+    plugin_args *grown;
+
+    if((grown = realloc(plugins, (plugin_count + 1) * sizeof(plugin_args))) == NULL) {
+        fprintf(stderr, "not enough memory\n");
+        exit(EXIT_FAILURE);
+    }
+    plugins = grown;
+    memset(&plugins[plugin_count], 0, sizeof(plugin_args));
+    add_arg(&plugins[plugin_count].argv, &plugins[plugin_count].argc, option == 'i' ? "-i" : "-o");
+    add_arg(&plugins[plugin_count].argv, &plugins[plugin_count].argc, spec);
+    plugin_count++;
+}
+
+/******************************************************************************
+Description.: record an option of the plugin given before it
+Input Value.: * option..: like 'c' for --cpus
+              * argument: its argument
+Return Value: -
+******************************************************************************/
+void shard_option(int option, const char *argument)
+{
+    char name[3] = { '-', option, '\0' };
+    plugin_args *p;
+
+    if(plugin_count == 0)
+        return;
+
+    p = &plugins[plugin_count - 1];
+    add_arg(&p->argv, &p->argc, name);
+    add_arg(&p->argv, &p->argc, argument);
+    if(option == 'c' || option == 'N')
+        p->pinned = 1;
+}
+
+/******************************************************************************
+Description.: record an option which applies to the whole program
+Input Value.: * option..: like 'l' for --log-format
+              * argument: its argument, NULL for an option without one
+Return Value: -
+******************************************************************************/
+void shard_global(int option, const char *argument)
+{
+    char name[3] = { '-', option, '\0' };
+
+    add_arg(&program_args.argv, &program_args.argc, name);
+    if(argument != NULL)
+        add_arg(&program_args.argv, &program_args.argc, argument);
+}
+
+/******************************************************************************
+Description.: tell the supervisor how many inputs this shard exports
+Input Value.: the number of inputs
+Return Value: -
+******************************************************************************/
+void shard_ready(int inputs)
+{
+    char *value = getenv(SHARD_READY_ENV);
+    int fd;
+
+    if(value == NULL)
+        return;
+
+    fd = atoi(value);
+    dprintf(fd, "%d\n", inputs);
+    close(fd);
+    unsetenv(SHARD_READY_ENV);
+}
+
+/******************************************************************************
+Description.: read the cores of the NUMA nodes
+Input Value.: gets the lists, like 0-7, one for each node
+Return Value: number of nodes, 0 if the system does not tell
+******************************************************************************/
+static int numa_nodes(char ***cpus)
+{
+    char path[64], line[1024];
+    int nodes = 0;
+    FILE *f;
+
+    *cpus = NULL;
+    while(1) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes);
+        if((f = fopen(path, "r")) == NULL)
+            break;
+        if(fgets(line, sizeof(line), f) == NULL)
+            line[0] = '\0';
+        fclose(f);
+
+        line[strcspn(line, "\n")] = '\0';
+        if(line[0] == '\0')
+            break;
+        add_arg(cpus, &nodes, line);
+    }
+    return nodes;
+}
+
+/******************************************************************************
+Description.: start a shard, it runs this program again with its options
+Input Value.: * s....: the shard
+              * ready: descriptor it reports with, -1 for none
+Return Value: 0 if it was started, -1 otherwise
+******************************************************************************/
+static int start_shard(shard *s, int ready)
+{
+    sigset_t none;
+    char value[16];
+    pid_t pid;
+
+    if((pid = fork()) < 0) {
+        LOG("could not start %s: %s\n", s->name, strerror(errno));
+        return -1;
+    }
+
+    if(pid == 0) {
+        if(ready >= 0) {
+            snprintf(value, sizeof(value), "%d", ready);
+            setenv(SHARD_READY_ENV, value, 1);
+            fcntl(ready, F_SETFD, 0);
+        }
+
+        /* CTRL+C reaches the supervisor only, it stops the shards */
+        setpgid(0, 0);
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+
+        execv(program, s->argv);
+        fprintf(stderr, "could not run %s: %s\n", s->argv[0], strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+
+    s->pid = pid;
+    s->started = monotonic_usec();
+    LOG("started %s (pid %d)\n", s->name, pid);
+    return 0;
+}
+
+/******************************************************************************
+Description.: note that a shard ended and when to start it again
+Input Value.: * s.....: the shard
+              * status: of waitpid()
+Return Value: -
+******************************************************************************/
+static void shard_ended(shard *s, int status)
+{
+    unsigned long long now = monotonic_usec();
+
+    if(WIFSIGNALED(status)) {
+        LOG("%s (pid %d) was killed by signal %d\n", s->name, s->pid, WTERMSIG(status));
+    } else {
+        LOG("%s (pid %d) exited with %d\n", s->name, s->pid, WEXITSTATUS(status));
+    }
+
+    if(now - s->started >= RESTART_STABLE_USEC || s->delay == 0)
+        s->delay = 1;
+    else
+        s->delay = MIN(2 * s->delay, RESTART_MAX_DELAY);
+
+    LOG("starting %s again in %d s\n", s->name, s->delay);
+    s->pid = 0;
+    s->restart = now + s->delay * 1000000ULL;
+}
+
+/******************************************************************************
+Description.: stop all shards, those which do not end in time are killed,
+              segments of crashed input shards are removed
+Input Value.: * shards: the shards
+              * count.: their number
+Return Value: -
+******************************************************************************/
+static void stop_shards(shard *shards, int count)
+{
+    unsigned long long deadline = monotonic_usec() + 5000000ULL;
+    char name[NAME_MAX];
+    int i, j, running, status;
+
+    for(i = 0; i < count; i++) {
+        if(shards[i].pid > 0)
+            kill(shards[i].pid, SIGINT);
+    }
+
+    do {
+        running = 0;
+        for(i = 0; i < count; i++) {
+            if(shards[i].pid > 0 && waitpid(shards[i].pid, &status, WNOHANG) == 0)
+                running++;
+            else
+                shards[i].pid = 0;
+        }
+        if(running > 0)
+            usleep(100 * 1000);
+    } while(running > 0 && monotonic_usec() < deadline);
+
+    for(i = 0; i < count; i++) {
+        if(shards[i].pid > 0) {
+            LOG("%s does not stop, killing it\n", shards[i].name);
+            kill(shards[i].pid, SIGKILL);
+            waitpid(shards[i].pid, &status, 0);
+        }
+        for(j = 0; j < shards[i].exports; j++) {
+            snprintf(name, sizeof(name), "%s%d", shards[i].prefix, j);
+            shm_unlink(name);
+        }
+    }
+}
+
+/******************************************************************************
+Description.: start the shards and keep them running until SIGINT or SIGTERM
+Input Value.: the name of the program, the shards run it with their options
+Return Value: the exit code of the program
+******************************************************************************/
+int supervise(const char *progname)
+{
+    char **cpus, *names = NULL, *spec, name[NAME_MAX], node[16];
+    unsigned long long now, next;
+    int inputs = 0, nodes, i, j, k, n, status, ready[2], *reports;
+    struct timespec timeout;
+    shard *shards, *s;
+    sigset_t stop;
+    FILE *report;
+    pid_t pid;
+
+    for(i = 0; i < plugin_count; i++) {
+        if(strcmp(plugins[i].argv[0], "-i") == 0)
+            inputs++;
+    }
+
+    if((n = readlink("/proc/self/exe", program, sizeof(program) - 1)) < 0) {
+        LOG("could not find the executable: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    program[n] = '\0';
+
+    /* the shards are started and reaped from here alone */
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    sigaddset(&stop, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &stop, NULL);
+
+    if((shards = calloc(inputs + 1, sizeof(shard))) == NULL ||
+       (reports = calloc(inputs + 1, sizeof(int))) == NULL) {
+        LOG("not enough memory\n");
+        return EXIT_FAILURE;
+    }
+
+    /* an input shard exports its inputs, one after another on the NUMA nodes */
+    nodes = numa_nodes(&cpus);
+    for(i = 0, k = 0; i < plugin_count; i++) {
+        if(strcmp(plugins[i].argv[0], "-i") != 0)
+            continue;
+
+        s = &shards[k];
+        s->name = plugins[i].argv[1];
+        add_arg(&s->argv, &s->argc, progname);
+        for(j = 0; j < program_args.argc; j++)
+            add_arg(&s->argv, &s->argc, program_args.argv[j]);
+        for(j = 0; j < plugins[i].argc; j++)
+            add_arg(&s->argv, &s->argc, plugins[i].argv[j]);
+        if(nodes > 1 && !plugins[i].pinned) {
+            LOG("%s runs on NUMA node %d: cores %s\n", s->name, k % nodes, cpus[k % nodes]);
+            snprintf(node, sizeof(node), "%d", k % nodes);
+            add_arg(&s->argv, &s->argc, "-N");
+            add_arg(&s->argv, &s->argc, node);
+        }
+        if(asprintf(&s->prefix, "/mjpg-streamer-%d-%d-", getpid(), k) < 0 ||
+           asprintf(&spec, "output_shm.so -p %s", s->prefix) < 0) {
+            LOG("not enough memory\n");
+            return EXIT_FAILURE;
+        }
+        add_arg(&s->argv, &s->argc, "-o");
+        add_arg(&s->argv, &s->argc, spec);
+        free(spec);
+        k++;
+    }
+
+    /* they initialize in parallel, the outputs need to know what they export */
+    for(k = 0; k < inputs; k++) {
+        s = &shards[k];
+        if(pipe2(ready, O_CLOEXEC) < 0 || start_shard(s, ready[1]) < 0) {
+            stop_shards(shards, k);
+            return EXIT_FAILURE;
+        }
+        close(ready[1]);
+        reports[k] = ready[0];
+    }
+    for(k = 0; k < inputs; k++) {
+        s = &shards[k];
+        report = fdopen(reports[k], "r");
+        if(report == NULL || fscanf(report, "%d", &n) != 1 || n < 1) {
+            LOG("%s did not start\n", s->name);
+            n = 0;
+        }
+        if(report != NULL)
+            fclose(report);
+        else
+            close(reports[k]);
+        s->exports = n;
+        if(n == 0) {
+            stop_shards(shards, inputs);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* inputs a plugin adds are numbered after the given ones, like without shards */
+    for(j = 0, n = 1; n > 0; j++) {
+        for(k = 0, n = 0; k < inputs; k++) {
+            if(j >= shards[k].exports)
+                continue;
+            snprintf(name, sizeof(name), "%s%s%d", names == NULL ? "" : ",", shards[k].prefix, j);
+            if((spec = realloc(names, (names == NULL ? 0 : strlen(names)) + strlen(name) + 1)) == NULL) {
+                LOG("not enough memory\n");
+                return EXIT_FAILURE;
+            }
+            if(names == NULL)
+                spec[0] = '\0';
+            names = strcat(spec, name);
+            n++;
+        }
+    }
+
+    s = &shards[inputs];
+    s->name = "the outputs";
+    add_arg(&s->argv, &s->argc, progname);
+    for(j = 0; j < program_args.argc; j++)
+        add_arg(&s->argv, &s->argc, program_args.argv[j]);
+    if(names != NULL) {
+        if(asprintf(&spec, "input_shm.so -n %s", names) < 0) {
+            LOG("not enough memory\n");
+            return EXIT_FAILURE;
+        }
+        add_arg(&s->argv, &s->argc, "-i");
+        add_arg(&s->argv, &s->argc, spec);
+        free(spec);
+    }
+    for(i = 0; i < plugin_count; i++) {
+        if(strcmp(plugins[i].argv[0], "-o") != 0)
+            continue;
+        for(j = 0; j < plugins[i].argc; j++)
+            add_arg(&s->argv, &s->argc, plugins[i].argv[j]);
+    }
+    if(start_shard(s, -1) < 0) {
+        stop_shards(shards, inputs);
+        return EXIT_FAILURE;
+    }
+    free(reports);
+    LOG("supervising %d shards\n", inputs + 1);
+
+    while(1) {
+        now = monotonic_usec();
+        next = now + 1000000ULL;
+        for(k = 0; k <= inputs; k++) {
+            if(shards[k].pid == 0 && shards[k].restart < next)
+                next = MAX(shards[k].restart, now);
+        }
+        timeout.tv_sec = (next - now) / 1000000;
+        timeout.tv_nsec = (next - now) % 1000000 * 1000;
+
+        i = sigtimedwait(&stop, NULL, &timeout);
+        if(i == SIGINT || i == SIGTERM)
+            break;
+
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for(k = 0; k <= inputs; k++) {
+                if(shards[k].pid == pid)
+                    shard_ended(&shards[k], status);
+            }
+        }
+
+        now = monotonic_usec();
+        for(k = 0; k <= inputs; k++) {
+            if(shards[k].pid == 0 && shards[k].restart <= now && start_shard(&shards[k], -1) < 0)
+                shards[k].restart = now + RESTART_MAX_DELAY * 1000000ULL;
+        }
+    }
+
+    LOG("stopping the shards\n");
+    stop_shards(shards, inputs + 1);
+    LOG("done\n");
+    return 0;
+}
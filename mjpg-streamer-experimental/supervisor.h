@@ -0,0 +1,43 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+/*
+ * mjpg_streamer --shards runs each input in a process of its own, which
+ * exports its frames with output_shm, and the outputs in one more process,
+ * which reads them with input_shm. The first process only supervises them:
+ * a shard which exits or crashes is started again, the others keep running.
+ */
+
+/* the options of the plugins are recorded while main() parses them */
+void shard_plugin(int option, const char *spec);
+void shard_option(int option, const char *argument);
+void shard_global(int option, const char *argument);
+
+/* run the shards until a signal stops the program, returns the exit code */
+int supervise(const char *progname);
+
+/* called by a shard once its plugins run, with the number of its inputs */
+void shard_ready(int inputs);
+
+#endif
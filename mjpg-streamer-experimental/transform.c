@@ -0,0 +1,365 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * lossless rotations and flips of the frames of an input
+ *
+ * Many cameras ignore V4L2_CID_ROTATE, V4L2_CID_HFLIP and V4L2_CID_VFLIP, so
+ * a camera mounted upside down delivers its pictures upside down. Like
+ * jpegtran, the transformation moves and mirrors the DCT blocks of a frame
+ * instead of decoding it: mirroring a block negates its odd frequencies,
+ * rotating it by 90 degrees transposes it. Nothing is quantized again, so
+ * the picture loses nothing and the cost is a fraction of an encode.
+ *
+ * A block at the right or bottom edge which is only partly inside the
+ * picture can not move to the opposite edge, so an edge that moves is cut
+ * to whole MCUs, like jpegtran -trim does. With 4:2:0 and a height of 1080
+ * the picture of a vertical flip becomes 1072 lines high.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#include <jerror.h>
+#endif
+
+#include "mjpg_streamer.h"
+#include "utils.h"
+
+/*
+ * each transformation as a transposition followed by flips of the
+ * transposed picture, in the order of frame_transform_t
+ */
+static const struct {
+    const char *name;
+    int transpose;
+    int flip_x;
+    int flip_y;
+} transforms[] = {
+    { "none",       0, 0, 0 },
+    { "hflip",      0, 1, 0 },
+    { "vflip",      0, 0, 1 },
+    { "rotate180",  0, 1, 1 },
+    { "transpose",  1, 0, 0 },
+    { "rotate90",   1, 1, 0 },
+    { "rotate270",  1, 0, 1 },
+    { "transverse", 1, 1, 1 },
+};
+
+/******************************************************************************
+Description.: look up a transformation by its name
+Input Value.: name like "rotate180"
+Return Value: the transformation or -1 if the name is unknown or the program
+              was built without libjpeg
+******************************************************************************/
+int transform_parse(const char *name)
+{
+    int i;
+
+    for(i = 0; i < LENGTH_OF(transforms); i++) {
+        if(strcmp(name, transforms[i].name) == 0) {
+            #ifdef NO_LIBJPEG
+            return (i == TRANSFORM_NONE) ? i : -1;
+            #else
+            return i;
+            #endif
+        }
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: name of a transformation
+Input Value.: the transformation
+Return Value: its name
+******************************************************************************/
+const char *transform_name(int transform)
+{
+    if(transform < 0 || transform >= LENGTH_OF(transforms))
+        return "unknown";
+    return transforms[transform].name;
+}
+
+#ifdef NO_LIBJPEG
+
+input_frame *frame_transform(input_frame *frame, int transform)
+{
+    return frame;
+}
+
+#else
+
+/* longjmp target for errors of libjpeg, the default handler would exit */
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} transform_error_mgr;
+
+/* encodes into a growing buffer */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    unsigned char *out;
+    size_t out_size;
+} transform_dest_mgr;
+
+static void transform_error_exit(j_common_ptr cinfo)
+{
+    transform_error_mgr *err = (transform_error_mgr *)cinfo->err;
+
+    #ifdef DEBUG
+    (*cinfo->err->output_message)(cinfo);
+    #endif
+    longjmp(err->setjmp_buffer, 1);
+}
+
+static void dest_init(j_compress_ptr cinfo)
+{
+    transform_dest_mgr *dest = (transform_dest_mgr *)cinfo->dest;
+
+    dest->pub.next_output_byte = dest->out;
+    dest->pub.free_in_buffer = dest->out_size;
+}
+
+static boolean dest_empty(j_compress_ptr cinfo)
+{
+    transform_dest_mgr *dest = (transform_dest_mgr *)cinfo->dest;
+    unsigned char *out;
+
+    /* libjpeg calls this only with a completely full buffer */
+    if((out = realloc(dest->out, dest->out_size * 2)) == NULL)
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+
+    dest->pub.next_output_byte = out + dest->out_size;
+    dest->pub.free_in_buffer = dest->out_size;
+    dest->out = out;
+    dest->out_size *= 2;
+    return TRUE;
+}
+
+static void dest_term(j_compress_ptr cinfo)
+{
+}
+
+/******************************************************************************
+Description.: blocks of a component along one side of the source, the partial
+              MCU at the end is left out if the side gets flipped
+Input Value.: * size: width or height of the picture in pixels
+              * samp: sampling factor of the component along this side
+              * mcu.: pixels of an MCU along this side
+              * trim: leave out a partial MCU
+Return Value: the number of blocks, a multiple of samp
+******************************************************************************/
+static JDIMENSION side_blocks(JDIMENSION size, int samp, JDIMENSION mcu, int trim)
+{
+    return (trim ? size / mcu : (size + mcu - 1) / mcu) * samp;
+}
+
+/******************************************************************************
+Description.: transform the coefficients of one block
+Input Value.: * t..: the transformation
+              * in.: the block of the source
+              * out: the block of the result
+Return Value: -
+******************************************************************************/
+static void transform_block(int t, JCOEF *in, JCOEF *out)
+{
+    int u, v, c;
+
+    for(v = 0; v < DCTSIZE; v++) {
+        for(u = 0; u < DCTSIZE; u++) {
+            c = transforms[t].transpose ? in[u * DCTSIZE + v] : in[v * DCTSIZE + u];
+            /* a mirrored cosine of an odd frequency changes its sign */
+            if((transforms[t].flip_x && (u & 1)) ^ (transforms[t].flip_y && (v & 1)))
+                c = -c;
+            out[v * DCTSIZE + u] = c;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: rotate or flip a frame without decoding it
+Input Value.: * frame....: the frame, the reference is taken over
+              * transform: TRANSFORM_NONE, TRANSFORM_HFLIP, ...
+Return Value: the transformed frame, on errors the frame itself
+******************************************************************************/
+input_frame *frame_transform(input_frame *frame, int transform)
+{
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    transform_error_mgr err;
+    transform_dest_mgr dest;
+    jvirt_barray_ptr *src_coef, dst_coef[MAX_COMPONENTS];
+    JDIMENSION src_w[MAX_COMPONENTS], src_h[MAX_COMPONENTS];
+    JDIMENSION mcu_w, mcu_h, width, height, tw, th, x, y, sx, sy, first;
+    int ci, i, hs, vs, trim_w, trim_h, transpose;
+    jpeg_component_info *comp;
+    JQUANT_TBL *qtbl;
+    input_frame *result = NULL;
+    UINT16 q;
+
+    if(transform <= TRANSFORM_NONE || transform >= LENGTH_OF(transforms))
+        return frame;
+
+    transpose = transforms[transform].transpose;
+    /* the flips happen after the transposition, on the other side of the source */
+    trim_w = transpose ? transforms[transform].flip_y : transforms[transform].flip_x;
+    trim_h = transpose ? transforms[transform].flip_x : transforms[transform].flip_y;
+
+    dest.out_size = frame->size + 1024;
+    if((dest.out = malloc(dest.out_size)) == NULL)
+        return frame;
+
+    /* both share the error handler, a broken frame must not exit the program */
+    dinfo.err = cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = transform_error_exit;
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+    if(setjmp(err.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        free(dest.out);
+        return frame;
+    }
+
+    jpeg_mem_src(&dinfo, frame->buf, frame->size);
+    jpeg_read_header(&dinfo, TRUE);
+
+    mcu_w = dinfo.max_h_samp_factor * DCTSIZE;
+    mcu_h = dinfo.max_v_samp_factor * DCTSIZE;
+    width = trim_w ? dinfo.image_width / mcu_w * mcu_w : dinfo.image_width;
+    height = trim_h ? dinfo.image_height / mcu_h * mcu_h : dinfo.image_height;
+    if(width == 0 || height == 0)
+        ERREXIT(&dinfo, JERR_EMPTY_IMAGE);
+
+    /* the arrays of the result cover whole MCUs, with the sampling transposed */
+    for(ci = 0; ci < dinfo.num_components; ci++) {
+        comp = &dinfo.comp_info[ci];
+        src_w[ci] = side_blocks(dinfo.image_width, comp->h_samp_factor, mcu_w, trim_w);
+        src_h[ci] = side_blocks(dinfo.image_height, comp->v_samp_factor, mcu_h, trim_h);
+        dst_coef[ci] = (*dinfo.mem->request_virt_barray)((j_common_ptr)&dinfo, JPOOL_IMAGE, FALSE,
+                       transpose ? src_h[ci] : src_w[ci], transpose ? src_w[ci] : src_h[ci],
+                       transpose ? comp->h_samp_factor : comp->v_samp_factor);
+    }
+
+    src_coef = jpeg_read_coefficients(&dinfo);
+
+    for(ci = 0; ci < dinfo.num_components; ci++) {
+        comp = &dinfo.comp_info[ci];
+        /* size and sampling of the result, the source rows come in chunks of vs */
+        tw = transpose ? src_h[ci] : src_w[ci];
+        th = transpose ? src_w[ci] : src_h[ci];
+        hs = transpose ? comp->v_samp_factor : comp->h_samp_factor;
+        vs = comp->v_samp_factor;
+
+        for(y = 0; y < th; y += (transpose ? comp->h_samp_factor : vs)) {
+            int rows = transpose ? comp->h_samp_factor : vs;
+            JBLOCKARRAY out = (*dinfo.mem->access_virt_barray)((j_common_ptr)&dinfo, dst_coef[ci], y, rows, TRUE);
+
+            for(x = 0; x < tw; x += hs) {
+                JBLOCKARRAY in;
+
+                /* all blocks of this piece come from one chunk of source rows */
+                first = transpose ? (transforms[transform].flip_x ? tw - x - hs : x) :
+                                    (transforms[transform].flip_y ? th - y - rows : y);
+                in = (*dinfo.mem->access_virt_barray)((j_common_ptr)&dinfo, src_coef[ci], first, vs, FALSE);
+
+                for(i = 0; i < rows * hs; i++) {
+                    JDIMENSION dx = x + i % hs, dy = y + i / hs;
+                    JDIMENSION fx = transforms[transform].flip_x ? tw - 1 - dx : dx;
+                    JDIMENSION fy = transforms[transform].flip_y ? th - 1 - dy : dy;
+
+                    sx = transpose ? fy : fx;
+                    sy = transpose ? fx : fy;
+                    transform_block(transform, in[sy - first][sx], out[dy - y][dx]);
+                }
+            }
+        }
+    }
+
+    /* same tables, the sampling and quantization transposed along with the blocks */
+    jpeg_copy_critical_parameters(&dinfo, &cinfo);
+    cinfo.image_width = transpose ? height : width;
+    cinfo.image_height = transpose ? width : height;
+    if(transpose) {
+        for(ci = 0; ci < cinfo.num_components; ci++) {
+            comp = &cinfo.comp_info[ci];
+            i = comp->h_samp_factor;
+            comp->h_samp_factor = comp->v_samp_factor;
+            comp->v_samp_factor = i;
+        }
+        for(i = 0; i < NUM_QUANT_TBLS; i++) {
+            if((qtbl = cinfo.quant_tbl_ptrs[i]) == NULL)
+                continue;
+            for(y = 0; y < DCTSIZE; y++) {
+                for(x = y + 1; x < DCTSIZE; x++) {
+                    q = qtbl->quantval[y * DCTSIZE + x];
+                    qtbl->quantval[y * DCTSIZE + x] = qtbl->quantval[x * DCTSIZE + y];
+                    qtbl->quantval[x * DCTSIZE + y] = q;
+                }
+            }
+        }
+        q = cinfo.X_density;
+        cinfo.X_density = cinfo.Y_density;
+        cinfo.Y_density = q;
+    }
+
+    dest.pub.init_destination = dest_init;
+    dest.pub.empty_output_buffer = dest_empty;
+    dest.pub.term_destination = dest_term;
+    cinfo.dest = &dest.pub;
+
+    jpeg_write_coefficients(&cinfo, dst_coef);
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+
+    if((result = frame_alloc(dest.out_size - dest.pub.free_in_buffer)) != NULL) {
+        result->size = dest.out_size - dest.pub.free_in_buffer;
+        memcpy(result->buf, dest.out, result->size);
+        result->timestamp = frame->timestamp;
+        result->capture_usec = frame->capture_usec;
+        result->dequeue_usec = frame->dequeue_usec;
+        result->encoded_usec = frame->encoded_usec;
+        result->burst = frame->burst;
+        result->burst_index = frame->burst_index;
+        result->raw = frame_ref(frame->raw);
+    }
+
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    free(dest.out);
+
+    if(result == NULL)
+        return frame;
+
+    frame_unref(frame);
+    return result;
+}
+
+#endif
@@ -31,7 +31,11 @@
 #include <limits.h>
 #include <linux/stat.h>
 #include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <spawn.h>
 
+#include "mjpg_streamer.h"
 #include "utils.h"
 
 /******************************************************************************
@@ -133,6 +137,293 @@ void parse_resolution_opt(const char * optarg, int * width, int * height) {
     }
 }
 
+/******************************************************************************
+Description.: sleep until a time of the monotonic clock, also when signals
+              interrupt the sleep
+Input Value.: deadline in microseconds of monotonic_usec()
+Return Value: -
+******************************************************************************/
+void sleep_until_usec(unsigned long long deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000;
+    ts.tv_nsec = (deadline % 1000000) * 1000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/******************************************************************************
+Description.: start pacing a loop, the first frame is due right away
+Input Value.: * p..: the pacer
+              * fps: frames per second, 0 or less to not wait at all
+              * in.: input to report the rates to, may be NULL
+Return Value: -
+******************************************************************************/
+void pacer_init(pacer *p, double fps, struct _input *in)
+{
+    p->fps = (fps > 0) ? fps : 0;
+    p->in = in;
+    p->start_usec = p->window_usec = monotonic_usec();
+    p->n = 0;
+    p->window_frames = 0;
+
+    if(in != NULL)
+        in->stats.target_fps = p->fps;
+}
+
+/******************************************************************************
+Description.: wait for the deadline of the next frame. The deadlines are
+              counted from the start, so they do not drift. A loop more
+              than one frame behind starts a new schedule instead of
+              catching up with a burst of frames.
+Input Value.: the pacer
+Return Value: 1 if the deadline had passed already, 0 otherwise
+******************************************************************************/
+int pacer_wait(pacer *p)
+{
+    unsigned long long now = monotonic_usec(), deadline;
+    int late = 0;
+
+    if(p->fps > 0) {
+        p->n++;
+        deadline = p->start_usec + (unsigned long long)(p->n * 1000000.0 / p->fps);
+
+        if(deadline + 1000000.0 / p->fps < now) {
+            p->start_usec = now;
+            p->n = 0;
+            late = 1;
+            if(p->in != NULL)
+                __sync_fetch_and_add(&p->in->stats.pacing_late, 1);
+        } else if(deadline > now) {
+            sleep_until_usec(deadline);
+            now = deadline;
+        }
+    }
+
+    /* the rate reached, measured once a second */
+    p->window_frames++;
+    if(now - p->window_usec >= 1000000) {
+        if(p->in != NULL)
+            p->in->stats.paced_fps = p->window_frames * 1000000.0 / (now - p->window_usec);
+        p->window_usec = now;
+        p->window_frames = 0;
+    }
+
+    return late;
+}
+
+struct _command_queue {
+    char *command;
+    char **files;                   // waiting files, a circular array
+    int head, count, depth;
+    int coalesce;                   // ms between two runs, 0 runs every file
+    unsigned long long refused;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t update;
+};
+
+extern char **environ;
+
+/******************************************************************************
+Description.: run the command for a file and wait for it, the file is passed
+              as argument and as environment variable MJPG_FILE
+Input Value.: * command: the command
+              * file...: the file
+Return Value: -
+******************************************************************************/
+static void run_command(const char *command, const char *file)
+{
+    char *line, *variable, **env;
+    char *argv[] = { "sh", "-c", NULL, NULL };
+    int i, n, rc, status;
+    pid_t pid;
+
+    for(n = 0; environ[n] != NULL; n++);
+    line = malloc(strlen(command) + strlen(file) + 4);
+    variable = malloc(strlen(file) + 10);
+    env = malloc((n + 2) * sizeof(char *));
+    if(line == NULL || variable == NULL || env == NULL) {
+        LOG("could not run the command for %s\n", file);
+        free(line);
+        free(variable);
+        free(env);
+        return;
+    }
+
+    sprintf(line, "%s \"%s\"", command, file);
+    sprintf(variable, "MJPG_FILE=%s", file);
+    argv[2] = line;
+
+    /* the environment of the process with MJPG_FILE replaced */
+    for(i = 0, n = 0; environ[i] != NULL; i++) {
+        if(strncmp(environ[i], "MJPG_FILE=", 10) != 0)
+            env[n++] = environ[i];
+    }
+    env[n++] = variable;
+    env[n] = NULL;
+
+    DBG("calling command %s\n", line);
+    if((rc = posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, env)) != 0) {
+        LOG("could not run the command (%s)\n", strerror(rc));
+    } else {
+        while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+        if(status != 0) {
+            LOG("command failed (return value %d)\n", status);
+        }
+    }
+
+    free(line);
+    free(variable);
+    free(env);
+}
+
+/******************************************************************************
+Description.: the helper thread of a command queue
+Input Value.: the queue
+Return Value: NULL
+******************************************************************************/
+static void *command_thread(void *arg)
+{
+    command_queue *q = arg;
+    unsigned long long last = 0;
+    char *file;
+
+    pthread_mutex_lock(&q->mutex);
+    while(!q->stop) {
+        if(q->count == 0) {
+            pthread_cond_wait(&q->update, &q->mutex);
+            continue;
+        }
+
+        /* files coming in meanwhile replace the waiting one */
+        if(q->coalesce > 0 && last != 0 && monotonic_usec() < last + q->coalesce * 1000ULL) {
+            pthread_mutex_unlock(&q->mutex);
+            sleep_until_usec(last + q->coalesce * 1000ULL);
+            pthread_mutex_lock(&q->mutex);
+            continue;
+        }
+
+        file = q->files[q->head];
+        q->head = (q->head + 1) % q->depth;
+        q->count--;
+        pthread_mutex_unlock(&q->mutex);
+
+        last = monotonic_usec();
+        run_command(q->command, file);
+        free(file);
+
+        pthread_mutex_lock(&q->mutex);
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: start the helper thread running a command for files
+Input Value.: * command.: the command, the name of a file gets appended
+              * depth...: files which may wait at most
+              * coalesce: ms between two runs with the latest file, 0 to run
+                          the command for every file
+Return Value: the queue, NULL on error
+******************************************************************************/
+command_queue *command_queue_new(const char *command, int depth, int coalesce)
+{
+    command_queue *q;
+
+    if((q = calloc(1, sizeof(command_queue))) == NULL)
+        return NULL;
+
+    /* only the latest file waits while coalescing */
+    q->depth = (coalesce > 0) ? 1 : MAX(depth, 1);
+    q->coalesce = coalesce;
+    q->command = strdup(command);
+    q->files = calloc(q->depth, sizeof(char *));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->update, NULL);
+
+    if(q->command == NULL || q->files == NULL ||
+       pthread_create(&q->thread, NULL, command_thread, q) != 0) {
+        pthread_mutex_destroy(&q->mutex);
+        pthread_cond_destroy(&q->update);
+        free(q->command);
+        free(q->files);
+        free(q);
+        return NULL;
+    }
+
+    return q;
+}
+
+/******************************************************************************
+Description.: hand over a file to the command, without waiting
+Input Value.: * q...: the queue
+              * file: the name of the file
+Return Value: 0 if ok, -1 if the queue is full and the file was refused
+******************************************************************************/
+int command_queue_push(command_queue *q, const char *file)
+{
+    char *name;
+    int rc = 0;
+
+    if((name = strdup(file)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&q->mutex);
+    if(q->coalesce > 0 && q->count > 0) {
+        free(q->files[q->head]);
+        q->files[q->head] = name;
+    } else if(q->count < q->depth) {
+        q->files[(q->head + q->count) % q->depth] = name;
+        q->count++;
+    } else {
+        free(name);
+        rc = -1;
+
+        /* reported once for each power of two, a slow command would flood
+         * the log otherwise */
+        q->refused++;
+        if((q->refused & (q->refused - 1)) == 0) {
+            LOG("the command is too slow, %llu files were skipped\n", q->refused);
+        }
+    }
+    pthread_cond_signal(&q->update);
+    pthread_mutex_unlock(&q->mutex);
+
+    return rc;
+}
+
+/******************************************************************************
+Description.: stop the helper thread, a command running is waited for, the
+              files still waiting are dropped
+Input Value.: the queue, may be NULL
+Return Value: -
+******************************************************************************/
+void command_queue_free(command_queue *q)
+{
+    if(q == NULL)
+        return;
+
+    pthread_mutex_lock(&q->mutex);
+    q->stop = 1;
+    pthread_cond_signal(&q->update);
+    pthread_mutex_unlock(&q->mutex);
+    pthread_join(q->thread, NULL);
+
+    while(q->count > 0) {
+        free(q->files[q->head]);
+        q->head = (q->head + 1) % q->depth;
+        q->count--;
+    }
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->update);
+    free(q->command);
+    free(q->files);
+    free(q);
+}
+
 void resolutions_help(const char * padding) {
     int i;
     for(i = 0; i < LENGTH_OF(resolutions); i++) {
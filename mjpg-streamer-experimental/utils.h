@@ -130,3 +130,41 @@ void daemon_mode(void);
 void resolutions_help(const char * padding);
 void parse_resolution_opt(const char * optarg, int * width, int * height);
 
+/******************************************************************************
+ Frame pacing
+
+ Keeps a loop at a fixed, also fractional, rate like 29.97 fps by sleeping
+ until absolute deadlines of the monotonic clock, so the time spent on a
+ frame does not add up. The rate reached is reported in the stats of the
+ input, like the target.
+******************************************************************************/
+struct _input;
+
+typedef struct _pacer {
+    double fps;                         // target, 0 for no pacing
+    struct _input *in;                  // gets the rates, may be NULL
+    unsigned long long start_usec;      // deadline of frame 0
+    unsigned long long n;               // frames since then
+    unsigned long long window_usec;     // start of the current measurement
+    unsigned long long window_frames;
+} pacer;
+
+void sleep_until_usec(unsigned long long deadline);
+void pacer_init(pacer *p, double fps, struct _input *in);
+int pacer_wait(pacer *p);
+
+/******************************************************************************
+ Command queue
+
+ Runs a command with the name of a file as argument, like system() would,
+ from a helper thread with posix_spawn(), so the thread handing over the
+ files does not wait for the fork and the command. At most "depth" files
+ wait, further ones are refused. With "coalesce" the command runs at most
+ once per that many ms, with the latest file.
+******************************************************************************/
+typedef struct _command_queue command_queue;
+
+command_queue *command_queue_new(const char *command, int depth, int coalesce);
+int command_queue_push(command_queue *q, const char *file);
+void command_queue_free(command_queue *q);
+